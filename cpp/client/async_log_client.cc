@@ -1,14 +1,19 @@
 #include "client/async_log_client.h"
 
 #include <algorithm>
+#include <event2/buffer.h>
 #include <event2/http.h>
 #include <glog/logging.h>
 #include <iterator>
 #include <memory>
+#include <string.h>
+#include <utility>
 
 #include "log/cert.h"
 #include "proto/serializer.h"
+#include "util/gzip.h"
 #include "util/json_wrapper.h"
+#include "util/util.h"
 
 using cert_trans::AsyncLogClient;
 using cert_trans::Cert;
@@ -17,11 +22,13 @@ using cert_trans::PreCertChain;
 using cert_trans::URL;
 using cert_trans::UrlFetcher;
 using ct::DigitallySigned;
+using ct::LoggedCertificatePB;
 using ct::MerkleAuditProof;
 using ct::SignedCertificateTimestamp;
 using ct::SignedTreeHead;
 using std::back_inserter;
 using std::bind;
+using std::make_pair;
 using std::move;
 using std::placeholders::_1;
 using std::string;
@@ -56,40 +63,28 @@ bool SanityCheck(UrlFetcher::Response* resp,
 }
 
 
-void DoneGetSTH(UrlFetcher::Response* resp, SignedTreeHead* sth,
-                const AsyncLogClient::Callback& done, util::Task* task) {
-  unique_ptr<UrlFetcher::Response> resp_deleter(CHECK_NOTNULL(resp));
-  unique_ptr<util::Task> task_deleter(CHECK_NOTNULL(task));
-
-  LOG_IF(INFO, !task->status().ok()) << "DoneGetSTH: " << task->status();
-
-  if (!SanityCheck(resp, done, task)) {
-    return;
-  }
-
-  JsonObject jresponse(resp->body);
-  if (!jresponse.Ok())
-    return done(AsyncLogClient::BAD_RESPONSE);
-
+// Parses the members of a get-sth reply (which are also in get-snapshot
+// replies) into |sth|.
+bool ParseSTH(const JsonObject& jresponse, SignedTreeHead* sth) {
   JsonInt tree_size(jresponse, "tree_size");
   if (!tree_size.Ok() || tree_size.Value() < 0)
-    return done(AsyncLogClient::BAD_RESPONSE);
+    return false;
 
   JsonInt timestamp(jresponse, "timestamp");
   if (!timestamp.Ok() || timestamp.Value() < 0)
-    return done(AsyncLogClient::BAD_RESPONSE);
+    return false;
 
   JsonString root_hash(jresponse, "sha256_root_hash");
   if (!root_hash.Ok())
-    return done(AsyncLogClient::BAD_RESPONSE);
+    return false;
 
   JsonString jsignature(jresponse, "tree_head_signature");
   if (!jsignature.Ok())
-    return done(AsyncLogClient::BAD_RESPONSE);
+    return false;
   DigitallySigned signature;
   if (Deserializer::DeserializeDigitallySigned(jsignature.FromBase64(),
                                                &signature) != Deserializer::OK)
-    return done(AsyncLogClient::BAD_RESPONSE);
+    return false;
 
   sth->Clear();
   sth->set_version(ct::V1);
@@ -98,6 +93,60 @@ void DoneGetSTH(UrlFetcher::Response* resp, SignedTreeHead* sth,
   sth->set_sha256_root_hash(root_hash.FromBase64());
   sth->mutable_signature()->CopyFrom(signature);
 
+  return true;
+}
+
+
+void DoneGetSTH(UrlFetcher::Response* resp, SignedTreeHead* sth,
+                const AsyncLogClient::Callback& done, util::Task* task) {
+  unique_ptr<UrlFetcher::Response> resp_deleter(CHECK_NOTNULL(resp));
+  unique_ptr<util::Task> task_deleter(CHECK_NOTNULL(task));
+
+  LOG_IF(INFO, !task->status().ok()) << "DoneGetSTH: " << task->status();
+
+  if (!SanityCheck(resp, done, task)) {
+    return;
+  }
+
+  JsonObject jresponse(resp->body);
+  if (!jresponse.Ok() || !ParseSTH(jresponse, sth))
+    return done(AsyncLogClient::BAD_RESPONSE);
+
+  return done(AsyncLogClient::OK);
+}
+
+
+void DoneGetSnapshot(UrlFetcher::Response* resp, SignedTreeHead* sth,
+                     vector<string>* entries,
+                     const AsyncLogClient::Callback& done, util::Task* task) {
+  unique_ptr<UrlFetcher::Response> resp_deleter(CHECK_NOTNULL(resp));
+  unique_ptr<util::Task> task_deleter(CHECK_NOTNULL(task));
+
+  if (!SanityCheck(resp, done, task)) {
+    return;
+  }
+
+  JsonObject jresponse(resp->body);
+  if (!jresponse.Ok() || !ParseSTH(jresponse, sth))
+    return done(AsyncLogClient::BAD_RESPONSE);
+
+  JsonArray jentries(jresponse, "entries");
+  if (!jentries.Ok())
+    return done(AsyncLogClient::BAD_RESPONSE);
+
+  vector<string> new_entries;
+  new_entries.reserve(jentries.Length());
+  for (int i = 0; i < jentries.Length(); ++i) {
+    JsonString entry(jentries, i);
+    if (!entry.Ok())
+      return done(AsyncLogClient::BAD_RESPONSE);
+
+    new_entries.push_back(entry.FromBase64());
+  }
+
+  entries->reserve(entries->size() + new_entries.size());
+  move(new_entries.begin(), new_entries.end(), back_inserter(*entries));
+
   return done(AsyncLogClient::OK);
 }
 
@@ -140,6 +189,137 @@ void DoneGetRoots(UrlFetcher::Response* resp, vector<unique_ptr<Cert>>* roots,
 }
 
 
+const size_t kBinaryEntryLengthBytes = 4;
+
+
+// Fills |log_entry| with what get-entries would have for |logged|.
+bool EntryFromLogged(const LoggedCertificatePB& logged,
+                     AsyncLogClient::Entry* log_entry) {
+  const ct::LogEntry& entry(logged.contents().entry());
+  const SignedCertificateTimestamp& sct(logged.contents().sct());
+
+  log_entry->leaf.set_version(ct::V1);
+  log_entry->leaf.set_type(ct::TIMESTAMPED_ENTRY);
+  ct::TimestampedEntry* const timestamped(
+      log_entry->leaf.mutable_timestamped_entry());
+  timestamped->set_timestamp(sct.timestamp());
+  timestamped->set_entry_type(entry.type());
+  timestamped->set_extensions(sct.extensions());
+  switch (entry.type()) {
+    case ct::X509_ENTRY:
+      timestamped->mutable_signed_entry()->set_x509(
+          entry.x509_entry().leaf_certificate());
+      break;
+    case ct::PRECERT_ENTRY:
+      timestamped->mutable_signed_entry()->mutable_precert()->CopyFrom(
+          entry.precert_entry().pre_cert());
+      break;
+    default:
+      return false;
+  }
+
+  log_entry->entry.CopyFrom(entry);
+  log_entry->sct.reset(new SignedCertificateTimestamp(sct));
+  return true;
+}
+
+
+// Parses a get-entries reply of kBinaryEntriesContentType.
+void DoneGetBinaryEntries(const UrlFetcher::Response& resp,
+                          vector<AsyncLogClient::Entry>* entries,
+                          const AsyncLogClient::Callback& done) {
+  const auto encoding(resp.headers.find("Content-Encoding"));
+  const bool gzipped(encoding != resp.headers.end() &&
+                     encoding->second == "gzip");
+  string gunzipped;
+  if (gzipped && !util::Gunzip(resp.body, &gunzipped)) {
+    return done(AsyncLogClient::BAD_RESPONSE);
+  }
+  const string& body(gzipped ? gunzipped : resp.body);
+
+  vector<AsyncLogClient::Entry> new_entries;
+  size_t pos(0);
+  while (pos < body.size()) {
+    if (body.size() - pos < kBinaryEntryLengthBytes) {
+      return done(AsyncLogClient::BAD_RESPONSE);
+    }
+    size_t length(0);
+    for (size_t i = 0; i < kBinaryEntryLengthBytes; ++i) {
+      length = (length << 8) | static_cast<unsigned char>(body[pos++]);
+    }
+    LoggedCertificatePB logged;
+    AsyncLogClient::Entry log_entry;
+    if (body.size() - pos < length ||
+        !logged.ParseFromArray(body.data() + pos, length) ||
+        !EntryFromLogged(logged, &log_entry)) {
+      return done(AsyncLogClient::BAD_RESPONSE);
+    }
+    pos += length;
+    new_entries.emplace_back(move(log_entry));
+  }
+
+  entries->reserve(entries->size() + new_entries.size());
+  move(new_entries.begin(), new_entries.end(), back_inserter(*entries));
+
+  return done(AsyncLogClient::OK);
+}
+
+
+// The body of |resp|, wherever the fetcher left it. A body left in
+// |body_buffer| is made contiguous in place, rather than copied out.
+const char* BodyData(UrlFetcher::Response* resp) {
+  if (resp->body_buffer) {
+    return reinterpret_cast<const char*>(
+        evbuffer_pullup(resp->body_buffer.get(), -1));
+  }
+  return resp->body.data();
+}
+
+
+size_t BodyLength(const UrlFetcher::Response* resp) {
+  return resp->body_buffer ? evbuffer_get_length(resp->body_buffer.get())
+                           : resp->body.size();
+}
+
+
+// Fills |log_entry| from the decoded fields of a JSON get-entries
+// reply. |sct| is optional.
+bool EntryFromJsonFields(const string& leaf_input, const string& extra_data,
+                         const string* sct, AsyncLogClient::Entry* log_entry) {
+  if (Deserializer::DeserializeMerkleTreeLeaf(leaf_input, &log_entry->leaf) !=
+      Deserializer::OK) {
+    return false;
+  }
+
+  // This is an optional non-standard extension, used only by the log
+  // internally when running in clustered mode.
+  if (sct) {
+    unique_ptr<SignedCertificateTimestamp> parsed_sct(
+        new SignedCertificateTimestamp);
+    if (Deserializer::DeserializeSCT(*sct, parsed_sct.get()) !=
+        Deserializer::OK) {
+      return false;
+    }
+    log_entry->sct.reset(parsed_sct.release());
+  }
+
+  if (log_entry->leaf.timestamped_entry().entry_type() == ct::X509_ENTRY) {
+    Deserializer::DeserializeX509Chain(extra_data,
+                                       log_entry->entry.mutable_x509_entry());
+  } else if (log_entry->leaf.timestamped_entry().entry_type() ==
+             ct::PRECERT_ENTRY) {
+    Deserializer::DeserializePrecertChainEntry(
+        extra_data, log_entry->entry.mutable_precert_entry());
+  } else {
+    LOG(WARNING) << "Don't understand entry type: "
+                 << log_entry->leaf.timestamped_entry().entry_type();
+    return false;
+  }
+
+  return true;
+}
+
+
 void DoneGetEntries(UrlFetcher::Response* resp,
                     vector<AsyncLogClient::Entry>* entries,
                     const AsyncLogClient::Callback& done, util::Task* task) {
@@ -150,70 +330,46 @@ void DoneGetEntries(UrlFetcher::Response* resp,
     return;
   }
 
-  JsonObject jresponse(resp->body);
-  if (!jresponse.Ok())
-    return done(AsyncLogClient::BAD_RESPONSE);
+  const auto content_type(resp->headers.find("Content-Type"));
+  if (content_type != resp->headers.end() &&
+      content_type->second == cert_trans::kBinaryEntriesContentType) {
+    FlattenBody(resp);
+    return DoneGetBinaryEntries(*resp, entries, done);
+  }
 
-  JsonArray jentries(jresponse, "entries");
-  if (!jentries.Ok())
+  AsyncLogClient::RawEntries raw_entries;
+  if (!raw_entries.AppendJson(BodyData(resp), BodyLength(resp))) {
     return done(AsyncLogClient::BAD_RESPONSE);
+  }
 
-  vector<AsyncLogClient::Entry> new_entries;
-  new_entries.reserve(jentries.Length());
-
-  for (int n = 0; n < jentries.Length(); ++n) {
-    JsonObject entry(jentries, n);
-    if (!entry.Ok()) {
-      return done(AsyncLogClient::BAD_RESPONSE);
-    }
-
-    JsonString leaf_input(entry, "leaf_input");
-    if (!leaf_input.Ok()) {
+  vector<AsyncLogClient::Entry> new_entries(raw_entries.size());
+  for (size_t i = 0; i < raw_entries.size(); ++i) {
+    if (!raw_entries.Parse(i, &new_entries[i])) {
       return done(AsyncLogClient::BAD_RESPONSE);
     }
+  }
 
-    AsyncLogClient::Entry log_entry;
-    if (Deserializer::DeserializeMerkleTreeLeaf(leaf_input.FromBase64(),
-                                                &log_entry.leaf) !=
-        Deserializer::OK) {
-      return done(AsyncLogClient::BAD_RESPONSE);
-    }
+  entries->reserve(entries->size() + new_entries.size());
+  move(new_entries.begin(), new_entries.end(), back_inserter(*entries));
 
-    JsonString extra_data(entry, "extra_data");
-    if (!extra_data.Ok()) {
-      return done(AsyncLogClient::BAD_RESPONSE);
-    }
+  return done(AsyncLogClient::OK);
+}
 
-    // This is an optional non-standard extension, used only by the log
-    // internally when running in clustered mode.
-    JsonString sct_data(entry, "sct");
-    if (sct_data.Ok()) {
-      unique_ptr<SignedCertificateTimestamp> sct(
-          new SignedCertificateTimestamp);
-      if (Deserializer::DeserializeSCT(sct_data.FromBase64(), sct.get()) !=
-          Deserializer::OK) {
-        return done(AsyncLogClient::BAD_RESPONSE);
-      }
-      log_entry.sct.reset(sct.release());
-    }
 
-    if (log_entry.leaf.timestamped_entry().entry_type() == ct::X509_ENTRY) {
-      Deserializer::DeserializeX509Chain(extra_data.FromBase64(),
-                                         log_entry.entry.mutable_x509_entry());
-    } else if (log_entry.leaf.timestamped_entry().entry_type() ==
-               ct::PRECERT_ENTRY) {
-      Deserializer::DeserializePrecertChainEntry(
-          extra_data.FromBase64(), log_entry.entry.mutable_precert_entry());
-    } else {
-      LOG(FATAL) << "Don't understand entry type: "
-                 << log_entry.leaf.timestamped_entry().entry_type();
-    }
+void DoneGetRawEntries(UrlFetcher::Response* resp,
+                       AsyncLogClient::RawEntries* entries,
+                       const AsyncLogClient::Callback& done,
+                       util::Task* task) {
+  unique_ptr<UrlFetcher::Response> resp_deleter(CHECK_NOTNULL(resp));
+  unique_ptr<util::Task> task_deleter(CHECK_NOTNULL(task));
 
-    new_entries.emplace_back(move(log_entry));
+  if (!SanityCheck(resp, done, task)) {
+    return;
   }
 
-  entries->reserve(entries->size() + new_entries.size());
-  move(new_entries.begin(), new_entries.end(), back_inserter(*entries));
+  if (!entries->AppendJson(BodyData(resp), BodyLength(resp))) {
+    return done(AsyncLogClient::BAD_RESPONSE);
+  }
 
   return done(AsyncLogClient::OK);
 }
@@ -369,6 +525,267 @@ URL NormalizeURL(const string& server_url) {
 namespace cert_trans {
 
 
+const char kBinaryEntriesContentType[] = "application/x-ct-logged-certificates";
+
+
+// Scans a get-entries reply, decoding the fields of each entry straight
+// into the RawEntries buffer. Members it has no use for are skipped over
+// without being decoded.
+class AsyncLogClient::RawEntries::Scanner {
+ public:
+  Scanner(const char* json, size_t length, RawEntries* batch)
+      : pos_(json), end_(json + length), depth_(0), batch_(batch) {
+  }
+
+  bool Scan() {
+    return ScanObject([this](const char* key, size_t key_length) {
+      return IsKey(key, key_length, "entries") ? ScanEntries() : SkipValue();
+    }) && AtEnd();
+  }
+
+ private:
+  // Deeper than any get-entries reply, so that a hostile one can't run
+  // us out of stack.
+  static const int kMaxDepth = 32;
+
+  static bool IsKey(const char* key, size_t key_length, const char* name) {
+    return key_length == strlen(name) && memcmp(key, name, key_length) == 0;
+  }
+
+  void SkipSpace() {
+    while (pos_ < end_ &&
+           (*pos_ == ' ' || *pos_ == '\t' || *pos_ == '\n' || *pos_ == '\r')) {
+      ++pos_;
+    }
+  }
+
+  bool AtEnd() {
+    SkipSpace();
+    return pos_ == end_;
+  }
+
+  bool Consume(char c) {
+    SkipSpace();
+    if (pos_ < end_ && *pos_ == c) {
+      ++pos_;
+      return true;
+    }
+    return false;
+  }
+
+  // Sets |start| and |length| to the contents of the string at the
+  // current position, still escaped. |escaped| is set if there are
+  // escape sequences in it.
+  bool ScanString(const char** start, size_t* length, bool* escaped) {
+    if (!Consume('"')) {
+      return false;
+    }
+    *start = pos_;
+    *escaped = false;
+    while (pos_ < end_) {
+      if (*pos_ == '"') {
+        *length = pos_ - *start;
+        ++pos_;
+        return true;
+      }
+      if (*pos_ == '\\') {
+        *escaped = true;
+        ++pos_;
+      }
+      ++pos_;
+    }
+    return false;
+  }
+
+  // Calls |member| with the key of each member of the object at the
+  // current position, positioned on its value, which it must consume.
+  template <class Member>
+  bool ScanObject(const Member& member) {
+    if (++depth_ > kMaxDepth || !Consume('{')) {
+      return false;
+    }
+    if (!Consume('}')) {
+      do {
+        const char* key;
+        size_t key_length;
+        bool escaped;
+        if (!ScanString(&key, &key_length, &escaped) || !Consume(':') ||
+            !member(key, key_length)) {
+          return false;
+        }
+      } while (Consume(','));
+      if (!Consume('}')) {
+        return false;
+      }
+    }
+    --depth_;
+    return true;
+  }
+
+  // Likewise, calling |element| on each element of an array.
+  template <class Element>
+  bool ScanArray(const Element& element) {
+    if (++depth_ > kMaxDepth || !Consume('[')) {
+      return false;
+    }
+    if (!Consume(']')) {
+      do {
+        if (!element()) {
+          return false;
+        }
+      } while (Consume(','));
+      if (!Consume(']')) {
+        return false;
+      }
+    }
+    --depth_;
+    return true;
+  }
+
+  bool SkipValue() {
+    SkipSpace();
+    if (pos_ == end_) {
+      return false;
+    }
+    switch (*pos_) {
+      case '"': {
+        const char* start;
+        size_t length;
+        bool escaped;
+        return ScanString(&start, &length, &escaped);
+      }
+      case '{':
+        return ScanObject(
+            [this](const char*, size_t) { return SkipValue(); });
+      case '[':
+        return ScanArray([this]() { return SkipValue(); });
+      default: {
+        // A number, true, false or null.
+        const char* const start(pos_);
+        while (pos_ < end_ && (isalnum(static_cast<unsigned char>(*pos_)) ||
+                               *pos_ == '-' || *pos_ == '+' || *pos_ == '.')) {
+          ++pos_;
+        }
+        return pos_ != start;
+      }
+    }
+  }
+
+  // Decodes the base 64 string at the current position onto the end of
+  // the batch's buffer.
+  bool ScanBase64(Field* field) {
+    const char* start;
+    size_t length;
+    bool escaped;
+    if (!ScanString(&start, &length, &escaped)) {
+      return false;
+    }
+    field->offset = batch_->data_.size();
+    if (escaped) {
+      // Some encoders escape "/", the only escape base 64 can have.
+      string unescaped;
+      unescaped.reserve(length);
+      for (size_t i = 0; i < length; ++i) {
+        if (start[i] == '\\' && (++i == length || start[i] != '/')) {
+          return false;
+        }
+        unescaped.push_back(start[i]);
+      }
+      if (!util::FromBase64(unescaped.data(), unescaped.size(),
+                            &batch_->data_)) {
+        return false;
+      }
+    } else if (!util::FromBase64(start, length, &batch_->data_)) {
+      return false;
+    }
+    field->length = batch_->data_.size() - field->offset;
+    return true;
+  }
+
+  bool ScanEntry() {
+    RawEntry entry;
+    entry.has_sct = false;
+    bool has_leaf_input(false);
+    bool has_extra_data(false);
+    if (!ScanObject([&](const char* key, size_t key_length) {
+          if (IsKey(key, key_length, "leaf_input")) {
+            has_leaf_input = true;
+            return ScanBase64(&entry.leaf_input);
+          }
+          if (IsKey(key, key_length, "extra_data")) {
+            has_extra_data = true;
+            return ScanBase64(&entry.extra_data);
+          }
+          if (IsKey(key, key_length, "sct")) {
+            entry.has_sct = true;
+            return ScanBase64(&entry.sct);
+          }
+          return SkipValue();
+        }) ||
+        !has_leaf_input || !has_extra_data) {
+      return false;
+    }
+    batch_->entries_.push_back(entry);
+    return true;
+  }
+
+  bool ScanEntries() {
+    return ScanArray([this]() { return ScanEntry(); });
+  }
+
+  const char* pos_;
+  const char* const end_;
+  int depth_;
+  RawEntries* const batch_;
+
+  DISALLOW_COPY_AND_ASSIGN(Scanner);
+};
+
+
+void AsyncLogClient::RawEntries::clear() {
+  data_.clear();
+  entries_.clear();
+}
+
+
+bool AsyncLogClient::RawEntries::AppendJson(const char* json, size_t length) {
+  const size_t old_data_size(data_.size());
+  const size_t old_size(entries_.size());
+  // Decoding can only make the reply smaller.
+  data_.reserve(old_data_size + length / 4 * 3);
+
+  if (!Scanner(json, length, this).Scan()) {
+    data_.resize(old_data_size);
+    entries_.resize(old_size);
+    return false;
+  }
+
+  return true;
+}
+
+
+string AsyncLogClient::RawEntries::LeafInput(size_t i) const {
+  CHECK_LT(i, entries_.size());
+  return Get(entries_[i].leaf_input);
+}
+
+
+string AsyncLogClient::RawEntries::ExtraData(size_t i) const {
+  CHECK_LT(i, entries_.size());
+  return Get(entries_[i].extra_data);
+}
+
+
+bool AsyncLogClient::RawEntries::Parse(size_t i, Entry* entry) const {
+  CHECK_LT(i, entries_.size());
+  CHECK_NOTNULL(entry);
+  const RawEntry& raw(entries_[i]);
+  const string sct(raw.has_sct ? Get(raw.sct) : string());
+  return EntryFromJsonFields(Get(raw.leaf_input), Get(raw.extra_data),
+                             raw.has_sct ? &sct : nullptr, entry);
+}
+
+
 AsyncLogClient::AsyncLogClient(util::Executor* const executor,
                                UrlFetcher* fetcher, const string& server_url)
     : executor_(CHECK_NOTNULL(executor)),
@@ -422,17 +839,64 @@ void AsyncLogClient::InternalGetEntries(int first, int last,
     return;
   }
 
-  URL url(GetURL("get-entries"));
-  url.SetQuery("start=" + to_string(first) + "&end=" + to_string(last) +
-               (request_scts ? "&include_scts=true" : ""));
+  UrlFetcher::Request req(GetURL("get-entries"));
+  req.url.SetQuery("start=" + to_string(first) + "&end=" + to_string(last) +
+                   (request_scts ? "&include_scts=true" : ""));
+  req.body_as_buffer = true;
+  if (request_scts) {
+    // Only other nodes of the cluster ask for these, and the logs
+    // that don't have the binary format reply with JSON anyway.
+    req.headers.insert(make_pair(
+        "Accept",
+        string(kBinaryEntriesContentType) + ", application/json;q=0.5"));
+    req.headers.insert(make_pair("Accept-Encoding", "gzip"));
+  }
 
   UrlFetcher::Response* const resp(new UrlFetcher::Response);
-  fetcher_->Fetch(url, resp,
+  fetcher_->Fetch(req, resp,
                   new util::Task(bind(DoneGetEntries, resp, entries, done, _1),
                                  executor_));
 }
 
 
+void AsyncLogClient::GetRawEntries(int first, int last, RawEntries* entries,
+                                   const Callback& done) {
+  CHECK_GE(first, 0);
+  CHECK_GE(last, 0);
+  CHECK_NOTNULL(entries);
+
+  if (last < first) {
+    done(INVALID_INPUT);
+    return;
+  }
+
+  UrlFetcher::Request req(GetURL("get-entries"));
+  req.url.SetQuery("start=" + to_string(first) + "&end=" + to_string(last));
+  req.body_as_buffer = true;
+
+  UrlFetcher::Response* const resp(new UrlFetcher::Response);
+  fetcher_->Fetch(req, resp, new util::Task(bind(DoneGetRawEntries, resp,
+                                                 entries, done, _1),
+                                            executor_));
+}
+
+
+void AsyncLogClient::GetSnapshot(int64_t start, SignedTreeHead* sth,
+                                 vector<string>* entries,
+                                 const Callback& done) {
+  CHECK_GE(start, 0);
+
+  URL url(GetURL("get-snapshot"));
+  url.SetQuery("start=" + to_string(start));
+
+  UrlFetcher::Response* const resp(new UrlFetcher::Response);
+  fetcher_->Fetch(url, resp,
+                  new util::Task(bind(DoneGetSnapshot, resp, sth, entries,
+                                      done, _1),
+                                 executor_));
+}
+
+
 void AsyncLogClient::QueryInclusionProof(const SignedTreeHead& sth,
                                          const std::string& merkle_leaf_hash,
                                          MerkleAuditProof* proof,
@@ -23,6 +23,13 @@ class CertChain;
 class PreCertChain;
 
 
+// The media type of the get-entries replies in which each entry is a
+// LoggedCertificatePB, preceded by its length in 4 bytes. This is
+// NON-standard, and only sent by SuperDuper logs to the clients that
+// accept it, as it is much cheaper to encode and decode than JSON.
+extern const char kBinaryEntriesContentType[];
+
+
 class AsyncLogClient {
  public:
   enum Status {
@@ -41,6 +48,61 @@ class AsyncLogClient {
     std::unique_ptr<ct::SignedCertificateTimestamp> sct;
   };
 
+  // A batch of entries as the log sent them. The decoded fields of all
+  // the entries are kept in a single buffer, and only parsed into an
+  // Entry when asked for.
+  class RawEntries {
+   public:
+    RawEntries() = default;
+
+    size_t size() const {
+      return entries_.size();
+    }
+
+    void clear();
+
+    // Appends the entries of a JSON get-entries reply, without building
+    // a DOM of it. Returns false, leaving the batch as it was, if it is
+    // malformed.
+    bool AppendJson(const char* json, size_t length);
+
+    // The serialized MerkleTreeLeaf of entry |i|, which its leaf hash is
+    // computed from.
+    std::string LeafInput(size_t i) const;
+
+    // The extra_data of entry |i|, still serialized.
+    std::string ExtraData(size_t i) const;
+
+    // Returns false if entry |i| doesn't parse.
+    bool Parse(size_t i, Entry* entry) const;
+
+   private:
+    class Scanner;
+
+    // A decoded field, as a range of |data_|.
+    struct Field {
+      size_t offset;
+      size_t length;
+    };
+
+    struct RawEntry {
+      Field leaf_input;
+      Field extra_data;
+      // Only for the logs which sent the non-standard "sct".
+      bool has_sct;
+      Field sct;
+    };
+
+    std::string Get(const Field& field) const {
+      return data_.substr(field.offset, field.length);
+    }
+
+    std::string data_;
+    std::vector<RawEntry> entries_;
+
+    DISALLOW_COPY_AND_ASSIGN(RawEntries);
+  };
+
   typedef std::function<void(Status)> Callback;
 
   // The "executor" will be used to run callbacks.
@@ -62,13 +124,30 @@ class AsyncLogClient {
   void GetEntries(int first, int last, std::vector<Entry>* entries,
                   const Callback& done);
 
+  // Like GetEntries(), but leaves the entries unparsed, which is much
+  // cheaper for callers that only need some of them, or only their
+  // leaf hashes. This does not clear "entries" before appending the
+  // retrieved entries.
+  void GetRawEntries(int first, int last, RawEntries* entries,
+                     const Callback& done);
+
   // This is NON-standard, and only works with SuperDuper logs.
   // It's intended for internal use when running in a clustered configuration.
+  // The entries are asked for in the kBinaryEntriesContentType format
+  // (gzipped), falling back to JSON with logs that don't have it.
   // This does not clear "entries" before appending the retrieved
   // entries.
   void GetEntriesAndSCTs(int first, int last, std::vector<Entry>* entries,
                          const Callback& done);
 
+  // This is NON-standard, and only works with SuperDuper logs. It is
+  // meant for bootstrapping new nodes: "sth" is set to the tree head
+  // of the log, and the entries from "start" that it covers (up to
+  // some limit) are appended to "entries", each as serialized in the
+  // database.
+  void GetSnapshot(int64_t start, ct::SignedTreeHead* sth,
+                   std::vector<std::string>* entries, const Callback& done);
+
   void QueryInclusionProof(const ct::SignedTreeHead& sth,
                            const std::string& merkle_leaf_hash,
                            ct::MerkleAuditProof* proof, const Callback& done);
@@ -1,11 +1,18 @@
 /* -*- indent-tabs-mode: nil -*- */
+#include <chrono>
+#include <condition_variable>
+#include <errno.h>
 #include <event2/thread.h>
 #include <fcntl.h>
 #include <fstream>
+#include <functional>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <iomanip>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <openssl/asn1.h>
 #include <openssl/bio.h>
 #include <openssl/bn.h>
@@ -18,9 +25,12 @@
 #include <sstream>
 #include <stdio.h>
 #include <string>
+#include <unistd.h>
 
+#include "base/macros.h"
 #include "client/http_log_client.h"
 #include "client/ssl_client.h"
+#include "client/ssl_scanner.h"
 #include "log/cert.h"
 #include "log/cert_submission_handler.h"
 #include "log/ct_extensions.h"
@@ -30,12 +40,17 @@
 #include "merkletree/merkle_verifier.h"
 #include "merkletree/serial_hasher.h"
 #include "monitor/database.h"
+#include "monitor/leveldb_db.h"
 #include "monitor/monitor.h"
+#include "monitor/multi_monitor.h"
 #include "monitor/sqlite_db.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
 #include "util/init.h"
+#include "util/parallel_for.h"
 #include "util/read_key.h"
+#include "util/libevent_wrapper.h"
+#include "util/thread_pool.h"
 
 DEFINE_string(ssl_client_trusted_cert_dir, "",
               "Trusted root certificates for the ssl client");
@@ -79,6 +94,43 @@ DEFINE_string(certificate_chain_in, "",
 DEFINE_string(sct_in, "", "SCT to wrap");
 DEFINE_int32(get_first, 0, "First entry to retrieve with the 'get' command");
 DEFINE_int32(get_last, 0, "Last entry to retrieve with the 'get' command");
+DEFINE_int32(get_entries_batch_size, 1000,
+             "Number of entries to ask for in each request with the 'get' "
+             "command");
+DEFINE_int32(max_inflight_log_requests, 4,
+             "Maximum number of requests to the log server outstanding at "
+             "once");
+DEFINE_string(audit_batch_in, "",
+              "File of SSLClientCTData records to audit with the "
+              "'audit_batch' command, each preceded by its length in 4 bytes "
+              "(big-endian)");
+DEFINE_int32(audit_batch_size, 10000,
+             "Number of records from --audit_batch_in audited at once");
+DEFINE_string(ssl_scan_servers, "",
+              "File of SSL servers to connect to with the 'ssl_scan' "
+              "command, one <address>:<port> per line");
+DEFINE_string(ssl_scan_out, "",
+              "File to write the SSLClientCTData of each server with SCTs "
+              "to with the 'ssl_scan' command, in the format of "
+              "--audit_batch_in");
+DEFINE_int32(ssl_scan_concurrency, 256,
+             "Number of handshakes in progress at once with the 'ssl_scan' "
+             "command");
+DEFINE_int32(ssl_scan_timeout_secs, 10,
+             "Seconds to wait for each step of a connection with the "
+             "'ssl_scan' command");
+DEFINE_int32(ssl_scan_verify_batch_size, 100,
+             "Number of servers whose SCTs are verified together with the "
+             "'ssl_scan' command");
+DEFINE_string(export_dir, "",
+              "Directory to write segment files to with the "
+              "'export_entries' command");
+DEFINE_int32(export_entries_per_segment, 100000,
+             "Number of entries in each segment file written by the "
+             "'export_entries' command");
+DEFINE_int32(export_writers, 4,
+             "Number of threads writing segment files with the "
+             "'export_entries' command");
 DEFINE_string(certificate_base, "",
               "Base name for retrieved certificates - "
               "files will be <base><entry>.<cert>.der");
@@ -92,7 +144,18 @@ DEFINE_string(
     "confirm_tree - build merkletree (latest STH in db OR a given timestamp)\n"
     "init - initiate monitor (i.e. database) prior to its first run\n"
     "loop - start the monitor in a loop (default)");
-DEFINE_string(sqlite_db, "", "Database for certificate and tree storage");
+DEFINE_string(sqlite_db, "",
+              "Database for certificate and tree storage, of "
+              "--monitor_db_type");
+DEFINE_string(monitor_db_type, "sqlite",
+              "Type of the monitor databases, \"sqlite\" or \"leveldb\"");
+DEFINE_string(monitor_logs, "",
+              "File listing the logs to watch with the 'monitor_logs' "
+              "command, one per line as \"<name> <log URL> <public key file> "
+              "<database>\"");
+DEFINE_int32(monitor_threads, 4,
+             "Number of logs polled at the same time by the 'monitor_logs' "
+             "command");
 DEFINE_uint64(timestamp, 0,
               "The timestamp to be used in the monitor actions "
               "verify_sth and confirm_tree.");
@@ -107,7 +170,9 @@ static const char kUsage[] =
     " <command> ...\n"
     "Known commands:\n"
     "connect - connect to an SSL server\n"
+    "ssl_scan - connect to many SSL servers at once and collect their SCTs\n"
     "upload - upload a submission to a CT log server\n"
+    "audit_batch - audit the SCTs of many connections at once\n"
     "certificate - make a superfluous proof certificate\n"
     "extension_data - convert an audit proof to TLS extension format\n"
     "configure_proof - write the proof in an X509v3 configuration file\n"
@@ -118,9 +183,11 @@ static const char kUsage[] =
     "                them as if they were retrieved via 'connect'\n"
     "get_roots - get roots from the log\n"
     "get_entries - get entries from the log\n"
+    "export_entries - get entries from the log into segment files\n"
     "sth - get the current STH from the log\n"
     "consistency - get and check consistency of two STHs\n"
     "monitor - use the monitor (see monitor_action flag)\n"
+    "monitor_logs - monitor several logs at once (see monitor_logs flag)\n"
     "Use --help to display command-line flag options\n";
 
 using cert_trans::AsyncLogClient;
@@ -130,13 +197,24 @@ using cert_trans::HTTPLogClient;
 using cert_trans::PreCertChain;
 using cert_trans::ReadPublicKey;
 using cert_trans::TbsCertificate;
+using cert_trans::ThreadPool;
 using ct::LogEntry;
 using ct::MerkleAuditProof;
 using ct::SSLClientCTData;
 using ct::SignedCertificateTimestamp;
 using ct::SignedCertificateTimestampList;
+using std::bind;
+using std::condition_variable;
+using std::lock_guard;
+using std::make_shared;
+using std::map;
+using std::min;
+using std::mutex;
+using std::placeholders::_1;
+using std::placeholders::_2;
 using std::shared_ptr;
 using std::string;
+using std::unique_lock;
 using std::unique_ptr;
 using std::vector;
 using util::StatusOr;
@@ -151,10 +229,8 @@ static string SCTToList(const string& serialized_sct) {
   return result;
 }
 
-static LogVerifier* GetLogVerifierFromFlags() {
-  CHECK(!FLAGS_ct_server_public_key.empty());
-
-  StatusOr<EVP_PKEY*> pkey(ReadPublicKey(FLAGS_ct_server_public_key));
+static LogVerifier* GetLogVerifier(const string& public_key_file) {
+  StatusOr<EVP_PKEY*> pkey(ReadPublicKey(public_key_file));
   CHECK(pkey.ok()) << "could not read CT server public key file: "
                    << pkey.status();
 
@@ -162,6 +238,11 @@ static LogVerifier* GetLogVerifierFromFlags() {
                          new MerkleVerifier(new Sha256Hasher()));
 }
 
+static LogVerifier* GetLogVerifierFromFlags() {
+  CHECK(!FLAGS_ct_server_public_key.empty());
+  return GetLogVerifier(FLAGS_ct_server_public_key);
+}
+
 // Adds the data to the cert as an extension, formatted as a single
 // ASN.1 octet string.
 static void AddOctetExtension(X509* cert, int nid, const unsigned char* data,
@@ -325,7 +406,7 @@ static int Upload() {
   LOG(INFO) << submission_file << " is " << contents.length() << " bytes.";
 
   SignedCertificateTimestamp sct;
-  HTTPLogClient client(FLAGS_ct_server);
+  HTTPLogClient client(FLAGS_ct_server, FLAGS_max_inflight_log_requests);
   AsyncLogClient::Status ret =
       client.UploadSubmission(contents, FLAGS_precert, &sct);
 
@@ -631,7 +712,7 @@ static AuditResult Audit() {
     }
 
     MerkleAuditProof proof;
-    HTTPLogClient client(FLAGS_ct_server);
+    HTTPLogClient client(FLAGS_ct_server, FLAGS_max_inflight_log_requests);
 
     LOG(INFO) << "info = " << ct_data.attached_sct_info(i).DebugString();
     AsyncLogClient::Status ret =
@@ -668,8 +749,280 @@ static AuditResult Audit() {
   return audit_result;
 }
 
+// Reads the next record of a file of length-prefixed records. Returns
+// false at the end of the file.
+static bool ReadRecord(std::istream* in, string* record) {
+  char length_bytes[4];
+  if (!in->read(length_bytes, sizeof(length_bytes))) {
+    CHECK_EQ(in->gcount(), 0) << "Truncated record length";
+    return false;
+  }
+  size_t length(0);
+  for (size_t i = 0; i < sizeof(length_bytes); ++i) {
+    length = (length << 8) | static_cast<unsigned char>(length_bytes[i]);
+  }
+  record->resize(length);
+  CHECK(in->read(&(*record)[0], length)) << "Truncated record";
+  return true;
+}
+
+static void WriteRecord(const string& record, std::ostream* out) {
+  char length_bytes[4];
+  size_t length(record.size());
+  CHECK_LE(length, 0xffffffffU);
+  for (int i = sizeof(length_bytes) - 1; i >= 0; --i) {
+    length_bytes[i] = length & 0xff;
+    length >>= 8;
+  }
+  CHECK(out->write(length_bytes, sizeof(length_bytes)));
+  CHECK(out->write(record.data(), record.size()));
+}
+
+// One SCT of a record being audited by AuditBatch().
+struct AuditedSCT {
+  AuditedSCT(int record_number, const SSLClientCTData* record, int sct)
+      : record_number(record_number),
+        record(record),
+        sct(sct),
+        result(LogVerifier::VERIFY_OK) {
+  }
+
+  const SignedCertificateTimestamp& Get() const {
+    return record->attached_sct_info(sct).sct();
+  }
+
+  const int record_number;
+  const SSLClientCTData* const record;
+  // The index of the SCT in the record.
+  const int sct;
+  string leaf_hash;
+  LogVerifier::VerifyResult result;
+};
+
+// The outcome of auditing a leaf, shared by all the SCTs for it.
+enum LeafAuditResult {
+  LEAF_VERIFIED,
+  LEAF_PROOF_NOT_FOUND,
+  LEAF_PROOF_INVALID,
+};
+
+// Like Audit(), for every record of --audit_batch_in. Records are read
+// --audit_batch_size at a time: their SCT signatures are verified in
+// parallel, then an inclusion proof is fetched for each leaf not seen
+// before, with up to --max_inflight_log_requests outstanding, and
+// those are verified together with MerkleVerifier::VerifyPaths(). All
+// the proofs are against the same STH, whose signature is only checked
+// once.
+static AuditResult AuditBatch() {
+  std::ifstream in(FLAGS_audit_batch_in.c_str(), std::ios::binary);
+  PCHECK(in.good()) << "Could not open " << FLAGS_audit_batch_in;
+  CHECK_GT(FLAGS_audit_batch_size, 0);
+
+  const unique_ptr<LogVerifier> verifier(GetLogVerifierFromFlags());
+  const string key_id(verifier->KeyID());
+  MerkleVerifier merkle_verifier(new Sha256Hasher);
+  HTTPLogClient client(FLAGS_ct_server, FLAGS_max_inflight_log_requests);
+  ThreadPool pool;
+
+  ct::SignedTreeHead sth;
+  const AsyncLogClient::Status sth_status(client.GetSTH(&sth));
+  if (sth_status == AsyncLogClient::CONNECT_FAILED) {
+    LOG(ERROR) << "Unable to connect";
+    return CT_SERVER_UNAVAILABLE;
+  }
+  CHECK_EQ(sth_status, AsyncLogClient::OK);
+  CHECK_EQ(verifier->VerifySignedTreeHead(sth), LogVerifier::VERIFY_OK)
+      << "Invalid STH from the log";
+
+  map<string, LeafAuditResult> audited_leaves;
+  int num_records(0);
+  int num_skipped(0);
+  int num_verified(0);
+  int num_failed(0);
+
+  string serialized;
+  bool more(true);
+  while (more) {
+    vector<SSLClientCTData> records;
+    while (records.size() < static_cast<size_t>(FLAGS_audit_batch_size) &&
+           (more = ReadRecord(&in, &serialized))) {
+      records.emplace_back();
+      CHECK(records.back().ParseFromString(serialized))
+          << "Failed to parse record " << num_records + records.size();
+    }
+
+    vector<AuditedSCT> scts;
+    for (size_t r = 0; r < records.size(); ++r) {
+      for (int i = 0; i < records[r].attached_sct_info_size(); ++i) {
+        if (records[r].attached_sct_info(i).sct().id().key_id() != key_id) {
+          ++num_skipped;
+          continue;
+        }
+        scts.emplace_back(num_records + r, &records[r], i);
+      }
+    }
+    num_records += records.size();
+
+    util::ParallelFor(
+        scts.size(), pool.NumThreads(), &pool, [&verifier, &scts](size_t i) {
+          AuditedSCT* const sct(&scts[i]);
+          sct->result = verifier->VerifySignedCertificateTimestamp(
+              sct->record->reconstructed_entry(), sct->Get(),
+              &sct->leaf_hash);
+        });
+
+    // One proof for each new leaf, verified with the first of its SCTs.
+    struct ProofQuery {
+      const AuditedSCT* sct;
+      MerkleAuditProof proof;
+      unique_ptr<HTTPLogClient::Request> request;
+      LeafAuditResult result;
+    };
+    vector<ProofQuery> queries;
+    for (const auto& sct : scts) {
+      if (sct.result == LogVerifier::VERIFY_OK &&
+          audited_leaves.insert(make_pair(sct.leaf_hash, LEAF_VERIFIED))
+              .second) {
+        queries.emplace_back();
+        queries.back().sct = &sct;
+      }
+    }
+    // Starting a request blocks while too many are outstanding, so the
+    // requests are started first, and all waited for afterwards.
+    for (auto& query : queries) {
+      query.request = client.StartQueryInclusionProof(
+          sth, query.sct->leaf_hash, &query.proof);
+    }
+    for (auto& query : queries) {
+      const AsyncLogClient::Status status(query.request->Wait());
+      if (status == AsyncLogClient::CONNECT_FAILED) {
+        LOG(ERROR) << "Unable to connect";
+        return CT_SERVER_UNAVAILABLE;
+      }
+      query.result =
+          status == AsyncLogClient::OK ? LEAF_VERIFIED : LEAF_PROOF_NOT_FOUND;
+    }
+
+    // The STH was verified once, so the paths only need to lead to its
+    // root, and are walked together.
+    vector<MerkleVerifier::LeafPath> paths;
+    vector<ProofQuery*> path_queries;
+    for (auto& query : queries) {
+      if (query.result != LEAF_VERIFIED) {
+        continue;
+      }
+      if (query.sct->Get().timestamp() > sth.timestamp()) {
+        query.result = LEAF_PROOF_INVALID;
+        continue;
+      }
+      paths.emplace_back();
+      // Leaf indexing in the MerkleTree starts from 1.
+      paths.back().leaf = query.proof.leaf_index() + 1;
+      paths.back().leaf_hash = query.sct->leaf_hash;
+      paths.back().path.assign(query.proof.path_node().begin(),
+                               query.proof.path_node().end());
+      path_queries.push_back(&query);
+    }
+    const vector<bool> paths_ok(merkle_verifier.VerifyPaths(
+        sth.tree_size(), sth.sha256_root_hash(), paths, &pool));
+    for (size_t i = 0; i < path_queries.size(); ++i) {
+      if (!paths_ok[i]) {
+        path_queries[i]->result = LEAF_PROOF_INVALID;
+      }
+    }
+    for (const auto& query : queries) {
+      audited_leaves[query.sct->leaf_hash] = query.result;
+    }
+
+    for (const auto& sct : scts) {
+      string failure;
+      if (sct.result != LogVerifier::VERIFY_OK) {
+        failure = LogVerifier::VerifyResultString(sct.result);
+      } else {
+        switch (audited_leaves[sct.leaf_hash]) {
+          case LEAF_VERIFIED:
+            ++num_verified;
+            continue;
+          case LEAF_PROOF_NOT_FOUND:
+            failure = "No inclusion proof.";
+            break;
+          case LEAF_PROOF_INVALID:
+            failure = "Retrieved Merkle proof is invalid.";
+            break;
+        }
+      }
+      ++num_failed;
+      LOG(WARNING) << "Record " << sct.record_number << ", SCT " << sct.sct
+                   << ": " << failure;
+    }
+  }
+
+  LOG(INFO) << num_records << " records: " << num_verified
+            << " SCTs verified, " << num_failed << " failed, " << num_skipped
+            << " from other logs skipped.";
+  return num_failed == 0 && num_verified > 0 ? PROOF_OK : PROOF_NOT_FOUND;
+}
+
+// Return values upon completion
+//  0: every server sent at least one valid SCT
+//  1: some didn't, or couldn't be reached
+static int ScanServers() {
+  std::ifstream servers_in(FLAGS_ssl_scan_servers.c_str());
+  PCHECK(servers_in.good()) << "Could not open " << FLAGS_ssl_scan_servers;
+  vector<cert_trans::SSLScanner::Server> servers;
+  string line;
+  while (std::getline(servers_in, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    const size_t colon(line.rfind(':'));
+    CHECK_NE(colon, string::npos) << "Expected <address>:<port>: " << line;
+    servers.push_back({line.substr(0, colon),
+                       static_cast<uint16_t>(atoi(line.c_str() + colon + 1))});
+  }
+
+  std::ofstream records_out;
+  if (!FLAGS_ssl_scan_out.empty()) {
+    records_out.open(FLAGS_ssl_scan_out.c_str(),
+                     std::ios::out | std::ios::binary);
+    PCHECK(records_out.good()) << "Could not open " << FLAGS_ssl_scan_out;
+  }
+
+  const shared_ptr<cert_trans::libevent::Base> base(
+      make_shared<cert_trans::libevent::Base>());
+  cert_trans::libevent::EventPumpThread pump(base);
+  ThreadPool verify_pool;
+  cert_trans::SSLScanner scanner(
+      base.get(), FLAGS_ssl_client_trusted_cert_dir,
+      GetLogVerifierFromFlags(), &verify_pool, FLAGS_ssl_scan_concurrency,
+      FLAGS_ssl_scan_verify_batch_size,
+      std::chrono::seconds(FLAGS_ssl_scan_timeout_secs));
+
+  map<SSLClient::HandshakeResult, int> handshakes;
+  int num_with_scts(0);
+  scanner.Scan(servers, [&](const cert_trans::SSLScanner::Result& result) {
+    ++handshakes[result.handshake];
+    if (result.ct_data.attached_sct_info_size() == 0) {
+      return;
+    }
+    ++num_with_scts;
+    if (records_out.is_open()) {
+      string serialized;
+      CHECK(result.ct_data.SerializeToString(&serialized));
+      WriteRecord(serialized, &records_out);
+    }
+  });
+
+  LOG(INFO) << servers.size() << " servers: " << handshakes[SSLClient::OK]
+            << " handshakes completed, "
+            << handshakes[SSLClient::HANDSHAKE_FAILED] << " failed, "
+            << handshakes[SSLClient::SERVER_UNAVAILABLE]
+            << " unavailable; " << num_with_scts << " with valid SCTs.";
+  return static_cast<size_t>(num_with_scts) == servers.size() ? 0 : 1;
+}
+
 static int CheckConsistency() {
-  HTTPLogClient client(FLAGS_ct_server);
+  HTTPLogClient client(FLAGS_ct_server, FLAGS_max_inflight_log_requests);
   LogVerifier* verifier = GetLogVerifierFromFlags();
 
   string sth1_str;
@@ -850,20 +1203,11 @@ static void WriteCertificate(const std::string& cert, int entry,
   out << cert;
 }
 
-void GetEntries() {
-  CHECK_NE(FLAGS_ct_server, "");
-  HTTPLogClient client(FLAGS_ct_server);
-  std::vector<AsyncLogClient::Entry> entries;
-  AsyncLogClient::Status error =
-      client.GetEntries(FLAGS_get_first, FLAGS_get_last, &entries);
-  CHECK_EQ(error, AsyncLogClient::OK);
-
-  CHECK(!FLAGS_certificate_base.empty());
-
-  int e = FLAGS_get_first;
+void WriteEntries(int first, vector<AsyncLogClient::Entry>* entries) {
+  int e = first;
   for (std::vector<AsyncLogClient::Entry>::const_iterator
-           entry = entries.begin();
-       entry != entries.end(); ++entry, ++e) {
+           entry = entries->begin();
+       entry != entries->end(); ++entry, ++e) {
     if (entry->leaf.timestamped_entry().entry_type() == ct::X509_ENTRY) {
       WriteCertificate(entry->leaf.timestamped_entry().signed_entry().x509(),
                        e, 0, "x509");
@@ -886,8 +1230,182 @@ void GetEntries() {
   }
 }
 
+void GetEntries() {
+  CHECK_NE(FLAGS_ct_server, "");
+  CHECK(!FLAGS_certificate_base.empty());
+  HTTPLogClient client(FLAGS_ct_server, FLAGS_max_inflight_log_requests);
+  // Each batch is written out while the following ones are fetched.
+  AsyncLogClient::Status error =
+      client.GetEntriesPipelined(FLAGS_get_first, FLAGS_get_last,
+                                 FLAGS_get_entries_batch_size, &WriteEntries);
+  CHECK_EQ(error, AsyncLogClient::OK);
+}
+
+// Writes entries to append-only segment files of
+// --export_entries_per_segment entries each, named after the index of
+// their first entry. Each record is the leaf_input and then the
+// extra_data of an entry, both preceded by their length in 4 bytes
+// (big-endian). The segments are sharded over --export_writers threads,
+// and each is only synced once, when it is complete.
+class SegmentExporter {
+ public:
+  SegmentExporter(const string& dir, int entries_per_segment,
+                  int num_writers)
+      : dir_(dir),
+        entries_per_segment_(entries_per_segment),
+        pending_bytes_(0) {
+    CHECK_GT(entries_per_segment_, 0);
+    CHECK_GT(num_writers, 0);
+    for (int i = 0; i < num_writers; ++i) {
+      writers_.emplace_back(new Writer);
+    }
+  }
+
+  // Syncs and closes the segments left incomplete, once everything has
+  // been written.
+  ~SegmentExporter() {
+    for (const auto& writer : writers_) {
+      writer->pool.Add(bind(&SegmentExporter::CloseAll, writer.get()));
+    }
+    // Each pool waits for its closures as it goes away.
+    writers_.clear();
+  }
+
+  // Queues the records of |entries|, which start with entry |first|.
+  // Blocks while too much is already waiting to be written.
+  void Add(int first, AsyncLogClient::RawEntries* entries) {
+    size_t i(0);
+    while (i < entries->size()) {
+      const int index(first + i);
+      const int segment(index - index % entries_per_segment_);
+      const int segment_end(segment + entries_per_segment_);
+      const size_t end(
+          min(entries->size(), i + static_cast<size_t>(segment_end - index)));
+
+      const shared_ptr<string> records(make_shared<string>());
+      for (; i < end; ++i) {
+        AppendRecord(entries->LeafInput(i), records.get());
+        AppendRecord(entries->ExtraData(i), records.get());
+      }
+
+      {
+        unique_lock<mutex> lock(lock_);
+        room_.wait(lock, [this]() {
+          return pending_bytes_ < kMaxPendingBytes;
+        });
+        pending_bytes_ += records->size();
+      }
+      Writer* const writer(
+          writers_[(segment / entries_per_segment_) % writers_.size()].get());
+      writer->pool.Add(bind(&SegmentExporter::Write, this, writer, segment,
+                            records, first + i == segment_end));
+    }
+  }
+
+ private:
+  // A single thread, so that the records of each segment are written
+  // in order, and the segments it has open.
+  struct Writer {
+    Writer() : pool(1) {
+    }
+
+    // Only used on |pool|'s thread.
+    map<int, int> fds;
+    // Declared last, so that it is done before |fds| goes away.
+    ThreadPool pool;
+  };
+
+  static const size_t kMaxPendingBytes = 64 << 20;
+
+  static void AppendRecord(const string& data, string* records) {
+    CHECK_LE(data.size(), 0xffffffffUL);
+    for (int shift = 24; shift >= 0; shift -= 8) {
+      records->push_back(static_cast<char>(data.size() >> shift));
+    }
+    records->append(data);
+  }
+
+  static void CloseSegment(int fd) {
+    PCHECK(fsync(fd) == 0) << "Could not sync segment";
+    PCHECK(close(fd) == 0) << "Could not close segment";
+  }
+
+  static void CloseAll(Writer* writer) {
+    for (const auto& fd : writer->fds) {
+      CloseSegment(fd.second);
+    }
+    writer->fds.clear();
+  }
+
+  string SegmentName(int segment) const {
+    std::ostringstream name;
+    name << dir_ << "/entries-" << std::setfill('0') << std::setw(10)
+         << segment;
+    return name.str();
+  }
+
+  void Write(Writer* writer, int segment, const shared_ptr<string>& records,
+             bool complete) {
+    auto it(writer->fds.find(segment));
+    if (it == writer->fds.end()) {
+      const string name(SegmentName(segment));
+      const int fd(open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+      PCHECK(fd >= 0) << "Could not open " << name << " for writing";
+      it = writer->fds.emplace(segment, fd).first;
+    }
+
+    const char* data(records->data());
+    size_t left(records->size());
+    while (left > 0) {
+      const ssize_t written(write(it->second, data, left));
+      if (written < 0 && errno == EINTR) {
+        continue;
+      }
+      PCHECK(written > 0) << "Could not write segment " << segment;
+      data += written;
+      left -= written;
+    }
+
+    if (complete) {
+      CloseSegment(it->second);
+      writer->fds.erase(it);
+    }
+
+    {
+      lock_guard<mutex> lock(lock_);
+      pending_bytes_ -= records->size();
+    }
+    room_.notify_one();
+  }
+
+  const string dir_;
+  const int entries_per_segment_;
+
+  mutex lock_;
+  condition_variable room_;
+  size_t pending_bytes_;
+
+  vector<unique_ptr<Writer>> writers_;
+
+  DISALLOW_COPY_AND_ASSIGN(SegmentExporter);
+};
+
+// Fetches whole ranges of entries as fast as the log will send them,
+// while they are written out by a SegmentExporter.
+void ExportEntries() {
+  CHECK_NE(FLAGS_ct_server, "");
+  CHECK(!FLAGS_export_dir.empty());
+  HTTPLogClient client(FLAGS_ct_server, FLAGS_max_inflight_log_requests);
+  SegmentExporter exporter(FLAGS_export_dir, FLAGS_export_entries_per_segment,
+                           FLAGS_export_writers);
+  const AsyncLogClient::Status error(client.GetRawEntriesPipelined(
+      FLAGS_get_first, FLAGS_get_last, FLAGS_get_entries_batch_size,
+      bind(&SegmentExporter::Add, &exporter, _1, _2)));
+  CHECK_EQ(error, AsyncLogClient::OK);
+}
+
 int GetRoots() {
-  HTTPLogClient client(FLAGS_ct_server);
+  HTTPLogClient client(FLAGS_ct_server, FLAGS_max_inflight_log_requests);
 
   vector<unique_ptr<Cert>> roots;
   CHECK_EQ(client.GetRoots(&roots), AsyncLogClient::OK);
@@ -908,7 +1426,7 @@ int GetRoots() {
 int GetSTH() {
   CHECK_NE(FLAGS_ct_server, "");
 
-  HTTPLogClient client(FLAGS_ct_server);
+  HTTPLogClient client(FLAGS_ct_server, FLAGS_max_inflight_log_requests);
 
   ct::SignedTreeHead sth;
   CHECK_EQ(AsyncLogClient::OK, client.GetSTH(&sth));
@@ -939,11 +1457,17 @@ int GetSTH() {
   return 0;
 }
 
+static monitor::Database* GetMonitorDB(const string& path) {
+  CHECK_NE(path, "");
+  if (FLAGS_monitor_db_type == "leveldb") {
+    return new monitor::LevelDB(path);
+  }
+  CHECK_EQ(FLAGS_monitor_db_type, "sqlite") << "Unknown --monitor_db_type";
+  return new monitor::SQLiteDB(path);
+}
+
 static monitor::Database* GetMonitorDBFromFlags() {
-  CHECK_NE(FLAGS_sqlite_db, "");
-  monitor::Database* db;
-  db = new monitor::SQLiteDB(FLAGS_sqlite_db);
-  return db;
+  return GetMonitorDB(FLAGS_sqlite_db);
 }
 
 // Return code 0 indicates success.
@@ -952,7 +1476,7 @@ int Monitor() {
   CHECK_NE(FLAGS_monitor_action, "");
   CHECK_NE(FLAGS_ct_server, "");
 
-  HTTPLogClient client(FLAGS_ct_server);
+  HTTPLogClient client(FLAGS_ct_server, FLAGS_max_inflight_log_requests);
   monitor::Monitor monitor(GetMonitorDBFromFlags(), GetLogVerifierFromFlags(),
                            &client, FLAGS_monitor_sleep_time_secs);
 
@@ -975,6 +1499,37 @@ int Monitor() {
   return ret;
 }
 
+// Monitors all the logs listed in --monitor_logs, which have to have
+// been initialized with "monitor --monitor_action=init" first.
+int MonitorLogs() {
+  std::ifstream in(FLAGS_monitor_logs.c_str());
+  PCHECK(in.good()) << "Could not open " << FLAGS_monitor_logs;
+
+  ThreadPool poll_pool(FLAGS_monitor_threads);
+  ThreadPool hash_pool;
+  monitor::MultiMonitor monitors(
+      &poll_pool, &hash_pool,
+      std::chrono::seconds(FLAGS_monitor_sleep_time_secs));
+
+  string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream fields(line);
+    string name, url, public_key_file, db;
+    CHECK(fields >> name >> url >> public_key_file >> db)
+        << "Malformed line in " << FLAGS_monitor_logs << ": " << line;
+    monitors.AddLog(name, unique_ptr<monitor::Database>(GetMonitorDB(db)),
+                    unique_ptr<LogVerifier>(GetLogVerifier(public_key_file)),
+                    unique_ptr<HTTPLogClient>(new HTTPLogClient(
+                        url, FLAGS_max_inflight_log_requests)));
+  }
+
+  monitors.Run();
+  return 0;
+}
+
 
 // Exit code upon normal exit:
 // 0: success
@@ -1004,10 +1559,14 @@ int main(int argc, char** argv) {
     if ((!want_fail && result != SSLClient::OK) ||
         (want_fail && result != SSLClient::HANDSHAKE_FAILED))
       ret = 1;
+  } else if (cmd == "ssl_scan") {
+    ret = ScanServers();
   } else if (cmd == "upload") {
     ret = Upload();
   } else if (cmd == "audit") {
     ret = Audit();
+  } else if (cmd == "audit_batch") {
+    ret = AuditBatch();
   } else if (cmd == "consistency") {
     ret = CheckConsistency();
   } else if (cmd == "certificate") {
@@ -1024,10 +1583,14 @@ int main(int argc, char** argv) {
     WrapEmbedded();
   } else if (cmd == "get_entries") {
     GetEntries();
+  } else if (cmd == "export_entries") {
+    ExportEntries();
   } else if (cmd == "get_roots") {
     ret = GetRoots();
   } else if (cmd == "monitor") {
     ret = Monitor();
+  } else if (cmd == "monitor_logs") {
+    ret = MonitorLogs();
   } else if (cmd == "sth") {
     ret = GetSTH();
   } else {
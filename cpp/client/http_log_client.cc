@@ -1,6 +1,7 @@
 /* -*- indent-tabs-mode: nil -*- */
 #include "client/http_log_client.h"
 
+#include <deque>
 #include <event2/buffer.h>
 #include <functional>
 #include <glog/logging.h>
@@ -24,128 +25,251 @@ using ct::MerkleAuditProof;
 using ct::SignedCertificateTimestamp;
 using ct::SignedTreeHead;
 using std::bind;
+using std::deque;
+using std::function;
+using std::lock_guard;
+using std::make_shared;
+using std::min;
+using std::mutex;
+using std::unique_lock;
 using std::unique_ptr;
 using std::placeholders::_1;
 using std::string;
 using std::vector;
 
-namespace {
+HTTPLogClient::Request::Request(HTTPLogClient* client)
+    : client_(CHECK_NOTNULL(client)), status_(AsyncLogClient::UNKNOWN_ERROR) {
+}
 
+HTTPLogClient::Request::~Request() {
+  done_.WaitForNotification();
+}
 
-void DoneRequest(AsyncLogClient::Status status, AsyncLogClient::Status* retval,
-                 bool* done) {
-  *retval = status;
-  *done = true;
+bool HTTPLogClient::Request::IsDone() const {
+  return done_.HasBeenNotified();
 }
 
+AsyncLogClient::Status HTTPLogClient::Request::Wait() const {
+  done_.WaitForNotification();
+  return status_;
+}
 
-}  // namespace
+void HTTPLogClient::Request::Done(AsyncLogClient::Status status) {
+  status_ = status;
+  {
+    lock_guard<mutex> lock(client_->lock_);
+    --client_->in_flight_;
+  }
+  client_->room_.notify_one();
+  done_.Notify();
+}
 
-HTTPLogClient::HTTPLogClient(const string& server)
-    : base_(new libevent::Base()),
+HTTPLogClient::HTTPLogClient(const string& server, int max_in_flight)
+    : max_in_flight_(max_in_flight),
+      in_flight_(0),
+      base_(make_shared<libevent::Base>()),
       pool_(),
       fetcher_(base_.get(), &pool_),
-      client_(base_.get(), &fetcher_, server) {
+      client_(base_.get(), &fetcher_, server),
+      pump_(base_) {
+  CHECK_GT(max_in_flight_, 0);
 }
 
-AsyncLogClient::Status HTTPLogClient::UploadSubmission(
+HTTPLogClient::~HTTPLogClient() {
+  // Requests wait for themselves when destroyed, so none can be left.
+  lock_guard<mutex> lock(lock_);
+  CHECK_EQ(0, in_flight_);
+}
+
+unique_ptr<HTTPLogClient::Request> HTTPLogClient::NewRequest() {
+  unique_lock<mutex> lock(lock_);
+  room_.wait(lock, [this]() { return in_flight_ < max_in_flight_; });
+  ++in_flight_;
+  return unique_ptr<Request>(new Request(this));
+}
+
+unique_ptr<HTTPLogClient::Request> HTTPLogClient::StartUploadSubmission(
     const string& submission, bool pre, SignedCertificateTimestamp* sct) {
-  AsyncLogClient::Status retval(AsyncLogClient::UNKNOWN_ERROR);
-  bool done(false);
+  unique_ptr<Request> request(NewRequest());
 
+  // The chains are serialized before these return, they needn't outlive
+  // the request.
   if (pre) {
     PreCertChain pre_cert_chain(submission);
     client_.AddPreCertChain(pre_cert_chain, sct,
-                            bind(&DoneRequest, _1, &retval, &done));
+                            bind(&Request::Done, request.get(), _1));
   } else {
     CertChain cert_chain(submission);
     client_.AddCertChain(cert_chain, sct,
-                         bind(&DoneRequest, _1, &retval, &done));
+                         bind(&Request::Done, request.get(), _1));
   }
 
-  while (!done) {
-    base_->DispatchOnce();
-  }
+  return request;
+}
 
-  return retval;
+unique_ptr<HTTPLogClient::Request> HTTPLogClient::StartGetSTH(
+    SignedTreeHead* sth) {
+  unique_ptr<Request> request(NewRequest());
+  client_.GetSTH(sth, bind(&Request::Done, request.get(), _1));
+  return request;
 }
 
+unique_ptr<HTTPLogClient::Request> HTTPLogClient::StartGetRoots(
+    vector<unique_ptr<Cert>>* roots) {
+  unique_ptr<Request> request(NewRequest());
+  client_.GetRoots(roots, bind(&Request::Done, request.get(), _1));
+  return request;
+}
 
-AsyncLogClient::Status HTTPLogClient::GetSTH(SignedTreeHead* sth) {
-  AsyncLogClient::Status retval(AsyncLogClient::UNKNOWN_ERROR);
-  bool done(false);
+unique_ptr<HTTPLogClient::Request> HTTPLogClient::StartQueryInclusionProof(
+    const SignedTreeHead& sth, const string& merkle_leaf_hash,
+    MerkleAuditProof* proof) {
+  unique_ptr<Request> request(NewRequest());
+  client_.QueryInclusionProof(sth, merkle_leaf_hash, proof,
+                              bind(&Request::Done, request.get(), _1));
+  return request;
+}
 
-  client_.GetSTH(sth, bind(&DoneRequest, _1, &retval, &done));
-  while (!done) {
-    base_->DispatchOnce();
-  }
+unique_ptr<HTTPLogClient::Request> HTTPLogClient::StartGetSTHConsistency(
+    int64_t size1, int64_t size2, vector<string>* proof) {
+  unique_ptr<Request> request(NewRequest());
+  client_.GetSTHConsistency(size1, size2, proof,
+                            bind(&Request::Done, request.get(), _1));
+  return request;
+}
 
-  return retval;
+unique_ptr<HTTPLogClient::Request> HTTPLogClient::StartGetEntries(
+    int first, int last, vector<AsyncLogClient::Entry>* entries) {
+  unique_ptr<Request> request(NewRequest());
+  client_.GetEntries(first, last, entries,
+                     bind(&Request::Done, request.get(), _1));
+  return request;
 }
 
-AsyncLogClient::Status HTTPLogClient::GetRoots(
-    vector<unique_ptr<Cert>>* roots) {
-  AsyncLogClient::Status retval(AsyncLogClient::UNKNOWN_ERROR);
-  bool done(false);
+unique_ptr<HTTPLogClient::Request> HTTPLogClient::StartGetEntries(
+    int first, int last, AsyncLogClient::RawEntries* entries) {
+  unique_ptr<Request> request(NewRequest());
+  client_.GetRawEntries(first, last, entries,
+                        bind(&Request::Done, request.get(), _1));
+  return request;
+}
 
-  client_.GetRoots(roots, bind(&DoneRequest, _1, &retval, &done));
-  while (!done) {
-    base_->DispatchOnce();
-  }
+AsyncLogClient::Status HTTPLogClient::UploadSubmission(
+    const string& submission, bool pre, SignedCertificateTimestamp* sct) {
+  return StartUploadSubmission(submission, pre, sct)->Wait();
+}
+
+AsyncLogClient::Status HTTPLogClient::GetSTH(SignedTreeHead* sth) {
+  return StartGetSTH(sth)->Wait();
+}
 
-  return retval;
+AsyncLogClient::Status HTTPLogClient::GetRoots(
+    vector<unique_ptr<Cert>>* roots) {
+  return StartGetRoots(roots)->Wait();
 }
 
 AsyncLogClient::Status HTTPLogClient::QueryAuditProof(
     const string& merkle_leaf_hash, MerkleAuditProof* proof) {
-  AsyncLogClient::Status retval(AsyncLogClient::UNKNOWN_ERROR);
-  bool done(false);
   SignedTreeHead sth;
-
-  client_.GetSTH(&sth, bind(&DoneRequest, _1, &retval, &done));
-  while (!done) {
-    base_->DispatchOnce();
-  }
-
+  const AsyncLogClient::Status retval(GetSTH(&sth));
   if (retval != AsyncLogClient::OK)
     return retval;
 
-  retval = AsyncLogClient::UNKNOWN_ERROR;
-  done = false;
-  client_.QueryInclusionProof(sth, merkle_leaf_hash, proof,
-                              bind(&DoneRequest, _1, &retval, &done));
-
-  while (!done) {
-    base_->DispatchOnce();
-  }
-
-  return retval;
+  return StartQueryInclusionProof(sth, merkle_leaf_hash, proof)->Wait();
 }
 
 AsyncLogClient::Status HTTPLogClient::GetEntries(
     int first, int last, vector<AsyncLogClient::Entry>* entries) {
-  AsyncLogClient::Status retval(AsyncLogClient::UNKNOWN_ERROR);
-  bool done(false);
+  return StartGetEntries(first, last, entries)->Wait();
+}
 
-  client_.GetEntries(first, last, entries,
-                     bind(&DoneRequest, _1, &retval, &done));
-  while (!done) {
-    base_->DispatchOnce();
+namespace {
+
+
+// The entries [first, last] being fetched, into an |Entries|, which is
+// either a vector of AsyncLogClient::Entry or an
+// AsyncLogClient::RawEntries.
+template <class Entries>
+struct EntriesBatch {
+  EntriesBatch(int first, int last)
+      : first(first), last(last), fetching_from(first) {
   }
 
-  return retval;
+  const int first;
+  const int last;
+  // The first entry asked for by |request|.
+  int fetching_from;
+  Entries entries;
+  // Declared last, so that it waits before |entries| goes away.
+  unique_ptr<HTTPLogClient::Request> request;
+};
+
+
+}  // namespace
+
+AsyncLogClient::Status HTTPLogClient::GetEntriesPipelined(
+    int first, int last, int batch_size,
+    const function<void(int first, vector<AsyncLogClient::Entry>* entries)>&
+        consume) {
+  return PipelineGetEntries(first, last, batch_size, consume);
 }
 
-AsyncLogClient::Status HTTPLogClient::GetSTHConsistency(
-    int64_t size1, int64_t size2, vector<string>* proof) {
-  AsyncLogClient::Status retval(AsyncLogClient::UNKNOWN_ERROR);
-  bool done(false);
+AsyncLogClient::Status HTTPLogClient::GetRawEntriesPipelined(
+    int first, int last, int batch_size,
+    const function<void(int first, AsyncLogClient::RawEntries* entries)>&
+        consume) {
+  return PipelineGetEntries(first, last, batch_size, consume);
+}
 
-  client_.GetSTHConsistency(size1, size2, proof,
-                            bind(&DoneRequest, _1, &retval, &done));
-  while (!done) {
-    base_->DispatchOnce();
+template <class Entries>
+AsyncLogClient::Status HTTPLogClient::PipelineGetEntries(
+    int first, int last, int batch_size,
+    const function<void(int first, Entries* entries)>& consume) {
+  CHECK_GE(first, 0);
+  CHECK_GT(batch_size, 0);
+
+  // In order, and no more of them than can be in flight, so that a slow
+  // request doesn't let the ones after it pile up.
+  deque<unique_ptr<EntriesBatch<Entries>>> batches;
+  int next_first(first);
+
+  while (next_first <= last || !batches.empty()) {
+    while (next_first <= last &&
+           batches.size() < static_cast<size_t>(max_in_flight_)) {
+      const int batch_last(min(last, next_first + batch_size - 1));
+      batches.emplace_back(
+          new EntriesBatch<Entries>(next_first, batch_last));
+      batches.back()->request =
+          StartGetEntries(next_first, batch_last, &batches.back()->entries);
+      next_first = batch_last + 1;
+    }
+
+    EntriesBatch<Entries>* const batch(batches.front().get());
+    const AsyncLogClient::Status status(batch->request->Wait());
+    if (status != AsyncLogClient::OK) {
+      return status;
+    }
+    const int fetched_to(batch->first + batch->entries.size());
+    if (fetched_to <= batch->last) {
+      if (fetched_to == batch->fetching_from) {
+        // No progress, don't spin on it.
+        return AsyncLogClient::BAD_RESPONSE;
+      }
+      // Logs can return fewer entries than asked for, get the rest.
+      batch->fetching_from = fetched_to;
+      batch->request =
+          StartGetEntries(fetched_to, batch->last, &batch->entries);
+      continue;
+    }
+
+    consume(batch->first, &batch->entries);
+    batches.pop_front();
   }
 
-  return retval;
+  return AsyncLogClient::OK;
+}
+
+AsyncLogClient::Status HTTPLogClient::GetSTHConsistency(
+    int64_t size1, int64_t size2, vector<string>* proof) {
+  return StartGetSTHConsistency(size1, size2, proof)->Wait();
 }
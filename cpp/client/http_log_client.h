@@ -2,11 +2,15 @@
 #ifndef HTTP_LOG_CLIENT_H
 #define HTTP_LOG_CLIENT_H
 
+#include <condition_variable>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <stdint.h>
 #include <string>
 
 #include "base/macros.h"
+#include "base/notification.h"
 #include "client/async_log_client.h"
 #include "proto/ct.pb.h"
 #include "util/libevent_wrapper.h"
@@ -17,9 +21,66 @@ namespace cert_trans {
 class Cert;
 
 
+// Runs an AsyncLogClient on its own event loop thread. Each operation
+// can either be started, getting back a Request to wait on later, or
+// run synchronously. Either way, at most |max_in_flight| requests are
+// outstanding at once, starting one blocks until there is room.
 class HTTPLogClient {
  public:
-  explicit HTTPLogClient(const std::string& server);
+  // An operation started by one of the Start*() methods. It goes on
+  // whether or not it is waited for, but the Request must outlive it:
+  // destroying a Request waits for it to complete.
+  class Request {
+   public:
+    ~Request();
+
+    bool IsDone() const;
+
+    // Blocks until the request completes, and returns its status.
+    AsyncLogClient::Status Wait() const;
+
+   private:
+    friend class HTTPLogClient;
+
+    explicit Request(HTTPLogClient* client);
+
+    void Done(AsyncLogClient::Status status);
+
+    HTTPLogClient* const client_;
+    AsyncLogClient::Status status_;
+    Notification done_;
+
+    DISALLOW_COPY_AND_ASSIGN(Request);
+  };
+
+  HTTPLogClient(const std::string& server, int max_in_flight);
+  ~HTTPLogClient();
+
+  std::unique_ptr<Request> StartUploadSubmission(
+      const std::string& submission, bool pre,
+      ct::SignedCertificateTimestamp* sct);
+
+  std::unique_ptr<Request> StartGetSTH(ct::SignedTreeHead* sth);
+
+  std::unique_ptr<Request> StartGetRoots(
+      std::vector<std::unique_ptr<Cert>>* roots);
+
+  std::unique_ptr<Request> StartQueryInclusionProof(
+      const ct::SignedTreeHead& sth, const std::string& merkle_leaf_hash,
+      ct::MerkleAuditProof* proof);
+
+  std::unique_ptr<Request> StartGetSTHConsistency(
+      int64_t size1, int64_t size2, std::vector<std::string>* proof);
+
+  // This does not clear |entries| before appending the retrieved
+  // entries.
+  std::unique_ptr<Request> StartGetEntries(
+      int first, int last, std::vector<AsyncLogClient::Entry>* entries);
+
+  // This does not clear |entries| before appending the retrieved
+  // entries.
+  std::unique_ptr<Request> StartGetEntries(
+      int first, int last, AsyncLogClient::RawEntries* entries);
 
   AsyncLogClient::Status UploadSubmission(const std::string& submission,
                                           bool pre,
@@ -40,11 +101,43 @@ class HTTPLogClient {
   AsyncLogClient::Status GetEntries(
       int first, int last, std::vector<AsyncLogClient::Entry>* entries);
 
+  // Fetches entries |first| to |last| in batches of up to |batch_size|,
+  // keeping as many requests outstanding as allowed. |consume| is called
+  // on this thread with each batch, in order, while the following ones
+  // are being fetched, and can take the entries out of the vector. It
+  // stops at the first failed request, after the batches before it have
+  // been consumed.
+  AsyncLogClient::Status GetEntriesPipelined(
+      int first, int last, int batch_size,
+      const std::function<void(int first,
+                               std::vector<AsyncLogClient::Entry>* entries)>&
+          consume);
+
+  // Likewise, leaving the entries unparsed.
+  AsyncLogClient::Status GetRawEntriesPipelined(
+      int first, int last, int batch_size,
+      const std::function<void(int first,
+                               AsyncLogClient::RawEntries* entries)>& consume);
+
  private:
-  const std::unique_ptr<libevent::Base> base_;
+  // Blocks until a request can be started, and returns it.
+  std::unique_ptr<Request> NewRequest();
+
+  template <class Entries>
+  AsyncLogClient::Status PipelineGetEntries(
+      int first, int last, int batch_size,
+      const std::function<void(int first, Entries* entries)>& consume);
+
+  const int max_in_flight_;
+  std::mutex lock_;
+  std::condition_variable room_;
+  int in_flight_;
+
+  const std::shared_ptr<libevent::Base> base_;
   ThreadPool pool_;
   UrlFetcher fetcher_;
   AsyncLogClient client_;
+  libevent::EventPumpThread pump_;
 
   DISALLOW_COPY_AND_ASSIGN(HTTPLogClient);
 };
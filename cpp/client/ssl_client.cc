@@ -150,18 +150,8 @@ LogVerifier::VerifyResult SSLClient::VerifySCT(const string& token,
 }
 
 // static
-int SSLClient::VerifyCallback(X509_STORE_CTX* ctx, void* arg) {
-  VerifyCallbackArgs* args = reinterpret_cast<VerifyCallbackArgs*>(arg);
-  CHECK_NOTNULL(args);
-  LogVerifier* verifier = args->verifier;
-  CHECK_NOTNULL(verifier);
-
-  int vfy = X509_verify_cert(ctx);
-  if (vfy != 1) {
-    LOG(ERROR) << "Certificate verification failed.";
-    return vfy;
-  }
-
+bool SSLClient::GetSCTList(X509_STORE_CTX* ctx, const string& ct_extension,
+                           LogEntry* entry, string* serialized_scts) {
   // If verify passed then surely we must have a cert.
   CHECK_NOTNULL(ctx->cert);
 
@@ -182,7 +172,7 @@ int SSLClient::VerifyCallback(X509_STORE_CTX* ctx, void* arg) {
   for (int i = 0; i < chain_size; ++i)
     input_chain.AddCert(new Cert(X509_dup(sk_X509_value(ctx->untrusted, i))));
 
-  string serialized_scts;
+  serialized_scts->clear();
   // First, see if the cert has an embedded proof.
   const StatusOr<bool> has_embedded_proof = chain.LeafCert()->HasExtension(
       cert_trans::NID_ctEmbeddedSignedCertificateTimestampList);
@@ -202,7 +192,7 @@ int SSLClient::VerifyCallback(X509_STORE_CTX* ctx, void* arg) {
               << "verifying...";
     util::Status status = chain.LeafCert()->OctetStringExtensionData(
         cert_trans::NID_ctEmbeddedSignedCertificateTimestampList,
-        &serialized_scts);
+        serialized_scts);
     if (!status.ok()) {
       // Any error here is likely OpenSSL acting up, so just die. Previously
       // was CHECK_EQ(FALSE..., which meant fail check if not an error and not
@@ -214,7 +204,7 @@ int SSLClient::VerifyCallback(X509_STORE_CTX* ctx, void* arg) {
              superf_has_timestamp_list.ValueOrDie()) {
     LOG(INFO) << "Proof extension found in certificate, verifying...";
     util::Status status = input_chain.LastCert()->OctetStringExtensionData(
-        cert_trans::NID_ctSignedCertificateTimestampList, &serialized_scts);
+        cert_trans::NID_ctSignedCertificateTimestampList, serialized_scts);
     if (!status.ok()) {
       // Any error here is likely OpenSSL acting up, so just die.
       CHECK_EQ(Code::NOT_FOUND, status.CanonicalCode());
@@ -223,42 +213,71 @@ int SSLClient::VerifyCallback(X509_STORE_CTX* ctx, void* arg) {
   }
 
   // FIXME(benl): we should check all SCTs.
-  if (serialized_scts.empty() && !args->ct_extension.empty())
-    serialized_scts = args->ct_extension;
+  if (serialized_scts->empty() && !ct_extension.empty())
+    *serialized_scts = ct_extension;
+
+  if (serialized_scts->empty())
+    return false;
+
+  if (!CertSubmissionHandler::X509ChainToEntry(chain, entry)) {
+    LOG(ERROR) << "Failed to reconstruct log entry input from chain";
+    return false;
+  }
+  return true;
+}
 
-  if (!serialized_scts.empty()) {
-    LogEntry entry;
-    if (!CertSubmissionHandler::X509ChainToEntry(chain, &entry)) {
-      LOG(ERROR) << "Failed to reconstruct log entry input from chain";
+// static
+int SSLClient::VerifySCTList(const string& serialized_scts,
+                             LogVerifier* verifier, SSLClientCTData* data) {
+  // Only writes the checkpoint if verification succeeds.
+  // Note: an optimized client could only verify the signature if it's
+  // a certificate it hasn't seen before.
+  SignedCertificateTimestampList sct_list;
+  if (Deserializer::DeserializeSCTList(serialized_scts, &sct_list) !=
+      Deserializer::OK) {
+    LOG(ERROR) << "Failed to parse SCT list.";
+    return 0;
+  }
+
+  LOG(INFO) << "Received " << sct_list.sct_list_size() << " SCTs";
+  int num_verified(0);
+  for (int i = 0; i < sct_list.sct_list_size(); ++i) {
+    LogVerifier::VerifyResult result =
+        VerifySCT(sct_list.sct_list(i), verifier, data);
+
+    if (result == LogVerifier::VERIFY_OK) {
+      LOG(INFO) << "SCT number " << i + 1 << " verified";
+      ++num_verified;
     } else {
-      args->ct_data.mutable_reconstructed_entry()->CopyFrom(entry);
-      args->ct_data.set_certificate_sha256_hash(
-          Sha256Hasher::Sha256Digest(Serializer::LeafCertificate(entry)));
-      // Only writes the checkpoint if verification succeeds.
-      // Note: an optimized client could only verify the signature if it's
-      // a certificate it hasn't seen before.
-      SignedCertificateTimestampList sct_list;
-      if (Deserializer::DeserializeSCTList(serialized_scts, &sct_list) !=
-          Deserializer::OK) {
-        LOG(ERROR) << "Failed to parse SCT list.";
-      } else {
-        LOG(INFO) << "Received " << sct_list.sct_list_size() << " SCTs";
-        for (int i = 0; i < sct_list.sct_list_size(); ++i) {
-          LogVerifier::VerifyResult result =
-              VerifySCT(sct_list.sct_list(i), verifier, &args->ct_data);
-
-          if (result == LogVerifier::VERIFY_OK) {
-            LOG(INFO) << "SCT number " << i + 1 << " verified";
-            args->sct_verified = true;
-          } else {
-            LOG(ERROR) << "Verification for SCT number " << i + 1
-                       << " failed: "
-                       << LogVerifier::VerifyResultString(result);
-          }
-        }  // end for
-      }
+      LOG(ERROR) << "Verification for SCT number " << i + 1
+                 << " failed: " << LogVerifier::VerifyResultString(result);
     }
-  }  // end if (!serialized_scts.empty())
+  }  // end for
+  return num_verified;
+}
+
+// static
+int SSLClient::VerifyCallback(X509_STORE_CTX* ctx, void* arg) {
+  VerifyCallbackArgs* args = reinterpret_cast<VerifyCallbackArgs*>(arg);
+  CHECK_NOTNULL(args);
+  LogVerifier* verifier = args->verifier;
+  CHECK_NOTNULL(verifier);
+
+  int vfy = X509_verify_cert(ctx);
+  if (vfy != 1) {
+    LOG(ERROR) << "Certificate verification failed.";
+    return vfy;
+  }
+
+  LogEntry entry;
+  string serialized_scts;
+  if (GetSCTList(ctx, args->ct_extension, &entry, &serialized_scts)) {
+    args->ct_data.mutable_reconstructed_entry()->CopyFrom(entry);
+    args->ct_data.set_certificate_sha256_hash(
+        Sha256Hasher::Sha256Digest(Serializer::LeafCertificate(entry)));
+    if (VerifySCTList(serialized_scts, verifier, &args->ct_data) > 0)
+      args->sct_verified = true;
+  }
 
   if (!args->sct_verified && args->require_sct) {
     LOG(ERROR) << "No valid SCT found";
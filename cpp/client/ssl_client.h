@@ -49,6 +49,19 @@ class SSLClient {
                                              LogVerifier* verifier,
                                              ct::SSLClientCTData* data);
 
+  // Finds the serialized SCT list for the chain verified in |ctx|:
+  // embedded in the leaf certificate, in a superfluous certificate at
+  // the end of the chain, or else |ct_extension|, the contents of the
+  // TLS extension, if any. Returns false if there is none, or if the
+  // log entry for the chain, written to |entry|, can't be reconstructed.
+  static bool GetSCTList(X509_STORE_CTX* ctx, const std::string& ct_extension,
+                         ct::LogEntry* entry, std::string* serialized_scts);
+
+  // Verifies each SCT of a serialized list with VerifySCT(), and returns
+  // the number that verified. |data| must have the reconstructed entry.
+  static int VerifySCTList(const std::string& serialized_scts,
+                           LogVerifier* verifier, ct::SSLClientCTData* data);
+
   // Custom verification callback for verifying the SCT token
   // in a superfluous certificate. Return values:
   // With TLS extension support:
@@ -0,0 +1,337 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "client/ssl_scanner.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <glog/logging.h>
+#include <netinet/in.h>
+#include <openssl/err.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "log/log_verifier.h"
+#include "merkletree/serial_hasher.h"
+#include "proto/serializer.h"
+#include "util/executor.h"
+
+namespace libevent = cert_trans::libevent;
+
+using ct::LogEntry;
+using ct::SSLClientCTData;
+using std::function;
+using std::lock_guard;
+using std::make_shared;
+using std::mutex;
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace cert_trans {
+
+namespace {
+
+
+const uint16_t kCTExtensionType(18);
+
+
+}  // namespace
+
+
+struct SSLScanner::Connection {
+  explicit Connection(const Server& server)
+      : fd(-1), ssl(nullptr), has_scts(false) {
+    result.server = server;
+    result.handshake = SSLClient::SERVER_UNAVAILABLE;
+  }
+
+  ~Connection() {
+    Close();
+  }
+
+  void Close() {
+    event.reset();
+    if (ssl) {
+      // Best effort, this won't wait for the server's close_notify.
+      SSL_shutdown(ssl);
+      SSL_free(ssl);
+      ssl = nullptr;
+    }
+    if (fd >= 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+
+  Result result;
+  int fd;
+  SSL* ssl;
+  unique_ptr<libevent::Event> event;
+  // Filled in during the handshake, by the callbacks.
+  string ct_extension;
+  bool has_scts;
+  LogEntry entry;
+  string serialized_scts;
+};
+
+
+SSLScanner::SSLScanner(libevent::Base* base, const string& ca_dir,
+                       LogVerifier* verifier, util::Executor* verify_executor,
+                       int max_concurrent, int verify_batch_size,
+                       const std::chrono::duration<double>& timeout)
+    : base_(CHECK_NOTNULL(base)),
+      verifier_(CHECK_NOTNULL(verifier)),
+      verify_executor_(CHECK_NOTNULL(verify_executor)),
+      max_concurrent_(max_concurrent),
+      verify_batch_size_(verify_batch_size),
+      timeout_(timeout),
+      ctx_(SSL_CTX_new(TLSv1_client_method())),
+      active_(0),
+      outstanding_(0) {
+  CHECK_GT(max_concurrent, 0);
+  CHECK_GT(verify_batch_size, 0);
+  CHECK_NOTNULL(ctx_);
+
+  // As with SSLClient, the handshake is aborted if the chain doesn't
+  // verify.
+  SSL_CTX_set_verify(ctx_, SSL_VERIFY_PEER, NULL);
+  if (!ca_dir.empty()) {
+    CHECK_EQ(1, SSL_CTX_load_verify_locations(ctx_, NULL, ca_dir.c_str()))
+        << "Unable to load trusted CA certificates.";
+  } else {
+    LOG(WARNING) << "No trusted CA certificates given.";
+  }
+
+  // The callbacks find their connection through the SSL object, so
+  // they need no argument.
+  SSL_CTX_set_cert_verify_callback(ctx_, &VerifyCallback, NULL);
+
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+  SSL_CTX_add_client_custom_ext(ctx_, kCTExtensionType, NULL, NULL, NULL,
+                                ExtensionCallback, NULL);
+#else
+  LOG(WARNING) << "OpenSSL version is too low to check the Certificate "
+                  "Transparency TLS extension";
+#endif
+}
+
+
+SSLScanner::~SSLScanner() {
+  {
+    lock_guard<mutex> lock(lock_);
+    CHECK_EQ(0U, outstanding_);
+  }
+  SSL_CTX_free(ctx_);
+}
+
+
+void SSLScanner::Scan(const vector<Server>& servers,
+                      const ResultCallback& done) {
+  if (servers.empty()) {
+    return;
+  }
+
+  {
+    lock_guard<mutex> lock(lock_);
+    CHECK_EQ(0U, outstanding_) << "A scan is already in progress";
+    done_ = done;
+    outstanding_ = servers.size();
+    scan_done_.reset(new Notification);
+  }
+
+  base_->Add([this, servers]() {
+    queue_.insert(queue_.end(), servers.begin(), servers.end());
+    StartMore();
+  });
+
+  scan_done_->WaitForNotification();
+}
+
+
+// static
+int SSLScanner::VerifyCallback(X509_STORE_CTX* ctx, void*) {
+  const int vfy(X509_verify_cert(ctx));
+  if (vfy != 1) {
+    return vfy;
+  }
+
+  SSL* const ssl(static_cast<SSL*>(
+      X509_STORE_CTX_get_ex_data(ctx, SSL_get_ex_data_X509_STORE_CTX_idx())));
+  Connection* const conn(
+      static_cast<Connection*>(SSL_get_app_data(CHECK_NOTNULL(ssl))));
+  conn->has_scts = SSLClient::GetSCTList(ctx, conn->ct_extension,
+                                         &conn->entry, &conn->serialized_scts);
+  return 1;
+}
+
+
+// static
+int SSLScanner::ExtensionCallback(SSL* s, unsigned ext_type,
+                                  const unsigned char* in, size_t inlen,
+                                  int*, void*) {
+  CHECK_EQ(ext_type, kCTExtensionType);
+  Connection* const conn(static_cast<Connection*>(SSL_get_app_data(s)));
+  conn->ct_extension.assign(reinterpret_cast<const char*>(in), inlen);
+  return 1;
+}
+
+
+void SSLScanner::StartMore() {
+  while (active_ < max_concurrent_ && !queue_.empty()) {
+    ++active_;
+    const Server server(queue_.front());
+    queue_.pop_front();
+    Start(server);
+  }
+}
+
+
+void SSLScanner::Start(const Server& server) {
+  Connection* const conn(new Connection(server));
+
+  struct sockaddr_in server_socket;
+  memset(&server_socket, 0, sizeof(server_socket));
+  server_socket.sin_family = AF_INET;
+  server_socket.sin_port = htons(server.port);
+  if (inet_aton(server.address.c_str(), &server_socket.sin_addr) != 1) {
+    LOG(WARNING) << "Can't parse server address: " << server.address;
+    Finish(conn, SSLClient::SERVER_UNAVAILABLE);
+    return;
+  }
+
+  conn->fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  PCHECK(conn->fd >= 0) << "Socket creation failed";
+  CHECK_EQ(0, evutil_make_socket_nonblocking(conn->fd));
+
+  if (connect(conn->fd, reinterpret_cast<struct sockaddr*>(&server_socket),
+              sizeof(server_socket)) == 0) {
+    Handshake(conn, 0);
+  } else if (errno == EINPROGRESS) {
+    Wait(conn, EV_WRITE, [this, conn](short what) { Connected(conn, what); });
+  } else {
+    PLOG(WARNING) << "Connection to " << server.address << ":" << server.port
+                  << " failed";
+    Finish(conn, SSLClient::SERVER_UNAVAILABLE);
+  }
+}
+
+
+void SSLScanner::Wait(Connection* conn, short events,
+                      const function<void(short what)>& next) {
+  // The next step replaces |conn->event|, so it can't run from inside
+  // the event's own callback.
+  conn->event.reset(new libevent::Event(
+      *base_, conn->fd, events, [this, next](evutil_socket_t, short what) {
+        base_->Add([next, what]() { next(what); });
+      }));
+  conn->event->Add(timeout_);
+}
+
+
+void SSLScanner::Connected(Connection* conn, short what) {
+  int error(0);
+  socklen_t error_len(sizeof(error));
+  if ((what & EV_TIMEOUT) ||
+      getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &error_len) != 0 ||
+      error != 0) {
+    VLOG(1) << "Connection to " << conn->result.server.address << ":"
+            << conn->result.server.port << " failed";
+    Finish(conn, SSLClient::SERVER_UNAVAILABLE);
+    return;
+  }
+  Handshake(conn, 0);
+}
+
+
+void SSLScanner::Handshake(Connection* conn, short what) {
+  if (what & EV_TIMEOUT) {
+    VLOG(1) << "Handshake with " << conn->result.server.address << ":"
+            << conn->result.server.port << " timed out";
+    Finish(conn, SSLClient::HANDSHAKE_FAILED);
+    return;
+  }
+
+  if (!conn->ssl) {
+    conn->ssl = CHECK_NOTNULL(SSL_new(ctx_));
+    CHECK_EQ(1, SSL_set_fd(conn->ssl, conn->fd));
+    SSL_set_connect_state(conn->ssl);
+    SSL_set_app_data(conn->ssl, conn);
+  }
+
+  const int ret(SSL_do_handshake(conn->ssl));
+  if (ret == 1) {
+    Finish(conn, SSLClient::OK);
+    return;
+  }
+
+  const auto next([this, conn](short what) { Handshake(conn, what); });
+  switch (SSL_get_error(conn->ssl, ret)) {
+    case SSL_ERROR_WANT_READ:
+      Wait(conn, EV_READ, next);
+      break;
+    case SSL_ERROR_WANT_WRITE:
+      Wait(conn, EV_WRITE, next);
+      break;
+    default:
+      VLOG(1) << "Handshake with " << conn->result.server.address << ":"
+              << conn->result.server.port << " failed";
+      // The error queue is per thread, don't let it grow.
+      ERR_clear_error();
+      Finish(conn, SSLClient::HANDSHAKE_FAILED);
+  }
+}
+
+
+void SSLScanner::Finish(Connection* conn, SSLClient::HandshakeResult result) {
+  conn->result.handshake = result;
+  conn->Close();
+  batch_.emplace_back(conn);
+  --active_;
+
+  if (batch_.size() >= verify_batch_size_ ||
+      (active_ == 0 && queue_.empty())) {
+    FlushBatch();
+  }
+  // Not called directly, so that a run of servers that fail right
+  // away doesn't recurse. Once the queue is empty, the scan may be over
+  // as soon as the batch is verified, so nothing must be left behind.
+  if (!queue_.empty()) {
+    base_->Add([this]() { StartMore(); });
+  }
+}
+
+
+void SSLScanner::FlushBatch() {
+  const shared_ptr<vector<unique_ptr<Connection>>> batch(
+      make_shared<vector<unique_ptr<Connection>>>());
+  batch->swap(batch_);
+  verify_executor_->Add([this, batch]() { Verify(*batch); });
+}
+
+
+void SSLScanner::Verify(const vector<unique_ptr<Connection>>& batch) {
+  for (const auto& conn : batch) {
+    if (conn->result.handshake != SSLClient::OK || !conn->has_scts) {
+      continue;
+    }
+    SSLClientCTData* const ct_data(&conn->result.ct_data);
+    ct_data->mutable_reconstructed_entry()->CopyFrom(conn->entry);
+    ct_data->set_certificate_sha256_hash(
+        Sha256Hasher::Sha256Digest(Serializer::LeafCertificate(conn->entry)));
+    SSLClient::VerifySCTList(conn->serialized_scts, verifier_.get(), ct_data);
+  }
+
+  lock_guard<mutex> lock(lock_);
+  for (const auto& conn : batch) {
+    done_(conn->result);
+  }
+  CHECK_GE(outstanding_, batch.size());
+  outstanding_ -= batch.size();
+  if (outstanding_ == 0) {
+    scan_done_->Notify();
+  }
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,116 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+#ifndef SSL_SCANNER_H
+#define SSL_SCANNER_H
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "base/notification.h"
+#include "client/ssl_client.h"
+#include "proto/ct.pb.h"
+#include "util/libevent_wrapper.h"
+
+class LogVerifier;
+
+namespace util {
+class Executor;
+}  // namespace util
+
+namespace cert_trans {
+
+
+// Handshakes with many TLS servers at once, to collect their SCTs. All
+// the connections are non-blocking and driven by one event loop, and
+// share one SSL_CTX and LogVerifier. Unlike SSLClient, the SCTs are not
+// verified during the handshake: they are queued up, and verified in
+// batches on a separate executor, so that the signature checks don't
+// hold up the handshakes.
+class SSLScanner {
+ public:
+  struct Server {
+    // An IPv4 address, as for SSLClient.
+    std::string address;
+    uint16_t port;
+  };
+
+  struct Result {
+    Server server;
+    SSLClient::HandshakeResult handshake;
+    // The reconstructed entry, if the server sent SCTs, and the ones
+    // that verified.
+    ct::SSLClientCTData ct_data;
+  };
+
+  typedef std::function<void(const Result& result)> ResultCallback;
+
+  // Takes ownership of |verifier|. |base| must be dispatched by some
+  // other thread, e.g. an EventPumpThread. At most |max_concurrent|
+  // handshakes are in progress at once, each given up after |timeout|,
+  // and SCTs are verified on |verify_executor| in batches of
+  // |verify_batch_size| servers.
+  SSLScanner(libevent::Base* base, const std::string& ca_dir,
+             LogVerifier* verifier, util::Executor* verify_executor,
+             int max_concurrent, int verify_batch_size,
+             const std::chrono::duration<double>& timeout);
+  ~SSLScanner();
+
+  // Scans each of |servers|, and calls |done| with each result, in no
+  // particular order, from |verify_executor|, one at a time. Blocks
+  // until all the results are in. Only one scan can be in progress.
+  void Scan(const std::vector<Server>& servers, const ResultCallback& done);
+
+ private:
+  struct Connection;
+
+  static int VerifyCallback(X509_STORE_CTX* ctx, void* arg);
+  static int ExtensionCallback(SSL* s, unsigned ext_type,
+                               const unsigned char* in, size_t inlen, int* al,
+                               void* arg);
+
+  // These run on the event loop.
+  void StartMore();
+  void Start(const Server& server);
+  void Wait(Connection* conn, short events,
+            const std::function<void(short what)>& next);
+  void Connected(Connection* conn, short what);
+  void Handshake(Connection* conn, short what);
+  void Finish(Connection* conn, SSLClient::HandshakeResult result);
+  void FlushBatch();
+
+  // Runs on |verify_executor_|.
+  void Verify(const std::vector<std::unique_ptr<Connection>>& batch);
+
+  libevent::Base* const base_;
+  const std::unique_ptr<LogVerifier> verifier_;
+  util::Executor* const verify_executor_;
+  const int max_concurrent_;
+  const size_t verify_batch_size_;
+  const std::chrono::duration<double> timeout_;
+  SSL_CTX* ctx_;
+
+  // Only used on the event loop.
+  std::deque<Server> queue_;
+  int active_;
+  std::vector<std::unique_ptr<Connection>> batch_;
+
+  std::mutex lock_;
+  ResultCallback done_;
+  size_t outstanding_;
+  std::unique_ptr<Notification> scan_done_;
+
+  DISALLOW_COPY_AND_ASSIGN(SSLScanner);
+};
+
+
+}  // namespace cert_trans
+
+#endif
@@ -10,6 +10,7 @@
 using std::bind;
 using std::chrono::seconds;
 using std::lock_guard;
+using std::make_shared;
 using std::map;
 using std::move;
 using std::mutex;
@@ -21,7 +22,8 @@ using std::unique_ptr;
 using util::Executor;
 using util::Task;
 
-DEFINE_int32(delay_between_fetches_seconds, 30, "delay between fetches");
+DEFINE_int32(delay_between_fetches_seconds, 30,
+             "delay between fetches, when no peer reported new entries");
 
 namespace cert_trans {
 
@@ -36,6 +38,7 @@ class ContinuousFetcherImpl : public ContinuousFetcher {
 
   void AddPeer(const string& node_id, const shared_ptr<Peer>& peer) override;
   void RemovePeer(const string& node_id) override;
+  void NewTreeSize(int64_t tree_size) override;
 
  private:
   void StartFetch(const unique_lock<mutex>& lock);
@@ -50,8 +53,17 @@ class ContinuousFetcherImpl : public ContinuousFetcher {
 
   mutex lock_;
   map<string, shared_ptr<Peer>> peers_;
+  // What each fetch learnt of the peers, for the next ones to pick
+  // peers from.
+  map<string, shared_ptr<PeerGroup::PeerState>> peer_states_;
 
   bool restart_fetch_;
+  // Set when a peer reported new entries since the last fetch
+  // started, so that another one follows right away.
+  bool fetch_again_;
+  // Whether a delayed fetch is scheduled. There is only ever one.
+  bool delay_pending_;
+  int64_t notified_tree_size_;
   unique_ptr<Task> fetch_task_;
 
   DISALLOW_COPY_AND_ASSIGN(ContinuousFetcherImpl);
@@ -66,7 +78,10 @@ ContinuousFetcherImpl::ContinuousFetcherImpl(
       db_(CHECK_NOTNULL(db)),
       log_verifier_(CHECK_NOTNULL(log_verifier)),
       fetch_scts_(fetch_scts),
-      restart_fetch_(false) {
+      restart_fetch_(false),
+      fetch_again_(false),
+      delay_pending_(false),
+      notified_tree_size_(-1) {
 }
 
 
@@ -82,6 +97,8 @@ void ContinuousFetcherImpl::AddPeer(const string& node_id,
   } else {
     CHECK(peers_.emplace(node_id, peer).second);
   }
+  // It might be somewhere else now, so start over.
+  peer_states_[node_id] = make_shared<PeerGroup::PeerState>();
 
   if (fetch_task_) {
     restart_fetch_ = true;
@@ -99,6 +116,7 @@ void ContinuousFetcherImpl::RemovePeer(const string& node_id) {
   // controllers to the same continuous fetcher instance, so additions
   // and removals can be duplicated. Tolerate this for now, but only
   // restart the fetching process if there was an actual removal.
+  peer_states_.erase(node_id);
   if (peers_.erase(node_id) > 0 && fetch_task_) {
     restart_fetch_ = true;
     fetch_task_->Cancel();
@@ -106,15 +124,38 @@ void ContinuousFetcherImpl::RemovePeer(const string& node_id) {
 }
 
 
+void ContinuousFetcherImpl::NewTreeSize(int64_t tree_size) {
+  lock_guard<mutex> lock(lock_);
+
+  // Many peers report the same tree sizes.
+  if (tree_size <= notified_tree_size_) {
+    return;
+  }
+  notified_tree_size_ = tree_size;
+
+  // All the reports that come in until a fetch starts are handled by
+  // that one fetch. The caller might hold locks that the fetch needs,
+  // so it is started from the executor.
+  if (!fetch_again_) {
+    fetch_again_ = true;
+    if (!fetch_task_) {
+      executor_->Add(
+          bind(&ContinuousFetcherImpl::FetchDelayDone, this, nullptr));
+    }
+  }
+}
+
+
 void ContinuousFetcherImpl::StartFetch(const unique_lock<mutex>& lock) {
   CHECK(lock.owns_lock());
   CHECK(!fetch_task_);
 
   restart_fetch_ = false;
+  fetch_again_ = false;
 
   unique_ptr<PeerGroup> peer_group(new PeerGroup(fetch_scts_));
   for (const auto& peer : peers_) {
-    peer_group->Add(peer.second);
+    peer_group->Add(peer.second, peer_states_.at(peer.first));
   }
 
   fetch_task_.reset(
@@ -133,10 +174,11 @@ void ContinuousFetcherImpl::FetchDone(Task* task) {
   lock_guard<mutex> lock(lock_);
   fetch_task_.reset();
 
-  if (restart_fetch_) {
+  if (restart_fetch_ || fetch_again_) {
     executor_->Add(
         bind(&ContinuousFetcherImpl::FetchDelayDone, this, nullptr));
-  } else {
+  } else if (!delay_pending_) {
+    delay_pending_ = true;
     base_->Delay(seconds(FLAGS_delay_between_fetches_seconds),
                  new Task(bind(&ContinuousFetcherImpl::FetchDelayDone, this,
                                _1),
@@ -146,13 +188,14 @@ void ContinuousFetcherImpl::FetchDone(Task* task) {
 
 
 void ContinuousFetcherImpl::FetchDelayDone(Task* task) {
+  unique_lock<mutex> lock(lock_);
   // "task" can be null, if we're restarting a fetch.
   if (task) {
     CHECK_EQ(util::Status::OK, task->status());
     delete task;
+    delay_pending_ = false;
   }
 
-  unique_lock<mutex> lock(lock_);
   if (!fetch_task_) {
     StartFetch(lock);
   }
@@ -5,6 +5,7 @@
 #include <memory>
 #include <mutex>
 #include <set>
+#include <stdint.h>
 #include <string>
 
 #include "base/macros.h"
@@ -34,6 +35,11 @@ class ContinuousFetcher {
 
   virtual void RemovePeer(const std::string& node_id) = 0;
 
+  // Tells the fetcher that one of its peers now has |tree_size|
+  // entries, so that it fetches them without waiting for the next
+  // round. Can be called from the callbacks of a peer.
+  virtual void NewTreeSize(int64_t tree_size) = 0;
+
  protected:
   ContinuousFetcher() = default;
 
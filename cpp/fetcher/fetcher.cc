@@ -1,21 +1,29 @@
 #include "fetcher/fetcher.h"
 
+#include <algorithm>
+#include <chrono>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <iterator>
 #include <memory>
 #include <mutex>
+#include <utility>
 
 #include "base/macros.h"
 #include "log/log_verifier.h"
 #include "monitoring/monitoring.h"
+#include "util/parallel_for.h"
 
 using cert_trans::AsyncLogClient;
 using cert_trans::LoggedCertificate;
 using cert_trans::PeerGroup;
 using std::bind;
+using std::chrono::duration;
+using std::chrono::steady_clock;
 using std::lock_guard;
 using std::move;
 using std::mutex;
+using std::pair;
 using std::placeholders::_1;
 using std::string;
 using std::to_string;
@@ -27,9 +35,17 @@ using util::Task;
 using util::TaskHold;
 
 DEFINE_int32(fetcher_concurrent_fetches, 2,
-             "number of concurrent fetch requests");
+             "number of concurrent fetch requests to start with");
+DEFINE_int32(fetcher_max_concurrent_fetches, 16,
+             "maximum number of concurrent fetch requests, up to which "
+             "their number is adjusted according to the measured "
+             "throughput");
 DEFINE_int32(fetcher_batch_size, 1000,
-             "maximum number of entries to fetch per request");
+             "maximum number of entries to fetch per request, which is "
+             "lowered to what the peers are seen to return at most");
+DEFINE_int32(fetcher_sct_verification_parallelism, 8,
+             "maximum number of threads verifying the SCTs of a batch of "
+             "fetched entries at once");
 
 namespace cert_trans {
 
@@ -38,6 +54,11 @@ Counter<string>* num_invalid_entries_fetched =
                          "Number of invalid entries fetched from remote peers "
                          "broken down by reason.");
 
+static Gauge<>* fetcher_concurrent_fetches(
+    Gauge<>::New("fetcher_concurrent_fetches",
+                 "Number of ranges of entries the fetcher currently allows "
+                 "in flight."));
+
 
 namespace {
 
@@ -45,8 +66,11 @@ namespace {
 struct Range {
   enum State {
     HAVE,
+    // Fetched, waiting to be written to the database.
+    FETCHED,
     FETCHING,
     WANT,
+    WRITING,
   };
 
   Range(State state, int64_t size, unique_ptr<Range> next = nullptr)
@@ -55,12 +79,129 @@ struct Range {
     CHECK_GT(size_, 0);
   };
 
+  // Whether the range still holds a slot for a fetch.
+  bool InFlight() const {
+    return state_ == FETCHED || state_ == FETCHING || state_ == WRITING;
+  }
+
   State state_;
   int64_t size_;
   unique_ptr<Range> next_;
+  // The entries, while FETCHED.
+  vector<LoggedCertificate> fetched_;
 };
 
 
+// Makes the ranges of the entries from |start| to |end| (excluded),
+// given the sequence numbers of those the database already has, in
+// order. This way, a fetch that was interrupted only gets what is
+// still missing.
+unique_ptr<Range> MakeRanges(int64_t start, int64_t end,
+                             const vector<int64_t>& have) {
+  vector<pair<Range::State, int64_t>> pieces;
+  int64_t index(start);
+  for (const int64_t sequence_number : have) {
+    if (sequence_number < index) {
+      continue;
+    }
+    if (sequence_number >= end) {
+      break;
+    }
+    if (sequence_number > index) {
+      pieces.emplace_back(Range::WANT, sequence_number - index);
+    }
+    if (pieces.empty() || pieces.back().first != Range::HAVE) {
+      pieces.emplace_back(Range::HAVE, 0);
+    }
+    ++pieces.back().second;
+    index = sequence_number + 1;
+  }
+  if (index < end) {
+    pieces.emplace_back(Range::WANT, end - index);
+  }
+
+  unique_ptr<Range> ranges;
+  for (auto it = pieces.rbegin(); it != pieces.rend(); ++it) {
+    ranges.reset(new Range(it->first, it->second, move(ranges)));
+  }
+  return ranges;
+}
+
+
+// Adjusts the number of concurrent fetches by hill climbing on the
+// throughput: it keeps going in the same direction while that doesn't
+// make the fetching slower, and turns around when it does.
+class ConcurrencyController {
+ public:
+  ConcurrencyController(int initial, int max)
+      : max_(std::max(initial, max)),
+        concurrency_(initial),
+        direction_(1),
+        window_start_(steady_clock::now()),
+        window_entries_(0),
+        window_fetches_(0),
+        last_rate_(0) {
+    CHECK_GT(concurrency_, 0);
+    fetcher_concurrent_fetches->Set(concurrency_);
+  }
+
+  int concurrency() const {
+    return concurrency_;
+  }
+
+  // Reports that a fetch of |entries| entries completed.
+  void Fetched(int64_t entries);
+
+ private:
+  // Give a change in throughput of less than this some slack, as it
+  // could just be noise.
+  static constexpr double kTolerance = 0.05;
+
+  const int max_;
+  int concurrency_;
+  int direction_;
+  steady_clock::time_point window_start_;
+  int64_t window_entries_;
+  int window_fetches_;
+  // In entries per second, for the previous window.
+  double last_rate_;
+
+  DISALLOW_COPY_AND_ASSIGN(ConcurrencyController);
+};
+
+
+constexpr double ConcurrencyController::kTolerance;
+
+
+void ConcurrencyController::Fetched(int64_t entries) {
+  window_entries_ += entries;
+  // Measure over a couple of rounds of fetches at the current level.
+  if (++window_fetches_ < 2 * concurrency_) {
+    return;
+  }
+
+  const steady_clock::time_point now(steady_clock::now());
+  const double rate(window_entries_ /
+                    std::max(duration<double>(now - window_start_).count(),
+                             1e-3));
+  if (last_rate_ > 0 && rate < last_rate_ * (1 - kTolerance)) {
+    direction_ = -direction_;
+  }
+  if (concurrency_ + direction_ < 1 || concurrency_ + direction_ > max_) {
+    direction_ = -direction_;
+  }
+  concurrency_ = std::min(max_, std::max(1, concurrency_ + direction_));
+  VLOG(1) << "fetched at " << rate << " entries/s, now fetching "
+          << concurrency_ << " ranges at once";
+  fetcher_concurrent_fetches->Set(concurrency_);
+
+  last_rate_ = rate;
+  window_start_ = now;
+  window_entries_ = 0;
+  window_fetches_ = 0;
+}
+
+
 struct FetchState {
   FetchState(Database<LoggedCertificate>* db, unique_ptr<PeerGroup> peer_group,
              const LogVerifier* log_verifier, Task* task);
@@ -68,9 +209,16 @@ struct FetchState {
   void WalkEntries();
   void FetchRange(const unique_lock<mutex>& lock, Range* current,
                   int64_t index, Task* range_task);
-  void WriteToDatabase(int64_t index, Range* range,
-                       const vector<AsyncLogClient::Entry>* retval,
-                       Task* range_task, Task* fetch_task);
+  // Checks the entries fetched, and has them written.
+  void FetchDone(int64_t index, Range* range,
+                 const vector<AsyncLogClient::Entry>* retval,
+                 Task* range_task, Task* fetch_task);
+  // Writes the ranges that were fetched, in one batch, for as long as
+  // there are some. The database takes entries out of order, so these
+  // need not follow the ones it has, and are not lost if the fetch is
+  // interrupted. Only one thread does this at a time, the others
+  // leave their ranges to it.
+  void WriteFetched();
 
   Database<LoggedCertificate>* const db_;
   const unique_ptr<PeerGroup> peer_group_;
@@ -80,6 +228,8 @@ struct FetchState {
   mutex lock_;
   int64_t start_;
   unique_ptr<Range> entries_;
+  ConcurrencyController concurrency_;
+  bool writing_;
 
  private:
   DISALLOW_COPY_AND_ASSIGN(FetchState);
@@ -93,7 +243,10 @@ FetchState::FetchState(Database<LoggedCertificate>* db,
       peer_group_(move(peer_group)),
       log_verifier_(CHECK_NOTNULL(log_verifier)),
       task_(CHECK_NOTNULL(task)),
-      start_(db_->TreeSize()) {
+      start_(db_->TreeSize()),
+      concurrency_(FLAGS_fetcher_concurrent_fetches,
+                   FLAGS_fetcher_max_concurrent_fetches),
+      writing_(false) {
   // TODO(pphaneuf): Might be better to get that as a parameter?
   const int64_t remote_tree_size(peer_group_->TreeSize());
   CHECK_GE(start_, 0);
@@ -106,7 +259,11 @@ FetchState::FetchState(Database<LoggedCertificate>* db,
     return;
   }
 
-  entries_.reset(new Range(Range::WANT, remote_tree_size - start_));
+  const vector<int64_t> sparse_entries(db_->SparseEntries());
+  VLOG_IF(1, !sparse_entries.empty())
+      << "resuming with " << sparse_entries.size()
+      << " entries past the contiguous " << start_ << " fetched already";
+  entries_ = MakeRanges(start_, remote_tree_size, sparse_entries);
 
   WalkEntries();
 }
@@ -145,12 +302,15 @@ void FetchState::WalkEntries() {
     return;
   }
 
+  // Ask for no more than the peers return at once, to not have to
+  // split the ranges as the replies come back short.
+  const int64_t batch_size(peer_group_->BatchSize(FLAGS_fetcher_batch_size));
   int64_t index(start_);
   int num_fetch(0);
   for (Range* current = entries_.get(); current;
        index += current->size_, current = current->next_.get()) {
     // Coalesce with the next Range, if possible.
-    if (current->state_ != Range::FETCHING) {
+    if (current->state_ == Range::HAVE || current->state_ == Range::WANT) {
       while (current->next_ && current->next_->state_ == current->state_) {
         current->size_ += current->next_->size_;
         current->next_ = move(current->next_->next_);
@@ -163,7 +323,9 @@ void FetchState::WalkEntries() {
                 << " entries";
         break;
 
+      case Range::FETCHED:
       case Range::FETCHING:
+      case Range::WRITING:
         VLOG(2) << "at offset " << index << ", fetching " << current->size_
                 << " entries";
         ++num_fetch;
@@ -179,12 +341,12 @@ void FetchState::WalkEntries() {
           break;
         }
 
-        // If the range is bigger than the maximum batch size, split it.
-        if (current->size_ > FLAGS_fetcher_batch_size) {
-          current->next_.reset(
-              new Range(Range::WANT, current->size_ - FLAGS_fetcher_batch_size,
-                        move(current->next_)));
-          current->size_ = FLAGS_fetcher_batch_size;
+        // If the range is bigger than the batch size, split it.
+        if (current->size_ > batch_size) {
+          current->next_.reset(new Range(Range::WANT,
+                                         current->size_ - batch_size,
+                                         move(current->next_)));
+          current->size_ = batch_size;
         }
 
         FetchRange(lock, current, index,
@@ -194,7 +356,7 @@ void FetchState::WalkEntries() {
         break;
     }
 
-    if (num_fetch >= FLAGS_fetcher_concurrent_fetches ||
+    if (num_fetch >= concurrency_.concurrency() ||
         index >= remote_tree_size) {
       break;
     }
@@ -216,14 +378,14 @@ void FetchState::FetchRange(const unique_lock<mutex>& lock, Range* current,
 
   peer_group_->FetchEntries(index, end_index, retval,
                             range_task->AddChild(
-                                bind(&FetchState::WriteToDatabase, this, index,
+                                bind(&FetchState::FetchDone, this, index,
                                      current, retval, range_task, _1)));
 }
 
 
-void FetchState::WriteToDatabase(int64_t index, Range* range,
-                                 const vector<AsyncLogClient::Entry>* retval,
-                                 Task* range_task, Task* fetch_task) {
+void FetchState::FetchDone(int64_t index, Range* range,
+                           const vector<AsyncLogClient::Entry>* retval,
+                           Task* range_task, Task* fetch_task) {
   if (!fetch_task->status().ok()) {
     LOG(INFO) << "error fetching entries at index " << index << ": "
               << fetch_task->status();
@@ -236,50 +398,59 @@ void FetchState::WriteToDatabase(int64_t index, Range* range,
   CHECK_GT(retval->size(), 0);
 
   VLOG(1) << "received " << retval->size() << " entries at offset " << index;
-  int64_t processed(0);
+  vector<LoggedCertificate> certs;
+  certs.reserve(retval->size());
   for (const auto& entry : *retval) {
-    LoggedCertificate cert;
-    if (!cert.CopyFromClientLogEntry(entry)) {
+    // Converted in place, rather than copied into |certs|.
+    certs.emplace_back();
+    LoggedCertificate* const cert(&certs.back());
+    if (!cert->CopyFromClientLogEntry(entry)) {
       LOG(WARNING) << "could not convert entry to a LoggedCertificate";
       num_invalid_entries_fetched->Increment("format");
+      certs.pop_back();
       break;
     }
     if (entry.sct) {
-      *cert.mutable_sct() = *entry.sct;
-      // If we have the full SCT (because this LogEntry came from another
-      // internal node which supports our private "give me the SCT too"
-      // option), then verify that the signature is good.
-      // TODO(pphaneuf): Note to self: util::Status this!
-      const LogVerifier::VerifyResult verify_result(
-          log_verifier_->VerifySignedCertificateTimestamp(
-              cert.contents().entry(), cert.sct()));
-      VLOG(1) << "SCT verify entry #" << index << ": "
-              << LogVerifier::VerifyResultString(verify_result);
-      if (verify_result != LogVerifier::VERIFY_OK) {
-        num_invalid_entries_fetched->Increment("sct_verify_failed");
-        const string msg("Failed to verify SCT signature for entry# " +
-                         to_string(index) + " : " +
-                         LogVerifier::VerifyResultString(verify_result));
-        LOG(WARNING) << msg;
-        task_->Return(Status(util::error::FAILED_PRECONDITION, msg));
-        return;
-      }
+      *cert->mutable_sct() = *entry.sct;
     }
-    cert.set_sequence_number(index++);
-    if (db_->CreateSequencedEntry(cert) == Database<LoggedCertificate>::OK) {
-      ++processed;
-    } else {
-      LOG(WARNING) << "could not insert entry into the database:\n"
-                   << cert.DebugString();
-      break;
+    cert->set_sequence_number(index + certs.size() - 1);
+  }
+
+  // If we have the full SCTs (because these entries came from another
+  // internal node which supports our private "give me the SCT too"
+  // option), then verify that the signatures are good. This is what
+  // takes the most time, so it's done in parallel.
+  // TODO(pphaneuf): Note to self: util::Status this!
+  vector<LogVerifier::VerifyResult> verify_results(certs.size(),
+                                                   LogVerifier::VERIFY_OK);
+  util::ParallelFor(
+      certs.size(), FLAGS_fetcher_sct_verification_parallelism,
+      task_->executor(), [this, retval, &certs, &verify_results](size_t i) {
+        if ((*retval)[i].sct) {
+          verify_results[i] = log_verifier_->VerifySignedCertificateTimestamp(
+              certs[i].contents().entry(), certs[i].sct());
+        }
+      });
+  for (size_t i = 0; i < certs.size(); ++i) {
+    if (verify_results[i] != LogVerifier::VERIFY_OK) {
+      num_invalid_entries_fetched->Increment("sct_verify_failed");
+      const string msg("Failed to verify SCT signature for entry# " +
+                       to_string(certs[i].sequence_number()) + " : " +
+                       LogVerifier::VerifyResultString(verify_results[i]));
+      LOG(WARNING) << msg;
+      task_->Return(Status(util::error::FAILED_PRECONDITION, msg));
+      range_task->Return(Status::CANCELLED);
+      return;
     }
   }
 
   {
     lock_guard<mutex> lock(lock_);
+    concurrency_.Fetched(retval->size());
     // TODO(pphaneuf): If we have problems fetching entries, to what
     // point should we retry? Or should we just return on the task
     // with an error?
+    const int64_t processed(certs.size());
     if (processed > 0) {
       // If we don't receive everything, split up the range.
       if (range->size_ > processed) {
@@ -288,21 +459,76 @@ void FetchState::WriteToDatabase(int64_t index, Range* range,
         range->size_ = processed;
       }
 
-      range->state_ = Range::HAVE;
+      range->state_ = Range::FETCHED;
+      range->fetched_ = move(certs);
     } else {
       range->state_ = Range::WANT;
     }
   }
 
-  if (static_cast<uint64_t>(processed) < retval->size()) {
-    // We couldn't insert everything that we received into the
-    // database, this is fairly serious, return an error for the
-    // overall operation and let the higher level deal with it.
-    task_->Return(Status(util::error::INTERNAL,
-                         "could not write some entries to the database"));
+  WriteFetched();
+  range_task->Return();
+}
+
+
+void FetchState::WriteFetched() {
+  unique_lock<mutex> lock(lock_);
+  if (writing_) {
+    return;
+  }
+  writing_ = true;
+
+  while (task_->IsActive()) {
+    vector<Range*> ranges;
+    vector<LoggedCertificate> batch;
+    for (Range* current = entries_.get(); current;
+         current = current->next_.get()) {
+      if (current->state_ != Range::FETCHED) {
+        continue;
+      }
+      current->state_ = Range::WRITING;
+      ranges.push_back(current);
+      if (batch.empty()) {
+        batch.swap(current->fetched_);
+      } else {
+        std::move(current->fetched_.begin(), current->fetched_.end(),
+                  std::back_inserter(batch));
+        current->fetched_.clear();
+      }
+    }
+    if (ranges.empty()) {
+      break;
+    }
+
+    lock.unlock();
+    vector<const LoggedCertificate*> logged;
+    logged.reserve(batch.size());
+    for (const auto& cert : batch) {
+      logged.push_back(&cert);
+    }
+    VLOG(1) << "writing " << batch.size() << " entries at offset "
+            << batch.front().sequence_number();
+    const Database<LoggedCertificate>::WriteResult result(
+        db_->CreateSequencedEntries(logged));
+    lock.lock();
+
+    for (Range* range : ranges) {
+      range->state_ =
+          result == Database<LoggedCertificate>::OK ? Range::HAVE : Range::WANT;
+    }
+    if (result != Database<LoggedCertificate>::OK) {
+      LOG(WARNING) << "could not insert entries into the database at offset "
+                   << batch.front().sequence_number() << ": " << result;
+      // We couldn't insert everything that we received into the
+      // database, this is fairly serious, return an error for the
+      // overall operation and let the higher level deal with it.
+      task_->Return(Status(util::error::INTERNAL,
+                           "could not write some entries to the database"));
+      break;
+    }
   }
 
-  range_task->Return();
+  writing_ = false;
 }
 
 
@@ -1,23 +1,39 @@
 #include "fetcher/peer_group.h"
 
+#include <algorithm>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
+using std::chrono::duration;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
 using std::lock_guard;
+using std::make_pair;
+using std::make_shared;
 using std::max;
 using std::mutex;
 using std::placeholders::_1;
 using std::shared_ptr;
+using std::unique_ptr;
 using std::vector;
 using util::Status;
 using util::Task;
 
+DEFINE_int32(peer_group_hedge_delay_ms, 0,
+             "if non-zero, fetches of entries from a peer that are not done "
+             "after this many milliseconds are also sent to another peer, "
+             "and the first to succeed is used");
+
 namespace cert_trans {
 
 namespace {
 
+// The weight of each new sample in the moving averages of PeerState.
+const double kDecay = 0.2;
+
 
-void GetEntriesDone(AsyncLogClient::Status client_status,
-                    const vector<AsyncLogClient::Entry>* entries, Task* task) {
+Status GetEntriesStatus(AsyncLogClient::Status client_status,
+                        const vector<AsyncLogClient::Entry>& entries) {
   Status status;
 
   switch (client_status) {
@@ -30,27 +46,130 @@ void GetEntriesDone(AsyncLogClient::Status client_status,
       status = util::Status::UNKNOWN;
   }
 
-  if (status.ok() && entries->empty()) {
+  if (status.ok() && entries.empty()) {
     // This should never happen.
     status =
         Status(util::error::INTERNAL, "log server did not return any entries");
   }
 
-  task->Return(status);
+  return status;
 }
 
 
 }  // namespace
 
 
+// A call to FetchEntries(), which is sent to one peer, or two when
+// hedged.
+struct PeerGroup::Fetch {
+  Fetch(PeerGroup* group, int64_t start_index, int64_t end_index,
+        vector<AsyncLogClient::Entry>* entries, Task* task)
+      : group(group),
+        fetch_scts(group->fetch_scts_),
+        start_index(start_index),
+        end_index(end_index),
+        entries(entries),
+        task(task),
+        done(false),
+        pending(0) {
+  }
+
+  // Only valid as long as |done| is false.
+  PeerGroup* const group;
+  const bool fetch_scts;
+  const int64_t start_index;
+  const int64_t end_index;
+  vector<AsyncLogClient::Entry>* const entries;
+  Task* const task;
+
+  mutex lock;
+  bool done;
+  int pending;
+  shared_ptr<Peer> first_peer;
+};
+
+
+struct PeerGroup::Attempt {
+  Attempt(const shared_ptr<Fetch>& fetch, const PeerAndState& peer)
+      : fetch(fetch), peer(peer), started(steady_clock::now()) {
+  }
+
+  const shared_ptr<Fetch> fetch;
+  // Keeps the peer alive for as long as its client is used.
+  const PeerAndState peer;
+  const steady_clock::time_point started;
+  vector<AsyncLogClient::Entry> entries;
+};
+
+
+PeerGroup::PeerState::PeerState()
+    : in_flight_(0), entries_per_second_(0), error_rate_(0), max_batch_(0) {
+}
+
+
+void PeerGroup::PeerState::Started() {
+  lock_guard<mutex> lock(lock_);
+  ++in_flight_;
+}
+
+
+void PeerGroup::PeerState::Finished(bool ok, int64_t num_entries,
+                                    int64_t num_requested,
+                                    const steady_clock::duration& elapsed) {
+  lock_guard<mutex> lock(lock_);
+  --in_flight_;
+  error_rate_ = (1 - kDecay) * error_rate_ + (ok ? 0 : kDecay);
+  if (ok) {
+    if (num_entries < num_requested) {
+      max_batch_ = num_entries;
+    } else if (max_batch_ > 0 && num_entries > max_batch_) {
+      // It returns more than it used to, maybe the cap was raised.
+      max_batch_ = num_entries;
+    }
+
+    const double rate(num_entries /
+                      max(duration<double>(elapsed).count(), 1e-3));
+    entries_per_second_ = entries_per_second_ > 0
+                              ? (1 - kDecay) * entries_per_second_ +
+                                    kDecay * rate
+                              : rate;
+  }
+}
+
+
+double PeerGroup::PeerState::Cost() const {
+  lock_guard<mutex> lock(lock_);
+  if (entries_per_second_ <= 0) {
+    // Untried peers count as fast, so that they get a chance.
+    return 0;
+  }
+  // The fetches share the peer, and the ones that fail have to be
+  // done again.
+  return (in_flight_ + 1) / entries_per_second_ /
+         max(1 - error_rate_, 0.05);
+}
+
+
+int64_t PeerGroup::PeerState::MaxBatch() const {
+  lock_guard<mutex> lock(lock_);
+  return max_batch_;
+}
+
+
 PeerGroup::PeerGroup(bool fetch_scts) : fetch_scts_(fetch_scts) {
 }
 
 
 void PeerGroup::Add(const shared_ptr<Peer>& peer) {
+  Add(peer, make_shared<PeerState>());
+}
+
+
+void PeerGroup::Add(const shared_ptr<Peer>& peer,
+                    const shared_ptr<PeerState>& state) {
   lock_guard<mutex> lock(lock_);
 
-  CHECK(peers_.emplace(peer, PeerState()).second);
+  CHECK(peers_.emplace(peer, CHECK_NOTNULL(state)).second);
 }
 
 
@@ -66,55 +185,161 @@ int64_t PeerGroup::TreeSize() const {
 }
 
 
+int64_t PeerGroup::BatchSize(int64_t max_size) const {
+  lock_guard<mutex> lock(lock_);
+
+  int64_t batch_size(max_size);
+  for (const auto& peer : peers_) {
+    const int64_t max_batch(peer.second->MaxBatch());
+    if (max_batch > 0) {
+      batch_size = std::min(batch_size, max_batch);
+    }
+  }
+
+  return batch_size;
+}
+
+
 void PeerGroup::FetchEntries(int64_t start_index, int64_t end_index,
                              vector<AsyncLogClient::Entry>* entries,
                              Task* task) {
   CHECK_GE(start_index, 0);
   CHECK_GE(end_index, start_index);
 
-  const shared_ptr<Peer> peer(PickPeer(end_index + 1));
-  if (!peer) {
+  const PeerAndState peer(PickPeer(end_index + 1, nullptr));
+  if (!peer.first) {
     task->Return(Status(util::error::UNAVAILABLE,
                         "requested entries not available in the peer group"));
     return;
   }
 
+  const shared_ptr<Fetch> fetch(make_shared<Fetch>(
+      this, start_index, end_index, CHECK_NOTNULL(entries), task));
+  fetch->pending = 1;
+  fetch->first_peer = peer.first;
+  if (FLAGS_peer_group_hedge_delay_ms > 0) {
+    task->executor()->Delay(milliseconds(FLAGS_peer_group_hedge_delay_ms),
+                            new Task(bind(&PeerGroup::MaybeHedge, fetch, _1),
+                                     task->executor()));
+  }
+  StartAttempt(fetch, peer);
+}
+
+
+// static
+void PeerGroup::StartAttempt(const shared_ptr<Fetch>& fetch,
+                             const PeerAndState& peer) {
+  const shared_ptr<Attempt> attempt(make_shared<Attempt>(fetch, peer));
+  peer.second->Started();
+
   // TODO(pphaneuf): Handle the case where we have no peer more cleanly.
-  if (fetch_scts_) {
-    peer->client().GetEntriesAndSCTs(start_index, end_index,
-                                     CHECK_NOTNULL(entries),
-                                     bind(GetEntriesDone, _1, entries, task));
+  if (fetch->fetch_scts) {
+    peer.first->client().GetEntriesAndSCTs(
+        fetch->start_index, fetch->end_index, &attempt->entries,
+        bind(&PeerGroup::AttemptDone, attempt, _1));
   } else {
-    peer->client().GetEntries(start_index, end_index, CHECK_NOTNULL(entries),
-                              bind(GetEntriesDone, _1, entries, task));
+    peer.first->client().GetEntries(fetch->start_index, fetch->end_index,
+                                    &attempt->entries,
+                                    bind(&PeerGroup::AttemptDone, attempt,
+                                         _1));
+  }
+}
+
+
+// static
+void PeerGroup::AttemptDone(const shared_ptr<Attempt>& attempt,
+                            AsyncLogClient::Status client_status) {
+  const Status status(GetEntriesStatus(client_status, attempt->entries));
+  Fetch* const fetch(attempt->fetch.get());
+  // A reply is only short because of a cap if the peer had the entries.
+  const int64_t num_requested(
+      std::min(fetch->end_index + 1, attempt->peer.first->TreeSize()) -
+      fetch->start_index);
+  attempt->peer.second->Finished(status.ok(), attempt->entries.size(),
+                                 num_requested,
+                                 steady_clock::now() - attempt->started);
+
+  {
+    lock_guard<mutex> lock(fetch->lock);
+    --fetch->pending;
+    // If the other attempt is still going, it might do better.
+    if (fetch->done || (!status.ok() && fetch->pending > 0)) {
+      return;
+    }
+    fetch->done = true;
   }
+
+  fetch->entries->swap(attempt->entries);
+  fetch->task->Return(status);
 }
 
 
-shared_ptr<Peer> PeerGroup::PickPeer(const int64_t needed_size) const {
+// static
+void PeerGroup::MaybeHedge(const shared_ptr<Fetch>& fetch, Task* timer) {
+  unique_ptr<Task> timer_deleter(timer);
+  if (!timer->status().ok()) {
+    return;
+  }
+
+  PeerAndState peer;
+  {
+    // Holding the lock keeps the fetch from being done, and so the
+    // group alive.
+    lock_guard<mutex> lock(fetch->lock);
+    if (fetch->done) {
+      return;
+    }
+    peer = fetch->group->PickPeer(fetch->end_index + 1, fetch->first_peer);
+    if (!peer.first || peer.first == fetch->first_peer) {
+      return;
+    }
+    ++fetch->pending;
+  }
+
+  VLOG(1) << "hedging the fetch of entries " << fetch->start_index << " to "
+          << fetch->end_index;
+  StartAttempt(fetch, peer);
+}
+
+
+PeerGroup::PeerAndState PeerGroup::PickPeer(
+    const int64_t needed_size, const shared_ptr<Peer>& exclude) const {
   lock_guard<mutex> lock(lock_);
 
-  // TODO(pphaneuf): We should pick peers a bit more cleverly, to
-  // spread the load somewhat.
   int64_t group_tree_size(-1);
-  vector<shared_ptr<Peer>> capable_peers;
+  vector<PeerAndState> capable_peers;
+  bool excluded(false);
   for (const auto& peer : peers_) {
     const int64_t tree_size(peer.first->TreeSize());
     group_tree_size = max(group_tree_size, tree_size);
     if (tree_size >= needed_size) {
-      capable_peers.push_back(peer.first);
+      if (peer.first == exclude) {
+        excluded = true;
+      } else {
+        capable_peers.push_back(peer);
+      }
     }
   }
 
+  if (capable_peers.empty() && excluded) {
+    return make_pair(exclude, peers_.at(exclude));
+  }
+
   if (!capable_peers.empty()) {
-    return capable_peers[std::rand() % capable_peers.size()];
+    // Of two peers picked at random, the one expected to be done
+    // first, which spreads the load while favouring the fast ones.
+    const PeerAndState& first(
+        capable_peers[std::rand() % capable_peers.size()]);
+    const PeerAndState& second(
+        capable_peers[std::rand() % capable_peers.size()]);
+    return second.second->Cost() < first.second->Cost() ? second : first;
   }
 
   LOG(INFO) << "requested a peer with " << needed_size
             << " entries but the peer group only has " << group_tree_size
             << " entries";
 
-  return nullptr;
+  return PeerAndState();
 }
 
 
@@ -1,6 +1,8 @@
 #ifndef CERT_TRANS_FETCHER_PEER_GROUP_H_
 #define CERT_TRANS_FETCHER_PEER_GROUP_H_
 
+#include <chrono>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <set>
@@ -20,6 +22,11 @@ namespace cert_trans {
 // errors will be retried, and unhealthy peers will be dropped (so the
 // available tree size can get smaller).
 // TODO(pphaneuf): Make that last sentence true!
+//
+// Each fetch goes to the peer expected to be done with it first, out
+// of two picked at random among those that have the entries, from
+// their recent throughput, error rate and number of fetches in
+// flight. Fetches that take too long can be hedged to a second peer.
 class PeerGroup {
  public:
   explicit PeerGroup(bool fetch_scts_);
@@ -30,21 +37,75 @@ class PeerGroup {
   // Returns the highest tree size of the peer group.
   int64_t TreeSize() const;
 
+  // Returns |max_size|, or less if some peers were seen to return no
+  // more than that many entries at a time, so that the fetches are
+  // not cut short.
+  int64_t BatchSize(int64_t max_size) const;
+
   void FetchEntries(int64_t start_offset, int64_t end_offset,
                     std::vector<AsyncLogClient::Entry>* entries,
                     util::Task* task);
 
- private:
-  struct PeerState {
-    // TODO(pphaneuf): Keep a count of errors here, to prune away
-    // unhealthy peers.
+  // This is thread-safe, and shared with the fetches in flight, which
+  // can outlive the group when they were hedged.
+  class PeerState {
+   public:
+    PeerState();
+
+    void Started();
+    // |num_entries| out of |num_requested|, which is short only if the
+    // peer caps its replies.
+    void Finished(bool ok, int64_t num_entries, int64_t num_requested,
+                  const std::chrono::steady_clock::duration& elapsed);
+
+    // The expected time for another fetch to be done, in seconds per
+    // entry, or zero if no fetch is done yet.
+    double Cost() const;
+
+    // The most entries the peer was seen to return at once, or zero if
+    // it returned all that was asked so far.
+    int64_t MaxBatch() const;
+
+   private:
+    mutable std::mutex lock_;
+    int in_flight_;
+    // Moving averages, of the entries per second of the fetches that
+    // succeeded, and of the fraction of the fetches that failed.
+    double entries_per_second_;
+    double error_rate_;
+    int64_t max_batch_;
+
+    DISALLOW_COPY_AND_ASSIGN(PeerState);
   };
 
-  std::shared_ptr<Peer> PickPeer(const int64_t needed_size) const;
+  typedef std::pair<std::shared_ptr<Peer>, std::shared_ptr<PeerState>>
+      PeerAndState;
+
+  // As Add(), but with |state| carried over from an earlier group, so
+  // that what was learnt of the peer is not lost between fetches.
+  void Add(const std::shared_ptr<Peer>& peer,
+           const std::shared_ptr<PeerState>& state);
+
+ private:
+  struct Attempt;
+  struct Fetch;
+
+  // Returns a peer with at least |needed_size| entries, other than
+  // |exclude| (which can be null) if there is another.
+  PeerAndState PickPeer(const int64_t needed_size,
+                        const std::shared_ptr<Peer>& exclude) const;
+  // These are static, as the group might be gone by the time they
+  // run, if the fetch is done.
+  static void StartAttempt(const std::shared_ptr<Fetch>& fetch,
+                           const PeerAndState& peer);
+  static void AttemptDone(const std::shared_ptr<Attempt>& attempt,
+                          AsyncLogClient::Status client_status);
+  static void MaybeHedge(const std::shared_ptr<Fetch>& fetch,
+                         util::Task* timer);
 
   mutable std::mutex lock_;
   const bool fetch_scts_;
-  std::map<std::shared_ptr<Peer>, PeerState> peers_;
+  std::map<std::shared_ptr<Peer>, std::shared_ptr<PeerState>> peers_;
 
   DISALLOW_COPY_AND_ASSIGN(PeerGroup);
 };
@@ -100,7 +100,7 @@ class RemotePeerTest : public ::testing::Test {
         tree_signer_(std::chrono::duration<double>(0), test_db_.db(),
                      unique_ptr<CompactMerkleTree>(
                          new CompactMerkleTree(new Sha256Hasher)),
-                     &store_, TestSigner::DefaultLogSigner()),
+                     &store_, TestSigner::DefaultLogSigner(), &pool_),
         task_(&pool_) {
     FLAGS_remote_peer_sth_refresh_interval_seconds = 1;
     StoreInitialSthMetricValues();
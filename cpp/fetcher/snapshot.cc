@@ -0,0 +1,275 @@
+#include "fetcher/snapshot.h"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/notification.h"
+#include "log/log_verifier.h"
+#include "merkletree/compact_merkle_tree.h"
+#include "merkletree/digest.h"
+#include "merkletree/incremental_merkle_verifier.h"
+#include "merkletree/serial_hasher.h"
+#include "monitoring/monitoring.h"
+#include "util/parallel_for.h"
+#include "util/util.h"
+
+using ct::SignedTreeHead;
+using std::string;
+using std::to_string;
+using std::unique_ptr;
+using std::vector;
+using util::Status;
+
+DECLARE_int32(fetcher_sct_verification_parallelism);
+
+namespace cert_trans {
+namespace {
+
+
+// Enough for the subtrees of the proofs of a few thousand batches.
+const size_t kMaxCachedSubtrees = 1 << 16;
+
+
+static Gauge<>* snapshot_imported_entries(
+    Gauge<>::New("snapshot_imported_entries",
+                 "Number of entries imported from a snapshot so far."));
+
+
+Status GetSnapshot(AsyncLogClient* client, int64_t start, SignedTreeHead* sth,
+                   vector<string>* entries) {
+  Notification done;
+  AsyncLogClient::Status client_status;
+  client->GetSnapshot(start, sth, entries,
+                      [&done, &client_status](AsyncLogClient::Status status) {
+                        client_status = status;
+                        done.Notify();
+                      });
+  done.WaitForNotification();
+
+  if (client_status != AsyncLogClient::OK) {
+    return Status(util::error::UNAVAILABLE,
+                  "get-snapshot failed from entry " + to_string(start));
+  }
+  return Status::OK;
+}
+
+
+// Checks that |tree| is the start of the tree of |sth|. Returns
+// |mismatch_code| if it isn't. The root of |sth| must be in the history
+// of |verifier|, so that the proofs for successive prefixes all link to
+// it, and share the subtrees already checked.
+Status CheckTreePrefix(AsyncLogClient* client,
+                       IncrementalMerkleVerifier* verifier,
+                       const SignedTreeHead& sth, CompactMerkleTree* tree,
+                       util::error::Code mismatch_code) {
+  const int64_t size(tree->LeafCount());
+  CHECK_LE(size, sth.tree_size());
+  if (size == 0) {
+    return Status::OK;
+  }
+
+  bool consistent;
+  if (size == sth.tree_size()) {
+    consistent = tree->CurrentRoot() == sth.sha256_root_hash();
+  } else {
+    Notification done;
+    AsyncLogClient::Status client_status;
+    vector<string> proof;
+    client->GetSTHConsistency(size, sth.tree_size(), &proof,
+                              [&done, &client_status](
+                                  AsyncLogClient::Status status) {
+                                client_status = status;
+                                done.Notify();
+                              });
+    done.WaitForNotification();
+    if (client_status != AsyncLogClient::OK) {
+      return Status(util::error::UNAVAILABLE,
+                    "get-sth-consistency failed from " + to_string(size) +
+                        " to " + to_string(sth.tree_size()));
+    }
+
+    vector<Digest> proof_digests;
+    for (const auto& node : proof) {
+      if (node.size() != Digest::kSize) {
+        return Status(mismatch_code, "consistency proof from " +
+                                         to_string(size) +
+                                         " has a node of the wrong size");
+      }
+      proof_digests.emplace_back(node);
+    }
+    consistent = verifier->VerifyConsistency(
+        size, sth.tree_size(), Digest(tree->CurrentRoot()),
+        Digest(sth.sha256_root_hash()), proof_digests);
+  }
+
+  if (!consistent) {
+    return Status(mismatch_code, "tree of the first " + to_string(size) +
+                                     " entries, with root " +
+                                     util::HexString(tree->CurrentRoot()) +
+                                     ", is not part of the tree head");
+  }
+  return Status::OK;
+}
+
+
+}  // namespace
+
+
+Status ImportSnapshot(AsyncLogClient* client, const LogVerifier* verifier,
+                      util::Executor* executor,
+                      Database<LoggedCertificate>* db) {
+  CHECK_NOTNULL(client);
+  CHECK_NOTNULL(verifier);
+  CHECK_NOTNULL(db);
+
+  SignedTreeHead sth;
+  vector<string> entries;
+  int64_t start(db->TreeSize());
+  Status status(GetSnapshot(client, start, &sth, &entries));
+  if (!status.ok()) {
+    return status;
+  }
+  const LogVerifier::VerifyResult verify_result(
+      verifier->VerifySignedTreeHead(sth));
+  if (verify_result != LogVerifier::VERIFY_OK) {
+    return Status(util::error::FAILED_PRECONDITION,
+                  "snapshot tree head did not verify: " +
+                      LogVerifier::VerifyResultString(verify_result));
+  }
+  if (sth.sha256_root_hash().size() != Digest::kSize) {
+    return Status(util::error::FAILED_PRECONDITION,
+                  "snapshot tree head has a root of the wrong size");
+  }
+  // The entries are only written once they have been checked against
+  // a tree head, so those already there are good.
+  if (start >= sth.tree_size()) {
+    LOG(INFO) << "Database already has the " << sth.tree_size()
+              << " entries of the snapshot";
+    return Status::OK;
+  }
+  LOG(INFO) << "Importing entries " << start << " to " << sth.tree_size() - 1
+            << " from a snapshot";
+
+  IncrementalMerkleVerifier consistency(new Sha256Hasher,
+                                        kMaxCachedSubtrees);
+  CHECK(consistency.TrustRoot(sth.tree_size(),
+                              Digest(sth.sha256_root_hash())));
+
+  CompactMerkleTree tree(new Sha256Hasher);
+  {
+    unique_ptr<Database<LoggedCertificate>::LeafHashIterator> it(
+        db->ScanLeafHashes(0));
+    Database<LoggedCertificate>::LeafHash leaf_hash;
+    while (static_cast<int64_t>(tree.LeafCount()) < start) {
+      if (!it->GetNextLeafHash(&leaf_hash) ||
+          leaf_hash.sequence_number !=
+              static_cast<int64_t>(tree.LeafCount())) {
+        return Status(util::error::DATA_LOSS,
+                      "database is missing entry " +
+                          to_string(tree.LeafCount()) + " of " +
+                          to_string(start));
+      }
+      tree.AddLeafHash(leaf_hash.hash);
+    }
+  }
+  // Those of another log, or of an earlier import from a bad peer.
+  status = CheckTreePrefix(client, &consistency, sth, &tree,
+                           util::error::DATA_LOSS);
+  if (!status.ok()) {
+    return status;
+  }
+
+  while (true) {
+    // The later replies can have a newer tree head, but the entries
+    // of the first one don't change.
+    const int64_t end(std::min<int64_t>(start + entries.size(),
+                                        sth.tree_size()));
+    if (end <= start) {
+      return Status(util::error::UNAVAILABLE,
+                    "snapshot has no entry " + to_string(start));
+    }
+
+    vector<LoggedCertificate> batch(end - start);
+    for (size_t i = 0; i < batch.size(); ++i) {
+      LoggedCertificate* const logged(&batch[i]);
+      if (!logged->ParseFromDatabase(entries[i])) {
+        return Status(util::error::INVALID_ARGUMENT,
+                      "could not parse snapshot entry " +
+                          to_string(start + i));
+      }
+      logged->set_sequence_number(start + i);
+      // Whatever the peer had stored, the hash is of what it sent.
+      if (!logged->ComputeMerkleLeafHash()) {
+        return Status(util::error::INVALID_ARGUMENT,
+                      "could not hash snapshot entry " +
+                          to_string(start + i));
+      }
+    }
+
+    // As when fetching entries with their SCTs.
+    vector<LogVerifier::VerifyResult> verify_results(batch.size(),
+                                                     LogVerifier::VERIFY_OK);
+    util::ParallelFor(batch.size(),
+                      FLAGS_fetcher_sct_verification_parallelism, executor,
+                      [verifier, &batch, &verify_results](size_t i) {
+                        verify_results[i] =
+                            verifier->VerifySignedCertificateTimestamp(
+                                batch[i].entry(), batch[i].sct());
+                      });
+    for (size_t i = 0; i < batch.size(); ++i) {
+      if (verify_results[i] != LogVerifier::VERIFY_OK) {
+        return Status(util::error::FAILED_PRECONDITION,
+                      "SCT of snapshot entry " + to_string(start + i) +
+                          " did not verify: " +
+                          LogVerifier::VerifyResultString(verify_results[i]));
+      }
+    }
+
+    // Nothing is written before it is known to be in the tree head.
+    for (const auto& logged : batch) {
+      tree.AddLeafHash(logged.merkle_leaf_hash());
+    }
+    status = CheckTreePrefix(client, &consistency, sth, &tree,
+                             util::error::FAILED_PRECONDITION);
+    if (!status.ok()) {
+      return Status(status.CanonicalCode(),
+                    "snapshot entries " + to_string(start) + " to " +
+                        to_string(end - 1) + ": " + status.error_message());
+    }
+
+    vector<const LoggedCertificate*> to_write;
+    to_write.reserve(batch.size());
+    for (const auto& logged : batch) {
+      to_write.push_back(&logged);
+    }
+    const Database<LoggedCertificate>::WriteResult result(
+        db->CreateSequencedEntries(to_write));
+    if (result != Database<LoggedCertificate>::OK) {
+      return Status(util::error::INTERNAL,
+                    "failed to write snapshot entries from " +
+                        to_string(start) + ": " + to_string(result));
+    }
+    start = end;
+    snapshot_imported_entries->Set(start);
+    VLOG(1) << "Imported snapshot entries up to " << start;
+
+    if (start >= sth.tree_size()) {
+      break;
+    }
+    SignedTreeHead newer_sth;
+    entries.clear();
+    status = GetSnapshot(client, start, &newer_sth, &entries);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  LOG(INFO) << "Imported a snapshot of " << sth.tree_size() << " entries";
+  return Status::OK;
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,37 @@
+#ifndef CERT_TRANS_FETCHER_SNAPSHOT_H_
+#define CERT_TRANS_FETCHER_SNAPSHOT_H_
+
+#include "client/async_log_client.h"
+#include "log/database.h"
+#include "log/logged_certificate.h"
+#include "util/executor.h"
+#include "util/status.h"
+
+class LogVerifier;
+
+namespace cert_trans {
+
+
+// Bootstraps |db| from the get-snapshot replies of another node, which
+// carry its entries as stored, many at a time, rather than through
+// get-entries. Imports the entries from db->TreeSize() (so that an
+// interrupted import picks up where it stopped) up to the tree size of
+// the first tree head |client| returns, which has to verify with
+// |verifier|. Fetching entries as usual can then resume from there.
+//
+// Each batch of entries is only written once their SCTs verify (on
+// |executor|, if not null, as in the fetcher) and the tree up to them
+// is shown to be part of that tree head, with a consistency proof from
+// |client|. Returns FAILED_PRECONDITION if they aren't, leaving
+// |db| with the entries before them.
+//
+// Blocks until done. Returns DATA_LOSS if the entries |db| had before
+// are not part of that tree head: the database has to be started over.
+util::Status ImportSnapshot(AsyncLogClient* client,
+                            const LogVerifier* verifier,
+                            util::Executor* executor,
+                            Database<LoggedCertificate>* db);
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_FETCHER_SNAPSHOT_H_
@@ -0,0 +1,252 @@
+#include "fetcher/snapshot.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <inttypes.h>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "log/log_signer.h"
+#include "log/log_verifier.h"
+#include "log/sqlite_db.h"
+#include "log/test_db.h"
+#include "log/test_signer.h"
+#include "merkletree/merkle_tree.h"
+#include "merkletree/merkle_verifier.h"
+#include "merkletree/serial_hasher.h"
+#include "net/mock_url_fetcher.h"
+#include "proto/serializer.h"
+#include "util/json_wrapper.h"
+#include "util/status_test_util.h"
+#include "util/testing.h"
+#include "util/thread_pool.h"
+
+namespace cert_trans {
+namespace {
+
+using ct::SignedTreeHead;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using testing::_;
+using testing::Invoke;
+using util::Status;
+using util::Task;
+
+const char kLogUrl[] = "http://example.com";
+
+
+class SnapshotTest : public ::testing::Test {
+ protected:
+  SnapshotTest()
+      : client_(&pool_, &fetcher_, kLogUrl),
+        signer_(TestSigner::DefaultLogSigner()),
+        verifier_(TestSigner::DefaultLogSigVerifier(),
+                  new MerkleVerifier(new Sha256Hasher)),
+        tree_(new Sha256Hasher),
+        batch_size_(3) {
+    ON_CALL(fetcher_, Fetch(_, _, _))
+        .WillByDefault(Invoke(this, &SnapshotTest::Serve));
+  }
+
+  // Makes the entries of the log, and its tree head. Changing |log_|
+  // afterwards makes it serve entries which aren't those of the tree.
+  void MakeLog(int num_entries) {
+    for (int i = 0; i < num_entries; ++i) {
+      LoggedCertificate logged;
+      test_signer_.CreateUnique(&logged);
+      logged.set_sequence_number(i);
+      CHECK(logged.ComputeMerkleLeafHash());
+      tree_.AddLeafHash(logged.merkle_leaf_hash());
+      log_.push_back(logged);
+    }
+
+    sth_.set_version(ct::V1);
+    sth_.set_timestamp(1000);
+    sth_.set_tree_size(num_entries);
+    sth_.set_sha256_root_hash(tree_.CurrentRoot());
+    CHECK_EQ(LogSigner::OK, signer_->SignTreeHead(&sth_));
+  }
+
+  void Serve(const UrlFetcher::Request& req, UrlFetcher::Response* resp,
+             Task* task) {
+    if (req.url.Path() == "/ct/v1/get-sth-consistency") {
+      ServeConsistency(req, resp, task);
+    } else {
+      ServeSnapshot(req, resp, task);
+    }
+  }
+
+  // Replies to get-sth-consistency, from the tree of the entries as
+  // they were made.
+  void ServeConsistency(const UrlFetcher::Request& req,
+                        UrlFetcher::Response* resp, Task* task) {
+    int64_t first, second;
+    CHECK_EQ(2, sscanf(req.url.Query().c_str(), "first=%" SCNd64
+                                                "&second=%" SCNd64,
+                       &first, &second));
+    JsonArray proof;
+    for (const auto& node : tree_.SnapshotConsistency(first, second)) {
+      proof.AddBase64(node);
+    }
+    JsonObject json;
+    json.Add("consistency", proof);
+
+    resp->status_code = 200;
+    resp->body = json.ToString();
+    task->Return();
+  }
+
+  // Replies to get-snapshot with up to |batch_size_| entries.
+  void ServeSnapshot(const UrlFetcher::Request& req,
+                     UrlFetcher::Response* resp, Task* task) {
+    CHECK_EQ("/ct/v1/get-snapshot", req.url.Path());
+    CHECK_EQ(0U, req.url.Query().find("start="));
+    const int64_t start(atoll(req.url.Query().c_str() + 6));
+
+    string signature;
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeDigitallySigned(sth_.signature(),
+                                                  &signature));
+    JsonObject json;
+    json.Add("tree_size", sth_.tree_size());
+    json.Add("timestamp", sth_.timestamp());
+    json.AddBase64("sha256_root_hash", sth_.sha256_root_hash());
+    json.AddBase64("tree_head_signature", signature);
+    JsonArray entries;
+    for (int64_t i = start;
+         i < start + batch_size_ && i < static_cast<int64_t>(log_.size());
+         ++i) {
+      string serialized;
+      CHECK(log_[i].SerializeForDatabase(&serialized));
+      entries.AddBase64(serialized);
+    }
+    json.Add("entries", entries);
+
+    resp->status_code = 200;
+    resp->body = json.ToString();
+    task->Return();
+  }
+
+  void ExpectImported() {
+    ASSERT_EQ(static_cast<int64_t>(log_.size()), db()->TreeSize());
+    for (const auto& expected : log_) {
+      LoggedCertificate logged;
+      ASSERT_EQ(Database<LoggedCertificate>::LOOKUP_OK,
+                db()->LookupByIndex(expected.sequence_number(), &logged));
+      EXPECT_EQ(expected.contents().DebugString(),
+                logged.contents().DebugString());
+    }
+  }
+
+  SQLiteDB<LoggedCertificate>* db() const {
+    return test_db_.db();
+  }
+
+  ThreadPool pool_;
+  testing::NiceMock<MockUrlFetcher> fetcher_;
+  AsyncLogClient client_;
+  TestDB<SQLiteDB<LoggedCertificate>> test_db_;
+  TestSigner test_signer_;
+  const unique_ptr<LogSigner> signer_;
+  LogVerifier verifier_;
+  vector<LoggedCertificate> log_;
+  MerkleTree tree_;
+  SignedTreeHead sth_;
+  int batch_size_;
+};
+
+
+TEST_F(SnapshotTest, ImportsAllEntriesInBatches) {
+  MakeLog(8);
+  // Three batches, the first two checked with a consistency proof.
+  EXPECT_CALL(fetcher_, Fetch(_, _, _)).Times(5);
+
+  EXPECT_OK(ImportSnapshot(&client_, &verifier_, &pool_, db()));
+  ExpectImported();
+}
+
+
+TEST_F(SnapshotTest, ResumesFromTheEntriesItHas) {
+  MakeLog(8);
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_EQ(Database<LoggedCertificate>::OK,
+              db()->CreateSequencedEntry(log_[i]));
+  }
+  // The entries it has, and the first batch, are checked with a
+  // consistency proof.
+  EXPECT_CALL(fetcher_, Fetch(_, _, _)).Times(4);
+
+  EXPECT_OK(ImportSnapshot(&client_, &verifier_, &pool_, db()));
+  ExpectImported();
+}
+
+
+TEST_F(SnapshotTest, RejectsEntriesNotInTheTreeHead) {
+  MakeLog(8);
+  // With a good SCT, but not the entry that was logged.
+  test_signer_.CreateUnique(&log_[1]);
+  log_[1].set_sequence_number(1);
+
+  EXPECT_EQ(util::error::FAILED_PRECONDITION,
+            ImportSnapshot(&client_, &verifier_, &pool_, db()).CanonicalCode());
+  EXPECT_EQ(0, db()->TreeSize());
+}
+
+
+TEST_F(SnapshotTest, OnlyWritesTheBatchesBeforeABadEntry) {
+  MakeLog(8);
+  test_signer_.CreateUnique(&log_[5]);
+  log_[5].set_sequence_number(5);
+
+  EXPECT_EQ(util::error::FAILED_PRECONDITION,
+            ImportSnapshot(&client_, &verifier_, &pool_, db()).CanonicalCode());
+  EXPECT_EQ(3, db()->TreeSize());
+}
+
+
+TEST_F(SnapshotTest, ChecksTheSCTs) {
+  MakeLog(8);
+  log_[1].mutable_sct()->set_timestamp(log_[1].sct().timestamp() + 1);
+
+  EXPECT_EQ(util::error::FAILED_PRECONDITION,
+            ImportSnapshot(&client_, &verifier_, &pool_, db()).CanonicalCode());
+  EXPECT_EQ(0, db()->TreeSize());
+}
+
+
+TEST_F(SnapshotTest, ChecksTheEntriesItHas) {
+  MakeLog(8);
+  LoggedCertificate other;
+  test_signer_.CreateUnique(&other);
+  other.set_sequence_number(0);
+  ASSERT_EQ(Database<LoggedCertificate>::OK,
+            db()->CreateSequencedEntry(other));
+
+  EXPECT_EQ(util::error::DATA_LOSS,
+            ImportSnapshot(&client_, &verifier_, &pool_, db()).CanonicalCode());
+  EXPECT_EQ(1, db()->TreeSize());
+}
+
+
+TEST_F(SnapshotTest, ChecksTheTreeHeadSignature) {
+  MakeLog(8);
+  sth_.set_tree_size(7);
+
+  EXPECT_EQ(util::error::FAILED_PRECONDITION,
+            ImportSnapshot(&client_, &verifier_, &pool_, db()).CanonicalCode());
+  EXPECT_EQ(0, db()->TreeSize());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
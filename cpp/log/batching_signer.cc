@@ -0,0 +1,182 @@
+#include "log/batching_signer.h"
+
+#include <glog/logging.h>
+
+#include "monitoring/monitoring.h"
+#include "util/status.h"
+#include "util/sync_task.h"
+#include "util/task.h"
+
+using std::bind;
+using std::lock_guard;
+using std::mutex;
+using std::placeholders::_1;
+using std::string;
+using std::unique_lock;
+using std::unique_ptr;
+using std::vector;
+using util::Status;
+using util::SyncTask;
+using util::Task;
+
+namespace cert_trans {
+namespace {
+
+
+static Counter<>* signer_backend_batches =
+    Counter<>::New("signer_backend_batches",
+                   "Number of batches of signatures sent to the signing "
+                   "backend.");
+
+static Counter<>* signer_backend_signatures =
+    Counter<>::New("signer_backend_signatures",
+                   "Number of signatures requested from the signing "
+                   "backend.");
+
+
+}  // namespace
+
+
+LocalSigningBackend::LocalSigningBackend(unique_ptr<Signer> signer)
+    : signer_(std::move(signer)) {
+  CHECK(signer_);
+  ct::DigitallySigned signature;
+  signer_->Sign("", &signature);
+  hash_algo_ = signature.hash_algorithm();
+  sig_algo_ = signature.sig_algorithm();
+}
+
+
+string LocalSigningBackend::KeyID() const {
+  return signer_->KeyID();
+}
+
+
+ct::DigitallySigned::HashAlgorithm LocalSigningBackend::HashAlgorithm()
+    const {
+  return hash_algo_;
+}
+
+
+ct::DigitallySigned::SignatureAlgorithm
+LocalSigningBackend::SignatureAlgorithm() const {
+  return sig_algo_;
+}
+
+
+void LocalSigningBackend::SignBatch(const vector<string>& data,
+                                    vector<string>* signatures, Task* task) {
+  CHECK_NOTNULL(signatures)->clear();
+  for (const auto& d : data) {
+    ct::DigitallySigned signature;
+    signer_->Sign(d, &signature);
+    signatures->emplace_back(signature.signature());
+  }
+  task->Return();
+}
+
+
+BatchingSigner::BatchingSigner(unique_ptr<SigningBackend> backend,
+                               size_t max_batch_size, size_t max_outstanding)
+    : backend_(std::move(backend)),
+      max_batch_size_(max_batch_size),
+      max_outstanding_(max_outstanding),
+      outstanding_(0),
+      pool_(1) {
+  CHECK(backend_);
+  CHECK_GT(max_batch_size_, 0U);
+  CHECK_GT(max_outstanding_, 0U);
+}
+
+
+BatchingSigner::~BatchingSigner() {
+  lock_guard<mutex> lock(lock_);
+  CHECK(queue_.empty());
+  CHECK_EQ(0U, outstanding_);
+}
+
+
+string BatchingSigner::KeyID() const {
+  return backend_->KeyID();
+}
+
+
+void BatchingSigner::Sign(const string& data,
+                          ct::DigitallySigned* signature) const {
+  SyncTask task(&pool_);
+  SignAsync(data, signature, task.task());
+  task.Wait();
+  // Signer::Sign() has no way to report errors.
+  CHECK_EQ(Status::OK, task.status());
+}
+
+
+void BatchingSigner::SignAsync(const string& data,
+                               ct::DigitallySigned* signature,
+                               Task* task) const {
+  CHECK_NOTNULL(signature);
+  CHECK_NOTNULL(task);
+  unique_lock<mutex> lock(lock_);
+  queue_.emplace_back(Request{data, signature, task});
+  MaybeSendBatch(&lock);
+}
+
+
+void BatchingSigner::MaybeSendBatch(unique_lock<mutex>* lock) const {
+  CHECK(lock->owns_lock());
+  if (queue_.empty() || outstanding_ >= max_outstanding_) {
+    return;
+  }
+
+  Batch* const batch(new Batch);
+  while (!queue_.empty() && batch->requests.size() < max_batch_size_) {
+    batch->data.emplace_back(std::move(queue_.front().data));
+    batch->requests.emplace_back(std::move(queue_.front()));
+    queue_.pop_front();
+  }
+  ++outstanding_;
+  lock->unlock();
+
+  signer_backend_batches->Increment();
+  signer_backend_signatures->IncrementBy(batch->requests.size());
+  backend_->SignBatch(batch->data, &batch->signatures,
+                      new Task(bind(&BatchingSigner::BatchDone, this, batch,
+                                    _1),
+                               &pool_));
+  lock->lock();
+}
+
+
+void BatchingSigner::BatchDone(Batch* batch, Task* task) const {
+  const unique_ptr<Batch> batch_deleter(batch);
+  const unique_ptr<Task> task_deleter(task);
+
+  Status status(task->status());
+  if (status.ok() && batch->signatures.size() != batch->requests.size()) {
+    status = Status(util::error::INTERNAL,
+                    "signing backend returned the wrong number of "
+                    "signatures");
+  }
+  if (status.ok()) {
+    for (size_t i = 0; i < batch->requests.size(); ++i) {
+      ct::DigitallySigned* const signature(batch->requests[i].signature);
+      signature->set_hash_algorithm(backend_->HashAlgorithm());
+      signature->set_sig_algorithm(backend_->SignatureAlgorithm());
+      signature->set_signature(std::move(batch->signatures[i]));
+    }
+  }
+
+  {
+    unique_lock<mutex> lock(lock_);
+    --outstanding_;
+    MaybeSendBatch(&lock);
+  }
+
+  // Once the last request has returned, this object can be deleted.
+  for (const auto& request : batch->requests) {
+    request.task->Return(status);
+  }
+}
+
+
+}  // namespace cert_trans
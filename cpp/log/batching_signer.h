@@ -0,0 +1,130 @@
+#ifndef CERT_TRANS_LOG_BATCHING_SIGNER_H_
+#define CERT_TRANS_LOG_BATCHING_SIGNER_H_
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "log/signer.h"
+#include "proto/ct.pb.h"
+#include "util/thread_pool.h"
+
+namespace util {
+class Task;
+}  // namespace util
+
+namespace cert_trans {
+
+
+// Computes signatures with a key held elsewhere, typically in an HSM or
+// a remote KMS, where each call is expensive enough that signatures
+// should be requested in batches.
+class SigningBackend {
+ public:
+  virtual ~SigningBackend() = default;
+
+  virtual std::string KeyID() const = 0;
+  virtual ct::DigitallySigned::HashAlgorithm HashAlgorithm() const = 0;
+  virtual ct::DigitallySigned::SignatureAlgorithm SignatureAlgorithm()
+      const = 0;
+
+  // Signs each of |data|, putting the raw signatures in |signatures|,
+  // in the same order. Returns |task| once done.
+  virtual void SignBatch(const std::vector<std::string>& data,
+                         std::vector<std::string>* signatures,
+                         util::Task* task) = 0;
+
+ protected:
+  SigningBackend() = default;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(SigningBackend);
+};
+
+
+// Signs locally with |signer|, one signature at a time. Mostly useful
+// for testing.
+class LocalSigningBackend : public SigningBackend {
+ public:
+  explicit LocalSigningBackend(std::unique_ptr<Signer> signer);
+
+  std::string KeyID() const override;
+  ct::DigitallySigned::HashAlgorithm HashAlgorithm() const override;
+  ct::DigitallySigned::SignatureAlgorithm SignatureAlgorithm() const override;
+  void SignBatch(const std::vector<std::string>& data,
+                 std::vector<std::string>* signatures,
+                 util::Task* task) override;
+
+ private:
+  const std::unique_ptr<Signer> signer_;
+  ct::DigitallySigned::HashAlgorithm hash_algo_;
+  ct::DigitallySigned::SignatureAlgorithm sig_algo_;
+
+  DISALLOW_COPY_AND_ASSIGN(LocalSigningBackend);
+};
+
+
+// Signer sending the signature requests to a SigningBackend. While
+// |max_outstanding| batches are being signed, new requests are
+// queued, and the next batch takes up to |max_batch_size| of them at
+// once. Concurrent SCT and STH signatures are thus coalesced into few
+// backend calls.
+//
+// SignAsync() does not hold a thread while waiting for the backend,
+// Sign() blocks until the signature is done. The backend callbacks run
+// on a thread of the signer's own, so Sign() can be called from any
+// thread, those of a busy pool included, without waiting for one of
+// them to be free.
+class BatchingSigner : public Signer {
+ public:
+  BatchingSigner(std::unique_ptr<SigningBackend> backend,
+                 size_t max_batch_size, size_t max_outstanding);
+  // REQUIRES: there are no outstanding signature requests.
+  ~BatchingSigner() override;
+
+  std::string KeyID() const override;
+
+  void Sign(const std::string& data,
+            ct::DigitallySigned* signature) const override;
+
+  void SignAsync(const std::string& data, ct::DigitallySigned* signature,
+                 util::Task* task) const override;
+
+ private:
+  struct Request {
+    std::string data;
+    ct::DigitallySigned* signature;
+    util::Task* task;
+  };
+
+  struct Batch {
+    std::vector<Request> requests;
+    std::vector<std::string> data;
+    std::vector<std::string> signatures;
+  };
+
+  // REQUIRES: |lock| is held.
+  void MaybeSendBatch(std::unique_lock<std::mutex>* lock) const;
+  void BatchDone(Batch* batch, util::Task* task) const;
+
+  const std::unique_ptr<SigningBackend> backend_;
+  const size_t max_batch_size_;
+  const size_t max_outstanding_;
+
+  mutable std::mutex lock_;
+  mutable std::deque<Request> queue_;
+  mutable size_t outstanding_;
+
+  // Runs the backend callbacks, and whatever they send next.
+  mutable ThreadPool pool_;
+
+  DISALLOW_COPY_AND_ASSIGN(BatchingSigner);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_BATCHING_SIGNER_H_
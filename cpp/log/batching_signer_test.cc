@@ -0,0 +1,240 @@
+#include "log/batching_signer.h"
+
+#include <condition_variable>
+#include <gtest/gtest.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/notification.h"
+#include "log/test_signer.h"
+#include "log/verifier.h"
+#include "util/status_test_util.h"
+#include "util/sync_task.h"
+#include "util/testing.h"
+#include "util/thread_pool.h"
+
+namespace cert_trans {
+namespace {
+
+using ct::DigitallySigned;
+using std::condition_variable;
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::unique_lock;
+using std::unique_ptr;
+using std::vector;
+using util::Status;
+using util::SyncTask;
+using util::Task;
+
+
+// Holds on to the batches until the test completes them.
+class FakeSigningBackend : public SigningBackend {
+ public:
+  struct Batch {
+    vector<string> data;
+    vector<string>* signatures;
+    Task* task;
+  };
+
+  string KeyID() const override {
+    return "key";
+  }
+
+  DigitallySigned::HashAlgorithm HashAlgorithm() const override {
+    return DigitallySigned::SHA256;
+  }
+
+  DigitallySigned::SignatureAlgorithm SignatureAlgorithm() const override {
+    return DigitallySigned::ECDSA;
+  }
+
+  void SignBatch(const vector<string>& data, vector<string>* signatures,
+                 Task* task) override {
+    lock_guard<mutex> lock(lock_);
+    batches_.push_back(Batch{data, signatures, task});
+    cv_.notify_all();
+  }
+
+  // Waits for the next batch.
+  Batch NextBatch() {
+    unique_lock<mutex> lock(lock_);
+    cv_.wait(lock, [this]() { return !batches_.empty(); });
+    const Batch batch(batches_.front());
+    batches_.erase(batches_.begin());
+    return batch;
+  }
+
+  int NumWaitingBatches() {
+    lock_guard<mutex> lock(lock_);
+    return batches_.size();
+  }
+
+  static void Complete(const Batch& batch) {
+    for (const auto& d : batch.data) {
+      batch.signatures->emplace_back("signature of " + d);
+    }
+    batch.task->Return();
+  }
+
+ private:
+  mutex lock_;
+  condition_variable cv_;
+  vector<Batch> batches_;
+};
+
+
+class BatchingSignerTest : public ::testing::Test {
+ protected:
+  BatchingSignerTest() : pool_(2) {
+  }
+
+  ThreadPool pool_;
+};
+
+
+TEST_F(BatchingSignerTest, SignsWithLocalBackend) {
+  const unique_ptr<Verifier> verifier(TestSigner::DefaultVerifier());
+  BatchingSigner signer(
+      unique_ptr<SigningBackend>(new LocalSigningBackend(
+          unique_ptr<Signer>(TestSigner::DefaultSigner()))),
+      10, 1);
+  EXPECT_EQ(verifier->KeyID(), signer.KeyID());
+
+  DigitallySigned signature;
+  signer.Sign("data", &signature);
+  EXPECT_EQ(DigitallySigned::SHA256, signature.hash_algorithm());
+  EXPECT_EQ(DigitallySigned::ECDSA, signature.sig_algorithm());
+  EXPECT_EQ(Verifier::OK, verifier->Verify("data", signature));
+}
+
+
+TEST_F(BatchingSignerTest, ConcurrentSigners) {
+  const unique_ptr<Verifier> verifier(TestSigner::DefaultVerifier());
+  BatchingSigner signer(
+      unique_ptr<SigningBackend>(new LocalSigningBackend(
+          unique_ptr<Signer>(TestSigner::DefaultSigner()))),
+      4, 2);
+
+  const int kNumThreads(8);
+  const int kSignaturesPerThread(20);
+  vector<vector<DigitallySigned>> signatures(
+      kNumThreads, vector<DigitallySigned>(kSignaturesPerThread));
+  vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; ++t) {
+    threads.emplace_back([&signer, &signatures, t]() {
+      for (int i = 0; i < kSignaturesPerThread; ++i) {
+        signer.Sign(std::to_string(t) + "/" + std::to_string(i),
+                    &signatures[t][i]);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  for (int t = 0; t < kNumThreads; ++t) {
+    for (int i = 0; i < kSignaturesPerThread; ++i) {
+      EXPECT_EQ(Verifier::OK,
+                verifier->Verify(std::to_string(t) + "/" + std::to_string(i),
+                                 signatures[t][i]));
+    }
+  }
+}
+
+
+TEST_F(BatchingSignerTest, SignsFromABusyPool) {
+  FakeSigningBackend* const backend(new FakeSigningBackend);
+  BatchingSigner signer(unique_ptr<SigningBackend>(backend), 3, 1);
+
+  // Every thread of |pool_| blocks in Sign(), so the signatures must
+  // not need one of them to complete.
+  vector<DigitallySigned> signatures(2);
+  vector<unique_ptr<Notification>> done;
+  for (int i = 0; i < 2; ++i) {
+    done.emplace_back(new Notification);
+    Notification* const notification(done.back().get());
+    DigitallySigned* const signature(&signatures[i]);
+    pool_.Add([&signer, i, signature, notification]() {
+      signer.Sign("data" + std::to_string(i), signature);
+      notification->Notify();
+    });
+  }
+
+  int signed_requests(0);
+  while (signed_requests < 2) {
+    const FakeSigningBackend::Batch batch(backend->NextBatch());
+    signed_requests += batch.data.size();
+    FakeSigningBackend::Complete(batch);
+  }
+  for (int i = 0; i < 2; ++i) {
+    done[i]->WaitForNotification();
+    EXPECT_EQ("signature of data" + std::to_string(i),
+              signatures[i].signature());
+  }
+}
+
+
+TEST_F(BatchingSignerTest, CoalescesRequests) {
+  FakeSigningBackend* const backend(new FakeSigningBackend);
+  BatchingSigner signer(unique_ptr<SigningBackend>(backend), 3, 1);
+
+  vector<unique_ptr<SyncTask>> tasks;
+  vector<DigitallySigned> signatures(5);
+  for (int i = 0; i < 5; ++i) {
+    tasks.emplace_back(new SyncTask(&pool_));
+    signer.SignAsync("data" + std::to_string(i), &signatures[i],
+                     tasks.back()->task());
+  }
+
+  // The first request went out on its own, the others waited for it.
+  FakeSigningBackend::Batch batch(backend->NextBatch());
+  EXPECT_EQ(vector<string>({"data0"}), batch.data);
+  EXPECT_EQ(0, backend->NumWaitingBatches());
+  FakeSigningBackend::Complete(batch);
+
+  batch = backend->NextBatch();
+  EXPECT_EQ(vector<string>({"data1", "data2", "data3"}), batch.data);
+  FakeSigningBackend::Complete(batch);
+
+  batch = backend->NextBatch();
+  EXPECT_EQ(vector<string>({"data4"}), batch.data);
+  FakeSigningBackend::Complete(batch);
+
+  for (int i = 0; i < 5; ++i) {
+    tasks[i]->Wait();
+    EXPECT_OK(tasks[i]->status());
+    EXPECT_EQ("signature of data" + std::to_string(i),
+              signatures[i].signature());
+    EXPECT_EQ(DigitallySigned::ECDSA, signatures[i].sig_algorithm());
+  }
+}
+
+
+TEST_F(BatchingSignerTest, ReturnsBackendErrors) {
+  FakeSigningBackend* const backend(new FakeSigningBackend);
+  BatchingSigner signer(unique_ptr<SigningBackend>(backend), 3, 1);
+
+  DigitallySigned signature;
+  SyncTask task(&pool_);
+  signer.SignAsync("data", &signature, task.task());
+  backend->NextBatch().task->Return(
+      Status(util::error::UNAVAILABLE, "HSM unreachable"));
+  task.Wait();
+  EXPECT_EQ(util::error::UNAVAILABLE, task.status().CanonicalCode());
+  EXPECT_FALSE(signature.has_signature());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,285 @@
+#include "log/bloom_filter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <errno.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <memory>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace cert_trans {
+
+namespace {
+
+// Each layer has twice the capacity, and half the false positive
+// rate, of the previous one. The rates of all the layers then add up
+// to less than that of the whole filter.
+const int kGrowth = 2;
+const double kTightening = 0.5;
+
+// Size of the header length at the start of a saved filter.
+const size_t kLengthBytes = 4;
+
+
+util::Status ErrnoStatus(const string& what, const string& path) {
+  return util::Status(util::error::INTERNAL,
+                      what + " " + path + ": " + strerror(errno));
+}
+
+
+// Writes all of |size| bytes at |data| to |fd|, retrying short writes.
+bool WriteAll(int fd, const void* data, size_t size) {
+  const char* const bytes(static_cast<const char*>(data));
+  size_t written(0);
+  while (written < size) {
+    const ssize_t ret(write(fd, bytes + written, size - written));
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    written += ret;
+  }
+  return true;
+}
+
+
+void FileCloser(FILE* fp) {
+  if (fp) {
+    fclose(fp);
+  }
+}
+
+
+// The two hashes the bit indices are derived from (Kirsch and
+// Mitzenmacher's double hashing).
+void KeyHashes(const string& key, uint64_t* h1, uint64_t* h2) {
+  CHECK_GE(key.size(), 2 * sizeof(uint64_t)) << "key is not a digest";
+  memcpy(h1, key.data(), sizeof(*h1));
+  memcpy(h2, key.data() + sizeof(*h1), sizeof(*h2));
+}
+
+
+}  // namespace
+
+
+ScalableBloomFilter::Layer::Layer(int64_t capacity, double false_positive_rate)
+    : capacity(capacity),
+      num_hashes(std::max(1, static_cast<int>(
+                                 std::ceil(-std::log2(false_positive_rate))))),
+      num_bits(0),
+      count(0) {
+  // The optimal number of bits for that many hashes, rounded up to
+  // whole bytes.
+  const uint64_t bytes(static_cast<uint64_t>(
+      std::ceil(capacity * num_hashes / std::log(2.0) / 8)));
+  bits.resize(std::max<uint64_t>(1, bytes));
+  num_bits = bits.size() * 8;
+}
+
+
+ScalableBloomFilter::Layer::Layer(
+    const ct::BloomFilterCheckpointHeader::Layer& header)
+    : capacity(header.capacity()),
+      num_hashes(header.num_hashes()),
+      num_bits(header.num_bits()),
+      count(header.count()),
+      bits(num_bits / 8) {
+}
+
+
+bool ScalableBloomFilter::Layer::Test(uint64_t h1, uint64_t h2) const {
+  for (int i = 0; i < num_hashes; ++i) {
+    const uint64_t bit((h1 + i * h2) % num_bits);
+    if (!(bits[bit / 8] & (1 << (bit % 8)))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+void ScalableBloomFilter::Layer::Set(uint64_t h1, uint64_t h2) {
+  for (int i = 0; i < num_hashes; ++i) {
+    const uint64_t bit((h1 + i * h2) % num_bits);
+    bits[bit / 8] |= 1 << (bit % 8);
+  }
+  ++count;
+}
+
+
+ScalableBloomFilter::ScalableBloomFilter(int64_t initial_capacity,
+                                         double false_positive_rate)
+    : false_positive_rate_(false_positive_rate) {
+  CHECK_GT(initial_capacity, 0);
+  CHECK_GT(false_positive_rate_, 0);
+  CHECK_LT(false_positive_rate_, 1);
+  layers_.emplace_back(initial_capacity, false_positive_rate_ * kTightening);
+}
+
+
+void ScalableBloomFilter::Add(const string& key) {
+  uint64_t h1, h2;
+  KeyHashes(key, &h1, &h2);
+  for (const Layer& layer : layers_) {
+    if (layer.Test(h1, h2)) {
+      return;
+    }
+  }
+  if (layers_.back().count >= layers_.back().capacity) {
+    layers_.emplace_back(layers_.back().capacity * kGrowth,
+                         false_positive_rate_ *
+                             std::pow(kTightening, layers_.size() + 1));
+  }
+  layers_.back().Set(h1, h2);
+}
+
+
+bool ScalableBloomFilter::MayContain(const string& key) const {
+  uint64_t h1, h2;
+  KeyHashes(key, &h1, &h2);
+  for (const Layer& layer : layers_) {
+    if (layer.Test(h1, h2)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+int64_t ScalableBloomFilter::size() const {
+  int64_t size(0);
+  for (const Layer& layer : layers_) {
+    size += layer.count;
+  }
+  return size;
+}
+
+
+size_t ScalableBloomFilter::ByteSize() const {
+  size_t bytes(0);
+  for (const Layer& layer : layers_) {
+    bytes += layer.bits.size();
+  }
+  return bytes;
+}
+
+
+util::Status ScalableBloomFilter::Write(
+    const string& path, ct::BloomFilterCheckpointHeader* header) const {
+  CHECK_NOTNULL(header);
+  header->clear_layer();
+  for (const Layer& layer : layers_) {
+    ct::BloomFilterCheckpointHeader::Layer* const saved(header->add_layer());
+    saved->set_capacity(layer.capacity);
+    saved->set_num_hashes(layer.num_hashes);
+    saved->set_num_bits(layer.num_bits);
+    saved->set_count(layer.count);
+  }
+  string serialized;
+  CHECK(header->SerializeToString(&serialized));
+  const uint32_t length(serialized.size());
+  const unsigned char length_bytes[kLengthBytes] = {
+      static_cast<unsigned char>(length >> 24),
+      static_cast<unsigned char>(length >> 16),
+      static_cast<unsigned char>(length >> 8),
+      static_cast<unsigned char>(length)};
+
+  const string tmp_path(path + ".tmp");
+  const int fd(open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+  if (fd < 0) {
+    return ErrnoStatus("failed to open", tmp_path);
+  }
+  bool ok(WriteAll(fd, length_bytes, kLengthBytes) &&
+          WriteAll(fd, serialized.data(), serialized.size()));
+  for (size_t i = 0; ok && i < layers_.size(); ++i) {
+    ok = WriteAll(fd, layers_[i].bits.data(), layers_[i].bits.size());
+  }
+  ok = ok && fsync(fd) == 0;
+  if (!ok) {
+    const util::Status status(ErrnoStatus("failed to write", tmp_path));
+    close(fd);
+    return status;
+  }
+  CHECK_ERR(close(fd));
+  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+    return ErrnoStatus("failed to rename " + tmp_path + " to", path);
+  }
+  return util::Status::OK;
+}
+
+
+util::Status ScalableBloomFilter::Read(
+    const string& path, ct::BloomFilterCheckpointHeader* header) {
+  CHECK_NOTNULL(header);
+  unique_ptr<FILE, void (*)(FILE*)> fp(fopen(path.c_str(), "rb"),
+                                       FileCloser);
+  if (!fp) {
+    if (errno == ENOENT) {
+      return util::Status(util::error::NOT_FOUND,
+                          "no Bloom filter at " + path);
+    }
+    return ErrnoStatus("failed to open", path);
+  }
+  struct stat st;
+  if (fstat(fileno(fp.get()), &st) != 0) {
+    return ErrnoStatus("failed to stat", path);
+  }
+  const uint64_t file_size(st.st_size);
+  const util::Status corrupt(util::error::DATA_LOSS,
+                             "corrupt Bloom filter in " + path);
+
+  unsigned char length_bytes[kLengthBytes];
+  if (fread(length_bytes, 1, kLengthBytes, fp.get()) != kLengthBytes) {
+    return corrupt;
+  }
+  const uint32_t length((length_bytes[0] << 24) | (length_bytes[1] << 16) |
+                        (length_bytes[2] << 8) | length_bytes[3]);
+  if (kLengthBytes + length > file_size) {
+    return corrupt;
+  }
+  string serialized(length, '\0');
+  if (fread(&serialized[0], 1, length, fp.get()) != length ||
+      !header->ParseFromString(serialized) || header->layer_size() == 0) {
+    return corrupt;
+  }
+
+  // Check that the bits are all there before allocating them.
+  uint64_t bytes(0);
+  for (const auto& saved : header->layer()) {
+    if (saved.capacity() <= 0 || saved.num_hashes() <= 0 ||
+        saved.num_bits() <= 0 || saved.num_bits() % 8 != 0 ||
+        saved.count() < 0) {
+      return corrupt;
+    }
+    bytes += saved.num_bits() / 8;
+  }
+  if (file_size != kLengthBytes + length + bytes) {
+    return corrupt;
+  }
+
+  vector<Layer> layers;
+  for (const auto& saved : header->layer()) {
+    layers.emplace_back(saved);
+    Layer* const layer(&layers.back());
+    if (fread(layer->bits.data(), 1, layer->bits.size(), fp.get()) !=
+        layer->bits.size()) {
+      return corrupt;
+    }
+  }
+
+  layers_.swap(layers);
+  return util::Status::OK;
+}
+
+
+}  // namespace cert_trans
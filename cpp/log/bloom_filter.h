@@ -0,0 +1,74 @@
+#ifndef CERT_TRANS_LOG_BLOOM_FILTER_H_
+#define CERT_TRANS_LOG_BLOOM_FILTER_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "proto/ct.pb.h"
+#include "util/status.h"
+
+namespace cert_trans {
+
+
+// A scalable Bloom filter (Almeida et al., "Scalable Bloom Filters",
+// 2007): a chain of plain Bloom filters, each twice the capacity of
+// the previous one and with half its false positive rate, a new one
+// being started whenever the last one is full. This way, the filter
+// grows with the number of keys added, while the overall false
+// positive rate stays under the one it was created with.
+//
+// The keys must be cryptographic digests (at least 16 bytes), as
+// their bytes are used as the hashes directly.
+//
+// This class is thread-compatible, but not thread-safe.
+class ScalableBloomFilter {
+ public:
+  ScalableBloomFilter(int64_t initial_capacity, double false_positive_rate);
+
+  void Add(const std::string& key);
+
+  // False if |key| was definitely never added, true if it probably
+  // was.
+  bool MayContain(const std::string& key) const;
+
+  // The number of distinct keys added (approximately, as keys that
+  // were false positives when added are not counted).
+  int64_t size() const;
+
+  // The memory used by the bits of the filter.
+  size_t ByteSize() const;
+
+  // Replaces the file at |path| with the filter, preceded by |header|,
+  // in which the layers are filled in.
+  util::Status Write(const std::string& path,
+                     ct::BloomFilterCheckpointHeader* header) const;
+
+  // Replaces the filter with the one saved at |path|, and fills in
+  // |header|. Returns NOT_FOUND if there is no such file.
+  util::Status Read(const std::string& path,
+                    ct::BloomFilterCheckpointHeader* header);
+
+ private:
+  struct Layer {
+    Layer(int64_t capacity, double false_positive_rate);
+    explicit Layer(const ct::BloomFilterCheckpointHeader::Layer& header);
+
+    bool Test(uint64_t h1, uint64_t h2) const;
+    void Set(uint64_t h1, uint64_t h2);
+
+    int64_t capacity;
+    int num_hashes;
+    uint64_t num_bits;
+    int64_t count;
+    std::vector<uint8_t> bits;
+  };
+
+  double false_positive_rate_;
+  std::vector<Layer> layers_;
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_BLOOM_FILTER_H_
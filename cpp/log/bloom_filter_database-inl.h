@@ -0,0 +1,291 @@
+#ifndef CERT_TRANS_LOG_BLOOM_FILTER_DATABASE_INL_H_
+#define CERT_TRANS_LOG_BLOOM_FILTER_DATABASE_INL_H_
+
+#include "log/bloom_filter_database.h"
+
+#include <glog/logging.h>
+
+#include "monitoring/monitoring.h"
+
+namespace cert_trans {
+namespace {
+
+
+static Counter<std::string>* bloom_filter_database_lookups(
+    Counter<std::string>::New("bloom_filter_database_lookups", "result",
+                              "Number of lookups by hash through the Bloom "
+                              "filter, by result (\"absent\" if answered "
+                              "from the filter, otherwise \"found\" or "
+                              "\"false_positive\")."));
+
+static Gauge<>* bloom_filter_database_bytes(
+    Gauge<>::New("bloom_filter_database_bytes",
+                 "Memory used by the Bloom filter of the entry hashes."));
+
+
+}  // namespace
+
+
+template <class Logged>
+BloomFilterDatabase<Logged>::BloomFilterDatabase(
+    Database<Logged>* db, int64_t initial_capacity, double false_positive_rate,
+    const std::string& checkpoint_path, int64_t checkpoint_interval)
+    : db_(CHECK_NOTNULL(db)),
+      checkpoint_path_(checkpoint_path),
+      checkpoint_interval_(checkpoint_interval),
+      filter_(initial_capacity, false_positive_rate),
+      checkpoint_tree_size_(0) {
+  CHECK_GT(checkpoint_interval_, 0);
+  const int64_t start(LoadCheckpoint());
+  checkpoint_tree_size_.store(start);
+
+  int64_t added(0);
+  const std::unique_ptr<typename Database<Logged>::Iterator> it(
+      db_->ScanEntries(start));
+  // Reused for each entry, to save on allocations.
+  Logged logged;
+  while (it->GetNextEntry(&logged)) {
+    filter_.Add(logged.Hash());
+    ++added;
+  }
+  bloom_filter_database_bytes->Set(filter_.ByteSize());
+  LOG(INFO) << "Added " << added << " entries past " << start
+            << " to the Bloom filter, which now holds " << filter_.size()
+            << " hashes in " << filter_.ByteSize() << " bytes";
+}
+
+
+template <class Logged>
+int64_t BloomFilterDatabase<Logged>::LoadCheckpoint() {
+  if (checkpoint_path_.empty()) {
+    return 0;
+  }
+  ct::BloomFilterCheckpointHeader header;
+  // Read into a separate filter, so that |filter_| is left empty if
+  // the checkpoint turns out to be unusable.
+  ScalableBloomFilter loaded(filter_);
+  const util::Status status(loaded.Read(checkpoint_path_, &header));
+  if (status.CanonicalCode() == util::error::NOT_FOUND) {
+    LOG(INFO) << "No Bloom filter checkpoint found, starting from scratch";
+    return 0;
+  }
+  if (!status.ok()) {
+    LOG(WARNING) << "Ignoring unusable Bloom filter checkpoint: " << status;
+    return 0;
+  }
+
+  // Every checkpoint covers entries that were in the database, so
+  // they still have to be, with the same hash for the last one.
+  Logged last;
+  if (header.tree_size() <= 0 || header.tree_size() > db_->TreeSize() ||
+      db_->LookupByIndex(header.tree_size() - 1, &last) !=
+          Database<Logged>::LOOKUP_OK ||
+      last.Hash() != header.last_entry_hash()) {
+    LOG(WARNING) << "Bloom filter checkpoint at " << checkpoint_path_
+                 << " does not match the database, ignoring it";
+    return 0;
+  }
+
+  filter_ = std::move(loaded);
+  LOG(INFO) << "Loaded the Bloom filter of " << header.tree_size()
+            << " entries from " << checkpoint_path_;
+  return header.tree_size();
+}
+
+
+template <class Logged>
+util::Status BloomFilterDatabase<Logged>::WriteCheckpoint() {
+  if (checkpoint_path_.empty()) {
+    return util::Status::OK;
+  }
+  std::lock_guard<std::mutex> checkpoint_lock(checkpoint_lock_);
+  // The entries are added to the filter before they are written, so
+  // all of those below the tree size are in the copy taken after.
+  const int64_t tree_size(db_->TreeSize());
+  Logged last;
+  if (tree_size == 0 || db_->LookupByIndex(tree_size - 1, &last) !=
+                            Database<Logged>::LOOKUP_OK) {
+    return util::Status(util::error::FAILED_PRECONDITION,
+                        "no entries to checkpoint");
+  }
+
+  // Write a copy, so as not to hold up the lookups for as long.
+  std::unique_lock<std::mutex> lock(lock_);
+  const ScalableBloomFilter filter(filter_);
+  lock.unlock();
+
+  ct::BloomFilterCheckpointHeader header;
+  header.set_tree_size(tree_size);
+  header.set_last_entry_hash(last.Hash());
+  const util::Status status(filter.Write(checkpoint_path_, &header));
+  if (status.ok()) {
+    checkpoint_tree_size_.store(tree_size);
+  }
+  return status;
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult
+BloomFilterDatabase<Logged>::LookupByHash(const std::string& hash,
+                                          Logged* result) const {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (!filter_.MayContain(hash)) {
+      bloom_filter_database_lookups->Increment("absent");
+      return this->NOT_FOUND;
+    }
+  }
+
+  const typename Database<Logged>::LookupResult ret(
+      db_->LookupByHash(hash, result));
+  bloom_filter_database_lookups->Increment(
+      ret == this->LOOKUP_OK ? "found" : "false_positive");
+  return ret;
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult
+BloomFilterDatabase<Logged>::LookupByIndex(int64_t sequence_number,
+                                           Logged* result) const {
+  return db_->LookupByIndex(sequence_number, result);
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult
+BloomFilterDatabase<Logged>::LatestTreeHead(ct::SignedTreeHead* result) const {
+  return db_->LatestTreeHead(result);
+}
+
+
+template <class Logged>
+std::unique_ptr<typename Database<Logged>::Iterator>
+BloomFilterDatabase<Logged>::ScanEntries(int64_t start_index) const {
+  return db_->ScanEntries(start_index);
+}
+
+
+template <class Logged>
+std::unique_ptr<typename Database<Logged>::RawLeafIterator>
+BloomFilterDatabase<Logged>::ScanRawLeaves(int64_t start_index) const {
+  return db_->ScanRawLeaves(start_index);
+}
+
+
+template <class Logged>
+std::unique_ptr<typename Database<Logged>::LeafHashIterator>
+BloomFilterDatabase<Logged>::ScanLeafHashes(int64_t start_index) const {
+  return db_->ScanLeafHashes(start_index);
+}
+
+
+template <class Logged>
+std::unique_ptr<typename Database<Logged>::Iterator>
+BloomFilterDatabase<Logged>::ScanEntriesByTime(uint64_t begin,
+                                               uint64_t end) const {
+  return db_->ScanEntriesByTime(begin, end);
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult
+BloomFilterDatabase<Logged>::LookupSubtreeHash(int level, int64_t index,
+                                               std::string* hash) const {
+  return db_->LookupSubtreeHash(level, index, hash);
+}
+
+
+template <class Logged>
+int64_t BloomFilterDatabase<Logged>::TreeSize() const {
+  return db_->TreeSize();
+}
+
+
+template <class Logged>
+std::vector<int64_t> BloomFilterDatabase<Logged>::SparseEntries() const {
+  return db_->SparseEntries();
+}
+
+
+template <class Logged>
+void BloomFilterDatabase<Logged>::AddNotifySTHCallback(
+    const typename Database<Logged>::NotifySTHCallback* callback) {
+  db_->AddNotifySTHCallback(callback);
+}
+
+
+template <class Logged>
+void BloomFilterDatabase<Logged>::RemoveNotifySTHCallback(
+    const typename Database<Logged>::NotifySTHCallback* callback) {
+  db_->RemoveNotifySTHCallback(callback);
+}
+
+
+template <class Logged>
+void BloomFilterDatabase<Logged>::InitializeNode(const std::string& node_id) {
+  db_->InitializeNode(node_id);
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult BloomFilterDatabase<Logged>::NodeId(
+    std::string* node_id) {
+  return db_->NodeId(node_id);
+}
+
+
+template <class Logged>
+typename Database<Logged>::WriteResult
+BloomFilterDatabase<Logged>::CreateSequencedEntry_(const Logged& logged) {
+  const std::string hash(logged.Hash());
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    filter_.Add(hash);
+    bloom_filter_database_bytes->Set(filter_.ByteSize());
+  }
+  return db_->CreateSequencedEntry(logged);
+}
+
+
+template <class Logged>
+typename Database<Logged>::WriteResult
+BloomFilterDatabase<Logged>::CreateSequencedEntries_(
+    const std::vector<const Logged*>& logged) {
+  std::vector<std::string> hashes;
+  hashes.reserve(logged.size());
+  for (const Logged* entry : logged) {
+    hashes.emplace_back(entry->Hash());
+  }
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    for (const std::string& hash : hashes) {
+      filter_.Add(hash);
+    }
+    bloom_filter_database_bytes->Set(filter_.ByteSize());
+  }
+  return db_->CreateSequencedEntries(logged);
+}
+
+
+template <class Logged>
+typename Database<Logged>::WriteResult
+BloomFilterDatabase<Logged>::WriteTreeHead_(const ct::SignedTreeHead& sth) {
+  const typename Database<Logged>::WriteResult ret(db_->WriteTreeHead(sth));
+  if (ret == this->OK && !checkpoint_path_.empty() &&
+      sth.tree_size() - checkpoint_tree_size_.load() >= checkpoint_interval_) {
+    const util::Status status(WriteCheckpoint());
+    if (status.ok()) {
+      VLOG(1) << "Wrote Bloom filter checkpoint at size " << sth.tree_size();
+    } else {
+      LOG(WARNING) << "Failed to write Bloom filter checkpoint: " << status;
+    }
+  }
+  return ret;
+}
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_BLOOM_FILTER_DATABASE_INL_H_
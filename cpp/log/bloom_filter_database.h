@@ -0,0 +1,118 @@
+#ifndef CERT_TRANS_LOG_BLOOM_FILTER_DATABASE_H_
+#define CERT_TRANS_LOG_BLOOM_FILTER_DATABASE_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "log/bloom_filter.h"
+#include "log/database.h"
+
+namespace cert_trans {
+
+
+// Wraps another Database, keeping a Bloom filter of the hashes of all
+// its entries in memory, so that LookupByHash() can answer NOT_FOUND
+// for entries that are definitely not in it without going to the
+// underlying database. Most submissions being new entries, that is
+// most lookups by hash.
+//
+// The hash of every entry written is added to the filter before it
+// is passed on. At construction, the filter is read from
+// |checkpoint_path|, if there is one there that matches the database,
+// and the entries past it are added by scanning the database (all of
+// them, if there is no checkpoint). The filter is then saved there
+// again whenever a tree head is written for |checkpoint_interval|
+// more entries than the last time.
+//
+// Everything else is passed through to the underlying database.
+template <class Logged>
+class BloomFilterDatabase : public Database<Logged> {
+ public:
+  // Takes ownership of |db|. |checkpoint_path| may be empty, in which
+  // case the filter is rebuilt from the database at every start.
+  BloomFilterDatabase(Database<Logged>* db, int64_t initial_capacity,
+                      double false_positive_rate,
+                      const std::string& checkpoint_path,
+                      int64_t checkpoint_interval);
+  ~BloomFilterDatabase() = default;
+
+  typename Database<Logged>::LookupResult LookupByHash(
+      const std::string& hash, Logged* result) const override;
+
+  typename Database<Logged>::LookupResult LookupByIndex(
+      int64_t sequence_number, Logged* result) const override;
+
+  typename Database<Logged>::LookupResult LatestTreeHead(
+      ct::SignedTreeHead* result) const override;
+
+  std::unique_ptr<typename Database<Logged>::Iterator> ScanEntries(
+      int64_t start_index) const override;
+
+  std::unique_ptr<typename Database<Logged>::RawLeafIterator> ScanRawLeaves(
+      int64_t start_index) const override;
+
+  std::unique_ptr<typename Database<Logged>::LeafHashIterator> ScanLeafHashes(
+      int64_t start_index) const override;
+
+  std::unique_ptr<typename Database<Logged>::Iterator> ScanEntriesByTime(
+      uint64_t begin, uint64_t end) const override;
+
+  typename Database<Logged>::LookupResult LookupSubtreeHash(
+      int level, int64_t index, std::string* hash) const override;
+
+  int64_t TreeSize() const override;
+
+  std::vector<int64_t> SparseEntries() const override;
+
+  void AddNotifySTHCallback(
+      const typename Database<Logged>::NotifySTHCallback* callback) override;
+
+  void RemoveNotifySTHCallback(
+      const typename Database<Logged>::NotifySTHCallback* callback) override;
+
+  void InitializeNode(const std::string& node_id) override;
+
+  typename Database<Logged>::LookupResult NodeId(
+      std::string* node_id) override;
+
+  // Saves the filter to the checkpoint path, if there is one.
+  util::Status WriteCheckpoint();
+
+ protected:
+  typename Database<Logged>::WriteResult CreateSequencedEntry_(
+      const Logged& logged) override;
+
+  typename Database<Logged>::WriteResult CreateSequencedEntries_(
+      const std::vector<const Logged*>& logged) override;
+
+  typename Database<Logged>::WriteResult WriteTreeHead_(
+      const ct::SignedTreeHead& sth) override;
+
+ private:
+  // Returns the tree size the checkpoint covers, or 0 if there is no
+  // usable checkpoint.
+  int64_t LoadCheckpoint();
+
+  const std::unique_ptr<Database<Logged>> db_;
+  const std::string checkpoint_path_;
+  const int64_t checkpoint_interval_;
+
+  mutable std::mutex lock_;
+  ScalableBloomFilter filter_;
+
+  // Serializes the writing of checkpoints.
+  std::mutex checkpoint_lock_;
+  std::atomic<int64_t> checkpoint_tree_size_;
+
+  DISALLOW_COPY_AND_ASSIGN(BloomFilterDatabase);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_BLOOM_FILTER_DATABASE_H_
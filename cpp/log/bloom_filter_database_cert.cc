@@ -0,0 +1,4 @@
+#include "log/bloom_filter_database-inl.h"
+#include "log/logged_certificate.h"
+
+template class cert_trans::BloomFilterDatabase<cert_trans::LoggedCertificate>;
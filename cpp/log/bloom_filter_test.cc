@@ -0,0 +1,126 @@
+#include "log/bloom_filter.h"
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <string>
+#include <unistd.h>
+
+#include "merkletree/serial_hasher.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::to_string;
+
+
+string Key(int i) {
+  return Sha256Hasher::Sha256Digest(to_string(i));
+}
+
+
+class BloomFilterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = util::CreateTemporaryDirectory("/tmp/bloomfilterXXXXXX");
+    path_ = dir_ + "/filter";
+  }
+
+  void TearDown() override {
+    unlink(path_.c_str());
+    rmdir(dir_.c_str());
+  }
+
+  string dir_;
+  string path_;
+};
+
+
+TEST_F(BloomFilterTest, GrowsWithoutFalseNegatives) {
+  ScalableBloomFilter filter(100, 0.01);
+  const size_t initial_bytes(filter.ByteSize());
+  for (int i = 0; i < 10000; ++i) {
+    filter.Add(Key(i));
+  }
+  EXPECT_GT(filter.ByteSize(), initial_bytes);
+  EXPECT_LE(filter.size(), 10000);
+  EXPECT_GT(filter.size(), 9900);
+  for (int i = 0; i < 10000; ++i) {
+    EXPECT_TRUE(filter.MayContain(Key(i))) << i;
+  }
+}
+
+
+TEST_F(BloomFilterTest, FalsePositiveRate) {
+  ScalableBloomFilter filter(100, 0.01);
+  for (int i = 0; i < 10000; ++i) {
+    filter.Add(Key(i));
+  }
+  int false_positives(0);
+  for (int i = 10000; i < 20000; ++i) {
+    if (filter.MayContain(Key(i))) {
+      ++false_positives;
+    }
+  }
+  // Well within the target of 1%, allowing for chance.
+  EXPECT_LT(false_positives, 150);
+}
+
+
+TEST_F(BloomFilterTest, WriteAndRead) {
+  ScalableBloomFilter filter(100, 0.01);
+  for (int i = 0; i < 1000; ++i) {
+    filter.Add(Key(i));
+  }
+  ct::BloomFilterCheckpointHeader header;
+  header.set_tree_size(1000);
+  ASSERT_TRUE(filter.Write(path_, &header).ok());
+  EXPECT_GT(header.layer_size(), 1);
+
+  ScalableBloomFilter loaded(10, 0.01);
+  ct::BloomFilterCheckpointHeader loaded_header;
+  ASSERT_TRUE(loaded.Read(path_, &loaded_header).ok());
+  EXPECT_EQ(header.DebugString(), loaded_header.DebugString());
+  EXPECT_EQ(filter.size(), loaded.size());
+  EXPECT_EQ(filter.ByteSize(), loaded.ByteSize());
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_TRUE(loaded.MayContain(Key(i))) << i;
+  }
+
+  // It keeps growing from there.
+  for (int i = 1000; i < 2000; ++i) {
+    loaded.Add(Key(i));
+  }
+  for (int i = 0; i < 2000; ++i) {
+    EXPECT_TRUE(loaded.MayContain(Key(i))) << i;
+  }
+}
+
+
+TEST_F(BloomFilterTest, ReadMissingOrTruncated) {
+  ScalableBloomFilter filter(100, 0.01);
+  ct::BloomFilterCheckpointHeader header;
+  EXPECT_EQ(util::error::NOT_FOUND,
+            filter.Read(path_, &header).CanonicalCode());
+
+  filter.Add(Key(0));
+  ASSERT_TRUE(filter.Write(path_, &header).ok());
+  ASSERT_EQ(0, truncate(path_.c_str(), 10));
+  ScalableBloomFilter loaded(100, 0.01);
+  EXPECT_EQ(util::error::DATA_LOSS,
+            loaded.Read(path_, &header).CanonicalCode());
+  // The filter is left as it was.
+  EXPECT_FALSE(loaded.MayContain(Key(0)));
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,287 @@
+#ifndef CERT_TRANS_LOG_CACHING_DATABASE_INL_H_
+#define CERT_TRANS_LOG_CACHING_DATABASE_INL_H_
+
+#include "log/caching_database.h"
+
+#include <glog/logging.h>
+
+#include "monitoring/monitoring.h"
+
+namespace cert_trans {
+namespace {
+
+
+static Counter<std::string>* caching_database_lookups(
+    Counter<std::string>::New("caching_database_lookups", "result",
+                              "Number of entry lookups by the caching "
+                              "database, by result (\"hit\" or \"miss\")."));
+
+static Gauge<>* caching_database_bytes(
+    Gauge<>::New("caching_database_bytes",
+                 "Estimated memory used by the entries cached by the "
+                 "caching database."));
+
+
+}  // namespace
+
+
+template <class Logged>
+class CachingDatabase<Logged>::Iterator : public Database<Logged>::Iterator {
+ public:
+  Iterator(const CachingDatabase<Logged>* db, int64_t start_index)
+      : db_(CHECK_NOTNULL(db)), next_index_(start_index) {
+    CHECK_GE(next_index_, 0);
+  }
+
+  bool GetNextEntry(Logged* entry) override {
+    if (!sparse_it_) {
+      if (next_index_ < db_->TreeSize()) {
+        CHECK_EQ(db_->LookupByIndex(next_index_, entry),
+                 Database<Logged>::LOOKUP_OK);
+        ++next_index_;
+        return true;
+      }
+      // Past the contiguous entries, the underlying database knows
+      // where the next one is.
+      sparse_it_ = db_->db_->ScanEntries(next_index_);
+    }
+    return sparse_it_->GetNextEntry(entry);
+  }
+
+ private:
+  const CachingDatabase<Logged>* const db_;
+  int64_t next_index_;
+  std::unique_ptr<typename Database<Logged>::Iterator> sparse_it_;
+};
+
+
+template <class Logged>
+CachingDatabase<Logged>::CachingDatabase(Database<Logged>* db,
+                                         size_t max_bytes,
+                                         MemoryBudget* budget)
+    : db_(CHECK_NOTNULL(db)),
+      max_bytes_(max_bytes),
+      account_(budget ? budget->OpenAccount() : nullptr),
+      bytes_(0) {
+  CHECK_GT(max_bytes_, 0U);
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult CachingDatabase<Logged>::LookupByHash(
+    const std::string& hash, Logged* result) const {
+  CHECK_NOTNULL(result);
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    const auto it(by_hash_.find(hash));
+    if (it != by_hash_.end()) {
+      LookupCached(it->second, result);
+      return this->LOOKUP_OK;
+    }
+  }
+
+  caching_database_lookups->Increment("miss");
+  const typename Database<Logged>::LookupResult ret(
+      db_->LookupByHash(hash, result));
+  if (ret == this->LOOKUP_OK) {
+    std::lock_guard<std::mutex> lock(lock_);
+    const typename EntryList::iterator it(Insert(*result));
+    if (it->hash.empty() && by_hash_.emplace(hash, it).second) {
+      it->hash = hash;
+    }
+  }
+  return ret;
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult CachingDatabase<Logged>::LookupByIndex(
+    int64_t sequence_number, Logged* result) const {
+  CHECK_NOTNULL(result);
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    const auto it(by_index_.find(sequence_number));
+    if (it != by_index_.end()) {
+      LookupCached(it->second, result);
+      return this->LOOKUP_OK;
+    }
+  }
+
+  caching_database_lookups->Increment("miss");
+  const typename Database<Logged>::LookupResult ret(
+      db_->LookupByIndex(sequence_number, result));
+  if (ret == this->LOOKUP_OK) {
+    std::lock_guard<std::mutex> lock(lock_);
+    Insert(*result);
+  }
+  return ret;
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult
+CachingDatabase<Logged>::LatestTreeHead(ct::SignedTreeHead* result) const {
+  return db_->LatestTreeHead(result);
+}
+
+
+template <class Logged>
+std::unique_ptr<typename Database<Logged>::Iterator>
+CachingDatabase<Logged>::ScanEntries(int64_t start_index) const {
+  return std::unique_ptr<Iterator>(new Iterator(this, start_index));
+}
+
+
+template <class Logged>
+std::unique_ptr<typename Database<Logged>::RawLeafIterator>
+CachingDatabase<Logged>::ScanRawLeaves(int64_t start_index) const {
+  return db_->ScanRawLeaves(start_index);
+}
+
+
+template <class Logged>
+std::unique_ptr<typename Database<Logged>::LeafHashIterator>
+CachingDatabase<Logged>::ScanLeafHashes(int64_t start_index) const {
+  return db_->ScanLeafHashes(start_index);
+}
+
+
+template <class Logged>
+std::unique_ptr<typename Database<Logged>::Iterator>
+CachingDatabase<Logged>::ScanEntriesByTime(uint64_t begin,
+                                           uint64_t end) const {
+  return db_->ScanEntriesByTime(begin, end);
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult
+CachingDatabase<Logged>::LookupSubtreeHash(int level, int64_t index,
+                                           std::string* hash) const {
+  return db_->LookupSubtreeHash(level, index, hash);
+}
+
+
+template <class Logged>
+int64_t CachingDatabase<Logged>::TreeSize() const {
+  return db_->TreeSize();
+}
+
+
+template <class Logged>
+std::vector<int64_t> CachingDatabase<Logged>::SparseEntries() const {
+  return db_->SparseEntries();
+}
+
+
+template <class Logged>
+void CachingDatabase<Logged>::AddNotifySTHCallback(
+    const typename Database<Logged>::NotifySTHCallback* callback) {
+  db_->AddNotifySTHCallback(callback);
+}
+
+
+template <class Logged>
+void CachingDatabase<Logged>::RemoveNotifySTHCallback(
+    const typename Database<Logged>::NotifySTHCallback* callback) {
+  db_->RemoveNotifySTHCallback(callback);
+}
+
+
+template <class Logged>
+void CachingDatabase<Logged>::InitializeNode(const std::string& node_id) {
+  db_->InitializeNode(node_id);
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult CachingDatabase<Logged>::NodeId(
+    std::string* node_id) {
+  return db_->NodeId(node_id);
+}
+
+
+// The cache only has entries, which never change once written.
+template <class Logged>
+util::Status CachingDatabase<Logged>::CatchUp() {
+  return db_->CatchUp();
+}
+
+
+template <class Logged>
+typename Database<Logged>::WriteResult
+CachingDatabase<Logged>::CreateSequencedEntry_(const Logged& logged) {
+  return db_->CreateSequencedEntry(logged);
+}
+
+
+template <class Logged>
+typename Database<Logged>::WriteResult
+CachingDatabase<Logged>::CreateSequencedEntries_(
+    const std::vector<const Logged*>& logged) {
+  return db_->CreateSequencedEntries(logged);
+}
+
+
+template <class Logged>
+typename Database<Logged>::WriteResult CachingDatabase<Logged>::WriteTreeHead_(
+    const ct::SignedTreeHead& sth) {
+  return db_->WriteTreeHead(sth);
+}
+
+
+// This must be called with "lock_" held.
+template <class Logged>
+void CachingDatabase<Logged>::LookupCached(typename EntryList::iterator it,
+                                           Logged* result) const {
+  caching_database_lookups->Increment("hit");
+  entries_.splice(entries_.begin(), entries_, it);
+  *result = it->logged;
+}
+
+
+// This must be called with "lock_" held.
+template <class Logged>
+typename CachingDatabase<Logged>::EntryList::iterator
+CachingDatabase<Logged>::Insert(const Logged& logged) const {
+  CHECK(logged.has_sequence_number());
+  const auto existing(by_index_.find(logged.sequence_number()));
+  if (existing != by_index_.end()) {
+    // Another thread got there first.
+    return existing->second;
+  }
+
+  entries_.push_front(Entry());
+  Entry* const entry(&entries_.front());
+  entry->logged = logged;
+  entry->bytes = sizeof(Entry) + logged.ByteSize();
+  bytes_ += entry->bytes;
+  by_index_.emplace(logged.sequence_number(), entries_.begin());
+
+  if (account_) {
+    account_->Set(bytes_);
+  }
+
+  // Keep at least the new entry, even if it is too big.
+  while ((bytes_ > max_bytes_ || (account_ && account_->ShouldShrink())) &&
+         entries_.size() > 1) {
+    const Entry& evicted(entries_.back());
+    CHECK_EQ(1U, by_index_.erase(evicted.logged.sequence_number()));
+    if (!evicted.hash.empty()) {
+      CHECK_EQ(1U, by_hash_.erase(evicted.hash));
+    }
+    bytes_ -= evicted.bytes;
+    entries_.pop_back();
+    if (account_) {
+      account_->Set(bytes_);
+    }
+  }
+  caching_database_bytes->Set(bytes_);
+
+  return entries_.begin();
+}
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_CACHING_DATABASE_INL_H_
@@ -0,0 +1,128 @@
+#ifndef CERT_TRANS_LOG_CACHING_DATABASE_H_
+#define CERT_TRANS_LOG_CACHING_DATABASE_H_
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "base/macros.h"
+#include "log/database.h"
+#include "util/memory_budget.h"
+
+namespace cert_trans {
+
+
+// Wraps another Database, keeping the most recently read entries in
+// memory, so that they do not have to be read and parsed again. As
+// entries never change once written, nothing is ever invalidated:
+// entries are only evicted, least recently used first, once they use
+// more than |max_bytes| (as estimated from their serialized size), or
+// when |budget| asks for it, if it is not null (see
+// util/memory_budget.h).
+//
+// Everything else is passed through to the underlying database,
+// including ScanRawLeaves(), ScanLeafHashes(), ScanEntriesByTime() and
+// LookupSubtreeHash(), which don't go through the cache, so that the
+// database can serve them from its own indexes.
+template <class Logged>
+class CachingDatabase : public Database<Logged> {
+ public:
+  // Takes ownership of |db|.
+  CachingDatabase(Database<Logged>* db, size_t max_bytes,
+                  MemoryBudget* budget);
+  ~CachingDatabase() = default;
+
+  typename Database<Logged>::LookupResult LookupByHash(
+      const std::string& hash, Logged* result) const override;
+
+  typename Database<Logged>::LookupResult LookupByIndex(
+      int64_t sequence_number, Logged* result) const override;
+
+  typename Database<Logged>::LookupResult LatestTreeHead(
+      ct::SignedTreeHead* result) const override;
+
+  // Reads the contiguous entries through the cache, and lets the
+  // underlying database scan the sparse ones.
+  std::unique_ptr<typename Database<Logged>::Iterator> ScanEntries(
+      int64_t start_index) const override;
+
+  std::unique_ptr<typename Database<Logged>::RawLeafIterator> ScanRawLeaves(
+      int64_t start_index) const override;
+
+  std::unique_ptr<typename Database<Logged>::LeafHashIterator> ScanLeafHashes(
+      int64_t start_index) const override;
+
+  std::unique_ptr<typename Database<Logged>::Iterator> ScanEntriesByTime(
+      uint64_t begin, uint64_t end) const override;
+
+  typename Database<Logged>::LookupResult LookupSubtreeHash(
+      int level, int64_t index, std::string* hash) const override;
+
+  int64_t TreeSize() const override;
+
+  std::vector<int64_t> SparseEntries() const override;
+
+  void AddNotifySTHCallback(
+      const typename Database<Logged>::NotifySTHCallback* callback) override;
+
+  void RemoveNotifySTHCallback(
+      const typename Database<Logged>::NotifySTHCallback* callback) override;
+
+  void InitializeNode(const std::string& node_id) override;
+
+  typename Database<Logged>::LookupResult NodeId(
+      std::string* node_id) override;
+
+  util::Status CatchUp() override;
+
+ protected:
+  typename Database<Logged>::WriteResult CreateSequencedEntry_(
+      const Logged& logged) override;
+
+  typename Database<Logged>::WriteResult CreateSequencedEntries_(
+      const std::vector<const Logged*>& logged) override;
+
+  typename Database<Logged>::WriteResult WriteTreeHead_(
+      const ct::SignedTreeHead& sth) override;
+
+ private:
+  class Iterator;
+
+  struct Entry {
+    Logged logged;
+    size_t bytes;
+    // Set if |by_hash_| points to this entry.
+    std::string hash;
+  };
+  typedef std::list<Entry> EntryList;
+
+  // These must be called with "lock_" held.
+  void LookupCached(typename EntryList::iterator it, Logged* result) const;
+  typename EntryList::iterator Insert(const Logged& logged) const;
+
+  const std::unique_ptr<Database<Logged>> db_;
+  const size_t max_bytes_;
+  const std::unique_ptr<MemoryBudget::Account> account_;
+
+  mutable std::mutex lock_;
+  // The most recently used entries first.
+  mutable EntryList entries_;
+  mutable size_t bytes_;
+  mutable std::unordered_map<int64_t, typename EntryList::iterator>
+      by_index_;
+  // Only entries obtained from LookupByHash() are indexed here, as the
+  // underlying database picks which of the duplicate entries to return.
+  mutable std::unordered_map<std::string, typename EntryList::iterator>
+      by_hash_;
+
+  DISALLOW_COPY_AND_ASSIGN(CachingDatabase);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_CACHING_DATABASE_H_
@@ -0,0 +1,4 @@
+#include "log/caching_database-inl.h"
+#include "log/logged_certificate.h"
+
+template class cert_trans::CachingDatabase<cert_trans::LoggedCertificate>;
@@ -0,0 +1,314 @@
+#include "log/caching_database.h"
+
+#include <gtest/gtest.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "log/logged_certificate.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::map;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+typedef Database<LoggedCertificate> DB;
+
+
+// Keeps the entries in memory and counts the lookups, and the scans
+// which have a default implementation.
+class FakeDatabase : public DB {
+ public:
+  FakeDatabase() : lookups_(0), leaf_scans_(0), time_scans_(0) {
+  }
+
+  LookupResult LookupByHash(const string& hash,
+                            LoggedCertificate* result) const override {
+    ++lookups_;
+    for (const auto& entry : entries_) {
+      if (entry.second.Hash() == hash) {
+        *result = entry.second;
+        return LOOKUP_OK;
+      }
+    }
+    return NOT_FOUND;
+  }
+
+  LookupResult LookupByIndex(int64_t sequence_number,
+                             LoggedCertificate* result) const override {
+    ++lookups_;
+    const auto it(entries_.find(sequence_number));
+    if (it == entries_.end()) {
+      return NOT_FOUND;
+    }
+    *result = it->second;
+    return LOOKUP_OK;
+  }
+
+  LookupResult LatestTreeHead(ct::SignedTreeHead* result) const override {
+    return NOT_FOUND;
+  }
+
+  unique_ptr<Iterator> ScanEntries(int64_t start_index) const override {
+    return unique_ptr<Iterator>(new MapIterator(this, start_index));
+  }
+
+  unique_ptr<RawLeafIterator> ScanRawLeaves(
+      int64_t start_index) const override {
+    ++leaf_scans_;
+    return DB::ScanRawLeaves(start_index);
+  }
+
+  unique_ptr<LeafHashIterator> ScanLeafHashes(
+      int64_t start_index) const override {
+    ++leaf_scans_;
+    return DB::ScanLeafHashes(start_index);
+  }
+
+  unique_ptr<Iterator> ScanEntriesByTime(uint64_t begin,
+                                         uint64_t end) const override {
+    ++time_scans_;
+    return DB::ScanEntriesByTime(begin, end);
+  }
+
+  int64_t TreeSize() const override {
+    int64_t size(0);
+    while (entries_.find(size) != entries_.end()) {
+      ++size;
+    }
+    return size;
+  }
+
+  vector<int64_t> SparseEntries() const override {
+    vector<int64_t> sparse;
+    for (auto it = entries_.upper_bound(TreeSize()); it != entries_.end();
+         ++it) {
+      sparse.push_back(it->first);
+    }
+    return sparse;
+  }
+
+  void AddNotifySTHCallback(const NotifySTHCallback* callback) override {
+  }
+
+  void RemoveNotifySTHCallback(const NotifySTHCallback* callback) override {
+  }
+
+  void InitializeNode(const string& node_id) override {
+  }
+
+  LookupResult NodeId(string* node_id) override {
+    return NOT_FOUND;
+  }
+
+  int lookups() const {
+    return lookups_;
+  }
+
+  int leaf_scans() const {
+    return leaf_scans_;
+  }
+
+  int time_scans() const {
+    return time_scans_;
+  }
+
+ protected:
+  WriteResult CreateSequencedEntry_(const LoggedCertificate& logged) override {
+    if (!entries_.emplace(logged.sequence_number(), logged).second) {
+      return SEQUENCE_NUMBER_ALREADY_IN_USE;
+    }
+    return OK;
+  }
+
+  WriteResult WriteTreeHead_(const ct::SignedTreeHead& sth) override {
+    return OK;
+  }
+
+ private:
+  class MapIterator : public Iterator {
+   public:
+    MapIterator(const FakeDatabase* db, int64_t start_index)
+        : db_(db), it_(db_->entries_.lower_bound(start_index)) {
+    }
+
+    bool GetNextEntry(LoggedCertificate* entry) override {
+      if (it_ == db_->entries_.end()) {
+        return false;
+      }
+      *entry = it_->second;
+      ++it_;
+      return true;
+    }
+
+   private:
+    const FakeDatabase* const db_;
+    map<int64_t, LoggedCertificate>::const_iterator it_;
+  };
+
+  map<int64_t, LoggedCertificate> entries_;
+  mutable int lookups_;
+  mutable int leaf_scans_;
+  mutable int time_scans_;
+};
+
+
+class CachingDatabaseTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    Open(1 << 20);
+  }
+
+  void Open(size_t max_bytes) {
+    fake_ = new FakeDatabase;
+    db_.reset(
+        new CachingDatabase<LoggedCertificate>(fake_, max_bytes, nullptr));
+  }
+
+  LoggedCertificate AddEntry(int64_t sequence_number) {
+    LoggedCertificate logged;
+    logged.RandomForTest();
+    logged.set_sequence_number(sequence_number);
+    EXPECT_EQ(DB::OK, db_->CreateSequencedEntry(logged));
+    return logged;
+  }
+
+  // Owned by |db_|.
+  FakeDatabase* fake_;
+  unique_ptr<CachingDatabase<LoggedCertificate>> db_;
+};
+
+
+TEST_F(CachingDatabaseTest, LookupByIndex) {
+  const LoggedCertificate logged(AddEntry(0));
+
+  LoggedCertificate result;
+  EXPECT_EQ(DB::NOT_FOUND, db_->LookupByIndex(1, &result));
+  EXPECT_EQ(1, fake_->lookups());
+
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(DB::LOOKUP_OK, db_->LookupByIndex(0, &result));
+    EXPECT_EQ(logged.DebugString(), result.DebugString());
+  }
+  EXPECT_EQ(2, fake_->lookups());
+
+  // Missing entries are not cached.
+  EXPECT_EQ(DB::NOT_FOUND, db_->LookupByIndex(1, &result));
+  EXPECT_EQ(3, fake_->lookups());
+}
+
+
+TEST_F(CachingDatabaseTest, LookupByHash) {
+  const LoggedCertificate logged(AddEntry(0));
+  // Same hash, higher sequence number.
+  LoggedCertificate duplicate(logged);
+  duplicate.set_sequence_number(1);
+  ASSERT_EQ(DB::OK, db_->CreateSequencedEntry(duplicate));
+
+  // Having cached the duplicate by index doesn't change what is
+  // returned by hash.
+  LoggedCertificate result;
+  EXPECT_EQ(DB::LOOKUP_OK, db_->LookupByIndex(1, &result));
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(DB::LOOKUP_OK, db_->LookupByHash(logged.Hash(), &result));
+    EXPECT_EQ(0, result.sequence_number());
+  }
+  EXPECT_EQ(2, fake_->lookups());
+
+  // The entry found by hash is also cached by index.
+  EXPECT_EQ(DB::LOOKUP_OK, db_->LookupByIndex(0, &result));
+  EXPECT_EQ(2, fake_->lookups());
+}
+
+
+TEST_F(CachingDatabaseTest, EvictsLeastRecentlyUsed) {
+  LoggedCertificate logged;
+  logged.RandomForTest();
+  logged.set_sequence_number(0);
+  // Room for two entries of that size, but not three.
+  Open(5 * (sizeof(LoggedCertificate) + logged.ByteSize() + 64) / 2);
+  for (int64_t seq = 0; seq < 3; ++seq) {
+    logged.set_sequence_number(seq);
+    ASSERT_EQ(DB::OK, db_->CreateSequencedEntry(logged));
+  }
+
+  LoggedCertificate result;
+  EXPECT_EQ(DB::LOOKUP_OK, db_->LookupByIndex(0, &result));
+  EXPECT_EQ(DB::LOOKUP_OK, db_->LookupByIndex(1, &result));
+  EXPECT_EQ(DB::LOOKUP_OK, db_->LookupByIndex(0, &result));
+  EXPECT_EQ(2, fake_->lookups());
+
+  // Evicts 1, the least recently used.
+  EXPECT_EQ(DB::LOOKUP_OK, db_->LookupByIndex(2, &result));
+  EXPECT_EQ(DB::LOOKUP_OK, db_->LookupByIndex(0, &result));
+  EXPECT_EQ(3, fake_->lookups());
+  EXPECT_EQ(DB::LOOKUP_OK, db_->LookupByIndex(1, &result));
+  EXPECT_EQ(4, fake_->lookups());
+}
+
+
+TEST_F(CachingDatabaseTest, ScanEntries) {
+  AddEntry(0);
+  AddEntry(1);
+  AddEntry(3);
+
+  LoggedCertificate result;
+  EXPECT_EQ(DB::LOOKUP_OK, db_->LookupByIndex(1, &result));
+  EXPECT_EQ(1, fake_->lookups());
+
+  const unique_ptr<DB::Iterator> it(db_->ScanEntries(0));
+  for (int64_t seq : {0, 1, 3}) {
+    ASSERT_TRUE(it->GetNextEntry(&result));
+    EXPECT_EQ(seq, result.sequence_number());
+  }
+  EXPECT_FALSE(it->GetNextEntry(&result));
+  // Only entry 0 had to be looked up, entry 3 came from the scan of
+  // the underlying database.
+  EXPECT_EQ(2, fake_->lookups());
+}
+
+
+TEST_F(CachingDatabaseTest, ForwardsLeafScans) {
+  AddEntry(0);
+
+  DB::RawLeaf leaf;
+  EXPECT_TRUE(db_->ScanRawLeaves(0)->GetNextLeaf(&leaf));
+  EXPECT_EQ(0, leaf.sequence_number);
+  DB::LeafHash leaf_hash;
+  EXPECT_TRUE(db_->ScanLeafHashes(0)->GetNextLeafHash(&leaf_hash));
+  EXPECT_EQ(0, leaf_hash.sequence_number);
+  EXPECT_EQ(2, fake_->leaf_scans());
+}
+
+
+TEST_F(CachingDatabaseTest, ForwardsScansByTime) {
+  const LoggedCertificate logged(AddEntry(0));
+  AddEntry(1);
+
+  const uint64_t timestamp(logged.timestamp());
+  const unique_ptr<DB::Iterator> it(
+      db_->ScanEntriesByTime(timestamp, timestamp + 1));
+  EXPECT_EQ(1, fake_->time_scans());
+  LoggedCertificate result;
+  bool found(false);
+  while (it->GetNextEntry(&result)) {
+    EXPECT_EQ(timestamp, result.timestamp());
+    found |= result.sequence_number() == 0;
+  }
+  EXPECT_TRUE(found);
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -67,6 +67,7 @@ string ASN1ToStringAndCheckForNulls(ASN1_STRING* asn1_string,
 
 
 Cert::Cert(X509* x509) : x509_(x509) {
+  EncodeDer();
 }
 
 
@@ -88,7 +89,9 @@ Cert::Cert(const string& pem_string) : x509_(nullptr) {
     // virtually impossible to fish them out.
     LOG(WARNING) << "Input is not a valid PEM-encoded certificate";
     LOG_OPENSSL_ERRORS(WARNING);
+    return;
   }
+  EncodeDer();
 }
 
 
@@ -114,6 +117,7 @@ util::Status Cert::LoadFromDerString(const string& der_string) {
     X509_free(x509_);
     x509_ = nullptr;
   }
+  der_.Clear();
   const unsigned char* start =
       reinterpret_cast<const unsigned char*>(der_string.data());
   x509_ = d2i_X509(nullptr, &start, der_string.size());
@@ -122,6 +126,11 @@ util::Status Cert::LoadFromDerString(const string& der_string) {
     LOG_OPENSSL_ERRORS(WARNING);
     return util::Status(Code::INVALID_ARGUMENT, "Not a valid encoded cert");
   }
+  // Keep the input, rather than encoding it again, unless it's not
+  // strictly DER, in which case the re-encoding might differ.
+  if (!der_.Parse(der_string).ok()) {
+    EncodeDer();
+  }
   return util::Status::OK;
 }
 
@@ -142,12 +151,34 @@ util::Status Cert::LoadFromDerBio(BIO* bio_in) {
     // virtually impossible to fish them out.
     LOG(WARNING) << "Input is not a valid encoded certificate";
     LOG_OPENSSL_ERRORS(WARNING);
+    der_.Clear();
     return util::Status(Code::INVALID_ARGUMENT, "Not a valid encoded cert");
   }
+  EncodeDer();
   return util::Status::OK;
 }
 
 
+void Cert::EncodeDer() {
+  der_.Clear();
+  if (!x509_) {
+    return;
+  }
+
+  unsigned char* der_buf(nullptr);
+  const int der_length(i2d_X509(x509_, &der_buf));
+  if (der_length < 0) {
+    LOG_OPENSSL_ERRORS(WARNING);
+    return;
+  }
+  const string der(reinterpret_cast<char*>(der_buf), der_length);
+  OPENSSL_free(der_buf);
+  if (!der_.Parse(der).ok()) {
+    LOG(WARNING) << "Could not locate the components of the certificate";
+  }
+}
+
+
 string Cert::PrintIssuerName() const {
   if (!IsLoaded()) {
     LOG(ERROR) << "Cert not loaded";
@@ -426,6 +457,11 @@ util::Status Cert::DerEncoding(string* result) const {
     return util::Status(Code::FAILED_PRECONDITION, "Cert not loaded");
   }
 
+  if (der_.IsLoaded()) {
+    result->assign(der_.encoding());
+    return util::Status::OK;
+  }
+
   unsigned char* der_buf(nullptr);
   int der_length = i2d_X509(x509_, &der_buf);
 
@@ -473,6 +509,11 @@ util::Status Cert::Sha256Digest(string* result) const {
     return util::Status(Code::FAILED_PRECONDITION, "Cert not loaded");
   }
 
+  if (der_.IsLoaded()) {
+    result->assign(Sha256Hasher::Sha256Digest(der_.encoding()));
+    return util::Status::OK;
+  }
+
   unsigned char digest[EVP_MAX_MD_SIZE];
   unsigned int len;
   if (X509_digest(x509_, EVP_sha256(), digest, &len) != 1) {
@@ -494,6 +535,11 @@ util::Status Cert::DerEncodedTbsCertificate(string* result) const {
     return util::Status(Code::FAILED_PRECONDITION, "Cert not loaded");
   }
 
+  if (der_.IsLoaded()) {
+    der_.TbsCertificate(result);
+    return util::Status::OK;
+  }
+
   unsigned char* der_buf(nullptr);
   int der_length = i2d_re_X509_tbs(x509_, &der_buf);
   if (der_length < 0) {
@@ -514,6 +560,10 @@ util::Status Cert::DerEncodedSubjectName(string* result) const {
     LOG(ERROR) << "Cert not loaded";
     return util::Status(Code::FAILED_PRECONDITION, "Cert not loaded");
   }
+  if (der_.IsLoaded()) {
+    der_.SubjectName(result);
+    return util::Status::OK;
+  }
   return DerEncodedName(X509_get_subject_name(x509_), result);
 }
 
@@ -523,6 +573,10 @@ util::Status Cert::DerEncodedIssuerName(string* result) const {
     LOG(ERROR) << "Cert not loaded";
     return util::Status(Code::FAILED_PRECONDITION, "Cert not loaded");
   }
+  if (der_.IsLoaded()) {
+    der_.IssuerName(result);
+    return util::Status::OK;
+  }
   return DerEncodedName(X509_get_issuer_name(x509_), result);
 }
 
@@ -570,6 +624,13 @@ util::Status Cert::SPKISha256Digest(string* result) const {
     return util::Status(Code::FAILED_PRECONDITION, "Cert not loaded");
   }
 
+  if (der_.IsLoaded()) {
+    string spki;
+    der_.SubjectPublicKeyInfo(&spki);
+    result->assign(Sha256Hasher::Sha256Digest(spki));
+    return util::Status::OK;
+  }
+
   unsigned char* der_buf(nullptr);
   int der_length = i2d_X509_PUBKEY(X509_get_X509_PUBKEY(x509_), &der_buf);
   if (der_length < 0) {
@@ -588,6 +649,45 @@ util::Status Cert::SPKISha256Digest(string* result) const {
   return util::Status::OK;
 }
 
+util::Status Cert::SubjectKeyIdentifier(string* result) const {
+  if (!IsLoaded()) {
+    LOG(ERROR) << "Cert not loaded";
+    return util::Status(Code::FAILED_PRECONDITION, "Cert not loaded");
+  }
+
+  ASN1_OCTET_STRING* const key_id(static_cast<ASN1_OCTET_STRING*>(
+      X509_get_ext_d2i(x509_, NID_subject_key_identifier, nullptr, nullptr)));
+  if (!key_id) {
+    ClearOpenSSLErrors();
+    return util::Status(Code::NOT_FOUND, "no subject key identifier");
+  }
+
+  result->assign(reinterpret_cast<const char*>(key_id->data),
+                 key_id->length);
+  ASN1_OCTET_STRING_free(key_id);
+  return util::Status::OK;
+}
+
+util::Status Cert::AuthorityKeyIdentifier(string* result) const {
+  if (!IsLoaded()) {
+    LOG(ERROR) << "Cert not loaded";
+    return util::Status(Code::FAILED_PRECONDITION, "Cert not loaded");
+  }
+
+  AUTHORITY_KEYID* const akid(static_cast<AUTHORITY_KEYID*>(X509_get_ext_d2i(
+      x509_, NID_authority_key_identifier, nullptr, nullptr)));
+  if (!akid || !akid->keyid) {
+    AUTHORITY_KEYID_free(akid);
+    ClearOpenSSLErrors();
+    return util::Status(Code::NOT_FOUND, "no authority key identifier");
+  }
+
+  result->assign(reinterpret_cast<const char*>(akid->keyid->data),
+                 akid->keyid->length);
+  AUTHORITY_KEYID_free(akid);
+  return util::Status::OK;
+}
+
 util::Status Cert::OctetStringExtensionData(int extension_nid,
                                             string* result) const {
   if (!IsLoaded()) {
@@ -1088,12 +1188,40 @@ util::Status Cert::IsValidNameConstrainedIntermediateCa() const {
 }
 
 
+// Sets the complete encoding of the OBJECT IDENTIFIER of |nid| in
+// |result|.
+static util::Status ObjectIdEncoding(int nid, string* result) {
+  const ASN1_OBJECT* const object(OBJ_nid2obj(nid));
+  if (!object) {
+    LOG(ERROR) << "OpenSSL OBJ_nid2obj failed for NID " << nid
+               << ". Is the NID not recognised?";
+    LOG_OPENSSL_ERRORS(ERROR);
+    return util::Status(Code::INTERNAL,
+                        "Extension lookup failed. Incorrect NID?");
+  }
+  unsigned char* buf(nullptr);
+  const int length(i2d_ASN1_OBJECT(const_cast<ASN1_OBJECT*>(object), &buf));
+  if (length < 0) {
+    LOG_OPENSSL_ERRORS(ERROR);
+    return util::Status(Code::INTERNAL, "Failed to encode object identifier");
+  }
+  result->assign(reinterpret_cast<char*>(buf), length);
+  OPENSSL_free(buf);
+  return util::Status::OK;
+}
+
+
 TbsCertificate::TbsCertificate(const Cert& cert) : x509_(nullptr) {
   if (!cert.IsLoaded()) {
     LOG(ERROR) << "Cert not loaded";
     return;
   }
 
+  if (cert.der_.IsLoaded()) {
+    cert.der_.TbsCertificate(&der_);
+    return;
+  }
+
   x509_ = X509_dup(cert.x509_);
 
   if (!x509_)
@@ -1113,6 +1241,11 @@ util::Status TbsCertificate::DerEncoding(string* result) const {
     return util::Status(Code::FAILED_PRECONDITION, "Cert not loaded (TBS)");
   }
 
+  if (!der_.empty()) {
+    result->assign(der_);
+    return util::Status::OK;
+  }
+
   unsigned char* der_buf(nullptr);
   int der_length = i2d_re_X509_tbs(x509_, &der_buf);
   if (der_length < 0) {
@@ -1134,6 +1267,19 @@ util::Status TbsCertificate::DeleteExtension(int extension_nid) {
     return util::Status(Code::FAILED_PRECONDITION, "Cert not loaded (TBS)");
   }
 
+  if (!der_.empty()) {
+    string oid;
+    const util::Status status(ObjectIdEncoding(extension_nid, &oid));
+    if (!status.ok()) {
+      return status;
+    }
+    const util::Status deleted(DeleteTbsExtension(oid, &der_));
+    LOG_IF(WARNING, deleted.CanonicalCode() == Code::ALREADY_EXISTS)
+        << "Failed to delete the extension. Does the certificate have "
+        << "duplicate extensions?";
+    return deleted;
+  }
+
   const StatusOr<int> extension_index(ExtensionIndex(extension_nid));
   // If the extension doesn't exist then there is nothing to do and this
   // propagates the NOT_FOUND status.
@@ -1186,6 +1332,10 @@ util::Status TbsCertificate::CopyIssuerFrom(const Cert& from) {
     return util::Status(Code::FAILED_PRECONDITION, "Cert not loaded (TBS)");
   }
 
+  if (!der_.empty()) {
+    return CopyDerIssuerFrom(from);
+  }
+
   // This just looks up the relevant pointer so there shouldn't
   // be any errors to clear.
   X509_NAME* ca_name = X509_get_issuer_name(from.x509_);
@@ -1257,6 +1407,59 @@ util::Status TbsCertificate::CopyIssuerFrom(const Cert& from) {
 }
 
 
+util::Status TbsCertificate::CopyDerIssuerFrom(const Cert& from) {
+  string issuer;
+  if (!from.DerEncodedIssuerName(&issuer).ok()) {
+    LOG(WARNING) << "Issuer certificate has NULL name";
+    return util::Status(Code::FAILED_PRECONDITION, "Issuer cert has NULL name");
+  }
+  util::Status status(SetTbsIssuer(issuer, &der_));
+  if (!status.ok()) {
+    return status;
+  }
+
+  // Verify that the Authority KeyID extensions are compatible.
+  string oid;
+  status = ObjectIdEncoding(NID_authority_key_identifier, &oid);
+  if (!status.ok()) {
+    return status;
+  }
+  string key_id;
+  status = TbsExtensionValue(der_, oid, &key_id);
+  if (status.CanonicalCode() == Code::NOT_FOUND) {
+    // No extension found = nothing to copy
+    return util::Status::OK;
+  }
+  if (!status.ok()) {
+    LOG(ERROR) << "Failed to check Authority Key Identifier extension";
+    return util::Status(Code::INTERNAL,
+                        "Failed to check Authority KeyID extension (TBS)");
+  }
+
+  string from_tbs;
+  status = from.DerEncodedTbsCertificate(&from_tbs);
+  if (status.ok()) {
+    status = TbsExtensionValue(from_tbs, oid, &key_id);
+  }
+  if (status.CanonicalCode() == Code::NOT_FOUND) {
+    // No extension found = cannot copy.
+    LOG(WARNING) << "Unable to copy issuer: destination has an Authority "
+                 << "KeyID extension, but the source has none.";
+    return util::Status(Code::FAILED_PRECONDITION,
+                        "Incompatible Authority KeyID extensions");
+  }
+  if (!status.ok()) {
+    LOG(ERROR) << "Failed to check Authority Key Identifier extension";
+    return util::Status(Code::INTERNAL,
+                        "Failed to check Authority KeyID extension");
+  }
+
+  // Keeps the critical bit (which should always be false in a valid
+  // cert, mind you).
+  return SetTbsExtensionValue(oid, key_id, &der_);
+}
+
+
 StatusOr<int> TbsCertificate::ExtensionIndex(int extension_nid) const {
   int index = X509_get_ext_by_NID(x509_, extension_nid, -1);
   if (index < -1) {
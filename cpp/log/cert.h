@@ -8,6 +8,7 @@
 #include <vector>
 
 #include "base/macros.h"
+#include "log/der_certificate.h"
 #include "util/statusor.h"
 
 namespace cert_trans {
@@ -153,6 +154,19 @@ class Cert {
   // Returns ERROR if the cert is not loaded.
   util::Status SPKISha256Digest(std::string* result) const;
 
+  // Sets the key identifier from the subjectKeyIdentifier extension
+  // in |result|.
+  // Returns NOT_FOUND if the extension is not present or invalid.
+  // Returns ERROR if the cert is not loaded.
+  util::Status SubjectKeyIdentifier(std::string* result) const;
+
+  // Sets the key identifier from the authorityKeyIdentifier extension
+  // in |result|.
+  // Returns NOT_FOUND if the extension is not present, is invalid, or
+  // identifies the issuer by name and serial number only.
+  // Returns ERROR if the cert is not loaded.
+  util::Status AuthorityKeyIdentifier(std::string* result) const;
+
   // Fetch data from an extension if encoded as an ASN1_OCTET_STRING.
   // Useful for handling custom extensions registered with X509V3_EXT_add.
   // Returns true if the extension is present and the data could be decoded.
@@ -200,7 +214,14 @@ class Cert {
   static std::string PrintName(X509_NAME* name);
   static std::string PrintTime(ASN1_TIME* when);
   static util::Status DerEncodedName(X509_NAME* name, std::string* result);
+  // Sets |der_| from |x509_|.
+  void EncodeDer();
   X509* x509_;
+  // The encoding |x509_| was decoded from (or would encode to), so the
+  // encodings of its components don't have to be redone each time.
+  // Not loaded in the unlikely case of a certificate OpenSSL decodes,
+  // but DerCertificate doesn't.
+  DerCertificate der_;
 
   DISALLOW_COPY_AND_ASSIGN(Cert);
 };
@@ -208,6 +229,10 @@ class Cert {
 // A wrapper around X509_CINF for chopping at the TBS to CT-sign it or verify
 // a CT signature. We construct a TBS for this rather than chopping at the full
 // cert so that the X509 information OpenSSL caches doesn't get out of sync.
+//
+// If the certificate has a DER encoding (see DerCertificate), the TBS is a
+// copy of it, which the modifications below splice directly. Otherwise, it
+// goes through OpenSSL, which re-encodes all of it.
 class TbsCertificate {
  public:
   // TODO(ekasper): add construction from PEM and DER as needed.
@@ -215,7 +240,7 @@ class TbsCertificate {
   ~TbsCertificate();
 
   bool IsLoaded() const {
-    return x509_ != NULL;
+    return !der_.empty() || x509_ != NULL;
   }
 
   // Sets the DER-encoded TBS structure in |result|.
@@ -246,8 +271,12 @@ class TbsCertificate {
 
  private:
   util::StatusOr<int> ExtensionIndex(int extension_nid) const;
-  // OpenSSL does not expose a TBSCertificate API, so we keep the TBS wrapped
-  // in the X509.
+  util::Status CopyDerIssuerFrom(const Cert& from);
+
+  // The DER encoding of the TBS, if the certificate had one.
+  std::string der_;
+  // OpenSSL does not expose a TBSCertificate API, so we otherwise keep the
+  // TBS wrapped in the X509.
   X509* x509_;
 
   DISALLOW_COPY_AND_ASSIGN(TbsCertificate);
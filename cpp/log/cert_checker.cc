@@ -1,53 +1,332 @@
 /* -*- indent-tabs-mode: nil -*- */
 #include "log/cert_checker.h"
 
+#include <algorithm>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <memory>
 #include <openssl/asn1.h>
 #include <openssl/bio.h>
+#include <openssl/ec.h>
+#include <openssl/evp.h>
 #include <openssl/pem.h>
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
 #include <string.h>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include "log/cert.h"
 #include "log/ct_extensions.h"
+#include "merkletree/serial_hasher.h"
+#include "monitoring/monitoring.h"
 #include "util/openssl_util.h"  // for LOG_OPENSSL_ERRORS
+#include "util/parallel_for.h"
 #include "util/util.h"
 
+using std::find;
+using std::lock_guard;
+using std::make_shared;
+using std::move;
+using std::mutex;
+using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
+using std::unordered_map;
+using std::unordered_multimap;
 using std::vector;
 using util::ClearOpenSSLErrors;
 using util::Status;
 using util::StatusOr;
 using util::error::Code;
 
+DEFINE_int32(cert_checker_max_parallel_loads, 8,
+             "Maximum number of trusted certificates parsed at the same "
+             "time when loading them, if the certificate checker was given "
+             "an executor.");
+DEFINE_int32(cert_checker_max_parallel_signatures, 4,
+             "Maximum number of signatures of a chain verified at the same "
+             "time, if the certificate checker was given an executor.");
+DEFINE_int32(cert_checker_public_key_cache_size, 1000,
+             "Maximum number of decoded ECDSA P-256 and RSA 2048 public keys "
+             "of issuing certificates to keep, to verify the signatures "
+             "they make without decoding them again. Zero disables the "
+             "cache.");
+DEFINE_int32(cert_checker_verified_cache_size, 10000,
+             "Maximum number of verified signatures of issuing certificates "
+             "to remember, so that they don't have to be verified again for "
+             "each submission. Zero disables the cache.");
+
 namespace cert_trans {
+namespace {
+
+
+static Counter<std::string>* verified_cache_lookups(
+    Counter<std::string>::New("cert_checker_verified_cache_lookups", "result",
+                              "Number of lookups of issuing certificate "
+                              "signatures in the verified signature cache, "
+                              "by result (\"hit\" or \"miss\")."));
+
+static Gauge<>* verified_cache_size(
+    Gauge<>::New("cert_checker_verified_cache_size",
+                 "Number of signatures in the verified signature cache."));
+
+static Counter<std::string>* public_key_cache_lookups(
+    Counter<std::string>::New("cert_checker_public_key_cache_lookups",
+                              "result",
+                              "Number of lookups of issuer public keys in "
+                              "the decoded public key cache, by result "
+                              "(\"hit\" or \"miss\")."));
+
+
+// The DER encodings of the AlgorithmIdentifiers of the signature
+// algorithms verified with cached public keys.
+const char kSha256WithRsaEncryption[] =
+    "\x30\x0d\x06\x09\x2a\x86\x48\x86\xf7\x0d\x01\x01\x0b\x05\x00";
+const char kEcdsaWithSha256[] =
+    "\x30\x0a\x06\x08\x2a\x86\x48\xce\x3d\x04\x03\x02";
+
+
+// Returns the type of key that makes signatures with the
+// AlgorithmIdentifier |algorithm|, or EVP_PKEY_NONE if it's not one
+// of those verified with cached keys.
+int KeyTypeForAlgorithm(const string& algorithm) {
+  if (algorithm == string(kSha256WithRsaEncryption,
+                          sizeof(kSha256WithRsaEncryption) - 1)) {
+    return EVP_PKEY_RSA;
+  }
+  if (algorithm == string(kEcdsaWithSha256, sizeof(kEcdsaWithSha256) - 1)) {
+    return EVP_PKEY_EC;
+  }
+  return EVP_PKEY_NONE;
+}
+
+
+// Decodes |spki|, returning null if it isn't an ECDSA P-256 or RSA
+// 2048 public key.
+shared_ptr<EVP_PKEY> DecodePublicKey(const string& spki) {
+  const unsigned char* data(
+      reinterpret_cast<const unsigned char*>(spki.data()));
+  EVP_PKEY* const key(d2i_PUBKEY(nullptr, &data, spki.size()));
+  if (!key) {
+    ClearOpenSSLErrors();
+    return nullptr;
+  }
+  shared_ptr<EVP_PKEY> result(key, EVP_PKEY_free);
+
+  switch (EVP_PKEY_id(key)) {
+    case EVP_PKEY_RSA:
+      // The Montgomery context of the modulus gets computed by the
+      // first verification, and kept in the key.
+      if (EVP_PKEY_bits(key) != 2048) {
+        return nullptr;
+      }
+      return result;
+    case EVP_PKEY_EC: {
+      EC_KEY* const ec_key(EVP_PKEY_get1_EC_KEY(key));
+      if (!ec_key) {
+        ClearOpenSSLErrors();
+        return nullptr;
+      }
+      const bool p256(EC_GROUP_get_curve_name(EC_KEY_get0_group(ec_key)) ==
+                      NID_X9_62_prime256v1);
+      // Precompute the multiples of the generator used by each
+      // verification.
+      const bool precomputed(p256 && EC_KEY_precompute_mult(ec_key, nullptr));
+      EC_KEY_free(ec_key);
+      if (!precomputed) {
+        ClearOpenSSLErrors();
+        return nullptr;
+      }
+      return result;
+    }
+    default:
+      return nullptr;
+  }
+}
+
+
+bool VerifySha256Signature(EVP_PKEY* key, const string& data,
+                           const string& signature) {
+  EVP_MD_CTX* const ctx(EVP_MD_CTX_create());
+  // Anything but 1 is a failure to verify, malformed signatures
+  // included, as with X509_verify().
+  const bool verified(
+      EVP_DigestVerifyInit(ctx, nullptr, EVP_sha256(), nullptr, key) == 1 &&
+      EVP_DigestVerifyUpdate(ctx, data.data(), data.size()) == 1 &&
+      EVP_DigestVerifyFinal(ctx,
+                            reinterpret_cast<unsigned char*>(
+                                const_cast<char*>(signature.data())),
+                            signature.size()) == 1);
+  EVP_MD_CTX_destroy(ctx);
+  if (!verified) {
+    ClearOpenSSLErrors();
+  }
+  return verified;
+}
+
+
+}  // namespace
+
+
+// The trusted certificates, indexed by their digest, and by their
+// subject name, alone and with their subject key identifier.
+class CertChecker::TrustStore {
+ public:
+  TrustStore() = default;
+  // The certificates are shared with |other|.
+  TrustStore(const TrustStore& other) = default;
+
+  // Returns false (and does nothing) if |cert| is already in the
+  // store. |public_key| is its decoded public key, if it is one
+  // IsSignedByCachedKey() handles, null otherwise.
+  bool Add(unique_ptr<const Cert> cert, const string& subject_name,
+           const string& digest, const shared_ptr<EVP_PKEY>& public_key) {
+    if (!by_digest_.emplace(digest, cert.get()).second) {
+      return false;
+    }
+    if (public_key) {
+      public_keys_.emplace(cert.get(), public_key);
+    }
+    roots_.emplace(subject_name, cert.get());
+    by_subject_name_.emplace(subject_name, cert.get());
+    string key_id;
+    if (cert->SubjectKeyIdentifier(&key_id).ok()) {
+      by_subject_name_and_key_id_.emplace(subject_name + key_id, cert.get());
+    }
+    certs_.emplace_back(move(cert));
+    return true;
+  }
+
+  bool Contains(const string& digest) const {
+    return by_digest_.find(digest) != by_digest_.end();
+  }
+
+  // Returns the certificates which could have issued a certificate
+  // with |issuer_name| and authority |key_id| (empty if unknown). Those
+  // with a matching subject key identifier come first.
+  vector<const Cert*> FindIssuers(const string& issuer_name,
+                                  const string& key_id) const {
+    vector<const Cert*> issuers;
+    if (!key_id.empty()) {
+      const auto range(
+          by_subject_name_and_key_id_.equal_range(issuer_name + key_id));
+      for (auto it = range.first; it != range.second; ++it) {
+        issuers.push_back(it->second);
+      }
+    }
+    const auto range(by_subject_name_.equal_range(issuer_name));
+    for (auto it = range.first; it != range.second; ++it) {
+      if (find(issuers.begin(), issuers.end(), it->second) == issuers.end()) {
+        issuers.push_back(it->second);
+      }
+    }
+    return issuers;
+  }
+
+  // Returns the decoded public key of |cert|, a certificate of this
+  // store, or null if it was not decoded.
+  shared_ptr<EVP_PKEY> PublicKey(const Cert* cert) const {
+    const auto it(public_keys_.find(cert));
+    return it != public_keys_.end() ? it->second : nullptr;
+  }
+
+  const std::multimap<string, const Cert*>& roots() const {
+    return roots_;
+  }
+
+  size_t size() const {
+    return certs_.size();
+  }
+
+ private:
+  vector<shared_ptr<const Cert>> certs_;
+  // By DER encoded subject name, in order, for listing.
+  std::multimap<string, const Cert*> roots_;
+  unordered_map<string, const Cert*> by_digest_;
+  unordered_multimap<string, const Cert*> by_subject_name_;
+  unordered_multimap<string, const Cert*> by_subject_name_and_key_id_;
+  unordered_map<const Cert*, shared_ptr<EVP_PKEY>> public_keys_;
+};
+
+CertChecker::CertChecker() : CertChecker(nullptr) {
+}
+
+CertChecker::CertChecker(util::Executor* executor)
+    : trust_store_(make_shared<TrustStore>()),
+      executor_(executor),
+      max_parallel_loads_(FLAGS_cert_checker_max_parallel_loads),
+      max_parallel_signatures_(FLAGS_cert_checker_max_parallel_signatures),
+      max_verified_signatures_(FLAGS_cert_checker_verified_cache_size),
+      max_public_keys_(FLAGS_cert_checker_public_key_cache_size) {
+  CHECK_GT(FLAGS_cert_checker_max_parallel_loads, 0);
+  CHECK_GT(FLAGS_cert_checker_max_parallel_signatures, 0);
+  CHECK_GE(FLAGS_cert_checker_verified_cache_size, 0);
+  CHECK_GE(FLAGS_cert_checker_public_key_cache_size, 0);
+}
 
 CertChecker::~CertChecker() {
-  ClearAllTrustedCertificates();
 }
 
-bool CertChecker::LoadTrustedCertificates(const string& cert_file) {
+namespace {
+
+BIO* OpenCertFile(const string& cert_file) {
   // A read-only BIO.
   BIO* bio_in = BIO_new(BIO_s_file());
   if (!bio_in) {
     LOG_OPENSSL_ERRORS(ERROR);
-    return false;
+    return nullptr;
   }
 
   if (BIO_read_filename(bio_in, cert_file.c_str()) <= 0) {
     BIO_free(bio_in);
     LOG(ERROR) << "Failed to open file " << cert_file << " for reading";
     LOG_OPENSSL_ERRORS(ERROR);
-    return false;
+    return nullptr;
   }
 
-  return LoadTrustedCertificatesFromBIO(bio_in);
+  return bio_in;
+}
+
+// Appends the DER encodings of the certificates in |bio_in| to |ders|,
+// skipping the PEM blocks of other types as PEM_read_bio_X509() does.
+// Returns false on a decoding error.
+bool ReadPemCertificates(BIO* bio_in, vector<string>* ders) {
+  while (true) {
+    char* name(nullptr);
+    char* header(nullptr);
+    unsigned char* data(nullptr);
+    long length(0);
+    if (!PEM_read_bio(bio_in, &name, &header, &data, &length)) {
+      // See if we reached the end of the file.
+      unsigned long err = ERR_peek_last_error();
+      if (ERR_GET_LIB(err) == ERR_LIB_PEM &&
+          ERR_GET_REASON(err) == PEM_R_NO_START_LINE) {
+        ClearOpenSSLErrors();
+        return true;
+      }
+      // A real error.
+      LOG(ERROR) << "Badly encoded certificate file.";
+      LOG_OPENSSL_ERRORS(WARNING);
+      return false;
+    }
+    if (strcmp(name, PEM_STRING_X509) == 0 ||
+        strcmp(name, PEM_STRING_X509_OLD) == 0) {
+      ders->emplace_back(reinterpret_cast<char*>(data), length);
+    }
+    OPENSSL_free(name);
+    OPENSSL_free(header);
+    OPENSSL_free(data);
+  }
+}
+
+}  // namespace
+
+bool CertChecker::LoadTrustedCertificates(const string& cert_file) {
+  BIO* const bio_in(OpenCertFile(cert_file));
+  return bio_in && LoadTrustedCertificatesFromBIO(bio_in, false);
 }
 
 bool CertChecker::LoadTrustedCertificates(const vector<string>& trusted_certs) {
@@ -65,75 +344,91 @@ bool CertChecker::LoadTrustedCertificates(const vector<string>& trusted_certs) {
     return false;
   }
 
-  return LoadTrustedCertificatesFromBIO(bio_in);
+  return LoadTrustedCertificatesFromBIO(bio_in, false);
 }
 
-bool CertChecker::LoadTrustedCertificatesFromBIO(BIO* bio_in) {
-  CHECK_NOTNULL(bio_in);
-  std::vector<std::pair<string, Cert*> > certs_to_add;
-  bool error = false;
-  // certs_to_add may be empty if no new certs were added, so keep track of
-  // successfully parsed cert count separately.
-  size_t cert_count = 0;
-
-  while (!error) {
-    X509* x509 = PEM_read_bio_X509(bio_in, nullptr, nullptr, nullptr);
-    if (x509) {
-      // TODO(ekasper): check that the issuing CA cert is temporally valid
-      // and at least warn if it isn't.
-      unique_ptr<Cert> cert(new Cert(x509));
-      string subject_name;
-      const StatusOr<bool> is_trusted(IsTrusted(*cert, &subject_name));
-      if (!is_trusted.ok()) {
-        error = true;
-        break;
-      }
-
-      ++cert_count;
-      if (!is_trusted.ValueOrDie()) {
-        certs_to_add.push_back(make_pair(subject_name, cert.release()));
-      }
-    } else {
-      // See if we reached the end of the file.
-      unsigned long err = ERR_peek_last_error();
-      if (ERR_GET_LIB(err) == ERR_LIB_PEM &&
-          ERR_GET_REASON(err) == PEM_R_NO_START_LINE) {
-        ClearOpenSSLErrors();
-        break;
-      } else {
-        // A real error.
-        LOG(ERROR) << "Badly encoded certificate file.";
-        LOG_OPENSSL_ERRORS(WARNING);
-        error = true;
-        break;
-      }
-    }
-  }
+bool CertChecker::ReloadTrustedCertificates(const string& cert_file) {
+  BIO* const bio_in(OpenCertFile(cert_file));
+  return bio_in && LoadTrustedCertificatesFromBIO(bio_in, true);
+}
 
+bool CertChecker::LoadTrustedCertificatesFromBIO(BIO* bio_in, bool replace) {
+  CHECK_NOTNULL(bio_in);
+  vector<string> ders;
+  const bool read(ReadPemCertificates(bio_in, &ders));
   BIO_free(bio_in);
-
-  if (error || !cert_count) {
-    while (!certs_to_add.empty()) {
-      delete certs_to_add.back().second;
-      certs_to_add.pop_back();
-    }
+  if (!read || ders.empty()) {
     return false;
   }
 
-  size_t new_certs = certs_to_add.size();
-  while (!certs_to_add.empty()) {
-    trusted_.insert(certs_to_add.back());
-    certs_to_add.pop_back();
+  // Only the PEM decoding above is sequential, the certificates are
+  // parsed, and their public keys decoded for the signatures they will
+  // be checking, in parallel.
+  struct Parsed {
+    unique_ptr<const Cert> cert;
+    string subject_name;
+    string digest;
+    shared_ptr<EVP_PKEY> public_key;
+  };
+  vector<Parsed> parsed(ders.size());
+  const auto parse([this, &ders, &parsed](size_t i) {
+    // TODO(ekasper): check that the issuing CA cert is temporally valid
+    // and at least warn if it isn't.
+    unique_ptr<Cert> cert(new Cert);
+    Parsed* const out(&parsed[i]);
+    if (!cert->LoadFromDerString(ders[i]).ok() ||
+        !cert->DerEncodedSubjectName(&out->subject_name).ok() ||
+        !cert->Sha256Digest(&out->digest).ok()) {
+      return;
+    }
+    if (max_public_keys_ > 0 && cert->der_.IsLoaded()) {
+      string spki;
+      cert->der_.SubjectPublicKeyInfo(&spki);
+      out->public_key = DecodePublicKey(spki);
+    }
+    out->cert = move(cert);
+  });
+  util::ParallelFor(ders.size(), max_parallel_loads_, executor_, parse);
+
+  lock_guard<mutex> lock(trust_store_update_lock_);
+  unique_ptr<TrustStore> store(replace ? new TrustStore
+                                       : new TrustStore(*GetTrustStore()));
+  // No new certs may be added, so count them separately.
+  size_t new_certs = 0;
+  for (Parsed& cert : parsed) {
+    if (!cert.cert) {
+      return false;
+    }
+    if (store->Add(move(cert.cert), cert.subject_name, cert.digest,
+                   cert.public_key)) {
+      ++new_certs;
+    }
   }
+
+  std::atomic_store(&trust_store_, shared_ptr<const TrustStore>(move(store)));
   LOG(INFO) << "Added " << new_certs << " new certificate(s) to trusted store";
   return true;
 }
 
 void CertChecker::ClearAllTrustedCertificates() {
-  std::multimap<string, const Cert*>::iterator it = trusted_.begin();
-  for (; it != trusted_.end(); ++it)
-    delete it->second;
-  trusted_.clear();
+  lock_guard<mutex> lock(trust_store_update_lock_);
+  std::atomic_store(&trust_store_,
+                    shared_ptr<const TrustStore>(make_shared<TrustStore>()));
+}
+
+shared_ptr<const std::multimap<string, const Cert*>>
+CertChecker::GetTrustedCertificates() const {
+  const shared_ptr<const TrustStore> store(GetTrustStore());
+  return shared_ptr<const std::multimap<string, const Cert*>>(store,
+                                                              &store->roots());
+}
+
+size_t CertChecker::NumTrustedCertificates() const {
+  return GetTrustStore()->size();
+}
+
+shared_ptr<const CertChecker::TrustStore> CertChecker::GetTrustStore() const {
+  return std::atomic_load(&trust_store_);
 }
 
 Status CertChecker::CheckCertChain(CertChain* chain) const {
@@ -168,7 +463,7 @@ Status CertChecker::CheckIssuerChain(CertChain* chain) const {
     return Status(status.CanonicalCode(), "invalid certificate chain");
   }
 
-  const Status valid_chain(chain->IsValidSignatureChain());
+  const Status valid_chain(CheckSignatureChain(*chain));
   if (!valid_chain.ok()) {
     return valid_chain;
   }
@@ -262,14 +557,15 @@ Status CertChecker::GetTrustedCa(CertChain* chain) const {
   }
 
   // Look up issuer from the trusted store.
-  if (trusted_.empty()) {
+  const shared_ptr<const TrustStore> store(GetTrustStore());
+  if (store->size() == 0) {
     LOG(WARNING) << "No trusted certificates loaded";
     return Status(util::error::FAILED_PRECONDITION,
                   "no trusted certificates loaded");
   }
 
   string subject_name;
-  const StatusOr<bool> is_trusted(IsTrusted(*subject, &subject_name));
+  const StatusOr<bool> is_trusted(IsTrusted(*store, *subject, &subject_name));
   // Either an error, or true, meaning the last cert is in our trusted
   // store.  Note the trusted cert need not necessarily be
   // self-signed.
@@ -290,17 +586,17 @@ Status CertChecker::GetTrustedCa(CertChain* chain) const {
                   "untrusted self-signed certificate");
   }
 
-  std::pair<std::multimap<string, const Cert*>::const_iterator,
-            std::multimap<string, const Cert*>::const_iterator> issuer_range =
-      trusted_.equal_range(issuer_name);
+  // Without an authority key identifier, all the trusted certificates
+  // with the right name are candidates.
+  string key_id;
+  subject->AuthorityKeyIdentifier(&key_id).IgnoreError();
 
   const Cert* issuer(nullptr);
-  for (std::multimap<string, const Cert*>::const_iterator it =
-           issuer_range.first;
-       it != issuer_range.second; ++it) {
-    const Cert* issuer_cand = it->second;
-
-    StatusOr<bool> signed_by_issuer = subject->IsSignedBy(*issuer_cand);
+  for (const Cert* issuer_cand : store->FindIssuers(issuer_name, key_id)) {
+    // Only a chain consisting of just the leaf is not worth caching.
+    StatusOr<bool> signed_by_issuer =
+        IsSignedBy(*subject, *issuer_cand, store->PublicKey(issuer_cand),
+                   chain->Length() > 1);
     if (signed_by_issuer.status().CanonicalCode() == Code::UNIMPLEMENTED) {
       // If the cert's algorithm is unsupported, then there's no point
       // continuing: it's unconditionally invalid.
@@ -334,29 +630,184 @@ Status CertChecker::GetTrustedCa(CertChain* chain) const {
   return Status::OK;
 }
 
-StatusOr<bool> CertChecker::IsTrusted(const Cert& cert,
-                                      string* subject_name) const {
-  string cert_name;
-  util::Status status = cert.DerEncodedSubjectName(&cert_name);
-  if (status != util::Status::OK) {
-    // Doesn't matter whether it failed to decode or did not exist
-    return Status(util::error::INVALID_ARGUMENT, "invalid certificate chain");
+Status CertChecker::CheckSignatureChain(const CertChain& chain) const {
+  if (!chain.IsLoaded()) {
+    LOG(ERROR) << "Chain is not loaded";
+    return Status(util::error::FAILED_PRECONDITION,
+                  "certificate chain is not loaded");
   }
 
-  *subject_name = cert_name;
+  // The links of the chain are independent of each other, so check
+  // them all at once, but report the first failure, as
+  // CertChain::IsValidSignatureChain() does.
+  const size_t num_links(chain.Length() - 1);
+  vector<StatusOr<bool>> signed_by_issuer(num_links);
+  util::ParallelFor(num_links, max_parallel_signatures_, executor_,
+                    [this, &chain, &signed_by_issuer](size_t i) {
+                      signed_by_issuer[i] =
+                          IsSignedBy(*chain.CertAt(i), *chain.CertAt(i + 1),
+                                     nullptr, i > 0);
+                    });
+
+  for (const auto& result : signed_by_issuer) {
+    // Propagate any failure status, including UNIMPLEMENTED for
+    // unsupported algorithms.
+    if (!result.ok()) {
+      return result.status();
+    }
+    if (!result.ValueOrDie()) {
+      return Status(util::error::INVALID_ARGUMENT,
+                    "invalid certificate chain");
+    }
+  }
 
-  std::pair<std::multimap<string, const Cert*>::const_iterator,
-            std::multimap<string, const Cert*>::const_iterator> cand_range =
-      trusted_.equal_range(cert_name);
-  for (std::multimap<string, const Cert*>::const_iterator it =
-           cand_range.first;
-       it != cand_range.second; ++it) {
-    const Cert* cand = it->second;
-    if (cert.IsIdenticalTo(*cand)) {
+  return Status::OK;
+}
+
+StatusOr<bool> CertChecker::IsSignedBy(
+    const Cert& subject, const Cert& issuer,
+    const shared_ptr<EVP_PKEY>& issuer_key, bool cacheable) const {
+  string key;
+  if (cacheable && max_verified_signatures_ > 0) {
+    string issuer_digest;
+    if (subject.Sha256Digest(&key).ok() &&
+        issuer.Sha256Digest(&issuer_digest).ok()) {
+      key.append(issuer_digest);
+    } else {
+      // Let Cert::IsSignedBy() report the problem.
+      key.clear();
+    }
+  }
+
+  if (!key.empty()) {
+    lock_guard<mutex> lock(verified_lock_);
+    const auto it(verified_index_.find(key));
+    if (it != verified_index_.end()) {
+      verified_cache_lookups->Increment("hit");
+      verified_.splice(verified_.begin(), verified_, it->second);
       return true;
     }
+    verified_cache_lookups->Increment("miss");
+  }
+
+  bool signed_by_cached_key;
+  const StatusOr<bool> signed_by_issuer(
+      IsSignedByCachedKey(subject, issuer, issuer_key, &signed_by_cached_key)
+          ? signed_by_cached_key
+          : subject.IsSignedBy(issuer));
+  if (key.empty() || !signed_by_issuer.ok() ||
+      !signed_by_issuer.ValueOrDie()) {
+    return signed_by_issuer;
   }
-  return false;
+
+  lock_guard<mutex> lock(verified_lock_);
+  // Another thread might have verified it concurrently.
+  if (verified_index_.find(key) == verified_index_.end()) {
+    verified_.push_front(key);
+    verified_index_.emplace(key, verified_.begin());
+    if (verified_.size() > max_verified_signatures_) {
+      verified_index_.erase(verified_.back());
+      verified_.pop_back();
+    }
+    verified_cache_size->Set(verified_.size());
+  }
+  return signed_by_issuer;
+}
+
+bool CertChecker::IsSignedByCachedKey(const Cert& subject,
+                                      const Cert& issuer,
+                                      const shared_ptr<EVP_PKEY>& issuer_key,
+                                      bool* signed_by_issuer) const {
+  if (max_public_keys_ == 0 || !subject.der_.IsLoaded() ||
+      !issuer.der_.IsLoaded()) {
+    return false;
+  }
+  string algorithm;
+  subject.der_.SignatureAlgorithm(&algorithm);
+  const int key_type(KeyTypeForAlgorithm(algorithm));
+  string signature;
+  if (key_type == EVP_PKEY_NONE || !subject.der_.SignatureBits(&signature)) {
+    return false;
+  }
+  string tbs;
+  subject.der_.TbsCertificate(&tbs);
+
+  if (issuer_key) {
+    if (EVP_PKEY_id(issuer_key.get()) != key_type) {
+      return false;
+    }
+    *signed_by_issuer =
+        VerifySha256Signature(issuer_key.get(), tbs, signature);
+    return true;
+  }
+
+  string spki;
+  issuer.der_.SubjectPublicKeyInfo(&spki);
+  const string key_digest(Sha256Hasher::Sha256Digest(spki));
+
+  shared_ptr<EVP_PKEY> public_key;
+  bool cached;
+  {
+    lock_guard<mutex> lock(public_keys_lock_);
+    const auto it(public_keys_index_.find(key_digest));
+    cached = it != public_keys_index_.end();
+    if (cached) {
+      public_key_cache_lookups->Increment("hit");
+      public_keys_.splice(public_keys_.begin(), public_keys_, it->second);
+      public_key = it->second->second;
+    } else {
+      public_key_cache_lookups->Increment("miss");
+    }
+  }
+  if (!cached) {
+    public_key = DecodePublicKey(spki);
+  }
+
+  if (!public_key || EVP_PKEY_id(public_key.get()) != key_type) {
+    // Keys of other kinds are cached as null, so that they don't get
+    // decoded for nothing every time.
+    if (!cached) {
+      AddPublicKey(key_digest, public_key);
+    }
+    return false;
+  }
+  *signed_by_issuer = VerifySha256Signature(public_key.get(), tbs, signature);
+  if (!cached) {
+    // Only share the key once it has been used, so that what OpenSSL
+    // computes lazily on the first verification is already there.
+    AddPublicKey(key_digest, public_key);
+  }
+  return true;
+}
+
+void CertChecker::AddPublicKey(const string& key_digest,
+                               const shared_ptr<EVP_PKEY>& public_key) const {
+  lock_guard<mutex> lock(public_keys_lock_);
+  // Another thread might have decoded it concurrently.
+  if (public_keys_index_.find(key_digest) != public_keys_index_.end()) {
+    return;
+  }
+  public_keys_.emplace_front(key_digest, public_key);
+  public_keys_index_.emplace(key_digest, public_keys_.begin());
+  if (public_keys_.size() > max_public_keys_) {
+    public_keys_index_.erase(public_keys_.back().first);
+    public_keys_.pop_back();
+  }
+}
+
+StatusOr<bool> CertChecker::IsTrusted(const TrustStore& store,
+                                      const Cert& cert,
+                                      string* subject_name) {
+  string cert_name;
+  string digest;
+  if (cert.DerEncodedSubjectName(&cert_name) != util::Status::OK ||
+      cert.Sha256Digest(&digest) != util::Status::OK) {
+    // Doesn't matter whether it failed to decode or did not exist
+    return Status(util::error::INVALID_ARGUMENT, "invalid certificate chain");
+  }
+
+  *subject_name = cert_name;
+  return store.Contains(digest);
 }
 
 }  // namespace cert_trans
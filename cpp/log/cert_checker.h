@@ -4,8 +4,13 @@
 
 #include <openssl/x509.h>
 
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "base/macros.h"
@@ -13,6 +18,10 @@
 #include "util/status.h"
 #include "util/statusor.h"
 
+namespace util {
+class Executor;
+}  // namespace util
+
 namespace cert_trans {
 
 class Cert;
@@ -29,7 +38,19 @@ class PreCertChain;
 // (2) we get some spam protection.
 class CertChecker {
  public:
-  CertChecker() = default;
+  // Up to --cert_checker_verified_cache_size signatures of issuing
+  // certificates which were verified successfully are remembered, so
+  // that chains sharing intermediates only get their leaf verified.
+  CertChecker();
+
+  // The signatures of a chain are also checked in parallel on
+  // |executor| (if not null), with up to
+  // --cert_checker_max_parallel_signatures of them at the same time,
+  // and trusted certificates are parsed with up to
+  // --cert_checker_max_parallel_loads of them at the same time.
+  // The calling thread checks signatures too, so |executor| can be the
+  // one it runs on. Does not take ownership of |executor|.
+  explicit CertChecker(util::Executor* executor);
 
   virtual ~CertChecker();
 
@@ -44,16 +65,21 @@ class CertChecker {
   virtual bool LoadTrustedCertificates(
       const std::vector<std::string>& trusted_certs);
 
+  // Replaces all the trusted certificates with those in
+  // |trusted_cert_file|, in one step, so that concurrent checks see
+  // either the old or the new ones. Returns false (and leaves the
+  // trusted certificates unchanged) on the same conditions as
+  // LoadTrustedCertificates().
+  virtual bool ReloadTrustedCertificates(const std::string& trusted_cert_file);
+
   virtual void ClearAllTrustedCertificates();
 
-  virtual const std::multimap<std::string, const Cert*>&
-  GetTrustedCertificates() const {
-    return trusted_;
-  }
+  // The trusted certificates, by the DER encoding of their subject
+  // name. This snapshot is not affected by later changes.
+  virtual std::shared_ptr<const std::multimap<std::string, const Cert*>>
+  GetTrustedCertificates() const;
 
-  virtual size_t NumTrustedCertificates() const {
-    return trusted_.size();
-  }
+  virtual size_t NumTrustedCertificates() const;
 
   // Check that:
   // (1) Each certificate is correctly signed by the next one in the chain; and
@@ -83,23 +109,81 @@ class CertChecker {
  private:
   util::Status CheckIssuerChain(CertChain* chain) const;
 
+  // Like CertChain::IsValidSignatureChain(), but skipping the
+  // signatures of the issuing certificates already verified, and
+  // verifying the others in parallel.
+  util::Status CheckSignatureChain(const CertChain& chain) const;
+
+  // Like Cert::IsSignedBy(), but only verifies the signature if it is
+  // not in the verified signature cache. Successful verifications are
+  // added to the cache if |cacheable| (leaves are not worth caching).
+  // |issuer_key| is the decoded public key of |issuer|, if known.
+  util::StatusOr<bool> IsSignedBy(const Cert& subject, const Cert& issuer,
+                                  const std::shared_ptr<EVP_PKEY>& issuer_key,
+                                  bool cacheable) const;
+
+  // Verifies the signature of |subject| directly with the decoded
+  // public key of |issuer|, which is |issuer_key| if not null (as for
+  // trusted certificates, decoded when loaded), and otherwise kept from
+  // previous verifications, if they use ECDSA P-256 or RSA 2048 with
+  // SHA-256. Returns false if they use something else (or if |issuer|
+  // doesn't decode), in which case Cert::IsSignedBy() has to be used
+  // instead.
+  bool IsSignedByCachedKey(const Cert& subject, const Cert& issuer,
+                           const std::shared_ptr<EVP_PKEY>& issuer_key,
+                           bool* signed_by_issuer) const;
+  // Adds |public_key| (which may be null) to the decoded public key
+  // cache, under the SHA256 digest of the subjectPublicKeyInfo it was
+  // decoded from.
+  void AddPublicKey(const std::string& key_digest,
+                    const std::shared_ptr<EVP_PKEY>& public_key) const;
+
+  class TrustStore;
+
   // Look issuer up from the trusted store, and verify signature.
   util::Status GetTrustedCa(CertChain* chain) const;
 
-  // Returns true if the cert is trusted, false if it's not,
+  // Returns true if the cert is in |store|, false if it's not,
   // INVALID_ARGUMENT if something is wrong with the cert, and
   // INTERNAL if something terrible happened.
-  util::StatusOr<bool> IsTrusted(const Cert& cert,
-                                 std::string* subject_name) const;
+  static util::StatusOr<bool> IsTrusted(const TrustStore& store,
+                                        const Cert& cert,
+                                        std::string* subject_name);
 
-  // A map by the DER encoding of the subject name.
-  // All code manipulating this container must ensure contained elements are
-  // deallocated appropriately.
-  std::multimap<std::string, const Cert*> trusted_;
+  std::shared_ptr<const TrustStore> GetTrustStore() const;
 
   // Helper for LoadTrustedCertificates, whether reading from file or memory.
-  // Takes ownership of bio_in and frees it.
-  bool LoadTrustedCertificatesFromBIO(BIO* bio_in);
+  // Takes ownership of bio_in and frees it. The certificates are added
+  // to the current ones, unless |replace|.
+  bool LoadTrustedCertificatesFromBIO(BIO* bio_in, bool replace);
+
+  // Never modified once set, but replaced as a whole (with
+  // std::atomic_store()), so that checks never wait for a reload.
+  std::shared_ptr<const TrustStore> trust_store_;
+  // Serializes the changes of |trust_store_|.
+  std::mutex trust_store_update_lock_;
+
+  util::Executor* const executor_;
+  const size_t max_parallel_loads_;
+  const size_t max_parallel_signatures_;
+
+  const size_t max_verified_signatures_;
+  mutable std::mutex verified_lock_;
+  // The verified signatures, by the SHA256 digests of the subject and
+  // issuer certificates, most recently used first.
+  mutable std::list<std::string> verified_;
+  mutable std::unordered_map<std::string, std::list<std::string>::iterator>
+      verified_index_;
+
+  const size_t max_public_keys_;
+  mutable std::mutex public_keys_lock_;
+  // The decoded public keys of issuers, by the SHA256 digest of their
+  // subjectPublicKeyInfo, most recently used first. Null for the keys
+  // IsSignedByCachedKey() doesn't handle.
+  typedef std::pair<std::string, std::shared_ptr<EVP_PKEY>> PublicKeyEntry;
+  mutable std::list<PublicKeyEntry> public_keys_;
+  mutable std::unordered_map<std::string, std::list<PublicKeyEntry>::iterator>
+      public_keys_index_;
 
   DISALLOW_COPY_AND_ASSIGN(CertChecker);
 };
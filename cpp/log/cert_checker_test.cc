@@ -6,21 +6,27 @@
 #include <openssl/evp.h>
 #include <string>
 
+#include "base/notification.h"
 #include "log/cert.h"
 #include "log/cert_checker.h"
 #include "log/ct_extensions.h"
 #include "util/status_test_util.h"
 #include "util/testing.h"
+#include "util/thread_pool.h"
 #include "util/util.h"
 
 using cert_trans::Cert;
 using cert_trans::CertChain;
 using cert_trans::CertChecker;
 using cert_trans::PreCertChain;
+using cert_trans::ThreadPool;
 using std::string;
 using std::vector;
 using util::testing::StatusIs;
 
+DECLARE_int32(cert_checker_public_key_cache_size);
+DECLARE_int32(cert_checker_verified_cache_size);
+
 // Valid certificates.
 // Self-signed
 static const char kCaCert[] = "ca-cert.pem";
@@ -52,6 +58,15 @@ static const char kCollidingRoots[] = "test-colliding-roots.pem";
 // A chain terminating with an MD2 intermediate.
 // Issuer is test-no-bc-ca-cert.pem.
 static const char kMd2Chain[] = "test-md2-chain.pem";
+// ECDSA P-256 and RSA 2048 CAs, signing with SHA-256.
+static const char kEcCaCert[] = "test-ec-ca-cert.pem";
+static const char kRsaCaCert[] = "test-rsa-ca-cert.pem";
+// Issued by test-ec-ca-cert.pem
+static const char kEcCert[] = "test-ec-cert.pem";
+// Issued by test-rsa-ca-cert.pem
+static const char kRsaCert[] = "test-rsa-cert.pem";
+// The issuer name of test-ec-ca-cert.pem, but signed with another key.
+static const char kEcWrongKeyCert[] = "test-ec-wrong-key-cert.pem";
 // A file which doesn't exist.
 static const char kNonexistent[] = "test-nonexistent.pem";
 // A file with corrupted contents (bit flip from ca-cert.pem).
@@ -179,6 +194,32 @@ TEST_F(CertCheckerTest, LoadTrustedCertificatesIgnoresDuplicates) {
   EXPECT_EQ(1U, checker_.NumTrustedCertificates());
 }
 
+TEST_F(CertCheckerTest, ReloadTrustedCertificates) {
+  EXPECT_TRUE(checker_.LoadTrustedCertificates(cert_dir_ + "/" + kCaCert));
+  const auto old_roots(checker_.GetTrustedCertificates());
+  ASSERT_EQ(1U, old_roots->size());
+
+  EXPECT_TRUE(
+      checker_.ReloadTrustedCertificates(cert_dir_ + "/" + kIntermediateCert));
+  EXPECT_EQ(1U, checker_.NumTrustedCertificates());
+  CertChain chain(chain_leaf_pem_);
+  ASSERT_TRUE(chain.IsLoaded());
+  EXPECT_OK(checker_.CheckCertChain(&chain));
+  CertChain untrusted(leaf_pem_);
+  ASSERT_TRUE(untrusted.IsLoaded());
+  EXPECT_THAT(checker_.CheckCertChain(&untrusted),
+              StatusIs(util::error::FAILED_PRECONDITION));
+
+  // A snapshot taken before is not affected.
+  ASSERT_EQ(1U, old_roots->size());
+  EXPECT_TRUE(Cert(ca_pem_).IsIdenticalTo(*old_roots->begin()->second));
+
+  // A failed reload leaves the trusted certificates alone.
+  EXPECT_FALSE(
+      checker_.ReloadTrustedCertificates(cert_dir_ + "/" + kNonexistent));
+  EXPECT_EQ(1U, checker_.NumTrustedCertificates());
+}
+
 TEST_F(CertCheckerTest, LoadTrustedCertificatesMissingFile) {
   EXPECT_EQ(0U, checker_.NumTrustedCertificates());
 
@@ -257,6 +298,96 @@ TEST_F(CertCheckerTest, Intermediates) {
               StatusIs(util::error::INVALID_ARGUMENT));
 }
 
+TEST_F(CertCheckerTest, CachesIssuerSignatures) {
+  EXPECT_TRUE(checker_.LoadTrustedCertificates(cert_dir_ + "/" + kCaCert));
+  for (int i = 0; i < 2; ++i) {
+    CertChain chain(chain_leaf_pem_ + intermediate_pem_);
+    ASSERT_TRUE(chain.IsLoaded());
+    EXPECT_OK(checker_.CheckCertChain(&chain));
+    EXPECT_EQ(3U, chain.Length());
+  }
+
+  // The leaf signature is still verified, even though that of the
+  // intermediate is cached.
+  CertChain wrong_leaf(leaf_pem_ + intermediate_pem_);
+  ASSERT_TRUE(wrong_leaf.IsLoaded());
+  EXPECT_THAT(checker_.CheckCertChain(&wrong_leaf),
+              StatusIs(util::error::INVALID_ARGUMENT));
+}
+
+TEST_F(CertCheckerTest, IntermediatesWithoutCache) {
+  FLAGS_cert_checker_verified_cache_size = 0;
+  CertChecker checker;
+  FLAGS_cert_checker_verified_cache_size = 10000;
+  EXPECT_TRUE(checker.LoadTrustedCertificates(cert_dir_ + "/" + kCaCert));
+  for (int i = 0; i < 2; ++i) {
+    CertChain chain(chain_leaf_pem_ + intermediate_pem_);
+    ASSERT_TRUE(chain.IsLoaded());
+    EXPECT_OK(checker.CheckCertChain(&chain));
+  }
+
+  CertChain invalid(intermediate_pem_ + chain_leaf_pem_);
+  ASSERT_TRUE(invalid.IsLoaded());
+  EXPECT_THAT(checker.CheckCertChain(&invalid),
+              StatusIs(util::error::INVALID_ARGUMENT));
+}
+
+TEST_F(CertCheckerTest, IntermediatesInParallel) {
+  ThreadPool pool(2);
+  FLAGS_cert_checker_verified_cache_size = 0;
+  CertChecker checker(&pool);
+  FLAGS_cert_checker_verified_cache_size = 10000;
+  EXPECT_TRUE(checker.LoadTrustedCertificates(cert_dir_ + "/" + kCaCert));
+  for (int i = 0; i < 10; ++i) {
+    CertChain chain(chain_leaf_pem_ + intermediate_pem_ + ca_pem_);
+    ASSERT_TRUE(chain.IsLoaded());
+    EXPECT_OK(checker.CheckCertChain(&chain));
+  }
+
+  // Still the first broken link that is reported.
+  CertChain invalid(intermediate_pem_ + chain_leaf_pem_ + ca_pem_);
+  ASSERT_TRUE(invalid.IsLoaded());
+  EXPECT_THAT(checker.CheckCertChain(&invalid),
+              StatusIs(util::error::INVALID_ARGUMENT));
+
+  // Let the helpers that had nothing left to do go before the pool.
+  cert_trans::Notification drained;
+  pool.Add([&drained]() { drained.Notify(); });
+  drained.WaitForNotification();
+}
+
+TEST_F(CertCheckerTest, CachedPublicKeys) {
+  for (const int cache_size : {1000, 0}) {
+    FLAGS_cert_checker_public_key_cache_size = cache_size;
+    CertChecker checker;
+    FLAGS_cert_checker_public_key_cache_size = 1000;
+    EXPECT_TRUE(checker.LoadTrustedCertificates(cert_dir_ + "/" + kEcCaCert));
+    EXPECT_TRUE(
+        checker.LoadTrustedCertificates(cert_dir_ + "/" + kRsaCaCert));
+
+    for (const char* leaf : {kEcCert, kRsaCert}) {
+      string leaf_pem;
+      CHECK(util::ReadTextFile(cert_dir_ + "/" + leaf, &leaf_pem));
+      // The first check decodes the key of the CA, the second reuses it.
+      for (int i = 0; i < 2; ++i) {
+        CertChain chain(leaf_pem);
+        ASSERT_TRUE(chain.IsLoaded());
+        EXPECT_OK(checker.CheckCertChain(&chain)) << leaf << " " << i;
+        EXPECT_EQ(2U, chain.Length());
+      }
+    }
+
+    string wrong_key_pem;
+    CHECK(util::ReadTextFile(cert_dir_ + "/" + kEcWrongKeyCert,
+                             &wrong_key_pem));
+    CertChain wrong_key(wrong_key_pem);
+    ASSERT_TRUE(wrong_key.IsLoaded());
+    EXPECT_THAT(checker.CheckCertChain(&wrong_key),
+                StatusIs(util::error::FAILED_PRECONDITION));
+    EXPECT_EQ(1U, wrong_key.Length());
+  }
+}
+
 TEST_F(CertCheckerTest, PreCert) {
   const string chain_pem = precert_pem_ + ca_pem_;
   PreCertChain chain(chain_pem);
@@ -1,6 +1,7 @@
 #ifndef CERT_SUBMISSION_HANDLER_H
 #define CERT_SUBMISSION_HANDLER_H
 
+#include <memory>
 #include <string>
 
 #include "base/macros.h"
@@ -31,7 +32,8 @@ class CertSubmissionHandler {
   static bool X509ChainToEntry(const cert_trans::CertChain& chain,
                                ct::LogEntry* entry);
 
-  const std::multimap<std::string, const cert_trans::Cert*>& GetRoots() const {
+  std::shared_ptr<const std::multimap<std::string, const cert_trans::Cert*>>
+  GetRoots() const {
     return cert_checker_->GetTrustedCertificates();
   }
 
@@ -4,6 +4,7 @@
 #include "log/cluster_state_controller.h"
 
 #include <functional>
+#include <gflags/gflags.h>
 #include <stdint.h>
 
 #include "fetcher/peer.h"
@@ -12,6 +13,8 @@
 #include "monitoring/monitoring.h"
 #include "proto/ct.pb.h"
 
+DECLARE_int32(node_state_push_delay_ms);
+
 
 namespace cert_trans {
 
@@ -101,10 +104,16 @@ ClusterStateController<Logged>::ClusterStateController(
       watch_serving_sth_task_(CHECK_NOTNULL(executor)),
       exiting_(false),
       update_required_(false),
+      push_delay_(FLAGS_node_state_push_delay_ms),
+      push_required_(false),
+      force_push_(false),
       cluster_serving_sth_update_thread_(
           std::bind(&ClusterStateController<Logged>::ClusterServingSTHUpdater,
-                    this)) {
+                    this)),
+      node_state_push_thread_(
+          std::bind(&ClusterStateController<Logged>::NodeStatePusher, this)) {
   CHECK_NOTNULL(base_.get());
+  CHECK_GE(FLAGS_node_state_push_delay_ms, 0);
   store_->WatchClusterNodeStates(
       std::bind(&ClusterStateController::OnClusterStateUpdated, this,
                 std::placeholders::_1),
@@ -130,7 +139,9 @@ ClusterStateController<Logged>::~ClusterStateController() {
     exiting_ = true;
   }
   update_required_cv_.notify_all();
+  push_required_cv_.notify_all();
   cluster_serving_sth_update_thread_.join();
+  node_state_push_thread_.join();
   watch_config_task_.Wait();
   watch_node_states_task_.Wait();
   watch_serving_sth_task_.Wait();
@@ -217,6 +228,7 @@ void ClusterStateController<Logged>::SetNodeHostPort(const std::string& host,
 template <class Logged>
 void ClusterStateController<Logged>::RefreshNodeState() {
   std::unique_lock<std::mutex> lock(mutex_);
+  force_push_ = true;
   PushLocalNodeState(lock);
 }
 
@@ -260,9 +272,76 @@ template <class Logged>
 void ClusterStateController<Logged>::PushLocalNodeState(
     const std::unique_lock<std::mutex>& lock) {
   CHECK(lock.owns_lock());
+  if (!push_required_ &&
+      std::chrono::steady_clock::now() >= last_push_time_ + push_delay_) {
+    // Nothing was written recently, no need to wait.
+    WriteLocalNodeState(lock);
+    return;
+  }
+  push_required_ = true;
+  push_required_cv_.notify_all();
+}
+
+
+template <class Logged>
+void ClusterStateController<Logged>::WriteLocalNodeState(
+    const std::unique_lock<std::mutex>& lock) {
+  CHECK(lock.owns_lock());
+  const bool force(force_push_);
+  push_required_ = false;
+  force_push_ = false;
+  std::string serialized_state;
+  CHECK(local_node_state_.SerializeToString(&serialized_state));
+  if (!force && serialized_state == last_pushed_state_) {
+    VLOG(1) << "ClusterNodeState unchanged, not pushing it.";
+    return;
+  }
 
+  last_push_time_ = std::chrono::steady_clock::now();
   const util::Status status(store_->SetClusterNodeState(local_node_state_));
   LOG_IF(WARNING, !status.ok()) << "Couldn't set ClusterNodeState: " << status;
+  if (status.ok()) {
+    last_pushed_state_ = serialized_state;
+  } else {
+    last_pushed_state_.clear();
+  }
+}
+
+
+// Thread entry point for node_state_push_thread_.
+template <class Logged>
+void ClusterStateController<Logged>::NodeStatePusher() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    push_required_cv_.wait(lock, [this]() {
+      return push_required_ || exiting_;
+    });
+    if (!push_required_) {
+      VLOG(1) << "NodeStatePusher thread returning.";
+      return;
+    }
+    // Let further changes accumulate until the delay since the last
+    // write has expired, so they go out in the same write.
+    push_required_cv_.wait_until(lock, last_push_time_ + push_delay_,
+                                 [this]() { return exiting_; });
+    if (push_required_) {
+      WriteLocalNodeState(lock);
+    }
+  }
+}
+
+
+template <class Logged>
+bool ClusterStateController<Logged>::CanMoveServingSTH(
+    const std::unique_lock<std::mutex>& lock,
+    const ct::ClusterNodeState& state) const {
+  CHECK(lock.owns_lock());
+  // CalculateServingSTH() does not look at the nodes with smaller
+  // STHs than the one it last picked.
+  return state.has_newest_sth() &&
+         (!calculated_serving_sth_ ||
+          state.newest_sth().tree_size() >=
+              calculated_serving_sth_->tree_size());
 }
 
 
@@ -270,11 +349,27 @@ template <class Logged>
 void ClusterStateController<Logged>::OnClusterStateUpdated(
     const std::vector<Update<ct::ClusterNodeState>>& updates) {
   std::unique_lock<std::mutex> lock(mutex_);
+  // Joins and departures change the fraction of nodes able to serve,
+  // but other changes can only matter if they involve large enough
+  // STHs.
+  bool recalculate(false);
   for (const auto& update : updates) {
     const std::string& node_id(update.handle_.Key());
     if (update.exists_) {
       auto it(all_peers_.find(node_id));
       VLOG_IF(1, it == all_peers_.end()) << "Node joined: " << node_id;
+      if (it == all_peers_.end()) {
+        recalculate = true;
+      } else {
+        const ct::ClusterNodeState old_state(it->second->state());
+        const ct::ClusterNodeState& new_state(update.handle_.Entry());
+        if ((CanMoveServingSTH(lock, old_state) ||
+             CanMoveServingSTH(lock, new_state)) &&
+            old_state.newest_sth().SerializeAsString() !=
+                new_state.newest_sth().SerializeAsString()) {
+          recalculate = true;
+        }
+      }
 
       // If the host or port change, remove the ClusterPeer, so that
       // we re-create it.
@@ -288,6 +383,10 @@ void ClusterStateController<Logged>::OnClusterStateUpdated(
 
       if (it != all_peers_.end()) {
         it->second->UpdateClusterNodeState(update.handle_.Entry());
+        if (update.handle_.Entry().has_newest_sth()) {
+          fetcher_->NewTreeSize(
+              update.handle_.Entry().newest_sth().tree_size());
+        }
       } else {
         const std::shared_ptr<ClusterPeer> peer(
             std::make_shared<ClusterPeer>(base_, url_fetcher_,
@@ -303,10 +402,15 @@ void ClusterStateController<Logged>::OnClusterStateUpdated(
       VLOG(1) << "Node left: " << node_id;
       CHECK_EQ(1, all_peers_.erase(node_id));
       fetcher_->RemovePeer(node_id);
+      recalculate = true;
     }
   }
 
-  CalculateServingSTH(lock);
+  if (recalculate) {
+    CalculateServingSTH(lock);
+  } else {
+    VLOG(1) << "Node state changes cannot affect the serving STH.";
+  }
 }
 
 
@@ -1,6 +1,7 @@
 #ifndef CERT_TRANS_LOG_CLUSTER_STATE_CONTROLLER_H_
 #define CERT_TRANS_LOG_CLUSTER_STATE_CONTROLLER_H_
 
+#include <chrono>
 #include <condition_variable>
 #include <functional>
 #include <map>
@@ -60,6 +61,8 @@ class ClusterStateController {
   // other nodes can request entries from its database.
   void SetNodeHostPort(const std::string& host, const uint16_t port);
 
+  // Rewrites this node's ClusterNodeState even if it has not changed,
+  // to keep it from expiring.
   void RefreshNodeState();
 
   bool NodeIsStale() const;
@@ -72,9 +75,25 @@ class ClusterStateController {
  private:
   class ClusterPeer;
 
-  // Updates the representation of *this* node's state in the consistent store.
+  // Updates the representation of *this* node's state in the consistent
+  // store. If it was written less than --node_state_push_delay_ms ago,
+  // this is left to NodeStatePusher(), so that changes made in quick
+  // succession are written together.
   void PushLocalNodeState(const std::unique_lock<std::mutex>& lock);
 
+  // Writes this node's state to the consistent store, unless it is the
+  // same as was last written (and no refresh was requested).
+  void WriteLocalNodeState(const std::unique_lock<std::mutex>& lock);
+
+  // Thread entry point for the node state pusher thread.
+  void NodeStatePusher();
+
+  // Returns true if |state| counts towards serving STHs at least as
+  // large as the currently calculated one, meaning that a change to
+  // it could change the serving STH.
+  bool CanMoveServingSTH(const std::unique_lock<std::mutex>& lock,
+                         const ct::ClusterNodeState& state) const;
+
   // Entry point for the watcher callback.
   // Called whenever a node changes its node state.
   void OnClusterStateUpdated(
@@ -121,7 +140,16 @@ class ClusterStateController {
   bool exiting_;
   bool update_required_;
   std::condition_variable update_required_cv_;
+  const std::chrono::milliseconds push_delay_;
+  bool push_required_;
+  // Set by RefreshNodeState(), to push even an unchanged state.
+  bool force_push_;
+  // The serialized ClusterNodeState last written successfully.
+  std::string last_pushed_state_;
+  std::chrono::steady_clock::time_point last_push_time_;
+  std::condition_variable push_required_cv_;
   std::thread cluster_serving_sth_update_thread_;
+  std::thread node_state_push_thread_;
 
   friend class ClusterStateControllerTest;
 
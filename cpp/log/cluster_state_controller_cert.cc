@@ -1,6 +1,11 @@
 #include "log/cluster_state_controller-inl.h"
 #include "log/logged_certificate.h"
 
+DEFINE_int32(node_state_push_delay_ms, 100,
+             "How long to wait for further changes to this node's state "
+             "before writing it to etcd, so that bursts of changes result "
+             "in a single write.");
+
 namespace cert_trans {
 template class ClusterStateController<LoggedCertificate>;
 }  // namespace cert_trans
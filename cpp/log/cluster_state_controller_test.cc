@@ -1,3 +1,4 @@
+#include <atomic>
 #include <gtest/gtest.h>
 #include <map>
 #include <memory>
@@ -64,10 +65,11 @@ class ClusterStateControllerTest : public ::testing::Test {
                                                            "", kNodeId3)),
         controller_(&pool_, base_, &url_fetcher_, test_db_.db(), store1_.get(),
                     &election1_, &fetcher_) {
-    // There will be many calls to ContinuousFetcher::AddPeer during
-    // this test, but this isn't what we're testing here, so just
-    // ignore them.
+    // There will be many calls to ContinuousFetcher::AddPeer and
+    // NewTreeSize during this test, but this isn't what we're testing
+    // here, so just ignore them.
     EXPECT_CALL(fetcher_, AddPeer(_, _)).Times(AnyNumber());
+    EXPECT_CALL(fetcher_, NewTreeSize(_)).Times(AnyNumber());
 
     // Set default cluster config:
     ct::ClusterConfig default_config;
@@ -529,6 +531,50 @@ TEST_F(ClusterStateControllerTest, TestNodeHostPort) {
 }
 
 
+TEST_F(ClusterStateControllerTest, TestCoalescesNodeStatePushes) {
+  sleep(1);
+  std::atomic<int> num_writes(0);
+  bool initial(true);
+  util::SyncTask watch_task(&pool_);
+  etcd_.Watch("/nodes/",
+              [&num_writes, &initial](const vector<EtcdClient::Node>& nodes) {
+                if (initial) {
+                  initial = false;
+                  return;
+                }
+                for (const auto& node : nodes) {
+                  if (node.key_ == string("/nodes/") + kNodeId1) {
+                    ++num_writes;
+                  }
+                }
+              },
+              watch_task.task());
+
+  for (int i = 1; i <= 10; ++i) {
+    SignedTreeHead sth;
+    sth.set_timestamp(i);
+    sth.set_tree_size(i);
+    controller_.NewTreeHead(sth);
+  }
+  sleep(1);
+  EXPECT_EQ(10, GetNodeStateView(kNodeId1).newest_sth().tree_size());
+  // The first one went out immediately, the others together.
+  EXPECT_EQ(2, num_writes.load());
+
+  // Unchanged states are not written again, unless refreshing.
+  const int num_writes_after_sths(num_writes.load());
+  controller_.SetNodeHostPort(kNodeId1, 9001);
+  sleep(1);
+  EXPECT_EQ(num_writes_after_sths, num_writes.load());
+  controller_.RefreshNodeState();
+  sleep(1);
+  EXPECT_EQ(num_writes_after_sths + 1, num_writes.load());
+
+  watch_task.Cancel();
+  watch_task.Wait();
+}
+
+
 TEST_F(ClusterStateControllerTest, TestStoresServingSthInDatabase) {
   SignedTreeHead sth;
   sth.set_timestamp(10000);
@@ -112,6 +112,8 @@ class ConsistentStore {
                                  updates)> ClusterNodeStateCallback;
   typedef std::function<void(const Update<ct::ClusterConfig>& update)>
       ClusterConfigCallback;
+  typedef std::function<void(const std::vector<Update<Logged>>& updates)>
+      PendingEntriesCallback;
 
   ConsistentStore() = default;
 
@@ -125,9 +127,32 @@ class ConsistentStore {
 
   virtual util::Status AddPendingEntry(Logged* entry) = 0;
 
+  // Like AddPendingEntry(), but returns the status on |task| instead
+  // of blocking. |entry| must stay valid until then. The default runs
+  // AddPendingEntry() on the executor of |task|, implementations that
+  // can do better should override it.
+  virtual void AddPendingEntryAsync(Logged* entry, util::Task* task) {
+    task->executor()->Add([this, entry, task]() {
+      task->Return(AddPendingEntry(entry));
+    });
+  }
+
+  // Adds each of |entries| as AddPendingEntry() would, but possibly
+  // all at once. Sets |statuses| to the result for each of them, in
+  // the same order.
+  virtual void AddPendingEntries(const std::vector<Logged*>& entries,
+                                 std::vector<util::Status>* statuses) = 0;
+
   virtual util::Status GetPendingEntryForHash(
       const std::string& hash, EntryHandle<Logged>* entry) const = 0;
 
+  // True if GetPendingEntryForHash() is answered from memory, cheaply
+  // enough to be called for every submission. It can then miss the
+  // entries added very recently by other nodes.
+  virtual bool CachesPendingEntries() const {
+    return false;
+  }
+
   virtual util::Status GetPendingEntries(
       std::vector<EntryHandle<Logged>>* entries) const = 0;
 
@@ -151,6 +176,11 @@ class ConsistentStore {
   virtual void WatchClusterConfig(const ClusterConfigCallback& cb,
                                   util::Task* task) = 0;
 
+  // The first call to |cb| has all the existing pending entries, and
+  // the following ones the entries added or removed since.
+  virtual void WatchPendingEntries(const PendingEntriesCallback& cb,
+                                   util::Task* task) = 0;
+
   virtual util::Status SetClusterConfig(const ct::ClusterConfig& config) = 0;
 
   // Cleans up entries in the store according to the implementation's policy.
@@ -1,30 +1,136 @@
 #include "log/database.h"
 
+#include <gflags/gflags.h>
+
+#include "monitoring/monitoring.h"
+
+DEFINE_int32(database_scan_readahead, 0,
+             "If non-zero, the long scans of the database (updating the "
+             "in-memory tree, for example) read and parse up to this many "
+             "entries ahead on another thread, while the previous ones are "
+             "hashed.");
+DEFINE_int32(merkle_tree_snapshot_cache_size, 64,
+             "Number of past tree snapshots whose right edge the in-memory "
+             "tree keeps, to answer repeated proof requests without "
+             "rehashing.");
+DEFINE_bool(async_sth_notifications, false,
+            "Notify the users of a database (such as the in-memory tree) "
+            "of new tree heads on a thread of its own, rather than on the "
+            "thread writing the tree head, skipping those superseded while "
+            "the previous one was being handled.");
+
+using std::lock_guard;
+using std::mutex;
+using std::thread;
+using std::unique_lock;
+using std::vector;
+
 namespace cert_trans {
+namespace {
+
+
+Counter<>* superseded_sth_notifications(
+    Counter<>::New("superseded_sth_notifications",
+                   "Number of tree heads the database callbacks were not "
+                   "notified of, because a newer one came along first."));
+
+
+}  // namespace
+
+
+DatabaseNotifierHelper::DatabaseNotifierHelper()
+    : num_calling_(0), has_pending_(false), exiting_(false) {
+  if (FLAGS_async_sth_notifications) {
+    dispatcher_ = thread(&DatabaseNotifierHelper::Dispatch, this);
+  }
+}
 
 
 DatabaseNotifierHelper::~DatabaseNotifierHelper() {
+  if (dispatcher_.joinable()) {
+    {
+      lock_guard<mutex> lock(lock_);
+      exiting_ = true;
+    }
+    cond_var_.notify_all();
+    dispatcher_.join();
+  }
   CHECK(callbacks_.empty());
 }
 
 
 void DatabaseNotifierHelper::Add(const NotifySTHCallback* callback) {
+  lock_guard<mutex> lock(lock_);
   CHECK(callbacks_.insert(callback).second);
 }
 
 
 void DatabaseNotifierHelper::Remove(const NotifySTHCallback* callback) {
+  unique_lock<mutex> lock(lock_);
   Map::iterator it(callbacks_.find(callback));
   CHECK(it != callbacks_.end());
 
   callbacks_.erase(it);
+  // The caller may destroy the callback once this returns. A callback
+  // removing itself doesn't have to wait for its own call, though.
+  if (dispatcher_.joinable() &&
+      std::this_thread::get_id() != dispatcher_.get_id()) {
+    cond_var_.wait(lock, [this]() { return num_calling_ == 0; });
+  }
+}
+
+
+void DatabaseNotifierHelper::Call(const ct::SignedTreeHead& sth) {
+  if (!dispatcher_.joinable()) {
+    return CallCallbacks(sth);
+  }
+
+  {
+    lock_guard<mutex> lock(lock_);
+    if (has_pending_) {
+      superseded_sth_notifications->Increment();
+      if (sth.timestamp() < pending_.timestamp()) {
+        return;
+      }
+    }
+    pending_.CopyFrom(sth);
+    has_pending_ = true;
+  }
+  cond_var_.notify_all();
+}
+
+
+void DatabaseNotifierHelper::CallCallbacks(const ct::SignedTreeHead& sth) {
+  vector<const NotifySTHCallback*> callbacks;
+  {
+    lock_guard<mutex> lock(lock_);
+    callbacks.assign(callbacks_.begin(), callbacks_.end());
+    ++num_calling_;
+  }
+  for (const NotifySTHCallback* callback : callbacks) {
+    (*callback)(sth);
+  }
+  {
+    lock_guard<mutex> lock(lock_);
+    --num_calling_;
+  }
+  cond_var_.notify_all();
 }
 
 
-void DatabaseNotifierHelper::Call(const ct::SignedTreeHead& sth) const {
-  for (Map::const_iterator it = callbacks_.begin(); it != callbacks_.end();
-       ++it) {
-    (**it)(sth);
+void DatabaseNotifierHelper::Dispatch() {
+  ct::SignedTreeHead sth;
+  while (true) {
+    {
+      unique_lock<mutex> lock(lock_);
+      cond_var_.wait(lock, [this]() { return has_pending_ || exiting_; });
+      if (exiting_) {
+        return;
+      }
+      sth.Swap(&pending_);
+      has_pending_ = false;
+    }
+    CallCallbacks(sth);
   }
 }
 
@@ -2,14 +2,24 @@
 #ifndef DATABASE_H
 #define DATABASE_H
 
+#include <condition_variable>
 #include <functional>
 #include <glog/logging.h>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "base/macros.h"
+#include "log/read_ahead.h"
+#include "merkletree/serial_hasher.h"
+#include "merkletree/tree_hasher.h"
 #include "proto/ct.pb.h"
+#include "util/status.h"
+#include "util/util.h"
 
 // The |Logged| class needs to provide this interface:
 // class Logged {
@@ -40,6 +50,20 @@
 //   // Serialization for inclusion in the tree (i.e. this is what
 //   // clients would hash over).
 //   bool SerializeForLeaf(std::string *dst) const;
+//   // The tree hash of that serialization, if it was computed and
+//   // stored with the item already, or an empty string.
+//   const std::string& merkle_leaf_hash() const;
+//
+//   // Serialization of the data and of the SCT returned alongside the
+//   // leaf by get-entries.
+//   bool SerializeExtraData(std::string *dst) const;
+//   bool SerializeSCT(std::string *dst) const;
+//
+//   // Moves the certificates of the chain out, keyed by hash, and puts
+//   // them back, for databases that store them apart from the entries.
+//   void SplitChain(std::map<std::string, std::string> *certs);
+//   bool JoinChain(const std::function<bool(const std::string &hash,
+//                                           std::string *cert)> &lookup);
 //
 //   // Debugging.
 //   std::string DebugString() const;
@@ -81,6 +105,51 @@ class ReadOnlyDatabase {
     DISALLOW_COPY_AND_ASSIGN(Iterator);
   };
 
+  // An entry in the form served by get-entries.
+  struct RawLeaf {
+    int64_t sequence_number;
+    std::string leaf_input;
+    std::string extra_data;
+    std::string sct;
+    // The get-entries object for the entry (without its SCT), as made
+    // by EntryJson(), if the database stores it; empty otherwise.
+    std::string json;
+  };
+
+  class RawLeafIterator {
+   public:
+    RawLeafIterator() = default;
+    virtual ~RawLeafIterator() = default;
+
+    // If the next entry is available, fill *leaf and return true,
+    // otherwise return false.
+    virtual bool GetNextLeaf(RawLeaf* leaf) = 0;
+
+   private:
+    DISALLOW_COPY_AND_ASSIGN(RawLeafIterator);
+  };
+
+  // What the Merkle tree needs of an entry: the tree hash of its leaf,
+  // and its timestamp.
+  struct LeafHash {
+    int64_t sequence_number;
+    std::string hash;
+    uint64_t timestamp;
+  };
+
+  class LeafHashIterator {
+   public:
+    LeafHashIterator() = default;
+    virtual ~LeafHashIterator() = default;
+
+    // If the next entry is available, fill *leaf_hash and return
+    // true, otherwise return false.
+    virtual bool GetNextLeafHash(LeafHash* leaf_hash) = 0;
+
+   private:
+    DISALLOW_COPY_AND_ASSIGN(LeafHashIterator);
+  };
+
   virtual ~ReadOnlyDatabase() = default;
 
   // Look up by hash. If the entry exists write the result. If the
@@ -98,11 +167,59 @@ class ReadOnlyDatabase {
   // Scan the entries, starting with the given index.
   virtual std::unique_ptr<Iterator> ScanEntries(int64_t start_index) const = 0;
 
+  // As above, but if |readahead| is non-zero, the entries are read and
+  // parsed on another thread, up to |readahead| of them ahead of the
+  // caller, so that it overlaps with what the caller does with them.
+  // This starts a thread, so it is only worth it for long scans.
+  std::unique_ptr<Iterator> ScanEntriesAhead(int64_t start_index,
+                                             size_t readahead) const;
+
+  // Scan the serialized entries, starting with the given index, and
+  // stopping at the first one missing. The default implementation
+  // serializes the entries returned by ScanEntries(); implementations
+  // can do better by storing the serialized forms.
+  virtual std::unique_ptr<RawLeafIterator> ScanRawLeaves(
+      int64_t start_index) const;
+
+  // Scan the leaf hashes, starting with the given index, and stopping
+  // at the first entry missing. The default implementation hashes the
+  // entries returned by ScanEntries() (unless they have their
+  // merkle_leaf_hash() already); implementations can do better by
+  // storing the hashes when the entries are sequenced.
+  virtual std::unique_ptr<LeafHashIterator> ScanLeafHashes(
+      int64_t start_index) const;
+
+  // As above, reading up to |readahead| leaf hashes ahead of the
+  // caller on another thread, if it is non-zero.
+  std::unique_ptr<LeafHashIterator> ScanLeafHashesAhead(
+      int64_t start_index, size_t readahead) const;
+
+  // Scan the entries whose timestamp() is in [|begin|, |end|), sparse
+  // ones included. The order is up to the implementation. The default
+  // implementation scans all the entries, in sequence number order, and
+  // skips the others; implementations can do better by indexing the
+  // entries by timestamp.
+  virtual std::unique_ptr<Iterator> ScanEntriesByTime(uint64_t begin,
+                                                      uint64_t end) const;
+
+  // The hash of the perfect subtree at (|level|, |index|) of the tree
+  // formed by the contiguous entries, for use by cert_trans::SubtreeProver,
+  // if the implementation stores them. Returns NOT_FOUND by default.
+  virtual LookupResult LookupSubtreeHash(int level, int64_t index,
+                                         std::string* hash) const {
+    return NOT_FOUND;
+  }
+
   // Return the number of entries of contiguous entries (what could be
   // put in a signed tree head). This can be greater than the tree
   // size returned by LatestTreeHead.
   virtual int64_t TreeSize() const = 0;
 
+  // Return, in order, the sequence numbers of the entries past
+  // TreeSize(), which are not contiguous with the others yet (while
+  // the log is being fetched, for example).
+  virtual std::vector<int64_t> SparseEntries() const = 0;
+
   // Add/remove a callback to be called when a new tree head is
   // available. The pointer is used as a key, so it should be the same
   // in matching add/remove calls.
@@ -118,14 +235,241 @@ class ReadOnlyDatabase {
   virtual void InitializeNode(const std::string& node_id) = 0;
   virtual LookupResult NodeId(std::string* node_id) = 0;
 
+  // For a database following the files another process writes (such
+  // as a RocksDB secondary instance), picks up what was written since
+  // the last call, and notifies the callbacks of the new tree head, if
+  // there is one. Does nothing by default.
+  virtual util::Status CatchUp() {
+    return util::Status::OK;
+  }
+
+  // The JSON object get-entries serves for |leaf|, as JsonWriter would
+  // write it.
+  static std::string EntryJson(const RawLeaf& leaf) {
+    return "{\"leaf_input\":\"" + util::ToBase64(leaf.leaf_input) +
+           "\",\"extra_data\":\"" + util::ToBase64(leaf.extra_data) + "\"}";
+  }
+
  protected:
   ReadOnlyDatabase() = default;
 
+  static bool SerializeRawLeaf(const Logged& logged, RawLeaf* leaf) {
+    leaf->sequence_number = logged.sequence_number();
+    leaf->json.clear();
+    return logged.SerializeForLeaf(&leaf->leaf_input) &&
+           logged.SerializeExtraData(&leaf->extra_data) &&
+           logged.SerializeSCT(&leaf->sct);
+  }
+
+  static bool HashLeaf(const TreeHasher& hasher, const Logged& logged,
+                       LeafHash* leaf_hash) {
+    leaf_hash->sequence_number = logged.sequence_number();
+    leaf_hash->timestamp = logged.timestamp();
+    if (!logged.merkle_leaf_hash().empty()) {
+      leaf_hash->hash = logged.merkle_leaf_hash();
+      return true;
+    }
+    std::string leaf;
+    if (!logged.SerializeForLeaf(&leaf)) {
+      return false;
+    }
+    leaf_hash->hash = hasher.HashLeaf(leaf);
+    return true;
+  }
+
  private:
+  class SerializingLeafIterator;
+  class HashingLeafIterator;
+  class TimeRangeIterator;
+  class ReadAheadIterator;
+  class ReadAheadLeafHashIterator;
+
   DISALLOW_COPY_AND_ASSIGN(ReadOnlyDatabase);
 };
 
 
+template <class Logged>
+class ReadOnlyDatabase<Logged>::SerializingLeafIterator
+    : public ReadOnlyDatabase<Logged>::RawLeafIterator {
+ public:
+  SerializingLeafIterator(const ReadOnlyDatabase<Logged>* db,
+                          int64_t start_index)
+      : it_(db->ScanEntries(start_index)), next_index_(start_index) {
+  }
+
+  bool GetNextLeaf(RawLeaf* leaf) override {
+    if (!it_->GetNextEntry(&logged_) ||
+        logged_.sequence_number() != next_index_) {
+      return false;
+    }
+    if (!SerializeRawLeaf(logged_, leaf)) {
+      LOG(WARNING) << "Failed to serialize entry @ " << next_index_ << ":\n"
+                   << logged_.DebugString();
+      return false;
+    }
+    ++next_index_;
+    return true;
+  }
+
+ private:
+  const std::unique_ptr<typename ReadOnlyDatabase<Logged>::Iterator> it_;
+  int64_t next_index_;
+  // Reused for each entry, to save on allocations.
+  Logged logged_;
+};
+
+
+template <class Logged>
+std::unique_ptr<typename ReadOnlyDatabase<Logged>::RawLeafIterator>
+ReadOnlyDatabase<Logged>::ScanRawLeaves(int64_t start_index) const {
+  return std::unique_ptr<RawLeafIterator>(
+      new SerializingLeafIterator(this, start_index));
+}
+
+
+template <class Logged>
+class ReadOnlyDatabase<Logged>::HashingLeafIterator
+    : public ReadOnlyDatabase<Logged>::LeafHashIterator {
+ public:
+  HashingLeafIterator(const ReadOnlyDatabase<Logged>* db, int64_t start_index)
+      : it_(db->ScanEntries(start_index)),
+        next_index_(start_index),
+        hasher_(new Sha256Hasher) {
+  }
+
+  bool GetNextLeafHash(LeafHash* leaf_hash) override {
+    if (!it_->GetNextEntry(&logged_) ||
+        logged_.sequence_number() != next_index_) {
+      return false;
+    }
+    if (!HashLeaf(hasher_, logged_, leaf_hash)) {
+      LOG(WARNING) << "Failed to serialize entry @ " << next_index_ << ":\n"
+                   << logged_.DebugString();
+      return false;
+    }
+    ++next_index_;
+    return true;
+  }
+
+ private:
+  const std::unique_ptr<typename ReadOnlyDatabase<Logged>::Iterator> it_;
+  int64_t next_index_;
+  const TreeHasher hasher_;
+  // Reused for each entry, to save on allocations.
+  Logged logged_;
+};
+
+
+template <class Logged>
+std::unique_ptr<typename ReadOnlyDatabase<Logged>::LeafHashIterator>
+ReadOnlyDatabase<Logged>::ScanLeafHashes(int64_t start_index) const {
+  return std::unique_ptr<LeafHashIterator>(
+      new HashingLeafIterator(this, start_index));
+}
+
+
+template <class Logged>
+class ReadOnlyDatabase<Logged>::TimeRangeIterator
+    : public ReadOnlyDatabase<Logged>::Iterator {
+ public:
+  TimeRangeIterator(const ReadOnlyDatabase<Logged>* db, uint64_t begin,
+                    uint64_t end)
+      : it_(db->ScanEntries(0)), begin_(begin), end_(end) {
+  }
+
+  bool GetNextEntry(Logged* entry) override {
+    while (it_->GetNextEntry(entry)) {
+      if (entry->timestamp() >= begin_ && entry->timestamp() < end_) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  const std::unique_ptr<typename ReadOnlyDatabase<Logged>::Iterator> it_;
+  const uint64_t begin_;
+  const uint64_t end_;
+};
+
+
+template <class Logged>
+std::unique_ptr<typename ReadOnlyDatabase<Logged>::Iterator>
+ReadOnlyDatabase<Logged>::ScanEntriesByTime(uint64_t begin,
+                                            uint64_t end) const {
+  return std::unique_ptr<Iterator>(new TimeRangeIterator(this, begin, end));
+}
+
+
+template <class Logged>
+class ReadOnlyDatabase<Logged>::ReadAheadIterator
+    : public ReadOnlyDatabase<Logged>::Iterator {
+ public:
+  ReadAheadIterator(std::unique_ptr<Iterator> it, size_t readahead)
+      : it_(std::move(it)),
+        read_ahead_(std::bind(&Iterator::GetNextEntry, it_.get(),
+                              std::placeholders::_1),
+                    readahead) {
+  }
+
+  bool GetNextEntry(Logged* entry) override {
+    return read_ahead_.Next(entry);
+  }
+
+ private:
+  // Only used by the thread of |read_ahead_|, which is stopped first.
+  const std::unique_ptr<Iterator> it_;
+  cert_trans::ReadAhead<Logged> read_ahead_;
+};
+
+
+template <class Logged>
+std::unique_ptr<typename ReadOnlyDatabase<Logged>::Iterator>
+ReadOnlyDatabase<Logged>::ScanEntriesAhead(int64_t start_index,
+                                           size_t readahead) const {
+  if (readahead == 0) {
+    return ScanEntries(start_index);
+  }
+  return std::unique_ptr<Iterator>(
+      new ReadAheadIterator(ScanEntries(start_index), readahead));
+}
+
+
+template <class Logged>
+class ReadOnlyDatabase<Logged>::ReadAheadLeafHashIterator
+    : public ReadOnlyDatabase<Logged>::LeafHashIterator {
+ public:
+  ReadAheadLeafHashIterator(std::unique_ptr<LeafHashIterator> it,
+                            size_t readahead)
+      : it_(std::move(it)),
+        read_ahead_(std::bind(&LeafHashIterator::GetNextLeafHash, it_.get(),
+                              std::placeholders::_1),
+                    readahead) {
+  }
+
+  bool GetNextLeafHash(LeafHash* leaf_hash) override {
+    return read_ahead_.Next(leaf_hash);
+  }
+
+ private:
+  // Only used by the thread of |read_ahead_|, which is stopped first.
+  const std::unique_ptr<LeafHashIterator> it_;
+  cert_trans::ReadAhead<LeafHash> read_ahead_;
+};
+
+
+template <class Logged>
+std::unique_ptr<typename ReadOnlyDatabase<Logged>::LeafHashIterator>
+ReadOnlyDatabase<Logged>::ScanLeafHashesAhead(int64_t start_index,
+                                              size_t readahead) const {
+  if (readahead == 0) {
+    return ScanLeafHashes(start_index);
+  }
+  return std::unique_ptr<LeafHashIterator>(
+      new ReadAheadLeafHashIterator(ScanLeafHashes(start_index), readahead));
+}
+
+
 template <class Logged>
 class Database : public ReadOnlyDatabase<Logged> {
  public:
@@ -154,6 +498,20 @@ class Database : public ReadOnlyDatabase<Logged> {
     return CreateSequencedEntry_(logged);
   }
 
+  // As CreateSequencedEntry(), for each of |logged| in turn, but lets
+  // the implementation write them all at once. Returns OK if all the
+  // entries were created, or already existed with the same contents.
+  // Otherwise returns the result for the first entry that could not be
+  // created; entries before it may or may not have been written.
+  WriteResult CreateSequencedEntries(
+      const std::vector<const Logged*>& logged) {
+    for (const Logged* entry : logged) {
+      CHECK(CHECK_NOTNULL(entry)->has_sequence_number());
+      CHECK_GE(entry->sequence_number(), 0);
+    }
+    return CreateSequencedEntries_(logged);
+  }
+
   // Attempt to write a tree head. Fails only if a tree head with this
   // timestamp already exists (i.e., |timestamp| is primary key). Does
   // not check that the timestamp is newer than previous entries.
@@ -169,6 +527,17 @@ class Database : public ReadOnlyDatabase<Logged> {
   // See the inline methods with similar names defined above for more
   // documentation.
   virtual WriteResult CreateSequencedEntry_(const Logged& logged) = 0;
+  // The default implementation writes the entries one at a time.
+  virtual WriteResult CreateSequencedEntries_(
+      const std::vector<const Logged*>& logged) {
+    for (const Logged* entry : logged) {
+      const WriteResult result(CreateSequencedEntry_(*entry));
+      if (result != OK) {
+        return result;
+      }
+    }
+    return OK;
+  }
   virtual WriteResult WriteTreeHead_(const ct::SignedTreeHead& sth) = 0;
 
  private:
@@ -179,21 +548,46 @@ class Database : public ReadOnlyDatabase<Logged> {
 namespace cert_trans {
 
 
+// Keeps the STH callbacks of a database, and calls them. With
+// --async_sth_notifications, Call() only hands the STH to a thread of
+// its own, which calls the callbacks with the latest STH it was given,
+// skipping those superseded in the meantime. That way, the writers of
+// tree heads don't wait for the callbacks (such as LogLookup catching
+// up with the new tree). Otherwise, Call() calls them right away.
+//
+// This class is thread-safe. Remove() waits for a call of the
+// callback in progress, so it must not be called with a lock the
+// callbacks take.
 class DatabaseNotifierHelper {
  public:
   typedef std::function<void(const ct::SignedTreeHead&)> NotifySTHCallback;
 
-  DatabaseNotifierHelper() = default;
+  DatabaseNotifierHelper();
   ~DatabaseNotifierHelper();
 
   void Add(const NotifySTHCallback* callback);
   void Remove(const NotifySTHCallback* callback);
-  void Call(const ct::SignedTreeHead& sth) const;
+  void Call(const ct::SignedTreeHead& sth);
 
  private:
   typedef std::set<const NotifySTHCallback*> Map;
 
+  void CallCallbacks(const ct::SignedTreeHead& sth);
+  void Dispatch();
+
+  std::mutex lock_;
+  std::condition_variable cond_var_;
   Map callbacks_;
+  // The number of calls of the callbacks in progress.
+  int num_calling_;
+  // The latest STH not yet handed to the callbacks, if
+  // |has_pending_|.
+  ct::SignedTreeHead pending_;
+  bool has_pending_;
+  bool exiting_;
+  // Not running unless --async_sth_notifications was set when this
+  // instance was created.
+  std::thread dispatcher_;
 
   DISALLOW_COPY_AND_ASSIGN(DatabaseNotifierHelper);
 };
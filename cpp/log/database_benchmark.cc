@@ -0,0 +1,273 @@
+/* -*- indent-tabs-mode: nil -*- */
+// Benchmarks for the Database implementations, run against each of
+// FileDB, SQLiteDB and LevelDB, e.g.:
+//
+//   database_benchmark --database_size=100000 --entry_size=2048 \
+//       --max_threads=8 --benchmark_filter=LevelDB \
+//       --benchmark_out=leveldb.json --benchmark_out_format=json
+//
+// The read benchmarks share one database of --database_size entries
+// per implementation, filled the first time one of them runs. They
+// delete it when they are done. Be careful choosing the size, as the
+// databases are written to --database_test_dir.
+#include <benchmark/benchmark.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "log/database.h"
+#include "log/file_db.h"
+#include "log/file_storage.h"
+#include "log/leveldb_db.h"
+#include "log/logged_certificate.h"
+#include "log/sqlite_db.h"
+#include "log/test_db.h"
+#include "log/test_signer.h"
+#include "util/init.h"
+
+DEFINE_int32(database_size, 10000,
+             "Number of entries to put in the test databases. Maximum is "
+             "limited to 1 000 000.");
+DEFINE_int32(entry_size, 1024,
+             "Size of the leaf certificate of each entry, in bytes. If 0, "
+             "they are 512 to 1023 bytes long.");
+DEFINE_int32(max_threads, 4,
+             "The benchmarks are run with 1, 2, 4... concurrent threads, up "
+             "to this many.");
+DEFINE_int32(scan_length, 1000,
+             "Number of entries read by each iteration of the ScanEntries "
+             "benchmarks.");
+
+namespace {
+
+using cert_trans::LoggedCertificate;
+using std::mt19937;
+using std::string;
+using std::to_string;
+using std::uniform_int_distribution;
+using std::unique_ptr;
+using std::vector;
+
+// Batch size used to fill the databases for the read benchmarks.
+const int kFillBatchSize(1000);
+
+
+// The entries written to the databases, with sequence numbers 0 to
+// --database_size - 1.
+const vector<LoggedCertificate>& Entries() {
+  static const vector<LoggedCertificate>* const entries([]() {
+    vector<LoggedCertificate>* const entries(new vector<LoggedCertificate>);
+    TestSigner signer;
+    entries->resize(FLAGS_database_size);
+    for (int i = 0; i < FLAGS_database_size; ++i) {
+      LoggedCertificate* const entry(&(*entries)[i]);
+      signer.CreateUniqueFakeSignature(entry);
+      if (FLAGS_entry_size > 0) {
+        string cert(to_string(i) + ":");
+        cert.resize(FLAGS_entry_size, 'x');
+        entry->mutable_entry()->set_type(ct::X509_ENTRY);
+        entry->mutable_entry()->clear_precert_entry();
+        entry->mutable_entry()->mutable_x509_entry()->set_leaf_certificate(
+            cert);
+        CHECK(entry->ComputeMerkleLeafHash());
+      }
+      entry->set_sequence_number(i);
+    }
+    return entries;
+  }());
+  return *entries;
+}
+
+
+// The hashes of Entries(), in the same order.
+const vector<string>& Hashes() {
+  static const vector<string>* const hashes([]() {
+    vector<string>* const hashes(new vector<string>);
+    for (const auto& entry : Entries()) {
+      hashes->push_back(entry.Hash());
+    }
+    return hashes;
+  }());
+  return *hashes;
+}
+
+
+template <class DB>
+void Fill(DB* db, size_t begin, size_t end, size_t stride, size_t batch_size) {
+  const vector<LoggedCertificate>& entries(Entries());
+  vector<const LoggedCertificate*> batch;
+  for (size_t i = begin; i < end; i += stride) {
+    for (size_t j = i; j < i + batch_size && j < end; ++j) {
+      batch.push_back(&entries[j]);
+    }
+    CHECK_EQ(DB::OK, db->CreateSequencedEntries(batch));
+    batch.clear();
+  }
+}
+
+
+// The database shared by the read benchmarks, filled with Entries().
+template <class DB>
+unique_ptr<TestDB<DB>>& FilledDatabase() {
+  static std::mutex* const lock(new std::mutex);
+  static unique_ptr<TestDB<DB>>* const db(new unique_ptr<TestDB<DB>>);
+  std::lock_guard<std::mutex> guard(*lock);
+  if (!*db) {
+    db->reset(new TestDB<DB>);
+    Fill((*db)->db(), 0, Entries().size(), kFillBatchSize, kFillBatchSize);
+  }
+  return *db;
+}
+
+
+// Writes all of Entries() to an empty database, split between the
+// threads, in batches of state.range(0). This only runs once, as the
+// entries can't be written twice.
+template <class DB>
+void BM_CreateSequencedEntries(benchmark::State& state) {
+  static unique_ptr<TestDB<DB>> db;
+  const size_t batch_size(state.range(0));
+  const size_t stride(batch_size * state.threads());
+  // The other threads wait for this one to get here before starting.
+  if (state.thread_index() == 0) {
+    Entries();
+    db.reset(new TestDB<DB>);
+  }
+
+  for (auto _ : state) {
+    Fill(db->db(), state.thread_index() * batch_size, Entries().size(),
+         stride, batch_size);
+  }
+
+  if (state.thread_index() == 0) {
+    db.reset();
+  }
+  state.SetItemsProcessed(state.iterations() * Entries().size() /
+                          state.threads());
+}
+
+
+// Lookups of random entries.
+template <class DB>
+void BM_LookupByIndex(benchmark::State& state) {
+  DB* const db(FilledDatabase<DB>()->db());
+  mt19937 rng(state.thread_index());
+  uniform_int_distribution<int64_t> index(0, Entries().size() - 1);
+  LoggedCertificate entry;
+
+  for (auto _ : state) {
+    CHECK_EQ(DB::LOOKUP_OK, db->LookupByIndex(index(rng), &entry));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+
+template <class DB>
+void BM_LookupByHash(benchmark::State& state) {
+  DB* const db(FilledDatabase<DB>()->db());
+  const vector<string>& hashes(Hashes());
+  mt19937 rng(state.thread_index());
+  uniform_int_distribution<size_t> index(0, hashes.size() - 1);
+  LoggedCertificate entry;
+
+  for (auto _ : state) {
+    CHECK_EQ(DB::LOOKUP_OK, db->LookupByHash(hashes[index(rng)], &entry));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+
+// Each iteration reads up to --scan_length entries, starting
+// state.range(0) percent of the way into the database.
+template <class DB>
+void BM_ScanEntries(benchmark::State& state) {
+  DB* const db(FilledDatabase<DB>()->db());
+  const int64_t start(Entries().size() * state.range(0) / 100);
+  LoggedCertificate entry;
+  int64_t items(0);
+
+  for (auto _ : state) {
+    const auto it(db->ScanEntries(start));
+    for (int i = 0; i < FLAGS_scan_length && it->GetNextEntry(&entry); ++i) {
+      ++items;
+    }
+  }
+  state.SetItemsProcessed(items);
+}
+
+
+// Opening the full database again, which includes rebuilding the
+// in-memory index. Its files will likely be in the page cache, so this
+// is not quite a cold start. Runs last, and deletes the database.
+template <class DB>
+void BM_Open(benchmark::State& state) {
+  const unique_ptr<TestDB<DB>>& test_db(FilledDatabase<DB>());
+
+  for (auto _ : state) {
+    // LevelDB can only be opened once at a time, so SecondDB() closes
+    // the original, and each copy has to be closed in turn.
+    unique_ptr<DB> db(test_db->SecondDB());
+    benchmark::DoNotOptimize(db->TreeSize());
+    state.PauseTiming();
+    db.reset();
+    state.ResumeTiming();
+  }
+
+  FilledDatabase<DB>().reset();
+}
+
+
+template <class DB>
+void RegisterBenchmarks(const string& name) {
+  benchmark::RegisterBenchmark((name + "/CreateSequencedEntries").c_str(),
+                               BM_CreateSequencedEntries<DB>)
+      ->ArgName("batch")
+      ->RangeMultiplier(10)
+      ->Range(1, kFillBatchSize)
+      ->ThreadRange(1, FLAGS_max_threads)
+      ->Iterations(1)
+      ->UseRealTime()
+      ->Unit(benchmark::kMillisecond);
+  benchmark::RegisterBenchmark((name + "/LookupByIndex").c_str(),
+                               BM_LookupByIndex<DB>)
+      ->ThreadRange(1, FLAGS_max_threads)
+      ->UseRealTime();
+  benchmark::RegisterBenchmark((name + "/LookupByHash").c_str(),
+                               BM_LookupByHash<DB>)
+      ->ThreadRange(1, FLAGS_max_threads)
+      ->UseRealTime();
+  benchmark::RegisterBenchmark((name + "/ScanEntries").c_str(),
+                               BM_ScanEntries<DB>)
+      ->ArgName("start_percent")
+      ->Arg(0)
+      ->Arg(50)
+      ->Arg(99)
+      ->ThreadRange(1, FLAGS_max_threads)
+      ->UseRealTime();
+  benchmark::RegisterBenchmark((name + "/Open").c_str(), BM_Open<DB>)
+      ->Unit(benchmark::kMillisecond);
+}
+
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+  util::InitCT(&argc, &argv);
+  CHECK_GT(FLAGS_database_size, 0) << "Please specify the database size";
+  CHECK_LE(FLAGS_database_size, 1000000)
+      << "Database size exceeds allowed maximum";
+  CHECK_GT(FLAGS_max_threads, 0);
+
+  RegisterBenchmarks<FileDB<LoggedCertificate>>("FileDB");
+  RegisterBenchmarks<SQLiteDB<LoggedCertificate>>("SQLiteDB");
+  RegisterBenchmarks<LevelDB<LoggedCertificate>>("LevelDB");
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -1,8 +1,13 @@
 /* -*- indent-tabs-mode: nil -*- */
+#include <gflags/gflags.h>
 #include <gtest/gtest.h>
 #include <set>
 #include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
+#include "base/notification.h"
 #include "log/database.h"
 #include "log/file_db.h"
 #include "log/file_storage.h"
@@ -11,17 +16,34 @@
 #include "log/sqlite_db.h"
 #include "log/test_db.h"
 #include "log/test_signer.h"
+#include "merkletree/merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "merkletree/subtree_prover.h"
+#include "merkletree/tree_hasher.h"
 #include "util/testing.h"
 #include "util/util.h"
 
+DECLARE_bool(async_sth_notifications);
+DECLARE_string(leveldb_entry_dictionary);
+DECLARE_bool(leveldb_entry_json);
+DECLARE_bool(leveldb_leaf_hashes);
+DECLARE_bool(leveldb_raw_leaves);
+DECLARE_bool(leveldb_shared_chain_certs);
+DECLARE_bool(leveldb_subtree_hashes);
+DECLARE_bool(leveldb_time_index);
+DECLARE_bool(sqlite_batch_into_transactions);
+DECLARE_int32(sqlite_group_commit_delay_ms);
+
 // TODO(benl): Introduce a test |Logged| type.
 
 namespace {
 
 using cert_trans::LoggedCertificate;
+using cert_trans::Notification;
 using ct::SignedTreeHead;
 using std::string;
 using std::unique_ptr;
+using std::vector;
 
 
 template <class T>
@@ -41,9 +63,16 @@ class DBTest : public ::testing::Test {
   TestSigner test_signer_;
 };
 
+#ifdef HAVE_ROCKSDB
+typedef testing::Types<FileDB<cert_trans::LoggedCertificate>,
+                       SQLiteDB<cert_trans::LoggedCertificate>,
+                       LevelDB<cert_trans::LoggedCertificate>,
+                       RocksDB<cert_trans::LoggedCertificate>> Databases;
+#else
 typedef testing::Types<FileDB<cert_trans::LoggedCertificate>,
                        SQLiteDB<cert_trans::LoggedCertificate>,
                        LevelDB<cert_trans::LoggedCertificate>> Databases;
+#endif
 
 typedef Database<cert_trans::LoggedCertificate> DB;
 
@@ -55,6 +84,32 @@ TYPED_TEST_CASE(DBTest, Databases);
 TYPED_TEST_CASE(DBTestDeathTest, Databases);
 
 
+void ExpectRawLeaf(const LoggedCertificate& logged,
+                   const DB::RawLeaf& leaf) {
+  DB::RawLeaf expected;
+  ASSERT_TRUE(logged.SerializeForLeaf(&expected.leaf_input));
+  ASSERT_TRUE(logged.SerializeExtraData(&expected.extra_data));
+  ASSERT_TRUE(logged.SerializeSCT(&expected.sct));
+  EXPECT_EQ(logged.sequence_number(), leaf.sequence_number);
+  EXPECT_EQ(util::HexString(expected.leaf_input),
+            util::HexString(leaf.leaf_input));
+  EXPECT_EQ(util::HexString(expected.extra_data),
+            util::HexString(leaf.extra_data));
+  EXPECT_EQ(util::HexString(expected.sct), util::HexString(leaf.sct));
+}
+
+
+void ExpectLeafHash(const LoggedCertificate& logged,
+                    const DB::LeafHash& leaf_hash) {
+  string leaf;
+  ASSERT_TRUE(logged.SerializeForLeaf(&leaf));
+  EXPECT_EQ(logged.sequence_number(), leaf_hash.sequence_number);
+  EXPECT_EQ(util::HexString(TreeHasher(new Sha256Hasher).HashLeaf(leaf)),
+            util::HexString(leaf_hash.hash));
+  EXPECT_EQ(logged.timestamp(), leaf_hash.timestamp);
+}
+
+
 TYPED_TEST(DBTest, CreateSequenced) {
   LoggedCertificate logged_cert, lookup_cert;
   this->test_signer_.CreateUnique(&logged_cert);
@@ -171,6 +226,44 @@ TYPED_TEST(DBTest, CreateSequencedDuplicateSequenceNumber) {
 }
 
 
+TYPED_TEST(DBTest, CreateSequencedEntries) {
+  std::vector<LoggedCertificate> entries(5);
+  std::vector<const LoggedCertificate*> batch;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    this->test_signer_.CreateUnique(&entries[i]);
+    entries[i].set_sequence_number(i);
+    batch.push_back(&entries[i]);
+  }
+
+  EXPECT_EQ(DB::OK, this->db()->CreateSequencedEntries(
+                        std::vector<const LoggedCertificate*>()));
+  EXPECT_EQ(DB::OK, this->db()->CreateSequencedEntry(entries[1]));
+  // Entries that are already there, with the same contents, are fine.
+  EXPECT_EQ(DB::OK, this->db()->CreateSequencedEntries(batch));
+  EXPECT_EQ(5, this->db()->TreeSize());
+
+  LoggedCertificate lookup_cert;
+  for (const auto& entry : entries) {
+    EXPECT_EQ(DB::LOOKUP_OK,
+              this->db()->LookupByIndex(entry.sequence_number(),
+                                        &lookup_cert));
+    TestSigner::TestEqualLoggedCerts(entry, lookup_cert);
+    EXPECT_EQ(DB::LOOKUP_OK,
+              this->db()->LookupByHash(entry.Hash(), &lookup_cert));
+    EXPECT_EQ(entry.sequence_number(), lookup_cert.sequence_number());
+  }
+
+  LoggedCertificate duplicate_seq;
+  this->test_signer_.CreateUnique(&duplicate_seq);
+  duplicate_seq.set_sequence_number(3);
+  EXPECT_EQ(DB::SEQUENCE_NUMBER_ALREADY_IN_USE,
+            this->db()->CreateSequencedEntries(
+                std::vector<const LoggedCertificate*>(1, &duplicate_seq)));
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupByIndex(3, &lookup_cert));
+  TestSigner::TestEqualLoggedCerts(entries[3], lookup_cert);
+}
+
+
 TYPED_TEST(DBTest, TreeSize) {
   LoggedCertificate logged_cert;
 
@@ -217,6 +310,27 @@ TYPED_TEST(DBTest, TreeSize) {
 }
 
 
+TYPED_TEST(DBTest, SparseEntries) {
+  EXPECT_TRUE(this->db()->SparseEntries().empty());
+
+  LoggedCertificate logged_cert;
+  for (const int64_t sequence_number : {0, 2, 3, 5}) {
+    this->test_signer_.CreateUnique(&logged_cert);
+    logged_cert.set_sequence_number(sequence_number);
+    EXPECT_EQ(DB::OK, this->db()->CreateSequencedEntry(logged_cert));
+  }
+  EXPECT_EQ(1, this->db()->TreeSize());
+  EXPECT_EQ((vector<int64_t>{2, 3, 5}), this->db()->SparseEntries());
+
+  // Entries stop being sparse once the gap before them is filled.
+  this->test_signer_.CreateUnique(&logged_cert);
+  logged_cert.set_sequence_number(1);
+  EXPECT_EQ(DB::OK, this->db()->CreateSequencedEntry(logged_cert));
+  EXPECT_EQ((vector<int64_t>{5}), this->db()->SparseEntries());
+  EXPECT_EQ(4, this->db()->TreeSize());
+}
+
+
 TYPED_TEST(DBTest, LookupBySequenceNumber) {
   LoggedCertificate logged_cert, logged_cert2, lookup_cert, lookup_cert2;
   this->test_signer_.CreateUnique(&logged_cert);
@@ -428,6 +542,622 @@ TYPED_TEST(DBTest, Iterator) {
 }
 
 
+// Returns the sequence numbers of the entries |it| returns, sorted.
+std::set<int64_t> ScannedSequenceNumbers(DB::Iterator* it) {
+  std::set<int64_t> sequence_numbers;
+  LoggedCertificate logged;
+  while (it->GetNextEntry(&logged)) {
+    EXPECT_TRUE(sequence_numbers.insert(logged.sequence_number()).second);
+  }
+  return sequence_numbers;
+}
+
+
+TYPED_TEST(DBTest, ScanEntriesByTime) {
+  // Timestamps out of sequence number order, with a sparse entry.
+  const std::vector<uint64_t> timestamps{1000, 3000, 2000, 2000, 5000, 4000};
+  for (size_t i = 0; i < timestamps.size(); ++i) {
+    LoggedCertificate logged;
+    this->test_signer_.CreateUnique(&logged);
+    logged.mutable_sct()->set_timestamp(timestamps[i]);
+    logged.set_sequence_number(i == 5 ? 10 : i);
+    ASSERT_EQ(DB::OK, this->db()->CreateSequencedEntry(logged));
+  }
+
+  EXPECT_EQ((std::set<int64_t>{1, 2, 3}),
+            ScannedSequenceNumbers(
+                this->db()->ScanEntriesByTime(2000, 4000).get()));
+  EXPECT_EQ((std::set<int64_t>{4, 10}),
+            ScannedSequenceNumbers(
+                this->db()->ScanEntriesByTime(3001, 10000).get()));
+  EXPECT_TRUE(ScannedSequenceNumbers(
+                  this->db()->ScanEntriesByTime(2000, 2000).get())
+                  .empty());
+}
+
+
+TYPED_TEST(DBTest, ScanEntriesAhead) {
+  std::vector<LoggedCertificate> entries(10);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    this->test_signer_.CreateUnique(&entries[i]);
+    entries[i].set_sequence_number(i);
+    ASSERT_EQ(DB::OK, this->db()->CreateSequencedEntry(entries[i]));
+  }
+
+  for (size_t readahead : {0, 1, 3, 20}) {
+    unique_ptr<DB::Iterator> it(this->db()->ScanEntriesAhead(2, readahead));
+    LoggedCertificate it_cert;
+    for (size_t i = 2; i < entries.size(); ++i) {
+      ASSERT_TRUE(it->GetNextEntry(&it_cert));
+      TestSigner::TestEqualLoggedCerts(entries[i], it_cert);
+    }
+    EXPECT_FALSE(it->GetNextEntry(&it_cert));
+  }
+
+  // Stopped before the end.
+  unique_ptr<DB::Iterator> it(this->db()->ScanEntriesAhead(0, 2));
+  LoggedCertificate it_cert;
+  ASSERT_TRUE(it->GetNextEntry(&it_cert));
+  TestSigner::TestEqualLoggedCerts(entries[0], it_cert);
+}
+
+
+TYPED_TEST(DBTest, ScanRawLeaves) {
+  std::vector<LoggedCertificate> entries(5);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    this->test_signer_.CreateUnique(&entries[i]);
+    entries[i].set_sequence_number(i);
+    if (i != 3) {
+      ASSERT_EQ(DB::OK, this->db()->CreateSequencedEntry(entries[i]));
+    }
+  }
+
+  // The scan stops at the missing entry.
+  unique_ptr<DB::RawLeafIterator> it(this->db()->ScanRawLeaves(0));
+  DB::RawLeaf leaf;
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_TRUE(it->GetNextLeaf(&leaf));
+    ExpectRawLeaf(entries[i], leaf);
+  }
+  EXPECT_FALSE(it->GetNextLeaf(&leaf));
+
+  it = this->db()->ScanRawLeaves(4);
+  ASSERT_TRUE(it->GetNextLeaf(&leaf));
+  ExpectRawLeaf(entries[4], leaf);
+  EXPECT_FALSE(it->GetNextLeaf(&leaf));
+}
+
+
+TYPED_TEST(DBTest, ScanLeafHashes) {
+  std::vector<LoggedCertificate> entries(5);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    this->test_signer_.CreateUnique(&entries[i]);
+    entries[i].set_sequence_number(i);
+    if (i != 3) {
+      ASSERT_EQ(DB::OK, this->db()->CreateSequencedEntry(entries[i]));
+    }
+  }
+
+  // The scan stops at the missing entry.
+  unique_ptr<DB::LeafHashIterator> it(this->db()->ScanLeafHashesAhead(0, 2));
+  DB::LeafHash leaf_hash;
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_TRUE(it->GetNextLeafHash(&leaf_hash));
+    ExpectLeafHash(entries[i], leaf_hash);
+  }
+  EXPECT_FALSE(it->GetNextLeafHash(&leaf_hash));
+
+  it = this->db()->ScanLeafHashes(4);
+  ASSERT_TRUE(it->GetNextLeafHash(&leaf_hash));
+  ExpectLeafHash(entries[4], leaf_hash);
+  EXPECT_FALSE(it->GetNextLeafHash(&leaf_hash));
+}
+
+
+TEST(SQLiteDBTest, GroupCommit) {
+  FLAGS_sqlite_batch_into_transactions = false;
+  FLAGS_sqlite_group_commit_delay_ms = 20;
+  TestDB<SQLiteDB<LoggedCertificate>> test_db;
+  TestSigner test_signer;
+  const int kThreads(8);
+  const int kEntriesPerThread(10);
+
+  std::vector<LoggedCertificate> entries(kThreads * kEntriesPerThread);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    test_signer.CreateUnique(&entries[i]);
+    entries[i].set_sequence_number(i);
+  }
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&test_db, &entries, t, kThreads]() {
+      for (size_t i = t; i < entries.size(); i += kThreads) {
+        EXPECT_EQ(DB::OK, test_db.db()->CreateSequencedEntry(entries[i]));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  // Another connection only sees committed entries.
+  const unique_ptr<SQLiteDB<LoggedCertificate>> db2(test_db.SecondDB());
+  EXPECT_EQ(static_cast<int64_t>(entries.size()), db2->TreeSize());
+  FLAGS_sqlite_batch_into_transactions = true;
+  FLAGS_sqlite_group_commit_delay_ms = 0;
+}
+
+
+TEST(LevelDBTest, RawLeaves) {
+  TestDB<LevelDB<LoggedCertificate>> test_db;
+  TestSigner test_signer;
+
+  std::vector<LoggedCertificate> entries(4);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    test_signer.CreateUnique(&entries[i]);
+    entries[i].set_sequence_number(i);
+    // The first entries are written without their raw leaves, which
+    // then have to be serialized when scanning.
+    FLAGS_leveldb_raw_leaves = i >= 2;
+    ASSERT_EQ(DB::OK, test_db.db()->CreateSequencedEntry(entries[i]));
+  }
+
+  unique_ptr<DB::RawLeafIterator> it(test_db.db()->ScanRawLeaves(0));
+  DB::RawLeaf leaf;
+  for (const auto& entry : entries) {
+    ASSERT_TRUE(it->GetNextLeaf(&leaf));
+    ExpectRawLeaf(entry, leaf);
+  }
+  EXPECT_FALSE(it->GetNextLeaf(&leaf));
+  FLAGS_leveldb_raw_leaves = false;
+}
+
+
+TEST(LevelDBTest, RawLeavesWithJson) {
+  TestDB<LevelDB<LoggedCertificate>> test_db;
+  TestSigner test_signer;
+  FLAGS_leveldb_raw_leaves = true;
+
+  std::vector<LoggedCertificate> entries(4);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    test_signer.CreateUnique(&entries[i]);
+    entries[i].set_sequence_number(i);
+    // Raw leaves stored without their JSON can still be read.
+    FLAGS_leveldb_entry_json = i >= 2;
+    ASSERT_EQ(DB::OK, test_db.db()->CreateSequencedEntry(entries[i]));
+  }
+
+  unique_ptr<DB::RawLeafIterator> it(test_db.db()->ScanRawLeaves(0));
+  DB::RawLeaf leaf;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    ASSERT_TRUE(it->GetNextLeaf(&leaf));
+    ExpectRawLeaf(entries[i], leaf);
+    if (i >= 2) {
+      EXPECT_EQ("{\"leaf_input\":\"" + util::ToBase64(leaf.leaf_input) +
+                    "\",\"extra_data\":\"" +
+                    util::ToBase64(leaf.extra_data) + "\"}",
+                leaf.json);
+    } else {
+      EXPECT_EQ("", leaf.json);
+    }
+  }
+  EXPECT_FALSE(it->GetNextLeaf(&leaf));
+  FLAGS_leveldb_entry_json = false;
+  FLAGS_leveldb_raw_leaves = false;
+}
+
+
+TEST(LevelDBTest, LeafHashes) {
+  FLAGS_leveldb_subtree_hashes = true;
+  TestDB<LevelDB<LoggedCertificate>> test_db;
+  TestSigner test_signer;
+
+  std::vector<LoggedCertificate> entries(4);
+  MerkleTree tree(new Sha256Hasher);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    test_signer.CreateUnique(&entries[i]);
+    entries[i].set_sequence_number(i);
+    string leaf;
+    ASSERT_TRUE(entries[i].SerializeForLeaf(&leaf));
+    tree.AddLeaf(leaf);
+    // The first entries are written without their leaf hashes, which
+    // then have to be computed when scanning.
+    FLAGS_leveldb_leaf_hashes = i >= 2;
+    ASSERT_EQ(DB::OK, test_db.db()->CreateSequencedEntry(entries[i]));
+  }
+
+  unique_ptr<DB::LeafHashIterator> it(test_db.db()->ScanLeafHashes(0));
+  DB::LeafHash leaf_hash;
+  for (const auto& entry : entries) {
+    ASSERT_TRUE(it->GetNextLeafHash(&leaf_hash));
+    ExpectLeafHash(entry, leaf_hash);
+  }
+  EXPECT_FALSE(it->GetNextLeafHash(&leaf_hash));
+
+  // The subtree hashes are built from the stored leaf hashes.
+  string hash;
+  ASSERT_EQ(DB::LOOKUP_OK, test_db.db()->LookupSubtreeHash(2, 0, &hash));
+  EXPECT_EQ(tree.CurrentRoot(), hash);
+  FLAGS_leveldb_leaf_hashes = false;
+  FLAGS_leveldb_subtree_hashes = false;
+}
+
+
+TEST(LevelDBTest, SharedChainCerts) {
+  TestDB<LevelDB<LoggedCertificate>> test_db;
+  TestSigner test_signer;
+  const string intermediate(util::RandomString(512, 1024));
+  const string root(util::RandomString(512, 1024));
+
+  std::vector<LoggedCertificate> entries(4);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    test_signer.CreateUnique(&entries[i]);
+    entries[i].set_sequence_number(i);
+    ct::LogEntry* const entry(entries[i].mutable_entry());
+    google::protobuf::RepeatedPtrField<string>* const chain(
+        entry->type() == ct::X509_ENTRY
+            ? entry->mutable_x509_entry()->mutable_certificate_chain()
+            : entry->mutable_precert_entry()
+                  ->mutable_precertificate_chain());
+    chain->Clear();
+    *chain->Add() = intermediate;
+    if (i % 2 == 0) {
+      *chain->Add() = root;
+    }
+    // The first entry is stored with its chain.
+    FLAGS_leveldb_shared_chain_certs = i > 0;
+    ASSERT_EQ(DB::OK, test_db.db()->CreateSequencedEntry(entries[i]));
+  }
+
+  // The entries can be written again, however they were stored.
+  for (const bool shared : {true, false}) {
+    FLAGS_leveldb_shared_chain_certs = shared;
+    for (const auto& entry : entries) {
+      EXPECT_EQ(DB::OK, test_db.db()->CreateSequencedEntry(entry));
+    }
+  }
+  LoggedCertificate other_chain(entries[1]);
+  other_chain.mutable_entry()->mutable_x509_entry()->add_certificate_chain(
+      "other");
+  other_chain.mutable_entry()->mutable_precert_entry()
+      ->add_precertificate_chain("other");
+  EXPECT_EQ(DB::SEQUENCE_NUMBER_ALREADY_IN_USE,
+            test_db.db()->CreateSequencedEntry(other_chain));
+
+  unique_ptr<LevelDB<LoggedCertificate>> db2(test_db.SecondDB());
+  unique_ptr<DB::Iterator> it(db2->ScanEntries(0));
+  LoggedCertificate lookup;
+  for (const auto& entry : entries) {
+    ASSERT_EQ(DB::LOOKUP_OK,
+              db2->LookupByIndex(entry.sequence_number(), &lookup));
+    TestSigner::TestEqualLoggedCerts(entry, lookup);
+    EXPECT_EQ(0, lookup.chain_certificate_hashes_size());
+    ASSERT_EQ(DB::LOOKUP_OK, db2->LookupByHash(entry.Hash(), &lookup));
+    TestSigner::TestEqualLoggedCerts(entry, lookup);
+    ASSERT_TRUE(it->GetNextEntry(&lookup));
+    TestSigner::TestEqualLoggedCerts(entry, lookup);
+  }
+  EXPECT_FALSE(it->GetNextEntry(&lookup));
+}
+
+
+TEST(LevelDBTest, EntryDictionary) {
+  TestDB<LevelDB<LoggedCertificate>> test_db;
+  TestSigner test_signer;
+
+  std::vector<LoggedCertificate> entries(6);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    test_signer.CreateUnique(&entries[i]);
+    entries[i].set_sequence_number(i);
+  }
+  // The first entries are stored uncompressed, the next ones with one
+  // dictionary, and the last ones with another.
+  ASSERT_EQ(DB::OK, test_db.db()->CreateSequencedEntry(entries[0]));
+  ASSERT_EQ(DB::OK, test_db.db()->CreateSequencedEntry(entries[1]));
+  unique_ptr<LevelDB<LoggedCertificate>> db;
+  for (const int first : {2, 4}) {
+    string dictionary;
+    ASSERT_TRUE(entries[first - 1].SerializeToString(&dictionary));
+    FLAGS_leveldb_entry_dictionary =
+        util::WriteTemporaryBinaryFile("/tmp/dictionaryXXXXXX", dictionary);
+    ASSERT_FALSE(FLAGS_leveldb_entry_dictionary.empty());
+    db.reset();
+    db.reset(test_db.SecondDB());
+    unlink(FLAGS_leveldb_entry_dictionary.c_str());
+    for (int i = first; i < first + 2; ++i) {
+      ASSERT_EQ(DB::OK, db->CreateSequencedEntry(entries[i]));
+      // Writing an entry again is fine.
+      EXPECT_EQ(DB::OK, db->CreateSequencedEntry(entries[i]));
+    }
+  }
+  FLAGS_leveldb_entry_dictionary.clear();
+
+  // Rewriting the entries compares them uncompressed.
+  db.reset();
+  db.reset(test_db.SecondDB());
+  for (const auto& entry : entries) {
+    EXPECT_EQ(DB::OK, db->CreateSequencedEntry(entry));
+  }
+  LoggedCertificate other(entries[3]);
+  other.mutable_sct()->set_timestamp(other.timestamp() + 1);
+  EXPECT_EQ(DB::SEQUENCE_NUMBER_ALREADY_IN_USE,
+            db->CreateSequencedEntry(other));
+
+  unique_ptr<DB::Iterator> it(db->ScanEntries(0));
+  LoggedCertificate lookup;
+  for (const auto& entry : entries) {
+    ASSERT_EQ(DB::LOOKUP_OK,
+              db->LookupByIndex(entry.sequence_number(), &lookup));
+    TestSigner::TestEqualLoggedCerts(entry, lookup);
+    ASSERT_EQ(DB::LOOKUP_OK, db->LookupByHash(entry.Hash(), &lookup));
+    TestSigner::TestEqualLoggedCerts(entry, lookup);
+    ASSERT_TRUE(it->GetNextEntry(&lookup));
+    TestSigner::TestEqualLoggedCerts(entry, lookup);
+  }
+  EXPECT_FALSE(it->GetNextEntry(&lookup));
+}
+
+
+TEST(LevelDBTest, ResumeSparseEntries) {
+  TestDB<LevelDB<LoggedCertificate>> test_db;
+  TestSigner test_signer;
+
+  std::vector<LoggedCertificate> entries(4);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    test_signer.CreateUnique(&entries[i]);
+    entries[i].set_sequence_number(i);
+  }
+  // Same hash as entries[1], but a higher sequence number.
+  LoggedCertificate duplicate(entries[1]);
+  duplicate.set_sequence_number(5);
+  EXPECT_EQ(DB::OK, test_db.db()->CreateSequencedEntry(duplicate));
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (i != 2) {
+      EXPECT_EQ(DB::OK, test_db.db()->CreateSequencedEntry(entries[i]));
+    }
+  }
+
+  LoggedCertificate lookup_cert;
+  unique_ptr<LevelDB<LoggedCertificate>> db2(test_db.SecondDB());
+  EXPECT_EQ(2, db2->TreeSize());
+  EXPECT_EQ(DB::LOOKUP_OK, db2->LookupByHash(entries[3].Hash(), &lookup_cert));
+  EXPECT_EQ(3, lookup_cert.sequence_number());
+  EXPECT_EQ(DB::LOOKUP_OK, db2->LookupByHash(entries[1].Hash(), &lookup_cert));
+  EXPECT_EQ(1, lookup_cert.sequence_number());
+
+  // Filling the gap makes the sparse entries found at startup contiguous.
+  EXPECT_EQ(DB::OK, db2->CreateSequencedEntry(entries[2]));
+  EXPECT_EQ(4, db2->TreeSize());
+  db2.reset();
+  db2.reset(test_db.SecondDB());
+  EXPECT_EQ(4, db2->TreeSize());
+  EXPECT_EQ(DB::LOOKUP_OK, db2->LookupByHash(entries[2].Hash(), &lookup_cert));
+  EXPECT_EQ(2, lookup_cert.sequence_number());
+}
+
+
+TEST(LevelDBTest, SubtreeHashes) {
+  FLAGS_leveldb_subtree_hashes = true;
+  TestDB<LevelDB<LoggedCertificate>> test_db;
+  TestSigner test_signer;
+  const int kEntries(70);
+
+  std::vector<LoggedCertificate> entries(kEntries);
+  MerkleTree tree(new Sha256Hasher);
+  for (int i = 0; i < kEntries; ++i) {
+    test_signer.CreateUnique(&entries[i]);
+    entries[i].set_sequence_number(i);
+    string leaf;
+    ASSERT_TRUE(entries[i].SerializeForLeaf(&leaf));
+    tree.AddLeaf(leaf);
+  }
+  // Leave a gap, which the subtree hashes must wait on.
+  for (int i = 0; i < kEntries; ++i) {
+    if (i != 40) {
+      EXPECT_EQ(DB::OK, test_db.db()->CreateSequencedEntry(entries[i]));
+    }
+  }
+
+  LevelDB<LoggedCertificate>* db(test_db.db());
+  const cert_trans::SubtreeProver prover(
+      new Sha256Hasher, [&db](int level, int64_t index, string* hash) {
+        return db->LookupSubtreeHash(level, index, hash) == DB::LOOKUP_OK;
+      });
+  string root;
+  ASSERT_TRUE(prover.RootAtSnapshot(40, &root).ok());
+  EXPECT_EQ(tree.RootAtSnapshot(40), root);
+  EXPECT_FALSE(prover.RootAtSnapshot(41, &root).ok());
+
+  EXPECT_EQ(DB::OK, db->CreateSequencedEntry(entries[40]));
+  // The hashes are found again after a restart.
+  const unique_ptr<LevelDB<LoggedCertificate>> db2(test_db.SecondDB());
+  db = db2.get();
+  std::vector<string> proof;
+  for (int snapshot = 1; snapshot <= kEntries; ++snapshot) {
+    ASSERT_TRUE(prover.RootAtSnapshot(snapshot, &root).ok());
+    EXPECT_EQ(tree.RootAtSnapshot(snapshot), root);
+    ASSERT_TRUE(prover.PathToRootAtSnapshot(snapshot / 2 + 1, snapshot, &proof)
+                    .ok());
+    EXPECT_EQ(tree.PathToRootAtSnapshot(snapshot / 2 + 1, snapshot), proof);
+    if (snapshot > 1) {
+      ASSERT_TRUE(prover.SnapshotConsistency(snapshot / 3 + 1, snapshot,
+                                             &proof).ok());
+      EXPECT_EQ(tree.SnapshotConsistency(snapshot / 3 + 1, snapshot), proof);
+    }
+  }
+  FLAGS_leveldb_subtree_hashes = false;
+}
+
+
+TEST(LevelDBTest, DropIndexes) {
+  FLAGS_leveldb_subtree_hashes = true;
+  TmpStorage tmp;
+  const string path(tmp.TmpStorageDir() + "/leveldb");
+  TestSigner test_signer;
+  const int kEntries(70);
+
+  std::vector<LoggedCertificate> entries(kEntries);
+  MerkleTree tree(new Sha256Hasher);
+  {
+    LevelDB<LoggedCertificate> db(path);
+    for (int i = 0; i < kEntries; ++i) {
+      test_signer.CreateUnique(&entries[i]);
+      entries[i].set_sequence_number(i);
+      string leaf;
+      ASSERT_TRUE(entries[i].SerializeForLeaf(&leaf));
+      tree.AddLeaf(leaf);
+      EXPECT_EQ(DB::OK, db.CreateSequencedEntry(entries[i]));
+    }
+  }
+
+  LevelDB<LoggedCertificate>::DropIndexes(path);
+  // A rebuild is pending, so this leaves it be.
+  LevelDB<LoggedCertificate>::DropIndexes(path);
+
+  // Opening the database rebuilds the indexes.
+  LevelDB<LoggedCertificate> db(path);
+  EXPECT_EQ(kEntries, db.TreeSize());
+  LoggedCertificate lookup_cert;
+  for (int i = 0; i < kEntries; ++i) {
+    ASSERT_EQ(DB::LOOKUP_OK, db.LookupByHash(entries[i].Hash(), &lookup_cert));
+    EXPECT_EQ(i, lookup_cert.sequence_number());
+  }
+  string hash;
+  ASSERT_EQ(DB::LOOKUP_OK, db.LookupSubtreeHash(6, 0, &hash));
+  EXPECT_EQ(tree.RootAtSnapshot(64), hash);
+  FLAGS_leveldb_subtree_hashes = false;
+}
+
+
+TEST(LevelDBTest, TimeIndex) {
+  TmpStorage tmp;
+  const string path(tmp.TmpStorageDir() + "/leveldb");
+  TestSigner test_signer;
+
+  std::vector<LoggedCertificate> entries(6);
+  {
+    LevelDB<LoggedCertificate> db(path);
+    for (size_t i = 0; i < entries.size(); ++i) {
+      test_signer.CreateUnique(&entries[i]);
+      // Later entries have earlier timestamps.
+      entries[i].mutable_sct()->set_timestamp(1000 * (entries.size() - i));
+      entries[i].set_sequence_number(i);
+      // The first entries are written before there is an index.
+      FLAGS_leveldb_time_index = i >= 3;
+      ASSERT_EQ(DB::OK, db.CreateSequencedEntry(entries[i]));
+    }
+  }
+
+  // Opening the database indexes the entries written without it.
+  LevelDB<LoggedCertificate> db(path);
+  unique_ptr<DB::Iterator> it(db.ScanEntriesByTime(2000, 5500));
+  LoggedCertificate logged;
+  // In timestamp order.
+  for (int i = 4; i >= 1; --i) {
+    ASSERT_TRUE(it->GetNextEntry(&logged));
+    TestSigner::TestEqualLoggedCerts(entries[i], logged);
+  }
+  EXPECT_FALSE(it->GetNextEntry(&logged));
+  FLAGS_leveldb_time_index = false;
+}
+
+
+#ifdef HAVE_ROCKSDB
+TEST(RocksDBTest, SecondaryCatchesUp) {
+  TmpStorage tmp;
+  const string path(tmp.TmpStorageDir() + "/rocksdb");
+  TestSigner test_signer;
+
+  std::vector<LoggedCertificate> entries(4);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    test_signer.CreateUnique(&entries[i]);
+    entries[i].set_sequence_number(i);
+  }
+  RocksDB<LoggedCertificate> primary(path);
+  EXPECT_EQ(DB::OK, primary.CreateSequencedEntry(entries[0]));
+
+  RocksDB<LoggedCertificate> secondary(path,
+                                       tmp.TmpStorageDir() + "/secondary");
+  EXPECT_EQ(1, secondary.TreeSize());
+  std::vector<SignedTreeHead> notified;
+  const DB::NotifySTHCallback callback(
+      [&notified](const SignedTreeHead& sth) { notified.push_back(sth); });
+  secondary.AddNotifySTHCallback(&callback);
+  EXPECT_TRUE(notified.empty());
+
+  // Leave a gap, which is filled after the first catch up.
+  EXPECT_EQ(DB::OK, primary.CreateSequencedEntry(entries[1]));
+  EXPECT_EQ(DB::OK, primary.CreateSequencedEntry(entries[3]));
+  SignedTreeHead sth;
+  test_signer.CreateUnique(&sth);
+  EXPECT_EQ(DB::OK, primary.WriteTreeHead(sth));
+  EXPECT_EQ(2, secondary.TreeSize());
+
+  ASSERT_TRUE(secondary.CatchUp().ok());
+  EXPECT_EQ(2, secondary.TreeSize());
+  EXPECT_EQ(std::vector<int64_t>{3}, secondary.SparseEntries());
+  ASSERT_EQ(1U, notified.size());
+  TestSigner::TestEqualTreeHeads(sth, notified[0]);
+
+  // No new tree head, nothing notified.
+  EXPECT_EQ(DB::OK, primary.CreateSequencedEntry(entries[2]));
+  ASSERT_TRUE(secondary.CatchUp().ok());
+  EXPECT_EQ(4, secondary.TreeSize());
+  EXPECT_TRUE(secondary.SparseEntries().empty());
+  EXPECT_EQ(1U, notified.size());
+  LoggedCertificate lookup_cert;
+  EXPECT_EQ(DB::LOOKUP_OK,
+            secondary.LookupByHash(entries[2].Hash(), &lookup_cert));
+  EXPECT_EQ(2, lookup_cert.sequence_number());
+
+  secondary.RemoveNotifySTHCallback(&callback);
+}
+#endif
+
+
+TEST(DatabaseNotifierHelperTest, SkipsSupersededTreeHeads) {
+  FLAGS_async_sth_notifications = true;
+  cert_trans::DatabaseNotifierHelper helper;
+  FLAGS_async_sth_notifications = false;
+
+  Notification first_called;
+  Notification release;
+  std::mutex mutex;
+  vector<int64_t> sizes;
+  Notification done;
+  const cert_trans::DatabaseNotifierHelper::NotifySTHCallback callback(
+      [&](const SignedTreeHead& sth) {
+        if (!first_called.HasBeenNotified()) {
+          first_called.Notify();
+          release.WaitForNotification();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        sizes.push_back(sth.tree_size());
+        if (sth.tree_size() == 3) {
+          done.Notify();
+        }
+      });
+  helper.Add(&callback);
+
+  SignedTreeHead sth;
+  sth.set_timestamp(1);
+  sth.set_tree_size(1);
+  // This returns right away, while the callback is blocked.
+  helper.Call(sth);
+  first_called.WaitForNotification();
+  sth.set_timestamp(2);
+  sth.set_tree_size(2);
+  helper.Call(sth);
+  sth.set_timestamp(3);
+  sth.set_tree_size(3);
+  helper.Call(sth);
+  release.Notify();
+  done.WaitForNotification();
+
+  helper.Remove(&callback);
+  EXPECT_EQ(vector<int64_t>({1, 3}), sizes);
+}
+
+
 }  // namespace
 
 
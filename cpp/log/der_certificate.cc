@@ -0,0 +1,491 @@
+#include "log/der_certificate.h"
+
+#include <glog/logging.h>
+
+using std::string;
+using util::Status;
+
+namespace cert_trans {
+namespace {
+
+
+const unsigned char kBooleanTag = 0x01;
+const unsigned char kIntegerTag = 0x02;
+const unsigned char kBitStringTag = 0x03;
+const unsigned char kOctetStringTag = 0x04;
+const unsigned char kObjectIdTag = 0x06;
+const unsigned char kSequenceTag = 0x30;
+// The context-specific tags of the optional fields of the TBS.
+const unsigned char kVersionTag = 0xa0;
+const unsigned char kIssuerUniqueIdTag = 0x81;
+const unsigned char kSubjectUniqueIdTag = 0x82;
+const unsigned char kExtensionsTag = 0xa3;
+
+
+struct Element {
+  unsigned char tag;
+  // Where the tag is.
+  size_t start;
+  // Where the contents are.
+  size_t contents;
+  // Just past the contents.
+  size_t end;
+};
+
+
+// Reads the element at |*offset| in |der|, which must fit before
+// |end|, and advances |*offset| past it.
+bool ReadElement(const string& der, size_t end, size_t* offset,
+                 Element* element) {
+  size_t pos(*offset);
+  if (pos + 2 > end) {
+    return false;
+  }
+  element->tag = der[pos];
+  // Certificates don't use the high tag numbers.
+  if ((element->tag & 0x1f) == 0x1f) {
+    return false;
+  }
+  element->start = pos;
+  const unsigned char first(der[pos + 1]);
+  pos += 2;
+
+  size_t length;
+  if (first < 0x80) {
+    length = first;
+  } else {
+    // 0x80 is the indefinite form, which isn't DER, and a certificate
+    // of more than 4GB isn't a certificate.
+    const size_t num_bytes(first & 0x7f);
+    if (num_bytes == 0 || num_bytes > 4 || pos + num_bytes > end ||
+        der[pos] == 0) {
+      return false;
+    }
+    length = 0;
+    for (size_t i = 0; i < num_bytes; ++i) {
+      length = (length << 8) | static_cast<unsigned char>(der[pos + i]);
+    }
+    pos += num_bytes;
+    // DER requires the short form when it's possible.
+    if (length < 0x80) {
+      return false;
+    }
+  }
+  if (length > end - pos) {
+    return false;
+  }
+
+  element->contents = pos;
+  element->end = pos + length;
+  *offset = element->end;
+  return true;
+}
+
+
+bool ReadElementWithTag(const string& der, size_t end, unsigned char tag,
+                        size_t* offset, Element* element) {
+  return ReadElement(der, end, offset, element) && element->tag == tag;
+}
+
+
+Status InvalidCertificate() {
+  return Status(util::error::INVALID_ARGUMENT, "invalid DER certificate");
+}
+
+
+// The fields of a TBSCertificate that are located or edited.
+struct TbsFields {
+  Element tbs;
+  Element issuer;
+  Element subject;
+  Element spki;
+  // The [3] tagged field, and the SEQUENCE of extensions in it. Both
+  // are empty, at the end of the TBS, if there are no extensions.
+  Element extensions_field;
+  Element extensions;
+};
+
+
+// Reads the fields of |tbs|, a TBSCertificate in |der|.
+bool ReadTbsFields(const string& der, const Element& tbs, TbsFields* fields) {
+  // TBSCertificate ::= SEQUENCE { version [0] EXPLICIT OPTIONAL,
+  //     serialNumber, signature, issuer, validity, subject,
+  //     subjectPublicKeyInfo, issuerUniqueID [1] IMPLICIT OPTIONAL,
+  //     subjectUniqueID [2] IMPLICIT OPTIONAL,
+  //     extensions [3] EXPLICIT OPTIONAL }
+  fields->tbs = tbs;
+  size_t offset(tbs.contents);
+  Element element;
+  if (!ReadElement(der, tbs.end, &offset, &element)) {
+    return false;
+  }
+  if (element.tag == kVersionTag &&
+      !ReadElement(der, tbs.end, &offset, &element)) {
+    return false;
+  }
+  if (element.tag != kIntegerTag ||
+      !ReadElementWithTag(der, tbs.end, kSequenceTag, &offset, &element) ||
+      !ReadElementWithTag(der, tbs.end, kSequenceTag, &offset,
+                          &fields->issuer) ||
+      !ReadElementWithTag(der, tbs.end, kSequenceTag, &offset, &element) ||
+      !ReadElementWithTag(der, tbs.end, kSequenceTag, &offset,
+                          &fields->subject) ||
+      !ReadElementWithTag(der, tbs.end, kSequenceTag, &offset,
+                          &fields->spki)) {
+    return false;
+  }
+
+  fields->extensions_field.start = fields->extensions_field.end = tbs.end;
+  fields->extensions.start = fields->extensions.contents =
+      fields->extensions.end = tbs.end;
+  unsigned char last_tag(0);
+  while (offset < tbs.end) {
+    if (!ReadElement(der, tbs.end, &offset, &element) ||
+        element.tag <= last_tag) {
+      return false;
+    }
+    last_tag = element.tag;
+    if (element.tag == kExtensionsTag) {
+      size_t extensions_offset(element.contents);
+      if (!ReadElementWithTag(der, element.end, kSequenceTag,
+                              &extensions_offset, &fields->extensions) ||
+          extensions_offset != element.end) {
+        return false;
+      }
+      fields->extensions_field = element;
+    } else if (element.tag != kIssuerUniqueIdTag &&
+               element.tag != kSubjectUniqueIdTag) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+// Reads the TBSCertificate that |der| consists of.
+bool ReadTbs(const string& der, TbsFields* fields) {
+  size_t offset(0);
+  Element tbs;
+  return ReadElementWithTag(der, der.size(), kSequenceTag, &offset, &tbs) &&
+         offset == der.size() && ReadTbsFields(der, tbs, fields);
+}
+
+
+// Extension ::= SEQUENCE { extnID OBJECT IDENTIFIER,
+//                          critical BOOLEAN DEFAULT FALSE,
+//                          extnValue OCTET STRING }
+struct Extension {
+  Element extension;
+  Element id;
+  Element value;
+};
+
+
+bool ReadExtension(const string& der, size_t end, size_t* offset,
+                   Extension* extension) {
+  if (!ReadElementWithTag(der, end, kSequenceTag, offset,
+                          &extension->extension)) {
+    return false;
+  }
+  const size_t extension_end(extension->extension.end);
+  size_t pos(extension->extension.contents);
+  if (!ReadElementWithTag(der, extension_end, kObjectIdTag, &pos,
+                          &extension->id) ||
+      !ReadElement(der, extension_end, &pos, &extension->value)) {
+    return false;
+  }
+  if (extension->value.tag == kBooleanTag &&
+      !ReadElement(der, extension_end, &pos, &extension->value)) {
+    return false;
+  }
+  return extension->value.tag == kOctetStringTag && pos == extension_end;
+}
+
+
+bool IsExtension(const string& der, const Extension& extension,
+                 const string& oid) {
+  return der.compare(extension.id.start,
+                     extension.id.end - extension.id.start, oid) == 0;
+}
+
+
+void AppendElement(unsigned char tag, const string& contents, string* out) {
+  out->push_back(tag);
+  const size_t length(contents.size());
+  if (length < 0x80) {
+    out->push_back(length);
+  } else {
+    int num_bytes(0);
+    for (size_t rest = length; rest > 0; rest >>= 8) {
+      ++num_bytes;
+    }
+    out->push_back(0x80 | num_bytes);
+    for (int i = num_bytes - 1; i >= 0; --i) {
+      out->push_back((length >> (8 * i)) & 0xff);
+    }
+  }
+  out->append(contents);
+}
+
+
+// Returns |der|, a TBSCertificate read into |fields|, with |issuer|
+// and |extensions| (the concatenated encodings of each one) in place
+// of its own.
+string SpliceTbs(const string& der, const TbsFields& fields,
+                 const string& issuer, const string& extensions) {
+  string contents(der, fields.tbs.contents,
+                  fields.issuer.start - fields.tbs.contents);
+  contents.append(issuer);
+  contents.append(der, fields.issuer.end,
+                  fields.extensions_field.start - fields.issuer.end);
+  // Like OpenSSL, keep the field even if there are no extensions left.
+  if (fields.extensions_field.end > fields.extensions_field.start) {
+    string sequence;
+    AppendElement(kSequenceTag, extensions, &sequence);
+    AppendElement(kExtensionsTag, sequence, &contents);
+  }
+  string result;
+  AppendElement(kSequenceTag, contents, &result);
+  return result;
+}
+
+
+string Range(const string& der, const Element& element) {
+  return der.substr(element.start, element.end - element.start);
+}
+
+
+Status InvalidTbs() {
+  return Status(util::error::INVALID_ARGUMENT, "invalid DER TBS certificate");
+}
+
+
+Status ExtensionNotFound() {
+  return Status(util::error::NOT_FOUND, "extension not found");
+}
+
+
+}  // namespace
+
+
+DerCertificate::DerCertificate() {
+}
+
+
+Status DerCertificate::Parse(const string& der) {
+  Clear();
+
+  size_t offset(0);
+  Element cert;
+  if (!ReadElementWithTag(der, der.size(), kSequenceTag, &offset, &cert)) {
+    return InvalidCertificate();
+  }
+
+  // Certificate ::= SEQUENCE { tbsCertificate, signatureAlgorithm,
+  //                            signatureValue }
+  offset = cert.contents;
+  Element tbs;
+  Element signature_algorithm;
+  Element signature;
+  if (!ReadElementWithTag(der, cert.end, kSequenceTag, &offset, &tbs) ||
+      !ReadElementWithTag(der, cert.end, kSequenceTag, &offset,
+                          &signature_algorithm) ||
+      !ReadElementWithTag(der, cert.end, kBitStringTag, &offset,
+                          &signature) ||
+      offset != cert.end) {
+    return InvalidCertificate();
+  }
+
+  TbsFields fields;
+  if (!ReadTbsFields(der, tbs, &fields)) {
+    return InvalidCertificate();
+  }
+
+  encoding_.assign(der, 0, cert.end);
+  tbs_.offset = tbs.start;
+  tbs_.length = tbs.end - tbs.start;
+  issuer_.offset = fields.issuer.start;
+  issuer_.length = fields.issuer.end - fields.issuer.start;
+  subject_.offset = fields.subject.start;
+  subject_.length = fields.subject.end - fields.subject.start;
+  spki_.offset = fields.spki.start;
+  spki_.length = fields.spki.end - fields.spki.start;
+  if (fields.extensions.end > fields.extensions.start) {
+    extensions_.offset = fields.extensions.start;
+    extensions_.length = fields.extensions.end - fields.extensions.start;
+  }
+  signature_algorithm_.offset = signature_algorithm.start;
+  signature_algorithm_.length =
+      signature_algorithm.end - signature_algorithm.start;
+  signature_.offset = signature.start;
+  signature_.length = signature.end - signature.start;
+  // The first byte of a BIT STRING is the number of unused bits.
+  if (signature.end > signature.contents && der[signature.contents] == 0) {
+    signature_bits_.offset = signature.contents + 1;
+    signature_bits_.length = signature.end - signature.contents - 1;
+  }
+  return Status::OK;
+}
+
+
+void DerCertificate::Clear() {
+  encoding_.clear();
+  tbs_ = issuer_ = subject_ = spki_ = extensions_ = signature_algorithm_ =
+      signature_ = signature_bits_ = Span();
+}
+
+
+void DerCertificate::TbsCertificate(string* result) const {
+  Assign(tbs_, result);
+}
+
+
+void DerCertificate::IssuerName(string* result) const {
+  Assign(issuer_, result);
+}
+
+
+void DerCertificate::SubjectName(string* result) const {
+  Assign(subject_, result);
+}
+
+
+void DerCertificate::SubjectPublicKeyInfo(string* result) const {
+  Assign(spki_, result);
+}
+
+
+void DerCertificate::SignatureAlgorithm(string* result) const {
+  Assign(signature_algorithm_, result);
+}
+
+
+void DerCertificate::Signature(string* result) const {
+  Assign(signature_, result);
+}
+
+
+bool DerCertificate::SignatureBits(string* result) const {
+  if (signature_bits_.length == 0) {
+    return false;
+  }
+  Assign(signature_bits_, result);
+  return true;
+}
+
+
+bool DerCertificate::Extensions(string* result) const {
+  if (extensions_.length == 0) {
+    return false;
+  }
+  Assign(extensions_, result);
+  return true;
+}
+
+
+void DerCertificate::Assign(const Span& span, string* result) const {
+  CHECK(IsLoaded());
+  CHECK_NOTNULL(result)->assign(encoding_, span.offset, span.length);
+}
+
+
+Status DeleteTbsExtension(const string& oid, string* tbs) {
+  TbsFields fields;
+  if (!ReadTbs(*CHECK_NOTNULL(tbs), &fields)) {
+    return InvalidTbs();
+  }
+  int found(0);
+  string extensions;
+  size_t offset(fields.extensions.contents);
+  while (offset < fields.extensions.end) {
+    Extension extension;
+    if (!ReadExtension(*tbs, fields.extensions.end, &offset, &extension)) {
+      return InvalidTbs();
+    }
+    if (IsExtension(*tbs, extension, oid) && found++ == 0) {
+      continue;
+    }
+    extensions.append(Range(*tbs, extension.extension));
+  }
+  if (found == 0) {
+    return ExtensionNotFound();
+  }
+  *tbs = SpliceTbs(*tbs, fields, Range(*tbs, fields.issuer), extensions);
+  if (found > 1) {
+    return Status(util::error::ALREADY_EXISTS,
+                  "multiple extensions in certificate");
+  }
+  return Status::OK;
+}
+
+
+Status SetTbsIssuer(const string& issuer, string* tbs) {
+  TbsFields fields;
+  if (!ReadTbs(*CHECK_NOTNULL(tbs), &fields)) {
+    return InvalidTbs();
+  }
+  const string extensions(
+      *tbs, fields.extensions.contents,
+      fields.extensions.end - fields.extensions.contents);
+  *tbs = SpliceTbs(*tbs, fields, issuer, extensions);
+  return Status::OK;
+}
+
+
+Status TbsExtensionValue(const string& tbs, const string& oid,
+                         string* value) {
+  TbsFields fields;
+  if (!ReadTbs(tbs, &fields)) {
+    return InvalidTbs();
+  }
+  size_t offset(fields.extensions.contents);
+  while (offset < fields.extensions.end) {
+    Extension extension;
+    if (!ReadExtension(tbs, fields.extensions.end, &offset, &extension)) {
+      return InvalidTbs();
+    }
+    if (IsExtension(tbs, extension, oid)) {
+      CHECK_NOTNULL(value)->assign(
+          tbs, extension.value.contents,
+          extension.value.end - extension.value.contents);
+      return Status::OK;
+    }
+  }
+  return ExtensionNotFound();
+}
+
+
+Status SetTbsExtensionValue(const string& oid, const string& value,
+                            string* tbs) {
+  TbsFields fields;
+  if (!ReadTbs(*CHECK_NOTNULL(tbs), &fields)) {
+    return InvalidTbs();
+  }
+  bool found(false);
+  string extensions;
+  size_t offset(fields.extensions.contents);
+  while (offset < fields.extensions.end) {
+    Extension extension;
+    if (!ReadExtension(*tbs, fields.extensions.end, &offset, &extension)) {
+      return InvalidTbs();
+    }
+    if (found || !IsExtension(*tbs, extension, oid)) {
+      extensions.append(Range(*tbs, extension.extension));
+      continue;
+    }
+    found = true;
+    // The extnID and critical flag, followed by the new extnValue.
+    string contents(*tbs, extension.extension.contents,
+                    extension.value.start - extension.extension.contents);
+    AppendElement(kOctetStringTag, value, &contents);
+    AppendElement(kSequenceTag, contents, &extensions);
+  }
+  if (!found) {
+    return ExtensionNotFound();
+  }
+  *tbs = SpliceTbs(*tbs, fields, Range(*tbs, fields.issuer), extensions);
+  return Status::OK;
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,112 @@
+#ifndef CERT_TRANS_LOG_DER_CERTIFICATE_H_
+#define CERT_TRANS_LOG_DER_CERTIFICATE_H_
+
+#include <stddef.h>
+#include <string>
+
+#include "base/macros.h"
+#include "util/status.h"
+
+namespace cert_trans {
+
+// Keeps the DER encoding of an X.509 certificate, and locates its main
+// components in it, without decoding them. This makes it cheap to get
+// at the encoding of the TBS, the names or the signature, as OpenSSL
+// would otherwise re-encode them every time.
+//
+// Only the structure of the certificate is checked, its contents are
+// not. But the encoding of that structure has to be DER: lengths are
+// minimal, and the indefinite length form of BER is rejected.
+class DerCertificate {
+ public:
+  DerCertificate();
+
+  // Returns INVALID_ARGUMENT if |der| doesn't start with a DER
+  // encoded certificate. Anything after the certificate is ignored.
+  util::Status Parse(const std::string& der);
+
+  void Clear();
+
+  bool IsLoaded() const {
+    return !encoding_.empty();
+  }
+
+  // The encoding of the whole certificate.
+  const std::string& encoding() const {
+    return encoding_;
+  }
+
+  // These set the complete encoding (tag and length included) of the
+  // component in |result|. They must only be called if IsLoaded().
+  void TbsCertificate(std::string* result) const;
+  void IssuerName(std::string* result) const;
+  void SubjectName(std::string* result) const;
+  void SubjectPublicKeyInfo(std::string* result) const;
+  void SignatureAlgorithm(std::string* result) const;
+  void Signature(std::string* result) const;
+
+  // Sets the bits of the signature in |result|, without the header of
+  // the BIT STRING. Returns false if there are none, or if their number
+  // isn't a multiple of 8, which no signature algorithm produces.
+  bool SignatureBits(std::string* result) const;
+
+  // Sets the complete encoding of the SEQUENCE of extensions in
+  // |result|, without the [3] tag around it. Returns false if the
+  // certificate has no extensions.
+  bool Extensions(std::string* result) const;
+
+ private:
+  struct Span {
+    Span() : offset(0), length(0) {
+    }
+
+    size_t offset;
+    size_t length;
+  };
+
+  void Assign(const Span& span, std::string* result) const;
+
+  std::string encoding_;
+  Span tbs_;
+  Span issuer_;
+  Span subject_;
+  Span spki_;
+  Span extensions_;
+  Span signature_algorithm_;
+  Span signature_;
+  Span signature_bits_;
+
+  DISALLOW_COPY_AND_ASSIGN(DerCertificate);
+};
+
+
+// Edits of |tbs|, the DER encoding of a TBSCertificate, as needed to
+// make the TBS of a precertificate (RFC 6962, section 3.2). They
+// splice its bytes and fix up the lengths around them, rather than
+// decoding and re-encoding the whole structure. They return
+// INVALID_ARGUMENT if |tbs| is malformed, and leave it unchanged on
+// error.
+//
+// |oid| is the complete encoding of the OBJECT IDENTIFIER of an
+// extension.
+
+// Removes the extension |oid|. Returns NOT_FOUND if there is none, and
+// ALREADY_EXISTS if there is more than one, after removing the first.
+util::Status DeleteTbsExtension(const std::string& oid, std::string* tbs);
+
+// Replaces the issuer name with |issuer|, a complete encoding.
+util::Status SetTbsIssuer(const std::string& issuer, std::string* tbs);
+
+// Sets in |value| the contents of the extnValue OCTET STRING of the
+// extension |oid|. Returns NOT_FOUND if there is none.
+util::Status TbsExtensionValue(const std::string& tbs, const std::string& oid,
+                               std::string* value);
+
+// Replaces the contents of the extnValue OCTET STRING of the extension
+// |oid|, keeping its critical flag. Returns NOT_FOUND if there is none.
+util::Status SetTbsExtensionValue(const std::string& oid,
+                                  const std::string& value, std::string* tbs);
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_DER_CERTIFICATE_H_
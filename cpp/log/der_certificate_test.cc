@@ -0,0 +1,274 @@
+#include "log/der_certificate.h"
+
+#include <gtest/gtest.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <string>
+
+#include "util/status_test_util.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using util::testing::StatusIs;
+
+// With extensions.
+const char kLeafCert[] = "test-cert.pem";
+// Also with the poison extension.
+const char kPreCert[] = "test-embedded-pre-cert.pem";
+const char kCaCert[] = "ca-cert.pem";
+
+
+string NameDer(X509_NAME* name) {
+  unsigned char* buf(nullptr);
+  const int length(i2d_X509_NAME(name, &buf));
+  CHECK_GT(length, 0);
+  const string result(reinterpret_cast<char*>(buf), length);
+  OPENSSL_free(buf);
+  return result;
+}
+
+
+string ObjectDer(const ASN1_OBJECT* object) {
+  unsigned char* buf(nullptr);
+  const int length(i2d_ASN1_OBJECT(const_cast<ASN1_OBJECT*>(object), &buf));
+  CHECK_GT(length, 0);
+  const string result(reinterpret_cast<char*>(buf), length);
+  OPENSSL_free(buf);
+  return result;
+}
+
+
+// The TBS as OpenSSL re-encodes it.
+string TbsDer(X509* x509) {
+  unsigned char* buf(nullptr);
+  const int length(i2d_re_X509_tbs(x509, &buf));
+  CHECK_GT(length, 0);
+  const string result(reinterpret_cast<char*>(buf), length);
+  OPENSSL_free(buf);
+  return result;
+}
+
+
+class DerCertificateTest : public ::testing::TestWithParam<const char*> {
+ protected:
+  void SetUp() override {
+    string pem;
+    CHECK(util::ReadTextFile(FLAGS_test_srcdir + "/test/testdata/" +
+                                 GetParam(),
+                             &pem))
+        << "Could not read test data. Wrong --test_srcdir?";
+    BIO* const bio(BIO_new_mem_buf(const_cast<char*>(pem.data()),
+                                   pem.size()));
+    x509_ = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr);
+    BIO_free(bio);
+    CHECK_NOTNULL(x509_);
+
+    unsigned char* buf(nullptr);
+    const int length(i2d_X509(x509_, &buf));
+    CHECK_GT(length, 0);
+    der_.assign(reinterpret_cast<char*>(buf), length);
+    OPENSSL_free(buf);
+  }
+
+  void TearDown() override {
+    X509_free(x509_);
+  }
+
+  X509* x509_;
+  string der_;
+};
+
+
+TEST_P(DerCertificateTest, LocatesComponents) {
+  DerCertificate cert;
+  EXPECT_FALSE(cert.IsLoaded());
+  // Trailing data is ignored.
+  ASSERT_OK(cert.Parse(der_ + "trailing"));
+  EXPECT_TRUE(cert.IsLoaded());
+  EXPECT_EQ(der_, cert.encoding());
+
+  string result;
+  cert.IssuerName(&result);
+  EXPECT_EQ(NameDer(X509_get_issuer_name(x509_)), result);
+  cert.SubjectName(&result);
+  EXPECT_EQ(NameDer(X509_get_subject_name(x509_)), result);
+
+  unsigned char* buf(nullptr);
+  int length(i2d_re_X509_tbs(x509_, &buf));
+  ASSERT_GT(length, 0);
+  cert.TbsCertificate(&result);
+  EXPECT_EQ(string(reinterpret_cast<char*>(buf), length), result);
+  OPENSSL_free(buf);
+
+  buf = nullptr;
+  length = i2d_X509_PUBKEY(X509_get_X509_PUBKEY(x509_), &buf);
+  ASSERT_GT(length, 0);
+  cert.SubjectPublicKeyInfo(&result);
+  EXPECT_EQ(string(reinterpret_cast<char*>(buf), length), result);
+  OPENSSL_free(buf);
+
+  // The certificate ends with the signature, right after its algorithm.
+  string signature_algorithm;
+  cert.SignatureAlgorithm(&signature_algorithm);
+  cert.Signature(&result);
+  EXPECT_EQ(signature_algorithm + result,
+            der_.substr(der_.size() - signature_algorithm.size() -
+                        result.size()));
+  string bits;
+  ASSERT_TRUE(cert.SignatureBits(&bits));
+  // Right after the number of unused bits.
+  EXPECT_EQ(bits, result.substr(result.size() - bits.size()));
+  EXPECT_EQ('\0', result[result.size() - bits.size() - 1]);
+
+  EXPECT_EQ(X509_get_ext_count(x509_) > 0, cert.Extensions(&result));
+  if (X509_get_ext_count(x509_) > 0) {
+    EXPECT_EQ(0x30, result[0]);
+    string tbs;
+    cert.TbsCertificate(&tbs);
+    // The extensions are last in the TBS.
+    EXPECT_EQ(result, tbs.substr(tbs.size() - result.size()));
+  }
+
+  cert.Clear();
+  EXPECT_FALSE(cert.IsLoaded());
+}
+
+
+TEST_P(DerCertificateTest, RejectsTruncated) {
+  DerCertificate cert;
+  for (size_t length : {size_t(0), size_t(1), size_t(4), der_.size() / 2,
+                        der_.size() - 1}) {
+    EXPECT_THAT(cert.Parse(der_.substr(0, length)),
+                StatusIs(util::error::INVALID_ARGUMENT))
+        << length;
+    EXPECT_FALSE(cert.IsLoaded());
+  }
+}
+
+
+TEST_P(DerCertificateTest, RejectsNonDer) {
+  // The outer length is long enough to use the long form.
+  ASSERT_EQ(0x82, static_cast<unsigned char>(der_[1]));
+  DerCertificate cert;
+
+  // Indefinite length.
+  string indefinite(der_.substr(0, 1) + '\x80' + der_.substr(4) +
+                    string(2, '\0'));
+  EXPECT_THAT(cert.Parse(indefinite), StatusIs(util::error::INVALID_ARGUMENT));
+
+  // Length with a leading zero byte.
+  string padded(der_.substr(0, 1) + '\x83' + '\0' + der_.substr(2));
+  EXPECT_THAT(cert.Parse(padded), StatusIs(util::error::INVALID_ARGUMENT));
+
+  // An extra element after the signature.
+  string extra(der_ + string("\x05\x00", 2));
+  const size_t length((static_cast<unsigned char>(extra[2]) << 8 |
+                       static_cast<unsigned char>(extra[3])) +
+                      2);
+  extra[2] = length >> 8;
+  extra[3] = length & 0xff;
+  EXPECT_THAT(cert.Parse(extra), StatusIs(util::error::INVALID_ARGUMENT));
+
+  // Not a certificate at all.
+  EXPECT_THAT(cert.Parse(string("\x30\x03\x02\x01\x01", 5)),
+              StatusIs(util::error::INVALID_ARGUMENT));
+  EXPECT_FALSE(cert.IsLoaded());
+}
+
+
+TEST_P(DerCertificateTest, DeletesExtensionsLikeOpenSSL) {
+  DerCertificate cert;
+  ASSERT_OK(cert.Parse(der_));
+  string tbs;
+  cert.TbsCertificate(&tbs);
+
+  ASSERT_LT(0, X509_get_ext_count(x509_));
+  for (int i = 0; i < X509_get_ext_count(x509_); ++i) {
+    X509* const copy(X509_dup(x509_));
+    X509_EXTENSION* const extension(X509_delete_ext(copy, i));
+    const string oid(ObjectDer(X509_EXTENSION_get_object(extension)));
+    X509_EXTENSION_free(extension);
+
+    string spliced(tbs);
+    EXPECT_OK(DeleteTbsExtension(oid, &spliced));
+    EXPECT_EQ(TbsDer(copy), spliced) << i;
+    X509_free(copy);
+  }
+
+  // Down to an empty extensions field, which is kept.
+  X509* const copy(X509_dup(x509_));
+  string spliced(tbs);
+  while (X509_get_ext_count(copy) > 0) {
+    X509_EXTENSION* const extension(X509_delete_ext(copy, 0));
+    EXPECT_OK(DeleteTbsExtension(
+        ObjectDer(X509_EXTENSION_get_object(extension)), &spliced));
+    X509_EXTENSION_free(extension);
+  }
+  EXPECT_EQ(TbsDer(copy), spliced);
+  X509_free(copy);
+
+  string unchanged(tbs);
+  EXPECT_THAT(DeleteTbsExtension(ObjectDer(OBJ_nid2obj(NID_invalidity_date)),
+                                 &unchanged),
+              StatusIs(util::error::NOT_FOUND));
+  EXPECT_EQ(tbs, unchanged);
+}
+
+
+TEST_P(DerCertificateTest, ReplacesIssuerAndExtensionValueLikeOpenSSL) {
+  DerCertificate cert;
+  ASSERT_OK(cert.Parse(der_));
+  string tbs;
+  cert.TbsCertificate(&tbs);
+
+  X509_EXTENSION* const extension(X509_get_ext(x509_, 0));
+  const string oid(ObjectDer(X509_EXTENSION_get_object(extension)));
+  string value;
+  ASSERT_OK(TbsExtensionValue(tbs, oid, &value));
+  const ASN1_OCTET_STRING* const data(X509_EXTENSION_get_data(extension));
+  EXPECT_EQ(string(reinterpret_cast<const char*>(data->data), data->length),
+            value);
+
+  // A longer value, so that the lengths around it change.
+  const string new_value(string(200, 'x'));
+  ASSERT_OK(SetTbsIssuer(NameDer(X509_get_subject_name(x509_)), &tbs));
+  ASSERT_OK(SetTbsExtensionValue(oid, new_value, &tbs));
+
+  X509* const copy(X509_dup(x509_));
+  ASSERT_EQ(1, X509_set_issuer_name(copy, X509_get_subject_name(x509_)));
+  ASN1_OCTET_STRING* const new_data(ASN1_OCTET_STRING_new());
+  ASSERT_EQ(1, ASN1_OCTET_STRING_set(
+                   new_data,
+                   reinterpret_cast<const unsigned char*>(new_value.data()),
+                   new_value.size()));
+  ASSERT_EQ(1, X509_EXTENSION_set_data(X509_get_ext(copy, 0), new_data));
+  ASN1_OCTET_STRING_free(new_data);
+  EXPECT_EQ(TbsDer(copy), tbs);
+  X509_free(copy);
+}
+
+
+TEST(DerTbsTest, RejectsMalformed) {
+  string tbs("\x30\x03\x02\x01\x01", 5);
+  EXPECT_THAT(SetTbsIssuer(string("\x30\x00", 2), &tbs),
+              StatusIs(util::error::INVALID_ARGUMENT));
+  EXPECT_EQ(string("\x30\x03\x02\x01\x01", 5), tbs);
+}
+
+
+INSTANTIATE_TEST_CASE_P(Certificates, DerCertificateTest,
+                        ::testing::Values(kLeafCert, kPreCert, kCaCert));
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -1,10 +1,17 @@
 #ifndef CERT_TRANS_LOG_ETCD_CONSISTENT_STORE_INL_H_
 #define CERT_TRANS_LOG_ETCD_CONSISTENT_STORE_INL_H_
 
+#include <algorithm>
 #include <chrono>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <inttypes.h>
+#include <iterator>
+#include <stdio.h>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include "base/notification.h"
@@ -13,6 +20,7 @@
 #include "monitoring/event_metric.h"
 #include "monitoring/latency.h"
 #include "monitoring/monitoring.h"
+#include "monitoring/trace.h"
 #include "util/etcd_delete.h"
 #include "util/executor.h"
 #include "util/masterelection.h"
@@ -22,6 +30,26 @@ DECLARE_int32(etcd_stats_collection_interval_seconds);
 
 DECLARE_int32(node_state_ttl_seconds);
 
+DECLARE_int32(etcd_delete_concurrency);
+
+DECLARE_int32(etcd_add_pending_concurrency);
+
+DECLARE_int32(etcd_add_pending_group_commit_ms);
+
+DECLARE_int32(etcd_sequence_mapping_chunk_size);
+
+DECLARE_int32(etcd_entries_shard_digits);
+
+DECLARE_int32(etcd_cleanup_batch_size);
+
+DECLARE_bool(etcd_pending_entry_index);
+
+DECLARE_double(etcd_throttle_start_fraction);
+
+DECLARE_int32(etcd_throttle_target_latency_ms);
+
+DECLARE_double(etcd_throttle_rate_increase);
+
 namespace cert_trans {
 namespace {
 
@@ -29,6 +57,7 @@ namespace {
 const char kClusterConfigFile[] = "/cluster_config";
 const char kEntriesDir[] = "/entries/";
 const char kSequenceFile[] = "/sequence_mapping";
+const char kSequenceChunksDir[] = "/sequence_mapping_chunks/";
 const char kServingSthFile[] = "/serving_sth";
 const char kNodesDir[] = "/nodes/";
 
@@ -51,11 +80,64 @@ static Counter<std::string>* etcd_rejected_requests =
                               "Total number of requests rejected due to "
                               "overload, broken down by request type.");
 
+static Counter<>* etcd_add_pending_group_commits =
+    Counter<>::New("etcd_add_pending_group_commits",
+                   "Number of groups of concurrently added pending entries "
+                   "written to etcd together.");
+
+static Counter<>* etcd_add_pending_group_commit_entries =
+    Counter<>::New("etcd_add_pending_group_commit_entries",
+                   "Number of pending entries written to etcd as part of a "
+                   "group.");
+
+static Gauge<>* etcd_cleanup_backlog =
+    Gauge<>::New("etcd_cleanup_backlog",
+                 "Number of entries covered by the serving STH still "
+                 "waiting to be cleaned up from etcd, as of the last "
+                 "cleanup.");
+
+static Gauge<>* etcd_throttle_rate =
+    Gauge<>::New("etcd_throttle_rate",
+                 "Limit on the rate of new pending entries accepted per "
+                 "second, or -1 if there is none.");
+
 static Latency<std::chrono::milliseconds, std::string> etcd_latency_by_op_ms(
     "etcd_latency_by_op_ms", "operation",
     "Etcd latency in ms broken down by operation.");
 
 
+// Values are stored as the base 64 of their serialized form, since
+// the v2 API of etcd carries them as JSON strings. All the encoding
+// and decoding goes through these, so a binary-safe transport only
+// needs to change them.
+std::string EncodeValue(const std::string& flat) {
+  std::string ret;
+  util::ToBase64(flat.data(), flat.size(), &ret);
+  return ret;
+}
+
+
+template <class T>
+std::string EncodeMessage(const T& message) {
+  std::string flat;
+  CHECK(message.SerializeToString(&flat));
+  return EncodeValue(flat);
+}
+
+
+bool DecodeValue(const std::string& value, std::string* flat) {
+  CHECK_NOTNULL(flat)->clear();
+  return util::FromBase64(value.data(), value.size(), flat);
+}
+
+
+template <class T>
+bool DecodeMessage(const std::string& value, T* message) {
+  std::string flat;
+  return DecodeValue(value, &flat) && message->ParseFromString(flat);
+}
+
+
 void CheckMappingIsOrdered(const ct::SequenceMapping& mapping) {
   if (mapping.mapping_size() < 2) {
     return;
@@ -121,9 +203,26 @@ EtcdConsistentStore<Logged>::EtcdConsistentStore(
       node_id_(node_id),
       serving_sth_watch_task_(CHECK_NOTNULL(executor)),
       cluster_config_watch_task_(CHECK_NOTNULL(executor)),
+      pending_index_watch_task_(CHECK_NOTNULL(executor)),
       etcd_stats_task_(executor_),
       received_initial_sth_(false),
-      exiting_(false) {
+      exiting_(false),
+      num_etcd_entries_(0),
+      add_latency_total_(0),
+      num_adds_(0),
+      admission_(FLAGS_etcd_throttle_rate_increase, 0.5,
+                 util::AdmissionController::Clock::now()),
+      cleaned_up_to_(0),
+      mapping_chunk_size_(FLAGS_etcd_sequence_mapping_chunk_size),
+      mapping_chunks_handle_(-1),
+      entries_shard_digits_(FLAGS_etcd_entries_shard_digits),
+      group_commit_window_(FLAGS_etcd_add_pending_group_commit_ms),
+      pending_index_enabled_(FLAGS_etcd_pending_entry_index) {
+  CHECK_GE(mapping_chunk_size_, 0);
+  // Up to 4096 shards.
+  CHECK_GE(entries_shard_digits_, 0);
+  CHECK_LE(entries_shard_digits_, 3);
+  CHECK_GE(group_commit_window_.count(), 0);
   // Set up watches on things we're interested in...
   WatchServingSTH(
       std::bind(&EtcdConsistentStore<Logged>::OnEtcdServingSTHUpdated, this,
@@ -133,6 +232,14 @@ EtcdConsistentStore<Logged>::EtcdConsistentStore(
       std::bind(&EtcdConsistentStore<Logged>::OnClusterConfigUpdated, this,
                 std::placeholders::_1),
       cluster_config_watch_task_.task());
+  if (pending_index_enabled_) {
+    WatchPendingEntries(
+        std::bind(&EtcdConsistentStore<Logged>::OnPendingEntriesUpdated, this,
+                  std::placeholders::_1),
+        pending_index_watch_task_.task());
+  } else {
+    pending_index_watch_task_.task()->Return();
+  }
 
   StartEtcdStatsFetch();
 
@@ -150,9 +257,11 @@ EtcdConsistentStore<Logged>::~EtcdConsistentStore() {
   VLOG(1) << "Cancelling watch tasks.";
   serving_sth_watch_task_.Cancel();
   cluster_config_watch_task_.Cancel();
+  pending_index_watch_task_.Cancel();
   VLOG(1) << "Waiting for watch tasks to return.";
   serving_sth_watch_task_.Wait();
   cluster_config_watch_task_.Wait();
+  pending_index_watch_task_.Wait();
   VLOG(1) << "Cancelling stats task.";
   etcd_stats_task_.Cancel();
   etcd_stats_task_.Wait();
@@ -291,6 +400,10 @@ util::Status EtcdConsistentStore<Logged>::AddPendingEntry(Logged* entry) {
   CHECK_NOTNULL(entry);
   CHECK(!entry->has_sequence_number());
 
+  if (group_commit_window_ > std::chrono::milliseconds::zero()) {
+    return GroupCommitPendingEntry(entry);
+  }
+
   util::Status status(MaybeReject("add_pending_entry"));
   if (!status.ok()) {
     return status;
@@ -298,30 +411,297 @@ util::Status EtcdConsistentStore<Logged>::AddPendingEntry(Logged* entry) {
 
   const std::string full_path(GetEntryPath(*entry));
   EntryHandle<Logged> handle(full_path, *entry);
-  status = CreateEntry(&handle);
+  const std::chrono::steady_clock::time_point start(
+      std::chrono::steady_clock::now());
+  {
+    TraceSpan span("etcd_create");
+    status = CreateEntry(&handle);
+  }
+  RecordAddLatency(start);
   if (status.CanonicalCode() == util::error::FAILED_PRECONDITION) {
-    // Entry with that hash already exists.
-    EntryHandle<Logged> preexisting_entry;
-    status = GetEntry(full_path, &preexisting_entry);
-    if (!status.ok()) {
-      LOG(ERROR) << "Couldn't create or fetch " << full_path << " : "
-                 << status;
-      return status;
+    TraceSpan span("etcd_get_preexisting");
+    return GetPreexistingPendingEntry(full_path, entry);
+  }
+  return status;
+}
+
+
+template <class Logged>
+struct EtcdConsistentStore<Logged>::AddPendingState {
+  AddPendingState(Logged* entry, const std::string& path)
+      : entry(entry), path(path), start(std::chrono::steady_clock::now()) {
+  }
+
+  Logged* const entry;
+  const std::string path;
+  const std::chrono::steady_clock::time_point start;
+  EtcdClient::Response create_resp;
+  EtcdClient::GetResponse get_resp;
+};
+
+
+template <class Logged>
+void EtcdConsistentStore<Logged>::AddPendingEntryAsync(Logged* entry,
+                                                       util::Task* task) {
+  CHECK_NOTNULL(entry);
+  CHECK(!entry->has_sequence_number());
+
+  if (group_commit_window_ > std::chrono::milliseconds::zero()) {
+    if (JoinGroupCommit(entry, [task](const util::Status& status) {
+          task->Return(status);
+        })) {
+      // The group is written on a thread of |executor_|, which blocks
+      // while etcd answers, but only one per group.
+      executor_->Delay(group_commit_window_,
+                       new util::Task(
+                           [this](util::Task* delay_task) {
+                             delete delay_task;
+                             FlushGroupCommit();
+                           },
+                           executor_));
     }
+    return;
+  }
+
+  const util::Status status(MaybeReject("add_pending_entry"));
+  if (!status.ok()) {
+    task->Return(status);
+    return;
+  }
+
+  AddPendingState* const state(
+      new AddPendingState(entry, GetEntryPath(*entry)));
+  task->DeleteWhenDone(state);
+
+  client_->Create(state->path, EncodeMessage(*entry), &state->create_resp,
+                  task->AddChild(std::bind(
+                      &EtcdConsistentStore<Logged>::AddPendingCreated, this,
+                      state, task, std::placeholders::_1)));
+}
+
+
+template <class Logged>
+void EtcdConsistentStore<Logged>::AddPendingCreated(AddPendingState* state,
+                                                    util::Task* task,
+                                                    util::Task* child_task) {
+  RecordAddLatency(state->start);
+
+  if (child_task->status().CanonicalCode() ==
+      util::error::FAILED_PRECONDITION) {
+    client_->Get(state->path, &state->get_resp,
+                 task->AddChild(std::bind(
+                     &EtcdConsistentStore<Logged>::AddPendingFetched, this,
+                     state, task, std::placeholders::_1)));
+    return;
+  }
+
+  etcd_latency_by_op_ms.RecordLatency(
+      "add_pending_entry", std::chrono::steady_clock::now() - state->start);
+  task->Return(child_task->status());
+}
 
-    // Check the leaf certs are the same (we might be seeing the same cert
-    // submitted with a different chain.)
-    CHECK(LeafEntriesMatch(preexisting_entry.Entry(), *entry));
-    *entry->mutable_sct() = preexisting_entry.Entry().sct();
-    return util::Status(util::error::ALREADY_EXISTS,
-                        "Pending entry already exists.");
+
+template <class Logged>
+void EtcdConsistentStore<Logged>::AddPendingFetched(AddPendingState* state,
+                                                    util::Task* task,
+                                                    util::Task* child_task) {
+  etcd_latency_by_op_ms.RecordLatency(
+      "add_pending_entry", std::chrono::steady_clock::now() - state->start);
+
+  if (!child_task->status().ok()) {
+    LOG(ERROR) << "Couldn't create or fetch " << state->path << " : "
+               << child_task->status();
+    task->Return(child_task->status());
+    return;
   }
+
+  Logged preexisting;
+  CHECK(DecodeMessage(state->get_resp.node.value_, &preexisting));
+  task->Return(UsePreexistingPendingEntry(preexisting, state->entry));
+}
+
+
+template <class Logged>
+void EtcdConsistentStore<Logged>::AddPendingEntries(
+    const std::vector<Logged*>& entries, std::vector<util::Status>* statuses) {
+  ScopedLatency scoped_latency(
+      etcd_latency_by_op_ms.GetScopedLatency("add_pending_entries"));
+
+  CHECK_NOTNULL(statuses)->assign(entries.size(), util::Status::OK);
+  // The indices in |entries| of the ones still to be written.
+  std::vector<size_t> remaining;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    CHECK_NOTNULL(entries[i]);
+    CHECK(!entries[i]->has_sequence_number());
+    (*statuses)[i] = MaybeReject("add_pending_entry");
+    if ((*statuses)[i].ok()) {
+      remaining.push_back(i);
+    }
+  }
+
+  WritePendingEntries(entries, std::move(remaining), statuses);
+}
+
+
+template <class Logged>
+void EtcdConsistentStore<Logged>::WritePendingEntries(
+    const std::vector<Logged*>& entries, std::vector<size_t> remaining,
+    std::vector<util::Status>* statuses) {
+  CHECK_EQ(entries.size(), CHECK_NOTNULL(statuses)->size());
+  while (!remaining.empty()) {
+    std::vector<EtcdClient::WriteOp> ops;
+    for (const size_t i : remaining) {
+      ops.emplace_back(EtcdClient::WriteOp::CREATE, GetEntryPath(*entries[i]),
+                       EncodeMessage(*entries[i]), -1);
+    }
+
+    const std::chrono::steady_clock::time_point start(
+        std::chrono::steady_clock::now());
+    util::SyncTask task(executor_);
+    EtcdClient::BatchResponse resp;
+    client_->Batch(std::move(ops), FLAGS_etcd_add_pending_concurrency, &resp,
+                   task.task());
+    task.Wait();
+    // For throttling purposes, a batch counts as a single addition.
+    RecordAddLatency(start);
+
+    // The batch stops at the first failure, which is usually an entry
+    // that already exists. The entries it didn't get to (left ABORTED)
+    // are then tried again.
+    const bool retry(task.status().CanonicalCode() ==
+                     util::error::FAILED_PRECONDITION);
+    std::vector<size_t> not_attempted;
+    for (size_t j = 0; j < remaining.size(); ++j) {
+      const size_t i(remaining[j]);
+      const util::Status& status(resp.statuses[j]);
+      if (status.CanonicalCode() == util::error::FAILED_PRECONDITION) {
+        (*statuses)[i] =
+            GetPreexistingPendingEntry(GetEntryPath(*entries[i]), entries[i]);
+      } else if (status.CanonicalCode() == util::error::ABORTED && retry) {
+        not_attempted.push_back(i);
+      } else if (status.CanonicalCode() == util::error::ABORTED) {
+        (*statuses)[i] = task.status();
+      } else {
+        (*statuses)[i] = status;
+      }
+    }
+    remaining.swap(not_attempted);
+  }
+}
+
+
+template <class Logged>
+util::Status EtcdConsistentStore<Logged>::GroupCommitPendingEntry(
+    Logged* entry) {
+  util::Status status;
+  Notification done;
+  if (JoinGroupCommit(entry, [&status, &done](const util::Status& s) {
+        status = s;
+        done.Notify();
+      })) {
+    std::this_thread::sleep_for(group_commit_window_);
+    FlushGroupCommit();
+  }
+  done.WaitForNotification();
   return status;
 }
 
+
+template <class Logged>
+bool EtcdConsistentStore<Logged>::JoinGroupCommit(
+    Logged* entry, const std::function<void(const util::Status&)>& done) {
+  std::lock_guard<std::mutex> lock(group_commit_lock_);
+  group_commit_queue_.push_back(GroupCommitRequest{entry, done});
+  return group_commit_queue_.size() == 1;
+}
+
+
+template <class Logged>
+void EtcdConsistentStore<Logged>::FlushGroupCommit() {
+  // The callers arriving from now on start the next group, which can
+  // be written while this one is.
+  std::vector<GroupCommitRequest> group;
+  {
+    std::lock_guard<std::mutex> lock(group_commit_lock_);
+    group.swap(group_commit_queue_);
+  }
+  etcd_add_pending_group_commits->Increment();
+  etcd_add_pending_group_commit_entries->IncrementBy(group.size());
+
+  std::vector<Logged*> entries;
+  std::vector<util::Status> statuses;
+  // As with AddPendingEntry(), each entry is admitted on its own.
+  std::vector<size_t> remaining;
+  for (size_t i = 0; i < group.size(); ++i) {
+    entries.push_back(group[i].entry);
+    statuses.push_back(MaybeReject("add_pending_entry"));
+    if (statuses[i].ok()) {
+      remaining.push_back(i);
+    }
+  }
+  WritePendingEntries(entries, std::move(remaining), &statuses);
+
+  for (size_t i = 0; i < group.size(); ++i) {
+    group[i].done(statuses[i]);
+  }
+}
+
+
+template <class Logged>
+util::Status EtcdConsistentStore<Logged>::GetPreexistingPendingEntry(
+    const std::string& path, Logged* entry) const {
+  EntryHandle<Logged> preexisting_entry;
+  const util::Status status(GetEntry(path, &preexisting_entry));
+  if (!status.ok()) {
+    LOG(ERROR) << "Couldn't create or fetch " << path << " : " << status;
+    return status;
+  }
+
+  return UsePreexistingPendingEntry(preexisting_entry.Entry(), entry);
+}
+
+
+template <class Logged>
+util::Status EtcdConsistentStore<Logged>::UsePreexistingPendingEntry(
+    const Logged& preexisting, Logged* entry) const {
+  // Check the leaf certs are the same (we might be seeing the same cert
+  // submitted with a different chain.)
+  CHECK(LeafEntriesMatch(preexisting, *entry));
+  *entry->mutable_sct() = preexisting.sct();
+  // The leaf hash goes with the SCT.
+  if (preexisting.has_merkle_leaf_hash()) {
+    entry->set_merkle_leaf_hash(preexisting.merkle_leaf_hash());
+  } else {
+    entry->clear_merkle_leaf_hash();
+  }
+  return util::Status(util::error::ALREADY_EXISTS,
+                      "Pending entry already exists.");
+}
+
+
+template <class Logged>
+void EtcdConsistentStore<Logged>::RecordAddLatency(
+    const std::chrono::steady_clock::time_point& start) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  add_latency_total_ += std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
+  ++num_adds_;
+}
+
 template <class Logged>
 util::Status EtcdConsistentStore<Logged>::GetPendingEntryForHash(
     const std::string& hash, EntryHandle<Logged>* entry) const {
+  if (pending_index_enabled_) {
+    CHECK_NOTNULL(entry);
+    std::lock_guard<std::mutex> lock(pending_index_lock_);
+    const auto it(pending_index_.find(GetEntryPath(hash)));
+    if (it == pending_index_.end()) {
+      return util::Status(util::error::NOT_FOUND, "no pending entry");
+    }
+    *entry = it->second;
+    return util::Status::OK;
+  }
+
   ScopedLatency scoped_latency(
       etcd_latency_by_op_ms.GetScopedLatency("get_pending_entry_for_hash"));
 
@@ -334,13 +714,37 @@ util::Status EtcdConsistentStore<Logged>::GetPendingEntryForHash(
 }
 
 
+template <class Logged>
+bool EtcdConsistentStore<Logged>::CachesPendingEntries() const {
+  return pending_index_enabled_;
+}
+
+
+template <class Logged>
+void EtcdConsistentStore<Logged>::OnPendingEntriesUpdated(
+    const std::vector<Update<Logged>>& updates) {
+  std::lock_guard<std::mutex> lock(pending_index_lock_);
+  for (const auto& update : updates) {
+    if (update.exists_) {
+      pending_index_[update.handle_.Key()] = update.handle_;
+    } else {
+      pending_index_.erase(update.handle_.Key());
+    }
+  }
+  etcd_total_entries->Set("indexed_pending", pending_index_.size());
+}
+
+
 template <class Logged>
 util::Status EtcdConsistentStore<Logged>::GetPendingEntries(
     std::vector<EntryHandle<Logged>>* entries) const {
   ScopedLatency scoped_latency(
       etcd_latency_by_op_ms.GetScopedLatency("get_pending_entries"));
 
-  util::Status status(GetAllEntriesInDir(GetFullPath(kEntriesDir), entries));
+  util::Status status(
+      entries_shard_digits_ > 0
+          ? GetShardedPendingEntries(entries)
+          : GetAllEntriesInDir(GetFullPath(kEntriesDir), entries));
   if (status.ok()) {
     for (const auto& entry : *entries) {
       CHECK(!entry.Entry().has_sequence_number());
@@ -366,7 +770,10 @@ util::Status EtcdConsistentStore<Logged>::GetSequenceMapping(
   ScopedLatency scoped_latency(
       etcd_latency_by_op_ms.GetScopedLatency("get_sequence_mapping"));
 
-  util::Status status(GetEntry(GetFullPath(kSequenceFile), sequence_mapping));
+  util::Status status(
+      mapping_chunk_size_ > 0
+          ? GetChunkedSequenceMapping(sequence_mapping)
+          : GetEntry(GetFullPath(kSequenceFile), sequence_mapping));
   if (!status.ok()) {
     return status;
   }
@@ -387,10 +794,189 @@ util::Status EtcdConsistentStore<Logged>::UpdateSequenceMapping(
   CHECK(entry->HasHandle());
   CheckMappingIsOrdered(entry->Entry());
   CheckMappingIsContiguousWithServingTree(entry->Entry());
+  if (mapping_chunk_size_ > 0) {
+    return UpdateChunkedSequenceMapping(entry);
+  }
   return UpdateEntry(entry);
 }
 
 
+template <class Logged>
+util::Status EtcdConsistentStore<Logged>::GetChunkedSequenceMapping(
+    EntryHandle<ct::SequenceMapping>* sequence_mapping) const {
+  CHECK_NOTNULL(sequence_mapping);
+  util::SyncTask task(executor_);
+  EtcdClient::GetResponse resp;
+  client_->Get(GetFullPath(kSequenceChunksDir), &resp, task.task());
+  task.Wait();
+  if (task.status().CanonicalCode() == util::error::NOT_FOUND) {
+    // Nothing was written in chunks yet, start from the single value
+    // (if any), the first update will split it.
+    util::Status status(GetEntry(GetFullPath(kSequenceFile), sequence_mapping));
+    if (status.CanonicalCode() == util::error::NOT_FOUND) {
+      sequence_mapping->Set(GetFullPath(kSequenceChunksDir),
+                            ct::SequenceMapping(), 0);
+      status = util::Status::OK;
+    }
+    if (status.ok()) {
+      std::lock_guard<std::mutex> lock(mapping_chunks_lock_);
+      mapping_chunks_.clear();
+      mapping_chunks_handle_ = sequence_mapping->Handle();
+    }
+    return status;
+  }
+  if (!task.status().ok()) {
+    return task.status();
+  }
+  if (!resp.node.is_dir_) {
+    return util::Status(util::error::FAILED_PRECONDITION,
+                        "node is not a directory: " + resp.node.key_);
+  }
+
+  std::map<std::string, MappingChunk> chunks;
+  for (const auto& node : resp.node.nodes_) {
+    MappingChunk* const chunk(&chunks[node.key_]);
+    chunk->handle = node.modified_index_;
+    CHECK(DecodeValue(node.value_, &chunk->value)) << node.key_;
+  }
+
+  // The paths sort in sequence number order.
+  ct::SequenceMapping mapping;
+  int64_t handle(0);
+  for (auto& chunk : chunks) {
+    ct::SequenceMapping part;
+    CHECK(part.ParseFromString(chunk.second.value)) << chunk.first;
+    CHECK_GT(part.mapping_size(), 0) << chunk.first;
+    chunk.second.last_sequence_number =
+        part.mapping(part.mapping_size() - 1).sequence_number();
+    mapping.mutable_mapping()->MergeFrom(part.mapping());
+    handle = std::max(handle, chunk.second.handle);
+  }
+  sequence_mapping->Set(GetFullPath(kSequenceChunksDir), mapping, handle);
+
+  std::lock_guard<std::mutex> lock(mapping_chunks_lock_);
+  mapping_chunks_.swap(chunks);
+  mapping_chunks_handle_ = handle;
+  return util::Status::OK;
+}
+
+
+template <class Logged>
+util::Status EtcdConsistentStore<Logged>::UpdateChunkedSequenceMapping(
+    EntryHandle<ct::SequenceMapping>* entry) {
+  std::map<std::string, ct::SequenceMapping> new_chunks;
+  for (const auto& m : entry->Entry().mapping()) {
+    *new_chunks[GetMappingChunkPath(m.sequence_number())].add_mapping() = m;
+  }
+
+  std::lock_guard<std::mutex> lock(mapping_chunks_lock_);
+  if (entry->Handle() != mapping_chunks_handle_) {
+    return util::Status(util::error::FAILED_PRECONDITION,
+                        "sequence mapping changed since it was read");
+  }
+  // Whatever happens below, the mapping has to be read again before
+  // the next update.
+  mapping_chunks_handle_ = -1;
+
+  // Remove the chunks which are gone first, they are all below the
+  // serving tree...
+  for (auto it(mapping_chunks_.begin()); it != mapping_chunks_.end();) {
+    if (new_chunks.find(it->first) != new_chunks.end()) {
+      ++it;
+      continue;
+    }
+    util::SyncTask task(executor_);
+    client_->Delete(it->first, it->second.handle, task.task());
+    task.Wait();
+    // It might have been dropped by CleanupOldEntries() already.
+    if (!task.status().ok() &&
+        task.status().CanonicalCode() != util::error::NOT_FOUND) {
+      return task.status();
+    }
+    it = mapping_chunks_.erase(it);
+  }
+
+  // ...then write the others in order, so that readers never see a gap
+  // in the newer entries.
+  for (const auto& new_chunk : new_chunks) {
+    std::string flat_chunk;
+    CHECK(new_chunk.second.SerializeToString(&flat_chunk));
+    const auto existing(mapping_chunks_.find(new_chunk.first));
+    if (existing != mapping_chunks_.end() &&
+        existing->second.value == flat_chunk) {
+      continue;
+    }
+
+    util::SyncTask task(executor_);
+    EtcdClient::Response resp;
+    if (existing == mapping_chunks_.end()) {
+      client_->Create(new_chunk.first, EncodeValue(flat_chunk), &resp,
+                      task.task());
+    } else {
+      client_->Update(new_chunk.first, EncodeValue(flat_chunk),
+                      existing->second.handle, &resp, task.task());
+    }
+    task.Wait();
+    if (!task.status().ok()) {
+      return task.status();
+    }
+    MappingChunk* const chunk(&mapping_chunks_[new_chunk.first]);
+    chunk->handle = resp.etcd_index;
+    chunk->value.swap(flat_chunk);
+    chunk->last_sequence_number =
+        new_chunk.second.mapping(new_chunk.second.mapping_size() - 1)
+            .sequence_number();
+  }
+
+  int64_t handle(0);
+  for (const auto& chunk : mapping_chunks_) {
+    handle = std::max(handle, chunk.second.handle);
+  }
+  mapping_chunks_handle_ = handle;
+  entry->SetHandle(handle);
+  return util::Status::OK;
+}
+
+
+template <class Logged>
+void EtcdConsistentStore<Logged>::DeleteOldMappingChunks(
+    int64_t clean_up_to_sequence_number) {
+  std::lock_guard<std::mutex> lock(mapping_chunks_lock_);
+  std::vector<EtcdClient::WriteOp> ops;
+  for (auto it(mapping_chunks_.begin());
+       it != mapping_chunks_.end() &&
+       it->second.last_sequence_number <= clean_up_to_sequence_number;
+       ++it) {
+    ops.emplace_back(EtcdClient::WriteOp::DELETE, it->first, "",
+                     it->second.handle);
+  }
+  if (ops.empty()) {
+    return;
+  }
+  // A concurrent update would put them back.
+  mapping_chunks_handle_ = -1;
+
+  util::SyncTask task(executor_);
+  EtcdClient::BatchResponse resp;
+  client_->Batch(std::move(ops), FLAGS_etcd_delete_concurrency, &resp,
+                 task.task());
+  task.Wait();
+  if (!task.status().ok()) {
+    // Leave the rest to the next update of the mapping.
+    LOG(WARNING) << "Couldn't delete old sequence mapping chunks: "
+                 << task.status();
+  }
+  auto it(mapping_chunks_.begin());
+  for (const auto& status : resp.statuses) {
+    if (status.ok()) {
+      it = mapping_chunks_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+
 template <class Logged>
 util::StatusOr<ct::ClusterNodeState>
 EtcdConsistentStore<Logged>::GetClusterNodeState() const {
@@ -497,6 +1083,23 @@ void EtcdConsistentStore<Logged>::WatchClusterConfig(
 }
 
 
+template <class Logged>
+void EtcdConsistentStore<Logged>::WatchPendingEntries(
+    const typename ConsistentStore<Logged>::PendingEntriesCallback& cb,
+    util::Task* task) {
+  // The watch covers the shard directories too, so that a single long
+  // poll follows all of the entries, and the first call to |cb| has
+  // those of every shard.
+  client_->Watch(
+      GetFullPath(kEntriesDir),
+      std::bind(&ConvertMultipleUpdate<
+                    Logged,
+                    typename ConsistentStore<Logged>::PendingEntriesCallback>,
+                cb, std::placeholders::_1),
+      task);
+}
+
+
 template <class Logged>
 util::Status EtcdConsistentStore<Logged>::SetClusterConfig(
     const ct::ClusterConfig& config) {
@@ -525,7 +1128,7 @@ util::Status EtcdConsistentStore<Logged>::GetEntry(
     return task.status();
   }
   T t;
-  CHECK(t.ParseFromString(util::FromBase64(resp.node.value_.c_str())));
+  CHECK(DecodeMessage(resp.node.value_, &t));
   entry->Set(path, t, resp.node.modified_index_);
   return util::Status::OK;
 }
@@ -542,20 +1145,88 @@ util::Status EtcdConsistentStore<Logged>::GetAllEntriesInDir(
   CHECK_EQ(0, entries->size());
   util::SyncTask task(executor_);
   EtcdClient::GetResponse resp;
-  client_->Get(dir, &resp, task.task());
+  // Decode the entries as they are parsed out of the response, rather
+  // than holding on to the whole listing first.
+  client_->GetDir(dir,
+                  [entries](const EtcdClient::Node& node) {
+                    T t;
+                    CHECK(DecodeMessage(node.value_, &t));
+                    entries->emplace_back(EntryHandle<Logged>(
+                        node.key_, t, node.modified_index_));
+                  },
+                  &resp, task.task());
   task.Wait();
   if (!task.status().ok()) {
+    entries->clear();
     return task.status();
   }
   if (!resp.node.is_dir_) {
+    entries->clear();
     return util::Status(util::error::FAILED_PRECONDITION,
                         "node is not a directory: " + dir);
   }
-  for (const auto& node : resp.node.nodes_) {
-    T t;
-    CHECK(t.ParseFromString(util::FromBase64(node.value_.c_str())));
-    entries->emplace_back(
-        EntryHandle<Logged>(node.key_, t, node.modified_index_));
+  return util::Status::OK;
+}
+
+
+template <class Logged>
+util::Status EtcdConsistentStore<Logged>::GetShardedPendingEntries(
+    std::vector<EntryHandle<Logged>>* entries) const {
+  CHECK_NOTNULL(entries);
+  CHECK_EQ(0, entries->size());
+  const int num_shards(NumEntryShards());
+  std::vector<EtcdClient::GetResponse> resps(num_shards);
+  std::vector<std::vector<EntryHandle<Logged>>> shards(num_shards);
+  std::vector<util::Status> statuses(num_shards);
+  util::SyncTask task(executor_);
+  for (int shard = 0; shard < num_shards; ++shard) {
+    // The shards are decoded as their responses are parsed, on the
+    // thread handling each of them.
+    std::vector<EntryHandle<Logged>>* const shard_entries(&shards[shard]);
+    client_->GetDir(
+        GetEntryShardPath(shard),
+        [shard_entries](const EtcdClient::Node& node) {
+          Logged entry;
+          CHECK(DecodeMessage(node.value_, &entry));
+          shard_entries->emplace_back(
+              EntryHandle<Logged>(node.key_, entry, node.modified_index_));
+        },
+        &resps[shard],
+        task.task()->AddChild([shard, &resps, &shards, &statuses](
+            util::Task* child) {
+          EtcdClient::GetResponse resp;
+          std::swap(resp, resps[shard]);
+          if (child->status().CanonicalCode() == util::error::NOT_FOUND) {
+            // Nothing has been added to that shard yet.
+            return;
+          }
+          if (!child->status().ok()) {
+            shards[shard].clear();
+            statuses[shard] = child->status();
+            return;
+          }
+          if (!resp.node.is_dir_) {
+            shards[shard].clear();
+            statuses[shard] =
+                util::Status(util::error::FAILED_PRECONDITION,
+                             "node is not a directory: " + resp.node.key_);
+            return;
+          }
+        }));
+  }
+  task.task()->Return();
+  task.Wait();
+
+  size_t total(0);
+  for (int shard = 0; shard < num_shards; ++shard) {
+    if (!statuses[shard].ok()) {
+      return statuses[shard];
+    }
+    total += shards[shard].size();
+  }
+  entries->reserve(total);
+  for (auto& shard : shards) {
+    std::move(shard.begin(), shard.end(), std::back_inserter(*entries));
   }
   return util::Status::OK;
 }
@@ -570,11 +1241,9 @@ util::Status EtcdConsistentStore<Logged>::UpdateEntry(EntryHandle<T>* t) {
   CHECK_NOTNULL(t);
   CHECK(t->HasHandle());
   CHECK(t->HasKey());
-  std::string flat_entry;
-  CHECK(t->Entry().SerializeToString(&flat_entry));
   util::SyncTask task(executor_);
   EtcdClient::Response resp;
-  client_->Update(t->Key(), util::ToBase64(flat_entry), t->Handle(), &resp,
+  client_->Update(t->Key(), EncodeMessage(t->Entry()), t->Handle(), &resp,
                   task.task());
   task.Wait();
   if (task.status().ok()) {
@@ -593,11 +1262,9 @@ util::Status EtcdConsistentStore<Logged>::CreateEntry(EntryHandle<T>* t) {
   CHECK_NOTNULL(t);
   CHECK(!t->HasHandle());
   CHECK(t->HasKey());
-  std::string flat_entry;
-  CHECK(t->Entry().SerializeToString(&flat_entry));
   util::SyncTask task(executor_);
   EtcdClient::Response resp;
-  client_->Create(t->Key(), util::ToBase64(flat_entry), &resp, task.task());
+  client_->Create(t->Key(), EncodeMessage(t->Entry()), &resp, task.task());
   task.Wait();
   if (task.status().ok()) {
     t->SetHandle(resp.etcd_index);
@@ -619,11 +1286,9 @@ util::Status EtcdConsistentStore<Logged>::ForceSetEntry(EntryHandle<T>* t) {
   // calling code should be doing an UpdateEntry() here since they have the
   // handle.
   CHECK(!t->HasHandle());
-  std::string flat_entry;
-  CHECK(t->Entry().SerializeToString(&flat_entry));
   util::SyncTask task(executor_);
   EtcdClient::Response resp;
-  client_->ForceSet(t->Key(), util::ToBase64(flat_entry), &resp, task.task());
+  client_->ForceSet(t->Key(), EncodeMessage(t->Entry()), &resp, task.task());
   task.Wait();
   if (task.status().ok()) {
     t->SetHandle(resp.etcd_index);
@@ -647,11 +1312,9 @@ util::Status EtcdConsistentStore<Logged>::ForceSetEntryWithTTL(
   // the handle.
   CHECK(!t->HasHandle());
   CHECK_LE(0, ttl.count());
-  std::string flat_entry;
-  CHECK(t->Entry().SerializeToString(&flat_entry));
   util::SyncTask task(executor_);
   EtcdClient::Response resp;
-  client_->ForceSetWithTTL(t->Key(), util::ToBase64(flat_entry), ttl, &resp,
+  client_->ForceSetWithTTL(t->Key(), EncodeMessage(t->Entry()), ttl, &resp,
                            task.task());
   task.Wait();
   if (task.status().ok()) {
@@ -687,7 +1350,46 @@ std::string EtcdConsistentStore<Logged>::GetEntryPath(
 template <class Logged>
 std::string EtcdConsistentStore<Logged>::GetEntryPath(
     const std::string& hash) const {
-  return GetFullPath(std::string(kEntriesDir) + util::HexString(hash));
+  const std::string hex(util::HexString(hash));
+  if (entries_shard_digits_ == 0) {
+    return GetFullPath(std::string(kEntriesDir) + hex);
+  }
+  CHECK_GE(hex.size(), static_cast<size_t>(entries_shard_digits_));
+  return GetFullPath(std::string(kEntriesDir) +
+                     hex.substr(0, entries_shard_digits_) + "/" + hex);
+}
+
+
+template <class Logged>
+int EtcdConsistentStore<Logged>::NumEntryShards() const {
+  return 1 << (4 * entries_shard_digits_);
+}
+
+
+template <class Logged>
+std::string EtcdConsistentStore<Logged>::GetEntryShardPath(int shard) const {
+  CHECK_GT(entries_shard_digits_, 0);
+  CHECK_GE(shard, 0);
+  CHECK_LT(shard, NumEntryShards());
+  char prefix[4];
+  CHECK_LT(snprintf(prefix, sizeof(prefix), "%0*x", entries_shard_digits_,
+                    shard),
+           static_cast<int>(sizeof(prefix)));
+  return GetFullPath(std::string(kEntriesDir) + prefix + "/");
+}
+
+
+template <class Logged>
+std::string EtcdConsistentStore<Logged>::GetMappingChunkPath(
+    int64_t sequence_number) const {
+  CHECK_GT(mapping_chunk_size_, 0);
+  CHECK_GE(sequence_number, 0);
+  // Zero-padded, so that the chunks sort in order.
+  char name[24];
+  CHECK_LT(snprintf(name, sizeof(name), "%020" PRId64,
+                    sequence_number / mapping_chunk_size_),
+           static_cast<int>(sizeof(name)));
+  return GetFullPath(std::string(kSequenceChunksDir) + name);
 }
 
 
@@ -740,9 +1442,12 @@ template <class Logged>
 template <class T>
 Update<T> EtcdConsistentStore<Logged>::TypedUpdateFromNode(
     const EtcdClient::Node& node) {
-  const std::string raw_value(util::FromBase64(node.value_.c_str()));
   T thing;
-  CHECK(thing.ParseFromString(raw_value)) << raw_value;
+  // Deleted nodes have no value left, which wouldn't parse for types
+  // with required fields.
+  if (!node.deleted_) {
+    CHECK(DecodeMessage(node.value_, &thing)) << node.value_;
+  }
   EntryHandle<T> handle(node.key_, thing);
   if (!node.deleted_) {
     handle.SetHandle(node.modified_index_);
@@ -800,46 +1505,98 @@ void EtcdConsistentStore<Logged>::OnClusterConfigUpdated(
 
 
 template <class Logged>
-util::StatusOr<int64_t> EtcdConsistentStore<Logged>::CleanupOldEntries() {
-  ScopedLatency scoped_latency(
-      etcd_latency_by_op_ms.GetScopedLatency("cleanup_old_entries"));
-
+util::Status EtcdConsistentStore<Logged>::GetOldEntryKeys(
+    int64_t max_keys, int64_t* clean_up_to_sequence_number,
+    std::vector<std::string>* keys_to_delete, int64_t* backlog) const {
+  CHECK_GE(max_keys, 0);
+  CHECK_NOTNULL(clean_up_to_sequence_number);
+  CHECK_NOTNULL(keys_to_delete);
+  CHECK_NOTNULL(backlog);
+  *clean_up_to_sequence_number = -1;
+  *backlog = 0;
   if (!election_->IsMaster()) {
     return util::Status(util::error::PERMISSION_DENIED,
                         "Non-master node cannot run cleanups.");
   }
 
-  // Figure out where we're cleaning up to...
+  // Figure out where we're cleaning up from and to...
   std::unique_lock<std::mutex> lock(mutex_);
   if (!serving_sth_) {
     LOG(INFO) << "No current serving_sth, nothing to do.";
-    return 0;
+    return util::Status::OK;
   }
-  const int64_t clean_up_to_sequence_number(
-      serving_sth_->Entry().tree_size() - 1);
+  const int64_t serving_tree_size(serving_sth_->Entry().tree_size());
+  const int64_t clean_up_from(cleaned_up_to_);
   lock.unlock();
-
-  LOG(INFO) << "Cleaning old entries up to and including sequence number: "
-            << clean_up_to_sequence_number;
+  if (serving_tree_size <= clean_up_from) {
+    // Nothing new since the last cleanup, don't even read the mapping.
+    return util::Status::OK;
+  }
 
   EntryHandle<ct::SequenceMapping> sequence_mapping;
-  util::Status status(GetSequenceMapping(&sequence_mapping));
+  const util::Status status(GetSequenceMapping(&sequence_mapping));
   if (!status.ok()) {
     LOG(WARNING) << "Couldn't get sequence mapping: " << status;
     return status;
   }
 
-  std::vector<std::string> keys_to_delete;
-  for (int mapping_index = 0;
-       mapping_index < sequence_mapping.Entry().mapping_size() &&
-       sequence_mapping.Entry().mapping(mapping_index).sequence_number() <=
-           clean_up_to_sequence_number;
-       ++mapping_index) {
+  for (const auto& mapping : sequence_mapping.Entry().mapping()) {
+    if (mapping.sequence_number() >= serving_tree_size) {
+      break;
+    }
+    if (mapping.sequence_number() < clean_up_from) {
+      continue;
+    }
+    ++*backlog;
+    if (max_keys > 0 &&
+        keys_to_delete->size() >= static_cast<size_t>(max_keys)) {
+      continue;
+    }
     // Delete the entry from /entries.
-    keys_to_delete.emplace_back(GetEntryPath(
-        sequence_mapping.Entry().mapping(mapping_index).entry_hash()));
+    keys_to_delete->emplace_back(GetEntryPath(mapping.entry_hash()));
+    *clean_up_to_sequence_number = mapping.sequence_number();
+  }
+  if (keys_to_delete->size() == static_cast<size_t>(*backlog)) {
+    // Also skip the sequence numbers no longer in the mapping next time.
+    *clean_up_to_sequence_number = serving_tree_size - 1;
   }
 
+  LOG(INFO) << "Cleaning " << keys_to_delete->size() << " of " << *backlog
+            << " old entries, up to and including sequence number: "
+            << *clean_up_to_sequence_number;
+  return util::Status::OK;
+}
+
+
+template <class Logged>
+void EtcdConsistentStore<Logged>::SetCleanedUpTo(int64_t sequence_number,
+                                                 int64_t backlog) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cleaned_up_to_ = std::max(cleaned_up_to_, sequence_number + 1);
+  }
+  etcd_cleanup_backlog->Set(backlog);
+}
+
+
+template <class Logged>
+util::StatusOr<int64_t> EtcdConsistentStore<Logged>::CleanupOldEntries() {
+  ScopedLatency scoped_latency(
+      etcd_latency_by_op_ms.GetScopedLatency("cleanup_old_entries"));
+
+  CHECK_GE(FLAGS_etcd_cleanup_batch_size, 0);
+  int64_t clean_up_to_sequence_number;
+  std::vector<std::string> keys_to_delete;
+  int64_t backlog;
+  util::Status status(GetOldEntryKeys(FLAGS_etcd_cleanup_batch_size,
+                                      &clean_up_to_sequence_number,
+                                      &keys_to_delete, &backlog));
+  if (!status.ok()) {
+    return status;
+  }
+  if (clean_up_to_sequence_number < 0) {
+    return 0;
+  }
 
   const int64_t num_entries_cleaned(keys_to_delete.size());
   util::SyncTask task(executor_);
@@ -848,11 +1605,139 @@ util::StatusOr<int64_t> EtcdConsistentStore<Logged>::CleanupOldEntries() {
   status = task.status();
   if (!status.ok()) {
     LOG(WARNING) << "EtcdDeleteKeys failed: " << task.status();
+    return status;
+  }
+  SetCleanedUpTo(clean_up_to_sequence_number, backlog - num_entries_cleaned);
+  if (mapping_chunk_size_ > 0) {
+    // The chunks with only cleaned up entries can go at once, rather
+    // than be rewritten by the next sequencing.
+    DeleteOldMappingChunks(clean_up_to_sequence_number);
   }
   return num_entries_cleaned;
 }
 
 
+template <class Logged>
+util::StatusOr<int64_t> EtcdConsistentStore<Logged>::BulkCleanupOldEntries(
+    int64_t chunk_size, bool delete_shard_dirs) {
+  CHECK_GT(chunk_size, 0);
+  int64_t clean_up_to_sequence_number;
+  std::vector<std::string> keys_to_delete;
+  int64_t backlog;
+  util::Status status(GetOldEntryKeys(0 /* max_keys */,
+                                      &clean_up_to_sequence_number,
+                                      &keys_to_delete, &backlog));
+  if (!status.ok()) {
+    return status;
+  }
+  if (clean_up_to_sequence_number < 0) {
+    return 0;
+  }
+
+  const std::chrono::steady_clock::time_point start(
+      std::chrono::steady_clock::now());
+  int64_t num_entries_cleaned(0);
+  if (delete_shard_dirs && entries_shard_digits_ > 0) {
+    status = DeleteOldEntryShards(&keys_to_delete, &num_entries_cleaned);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  const int64_t total(num_entries_cleaned + keys_to_delete.size());
+  for (size_t begin = 0; begin < keys_to_delete.size(); begin += chunk_size) {
+    const size_t end(std::min(keys_to_delete.size(),
+                              begin + static_cast<size_t>(chunk_size)));
+    std::vector<std::string> chunk(keys_to_delete.begin() + begin,
+                                   keys_to_delete.begin() + end);
+    util::SyncTask task(executor_);
+    EtcdForceDeleteKeys(client_, std::move(chunk), task.task());
+    task.Wait();
+    if (!task.status().ok()) {
+      LOG(WARNING) << "EtcdDeleteKeys failed after " << num_entries_cleaned
+                   << " entries: " << task.status();
+      return task.status();
+    }
+    num_entries_cleaned += end - begin;
+
+    const double elapsed_secs(std::chrono::duration<double>(
+                                  std::chrono::steady_clock::now() - start)
+                                  .count());
+    LOG(INFO) << "Deleted " << num_entries_cleaned << " of " << total
+              << " old entries ("
+              << (elapsed_secs > 0 ? num_entries_cleaned / elapsed_secs : 0)
+              << " entries/s)";
+  }
+
+  SetCleanedUpTo(clean_up_to_sequence_number, 0);
+  if (mapping_chunk_size_ > 0) {
+    DeleteOldMappingChunks(clean_up_to_sequence_number);
+  }
+  return num_entries_cleaned;
+}
+
+
+// Removes each entry shard in which all the entries are in
+// |keys_to_delete| with a single recursive delete, and takes their
+// entries out of |keys_to_delete|.
+template <class Logged>
+util::Status EtcdConsistentStore<Logged>::DeleteOldEntryShards(
+    std::vector<std::string>* keys_to_delete, int64_t* num_entries_cleaned) {
+  CHECK_NOTNULL(keys_to_delete);
+  CHECK_NOTNULL(num_entries_cleaned);
+  const std::unordered_set<std::string> old_keys(keys_to_delete->begin(),
+                                                 keys_to_delete->end());
+  std::unordered_set<std::string> deleted_keys;
+  for (int shard = 0; shard < NumEntryShards(); ++shard) {
+    const std::string shard_path(GetEntryShardPath(shard));
+    EtcdClient::GetResponse resp;
+    util::SyncTask get_task(executor_);
+    client_->Get(shard_path, &resp, get_task.task());
+    get_task.Wait();
+    if (get_task.status().CanonicalCode() == util::error::NOT_FOUND) {
+      continue;
+    }
+    if (!get_task.status().ok()) {
+      return get_task.status();
+    }
+
+    bool all_old(!resp.node.nodes_.empty());
+    for (const auto& node : resp.node.nodes_) {
+      if (old_keys.count(node.key_) == 0) {
+        all_old = false;
+        break;
+      }
+    }
+    if (!all_old) {
+      continue;
+    }
+
+    util::SyncTask delete_task(executor_);
+    // Without the trailing slash.
+    client_->ForceDeleteDir(shard_path.substr(0, shard_path.size() - 1),
+                            delete_task.task());
+    delete_task.Wait();
+    if (!delete_task.status().ok()) {
+      return delete_task.status();
+    }
+    for (const auto& node : resp.node.nodes_) {
+      deleted_keys.insert(node.key_);
+    }
+    LOG(INFO) << "Deleted " << shard_path << " (" << resp.node.nodes_.size()
+              << " entries)";
+  }
+
+  keys_to_delete->erase(
+      std::remove_if(keys_to_delete->begin(), keys_to_delete->end(),
+                     [&deleted_keys](const std::string& key) {
+                       return deleted_keys.count(key) > 0;
+                     }),
+      keys_to_delete->end());
+  *num_entries_cleaned += deleted_keys.size();
+  return util::Status::OK;
+}
+
+
 template <class Logged>
 void EtcdConsistentStore<Logged>::StartEtcdStatsFetch() {
   if (etcd_stats_task_.task()->CancelRequested()) {
@@ -881,11 +1766,8 @@ void EtcdConsistentStore<Logged>::EtcdStatsFetchDone(
     const util::StatusOr<int64_t> num_entries(
         CalculateNumEtcdEntries(response->stats));
     if (num_entries.ok()) {
-      {
-        std::lock_guard<std::mutex> lock(mutex_);
-        num_etcd_entries_ = num_entries.ValueOrDie();
-      }
-      etcd_total_entries->Set("all", num_etcd_entries_);
+      UpdateThrottling(num_entries.ValueOrDie());
+      etcd_total_entries->Set("all", num_entries.ValueOrDie());
     } else {
       VLOG(1) << "Failed to calculate num_entries: " << num_entries.status();
     }
@@ -899,31 +1781,66 @@ void EtcdConsistentStore<Logged>::EtcdStatsFetchDone(
           std::bind(&EtcdConsistentStore<Logged>::StartEtcdStatsFetch, this)));
 }
 
+template <class Logged>
+void EtcdConsistentStore<Logged>::UpdateThrottling(int64_t num_entries) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  // etcd is falling behind if the entries are piling up faster than
+  // they are sequenced and cleaned up...
+  bool congested(false);
+  if (cluster_config_ && num_entries > num_etcd_entries_ &&
+      num_entries >=
+          FLAGS_etcd_throttle_start_fraction *
+              cluster_config_->etcd_reject_add_pending_threshold()) {
+    congested = true;
+  }
+  // ...or if it is getting slow.
+  if (FLAGS_etcd_throttle_target_latency_ms > 0 && num_adds_ > 0 &&
+      add_latency_total_ / num_adds_ >
+          std::chrono::milliseconds(FLAGS_etcd_throttle_target_latency_ms)) {
+    congested = true;
+  }
+  num_etcd_entries_ = num_entries;
+  add_latency_total_ = std::chrono::microseconds::zero();
+  num_adds_ = 0;
+  lock.unlock();
+
+  admission_.Update(congested, util::AdmissionController::Clock::now());
+  etcd_throttle_rate->Set(admission_.rate());
+}
+
+
 // This method attempts to modulate the incoming traffic in response to the
-// number of entries currently in etcd.
+// number of entries currently in etcd, and how fast it is keeping up.
 //
 // Once the number of entries is above reject_threshold, we will start
 // returning a RESOURCE_EXHAUSTED status, which should result in a 503 being
-// sent to the client.
+// sent to the client. Before that, UpdateThrottling() limits the rate at
+// which the entries are accepted, so that the extra load is shed
+// progressively.
 template <class Logged>
 util::Status EtcdConsistentStore<Logged>::MaybeReject(
     const std::string& type) const {
   std::unique_lock<std::mutex> lock(mutex_);
 
-  if (!cluster_config_) {
-    // No config, whatever.
-    return util::Status::OK;
-  }
+  if (cluster_config_) {
+    const int64_t etcd_size(num_etcd_entries_);
+    const int64_t reject_threshold(
+        cluster_config_->etcd_reject_add_pending_threshold());
+    lock.unlock();
 
-  const int64_t etcd_size(num_etcd_entries_);
-  const int64_t reject_threshold(
-      cluster_config_->etcd_reject_add_pending_threshold());
-  lock.unlock();
+    if (etcd_size >= reject_threshold) {
+      etcd_rejected_requests->Increment(type);
+      return util::Status(util::error::RESOURCE_EXHAUSTED,
+                          "Rejected due to high number of pending entries.");
+    }
+  } else {
+    lock.unlock();
+  }
 
-  if (etcd_size >= reject_threshold) {
+  if (!admission_.Admit(util::AdmissionController::Clock::now())) {
     etcd_rejected_requests->Increment(type);
     return util::Status(util::error::RESOURCE_EXHAUSTED,
-                        "Rejected due to high number of pending entries.");
+                        "Rejected to let etcd catch up.");
   }
   return util::Status::OK;
 }
@@ -1,14 +1,20 @@
 #ifndef CERT_TRANS_LOG_ETCD_CONSISTENT_STORE_H_
 #define CERT_TRANS_LOG_ETCD_CONSISTENT_STORE_H_
 
+#include <chrono>
+#include <functional>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <stdint.h>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "base/macros.h"
 #include "log/consistent_store.h"
 #include "proto/ct.pb.h"
+#include "util/admission_controller.h"
 #include "util/etcd.h"
 #include "util/libevent_wrapper.h"
 #include "util/status.h"
@@ -37,11 +43,30 @@ class EtcdConsistentStore : public ConsistentStore<Logged> {
 
   util::StatusOr<ct::SignedTreeHead> GetServingSTH() const override;
 
+  // With --etcd_add_pending_group_commit_ms, the entries added by
+  // concurrent callers are collected and written to etcd together.
+  // Admission control still applies to each entry, so that part of a
+  // group can be rejected while the rest of it is written.
   util::Status AddPendingEntry(Logged* entry) override;
 
+  // Doesn't block a thread while etcd is written to, so that many
+  // additions can be in flight at once. With
+  // --etcd_add_pending_group_commit_ms, the entry joins the next group
+  // instead, and only the thread writing the group blocks.
+  void AddPendingEntryAsync(Logged* entry, util::Task* task) override;
+
+  // The entries are written with up to --etcd_add_pending_concurrency
+  // requests in flight.
+  void AddPendingEntries(const std::vector<Logged*>& entries,
+                         std::vector<util::Status>* statuses) override;
+
+  // With --etcd_pending_entry_index, this is answered from the index
+  // of the pending entries, without going to etcd.
   util::Status GetPendingEntryForHash(
       const std::string& hash, EntryHandle<Logged>* entry) const override;
 
+  bool CachesPendingEntries() const override;
+
   util::Status GetPendingEntries(
       std::vector<EntryHandle<Logged>>* entries) const override;
 
@@ -67,12 +92,28 @@ class EtcdConsistentStore : public ConsistentStore<Logged> {
       const typename ConsistentStore<Logged>::ClusterConfigCallback& cb,
       util::Task* task) override;
 
+  void WatchPendingEntries(
+      const typename ConsistentStore<Logged>::PendingEntriesCallback& cb,
+      util::Task* task) override;
+
   util::Status SetClusterConfig(const ct::ClusterConfig& config) override;
 
   // Removes sequenced entries with sequence numbers covered by the current
-  // serving STH.
+  // serving STH, up to --etcd_cleanup_batch_size of them at a time,
+  // starting from where the previous call left off. Returns right away
+  // if the serving STH hasn't moved past that.
   util::StatusOr<int64_t> CleanupOldEntries() override;
 
+  // Like CleanupOldEntries(), but for clearing out a large backlog of
+  // them: the entries are deleted |chunk_size| at a time, logging the
+  // progress after each chunk. If |delete_shard_dirs| is set (and
+  // --etcd_entries_shard_digits is in use), the shards that only hold
+  // old entries are removed with one recursive delete each instead,
+  // which doesn't notify the watchers of the individual entries, so
+  // it should only be used while the log servers are stopped.
+  util::StatusOr<int64_t> BulkCleanupOldEntries(int64_t chunk_size,
+                                                bool delete_shard_dirs);
+
  private:
   void WaitForServingSTHVersion(std::unique_lock<std::mutex>* lock,
                                 const int version);
@@ -104,6 +145,29 @@ class EtcdConsistentStore : public ConsistentStore<Logged> {
 
   std::string GetEntryPath(const std::string& hash) const;
 
+  // Used when --etcd_entries_shard_digits is set.
+  int NumEntryShards() const;
+  std::string GetEntryShardPath(int shard) const;
+  util::Status GetShardedPendingEntries(
+      std::vector<EntryHandle<Logged>>* entries) const;
+  util::Status DeleteOldEntryShards(std::vector<std::string>* keys_to_delete,
+                                    int64_t* num_entries_cleaned);
+
+  // Fills |keys_to_delete| with the paths of the entries covered by
+  // the serving STH which haven't been cleaned up yet (see
+  // |cleaned_up_to_|), up to |max_keys| of them if it is non-zero, and
+  // sets |clean_up_to_sequence_number| to the last sequence number
+  // they cover (or -1 if there is nothing to do). |backlog| is set to
+  // the number of entries to clean up, including those past
+  // |max_keys|.
+  util::Status GetOldEntryKeys(int64_t max_keys,
+                               int64_t* clean_up_to_sequence_number,
+                               std::vector<std::string>* keys_to_delete,
+                               int64_t* backlog) const;
+  // Records that the entries up to |sequence_number| have been
+  // cleaned up, and that |backlog| remain.
+  void SetCleanedUpTo(int64_t sequence_number, int64_t backlog);
+
   std::string GetNodePath(const std::string& node_id) const;
 
   std::string GetFullPath(const std::string& key) const;
@@ -111,6 +175,15 @@ class EtcdConsistentStore : public ConsistentStore<Logged> {
   void CheckMappingIsContiguousWithServingTree(
       const ct::SequenceMapping& mapping) const;
 
+  // Used instead of a single value when --etcd_sequence_mapping_chunk_size
+  // is set.
+  util::Status GetChunkedSequenceMapping(
+      EntryHandle<ct::SequenceMapping>* entry) const;
+  util::Status UpdateChunkedSequenceMapping(
+      EntryHandle<ct::SequenceMapping>* entry);
+  void DeleteOldMappingChunks(int64_t clean_up_to_sequence_number);
+  std::string GetMappingChunkPath(int64_t sequence_number) const;
+
 
   // The following 3 methods are static just so that they have friend access to
   // the private c'tor/setters of Update<>
@@ -140,11 +213,58 @@ class EtcdConsistentStore : public ConsistentStore<Logged> {
 
   void OnClusterConfigUpdated(const Update<ct::ClusterConfig>& update);
 
+  void OnPendingEntriesUpdated(const std::vector<Update<Logged>>& updates);
+
   void StartEtcdStatsFetch();
   void EtcdStatsFetchDone(EtcdClient::StatsResponse* response,
                           util::Task* task);
 
+  // Feeds the latest number of etcd entries, and the latency of the
+  // recent additions, to |admission_|.
+  void UpdateThrottling(int64_t num_entries);
   util::Status MaybeReject(const std::string& type) const;
+  void RecordAddLatency(const std::chrono::steady_clock::time_point& start);
+
+  // Writes the entries of |entries| at the indices in |remaining|,
+  // setting their statuses in |statuses| (which must already be the
+  // size of |entries|).
+  void WritePendingEntries(const std::vector<Logged*>& entries,
+                           std::vector<size_t> remaining,
+                           std::vector<util::Status>* statuses);
+
+  // AddPendingEntry() with --etcd_add_pending_group_commit_ms: the
+  // first caller to find |group_commit_queue_| empty waits for the
+  // others to join it, then writes the whole group in one batch and
+  // hands each one its status.
+  struct GroupCommitRequest {
+    Logged* entry;
+    std::function<void(const util::Status&)> done;
+  };
+  util::Status GroupCommitPendingEntry(Logged* entry);
+  // Queues |entry| for the next group commit, with |done| to be called
+  // with its status. Returns true if the caller started a new group,
+  // and so must call FlushGroupCommit() after the window.
+  bool JoinGroupCommit(Logged* entry,
+                       const std::function<void(const util::Status&)>& done);
+  void FlushGroupCommit();
+
+  // Called when |entry| couldn't be added at |path| because there's
+  // already an entry there: sets the SCT of |entry| to the one of the
+  // existing entry and returns ALREADY_EXISTS.
+  util::Status GetPreexistingPendingEntry(const std::string& path,
+                                          Logged* entry) const;
+  // Sets the SCT of |entry| to the one of |preexisting| and returns
+  // ALREADY_EXISTS.
+  util::Status UsePreexistingPendingEntry(const Logged& preexisting,
+                                          Logged* entry) const;
+
+  // The steps of AddPendingEntryAsync(), each called with the child
+  // task of the etcd request before it.
+  struct AddPendingState;
+  void AddPendingCreated(AddPendingState* state, util::Task* task,
+                         util::Task* child_task);
+  void AddPendingFetched(AddPendingState* state, util::Task* task,
+                         util::Task* child_task);
 
   EtcdClient* const client_;  // We don't own this.
   libevent::Base* base_;                  // We don't own this.
@@ -155,6 +275,7 @@ class EtcdConsistentStore : public ConsistentStore<Logged> {
   std::condition_variable serving_sth_cv_;
   util::SyncTask serving_sth_watch_task_;
   util::SyncTask cluster_config_watch_task_;
+  util::SyncTask pending_index_watch_task_;
   util::SyncTask etcd_stats_task_;
 
   mutable std::mutex mutex_;
@@ -163,6 +284,39 @@ class EtcdConsistentStore : public ConsistentStore<Logged> {
   std::unique_ptr<ct::ClusterConfig> cluster_config_;
   bool exiting_;
   int64_t num_etcd_entries_;
+  // For the pending entries added since the last stats fetch.
+  std::chrono::microseconds add_latency_total_;
+  int64_t num_adds_;
+  mutable util::AdmissionController admission_;
+  // The entries with sequence numbers below this have been deleted by
+  // the cleanups of this node, so that the next ones can skip them.
+  int64_t cleaned_up_to_;
+
+  struct MappingChunk {
+    int64_t handle;
+    // The serialized ct::SequenceMapping.
+    std::string value;
+    int64_t last_sequence_number;
+  };
+
+  const int64_t mapping_chunk_size_;
+  // The chunks of the sequence mapping as last read or written, by
+  // path, and the handle given out for them.
+  mutable std::mutex mapping_chunks_lock_;
+  mutable std::map<std::string, MappingChunk> mapping_chunks_;
+  mutable int64_t mapping_chunks_handle_;
+
+  const int entries_shard_digits_;
+
+  const std::chrono::milliseconds group_commit_window_;
+  std::mutex group_commit_lock_;
+  std::vector<GroupCommitRequest> group_commit_queue_;
+
+  // With --etcd_pending_entry_index, the pending entries by path, as
+  // seen by a watch.
+  const bool pending_index_enabled_;
+  mutable std::mutex pending_index_lock_;
+  std::unordered_map<std::string, EntryHandle<Logged>> pending_index_;
 
   friend class EtcdConsistentStoreTest;
   template <class T>
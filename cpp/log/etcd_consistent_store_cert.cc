@@ -7,6 +7,48 @@ DEFINE_int32(etcd_stats_collection_interval_seconds, 2,
              "Number of seconds between fetches of etcd stats.");
 DEFINE_int32(node_state_ttl_seconds, 60,
              "TTL in seconds on the node state files.");
+DEFINE_int32(etcd_sequence_mapping_chunk_size, 0,
+             "If non-zero, store the sequence mapping in etcd as chunks "
+             "covering this many sequence numbers each, so that only the "
+             "chunks which changed have to be written. Otherwise, the whole "
+             "mapping is a single value.");
+DEFINE_int32(etcd_add_pending_concurrency, 8,
+             "Maximum number of requests in flight to etcd when adding a "
+             "batch of pending entries.");
+DEFINE_int32(etcd_add_pending_group_commit_ms, 0,
+             "If non-zero, the pending entries added by concurrent "
+             "submissions are collected for this many milliseconds, and "
+             "written to etcd together as one batch.");
+DEFINE_int32(etcd_entries_shard_digits, 0,
+             "If non-zero, store the pending entries in one directory per "
+             "value of this many leading hex digits of their hash, so that "
+             "they can be fetched and parsed in parallel. Must be the same "
+             "on all the nodes, and only changed when there are no pending "
+             "entries.");
+DEFINE_bool(etcd_pending_entry_index, false,
+            "If set, keep the pending entries in memory, as seen by a watch "
+            "on etcd, so that duplicate submissions can be given the SCT "
+            "of the pending entry before being signed again. This uses "
+            "about as much memory as the pending entries use in etcd.");
+
+DEFINE_int32(etcd_cleanup_batch_size, 1000,
+             "Maximum number of old entries deleted from etcd by each "
+             "cleanup, so that a large backlog is worked through in "
+             "batches rather than in a single burst. 0 for no limit.");
+
+DEFINE_double(etcd_throttle_start_fraction, 0.8,
+              "Once the number of etcd entries is above this fraction of "
+              "the etcd_reject_add_pending_threshold in the cluster config, "
+              "and still growing, the rate of new pending entries accepted "
+              "is reduced.");
+DEFINE_int32(etcd_throttle_target_latency_ms, 0,
+             "If non-zero, the rate of new pending entries accepted is also "
+             "reduced while adding them to etcd takes longer than this on "
+             "average.");
+DEFINE_double(etcd_throttle_rate_increase, 50,
+              "While etcd keeps up, the limit on the rate of new pending "
+              "entries accepted is raised by this many per second at every "
+              "etcd stats collection.");
 
 namespace cert_trans {
 template class EtcdConsistentStore<LoggedCertificate>;
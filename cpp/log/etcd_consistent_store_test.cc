@@ -1,12 +1,15 @@
 #include "log/etcd_consistent_store.h"
 
 #include <atomic>
+#include <chrono>
 #include <functional>
 #include <gflags/gflags.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <string>
 #include <thread>
 #include <unordered_map>
@@ -24,6 +27,11 @@
 
 DECLARE_int32(node_state_ttl_seconds);
 DECLARE_int32(etcd_stats_collection_interval_seconds);
+DECLARE_int32(etcd_sequence_mapping_chunk_size);
+DECLARE_int32(etcd_entries_shard_digits);
+DECLARE_int32(etcd_cleanup_batch_size);
+DECLARE_bool(etcd_pending_entry_index);
+DECLARE_int32(etcd_add_pending_group_commit_ms);
 
 namespace cert_trans {
 
@@ -35,6 +43,7 @@ using std::bind;
 using std::chrono::milliseconds;
 using std::make_pair;
 using std::make_shared;
+using std::map;
 using std::ostringstream;
 using std::pair;
 using std::placeholders::_1;
@@ -75,6 +84,10 @@ class EtcdConsistentStoreTest : public ::testing::Test {
  protected:
   void SetUp() override {
     FLAGS_etcd_stats_collection_interval_seconds = 1;
+    FLAGS_etcd_sequence_mapping_chunk_size = 0;
+    FLAGS_etcd_entries_shard_digits = 0;
+    FLAGS_etcd_pending_entry_index = false;
+    FLAGS_etcd_add_pending_group_commit_ms = 0;
     store_.reset(new EtcdConsistentStore<LoggedCertificate>(
         base_.get(), &executor_, &client_, &election_, kRoot, kNodeId));
     InsertEntry("/root/sequence_mapping", SequenceMapping());
@@ -137,6 +150,57 @@ class EtcdConsistentStoreTest : public ::testing::Test {
     }
   }
 
+  void UseMappingChunks(int chunk_size) {
+    FLAGS_etcd_sequence_mapping_chunk_size = chunk_size;
+    store_.reset();
+    store_.reset(new EtcdConsistentStore<LoggedCertificate>(
+        base_.get(), &executor_, &client_, &election_, kRoot, kNodeId));
+  }
+
+  void UseEntryShards(int digits) {
+    FLAGS_etcd_entries_shard_digits = digits;
+    store_.reset();
+    store_.reset(new EtcdConsistentStore<LoggedCertificate>(
+        base_.get(), &executor_, &client_, &election_, kRoot, kNodeId));
+  }
+
+  void UsePendingEntryIndex() {
+    FLAGS_etcd_pending_entry_index = true;
+    store_.reset();
+    store_.reset(new EtcdConsistentStore<LoggedCertificate>(
+        base_.get(), &executor_, &client_, &election_, kRoot, kNodeId));
+  }
+
+  // Waits for GetPendingEntryForHash() to return |code| for |hash|,
+  // as it can take a moment for the watch to catch up.
+  void WaitForPendingEntryIndex(const string& hash, util::error::Code code) {
+    EntryHandle<LoggedCertificate> handle;
+    for (int i = 0; i < 100; ++i) {
+      if (store_->GetPendingEntryForHash(hash, &handle).CanonicalCode() ==
+          code) {
+        return;
+      }
+      std::this_thread::sleep_for(milliseconds(10));
+    }
+  }
+
+  // Returns the modified index of the chunks, by chunk number.
+  map<int, int64_t> MappingChunks() {
+    const string dir(string(kRoot) + "/sequence_mapping_chunks/");
+    EtcdClient::GetResponse resp;
+    SyncTask task(base_.get());
+    client_.Get(dir, &resp, task.task());
+    task.Wait();
+    map<int, int64_t> chunks;
+    if (task.status().ok()) {
+      for (const auto& node : resp.node.nodes_) {
+        chunks[std::stoi(node.key_.substr(dir.size()))] =
+            node.modified_index_;
+      }
+    }
+    return chunks;
+  }
+
   util::StatusOr<int64_t> CleanupOldEntries() {
     return store_->CleanupOldEntries();
   }
@@ -209,6 +273,10 @@ class EtcdConsistentStoreTest : public ::testing::Test {
     return store_->num_etcd_entries_;
   }
 
+  void UpdateThrottling(int64_t num_entries) {
+    store_->UpdateThrottling(num_entries);
+  }
+
 
   shared_ptr<libevent::Base> base_;
   ThreadPool executor_;
@@ -337,6 +405,166 @@ TEST_F(EtcdConsistentStoreTest,
 }
 
 
+TEST_F(EtcdConsistentStoreTest, TestAddPendingEntryAsync) {
+  LoggedCertificate cert(DefaultCert());
+  LoggedCertificate existing_cert(MakeCert(kTimestamp + 1, "existing"));
+  LoggedCertificate other_cert(existing_cert);
+  other_cert.mutable_sct()->set_timestamp(55555);
+  InsertEntry(string(kRoot) + "/entries/" +
+                  util::HexString(existing_cert.Hash()),
+              other_cert);
+
+  SyncTask task(base_.get());
+  SyncTask existing_task(base_.get());
+  store_->AddPendingEntryAsync(&cert, task.task());
+  store_->AddPendingEntryAsync(&existing_cert, existing_task.task());
+  task.Wait();
+  existing_task.Wait();
+
+  EXPECT_EQ(Status::OK, task.status());
+  EXPECT_EQ(util::error::ALREADY_EXISTS,
+            existing_task.status().CanonicalCode());
+  EXPECT_EQ(other_cert.timestamp(), existing_cert.timestamp());
+
+  EtcdClient::GetResponse resp;
+  SyncTask get_task(base_.get());
+  client_.Get(string(kRoot) + "/entries/" + util::HexString(cert.Hash()),
+              &resp, get_task.task());
+  get_task.Wait();
+  EXPECT_EQ(Status::OK, get_task.status());
+  EXPECT_EQ(Serialize(cert), resp.node.value_);
+}
+
+
+TEST_F(EtcdConsistentStoreTest, TestAddPendingEntriesWorks) {
+  vector<LoggedCertificate> certs;
+  for (int i = 0; i < 10; ++i) {
+    certs.emplace_back(MakeCert(kTimestamp + i, "leaf" + std::to_string(i)));
+  }
+  const auto path([](const LoggedCertificate& cert) {
+    return string(kRoot) + "/entries/" + util::HexString(cert.Hash());
+  });
+  // Some of them are already there, with a different SCT.
+  LoggedCertificate other_cert(certs[3]);
+  other_cert.mutable_sct()->set_timestamp(55555);
+  InsertEntry(path(other_cert), other_cert);
+  InsertEntry(path(certs[7]), certs[7]);
+
+  vector<LoggedCertificate*> entries;
+  for (auto& cert : certs) {
+    entries.push_back(&cert);
+  }
+  vector<Status> statuses;
+  store_->AddPendingEntries(entries, &statuses);
+  ASSERT_EQ(certs.size(), statuses.size());
+
+  for (size_t i = 0; i < certs.size(); ++i) {
+    if (i == 3 || i == 7) {
+      EXPECT_EQ(util::error::ALREADY_EXISTS, statuses[i].CanonicalCode());
+    } else {
+      EXPECT_EQ(Status::OK, statuses[i]) << i;
+    }
+    EtcdClient::GetResponse resp;
+    SyncTask task(base_.get());
+    client_.Get(path(certs[i]), &resp, task.task());
+    task.Wait();
+    EXPECT_EQ(Status::OK, task.status());
+    EXPECT_EQ(Serialize(certs[i]), resp.node.value_);
+  }
+  EXPECT_EQ(55555, certs[3].sct().timestamp());
+}
+
+
+TEST_F(EtcdConsistentStoreTest, TestGroupCommitPendingEntries) {
+  FLAGS_etcd_add_pending_group_commit_ms = 50;
+  store_.reset();
+  store_.reset(new EtcdConsistentStore<LoggedCertificate>(
+      base_.get(), &executor_, &client_, &election_, kRoot, kNodeId));
+
+  vector<LoggedCertificate> certs;
+  for (int i = 0; i < 10; ++i) {
+    certs.emplace_back(MakeCert(kTimestamp + i, "leaf" + std::to_string(i)));
+  }
+  const auto path([](const LoggedCertificate& cert) {
+    return string(kRoot) + "/entries/" + util::HexString(cert.Hash());
+  });
+  LoggedCertificate other_cert(certs[3]);
+  other_cert.mutable_sct()->set_timestamp(55555);
+  InsertEntry(path(other_cert), other_cert);
+
+  vector<Status> statuses(certs.size());
+  vector<thread> threads;
+  for (size_t i = 0; i < certs.size(); ++i) {
+    threads.emplace_back([this, &certs, &statuses, i]() {
+      statuses[i] = store_->AddPendingEntry(&certs[i]);
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  for (size_t i = 0; i < certs.size(); ++i) {
+    if (i == 3) {
+      EXPECT_EQ(util::error::ALREADY_EXISTS, statuses[i].CanonicalCode());
+    } else {
+      EXPECT_EQ(Status::OK, statuses[i]) << i;
+    }
+    EtcdClient::GetResponse resp;
+    SyncTask task(base_.get());
+    client_.Get(path(certs[i]), &resp, task.task());
+    task.Wait();
+    EXPECT_EQ(Status::OK, task.status());
+    EXPECT_EQ(Serialize(certs[i]), resp.node.value_);
+  }
+  EXPECT_EQ(55555, certs[3].sct().timestamp());
+}
+
+
+TEST_F(EtcdConsistentStoreTest, TestGroupCommitPendingEntriesAsync) {
+  FLAGS_etcd_add_pending_group_commit_ms = 50;
+  store_.reset();
+  store_.reset(new EtcdConsistentStore<LoggedCertificate>(
+      base_.get(), &executor_, &client_, &election_, kRoot, kNodeId));
+
+  vector<LoggedCertificate> certs;
+  for (int i = 0; i < 10; ++i) {
+    certs.emplace_back(MakeCert(kTimestamp + i, "leaf" + std::to_string(i)));
+  }
+  const auto path([](const LoggedCertificate& cert) {
+    return string(kRoot) + "/entries/" + util::HexString(cert.Hash());
+  });
+  LoggedCertificate other_cert(certs[3]);
+  other_cert.mutable_sct()->set_timestamp(55555);
+  InsertEntry(path(other_cert), other_cert);
+
+  // All from this thread, none of them blocking it.
+  vector<unique_ptr<SyncTask>> tasks;
+  for (auto& cert : certs) {
+    tasks.emplace_back(new SyncTask(base_.get()));
+    store_->AddPendingEntryAsync(&cert, tasks.back()->task());
+  }
+  for (const auto& task : tasks) {
+    task->Wait();
+  }
+
+  for (size_t i = 0; i < certs.size(); ++i) {
+    if (i == 3) {
+      EXPECT_EQ(util::error::ALREADY_EXISTS,
+                tasks[i]->status().CanonicalCode());
+    } else {
+      EXPECT_EQ(Status::OK, tasks[i]->status()) << i;
+    }
+    EtcdClient::GetResponse resp;
+    SyncTask task(base_.get());
+    client_.Get(path(certs[i]), &resp, task.task());
+    task.Wait();
+    EXPECT_EQ(Status::OK, task.status());
+    EXPECT_EQ(Serialize(certs[i]), resp.node.value_);
+  }
+  EXPECT_EQ(55555, certs[3].sct().timestamp());
+}
+
+
 TEST_F(EtcdConsistentStoreDeathTest,
        TestAddPendingEntryForExistingNonIdenticalEntry) {
   LoggedCertificate cert(DefaultCert());
@@ -382,6 +610,38 @@ TEST_F(EtcdConsistentStoreTest, TestGetPendingEntryForNonExistantHash) {
 }
 
 
+TEST_F(EtcdConsistentStoreTest, TestPendingEntryIndex) {
+  const LoggedCertificate one(MakeCert(123, "one"));
+  InsertEntry(string(kRoot) + "/entries/" + util::HexString(one.Hash()), one);
+  EXPECT_FALSE(store_->CachesPendingEntries());
+  UsePendingEntryIndex();
+  EXPECT_TRUE(store_->CachesPendingEntries());
+
+  LoggedCertificate two(MakeCert(456, "two"));
+  ASSERT_OK(store_->AddPendingEntry(&two));
+  WaitForPendingEntryIndex(one.Hash(), util::error::OK);
+  WaitForPendingEntryIndex(two.Hash(), util::error::OK);
+
+  EntryHandle<LoggedCertificate> handle;
+  ASSERT_OK(store_->GetPendingEntryForHash(one.Hash(), &handle));
+  EXPECT_EQ(one, handle.Entry());
+  ASSERT_OK(store_->GetPendingEntryForHash(two.Hash(), &handle));
+  EXPECT_EQ(two, handle.Entry());
+  EXPECT_THAT(store_->GetPendingEntryForHash("Nah", &handle),
+              StatusIs(util::error::NOT_FOUND, _));
+
+  SyncTask task(&executor_);
+  client_.ForceDelete(string(kRoot) + "/entries/" +
+                          util::HexString(one.Hash()),
+                      task.task());
+  task.Wait();
+  ASSERT_OK(task.status());
+  WaitForPendingEntryIndex(one.Hash(), util::error::NOT_FOUND);
+  EXPECT_THAT(store_->GetPendingEntryForHash(one.Hash(), &handle),
+              StatusIs(util::error::NOT_FOUND, _));
+}
+
+
 TEST_F(EtcdConsistentStoreTest, TestGetPendingEntries) {
   const string kPath(string(kRoot) + "/entries/");
   const LoggedCertificate one(MakeCert(123, "one"));
@@ -516,6 +776,205 @@ TEST_F(EtcdConsistentStoreDeathTest,
 }
 
 
+TEST_F(EtcdConsistentStoreTest, TestChunkedSequenceMapping) {
+  UseMappingChunks(2);
+  for (int seq = 0; seq < 5; ++seq) {
+    AddSequenceMapping(seq, "hash" + std::to_string(seq));
+  }
+
+  EntryHandle<SequenceMapping> mapping;
+  ASSERT_OK(store_->GetSequenceMapping(&mapping));
+  ASSERT_EQ(5, mapping.Entry().mapping_size());
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(i, mapping.Entry().mapping(i).sequence_number());
+    EXPECT_EQ("hash" + std::to_string(i),
+              mapping.Entry().mapping(i).entry_hash());
+  }
+  const map<int, int64_t> chunks(MappingChunks());
+  ASSERT_EQ(3U, chunks.size());
+
+  // Only the last chunk is written again.
+  AddSequenceMapping(5, "hash5");
+  const map<int, int64_t> new_chunks(MappingChunks());
+  ASSERT_EQ(3U, new_chunks.size());
+  EXPECT_EQ(chunks.at(0), new_chunks.at(0));
+  EXPECT_EQ(chunks.at(1), new_chunks.at(1));
+  EXPECT_LT(chunks.at(2), new_chunks.at(2));
+}
+
+
+TEST_F(EtcdConsistentStoreTest, TestChunkedSequenceMappingRejectsStale) {
+  UseMappingChunks(2);
+  AddSequenceMapping(0, "zero");
+  EntryHandle<SequenceMapping> stale;
+  ASSERT_OK(store_->GetSequenceMapping(&stale));
+  AddSequenceMapping(1, "one");
+
+  SequenceMapping::Mapping* m(stale.MutableEntry()->add_mapping());
+  m->set_sequence_number(1);
+  m->set_entry_hash("uno");
+  EXPECT_THAT(store_->UpdateSequenceMapping(&stale),
+              StatusIs(util::error::FAILED_PRECONDITION));
+}
+
+
+TEST_F(EtcdConsistentStoreTest, TestChunkedSequenceMappingFromSingleValue) {
+  SequenceMapping single;
+  for (int seq = 0; seq < 2; ++seq) {
+    SequenceMapping::Mapping* m(single.add_mapping());
+    m->set_sequence_number(seq);
+    m->set_entry_hash("hash" + std::to_string(seq));
+  }
+  ForceSetEntry("/root/sequence_mapping", single);
+  UseMappingChunks(2);
+
+  AddSequenceMapping(2, "hash2");
+  EXPECT_EQ(2U, MappingChunks().size());
+  EntryHandle<SequenceMapping> mapping;
+  ASSERT_OK(store_->GetSequenceMapping(&mapping));
+  EXPECT_EQ(3, mapping.Entry().mapping_size());
+}
+
+
+TEST_F(EtcdConsistentStoreTest, TestCleanupDropsMappingChunks) {
+  UseMappingChunks(2);
+  PopulateForCleanupTests(5, 0, 0);
+  ASSERT_EQ(3U, MappingChunks().size());
+
+  EXPECT_CALL(election_, IsMaster()).WillRepeatedly(Return(true));
+  SignedTreeHead sth;
+  sth.set_timestamp(345345);
+  sth.set_tree_size(3);
+  CHECK(store_->SetServingSTH(sth).ok());
+  {
+    const StatusOr<int64_t> num_cleaned(CleanupOldEntries());
+    ASSERT_OK(num_cleaned.status());
+    EXPECT_EQ(3, num_cleaned.ValueOrDie());
+  }
+
+  // Only the first chunk was entirely cleaned up.
+  const map<int, int64_t> chunks(MappingChunks());
+  EXPECT_EQ(2U, chunks.size());
+  EXPECT_EQ(0U, chunks.count(0));
+  EntryHandle<SequenceMapping> mapping;
+  ASSERT_OK(store_->GetSequenceMapping(&mapping));
+  ASSERT_EQ(3, mapping.Entry().mapping_size());
+  EXPECT_EQ(2, mapping.Entry().mapping(0).sequence_number());
+}
+
+
+TEST_F(EtcdConsistentStoreTest, TestShardedPendingEntries) {
+  UseEntryShards(1);
+  vector<LoggedCertificate> certs;
+  for (int i = 0; i < 20; ++i) {
+    certs.emplace_back(MakeCert(i, "cert" + std::to_string(i)));
+    ASSERT_OK(store_->AddPendingEntry(&certs.back()));
+  }
+
+  for (const auto& cert : certs) {
+    const string hex(util::HexString(cert.Hash()));
+    LoggedCertificate stored;
+    PeekEntry(string(kRoot) + "/entries/" + hex.substr(0, 1) + "/" + hex,
+              &stored);
+    EXPECT_EQ(cert, stored);
+
+    EntryHandle<LoggedCertificate> handle;
+    ASSERT_OK(store_->GetPendingEntryForHash(cert.Hash(), &handle));
+    EXPECT_EQ(cert, handle.Entry());
+  }
+
+  vector<EntryHandle<LoggedCertificate>> entries;
+  ASSERT_OK(store_->GetPendingEntries(&entries));
+  ASSERT_EQ(certs.size(), entries.size());
+  vector<LoggedCertificate> got;
+  for (const auto& e : entries) {
+    got.push_back(e.Entry());
+  }
+  for (const auto& cert : certs) {
+    EXPECT_THAT(got, Contains(cert));
+  }
+}
+
+
+TEST_F(EtcdConsistentStoreTest, TestWatchShardedPendingEntries) {
+  UseEntryShards(1);
+  LoggedCertificate first(DefaultCert());
+  ASSERT_OK(store_->AddPendingEntry(&first));
+
+  std::mutex lock;
+  std::set<string> seen;
+  bool first_call(true);
+  SyncTask task(&executor_);
+  store_->WatchPendingEntries(
+      [&lock, &seen, &first_call,
+       &first](const vector<Update<LoggedCertificate>>& updates) {
+        std::lock_guard<std::mutex> lock_guard(lock);
+        // The first call has the entries of every shard.
+        if (first_call) {
+          first_call = false;
+          bool has_first(false);
+          for (const auto& update : updates) {
+            has_first |= update.handle_.Entry().Hash() == first.Hash();
+          }
+          EXPECT_TRUE(has_first);
+        }
+        for (const auto& update : updates) {
+          if (update.exists_) {
+            seen.insert(update.handle_.Entry().Hash());
+          }
+        }
+      },
+      task.task());
+
+  // Lands in a different shard from |first|.
+  LoggedCertificate second;
+  for (int i = 0;; ++i) {
+    second = MakeCert(kTimestamp, "other leaf " + std::to_string(i));
+    if (util::HexString(second.Hash())[0] !=
+        util::HexString(first.Hash())[0]) {
+      break;
+    }
+  }
+  ASSERT_OK(store_->AddPendingEntry(&second));
+
+  for (int i = 0; i < 100; ++i) {
+    {
+      std::lock_guard<std::mutex> lock_guard(lock);
+      if (seen.size() == 2) {
+        break;
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  {
+    std::lock_guard<std::mutex> lock_guard(lock);
+    EXPECT_EQ(1U, seen.count(first.Hash()));
+    EXPECT_EQ(1U, seen.count(second.Hash()));
+  }
+  task.Cancel();
+  task.Wait();
+}
+
+
+TEST_F(EtcdConsistentStoreTest, TestCleanupShardedEntries) {
+  UseEntryShards(2);
+  PopulateForCleanupTests(5, 4, 0);
+
+  EXPECT_CALL(election_, IsMaster()).WillRepeatedly(Return(true));
+  SignedTreeHead sth;
+  sth.set_timestamp(345345);
+  sth.set_tree_size(3);
+  CHECK(store_->SetServingSTH(sth).ok());
+  const StatusOr<int64_t> num_cleaned(CleanupOldEntries());
+  ASSERT_OK(num_cleaned.status());
+  EXPECT_EQ(3, num_cleaned.ValueOrDie());
+
+  vector<EntryHandle<LoggedCertificate>> entries;
+  ASSERT_OK(store_->GetPendingEntries(&entries));
+  EXPECT_EQ(6U, entries.size());
+}
+
+
 TEST_F(EtcdConsistentStoreTest, TestSetClusterNodeState) {
   const string kPath(string(kRoot) + "/nodes/" + kNodeId);
 
@@ -728,14 +1187,15 @@ TEST_F(EtcdConsistentStoreTest, TestCleansUpToNewSTH) {
   EXPECT_EQ(orig_seq_mapping.Entry().DebugString(),
             seq_mapping.Entry().DebugString());
 
-  // Now update ServingSTH so that all sequenced entries should be cleaned up:
+  // Now update ServingSTH so that all sequenced entries should be cleaned up,
+  // which only leaves the two not cleaned up already:
   sth.set_timestamp(sth.timestamp() + 1);
   sth.set_tree_size(105);
   CHECK(store_->SetServingSTH(sth).ok());
   {
     const StatusOr<int64_t> num_cleaned(CleanupOldEntries());
     ASSERT_OK(num_cleaned.status());
-    EXPECT_EQ(5, num_cleaned.ValueOrDie());
+    EXPECT_EQ(2, num_cleaned.ValueOrDie());
   }
 
 
@@ -764,6 +1224,66 @@ TEST_F(EtcdConsistentStoreTest, TestCleansUpToNewSTH) {
 }
 
 
+TEST_F(EtcdConsistentStoreTest, TestCleansUpInBatches) {
+  FLAGS_etcd_cleanup_batch_size = 2;
+  PopulateForCleanupTests(5, 0, 0);
+  EntryHandle<SequenceMapping> seq_mapping;
+  ASSERT_OK(store_->GetSequenceMapping(&seq_mapping));
+
+  EXPECT_CALL(election_, IsMaster()).WillRepeatedly(Return(true));
+  SignedTreeHead sth;
+  sth.set_timestamp(345345);
+  sth.set_tree_size(5);
+  CHECK(store_->SetServingSTH(sth).ok());
+  for (const int64_t expected : {2, 2, 1, 0}) {
+    const StatusOr<int64_t> num_cleaned(CleanupOldEntries());
+    ASSERT_OK(num_cleaned.status());
+    EXPECT_EQ(expected, num_cleaned.ValueOrDie());
+  }
+
+  EntryHandle<LoggedCertificate> unused;
+  for (const auto& m : seq_mapping.Entry().mapping()) {
+    EXPECT_EQ(util::error::NOT_FOUND,
+              store_->GetPendingEntryForHash(m.entry_hash(), &unused)
+                  .CanonicalCode());
+  }
+  FLAGS_etcd_cleanup_batch_size = 1000;
+}
+
+
+TEST_F(EtcdConsistentStoreTest, TestBulkCleanupDeletesOldShards) {
+  UseEntryShards(2);
+  PopulateForCleanupTests(5, 4, 100);
+  vector<EntryHandle<LoggedCertificate>> pending_entries_pre;
+  ASSERT_OK(store_->GetPendingEntries(&pending_entries_pre));
+  ASSERT_EQ(9, pending_entries_pre.size());
+  EntryHandle<SequenceMapping> seq_mapping;
+  ASSERT_OK(store_->GetSequenceMapping(&seq_mapping));
+
+  EXPECT_CALL(election_, IsMaster()).WillRepeatedly(Return(true));
+  SignedTreeHead sth;
+  sth.set_timestamp(345345);
+  sth.set_tree_size(105);
+  CHECK(store_->SetServingSTH(sth).ok());
+  {
+    const StatusOr<int64_t> num_cleaned(
+        store_->BulkCleanupOldEntries(2, true /* delete_shard_dirs */));
+    ASSERT_OK(num_cleaned.status());
+    EXPECT_EQ(5, num_cleaned.ValueOrDie());
+  }
+
+  EntryHandle<LoggedCertificate> unused;
+  for (const auto& m : seq_mapping.Entry().mapping()) {
+    EXPECT_EQ(util::error::NOT_FOUND,
+              store_->GetPendingEntryForHash(m.entry_hash(), &unused)
+                  .CanonicalCode());
+  }
+  vector<EntryHandle<LoggedCertificate>> pending_entries_post;
+  ASSERT_OK(store_->GetPendingEntries(&pending_entries_post));
+  EXPECT_EQ(4, pending_entries_post.size());
+}
+
+
 TEST_F(EtcdConsistentStoreTest, TestStoreStatsFetcher) {
   EXPECT_EQ(0, GetNumEtcdEntries());
   PopulateForCleanupTests(100, 100, 100);
@@ -791,6 +1311,30 @@ TEST_F(EtcdConsistentStoreTest, TestRejectsAddsWhenOverCapacity) {
 }
 
 
+TEST_F(EtcdConsistentStoreTest, TestThrottlesAddsWhenEntriesPileUp) {
+  // Only the throttling updates done by the test.
+  FLAGS_etcd_stats_collection_interval_seconds = 1000;
+  store_.reset();
+  store_.reset(new EtcdConsistentStore<LoggedCertificate>(
+      base_.get(), &executor_, &client_, &election_, kRoot, kNodeId));
+  ct::ClusterConfig config;
+  config.set_etcd_reject_add_pending_threshold(100);
+  ASSERT_OK(store_->SetClusterConfig(config));
+  sleep(1);
+
+  // Below the reject threshold, but growing.
+  UpdateThrottling(90);
+  LoggedCertificate cert(MakeCert(1000, "cert1000"));
+  EXPECT_THAT(store_->AddPendingEntry(&cert),
+              StatusIs(util::error::RESOURCE_EXHAUSTED));
+
+  // No longer growing.
+  UpdateThrottling(90);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_OK(store_->AddPendingEntry(&cert));
+}
+
+
 }  // namespace cert_trans
 
 int main(int argc, char** argv) {
@@ -4,11 +4,15 @@
 
 #include "log/file_db.h"
 
+#include <algorithm>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <map>
 #include <set>
 #include <stdint.h>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include "log/file_storage.h"
@@ -18,6 +22,10 @@
 #include "monitoring/latency.h"
 #include "util/util.h"
 
+DEFINE_int32(filedb_index_threads, 0,
+             "Number of threads reading the entries when building the index "
+             "of a FileDB at startup. Zero uses one per core.");
+
 
 namespace {
 
@@ -26,6 +34,10 @@ static cert_trans::Latency<std::chrono::milliseconds, std::string>
     latency_by_op_ms("filedb_latency_by_operation_ms", "operation",
                      "Database latency in ms broken out by operation.");
 
+static cert_trans::Gauge<>* filedb_index_bytes(cert_trans::Gauge<>::New(
+    "filedb_index_bytes",
+    "Estimated memory used by the in-memory indexes of the FileDB."));
+
 
 const char kMetaNodeIdKey[] = "node_id";
 
@@ -228,6 +240,7 @@ typename Database<Logged>::WriteResult FileDB<Logged>::WriteTreeHead_(
     latest_tree_timestamp_ = sth.timestamp();
     latest_timestamp_key_ = timestamp_key;
   }
+  UpdateIndexBytes();
 
   lock.unlock();
   callbacks_.Call(sth);
@@ -257,6 +270,13 @@ int64_t FileDB<Logged>::TreeSize() const {
 }
 
 
+template <class Logged>
+std::vector<int64_t> FileDB<Logged>::SparseEntries() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return std::vector<int64_t>(sparse_entries_.begin(), sparse_entries_.end());
+}
+
+
 template <class Logged>
 void FileDB<Logged>::AddNotifySTHCallback(
     const typename Database<Logged>::NotifySTHCallback* callback) {
@@ -275,8 +295,8 @@ void FileDB<Logged>::AddNotifySTHCallback(
 template <class Logged>
 void FileDB<Logged>::RemoveNotifySTHCallback(
     const typename Database<Logged>::NotifySTHCallback* callback) {
-  std::lock_guard<std::mutex> lock(lock_);
-
+  // Not under |lock_|, as this waits for the callback to return if it
+  // is being called, and it might want to perform some lookups.
   callbacks_.Remove(callback);
 }
 
@@ -315,28 +335,54 @@ void FileDB<Logged>::BuildIndex() {
   // this should not be necessarily, but just to be sure...
   std::lock_guard<std::mutex> lock(lock_);
 
-  const std::set<std::string> sequence_numbers(cert_storage_->Scan());
-  id_by_hash_.reserve(sequence_numbers.size());
-
-  for (const auto& seq_path : sequence_numbers) {
-    const int64_t seq(ParseSequenceNumber(seq_path));
-    std::string cert_data;
-    // Read the data; tolerate no errors.
-    CHECK_EQ(cert_storage_->LookupEntry(seq_path, &cert_data),
-             util::Status::OK)
-        << "Failed to read entry with sequence number " << seq;
-
-    Logged logged;
-    CHECK(logged.ParseFromString(cert_data))
-        << "Failed to parse entry with sequence number " << seq;
-    CHECK(logged.has_sequence_number())
-        << "sequence_number() is unset for for entry with sequence number "
-        << seq;
-    CHECK_EQ(logged.sequence_number(), seq)
-        << "Entry has a negative sequence_number(): " << seq;
-
-    InsertEntryMapping(logged.sequence_number(), logged.Hash());
+  const std::set<std::string> keys(cert_storage_->Scan());
+  const std::vector<std::string> seq_paths(keys.begin(), keys.end());
+  id_by_hash_.reserve(seq_paths.size());
+
+  // Reading and parsing the entries is the slow part, spread it over
+  // a few threads, each returning the (sequence number, hash) of every
+  // |num_threads|-th entry.
+  size_t num_threads(FLAGS_filedb_index_threads > 0
+                         ? FLAGS_filedb_index_threads
+                         : std::thread::hardware_concurrency());
+  num_threads = std::max<size_t>(
+      1, std::min<size_t>(num_threads, seq_paths.size() / 64));
+  std::vector<std::vector<std::pair<int64_t, std::string>>> mappings(
+      num_threads);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < num_threads; ++t) {
+    threads.emplace_back([this, t, num_threads, &seq_paths, &mappings]() {
+      for (size_t i = t; i < seq_paths.size(); i += num_threads) {
+        const int64_t seq(ParseSequenceNumber(seq_paths[i]));
+        std::string cert_data;
+        // Read the data; tolerate no errors.
+        CHECK_EQ(cert_storage_->LookupEntry(seq_paths[i], &cert_data),
+                 util::Status::OK)
+            << "Failed to read entry with sequence number " << seq;
+
+        Logged logged;
+        CHECK(logged.ParseFromString(cert_data))
+            << "Failed to parse entry with sequence number " << seq;
+        CHECK(logged.has_sequence_number())
+            << "sequence_number() is unset for for entry with sequence number "
+            << seq;
+        CHECK_EQ(logged.sequence_number(), seq)
+            << "Entry has a negative sequence_number(): " << seq;
+
+        mappings[t].emplace_back(seq, logged.Hash());
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  // Merge them back in the order returned by Scan().
+  for (size_t i = 0; i < seq_paths.size(); ++i) {
+    const auto& mapping(mappings[i % num_threads][i / num_threads]);
+    InsertEntryMapping(mapping.first, mapping.second);
   }
+  UpdateIndexBytes();
 
   // Now read the STH entries.
   std::set<std::string> sth_timestamps = tree_storage_->Scan();
@@ -368,6 +414,19 @@ typename Database<Logged>::LookupResult FileDB<Logged>::LatestTreeHeadNoLock(
 }
 
 
+template <class Logged>
+void FileDB<Logged>::UpdateIndexBytes() const {
+  // A node per entry, holding a hash too long to be stored inline, and
+  // the buckets. The sparse entries are nodes of a red-black tree.
+  const size_t hash_entry_bytes(
+      sizeof(void*) + sizeof(std::pair<const std::string, int64_t>) + 32);
+  const size_t sparse_entry_bytes(4 * sizeof(void*) + sizeof(int64_t));
+  filedb_index_bytes->Set(id_by_hash_.size() * hash_entry_bytes +
+                          id_by_hash_.bucket_count() * sizeof(void*) +
+                          sparse_entries_.size() * sparse_entry_bytes);
+}
+
+
 // This must be called with "lock_" held.
 template <class Logged>
 void FileDB<Logged>::InsertEntryMapping(int64_t sequence_number,
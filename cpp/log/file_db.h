@@ -63,6 +63,8 @@ class FileDB : public Database<Logged> {
 
   int64_t TreeSize() const override;
 
+  std::vector<int64_t> SparseEntries() const override;
+
   void AddNotifySTHCallback(
       const typename Database<Logged>::NotifySTHCallback* callback) override;
 
@@ -81,6 +83,9 @@ class FileDB : public Database<Logged> {
   typename Database<Logged>::LookupResult LatestTreeHeadNoLock(
       ct::SignedTreeHead* result) const;
   void InsertEntryMapping(int64_t sequence_number, const std::string& hash);
+  // Sets the memory gauge from the sizes of the indexes. Must be called
+  // with "lock_" held.
+  void UpdateIndexBytes() const;
 
   const std::unique_ptr<cert_trans::FileStorage> cert_storage_;
   // Store all tree heads, but currently only support looking up the latest
@@ -4,6 +4,7 @@
 #include <cstdlib>
 #include <dirent.h>
 #include <errno.h>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <set>
 #include <string>
@@ -11,24 +12,53 @@
 #include <unistd.h>
 
 #include "log/filesystem_ops.h"
+#include "log/segment_storage.h"
 #include "util/util.h"
 
 using cert_trans::BasicFilesystemOps;
 using cert_trans::FilesystemOps;
 using std::string;
 
+DEFINE_int32(file_storage_segment_size_mb, 0,
+             "If non-zero, append the entries to segment files of about "
+             "this size, rather than writing a file per entry. This cannot "
+             "be changed on existing storage.");
+
 namespace cert_trans {
 
+namespace {
+
+
+SegmentStorage* NewSegmentStorage(const string& file_base) {
+  if (FLAGS_file_storage_segment_size_mb <= 0) {
+    return nullptr;
+  }
+  return new SegmentStorage(file_base + "/segments",
+                            static_cast<int64_t>(
+                                FLAGS_file_storage_segment_size_mb)
+                                << 20);
+}
+
+
+}  // namespace
+
 
 FileStorage::FileStorage(const string& file_base, int storage_depth)
     : storage_dir_(file_base + "/storage"),
       tmp_dir_(file_base + "/tmp"),
       tmp_file_template_(tmp_dir_ + "/tmpXXXXXX"),
       storage_depth_(storage_depth),
-      file_op_(new BasicFilesystemOps()) {
+      file_op_(new BasicFilesystemOps()),
+      segments_(NewSegmentStorage(file_base)) {
   CHECK_GE(storage_depth_, 0);
   CreateMissingDirectory(storage_dir_);
   CreateMissingDirectory(tmp_dir_);
+  if (segments_) {
+    std::set<string> keys;
+    ScanDir(storage_dir_, storage_depth_, &keys);
+    CHECK(keys.empty()) << "cannot use segments with existing entries in "
+                        << storage_dir_;
+  }
 }
 
 
@@ -38,10 +68,17 @@ FileStorage::FileStorage(const string& file_base, int storage_depth,
       tmp_dir_(file_base + "/tmp"),
       tmp_file_template_(tmp_dir_ + "/tmpXXXXXX"),
       storage_depth_(storage_depth),
-      file_op_(CHECK_NOTNULL(file_op)) {
+      file_op_(CHECK_NOTNULL(file_op)),
+      segments_(NewSegmentStorage(file_base)) {
   CHECK_GE(storage_depth_, 0);
   CreateMissingDirectory(storage_dir_);
   CreateMissingDirectory(tmp_dir_);
+  if (segments_) {
+    std::set<string> keys;
+    ScanDir(storage_dir_, storage_depth_, &keys);
+    CHECK(keys.empty()) << "cannot use segments with existing entries in "
+                        << storage_dir_;
+  }
 }
 
 
@@ -51,6 +88,9 @@ FileStorage::~FileStorage() {
 
 
 std::set<string> FileStorage::Scan() const {
+  if (segments_) {
+    return segments_->Scan();
+  }
   std::set<string> storage_keys;
   ScanDir(storage_dir_, storage_depth_, &storage_keys);
   return storage_keys;
@@ -58,6 +98,9 @@ std::set<string> FileStorage::Scan() const {
 
 
 util::Status FileStorage::CreateEntry(const string& key, const string& data) {
+  if (segments_) {
+    return segments_->CreateEntry(key, data);
+  }
   if (LookupEntry(key, NULL).ok()) {
     return util::Status(util::error::ALREADY_EXISTS,
                         "entry already exists: " + key);
@@ -68,6 +111,9 @@ util::Status FileStorage::CreateEntry(const string& key, const string& data) {
 
 
 util::Status FileStorage::UpdateEntry(const string& key, const string& data) {
+  if (segments_) {
+    return segments_->UpdateEntry(key, data);
+  }
   if (!LookupEntry(key, NULL).ok()) {
     return util::Status(util::error::NOT_FOUND,
                         "tried to update non-existent entry: " + key);
@@ -79,6 +125,9 @@ util::Status FileStorage::UpdateEntry(const string& key, const string& data) {
 
 util::Status FileStorage::LookupEntry(const string& key,
                                       string* result) const {
+  if (segments_) {
+    return segments_->LookupEntry(key, result);
+  }
   string data_file = StoragePath(key);
   if (!FileExists(data_file)) {
     return util::Status(util::error::NOT_FOUND, "entry not found: " + key);
@@ -12,6 +12,7 @@
 namespace cert_trans {
 
 class FilesystemOps;
+class SegmentStorage;
 
 // A simple filesystem-based database for (key, data) entries,
 // structured as follows:
@@ -40,6 +41,11 @@ class FilesystemOps;
 // <root>/tmp     - Temporary storage for atomicity. Must be on the
 //                  same filesystem as <root>/storage.
 //
+// With --file_storage_segment_size_mb, the entries are instead
+// appended to a few large files, see SegmentStorage:
+//
+// <root>/segments - The segment files.
+//
 // FileStorage aborts upon any FilesystemOps error. This class is
 // threadsafe.
 class FileStorage {
@@ -87,6 +93,8 @@ class FileStorage {
   const std::string tmp_file_template_;
   const int storage_depth_;
   const std::unique_ptr<cert_trans::FilesystemOps> file_op_;
+  // If set, all the entries are kept there instead.
+  const std::unique_ptr<SegmentStorage> segments_;
 
   DISALLOW_COPY_AND_ASSIGN(FileStorage);
 };
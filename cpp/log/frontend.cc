@@ -1,24 +1,34 @@
 /* -*- indent-tabs-mode: nil -*- */
 #include "log/frontend.h"
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include "log/cert.h"
 #include "log/cert_submission_handler.h"
 #include "log/frontend_signer.h"
 #include "monitoring/event_metric.h"
+#include "monitoring/trace.h"
 #include "proto/ct.pb.h"
+#include "util/parallel_for.h"
 #include "util/status.h"
+#include "util/task.h"
 
 using cert_trans::CertChain;
 using cert_trans::PreCertChain;
+using cert_trans::TraceSpan;
 using ct::LogEntry;
 using ct::SignedCertificateTimestamp;
-using std::string;
 using std::lock_guard;
 using std::mutex;
+using std::string;
+using std::vector;
 using util::Status;
 
+DEFINE_int32(frontend_batch_validation_parallelism, 8,
+             "Maximum number of threads validating the chains of a batch "
+             "submission at the same time.");
+
 namespace {
 
 static cert_trans::EventMetric<std::string, std::string>
@@ -41,6 +51,7 @@ Status UpdateStats(ct::LogEntryType type, const Status& status) {
 
 Frontend::Frontend(CertSubmissionHandler* handler, FrontendSigner* signer)
     : handler_(CHECK_NOTNULL(handler)), signer_(CHECK_NOTNULL(signer)) {
+  CHECK_GT(FLAGS_frontend_batch_validation_parallelism, 0);
 }
 
 Frontend::~Frontend() {
@@ -53,16 +64,38 @@ Status Frontend::QueueProcessedEntry(Status pre_status, const LogEntry& entry,
   }
 
   // Step 2. Submit to database.
+  TraceSpan span("frontend_signer");
   return UpdateStats(entry.type(), signer_->QueueEntry(entry, sct));
 }
 
+void Frontend::QueueProcessedEntryAsync(Status pre_status,
+                                        const LogEntry& entry,
+                                        SignedCertificateTimestamp* sct,
+                                        util::Task* task) {
+  if (!pre_status.ok()) {
+    task->Return(UpdateStats(entry.type(), pre_status));
+    return;
+  }
+
+  // Step 2. Submit to database.
+  const ct::LogEntryType type(entry.type());
+  signer_->QueueEntryAsync(entry, sct,
+                           task->AddChild([type, task](util::Task* child) {
+                             task->Return(UpdateStats(type, child->status()));
+                           }));
+}
+
 Status Frontend::QueueX509Entry(CertChain* chain,
                                 SignedCertificateTimestamp* sct) {
   LogEntry entry;
   // Make sure the correct statistics get updated in case of error.
   entry.set_type(ct::X509_ENTRY);
-  return QueueProcessedEntry(handler_->ProcessX509Submission(chain, &entry),
-                             entry, sct);
+  Status status;
+  {
+    TraceSpan span("check_chain");
+    status = handler_->ProcessX509Submission(chain, &entry);
+  }
+  return QueueProcessedEntry(status, entry, sct);
 }
 
 Status Frontend::QueuePreCertEntry(PreCertChain* chain,
@@ -70,6 +103,78 @@ Status Frontend::QueuePreCertEntry(PreCertChain* chain,
   LogEntry entry;
   // Make sure the correct statistics get updated in case of error.
   entry.set_type(ct::PRECERT_ENTRY);
-  return QueueProcessedEntry(handler_->ProcessPreCertSubmission(chain, &entry),
-                             entry, sct);
+  Status status;
+  {
+    TraceSpan span("check_chain");
+    status = handler_->ProcessPreCertSubmission(chain, &entry);
+  }
+  return QueueProcessedEntry(status, entry, sct);
+}
+
+void Frontend::QueueX509EntryAsync(CertChain* chain,
+                                   SignedCertificateTimestamp* sct,
+                                   util::Task* task) {
+  LogEntry entry;
+  // Make sure the correct statistics get updated in case of error.
+  entry.set_type(ct::X509_ENTRY);
+  Status status;
+  {
+    TraceSpan span("check_chain");
+    status = handler_->ProcessX509Submission(chain, &entry);
+  }
+  QueueProcessedEntryAsync(status, entry, sct, task);
+}
+
+void Frontend::QueuePreCertEntryAsync(PreCertChain* chain,
+                                      SignedCertificateTimestamp* sct,
+                                      util::Task* task) {
+  LogEntry entry;
+  // Make sure the correct statistics get updated in case of error.
+  entry.set_type(ct::PRECERT_ENTRY);
+  Status status;
+  {
+    TraceSpan span("check_chain");
+    status = handler_->ProcessPreCertSubmission(chain, &entry);
+  }
+  QueueProcessedEntryAsync(status, entry, sct, task);
+}
+
+void Frontend::QueueX509Entries(const vector<CertChain*>& chains,
+                                util::Executor* executor,
+                                vector<SignedCertificateTimestamp>* scts,
+                                vector<Status>* statuses) {
+  CHECK_NOTNULL(scts)->assign(chains.size(), SignedCertificateTimestamp());
+  CHECK_NOTNULL(statuses)->resize(chains.size());
+
+  // Step 1. Check the chains.
+  vector<LogEntry> entries(chains.size());
+  util::ParallelFor(
+      chains.size(), FLAGS_frontend_batch_validation_parallelism, executor,
+      [this, &chains, &entries, statuses](size_t i) {
+        // Make sure the correct statistics get updated in case of error.
+        entries[i].set_type(ct::X509_ENTRY);
+        (*statuses)[i] = handler_->ProcessX509Submission(
+            CHECK_NOTNULL(chains[i]), &entries[i]);
+      });
+
+  vector<const LogEntry*> valid_entries;
+  vector<size_t> valid_indices;
+  for (size_t i = 0; i < chains.size(); ++i) {
+    if ((*statuses)[i].ok()) {
+      valid_entries.push_back(&entries[i]);
+      valid_indices.push_back(i);
+    } else {
+      UpdateStats(ct::X509_ENTRY, (*statuses)[i]);
+    }
+  }
+
+  // Step 2. Submit the valid ones to the database.
+  vector<SignedCertificateTimestamp> valid_scts;
+  vector<Status> valid_statuses;
+  signer_->QueueEntries(valid_entries, &valid_scts, &valid_statuses);
+  for (size_t j = 0; j < valid_indices.size(); ++j) {
+    const size_t i(valid_indices[j]);
+    (*statuses)[i] = UpdateStats(ct::X509_ENTRY, valid_statuses[j]);
+    (*scts)[i].Swap(&valid_scts[j]);
+  }
 }
@@ -4,6 +4,7 @@
 
 #include <memory>
 #include <mutex>
+#include <vector>
 
 #include "base/macros.h"
 #include "log/cert_submission_handler.h"
@@ -13,7 +14,9 @@
 class FrontendSigner;
 
 namespace util {
+class Executor;
 class Status;
+class Task;
 }  // namespace util
 
 // Frontend for accepting new submissions.
@@ -29,7 +32,28 @@ class Frontend {
   util::Status QueuePreCertEntry(cert_trans::PreCertChain* chain,
                                  ct::SignedCertificateTimestamp* sct);
 
-  const std::multimap<std::string, const cert_trans::Cert*>& GetRoots() const {
+  // Same as the above, but the status is returned on |task|, without
+  // blocking while the entry is stored. The chain is checked before
+  // these return, |sct| must stay valid until |task| is done.
+  void QueueX509EntryAsync(cert_trans::CertChain* chain,
+                           ct::SignedCertificateTimestamp* sct,
+                           util::Task* task);
+  void QueuePreCertEntryAsync(cert_trans::PreCertChain* chain,
+                              ct::SignedCertificateTimestamp* sct,
+                              util::Task* task);
+
+  // Same as QueueX509Entry() for each of |chains|, but they are
+  // validated in parallel on |executor|, and the new entries are
+  // stored in one batch. Sets |scts| and |statuses| to the result for
+  // each chain, in the same order. The calling thread works on the
+  // chains too, so |executor| can be the one it runs on.
+  void QueueX509Entries(const std::vector<cert_trans::CertChain*>& chains,
+                        util::Executor* executor,
+                        std::vector<ct::SignedCertificateTimestamp>* scts,
+                        std::vector<util::Status>* statuses);
+
+  std::shared_ptr<const std::multimap<std::string, const cert_trans::Cert*>>
+  GetRoots() const {
     return handler_->GetRoots();
   }
 
@@ -40,6 +64,10 @@ class Frontend {
   util::Status QueueProcessedEntry(util::Status pre_status,
                                    const ct::LogEntry& entry,
                                    ct::SignedCertificateTimestamp* sct);
+  void QueueProcessedEntryAsync(util::Status pre_status,
+                                const ct::LogEntry& entry,
+                                ct::SignedCertificateTimestamp* sct,
+                                util::Task* task);
 
   DISALLOW_COPY_AND_ASSIGN(Frontend);
 };
@@ -1,11 +1,14 @@
 /* -*- indent-tabs-mode: nil -*- */
 #include "log/frontend_signer.h"
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include "log/database.h"
 #include "log/log_signer.h"
 #include "merkletree/serial_hasher.h"
+#include "monitoring/monitoring.h"
+#include "monitoring/trace.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
 #include "util/status.h"
@@ -13,26 +16,222 @@
 
 
 using cert_trans::ConsistentStore;
+using cert_trans::Counter;
+using cert_trans::EntryHandle;
 using cert_trans::LoggedCertificate;
+using cert_trans::Trace;
+using cert_trans::TraceSpan;
 using ct::LogEntry;
 using ct::SignedCertificateTimestamp;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::mutex;
+using std::pair;
 using std::string;
+using std::unordered_map;
+using std::vector;
 using util::Status;
 
+DEFINE_int32(frontend_signer_dedup_cache_ttl_seconds, 60,
+             "How long to remember the SCTs issued for recent submissions, "
+             "so that duplicate submissions can be answered without "
+             "looking them up in the database and etcd. Zero disables the "
+             "cache.");
+DEFINE_int32(frontend_signer_dedup_cache_size, 10000,
+             "Maximum number of recently issued SCTs to remember.");
+
+namespace {
+
+
+static Counter<string>* dedup_cache_lookups(
+    Counter<string>::New("frontend_signer_dedup_cache_lookups", "result",
+                         "Number of lookups of submissions in the cache of "
+                         "recently issued SCTs, by result (\"hit\" or "
+                         "\"miss\")."));
+
+static Counter<string>* pending_entry_lookups(
+    Counter<string>::New("frontend_signer_pending_entry_lookups", "result",
+                         "Number of lookups of submissions in the local "
+                         "index of pending entries, before signing them, by "
+                         "result (\"hit\" or \"miss\")."));
+
+
+}  // namespace
+
 FrontendSigner::FrontendSigner(Database<cert_trans::LoggedCertificate>* db,
                                ConsistentStore<LoggedCertificate>* store,
                                LogSigner* signer)
     : db_(CHECK_NOTNULL(db)),
       store_(CHECK_NOTNULL(store)),
-      signer_(CHECK_NOTNULL(signer)) {
+      signer_(CHECK_NOTNULL(signer)),
+      dedup_cache_ttl_(FLAGS_frontend_signer_dedup_cache_ttl_seconds),
+      dedup_cache_size_(FLAGS_frontend_signer_dedup_cache_size) {
+  CHECK_GE(FLAGS_frontend_signer_dedup_cache_ttl_seconds, 0);
+  CHECK_GE(FLAGS_frontend_signer_dedup_cache_size, 0);
 }
 
 Status FrontendSigner::QueueEntry(const LogEntry& entry,
                                   SignedCertificateTimestamp* sct) {
+  cert_trans::LoggedCertificate new_logged;
+  Status status(PrepareEntry(entry, sct, &new_logged));
+  if (!status.ok()) {
+    return status;
+  }
+
+  // If this cert has already been added (but not yet integrated into the
+  // tree), then this call will update new_logged.sct with the previously
+  // issued one.
+  {
+    TraceSpan span("add_pending_entry");
+    status = store_->AddPendingEntry(&new_logged);
+  }
+  return FinishEntry(status, new_logged, sct);
+}
+
+
+void FrontendSigner::QueueEntryAsync(const LogEntry& entry,
+                                     SignedCertificateTimestamp* sct,
+                                     util::Task* task) {
+  LoggedCertificate* const new_logged(new LoggedCertificate);
+  task->DeleteWhenDone(new_logged);
+  const Status status(PrepareEntry(entry, sct, new_logged));
+  if (!status.ok()) {
+    task->Return(status);
+    return;
+  }
+
+  Trace* const trace(Trace::Current());
+  const steady_clock::time_point start(steady_clock::now());
+  store_->AddPendingEntryAsync(
+      new_logged,
+      task->AddChild([this, new_logged, sct, task, trace,
+                      start](util::Task* child) {
+        if (trace) {
+          trace->AddSpan("add_pending_entry", start, steady_clock::now());
+        }
+        task->Return(FinishEntry(child->status(), *new_logged, sct));
+      }));
+}
+
+
+Status FrontendSigner::PrepareEntry(const LogEntry& entry,
+                                    SignedCertificateTimestamp* sct,
+                                    LoggedCertificate* new_logged) {
   const string sha256_hash(
       Sha256Hasher::Sha256Digest(Serializer::LeafCertificate(entry)));
   CHECK(!sha256_hash.empty());
 
+  SignedCertificateTimestamp existing_sct;
+  Status status;
+  {
+    TraceSpan span("lookup_existing_entry");
+    status = LookupExistingEntry(sha256_hash, &existing_sct);
+  }
+  if (status.CanonicalCode() == util::error::ALREADY_EXISTS) {
+    if (sct != nullptr) {
+      sct->Swap(&existing_sct);
+    }
+    return status;
+  }
+
+  // Dont have the cert locally, so create an SCT and store it and the cert.
+  TraceSpan span("sign");
+  CreateLoggedEntry(entry, sha256_hash, new_logged);
+  return Status::OK;
+}
+
+
+Status FrontendSigner::FinishEntry(const Status& status,
+                                   const LoggedCertificate& new_logged,
+                                   SignedCertificateTimestamp* sct) {
+  if (status.ok() || status.CanonicalCode() == util::error::ALREADY_EXISTS) {
+    AddRecentSCT(new_logged.Hash(), new_logged.sct());
+  }
+
+  if (sct != nullptr) {
+    *sct = new_logged.sct();
+  }
+
+  return status;
+}
+
+
+void FrontendSigner::QueueEntries(const vector<const LogEntry*>& entries,
+                                  vector<SignedCertificateTimestamp>* scts,
+                                  vector<Status>* statuses) {
+  CHECK_NOTNULL(scts)->assign(entries.size(), SignedCertificateTimestamp());
+  CHECK_NOTNULL(statuses)->assign(entries.size(), Status::OK);
+
+  // The entries which have to be added to the store, and where they
+  // are in |entries|.
+  vector<LoggedCertificate> new_logged;
+  vector<size_t> new_indices;
+  // The entries which are in the batch more than once, and which of
+  // |new_logged| they'll get their SCT from.
+  vector<pair<size_t, size_t>> copies;
+  unordered_map<string, size_t> new_by_hash;
+  new_logged.reserve(entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const LogEntry& entry(*CHECK_NOTNULL(entries[i]));
+    const string sha256_hash(
+        Sha256Hasher::Sha256Digest(Serializer::LeafCertificate(entry)));
+    CHECK(!sha256_hash.empty());
+
+    const Status status(LookupExistingEntry(sha256_hash, &(*scts)[i]));
+    if (status.CanonicalCode() == util::error::ALREADY_EXISTS) {
+      (*statuses)[i] = status;
+      continue;
+    }
+
+    const auto inserted(new_by_hash.emplace(sha256_hash, new_logged.size()));
+    if (!inserted.second) {
+      copies.emplace_back(i, inserted.first->second);
+      continue;
+    }
+    new_logged.emplace_back();
+    new_indices.push_back(i);
+    CreateLoggedEntry(entry, sha256_hash, &new_logged.back());
+  }
+
+  vector<LoggedCertificate*> to_add;
+  for (auto& logged : new_logged) {
+    to_add.push_back(&logged);
+  }
+  vector<Status> add_statuses;
+  store_->AddPendingEntries(to_add, &add_statuses);
+  CHECK_EQ(new_logged.size(), add_statuses.size());
+
+  for (size_t j = 0; j < new_logged.size(); ++j) {
+    const size_t i(new_indices[j]);
+    (*statuses)[i] = add_statuses[j];
+    (*scts)[i] = new_logged[j].sct();
+    if (add_statuses[j].ok() ||
+        add_statuses[j].CanonicalCode() == util::error::ALREADY_EXISTS) {
+      AddRecentSCT(new_logged[j].Hash(), new_logged[j].sct());
+    }
+  }
+
+  for (const auto& copy : copies) {
+    const Status& status(add_statuses[copy.second]);
+    if (status.ok() || status.CanonicalCode() == util::error::ALREADY_EXISTS) {
+      (*statuses)[copy.first] =
+          Status(util::error::ALREADY_EXISTS, "entry submitted twice");
+      (*scts)[copy.first] = new_logged[copy.second].sct();
+    } else {
+      (*statuses)[copy.first] = status;
+    }
+  }
+}
+
+
+Status FrontendSigner::LookupExistingEntry(const string& sha256_hash,
+                                           SignedCertificateTimestamp* sct) {
+  // Clients often submit the same chain many times in a row, answer
+  // those from memory.
+  if (LookupRecentSCT(sha256_hash, sct)) {
+    return Status(util::error::ALREADY_EXISTS, "entry was submitted recently");
+  }
+
   // Check if the entry already exists in the local DB (i.e. it's been
   // integrated into the tree.)
   // This isn't foolproof; it could be that the local node doesn't yet have
@@ -45,34 +244,86 @@ Status FrontendSigner::QueueEntry(const LogEntry& entry,
 
   if (db_result == Database<cert_trans::LoggedCertificate>::LOOKUP_OK) {
     // If we did find a local copy, return the previously issued SCT.
-    if (sct != nullptr) {
-      *sct = logged.sct();
-    }
+    AddRecentSCT(sha256_hash, logged.sct());
+    sct->Swap(logged.mutable_sct());
     return Status(util::error::ALREADY_EXISTS,
                   "entry already exists in Database");
   }
   CHECK_EQ(Database<cert_trans::LoggedCertificate>::NOT_FOUND, db_result);
 
-  // Dont have the cert locally, so create an SCT and store it and the cert.
-  SignedCertificateTimestamp local_sct;
-  TimestampAndSign(entry, &local_sct);
+  // Another node may have the entry pending already. Only worth asking
+  // before signing if the store can answer without a round trip,
+  // otherwise AddPendingEntry() finds out anyway.
+  if (store_->CachesPendingEntries()) {
+    EntryHandle<LoggedCertificate> pending;
+    if (store_->GetPendingEntryForHash(sha256_hash, &pending).ok()) {
+      pending_entry_lookups->Increment("hit");
+      AddRecentSCT(sha256_hash, pending.Entry().sct());
+      *sct = pending.Entry().sct();
+      return Status(util::error::ALREADY_EXISTS,
+                    "pending entry already exists");
+    }
+    pending_entry_lookups->Increment("miss");
+  }
 
-  cert_trans::LoggedCertificate new_logged;
-  new_logged.mutable_sct()->CopyFrom(local_sct);
-  new_logged.mutable_entry()->CopyFrom(entry);
-  CHECK_EQ(new_logged.Hash(), sha256_hash);
+  return Status(util::error::NOT_FOUND, "new entry");
+}
 
-  // If this cert has already been added (but not yet integrated into the
-  // tree), then this call will update new_logged.sct with the previously
-  // issued one.
-  util::Status status(store_->AddPendingEntry(&new_logged));
-  CHECK_EQ(new_logged.Hash(), sha256_hash);
 
-  if (sct != nullptr) {
-    *sct = new_logged.sct();
+void FrontendSigner::CreateLoggedEntry(const LogEntry& entry,
+                                       const string& sha256_hash,
+                                       LoggedCertificate* logged) const {
+  TimestampAndSign(entry, logged->mutable_sct());
+  logged->mutable_entry()->CopyFrom(entry);
+  CHECK_EQ(logged->Hash(), sha256_hash);
+  CHECK(logged->ComputeMerkleLeafHash());
+}
+
+
+bool FrontendSigner::LookupRecentSCT(const string& sha256_hash,
+                                     SignedCertificateTimestamp* sct) {
+  if (dedup_cache_ttl_.count() == 0 || dedup_cache_size_ == 0) {
+    return false;
   }
 
-  return status;
+  const steady_clock::time_point now(steady_clock::now());
+  lock_guard<mutex> lock(dedup_cache_lock_);
+  while (!recent_scts_expiry_.empty() &&
+         recent_scts_expiry_.front().second <= now) {
+    recent_scts_.erase(recent_scts_expiry_.front().first);
+    recent_scts_expiry_.pop_front();
+  }
+
+  const auto it(recent_scts_.find(sha256_hash));
+  if (it == recent_scts_.end()) {
+    dedup_cache_lookups->Increment("miss");
+    return false;
+  }
+  dedup_cache_lookups->Increment("hit");
+  sct->CopyFrom(it->second);
+  return true;
+}
+
+
+void FrontendSigner::AddRecentSCT(const string& sha256_hash,
+                                  const SignedCertificateTimestamp& sct) {
+  if (dedup_cache_ttl_.count() == 0 || dedup_cache_size_ == 0) {
+    return;
+  }
+
+  const steady_clock::time_point expiry(steady_clock::now() +
+                                        dedup_cache_ttl_);
+  lock_guard<mutex> lock(dedup_cache_lock_);
+  // Another thread may have added it since our lookup, keep the first
+  // one (they're the same SCT anyway).
+  if (!recent_scts_.emplace(sha256_hash, sct).second) {
+    return;
+  }
+  recent_scts_expiry_.emplace_back(sha256_hash, expiry);
+  while (recent_scts_expiry_.size() > dedup_cache_size_) {
+    recent_scts_.erase(recent_scts_expiry_.front().first);
+    recent_scts_expiry_.pop_front();
+  }
 }
 
 
@@ -2,7 +2,13 @@
 #define FRONTEND_SIGNER_H
 
 #include <stdint.h>
+#include <chrono>
+#include <deque>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "base/macros.h"
 #include "log/consistent_store.h"
@@ -14,6 +20,7 @@ class LogSigner;
 
 namespace util {
 class Status;
+class Task;
 }  // namespace util
 
 
@@ -29,16 +36,69 @@ class FrontendSigner {
   // and return either a new timestamp-signature pair,
   // or a previously existing one. (Currently also copies the
   // entry to the sct but you shouldn't rely on this.)
+  // Entries submitted again within --frontend_signer_dedup_cache_ttl_seconds
+  // get their SCT straight from memory, without going to the database
+  // or the consistent store.
   util::Status QueueEntry(const ct::LogEntry& entry,
                           ct::SignedCertificateTimestamp* sct);
 
+  // Same as QueueEntry(), but returns the status on |task| rather than
+  // blocking while the entry is added to the consistent store (see
+  // ConsistentStore::AddPendingEntryAsync()). |entry| is only used
+  // before this returns, |sct| must stay valid until |task| is done.
+  void QueueEntryAsync(const ct::LogEntry& entry,
+                       ct::SignedCertificateTimestamp* sct, util::Task* task);
+
+  // Same as QueueEntry() for each of |entries|, but the new ones are
+  // added to the consistent store in one batch. Sets |scts| and
+  // |statuses| to the result for each entry, in the same order.
+  void QueueEntries(const std::vector<const ct::LogEntry*>& entries,
+                    std::vector<ct::SignedCertificateTimestamp>* scts,
+                    std::vector<util::Status>* statuses);
+
  private:
+  // Returns ALREADY_EXISTS and sets |sct| if the entry was submitted
+  // recently or is in the database, NOT_FOUND otherwise.
+  util::Status LookupExistingEntry(const std::string& sha256_hash,
+                                   ct::SignedCertificateTimestamp* sct);
+  // Returns ALREADY_EXISTS and sets |sct| (if not null) if the entry
+  // was submitted before, otherwise sets |new_logged| to |entry| with a
+  // new SCT, to be added to the store.
+  util::Status PrepareEntry(const ct::LogEntry& entry,
+                            ct::SignedCertificateTimestamp* sct,
+                            cert_trans::LoggedCertificate* new_logged);
+  // Returns |status|, the result of adding |new_logged| to the store,
+  // after remembering its SCT and setting |sct| (if not null) to it.
+  util::Status FinishEntry(const util::Status& status,
+                           const cert_trans::LoggedCertificate& new_logged,
+                           ct::SignedCertificateTimestamp* sct);
+  // Sets |logged| to |entry| with a new SCT.
+  void CreateLoggedEntry(const ct::LogEntry& entry,
+                         const std::string& sha256_hash,
+                         cert_trans::LoggedCertificate* logged) const;
+
   void TimestampAndSign(const ct::LogEntry& entry,
                         ct::SignedCertificateTimestamp* sct) const;
 
+  // Returns false if |sha256_hash| isn't in the dedup cache.
+  bool LookupRecentSCT(const std::string& sha256_hash,
+                       ct::SignedCertificateTimestamp* sct);
+  void AddRecentSCT(const std::string& sha256_hash,
+                    const ct::SignedCertificateTimestamp& sct);
+
   Database<cert_trans::LoggedCertificate>* const db_;
   cert_trans::ConsistentStore<cert_trans::LoggedCertificate>* const store_;
   LogSigner* const signer_;
+  const std::chrono::seconds dedup_cache_ttl_;
+  const size_t dedup_cache_size_;
+
+  std::mutex dedup_cache_lock_;
+  std::unordered_map<std::string, ct::SignedCertificateTimestamp>
+      recent_scts_;
+  // The hashes in |recent_scts_|, in the order they were added, with
+  // the time at which they expire.
+  std::deque<std::pair<std::string, std::chrono::steady_clock::time_point>>
+      recent_scts_expiry_;
 
   DISALLOW_COPY_AND_ASSIGN(FrontendSigner);
 };
@@ -21,6 +21,7 @@
 #include "util/mock_masterelection.h"
 #include "util/status.h"
 #include "util/status_test_util.h"
+#include "util/sync_task.h"
 #include "util/testing.h"
 #include "util/thread_pool.h"
 #include "util/util.h"
@@ -163,6 +164,33 @@ TYPED_TEST(FrontendSignerTest, LogDuplicates) {
   EXPECT_EQ(sct0.timestamp(), sct1.timestamp());
 }
 
+TYPED_TEST(FrontendSignerTest, LogDuplicatesFromMemory) {
+  LogEntry entry;
+  this->test_signer_.CreateUnique(&entry);
+
+  SignedCertificateTimestamp sct0, sct1;
+  EXPECT_OK(this->frontend_.QueueEntry(entry, &sct0));
+
+  // Remove the pending entry behind the store's back: only the recently
+  // issued SCTs kept in memory still know about it.
+  const string hash(
+      Sha256Hasher::Sha256Digest(Serializer::LeafCertificate(entry)));
+  util::SyncTask task(&this->pool_);
+  this->etcd_client_.ForceDelete("/root/entries/" + util::HexString(hash),
+                                 task.task());
+  task.Wait();
+  ASSERT_OK(task.status());
+  EntryHandle<LoggedCertificate> entry_handle;
+  ASSERT_THAT(this->store_.GetPendingEntryForHash(hash, &entry_handle),
+              StatusIs(util::error::NOT_FOUND, _));
+
+  usleep(2000);
+  EXPECT_THAT(this->frontend_.QueueEntry(entry, &sct1),
+              StatusIs(util::error::ALREADY_EXISTS, _));
+  EXPECT_EQ(sct0.timestamp(), sct1.timestamp());
+  EXPECT_EQ(sct0.signature().DebugString(), sct1.signature().DebugString());
+}
+
 TYPED_TEST(FrontendSignerTest, LogDuplicatesDifferentChain) {
   LogEntry entry0, entry1;
   this->test_signer_.CreateUnique(&entry0);
@@ -255,6 +255,50 @@ TYPED_TEST(FrontendTest, TestSubmitDuplicate) {
                 logged_cert.entry(), sct));
 }
 
+TYPED_TEST(FrontendTest, TestSubmitBatch) {
+  CertChain valid(this->leaf_pem_);
+  CertChain invalid(this->chain_leaf_pem_);
+  CertChain duplicate(this->leaf_pem_);
+  CertChain with_intermediate(this->chain_leaf_pem_ + this->intermediate_pem_);
+  const vector<CertChain*> chains{&valid, &invalid, &duplicate,
+                                  &with_intermediate};
+
+  vector<SignedCertificateTimestamp> scts;
+  vector<util::Status> statuses;
+  this->frontend_.QueueX509Entries(chains, &this->pool_, &scts, &statuses);
+  ASSERT_EQ(chains.size(), scts.size());
+  ASSERT_EQ(chains.size(), statuses.size());
+
+  EXPECT_OK(statuses[0]);
+  // Missing intermediate.
+  EXPECT_THAT(statuses[1],
+              StatusIs(util::error::FAILED_PRECONDITION, "unknown root"));
+  EXPECT_FALSE(scts[1].has_signature());
+  EXPECT_THAT(statuses[2], StatusIs(util::error::ALREADY_EXISTS, _));
+  EXPECT_EQ(scts[0].DebugString(), scts[2].DebugString());
+  EXPECT_OK(statuses[3]);
+
+  for (const int i : {0, 3}) {
+    Cert cert(i == 0 ? this->leaf_pem_ : this->chain_leaf_pem_);
+    string sha256_digest;
+    ASSERT_OK(cert.Sha256Digest(&sha256_digest));
+    EntryHandle<LoggedCertificate> entry_handle;
+    ASSERT_OK(
+        this->store_.GetPendingEntryForHash(sha256_digest, &entry_handle));
+    EXPECT_EQ(LogVerifier::VERIFY_OK,
+              this->verifier_.VerifySignedCertificateTimestamp(
+                  entry_handle.Entry().entry(), scts[i]));
+  }
+
+  // Submitting the batch again gets the same SCTs back.
+  vector<SignedCertificateTimestamp> scts2;
+  this->frontend_.QueueX509Entries(chains, &this->pool_, &scts2, &statuses);
+  EXPECT_THAT(statuses[0], StatusIs(util::error::ALREADY_EXISTS, _));
+  EXPECT_THAT(statuses[3], StatusIs(util::error::ALREADY_EXISTS, _));
+  EXPECT_EQ(scts[0].DebugString(), scts2[0].DebugString());
+  EXPECT_EQ(scts[3].DebugString(), scts2[3].DebugString());
+}
+
 TYPED_TEST(FrontendTest, TestSubmitInvalidChain) {
   CertChain chain(this->chain_leaf_pem_);
   EXPECT_TRUE(chain.IsLoaded());
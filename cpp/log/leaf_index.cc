@@ -0,0 +1,88 @@
+#include "log/leaf_index.h"
+
+#include <glog/logging.h>
+#include <string.h>
+
+using std::function;
+using std::string;
+
+namespace cert_trans {
+
+namespace {
+
+const size_t kInitialSlots = 1024;
+
+
+}  // namespace
+
+
+LeafIndex::LeafIndex() : slots_(kInitialSlots), size_(0) {
+}
+
+
+void LeafIndex::Insert(const string& leaf_hash, int64_t index) {
+  CHECK_GE(index, 0);
+  // Keep the load factor at or below 3/4, so probe sequences stay short.
+  if (4 * (size_ + 1) > 3 * slots_.size()) {
+    Grow();
+  }
+  InsertSlot(Slot{Key(leaf_hash), index + 1});
+  ++size_;
+}
+
+
+int64_t LeafIndex::Find(const string& leaf_hash,
+                        const function<bool(int64_t)>& matches) const {
+  const uint64_t key(Key(leaf_hash));
+  const size_t mask(slots_.size() - 1);
+  int64_t found(-1);
+  // Duplicates are not necessarily in insertion order along the probe
+  // sequence after a Grow(), so look at all of them.
+  for (size_t i = key & mask; slots_[i].value != 0; i = (i + 1) & mask) {
+    const int64_t index(slots_[i].value - 1);
+    if (slots_[i].key == key && (found < 0 || index < found) &&
+        matches(index)) {
+      found = index;
+    }
+  }
+  return found;
+}
+
+
+void LeafIndex::Clear() {
+  Slots(kInitialSlots).swap(slots_);
+  size_ = 0;
+}
+
+
+// static
+uint64_t LeafIndex::Key(const string& leaf_hash) {
+  CHECK_GE(leaf_hash.size(), sizeof(uint64_t));
+  uint64_t key;
+  memcpy(&key, leaf_hash.data(), sizeof(key));
+  return key;
+}
+
+
+void LeafIndex::InsertSlot(const Slot& slot) {
+  const size_t mask(slots_.size() - 1);
+  size_t i(slot.key & mask);
+  while (slots_[i].value != 0) {
+    i = (i + 1) & mask;
+  }
+  slots_[i] = slot;
+}
+
+
+void LeafIndex::Grow() {
+  Slots old_slots(2 * slots_.size());
+  old_slots.swap(slots_);
+  for (const Slot& slot : old_slots) {
+    if (slot.value != 0) {
+      InsertSlot(slot);
+    }
+  }
+}
+
+
+}  // namespace cert_trans
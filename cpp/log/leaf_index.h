@@ -0,0 +1,75 @@
+#ifndef CERT_TRANS_LOG_LEAF_INDEX_H_
+#define CERT_TRANS_LOG_LEAF_INDEX_H_
+
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "util/huge_pages.h"
+
+namespace cert_trans {
+
+// Maps Merkle leaf hashes to their index in the tree, for LogLookup.
+//
+// Rather than keeping the hashes themselves, this is an open-addressing
+// hash table (with linear probing) of their first 8 bytes, at 16 bytes
+// per slot. Since leaf hashes are uniformly distributed, the truncated
+// hash doubles as the hash function. Truncation means unrelated leaves
+// can share a key, so lookups always confirm candidates against the
+// full leaf hash, which the caller already has (in the tree).
+//
+// The table is backed by huge pages if --huge_pages says so.
+//
+// This class is thread-compatible, but not thread-safe.
+class LeafIndex {
+ public:
+  LeafIndex();
+
+  size_t size() const {
+    return size_;
+  }
+
+  size_t MemoryBytes() const {
+    return slots_.capacity() * sizeof(Slot);
+  }
+
+  // Records that the leaf with |leaf_hash| is at |index|. It is fine to
+  // add the same leaf hash more than once.
+  void Insert(const std::string& leaf_hash, int64_t index);
+
+  // Returns the lowest index inserted for |leaf_hash|, or -1 if there
+  // is none. |matches| is called with each candidate index whose
+  // truncated hash matches, and must return whether the leaf at that
+  // index really has |leaf_hash|.
+  int64_t Find(const std::string& leaf_hash,
+               const std::function<bool(int64_t)>& matches) const;
+
+  void Clear();
+
+ private:
+  struct Slot {
+    uint64_t key;
+    // The leaf index plus one, so that zeroed slots are empty.
+    int64_t value;
+  };
+
+  static uint64_t Key(const std::string& leaf_hash);
+  void InsertSlot(const Slot& slot);
+  void Grow();
+
+  typedef std::vector<Slot, HugePageAllocator<Slot>> Slots;
+
+  // Always a power of two in size.
+  Slots slots_;
+  size_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(LeafIndex);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_LEAF_INDEX_H_
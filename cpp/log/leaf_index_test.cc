@@ -0,0 +1,92 @@
+#include "log/leaf_index.h"
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "merkletree/serial_hasher.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::vector;
+
+
+class LeafIndexTest : public ::testing::Test {
+ protected:
+  int64_t Find(const string& leaf_hash) const {
+    return index_.Find(leaf_hash, [this, &leaf_hash](int64_t i) {
+      return i < static_cast<int64_t>(leaves_.size()) &&
+             leaves_[i] == leaf_hash;
+    });
+  }
+
+  void Add(const string& leaf_hash) {
+    index_.Insert(leaf_hash, leaves_.size());
+    leaves_.push_back(leaf_hash);
+  }
+
+  static string Hash(int i) {
+    return Sha256Hasher::Sha256Digest("leaf " + std::to_string(i));
+  }
+
+  LeafIndex index_;
+  vector<string> leaves_;
+};
+
+
+TEST_F(LeafIndexTest, FindsLeaves) {
+  EXPECT_EQ(-1, Find(Hash(0)));
+
+  // Enough to grow the table a few times.
+  for (int i = 0; i < 10000; ++i) {
+    Add(Hash(i));
+  }
+  EXPECT_EQ(10000U, index_.size());
+  for (int i = 0; i < 10000; ++i) {
+    EXPECT_EQ(i, Find(Hash(i)));
+  }
+  EXPECT_EQ(-1, Find(Hash(10000)));
+
+  index_.Clear();
+  EXPECT_EQ(0U, index_.size());
+  EXPECT_EQ(-1, Find(Hash(0)));
+}
+
+
+TEST_F(LeafIndexTest, ReturnsFirstDuplicate) {
+  for (int i = 0; i < 2000; ++i) {
+    Add(Hash(i % 3));
+  }
+  EXPECT_EQ(0, Find(Hash(0)));
+  EXPECT_EQ(1, Find(Hash(1)));
+  EXPECT_EQ(2, Find(Hash(2)));
+}
+
+
+TEST_F(LeafIndexTest, ConfirmsTruncatedMatches) {
+  const string hash(Hash(0));
+  // Same first 8 bytes, different leaf.
+  string other(hash);
+  other[31] ^= 1;
+  Add(hash);
+  Add(other);
+  EXPECT_EQ(0, Find(hash));
+  EXPECT_EQ(1, Find(other));
+
+  string missing(hash);
+  missing[30] ^= 1;
+  EXPECT_EQ(-1, Find(missing));
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
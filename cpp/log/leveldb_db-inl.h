@@ -5,10 +5,12 @@
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <leveldb/write_batch.h>
 #include <map>
 #include <stdint.h>
 #include <string>
 
+#include "merkletree/serial_hasher.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
 #include "monitoring/monitoring.h"
@@ -19,6 +21,45 @@ DEFINE_int32(leveldb_max_open_files, 0,
              "number of open files that can be used by leveldb");
 DEFINE_int32(leveldb_bloom_filter_bits_per_key, 0,
              "number of open files that can be used by leveldb");
+DEFINE_int32(leveldb_block_cache_size_mb, 0,
+             "size of the leveldb block cache in MB, if non-zero (otherwise "
+             "leveldb uses its own 8MB cache)");
+DEFINE_int32(leveldb_block_size_kb, 0,
+             "approximate size of the leveldb data blocks in KB, if non-zero");
+DEFINE_int32(leveldb_write_buffer_size_mb, 0,
+             "amount of data leveldb builds up in memory before writing it "
+             "to disk in MB, if non-zero");
+DEFINE_bool(leveldb_compression, true,
+            "whether leveldb compresses its blocks with Snappy");
+DEFINE_bool(leveldb_raw_leaves, false,
+            "Also store each entry as served by get-entries, so that it "
+            "can be returned without being parsed and serialized again.");
+DEFINE_bool(leveldb_entry_json, false,
+            "With --leveldb_raw_leaves, also store the JSON object "
+            "get-entries serves for each new entry, so that replies are "
+            "made by copying them rather than encoding them.");
+DEFINE_bool(leveldb_shared_chain_certs, false,
+            "Store the certificates of the chains of new entries apart from "
+            "them, once for all the entries sharing them, keyed by their "
+            "SHA-256 hash. Entries stored either way can be read.");
+DEFINE_string(leveldb_entry_dictionary, "",
+              "If set, a file (such as made by \"db_tool build_dictionary\") "
+              "used as a preset dictionary to compress new entries with. "
+              "The dictionaries used are kept in the database, so that the "
+              "entries compressed with earlier ones can still be read.");
+DEFINE_bool(leveldb_leaf_hashes, false,
+            "Also store the Merkle tree leaf hash and timestamp of each "
+            "entry, so that the tree can be built without reading and "
+            "parsing the entries.");
+DEFINE_bool(leveldb_time_index, false,
+            "Also index the entries by the timestamp of their SCT, so that "
+            "the entries of a time range are found without scanning them "
+            "all. Entries written without it are indexed the next time the "
+            "database is opened with it.");
+DEFINE_bool(leveldb_subtree_hashes, false,
+            "Also store the hashes of all the perfect subtrees of the tree "
+            "of contiguous entries, so that proofs can be computed from the "
+            "database without holding the tree in memory.");
 
 namespace {
 
@@ -27,9 +68,33 @@ static cert_trans::Latency<std::chrono::milliseconds, std::string>
     latency_by_op_ms("leveldb_latency_by_operation_ms", "operation",
                      "Database latency in ms broken out by operation.");
 
+static cert_trans::Gauge<>* block_cache_usage_bytes(
+    cert_trans::Gauge<>::New("leveldb_block_cache_usage_bytes",
+                             "Bytes of blocks held in the leveldb block "
+                             "cache, if --leveldb_block_cache_size_mb is "
+                             "set."));
+
+static cert_trans::Counter<>* oversized_raw_leaves(
+    cert_trans::Counter<>::New("leveldb_oversized_raw_leaves",
+                               "Number of entries with a field too long "
+                               "to be stored as a raw leaf, which are "
+                               "serialized when served instead."));
+
 
 const char kMetaNodeIdKey[] = "metadata";
+const char kMetaSubtreeSizeKey[] = "subtree_size";
+const char kMetaContiguousSizeKey[] = "contiguous_size";
+const char kMetaHashIndexKey[] = "hash_index";
+const char kMetaHashIndexProgressKey[] = "hash_index_progress";
+const char kMetaTimeIndexKey[] = "time_index";
 const char kEntryPrefix[] = "entry-";
+const char kHashPrefix[] = "hash-";
+const char kChainCertPrefix[] = "chaincert-";
+const char kDictionaryPrefix[] = "dict-";
+const char kLeafPrefix[] = "leaf-";
+const char kLeafHashPrefix[] = "leafhash-";
+const char kSubtreePrefix[] = "subtree-";
+const char kTimePrefix[] = "time-";
 const char kTreeHeadPrefix[] = "sth-";
 const char kMetaPrefix[] = "meta-";
 
@@ -48,9 +113,30 @@ std::unique_ptr<const leveldb::FilterPolicy> BuildFilterPolicy() {
 #endif
 
 
+std::unique_ptr<leveldb::Cache> BuildBlockCache() {
+  std::unique_ptr<leveldb::Cache> retval;
+
+  CHECK_GE(FLAGS_leveldb_block_cache_size_mb, 0);
+  if (FLAGS_leveldb_block_cache_size_mb > 0) {
+    retval.reset(CHECK_NOTNULL(leveldb::NewLRUCache(
+        static_cast<size_t>(FLAGS_leveldb_block_cache_size_mb) << 20)));
+  }
+
+  return retval;
+}
+
+
+// Number of entries whose subtree hashes are written in one batch.
+const int64_t kSubtreeBatchSize = 1024;
+
+// Number of entries indexed in one batch when building the hash index
+// of an existing database.
+const size_t kHashIndexBatchSize = 1024;
+
+
 // WARNING: Do NOT change the type of "index" from int64_t, or you'll
 // break existing databases!
-std::string IndexToKey(int64_t index) {
+std::string IndexToHex(int64_t index) {
   const char nibble[] = "0123456789abcdef";
   std::string index_str(sizeof(index) * 2, nibble[0]);
   for (int i = sizeof(index) * 2; i > 0 && index > 0; --i) {
@@ -58,7 +144,195 @@ std::string IndexToKey(int64_t index) {
     index = index >> 4;
   }
 
-  return kEntryPrefix + index_str;
+  return index_str;
+}
+
+
+std::string IndexToKey(int64_t index) {
+  return kEntryPrefix + IndexToHex(index);
+}
+
+
+std::string SubtreeKey(int level, int64_t index) {
+  CHECK_GE(level, 0);
+  CHECK_LT(level, 64);
+  const char nibble[] = "0123456789abcdef";
+  return kSubtreePrefix + std::string(1, nibble[level >> 4]) +
+         nibble[level & 0xf] + "-" + IndexToHex(index);
+}
+
+
+std::string LeafKey(int64_t index) {
+  return kLeafPrefix + IndexToHex(index);
+}
+
+
+std::string LeafHashKey(int64_t index) {
+  return kLeafHashPrefix + IndexToHex(index);
+}
+
+
+// The time index has a key per entry, with its timestamp and then its
+// sequence number, both big-endian so that they sort in that order,
+// and an empty value.
+const size_t kTimeKeyTimestampBytes = 8;
+
+
+std::string TimeKey(uint64_t timestamp) {
+  return kTimePrefix +
+         Serializer::SerializeUint(timestamp, kTimeKeyTimestampBytes);
+}
+
+
+std::string TimeKey(uint64_t timestamp, int64_t sequence_number) {
+  return TimeKey(timestamp) +
+         Serializer::SerializeUint(sequence_number, sizeof(sequence_number));
+}
+
+
+// Returns false if |key| is not a time index key.
+bool DecodeTimeKey(leveldb::Slice key, uint64_t* timestamp,
+                   int64_t* sequence_number) {
+  if (!key.starts_with(kTimePrefix) ||
+      key.size() != strlen(kTimePrefix) + kTimeKeyTimestampBytes +
+                        sizeof(*sequence_number)) {
+    return false;
+  }
+  key.remove_prefix(strlen(kTimePrefix));
+  *timestamp = 0;
+  for (size_t i = 0; i < kTimeKeyTimestampBytes; ++i) {
+    *timestamp = (*timestamp << 8) | static_cast<unsigned char>(key[i]);
+  }
+  uint64_t sequence(0);
+  for (size_t i = kTimeKeyTimestampBytes; i < key.size(); ++i) {
+    sequence = (sequence << 8) | static_cast<unsigned char>(key[i]);
+  }
+  *sequence_number = static_cast<int64_t>(sequence);
+  return true;
+}
+
+
+// Compressed entries start with a zero byte, which a serialized entry
+// never does (there is no field number 0), followed by the version of
+// their encoding, and the id of the dictionary they need.
+const char kCompressedEntryMarker = '\0';
+const char kCompressedEntryVersion = 1;
+const size_t kDictionaryIdBytes = 4;
+const size_t kCompressedEntryHeaderBytes = 2 + kDictionaryIdBytes;
+
+
+std::string DictionaryKey(uint32_t id) {
+  return kDictionaryPrefix + Serializer::SerializeUint(id, kDictionaryIdBytes);
+}
+
+
+// Entries are decompressed into this, which keeps its capacity from
+// one entry to the next.
+thread_local std::string decompressed_entry;
+
+
+// Raw leaves are stored as their fields, each preceded by its length.
+// The JSON object, if stored, is an optional fourth field.
+const size_t kRawLeafLengthBytes = 4;
+
+
+// Returns false, rather than truncating its length, if a field is
+// longer than kRawLeafLengthBytes can tell.
+bool EncodeRawLeaf(const std::string& leaf_input,
+                   const std::string& extra_data, const std::string& sct,
+                   const std::string& json, std::string* value) {
+  const uint64_t max_length((1ULL << (8 * kRawLeafLengthBytes)) - 1);
+  value->clear();
+  for (const std::string* field : {&leaf_input, &extra_data, &sct, &json}) {
+    if (field == &json && json.empty()) {
+      break;
+    }
+    if (field->size() > max_length) {
+      value->clear();
+      return false;
+    }
+    value->append(
+        Serializer::SerializeUint(field->size(), kRawLeafLengthBytes));
+    value->append(*field);
+  }
+  return true;
+}
+
+
+bool DecodeRawLeaf(leveldb::Slice value, std::string* leaf_input,
+                   std::string* extra_data, std::string* sct,
+                   std::string* json) {
+  json->clear();
+  for (std::string* field : {leaf_input, extra_data, sct, json}) {
+    if (field == json && value.empty()) {
+      break;
+    }
+    if (value.size() < kRawLeafLengthBytes) {
+      return false;
+    }
+    size_t length(0);
+    for (size_t i = 0; i < kRawLeafLengthBytes; ++i) {
+      length = (length << 8) | static_cast<unsigned char>(value[i]);
+    }
+    value.remove_prefix(kRawLeafLengthBytes);
+    if (value.size() < length) {
+      return false;
+    }
+    field->assign(value.data(), length);
+    value.remove_prefix(length);
+  }
+  return value.empty();
+}
+
+
+// Leaf hashes are stored followed by the timestamp of their entry.
+const size_t kLeafHashTimestampBytes = 8;
+
+
+std::string EncodeLeafHash(const std::string& hash, uint64_t timestamp) {
+  return hash + Serializer::SerializeUint(timestamp, kLeafHashTimestampBytes);
+}
+
+
+bool DecodeLeafHash(leveldb::Slice value, std::string* hash,
+                    uint64_t* timestamp) {
+  if (value.size() <= kLeafHashTimestampBytes) {
+    return false;
+  }
+  const size_t hash_size(value.size() - kLeafHashTimestampBytes);
+  hash->assign(value.data(), hash_size);
+  *timestamp = 0;
+  for (size_t i = hash_size; i < value.size(); ++i) {
+    *timestamp = (*timestamp << 8) | static_cast<unsigned char>(value[i]);
+  }
+  return true;
+}
+
+
+// The hash index is keyed by the raw hash, which halves its size
+// compared to a hex encoding.
+std::string HashToKey(const std::string& hash) {
+  return kHashPrefix + hash;
+}
+
+
+std::string ChainCertKey(const std::string& hash) {
+  return kChainCertPrefix + hash;
+}
+
+
+std::string SequenceNumberToValue(int64_t sequence_number) {
+  return Serializer::SerializeUint(sequence_number, sizeof(sequence_number));
+}
+
+
+int64_t ValueToSequenceNumber(const std::string& value) {
+  int64_t sequence_number;
+  CHECK_EQ(Deserializer::OK,
+           Deserializer::DeserializeUint<int64_t>(value,
+                                                  sizeof(sequence_number),
+                                                  &sequence_number));
+  return sequence_number;
 }
 
 
@@ -84,7 +358,8 @@ template <class Logged>
 class LevelDB<Logged>::Iterator : public Database<Logged>::Iterator {
  public:
   Iterator(const LevelDB<Logged>* db, int64_t start_index)
-      : it_(CHECK_NOTNULL(db)->db_->NewIterator(leveldb::ReadOptions())) {
+      : db_(CHECK_NOTNULL(db)),
+        it_(db->db_->NewIterator(leveldb::ReadOptions())) {
     CHECK(it_);
     it_->Seek(IndexToKey(start_index));
   }
@@ -95,12 +370,13 @@ class LevelDB<Logged>::Iterator : public Database<Logged>::Iterator {
     }
 
     const int64_t seq(KeyToIndex(it_->key()));
-    CHECK(entry->ParseFromArray(it_->value().data(), it_->value().size()))
+    CHECK(db_->ParseEntry(it_->value(), entry))
         << "failed to parse entry for key " << it_->key().ToString();
     CHECK(entry->has_sequence_number())
         << "no sequence number for entry with expected sequence number "
         << seq;
     CHECK_EQ(entry->sequence_number(), seq) << "unexpected sequence_number";
+    db_->JoinChain(entry);
 
     it_->Next();
 
@@ -108,7 +384,134 @@ class LevelDB<Logged>::Iterator : public Database<Logged>::Iterator {
   }
 
  private:
+  const LevelDB<Logged>* const db_;
+  const std::unique_ptr<leveldb::Iterator> it_;
+};
+
+
+// Returns the stored raw leaves, falling back to serializing the
+// entries that were written without --leveldb_raw_leaves.
+template <class Logged>
+class LevelDB<Logged>::LeafIterator
+    : public Database<Logged>::RawLeafIterator {
+ public:
+  LeafIterator(const LevelDB<Logged>* db, int64_t start_index)
+      : db_(CHECK_NOTNULL(db)),
+        it_(db->db_->NewIterator(leveldb::ReadOptions())),
+        next_index_(start_index) {
+    CHECK(it_);
+    it_->Seek(LeafKey(start_index));
+  }
+
+  bool GetNextLeaf(typename Database<Logged>::RawLeaf* leaf) override {
+    if (it_->Valid() && it_->key() == LeafKey(next_index_)) {
+      CHECK(DecodeRawLeaf(it_->value(), &leaf->leaf_input, &leaf->extra_data,
+                          &leaf->sct, &leaf->json))
+          << "failed to decode raw leaf for key " << it_->key().ToString();
+      leaf->sequence_number = next_index_;
+      it_->Next();
+    } else {
+      Logged logged;
+      if (db_->LookupByIndex(next_index_, &logged) != db_->LOOKUP_OK) {
+        return false;
+      }
+      if (!Database<Logged>::SerializeRawLeaf(logged, leaf)) {
+        LOG(WARNING) << "Failed to serialize entry @ " << next_index_ << ":\n"
+                     << logged.DebugString();
+        return false;
+      }
+    }
+    ++next_index_;
+
+    return true;
+  }
+
+ private:
+  const LevelDB<Logged>* const db_;
+  const std::unique_ptr<leveldb::Iterator> it_;
+  int64_t next_index_;
+};
+
+
+// Returns the stored leaf hashes, falling back to hashing the entries
+// that were written without --leveldb_leaf_hashes.
+template <class Logged>
+class LevelDB<Logged>::LeafHashIterator
+    : public Database<Logged>::LeafHashIterator {
+ public:
+  LeafHashIterator(const LevelDB<Logged>* db, int64_t start_index)
+      : db_(CHECK_NOTNULL(db)),
+        it_(db->db_->NewIterator(leveldb::ReadOptions())),
+        next_index_(start_index) {
+    CHECK(it_);
+    it_->Seek(LeafHashKey(start_index));
+  }
+
+  bool GetNextLeafHash(
+      typename Database<Logged>::LeafHash* leaf_hash) override {
+    if (it_->Valid() && it_->key() == LeafHashKey(next_index_)) {
+      CHECK(DecodeLeafHash(it_->value(), &leaf_hash->hash,
+                           &leaf_hash->timestamp))
+          << "failed to decode leaf hash for key " << it_->key().ToString();
+      leaf_hash->sequence_number = next_index_;
+      it_->Next();
+    } else {
+      if (db_->LookupByIndex(next_index_, &logged_) != db_->LOOKUP_OK) {
+        return false;
+      }
+      if (!Database<Logged>::HashLeaf(db_->tree_hasher_, logged_,
+                                      leaf_hash)) {
+        LOG(WARNING) << "Failed to serialize entry @ " << next_index_ << ":\n"
+                     << logged_.DebugString();
+        return false;
+      }
+    }
+    ++next_index_;
+
+    return true;
+  }
+
+ private:
+  const LevelDB<Logged>* const db_;
   const std::unique_ptr<leveldb::Iterator> it_;
+  int64_t next_index_;
+  // Reused for each entry, to save on allocations.
+  Logged logged_;
+};
+
+
+// Looks up the entries in the time index, in timestamp order.
+template <class Logged>
+class LevelDB<Logged>::TimeIterator : public Database<Logged>::Iterator {
+ public:
+  TimeIterator(const LevelDB<Logged>* db, uint64_t begin, uint64_t end)
+      : db_(CHECK_NOTNULL(db)),
+        it_(db->db_->NewIterator(leveldb::ReadOptions())),
+        end_(end) {
+    CHECK(it_);
+    it_->Seek(TimeKey(begin));
+  }
+
+  bool GetNextEntry(Logged* entry) override {
+    uint64_t timestamp;
+    int64_t sequence_number;
+    if (!it_->Valid() ||
+        !DecodeTimeKey(it_->key(), &timestamp, &sequence_number) ||
+        timestamp >= end_) {
+      return false;
+    }
+    CHECK_EQ(db_->LookupByIndex(sequence_number, entry), db_->LOOKUP_OK)
+        << "missing entry " << sequence_number << " of the time index";
+    CHECK_EQ(entry->timestamp(), timestamp);
+    it_->Next();
+
+    return true;
+  }
+
+ private:
+  const LevelDB<Logged>* const db_;
+  const std::unique_ptr<leveldb::Iterator> it_;
+  const uint64_t end_;
 };
 
 
@@ -122,7 +525,11 @@ LevelDB<Logged>::LevelDB(const std::string& dbfile)
 #ifdef HAVE_LEVELDB_FILTER_POLICY_H
       filter_policy_(BuildFilterPolicy()),
 #endif
+      block_cache_(BuildBlockCache()),
+      entry_compressor_(nullptr),
       contiguous_size_(0),
+      subtree_size_(0),
+      tree_hasher_(new Sha256Hasher),
       latest_tree_timestamp_(0) {
   LOG(INFO) << "Opening " << dbfile;
   cert_trans::ScopedLatency latency(latency_by_op_ms.GetScopedLatency("open"));
@@ -137,12 +544,28 @@ LevelDB<Logged>::LevelDB(const std::string& dbfile)
   CHECK_EQ(FLAGS_leveldb_bloom_filter_bits_per_key, 0)
       << "this version of leveldb does not have bloom filter support";
 #endif
+  options.block_cache = block_cache_.get();
+  CHECK_GE(FLAGS_leveldb_block_size_kb, 0);
+  if (FLAGS_leveldb_block_size_kb > 0) {
+    options.block_size = static_cast<size_t>(FLAGS_leveldb_block_size_kb)
+                         << 10;
+  }
+  CHECK_GE(FLAGS_leveldb_write_buffer_size_mb, 0);
+  if (FLAGS_leveldb_write_buffer_size_mb > 0) {
+    options.write_buffer_size =
+        static_cast<size_t>(FLAGS_leveldb_write_buffer_size_mb) << 20;
+  }
+  options.compression = FLAGS_leveldb_compression
+                            ? leveldb::kSnappyCompression
+                            : leveldb::kNoCompression;
   leveldb::DB* db;
   leveldb::Status status(leveldb::DB::Open(options, dbfile, &db));
   CHECK(status.ok()) << status.ToString();
   db_.reset(db);
 
+  LoadDictionaries();
   BuildIndex();
+  BuildTimeIndex();
 }
 
 
@@ -154,31 +577,22 @@ typename Database<Logged>::WriteResult LevelDB<Logged>::CreateSequencedEntry_(
   cert_trans::ScopedLatency latency(
       latency_by_op_ms.GetScopedLatency("create_sequenced_entry"));
 
-  std::unique_lock<std::mutex> lock(lock_);
+  std::lock_guard<std::mutex> lock(lock_);
 
-  std::string data;
-  CHECK(logged.SerializeToString(&data));
+  return WriteEntries(std::vector<const Logged*>(1, &logged));
+}
 
-  const std::string key(IndexToKey(logged.sequence_number()));
 
-  std::string existing_data;
-  leveldb::Status status(
-      db_->Get(leveldb::ReadOptions(), key, &existing_data));
-  if (status.IsNotFound()) {
-    status = db_->Put(leveldb::WriteOptions(), key, data);
-    CHECK(status.ok()) << "Failed to write sequenced entry (seq: "
-                       << logged.sequence_number()
-                       << "): " << status.ToString();
-  } else {
-    if (existing_data == data) {
-      return this->OK;
-    }
-    return this->SEQUENCE_NUMBER_ALREADY_IN_USE;
-  }
+template <class Logged>
+typename Database<Logged>::WriteResult
+LevelDB<Logged>::CreateSequencedEntries_(
+    const std::vector<const Logged*>& logged) {
+  cert_trans::ScopedLatency latency(
+      latency_by_op_ms.GetScopedLatency("create_sequenced_entries"));
 
-  InsertEntryMapping(logged.sequence_number(), logged.Hash());
+  std::lock_guard<std::mutex> lock(lock_);
 
-  return this->OK;
+  return WriteEntries(logged);
 }
 
 
@@ -188,25 +602,25 @@ typename Database<Logged>::LookupResult LevelDB<Logged>::LookupByHash(
   cert_trans::ScopedLatency latency(
       latency_by_op_ms.GetScopedLatency("lookup_by_hash"));
 
-  std::unique_lock<std::mutex> lock(lock_);
-
-  auto i(id_by_hash_.find(hash));
-  if (i == id_by_hash_.end()) {
+  std::string value;
+  leveldb::Status status(
+      db_->Get(leveldb::ReadOptions(), HashToKey(hash), &value));
+  if (status.IsNotFound()) {
     return this->NOT_FOUND;
   }
+  CHECK(status.ok()) << "Failed to get index of hash(" << util::HexString(hash)
+                     << "): " << status.ToString();
 
   std::string cert_data;
-  const leveldb::Status status(
-      db_->Get(leveldb::ReadOptions(), IndexToKey(i->second), &cert_data));
-  if (status.IsNotFound()) {
-    return this->NOT_FOUND;
-  }
+  status = db_->Get(leveldb::ReadOptions(),
+                    IndexToKey(ValueToSequenceNumber(value)), &cert_data);
   CHECK(status.ok()) << "Failed to get entry by hash(" << util::HexString(hash)
                      << "): " << status.ToString();
 
   Logged logged;
-  CHECK(logged.ParseFromString(cert_data));
+  CHECK(ParseEntry(cert_data, &logged));
   CHECK_EQ(logged.Hash(), hash);
+  JoinChain(&logged);
 
   if (result) {
     logged.Swap(result);
@@ -233,8 +647,9 @@ typename Database<Logged>::LookupResult LevelDB<Logged>::LookupByIndex(
                      << sequence_number;
 
   if (result) {
-    CHECK(result->ParseFromString(cert_data));
+    CHECK(ParseEntry(cert_data, result));
     CHECK_EQ(result->sequence_number(), sequence_number);
+    JoinChain(result);
   }
 
   return this->LOOKUP_OK;
@@ -248,6 +663,37 @@ LevelDB<Logged>::ScanEntries(int64_t start_index) const {
 }
 
 
+template <class Logged>
+std::unique_ptr<typename Database<Logged>::RawLeafIterator>
+LevelDB<Logged>::ScanRawLeaves(int64_t start_index) const {
+  if (!FLAGS_leveldb_raw_leaves) {
+    return Database<Logged>::ScanRawLeaves(start_index);
+  }
+  return std::unique_ptr<LeafIterator>(new LeafIterator(this, start_index));
+}
+
+
+template <class Logged>
+std::unique_ptr<typename Database<Logged>::LeafHashIterator>
+LevelDB<Logged>::ScanLeafHashes(int64_t start_index) const {
+  if (!FLAGS_leveldb_leaf_hashes) {
+    return Database<Logged>::ScanLeafHashes(start_index);
+  }
+  return std::unique_ptr<LeafHashIterator>(
+      new LeafHashIterator(this, start_index));
+}
+
+
+template <class Logged>
+std::unique_ptr<typename Database<Logged>::Iterator>
+LevelDB<Logged>::ScanEntriesByTime(uint64_t begin, uint64_t end) const {
+  if (!FLAGS_leveldb_time_index) {
+    return Database<Logged>::ScanEntriesByTime(begin, end);
+  }
+  return std::unique_ptr<TimeIterator>(new TimeIterator(this, begin, end));
+}
+
+
 template <class Logged>
 typename Database<Logged>::WriteResult LevelDB<Logged>::WriteTreeHead_(
     const ct::SignedTreeHead& sth) {
@@ -282,10 +728,14 @@ typename Database<Logged>::WriteResult LevelDB<Logged>::WriteTreeHead_(
 
   if (sth.timestamp() > latest_tree_timestamp_) {
     latest_tree_timestamp_ = sth.timestamp();
-    latest_timestamp_key_ = timestamp_key;
   }
 
   lock.unlock();
+  // Tree heads are written regularly, but rarely enough that this
+  // doesn't add contention on the cache.
+  if (block_cache_) {
+    block_cache_usage_bytes->Set(block_cache_->TotalCharge());
+  }
   callbacks_.Call(sth);
 
   return this->OK;
@@ -297,7 +747,6 @@ typename Database<Logged>::LookupResult LevelDB<Logged>::LatestTreeHead(
     ct::SignedTreeHead* result) const {
   cert_trans::ScopedLatency latency(
       latency_by_op_ms.GetScopedLatency("latest_tree_head"));
-  std::lock_guard<std::mutex> lock(lock_);
 
   return LatestTreeHeadNoLock(result);
 }
@@ -307,12 +756,18 @@ template <class Logged>
 int64_t LevelDB<Logged>::TreeSize() const {
   cert_trans::ScopedLatency latency(
       latency_by_op_ms.GetScopedLatency("tree_size"));
-  std::lock_guard<std::mutex> lock(lock_);
 
   return contiguous_size_;
 }
 
 
+template <class Logged>
+std::vector<int64_t> LevelDB<Logged>::SparseEntries() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return std::vector<int64_t>(sparse_entries_.begin(), sparse_entries_.end());
+}
+
+
 template <class Logged>
 void LevelDB<Logged>::AddNotifySTHCallback(
     const typename Database<Logged>::NotifySTHCallback* callback) {
@@ -331,8 +786,8 @@ void LevelDB<Logged>::AddNotifySTHCallback(
 template <class Logged>
 void LevelDB<Logged>::RemoveNotifySTHCallback(
     const typename Database<Logged>::NotifySTHCallback* callback) {
-  std::lock_guard<std::mutex> lock(lock_);
-
+  // Not under |lock_|, as this waits for the callback to return if it
+  // is being called, and it might want to perform some lookups.
   callbacks_.Remove(callback);
 }
 
@@ -370,6 +825,85 @@ typename Database<Logged>::LookupResult LevelDB<Logged>::NodeId(
 }
 
 
+template <class Logged>
+typename Database<Logged>::LookupResult LevelDB<Logged>::LookupSubtreeHash(
+    int level, int64_t index, std::string* hash) const {
+  CHECK_GE(index, 0);
+  CHECK_NOTNULL(hash);
+  cert_trans::ScopedLatency latency(
+      latency_by_op_ms.GetScopedLatency("lookup_subtree_hash"));
+
+  const leveldb::Status status(
+      db_->Get(leveldb::ReadOptions(), SubtreeKey(level, index), hash));
+  if (status.IsNotFound()) {
+    return this->NOT_FOUND;
+  }
+  CHECK(status.ok()) << "Failed to get subtree hash (level: " << level
+                     << ", index: " << index << "): " << status.ToString();
+
+  return this->LOOKUP_OK;
+}
+
+
+// static
+template <class Logged>
+void LevelDB<Logged>::DropIndexes(const std::string& dbfile) {
+  leveldb::DB* db;
+  leveldb::Status status(leveldb::DB::Open(leveldb::Options(), dbfile, &db));
+  CHECK(status.ok()) << status.ToString();
+  const std::unique_ptr<leveldb::DB> db_deleter(db);
+
+  std::string value;
+  status = db->Get(leveldb::ReadOptions(),
+                   std::string(kMetaPrefix) + kMetaHashIndexProgressKey,
+                   &value);
+  if (status.ok()) {
+    LOG(INFO) << "The hash index is already being rebuilt, from sequence "
+              << "number " << ValueToSequenceNumber(value);
+    return;
+  }
+  CHECK(status.IsNotFound()) << "Failed to read hash index progress: "
+                             << status.ToString();
+
+  // Without these, the indexes are rebuilt, even if deleting them is
+  // interrupted.
+  leveldb::WriteBatch batch;
+  batch.Delete(std::string(kMetaPrefix) + kMetaHashIndexKey);
+  batch.Delete(std::string(kMetaPrefix) + kMetaContiguousSizeKey);
+  batch.Delete(std::string(kMetaPrefix) + kMetaSubtreeSizeKey);
+  batch.Delete(std::string(kMetaPrefix) + kMetaTimeIndexKey);
+  status = db->Write(leveldb::WriteOptions(), &batch);
+  CHECK(status.ok()) << "Failed to delete index metadata: "
+                     << status.ToString();
+  batch.Clear();
+
+  leveldb::ReadOptions options;
+  options.fill_cache = false;
+  for (const char* prefix : {kHashPrefix, kSubtreePrefix, kTimePrefix}) {
+    LOG(INFO) << "Deleting the \"" << prefix << "\" keys";
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(options));
+    size_t batch_size(0);
+    for (it->Seek(prefix); it->Valid() && it->key().starts_with(prefix);
+         it->Next()) {
+      batch.Delete(it->key());
+      if (++batch_size >= kHashIndexBatchSize) {
+        status = db->Write(leveldb::WriteOptions(), &batch);
+        CHECK(status.ok()) << "Failed to delete index: " << status.ToString();
+        batch.Clear();
+        batch_size = 0;
+      }
+    }
+    CHECK(it->status().ok()) << "Failed to scan index: "
+                             << it->status().ToString();
+  }
+
+  batch.Put(std::string(kMetaPrefix) + kMetaHashIndexProgressKey,
+            SequenceNumberToValue(0));
+  status = db->Write(leveldb::WriteOptions(), &batch);
+  CHECK(status.ok()) << "Failed to delete index: " << status.ToString();
+}
+
+
 template <class Logged>
 void LevelDB<Logged>::BuildIndex() {
   cert_trans::ScopedLatency latency(
@@ -378,55 +912,205 @@ void LevelDB<Logged>::BuildIndex() {
   // this should not be necessarily, but just to be sure...
   std::lock_guard<std::mutex> lock(lock_);
 
+  std::string value;
+  leveldb::Status status(
+      db_->Get(leveldb::ReadOptions(),
+               std::string(kMetaPrefix) + kMetaHashIndexKey, &value));
+  CHECK(status.ok() || status.IsNotFound())
+      << "Failed to read hash index marker: " << status.ToString();
+  const bool have_hash_index(status.ok());
+
+  // The stored contiguous size is only ever behind the real one, so
+  // we only have to look at the entries from there onwards. Older
+  // databases without a hash index get it built here, from a full scan.
+  if (have_hash_index) {
+    status = db_->Get(leveldb::ReadOptions(),
+                      std::string(kMetaPrefix) + kMetaContiguousSizeKey,
+                      &value);
+    if (status.ok()) {
+      contiguous_size_ = ValueToSequenceNumber(value);
+    } else {
+      CHECK(status.IsNotFound()) << "Failed to read contiguous size: "
+                                 << status.ToString();
+    }
+  }
+  // Where an interrupted build of the hash index had got to.
+  int64_t hash_index_progress(0);
+  if (!have_hash_index) {
+    status = db_->Get(leveldb::ReadOptions(),
+                      std::string(kMetaPrefix) + kMetaHashIndexProgressKey,
+                      &value);
+    if (status.ok()) {
+      hash_index_progress = ValueToSequenceNumber(value);
+    } else {
+      CHECK(status.IsNotFound()) << "Failed to read hash index progress: "
+                                 << status.ToString();
+    }
+    LOG(INFO) << "Building the hash index from sequence number "
+              << hash_index_progress;
+  }
+  const int64_t stored_contiguous_size(contiguous_size_);
+
   leveldb::ReadOptions options;
   options.fill_cache = false;
   std::unique_ptr<leveldb::Iterator> it(db_->NewIterator(options));
   CHECK(it);
-  it->Seek(kEntryPrefix);
+  it->Seek(IndexToKey(contiguous_size_));
 
+  leveldb::WriteBatch batch;
+  std::map<std::string, int64_t> pending;
   for (; it->Valid() && it->key().starts_with(kEntryPrefix); it->Next()) {
     const int64_t seq(KeyToIndex(it->key()));
-    Logged logged;
-    CHECK(logged.ParseFromString(it->value().ToString()))
-        << "Failed to parse entry with sequence number " << seq;
-    CHECK(logged.has_sequence_number())
-        << "No sequence number for entry with sequence number " << seq;
-    CHECK_EQ(logged.sequence_number(), seq)
-        << "Entry has unexpected sequence_number: " << seq;
+    if (!have_hash_index && seq >= hash_index_progress) {
+      Logged logged;
+      CHECK(ParseEntry(it->value(), &logged))
+          << "Failed to parse entry with sequence number " << seq;
+      CHECK(logged.has_sequence_number())
+          << "No sequence number for entry with sequence number " << seq;
+      CHECK_EQ(logged.sequence_number(), seq)
+          << "Entry has unexpected sequence_number: " << seq;
+
+      IndexHash(logged.Hash(), seq, &batch, &pending);
+      if (pending.size() >= kHashIndexBatchSize) {
+        batch.Put(std::string(kMetaPrefix) + kMetaHashIndexProgressKey,
+                  SequenceNumberToValue(seq + 1));
+        LOG_EVERY_N(INFO, 1024) << "Indexed hashes up to sequence number "
+                                << seq;
+        status = db_->Write(leveldb::WriteOptions(), &batch);
+        CHECK(status.ok()) << "Failed to write hash index: "
+                           << status.ToString();
+        batch.Clear();
+        pending.clear();
+      }
+    }
+
+    InsertEntryMapping(seq);
+  }
 
-    InsertEntryMapping(logged.sequence_number(), logged.Hash());
+  if (!have_hash_index) {
+    batch.Put(std::string(kMetaPrefix) + kMetaHashIndexKey, "");
+    batch.Delete(std::string(kMetaPrefix) + kMetaHashIndexProgressKey);
   }
+  if (contiguous_size_ != stored_contiguous_size) {
+    batch.Put(std::string(kMetaPrefix) + kMetaContiguousSizeKey,
+              SequenceNumberToValue(contiguous_size_));
+  }
+  status = db_->Write(leveldb::WriteOptions(), &batch);
+  CHECK(status.ok()) << "Failed to write index metadata: "
+                     << status.ToString();
 
   // Now read the STH entries.
   it->Seek(kTreeHeadPrefix);
   for (; it->Valid() && it->key().starts_with(kTreeHeadPrefix); it->Next()) {
     leveldb::Slice key_slice(it->key());
     key_slice.remove_prefix(strlen(kTreeHeadPrefix));
-    latest_timestamp_key_ = key_slice.ToString();
+    uint64_t timestamp;
     CHECK_EQ(Deserializer::OK,
              Deserializer::DeserializeUint<uint64_t>(
-                 latest_timestamp_key_, LevelDB::kTimestampBytesIndexed,
-                 &latest_tree_timestamp_));
+                 key_slice.ToString(), LevelDB::kTimestampBytesIndexed,
+                 &timestamp));
+    latest_tree_timestamp_ = timestamp;
   }
+
+  std::string subtree_size;
+  status = db_->Get(leveldb::ReadOptions(),
+                    std::string(kMetaPrefix) + kMetaSubtreeSizeKey,
+                    &subtree_size);
+  if (status.ok()) {
+    CHECK_EQ(Deserializer::OK,
+             Deserializer::DeserializeUint<int64_t>(
+                 subtree_size, sizeof(subtree_size_), &subtree_size_));
+  } else {
+    CHECK(status.IsNotFound()) << "Failed to read subtree size: "
+                               << status.ToString();
+  }
+  // Catch up with entries written while the subtree hashes were not
+  // being maintained.
+  UpdateSubtreeHashes();
+}
+
+
+// The time index marker is only there while every entry is indexed:
+// it is dropped when the database is opened without
+// --leveldb_time_index, and the index is completed when it is opened
+// with it again.
+template <class Logged>
+void LevelDB<Logged>::BuildTimeIndex() {
+  std::lock_guard<std::mutex> lock(lock_);
+
+  const std::string marker_key(std::string(kMetaPrefix) + kMetaTimeIndexKey);
+  std::string value;
+  leveldb::Status status(
+      db_->Get(leveldb::ReadOptions(), marker_key, &value));
+  CHECK(status.ok() || status.IsNotFound())
+      << "Failed to read time index marker: " << status.ToString();
+  if (!FLAGS_leveldb_time_index) {
+    if (status.ok()) {
+      status = db_->Delete(leveldb::WriteOptions(), marker_key);
+      CHECK(status.ok()) << "Failed to delete time index marker: "
+                         << status.ToString();
+    }
+    return;
+  }
+  if (status.ok()) {
+    return;
+  }
+
+  cert_trans::ScopedLatency latency(
+      latency_by_op_ms.GetScopedLatency("build_time_index"));
+  LOG(INFO) << "Building the time index";
+  leveldb::ReadOptions options;
+  options.fill_cache = false;
+  std::unique_ptr<leveldb::Iterator> it(db_->NewIterator(options));
+  CHECK(it);
+  leveldb::WriteBatch batch;
+  size_t batch_size(0);
+  Logged logged;
+  for (it->Seek(kEntryPrefix);
+       it->Valid() && it->key().starts_with(kEntryPrefix); it->Next()) {
+    const int64_t seq(KeyToIndex(it->key()));
+    CHECK(ParseEntry(it->value(), &logged))
+        << "Failed to parse entry with sequence number " << seq;
+    // Puts are idempotent, so the entries indexed already, and those of
+    // an interrupted build, can simply be indexed again.
+    batch.Put(TimeKey(logged.timestamp(), seq), "");
+    if (++batch_size >= kHashIndexBatchSize) {
+      status = db_->Write(leveldb::WriteOptions(), &batch);
+      CHECK(status.ok()) << "Failed to write time index: "
+                         << status.ToString();
+      batch.Clear();
+      batch_size = 0;
+    }
+  }
+  CHECK(it->status().ok()) << "Failed to scan entries: "
+                           << it->status().ToString();
+
+  batch.Put(marker_key, "");
+  status = db_->Write(leveldb::WriteOptions(), &batch);
+  CHECK(status.ok()) << "Failed to write time index: " << status.ToString();
 }
 
 
 template <class Logged>
 typename Database<Logged>::LookupResult LevelDB<Logged>::LatestTreeHeadNoLock(
     ct::SignedTreeHead* result) const {
-  if (latest_tree_timestamp_ == 0) {
+  const uint64_t timestamp(latest_tree_timestamp_);
+  if (timestamp == 0) {
     return this->NOT_FOUND;
   }
 
   std::string tree_data;
-  leveldb::Status status(db_->Get(leveldb::ReadOptions(),
-                                  kTreeHeadPrefix + latest_timestamp_key_,
-                                  &tree_data));
+  leveldb::Status status(db_->Get(
+      leveldb::ReadOptions(),
+      kTreeHeadPrefix +
+          Serializer::SerializeUint(timestamp,
+                                    LevelDB::kTimestampBytesIndexed),
+      &tree_data));
   CHECK(status.ok()) << "Failed to read latest tree head: "
                      << status.ToString();
 
   CHECK(result->ParseFromString(tree_data));
-  CHECK_EQ(result->timestamp(), latest_tree_timestamp_);
+  CHECK_EQ(result->timestamp(), timestamp);
 
   return this->LOOKUP_OK;
 }
@@ -434,20 +1118,310 @@ typename Database<Logged>::LookupResult LevelDB<Logged>::LatestTreeHeadNoLock(
 
 // This must be called with "lock_" held.
 template <class Logged>
-void LevelDB<Logged>::InsertEntryMapping(int64_t sequence_number,
-                                         const std::string& hash) {
-  if (!id_by_hash_.insert(std::make_pair(hash, sequence_number)).second) {
-    // This is a duplicate hash under a new sequence number.
-    // Make sure we track the entry with the lowest sequence number:
-    id_by_hash_[hash] = std::min(id_by_hash_[hash], sequence_number);
+typename Database<Logged>::WriteResult LevelDB<Logged>::WriteEntries(
+    const std::vector<const Logged*>& logged) {
+  leveldb::WriteBatch batch;
+  // The entries being added, by key, in case |logged| has duplicates.
+  std::map<std::string, std::string> added;
+  std::map<std::string, int64_t> pending_hashes;
+  std::vector<const Logged*> new_entries;
+  // The chain certificates in |batch|.
+  std::set<std::string> added_chain_certs;
+  for (const Logged* entry : logged) {
+    std::string data;
+    CHECK(entry->SerializeToString(&data));
+    // What is stored for |entry|, different from |data| if its chain
+    // is kept apart.
+    std::string stored_data(data);
+    std::map<std::string, std::string> chain_certs;
+    if (FLAGS_leveldb_shared_chain_certs) {
+      Logged stored(*entry);
+      stored.SplitChain(&chain_certs);
+      CHECK(stored.SerializeToString(&stored_data));
+    }
+    if (entry_compressor_) {
+      stored_data = CompressEntry(stored_data);
+    }
+
+    const std::string key(IndexToKey(entry->sequence_number()));
+
+    std::string existing_data;
+    const auto it(added.find(key));
+    // Entries of this batch are all stored the same way, but the
+    // entries in the database may not be.
+    const bool in_batch(it != added.end());
+    if (in_batch) {
+      existing_data = it->second;
+    } else {
+      const leveldb::Status status(
+          db_->Get(leveldb::ReadOptions(), key, &existing_data));
+      if (status.IsNotFound()) {
+        batch.Put(key, stored_data);
+        added[key] = stored_data;
+        StoreChainCerts(chain_certs, &batch, &added_chain_certs);
+        IndexHash(entry->Hash(), entry->sequence_number(), &batch,
+                  &pending_hashes);
+        if (FLAGS_leveldb_raw_leaves) {
+          typename Database<Logged>::RawLeaf leaf;
+          CHECK(Database<Logged>::SerializeRawLeaf(*entry, &leaf))
+              << "Failed to serialize entry: " << entry->DebugString();
+          if (FLAGS_leveldb_entry_json) {
+            leaf.json = Database<Logged>::EntryJson(leaf);
+          }
+          std::string raw_leaf;
+          if (EncodeRawLeaf(leaf.leaf_input, leaf.extra_data, leaf.sct,
+                            leaf.json, &raw_leaf)) {
+            batch.Put(LeafKey(entry->sequence_number()), raw_leaf);
+          } else {
+            // Served as the entries written without --leveldb_raw_leaves.
+            LOG(WARNING) << "Entry " << entry->sequence_number()
+                         << " is too large to store as a raw leaf";
+            oversized_raw_leaves->Increment();
+          }
+        }
+        if (FLAGS_leveldb_leaf_hashes) {
+          typename Database<Logged>::LeafHash leaf_hash;
+          CHECK(Database<Logged>::HashLeaf(tree_hasher_, *entry, &leaf_hash))
+              << "Failed to serialize entry: " << entry->DebugString();
+          batch.Put(LeafHashKey(entry->sequence_number()),
+                    EncodeLeafHash(leaf_hash.hash, leaf_hash.timestamp));
+        }
+        if (FLAGS_leveldb_time_index) {
+          batch.Put(TimeKey(entry->timestamp(), entry->sequence_number()),
+                    "");
+        }
+        new_entries.push_back(entry);
+        continue;
+      }
+    }
+    if (existing_data != stored_data &&
+        (in_batch || !SameEntry(existing_data, data))) {
+      return this->SEQUENCE_NUMBER_ALREADY_IN_USE;
+    }
+  }
+
+  if (new_entries.empty()) {
+    return this->OK;
+  }
+  const leveldb::Status status(db_->Write(leveldb::WriteOptions(), &batch));
+  CHECK(status.ok()) << "Failed to write " << new_entries.size()
+                     << " sequenced entries (first seq: "
+                     << new_entries.front()->sequence_number()
+                     << "): " << status.ToString();
+
+  const int64_t old_contiguous_size(contiguous_size_);
+  for (const Logged* entry : new_entries) {
+    InsertEntryMapping(entry->sequence_number());
+  }
+  if (contiguous_size_ != old_contiguous_size) {
+    // This need not be written with the entries: BuildIndex() picks up
+    // any contiguous entries beyond the stored size.
+    const leveldb::Status status(
+        db_->Put(leveldb::WriteOptions(),
+                 std::string(kMetaPrefix) + kMetaContiguousSizeKey,
+                 SequenceNumberToValue(contiguous_size_)));
+    CHECK(status.ok()) << "Failed to write contiguous size: "
+                       << status.ToString();
+  }
+  UpdateSubtreeHashes();
+
+  return this->OK;
+}
+
+
+// Reads the dictionaries stored in the database, and adds the one of
+// --leveldb_entry_dictionary, if it isn't there yet. This must be
+// called before there are any readers, as they don't lock
+// |dictionaries_|.
+template <class Logged>
+void LevelDB<Logged>::LoadDictionaries() {
+  std::unique_ptr<leveldb::Iterator> it(
+      db_->NewIterator(leveldb::ReadOptions()));
+  for (it->Seek(kDictionaryPrefix);
+       it->Valid() && it->key().starts_with(kDictionaryPrefix); it->Next()) {
+    std::unique_ptr<const util::DictionaryCompressor> compressor(
+        new util::DictionaryCompressor(it->value().ToString()));
+    CHECK_EQ(DictionaryKey(compressor->id()), it->key().ToString())
+        << "Dictionary does not match its key";
+    dictionaries_[compressor->id()] = std::move(compressor);
+  }
+  CHECK(it->status().ok()) << "Failed to read dictionaries: "
+                           << it->status().ToString();
+
+  if (FLAGS_leveldb_entry_dictionary.empty()) {
+    return;
+  }
+  std::string dictionary;
+  CHECK(util::ReadBinaryFile(FLAGS_leveldb_entry_dictionary, &dictionary))
+      << "Could not read " << FLAGS_leveldb_entry_dictionary;
+  std::unique_ptr<const util::DictionaryCompressor> compressor(
+      new util::DictionaryCompressor(dictionary));
+  const uint32_t id(compressor->id());
+  if (dictionaries_.find(id) == dictionaries_.end()) {
+    LOG(INFO) << "Adding entry dictionary " << id << " ("
+              << compressor->dictionary().size() << " bytes)";
+    leveldb::WriteOptions options;
+    options.sync = true;
+    const leveldb::Status status(
+        db_->Put(options, DictionaryKey(id), compressor->dictionary()));
+    CHECK(status.ok()) << "Failed to write dictionary: "
+                       << status.ToString();
+    dictionaries_[id] = std::move(compressor);
+  }
+  entry_compressor_ = dictionaries_[id].get();
+}
+
+
+// Returns |data|, a serialized entry, compressed for storage.
+template <class Logged>
+std::string LevelDB<Logged>::CompressEntry(const std::string& data) const {
+  CHECK_NOTNULL(entry_compressor_);
+  std::string value;
+  value.reserve(kCompressedEntryHeaderBytes + data.size());
+  value.push_back(kCompressedEntryMarker);
+  value.push_back(kCompressedEntryVersion);
+  value.append(
+      Serializer::SerializeUint(entry_compressor_->id(), kDictionaryIdBytes));
+  entry_compressor_->Compress(data.data(), data.size(), &value);
+  return value;
+}
+
+
+// Parses |value|, as stored for an entry, compressed or not.
+template <class Logged>
+bool LevelDB<Logged>::ParseEntry(leveldb::Slice value, Logged* logged) const {
+  if (value.empty() || value[0] != kCompressedEntryMarker) {
+    return logged->ParseFromArray(value.data(), value.size());
+  }
+
+  if (value.size() < kCompressedEntryHeaderBytes ||
+      value[1] != kCompressedEntryVersion) {
+    LOG(WARNING) << "Unknown entry encoding";
+    return false;
+  }
+  uint32_t id(0);
+  for (size_t i = 0; i < kDictionaryIdBytes; ++i) {
+    id = (id << 8) | static_cast<unsigned char>(value[2 + i]);
+  }
+  const auto it(dictionaries_.find(id));
+  if (it == dictionaries_.end()) {
+    LOG(WARNING) << "Missing entry dictionary " << id;
+    return false;
   }
+  value.remove_prefix(kCompressedEntryHeaderBytes);
+  return it->second->Decompress(value.data(), value.size(),
+                                &decompressed_entry) &&
+         logged->ParseFromString(decompressed_entry);
+}
+
+
+// Adds to |batch| the certificates of |certs| that are neither in the
+// database, nor in |added|, which holds those already in |batch|. This
+// must be called with "lock_" held.
+template <class Logged>
+void LevelDB<Logged>::StoreChainCerts(
+    const std::map<std::string, std::string>& certs,
+    leveldb::WriteBatch* batch, std::set<std::string>* added) const {
+  for (const auto& cert : certs) {
+    if (added->count(cert.first) > 0) {
+      continue;
+    }
+    const std::string key(ChainCertKey(cert.first));
+    std::string value;
+    const leveldb::Status status(
+        db_->Get(leveldb::ReadOptions(), key, &value));
+    if (status.IsNotFound()) {
+      batch->Put(key, cert.second);
+    } else {
+      CHECK(status.ok()) << "Failed to get chain certificate "
+                         << util::HexString(cert.first) << ": "
+                         << status.ToString();
+    }
+    added->insert(cert.first);
+  }
+}
+
+
+// Puts back the chain certificates of |logged|, if they are stored
+// apart from it.
+template <class Logged>
+void LevelDB<Logged>::JoinChain(Logged* logged) const {
+  CHECK(logged->JoinChain([this](const std::string& hash, std::string* cert) {
+    const leveldb::Status status(
+        db_->Get(leveldb::ReadOptions(), ChainCertKey(hash), cert));
+    CHECK(status.ok() || status.IsNotFound())
+        << "Failed to get chain certificate " << util::HexString(hash)
+        << ": " << status.ToString();
+    return status.ok();
+  })) << "Missing chain certificate for entry with sequence number "
+      << logged->sequence_number();
+}
+
+
+// Whether |stored_data|, read from the database, is the entry
+// serialized as |data|, given that either of them may have been
+// written with its chain kept apart.
+template <class Logged>
+bool LevelDB<Logged>::SameEntry(const std::string& stored_data,
+                                const std::string& data) const {
+  Logged stored;
+  CHECK(ParseEntry(stored_data, &stored));
+  JoinChain(&stored);
+  std::string joined;
+  CHECK(stored.SerializeToString(&joined));
+  return joined == data;
+}
+
+
+// Adds the mapping of |hash| to |sequence_number| to |batch|, unless
+// |hash| is already mapped to a lower sequence number, either in the
+// database or in |pending|, which holds the mappings in |batch|. This
+// must be called with "lock_" held.
+template <class Logged>
+void LevelDB<Logged>::IndexHash(const std::string& hash,
+                                int64_t sequence_number,
+                                leveldb::WriteBatch* batch,
+                                std::map<std::string, int64_t>* pending) const {
+  const std::string key(HashToKey(hash));
+  const auto it(pending->find(key));
+  if (it != pending->end()) {
+    if (it->second <= sequence_number) {
+      return;
+    }
+  } else {
+    std::string value;
+    const leveldb::Status status(
+        db_->Get(leveldb::ReadOptions(), key, &value));
+    if (status.ok()) {
+      // This is a duplicate hash under a new sequence number. Make
+      // sure we track the entry with the lowest sequence number.
+      if (ValueToSequenceNumber(value) <= sequence_number) {
+        return;
+      }
+    } else {
+      CHECK(status.IsNotFound()) << "Failed to get index of hash("
+                                 << util::HexString(hash)
+                                 << "): " << status.ToString();
+    }
+  }
+
+  batch->Put(key, SequenceNumberToValue(sequence_number));
+  (*pending)[key] = sequence_number;
+}
+
+
+// This must be called with "lock_" held.
+template <class Logged>
+void LevelDB<Logged>::InsertEntryMapping(int64_t sequence_number) {
   if (sequence_number == contiguous_size_) {
-    ++contiguous_size_;
-    for (auto i = sparse_entries_.find(contiguous_size_);
-         i != sparse_entries_.end() && *i == contiguous_size_;) {
-      ++contiguous_size_;
+    // Readers don't take "lock_", so only publish the final size.
+    int64_t contiguous_size(contiguous_size_ + 1);
+    for (auto i = sparse_entries_.find(contiguous_size);
+         i != sparse_entries_.end() && *i == contiguous_size;) {
+      ++contiguous_size;
       i = sparse_entries_.erase(i);
     }
+    contiguous_size_ = contiguous_size;
   } else {
     // It's not contiguous, put it with the other sparse entries.
     CHECK(sparse_entries_.insert(sequence_number).second)
@@ -456,4 +1430,81 @@ void LevelDB<Logged>::InsertEntryMapping(int64_t sequence_number,
 }
 
 
+// Hashes the entries that became contiguous since the last call into
+// the perfect subtrees they complete. This must be called with "lock_"
+// held.
+template <class Logged>
+void LevelDB<Logged>::UpdateSubtreeHashes() {
+  if (!FLAGS_leveldb_subtree_hashes) {
+    return;
+  }
+
+  // Hashes in |batch|, which we may need before it is written.
+  std::map<std::string, std::string> pending;
+  leveldb::WriteBatch batch;
+  while (subtree_size_ < contiguous_size_) {
+    // The stored leaf hash saves parsing the entry, if there is one.
+    std::string data;
+    std::string hash;
+    uint64_t timestamp;
+    leveldb::Status status(db_->Get(leveldb::ReadOptions(),
+                                    LeafHashKey(subtree_size_), &data));
+    if (status.ok()) {
+      CHECK(DecodeLeafHash(data, &hash, &timestamp))
+          << "failed to decode leaf hash for sequence number "
+          << subtree_size_;
+    } else {
+      CHECK(status.IsNotFound()) << "Failed to get leaf hash for sequence "
+                                 << "number " << subtree_size_ << ": "
+                                 << status.ToString();
+      status =
+          db_->Get(leveldb::ReadOptions(), IndexToKey(subtree_size_), &data);
+      CHECK(status.ok()) << "Failed to get entry for sequence number "
+                         << subtree_size_ << ": " << status.ToString();
+      Logged logged;
+      CHECK(ParseEntry(data, &logged));
+      typename Database<Logged>::LeafHash leaf_hash;
+      CHECK(Database<Logged>::HashLeaf(tree_hasher_, logged, &leaf_hash));
+      hash.swap(leaf_hash.hash);
+    }
+
+    // Each entry completes the subtrees it is the last leaf of.
+    int level(0);
+    for (int64_t index = subtree_size_;; index >>= 1, ++level) {
+      const std::string key(SubtreeKey(level, index));
+      batch.Put(key, hash);
+      pending[key] = hash;
+      if (index % 2 == 0) {
+        break;
+      }
+
+      const std::string left_key(SubtreeKey(level, index - 1));
+      const auto it(pending.find(left_key));
+      std::string left;
+      if (it != pending.end()) {
+        left = it->second;
+      } else {
+        status = db_->Get(leveldb::ReadOptions(), left_key, &left);
+        CHECK(status.ok()) << "Failed to get subtree hash " << left_key
+                           << ": " << status.ToString();
+      }
+      hash = tree_hasher_.HashChildren(left, hash);
+    }
+
+    ++subtree_size_;
+    if (subtree_size_ % kSubtreeBatchSize == 0 ||
+        subtree_size_ == contiguous_size_) {
+      batch.Put(std::string(kMetaPrefix) + kMetaSubtreeSizeKey,
+                Serializer::SerializeUint(subtree_size_,
+                                          sizeof(subtree_size_)));
+      status = db_->Write(leveldb::WriteOptions(), &batch);
+      CHECK(status.ok()) << "Failed to write subtree hashes: "
+                         << status.ToString();
+      batch.Clear();
+      pending.clear();
+    }
+  }
+}
+
+
 #endif  // CERT_TRANS_LOG_LEVELDB_DB_INL_H_
@@ -3,7 +3,10 @@
 
 #include "config.h"
 
+#include <atomic>
+#include <leveldb/cache.h>
 #include <leveldb/db.h>
+#include <leveldb/write_batch.h>
 #ifdef HAVE_LEVELDB_FILTER_POLICY_H
 #include <leveldb/filter_policy.h>
 #endif
@@ -12,12 +15,13 @@
 #include <mutex>
 #include <set>
 #include <stdint.h>
-#include <unordered_map>
 #include <vector>
 
 #include "base/macros.h"
 #include "log/database.h"
+#include "merkletree/tree_hasher.h"
 #include "proto/ct.pb.h"
+#include "util/dictionary_compressor.h"
 #include "util/statusor.h"
 
 namespace cert_trans {
@@ -36,6 +40,11 @@ class LevelDB : public Database<Logged> {
   typename Database<Logged>::WriteResult CreateSequencedEntry_(
       const Logged& logged) override;
 
+  // Writes all the new entries in a single leveldb::WriteBatch, so
+  // either all of them are written, or none.
+  typename Database<Logged>::WriteResult CreateSequencedEntries_(
+      const std::vector<const Logged*>& logged) override;
+
   typename Database<Logged>::LookupResult LookupByHash(
       const std::string& hash, Logged* result) const override;
 
@@ -45,6 +54,21 @@ class LevelDB : public Database<Logged> {
   std::unique_ptr<typename Database<Logged>::Iterator> ScanEntries(
       int64_t start_index) const override;
 
+  // With --leveldb_raw_leaves, this reads the serialized entries
+  // stored next to them, rather than parsing and serializing them.
+  std::unique_ptr<typename Database<Logged>::RawLeafIterator> ScanRawLeaves(
+      int64_t start_index) const override;
+
+  // With --leveldb_leaf_hashes, this reads the leaf hashes stored next
+  // to the entries, rather than parsing and hashing them.
+  std::unique_ptr<typename Database<Logged>::LeafHashIterator> ScanLeafHashes(
+      int64_t start_index) const override;
+
+  // With --leveldb_time_index, this seeks in the index of the entries
+  // by timestamp, and returns them in timestamp order.
+  std::unique_ptr<typename Database<Logged>::Iterator> ScanEntriesByTime(
+      uint64_t begin, uint64_t end) const override;
+
   typename Database<Logged>::WriteResult WriteTreeHead_(
       const ct::SignedTreeHead& sth) override;
 
@@ -53,6 +77,8 @@ class LevelDB : public Database<Logged> {
 
   int64_t TreeSize() const override;
 
+  std::vector<int64_t> SparseEntries() const override;
+
   void AddNotifySTHCallback(
       const typename Database<Logged>::NotifySTHCallback* callback) override;
 
@@ -64,32 +90,81 @@ class LevelDB : public Database<Logged> {
   typename Database<Logged>::LookupResult NodeId(
       std::string* node_id) override;
 
+  // These are only maintained with --leveldb_subtree_hashes.
+  typename Database<Logged>::LookupResult LookupSubtreeHash(
+      int level, int64_t index, std::string* hash) const override;
+
+  // Deletes the hash index, the subtree hashes and the time index of
+  // the database in |dbfile|, which must not be open, so that they are
+  // rebuilt from the entries the next time it is opened. Building the
+  // hash index records its progress, and carries on from there if
+  // interrupted: if it was, this does nothing, so that it is not
+  // restarted.
+  static void DropIndexes(const std::string& dbfile);
+
  private:
   class Iterator;
+  class LeafIterator;
+  class LeafHashIterator;
+  class TimeIterator;
 
+  void LoadDictionaries();
+  std::string CompressEntry(const std::string& data) const;
+  bool ParseEntry(leveldb::Slice value, Logged* logged) const;
   void BuildIndex();
+  void BuildTimeIndex();
   typename Database<Logged>::LookupResult LatestTreeHeadNoLock(
       ct::SignedTreeHead* result) const;
-  void InsertEntryMapping(int64_t sequence_number, const std::string& hash);
-
+  typename Database<Logged>::WriteResult WriteEntries(
+      const std::vector<const Logged*>& logged);
+  void IndexHash(const std::string& hash, int64_t sequence_number,
+                 leveldb::WriteBatch* batch,
+                 std::map<std::string, int64_t>* pending) const;
+  void StoreChainCerts(const std::map<std::string, std::string>& certs,
+                       leveldb::WriteBatch* batch,
+                       std::set<std::string>* added) const;
+  void JoinChain(Logged* logged) const;
+  bool SameEntry(const std::string& stored_data,
+                 const std::string& data) const;
+  void InsertEntryMapping(int64_t sequence_number);
+  void UpdateSubtreeHashes();
+
+  // Serializes the writers. Readers don't need it: leveldb is
+  // thread-safe, and the sizes and timestamp they read are atomic.
   mutable std::mutex lock_;
 #ifdef HAVE_LEVELDB_FILTER_POLICY_H
   // filter_policy_ must be valid for at least as long as db_ is, so
   // keep this order.
   const std::unique_ptr<const leveldb::FilterPolicy> filter_policy_;
 #endif
+  // Same for block_cache_, which may be null to use leveldb's default.
+  const std::unique_ptr<leveldb::Cache> block_cache_;
   std::unique_ptr<leveldb::DB> db_;
 
-  int64_t contiguous_size_;
-  std::unordered_map<std::string, int64_t> id_by_hash_;
+  // The dictionaries of the compressed entries, by id, and the one new
+  // entries are compressed with, if any. These are only changed by
+  // the constructor.
+  std::map<uint32_t, std::unique_ptr<const util::DictionaryCompressor>>
+      dictionaries_;
+  const util::DictionaryCompressor* entry_compressor_;
+
+  // Entries are looked up by hash through "hash-" keys in db_, which
+  // are written in the same batch as the entries themselves, as are
+  // the "chaincert-" keys holding their chain certificates, with
+  // --leveldb_shared_chain_certs.
+  std::atomic<int64_t> contiguous_size_;
 
   // This is a mapping of the non-contiguous entries of the log (which
   // can happen while it is being fetched). When entries here become
   // contiguous with the beginning of the tree, they are removed.
   std::set<int64_t> sparse_entries_;
 
-  uint64_t latest_tree_timestamp_;
-  std::string latest_timestamp_key_;
+  // Number of leading entries covered by the stored subtree hashes.
+  int64_t subtree_size_;
+  const TreeHasher tree_hasher_;
+
+  // The tree head with this timestamp is written before this is set.
+  std::atomic<uint64_t> latest_tree_timestamp_;
   cert_trans::DatabaseNotifierHelper callbacks_;
 
   DISALLOW_COPY_AND_ASSIGN(LevelDB);
@@ -4,8 +4,10 @@
 
 #include "log/log_lookup.h"
 
+#include <algorithm>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
-#include <map>
+#include <memory>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string>
@@ -13,93 +15,434 @@
 #include <vector>
 
 #include "base/time_support.h"
+#include "merkletree/batch_paths.h"
+#include "merkletree/digest.h"
 #include "merkletree/merkle_tree.h"
+#include "merkletree/pruned_node_store.h"
 #include "merkletree/serial_hasher.h"
+#include "monitoring/monitoring.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
+#include "util/status.h"
 #include "util/util.h"
 
 
+DECLARE_int32(database_scan_readahead);
+DECLARE_int32(merkle_tree_snapshot_cache_size);
+
 static const int kCtimeBufSize = 26;
 
+static cert_trans::Gauge<std::string>* log_lookup_memory_bytes(
+    cert_trans::Gauge<std::string>::New(
+        "log_lookup_memory_bytes", "structure",
+        "Estimated memory used by the in-memory tree of the log lookup, by "
+        "structure (\"tree\", \"leaf_index\" or \"pending_hashes\")."));
+
+static cert_trans::Counter<>* log_lookup_precomputed_proofs(
+    cert_trans::Counter<>::New(
+        "log_lookup_precomputed_proofs",
+        "Number of audit proofs served from the paths precomputed when "
+        "the entries were added to the tree."));
+
+static cert_trans::Counter<std::string>* snapshot_cache_lookups(
+    cert_trans::Counter<std::string>::New(
+        "merkle_tree_snapshot_cache_lookups", "result",
+        "Number of lookups of past snapshot right edges in the in-memory "
+        "tree of the log lookup, by result (\"hit\" or \"miss\")."));
+
+static cert_trans::Counter<>* log_lookup_subtree_proofs(
+    cert_trans::Counter<>::New(
+        "log_lookup_subtree_proofs",
+        "Number of audit and consistency proofs served from the subtree "
+        "hashes of the database."));
+
 
 template <class Logged>
 LogLookup<Logged>::LogLookup(ReadOnlyDatabase<Logged>* db)
+    : LogLookup(db, "", 0) {
+}
+
+
+template <class Logged>
+LogLookup<Logged>::LogLookup(ReadOnlyDatabase<Logged>* db,
+                             const std::string& checkpoint_path,
+                             int64_t checkpoint_interval)
+    : LogLookup(db, checkpoint_path, checkpoint_interval, false) {
+}
+
+
+template <class Logged>
+LogLookup<Logged>::LogLookup(ReadOnlyDatabase<Logged>* db,
+                             const std::string& checkpoint_path,
+                             int64_t checkpoint_interval, bool deferred)
+    : LogLookup(db, checkpoint_path, checkpoint_interval, deferred, 0) {
+}
+
+
+template <class Logged>
+LogLookup<Logged>::LogLookup(ReadOnlyDatabase<Logged>* db,
+                             const std::string& checkpoint_path,
+                             int64_t checkpoint_interval, bool deferred,
+                             size_t memory_level)
     : db_(CHECK_NOTNULL(db)),
-      cert_tree_(new Sha256Hasher),
+      memory_level_(memory_level),
+      cert_tree_(NewTree()),
+      checkpoint_(checkpoint_path.empty()
+                      ? nullptr
+                      : new cert_trans::LookupCheckpoint(checkpoint_path)),
+      checkpoint_interval_(checkpoint_interval),
       latest_tree_head_(),
+      precompute_proof_leaves_(0),
+      root_executor_(nullptr),
+      precomputed_tree_size_(0),
+      exported_cache_hits_(0),
+      exported_cache_misses_(0),
       update_from_sth_cb_(std::bind(&LogLookup<Logged>::UpdateFromSTH, this,
-                                    std::placeholders::_1)) {
-  db_->AddNotifySTHCallback(&update_from_sth_cb_);
+                                    std::placeholders::_1)),
+      loaded_(false) {
+  if (checkpoint_) {
+    CHECK_GT(checkpoint_interval_, 0);
+  }
+  if (!deferred) {
+    Load();
+  }
 }
 
 
 template <class Logged>
 LogLookup<Logged>::~LogLookup() {
-  db_->RemoveNotifySTHCallback(&update_from_sth_cb_);
+  if (loaded_) {
+    db_->RemoveNotifySTHCallback(&update_from_sth_cb_);
+  }
 }
 
 
 template <class Logged>
-void LogLookup<Logged>::UpdateFromSTH(const ct::SignedTreeHead& sth) {
-  std::lock_guard<std::mutex> lock(lock_);
+void LogLookup<Logged>::Load() {
+  CHECK(!loaded_);
+  loaded_ = true;
+  if (checkpoint_) {
+    LoadCheckpoint();
+  }
+  // This calls UpdateFromSTH right away, which picks up from wherever
+  // the checkpoint left us.
+  db_->AddNotifySTHCallback(&update_from_sth_cb_);
+}
+
+
+template <class Logged>
+void LogLookup<Logged>::PrecomputeProofs(int64_t max_leaves) {
+  CHECK_GE(max_leaves, 0);
+  std::lock_guard<std::mutex> update_lock(update_lock_);
+  precompute_proof_leaves_ = max_leaves;
+}
 
-  CHECK_EQ(ct::V1, sth.version())
-      << "Tree head signed with an unknown version";
 
-  if (sth.timestamp() == latest_tree_head_.timestamp())
+template <class Logged>
+void LogLookup<Logged>::UpdateRootsOn(util::Executor* executor) {
+  std::lock_guard<std::mutex> update_lock(update_lock_);
+  root_executor_ = executor;
+}
+
+
+template <class Logged>
+void LogLookup<Logged>::ServeProofsFromSubtreeHashes() {
+  ReadOnlyDatabase<Logged>* const db(db_);
+  subtree_prover_.reset(new cert_trans::SubtreeProver(
+      new Sha256Hasher, [db](int level, int64_t index, std::string* hash) {
+        return db->LookupSubtreeHash(level, index, hash) ==
+               ReadOnlyDatabase<Logged>::LOOKUP_OK;
+      }));
+}
+
+
+template <class Logged>
+MerkleTree* LogLookup<Logged>::NewTree() {
+  CHECK_GE(FLAGS_merkle_tree_snapshot_cache_size, 0);
+  const size_t snapshot_cache_size(FLAGS_merkle_tree_snapshot_cache_size);
+  if (memory_level_ == 0) {
+    return new MerkleTree(new Sha256Hasher, snapshot_cache_size);
+  }
+  return new MerkleTree(
+      new Sha256Hasher,
+      new cert_trans::PrunedNodeStore(
+          memory_level_, std::bind(&LogLookup<Logged>::ReadLeafHashes, this,
+                                   std::placeholders::_1,
+                                   std::placeholders::_2),
+          new Sha256Hasher),
+      snapshot_cache_size);
+}
+
+
+template <class Logged>
+std::string LogLookup<Logged>::ReadLeafHashes(size_t begin, size_t end) {
+  std::string leaf_hashes;
+  if (checkpoint_) {
+    const util::Status status(checkpoint_->ReadLeaves(
+        cert_tree_->NodeSize(), begin, end, &leaf_hashes));
+    if (status.ok()) {
+      return leaf_hashes;
+    }
+    LOG_IF(WARNING, status.CanonicalCode() != util::error::OUT_OF_RANGE)
+        << "Reading leaf hashes from the database instead of the tree "
+        << "checkpoint: " << status;
+    leaf_hashes.clear();
+  }
+
+  auto it(db_->ScanLeafHashes(begin));
+  // Reused for each entry, to save on allocations.
+  typename ReadOnlyDatabase<Logged>::LeafHash leaf_hash;
+  for (size_t sequence_number = begin; sequence_number < end;
+       ++sequence_number) {
+    CHECK(it->GetNextLeafHash(&leaf_hash))
+        << "Failed to retrieve entry number " << sequence_number
+        << " to recompute the tree";
+    CHECK_EQ(sequence_number,
+             static_cast<size_t>(leaf_hash.sequence_number));
+    leaf_hashes.append(leaf_hash.hash);
+  }
+  return leaf_hashes;
+}
+
+
+template <class Logged>
+void LogLookup<Logged>::LoadCheckpoint() {
+  ct::LookupCheckpointHeader header;
+  const util::Status status(checkpoint_->Read(
+      cert_tree_->NodeSize(), &header, [this](const std::string& leaf_hash) {
+        const int64_t sequence_number(cert_tree_->AddLeafHash(leaf_hash) - 1);
+        leaf_index_.Insert(leaf_hash, sequence_number);
+      }));
+  if (status.CanonicalCode() == util::error::NOT_FOUND) {
+    LOG(INFO) << "No tree checkpoint found, starting from scratch";
     return;
+  }
 
-  CHECK_LE(0, sth.tree_size());
-  if (sth.timestamp() <= latest_tree_head_.timestamp() ||
-      static_cast<uint64_t>(sth.tree_size()) < cert_tree_.LeafCount()) {
-    LOG(WARNING) << "Database replied with an STH that is older than ours: "
-                 << "Our STH:\n" << latest_tree_head_.DebugString()
-                 << "Database STH:\n" << sth.DebugString();
+  if (status.ok() && CheckpointMatchesDatabase(header)) {
+    LOG(INFO) << "Loaded " << cert_tree_->LeafCount()
+              << " leaf hashes from tree checkpoint";
+    std::lock_guard<std::mutex> lock(lock_);
+    UpdateCompactSnapshot();
+    UpdateMemoryGauges();
     return;
   }
 
-  // Record the new hashes: append all of them, die on any error.
-  // TODO(ekasper): make tree signer write leaves out to the database,
-  // so that we don't have to read the entries in.
-  std::string leaf_hash;
-  auto it(db_->ScanEntries(cert_tree_.LeafCount()));
-  for (int64_t sequence_number = cert_tree_.LeafCount();
-       sequence_number < sth.tree_size(); ++sequence_number) {
-    Logged logged;
-    // TODO(ekasper): perhaps some of these errors can/should be
-    // handled more gracefully. E.g. we could retry a failed update
-    // a number of times -- but until we know under which conditions
-    // the database might fail (database busy?), just die.
-    CHECK(it->GetNextEntry(&logged))
-        << "Latest STH has " << sth.tree_size() << "entries but we failed to "
-        << "retrieve entry number " << sequence_number;
-    CHECK(logged.has_sequence_number())
-        << "Logged entry has no sequence number";
-    CHECK_EQ(sequence_number, logged.sequence_number());
+  LOG(WARNING) << "Ignoring unusable tree checkpoint"
+               << (status.ok() ? "" : ": ") << status.error_message();
+  cert_tree_.reset(NewTree());
+  leaf_index_.Clear();
+  checkpoint_->Discard();
+}
+
 
-    leaf_hash = LeafHash(logged);
-    // TODO(ekasper): plug in the log public key so that we can verify the STH.
-    CHECK_EQ(sequence_number + 1, cert_tree_.AddLeafHash(leaf_hash));
+// Makes sure the checkpoint was taken from this database. Checking the
+// last leaf hash is cheap, and together with the root hash this rules
+// out a checkpoint for another log, or for a database that was reset.
+template <class Logged>
+bool LogLookup<Logged>::CheckpointMatchesDatabase(
+    const ct::LookupCheckpointHeader& header) {
+  if (cert_tree_->CurrentRoot() != header.root_hash()) {
+    LOG(WARNING) << "Tree checkpoint root hash does not match its leaves";
+    return false;
+  }
+  if (header.tree_size() == 0) {
+    return true;
+  }
+  // Every checkpoint is taken at a tree head that was in the database,
+  // so the database should have caught up to it already.
+  ct::SignedTreeHead sth;
+  if (db_->LatestTreeHead(&sth) != ReadOnlyDatabase<Logged>::LOOKUP_OK ||
+      sth.tree_size() < header.tree_size()) {
+    LOG(WARNING) << "Tree checkpoint has " << header.tree_size()
+                 << " entries but the database tree head only has "
+                 << sth.tree_size();
+    return false;
+  }
+
+  typename ReadOnlyDatabase<Logged>::LeafHash leaf_hash;
+  if (!db_->ScanLeafHashes(header.tree_size() - 1)
+           ->GetNextLeafHash(&leaf_hash) ||
+      leaf_hash.sequence_number != header.tree_size() - 1 ||
+      leaf_hash.hash != cert_tree_->LeafHash(header.tree_size())) {
+    LOG(WARNING) << "Tree checkpoint does not match the database entries";
+    return false;
+  }
+  return true;
+}
+
+
+template <class Logged>
+void LogLookup<Logged>::UpdateFromSTH(const ct::SignedTreeHead& sth) {
+  // Readers keep being served from the tree as of the last update while
+  // we fetch the new entries, and only wait for them to be appended.
+  std::lock_guard<std::mutex> update_lock(update_lock_);
+
+  CHECK_EQ(ct::V1, sth.version())
+      << "Tree head signed with an unknown version";
+
+  int64_t tree_size;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (sth.timestamp() == latest_tree_head_.timestamp())
+      return;
+
+    CHECK_LE(0, sth.tree_size());
+    if (sth.timestamp() <= latest_tree_head_.timestamp() ||
+        static_cast<uint64_t>(sth.tree_size()) < cert_tree_->LeafCount()) {
+      LOG(WARNING) << "Database replied with an STH that is older than ours: "
+                   << "Our STH:\n" << latest_tree_head_.DebugString()
+                   << "Database STH:\n" << sth.DebugString();
+      return;
+    }
+    // Only we modify the tree, so this stays valid until we're done.
+    tree_size = cert_tree_->LeafCount();
+  }
+
+  // Record the new hashes: append all of them, die on any error. Some
+  // may have been computed already by RootAtDatabaseSize().
+  HashPendingLeaves(sth.tree_size());
+  const std::vector<std::string> leaf_hashes(
+      pending_hashes_.begin(),
+      pending_hashes_.begin() + (sth.tree_size() - tree_size));
+  pending_hashes_.erase(pending_hashes_.begin(),
+                        pending_hashes_.begin() + leaf_hashes.size());
+
+  std::unique_lock<std::mutex> lock(lock_);
+  for (size_t i = 0; i < leaf_hashes.size(); ++i) {
+    const int64_t sequence_number(tree_size + i);
+    // TODO(ekasper): plug in the log public key so that we can verify the
+    // STH.
+    CHECK_EQ(sequence_number + 1, cert_tree_->AddLeafHash(leaf_hashes[i]));
     // Duplicate leaves shouldn't really happen but are not a problem either:
     // we just return the Merkle proof of the first occurrence.
-    leaf_index_.insert(
-        std::pair<std::string, int64_t>(leaf_hash, sequence_number));
+    leaf_index_.Insert(leaf_hashes[i], sequence_number);
   }
-  CHECK_EQ(util::HexString(cert_tree_.CurrentRoot()),
+  CHECK_EQ(util::HexString(cert_tree_->UpdateRoot(root_executor_)),
            util::HexString(sth.sha256_root_hash()))
       << "Computed root hash and stored STH root hash do not match";
   LOG(INFO) << "Found " << sth.tree_size() - latest_tree_head_.tree_size()
             << " new log entries";
   latest_tree_head_.CopyFrom(sth);
+  UpdateCompactSnapshot();
+  UpdateMemoryGauges();
+
+  // Only the leaves are copied with |lock_| held, they are written and
+  // synced once it is released.
+  std::unique_ptr<cert_trans::LookupCheckpoint::Update> checkpoint_update;
+  if (checkpoint_ &&
+      sth.tree_size() - checkpoint_->tree_size() >= checkpoint_interval_) {
+    checkpoint_update.reset(new cert_trans::LookupCheckpoint::Update(
+        checkpoint_->Prepare(*cert_tree_, sth.sha256_root_hash())));
+  }
+
+  if (precompute_proof_leaves_ > 0) {
+    PrecomputePaths(&lock, leaf_hashes);
+  }
 
   const time_t last_update(static_cast<time_t>(
       latest_tree_head_.timestamp() / cert_trans::kNumMillisPerSecond));
+  lock.unlock();
+
+  if (checkpoint_update) {
+    const util::Status status(checkpoint_->Write(*checkpoint_update));
+    if (status.ok()) {
+      VLOG(1) << "Wrote tree checkpoint at size " << sth.tree_size();
+    } else {
+      LOG(WARNING) << "Failed to write tree checkpoint: " << status;
+    }
+  }
+
   char buf[kCtimeBufSize];
   LOG(INFO) << "Tree successfully updated at " << ctime_r(&last_update, buf);
 }
 
 
+template <class Logged>
+void LogLookup<Logged>::PrecomputePaths(
+    std::unique_lock<std::mutex>* lock,
+    const std::vector<std::string>& leaf_hashes) {
+  const size_t count(std::min<size_t>(leaf_hashes.size(),
+                                      precompute_proof_leaves_));
+  // Without new entries, the paths we have are still those of the
+  // last ones.
+  if (count == 0) {
+    return;
+  }
+  const size_t new_tree_size(cert_tree_->LeafCount());
+  // Only the path of the first leaf needs the nodes to the left of the
+  // new ones, everything else is hashed from the new leaves.
+  const std::vector<std::string> first_path(cert_tree_->PathToRootAtSnapshot(
+      new_tree_size - count + 1, new_tree_size));
+
+  // The tree only changes under |update_lock_|, and the previous paths
+  // stay valid for the previous tree size in the meantime.
+  lock->unlock();
+  std::vector<std::vector<std::string>> paths(cert_trans::PathsOfLastLeaves(
+      TreeHasher(new Sha256Hasher), new_tree_size,
+      std::vector<std::string>(leaf_hashes.end() - count, leaf_hashes.end()),
+      first_path));
+  lock->lock();
+
+  precomputed_paths_.swap(paths);
+  precomputed_tree_size_ = new_tree_size;
+}
+
+
+template <class Logged>
+bool LogLookup<Logged>::CopyPrecomputedPath(
+    int64_t leaf_index, size_t tree_size,
+    ct::ShortMerkleAuditProof* proof) const {
+  if (tree_size != precomputed_tree_size_ || leaf_index < 0) {
+    return false;
+  }
+  const size_t first(precomputed_tree_size_ - precomputed_paths_.size());
+  if (static_cast<size_t>(leaf_index) < first ||
+      static_cast<size_t>(leaf_index) >= precomputed_tree_size_) {
+    return false;
+  }
+  for (const auto& node : precomputed_paths_[leaf_index - first])
+    proof->add_path_node(node);
+  log_lookup_precomputed_proofs->Increment();
+  return true;
+}
+
+
+template <class Logged>
+void LogLookup<Logged>::UpdateCompactSnapshot() {
+  compact_snapshot_ =
+      CompactMerkleTree(*cert_tree_, new Sha256Hasher).GetSnapshot();
+}
+
+
+template <class Logged>
+void LogLookup<Logged>::UpdateMemoryGauges() {
+  log_lookup_memory_bytes->Set("tree", cert_tree_->MemoryBytes());
+  log_lookup_memory_bytes->Set("leaf_index", leaf_index_.MemoryBytes());
+  // The hashes are too long to be stored inline in the strings.
+  log_lookup_memory_bytes->Set(
+      "pending_hashes",
+      pending_hashes_.size() * (sizeof(std::string) + cert_tree_->NodeSize()));
+}
+
+
+template <class Logged>
+void LogLookup<Logged>::ExportSnapshotCacheLookups() {
+  // The tree is only replaced before any proof is served, so its counts
+  // only go up.
+  const size_t hits(cert_tree_->SnapshotCacheHits());
+  const size_t misses(cert_tree_->SnapshotCacheMisses());
+  if (hits > exported_cache_hits_) {
+    snapshot_cache_lookups->IncrementBy("hit", hits - exported_cache_hits_);
+    exported_cache_hits_ = hits;
+  }
+  if (misses > exported_cache_misses_) {
+    snapshot_cache_lookups->IncrementBy("miss",
+                                        misses - exported_cache_misses_);
+    exported_cache_misses_ = misses;
+  }
+}
+
+
 template <class Logged>
 typename LogLookup<Logged>::LookupResult LogLookup<Logged>::GetIndex(
     const std::string& merkle_leaf_hash, int64_t* index) {
@@ -128,15 +471,21 @@ typename LogLookup<Logged>::LookupResult LogLookup<Logged>::AuditProof(
 
   CHECK_GE(leaf_index, 0);
   proof->set_version(ct::V1);
-  proof->set_tree_size(cert_tree_.LeafCount());
+  proof->set_tree_size(cert_tree_->LeafCount());
   proof->set_timestamp(latest_tree_head_.timestamp());
   proof->set_leaf_index(leaf_index);
 
   proof->clear_path_node();
-  std::vector<std::string> audit_path =
-      cert_tree_.PathToCurrentRoot(leaf_index + 1);
-  for (size_t i = 0; i < audit_path.size(); ++i)
-    proof->add_path_node(audit_path[i]);
+  ct::ShortMerkleAuditProof precomputed;
+  if (CopyPrecomputedPath(leaf_index, cert_tree_->LeafCount(),
+                          &precomputed)) {
+    proof->mutable_path_node()->Swap(precomputed.mutable_path_node());
+  } else {
+    std::vector<cert_trans::Digest> audit_path;
+    cert_tree_->PathToCurrentRoot(leaf_index + 1, &audit_path);
+    for (const auto& node : audit_path)
+      proof->add_path_node(node.data(), node.size());
+  }
 
   proof->mutable_id()->CopyFrom(latest_tree_head_.id());
   proof->mutable_tree_head_signature()->CopyFrom(
@@ -148,15 +497,34 @@ typename LogLookup<Logged>::LookupResult LogLookup<Logged>::AuditProof(
 template <class Logged>
 typename LogLookup<Logged>::LookupResult LogLookup<Logged>::AuditProof(
     int64_t leaf_index, size_t tree_size, ct::ShortMerkleAuditProof* proof) {
-  std::lock_guard<std::mutex> lock(lock_);
+  std::unique_lock<std::mutex> lock(lock_);
 
   proof->set_leaf_index(leaf_index);
 
   proof->clear_path_node();
-  std::vector<std::string> audit_path =
-      cert_tree_.PathToRootAtSnapshot(leaf_index + 1, tree_size);
-  for (size_t i = 0; i < audit_path.size(); ++i)
-    proof->add_path_node(audit_path[i]);
+  if (CopyPrecomputedPath(leaf_index, tree_size, proof)) {
+    return OK;
+  }
+  // Only for the tree sizes the tree has, as the database can be ahead.
+  if (subtree_prover_ && tree_size <= cert_tree_->LeafCount()) {
+    lock.unlock();
+    std::vector<std::string> path;
+    if (subtree_prover_
+            ->PathToRootAtSnapshot(leaf_index + 1, tree_size, &path)
+            .ok()) {
+      for (const auto& node : path) {
+        proof->add_path_node(node);
+      }
+      log_lookup_subtree_proofs->Increment();
+      return OK;
+    }
+    lock.lock();
+  }
+  std::vector<cert_trans::Digest> audit_path;
+  cert_tree_->PathToRootAtSnapshot(leaf_index + 1, tree_size, &audit_path);
+  ExportSnapshotCacheLookups();
+  for (const auto& node : audit_path)
+    proof->add_path_node(node.data(), node.size());
 
   return OK;
 }
@@ -176,29 +544,159 @@ typename LogLookup<Logged>::LookupResult LogLookup<Logged>::AuditProof(
 }
 
 
+template <class Logged>
+void LogLookup<Logged>::AuditProofs(
+    const std::vector<std::string>& merkle_leaf_hashes, size_t tree_size,
+    std::vector<ct::ShortMerkleAuditProof>* proofs) {
+  CHECK_NOTNULL(proofs)->resize(merkle_leaf_hashes.size());
+  std::vector<cert_trans::Digest> audit_path;
+  std::unique_lock<std::mutex> lock(lock_);
+  for (size_t i = 0; i < merkle_leaf_hashes.size(); ++i) {
+    ct::ShortMerkleAuditProof* const proof(&(*proofs)[i]);
+    proof->Clear();
+    const int64_t leaf_index(GetIndexInternal(lock, merkle_leaf_hashes[i]));
+    if (leaf_index < 0 || leaf_index >= static_cast<int64_t>(tree_size)) {
+      continue;
+    }
+
+    proof->set_leaf_index(leaf_index);
+    if (CopyPrecomputedPath(leaf_index, tree_size, proof)) {
+      continue;
+    }
+    cert_tree_->PathToRootAtSnapshot(leaf_index + 1, tree_size, &audit_path);
+    for (const auto& node : audit_path)
+      proof->add_path_node(node.data(), node.size());
+  }
+  ExportSnapshotCacheLookups();
+}
+
+
+template <class Logged>
+std::vector<std::string> LogLookup<Logged>::ConsistencyProof(size_t first,
+                                                             size_t second) {
+  std::unique_lock<std::mutex> lock(lock_);
+  if (subtree_prover_ && second <= cert_tree_->LeafCount()) {
+    lock.unlock();
+    std::vector<std::string> proof;
+    if (subtree_prover_->SnapshotConsistency(first, second, &proof).ok()) {
+      log_lookup_subtree_proofs->Increment();
+      return proof;
+    }
+    lock.lock();
+  }
+  std::vector<std::string> proof(
+      cert_tree_->SnapshotConsistency(first, second));
+  ExportSnapshotCacheLookups();
+  return proof;
+}
+
+
 template <class Logged>
 std::string LogLookup<Logged>::RootAtSnapshot(size_t tree_size) {
   std::lock_guard<std::mutex> lock(lock_);
-  return cert_tree_.RootAtSnapshot(tree_size);
+  const std::string root(cert_tree_->RootAtSnapshot(tree_size));
+  ExportSnapshotCacheLookups();
+  return root;
+}
+
+
+template <class Logged>
+std::string LogLookup<Logged>::RootAtDatabaseSize(int64_t tree_size) {
+  std::lock_guard<std::mutex> update_lock(update_lock_);
+  return RootAtDatabaseSizeLocked(tree_size);
+}
+
+
+template <class Logged>
+std::vector<std::string> LogLookup<Logged>::RootsAtDatabaseSizes(
+    const std::vector<int64_t>& tree_sizes) {
+  std::vector<std::string> roots;
+  if (tree_sizes.empty()) {
+    return roots;
+  }
+  std::lock_guard<std::mutex> update_lock(update_lock_);
+  // Read all the new leaf hashes in one scan, rather than one per size.
+  HashPendingLeaves(tree_sizes.back());
+  for (size_t i = 0; i < tree_sizes.size(); ++i) {
+    CHECK(i == 0 || tree_sizes[i - 1] <= tree_sizes[i]);
+    roots.emplace_back(RootAtDatabaseSizeLocked(tree_sizes[i]));
+  }
+  return roots;
+}
+
+
+template <class Logged>
+std::string LogLookup<Logged>::RootAtDatabaseSizeLocked(int64_t tree_size) {
+  CHECK_GE(tree_size, 0);
+  // Only UpdateFromSTH modifies the tree, and it holds |update_lock_|.
+  const int64_t serving_size(cert_tree_->LeafCount());
+  if (tree_size <= serving_size) {
+    return RootAtSnapshot(tree_size);
+  }
+
+  HashPendingLeaves(tree_size);
+  if (!pending_tree_ ||
+      static_cast<int64_t>(pending_tree_->LeafCount()) < serving_size ||
+      static_cast<int64_t>(pending_tree_->LeafCount()) > tree_size) {
+    pending_tree_.reset(new CompactMerkleTree(GetCompactMerkleTreeSnapshot(),
+                                              new Sha256Hasher));
+  }
+  while (static_cast<int64_t>(pending_tree_->LeafCount()) < tree_size) {
+    pending_tree_->AddLeafHash(
+        pending_hashes_[pending_tree_->LeafCount() - serving_size]);
+  }
+
+  return pending_tree_->CurrentRoot();
+}
+
+
+template <class Logged>
+void LogLookup<Logged>::HashPendingLeaves(int64_t tree_size) {
+  const int64_t start(cert_tree_->LeafCount() + pending_hashes_.size());
+  if (tree_size <= start) {
+    return;
+  }
+
+  const size_t readahead(FLAGS_database_scan_readahead);
+  auto it(db_->ScanLeafHashesAhead(
+      start, tree_size - start > static_cast<int64_t>(readahead) ? readahead
+                                                                 : 0));
+  // Reused for each entry, to save on allocations.
+  typename ReadOnlyDatabase<Logged>::LeafHash leaf_hash;
+  for (int64_t sequence_number = start; sequence_number < tree_size;
+       ++sequence_number) {
+    // TODO(ekasper): perhaps some of these errors can/should be
+    // handled more gracefully. E.g. we could retry a failed update
+    // a number of times -- but until we know under which conditions
+    // the database might fail (database busy?), just die.
+    CHECK(it->GetNextLeafHash(&leaf_hash))
+        << "Wanted " << tree_size << " entries but we failed to "
+        << "retrieve entry number " << sequence_number;
+    CHECK_EQ(sequence_number, leaf_hash.sequence_number);
+
+    pending_hashes_.emplace_back(std::move(leaf_hash.hash));
+  }
 }
 
 
 template <class Logged>
 std::string LogLookup<Logged>::LeafHash(const Logged& logged) const {
+  if (!logged.merkle_leaf_hash().empty()) {
+    return logged.merkle_leaf_hash();
+  }
   std::string serialized_leaf;
   CHECK(logged.SerializeForLeaf(&serialized_leaf));
   // We do not need to take the lock for this call into cert_tree_, as
   // this is merely a const forwarder (to another const, thread-safe
   // method).
-  return cert_tree_.LeafHash(serialized_leaf);
+  return cert_tree_->LeafHash(serialized_leaf);
 }
 
 template <class Logged>
 std::unique_ptr<CompactMerkleTree> LogLookup<Logged>::GetCompactMerkleTree(
     SerialHasher* hasher) {
-  std::lock_guard<std::mutex> lock(lock_);
   return std::unique_ptr<CompactMerkleTree>(
-      new CompactMerkleTree(cert_tree_, hasher));
+      new CompactMerkleTree(GetCompactMerkleTreeSnapshot(), hasher));
 }
 
 template <class Logged>
@@ -207,13 +705,13 @@ int64_t LogLookup<Logged>::GetIndexInternal(
     const std::string& merkle_leaf_hash) const {
   CHECK(lock.owns_lock());
 
-  const std::map<std::string, int64_t>::const_iterator it(
-      leaf_index_.find(merkle_leaf_hash));
-  if (it == leaf_index_.end())
-    return -1;
-
-  CHECK_GE(it->second, 0);
-  return it->second;
+  // The index only keeps truncated hashes, check candidates against
+  // the full leaf hashes in the tree.
+  return leaf_index_.Find(merkle_leaf_hash,
+                          [this, &merkle_leaf_hash](int64_t index) {
+                            return cert_tree_->LeafHash(index + 1) ==
+                                   merkle_leaf_hash;
+                          });
 }
 
 
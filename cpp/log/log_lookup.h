@@ -2,26 +2,78 @@
 #ifndef LOG_LOOKUP_H
 #define LOG_LOOKUP_H
 
-#include <map>
+#include <deque>
+#include <memory>
 #include <mutex>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "base/macros.h"
 #include "log/database.h"
+#include "log/leaf_index.h"
+#include "log/lookup_checkpoint.h"
 #include "merkletree/compact_merkle_tree.h"
 #include "merkletree/merkle_tree.h"
+#include "merkletree/subtree_prover.h"
 #include "proto/ct.pb.h"
+#include "util/executor.h"
 
 // Lookups into the database. Read-only, so could also be a mirror.
-// Keeps the entire Merkle Tree in memory to serve audit proofs.
+// Keeps the Merkle Tree in memory to serve audit proofs, either whole
+// or with its lower levels pruned (see merkletree/pruned_node_store.h).
 template <class Logged>
 class LogLookup {
  public:
   // The constructor loads the content from the database.
   explicit LogLookup(ReadOnlyDatabase<Logged>* db);
+  // As above, but first reloads the leaf hashes from the checkpoint at
+  // |checkpoint_path| (see log/lookup_checkpoint.h), if there is one,
+  // so that only newer entries have to be read from the database. The
+  // checkpoint is rewritten whenever the tree has grown by at least
+  // |checkpoint_interval| entries. An empty |checkpoint_path| disables
+  // checkpointing.
+  LogLookup(ReadOnlyDatabase<Logged>* db, const std::string& checkpoint_path,
+            int64_t checkpoint_interval);
+  // As above, but if |deferred| is set, nothing is loaded until Load()
+  // is called, so that it can be done on another thread. Only GetSTH()
+  // can be called in the meantime, and returns an empty STH.
+  LogLookup(ReadOnlyDatabase<Logged>* db, const std::string& checkpoint_path,
+            int64_t checkpoint_interval, bool deferred);
+  // As above, but if |memory_level| is positive, only the levels of
+  // the tree from that one up are kept whole in memory. The nodes
+  // below are recomputed when serving proofs, from the leaf hashes in
+  // the checkpoint if they are there, from the database entries
+  // otherwise.
+  LogLookup(ReadOnlyDatabase<Logged>* db, const std::string& checkpoint_path,
+            int64_t checkpoint_interval, bool deferred, size_t memory_level);
   ~LogLookup();
 
+  // Loads the content from the checkpoint and the database, when
+  // constructed with |deferred| set. Must only be called once.
+  void Load();
+
+  // Makes each update compute the audit paths, in the new tree, of up
+  // to |max_leaves| of the entries it adds (the latest ones), all in
+  // one pass, so that the proofs for the newly merged entries, which
+  // are the ones most asked for, are served without walking the tree.
+  // Zero (the default) turns it off.
+  void PrecomputeProofs(int64_t max_leaves);
+
+  // Makes each update hash the new nodes of the tree in parallel on
+  // |executor| (see MerkleTree::UpdateRoot()), which is worth it when
+  // loading the tree, or catching up after falling behind. Null (the
+  // default) hashes them on the updating thread.
+  void UpdateRootsOn(util::Executor* executor);
+
+  // Makes the audit and consistency proofs (other than those of
+  // AuditProofs()) be computed from the perfect subtree hashes the
+  // database stores (see ReadOnlyDatabase::LookupSubtreeHash()),
+  // without holding the lock on the tree, falling back to the tree for
+  // those whose hashes are not there (yet). Must be called before any
+  // proof is served.
+  void ServeProofsFromSubtreeHashes();
+
   enum LookupResult {
     OK,
     NOT_FOUND,
@@ -44,11 +96,16 @@ class LogLookup {
   LookupResult AuditProof(const std::string& merkle_leaf_hash,
                           size_t tree_size, ct::ShortMerkleAuditProof* proof);
 
+  // As above, for all of |merkle_leaf_hashes| at once, holding the
+  // lock only once. |proofs| gets one proof per hash, in the same
+  // order, left empty (without a leaf index) for the hashes that are
+  // not in the tree of |tree_size|.
+  void AuditProofs(const std::vector<std::string>& merkle_leaf_hashes,
+                   size_t tree_size,
+                   std::vector<ct::ShortMerkleAuditProof>* proofs);
+
   // Get a consitency proof between two tree heads
-  std::vector<std::string> ConsistencyProof(size_t first, size_t second) {
-    std::lock_guard<std::mutex> lock(lock_);
-    return cert_tree_.SnapshotConsistency(first, second);
-  }
+  std::vector<std::string> ConsistencyProof(size_t first, size_t second);
 
   const ct::SignedTreeHead& GetSTH() const {
     std::lock_guard<std::mutex> lock(lock_);
@@ -57,30 +114,114 @@ class LogLookup {
 
   std::string RootAtSnapshot(size_t tree_size);
 
+  // Returns the root of the tree made of the first |tree_size| entries
+  // in the database, which can be ahead of the latest STH (when
+  // validating an STH before writing it, for example). The leaf hashes
+  // of the entries past the latest STH are kept, so that they are not
+  // computed again when the tree is updated to include them.
+  std::string RootAtDatabaseSize(int64_t tree_size);
+
+  // The roots at each of |tree_sizes|, which must be in increasing
+  // order, as RootAtDatabaseSize() would return them, but computed in
+  // a single pass over the entries.
+  std::vector<std::string> RootsAtDatabaseSizes(
+      const std::vector<int64_t>& tree_sizes);
+
   std::string LeafHash(const Logged& logged) const;
 
+  // A snapshot of the current state of our MerkleTree, as of the last
+  // update, from which CompactMerkleTrees can be forked cheaply.
+  CompactMerkleTree::Snapshot GetCompactMerkleTreeSnapshot() const {
+    std::lock_guard<std::mutex> lock(lock_);
+    return compact_snapshot_;
+  }
+
   // Creates a CompactMerkleTree based on the current state of our MerkleTree.
   // Takes ownership of |hasher|.
   std::unique_ptr<CompactMerkleTree> GetCompactMerkleTree(
       SerialHasher* hasher);
 
  private:
+  MerkleTree* NewTree();
+  // Returns the leaf hashes of the entries in [begin, end),
+  // concatenated, for a pruned tree. Called with |lock_| held.
+  std::string ReadLeafHashes(size_t begin, size_t end);
+  void LoadCheckpoint();
+  bool CheckpointMatchesDatabase(const ct::LookupCheckpointHeader& header);
   void UpdateFromSTH(const ct::SignedTreeHead& sth);
+  // Takes a new |compact_snapshot_| of |cert_tree_|. Must be called
+  // with |lock_| held.
+  void UpdateCompactSnapshot();
+  // Appends the leaf hashes of the entries up to |tree_size| to
+  // |pending_hashes_|. Must be called with |update_lock_| held.
+  void HashPendingLeaves(int64_t tree_size);
+  // RootAtDatabaseSize(), with |update_lock_| held.
+  std::string RootAtDatabaseSizeLocked(int64_t tree_size);
+  // Sets the memory gauges. Must be called with |update_lock_| and
+  // |lock_| held, or before loading is done.
+  void UpdateMemoryGauges();
+  // Adds the lookups in the snapshot cache of |cert_tree_| since the
+  // last call to the merkle_tree_snapshot_cache_lookups counter. Must
+  // be called with |lock_| held.
+  void ExportSnapshotCacheLookups();
   int64_t GetIndexInternal(const std::unique_lock<std::mutex>& lock,
                            const std::string& merkle_leaf_hash) const;
-
+  // Computes the paths for |precomputed_paths_| from the last of
+  // |leaf_hashes|, the entries just added. Must be called with
+  // |update_lock_| held, and |lock| (on |lock_|) locked, which is
+  // released while hashing.
+  void PrecomputePaths(std::unique_lock<std::mutex>* lock,
+                       const std::vector<std::string>& leaf_hashes);
+  // Copies the precomputed path of |leaf_index| in the tree of
+  // |tree_size| into |proof|, if there is one. Must be called with
+  // |lock_| held.
+  bool CopyPrecomputedPath(int64_t leaf_index, size_t tree_size,
+                           ct::ShortMerkleAuditProof* proof) const;
+
+  // Serializes calls to UpdateFromSTH, which only holds |lock_| while
+  // appending entries it already fetched and hashed.
+  std::mutex update_lock_;
   mutable std::mutex lock_;
   // We keep a hash -> index mapping in memory so that we can quickly serve
   // Merkle proofs without having to query the database at all.
-  // Note that 32 bytes is an overkill and we can optimize this to use
-  // a shorter prefix (possibly with a multimap).
-  std::map<std::string, int64_t> leaf_index_;
+  cert_trans::LeafIndex leaf_index_;
 
   ReadOnlyDatabase<Logged>* const db_;
-  MerkleTree cert_tree_;
+  const size_t memory_level_;
+  // Only replaced if a checkpoint turns out to be unusable, before
+  // the first update from the database.
+  std::unique_ptr<MerkleTree> cert_tree_;
+  const std::unique_ptr<cert_trans::LookupCheckpoint> checkpoint_;
+  const int64_t checkpoint_interval_;
   ct::SignedTreeHead latest_tree_head_;
+  // The state of |cert_tree_|, kept up to date along with it, so that
+  // compact trees can be made from it without going through the tree.
+  CompactMerkleTree::Snapshot compact_snapshot_;
+
+  // Guarded by |update_lock_|. The leaf hashes of the entries following
+  // the ones in |cert_tree_|, and a compact tree of all of them up to
+  // some size, which RootAtDatabaseSize() extends as needed.
+  std::deque<std::string> pending_hashes_;
+  std::unique_ptr<CompactMerkleTree> pending_tree_;
+
+  // Set by ServeProofsFromSubtreeHashes(), if at all.
+  std::unique_ptr<cert_trans::SubtreeProver> subtree_prover_;
+
+  // Guarded by |update_lock_|. Set by PrecomputeProofs().
+  int64_t precompute_proof_leaves_;
+  // Guarded by |update_lock_|. Set by UpdateRootsOn().
+  util::Executor* root_executor_;
+  // Guarded by |lock_|. The audit paths, in the tree of
+  // |precomputed_tree_size_| entries, of its last ones.
+  size_t precomputed_tree_size_;
+  std::vector<std::vector<std::string>> precomputed_paths_;
+  // Guarded by |lock_|. The snapshot cache lookups of |cert_tree_|
+  // already exported.
+  size_t exported_cache_hits_;
+  size_t exported_cache_misses_;
 
   const typename Database<Logged>::NotifySTHCallback update_from_sth_cb_;
+  bool loaded_;
 
   DISALLOW_COPY_AND_ASSIGN(LogLookup);
 };
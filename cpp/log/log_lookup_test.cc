@@ -1,4 +1,5 @@
 /* -*- indent-tabs-mode: nil -*- */
+#include <gflags/gflags.h>
 #include <gtest/gtest.h>
 #include <memory>
 #include <string>
@@ -6,6 +7,7 @@
 #include "log/etcd_consistent_store.h"
 #include "log/file_db.h"
 #include "log/file_storage.h"
+#include "log/leveldb_db.h"
 #include "log/log_lookup.h"
 #include "log/log_signer.h"
 #include "log/log_verifier.h"
@@ -14,6 +16,7 @@
 #include "log/test_db.h"
 #include "log/test_signer.h"
 #include "log/tree_signer.h"
+#include "merkletree/merkle_tree.h"
 #include "merkletree/merkle_verifier.h"
 #include "merkletree/serial_hasher.h"
 #include "util/fake_etcd.h"
@@ -23,6 +26,8 @@
 #include "util/thread_pool.h"
 #include "util/util.h"
 
+DECLARE_bool(leveldb_subtree_hashes);
+
 namespace {
 
 namespace libevent = cert_trans::libevent;
@@ -36,10 +41,12 @@ using cert_trans::ThreadPool;
 using cert_trans::TreeSigner;
 using ct::MerkleAuditProof;
 using ct::SequenceMapping;
+using ct::ShortMerkleAuditProof;
 using std::make_shared;
 using std::string;
 using std::shared_ptr;
 using std::unique_ptr;
+using std::vector;
 using testing::NiceMock;
 
 typedef Database<LoggedCertificate> DB;
@@ -61,7 +68,7 @@ class LogLookupTest : public ::testing::Test {
         tree_signer_(std::chrono::duration<double>(0), db(),
                      unique_ptr<CompactMerkleTree>(
                          new CompactMerkleTree(new Sha256Hasher)),
-                     &store_, TestSigner::DefaultLogSigner()),
+                     &store_, TestSigner::DefaultLogSigner(), &pool_),
         verifier_(TestSigner::DefaultLogSigVerifier(),
                   new MerkleVerifier(new Sha256Hasher())) {
     // Set some noddy STH so that we can call UpdateTree on the Tree Signer.
@@ -97,6 +104,10 @@ class LogLookupTest : public ::testing::Test {
     CHECK(this->store_.GetSequenceMapping(&mapping).ok());
 
     for (const auto& m : mapping.Entry().mapping()) {
+      // Skip entries already integrated by a previous update.
+      if (m.sequence_number() < this->db()->TreeSize()) {
+        continue;
+      }
       EntryHandle<LoggedCertificate> entry;
       CHECK_EQ(util::Status::OK,
                this->store_.GetPendingEntryForHash(m.entry_hash(), &entry));
@@ -114,6 +125,16 @@ class LogLookupTest : public ::testing::Test {
     return test_db_.db();
   }
 
+  void ExpectVerifies(LL* lookup, const LoggedCertificate& logged_cert) {
+    MerkleAuditProof proof;
+    EXPECT_EQ(LL::OK,
+              lookup->AuditProof(logged_cert.merkle_leaf_hash(), &proof));
+    EXPECT_EQ(LogVerifier::VERIFY_OK,
+              this->verifier_.VerifyMerkleAuditProof(logged_cert.entry(),
+                                                     logged_cert.sct(),
+                                                     proof));
+  }
+
 
   TestDB<T> test_db_;
   shared_ptr<libevent::Base> base_;
@@ -148,6 +169,22 @@ TYPED_TEST(LogLookupTest, Lookup) {
 }
 
 
+TYPED_TEST(LogLookupTest, DeferredLoad) {
+  LoggedCertificate logged_cert;
+  this->test_signer_.CreateUnique(&logged_cert);
+  this->CreateSequencedEntry(&logged_cert, 0);
+  this->UpdateTree();
+
+  LL lookup(this->db(), "", 0, true /* deferred */);
+  EXPECT_EQ(0, lookup.GetSTH().tree_size());
+
+  lookup.Load();
+  EXPECT_EQ(1, lookup.GetSTH().tree_size());
+  MerkleAuditProof proof;
+  EXPECT_EQ(LL::OK, lookup.AuditProof(logged_cert.merkle_leaf_hash(), &proof));
+}
+
+
 TYPED_TEST(LogLookupTest, NotFound) {
   LoggedCertificate logged_cert;
   this->test_signer_.CreateUnique(&logged_cert);
@@ -223,10 +260,235 @@ TYPED_TEST(LogLookupTest, VerifyWithPath) {
 }
 
 
+TYPED_TEST(LogLookupTest, AuditProofs) {
+  LoggedCertificate logged_certs[13];
+  for (int i = 0; i < 13; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    this->CreateSequencedEntry(&logged_certs[i], i);
+  }
+  this->UpdateTree();
+
+  LL lookup(this->db());
+  LoggedCertificate missing;
+  this->test_signer_.CreateUnique(&missing);
+  vector<string> hashes;
+  for (int i = 12; i >= 0; --i) {
+    hashes.push_back(logged_certs[i].merkle_leaf_hash());
+  }
+  hashes.push_back(lookup.LeafHash(missing));
+
+  // The last entries are past that tree size.
+  const size_t tree_size(9);
+  vector<ShortMerkleAuditProof> proofs;
+  lookup.AuditProofs(hashes, tree_size, &proofs);
+  ASSERT_EQ(hashes.size(), proofs.size());
+  for (size_t i = 0; i < hashes.size(); ++i) {
+    ShortMerkleAuditProof proof;
+    if (i < 4 || i == hashes.size() - 1) {
+      EXPECT_FALSE(proofs[i].has_leaf_index()) << i;
+      EXPECT_EQ(0, proofs[i].path_node_size()) << i;
+      continue;
+    }
+    ASSERT_EQ(LL::OK, lookup.AuditProof(hashes[i], tree_size, &proof));
+    EXPECT_EQ(proof.DebugString(), proofs[i].DebugString()) << i;
+  }
+}
+
+
+TYPED_TEST(LogLookupTest, PrecomputedProofs) {
+  LoggedCertificate logged_certs[13];
+  for (int i = 0; i < 13; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+  }
+  LL lookup(this->db(), "", 0, true /* deferred */);
+  lookup.PrecomputeProofs(4);
+  lookup.Load();
+
+  for (int i = 0; i < 7; ++i) {
+    this->CreateSequencedEntry(&logged_certs[i], i);
+  }
+  this->UpdateTree();
+  for (int i = 7; i < 13; ++i) {
+    this->CreateSequencedEntry(&logged_certs[i], i);
+  }
+  this->UpdateTree();
+  ASSERT_EQ(13, lookup.GetSTH().tree_size());
+
+  // Only the proofs of the last 4 entries in the latest tree are
+  // precomputed, the others must come out the same anyway.
+  LL expected(this->db());
+  for (const size_t tree_size : {13, 7}) {
+    for (size_t i = 0; i < tree_size; ++i) {
+      ShortMerkleAuditProof proof, expected_proof;
+      ASSERT_EQ(LL::OK, lookup.AuditProof(i, tree_size, &proof));
+      ASSERT_EQ(LL::OK, expected.AuditProof(i, tree_size, &expected_proof));
+      EXPECT_EQ(expected_proof.DebugString(), proof.DebugString())
+          << i << " of " << tree_size;
+    }
+  }
+  for (int i = 0; i < 13; ++i) {
+    this->ExpectVerifies(&lookup, logged_certs[i]);
+  }
+}
+
+
+TYPED_TEST(LogLookupTest, RootAtDatabaseSize) {
+  LoggedCertificate logged_certs[11];
+  MerkleTree tree(new Sha256Hasher);
+  LL lookup(this->db());
+
+  for (int i = 0; i < 11; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    string serialized_leaf;
+    CHECK(logged_certs[i].SerializeForLeaf(&serialized_leaf));
+    tree.AddLeaf(serialized_leaf);
+  }
+  for (int i = 0; i < 5; ++i) {
+    this->CreateSequencedEntry(&logged_certs[i], i);
+  }
+  this->UpdateTree();
+
+  // Entries the lookup has not been told about by an STH yet.
+  for (int i = 5; i < 11; ++i) {
+    logged_certs[i].set_sequence_number(i);
+    CHECK_EQ(this->db()->OK, this->db()->CreateSequencedEntry(logged_certs[i]));
+  }
+
+  for (const int size : {3, 8, 11, 7}) {
+    EXPECT_EQ(tree.RootAtSnapshot(size), lookup.RootAtDatabaseSize(size));
+  }
+  EXPECT_EQ(5, lookup.GetSTH().tree_size());
+
+  const vector<int64_t> sizes{2, 6, 6, 9, 11};
+  const vector<string> roots(lookup.RootsAtDatabaseSizes(sizes));
+  ASSERT_EQ(sizes.size(), roots.size());
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    EXPECT_EQ(tree.RootAtSnapshot(sizes[i]), roots[i]) << sizes[i];
+  }
+  EXPECT_TRUE(lookup.RootsAtDatabaseSizes(vector<int64_t>()).empty());
+}
+
+
+TYPED_TEST(LogLookupTest, RestartFromCheckpoint) {
+  TmpStorage tmp;
+  const string checkpoint(tmp.TmpStorageDir() + "/checkpoint");
+  LoggedCertificate logged_certs[13];
+  LL lookup(this->db(), checkpoint, 1);
+
+  for (int i = 0; i < 7; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    this->CreateSequencedEntry(&logged_certs[i], i);
+  }
+  this->UpdateTree();
+
+  {
+    LL restarted(this->db(), checkpoint, 1);
+    for (int i = 0; i < 7; ++i) {
+      this->ExpectVerifies(&restarted, logged_certs[i]);
+    }
+  }
+
+  // The second checkpoint only appends the new leaf hashes.
+  for (int i = 7; i < 13; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    this->CreateSequencedEntry(&logged_certs[i], i);
+  }
+  this->UpdateTree();
+
+  ct::LookupCheckpointHeader header;
+  int leaves(0);
+  cert_trans::LookupCheckpoint reader(checkpoint);
+  ASSERT_TRUE(reader
+                  .Read(32, &header,
+                        [&leaves](const string&) { ++leaves; })
+                  .ok());
+  EXPECT_EQ(13, header.tree_size());
+  EXPECT_EQ(13, leaves);
+  EXPECT_EQ(lookup.GetSTH().sha256_root_hash(), header.root_hash());
+
+  LL restarted(this->db(), checkpoint, 1);
+  for (int i = 0; i < 13; ++i) {
+    this->ExpectVerifies(&restarted, logged_certs[i]);
+  }
+}
+
+
+TYPED_TEST(LogLookupTest, IgnoresCorruptCheckpoint) {
+  TmpStorage tmp;
+  const string checkpoint(tmp.TmpStorageDir() + "/checkpoint");
+  LoggedCertificate logged_certs[5];
+  {
+    LL lookup(this->db(), checkpoint, 1);
+    for (int i = 0; i < 5; ++i) {
+      this->test_signer_.CreateUnique(&logged_certs[i]);
+      this->CreateSequencedEntry(&logged_certs[i], i);
+    }
+    this->UpdateTree();
+  }
+
+  // Clobber the first leaf hash.
+  FILE* fp(fopen((checkpoint + ".leaves").c_str(), "r+b"));
+  ASSERT_TRUE(fp != nullptr);
+  ASSERT_EQ(32U, fwrite(string(32, 'x').data(), 1, 32, fp));
+  fclose(fp);
+
+  LL lookup(this->db(), checkpoint, 1);
+  for (int i = 0; i < 5; ++i) {
+    this->ExpectVerifies(&lookup, logged_certs[i]);
+  }
+}
+
+
+typedef LogLookupTest<LevelDB<LoggedCertificate>> LevelDBLogLookupTest;
+
+
+TEST_F(LevelDBLogLookupTest, ProofsFromSubtreeHashes) {
+  LoggedCertificate logged_certs[13];
+  for (int i = 0; i < 13; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+  }
+  LL lookup(this->db(), "", 0, true /* deferred */);
+  lookup.ServeProofsFromSubtreeHashes();
+  lookup.Load();
+
+  for (int i = 0; i < 7; ++i) {
+    this->CreateSequencedEntry(&logged_certs[i], i);
+  }
+  this->UpdateTree();
+  for (int i = 7; i < 13; ++i) {
+    this->CreateSequencedEntry(&logged_certs[i], i);
+  }
+  this->UpdateTree();
+  ASSERT_EQ(13, lookup.GetSTH().tree_size());
+
+  // The proofs come out the same as from the tree.
+  LL expected(this->db());
+  for (size_t tree_size = 1; tree_size <= 13; ++tree_size) {
+    for (size_t i = 0; i < tree_size; ++i) {
+      ShortMerkleAuditProof proof, expected_proof;
+      ASSERT_EQ(LL::OK, lookup.AuditProof(i, tree_size, &proof));
+      ASSERT_EQ(LL::OK, expected.AuditProof(i, tree_size, &expected_proof));
+      EXPECT_EQ(expected_proof.DebugString(), proof.DebugString())
+          << i << " of " << tree_size;
+    }
+    for (size_t first = 1; first < tree_size; ++first) {
+      EXPECT_EQ(expected.ConsistencyProof(first, tree_size),
+                lookup.ConsistencyProof(first, tree_size))
+          << first << " to " << tree_size;
+    }
+  }
+  for (int i = 0; i < 13; ++i) {
+    this->ExpectVerifies(&lookup, logged_certs[i]);
+  }
+}
+
+
 }  // namespace
 
 
 int main(int argc, char** argv) {
   cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  // For LevelDBLogLookupTest, the only one using LevelDB.
+  FLAGS_leveldb_subtree_hashes = true;
   return RUN_ALL_TESTS();
 }
@@ -44,9 +44,35 @@ LogSigVerifier::VerifyResult ConvertStatus(const Verifier::Status status) {
 LogSigner::LogSigner(EVP_PKEY* pkey) : cert_trans::Signer(pkey) {
 }
 
+LogSigner::LogSigner(std::unique_ptr<cert_trans::Signer> signer)
+    : delegate_(std::move(signer)) {
+  CHECK(delegate_);
+}
+
 LogSigner::~LogSigner() {
 }
 
+string LogSigner::KeyID() const {
+  return delegate_ ? delegate_->KeyID() : cert_trans::Signer::KeyID();
+}
+
+void LogSigner::Sign(const string& data, DigitallySigned* signature) const {
+  if (delegate_) {
+    delegate_->Sign(data, signature);
+  } else {
+    cert_trans::Signer::Sign(data, signature);
+  }
+}
+
+void LogSigner::SignAsync(const string& data, DigitallySigned* signature,
+                          util::Task* task) const {
+  if (delegate_) {
+    delegate_->SignAsync(data, signature, task);
+  } else {
+    cert_trans::Signer::SignAsync(data, signature, task);
+  }
+}
+
 LogSigner::SignResult LogSigner::SignV1CertificateTimestamp(
     uint64_t timestamp, const string& leaf_certificate,
     const string& extensions, string* result) const {
@@ -2,6 +2,7 @@
 #define LOG_SIGNER_H
 
 #include <openssl/evp.h>
+#include <memory>
 #include <openssl/x509.h>  // for i2d_PUBKEY
 #include <stdint.h>
 
@@ -13,8 +14,19 @@
 class LogSigner : public cert_trans::Signer {
  public:
   explicit LogSigner(EVP_PKEY* pkey);
+  // Signs using |signer|, for example a cert_trans::BatchingSigner
+  // holding its key in an HSM.
+  explicit LogSigner(std::unique_ptr<cert_trans::Signer> signer);
   virtual ~LogSigner();
 
+  std::string KeyID() const override;
+
+  void Sign(const std::string& data,
+            ct::DigitallySigned* signature) const override;
+
+  void SignAsync(const std::string& data, ct::DigitallySigned* signature,
+                 util::Task* task) const override;
+
   enum SignResult {
     OK,
     INVALID_ENTRY_TYPE,
@@ -54,6 +66,9 @@ class LogSigner : public cert_trans::Signer {
 
  private:
   static SignResult GetSerializeError(Serializer::SerializeResult result);
+
+  // Set when not signing with our own key.
+  const std::unique_ptr<cert_trans::Signer> delegate_;
 };
 
 class LogSigVerifier : public cert_trans::Verifier {
@@ -1,12 +1,71 @@
 #include "log/logged_certificate.h"
 
+#include "merkletree/tree_hasher.h"
+
 using ct::LogEntry;
 using ct::PreCert;
 using ct::SignedCertificateTimestamp;
+using google::protobuf::RepeatedPtrField;
+using std::function;
+using std::map;
+using std::string;
 
 namespace cert_trans {
 
 
+bool LoggedCertificate::ComputeMerkleLeafHash() {
+  std::string leaf;
+  if (!SerializeForLeaf(&leaf)) {
+    clear_merkle_leaf_hash();
+    return false;
+  }
+  set_merkle_leaf_hash(TreeHasher(new Sha256Hasher).HashLeaf(leaf));
+  return true;
+}
+
+
+void LoggedCertificate::SplitChain(map<string, string>* certs) {
+  CHECK_NOTNULL(certs);
+  CHECK_EQ(0, chain_certificate_hashes_size());
+  RepeatedPtrField<string>* const chain(mutable_chain());
+  for (string& cert : *chain) {
+    const string hash(Sha256Hasher::Sha256Digest(cert));
+    add_chain_certificate_hashes(hash);
+    (*certs)[hash].swap(cert);
+  }
+  chain->Clear();
+}
+
+
+bool LoggedCertificate::JoinChain(
+    const function<bool(const string& hash, string* cert)>& lookup) {
+  if (chain_certificate_hashes_size() == 0) {
+    return true;
+  }
+  RepeatedPtrField<string>* const chain(mutable_chain());
+  CHECK_EQ(0, chain->size());
+  for (const string& hash : chain_certificate_hashes()) {
+    string* const cert(chain->Add());
+    if (!lookup(hash, cert) || Sha256Hasher::Sha256Digest(*cert) != hash) {
+      chain->Clear();
+      return false;
+    }
+  }
+  clear_chain_certificate_hashes();
+  return true;
+}
+
+
+RepeatedPtrField<string>* LoggedCertificate::mutable_chain() {
+  if (entry().type() == ct::X509_ENTRY) {
+    return mutable_entry()->mutable_x509_entry()->mutable_certificate_chain();
+  }
+  return mutable_entry()
+      ->mutable_precert_entry()
+      ->mutable_precertificate_chain();
+}
+
+
 bool LoggedCertificate::CopyFromClientLogEntry(
     const AsyncLogClient::Entry& entry) {
   if (entry.leaf.timestamped_entry().entry_type() != ct::X509_ENTRY &&
@@ -3,7 +3,10 @@
 #ifndef LOGGED_CERTIFICATE_H
 #define LOGGED_CERTIFICATE_H
 
+#include <functional>
 #include <glog/logging.h>
+#include <map>
+#include <string>
 
 #include "client/async_log_client.h"
 #include "merkletree/serial_hasher.h"
@@ -43,7 +46,11 @@ class LoggedCertificate : public ct::LoggedCertificatePB {
     return contents().SerializeToString(dst);
   }
 
+  // Replaces the whole entry, not just the contents, so that an
+  // instance can be reused for reading several entries.
   bool ParseFromDatabase(const std::string& src) {
+    clear_sequence_number();
+    clear_merkle_leaf_hash();
     return mutable_contents()->ParseFromString(src);
   }
 
@@ -52,6 +59,17 @@ class LoggedCertificate : public ct::LoggedCertificatePB {
            Serializer::OK;
   }
 
+  // Sets merkle_leaf_hash to the Merkle tree hash of
+  // SerializeForLeaf(), which is then stored along with the entry, so
+  // that sequencing, the tree and lookups don't have to serialize and
+  // hash the leaf again. It isn't updated when the SCT or the entry
+  // change, so only call it once they are final.
+  bool ComputeMerkleLeafHash();
+
+  bool SerializeSCT(std::string* dst) const {
+    return Serializer::SerializeSCT(sct(), dst) == Serializer::OK;
+  }
+
   bool SerializeExtraData(std::string* dst) const {
     if (entry().type() == ct::X509_ENTRY)
       return Serializer::SerializeX509Chain(entry().x509_entry(), dst) ==
@@ -61,6 +79,19 @@ class LoggedCertificate : public ct::LoggedCertificatePB {
                                                     dst) == Serializer::OK;
   }
 
+  // Moves the certificates of the chain to |certs|, keyed by their
+  // SHA-256 hash, leaving the hashes in chain_certificate_hashes, so
+  // that a database can store the certificates once for all the
+  // entries that share them.
+  void SplitChain(std::map<std::string, std::string>* certs);
+
+  // Puts back the certificates moved out by SplitChain(), which
+  // |lookup| returns by hash. Returns false if one of them is missing,
+  // or doesn't have the right hash. Does nothing if the chain wasn't
+  // split.
+  bool JoinChain(const std::function<bool(const std::string& hash,
+                                          std::string* cert)>& lookup);
+
   // Note that this method will not fully populate the SCT.
   bool CopyFromClientLogEntry(const AsyncLogClient::Entry& entry);
 
@@ -114,6 +145,9 @@ class LoggedCertificate : public ct::LoggedCertificatePB {
       }
     }
   }
+
+ private:
+  google::protobuf::RepeatedPtrField<std::string>* mutable_chain();
 };
 
 
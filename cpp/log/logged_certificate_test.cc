@@ -1,6 +1,83 @@
 #include "log/logged_certificate.h"
 
 #include <gtest/gtest.h>
+#include <map>
+#include <string>
+
+#include "merkletree/tree_hasher.h"
+
+namespace {
+
+
+TEST(LoggedCertificateTest, ComputeMerkleLeafHash) {
+  cert_trans::LoggedCertificate logged;
+  logged.RandomForTest();
+  EXPECT_TRUE(logged.merkle_leaf_hash().empty());
+
+  ASSERT_TRUE(logged.ComputeMerkleLeafHash());
+  std::string leaf;
+  ASSERT_TRUE(logged.SerializeForLeaf(&leaf));
+  EXPECT_EQ(TreeHasher(new Sha256Hasher).HashLeaf(leaf),
+            logged.merkle_leaf_hash());
+
+  // It is kept with the entry.
+  std::string serialized;
+  ASSERT_TRUE(logged.SerializeToString(&serialized));
+  cert_trans::LoggedCertificate parsed;
+  ASSERT_TRUE(parsed.ParseFromString(serialized));
+  EXPECT_EQ(logged.merkle_leaf_hash(), parsed.merkle_leaf_hash());
+}
+
+
+TEST(LoggedCertificateTest, SplitAndJoinChain) {
+  cert_trans::LoggedCertificate logged;
+  do {
+    logged.RandomForTest();
+  } while (logged.entry().type() != ct::X509_ENTRY);
+  ct::X509ChainEntry* const entry(
+      logged.mutable_entry()->mutable_x509_entry());
+  entry->clear_certificate_chain();
+  entry->add_certificate_chain("intermediate");
+  entry->add_certificate_chain("root");
+  entry->add_certificate_chain("intermediate");
+  const cert_trans::LoggedCertificate original(logged);
+
+  std::map<std::string, std::string> certs;
+  logged.SplitChain(&certs);
+  EXPECT_EQ(0, logged.entry().x509_entry().certificate_chain_size());
+  ASSERT_EQ(3, logged.chain_certificate_hashes_size());
+  EXPECT_EQ(logged.chain_certificate_hashes(0),
+            logged.chain_certificate_hashes(2));
+  ASSERT_EQ(2U, certs.size());
+  EXPECT_EQ("root", certs[logged.chain_certificate_hashes(1)]);
+  // The leaf is untouched.
+  EXPECT_EQ(original.Hash(), logged.Hash());
+
+  const auto lookup([&certs](const std::string& hash, std::string* cert) {
+    const auto it(certs.find(hash));
+    if (it == certs.end()) {
+      return false;
+    }
+    *cert = it->second;
+    return true;
+  });
+  cert_trans::LoggedCertificate missing(logged);
+  certs.erase(logged.chain_certificate_hashes(1));
+  EXPECT_FALSE(missing.JoinChain(lookup));
+
+  certs[logged.chain_certificate_hashes(1)] = "not the root";
+  EXPECT_FALSE(missing.JoinChain(lookup));
+
+  certs[logged.chain_certificate_hashes(1)] = "root";
+  ASSERT_TRUE(logged.JoinChain(lookup));
+  EXPECT_TRUE(original == logged);
+  // Nothing to do for an entry with its chain.
+  EXPECT_TRUE(logged.JoinChain(lookup));
+  EXPECT_TRUE(original == logged);
+}
+
+
+}  // namespace
 
 typedef testing::Types<cert_trans::LoggedCertificate> TestType;
 
@@ -0,0 +1,248 @@
+#include "log/lookup_checkpoint.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <memory>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "merkletree/merkle_tree.h"
+#include "util/util.h"
+
+using std::function;
+using std::string;
+using std::unique_ptr;
+
+namespace cert_trans {
+
+namespace {
+
+// Number of leaf hashes read per system call.
+const size_t kLeavesPerChunk = 4096;
+
+
+util::Status ErrnoStatus(const string& what, const string& path) {
+  return util::Status(util::error::INTERNAL,
+                      what + " " + path + ": " + strerror(errno));
+}
+
+
+// Writes all of |data| to |fd|, retrying short writes.
+bool WriteAll(int fd, const string& data) {
+  size_t written(0);
+  while (written < data.size()) {
+    const ssize_t ret(
+        write(fd, data.data() + written, data.size() - written));
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    written += ret;
+  }
+  return true;
+}
+
+
+// Reads all of |size| bytes at |offset| of |fd| into |data|, retrying
+// short reads. Fails if the file is shorter than that.
+bool PreadAll(int fd, char* data, size_t size, off_t offset) {
+  size_t done(0);
+  while (done < size) {
+    const ssize_t ret(pread(fd, data + done, size - done, offset + done));
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    if (ret == 0) {
+      errno = EIO;
+      return false;
+    }
+    done += ret;
+  }
+  return true;
+}
+
+
+void FileCloser(FILE* fp) {
+  if (fp) {
+    fclose(fp);
+  }
+}
+
+
+}  // namespace
+
+
+LookupCheckpoint::LookupCheckpoint(const string& path)
+    : path_(path), leaves_path_(path + ".leaves"), tree_size_(0) {
+  CHECK(!path_.empty());
+}
+
+
+util::Status LookupCheckpoint::Read(
+    size_t hash_size, ct::LookupCheckpointHeader* header,
+    const function<void(const string&)>& leaf_cb) {
+  CHECK_NOTNULL(header);
+  struct stat st;
+  if (stat(path_.c_str(), &st) != 0) {
+    if (errno == ENOENT) {
+      return util::Status(util::error::NOT_FOUND,
+                          "no checkpoint at " + path_);
+    }
+    return ErrnoStatus("failed to stat", path_);
+  }
+
+  string serialized;
+  if (!util::ReadBinaryFile(path_, &serialized)) {
+    return ErrnoStatus("failed to read", path_);
+  }
+  if (!header->ParseFromString(serialized) || header->tree_size() < 0 ||
+      header->hash_size() <= 0) {
+    return util::Status(util::error::DATA_LOSS,
+                        "corrupt checkpoint header in " + path_);
+  }
+
+  if (static_cast<size_t>(header->hash_size()) != hash_size) {
+    return util::Status(util::error::FAILED_PRECONDITION,
+                        "checkpoint in " + path_ +
+                            " was written with a different hash size");
+  }
+  const size_t tree_size(header->tree_size());
+  if (stat(leaves_path_.c_str(), &st) != 0) {
+    return ErrnoStatus("failed to stat", leaves_path_);
+  }
+  if (static_cast<size_t>(st.st_size) < tree_size * hash_size) {
+    return util::Status(util::error::DATA_LOSS,
+                        "leaves file " + leaves_path_ +
+                            " is shorter than its checkpoint header");
+  }
+
+  unique_ptr<FILE, void (*)(FILE*)> fp(fopen(leaves_path_.c_str(), "rb"),
+                                       FileCloser);
+  if (!fp) {
+    return ErrnoStatus("failed to open", leaves_path_);
+  }
+  string buf(kLeavesPerChunk * hash_size, '\0');
+  size_t leaf(0);
+  while (leaf < tree_size) {
+    const size_t count(std::min(kLeavesPerChunk, tree_size - leaf));
+    // The file was long enough when we checked, and is only ever
+    // appended to or truncated past the checkpoint, so a short read
+    // here means something is seriously wrong.
+    CHECK_EQ(count, fread(&buf[0], hash_size, count, fp.get()))
+        << "failed to read " << leaves_path_ << ": " << strerror(errno);
+    for (size_t i = 0; i < count; ++i) {
+      leaf_cb(buf.substr(i * hash_size, hash_size));
+    }
+    leaf += count;
+  }
+
+  tree_size_ = tree_size;
+  return util::Status::OK;
+}
+
+
+LookupCheckpoint::Update LookupCheckpoint::Prepare(
+    const MerkleTree& tree, const string& root_hash) const {
+  Update update;
+  update.tree_size = tree.LeafCount();
+  update.hash_size = tree.NodeSize();
+  for (int64_t leaf = tree_size_; leaf < update.tree_size; ++leaf) {
+    update.leaf_hashes.append(tree.LeafHash(leaf + 1));
+  }
+  update.root_hash = root_hash;
+  return update;
+}
+
+
+util::Status LookupCheckpoint::Write(const Update& update) {
+  const int64_t tree_size(tree_size_);
+  if (update.tree_size < tree_size) {
+    return util::Status(util::error::FAILED_PRECONDITION,
+                        "tree is smaller than the last checkpoint");
+  }
+  if (update.leaf_hashes.size() !=
+      (update.tree_size - tree_size) * update.hash_size) {
+    return util::Status(util::error::FAILED_PRECONDITION,
+                        "checkpoint changed since the update was prepared");
+  }
+
+  const int leaves_fd(open(leaves_path_.c_str(), O_WRONLY | O_CREAT, 0644));
+  if (leaves_fd < 0) {
+    return ErrnoStatus("failed to open", leaves_path_);
+  }
+  // Drop anything left over from an interrupted write, then append.
+  bool ok(ftruncate(leaves_fd, tree_size * update.hash_size) == 0 &&
+          lseek(leaves_fd, 0, SEEK_END) >= 0);
+  ok = ok && WriteAll(leaves_fd, update.leaf_hashes);
+  ok = ok && fsync(leaves_fd) == 0;
+  if (!ok) {
+    const util::Status status(ErrnoStatus("failed to write", leaves_path_));
+    close(leaves_fd);
+    return status;
+  }
+  CHECK_ERR(close(leaves_fd));
+
+  ct::LookupCheckpointHeader header;
+  header.set_tree_size(update.tree_size);
+  header.set_root_hash(update.root_hash);
+  header.set_hash_size(update.hash_size);
+  string serialized;
+  CHECK(header.SerializeToString(&serialized));
+
+  const string tmp_path(path_ + ".tmp");
+  const int fd(open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+  if (fd < 0) {
+    return ErrnoStatus("failed to open", tmp_path);
+  }
+  ok = WriteAll(fd, serialized) && fsync(fd) == 0;
+  if (!ok) {
+    const util::Status status(ErrnoStatus("failed to write", tmp_path));
+    close(fd);
+    return status;
+  }
+  CHECK_ERR(close(fd));
+  if (rename(tmp_path.c_str(), path_.c_str()) != 0) {
+    return ErrnoStatus("failed to rename " + tmp_path + " to", path_);
+  }
+
+  tree_size_ = update.tree_size;
+  return util::Status::OK;
+}
+
+
+util::Status LookupCheckpoint::ReadLeaves(size_t hash_size, int64_t begin,
+                                          int64_t end,
+                                          string* leaf_hashes) const {
+  CHECK_NOTNULL(leaf_hashes);
+  CHECK_LE(0, begin);
+  CHECK_LE(begin, end);
+  if (end > tree_size_) {
+    return util::Status(util::error::OUT_OF_RANGE,
+                        "leaves past the checkpoint in " + path_);
+  }
+
+  const int fd(open(leaves_path_.c_str(), O_RDONLY));
+  if (fd < 0) {
+    return ErrnoStatus("failed to open", leaves_path_);
+  }
+  leaf_hashes->resize((end - begin) * hash_size);
+  const bool ok(leaf_hashes->empty() ||
+                PreadAll(fd, &(*leaf_hashes)[0], leaf_hashes->size(),
+                         begin * hash_size));
+  const util::Status status(ok ? util::Status::OK
+                               : ErrnoStatus("failed to read", leaves_path_));
+  CHECK_ERR(close(fd));
+  return status;
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,95 @@
+#ifndef CERT_TRANS_LOG_LOOKUP_CHECKPOINT_H_
+#define CERT_TRANS_LOG_LOOKUP_CHECKPOINT_H_
+
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+#include <string>
+
+#include "base/macros.h"
+#include "proto/ct.pb.h"
+#include "util/status.h"
+
+class MerkleTree;
+
+namespace cert_trans {
+
+// Saves the leaf hashes of a LogLookup tree, so that a restarting
+// server only has to fetch and rehash the entries logged since the
+// last checkpoint. A checkpoint at <path> consists of two files:
+//
+// <path>         - A serialized ct::LookupCheckpointHeader holding the
+//                  tree size and root hash. It is replaced atomically.
+// <path>.leaves  - The leaf hashes in sequence number order, as raw
+//                  concatenated digests. It is only ever appended to,
+//                  and synced before the header that covers it is
+//                  written, so anything past the tree size in the
+//                  header is left over from an interrupted write.
+//
+// The leaf hashes are all that is needed to rebuild both the tree and
+// the hash -> index map of LogLookup, with no access to the entries.
+//
+// This class is thread-compatible, but not thread-safe, except that
+// ReadLeaves() can be called while Write() runs.
+class LookupCheckpoint {
+ public:
+  // What Write() needs from a tree, taken by Prepare(), so that the
+  // tree can keep changing while the files are written and synced.
+  struct Update {
+    int64_t tree_size;
+    size_t hash_size;
+    // The leaf hashes added since the last checkpoint, concatenated.
+    std::string leaf_hashes;
+    std::string root_hash;
+  };
+
+  explicit LookupCheckpoint(const std::string& path);
+
+  // The tree size of the last checkpoint read or written, 0 if none.
+  int64_t tree_size() const {
+    return tree_size_;
+  }
+
+  // Reads the checkpoint, checking that it holds leaf hashes of
+  // |hash_size| bytes and that its leaves file is complete, then calls
+  // |leaf_cb| with each leaf hash in order. |header| is filled in
+  // before the first call. Returns NOT_FOUND if there is no
+  // checkpoint.
+  util::Status Read(
+      size_t hash_size, ct::LookupCheckpointHeader* header,
+      const std::function<void(const std::string&)>& leaf_cb);
+
+  // Forget the checkpoint that was read, so that the next Write()
+  // starts over from an empty tree.
+  void Discard() {
+    tree_size_ = 0;
+  }
+
+  // Takes the leaves of |tree| added since the last checkpoint, with
+  // |root_hash| as the root of the whole tree.
+  Update Prepare(const MerkleTree& tree, const std::string& root_hash) const;
+
+  // Appends the leaves of |update|, and records its root. On failure,
+  // the previous checkpoint is left in place. Fails if another
+  // checkpoint was read or written since |update| was prepared.
+  util::Status Write(const Update& update);
+
+  // Reads the leaf hashes in [|begin|, |end|), of |hash_size| bytes
+  // each, into |leaf_hashes|, concatenated. Returns OUT_OF_RANGE if
+  // they are not all in the last checkpoint read or written.
+  util::Status ReadLeaves(size_t hash_size, int64_t begin, int64_t end,
+                          std::string* leaf_hashes) const;
+
+ private:
+  const std::string path_;
+  const std::string leaves_path_;
+  // Only set once the files it covers are synced, for ReadLeaves().
+  std::atomic<int64_t> tree_size_;
+
+  DISALLOW_COPY_AND_ASSIGN(LookupCheckpoint);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_LOOKUP_CHECKPOINT_H_
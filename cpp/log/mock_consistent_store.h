@@ -18,6 +18,10 @@ class MockConsistentStore : public ConsistentStore<Logged> {
 
   MOCK_METHOD1_T(AddPendingEntry, util::Status(Logged* entry));
 
+  MOCK_METHOD2_T(AddPendingEntries,
+                 void(const std::vector<Logged*>& entries,
+                      std::vector<util::Status>* statuses));
+
   MOCK_CONST_METHOD2_T(GetPendingEntryForHash,
                        util::Status(const std::string& hash,
                                     EntryHandle<Logged>* entry));
@@ -55,6 +59,11 @@ class MockConsistentStore : public ConsistentStore<Logged> {
       void(const typename ConsistentStore<Logged>::ClusterConfigCallback& cb,
            util::Task* task));
 
+  MOCK_METHOD2_T(
+      WatchPendingEntries,
+      void(const typename ConsistentStore<Logged>::PendingEntriesCallback& cb,
+           util::Task* task));
+
   MOCK_METHOD1(SetClusterConfig, util::Status(const ct::ClusterConfig&));
 
   MOCK_METHOD0(CleanupOldEntries, util::StatusOr<int64_t>());
@@ -0,0 +1,106 @@
+#ifndef CERT_TRANS_LOG_READ_AHEAD_H_
+#define CERT_TRANS_LOG_READ_AHEAD_H_
+
+#include <condition_variable>
+#include <functional>
+#include <glog/logging.h>
+#include <mutex>
+#include <stddef.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// Calls |next| on a thread of its own until it returns false, keeping
+// up to |size| of the items it returns in a ring buffer, ahead of the
+// calls to Next(). This way, reading and parsing the items overlaps
+// with what the caller does with them. The items are swapped in and
+// out of the ring buffer, rather than copied, and reused: |next| must
+// replace all of the item it is passed.
+template <class T>
+class ReadAhead {
+ public:
+  ReadAhead(const std::function<bool(T*)>& next, size_t size)
+      : next_(next),
+        items_(size),
+        first_(0),
+        count_(0),
+        done_(false),
+        stop_(false),
+        thread_(&ReadAhead<T>::Run, this) {
+    CHECK_GT(size, 0U);
+  }
+
+  ~ReadAhead() {
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+
+  // Returns false once |next| has, and all the items before were
+  // returned.
+  bool Next(T* item) {
+    std::unique_lock<std::mutex> lock(lock_);
+    cv_.wait(lock, [this]() { return count_ > 0 || done_; });
+    if (count_ == 0) {
+      return false;
+    }
+    using std::swap;
+    swap(*item, items_[first_]);
+    first_ = (first_ + 1) % items_.size();
+    --count_;
+    cv_.notify_all();
+    return true;
+  }
+
+ private:
+  void Run() {
+    std::unique_lock<std::mutex> lock(lock_);
+    T item;
+    while (!stop_) {
+      lock.unlock();
+      const bool more(next_(&item));
+      lock.lock();
+      if (!more) {
+        break;
+      }
+      cv_.wait(lock, [this]() { return count_ < items_.size() || stop_; });
+      if (stop_) {
+        break;
+      }
+      using std::swap;
+      swap(items_[(first_ + count_) % items_.size()], item);
+      ++count_;
+      cv_.notify_all();
+    }
+    done_ = true;
+    cv_.notify_all();
+  }
+
+  const std::function<bool(T*)> next_;
+  std::mutex lock_;
+  std::condition_variable cv_;
+  // The ring buffer, of which |count_| items starting at |first_| are
+  // waiting to be returned.
+  std::vector<T> items_;
+  size_t first_;
+  size_t count_;
+  bool done_;
+  bool stop_;
+  // Last, so that everything else is initialized before it starts.
+  std::thread thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(ReadAhead);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_READ_AHEAD_H_
@@ -0,0 +1,92 @@
+#include "log/read_ahead.h"
+
+#include <atomic>
+#include <gtest/gtest.h>
+#include <string>
+
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::atomic;
+using std::string;
+using std::to_string;
+
+
+// Returns the numbers from 0 to |count| - 1, as strings.
+class Counter {
+ public:
+  explicit Counter(int count) : count_(count), next_(0) {
+  }
+
+  bool Next(string* item) {
+    if (next_ >= count_) {
+      return false;
+    }
+    *item = to_string(next_++);
+    return true;
+  }
+
+  int next() const {
+    return next_;
+  }
+
+ private:
+  const int count_;
+  atomic<int> next_;
+};
+
+
+TEST(ReadAheadTest, ReturnsAllInOrder) {
+  Counter counter(100);
+  ReadAhead<string> read_ahead(
+      [&counter](string* item) { return counter.Next(item); }, 7);
+  string item;
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_TRUE(read_ahead.Next(&item));
+    EXPECT_EQ(to_string(i), item);
+  }
+  EXPECT_FALSE(read_ahead.Next(&item));
+  EXPECT_FALSE(read_ahead.Next(&item));
+}
+
+
+TEST(ReadAheadTest, Empty) {
+  Counter counter(0);
+  ReadAhead<string> read_ahead(
+      [&counter](string* item) { return counter.Next(item); }, 3);
+  string item;
+  EXPECT_FALSE(read_ahead.Next(&item));
+}
+
+
+TEST(ReadAheadTest, StaysWithinSize) {
+  Counter counter(100);
+  {
+    ReadAhead<string> read_ahead(
+        [&counter](string* item) { return counter.Next(item); }, 5);
+    string item;
+    ASSERT_TRUE(read_ahead.Next(&item));
+    EXPECT_EQ("0", item);
+    // Wait for the buffer to fill up again.
+    while (counter.next() < 6) {
+      std::this_thread::yield();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    // 5 in the buffer, and one held by the thread, waiting for room.
+    EXPECT_EQ(7, counter.next());
+  }
+  // Destroyed without reading the rest.
+  EXPECT_EQ(7, counter.next());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,762 @@
+#ifndef CERT_TRANS_LOG_ROCKSDB_DB_INL_H_
+#define CERT_TRANS_LOG_ROCKSDB_DB_INL_H_
+
+#include "log/rocksdb_db.h"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <map>
+#include <rocksdb/filter_policy.h>
+#include <rocksdb/options.h>
+#include <rocksdb/table.h>
+#include <stdint.h>
+#include <string>
+
+#include "merkletree/serial_hasher.h"
+#include "monitoring/latency.h"
+#include "monitoring/monitoring.h"
+#include "proto/ct.pb.h"
+#include "proto/serializer.h"
+#include "util/util.h"
+
+DEFINE_int32(rocksdb_block_cache_size_mb, 0,
+             "size of the block cache shared by the rocksdb column families "
+             "in MB, if non-zero (otherwise each uses rocksdb's default)");
+DEFINE_int32(rocksdb_background_threads, 4,
+             "number of threads rocksdb flushes and compacts with");
+DEFINE_int32(rocksdb_entry_block_size_kb, 16,
+             "approximate size of the data blocks of the entries in KB");
+DEFINE_bool(rocksdb_entry_compression, true,
+            "whether rocksdb compresses the blocks of the entries with "
+            "Snappy (hashes are not worth compressing)");
+DEFINE_int32(rocksdb_hash_bloom_filter_bits_per_key, 10,
+             "bits per key of the Bloom filter of the hash index, which "
+             "saves reading it for the hashes of new submissions, if "
+             "non-zero");
+DEFINE_int32(rocksdb_entry_write_buffer_size_mb, 64,
+             "amount of entries rocksdb builds up in memory before writing "
+             "them to disk in MB");
+
+namespace {
+
+
+static cert_trans::Latency<std::chrono::milliseconds, std::string>
+    rocksdb_latency_by_op_ms("rocksdb_latency_by_operation_ms", "operation",
+                             "Database latency in ms broken out by "
+                             "operation.");
+
+
+// The metadata is in the default column family, which always exists.
+const char* const kColumnFamilyNames[] = {
+    "default", "entries", "hashes", "leaf_hashes", "tree_heads",
+};
+
+const char kMetaNodeIdKey[] = "node_id";
+const char kMetaContiguousSizeKey[] = "contiguous_size";
+
+// Sequence numbers and timestamps are stored big-endian, so that the
+// keys sort in their order.
+const size_t kRocksDBKeyBytes = 8;
+
+// Leaf hashes are stored followed by the timestamp of their entry.
+const size_t kRocksDBLeafHashTimestampBytes = 8;
+
+
+std::string EncodeUint64(uint64_t value) {
+  return Serializer::SerializeUint(value, kRocksDBKeyBytes);
+}
+
+
+uint64_t DecodeUint64(const rocksdb::Slice& bytes) {
+  CHECK_EQ(bytes.size(), kRocksDBKeyBytes);
+  uint64_t value(0);
+  for (size_t i = 0; i < bytes.size(); ++i) {
+    value = (value << 8) | static_cast<unsigned char>(bytes[i]);
+  }
+  return value;
+}
+
+
+bool DecodeRocksDBLeafHash(rocksdb::Slice value, std::string* hash,
+                           uint64_t* timestamp) {
+  if (value.size() <= kRocksDBLeafHashTimestampBytes) {
+    return false;
+  }
+  const size_t hash_size(value.size() - kRocksDBLeafHashTimestampBytes);
+  hash->assign(value.data(), hash_size);
+  value.remove_prefix(hash_size);
+  *timestamp = DecodeUint64(value);
+  return true;
+}
+
+
+std::shared_ptr<rocksdb::Cache> BuildRocksDBBlockCache() {
+  CHECK_GE(FLAGS_rocksdb_block_cache_size_mb, 0);
+  if (FLAGS_rocksdb_block_cache_size_mb == 0) {
+    return nullptr;
+  }
+  return rocksdb::NewLRUCache(
+      static_cast<size_t>(FLAGS_rocksdb_block_cache_size_mb) << 20);
+}
+
+
+rocksdb::ColumnFamilyOptions ColumnFamilyOptions(
+    const std::shared_ptr<rocksdb::Cache>& block_cache, size_t block_size,
+    int bloom_filter_bits_per_key, bool compression) {
+  rocksdb::BlockBasedTableOptions table_options;
+  table_options.block_cache = block_cache;
+  if (block_size > 0) {
+    table_options.block_size = block_size;
+  }
+  if (bloom_filter_bits_per_key > 0) {
+    table_options.filter_policy.reset(
+        rocksdb::NewBloomFilterPolicy(bloom_filter_bits_per_key, false));
+  }
+
+  rocksdb::ColumnFamilyOptions options;
+  options.table_factory.reset(
+      rocksdb::NewBlockBasedTableFactory(table_options));
+  options.compression =
+      compression ? rocksdb::kSnappyCompression : rocksdb::kNoCompression;
+  return options;
+}
+
+
+}  // namespace
+
+
+template <class Logged>
+class RocksDB<Logged>::Iterator : public Database<Logged>::Iterator {
+ public:
+  Iterator(const RocksDB<Logged>* db, int64_t start_index)
+      : it_(CHECK_NOTNULL(db)->db_->NewIterator(rocksdb::ReadOptions(),
+                                                db->cf(ENTRIES))) {
+    CHECK(it_);
+    it_->Seek(EncodeUint64(start_index));
+  }
+
+  bool GetNextEntry(Logged* entry) override {
+    if (!it_->Valid()) {
+      CHECK(it_->status().ok()) << "Failed to scan entries: "
+                                << it_->status().ToString();
+      return false;
+    }
+
+    const int64_t seq(DecodeUint64(it_->key()));
+    CHECK(entry->ParseFromArray(it_->value().data(), it_->value().size()))
+        << "failed to parse entry with sequence number " << seq;
+    CHECK(entry->has_sequence_number())
+        << "no sequence number for entry with expected sequence number "
+        << seq;
+    CHECK_EQ(entry->sequence_number(), seq) << "unexpected sequence_number";
+
+    it_->Next();
+
+    return true;
+  }
+
+ private:
+  const std::unique_ptr<rocksdb::Iterator> it_;
+};
+
+
+template <class Logged>
+class RocksDB<Logged>::LeafHashIterator
+    : public Database<Logged>::LeafHashIterator {
+ public:
+  LeafHashIterator(const RocksDB<Logged>* db, int64_t start_index)
+      : it_(CHECK_NOTNULL(db)->db_->NewIterator(rocksdb::ReadOptions(),
+                                                db->cf(LEAF_HASHES))),
+        next_index_(start_index) {
+    CHECK(it_);
+    it_->Seek(EncodeUint64(start_index));
+  }
+
+  bool GetNextLeafHash(
+      typename Database<Logged>::LeafHash* leaf_hash) override {
+    if (!it_->Valid() ||
+        DecodeUint64(it_->key()) != static_cast<uint64_t>(next_index_)) {
+      CHECK(it_->status().ok()) << "Failed to scan leaf hashes: "
+                                << it_->status().ToString();
+      return false;
+    }
+    CHECK(DecodeRocksDBLeafHash(it_->value(), &leaf_hash->hash,
+                                &leaf_hash->timestamp))
+        << "failed to decode leaf hash for sequence number " << next_index_;
+    leaf_hash->sequence_number = next_index_;
+    it_->Next();
+    ++next_index_;
+
+    return true;
+  }
+
+ private:
+  const std::unique_ptr<rocksdb::Iterator> it_;
+  int64_t next_index_;
+};
+
+
+template <class Logged>
+RocksDB<Logged>::RocksDB(const std::string& dbfile)
+    : secondary_(false),
+      block_cache_(BuildRocksDBBlockCache()),
+      contiguous_size_(0),
+      tree_hasher_(new Sha256Hasher),
+      latest_tree_timestamp_(0) {
+  Open(dbfile, "");
+}
+
+
+template <class Logged>
+RocksDB<Logged>::RocksDB(const std::string& dbfile,
+                         const std::string& secondary_dir)
+    : secondary_(true),
+      block_cache_(BuildRocksDBBlockCache()),
+      contiguous_size_(0),
+      tree_hasher_(new Sha256Hasher),
+      latest_tree_timestamp_(0) {
+  CHECK(!secondary_dir.empty());
+  Open(dbfile, secondary_dir);
+}
+
+
+template <class Logged>
+void RocksDB<Logged>::Open(const std::string& dbfile,
+                           const std::string& secondary_dir) {
+  LOG(INFO) << "Opening " << dbfile
+            << (secondary_ ? " as a secondary instance" : "");
+  cert_trans::ScopedLatency latency(
+      rocksdb_latency_by_op_ms.GetScopedLatency("open"));
+  rocksdb::DBOptions options;
+  if (secondary_) {
+    // A secondary instance must keep all the files of the primary
+    // open, so that it still has them once the primary deletes them.
+    options.max_open_files = -1;
+  } else {
+    options.create_if_missing = true;
+    options.create_missing_column_families = true;
+  }
+  CHECK_GT(FLAGS_rocksdb_background_threads, 0);
+  options.IncreaseParallelism(FLAGS_rocksdb_background_threads);
+
+  CHECK_GE(FLAGS_rocksdb_entry_block_size_kb, 0);
+  CHECK_GT(FLAGS_rocksdb_entry_write_buffer_size_mb, 0);
+  CHECK_GE(FLAGS_rocksdb_hash_bloom_filter_bits_per_key, 0);
+  std::vector<rocksdb::ColumnFamilyDescriptor> families(NUM_COLUMN_FAMILIES);
+  for (int i = 0; i < NUM_COLUMN_FAMILIES; ++i) {
+    families[i].name = kColumnFamilyNames[i];
+  }
+  families[METADATA].options =
+      ColumnFamilyOptions(block_cache_, 0, 0, false);
+  families[ENTRIES].options = ColumnFamilyOptions(
+      block_cache_,
+      static_cast<size_t>(FLAGS_rocksdb_entry_block_size_kb) << 10, 0,
+      FLAGS_rocksdb_entry_compression);
+  families[ENTRIES].options.write_buffer_size =
+      static_cast<size_t>(FLAGS_rocksdb_entry_write_buffer_size_mb) << 20;
+  // The hash index is only ever looked up by key, mostly for hashes
+  // it doesn't have.
+  families[HASHES].options = ColumnFamilyOptions(
+      block_cache_, 0, FLAGS_rocksdb_hash_bloom_filter_bits_per_key, false);
+  families[LEAF_HASHES].options =
+      ColumnFamilyOptions(block_cache_, 0, 0, false);
+  families[TREE_HEADS].options =
+      ColumnFamilyOptions(block_cache_, 0, 0, false);
+
+  rocksdb::DB* db;
+  std::vector<rocksdb::ColumnFamilyHandle*> handles;
+  const rocksdb::Status status(
+      secondary_ ? rocksdb::DB::OpenAsSecondary(options, dbfile, secondary_dir,
+                                                families, &handles, &db)
+                 : rocksdb::DB::Open(options, dbfile, families, &handles,
+                                     &db));
+  CHECK(status.ok()) << status.ToString();
+  db_.reset(db);
+  CHECK_EQ(handles.size(), families.size());
+  for (rocksdb::ColumnFamilyHandle* handle : handles) {
+    column_families_.emplace_back(handle);
+  }
+
+  BuildIndex();
+}
+
+
+template <class Logged>
+typename Database<Logged>::WriteResult RocksDB<Logged>::CreateSequencedEntry_(
+    const Logged& logged) {
+  CHECK(logged.has_sequence_number());
+  CHECK_GE(logged.sequence_number(), 0);
+  cert_trans::ScopedLatency latency(
+      rocksdb_latency_by_op_ms.GetScopedLatency("create_sequenced_entry"));
+
+  std::lock_guard<std::mutex> lock(lock_);
+
+  return WriteEntries(std::vector<const Logged*>(1, &logged));
+}
+
+
+template <class Logged>
+typename Database<Logged>::WriteResult
+RocksDB<Logged>::CreateSequencedEntries_(
+    const std::vector<const Logged*>& logged) {
+  cert_trans::ScopedLatency latency(
+      rocksdb_latency_by_op_ms.GetScopedLatency("create_sequenced_entries"));
+
+  std::lock_guard<std::mutex> lock(lock_);
+
+  return WriteEntries(logged);
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult RocksDB<Logged>::LookupByHash(
+    const std::string& hash, Logged* result) const {
+  cert_trans::ScopedLatency latency(
+      rocksdb_latency_by_op_ms.GetScopedLatency("lookup_by_hash"));
+
+  std::string value;
+  rocksdb::Status status(
+      db_->Get(rocksdb::ReadOptions(), cf(HASHES), hash, &value));
+  if (status.IsNotFound()) {
+    return this->NOT_FOUND;
+  }
+  CHECK(status.ok()) << "Failed to get index of hash(" << util::HexString(hash)
+                     << "): " << status.ToString();
+
+  std::string cert_data;
+  status = db_->Get(rocksdb::ReadOptions(), cf(ENTRIES), value, &cert_data);
+  CHECK(status.ok()) << "Failed to get entry by hash(" << util::HexString(hash)
+                     << "): " << status.ToString();
+
+  Logged logged;
+  CHECK(logged.ParseFromString(cert_data));
+  CHECK_EQ(logged.Hash(), hash);
+
+  if (result) {
+    logged.Swap(result);
+  }
+
+  return this->LOOKUP_OK;
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult RocksDB<Logged>::LookupByIndex(
+    int64_t sequence_number, Logged* result) const {
+  CHECK_GE(sequence_number, 0);
+  cert_trans::ScopedLatency latency(
+      rocksdb_latency_by_op_ms.GetScopedLatency("lookup_by_index"));
+
+  std::string cert_data;
+  const rocksdb::Status status(db_->Get(rocksdb::ReadOptions(), cf(ENTRIES),
+                                        EncodeUint64(sequence_number),
+                                        &cert_data));
+  if (status.IsNotFound()) {
+    return this->NOT_FOUND;
+  }
+  CHECK(status.ok()) << "Failed to get entry for sequence number "
+                     << sequence_number << ": " << status.ToString();
+
+  if (result) {
+    CHECK(result->ParseFromString(cert_data));
+    CHECK_EQ(result->sequence_number(), sequence_number);
+  }
+
+  return this->LOOKUP_OK;
+}
+
+
+template <class Logged>
+std::unique_ptr<typename Database<Logged>::Iterator>
+RocksDB<Logged>::ScanEntries(int64_t start_index) const {
+  return std::unique_ptr<Iterator>(new Iterator(this, start_index));
+}
+
+
+template <class Logged>
+std::unique_ptr<typename Database<Logged>::LeafHashIterator>
+RocksDB<Logged>::ScanLeafHashes(int64_t start_index) const {
+  return std::unique_ptr<LeafHashIterator>(
+      new LeafHashIterator(this, start_index));
+}
+
+
+template <class Logged>
+typename Database<Logged>::WriteResult RocksDB<Logged>::WriteTreeHead_(
+    const ct::SignedTreeHead& sth) {
+  CHECK_GE(sth.tree_size(), 0);
+  cert_trans::ScopedLatency latency(
+      rocksdb_latency_by_op_ms.GetScopedLatency("write_tree_head"));
+
+  CHECK(!secondary_) << "Secondary instances can't be written to";
+  const std::string key(EncodeUint64(sth.timestamp()));
+  std::string data;
+  CHECK(sth.SerializeToString(&data));
+
+  std::unique_lock<std::mutex> lock(lock_);
+  std::string existing_data;
+  rocksdb::Status status(
+      db_->Get(rocksdb::ReadOptions(), cf(TREE_HEADS), key, &existing_data));
+  if (status.ok()) {
+    if (existing_data == data) {
+      return this->OK;
+    }
+    return this->DUPLICATE_TREE_HEAD_TIMESTAMP;
+  }
+  CHECK(status.IsNotFound()) << "Failed to read tree head: "
+                             << status.ToString();
+
+  rocksdb::WriteOptions opts;
+  opts.sync = true;
+  status = db_->Put(opts, cf(TREE_HEADS), key, data);
+  CHECK(status.ok()) << "Failed to write tree head (" << sth.timestamp()
+                     << "): " << status.ToString();
+
+  if (sth.timestamp() > latest_tree_timestamp_) {
+    latest_tree_timestamp_ = sth.timestamp();
+  }
+
+  lock.unlock();
+  callbacks_.Call(sth);
+
+  return this->OK;
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult RocksDB<Logged>::LatestTreeHead(
+    ct::SignedTreeHead* result) const {
+  cert_trans::ScopedLatency latency(
+      rocksdb_latency_by_op_ms.GetScopedLatency("latest_tree_head"));
+
+  return LatestTreeHeadNoLock(result);
+}
+
+
+template <class Logged>
+int64_t RocksDB<Logged>::TreeSize() const {
+  return contiguous_size_;
+}
+
+
+template <class Logged>
+std::vector<int64_t> RocksDB<Logged>::SparseEntries() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return std::vector<int64_t>(sparse_entries_.begin(), sparse_entries_.end());
+}
+
+
+template <class Logged>
+void RocksDB<Logged>::AddNotifySTHCallback(
+    const typename Database<Logged>::NotifySTHCallback* callback) {
+  std::unique_lock<std::mutex> lock(lock_);
+
+  callbacks_.Add(callback);
+
+  ct::SignedTreeHead sth;
+  if (LatestTreeHeadNoLock(&sth) == this->LOOKUP_OK) {
+    lock.unlock();
+    (*callback)(sth);
+  }
+}
+
+
+template <class Logged>
+void RocksDB<Logged>::RemoveNotifySTHCallback(
+    const typename Database<Logged>::NotifySTHCallback* callback) {
+  // Not under |lock_|, as this waits for the callback to return if it
+  // is being called, and it might want to perform some lookups.
+  callbacks_.Remove(callback);
+}
+
+
+template <class Logged>
+void RocksDB<Logged>::InitializeNode(const std::string& node_id) {
+  CHECK(!node_id.empty());
+  CHECK(!secondary_) << "Secondary instances can't be written to";
+  std::lock_guard<std::mutex> lock(lock_);
+  std::string existing_id;
+  rocksdb::Status status(db_->Get(rocksdb::ReadOptions(), cf(METADATA),
+                                  kMetaNodeIdKey, &existing_id));
+  if (!status.IsNotFound()) {
+    LOG(FATAL) << "Attempting to initialize DB beloging to node with node_id: "
+               << existing_id;
+  }
+  status = db_->Put(rocksdb::WriteOptions(), cf(METADATA), kMetaNodeIdKey,
+                    node_id);
+  CHECK(status.ok()) << "Failed to store NodeId: " << status.ToString();
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult RocksDB<Logged>::NodeId(
+    std::string* node_id) {
+  CHECK_NOTNULL(node_id);
+  if (!db_->Get(rocksdb::ReadOptions(), cf(METADATA), kMetaNodeIdKey,
+                node_id)
+           .ok()) {
+    return this->NOT_FOUND;
+  }
+  return this->LOOKUP_OK;
+}
+
+
+template <class Logged>
+util::Status RocksDB<Logged>::CatchUp() {
+  if (!secondary_) {
+    return util::Status::OK;
+  }
+  cert_trans::ScopedLatency latency(
+      rocksdb_latency_by_op_ms.GetScopedLatency("catch_up"));
+  std::unique_lock<std::mutex> lock(lock_);
+
+  const rocksdb::Status status(db_->TryCatchUpWithPrimary());
+  if (!status.ok()) {
+    return util::Status(util::error::UNAVAILABLE,
+                        "Failed to catch up with the primary: " +
+                            status.ToString());
+  }
+
+  // The writer writes the entries before the tree heads covering
+  // them, so index them first.
+  IndexNewEntries();
+  const uint64_t old_tree_timestamp(latest_tree_timestamp_);
+  ReadLatestTreeTimestamp();
+  ct::SignedTreeHead sth;
+  if (latest_tree_timestamp_ == old_tree_timestamp ||
+      LatestTreeHeadNoLock(&sth) != this->LOOKUP_OK) {
+    return util::Status::OK;
+  }
+
+  lock.unlock();
+  callbacks_.Call(sth);
+
+  return util::Status::OK;
+}
+
+
+template <class Logged>
+void RocksDB<Logged>::BuildIndex() {
+  cert_trans::ScopedLatency latency(
+      rocksdb_latency_by_op_ms.GetScopedLatency("build_index"));
+  std::lock_guard<std::mutex> lock(lock_);
+
+  // The stored contiguous size is only ever behind the real one, so
+  // we only have to look at the entries from there onwards. Their
+  // hashes were indexed when they were written.
+  std::string value;
+  rocksdb::Status status(db_->Get(rocksdb::ReadOptions(), cf(METADATA),
+                                  kMetaContiguousSizeKey, &value));
+  if (status.ok()) {
+    contiguous_size_ = DecodeUint64(value);
+  } else {
+    CHECK(status.IsNotFound()) << "Failed to read contiguous size: "
+                               << status.ToString();
+  }
+  const int64_t stored_contiguous_size(contiguous_size_);
+
+  IndexNewEntries();
+
+  if (!secondary_ && contiguous_size_ != stored_contiguous_size) {
+    status = db_->Put(rocksdb::WriteOptions(), cf(METADATA),
+                      kMetaContiguousSizeKey, EncodeUint64(contiguous_size_));
+    CHECK(status.ok()) << "Failed to write contiguous size: "
+                       << status.ToString();
+  }
+
+  ReadLatestTreeTimestamp();
+}
+
+
+// Adds the entries past the contiguous ones that aren't in
+// "sparse_entries_" yet. This must be called with "lock_" held.
+template <class Logged>
+void RocksDB<Logged>::IndexNewEntries() {
+  rocksdb::ReadOptions options;
+  options.fill_cache = false;
+  // Only the keys are needed, but rocksdb reads the values with them.
+  const std::unique_ptr<rocksdb::Iterator> it(
+      db_->NewIterator(options, cf(ENTRIES)));
+  CHECK(it);
+  for (it->Seek(EncodeUint64(contiguous_size_)); it->Valid(); it->Next()) {
+    const int64_t sequence_number(DecodeUint64(it->key()));
+    // Filling a gap makes the contiguous size jump over the sparse
+    // entries after it, which the scan then comes across.
+    if (sequence_number >= contiguous_size_ &&
+        sparse_entries_.count(sequence_number) == 0) {
+      InsertEntryMapping(sequence_number);
+    }
+  }
+  CHECK(it->status().ok()) << "Failed to scan entries: "
+                           << it->status().ToString();
+}
+
+
+// This must be called with "lock_" held.
+template <class Logged>
+void RocksDB<Logged>::ReadLatestTreeTimestamp() {
+  rocksdb::ReadOptions options;
+  options.fill_cache = false;
+  // The tree heads are keyed by timestamp, so the latest is the last.
+  const std::unique_ptr<rocksdb::Iterator> it(
+      db_->NewIterator(options, cf(TREE_HEADS)));
+  CHECK(it);
+  it->SeekToLast();
+  if (it->Valid()) {
+    latest_tree_timestamp_ = DecodeUint64(it->key());
+  }
+  CHECK(it->status().ok()) << "Failed to read tree heads: "
+                           << it->status().ToString();
+}
+
+
+template <class Logged>
+typename Database<Logged>::LookupResult RocksDB<Logged>::LatestTreeHeadNoLock(
+    ct::SignedTreeHead* result) const {
+  const uint64_t timestamp(latest_tree_timestamp_);
+  if (timestamp == 0) {
+    return this->NOT_FOUND;
+  }
+
+  std::string tree_data;
+  const rocksdb::Status status(db_->Get(rocksdb::ReadOptions(),
+                                        cf(TREE_HEADS),
+                                        EncodeUint64(timestamp), &tree_data));
+  CHECK(status.ok()) << "Failed to read latest tree head: "
+                     << status.ToString();
+
+  CHECK(result->ParseFromString(tree_data));
+  CHECK_EQ(result->timestamp(), timestamp);
+
+  return this->LOOKUP_OK;
+}
+
+
+// This must be called with "lock_" held.
+template <class Logged>
+typename Database<Logged>::WriteResult RocksDB<Logged>::WriteEntries(
+    const std::vector<const Logged*>& logged) {
+  CHECK(!secondary_) << "Secondary instances can't be written to";
+  rocksdb::WriteBatch batch;
+  // The entries being added, by key, in case |logged| has duplicates.
+  std::map<std::string, std::string> added;
+  std::map<std::string, int64_t> pending_hashes;
+  std::vector<const Logged*> new_entries;
+  for (const Logged* entry : logged) {
+    std::string data;
+    CHECK(entry->SerializeToString(&data));
+    const std::string key(EncodeUint64(entry->sequence_number()));
+
+    std::string existing_data;
+    const auto it(added.find(key));
+    if (it != added.end()) {
+      existing_data = it->second;
+    } else {
+      const rocksdb::Status status(db_->Get(rocksdb::ReadOptions(),
+                                            cf(ENTRIES), key, &existing_data));
+      if (status.IsNotFound()) {
+        batch.Put(cf(ENTRIES), key, data);
+        added[key] = data;
+        IndexHash(entry->Hash(), entry->sequence_number(), &batch,
+                  &pending_hashes);
+        typename Database<Logged>::LeafHash leaf_hash;
+        CHECK(Database<Logged>::HashLeaf(tree_hasher_, *entry, &leaf_hash))
+            << "Failed to serialize entry: " << entry->DebugString();
+        batch.Put(cf(LEAF_HASHES), key,
+                  leaf_hash.hash + EncodeUint64(leaf_hash.timestamp));
+        new_entries.push_back(entry);
+        continue;
+      }
+      CHECK(status.ok()) << "Failed to get entry for sequence number "
+                         << entry->sequence_number() << ": "
+                         << status.ToString();
+    }
+    if (existing_data != data) {
+      return this->SEQUENCE_NUMBER_ALREADY_IN_USE;
+    }
+  }
+
+  if (new_entries.empty()) {
+    return this->OK;
+  }
+  const rocksdb::Status status(db_->Write(rocksdb::WriteOptions(), &batch));
+  CHECK(status.ok()) << "Failed to write " << new_entries.size()
+                     << " sequenced entries (first seq: "
+                     << new_entries.front()->sequence_number()
+                     << "): " << status.ToString();
+
+  const int64_t old_contiguous_size(contiguous_size_);
+  for (const Logged* entry : new_entries) {
+    InsertEntryMapping(entry->sequence_number());
+  }
+  if (contiguous_size_ != old_contiguous_size) {
+    // This need not be written with the entries: BuildIndex() picks up
+    // any contiguous entries beyond the stored size.
+    const rocksdb::Status status(
+        db_->Put(rocksdb::WriteOptions(), cf(METADATA),
+                 kMetaContiguousSizeKey, EncodeUint64(contiguous_size_)));
+    CHECK(status.ok()) << "Failed to write contiguous size: "
+                       << status.ToString();
+  }
+
+  return this->OK;
+}
+
+
+// Adds the mapping of |hash| to |sequence_number| to |batch|, unless
+// |hash| is already mapped to a lower sequence number, either in the
+// database or in |pending|, which holds the mappings in |batch|. This
+// must be called with "lock_" held.
+template <class Logged>
+void RocksDB<Logged>::IndexHash(const std::string& hash,
+                                int64_t sequence_number,
+                                rocksdb::WriteBatch* batch,
+                                std::map<std::string, int64_t>* pending) const {
+  const auto it(pending->find(hash));
+  if (it != pending->end()) {
+    if (it->second <= sequence_number) {
+      return;
+    }
+  } else {
+    std::string value;
+    const rocksdb::Status status(
+        db_->Get(rocksdb::ReadOptions(), cf(HASHES), hash, &value));
+    if (status.ok()) {
+      // This is a duplicate hash under a new sequence number. Make
+      // sure we track the entry with the lowest sequence number.
+      if (static_cast<int64_t>(DecodeUint64(value)) <= sequence_number) {
+        return;
+      }
+    } else {
+      CHECK(status.IsNotFound()) << "Failed to get index of hash("
+                                 << util::HexString(hash)
+                                 << "): " << status.ToString();
+    }
+  }
+
+  batch->Put(cf(HASHES), hash, EncodeUint64(sequence_number));
+  (*pending)[hash] = sequence_number;
+}
+
+
+// This must be called with "lock_" held.
+template <class Logged>
+void RocksDB<Logged>::InsertEntryMapping(int64_t sequence_number) {
+  if (sequence_number == contiguous_size_) {
+    // Readers don't take "lock_", so only publish the final size.
+    int64_t contiguous_size(contiguous_size_ + 1);
+    for (auto i = sparse_entries_.find(contiguous_size);
+         i != sparse_entries_.end() && *i == contiguous_size;) {
+      ++contiguous_size;
+      i = sparse_entries_.erase(i);
+    }
+    contiguous_size_ = contiguous_size;
+  } else {
+    // It's not contiguous, put it with the other sparse entries.
+    CHECK(sparse_entries_.insert(sequence_number).second)
+        << "sequence number " << sequence_number << " already assigned.";
+  }
+}
+
+
+#endif  // CERT_TRANS_LOG_ROCKSDB_DB_INL_H_
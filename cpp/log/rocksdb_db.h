@@ -0,0 +1,149 @@
+#ifndef CERT_TRANS_LOG_ROCKSDB_DB_H_
+#define CERT_TRANS_LOG_ROCKSDB_DB_H_
+
+#include "config.h"
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <rocksdb/cache.h>
+#include <rocksdb/db.h>
+#include <rocksdb/write_batch.h>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "log/database.h"
+#include "merkletree/tree_hasher.h"
+#include "proto/ct.pb.h"
+
+
+// A database in RocksDB, with the entries, the hash index, the leaf
+// hashes and the tree heads each in a column family of their own, so
+// that they can be tuned (and compacted) apart: the entries are large
+// and read in order, while the hash index is only ever used for point
+// lookups of random keys, which a Bloom filter saves most of.
+//
+// Compared to LevelDB, this always stores the leaf hashes, and has no
+// support (yet) for raw leaves, shared chain certificates, entry
+// dictionaries or subtree hashes.
+template <class Logged>
+class RocksDB : public Database<Logged> {
+ public:
+  explicit RocksDB(const std::string& dbfile);
+  // Opens |dbfile|, which another process writes to, as a read-only
+  // secondary instance, keeping its own logs in |secondary_dir|. It
+  // follows the writer with CatchUp(), and can't be written to.
+  RocksDB(const std::string& dbfile, const std::string& secondary_dir);
+  ~RocksDB() = default;
+
+  // Implement abstract functions, see database.h for comments.
+  typename Database<Logged>::WriteResult CreateSequencedEntry_(
+      const Logged& logged) override;
+
+  // Writes all the new entries in a single rocksdb::WriteBatch, so
+  // either all of them are written, or none.
+  typename Database<Logged>::WriteResult CreateSequencedEntries_(
+      const std::vector<const Logged*>& logged) override;
+
+  typename Database<Logged>::LookupResult LookupByHash(
+      const std::string& hash, Logged* result) const override;
+
+  typename Database<Logged>::LookupResult LookupByIndex(
+      int64_t sequence_number, Logged* result) const override;
+
+  std::unique_ptr<typename Database<Logged>::Iterator> ScanEntries(
+      int64_t start_index) const override;
+
+  // Reads the leaf hashes stored with the entries.
+  std::unique_ptr<typename Database<Logged>::LeafHashIterator> ScanLeafHashes(
+      int64_t start_index) const override;
+
+  typename Database<Logged>::WriteResult WriteTreeHead_(
+      const ct::SignedTreeHead& sth) override;
+
+  typename Database<Logged>::LookupResult LatestTreeHead(
+      ct::SignedTreeHead* result) const override;
+
+  int64_t TreeSize() const override;
+
+  std::vector<int64_t> SparseEntries() const override;
+
+  void AddNotifySTHCallback(
+      const typename Database<Logged>::NotifySTHCallback* callback) override;
+
+  void RemoveNotifySTHCallback(
+      const typename Database<Logged>::NotifySTHCallback* callback) override;
+
+  void InitializeNode(const std::string& node_id) override;
+
+  typename Database<Logged>::LookupResult NodeId(
+      std::string* node_id) override;
+
+  // Does nothing unless this is a secondary instance.
+  util::Status CatchUp() override;
+
+ private:
+  class Iterator;
+  class LeafHashIterator;
+
+  // The column families, in the order they are opened in.
+  enum ColumnFamily {
+    METADATA,
+    ENTRIES,
+    HASHES,
+    LEAF_HASHES,
+    TREE_HEADS,
+    NUM_COLUMN_FAMILIES,
+  };
+
+  rocksdb::ColumnFamilyHandle* cf(ColumnFamily family) const {
+    return column_families_[family].get();
+  }
+  void Open(const std::string& dbfile, const std::string& secondary_dir);
+  void BuildIndex();
+  void IndexNewEntries();
+  void ReadLatestTreeTimestamp();
+  typename Database<Logged>::LookupResult LatestTreeHeadNoLock(
+      ct::SignedTreeHead* result) const;
+  typename Database<Logged>::WriteResult WriteEntries(
+      const std::vector<const Logged*>& logged);
+  void IndexHash(const std::string& hash, int64_t sequence_number,
+                 rocksdb::WriteBatch* batch,
+                 std::map<std::string, int64_t>* pending) const;
+  void InsertEntryMapping(int64_t sequence_number);
+
+  const bool secondary_;
+
+  // Serializes the writers (and CatchUp()). Readers don't need it:
+  // rocksdb is thread-safe, and the sizes and timestamp they read are
+  // atomic.
+  mutable std::mutex lock_;
+  // Shared by the column families, may be null to use rocksdb's
+  // default.
+  const std::shared_ptr<rocksdb::Cache> block_cache_;
+  std::unique_ptr<rocksdb::DB> db_;
+  // These must be released before db_ is, so keep this order.
+  std::vector<std::unique_ptr<rocksdb::ColumnFamilyHandle>> column_families_;
+
+  std::atomic<int64_t> contiguous_size_;
+
+  // This is a mapping of the non-contiguous entries of the log (which
+  // can happen while it is being fetched). When entries here become
+  // contiguous with the beginning of the tree, they are removed.
+  std::set<int64_t> sparse_entries_;
+
+  const TreeHasher tree_hasher_;
+
+  // The tree head with this timestamp is written before this is set.
+  std::atomic<uint64_t> latest_tree_timestamp_;
+  cert_trans::DatabaseNotifierHelper callbacks_;
+
+  DISALLOW_COPY_AND_ASSIGN(RocksDB);
+};
+
+
+#endif  // CERT_TRANS_LOG_ROCKSDB_DB_H_
@@ -0,0 +1,303 @@
+#include "log/segment_storage.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::unique_lock;
+
+namespace cert_trans {
+
+namespace {
+
+const char kRecordType = 0x01;
+const char kIndexType = 0x02;
+// Type, key length and data length.
+const size_t kRecordHeaderSize = 1 + 4 + 4;
+// Index offset and magic number.
+const size_t kTrailerSize = 8 + 8;
+// "CTSEGIDX"
+const uint64_t kIndexMagic = 0x4354534547494458ULL;
+
+
+void PutUint(uint64_t value, size_t bytes, string* out) {
+  for (size_t i = bytes; i > 0; --i) {
+    out->push_back(static_cast<char>((value >> (8 * (i - 1))) & 0xff));
+  }
+}
+
+
+uint64_t GetUint(const char* data, size_t bytes) {
+  uint64_t value(0);
+  for (size_t i = 0; i < bytes; ++i) {
+    value = (value << 8) | static_cast<unsigned char>(data[i]);
+  }
+  return value;
+}
+
+
+void ReadAll(int fd, int64_t offset, size_t size, string* result) {
+  result->resize(size);
+  size_t done(0);
+  while (done < size) {
+    const ssize_t ret(
+        pread(fd, &(*result)[done], size - done, offset + done));
+    CHECK_GT(ret, 0) << "pread failed: " << strerror(errno);
+    done += ret;
+  }
+}
+
+
+void WriteAll(int fd, int64_t offset, const string& data) {
+  size_t done(0);
+  while (done < data.size()) {
+    const ssize_t ret(
+        pwrite(fd, data.data() + done, data.size() - done, offset + done));
+    CHECK_GT(ret, 0) << "pwrite failed: " << strerror(errno);
+    done += ret;
+  }
+}
+
+
+void AddIndexEntry(const string& key, int64_t offset, uint32_t size,
+                   string* index) {
+  PutUint(key.size(), 4, index);
+  index->append(key);
+  PutUint(offset, 8, index);
+  PutUint(size, 4, index);
+}
+
+
+}  // namespace
+
+
+SegmentStorage::SegmentStorage(const string& dir, int64_t max_segment_size)
+    : dir_(dir), max_segment_size_(max_segment_size), active_size_(0) {
+  CHECK_GT(max_segment_size_, 0);
+  if (mkdir(dir_.c_str(), 0700) != 0) {
+    CHECK_EQ(errno, EEXIST) << "mkdir " << dir_ << ": " << strerror(errno);
+  }
+
+  size_t segment(0);
+  bool sealed(true);
+  for (; access(SegmentPath(segment).c_str(), F_OK) == 0; ++segment) {
+    CHECK(sealed) << "segment " << SegmentPath(segment - 1)
+                  << " is not sealed, but is not the last one";
+    sealed = LoadSegment(segment);
+  }
+  CHECK_EQ(errno, ENOENT);
+
+  if (sealed) {
+    OpenSegment(segment);
+  }
+}
+
+
+SegmentStorage::~SegmentStorage() {
+  for (int fd : fds_) {
+    CHECK_EQ(0, close(fd));
+  }
+}
+
+
+std::set<string> SegmentStorage::Scan() const {
+  lock_guard<mutex> lock(lock_);
+  std::set<string> keys;
+  for (const auto& entry : locations_) {
+    keys.insert(entry.first);
+  }
+  return keys;
+}
+
+
+util::Status SegmentStorage::CreateEntry(const string& key,
+                                         const string& data) {
+  lock_guard<mutex> lock(lock_);
+  if (locations_.find(key) != locations_.end()) {
+    return util::Status(util::error::ALREADY_EXISTS,
+                        "entry already exists: " + key);
+  }
+  Append(key, data);
+  return util::Status::OK;
+}
+
+
+util::Status SegmentStorage::UpdateEntry(const string& key,
+                                         const string& data) {
+  lock_guard<mutex> lock(lock_);
+  if (locations_.find(key) == locations_.end()) {
+    return util::Status(util::error::NOT_FOUND,
+                        "tried to update non-existent entry: " + key);
+  }
+  Append(key, data);
+  return util::Status::OK;
+}
+
+
+util::Status SegmentStorage::LookupEntry(const string& key,
+                                         string* result) const {
+  unique_lock<mutex> lock(lock_);
+  const auto it(locations_.find(key));
+  if (it == locations_.end()) {
+    return util::Status(util::error::NOT_FOUND, "entry not found: " + key);
+  }
+  if (result) {
+    const int fd(fds_[it->second.segment]);
+    const Location location(it->second);
+    // Records are never overwritten, so they can be read without the
+    // lock.
+    lock.unlock();
+    ReadAll(fd, location.offset, location.size, result);
+  }
+  return util::Status::OK;
+}
+
+
+string SegmentStorage::SegmentPath(size_t segment) const {
+  char name[16];
+  CHECK_LT(snprintf(name, sizeof(name), "%08zu", segment),
+           static_cast<int>(sizeof(name)));
+  return dir_ + "/" + name;
+}
+
+
+// Returns whether the segment is sealed.
+bool SegmentStorage::LoadSegment(size_t segment) {
+  CHECK_EQ(segment, fds_.size());
+  const string path(SegmentPath(segment));
+  const int fd(open(path.c_str(), O_RDWR));
+  CHECK_GE(fd, 0) << "open " << path << ": " << strerror(errno);
+  fds_.push_back(fd);
+
+  struct stat st;
+  CHECK_EQ(0, fstat(fd, &st)) << "fstat " << path << ": " << strerror(errno);
+  if (LoadSegmentIndex(segment, st.st_size)) {
+    return true;
+  }
+  LoadSegmentRecords(segment, st.st_size);
+  return false;
+}
+
+
+bool SegmentStorage::LoadSegmentIndex(size_t segment, int64_t file_size) {
+  if (file_size < static_cast<int64_t>(kRecordHeaderSize + kTrailerSize)) {
+    return false;
+  }
+  const int fd(fds_[segment]);
+  string trailer;
+  ReadAll(fd, file_size - kTrailerSize, kTrailerSize, &trailer);
+  const int64_t index_offset(GetUint(trailer.data(), 8));
+  if (GetUint(trailer.data() + 8, 8) != kIndexMagic || index_offset < 0 ||
+      index_offset >= file_size - static_cast<int64_t>(kTrailerSize)) {
+    return false;
+  }
+
+  string index;
+  ReadAll(fd, index_offset, file_size - kTrailerSize - index_offset, &index);
+  if (index[0] != kIndexType) {
+    return false;
+  }
+  size_t pos(1);
+  while (pos < index.size()) {
+    CHECK_LE(pos + 4, index.size()) << "corrupt index in "
+                                    << SegmentPath(segment);
+    const size_t key_size(GetUint(index.data() + pos, 4));
+    pos += 4;
+    CHECK_LE(pos + key_size + 8 + 4, index.size()) << "corrupt index in "
+                                                   << SegmentPath(segment);
+    const string key(index, pos, key_size);
+    pos += key_size;
+    const int64_t offset(GetUint(index.data() + pos, 8));
+    pos += 8;
+    const uint32_t size(GetUint(index.data() + pos, 4));
+    pos += 4;
+    locations_[key] = Location{segment, offset, size};
+  }
+  return true;
+}
+
+
+void SegmentStorage::LoadSegmentRecords(size_t segment, int64_t file_size) {
+  const int fd(fds_[segment]);
+  int64_t offset(0);
+  string header, key;
+  while (offset + static_cast<int64_t>(kRecordHeaderSize) <= file_size) {
+    ReadAll(fd, offset, kRecordHeaderSize, &header);
+    const size_t key_size(GetUint(header.data() + 1, 4));
+    const uint32_t data_size(GetUint(header.data() + 5, 4));
+    const int64_t data_offset(offset + kRecordHeaderSize + key_size);
+    // Stop at a partial index, or a partial record.
+    if (header[0] != kRecordType || data_offset + data_size > file_size) {
+      break;
+    }
+    ReadAll(fd, offset + kRecordHeaderSize, key_size, &key);
+    locations_[key] = Location{segment, data_offset, data_size};
+    AddIndexEntry(key, data_offset, data_size, &active_index_);
+    offset = data_offset + data_size;
+  }
+
+  if (offset < file_size) {
+    LOG(WARNING) << "Dropping " << file_size - offset << " trailing bytes "
+                 << "from " << SegmentPath(segment);
+    CHECK_EQ(0, ftruncate(fd, offset)) << "ftruncate: " << strerror(errno);
+  }
+  active_size_ = offset;
+}
+
+
+void SegmentStorage::OpenSegment(size_t segment) {
+  CHECK_EQ(segment, fds_.size());
+  const string path(SegmentPath(segment));
+  const int fd(open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600));
+  CHECK_GE(fd, 0) << "open " << path << ": " << strerror(errno);
+  fds_.push_back(fd);
+  active_size_ = 0;
+  active_index_.clear();
+}
+
+
+void SegmentStorage::Append(const string& key, const string& data) {
+  CHECK_LE(key.size(), UINT32_MAX);
+  CHECK_LE(data.size(), UINT32_MAX);
+  string record;
+  record.reserve(kRecordHeaderSize + key.size() + data.size());
+  record.push_back(kRecordType);
+  PutUint(key.size(), 4, &record);
+  PutUint(data.size(), 4, &record);
+  record.append(key);
+  record.append(data);
+  WriteAll(fds_.back(), active_size_, record);
+
+  const int64_t data_offset(active_size_ + kRecordHeaderSize + key.size());
+  locations_[key] = Location{fds_.size() - 1, data_offset,
+                             static_cast<uint32_t>(data.size())};
+  AddIndexEntry(key, data_offset, data.size(), &active_index_);
+  active_size_ += record.size();
+
+  if (active_size_ >= max_segment_size_) {
+    Seal();
+  }
+}
+
+
+void SegmentStorage::Seal() {
+  string footer;
+  footer.reserve(1 + active_index_.size() + kTrailerSize);
+  footer.push_back(kIndexType);
+  footer.append(active_index_);
+  PutUint(active_size_, 8, &footer);
+  PutUint(kIndexMagic, 8, &footer);
+  WriteAll(fds_.back(), active_size_, footer);
+
+  OpenSegment(fds_.size());
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,86 @@
+#ifndef CERT_TRANS_LOG_SEGMENT_STORAGE_H_
+#define CERT_TRANS_LOG_SEGMENT_STORAGE_H_
+
+#include <mutex>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "base/macros.h"
+#include "util/status.h"
+
+namespace cert_trans {
+
+// A (key, data) store with the same interface as FileStorage, which
+// appends the entries to a few large files instead of creating one
+// file per entry:
+//
+// <dir>/00000000, <dir>/00000001, ... - The segments, each a sequence
+//                  of records (key length, data length, key, data).
+//                  Once a segment grows past |max_segment_size|, it
+//                  is sealed by appending an index of its records
+//                  (key, offset and length of the data), followed by
+//                  the offset of that index and a magic number, and
+//                  the following segment is started.
+//
+// On startup, only the index is read from the sealed segments, and
+// the records of the last one are read back, dropping a partial
+// record left by a crash. Updates are appended like new entries, and
+// the last record for a key wins.
+//
+// SegmentStorage aborts upon any I/O error. This class is threadsafe.
+class SegmentStorage {
+ public:
+  SegmentStorage(const std::string& dir, int64_t max_segment_size);
+  ~SegmentStorage();
+
+  // Return the list of keys.
+  std::set<std::string> Scan() const;
+
+  // Write (key, data) unless an entry matching |key| already exists.
+  util::Status CreateEntry(const std::string& key, const std::string& data);
+
+  // Update an existing entry; fail if it doesn't already exist.
+  util::Status UpdateEntry(const std::string& key, const std::string& data);
+
+  // Lookup entry based on key.
+  util::Status LookupEntry(const std::string& key, std::string* result) const;
+
+ private:
+  struct Location {
+    size_t segment;
+    int64_t offset;
+    uint32_t size;
+  };
+
+  std::string SegmentPath(size_t segment) const;
+  // These must be called with "lock_" held, or from the constructor.
+  bool LoadSegment(size_t segment);
+  bool LoadSegmentIndex(size_t segment, int64_t file_size);
+  void LoadSegmentRecords(size_t segment, int64_t file_size);
+  void OpenSegment(size_t segment);
+  void Append(const std::string& key, const std::string& data);
+  void Seal();
+
+  const std::string dir_;
+  const int64_t max_segment_size_;
+
+  mutable std::mutex lock_;
+  // The file descriptors of the segments, the last one being the one
+  // appended to. These are only closed on destruction.
+  std::vector<int> fds_;
+  // The size of the last segment.
+  int64_t active_size_;
+  // The index records of the last segment, written out when sealing it.
+  std::string active_index_;
+  std::unordered_map<std::string, Location> locations_;
+
+  DISALLOW_COPY_AND_ASSIGN(SegmentStorage);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_SEGMENT_STORAGE_H_
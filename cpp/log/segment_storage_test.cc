@@ -0,0 +1,140 @@
+#include "log/segment_storage.h"
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <set>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util/test_db.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::set;
+using std::string;
+using std::unique_ptr;
+
+// Small enough for a segment to be sealed every few entries.
+const int64_t kSegmentSize = 64;
+
+
+class SegmentStorageTest : public ::testing::Test {
+ protected:
+  SegmentStorageTest() : dir_(tmp_.TmpStorageDir() + "/segments") {
+    Reopen();
+  }
+
+  void Reopen() {
+    storage_.reset();
+    storage_.reset(new SegmentStorage(dir_, kSegmentSize));
+  }
+
+  string Key(int i) const {
+    return "key" + std::to_string(i);
+  }
+
+  string Value(int i) const {
+    return "value of entry " + std::to_string(i);
+  }
+
+  void ExpectEntries(int count) {
+    set<string> keys;
+    string data;
+    for (int i = 0; i < count; ++i) {
+      keys.insert(Key(i));
+      ASSERT_TRUE(storage_->LookupEntry(Key(i), &data).ok()) << i;
+      EXPECT_EQ(Value(i), data);
+    }
+    EXPECT_EQ(keys, storage_->Scan());
+  }
+
+  bool SegmentExists(int segment) const {
+    const string path(dir_ + "/0000000" + std::to_string(segment));
+    return access(path.c_str(), F_OK) == 0;
+  }
+
+  TmpStorage tmp_;
+  const string dir_;
+  unique_ptr<SegmentStorage> storage_;
+};
+
+
+TEST_F(SegmentStorageTest, CreateLookupUpdate) {
+  string data;
+  EXPECT_EQ(util::error::NOT_FOUND,
+            storage_->LookupEntry(Key(0), &data).CanonicalCode());
+  EXPECT_EQ(util::error::NOT_FOUND,
+            storage_->UpdateEntry(Key(0), Value(0)).CanonicalCode());
+
+  EXPECT_EQ(util::Status::OK, storage_->CreateEntry(Key(0), Value(0)));
+  EXPECT_EQ(util::Status::OK, storage_->LookupEntry(Key(0), NULL));
+  EXPECT_EQ(util::error::ALREADY_EXISTS,
+            storage_->CreateEntry(Key(0), Value(1)).CanonicalCode());
+  ExpectEntries(1);
+
+  EXPECT_EQ(util::Status::OK, storage_->UpdateEntry(Key(0), "updated"));
+  EXPECT_EQ(util::Status::OK, storage_->LookupEntry(Key(0), &data));
+  EXPECT_EQ("updated", data);
+}
+
+
+TEST_F(SegmentStorageTest, SealsSegments) {
+  for (int i = 0; i < 20; ++i) {
+    ASSERT_EQ(util::Status::OK, storage_->CreateEntry(Key(i), Value(i)));
+  }
+  EXPECT_TRUE(SegmentExists(2));
+  ExpectEntries(20);
+
+  Reopen();
+  ExpectEntries(20);
+
+  // Entries can be added and updated after reopening.
+  EXPECT_EQ(util::Status::OK, storage_->CreateEntry(Key(20), Value(20)));
+  EXPECT_EQ(util::Status::OK, storage_->UpdateEntry(Key(0), "updated"));
+  Reopen();
+  string data;
+  EXPECT_EQ(util::Status::OK, storage_->LookupEntry(Key(0), &data));
+  EXPECT_EQ("updated", data);
+  EXPECT_EQ(util::Status::OK, storage_->LookupEntry(Key(20), &data));
+  EXPECT_EQ(Value(20), data);
+  EXPECT_EQ(21U, storage_->Scan().size());
+}
+
+
+TEST_F(SegmentStorageTest, DropsPartialRecord) {
+  // Stays in the first segment.
+  EXPECT_EQ(util::Status::OK, storage_->CreateEntry(Key(0), Value(0)));
+  storage_.reset();
+
+  // Simulate a crash in the middle of writing a record.
+  const string segment(dir_ + "/00000000");
+  struct stat st;
+  ASSERT_EQ(0, stat(segment.c_str(), &st));
+  FILE* file(fopen(segment.c_str(), "a"));
+  ASSERT_TRUE(file != NULL);
+  ASSERT_EQ(3U, fwrite("\x01\x00\x00", 1, 3, file));
+  fclose(file);
+
+  Reopen();
+  ExpectEntries(1);
+  struct stat truncated;
+  ASSERT_EQ(0, stat(segment.c_str(), &truncated));
+  EXPECT_EQ(st.st_size, truncated.st_size);
+
+  EXPECT_EQ(util::Status::OK, storage_->CreateEntry(Key(1), Value(1)));
+  Reopen();
+  ExpectEntries(2);
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,417 @@
+/* -*- indent-tabs-mode: nil -*- */
+// Measures the throughput of the sequencer, as run by ct-server: each
+// round assigns sequence numbers to the pending entries, signs a new
+// tree with them, and waits for the cluster to pick it as its serving
+// STH. The cluster is simulated with a FakeEtcdClient, with this node
+// as the master and --cluster_size - 1 other nodes that catch up with
+// each new tree after --peer_lag_ms, e.g.:
+//
+//   sequencer_benchmark --database=leveldb --backlog=100000 \
+//       --arrival_rate=2000 --duration_secs=60 --cluster_size=3
+//
+// It reports the entries sequenced per second, the merge delay of the
+// entries (from being added as pending to being in the serving STH),
+// and the time spent in each stage of a round.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <iostream>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fetcher/continuous_fetcher.h"
+#include "fetcher/peer.h"
+#include "log/cluster_state_controller-inl.h"
+#include "log/etcd_consistent_store.h"
+#include "log/logged_certificate.h"
+#include "log/test_db.h"
+#include "log/test_signer.h"
+#include "log/tree_signer-inl.h"
+#include "merkletree/compact_merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "net/url_fetcher.h"
+#include "proto/ct.pb.h"
+#include "util/fake_etcd.h"
+#include "util/init.h"
+#include "util/libevent_wrapper.h"
+#include "util/masterelection.h"
+#include "util/status.h"
+#include "util/sync_task.h"
+#include "util/thread_pool.h"
+#include "util/util.h"
+
+DEFINE_string(database, "leveldb",
+              "Database holding the sequenced entries: file, sqlite or "
+              "leveldb. It is created in --database_test_dir, and deleted on "
+              "exit.");
+DEFINE_int32(backlog, 100000,
+             "Number of pending entries added before the first round.");
+DEFINE_double(arrival_rate, 0,
+              "New pending entries added per second while the benchmark "
+              "runs, for --duration_secs.");
+DEFINE_int32(duration_secs, 10,
+             "How long to add new entries for, if --arrival_rate is set.");
+DEFINE_int32(entry_size, 1024, "Size of the leaf certificates, in bytes.");
+DEFINE_int32(round_period_ms, 0,
+             "Minimum time between the start of two rounds, as "
+             "--sequencing_frequency_seconds in ct-server.");
+DEFINE_double(guard_window_seconds, 0,
+              "Pending entries younger than this are left for a later round.");
+DEFINE_int32(cluster_size, 1,
+             "Number of nodes in the simulated cluster, including this one.");
+DEFINE_double(minimum_serving_fraction, 1,
+              "Fraction of the nodes that must have a tree for it to be "
+              "served.");
+DEFINE_int32(peer_lag_ms, 0,
+             "How long the other nodes take to catch up with a new tree.");
+DEFINE_int32(num_threads, 4, "Number of threads of the thread pool.");
+
+namespace {
+
+using cert_trans::ClusterStateController;
+using cert_trans::ContinuousFetcher;
+using cert_trans::EtcdClient;
+using cert_trans::EtcdConsistentStore;
+using cert_trans::FakeEtcdClient;
+using cert_trans::LoggedCertificate;
+using cert_trans::MasterElection;
+using cert_trans::Peer;
+using cert_trans::ThreadPool;
+using cert_trans::TreeSigner;
+using cert_trans::UrlFetcher;
+using ct::ClusterConfig;
+using ct::ClusterNodeState;
+using ct::SignedTreeHead;
+using std::atomic;
+using std::chrono::duration;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::make_shared;
+using std::shared_ptr;
+using std::string;
+using std::to_string;
+using std::unique_ptr;
+using std::vector;
+using util::Status;
+
+namespace libevent = cert_trans::libevent;
+
+const char kRoot[] = "/root";
+const int kAddBatchSize(1000);
+// How often the entries arriving at --arrival_rate are added.
+const milliseconds kArrivalTick(10);
+const milliseconds kServingSTHTimeout(60000);
+
+
+class FixedElection : public MasterElection {
+ public:
+  explicit FixedElection(bool master) : master_(master) {
+  }
+
+  bool IsMaster() const override {
+    return master_;
+  }
+
+ private:
+  const bool master_;
+};
+
+
+// The other nodes are simulated, there is nothing to fetch from them.
+class NullFetcher : public ContinuousFetcher {
+ public:
+  void AddPeer(const string&, const shared_ptr<Peer>&) override {
+  }
+  void RemovePeer(const string&) override {
+  }
+  void NewTreeSize(int64_t) override {
+  }
+};
+
+
+double ToMs(const steady_clock::duration& d) {
+  return duration<double, std::milli>(d).count();
+}
+
+
+void PrintDistribution(const string& name, vector<double>* values) {
+  if (values->empty()) {
+    std::cout << name << ": none\n";
+    return;
+  }
+  std::sort(values->begin(), values->end());
+  double total(0);
+  for (const double value : *values) {
+    total += value;
+  }
+  const auto quantile([values](double q) {
+    return (*values)[static_cast<size_t>(q * (values->size() - 1))];
+  });
+  std::cout << name << ": mean " << total / values->size() << " p50 "
+            << quantile(0.5) << " p90 " << quantile(0.9) << " p99 "
+            << quantile(0.99) << " max " << values->back() << "\n";
+}
+
+
+class SequencerBench {
+ public:
+  explicit SequencerBench(Database<LoggedCertificate>* db);
+  ~SequencerBench();
+
+  void Run();
+
+ private:
+  // Adds |count| new pending entries, timestamped now.
+  void AddPendingEntries(int count);
+  // Adds new entries at --arrival_rate for --duration_secs.
+  void AddArrivals();
+  // Returns once the serving STH is at least as new as |sth|, having
+  // had the other nodes catch up with it.
+  void WaitForServingSTH(const SignedTreeHead& sth);
+  // Adds the merge delays of the entries from |begin| to |end|, which
+  // are served as of |now_ms|.
+  void RecordMergeDelays(int64_t begin, int64_t end, uint64_t now_ms);
+
+  Database<LoggedCertificate>* const db_;
+  ThreadPool pool_;
+  const shared_ptr<libevent::Base> base_;
+  libevent::EventPumpThread pump_;
+  UrlFetcher url_fetcher_;
+  FakeEtcdClient etcd_;
+  FixedElection master_election_;
+  FixedElection peer_election_;
+  EtcdConsistentStore<LoggedCertificate> store_;
+  vector<unique_ptr<EtcdConsistentStore<LoggedCertificate>>> peer_stores_;
+  vector<ClusterNodeState> peer_states_;
+  NullFetcher fetcher_;
+  unique_ptr<TreeSigner<LoggedCertificate>> tree_signer_;
+  unique_ptr<ClusterStateController<LoggedCertificate>> controller_;
+
+  atomic<int64_t> num_added_;
+  atomic<bool> arrivals_done_;
+
+  vector<double> sequence_ms_;
+  vector<double> update_tree_ms_;
+  vector<double> serving_sth_ms_;
+  vector<double> merge_delay_ms_;
+};
+
+
+SequencerBench::SequencerBench(Database<LoggedCertificate>* db)
+    : db_(CHECK_NOTNULL(db)),
+      pool_(FLAGS_num_threads),
+      base_(make_shared<libevent::Base>()),
+      pump_(base_),
+      url_fetcher_(base_.get(), &pool_),
+      etcd_(base_.get()),
+      master_election_(true),
+      peer_election_(false),
+      store_(base_.get(), &pool_, &etcd_, &master_election_, kRoot, "node0"),
+      num_added_(0),
+      arrivals_done_(FLAGS_arrival_rate <= 0) {
+  // As "ct-clustertool initlog" would.
+  ClusterConfig config;
+  config.set_minimum_serving_nodes(1);
+  config.set_minimum_serving_fraction(FLAGS_minimum_serving_fraction);
+  CHECK_EQ(Status::OK, store_.SetClusterConfig(config));
+  {
+    util::SyncTask task(&pool_);
+    EtcdClient::Response resp;
+    etcd_.ForceSet(string(kRoot) + "/sequence_mapping", "", &resp,
+                   task.task());
+    task.Wait();
+    CHECK_EQ(Status::OK, task.status());
+  }
+  CHECK_EQ(Status::OK, store_.SetServingSTH(SignedTreeHead()));
+
+  for (int i = 1; i < FLAGS_cluster_size; ++i) {
+    const string node_id("node" + to_string(i));
+    peer_stores_.emplace_back(new EtcdConsistentStore<LoggedCertificate>(
+        base_.get(), &pool_, &etcd_, &peer_election_, kRoot, node_id));
+    peer_states_.emplace_back();
+    peer_states_.back().set_node_id(node_id);
+    peer_states_.back().set_hostname(node_id);
+    peer_states_.back().set_log_port(80);
+    CHECK_EQ(Status::OK,
+             peer_stores_.back()->SetClusterNodeState(peer_states_.back()));
+  }
+
+  tree_signer_.reset(new TreeSigner<LoggedCertificate>(
+      duration<double>(FLAGS_guard_window_seconds), db_,
+      unique_ptr<CompactMerkleTree>(new CompactMerkleTree(new Sha256Hasher)),
+      &store_, TestSigner::DefaultLogSigner(), &pool_));
+  controller_.reset(new ClusterStateController<LoggedCertificate>(
+      &pool_, base_, &url_fetcher_, db_, &store_, &master_election_,
+      &fetcher_));
+  controller_->SetNodeHostPort("node0", 80);
+}
+
+
+SequencerBench::~SequencerBench() {
+  controller_.reset();
+  tree_signer_.reset();
+}
+
+
+void SequencerBench::AddPendingEntries(int count) {
+  vector<LoggedCertificate> entries(count);
+  vector<LoggedCertificate*> pointers;
+  const uint64_t now_ms(util::TimeInMilliseconds());
+  for (auto& entry : entries) {
+    TestSigner::SetDefaults(&entry);
+    string cert(to_string(num_added_++) + ":");
+    cert.resize(std::max<size_t>(cert.size(), FLAGS_entry_size), 'x');
+    entry.mutable_entry()->mutable_x509_entry()->set_leaf_certificate(cert);
+    entry.mutable_sct()->set_timestamp(now_ms);
+    pointers.push_back(&entry);
+  }
+  vector<Status> statuses;
+  store_.AddPendingEntries(pointers, &statuses);
+  for (const auto& status : statuses) {
+    CHECK_EQ(Status::OK, status);
+  }
+}
+
+
+void SequencerBench::AddArrivals() {
+  const steady_clock::time_point start(steady_clock::now());
+  const steady_clock::time_point end(start +
+                                     std::chrono::seconds(FLAGS_duration_secs));
+  int64_t num_arrived(0);
+  for (steady_clock::time_point tick(start); tick < end; tick += kArrivalTick) {
+    std::this_thread::sleep_until(tick);
+    // Whatever is due by now, to keep up after a slow batch.
+    const int64_t due(FLAGS_arrival_rate *
+                      duration<double>(steady_clock::now() - start).count());
+    if (due > num_arrived) {
+      AddPendingEntries(due - num_arrived);
+      num_arrived = due;
+    }
+  }
+  arrivals_done_ = true;
+}
+
+
+void SequencerBench::WaitForServingSTH(const SignedTreeHead& sth) {
+  if (FLAGS_peer_lag_ms > 0) {
+    std::this_thread::sleep_for(milliseconds(FLAGS_peer_lag_ms));
+  }
+  for (size_t i = 0; i < peer_stores_.size(); ++i) {
+    peer_states_[i].mutable_newest_sth()->CopyFrom(sth);
+    CHECK_EQ(Status::OK,
+             peer_stores_[i]->SetClusterNodeState(peer_states_[i]));
+  }
+
+  const steady_clock::time_point deadline(steady_clock::now() +
+                                          kServingSTHTimeout);
+  while (true) {
+    const util::StatusOr<SignedTreeHead> serving(store_.GetServingSTH());
+    if (serving.ok() &&
+        serving.ValueOrDie().timestamp() >= sth.timestamp()) {
+      return;
+    }
+    CHECK(steady_clock::now() < deadline)
+        << "Timed out waiting for a serving STH of size " << sth.tree_size();
+    std::this_thread::sleep_for(milliseconds(1));
+  }
+}
+
+
+void SequencerBench::RecordMergeDelays(int64_t begin, int64_t end,
+                                       uint64_t now_ms) {
+  LoggedCertificate entry;
+  for (int64_t i = begin; i < end; ++i) {
+    CHECK_EQ(Database<LoggedCertificate>::LOOKUP_OK,
+             db_->LookupByIndex(i, &entry));
+    merge_delay_ms_.push_back(now_ms - entry.sct().timestamp());
+  }
+}
+
+
+void SequencerBench::Run() {
+  for (int added = 0; added < FLAGS_backlog; added += kAddBatchSize) {
+    AddPendingEntries(std::min(kAddBatchSize, FLAGS_backlog - added));
+  }
+  LOG(INFO) << "added a backlog of " << FLAGS_backlog << " entries";
+
+  std::thread arrivals;
+  if (FLAGS_arrival_rate > 0) {
+    arrivals = std::thread(&SequencerBench::AddArrivals, this);
+  }
+
+  const steady_clock::time_point start(steady_clock::now());
+  int64_t served_size(0);
+  int64_t rounds(0);
+  steady_clock::time_point next_round(start);
+  // Once the arrivals are done, everything added must get served.
+  while (!arrivals_done_ || served_size < num_added_) {
+    std::this_thread::sleep_until(next_round);
+    next_round = steady_clock::now() + milliseconds(FLAGS_round_period_ms);
+    ++rounds;
+
+    const steady_clock::time_point round_start(steady_clock::now());
+    CHECK_EQ(Status::OK, tree_signer_->SequenceNewEntries());
+    const steady_clock::time_point sequenced(steady_clock::now());
+    CHECK_EQ(TreeSigner<LoggedCertificate>::OK, tree_signer_->UpdateTree());
+    const SignedTreeHead sth(tree_signer_->LatestSTH());
+    const steady_clock::time_point signed_tree(steady_clock::now());
+    controller_->NewTreeHead(sth);
+    WaitForServingSTH(sth);
+    const steady_clock::time_point served(steady_clock::now());
+
+    sequence_ms_.push_back(ToMs(sequenced - round_start));
+    update_tree_ms_.push_back(ToMs(signed_tree - sequenced));
+    serving_sth_ms_.push_back(ToMs(served - signed_tree));
+    RecordMergeDelays(served_size, sth.tree_size(),
+                      util::TimeInMilliseconds());
+    VLOG(1) << "round " << rounds << ": served " << sth.tree_size();
+    served_size = sth.tree_size();
+  }
+  const double secs(duration<double>(steady_clock::now() - start).count());
+  if (arrivals.joinable()) {
+    arrivals.join();
+  }
+
+  std::cout << "sequenced " << served_size << " entries in " << rounds
+            << " rounds, " << secs << " s: " << served_size / secs
+            << " entries/s\n";
+  PrintDistribution("merge delay (ms)", &merge_delay_ms_);
+  PrintDistribution("SequenceNewEntries (ms/round)", &sequence_ms_);
+  PrintDistribution("UpdateTree (ms/round)", &update_tree_ms_);
+  PrintDistribution("serving STH (ms/round)", &serving_sth_ms_);
+}
+
+
+template <class DB>
+void RunBenchmark() {
+  TestDB<DB> test_db;
+  SequencerBench(test_db.db()).Run();
+}
+
+
+}  // namespace
+
+
+int main(int argc, char* argv[]) {
+  util::InitCT(&argc, &argv);
+  CHECK_GE(FLAGS_backlog, 0);
+  CHECK_GT(FLAGS_cluster_size, 0);
+  CHECK_GE(FLAGS_round_period_ms, 0);
+  CHECK_GE(FLAGS_peer_lag_ms, 0);
+
+  if (FLAGS_database == "file") {
+    RunBenchmark<FileDB<LoggedCertificate>>();
+  } else if (FLAGS_database == "sqlite") {
+    RunBenchmark<SQLiteDB<LoggedCertificate>>();
+  } else if (FLAGS_database == "leveldb") {
+    RunBenchmark<LevelDB<LoggedCertificate>>();
+  } else {
+    LOG(FATAL) << "Unknown --database: " << FLAGS_database;
+  }
+  return 0;
+}
@@ -1,28 +1,69 @@
 /* -*- indent-tabs-mode: nil -*- */
 #include "log/signer.h"
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <openssl/bn.h>
+#include <openssl/ecdsa.h>
 #include <openssl/evp.h>
 #include <openssl/opensslv.h>
+#include <openssl/sha.h>
 #include <stdint.h>
 
 #include "log/verifier.h"
 #include "proto/ct.pb.h"
+#include "util/task.h"
 #include "util/util.h"
 
 #if OPENSSL_VERSION_NUMBER < 0x10000000
 #error "Need OpenSSL >= 1.0.0"
 #endif
 
+DEFINE_int32(ecdsa_precomputed_nonces, 0,
+             "Number of ECDSA nonces to keep precomputed in the background, "
+             "for each signer using an ECDSA key. Zero disables the "
+             "precomputation.");
+
 using cert_trans::Verifier;
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::unique_lock;
+using std::unique_ptr;
 
 namespace cert_trans {
 
-Signer::Signer(EVP_PKEY* pkey) : pkey_(CHECK_NOTNULL(pkey)) {
+
+class Signer::Nonce {
+ public:
+  Nonce() : kinv_(NULL), rp_(NULL) {
+  }
+
+  ~Nonce() {
+    BN_clear_free(kinv_);
+    BN_clear_free(rp_);
+  }
+
+  // Nonces are secret, so they are cleared when freed.
+  BIGNUM* kinv_;
+  BIGNUM* rp_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(Nonce);
+};
+
+
+Signer::Signer(EVP_PKEY* pkey)
+    : pkey_(CHECK_NOTNULL(pkey)),
+      ec_key_(NULL),
+      num_precomputed_nonces_(FLAGS_ecdsa_precomputed_nonces),
+      exiting_(false) {
+  CHECK_GE(FLAGS_ecdsa_precomputed_nonces, 0);
   switch (pkey_->type) {
     case EVP_PKEY_EC:
       hash_algo_ = ct::DigitallySigned::SHA256;
       sig_algo_ = ct::DigitallySigned::ECDSA;
+      ec_key_ = CHECK_NOTNULL(EVP_PKEY_get1_EC_KEY(pkey_));
       break;
     case EVP_PKEY_RSA:
       hash_algo_ = ct::DigitallySigned::SHA256;
@@ -32,9 +73,26 @@ Signer::Signer(EVP_PKEY* pkey) : pkey_(CHECK_NOTNULL(pkey)) {
       LOG(FATAL) << "Unsupported key type " << pkey_->type;
   }
   key_id_ = Verifier::ComputeKeyID(pkey_);
+
+  if (ec_key_ && num_precomputed_nonces_ > 0) {
+    precompute_thread_ = std::thread(&Signer::PrecomputeNonces, this);
+  }
 }
 
 Signer::~Signer() {
+  {
+    lock_guard<mutex> lock(nonces_lock_);
+    exiting_ = true;
+  }
+  nonces_cv_.notify_all();
+  if (precompute_thread_.joinable()) {
+    precompute_thread_.join();
+  }
+  // Clear the nonces before the key they were computed for.
+  nonces_.clear();
+  if (ec_key_) {
+    EC_KEY_free(ec_key_);
+  }
   EVP_PKEY_free(pkey_);
 }
 
@@ -49,13 +107,27 @@ void Signer::Sign(const std::string& data,
   signature->set_signature(RawSign(data));
 }
 
+void Signer::SignAsync(const std::string& data,
+                       ct::DigitallySigned* signature,
+                       util::Task* task) const {
+  Sign(data, signature);
+  task->Return();
+}
+
 Signer::Signer()
     : pkey_(NULL),
       hash_algo_(ct::DigitallySigned::NONE),
-      sig_algo_(ct::DigitallySigned::ANONYMOUS) {
+      sig_algo_(ct::DigitallySigned::ANONYMOUS),
+      ec_key_(NULL),
+      num_precomputed_nonces_(0),
+      exiting_(false) {
 }
 
 std::string Signer::RawSign(const std::string& data) const {
+  if (ec_key_) {
+    return ECDSASign(data);
+  }
+
   EVP_MD_CTX ctx;
   EVP_MD_CTX_init(&ctx);
   // NOTE: this syntax for setting the hash function requires OpenSSL >= 1.0.0.
@@ -73,4 +145,72 @@ std::string Signer::RawSign(const std::string& data) const {
   return ret;
 }
 
+// Produces the same DER-encoded signature as EVP_SignFinal() would, but
+// hashes in one go, and uses a precomputed nonce when there is one.
+std::string Signer::ECDSASign(const std::string& data) const {
+  unsigned char digest[SHA256_DIGEST_LENGTH];
+  SHA256(reinterpret_cast<const unsigned char*>(data.data()), data.size(),
+         digest);
+
+  const unique_ptr<Nonce> nonce(TakeNonce());
+  ECDSA_SIG* sig(nullptr);
+  if (nonce) {
+    sig = ECDSA_do_sign_ex(digest, sizeof(digest), nonce->kinv_, nonce->rp_,
+                           ec_key_);
+  }
+  if (!sig) {
+    // Either there was no nonce ready, or (very unlikely) it could not
+    // be used, in which case OpenSSL wants a new one.
+    sig = CHECK_NOTNULL(ECDSA_do_sign(digest, sizeof(digest), ec_key_));
+  }
+
+  const int sig_size(i2d_ECDSA_SIG(sig, NULL));
+  CHECK_GT(sig_size, 0);
+  string ret(sig_size, '\0');
+  unsigned char* out(reinterpret_cast<unsigned char*>(&ret[0]));
+  CHECK_EQ(sig_size, i2d_ECDSA_SIG(sig, &out));
+  ECDSA_SIG_free(sig);
+  return ret;
+}
+
+unique_ptr<Signer::Nonce> Signer::TakeNonce() const {
+  if (num_precomputed_nonces_ == 0) {
+    return nullptr;
+  }
+  unique_ptr<Nonce> nonce;
+  {
+    lock_guard<mutex> lock(nonces_lock_);
+    if (nonces_.empty()) {
+      VLOG(1) << "Ran out of precomputed ECDSA nonces.";
+    } else {
+      nonce = std::move(nonces_.front());
+      nonces_.pop_front();
+    }
+  }
+  nonces_cv_.notify_all();
+  return nonce;
+}
+
+void Signer::PrecomputeNonces() {
+  BN_CTX* const ctx(CHECK_NOTNULL(BN_CTX_new()));
+  unique_lock<mutex> lock(nonces_lock_);
+  while (true) {
+    nonces_cv_.wait(lock, [this]() {
+      return exiting_ || nonces_.size() < num_precomputed_nonces_;
+    });
+    if (exiting_) {
+      break;
+    }
+
+    lock.unlock();
+    unique_ptr<Nonce> nonce(new Nonce);
+    CHECK_EQ(1, ECDSA_sign_setup(ec_key_, ctx, &nonce->kinv_, &nonce->rp_));
+    lock.lock();
+    nonces_.emplace_back(std::move(nonce));
+  }
+  lock.unlock();
+  BN_CTX_free(ctx);
+}
+
+
 }  // namespace cert_trans
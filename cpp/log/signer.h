@@ -3,15 +3,28 @@
 #ifndef SRC_LOG_SIGNER_H_
 #define SRC_LOG_SIGNER_H_
 
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <openssl/ec.h>
 #include <openssl/evp.h>
 #include <openssl/x509.h>  // for i2d_PUBKEY
 #include <stdint.h>
+#include <thread>
 
 #include "base/macros.h"
 #include "proto/ct.pb.h"
 
+namespace util {
+class Task;
+}  // namespace util
+
 namespace cert_trans {
 
+// With an ECDSA key, and --ecdsa_precomputed_nonces set, a background
+// thread keeps that many nonces ready, so that most of the cost of
+// each signature is paid ahead of time.
 class Signer {
  public:
   explicit Signer(EVP_PKEY* pkey);
@@ -22,17 +35,40 @@ class Signer {
   virtual void Sign(const std::string& data,
                     ct::DigitallySigned* signature) const;
 
+  // Like Sign(), but returns |task| once |signature| is set, which lets
+  // signers with a remote key avoid holding the calling thread. By
+  // default, this is the same as Sign().
+  virtual void SignAsync(const std::string& data,
+                         ct::DigitallySigned* signature,
+                         util::Task* task) const;
+
  protected:
   // A constructor for mocking.
   Signer();
 
  private:
+  // The (k^-1, r) pair of an ECDSA signature with a random k.
+  class Nonce;
+
   std::string RawSign(const std::string& data) const;
+  std::string ECDSASign(const std::string& data) const;
+  // Returns NULL if there is no precomputed nonce available.
+  std::unique_ptr<Nonce> TakeNonce() const;
+  void PrecomputeNonces();
 
   EVP_PKEY* pkey_;
   ct::DigitallySigned::HashAlgorithm hash_algo_;
   ct::DigitallySigned::SignatureAlgorithm sig_algo_;
   std::string key_id_;
+  // Only set for ECDSA keys.
+  EC_KEY* ec_key_;
+
+  const size_t num_precomputed_nonces_;
+  mutable std::mutex nonces_lock_;
+  mutable std::condition_variable nonces_cv_;
+  mutable std::deque<std::unique_ptr<Nonce>> nonces_;
+  bool exiting_;
+  std::thread precompute_thread_;
 
   DISALLOW_COPY_AND_ASSIGN(Signer);
 };
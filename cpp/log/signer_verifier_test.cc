@@ -1,8 +1,13 @@
 /* -*- indent-tabs-mode: nil -*- */
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
+#include <memory>
+#include <set>
 #include <stdint.h>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "log/signer.h"
 #include "log/test_signer.h"
@@ -12,9 +17,15 @@
 #include "util/testing.h"
 #include "util/util.h"
 
+DECLARE_int32(ecdsa_precomputed_nonces);
+
 using cert_trans::Verifier;
 using ct::DigitallySigned;
+using std::set;
 using std::string;
+using std::thread;
+using std::unique_ptr;
+using std::vector;
 
 namespace cert_trans {
 namespace {
@@ -90,6 +101,48 @@ TEST_F(SignerVerifierTest, SignAndVerify) {
   EXPECT_EQ(Verifier::OK, verifier_->Verify(kTestString, signature2));
 }
 
+// With precomputed nonces, the signatures all verify, and never reuse
+// a nonce (the first half of an ECDSA signature is derived from it).
+TEST_F(SignerVerifierTest, SignAndVerifyWithPrecomputedNonces) {
+  FLAGS_ecdsa_precomputed_nonces = 4;
+  const unique_ptr<Signer> signer(TestSigner::DefaultSigner());
+  FLAGS_ecdsa_precomputed_nonces = 0;
+
+  set<string> signatures;
+  for (int i = 0; i < 20; ++i) {
+    DigitallySigned signature;
+    signer->Sign(kTestString, &signature);
+    EXPECT_EQ(DigitallySigned::SHA256, signature.hash_algorithm());
+    EXPECT_EQ(DigitallySigned::ECDSA, signature.sig_algorithm());
+    EXPECT_EQ(Verifier::OK, verifier_->Verify(kTestString, signature));
+    EXPECT_TRUE(signatures.insert(signature.signature()).second);
+  }
+}
+
+// The verifier is shared by the threads which fetch and audit
+// entries, and the failures of some mustn't affect the others.
+TEST_F(SignerVerifierTest, VerifyFromManyThreads) {
+  DigitallySigned good_signature;
+  signer_->Sign(kTestString, &good_signature);
+  DigitallySigned bad_signature(good_signature);
+  bad_signature.mutable_signature()->back() ^= 0x01;
+
+  vector<thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([this, &good_signature, &bad_signature]() {
+      for (int j = 0; j < 50; ++j) {
+        EXPECT_EQ(Verifier::OK,
+                  verifier_->Verify(kTestString, good_signature));
+        EXPECT_EQ(Verifier::INVALID_SIGNATURE,
+                  verifier_->Verify(kTestString, bad_signature));
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+}
+
 // Check various error cases.
 TEST_F(SignerVerifierTest, Errors) {
   DigitallySigned signature;
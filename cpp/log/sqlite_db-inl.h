@@ -4,6 +4,7 @@
 
 #include "log/sqlite_db.h"
 
+#include <chrono>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <sqlite3.h>
@@ -38,6 +39,12 @@ DEFINE_bool(sqlite_batch_into_transactions, true,
             "scenes.");
 DEFINE_int32(sqlite_transaction_batch_size, 400,
              "Max number of operations to batch into one transaction.");
+DEFINE_int32(sqlite_group_commit_delay_ms, 0,
+             "If non-zero, writes wait for up to this long for others to "
+             "share their transaction with, up to "
+             "sqlite_transaction_batch_size operations, and only return "
+             "once it is committed. Requires "
+             "--nosqlite_batch_into_transactions.");
 
 
 namespace {
@@ -130,9 +137,17 @@ class SQLiteDB<Logged>::Iterator : public Database<Logged>::Iterator {
 template <class Logged>
 SQLiteDB<Logged>::SQLiteDB(const std::string& dbfile)
     : db_(SQLiteOpen(dbfile)),
+      statements_(db_),
       tree_size_(0),
       transaction_size_(0),
-      in_transaction_(false) {
+      in_transaction_(false),
+      group_size_(0),
+      group_generation_(0) {
+  CHECK_GE(FLAGS_sqlite_group_commit_delay_ms, 0);
+  CHECK(FLAGS_sqlite_group_commit_delay_ms == 0 ||
+        !FLAGS_sqlite_batch_into_transactions)
+      << "--sqlite_group_commit_delay_ms requires "
+      << "--nosqlite_batch_into_transactions";
   std::unique_lock<std::mutex> lock(lock_);
   {
     std::ostringstream oss;
@@ -171,6 +186,7 @@ SQLiteDB<Logged>::SQLiteDB(const std::string& dbfile)
 
 template <class Logged>
 SQLiteDB<Logged>::~SQLiteDB() {
+  statements_.Clear();
   CHECK_EQ(SQLITE_OK, sqlite3_close(db_));
 }
 
@@ -183,8 +199,59 @@ typename Database<Logged>::WriteResult SQLiteDB<Logged>::CreateSequencedEntry_(
   std::unique_lock<std::mutex> lock(lock_);
 
   MaybeStartNewTransaction(lock);
+  StartGroup(lock);
 
-  sqlite::Statement statement(db_,
+  const WriteResult result(InsertEntry(lock, logged));
+  WaitForGroupCommit(&lock, 1);
+
+  return result;
+}
+
+
+template <class Logged>
+typename Database<Logged>::WriteResult
+SQLiteDB<Logged>::CreateSequencedEntries_(
+    const std::vector<const Logged*>& logged) {
+  cert_trans::ScopedLatency latency(
+      latency_by_op_ms.GetScopedLatency("create_sequenced_entries"));
+  std::unique_lock<std::mutex> lock(lock_);
+
+  // The whole batch counts as a single operation towards the size of
+  // the background transaction. Without background transactions, use
+  // one of our own.
+  MaybeStartNewTransaction(lock);
+  StartGroup(lock);
+  const bool own_transaction(!FLAGS_sqlite_batch_into_transactions &&
+                             !in_transaction_);
+  if (own_transaction) {
+    sqlite::Statement s(&statements_, "BEGIN TRANSACTION");
+    CHECK_EQ(SQLITE_DONE, s.Step());
+  }
+
+  typename Database<Logged>::WriteResult result(this->OK);
+  for (const Logged* entry : logged) {
+    result = InsertEntry(lock, *entry);
+    if (result != this->OK) {
+      break;
+    }
+  }
+
+  if (own_transaction) {
+    sqlite::Statement s(&statements_, "END TRANSACTION");
+    CHECK_EQ(SQLITE_DONE, s.Step());
+  }
+  WaitForGroupCommit(&lock, logged.size());
+
+  return result;
+}
+
+
+template <class Logged>
+typename Database<Logged>::WriteResult SQLiteDB<Logged>::InsertEntry(
+    const std::unique_lock<std::mutex>& lock, const Logged& logged) {
+  CHECK(lock.owns_lock());
+
+  sqlite::Statement statement(&statements_,
                               "INSERT INTO leaves(hash, entry, sequence) "
                               "VALUES(?, ?, ?)");
   const std::string hash(logged.Hash());
@@ -202,7 +269,7 @@ typename Database<Logged>::WriteResult SQLiteDB<Logged>::CreateSequencedEntry_(
     // Check whether we're trying to store a hash/sequence pair which already
     // exists - if it's identical we'll return OK as it could be the fetcher.
     sqlite::Statement s2(
-        db_, "SELECT sequence, hash FROM leaves WHERE sequence = ?");
+        &statements_, "SELECT sequence, hash FROM leaves WHERE sequence = ?");
     s2.BindUInt64(0, logged.sequence_number());
     if (s2.Step() == SQLITE_ROW) {
       std::string existing_hash;
@@ -237,7 +304,7 @@ typename Database<Logged>::LookupResult SQLiteDB<Logged>::LookupByHash(
 
   std::lock_guard<std::mutex> lock(lock_);
 
-  sqlite::Statement statement(db_,
+  sqlite::Statement statement(&statements_,
                               "SELECT entry, sequence FROM leaves "
                               "WHERE hash = ? ORDER BY sequence LIMIT 1");
 
@@ -284,7 +351,7 @@ typename Database<Logged>::LookupResult SQLiteDB<Logged>::LookupByIndex(
   CHECK(lock.owns_lock());
   CHECK_GE(sequence_number, 0);
   CHECK_NOTNULL(result);
-  sqlite::Statement statement(db_,
+  sqlite::Statement statement(&statements_,
                               "SELECT entry, hash FROM leaves "
                               "WHERE sequence = ?");
   statement.BindUInt64(0, sequence_number);
@@ -318,7 +385,7 @@ typename Database<Logged>::LookupResult SQLiteDB<Logged>::LookupNextIndex(
   CHECK(lock.owns_lock());
   CHECK_GE(sequence_number, 0);
   CHECK_NOTNULL(result);
-  sqlite::Statement statement(db_,
+  sqlite::Statement statement(&statements_,
                               "SELECT entry, hash, sequence FROM leaves "
                               "WHERE sequence >= ? ORDER BY sequence");
   statement.BindUInt64(0, sequence_number);
@@ -358,7 +425,7 @@ typename Database<Logged>::WriteResult SQLiteDB<Logged>::WriteTreeHead_(
       latency_by_op_ms.GetScopedLatency("write_tree_head"));
   std::unique_lock<std::mutex> lock(lock_);
 
-  sqlite::Statement statement(db_,
+  sqlite::Statement statement(&statements_,
                               "INSERT INTO trees(timestamp, sth) "
                               "VALUES(?, ?)");
   statement.BindUInt64(0, sth.timestamp());
@@ -369,7 +436,7 @@ typename Database<Logged>::WriteResult SQLiteDB<Logged>::WriteTreeHead_(
 
   int r2 = statement.Step();
   if (r2 == SQLITE_CONSTRAINT) {
-    sqlite::Statement s2(db_,
+    sqlite::Statement s2(&statements_,
                          "SELECT timestamp,sth FROM trees "
                          "WHERE timestamp = ?");
     s2.BindUInt64(0, sth.timestamp());
@@ -386,6 +453,9 @@ typename Database<Logged>::WriteResult SQLiteDB<Logged>::WriteTreeHead_(
 
   EndTransaction(lock);
   BeginTransaction(lock);
+  // Tree heads don't wait for others to come along, and commit any
+  // group they were written into right away.
+  CommitGroup(lock);
 
   // Do not call the callbacks while holding the lock, as they might
   // want to perform some lookups.
@@ -415,7 +485,7 @@ int64_t SQLiteDB<Logged>::TreeSize() const {
 
   CHECK_GE(tree_size_, 0);
   sqlite::Statement statement(
-      db_,
+      &statements_,
       "SELECT sequence FROM leaves WHERE sequence >= ? ORDER BY sequence");
   statement.BindUInt64(0, tree_size_);
 
@@ -436,6 +506,35 @@ int64_t SQLiteDB<Logged>::TreeSize() const {
 }
 
 
+template <class Logged>
+std::vector<int64_t> SQLiteDB<Logged>::SparseEntries() const {
+  std::unique_lock<std::mutex> lock(lock_);
+
+  CHECK_GE(tree_size_, 0);
+  sqlite::Statement statement(
+      &statements_,
+      "SELECT sequence FROM leaves WHERE sequence >= ? ORDER BY sequence");
+  statement.BindUInt64(0, tree_size_);
+
+  // |tree_size_| is only updated by TreeSize(), so skip the entries
+  // that have become contiguous since.
+  std::vector<int64_t> sparse;
+  int ret(statement.Step());
+  while (ret == SQLITE_ROW) {
+    const sqlite3_uint64 sequence(statement.GetUInt64(0));
+    if (sparse.empty() && sequence == static_cast<uint64_t>(tree_size_)) {
+      ++tree_size_;
+    } else {
+      sparse.push_back(sequence);
+    }
+    ret = statement.Step();
+  }
+  CHECK_EQ(SQLITE_DONE, ret);
+
+  return sparse;
+}
+
+
 template <class Logged>
 void SQLiteDB<Logged>::AddNotifySTHCallback(
     const typename Database<Logged>::NotifySTHCallback* callback) {
@@ -456,8 +555,8 @@ void SQLiteDB<Logged>::AddNotifySTHCallback(
 template <class Logged>
 void SQLiteDB<Logged>::RemoveNotifySTHCallback(
     const typename Database<Logged>::NotifySTHCallback* callback) {
-  std::lock_guard<std::mutex> lock(lock_);
-
+  // Not under |lock_|, as this waits for the callback to return if it
+  // is being called, and it might want to perform some lookups.
   callbacks_.Remove(callback);
 }
 
@@ -473,11 +572,13 @@ void SQLiteDB<Logged>::InitializeNode(const std::string& node_id) {
     LOG(FATAL) << "Attempting to initialize DB beloging to node with node_id: "
                << existing_id;
   }
-  sqlite::Statement statement(db_, "INSERT INTO node(node_id) VALUES(?)");
+  sqlite::Statement statement(&statements_,
+                              "INSERT INTO node(node_id) VALUES(?)");
   statement.BindBlob(0, node_id);
 
   const int result(statement.Step());
   CHECK_EQ(SQLITE_DONE, result);
+  CommitGroup(lock);
 }
 
 
@@ -496,7 +597,7 @@ typename Database<Logged>::LookupResult SQLiteDB<Logged>::NodeId(
       latency_by_op_ms.GetScopedLatency("set_node_id"));
   CHECK(lock.owns_lock());
   CHECK_NOTNULL(node_id);
-  sqlite::Statement statement(db_, "SELECT node_id FROM node");
+  sqlite::Statement statement(&statements_, "SELECT node_id FROM node");
 
   int result(statement.Step());
   if (result == SQLITE_DONE) {
@@ -519,7 +620,7 @@ void SQLiteDB<Logged>::BeginTransaction(
     CHECK_EQ(0, transaction_size_);
     CHECK(!in_transaction_);
     VLOG(1) << "Beginning new transaction.";
-    sqlite::Statement s(db_, "BEGIN TRANSACTION");
+    sqlite::Statement s(&statements_, "BEGIN TRANSACTION");
     CHECK_EQ(SQLITE_DONE, s.Step());
     in_transaction_ = true;
   }
@@ -534,11 +635,11 @@ void SQLiteDB<Logged>::EndTransaction(
     CHECK(in_transaction_);
     VLOG(1) << "Committing transaction.";
     {
-      sqlite::Statement s(db_, "END TRANSACTION");
+      sqlite::Statement s(&statements_, "END TRANSACTION");
       CHECK_EQ(SQLITE_DONE, s.Step());
     }
     {
-      sqlite::Statement s(db_, "PRAGMA wal_checkpoint(TRUNCATE)");
+      sqlite::Statement s(&statements_, "PRAGMA wal_checkpoint(TRUNCATE)");
       CHECK_EQ(SQLITE_ROW, s.Step());
       CHECK_EQ(SQLITE_DONE, s.Step());
     }
@@ -563,6 +664,65 @@ void SQLiteDB<Logged>::MaybeStartNewTransaction(
 }
 
 
+template <class Logged>
+void SQLiteDB<Logged>::StartGroup(const std::unique_lock<std::mutex>& lock) {
+  CHECK(lock.owns_lock());
+  if (FLAGS_sqlite_group_commit_delay_ms > 0 && !in_transaction_) {
+    sqlite::Statement s(&statements_, "BEGIN TRANSACTION");
+    CHECK_EQ(SQLITE_DONE, s.Step());
+    in_transaction_ = true;
+  }
+}
+
+
+template <class Logged>
+void SQLiteDB<Logged>::WaitForGroupCommit(std::unique_lock<std::mutex>* lock,
+                                          int64_t operations) {
+  CHECK(lock->owns_lock());
+  if (FLAGS_sqlite_group_commit_delay_ms <= 0) {
+    return;
+  }
+
+  const uint64_t generation(group_generation_);
+  group_size_ += operations;
+  if (group_size_ < FLAGS_sqlite_transaction_batch_size) {
+    // The first writer to join a group has the earliest deadline, so
+    // it is usually the one to commit it.
+    const std::chrono::steady_clock::time_point deadline(
+        std::chrono::steady_clock::now() +
+        std::chrono::milliseconds(FLAGS_sqlite_group_commit_delay_ms));
+    while (group_generation_ == generation &&
+           group_committed_.wait_until(*lock, deadline) !=
+               std::cv_status::timeout) {
+    }
+    if (group_generation_ != generation) {
+      return;
+    }
+  }
+
+  CommitGroup(*lock);
+}
+
+
+template <class Logged>
+void SQLiteDB<Logged>::CommitGroup(const std::unique_lock<std::mutex>& lock) {
+  CHECK(lock.owns_lock());
+  if (FLAGS_sqlite_group_commit_delay_ms <= 0) {
+    return;
+  }
+
+  if (in_transaction_) {
+    VLOG(1) << "Committing group of " << group_size_ << " operations.";
+    sqlite::Statement s(&statements_, "END TRANSACTION");
+    CHECK_EQ(SQLITE_DONE, s.Step());
+    in_transaction_ = false;
+  }
+  group_size_ = 0;
+  ++group_generation_;
+  group_committed_.notify_all();
+}
+
+
 template <class Logged>
 void SQLiteDB<Logged>::ForceNotifySTH() {
   std::unique_lock<std::mutex> lock(lock_);
@@ -588,7 +748,7 @@ typename Database<Logged>::LookupResult SQLiteDB<Logged>::LatestTreeHeadNoLock(
     const std::unique_lock<std::mutex>& lock,
     ct::SignedTreeHead* result) const {
   CHECK(lock.owns_lock());
-  sqlite::Statement statement(db_,
+  sqlite::Statement statement(&statements_,
                               "SELECT sth FROM trees WHERE timestamp IN "
                               "(SELECT MAX(timestamp) FROM trees)");
 
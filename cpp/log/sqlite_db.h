@@ -2,12 +2,18 @@
 #ifndef SQLITE_DB_H
 #define SQLITE_DB_H
 
+#include <condition_variable>
+#include <memory>
 #include <mutex>
+#include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "base/macros.h"
 #include "log/database.h"
 
+#include "log/sqlite_statement.h"
+
 struct sqlite3;
 
 template <class Logged>
@@ -22,6 +28,10 @@ class SQLiteDB : public Database<Logged> {
 
   WriteResult CreateSequencedEntry_(const Logged& logged) override;
 
+  // Writes all the entries in a single transaction.
+  WriteResult CreateSequencedEntries_(
+      const std::vector<const Logged*>& logged) override;
+
   LookupResult LookupByHash(const std::string& hash,
                             Logged* result) const override;
 
@@ -37,6 +47,8 @@ class SQLiteDB : public Database<Logged> {
 
   int64_t TreeSize() const override;
 
+  std::vector<int64_t> SparseEntries() const override;
+
   void AddNotifySTHCallback(
       const typename Database<Logged>::NotifySTHCallback* callback) override;
 
@@ -54,6 +66,8 @@ class SQLiteDB : public Database<Logged> {
  private:
   class Iterator;
 
+  WriteResult InsertEntry(const std::unique_lock<std::mutex>& lock,
+                          const Logged& logged);
   LookupResult LookupByIndex(const std::unique_lock<std::mutex>& lock,
                              int64_t sequence_number, Logged* result) const;
   // This finds the next entry with a sequence number equal or greater
@@ -71,14 +85,27 @@ class SQLiteDB : public Database<Logged> {
 
   void MaybeStartNewTransaction(const std::unique_lock<std::mutex>& lock);
 
+  // With --sqlite_group_commit_delay_ms, writes go into a shared
+  // transaction, committed by the writer that fills it up or has waited
+  // long enough. Each writer waits for the commit before returning.
+  void StartGroup(const std::unique_lock<std::mutex>& lock);
+  void WaitForGroupCommit(std::unique_lock<std::mutex>* lock,
+                          int64_t operations);
+  void CommitGroup(const std::unique_lock<std::mutex>& lock);
+
   mutable std::mutex lock_;
   sqlite3* const db_;
+  mutable sqlite::StatementCache statements_;
   // This is marked mutable, as it is a lazily updated cache updated
   // from some of the getters.
   mutable int64_t tree_size_;
   cert_trans::DatabaseNotifierHelper callbacks_;
   int64_t transaction_size_;
   bool in_transaction_;
+  std::condition_variable group_committed_;
+  int64_t group_size_;
+  // Incremented every time a group transaction is committed.
+  uint64_t group_generation_;
 
   DISALLOW_COPY_AND_ASSIGN(SQLiteDB);
 };
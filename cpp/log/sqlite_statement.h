@@ -6,24 +6,92 @@
 #include <glog/logging.h>
 #include <sqlite3.h>
 #include <string>
+#include <unordered_map>
 
 #include "base/macros.h"
 
 namespace sqlite {
 
+
+inline sqlite3_stmt* Prepare(sqlite3* db, const char* sql) {
+  sqlite3_stmt* stmt(NULL);
+  int ret = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+  if (ret != SQLITE_OK)
+    LOG(ERROR) << "ret = " << ret << ", err = " << sqlite3_errmsg(db)
+               << ", sql = " << sql << std::endl;
+
+  CHECK_EQ(SQLITE_OK, ret);
+  return stmt;
+}
+
+
+// Keeps the statements used on a connection prepared, so that they
+// can be reused, keyed by their SQL. This is not thread-safe, and
+// Clear() must be called before the connection is closed.
+class StatementCache {
+ public:
+  explicit StatementCache(sqlite3* db) : db_(CHECK_NOTNULL(db)) {
+  }
+
+  ~StatementCache() {
+    Clear();
+  }
+
+  void Clear() {
+    for (const auto& entry : statements_) {
+      CHECK_EQ(SQLITE_OK, sqlite3_finalize(entry.second));
+    }
+    statements_.clear();
+  }
+
+ private:
+  friend class Statement;
+
+  // Returns a statement for |sql|, which is prepared if there are no
+  // unused ones in the cache.
+  sqlite3_stmt* Take(const std::string& sql) {
+    const auto it(statements_.find(sql));
+    if (it == statements_.end()) {
+      return Prepare(db_, sql.c_str());
+    }
+    sqlite3_stmt* const stmt(it->second);
+    statements_.erase(it);
+    return stmt;
+  }
+
+  void Return(const std::string& sql, sqlite3_stmt* stmt) {
+    // This returns the error from the last step, if any, which has
+    // been handled already.
+    sqlite3_reset(stmt);
+    CHECK_EQ(SQLITE_OK, sqlite3_clear_bindings(stmt));
+    statements_.insert(std::make_pair(sql, stmt));
+  }
+
+  sqlite3* const db_;
+  // A multimap, as the same SQL can be in use more than once at a time.
+  std::unordered_multimap<std::string, sqlite3_stmt*> statements_;
+
+  DISALLOW_COPY_AND_ASSIGN(StatementCache);
+};
+
+
 // Reduce the ugliness of the sqlite3 API.
 class Statement {
  public:
-  Statement(sqlite3* db, const char* sql) : stmt_(NULL) {
-    int ret = sqlite3_prepare_v2(db, sql, -1, &stmt_, NULL);
-    if (ret != SQLITE_OK)
-      LOG(ERROR) << "ret = " << ret << ", err = " << sqlite3_errmsg(db)
-                 << ", sql = " << sql << std::endl;
+  Statement(sqlite3* db, const char* sql)
+      : cache_(NULL), stmt_(Prepare(db, sql)) {
+  }
 
-    CHECK_EQ(SQLITE_OK, ret);
+  // Uses a statement from |cache|, returned to it on destruction.
+  Statement(StatementCache* cache, const char* sql)
+      : cache_(CHECK_NOTNULL(cache)), sql_(sql), stmt_(cache->Take(sql_)) {
   }
 
   ~Statement() {
+    if (cache_) {
+      cache_->Return(sql_, stmt_);
+      return;
+    }
     int ret = sqlite3_finalize(stmt_);
     // can get SQLITE_CONSTRAINT if an insert failed due to a duplicate key.
     CHECK(ret == SQLITE_OK || ret == SQLITE_CONSTRAINT);
@@ -60,8 +128,11 @@ class Statement {
     return sqlite3_step(stmt_);
   }
 
+
  private:
-  sqlite3_stmt* stmt_;
+  StatementCache* const cache_;
+  const std::string sql_;
+  sqlite3_stmt* const stmt_;
 
   DISALLOW_COPY_AND_ASSIGN(Statement);
 };
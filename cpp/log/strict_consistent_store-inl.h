@@ -1,9 +1,23 @@
 #ifndef CERT_TRANS_LOG_STRICT_CONSISTENT_STORE_INL_H_
 #define CERT_TRANS_LOG_STRICT_CONSISTENT_STORE_INL_H_
 
+#include <glog/logging.h>
+
 #include "log/strict_consistent_store.h"
+#include "monitoring/monitoring.h"
 
 namespace cert_trans {
+namespace {
+
+
+static Counter<>* strict_store_fenced_writes =
+    Counter<>::New("strict_store_fenced_writes",
+                   "Number of master-only writes which finished after the "
+                   "master lease they started with was lost.");
+
+
+}  // namespace
+
 
 template <class Logged>
 StrictConsistentStore<Logged>::StrictConsistentStore(
@@ -13,12 +27,40 @@ StrictConsistentStore<Logged>::StrictConsistentStore(
 
 
 template <class Logged>
-util::StatusOr<int64_t>
-StrictConsistentStore<Logged>::NextAvailableSequenceNumber() const {
-  if (!election_->IsMaster()) {
+util::Status StrictConsistentStore<Logged>::CheckLease(int64_t* token) const {
+  MasterElection::Lease lease;
+  if (!election_->GetMasterLease(&lease)) {
     return util::Status(util::error::PERMISSION_DENIED,
                         "Not currently master.");
   }
+  *token = lease.token;
+  return util::Status::OK;
+}
+
+
+template <class Logged>
+util::Status StrictConsistentStore<Logged>::CheckStillLeased(
+    int64_t token, const util::Status& status) const {
+  MasterElection::Lease lease;
+  if (!election_->GetMasterLease(&lease) || lease.token != token) {
+    strict_store_fenced_writes->Increment();
+    LOG(WARNING) << "Lost the master lease (token " << token
+                 << ") during a write, which returned: " << status;
+    return util::Status(util::error::ABORTED,
+                        "Lost the master lease during the write.");
+  }
+  return status;
+}
+
+
+template <class Logged>
+util::StatusOr<int64_t>
+StrictConsistentStore<Logged>::NextAvailableSequenceNumber() const {
+  int64_t token;
+  const util::Status status(CheckLease(&token));
+  if (!status.ok()) {
+    return status;
+  }
   return peer_->NextAvailableSequenceNumber();
 }
 
@@ -26,43 +68,52 @@ StrictConsistentStore<Logged>::NextAvailableSequenceNumber() const {
 template <class Logged>
 util::Status StrictConsistentStore<Logged>::SetServingSTH(
     const ct::SignedTreeHead& new_sth) {
-  if (!election_->IsMaster()) {
-    return util::Status(util::error::PERMISSION_DENIED,
-                        "Not currently master.");
+  int64_t token;
+  const util::Status status(CheckLease(&token));
+  if (!status.ok()) {
+    return status;
   }
-  return peer_->SetServingSTH(new_sth);
+  return CheckStillLeased(token, peer_->SetServingSTH(new_sth));
 }
 
 
 template <class Logged>
 util::Status StrictConsistentStore<Logged>::UpdateSequenceMapping(
     EntryHandle<ct::SequenceMapping>* entry) {
-  if (!election_->IsMaster()) {
-    return util::Status(util::error::PERMISSION_DENIED,
-                        "Not currently master.");
+  int64_t token;
+  const util::Status status(CheckLease(&token));
+  if (!status.ok()) {
+    return status;
   }
-  return peer_->UpdateSequenceMapping(entry);
+  return CheckStillLeased(token, peer_->UpdateSequenceMapping(entry));
 }
 
 
 template <class Logged>
 util::Status StrictConsistentStore<Logged>::SetClusterConfig(
     const ct::ClusterConfig& config) {
-  if (!election_->IsMaster()) {
-    return util::Status(util::error::PERMISSION_DENIED,
-                        "Not currently master.");
+  int64_t token;
+  const util::Status status(CheckLease(&token));
+  if (!status.ok()) {
+    return status;
   }
-  return peer_->SetClusterConfig(config);
+  return CheckStillLeased(token, peer_->SetClusterConfig(config));
 }
 
 
 template <class Logged>
 util::StatusOr<int64_t> StrictConsistentStore<Logged>::CleanupOldEntries() {
-  if (!election_->IsMaster()) {
-    return util::Status(util::error::PERMISSION_DENIED,
-                        "Not currently master.");
+  int64_t token;
+  const util::Status status(CheckLease(&token));
+  if (!status.ok()) {
+    return status;
+  }
+  const util::StatusOr<int64_t> cleaned(peer_->CleanupOldEntries());
+  const util::Status leased(CheckStillLeased(token, cleaned.status()));
+  if (!leased.ok()) {
+    return leased;
   }
-  return peer_->CleanupOldEntries();
+  return cleaned;
 }
 
 
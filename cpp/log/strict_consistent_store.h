@@ -10,6 +10,13 @@ namespace cert_trans {
 // the cluster state which should only be performed by the current master
 // unless this node /is/ the current master.
 //
+// The check is against the master lease (see MasterElection::Lease),
+// which only takes a clock comparison. A change is made only if the
+// lease is held both before and after it, with the same fencing token;
+// a change which finished after the lease ran out, or after another
+// term started, is reported as ABORTED, since it may have raced with
+// the next master.
+//
 // Note that while this is better than just gating the start of a high-level
 // action (especially a long running action, e.g. a signing run) with a check
 // to IsMaster(), it is still necessarily racy because etcd doesn't support
@@ -46,11 +53,24 @@ class StrictConsistentStore : public ConsistentStore<Logged> {
     return peer_->AddPendingEntry(entry);
   }
 
+  void AddPendingEntryAsync(Logged* entry, util::Task* task) override {
+    peer_->AddPendingEntryAsync(entry, task);
+  }
+
+  void AddPendingEntries(const std::vector<Logged*>& entries,
+                         std::vector<util::Status>* statuses) override {
+    peer_->AddPendingEntries(entries, statuses);
+  }
+
   util::Status GetPendingEntryForHash(
       const std::string& hash, EntryHandle<Logged>* entry) const override {
     return peer_->GetPendingEntryForHash(hash, entry);
   }
 
+  bool CachesPendingEntries() const override {
+    return peer_->CachesPendingEntries();
+  }
+
   util::Status GetPendingEntries(
       std::vector<EntryHandle<Logged>>* entries) const override {
     return peer_->GetPendingEntries(entries);
@@ -88,7 +108,19 @@ class StrictConsistentStore : public ConsistentStore<Logged> {
     return peer_->WatchClusterConfig(cb, task);
   }
 
+  void WatchPendingEntries(
+      const typename ConsistentStore<Logged>::PendingEntriesCallback& cb,
+      util::Task* task) override {
+    return peer_->WatchPendingEntries(cb, task);
+  }
+
  private:
+  // Returns OK and sets |token| iff this node holds the master lease.
+  util::Status CheckLease(int64_t* token) const;
+  // Returns |status|, unless the lease for |token| has been lost.
+  util::Status CheckStillLeased(int64_t token,
+                                const util::Status& status) const;
+
   const MasterElection* const election_;  // Not owned by us
   const std::unique_ptr<ConsistentStore<Logged>> peer_;
 };
@@ -126,6 +126,25 @@ INSTANTIATE_TEST_CASE_P(MasterInstance, StrictConsistentStoreTest,
                         testing::Values(true, false));
 
 
+TEST(StrictConsistentStoreFencingTest, LosingTheLeaseDuringAWriteAborts) {
+  NiceMock<MockMasterElection> election;
+  NiceMock<MockConsistentStore<LoggedCertificate>>* const peer(
+      new NiceMock<MockConsistentStore<LoggedCertificate>>());
+  StrictConsistentStore<LoggedCertificate> strict_store(&election, peer);
+
+  // Master when the write starts, but not once it is done.
+  EXPECT_CALL(election, IsMaster())
+      .WillOnce(Return(true))
+      .WillOnce(Return(false));
+  EXPECT_CALL(*peer, SetServingSTH(_)).WillOnce(Return(util::Status::OK));
+
+  ct::SignedTreeHead sth;
+  sth.set_timestamp(234);
+  EXPECT_EQ(util::error::ABORTED,
+            strict_store.SetServingSTH(sth).CanonicalCode());
+}
+
+
 }  // namespace cert_trans
 
 
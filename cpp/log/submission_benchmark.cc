@@ -0,0 +1,474 @@
+/* -*- indent-tabs-mode: nil -*- */
+// Microbenchmarks for the CPU work done on each submission, from the
+// decoding of the chain to the signing of the SCT, e.g.:
+//
+//   submission_benchmark --benchmark_filter=CheckCertChain \
+//       --benchmark_out=before.json --benchmark_out_format=json
+//
+// The chains are read from --testdata_dir, and the certificate ones
+// are checked as submitted (the root being added by the checker):
+//   rsa2   test-rsa-cert.pem, issued by test-rsa-ca-cert.pem
+//   ecdsa2 test-ec-cert.pem, issued by test-ec-ca-cert.pem
+//   rsa3   test-intermediate-cert.pem, intermediate-cert.pem, issued by
+//          ca-cert.pem
+// and the precertificate ones:
+//   rsa2   test-embedded-pre-cert.pem, issued by ca-cert.pem
+//   rsa4   test-embedded-with-intermediate-preca-pre-cert.pem,
+//          intermediate-pre-cert.pem, intermediate-cert.pem, issued by
+//          ca-cert.pem
+//
+// Each benchmark runs with 1, 2, 4... threads up to --max_threads, and
+// reports "ops/s/thread" next to the total throughput: with no more
+// threads than cores, that is the throughput per core.
+#include <benchmark/benchmark.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "log/cert.h"
+#include "log/cert_checker.h"
+#include "log/consistent_store.h"
+#include "log/frontend_signer.h"
+#include "log/leveldb_db.h"
+#include "log/log_signer.h"
+#include "log/logged_certificate.h"
+#include "log/test_db.h"
+#include "log/test_signer.h"
+#include "proto/ct.pb.h"
+#include "proto/serializer.h"
+#include "util/init.h"
+#include "util/status.h"
+#include "util/statusor.h"
+#include "util/task.h"
+#include "util/util.h"
+
+DEFINE_string(testdata_dir, "test/testdata",
+              "Directory of the test certificates.");
+DEFINE_int32(max_threads, 4,
+             "The benchmarks are run with 1, 2, 4... concurrent threads, up "
+             "to this many.");
+
+namespace {
+
+using cert_trans::Cert;
+using cert_trans::CertChain;
+using cert_trans::CertChecker;
+using cert_trans::ConsistentStore;
+using cert_trans::EntryHandle;
+using cert_trans::LoggedCertificate;
+using cert_trans::PreCertChain;
+using ct::LogEntry;
+using ct::SignedCertificateTimestamp;
+using std::pair;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using util::Status;
+using util::StatusOr;
+
+
+struct ChainSpec {
+  const char* name;
+  bool precert;
+  // Leaf first, as submitted.
+  vector<const char*> files;
+  const char* root;
+  // Once checked, with the root.
+  size_t length;
+};
+
+
+const vector<ChainSpec>& ChainSpecs() {
+  static const vector<ChainSpec>* const specs(new vector<ChainSpec>{
+      {"rsa2", false, {"test-rsa-cert.pem"}, "test-rsa-ca-cert.pem", 2},
+      {"ecdsa2", false, {"test-ec-cert.pem"}, "test-ec-ca-cert.pem", 2},
+      {"rsa3",
+       false,
+       {"test-intermediate-cert.pem", "intermediate-cert.pem"},
+       "ca-cert.pem",
+       3},
+      {"rsa2", true, {"test-embedded-pre-cert.pem"}, "ca-cert.pem", 2},
+      {"rsa4",
+       true,
+       {"test-embedded-with-intermediate-preca-pre-cert.pem",
+        "intermediate-pre-cert.pem", "intermediate-cert.pem"},
+       "ca-cert.pem",
+       4},
+  });
+  return *specs;
+}
+
+
+string ReadTestFile(const string& name) {
+  string contents;
+  CHECK(util::ReadTextFile(FLAGS_testdata_dir + "/" + name, &contents))
+      << "Could not read " << name << " from " << FLAGS_testdata_dir
+      << ". Wrong --testdata_dir?";
+  return contents;
+}
+
+
+// The DER encodings of the certificates of |spec|, leaf first.
+vector<string> ChainDers(const ChainSpec& spec) {
+  vector<string> ders;
+  for (const char* file : spec.files) {
+    const Cert cert(ReadTestFile(file));
+    CHECK(cert.IsLoaded()) << file;
+    ders.emplace_back();
+    CHECK_EQ(Status::OK, cert.DerEncoding(&ders.back()));
+  }
+  return ders;
+}
+
+
+// Loads |ders| into |chain|, as the submission handlers do.
+void LoadChain(const vector<string>& ders, CertChain* chain) {
+  for (const string& der : ders) {
+    Cert* const cert(new Cert);
+    CHECK_EQ(Status::OK, cert->LoadFromDerString(der));
+    CHECK(chain->AddCert(cert));
+  }
+}
+
+
+// A checker trusting the roots of all of ChainSpecs().
+const CertChecker& Checker() {
+  static const CertChecker* const checker([]() {
+    CertChecker* const checker(new CertChecker);
+    for (const ChainSpec& spec : ChainSpecs()) {
+      CHECK(checker->LoadTrustedCertificates(FLAGS_testdata_dir + "/" +
+                                             spec.root));
+    }
+    return checker;
+  }());
+  return *checker;
+}
+
+
+void SetOpsPerThread(benchmark::State& state) {
+  state.SetItemsProcessed(state.iterations());
+  state.counters["ops/s/thread"] =
+      benchmark::Counter(state.iterations(),
+                         benchmark::Counter::kIsRate |
+                             benchmark::Counter::kAvgThreads);
+}
+
+
+// Accepts all the pending entries, and doesn't implement anything
+// else (the watches return UNIMPLEMENTED on their task straight away),
+// so that the signer is measured on its own.
+class NullConsistentStore : public ConsistentStore<LoggedCertificate> {
+ public:
+  NullConsistentStore() = default;
+
+  StatusOr<int64_t> NextAvailableSequenceNumber() const override {
+    return Unimplemented();
+  }
+
+  Status SetServingSTH(const ct::SignedTreeHead&) override {
+    return Unimplemented();
+  }
+
+  StatusOr<ct::SignedTreeHead> GetServingSTH() const override {
+    return Unimplemented();
+  }
+
+  Status AddPendingEntry(LoggedCertificate*) override {
+    return Status::OK;
+  }
+
+  void AddPendingEntries(const vector<LoggedCertificate*>& entries,
+                         vector<Status>* statuses) override {
+    statuses->assign(entries.size(), Status::OK);
+  }
+
+  Status GetPendingEntryForHash(
+      const string&, EntryHandle<LoggedCertificate>*) const override {
+    return Status(util::error::NOT_FOUND, "null store");
+  }
+
+  Status GetPendingEntries(
+      vector<EntryHandle<LoggedCertificate>>*) const override {
+    return Unimplemented();
+  }
+
+  Status GetSequenceMapping(
+      EntryHandle<ct::SequenceMapping>*) const override {
+    return Unimplemented();
+  }
+
+  Status UpdateSequenceMapping(EntryHandle<ct::SequenceMapping>*) override {
+    return Unimplemented();
+  }
+
+  StatusOr<ct::ClusterNodeState> GetClusterNodeState() const override {
+    return Unimplemented();
+  }
+
+  Status SetClusterNodeState(const ct::ClusterNodeState&) override {
+    return Unimplemented();
+  }
+
+  void WatchServingSTH(const ServingSTHCallback&, util::Task* task) override {
+    task->Return(Unimplemented());
+  }
+
+  void WatchClusterNodeStates(const ClusterNodeStateCallback&,
+                              util::Task* task) override {
+    task->Return(Unimplemented());
+  }
+
+  void WatchClusterConfig(const ClusterConfigCallback&,
+                          util::Task* task) override {
+    task->Return(Unimplemented());
+  }
+
+  void WatchPendingEntries(const PendingEntriesCallback&,
+                           util::Task* task) override {
+    task->Return(Unimplemented());
+  }
+
+  Status SetClusterConfig(const ct::ClusterConfig&) override {
+    return Unimplemented();
+  }
+
+  StatusOr<int64_t> CleanupOldEntries() override {
+    return Unimplemented();
+  }
+
+ private:
+  static Status Unimplemented() {
+    return Status(util::error::UNIMPLEMENTED, "null store");
+  }
+};
+
+
+// What FrontendSigner needs, shared by the threads of its benchmark.
+// The database stays empty.
+struct SignerFixture {
+  SignerFixture()
+      : log_signer(TestSigner::DefaultLogSigner()),
+        signer(db.db(), &store, log_signer.get()) {
+  }
+
+  TestDB<LevelDB<LoggedCertificate>> db;
+  NullConsistentStore store;
+  const unique_ptr<LogSigner> log_signer;
+  FrontendSigner signer;
+};
+
+
+// Created by the first run of BM_QueueEntry, and reset by main() once
+// the benchmarks are done, to remove the database.
+unique_ptr<SignerFixture> signer_fixture;
+
+
+// An X.509 entry for the leaf of rsa3, with its chain, and an SCT
+// for it.
+void SetEntry(LogEntry* entry, SignedCertificateTimestamp* sct) {
+  const vector<string> ders(ChainDers(ChainSpecs()[2]));
+  entry->set_type(ct::X509_ENTRY);
+  entry->mutable_x509_entry()->set_leaf_certificate(ders[0]);
+  for (size_t i = 1; i < ders.size(); ++i) {
+    entry->mutable_x509_entry()->add_certificate_chain(ders[i]);
+  }
+  TestSigner::SetDefaults(sct);
+}
+
+
+void BM_SerializeSCT(benchmark::State& state) {
+  LogEntry entry;
+  SignedCertificateTimestamp sct;
+  SetEntry(&entry, &sct);
+  string serialized;
+  for (auto _ : state) {
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeSCT(sct, &serialized));
+    benchmark::DoNotOptimize(serialized.data());
+  }
+  SetOpsPerThread(state);
+}
+
+
+void BM_DeserializeSCT(benchmark::State& state) {
+  LogEntry entry;
+  SignedCertificateTimestamp sct;
+  SetEntry(&entry, &sct);
+  string serialized;
+  CHECK_EQ(Serializer::OK,
+           Serializer::SerializeSCT(sct, &serialized));
+  SignedCertificateTimestamp deserialized;
+  for (auto _ : state) {
+    CHECK_EQ(Deserializer::OK,
+             Deserializer::DeserializeSCT(serialized, &deserialized));
+  }
+  SetOpsPerThread(state);
+}
+
+
+// What is signed for an SCT, and what is hashed into the tree.
+void BM_SerializeSCTInputs(benchmark::State& state) {
+  LogEntry entry;
+  SignedCertificateTimestamp sct;
+  SetEntry(&entry, &sct);
+  string signature_input, leaf;
+  for (auto _ : state) {
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeSCTSignatureInput(sct, entry,
+                                                    &signature_input));
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeSCTMerkleTreeLeaf(sct, entry, &leaf));
+    benchmark::DoNotOptimize(signature_input.data());
+    benchmark::DoNotOptimize(leaf.data());
+  }
+  SetOpsPerThread(state);
+}
+
+
+void BM_MerkleTreeLeafRoundTrip(benchmark::State& state) {
+  LogEntry entry;
+  SignedCertificateTimestamp sct;
+  SetEntry(&entry, &sct);
+  string serialized;
+  ct::MerkleTreeLeaf leaf;
+  for (auto _ : state) {
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeSCTMerkleTreeLeaf(sct, entry,
+                                                    &serialized));
+    CHECK_EQ(Deserializer::OK,
+             Deserializer::DeserializeMerkleTreeLeaf(serialized, &leaf));
+  }
+  SetOpsPerThread(state);
+}
+
+
+void BM_X509ChainRoundTrip(benchmark::State& state) {
+  LogEntry entry;
+  SignedCertificateTimestamp sct;
+  SetEntry(&entry, &sct);
+  string serialized;
+  ct::X509ChainEntry chain;
+  for (auto _ : state) {
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeX509Chain(entry.x509_entry(),
+                                            &serialized));
+    CHECK_EQ(Deserializer::OK,
+             Deserializer::DeserializeX509Chain(serialized, &chain));
+  }
+  SetOpsPerThread(state);
+}
+
+
+// The leaf of |spec|.
+void BM_CertFromDer(benchmark::State& state, const ChainSpec& spec) {
+  const string der(ChainDers(spec)[0]);
+  for (auto _ : state) {
+    Cert cert;
+    CHECK_EQ(Status::OK, cert.LoadFromDerString(der));
+  }
+  SetOpsPerThread(state);
+}
+
+
+// Includes the decoding of the chain, which a submission needs anyway.
+void BM_CheckCertChain(benchmark::State& state, const ChainSpec& spec) {
+  const CertChecker& checker(Checker());
+  const vector<string> ders(ChainDers(spec));
+  for (auto _ : state) {
+    CertChain chain;
+    LoadChain(ders, &chain);
+    CHECK_EQ(Status::OK, checker.CheckCertChain(&chain));
+    CHECK_EQ(spec.length, chain.Length());
+  }
+  SetOpsPerThread(state);
+}
+
+
+void BM_CheckPreCertChain(benchmark::State& state, const ChainSpec& spec) {
+  const CertChecker& checker(Checker());
+  const vector<string> ders(ChainDers(spec));
+  string issuer_key_hash, tbs_certificate;
+  for (auto _ : state) {
+    PreCertChain chain;
+    LoadChain(ders, &chain);
+    CHECK_EQ(Status::OK, checker.CheckPreCertChain(&chain, &issuer_key_hash,
+                                                   &tbs_certificate));
+    CHECK_EQ(spec.length, chain.Length());
+  }
+  SetOpsPerThread(state);
+}
+
+
+// Each iteration submits a new entry (the leaf of rsa3, followed by
+// a unique suffix), so that none of them is answered from the
+// deduplication cache.
+void BM_QueueEntry(benchmark::State& state) {
+  static FrontendSigner* const signer([]() {
+    signer_fixture.reset(new SignerFixture);
+    return &signer_fixture->signer;
+  }());
+  LogEntry entry;
+  SignedCertificateTimestamp sct;
+  SetEntry(&entry, &sct);
+  string* const leaf(entry.mutable_x509_entry()->mutable_leaf_certificate());
+  const size_t leaf_size(leaf->size());
+  uint64_t i(state.thread_index());
+  for (auto _ : state) {
+    leaf->resize(leaf_size);
+    leaf->append(reinterpret_cast<const char*>(&i), sizeof(i));
+    i += state.threads();
+    CHECK_EQ(Status::OK, signer->QueueEntry(entry, &sct));
+  }
+  SetOpsPerThread(state);
+}
+
+
+void RegisterBenchmarks() {
+  const vector<pair<string, void (*)(benchmark::State&)>> benchmarks{
+      {"SerializeSCT", BM_SerializeSCT},
+      {"DeserializeSCT", BM_DeserializeSCT},
+      {"SerializeSCTInputs", BM_SerializeSCTInputs},
+      {"MerkleTreeLeafRoundTrip", BM_MerkleTreeLeafRoundTrip},
+      {"X509ChainRoundTrip", BM_X509ChainRoundTrip},
+      {"QueueEntry", BM_QueueEntry},
+  };
+  for (const auto& bm : benchmarks) {
+    benchmark::RegisterBenchmark(bm.first.c_str(), bm.second)
+        ->ThreadRange(1, FLAGS_max_threads)
+        ->UseRealTime();
+  }
+
+  for (const ChainSpec& spec : ChainSpecs()) {
+    const string name(spec.precert ? "CheckPreCertChain/" : "CheckCertChain/");
+    benchmark::RegisterBenchmark(
+        (name + spec.name).c_str(),
+        spec.precert ? BM_CheckPreCertChain : BM_CheckCertChain, spec)
+        ->ThreadRange(1, FLAGS_max_threads)
+        ->UseRealTime();
+    if (!spec.precert) {
+      benchmark::RegisterBenchmark(
+          (string("CertFromDer/") + spec.name).c_str(), BM_CertFromDer, spec)
+          ->ThreadRange(1, FLAGS_max_threads)
+          ->UseRealTime();
+    }
+  }
+}
+
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+  util::InitCT(&argc, &argv);
+  CHECK_GT(FLAGS_max_threads, 0);
+
+  RegisterBenchmarks();
+  benchmark::RunSpecifiedBenchmarks();
+  signer_fixture.reset();
+  return 0;
+}
@@ -6,17 +6,27 @@
 
 #include <algorithm>
 #include <chrono>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <memory>
 #include <set>
 #include <stdint.h>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "log/database.h"
 #include "log/log_signer.h"
+#include "merkletree/serial_hasher.h"
+#include "monitoring/monitoring.h"
+#include "monitoring/trace.h"
 #include "proto/serializer.h"
 #include "util/status.h"
+#include "util/sync_task.h"
 #include "util/util.h"
 
+DECLARE_int32(database_scan_readahead);
+
 
 namespace cert_trans {
 
@@ -32,29 +42,48 @@ bool LessThanBySequence(const ct::SequenceMapping::Mapping& lhs,
 }
 
 
+static Gauge<>* tree_signer_pending_bytes(
+    Gauge<>::New("tree_signer_pending_bytes",
+                 "Estimated memory used by the pending entries held by the "
+                 "tree signer."));
+
+
+// An estimate of the memory used by a pending entry, with its key in
+// the maps, and its hash.
+template <class Logged>
+size_t PendingEntryBytes(const EntryHandle<Logged>& handle) {
+  return sizeof(handle) + handle.Entry().ByteSize() +
+         3 * handle.Key().size() + 32;
+}
+
+
+template <class Logged>
+PendingEntryDigest DigestPendingEntry(const EntryHandle<Logged>& handle) {
+  CHECK(handle.Entry().contents().sct().has_timestamp());
+  return PendingEntryDigest{handle.Key(), handle.Entry().Hash(),
+                            handle.Entry().contents().sct().timestamp(),
+                            static_cast<size_t>(handle.Entry().ByteSize())};
+}
+
+
 }  // namespace
 
 
-// Comparator for ordering pending hashes.
+// Comparator for ordering pending entries.
 // Order by timestamp then hash.
-template <class Logged>
 struct PendingEntriesOrder
-    : std::binary_function<const cert_trans::EntryHandle<Logged>&,
-                           const cert_trans::EntryHandle<Logged>&, bool> {
-  bool operator()(const cert_trans::EntryHandle<Logged>& x,
-                  const cert_trans::EntryHandle<Logged>& y) const {
-    CHECK(x.Entry().contents().sct().has_timestamp());
-    CHECK(y.Entry().contents().sct().has_timestamp());
-    const uint64_t x_time(x.Entry().contents().sct().timestamp());
-    const uint64_t y_time(y.Entry().contents().sct().timestamp());
-    if (x_time < y_time) {
+    : std::binary_function<const PendingEntryDigest&,
+                           const PendingEntryDigest&, bool> {
+  bool operator()(const PendingEntryDigest& x,
+                  const PendingEntryDigest& y) const {
+    if (x.timestamp < y.timestamp) {
       return true;
-    } else if (x_time > y_time) {
+    } else if (x.timestamp > y.timestamp) {
       return false;
     }
 
     // Fallback to Hash as a final tie-breaker:
-    return x.Entry().Hash() < y.Entry().Hash();
+    return x.hash < y.hash;
   }
 };
 
@@ -63,14 +92,23 @@ template <class Logged>
 TreeSigner<Logged>::TreeSigner(
     const std::chrono::duration<double>& guard_window, Database<Logged>* db,
     std::unique_ptr<CompactMerkleTree> merkle_tree,
-    cert_trans::ConsistentStore<Logged>* consistent_store, LogSigner* signer)
+    cert_trans::ConsistentStore<Logged>* consistent_store, LogSigner* signer,
+    util::Executor* executor)
     : guard_window_(guard_window),
       db_(db),
       consistent_store_(consistent_store),
       signer_(signer),
+      executor_(executor),
       cert_tree_(std::move(merkle_tree)),
-      latest_tree_head_() {
+      latest_tree_head_(),
+      preview_timestamp_(0),
+      pending_synced_(false),
+      pending_bytes_(0),
+      watch_pending_task_(executor_ ? new util::SyncTask(executor_)
+                                    : nullptr),
+      assigned_size_(0) {
   CHECK(cert_tree_);
+  preview_tree_.reset(new CompactMerkleTree(*cert_tree_, new Sha256Hasher));
   // Try to get any STH previously published by this node.
   const util::StatusOr<ct::ClusterNodeState> node_state(
       consistent_store_->GetClusterNodeState());
@@ -81,6 +119,22 @@ TreeSigner<Logged>::TreeSigner(
   if (node_state.ok()) {
     latest_tree_head_ = node_state.ValueOrDie().newest_sth();
   }
+
+  if (watch_pending_task_) {
+    consistent_store_->WatchPendingEntries(
+        std::bind(&TreeSigner<Logged>::UpdatePendingEntries, this,
+                  std::placeholders::_1),
+        watch_pending_task_->task());
+  }
+}
+
+
+template <class Logged>
+TreeSigner<Logged>::~TreeSigner() {
+  if (watch_pending_task_) {
+    watch_pending_task_->Cancel();
+    watch_pending_task_->Wait();
+  }
 }
 
 
@@ -92,6 +146,27 @@ uint64_t TreeSigner<Logged>::LastUpdateTime() const {
 
 template <class Logged>
 util::Status TreeSigner<Logged>::SequenceNewEntries() {
+  const std::shared_ptr<Trace> trace(
+      Trace::MaybeStart("sequence_new_entries"));
+  ScopedTrace scoped_trace(trace.get());
+  std::vector<Logged> new_entries;
+  util::Status status;
+  {
+    TraceSpan span("assign_sequence_numbers");
+    status = AssignSequenceNumbers(&new_entries);
+  }
+  if (status.ok()) {
+    TraceSpan span("store_sequenced_entries");
+    StoreSequencedEntries(new_entries);
+  }
+  return status;
+}
+
+
+template <class Logged>
+util::Status TreeSigner<Logged>::AssignSequenceNumbers(
+    std::vector<Logged>* new_entries) {
+  CHECK_NOTNULL(new_entries)->clear();
   const std::chrono::system_clock::time_point now(
       std::chrono::system_clock::now());
   util::StatusOr<int64_t> status_or_sequence_number(
@@ -109,9 +184,19 @@ util::Status TreeSigner<Logged>::SequenceNewEntries() {
     return status;
   }
 
+  const util::StatusOr<ct::SignedTreeHead> serving_sth(
+      consistent_store_->GetServingSTH());
+  if (!serving_sth.ok()) {
+    LOG(WARNING) << "Failed to get ServingSTH: " << serving_sth.status();
+    return serving_sth.status();
+  }
+  const int64_t serving_tree_size(serving_sth.ValueOrDie().tree_size());
+  // Entries returned by a previous call might not be stored yet.
+  const int64_t local_size(std::max(db_->TreeSize(), assigned_size_));
+  assigned_size_ = local_size;
+
   // Hashes which are already sequenced.
-  std::unordered_map<std::string, std::pair<int64_t, bool /*present*/>>
-      sequenced_hashes;
+  SequencedHashes sequenced_hashes;
   for (const auto& m : mapping.Entry().mapping()) {
     // Go home clang-format, you're drunk.
     CHECK(
@@ -121,16 +206,35 @@ util::Status TreeSigner<Logged>::SequenceNewEntries() {
                                                            false))).second);
   }
 
-  std::vector<cert_trans::EntryHandle<Logged>> pending_entries;
-  status = consistent_store_->GetPendingEntries(&pending_entries);
+  // The digests of the pending entries which still need a sequence
+  // number, and the entries which have one, but are not in our local
+  // DB yet. Ordering and assigning sequence numbers only needs the
+  // digests, the entries themselves are only looked up to be stored.
+  std::vector<PendingEntryDigest> pending_entries;
+  std::vector<cert_trans::EntryHandle<Logged>> sequenced_entries;
+  std::unordered_map<std::string, cert_trans::EntryHandle<Logged>>
+      fetched_entries;
+  {
+    TraceSpan span("get_pending_entries");
+    status = GetPendingEntries(serving_tree_size, local_size,
+                               &sequenced_hashes, &pending_entries,
+                               &sequenced_entries, &fetched_entries);
+  }
   if (!status.ok()) {
     return status;
   }
   std::sort(pending_entries.begin(), pending_entries.end(),
-            PendingEntriesOrder<Logged>());
+            PendingEntriesOrder());
 
-  VLOG(1) << "Sequencing " << pending_entries.size() << " entr"
-          << (pending_entries.size() == 1 ? "y" : "ies");
+  if (VLOG_IS_ON(1)) {
+    size_t pending_bytes(0);
+    for (const auto& digest : pending_entries) {
+      pending_bytes += digest.bytes;
+    }
+    VLOG(1) << "Sequencing " << pending_entries.size() << " entr"
+            << (pending_entries.size() == 1 ? "y" : "ies") << " ("
+            << pending_bytes << " bytes)";
+  }
 
   // We're going to update the sequence mapping based on the following rules:
   // 1) existing sequence mappings whose corresponding PendingEntry still
@@ -140,62 +244,54 @@ util::Status TreeSigner<Logged>::SequenceNewEntries() {
   // 3) mappings whose corresponding PendingEntry no longer exists will be
   //    removed from the sequence mapping file.
   google::protobuf::RepeatedPtrField<ct::SequenceMapping_Mapping> new_mapping;
-  std::map<int64_t, const Logged*> seq_to_entry;
+  for (const auto& s : sequenced_hashes) {
+    if (s.second.second /*present*/) {
+      ct::SequenceMapping::Mapping* const seq_mapping(new_mapping.Add());
+      seq_mapping->set_entry_hash(s.first);
+      seq_mapping->set_sequence_number(s.second.first);
+    } else {
+      // Sanity check: make sure no hashes above the serving_sth level
+      // vanished.
+      CHECK_LT(s.second.first, serving_tree_size);
+    }
+  }
+
+  std::map<int64_t, Logged*> seq_to_entry;
+  for (auto& sequenced_entry : sequenced_entries) {
+    CHECK(seq_to_entry.insert(std::make_pair(
+                                  sequenced_entry.Entry().sequence_number(),
+                                  sequenced_entry.MutableEntry())).second);
+  }
+  // The entries sequenced by this round, which are only looked up once
+  // the mapping is stored.
+  std::map<int64_t, const PendingEntryDigest*> seq_to_digest;
+
   int num_sequenced(0);
-  for (auto& pending_entry : pending_entries) {
-    const std::string& pending_hash(pending_entry.Entry().Hash());
+  std::vector<PendingEntryDigest> too_recent_entries;
+  for (const auto& pending_entry : pending_entries) {
+    const std::string& pending_hash(pending_entry.hash);
     const std::chrono::system_clock::time_point cert_time(
-        std::chrono::milliseconds(pending_entry.Entry().timestamp()));
+        std::chrono::milliseconds(pending_entry.timestamp));
     if (now - cert_time < guard_window_) {
-      VLOG(1) << "Entry too recent: "
-              << util::ToBase64(pending_entry.Entry().Hash());
+      VLOG(1) << "Entry too recent: " << util::ToBase64(pending_hash);
+      too_recent_entries.push_back(pending_entry);
       continue;
     }
-    const auto seq_it(sequenced_hashes.find(pending_hash));
-    ct::SequenceMapping::Mapping* const seq_mapping(new_mapping.Add());
 
-    if (seq_it == sequenced_hashes.end()) {
-      // Need to sequence this one.
-      VLOG(1) << util::ToBase64(pending_hash) << " = " << next_sequence_number;
+    // Need to sequence this one.
+    VLOG(1) << util::ToBase64(pending_hash) << " = " << next_sequence_number;
 
-      // Record the sequence -> hash mapping
-      seq_mapping->set_sequence_number(next_sequence_number);
-      seq_mapping->set_entry_hash(pending_entry.Entry().Hash());
-      pending_entry.MutableEntry()->set_sequence_number(next_sequence_number);
-      ++num_sequenced;
-      ++next_sequence_number;
-    } else {
-      VLOG(1) << "Previously sequenced " << util::ToBase64(pending_hash)
-              << " = " << seq_it->second.first;
-      CHECK(!seq_it->second.second /*present*/)
-          << "Saw same sequenced cert twice.";
-      CHECK(!pending_entry.Entry().has_sequence_number());
-      seq_it->second.second = true;  // present
-
-      seq_mapping->set_entry_hash(seq_it->first);
-      seq_mapping->set_sequence_number(seq_it->second.first);
-      pending_entry.MutableEntry()->set_sequence_number(seq_it->second.first);
-    }
-    CHECK(seq_to_entry.insert(std::make_pair(
-                                  pending_entry.Entry().sequence_number(),
-                                  pending_entry.MutableEntry())).second);
-  }
-
-  const util::StatusOr<ct::SignedTreeHead> serving_sth(
-      consistent_store_->GetServingSTH());
-  if (!serving_sth.ok()) {
-    LOG(WARNING) << "Failed to get ServingSTH: " << serving_sth.status();
-    return serving_sth.status();
+    // Record the sequence -> hash mapping
+    ct::SequenceMapping::Mapping* const seq_mapping(new_mapping.Add());
+    seq_mapping->set_sequence_number(next_sequence_number);
+    seq_mapping->set_entry_hash(pending_hash);
+    CHECK(seq_to_digest.insert(std::make_pair(next_sequence_number,
+                                              &pending_entry)).second);
+    ++num_sequenced;
+    ++next_sequence_number;
   }
 
-  // Sanity check: make sure no hashes above the serving_sth level vanished:
-  const uint64_t serving_tree_size(serving_sth.ValueOrDie().tree_size());
-  for (const auto& s : sequenced_hashes) {
-    if (!s.second.second /*present*/) {
-      // if it disappeared, check it's underwater:
-      CHECK_LT(s.second.first, serving_tree_size);
-    }
-  }
+  RetryPendingEntries(too_recent_entries);
 
   if (new_mapping.size() > 0) {
     sort(new_mapping.begin(), new_mapping.end(), LessThanBySequence);
@@ -206,18 +302,37 @@ util::Status TreeSigner<Logged>::SequenceNewEntries() {
   mapping.MutableEntry()->mutable_mapping()->Swap(&new_mapping);
 
   // Store updated sequence->hash mappings in the consistent store
-  status = consistent_store_->UpdateSequenceMapping(&mapping);
+  {
+    TraceSpan span("update_sequence_mapping");
+    status = consistent_store_->UpdateSequenceMapping(&mapping);
+  }
   if (!status.ok()) {
+    RetryPendingEntries(pending_entries);
     return status;
   }
 
-  // Now add the sequenced entries to our local DB so that the local signer can
-  // incorporate them.
-  for (auto it(seq_to_entry.find(db_->TreeSize())); it != seq_to_entry.end();
-       ++it) {
-    VLOG(1) << "Adding to local DB: " << it->first;
+  // The sequenced entries now have to be added to our local DB so that
+  // the local signer can incorporate them.
+  std::map<int64_t, Logged> newly_sequenced;
+  for (auto it(seq_to_digest.lower_bound(local_size));
+       it != seq_to_digest.end(); ++it) {
+    Logged* const entry(&newly_sequenced[it->first]);
+    if (!GetPendingEntry(*it->second, &fetched_entries, entry)) {
+      // It has a sequence number now, so the next round will try again.
+      newly_sequenced.erase(it->first);
+      continue;
+    }
+    entry->set_sequence_number(it->first);
+    CHECK(seq_to_entry.insert(std::make_pair(it->first, entry)).second);
+  }
+  for (auto it(seq_to_entry.lower_bound(local_size));
+       it != seq_to_entry.end(); ++it) {
     CHECK_EQ(it->first, it->second->sequence_number());
-    CHECK_EQ(Database<Logged>::OK, db_->CreateSequencedEntry(*(it->second)));
+    // Only count the contiguous ones, the others will be fetched again.
+    if (it->first == assigned_size_) {
+      ++assigned_size_;
+    }
+    new_entries->emplace_back(std::move(*it->second));
   }
 
   VLOG(1) << "Sequenced " << num_sequenced << " entries.";
@@ -226,35 +341,338 @@ util::Status TreeSigner<Logged>::SequenceNewEntries() {
 }
 
 
+template <class Logged>
+void TreeSigner<Logged>::StoreSequencedEntries(
+    const std::vector<Logged>& new_entries) {
+  std::vector<const Logged*> entries;
+  entries.reserve(new_entries.size());
+  for (const auto& entry : new_entries) {
+    VLOG(1) << "Adding to local DB: " << entry.sequence_number();
+    entries.push_back(&entry);
+  }
+  CHECK_EQ(Database<Logged>::OK, db_->CreateSequencedEntries(entries));
+
+  // Extend the preview with them, hashing the leaves in batches as
+  // UpdateTree() would.
+  std::lock_guard<std::mutex> lock(preview_lock_);
+  std::vector<std::string> serialized_leaves;
+  int64_t next(preview_tree_->LeafCount());
+  for (const auto& entry : new_entries) {
+    if (entry.sequence_number() < next) {
+      continue;
+    }
+    if (entry.sequence_number() > next) {
+      // Left for UpdateTree() to read from the database.
+      break;
+    }
+    preview_timestamp_ = std::max(preview_timestamp_, entry.sct().timestamp());
+    if (!entry.merkle_leaf_hash().empty()) {
+      if (!serialized_leaves.empty()) {
+        preview_tree_->AddLeaves(serialized_leaves, executor_);
+        serialized_leaves.clear();
+      }
+      preview_tree_->AddLeafHash(entry.merkle_leaf_hash());
+    } else {
+      serialized_leaves.emplace_back();
+      CHECK(entry.SerializeForLeaf(&serialized_leaves.back()));
+    }
+    ++next;
+  }
+  if (!serialized_leaves.empty()) {
+    preview_tree_->AddLeaves(serialized_leaves, executor_);
+  }
+}
+
+
+template <class Logged>
+void TreeSigner<Logged>::WaitForPendingEntries(
+    size_t backlog_threshold, const std::chrono::duration<double>& max_delay,
+    std::chrono::steady_clock::time_point deadline) {
+  std::unique_lock<std::mutex> lock(pending_lock_);
+  while (true) {
+    const std::chrono::steady_clock::time_point steady_now(
+        std::chrono::steady_clock::now());
+    if (steady_now >= deadline) {
+      return;
+    }
+    std::chrono::steady_clock::time_point wake_up(deadline);
+
+    if (pending_synced_ && !new_pending_keys_.empty()) {
+      // The entries are timestamped with the system clock.
+      const std::chrono::system_clock::time_point now(
+          std::chrono::system_clock::now());
+      std::chrono::system_clock::time_point oldest(
+          std::chrono::system_clock::time_point::max());
+      size_t num_ready(0);
+      for (const auto& key : new_pending_keys_) {
+        const std::chrono::system_clock::time_point cert_time(
+            std::chrono::milliseconds(pending_.at(key).Entry().timestamp()));
+        if (now - cert_time >= guard_window_) {
+          ++num_ready;
+        }
+        oldest = std::min(oldest, cert_time);
+      }
+      if (backlog_threshold > 0 && num_ready >= backlog_threshold) {
+        return;
+      }
+
+      const std::chrono::duration<double> until_due(
+          oldest + std::chrono::duration_cast<
+                       std::chrono::system_clock::duration>(guard_window_ +
+                                                            max_delay) -
+          now);
+      if (until_due.count() <= 0) {
+        return;
+      }
+      wake_up = std::min(
+          wake_up,
+          steady_now +
+              std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                  until_due));
+    }
+
+    pending_cv_.wait_until(lock, wake_up);
+  }
+}
+
+
+template <class Logged>
+util::Status TreeSigner<Logged>::GetPendingEntries(
+    int64_t serving_tree_size, int64_t local_size,
+    SequencedHashes* sequenced_hashes,
+    std::vector<PendingEntryDigest>* pending_entries,
+    std::vector<EntryHandle<Logged>>* sequenced_entries,
+    std::unordered_map<std::string, EntryHandle<Logged>>* fetched_entries) {
+  if (watch_pending_task_ &&
+      GetPendingEntriesFromWatch(serving_tree_size, local_size,
+                                 sequenced_hashes, pending_entries,
+                                 sequenced_entries)) {
+    return util::Status::OK;
+  }
+
+  std::vector<EntryHandle<Logged>> all_entries;
+  const util::Status status(
+      consistent_store_->GetPendingEntries(&all_entries));
+  if (!status.ok()) {
+    return status;
+  }
+
+  for (auto& pending_entry : all_entries) {
+    CHECK(!pending_entry.Entry().has_sequence_number());
+    const auto seq_it(sequenced_hashes->find(pending_entry.Entry().Hash()));
+    if (seq_it == sequenced_hashes->end()) {
+      pending_entries->push_back(DigestPendingEntry(pending_entry));
+      const std::string key(pending_entry.Key());
+      fetched_entries->emplace(key, std::move(pending_entry));
+      continue;
+    }
+
+    VLOG(1) << "Previously sequenced " << util::ToBase64(seq_it->first)
+            << " = " << seq_it->second.first;
+    CHECK(!seq_it->second.second /*present*/)
+        << "Saw same sequenced cert twice.";
+    seq_it->second.second = true;  // present
+    if (seq_it->second.first >= local_size) {
+      pending_entry.MutableEntry()->set_sequence_number(seq_it->second.first);
+      sequenced_entries->emplace_back(std::move(pending_entry));
+    }
+  }
+
+  return util::Status::OK;
+}
+
+
+template <class Logged>
+bool TreeSigner<Logged>::GetPendingEntriesFromWatch(
+    int64_t serving_tree_size, int64_t local_size,
+    SequencedHashes* sequenced_hashes,
+    std::vector<PendingEntryDigest>* pending_entries,
+    std::vector<EntryHandle<Logged>>* sequenced_entries) {
+  std::lock_guard<std::mutex> lock(pending_lock_);
+  if (!pending_synced_) {
+    return false;
+  }
+
+  for (auto& s : *sequenced_hashes) {
+    const auto key_it(pending_keys_.find(s.first));
+    if (key_it == pending_keys_.end()) {
+      if (s.second.first >= serving_tree_size) {
+        // Maybe the watch hasn't caught up with another signer yet,
+        // let the caller fetch all the entries.
+        LOG(WARNING) << "Sequenced entry " << s.second.first
+                     << " missing from the watched pending entries";
+        for (auto& r : *sequenced_hashes) {
+          r.second.second = false;
+        }
+        sequenced_entries->clear();
+        return false;
+      }
+      continue;
+    }
+
+    s.second.second = true;  // present
+    if (s.second.first >= local_size) {
+      sequenced_entries->push_back(pending_.at(key_it->second));
+      sequenced_entries->back().MutableEntry()->set_sequence_number(
+          s.second.first);
+    }
+  }
+
+  for (const auto& key : new_pending_keys_) {
+    PendingEntryDigest digest(DigestPendingEntry(pending_.at(key)));
+    // Skip those sequenced since they were added.
+    if (sequenced_hashes->find(digest.hash) == sequenced_hashes->end()) {
+      pending_entries->push_back(std::move(digest));
+    }
+  }
+  new_pending_keys_.clear();
+
+  return true;
+}
+
+
+template <class Logged>
+bool TreeSigner<Logged>::GetPendingEntry(
+    const PendingEntryDigest& digest,
+    std::unordered_map<std::string, EntryHandle<Logged>>* fetched_entries,
+    Logged* entry) {
+  const auto fetched_it(fetched_entries->find(digest.key));
+  if (fetched_it != fetched_entries->end()) {
+    entry->Swap(fetched_it->second.MutableEntry());
+    return true;
+  }
+  if (watch_pending_task_) {
+    std::lock_guard<std::mutex> lock(pending_lock_);
+    const auto it(pending_.find(digest.key));
+    if (it != pending_.end()) {
+      entry->CopyFrom(it->second.Entry());
+      return true;
+    }
+  }
+
+  EntryHandle<Logged> handle;
+  const util::Status status(
+      consistent_store_->GetPendingEntryForHash(digest.hash, &handle));
+  if (!status.ok()) {
+    LOG(WARNING) << "Failed to read sequenced entry "
+                 << util::ToBase64(digest.hash) << ": " << status;
+    return false;
+  }
+  entry->Swap(handle.MutableEntry());
+  return true;
+}
+
+
+template <class Logged>
+void TreeSigner<Logged>::RetryPendingEntries(
+    const std::vector<PendingEntryDigest>& entries) {
+  if (!watch_pending_task_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(pending_lock_);
+  for (const auto& entry : entries) {
+    // Unless it was deleted in the meantime.
+    if (pending_.find(entry.key) != pending_.end()) {
+      new_pending_keys_.insert(entry.key);
+    }
+  }
+}
+
+
+template <class Logged>
+void TreeSigner<Logged>::UpdatePendingEntries(
+    const std::vector<Update<Logged>>& updates) {
+  std::lock_guard<std::mutex> lock(pending_lock_);
+  for (const auto& update : updates) {
+    const std::string& key(update.handle_.Key());
+    const auto it(pending_.find(key));
+    if (it != pending_.end()) {
+      pending_bytes_ -= PendingEntryBytes(it->second);
+      pending_keys_.erase(it->second.Entry().Hash());
+      pending_.erase(it);
+      new_pending_keys_.erase(key);
+    }
+    if (update.exists_) {
+      CHECK(!update.handle_.Entry().has_sequence_number());
+      pending_keys_[update.handle_.Entry().Hash()] = key;
+      pending_.insert(std::make_pair(key, update.handle_));
+      new_pending_keys_.insert(key);
+      pending_bytes_ += PendingEntryBytes(update.handle_);
+    }
+  }
+  tree_signer_pending_bytes->Set(pending_bytes_);
+  // The first call has all the pending entries, of all the shards
+  // (see ConsistentStore::WatchPendingEntries()).
+  pending_synced_ = true;
+  pending_cv_.notify_all();
+}
+
+
 // DB_ERROR: the database is inconsistent with our inner self.
 // However, if the database itself is giving inconsistent answers, or failing
 // reads/writes, then we die.
 template <class Logged>
 typename TreeSigner<Logged>::UpdateResult TreeSigner<Logged>::UpdateTree() {
+  const std::shared_ptr<Trace> trace(Trace::MaybeStart("update_tree"));
+  ScopedTrace scoped_trace(trace.get());
   // Try to make local timestamps unique, but there's always a chance that
   // multiple nodes in the cluster may make STHs with the same timestamp.
   // That'll get handled by the Serving STH selection code.
   uint64_t min_timestamp = LastUpdateTime() + 1;
 
-  // Add any newly sequenced entries from our local DB.
-  auto it(db_->ScanEntries(cert_tree_->LeafCount()));
-  for (int64_t i(cert_tree_->LeafCount());; ++i) {
-    Logged logged;
-    if (!it->GetNextEntry(&logged) || logged.sequence_number() != i) {
-      break;
+  // Start from the preview, if it got ahead of the tree.
+  {
+    std::lock_guard<std::mutex> lock(preview_lock_);
+    if (preview_tree_->LeafCount() > cert_tree_->LeafCount()) {
+      cert_tree_.reset(
+          new CompactMerkleTree(*preview_tree_, new Sha256Hasher));
+      min_timestamp = std::max(min_timestamp, preview_timestamp_);
+    }
+  }
+
+  // Add any other newly sequenced entries from our local DB. Only
+  // their leaf hashes are read, which the database may have stored
+  // when they were sequenced.
+  if (db_->TreeSize() > static_cast<int64_t>(cert_tree_->LeafCount())) {
+    TraceSpan span("add_leaves");
+    const size_t readahead(FLAGS_database_scan_readahead);
+    auto it(db_->ScanLeafHashesAhead(
+        cert_tree_->LeafCount(),
+        db_->TreeSize() - cert_tree_->LeafCount() >
+                static_cast<int64_t>(readahead)
+            ? readahead
+            : 0));
+    // Reused for each entry, to save on allocations.
+    typename Database<Logged>::LeafHash leaf_hash;
+    for (int64_t i(cert_tree_->LeafCount());; ++i) {
+      if (!it->GetNextLeafHash(&leaf_hash) ||
+          leaf_hash.sequence_number != i) {
+        break;
+      }
+      min_timestamp = std::max(min_timestamp, leaf_hash.timestamp);
+      cert_tree_->AddLeafHash(leaf_hash.hash);
     }
-    CHECK_EQ(logged.sequence_number(), i);
-    AppendToTree(logged);
-    min_timestamp = std::max(min_timestamp, logged.sct().timestamp());
   }
   int64_t next_seq(cert_tree_->LeafCount());
   CHECK_GE(next_seq, 0);
 
+  // The entries stored from now on follow the tree.
+  {
+    std::lock_guard<std::mutex> lock(preview_lock_);
+    if (preview_tree_->LeafCount() < cert_tree_->LeafCount()) {
+      preview_tree_.reset(
+          new CompactMerkleTree(*cert_tree_, new Sha256Hasher));
+    }
+  }
+
   // Our tree is consistent with the database, i.e., each leaf in the tree has
   // a matching sequence number in the database (at least assuming overwriting
   // the sequence number is not allowed).
   ct::SignedTreeHead new_sth;
-  TimestampAndSign(min_timestamp, &new_sth);
+  {
+    TraceSpan span("sign_tree_head");
+    TimestampAndSign(min_timestamp, &new_sth);
+  }
 
   // We don't actually store this STH anywhere durable yet, but rather let the
   // caller decide what to do with it.  (In practice, this will mean that it's
@@ -267,9 +685,11 @@ typename TreeSigner<Logged>::UpdateResult TreeSigner<Logged>::UpdateTree() {
 
 template <class Logged>
 bool TreeSigner<Logged>::Append(const Logged& logged) {
-  // Serialize for inclusion in the tree.
+  // Serialize for inclusion in the tree, unless it was already hashed.
   std::string serialized_leaf;
-  CHECK(logged.SerializeForLeaf(&serialized_leaf));
+  if (logged.merkle_leaf_hash().empty()) {
+    CHECK(logged.SerializeForLeaf(&serialized_leaf));
+  }
 
   CHECK_EQ(logged.sequence_number(), cert_tree_->LeafCount());
   // Commit the sequence number of this certificate locally
@@ -284,22 +704,15 @@ bool TreeSigner<Logged>::Append(const Logged& logged) {
   }
 
   // Update in-memory tree.
-  cert_tree_->AddLeaf(serialized_leaf);
+  if (logged.merkle_leaf_hash().empty()) {
+    cert_tree_->AddLeaf(serialized_leaf);
+  } else {
+    cert_tree_->AddLeafHash(logged.merkle_leaf_hash());
+  }
   return true;
 }
 
 
-template <class Logged>
-void TreeSigner<Logged>::AppendToTree(const Logged& logged) {
-  // Serialize for inclusion in the tree.
-  std::string serialized_leaf;
-  CHECK(logged.SerializeForLeaf(&serialized_leaf));
-
-  // Update in-memory tree.
-  cert_tree_->AddLeaf(serialized_leaf);
-}
-
-
 template <class Logged>
 void TreeSigner<Logged>::TimestampAndSign(uint64_t min_timestamp,
                                           ct::SignedTreeHead* sth) {
@@ -2,7 +2,15 @@
 #define TREE_SIGNER_H
 
 #include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "log/cluster_state_controller.h"
 #include "log/consistent_store.h"
@@ -11,7 +19,9 @@
 
 
 namespace util {
+class Executor;
 class Status;
+class SyncTask;
 }  // namespace util
 
 template <class Logged>
@@ -22,6 +32,19 @@ class LogSigner;
 namespace cert_trans {
 
 
+// What sequencing needs to know of a pending entry. The entry itself
+// is only needed once it has a sequence number, to be stored in the
+// local database.
+struct PendingEntryDigest {
+  // The key of the entry in the consistent store.
+  std::string key;
+  std::string hash;
+  uint64_t timestamp;
+  // The size of the serialized entry.
+  size_t bytes;
+};
+
+
 // Signer for appending new entries to the log.
 // This is the single authority that assigns sequence numbers to new entries,
 // timestamps and signs tree heads. The signer process assumes there are
@@ -32,12 +55,15 @@ template <class Logged>
 class TreeSigner {
  public:
   // No transfer of ownership for params other than merkle_tree whose contents
-  // is moved into this object.
+  // is moved into this object. New leaves are hashed on |executor|, if it
+  // is not NULL. If it is, the pending entries are also watched on it,
+  // so that SequenceNewEntries() only needs to look at the new ones.
   TreeSigner(const std::chrono::duration<double>& guard_window,
              Database<Logged>* db,
              std::unique_ptr<CompactMerkleTree> merkle_tree,
              cert_trans::ConsistentStore<Logged>* consistent_store,
-             LogSigner* signer);
+             LogSigner* signer, util::Executor* executor);
+  ~TreeSigner();
 
   enum UpdateResult {
     OK,
@@ -50,11 +76,34 @@ class TreeSigner {
   // Latest Tree Head timestamp;
   uint64_t LastUpdateTime() const;
 
+  // Assigns sequence numbers to the new entries, and stores them in the
+  // local database.
   util::Status SequenceNewEntries();
 
+  // The two halves of SequenceNewEntries(), so that they can be
+  // pipelined. AssignSequenceNumbers() updates the sequence mapping in
+  // the consistent store, and returns in |new_entries| the entries that
+  // must then be passed, in the same order, to StoreSequencedEntries().
+  // The next AssignSequenceNumbers() does not have to wait for them to
+  // be stored. StoreSequencedEntries() also appends the entries to the
+  // preview tree, which UpdateTree() then starts from.
+  util::Status AssignSequenceNumbers(std::vector<Logged>* new_entries);
+  void StoreSequencedEntries(const std::vector<Logged>& new_entries);
+
+  // Blocks until sequencing the pending entries is worthwhile: at
+  // least |backlog_threshold| of the new ones are past the guard window
+  // (if non-zero), or the oldest has been past it for |max_delay|. In
+  // any case, returns at |deadline|. Without a watch of the pending
+  // entries (if there was no executor), it always waits until
+  // |deadline|.
+  void WaitForPendingEntries(size_t backlog_threshold,
+                             const std::chrono::duration<double>& max_delay,
+                             std::chrono::steady_clock::time_point deadline);
+
   // Simplest update mechanism: take all pending entries and append
   // (in random order) to the tree. Checks that the update it writes
-  // to the database is consistent with the latest STH.
+  // to the database is consistent with the latest STH. The entries
+  // already in the preview tree are not read back from the database.
   UpdateResult UpdateTree();
 
   // Latest Tree Head (does not build a new tree, just retrieves the
@@ -64,17 +113,76 @@ class TreeSigner {
   }
 
  private:
+  typedef std::unordered_map<std::string, std::pair<int64_t, bool /*present*/>>
+      SequencedHashes;
+
   bool Append(const Logged& logged);
-  void AppendToTree(const Logged& logged_cert);
   void TimestampAndSign(uint64_t min_timestamp, ct::SignedTreeHead* sth);
+  // Fills |pending_entries| with the digests of the entries which are
+  // not in |sequenced_hashes| yet, marks the others present, and adds
+  // those with a sequence number of |local_size| or more to
+  // |sequenced_entries|, with their sequence number set. The entries
+  // of |pending_entries| it had to read are put in |fetched_entries|,
+  // by key.
+  util::Status GetPendingEntries(
+      int64_t serving_tree_size, int64_t local_size,
+      SequencedHashes* sequenced_hashes,
+      std::vector<PendingEntryDigest>* pending_entries,
+      std::vector<EntryHandle<Logged>>* sequenced_entries,
+      std::unordered_map<std::string, EntryHandle<Logged>>*
+          fetched_entries);
+  // As above, but from |pending_|, only looking at the entries added
+  // since the last call. Returns false if |pending_| looks out of date.
+  bool GetPendingEntriesFromWatch(
+      int64_t serving_tree_size, int64_t local_size,
+      SequencedHashes* sequenced_hashes,
+      std::vector<PendingEntryDigest>* pending_entries,
+      std::vector<EntryHandle<Logged>>* sequenced_entries);
+  // Sets |entry| to the pending entry of |digest|, taken from
+  // |fetched_entries| or |pending_| if it is there, read from the
+  // consistent store otherwise.
+  bool GetPendingEntry(
+      const PendingEntryDigest& digest,
+      std::unordered_map<std::string, EntryHandle<Logged>>* fetched_entries,
+      Logged* entry);
+  // Have the next sequencing round look at these entries again.
+  void RetryPendingEntries(const std::vector<PendingEntryDigest>& entries);
+  void UpdatePendingEntries(const std::vector<Update<Logged>>& updates);
 
   const std::chrono::duration<double> guard_window_;
   Database<Logged>* const db_;
   cert_trans::ConsistentStore<Logged>* const consistent_store_;
   LogSigner* const signer_;
-  const std::unique_ptr<CompactMerkleTree> cert_tree_;
+  util::Executor* const executor_;
+  std::unique_ptr<CompactMerkleTree> cert_tree_;
   ct::SignedTreeHead latest_tree_head_;
 
+  std::mutex preview_lock_;
+  // Forked from |cert_tree_|, followed by the entries stored by
+  // StoreSequencedEntries() since, as long as they are contiguous.
+  std::unique_ptr<CompactMerkleTree> preview_tree_;
+  // The latest SCT timestamp of the entries in |preview_tree_|.
+  uint64_t preview_timestamp_;
+
+  std::mutex pending_lock_;
+  // Notified when the watch updates |pending_|.
+  std::condition_variable pending_cv_;
+  // Set once the watch has delivered the pending entries.
+  bool pending_synced_;
+  // The pending entries by key, as seen by the watch.
+  std::unordered_map<std::string, EntryHandle<Logged>> pending_;
+  // The keys of |pending_| by entry hash.
+  std::unordered_map<std::string, std::string> pending_keys_;
+  // The keys of the entries added since the last sequencing round, or
+  // left for the next one.
+  std::unordered_set<std::string> new_pending_keys_;
+  // An estimate of the memory used by the above.
+  size_t pending_bytes_;
+  const std::unique_ptr<util::SyncTask> watch_pending_task_;
+  // The size the local database will have once the entries returned by
+  // AssignSequenceNumbers() are stored.
+  int64_t assigned_size_;
+
   template <class T>
   friend class TreeSignerTest;
 };
@@ -1,8 +1,11 @@
 /* -*- indent-tabs-mode: nil -*- */
 #include <gtest/gtest.h>
+#include <chrono>
 #include <memory>
+#include <mutex>
 #include <stdint.h>
 #include <string>
+#include <thread>
 
 #include "log/etcd_consistent_store-inl.h"
 #include "log/file_db.h"
@@ -68,7 +71,8 @@ class TreeSignerTest : public ::testing::Test {
     tree_signer_.reset(new TS(std::chrono::duration<double>(0), db(),
                               unique_ptr<CompactMerkleTree>(
                                   new CompactMerkleTree(new Sha256Hasher)),
-                              store_.get(), TestSigner::DefaultLogSigner()));
+                              store_.get(), TestSigner::DefaultLogSigner(),
+                              &pool_));
     // Set a default empty STH so that we can call UpdateTree() on the signer.
     store_->SetServingSTH(SignedTreeHead());
     // Force an empty sequence mapping file:
@@ -80,9 +84,23 @@ class TreeSignerTest : public ::testing::Test {
     }
   }
 
+  // Waits for the watch of |tree_signer_| to catch up with the store.
+  void WaitForPendingEntry(const string& hash, bool present) const {
+    while (true) {
+      {
+        std::lock_guard<std::mutex> lock(tree_signer_->pending_lock_);
+        if ((tree_signer_->pending_keys_.count(hash) > 0) == present) {
+          return;
+        }
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+
   void AddPendingEntry(LoggedCertificate* logged_cert) const {
     logged_cert->clear_sequence_number();
     CHECK(this->store_->AddPendingEntry(logged_cert).ok());
+    WaitForPendingEntry(logged_cert->Hash(), true);
   }
 
   void DeletePendingEntry(const LoggedCertificate& logged_cert) const {
@@ -90,11 +108,13 @@ class TreeSignerTest : public ::testing::Test {
     CHECK_EQ(Status::OK,
              this->store_->GetPendingEntryForHash(logged_cert.Hash(), &e));
     CHECK_EQ(Status::OK, this->store_->DeleteEntry(&e));
+    WaitForPendingEntry(logged_cert.Hash(), false);
   }
 
   void AddSequencedEntry(LoggedCertificate* logged_cert, int64_t seq) const {
     logged_cert->clear_sequence_number();
     CHECK(this->store_->AddPendingEntry(logged_cert).ok());
+    WaitForPendingEntry(logged_cert->Hash(), true);
 
     // This below would normally be done by TreeSigner::SequenceNewEntries()
     EntryHandle<LoggedCertificate> entry;
@@ -114,7 +134,7 @@ class TreeSignerTest : public ::testing::Test {
     return new TS(std::chrono::duration<double>(0), db(),
                   unique_ptr<CompactMerkleTree>(new CompactMerkleTree(
                       *tree_signer_->cert_tree_, new Sha256Hasher)),
-                  store_.get(), TestSigner::DefaultLogSigner());
+                  store_.get(), TestSigner::DefaultLogSigner(), &pool_);
   }
 
   T* db() const {
@@ -136,28 +156,26 @@ typedef testing::Types<FileDB<LoggedCertificate>, SQLiteDB<LoggedCertificate>>
     Databases;
 
 
-EntryHandle<LoggedCertificate> H(const LoggedCertificate& l) {
-  EntryHandle<LoggedCertificate> handle;
-  handle.MutableEntry()->CopyFrom(l);
-  return handle;
+PendingEntryDigest D(const LoggedCertificate& l) {
+  return PendingEntryDigest{"", l.Hash(), l.timestamp(), 0};
 }
 
 
 TYPED_TEST_CASE(TreeSignerTest, Databases);
 
 TYPED_TEST(TreeSignerTest, PendingEntriesOrder) {
-  PendingEntriesOrder<LoggedCertificate> ordering;
+  PendingEntriesOrder ordering;
   LoggedCertificate lowest;
   this->test_signer_.CreateUnique(&lowest);
 
   // Can't be lower than itself!
-  EXPECT_FALSE(ordering(H(lowest), H(lowest)));
+  EXPECT_FALSE(ordering(D(lowest), D(lowest)));
 
   // check timestamp:
   LoggedCertificate higher_timestamp(lowest);
   higher_timestamp.mutable_sct()->set_timestamp(lowest.timestamp() + 1);
-  EXPECT_TRUE(ordering(H(lowest), H(higher_timestamp)));
-  EXPECT_FALSE(ordering(H(higher_timestamp), H(lowest)));
+  EXPECT_TRUE(ordering(D(lowest), D(higher_timestamp)));
+  EXPECT_FALSE(ordering(D(higher_timestamp), D(lowest)));
 
   // check hash fallback:
   LoggedCertificate higher_hash(lowest);
@@ -165,8 +183,8 @@ TYPED_TEST(TreeSignerTest, PendingEntriesOrder) {
     this->test_signer_.CreateUnique(&higher_hash);
     higher_hash.mutable_sct()->set_timestamp(lowest.timestamp());
   }
-  EXPECT_TRUE(ordering(H(lowest), H(higher_hash)));
-  EXPECT_FALSE(ordering(H(higher_hash), H(lowest)));
+  EXPECT_TRUE(ordering(D(lowest), D(higher_hash)));
+  EXPECT_FALSE(ordering(D(higher_hash), D(lowest)));
 }
 
 
@@ -185,6 +203,54 @@ TYPED_TEST(TreeSignerTest, Sign) {
 }
 
 
+TYPED_TEST(TreeSignerTest, AssignBeforeStoring) {
+  LoggedCertificate logged_cert;
+  this->test_signer_.CreateUnique(&logged_cert);
+  this->AddPendingEntry(&logged_cert);
+  vector<LoggedCertificate> first;
+  EXPECT_EQ(Status::OK, this->tree_signer_->AssignSequenceNumbers(&first));
+  ASSERT_EQ(1U, first.size());
+  EXPECT_EQ(0, first[0].sequence_number());
+  EXPECT_EQ(0, this->db()->TreeSize());
+
+  // The first entry is not returned again, although it is not stored
+  // yet.
+  LoggedCertificate logged_cert2;
+  this->test_signer_.CreateUnique(&logged_cert2);
+  this->AddPendingEntry(&logged_cert2);
+  vector<LoggedCertificate> second;
+  EXPECT_EQ(Status::OK, this->tree_signer_->AssignSequenceNumbers(&second));
+  ASSERT_EQ(1U, second.size());
+  EXPECT_EQ(1, second[0].sequence_number());
+  EXPECT_EQ(logged_cert2.Hash(), second[0].Hash());
+
+  this->tree_signer_->StoreSequencedEntries(first);
+  this->tree_signer_->StoreSequencedEntries(second);
+  EXPECT_EQ(2, this->db()->TreeSize());
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+  EXPECT_EQ(2U, this->tree_signer_->LatestSTH().tree_size());
+}
+
+
+TYPED_TEST(TreeSignerTest, SignsEntriesStoredByOthers) {
+  LoggedCertificate logged_cert, logged_cert2;
+  this->test_signer_.CreateUnique(&logged_cert);
+  this->test_signer_.CreateUnique(&logged_cert2);
+  this->AddPendingEntry(&logged_cert);
+  this->AddPendingEntry(&logged_cert2);
+  EXPECT_EQ(Status::OK, this->tree_signer_->SequenceNewEntries());
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+  EXPECT_EQ(2U, this->tree_signer_->LatestSTH().tree_size());
+
+  // Not sequenced by this signer, so not in its preview tree.
+  LoggedCertificate logged_cert3;
+  this->test_signer_.CreateUnique(&logged_cert3);
+  this->AddSequencedEntry(&logged_cert3, 2);
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+  EXPECT_EQ(3U, this->tree_signer_->LatestSTH().tree_size());
+}
+
+
 TYPED_TEST(TreeSignerTest, Timestamp) {
   LoggedCertificate logged_cert;
   this->test_signer_.CreateUnique(&logged_cert);
@@ -278,6 +344,42 @@ TYPED_TEST(TreeSignerTest, ResumePartialSign) {
 }
 
 
+TYPED_TEST(TreeSignerTest, WaitForPendingEntries) {
+  const std::chrono::steady_clock::time_point start(
+      std::chrono::steady_clock::now());
+  const std::chrono::steady_clock::time_point far(
+      start + std::chrono::seconds(60));
+
+  // Nothing pending, so it waits until the deadline.
+  this->tree_signer_->WaitForPendingEntries(
+      1, std::chrono::seconds(60),
+      start + std::chrono::milliseconds(100));
+  EXPECT_LE(start + std::chrono::milliseconds(100),
+            std::chrono::steady_clock::now());
+
+  for (int i(0); i < 2; ++i) {
+    LoggedCertificate logged_cert;
+    this->test_signer_.CreateUnique(&logged_cert);
+    this->AddPendingEntry(&logged_cert);
+  }
+  // With no guard window, both are ready.
+  this->tree_signer_->WaitForPendingEntries(2, std::chrono::seconds(60),
+                                            far);
+  // Not enough of them, but they have waited long enough.
+  this->tree_signer_->WaitForPendingEntries(3, std::chrono::seconds(0),
+                                            far);
+  EXPECT_GT(far, std::chrono::steady_clock::now());
+
+  // Sequencing them leaves nothing to wait for.
+  EXPECT_EQ(util::Status::OK, this->tree_signer_->SequenceNewEntries());
+  const std::chrono::steady_clock::time_point deadline(
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(100));
+  this->tree_signer_->WaitForPendingEntries(1, std::chrono::seconds(0),
+                                            deadline);
+  EXPECT_LE(deadline, std::chrono::steady_clock::now());
+}
+
+
 TYPED_TEST(TreeSignerTest, SignEmpty) {
   EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
 
@@ -4,7 +4,9 @@
 #ifndef SRC_LOG_VERIFIER_H_
 #define SRC_LOG_VERIFIER_H_
 
+#include <openssl/ec.h>
 #include <openssl/evp.h>
+#include <openssl/rsa.h>
 #include <openssl/x509.h>  // for i2d_PUBKEY
 #include <stdint.h>
 
@@ -13,6 +15,11 @@
 
 namespace cert_trans {
 
+// Verifications are thread-safe, and share no state but the key: the
+// data is hashed in one go, and the signature checked against the
+// digest with the EC or RSA key directly, rather than through an
+// EVP_MD_CTX of its own each time. The multiples of the EC generator
+// that each verification uses are precomputed with the key.
 class Verifier {
  public:
   enum Status {
@@ -40,6 +47,9 @@ class Verifier {
   bool RawVerify(const std::string& data, const std::string& sig_string) const;
 
   EVP_PKEY* pkey_;
+  // One of these is set, sharing the key of |pkey_|.
+  EC_KEY* ec_key_;
+  RSA* rsa_key_;
   ct::DigitallySigned::HashAlgorithm hash_algo_;
   ct::DigitallySigned::SignatureAlgorithm sig_algo_;
   std::string key_id_;
@@ -0,0 +1,74 @@
+#include "merkletree/batch_paths.h"
+
+#include <glog/logging.h>
+
+using std::string;
+using std::vector;
+
+namespace cert_trans {
+
+
+vector<vector<string>> PathsOfLastLeaves(const TreeHasher& hasher,
+                                         size_t snapshot,
+                                         const vector<string>& leaf_hashes,
+                                         const vector<string>& first_path) {
+  const size_t count(leaf_hashes.size());
+  CHECK_LE(count, snapshot);
+  vector<vector<string>> paths(count);
+  if (count == 0) {
+    return paths;
+  }
+
+  const size_t first(snapshot - count);
+  // The nodes of the current level, from |begin| to the last one,
+  // |last|. |node| is the ancestor of the first leaf at this level.
+  vector<string> level(leaf_hashes);
+  size_t begin(first);
+  size_t node(first);
+  size_t last(snapshot - 1);
+  vector<string>::const_iterator first_path_it(first_path.begin());
+  for (size_t height = 0; last > 0; ++height) {
+    // A sibling past the last node doesn't exist, and isn't part of
+    // the paths. The only one before |node| any path can need is the
+    // sibling of |node| itself.
+    const size_t sibling(node ^ 1);
+    if (sibling <= last) {
+      CHECK(first_path_it != first_path.end());
+      if (sibling < node) {
+        level.insert(level.begin(), *first_path_it);
+        begin = sibling;
+      }
+      ++first_path_it;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+      const size_t leaf_sibling(((first + i) >> height) ^ 1);
+      if (leaf_sibling <= last) {
+        paths[i].push_back(level[leaf_sibling - begin]);
+      }
+    }
+
+    // |begin| is even here, so the nodes pair up from it. The last one
+    // moves up as it is if it has no sibling.
+    vector<string> parents;
+    parents.reserve((last - begin) / 2 + 1);
+    for (size_t i = begin; i <= last; i += 2) {
+      if (i < last) {
+        parents.push_back(
+            hasher.HashChildren(level[i - begin], level[i + 1 - begin]));
+      } else {
+        parents.push_back(level[i - begin]);
+      }
+    }
+    level.swap(parents);
+    begin >>= 1;
+    node >>= 1;
+    last >>= 1;
+  }
+  CHECK(first_path_it == first_path.end());
+
+  return paths;
+}
+
+
+}  // namespace cert_trans
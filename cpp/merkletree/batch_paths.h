@@ -0,0 +1,30 @@
+#ifndef CERT_TRANS_MERKLETREE_BATCH_PATHS_H_
+#define CERT_TRANS_MERKLETREE_BATCH_PATHS_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "merkletree/tree_hasher.h"
+
+namespace cert_trans {
+
+
+// Returns the audit paths, in the tree of |snapshot| leaves, of its
+// last leaves, whose hashes are |leaf_hashes|, as
+// MerkleTree::PathToRootAtSnapshot() would return them.
+//
+// The paths of neighbouring leaves share most of their nodes, so they
+// are all computed in one pass up the tree, hashing each node once,
+// rather than walking the tree once per leaf. The only nodes that
+// don't come from |leaf_hashes| are the ones to their left, which are
+// taken from |first_path|, the audit path of the first of them.
+std::vector<std::vector<std::string>> PathsOfLastLeaves(
+    const TreeHasher& hasher, size_t snapshot,
+    const std::vector<std::string>& leaf_hashes,
+    const std::vector<std::string>& first_path);
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_MERKLETREE_BATCH_PATHS_H_
@@ -0,0 +1,53 @@
+#include "merkletree/batch_paths.h"
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "merkletree/merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "merkletree/tree_hasher.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::to_string;
+using std::vector;
+
+
+TEST(BatchPathsTest, MatchesMerkleTree) {
+  const TreeHasher hasher(new Sha256Hasher);
+  MerkleTree tree(new Sha256Hasher);
+  vector<string> leaf_hashes;
+  for (size_t snapshot = 1; snapshot <= 70; ++snapshot) {
+    tree.AddLeaf("leaf " + to_string(snapshot));
+    leaf_hashes.push_back(tree.LeafHash(snapshot));
+
+    for (size_t count = 0; count <= snapshot; ++count) {
+      const size_t first(snapshot - count);
+      const vector<vector<string>> paths(PathsOfLastLeaves(
+          hasher, snapshot,
+          vector<string>(leaf_hashes.begin() + first, leaf_hashes.end()),
+          count > 0 ? tree.PathToRootAtSnapshot(first + 1, snapshot)
+                    : vector<string>()));
+      ASSERT_EQ(count, paths.size());
+      for (size_t i = 0; i < count; ++i) {
+        EXPECT_EQ(tree.PathToRootAtSnapshot(first + i + 1, snapshot),
+                  paths[i])
+            << "leaf " << first + i + 1 << " of " << snapshot;
+      }
+    }
+  }
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -8,8 +8,25 @@
 #include "merkletree/merkle_tree_math.h"
 
 using cert_trans::MerkleTreeInterface;
+using std::make_shared;
 using std::string;
 
+namespace {
+
+// ceil(log2(leaf_count)) + 1, see LevelCount().
+size_t LevelCountFor(size_t leaf_count) {
+  if (leaf_count == 0) {
+    return 0;
+  }
+  size_t level_count(1);
+  for (size_t n(leaf_count - 1); n != 0; n >>= 1) {
+    ++level_count;
+  }
+  return level_count;
+}
+
+}  // namespace
+
 CompactMerkleTree::CompactMerkleTree(SerialHasher* hasher)
     : MerkleTreeInterface(),
       treehasher_(hasher),
@@ -21,7 +38,6 @@ CompactMerkleTree::CompactMerkleTree(SerialHasher* hasher)
 
 CompactMerkleTree::CompactMerkleTree(MerkleTree& model, SerialHasher* hasher)
     : MerkleTreeInterface(),
-      tree_(std::max<int64_t>(0, model.LevelCount() - 1)),
       treehasher_(hasher),
       leaf_count_(model.LeafCount()),
       leaves_processed_(0),
@@ -34,9 +50,9 @@ CompactMerkleTree::CompactMerkleTree(MerkleTree& model, SerialHasher* hasher)
   // definition must consist purely of left-hand nodes.
   std::vector<string> path(model.PathToCurrentRoot(model.LeafCount()));
   if (path.size() > 0) {
-    /* We have to do some juggling here as tree_[] differs from our MerkleTree
-    // structure in that incomplete right-hand subtrees 'fall-through' to lower
-    // levels:
+    /* We have to do some juggling here as the frontier differs from our
+    // MerkleTree structure in that incomplete right-hand subtrees
+    // 'fall-through' to lower levels:
     //
     // MerkleTree structure for 3 leaves:
     //      R
@@ -54,8 +70,8 @@ CompactMerkleTree::CompactMerkleTree(MerkleTree& model, SerialHasher* hasher)
     //         |
     //         c
     // or:
-    // tree_[1] = AB
-    // tree_[0] = c  // (c) has "fallen-through" to the lowest level
+    // c (level 0) -> AB (level 1)
+    // where (c) has "fallen-through" to the lowest level
     //
     // The inclusion proof path for the right-most entry effectively
     // describes the state of the tree immediately before the right-most
@@ -66,27 +82,32 @@ CompactMerkleTree::CompactMerkleTree(MerkleTree& model, SerialHasher* hasher)
     // the tree before the newest entry was added.
     */
 
-    // index into tree_, starting at the leaf level:
-    int level(0);
-    std::vector<string>::const_iterator i = path.begin();
+    // The levels of the proof path entries, starting at the leaf level:
+    std::vector<size_t> levels;
+    size_t level(0);
     size_t size_of_previous_tree(model.LeafCount() - 1);
     for (; size_of_previous_tree != 0; size_of_previous_tree >>= 1) {
       if ((size_of_previous_tree & 1) != 0) {
         // if the level'th bit in the previous tree size is set, then we have
         // a proof path entry for this level (because proof entries cover the
         // maximum possible sub-tree.)
-        tree_[level] = *i;
-        i++;
+        levels.push_back(level);
       }
       level++;
     }
-    CHECK(i == path.end()) << "Failed to consume all proof nodes";
+    CHECK_EQ(levels.size(), path.size())
+        << "Failed to consume all proof nodes";
+    // The frontier is linked from the lowest level up.
+    for (size_t i = path.size(); i > 0; --i) {
+      frontier_ = make_shared<const FrontierNode>(levels[i - 1], path[i - 1],
+                                                  frontier_);
+    }
   }
 
-  // Now tree_ should contain a representation of the tree state just before
-  // the last entry was added, so we PushBack the final right-hand entry
-  // here, which will perform any recalculations necessary to reach the final
-  // tree.
+  // Now the frontier should contain a representation of the tree state
+  // just before the last entry was added, so we PushBack the final
+  // right-hand entry here, which will perform any recalculations necessary
+  // to reach the final tree.
   PushBack(0, model.LeafHash(model.LeafCount()));
   CHECK_EQ(model.CurrentRoot(), CurrentRoot());
   CHECK_EQ(model.LeafCount(), LeafCount());
@@ -96,7 +117,7 @@ CompactMerkleTree::CompactMerkleTree(MerkleTree& model, SerialHasher* hasher)
 
 CompactMerkleTree::CompactMerkleTree(const CompactMerkleTree& other,
                                      SerialHasher* hasher)
-    : tree_(other.tree_),
+    : frontier_(other.frontier_),
       treehasher_(hasher),
       leaf_count_(other.leaf_count_),
       leaves_processed_(other.leaves_processed_),
@@ -104,6 +125,42 @@ CompactMerkleTree::CompactMerkleTree(const CompactMerkleTree& other,
       root_(other.root_) {
 }
 
+CompactMerkleTree::CompactMerkleTree(const Snapshot& snapshot,
+                                     SerialHasher* hasher)
+    : MerkleTreeInterface(),
+      frontier_(snapshot.frontier_),
+      treehasher_(hasher),
+      leaf_count_(snapshot.leaf_count_),
+      leaves_processed_(0),
+      level_count_(LevelCountFor(leaf_count_)),
+      root_(treehasher_.HashEmpty()) {
+}
+
+CompactMerkleTree::CompactMerkleTree(size_t leaf_count,
+                                     const std::vector<string>& frontier,
+                                     SerialHasher* hasher)
+    : MerkleTreeInterface(),
+      treehasher_(hasher),
+      leaf_count_(leaf_count),
+      leaves_processed_(0),
+      level_count_(LevelCountFor(leaf_count)),
+      root_(treehasher_.HashEmpty()) {
+  // Level i holds a node exactly when bit i of the leaf count is set.
+  std::vector<size_t> levels;
+  for (size_t level(0); (leaf_count >> level) != 0; ++level) {
+    if (((leaf_count >> level) & 1) != 0) {
+      levels.push_back(level);
+    }
+  }
+  CHECK_LE(levels.size(), frontier.size()) << "Not enough frontier nodes";
+  CHECK_GE(levels.size(), frontier.size()) << "Too many frontier nodes";
+  for (size_t i = frontier.size(); i > 0; --i) {
+    CHECK_EQ(frontier[i - 1].size(), treehasher_.DigestSize());
+    frontier_ = make_shared<const FrontierNode>(levels[i - 1],
+                                                frontier[i - 1], frontier_);
+  }
+}
+
 CompactMerkleTree::~CompactMerkleTree() {
 }
 
@@ -112,6 +169,14 @@ size_t CompactMerkleTree::AddLeaf(const string& data) {
   return AddLeafHash(treehasher_.HashLeaf(data));
 }
 
+size_t CompactMerkleTree::AddLeaves(const std::vector<string>& data,
+                                    util::Executor* executor) {
+  for (const auto& hash : treehasher_.HashLeaves(data, executor)) {
+    AddLeafHash(hash);
+  }
+  return LeafCount();
+}
+
 size_t CompactMerkleTree::AddLeafHash(const string& hash) {
   PushBack(0, hash);
   // Update level count: a k-level tree can hold 2^{k-1} leaves,
@@ -127,19 +192,26 @@ string CompactMerkleTree::CurrentRoot() {
   return root_;
 }
 
+std::vector<string> CompactMerkleTree::Frontier() const {
+  std::vector<string> frontier;
+  for (const FrontierNode* node(frontier_.get()); node;
+       node = node->next.get()) {
+    frontier.push_back(node->hash);
+  }
+  return frontier;
+}
+
 void CompactMerkleTree::PushBack(size_t level, string node) {
   CHECK_EQ(node.size(), treehasher_.DigestSize());
-  if (tree_.size() <= level) {
-    // First node at a new level.
-    tree_.push_back(node);
-  } else if (tree_[level].empty()) {
-    // Lone left sibling.
-    tree_[level] = node;
-  } else {
-    // Left sibling waiting: hash together and propagate up.
-    PushBack(level + 1, treehasher_.HashChildren(tree_[level], node));
-    tree_[level].clear();
+  // Left siblings waiting: hash together and propagate up.
+  while (frontier_ && frontier_->level == level) {
+    node = treehasher_.HashChildren(frontier_->hash, node);
+    frontier_ = frontier_->next;
+    ++level;
   }
+  // Lone left sibling.
+  frontier_ = make_shared<const FrontierNode>(level, std::move(node),
+                                              frontier_);
 }
 
 void CompactMerkleTree::UpdateRoot() {
@@ -148,14 +220,13 @@ void CompactMerkleTree::UpdateRoot() {
 
   string right_sibling;
 
-  for (size_t level = 0; level < tree_.size(); ++level) {
-    if (!tree_[level].empty()) {
-      // A lonely left sibling gets pulled up as a right sibling.
-      if (right_sibling.empty())
-        right_sibling = tree_[level];
-      else
-        right_sibling = treehasher_.HashChildren(tree_[level], right_sibling);
-    }
+  for (const FrontierNode* node(frontier_.get()); node;
+       node = node->next.get()) {
+    // A lonely left sibling gets pulled up as a right sibling.
+    if (right_sibling.empty())
+      right_sibling = node->hash;
+    else
+      right_sibling = treehasher_.HashChildren(node->hash, right_sibling);
   }
 
   root_ = right_sibling;
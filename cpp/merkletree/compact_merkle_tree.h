@@ -1,6 +1,7 @@
 #ifndef COMPACT_MERKLETREE_H
 #define COMPACT_MERKLETREE_H
 
+#include <memory>
 #include <stddef.h>
 #include <string>
 #include <vector>
@@ -15,15 +16,50 @@ class SerialHasher;
 // (see merkletree/merkle_tree.h) but can only add new leaves and report
 // its current root (i.e., it cannot do paths, snapshots or consistency).
 //
+// The nodes are immutable and shared between copies of a tree, so that
+// copying one, or taking a Snapshot of it, takes constant time.
+//
 // This class is thread-compatible, but not thread-safe.
 class CompactMerkleTree : public cert_trans::MerkleTreeInterface {
+ private:
+  struct FrontierNode;
+
  public:
+  // An immutable copy of the state of a tree, from which any number of
+  // trees can be created (forked) in constant time. Snapshots share
+  // their nodes with the trees, and can be used from any thread while
+  // those keep growing.
+  class Snapshot {
+   public:
+    // A snapshot of an empty tree.
+    Snapshot() : leaf_count_(0) {
+    }
+
+    size_t LeafCount() const {
+      return leaf_count_;
+    }
+
+   private:
+    friend class CompactMerkleTree;
+
+    Snapshot(size_t leaf_count, std::shared_ptr<const FrontierNode> frontier)
+        : leaf_count_(leaf_count), frontier_(std::move(frontier)) {
+    }
+
+    size_t leaf_count_;
+    std::shared_ptr<const FrontierNode> frontier_;
+  };
+
   // The constructor takes a pointer to some concrete hash function
   // instantiation of the SerialHasher abstract class.
   // Takes ownership of the hasher.
   explicit CompactMerkleTree(SerialHasher* hasher);
   CompactMerkleTree(const CompactMerkleTree& other, SerialHasher* hasher);
 
+  // Recreates the tree |snapshot| was taken of, as it was then.
+  // Takes ownership of |hasher|.
+  CompactMerkleTree(const Snapshot& snapshot, SerialHasher* hasher);
+
   explicit CompactMerkleTree(CompactMerkleTree&& other) = default;
 
   // Creates a new CompactMerkleTree based on the data present in the
@@ -31,6 +67,12 @@ class CompactMerkleTree : public cert_trans::MerkleTreeInterface {
   // Takes ownership of |hasher|.
   CompactMerkleTree(MerkleTree& model, SerialHasher* hasher);
 
+  // Recreates a tree of |leaf_count| leaves from its Frontier().
+  // Takes ownership of |hasher|.
+  CompactMerkleTree(size_t leaf_count,
+                    const std::vector<std::string>& frontier,
+                    SerialHasher* hasher);
+
   virtual ~CompactMerkleTree();
 
   // Length of a node (i.e., a hash), in bytes.
@@ -66,6 +108,17 @@ class CompactMerkleTree : public cert_trans::MerkleTreeInterface {
   // @param data Binary input blob
   virtual size_t AddLeaf(const std::string& data);
 
+  // Add new leaves to the hash tree, in order. The leaves are hashed
+  // in parallel on |executor| (see TreeHasher::HashLeaves()), then
+  // appended as if by AddLeafHash().
+  //
+  // Returns the position of the last leaf in the tree, i.e., the
+  // number of leaves in the tree after this update.
+  //
+  // @param data Binary input blobs
+  size_t AddLeaves(const std::vector<std::string>& data,
+                   util::Executor* executor);
+
   // Add a new leaf to the hash tree. It is the caller's responsibility
   // to ensure that the hash is correct.
   //
@@ -86,15 +139,42 @@ class CompactMerkleTree : public cert_trans::MerkleTreeInterface {
   // (and hence, no root).
   virtual std::string CurrentRoot();
 
+  // The roots of the perfect subtrees the tree is made of, from the
+  // smallest (rightmost) one up. There is one for each bit set in
+  // LeafCount(), and together with it they are all that is needed to
+  // recreate the tree.
+  std::vector<std::string> Frontier() const;
+
+  Snapshot GetSnapshot() const {
+    return Snapshot(leaf_count_, frontier_);
+  }
+
  private:
+  // A node of the frontier, linked to the rest of the frontier above
+  // it. Pushing a leaf only replaces the nodes at the bottom, so the
+  // others stay shared with the copies of the tree.
+  struct FrontierNode {
+    FrontierNode(size_t level, std::string hash,
+                 std::shared_ptr<const FrontierNode> next)
+        : level(level), hash(std::move(hash)), next(std::move(next)) {
+    }
+
+    const size_t level;
+    const std::string hash;
+    const std::shared_ptr<const FrontierNode> next;
+  };
+
   // Append a node to the level.
   void PushBack(size_t level, std::string node);
 
   void UpdateRoot();
   // Since the tree is append-only to the right, at any given point in time,
   // at each level, all nodes that have a right sibling are fixed and will
-  // no longer change. Thus we store, for each level i, only the last lone
-  // left node (if one exists) or an empty string otherwise (tree_[i]).
+  // no longer change. Thus we store only the last lone left node of each
+  // level that has one, as a list from the lowest level up (the
+  // frontier). Adding a leaf hashes it with the nodes at the start of
+  // the list for as long as their levels follow, and replaces them with
+  // the result.
   //
   //        ___hash___
   //       |          |
@@ -104,15 +184,9 @@ class CompactMerkleTree : public cert_trans::MerkleTreeInterface {
   //  | |     | |  |
   // a0 a1   a2 a3 a4
   //
-  // is internally represented, top-down
+  // is internally represented as
   //
-  // --------
-  // | h20  |      tree_[2]
-  // --------
-  // |      |      tree_[1]
-  // --------
-  // |  a4  |      tree_[0]
-  // --------
+  // a4 (level 0) -> h20 (level 2)
   //
   // After adding a 6th hash a5, the tree becomes
   //
@@ -126,24 +200,16 @@ class CompactMerkleTree : public cert_trans::MerkleTreeInterface {
   //
   // and its internal representation is
   //
-  // --------
-  // | h20  |      tree_[2]
-  // --------
-  // | h12  |      tree_[1]
-  // --------
-  // |      |      tree_[0]
-  // --------
-
-  std::vector<std::string> tree_;
+  // h12 (level 1) -> h20 (level 2)
+  std::shared_ptr<const FrontierNode> frontier_;
   TreeHasher treehasher_;
   // True number of leaves in the tree.
   size_t leaf_count_;
   // Number of leaves propagated up to the root,
   // to keep track of lazy evaluation.
   size_t leaves_processed_;
-  // True number of levels in the tree. Note that the tree_ itself
-  // contains the root only if it's balanced, so tree_.size() does not always
-  // match true level count.
+  // True number of levels in the tree. Note that the frontier contains
+  // the root only if the tree is balanced.
   size_t level_count_;
   // The root for |leaves_processed_| leaves.
   std::string root_;
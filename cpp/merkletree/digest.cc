@@ -0,0 +1,19 @@
+#include "merkletree/digest.h"
+
+#include <glog/logging.h>
+
+using std::string;
+
+namespace cert_trans {
+
+
+const size_t Digest::kSize;
+
+
+Digest::Digest(const string& bytes) {
+  CHECK_EQ(kSize, bytes.size());
+  memcpy(bytes_.data(), bytes.data(), kSize);
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,55 @@
+#ifndef CERT_TRANS_MERKLETREE_DIGEST_H_
+#define CERT_TRANS_MERKLETREE_DIGEST_H_
+
+#include <array>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+
+namespace cert_trans {
+
+// A 32-byte (i.e., SHA-256) tree node, held by value. Unlike a
+// std::string, filling in a Digest does not allocate, so vectors of
+// them can be reused to build proofs without touching the heap.
+class Digest {
+ public:
+  static const size_t kSize = 32;
+
+  Digest() : bytes_() {
+  }
+
+  // |bytes| must be exactly kSize bytes long.
+  explicit Digest(const std::string& bytes);
+
+  const char* data() const {
+    return bytes_.data();
+  }
+
+  char* mutable_data() {
+    return bytes_.data();
+  }
+
+  size_t size() const {
+    return kSize;
+  }
+
+  std::string ToString() const {
+    return std::string(bytes_.data(), kSize);
+  }
+
+  bool operator==(const Digest& other) const {
+    return memcmp(bytes_.data(), other.bytes_.data(), kSize) == 0;
+  }
+
+  bool operator!=(const Digest& other) const {
+    return !(*this == other);
+  }
+
+ private:
+  std::array<char, kSize> bytes_;
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_MERKLETREE_DIGEST_H_
@@ -0,0 +1,274 @@
+#include "merkletree/incremental_merkle_verifier.h"
+
+#include <glog/logging.h>
+
+#include "merkletree/serial_hasher.h"
+
+using std::map;
+using std::vector;
+
+namespace cert_trans {
+
+namespace {
+
+
+inline size_t Parent(size_t node) {
+  return node >> 1;
+}
+
+
+inline bool IsRightChild(size_t node) {
+  return node & 1;
+}
+
+
+// Whether the subtree at (|level|, |index|) is complete in a tree of
+// |tree_size| leaves.
+inline bool IsPerfect(int level, size_t index, size_t tree_size) {
+  return ((index + 1) << level) <= tree_size;
+}
+
+
+// The number of nodes left in an audit path from |node| up, where
+// |last_node| is the last node of the tree on the same level.
+size_t RemainingPathLength(size_t node, size_t last_node) {
+  size_t length(0);
+  while (last_node) {
+    if (IsRightChild(node) || node < last_node) {
+      ++length;
+    }
+    node = Parent(node);
+    last_node = Parent(last_node);
+  }
+  return length;
+}
+
+
+}  // namespace
+
+
+IncrementalMerkleVerifier::IncrementalMerkleVerifier(
+    SerialHasher* hasher, size_t max_cached_subtrees)
+    : treehasher_(hasher), max_cached_subtrees_(max_cached_subtrees) {
+  CHECK_EQ(Digest::kSize, treehasher_.DigestSize());
+}
+
+
+bool IncrementalMerkleVerifier::TrustRoot(size_t snapshot,
+                                          const Digest& root) {
+  if (roots_.empty()) {
+    roots_.emplace(snapshot, root);
+    return true;
+  }
+  return IsVerified(snapshot, root);
+}
+
+
+bool IncrementalMerkleVerifier::IsVerified(size_t snapshot,
+                                           const Digest& root) const {
+  const map<size_t, Digest>::const_iterator it(roots_.find(snapshot));
+  return it != roots_.end() && it->second == root;
+}
+
+
+bool IncrementalMerkleVerifier::AgreesWithHistory(size_t snapshot,
+                                                  const Digest& root) const {
+  const map<size_t, Digest>::const_iterator it(roots_.find(snapshot));
+  return it == roots_.end() || it->second == root;
+}
+
+
+bool IncrementalMerkleVerifier::VerifyConsistency(
+    size_t snapshot1, size_t snapshot2, const Digest& root1,
+    const Digest& root2, const vector<Digest>& proof) {
+  if (snapshot1 > snapshot2)
+    // Can't go back in time.
+    return false;
+  if (!AgreesWithHistory(snapshot1, root1) ||
+      !AgreesWithHistory(snapshot2, root2))
+    return false;
+
+  const bool known1(IsVerified(snapshot1, root1));
+  const bool known2(IsVerified(snapshot2, root2));
+  if (known1 && known2)
+    return true;
+  if (snapshot1 == 0)
+    // Any snapshot greater than 0 is consistent with snapshot 0, which
+    // says nothing about |root2|.
+    return proof.empty();
+
+  pending_.clear();
+  if (!VerifyConsistencyProof(snapshot1, snapshot2, root1, root2, proof))
+    return false;
+
+  if (known1 || known2 || roots_.empty()) {
+    roots_.emplace(snapshot1, root1);
+    roots_.emplace(snapshot2, root2);
+    CachePending();
+  }
+  return true;
+}
+
+
+// Same walk as MerkleVerifier::VerifyConsistency(), keeping track of the
+// level, so that the perfect subtrees can be queued for the cache.
+bool IncrementalMerkleVerifier::VerifyConsistencyProof(
+    size_t snapshot1, size_t snapshot2, const Digest& root1,
+    const Digest& root2, const vector<Digest>& proof) {
+  if (snapshot1 == snapshot2)
+    return root1 == root2 && proof.empty();
+  // Now 0 < snapshot1 < snapshot2.
+  if (proof.empty())
+    return false;
+
+  size_t node(snapshot1 - 1);
+  size_t last_node(snapshot2 - 1);
+  int level(0);
+  vector<Digest>::const_iterator it(proof.begin());
+  // Move up until the first mutable node.
+  while (IsRightChild(node)) {
+    node = Parent(node);
+    last_node = Parent(last_node);
+    ++level;
+  }
+
+  Digest node1_hash;
+  Digest node2_hash;
+  if (node)
+    node2_hash = node1_hash = *it++;
+  else
+    // The tree at snapshot1 was balanced, nothing to verify for root1.
+    node2_hash = node1_hash = root1;
+  // Either way, this is the last perfect subtree of the first tree.
+  AddPending(level, node, snapshot2, node1_hash);
+
+  while (node) {
+    if (it == proof.end())
+      return false;
+
+    if (IsRightChild(node)) {
+      AddPending(level, node - 1, snapshot2, *it);
+      treehasher_.HashChildren(*it, node1_hash, &node1_hash);
+      treehasher_.HashChildren(*it, node2_hash, &node2_hash);
+      ++it;
+    } else if (node < last_node) {
+      // The sibling only exists in the later tree. The parent in the
+      // snapshot1 tree is a dummy copy.
+      AddPending(level, node + 1, snapshot2, *it);
+      treehasher_.HashChildren(node2_hash, *it++, &node2_hash);
+    }
+    // Else the sibling does not exist in either tree. Do nothing.
+
+    node = Parent(node);
+    last_node = Parent(last_node);
+    ++level;
+    AddPending(level, node, snapshot2, node2_hash);
+  }
+
+  // Verify the first root.
+  if (node1_hash != root1)
+    return false;
+
+  // Continue until the second root.
+  while (last_node) {
+    if (it == proof.end())
+      // We've reached the end but we're not done yet.
+      return false;
+
+    AddPending(level, 1, snapshot2, *it);
+    treehasher_.HashChildren(node2_hash, *it++, &node2_hash);
+    last_node = Parent(last_node);
+    ++level;
+    AddPending(level, 0, snapshot2, node2_hash);
+  }
+
+  // Verify the second root.
+  return node2_hash == root2 && it == proof.end();
+}
+
+
+bool IncrementalMerkleVerifier::VerifyPath(size_t leaf, size_t tree_size,
+                                           const vector<Digest>& path,
+                                           const Digest& root,
+                                           const Digest& leaf_hash) {
+  if (leaf > tree_size || leaf == 0)
+    // No valid path exists.
+    return false;
+
+  const bool trusted(IsVerified(tree_size, root));
+  pending_.clear();
+
+  size_t node(leaf - 1);
+  size_t last_node(tree_size - 1);
+  int level(0);
+  Digest node_hash(leaf_hash);
+  vector<Digest>::const_iterator it(path.begin());
+
+  while (true) {
+    if (trusted && IsPerfect(level, node, tree_size)) {
+      const map<SubtreeKey, Digest>::const_iterator cached(
+          subtrees_.find(SubtreeKey(level, node)));
+      if (cached != subtrees_.end()) {
+        // The rest of the path leads to |root| from here, only its
+        // length is left to check.
+        if (cached->second != node_hash ||
+            static_cast<size_t>(path.end() - it) !=
+                RemainingPathLength(node, last_node))
+          return false;
+        CachePending();
+        return true;
+      }
+    }
+    AddPending(level, node, tree_size, node_hash);
+
+    if (!last_node)
+      break;
+    if (it == path.end())
+      // We've reached the end but we're not done yet.
+      return false;
+
+    if (IsRightChild(node)) {
+      AddPending(level, node - 1, tree_size, *it);
+      treehasher_.HashChildren(*it++, node_hash, &node_hash);
+    } else if (node < last_node) {
+      AddPending(level, node + 1, tree_size, *it);
+      treehasher_.HashChildren(node_hash, *it++, &node_hash);
+    }
+    // Else the sibling does not exist and the parent is a dummy copy.
+    // Do nothing.
+
+    node = Parent(node);
+    last_node = Parent(last_node);
+    ++level;
+  }
+
+  // Check that we've reached the end.
+  if (it != path.end() || node_hash != root)
+    return false;
+  if (trusted)
+    CachePending();
+  return true;
+}
+
+
+void IncrementalMerkleVerifier::AddPending(int level, size_t index,
+                                           size_t tree_size,
+                                           const Digest& hash) {
+  if (IsPerfect(level, index, tree_size)) {
+    pending_.emplace_back(SubtreeKey(level, index), hash);
+  }
+}
+
+
+void IncrementalMerkleVerifier::CachePending() {
+  for (const auto& subtree : pending_) {
+    subtrees_.emplace(subtree.first, subtree.second);
+  }
+  pending_.clear();
+  while (subtrees_.size() > max_cached_subtrees_) {
+    subtrees_.erase(subtrees_.begin());
+  }
+}
+
+
+}  // namespace cert_trans
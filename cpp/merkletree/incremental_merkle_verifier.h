@@ -0,0 +1,105 @@
+#ifndef CERT_TRANS_MERKLETREE_INCREMENTAL_MERKLE_VERIFIER_H_
+#define CERT_TRANS_MERKLETREE_INCREMENTAL_MERKLE_VERIFIER_H_
+
+#include <map>
+#include <stddef.h>
+#include <utility>
+#include <vector>
+
+#include "base/macros.h"
+#include "merkletree/digest.h"
+#include "merkletree/tree_hasher.h"
+
+class SerialHasher;
+
+namespace cert_trans {
+
+// Verifies the same proofs as MerkleVerifier, but remembers what it has
+// verified, for callers that check a chain of consistency proofs
+// between successive tree heads, and many audit paths against the same
+// tree heads.
+//
+// The verifier keeps one history: a set of (tree size, root) pairs
+// known to be consistent with each other. It is seeded with
+// TrustRoot(), or by the first consistency proof verified, and grows
+// with each consistency proof that links a new root to it. Once both
+// ends of a consistency proof are in the history, it is accepted
+// without hashing.
+//
+// Along the way it caches the hashes of the perfect subtrees (as in
+// SubtreeProver) seen in proofs that checked out against the history.
+// These never change as the tree grows, so an audit path against a root
+// in the history stops as soon as it reaches a cached subtree, and only
+// the rest of its length is checked.
+//
+// Leaves are numbered from 1, and a snapshot is a tree size, as in
+// MerkleVerifier. This class is not thread-safe.
+class IncrementalMerkleVerifier {
+ public:
+  // Takes ownership of |hasher|, which must produce Digest::kSize byte
+  // digests. At most |max_cached_subtrees| subtree hashes are kept, the
+  // lowest ones are dropped first.
+  IncrementalMerkleVerifier(SerialHasher* hasher, size_t max_cached_subtrees);
+
+  // Adds |root| to the history, if it is empty, e.g. for a tree head
+  // whose signature has been checked. Otherwise, this only returns
+  // whether |root| is already in it, a new root must be linked to the
+  // history with a consistency proof.
+  bool TrustRoot(size_t snapshot, const Digest& root);
+
+  bool IsVerified(size_t snapshot, const Digest& root) const;
+
+  // As MerkleVerifier::VerifyConsistency(). A root that contradicts the
+  // history is rejected, whatever the proof. On success, the roots are
+  // added to the history if either of them was already in it, or if it
+  // was empty.
+  bool VerifyConsistency(size_t snapshot1, size_t snapshot2,
+                         const Digest& root1, const Digest& root2,
+                         const std::vector<Digest>& proof);
+
+  // As MerkleVerifier::VerifyPath(), given the leaf hash rather than
+  // the leaf data. Only audit paths against a root in the history use
+  // or fill in the subtree cache.
+  bool VerifyPath(size_t leaf, size_t tree_size,
+                  const std::vector<Digest>& path, const Digest& root,
+                  const Digest& leaf_hash);
+
+  size_t NumVerifiedRoots() const {
+    return roots_.size();
+  }
+
+  size_t NumCachedSubtrees() const {
+    return subtrees_.size();
+  }
+
+ private:
+  // (level, index) of a perfect subtree.
+  typedef std::pair<int, size_t> SubtreeKey;
+
+  bool VerifyConsistencyProof(size_t snapshot1, size_t snapshot2,
+                              const Digest& root1, const Digest& root2,
+                              const std::vector<Digest>& proof);
+  // Whether |root| for |snapshot| agrees with the history, i.e. is
+  // either in it or for a snapshot it doesn't have.
+  bool AgreesWithHistory(size_t snapshot, const Digest& root) const;
+  // Queues the subtree at (|level|, |index|) to be cached, if it is
+  // perfect in a tree of |tree_size| leaves.
+  void AddPending(int level, size_t index, size_t tree_size,
+                  const Digest& hash);
+  void CachePending();
+
+  const TreeHasher treehasher_;
+  const size_t max_cached_subtrees_;
+  std::map<size_t, Digest> roots_;
+  // Ordered by level first, so that the lowest subtrees go first.
+  std::map<SubtreeKey, Digest> subtrees_;
+  // Subtrees seen in the proof being checked, cached if it checks out.
+  std::vector<std::pair<SubtreeKey, Digest>> pending_;
+
+  DISALLOW_COPY_AND_ASSIGN(IncrementalMerkleVerifier);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_MERKLETREE_INCREMENTAL_MERKLE_VERIFIER_H_
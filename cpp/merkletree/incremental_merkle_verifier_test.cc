@@ -0,0 +1,224 @@
+#include "merkletree/incremental_merkle_verifier.h"
+
+#include <gtest/gtest.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "merkletree/digest.h"
+#include "merkletree/merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "merkletree/tree_hasher.h"
+#include "util/testing.h"
+
+namespace {
+
+using cert_trans::Digest;
+using cert_trans::IncrementalMerkleVerifier;
+using std::string;
+using std::to_string;
+using std::vector;
+
+const size_t kNumLeaves(77);
+
+
+class IncrementalMerkleVerifierTest : public ::testing::Test {
+ protected:
+  IncrementalMerkleVerifierTest()
+      : tree_(new Sha256Hasher),
+        hasher_(new Sha256Hasher),
+        verifier_(new Sha256Hasher, 1000) {
+    for (size_t i = 0; i < kNumLeaves; ++i) {
+      tree_.AddLeaf(to_string(i));
+    }
+  }
+
+  Digest Root(size_t snapshot) {
+    return Digest(tree_.RootAtSnapshot(snapshot));
+  }
+
+  Digest LeafHash(size_t leaf) {
+    return Digest(hasher_.HashLeaf(to_string(leaf - 1)));
+  }
+
+  vector<Digest> Path(size_t leaf, size_t snapshot) {
+    vector<Digest> path;
+    tree_.PathToRootAtSnapshot(leaf, snapshot, &path);
+    return path;
+  }
+
+  vector<Digest> Consistency(size_t snapshot1, size_t snapshot2) {
+    vector<Digest> proof;
+    tree_.SnapshotConsistency(snapshot1, snapshot2, &proof);
+    return proof;
+  }
+
+  MerkleTree tree_;
+  TreeHasher hasher_;
+  IncrementalMerkleVerifier verifier_;
+};
+
+
+TEST_F(IncrementalMerkleVerifierTest, TrustRoot) {
+  EXPECT_FALSE(verifier_.IsVerified(5, Root(5)));
+  EXPECT_TRUE(verifier_.TrustRoot(5, Root(5)));
+  EXPECT_TRUE(verifier_.IsVerified(5, Root(5)));
+  EXPECT_TRUE(verifier_.TrustRoot(5, Root(5)));
+
+  // Anything else has to be proved consistent with it.
+  EXPECT_FALSE(verifier_.TrustRoot(5, Root(6)));
+  EXPECT_FALSE(verifier_.TrustRoot(6, Root(6)));
+  EXPECT_EQ(1U, verifier_.NumVerifiedRoots());
+}
+
+
+TEST_F(IncrementalMerkleVerifierTest, ConsistencyChain) {
+  for (size_t snapshot = 1; snapshot < kNumLeaves; ++snapshot) {
+    EXPECT_TRUE(verifier_.VerifyConsistency(snapshot, snapshot + 1,
+                                            Root(snapshot),
+                                            Root(snapshot + 1),
+                                            Consistency(snapshot,
+                                                        snapshot + 1)))
+        << snapshot;
+  }
+  EXPECT_EQ(kNumLeaves, verifier_.NumVerifiedRoots());
+  EXPECT_LT(0U, verifier_.NumCachedSubtrees());
+
+  // Both ends are known, so no proof is needed.
+  EXPECT_TRUE(
+      verifier_.VerifyConsistency(3, 40, Root(3), Root(40), vector<Digest>()));
+  EXPECT_FALSE(
+      verifier_.VerifyConsistency(40, 3, Root(40), Root(3), vector<Digest>()));
+}
+
+
+TEST_F(IncrementalMerkleVerifierTest, MatchesMerkleTreeProofs) {
+  // Unlinked proofs check out, but don't seed a history that already
+  // exists.
+  ASSERT_TRUE(verifier_.TrustRoot(kNumLeaves, Root(kNumLeaves)));
+  for (size_t snapshot1 = 1; snapshot1 < 20; ++snapshot1) {
+    for (size_t snapshot2 = snapshot1; snapshot2 < 20; ++snapshot2) {
+      EXPECT_TRUE(verifier_.VerifyConsistency(snapshot1, snapshot2,
+                                              Root(snapshot1),
+                                              Root(snapshot2),
+                                              Consistency(snapshot1,
+                                                          snapshot2)))
+          << snapshot1 << " " << snapshot2;
+      EXPECT_FALSE(verifier_.VerifyConsistency(snapshot1, snapshot2 + 1,
+                                               Root(snapshot1),
+                                               Root(snapshot2),
+                                               Consistency(snapshot1,
+                                                           snapshot2 + 1)))
+          << snapshot1 << " " << snapshot2;
+    }
+  }
+  EXPECT_EQ(1U, verifier_.NumVerifiedRoots());
+
+  for (size_t snapshot = 1; snapshot < 20; ++snapshot) {
+    for (size_t leaf = 1; leaf <= snapshot; ++leaf) {
+      EXPECT_TRUE(verifier_.VerifyPath(leaf, snapshot, Path(leaf, snapshot),
+                                       Root(snapshot), LeafHash(leaf)))
+          << leaf << " " << snapshot;
+    }
+  }
+  // None of those roots are in the history.
+  EXPECT_EQ(0U, verifier_.NumCachedSubtrees());
+}
+
+
+TEST_F(IncrementalMerkleVerifierTest, ConflictingRoot) {
+  ASSERT_TRUE(verifier_.VerifyConsistency(10, 20, Root(10), Root(20),
+                                          Consistency(10, 20)));
+
+  // A valid proof for a root that isn't the one in the history.
+  EXPECT_FALSE(verifier_.VerifyConsistency(10, 20, Root(10), Root(21),
+                                           Consistency(10, 20)));
+  EXPECT_FALSE(verifier_.VerifyConsistency(20, 30, Root(21), Root(30),
+                                           Consistency(20, 30)));
+  EXPECT_EQ(2U, verifier_.NumVerifiedRoots());
+}
+
+
+TEST_F(IncrementalMerkleVerifierTest, PathsAgainstVerifiedRoot) {
+  ASSERT_TRUE(verifier_.TrustRoot(kNumLeaves, Root(kNumLeaves)));
+
+  vector<Digest> path(Path(1, kNumLeaves));
+  path.back().mutable_data()[0] ^= 1;
+  EXPECT_FALSE(verifier_.VerifyPath(1, kNumLeaves, path, Root(kNumLeaves),
+                                    LeafHash(1)));
+  EXPECT_EQ(0U, verifier_.NumCachedSubtrees());
+
+  for (size_t leaf = 1; leaf <= kNumLeaves; ++leaf) {
+    EXPECT_TRUE(verifier_.VerifyPath(leaf, kNumLeaves,
+                                     Path(leaf, kNumLeaves),
+                                     Root(kNumLeaves), LeafHash(leaf)))
+        << leaf;
+  }
+  EXPECT_LT(0U, verifier_.NumCachedSubtrees());
+
+  // Now that every subtree is cached, proofs for the wrong leaf, or of
+  // the wrong length, must still fail.
+  for (size_t leaf = 1; leaf <= kNumLeaves; ++leaf) {
+    EXPECT_FALSE(verifier_.VerifyPath(leaf, kNumLeaves,
+                                      Path(leaf, kNumLeaves),
+                                      Root(kNumLeaves),
+                                      LeafHash(leaf % kNumLeaves + 1)))
+        << leaf;
+
+    path = Path(leaf, kNumLeaves);
+    path.pop_back();
+    EXPECT_FALSE(verifier_.VerifyPath(leaf, kNumLeaves, path,
+                                      Root(kNumLeaves), LeafHash(leaf)))
+        << leaf;
+
+    path = Path(leaf, kNumLeaves);
+    path.push_back(Root(kNumLeaves));
+    EXPECT_FALSE(verifier_.VerifyPath(leaf, kNumLeaves, path,
+                                      Root(kNumLeaves), LeafHash(leaf)))
+        << leaf;
+  }
+}
+
+
+TEST_F(IncrementalMerkleVerifierTest, PathsAfterConsistency) {
+  for (size_t snapshot = 1; snapshot + 7 <= kNumLeaves; snapshot += 7) {
+    ASSERT_TRUE(verifier_.VerifyConsistency(snapshot, snapshot + 7,
+                                            Root(snapshot),
+                                            Root(snapshot + 7),
+                                            Consistency(snapshot,
+                                                        snapshot + 7)));
+  }
+
+  // Subtrees cached from the later trees apply to the earlier ones.
+  for (size_t snapshot = 1; snapshot <= kNumLeaves; snapshot += 7) {
+    for (size_t leaf = 1; leaf <= snapshot; ++leaf) {
+      EXPECT_TRUE(verifier_.VerifyPath(leaf, snapshot, Path(leaf, snapshot),
+                                       Root(snapshot), LeafHash(leaf)))
+          << leaf << " " << snapshot;
+      EXPECT_FALSE(verifier_.VerifyPath(leaf, snapshot, Path(leaf, snapshot),
+                                        Root(snapshot), LeafHash(leaf + 1)))
+          << leaf << " " << snapshot;
+    }
+  }
+}
+
+
+TEST_F(IncrementalMerkleVerifierTest, BoundedCache) {
+  IncrementalMerkleVerifier verifier(new Sha256Hasher, 5);
+  ASSERT_TRUE(verifier.TrustRoot(kNumLeaves, Root(kNumLeaves)));
+  for (size_t leaf = 1; leaf <= kNumLeaves; ++leaf) {
+    EXPECT_TRUE(verifier.VerifyPath(leaf, kNumLeaves, Path(leaf, kNumLeaves),
+                                    Root(kNumLeaves), LeafHash(leaf)))
+        << leaf;
+    EXPECT_GE(5U, verifier.NumCachedSubtrees());
+  }
+}
+
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,344 @@
+#include "merkletree/mapped_node_store.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::string;
+
+namespace cert_trans {
+
+namespace {
+
+const char kMetaMagic[8] = {'C', 'T', 'M', 'T', 'M', 'E', 'T', 'A'};
+const char kLevelMagic[8] = {'C', 'T', 'M', 'T', 'L', 'V', 'L', 'S'};
+const uint32_t kVersion = 1;
+
+// Level files are extended to hold at least this many nodes.
+const size_t kInitialCapacity = 1024;
+
+// Room reserved at the start of each level file for its header.
+const size_t kLevelHeaderSize = 64;
+
+
+struct MetaHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t node_size;
+  uint64_t leaves_processed;
+  uint64_t dirty;
+};
+
+
+struct LevelHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t node_size;
+  uint64_t node_count;
+};
+
+static_assert(sizeof(LevelHeader) <= kLevelHeaderSize,
+              "level header does not fit");
+
+
+}  // namespace
+
+
+// A file mapped read-write in its entirety.
+class MappedNodeStore::MappedFile {
+ public:
+  // Opens (or creates) |path|, making sure it is at least |min_size|
+  // bytes long. Returns nullptr if |create| is false and the file
+  // does not exist.
+  static MappedFile* Open(const string& path, size_t min_size, bool create);
+
+  ~MappedFile();
+
+  char* data() const {
+    return data_;
+  }
+
+  // The header at the start of the file.
+  template <class Header>
+  Header* header() const {
+    return reinterpret_cast<Header*>(data_);
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  // Grow or shrink the file, and remap it.
+  void Resize(size_t size);
+
+  void Sync();
+
+ private:
+  MappedFile(const string& path, int fd);
+  void Map();
+  void Unmap();
+
+  const string path_;
+  const int fd_;
+  char* data_;
+  size_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(MappedFile);
+};
+
+
+// static
+MappedNodeStore::MappedFile* MappedNodeStore::MappedFile::Open(
+    const string& path, size_t min_size, bool create) {
+  const int fd(open(path.c_str(), O_RDWR | (create ? O_CREAT : 0), 0600));
+  if (fd < 0) {
+    CHECK(!create && errno == ENOENT) << "Failed to open " << path << ": "
+                                      << strerror(errno);
+    return nullptr;
+  }
+  MappedFile* const file(new MappedFile(path, fd));
+  if (file->size_ < min_size) {
+    file->Resize(min_size);
+  } else {
+    file->Map();
+  }
+  return file;
+}
+
+
+MappedNodeStore::MappedFile::MappedFile(const string& path, int fd)
+    : path_(path), fd_(fd), data_(nullptr), size_(0) {
+  struct stat st;
+  CHECK_ERR(fstat(fd_, &st)) << "Failed to stat " << path_ << ": "
+                             << strerror(errno);
+  size_ = st.st_size;
+}
+
+
+MappedNodeStore::MappedFile::~MappedFile() {
+  Unmap();
+  CHECK_ERR(close(fd_));
+}
+
+
+void MappedNodeStore::MappedFile::Resize(size_t size) {
+  Unmap();
+  CHECK_ERR(ftruncate(fd_, size)) << "Failed to resize " << path_ << ": "
+                                  << strerror(errno);
+  size_ = size;
+  Map();
+}
+
+
+void MappedNodeStore::MappedFile::Sync() {
+  CHECK_ERR(msync(data_, size_, MS_SYNC)) << "Failed to sync " << path_
+                                          << ": " << strerror(errno);
+}
+
+
+void MappedNodeStore::MappedFile::Map() {
+  CHECK(data_ == nullptr);
+  CHECK_GT(size_, 0U);
+  void* const addr(
+      mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0));
+  CHECK(addr != MAP_FAILED) << "Failed to map " << path_ << ": "
+                            << strerror(errno);
+  data_ = static_cast<char*>(addr);
+}
+
+
+void MappedNodeStore::MappedFile::Unmap() {
+  if (data_) {
+    CHECK_ERR(munmap(data_, size_));
+    data_ = nullptr;
+  }
+}
+
+
+MappedNodeStore::MappedNodeStore(const string& dir, size_t node_size)
+    : dir_(dir), node_size_(node_size) {
+  CHECK_GT(node_size_, 0U);
+  if (mkdir(dir_.c_str(), 0700) != 0) {
+    CHECK_EQ(EEXIST, errno) << "Failed to create " << dir_ << ": "
+                            << strerror(errno);
+  }
+
+  meta_.reset(MappedFile::Open(dir_ + "/meta", sizeof(MetaHeader), true));
+  MetaHeader* const meta(meta_->header<MetaHeader>());
+  if (meta->version == 0) {
+    // Freshly created.
+    memcpy(meta->magic, kMetaMagic, sizeof(meta->magic));
+    meta->version = kVersion;
+    meta->node_size = node_size_;
+    meta->leaves_processed = 0;
+    meta->dirty = 0;
+  }
+  CHECK_EQ(0, memcmp(meta->magic, kMetaMagic, sizeof(meta->magic)))
+      << dir_ << " is not a node store";
+  CHECK_EQ(kVersion, meta->version);
+  CHECK_EQ(node_size_, meta->node_size);
+
+  // Levels are numbered consecutively, the first missing file marks
+  // the top of the tree.
+  do {
+    OpenLevel(levels_.size(), false);
+  } while (levels_.size() > 0 && levels_.back() != nullptr);
+  levels_.pop_back();
+}
+
+
+MappedNodeStore::~MappedNodeStore() {
+}
+
+
+void MappedNodeStore::AddLevel() {
+  OpenLevel(levels_.size(), true);
+}
+
+
+void MappedNodeStore::RemoveLevel() {
+  CHECK(!levels_.empty());
+  CHECK_EQ(0U, NodeCount(levels_.size() - 1));
+  const string path(LevelPath(levels_.size() - 1));
+  levels_.pop_back();
+  CHECK_ERR(unlink(path.c_str())) << "Failed to remove " << path << ": "
+                                  << strerror(errno);
+}
+
+
+size_t MappedNodeStore::NodeCount(size_t level) const {
+  CHECK_GT(levels_.size(), level);
+  return levels_[level]->header<LevelHeader>()->node_count;
+}
+
+
+string MappedNodeStore::Node(size_t level, size_t index) const {
+  CHECK_GT(NodeCount(level), index);
+  return string(slot(level, index), node_size_);
+}
+
+
+void MappedNodeStore::CopyNode(size_t level, size_t index, char* out) const {
+  CHECK_GT(NodeCount(level), index);
+  memcpy(out, slot(level, index), node_size_);
+}
+
+
+string MappedNodeStore::Nodes(size_t level, size_t begin, size_t end) const {
+  CHECK_LE(begin, end);
+  CHECK_GE(NodeCount(level), end);
+  return string(slot(level, begin), (end - begin) * node_size_);
+}
+
+
+void MappedNodeStore::PushBack(size_t level, const string& node) {
+  CHECK_EQ(node.size(), node_size_);
+  PushBackNodes(level, node);
+}
+
+
+void MappedNodeStore::PushBackNodes(size_t level, const string& nodes) {
+  CHECK_EQ(0U, nodes.size() % node_size_);
+  const size_t count(NodeCount(level));
+  const size_t new_count(count + nodes.size() / node_size_);
+  MappedFile* const file(levels_[level].get());
+  if (kLevelHeaderSize + new_count * node_size_ > file->size()) {
+    file->Resize(kLevelHeaderSize +
+                 std::max(kInitialCapacity, std::max(2 * count, new_count)) *
+                     node_size_);
+  }
+  // Write the nodes before making them visible.
+  memcpy(slot(level, count), nodes.data(), nodes.size());
+  levels_[level]->header<LevelHeader>()->node_count = new_count;
+}
+
+
+void MappedNodeStore::PopBack(size_t level) {
+  CHECK_GE(NodeCount(level), 1U);
+  --levels_[level]->header<LevelHeader>()->node_count;
+}
+
+
+void MappedNodeStore::TruncateLevel(size_t level, size_t count) {
+  CHECK_GE(NodeCount(level), count);
+  levels_[level]->header<LevelHeader>()->node_count = count;
+}
+
+
+size_t MappedNodeStore::LeavesProcessed() const {
+  return meta_->header<MetaHeader>()->leaves_processed;
+}
+
+
+bool MappedNodeStore::Dirty() const {
+  return meta_->header<MetaHeader>()->dirty != 0;
+}
+
+
+void MappedNodeStore::BeginUpdate() {
+  meta_->header<MetaHeader>()->dirty = 1;
+}
+
+
+void MappedNodeStore::CommitUpdate(size_t leaves_processed) {
+  MetaHeader* const meta(meta_->header<MetaHeader>());
+  meta->leaves_processed = leaves_processed;
+  meta->dirty = 0;
+}
+
+
+void MappedNodeStore::Sync() {
+  for (const auto& level : levels_) {
+    level->Sync();
+  }
+  meta_->Sync();
+}
+
+
+string MappedNodeStore::LevelPath(size_t level) const {
+  char name[16];
+  snprintf(name, sizeof(name), "level-%02zu", level);
+  return dir_ + "/" + name;
+}
+
+
+// Appends the level to |levels_|. If |create| is false and the level
+// does not exist, appends nullptr instead.
+void MappedNodeStore::OpenLevel(size_t level, bool create) {
+  CHECK_EQ(levels_.size(), level);
+  levels_.emplace_back(MappedFile::Open(
+      LevelPath(level), kLevelHeaderSize + kInitialCapacity * node_size_,
+      create));
+  if (!levels_.back()) {
+    return;
+  }
+
+  LevelHeader* const header(levels_.back()->header<LevelHeader>());
+  if (create) {
+    memcpy(header->magic, kLevelMagic, sizeof(header->magic));
+    header->version = kVersion;
+    header->node_size = node_size_;
+    header->node_count = 0;
+  }
+  CHECK_EQ(0, memcmp(header->magic, kLevelMagic, sizeof(header->magic)))
+      << LevelPath(level) << " is not a node store level";
+  CHECK_EQ(kVersion, header->version);
+  CHECK_EQ(node_size_, header->node_size);
+  CHECK_LE(kLevelHeaderSize + header->node_count * node_size_,
+           levels_.back()->size());
+}
+
+
+char* MappedNodeStore::slot(size_t level, size_t index) const {
+  return levels_[level]->data() + kLevelHeaderSize + index * node_size_;
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,88 @@
+#ifndef CERT_TRANS_MERKLETREE_MAPPED_NODE_STORE_H_
+#define CERT_TRANS_MERKLETREE_MAPPED_NODE_STORE_H_
+
+#include <memory>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "merkletree/node_store.h"
+
+namespace cert_trans {
+
+// A NodeStore whose levels live in memory-mapped files, so that a
+// MerkleTree can be reopened after a restart without rehashing its
+// leaves. The store is laid out as follows:
+//
+// <dir>/meta      - Node size, leaves processed and the dirty flag.
+// <dir>/level-NN  - One file per level NN (starting at 00 for the
+//                   leaves): a small header holding the node count,
+//                   followed by fixed-size node slots. Files grow by
+//                   doubling and are sparse beyond the last node.
+//
+// Modifications are written straight into the shared mappings, so
+// they survive the process going away at any point (an interrupted
+// tree update is reported with Dirty()). Call Sync() to also make
+// them durable against a system crash.
+//
+// This class is thread-compatible, but not thread-safe.
+class MappedNodeStore : public NodeStore {
+ public:
+  // Opens the store in |dir|, creating the directory and an empty
+  // store if necessary. Aborts if an existing store was created with
+  // a different |node_size|.
+  MappedNodeStore(const std::string& dir, size_t node_size);
+  ~MappedNodeStore() override;
+
+  size_t NodeSize() const override {
+    return node_size_;
+  }
+
+  size_t LevelCount() const override {
+    return levels_.size();
+  }
+
+  void AddLevel() override;
+  void RemoveLevel() override;
+  size_t NodeCount(size_t level) const override;
+  std::string Node(size_t level, size_t index) const override;
+  void CopyNode(size_t level, size_t index, char* out) const override;
+  std::string Nodes(size_t level, size_t begin, size_t end) const override;
+  void PushBack(size_t level, const std::string& node) override;
+  void PushBackNodes(size_t level, const std::string& nodes) override;
+  void PopBack(size_t level) override;
+  void TruncateLevel(size_t level, size_t count) override;
+  size_t LeavesProcessed() const override;
+  bool Dirty() const override;
+  void BeginUpdate() override;
+  void CommitUpdate(size_t leaves_processed) override;
+
+  // The levels are mapped files, paged in and out by the kernel, so
+  // they don't count.
+  size_t MemoryBytes() const override {
+    return 0;
+  }
+
+  // Flush all levels, then the metadata, to disk.
+  void Sync();
+
+ private:
+  class MappedFile;
+
+  std::string LevelPath(size_t level) const;
+  void OpenLevel(size_t level, bool create);
+  char* slot(size_t level, size_t index) const;
+
+  const std::string dir_;
+  const size_t node_size_;
+  std::unique_ptr<MappedFile> meta_;
+  std::vector<std::unique_ptr<MappedFile>> levels_;
+
+  DISALLOW_COPY_AND_ASSIGN(MappedNodeStore);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_MERKLETREE_MAPPED_NODE_STORE_H_
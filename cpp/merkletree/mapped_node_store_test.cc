@@ -0,0 +1,155 @@
+#include "merkletree/mapped_node_store.h"
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+
+#include "merkletree/merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "util/test_db.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::unique_ptr;
+
+const size_t kNodeSize = 32;
+
+
+class MappedNodeStoreTest : public ::testing::Test {
+ protected:
+  MappedNodeStoreTest() : dir_(tmp_.TmpStorageDir() + "/tree") {
+  }
+
+  MerkleTree* OpenTree() {
+    return new MerkleTree(new Sha256Hasher, OpenStore());
+  }
+
+  MappedNodeStore* OpenStore() {
+    return new MappedNodeStore(dir_, kNodeSize);
+  }
+
+  static string Leaf(size_t i) {
+    return "leaf " + std::to_string(i);
+  }
+
+  TmpStorage tmp_;
+  const string dir_;
+};
+
+
+TEST_F(MappedNodeStoreTest, StoresNodes) {
+  unique_ptr<MappedNodeStore> store(OpenStore());
+  EXPECT_EQ(0U, store->LevelCount());
+  EXPECT_EQ(0U, store->LeavesProcessed());
+  EXPECT_FALSE(store->Dirty());
+
+  store->AddLevel();
+  // Enough nodes to force the level file to grow a few times.
+  for (size_t i = 0; i < 5000; ++i) {
+    store->PushBack(0, Sha256Hasher::Sha256Digest(Leaf(i)));
+  }
+  store->PopBack(0);
+  store->BeginUpdate();
+  store->CommitUpdate(17);
+  store->Sync();
+  store.reset();
+
+  store.reset(OpenStore());
+  EXPECT_EQ(1U, store->LevelCount());
+  EXPECT_EQ(4999U, store->NodeCount(0));
+  EXPECT_EQ(17U, store->LeavesProcessed());
+  EXPECT_FALSE(store->Dirty());
+  EXPECT_EQ(Sha256Hasher::Sha256Digest(Leaf(1234)), store->Node(0, 1234));
+  EXPECT_EQ(store->Node(0, 10) + store->Node(0, 11), store->Nodes(0, 10, 12));
+
+  // Growing by more than double in one go.
+  store->AddLevel();
+  store->PushBackNodes(1, store->Nodes(0, 0, 3000));
+  EXPECT_EQ(3000U, store->NodeCount(1));
+  EXPECT_EQ(store->Node(0, 2999), store->Node(1, 2999));
+  store->TruncateLevel(1, 0);
+  store->RemoveLevel();
+
+  store->TruncateLevel(0, 0);
+  store->RemoveLevel();
+  EXPECT_EQ(0U, store->LevelCount());
+  store.reset(OpenStore());
+  EXPECT_EQ(0U, store->LevelCount());
+}
+
+
+TEST_F(MappedNodeStoreTest, MatchesMemoryTree) {
+  MerkleTree memory_tree(new Sha256Hasher);
+  unique_ptr<MerkleTree> mapped_tree(OpenTree());
+
+  for (size_t i = 0; i < 300; ++i) {
+    memory_tree.AddLeaf(Leaf(i));
+    mapped_tree->AddLeaf(Leaf(i));
+    if (i % 7 == 0) {
+      EXPECT_EQ(memory_tree.CurrentRoot(), mapped_tree->CurrentRoot());
+    }
+  }
+  EXPECT_EQ(memory_tree.CurrentRoot(), mapped_tree->CurrentRoot());
+  EXPECT_EQ(memory_tree.RootAtSnapshot(123),
+            mapped_tree->RootAtSnapshot(123));
+  EXPECT_EQ(memory_tree.PathToRootAtSnapshot(45, 250),
+            mapped_tree->PathToRootAtSnapshot(45, 250));
+  EXPECT_EQ(memory_tree.SnapshotConsistency(77, 300),
+            mapped_tree->SnapshotConsistency(77, 300));
+}
+
+
+TEST_F(MappedNodeStoreTest, Reopens) {
+  MerkleTree memory_tree(new Sha256Hasher);
+  for (size_t tree_size = 0; tree_size < 70; ++tree_size) {
+    unique_ptr<MerkleTree> mapped_tree(OpenTree());
+    ASSERT_EQ(tree_size, mapped_tree->LeafCount());
+    EXPECT_EQ(memory_tree.LevelCount(), mapped_tree->LevelCount());
+    EXPECT_EQ(memory_tree.CurrentRoot(), mapped_tree->CurrentRoot());
+
+    memory_tree.AddLeaf(Leaf(tree_size));
+    mapped_tree->AddLeaf(Leaf(tree_size));
+    // Leave every other tree lazily evaluated when closing it.
+    if (tree_size % 2 == 0) {
+      EXPECT_EQ(memory_tree.CurrentRoot(), mapped_tree->CurrentRoot());
+    }
+  }
+}
+
+
+TEST_F(MappedNodeStoreTest, RecoversFromInterruptedUpdate) {
+  MerkleTree memory_tree(new Sha256Hasher);
+  {
+    unique_ptr<MerkleTree> mapped_tree(OpenTree());
+    for (size_t i = 0; i < 100; ++i) {
+      memory_tree.AddLeaf(Leaf(i));
+      mapped_tree->AddLeaf(Leaf(i));
+    }
+    mapped_tree->CurrentRoot();
+  }
+  {
+    // Pretend an update died half-way through.
+    unique_ptr<MappedNodeStore> store(OpenStore());
+    store->BeginUpdate();
+    store->PopBack(store->LevelCount() - 1);
+  }
+
+  unique_ptr<MerkleTree> mapped_tree(OpenTree());
+  EXPECT_EQ(100U, mapped_tree->LeafCount());
+  EXPECT_EQ(memory_tree.CurrentRoot(), mapped_tree->CurrentRoot());
+  EXPECT_EQ(memory_tree.PathToCurrentRoot(33),
+            mapped_tree->PathToCurrentRoot(33));
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
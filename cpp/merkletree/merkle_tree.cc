@@ -7,30 +7,104 @@
 
 #include "merkletree/merkle_tree_math.h"
 
+using cert_trans::Digest;
+using cert_trans::MemoryNodeStore;
 using cert_trans::MerkleTreeInterface;
+using cert_trans::NodeStore;
 using std::string;
 
-MerkleTree::MerkleTree(SerialHasher* hasher)
+MerkleTree::MerkleTree(SerialHasher* hasher) : MerkleTree(hasher, 1) {
+}
+
+MerkleTree::MerkleTree(SerialHasher* hasher, NodeStore* store)
+    : MerkleTree(hasher, store, 1) {
+}
+
+MerkleTree::MerkleTree(SerialHasher* hasher, size_t snapshot_cache_size)
+    : MerkleTree(hasher, new MemoryNodeStore(hasher->DigestSize()),
+                 snapshot_cache_size) {
+}
+
+MerkleTree::MerkleTree(SerialHasher* hasher, NodeStore* store,
+                       size_t snapshot_cache_size)
     : MerkleTreeInterface(),
+      store_(CHECK_NOTNULL(store)),
       treehasher_(hasher),
       leaves_processed_(0),
-      level_count_(0) {
+      level_count_(0),
+      snapshot_cache_size_(snapshot_cache_size),
+      snapshot_cache_hits_(0),
+      snapshot_cache_misses_(0) {
+  CHECK_EQ(store_->NodeSize(), treehasher_.DigestSize());
+  LoadFromStore();
 }
 
 MerkleTree::~MerkleTree() {
 }
 
+void MerkleTree::LoadFromStore() {
+  const size_t leaf_count(LeafCount());
+  if (leaf_count > 0) {
+    level_count_ = 1;
+    while ((static_cast<size_t>(1) << (level_count_ - 1)) < leaf_count)
+      ++level_count_;
+  }
+
+  leaves_processed_ = store_->LeavesProcessed();
+  if (!store_->Dirty() && leaves_processed_ <= leaf_count) {
+    // Check that the inner levels have exactly the shape expected
+    // after processing |leaves_processed_| leaves.
+    size_t expected_levels(0);
+    bool consistent(true);
+    for (size_t level = 1; consistent && leaves_processed_ > 0; ++level) {
+      const size_t last_node((leaves_processed_ - 1) >> (level - 1));
+      if (last_node == 0) {
+        expected_levels = level;
+        break;
+      }
+      consistent = level < LazyLevelCount() &&
+                   NodeCount(level) == MerkleTreeMath::Parent(last_node) + 1;
+    }
+    if (consistent && LazyLevelCount() == expected_levels)
+      return;
+  }
+
+  // The inner nodes are stale or half-written: keep the leaves, and
+  // recompute everything else lazily.
+  LOG(WARNING) << "Discarding inner nodes of a tree with " << leaf_count
+               << " leaves";
+  store_->BeginUpdate();
+  while (LazyLevelCount() > 1 || (LazyLevelCount() == 1 && leaf_count == 0)) {
+    store_->TruncateLevel(LazyLevelCount() - 1, 0);
+    store_->RemoveLevel();
+  }
+  leaves_processed_ = leaf_count > 0 ? 1 : 0;
+  store_->CommitUpdate(leaves_processed_);
+}
+
 size_t MerkleTree::AddLeaf(const string& data) {
   return AddLeafHash(treehasher_.HashLeaf(data));
 }
 
+size_t MerkleTree::AddLeaves(const std::vector<string>& data,
+                             util::Executor* executor) {
+  for (const auto& hash : treehasher_.HashLeaves(data, executor)) {
+    AddLeafHash(hash);
+  }
+  return LeafCount();
+}
+
 size_t MerkleTree::AddLeafHash(const string& hash) {
   if (LazyLevelCount() == 0) {
+    store_->BeginUpdate();
     AddLevel();
+    PushBack(0, hash);
     // The first leaf hash is also the first root.
     leaves_processed_ = 1;
+    store_->CommitUpdate(leaves_processed_);
+  } else {
+    PushBack(0, hash);
   }
-  PushBack(0, hash);
   size_t leaf_count = LeafCount();
   // Update level count: a k-level tree can hold 2^{k-1} leaves,
   // so increment level count every time we overflow a power of two.
@@ -45,6 +119,10 @@ string MerkleTree::CurrentRoot() {
   return RootAtSnapshot(LeafCount());
 }
 
+string MerkleTree::UpdateRoot(util::Executor* executor) {
+  return UpdateToSnapshot(LeafCount(), executor);
+}
+
 string MerkleTree::RootAtSnapshot(size_t snapshot) {
   if (snapshot == 0)
     return treehasher_.HashEmpty();
@@ -52,7 +130,7 @@ string MerkleTree::RootAtSnapshot(size_t snapshot) {
   if (snapshot > leaf_count)
     return string();
   if (snapshot >= leaves_processed_)
-    return UpdateToSnapshot(snapshot);
+    return UpdateToSnapshot(snapshot, nullptr);
   // snapshot < leaves_processed_: recompute the snapshot root.
   return RecomputePastSnapshot(snapshot, 0, NULL);
 }
@@ -61,21 +139,53 @@ std::vector<string> MerkleTree::PathToCurrentRoot(size_t leaf) {
   return PathToRootAtSnapshot(leaf, LeafCount());
 }
 
+void MerkleTree::PathToCurrentRoot(size_t leaf, std::vector<Digest>* path) {
+  PathToRootAtSnapshot(leaf, LeafCount(), path);
+}
+
 std::vector<string> MerkleTree::PathToRootAtSnapshot(size_t leaf,
                                                      size_t snapshot) {
   std::vector<string> path;
+  PathToRootAtSnapshot(leaf, snapshot, &path);
+  return path;
+}
+
+void MerkleTree::PathToRootAtSnapshot(size_t leaf, size_t snapshot,
+                                      std::vector<Digest>* path) {
+  CHECK_EQ(Digest::kSize, NodeSize());
+  PathToRootAtSnapshot<Digest>(leaf, snapshot, path);
+}
+
+template <class NodeType>
+void MerkleTree::PathToRootAtSnapshot(size_t leaf, size_t snapshot,
+                                      std::vector<NodeType>* path) {
+  path->clear();
   size_t leaf_count = LeafCount();
   if (leaf > snapshot || snapshot > leaf_count || leaf == 0)
-    return path;
-  return PathFromNodeToRootAtSnapshot(leaf - 1, 0, snapshot);
+    return;
+  PathFromNodeToRootAtSnapshot(leaf - 1, 0, snapshot, path);
 }
 
 std::vector<string> MerkleTree::SnapshotConsistency(size_t snapshot1,
                                                     size_t snapshot2) {
   std::vector<string> proof;
+  SnapshotConsistency(snapshot1, snapshot2, &proof);
+  return proof;
+}
+
+void MerkleTree::SnapshotConsistency(size_t snapshot1, size_t snapshot2,
+                                     std::vector<Digest>* proof) {
+  CHECK_EQ(Digest::kSize, NodeSize());
+  SnapshotConsistency<Digest>(snapshot1, snapshot2, proof);
+}
+
+template <class NodeType>
+void MerkleTree::SnapshotConsistency(size_t snapshot1, size_t snapshot2,
+                                     std::vector<NodeType>* proof) {
+  proof->clear();
   size_t leaf_count = LeafCount();
   if (snapshot1 == 0 || snapshot1 >= snapshot2 || snapshot2 > leaf_count)
-    return proof;
+    return;
 
   size_t level = 0;
   // Rightmost node in snapshot1.
@@ -89,21 +199,21 @@ std::vector<string> MerkleTree::SnapshotConsistency(size_t snapshot1,
 
   if (snapshot2 > leaves_processed_) {
     // Bring the tree sufficiently up to date.
-    UpdateToSnapshot(snapshot2);
+    UpdateToSnapshot(snapshot2, nullptr);
   }
 
   // Record the node, unless we already reached the root of snapshot1.
-  if (node)
-    proof.push_back(Node(level, node));
+  if (node) {
+    proof->emplace_back();
+    CopyNode(level, node, &proof->back());
+  }
 
   // Now record the path from this node to the root of snapshot2.
-  std::vector<string> path =
-      PathFromNodeToRootAtSnapshot(node, level, snapshot2);
-  proof.insert(proof.end(), path.begin(), path.end());
-  return proof;
+  PathFromNodeToRootAtSnapshot(node, level, snapshot2, proof);
 }
 
-string MerkleTree::UpdateToSnapshot(size_t snapshot) {
+string MerkleTree::UpdateToSnapshot(size_t snapshot,
+                                    util::Executor* executor) {
   if (snapshot == 0)
     return treehasher_.HashEmpty();
   if (snapshot == 1)
@@ -112,6 +222,7 @@ string MerkleTree::UpdateToSnapshot(size_t snapshot) {
     return Root();
   CHECK_LE(snapshot, LeafCount());
   CHECK_GT(snapshot, leaves_processed_);
+  store_->BeginUpdate();
 
   // Update tree, moving up level-by-level.
   size_t level = 0;
@@ -132,11 +243,15 @@ string MerkleTree::UpdateToSnapshot(size_t snapshot) {
       PopBack(level + 1);
     }
 
-    // Compute the parents of new nodes at the current level.
-    // Start with a left sibling and parse an even number of nodes.
-    for (size_t j = first_node & ~1; j < last_node; j += 2) {
-      PushBack(level + 1,
-               treehasher_.HashChildren(Node(level, j), Node(level, j + 1)));
+    // Compute the parents of new nodes at the current level, all at
+    // once. Start with a left sibling and parse an even number of nodes.
+    const size_t first_left(first_node & ~1);
+    const size_t end(last_node & 1 ? last_node + 1 : last_node);
+    if (first_left < end) {
+      store_->PushBackNodes(level + 1,
+                            treehasher_.HashChildrenBatch(
+                                store_->Nodes(level, first_left, end),
+                                executor));
     }
     // If the last node at the current level is a left sibling,
     // dummy-propagate it one level up.
@@ -149,12 +264,12 @@ string MerkleTree::UpdateToSnapshot(size_t snapshot) {
   };
 
   leaves_processed_ = snapshot;
+  store_->CommitUpdate(leaves_processed_);
   return Root();
 }
 
 string MerkleTree::RecomputePastSnapshot(size_t snapshot, size_t node_level,
                                          string* node) {
-  size_t level = 0;
   // Index of the rightmost node at the current level for this snapshot.
   size_t last_node = snapshot - 1;
 
@@ -173,12 +288,32 @@ string MerkleTree::RecomputePastSnapshot(size_t snapshot, size_t node_level,
 
   CHECK_LT(snapshot, leaves_processed_);
 
+  const std::vector<string>& edge(RightEdgeAtSnapshot(snapshot));
+  if (node && node_level < edge.size())
+    node->assign(edge[node_level]);
+  return edge.back();
+}
+
+const std::vector<string>& MerkleTree::RightEdgeAtSnapshot(size_t snapshot) {
+  const auto cached(snapshot_cache_index_.find(snapshot));
+  if (cached != snapshot_cache_index_.end()) {
+    ++snapshot_cache_hits_;
+    snapshot_cache_.splice(snapshot_cache_.begin(), snapshot_cache_,
+                           cached->second);
+    return cached->second->second;
+  }
+  ++snapshot_cache_misses_;
+
+  std::vector<string> edge;
+  size_t level = 0;
+  // Index of the rightmost node at the current level for this snapshot.
+  size_t last_node = snapshot - 1;
+
   // Recompute nodes on the path of the last leaf.
   while (MerkleTreeMath::IsRightChild(last_node)) {
-    if (node && node_level == level)
-      node->assign(Node(level, last_node));
     // Left sibling and parent exist in the snapshot, and are equal to
     // those in the tree; no need to rehash, move one level up.
+    edge.push_back(Node(level, last_node));
     last_node = MerkleTreeMath::Parent(last_node);
     ++level;
   }
@@ -186,9 +321,7 @@ string MerkleTree::RecomputePastSnapshot(size_t snapshot, size_t node_level,
   // Now last_node is the index of a left sibling with no right sibling.
   // Record the node.
   string subtree_root = Node(level, last_node);
-
-  if (node && node_level == level)
-    node->assign(subtree_root);
+  edge.push_back(subtree_root);
 
   while (last_node) {
     if (MerkleTreeMath::IsRightChild(last_node)) {
@@ -200,27 +333,34 @@ string MerkleTree::RecomputePastSnapshot(size_t snapshot, size_t node_level,
 
     last_node = MerkleTreeMath::Parent(last_node);
     ++level;
-    if (node && node_level == level)
-      node->assign(subtree_root);
+    edge.push_back(subtree_root);
   }
 
-  return subtree_root;
+  snapshot_cache_.emplace_front(snapshot, std::move(edge));
+  snapshot_cache_index_[snapshot] = snapshot_cache_.begin();
+  // Always keep the entry we are about to return.
+  while (snapshot_cache_.size() > 1 &&
+         snapshot_cache_.size() > snapshot_cache_size_) {
+    snapshot_cache_index_.erase(snapshot_cache_.back().first);
+    snapshot_cache_.pop_back();
+  }
+  return snapshot_cache_.front().second;
 }
 
-std::vector<string> MerkleTree::PathFromNodeToRootAtSnapshot(size_t node,
-                                                             size_t level,
-                                                             size_t snapshot) {
-  std::vector<string> path;
+template <class NodeType>
+void MerkleTree::PathFromNodeToRootAtSnapshot(size_t node, size_t level,
+                                              size_t snapshot,
+                                              std::vector<NodeType>* path) {
   if (snapshot == 0)
-    return path;
+    return;
   // Index of the last node.
   size_t last_node = (snapshot - 1) >> level;
   if (level >= level_count_ || node > last_node || snapshot > LeafCount())
-    return path;
+    return;
 
   if (snapshot > leaves_processed_) {
     // Bring the tree sufficiently up to date.
-    UpdateToSnapshot(snapshot);
+    UpdateToSnapshot(snapshot, nullptr);
   }
 
   // Move up, recording the sibling of the current node at each level.
@@ -229,13 +369,14 @@ std::vector<string> MerkleTree::PathFromNodeToRootAtSnapshot(size_t node,
     if (sibling < last_node) {
       // The sibling is not the last node of the level in the snapshot
       // tree, so its value is correct in the tree.
-      path.push_back(Node(level, sibling));
+      path->emplace_back();
+      CopyNode(level, sibling, &path->back());
     } else if (sibling == last_node) {
       // The sibling is the last node of the level in the snapshot tree,
       // so we get its value for the snapshot. Get the root in the same pass.
       string recompute_node;
       RecomputePastSnapshot(snapshot, level, &recompute_node);
-      path.push_back(recompute_node);
+      path->emplace_back(recompute_node);
     }
     // Else sibling > last_node so the sibling does not exist. Do nothing.
     // Continue moving up in the tree, ignoring dummy copies.
@@ -244,46 +385,49 @@ std::vector<string> MerkleTree::PathFromNodeToRootAtSnapshot(size_t node,
     last_node = MerkleTreeMath::Parent(last_node);
     ++level;
   };
-
-  return path;
 }
 
 string MerkleTree::Node(size_t level, size_t index) const {
-  CHECK_GT(NodeCount(level), index);
-  return tree_[level].substr(index * treehasher_.DigestSize(),
-                             treehasher_.DigestSize());
+  return store_->Node(level, index);
+}
+
+void MerkleTree::CopyNode(size_t level, size_t index, string* node) const {
+  *node = store_->Node(level, index);
+}
+
+void MerkleTree::CopyNode(size_t level, size_t index, Digest* node) const {
+  store_->CopyNode(level, index, node->mutable_data());
 }
 
 string MerkleTree::Root() const {
-  CHECK_EQ(tree_.back().size(), treehasher_.DigestSize());
-  return tree_.back();
+  CHECK_EQ(NodeCount(LazyLevelCount() - 1), 1U);
+  return Node(LazyLevelCount() - 1, 0);
 }
 
 size_t MerkleTree::NodeCount(size_t level) const {
   CHECK_GT(LazyLevelCount(), level);
-  return tree_[level].size() / treehasher_.DigestSize();
+  return store_->NodeCount(level);
 }
 
 string MerkleTree::LastNode(size_t level) const {
   CHECK_GE(NodeCount(level), 1U);
-  return tree_[level].substr(tree_[level].size() - treehasher_.DigestSize());
+  return Node(level, NodeCount(level) - 1);
 }
 
 void MerkleTree::PopBack(size_t level) {
-  CHECK_GE(NodeCount(level), 1U);
-  tree_[level].erase(tree_[level].size() - treehasher_.DigestSize());
+  store_->PopBack(level);
 }
 
 void MerkleTree::PushBack(size_t level, string node) {
   CHECK_EQ(node.size(), treehasher_.DigestSize());
   CHECK_GT(LazyLevelCount(), level);
-  tree_[level].append(node);
+  store_->PushBack(level, node);
 }
 
 void MerkleTree::AddLevel() {
-  tree_.push_back(string());
+  store_->AddLevel();
 }
 
 size_t MerkleTree::LazyLevelCount() const {
-  return tree_.size();
+  return store_->LevelCount();
 }
@@ -2,11 +2,16 @@
 #ifndef MERKLETREE_H
 #define MERKLETREE_H
 
+#include <list>
+#include <memory>
 #include <stddef.h>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "merkletree/digest.h"
 #include "merkletree/merkle_tree_interface.h"
+#include "merkletree/node_store.h"
 #include "merkletree/tree_hasher.h"
 
 class SerialHasher;
@@ -25,7 +30,18 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   // The constructor takes a pointer to some concrete hash function
   // instantiation of the SerialHasher abstract class.
   // Takes ownership of the hasher.
+  // The nodes are kept in memory.
   explicit MerkleTree(SerialHasher* hasher);
+  // As above, but keeps the nodes in |store|, which may already hold
+  // a tree built with the same hash function (for example, a
+  // persistent store being reopened). Takes ownership of |store|.
+  MerkleTree(SerialHasher* hasher, cert_trans::NodeStore* store);
+  // As the above, but keeps the right edges of the last
+  // |snapshot_cache_size| past snapshots asked for, rather than only
+  // the last one, to answer repeated proof requests without rehashing.
+  MerkleTree(SerialHasher* hasher, size_t snapshot_cache_size);
+  MerkleTree(SerialHasher* hasher, cert_trans::NodeStore* store,
+             size_t snapshot_cache_size);
   virtual ~MerkleTree();
 
   // Length of a node (i.e., a hash), in bytes.
@@ -33,9 +49,24 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
     return treehasher_.DigestSize();
   };
 
+  // An estimate of the heap memory used by the nodes, in bytes.
+  size_t MemoryBytes() const {
+    return store_->MemoryBytes();
+  }
+
+  // Number of past snapshots whose right edge was found in the cache,
+  // and had to be recomputed, respectively.
+  size_t SnapshotCacheHits() const {
+    return snapshot_cache_hits_;
+  }
+
+  size_t SnapshotCacheMisses() const {
+    return snapshot_cache_misses_;
+  }
+
   // Number of leaves in the tree.
   virtual size_t LeafCount() const {
-    return tree_.empty() ? 0 : NodeCount(0);
+    return LazyLevelCount() == 0 ? 0 : NodeCount(0);
   }
 
   // The |leaf|th leaf hash in the tree. Indexing starts from 1.
@@ -68,6 +99,17 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   // @param data Binary input blob
   virtual size_t AddLeaf(const std::string& data);
 
+  // Add new leaves to the hash tree, in order. The leaves are hashed
+  // in parallel on |executor| (see TreeHasher::HashLeaves()), then
+  // appended as if by AddLeafHash().
+  //
+  // Returns the position of the last leaf in the tree, i.e., the
+  // number of leaves in the tree after this update.
+  //
+  // @param data Binary input blobs
+  size_t AddLeaves(const std::vector<std::string>& data,
+                   util::Executor* executor);
+
   // Add a new leaf to the hash tree. Stores the provided hash in the
   // tree structure.  It is the caller's responsibility to ensure that
   // the hash is correct.
@@ -88,6 +130,12 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   // (and hence, no root).
   virtual std::string CurrentRoot();
 
+  // As CurrentRoot(), but the new nodes of each level are hashed in
+  // parallel on |executor| (see TreeHasher::HashChildrenBatch()), one
+  // level at a time. Worth it after adding many leaves at once, e.g.
+  // when catching up with a log.
+  std::string UpdateRoot(util::Executor* executor);
+
   // Get the root of the tree for a previous snapshot,
   // where snapshot 0 is an empty tree, snapshot 1 is the tree with
   // 1 leaf, etc.
@@ -109,6 +157,11 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   // @param leaf the index of the leaf the path is for.
   std::vector<std::string> PathToCurrentRoot(size_t leaf);
 
+  // As above, but fill in |path| with fixed-size digests, without
+  // allocating beyond what |path| needs to grow. Requires a hasher with
+  // Digest::kSize byte digests.
+  void PathToCurrentRoot(size_t leaf, std::vector<cert_trans::Digest>* path);
+
   // Get the Merkle path from leaf to the root of a previous snapshot.
   //
   // Returns a vector of node hashes, ordered by levels from leaf to
@@ -121,6 +174,10 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   // @param snapshot point in time (= number of leaves at that point)
   std::vector<std::string> PathToRootAtSnapshot(size_t leaf, size_t snapshot);
 
+  // As above, but fill in |path| with fixed-size digests.
+  void PathToRootAtSnapshot(size_t leaf, size_t snapshot,
+                            std::vector<cert_trans::Digest>* path);
+
   // Get the Merkle consistency proof between two snapshots.
   // Returns a vector of node hashes, ordered according to levels.
   // Returns an empty vector if snapshot1 is 0, snapshot 1 >= snapshot2,
@@ -131,22 +188,44 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   std::vector<std::string> SnapshotConsistency(size_t snapshot1,
                                                size_t snapshot2);
 
+  // As above, but fill in |proof| with fixed-size digests.
+  void SnapshotConsistency(size_t snapshot1, size_t snapshot2,
+                           std::vector<cert_trans::Digest>* proof);
+
  private:
-  // Update to a given snapshot, return the root.
-  std::string UpdateToSnapshot(size_t snapshot);
+  // Pick up the state of a non-empty |store_|, discarding the inner
+  // nodes if they cannot be trusted.
+  void LoadFromStore();
+  // Update to a given snapshot, return the root. |executor| may be
+  // NULL.
+  std::string UpdateToSnapshot(size_t snapshot, util::Executor* executor);
   // Return the root of a past snapshot.
   // If node is not NULL, additionally record the rightmost node
   // for the given snapshot and node_level.
   std::string RecomputePastSnapshot(size_t snapshot, size_t node_level,
                                     std::string* node);
-  // Path from a node at a given level (both indexed starting with 0)
-  // to the root at a given snapshot.
-  std::vector<std::string> PathFromNodeToRootAtSnapshot(size_t node_index,
-                                                        size_t level,
-                                                        size_t snapshot);
+  // The rightmost node at each level of a past snapshot, from the last
+  // leaf up to the root, served from |snapshot_cache_| if possible.
+  const std::vector<std::string>& RightEdgeAtSnapshot(size_t snapshot);
+  // The proof functions are implemented once for both std::string
+  // and cert_trans::Digest nodes.
+  template <class NodeType>
+  void PathToRootAtSnapshot(size_t leaf, size_t snapshot,
+                            std::vector<NodeType>* path);
+  template <class NodeType>
+  void SnapshotConsistency(size_t snapshot1, size_t snapshot2,
+                           std::vector<NodeType>* proof);
+  // Append the path from a node at a given level (both indexed
+  // starting with 0) to the root at a given snapshot.
+  template <class NodeType>
+  void PathFromNodeToRootAtSnapshot(size_t node_index, size_t level,
+                                    size_t snapshot,
+                                    std::vector<NodeType>* path);
   // Get the |index|-th node at level |level|. Indexing starts at 0;
   // caller is responsible for ensuring tree is sufficiently up to date.
   std::string Node(size_t level, size_t index) const;
+  void CopyNode(size_t level, size_t index, std::string* node) const;
+  void CopyNode(size_t level, size_t index, cert_trans::Digest* node) const;
 
   // Get the current root (of the lazily evaluated tree).
   // Caller is responsible for keeping track of the lazy evaluation status.
@@ -175,6 +254,7 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   // The hash of nodes tree_[i][j] and tree_[i][j+1] (j even) is stored
   // at tree_[i+1][j/2]. When tree_[i][j] is the last node of the level with
   // no right sibling, we store its dummy copy: tree_[i+1][j/2] = tree_[i][j].
+  // (Here tree_[i][j] stands for Node(i, j), held in |store_|.)
   //
   // For example, a tree with 5 leaf hashes a0, a1, a2, a3, a4
   //
@@ -201,12 +281,23 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   // Since the tree is append-only from the right, at any given point in time,
   // at each level, all nodes computed so far, except possibly the last node,
   // are fixed and will no longer change.
-  std::vector<std::string> tree_;
+  const std::unique_ptr<cert_trans::NodeStore> store_;
   TreeHasher treehasher_;
   // Number of leaves propagated up to the root,
   // to keep track of lazy evaluation.
   size_t leaves_processed_;
   // The "true" level count for a fully evaluated tree.
   size_t level_count_;
+
+  // Right edges of recently requested past snapshots, most recently
+  // used first. Nodes of a past snapshot never change, so entries
+  // stay valid as the tree grows.
+  const size_t snapshot_cache_size_;
+  size_t snapshot_cache_hits_;
+  size_t snapshot_cache_misses_;
+  typedef std::pair<size_t, std::vector<std::string>> SnapshotEdge;
+  std::list<SnapshotEdge> snapshot_cache_;
+  std::unordered_map<size_t, std::list<SnapshotEdge>::iterator>
+      snapshot_cache_index_;
 };
 #endif
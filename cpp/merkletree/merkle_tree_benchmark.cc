@@ -0,0 +1,261 @@
+// Microbenchmarks for the merkletree package, to compare changes to the
+// trees against a baseline, e.g.:
+//
+//   merkle_tree_benchmark --benchmark_filter=Path \
+//       --benchmark_out=before.json --benchmark_out_format=json
+//
+// Each benchmark takes the number of leaves in the tree as its argument.
+// The ones that build trees also report "bytes/leaf", the heap growth
+// of the tree divided by its number of leaves.
+#include <benchmark/benchmark.h>
+#include <glog/logging.h>
+#include <malloc.h>
+#include <map>
+#include <memory>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "merkletree/compact_merkle_tree.h"
+#include "merkletree/digest.h"
+#include "merkletree/merkle_tree.h"
+#include "merkletree/merkle_verifier.h"
+#include "merkletree/serial_hasher.h"
+#include "merkletree/tree_hasher.h"
+
+namespace {
+
+using cert_trans::Digest;
+using std::map;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+const size_t kLeafSize(128);
+// Number of different proofs cycled through by the proof benchmarks.
+const size_t kNumProofs(256);
+
+
+string Leaf(size_t index) {
+  string leaf(kLeafSize, 'x');
+  leaf.replace(0, sizeof(index), reinterpret_cast<const char*>(&index),
+               sizeof(index));
+  return leaf;
+}
+
+
+// Bytes allocated on the heap and not freed yet. Large blocks are
+// mmap()ed separately, and counted apart.
+size_t HeapInUse() {
+#if defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 33)
+  const struct mallinfo2 info(mallinfo2());
+#else
+  const struct mallinfo info(mallinfo());
+#endif
+  return info.uordblks + info.hblkhd;
+#else
+  return 0;
+#endif
+}
+
+
+void SetBytesPerLeaf(benchmark::State& state, size_t heap_before,
+                     size_t leaves) {
+  state.counters["bytes/leaf"] =
+      static_cast<double>(HeapInUse() - heap_before) / leaves;
+}
+
+
+// Trees are expensive to build, so the benchmarks that only query them
+// share one per size. Their roots are computed.
+MerkleTree* TreeWithLeaves(size_t leaves) {
+  static map<size_t, unique_ptr<MerkleTree>>* const trees(
+      new map<size_t, unique_ptr<MerkleTree>>);
+  unique_ptr<MerkleTree>& tree((*trees)[leaves]);
+  if (!tree) {
+    tree.reset(new MerkleTree(new Sha256Hasher));
+    for (size_t i = 0; i < leaves; ++i) {
+      tree->AddLeaf(Leaf(i));
+    }
+    CHECK(!tree->CurrentRoot().empty());
+  }
+  return tree.get();
+}
+
+
+// The leaves that the proof benchmarks cycle through, spread over the
+// first |leaves|.
+size_t ProofLeaf(size_t i, size_t leaves) {
+  return (i % kNumProofs) * leaves / kNumProofs + 1;
+}
+
+
+void BM_AddLeaf(benchmark::State& state) {
+  const size_t leaves(state.range(0));
+  const string leaf(Leaf(0));
+  size_t heap_before(0);
+  for (auto _ : state) {
+    heap_before = HeapInUse();
+    MerkleTree tree(new Sha256Hasher);
+    for (size_t i = 0; i < leaves; ++i) {
+      tree.AddLeaf(leaf);
+    }
+    SetBytesPerLeaf(state, heap_before, leaves);
+  }
+  state.SetItemsProcessed(state.iterations() * leaves);
+}
+BENCHMARK(BM_AddLeaf)->RangeMultiplier(32)->Range(1 << 10, 1 << 20);
+
+
+void BM_AddLeafHash(benchmark::State& state) {
+  const size_t leaves(state.range(0));
+  const string hash(TreeHasher(new Sha256Hasher).HashLeaf(Leaf(0)));
+  size_t heap_before(0);
+  for (auto _ : state) {
+    heap_before = HeapInUse();
+    MerkleTree tree(new Sha256Hasher);
+    for (size_t i = 0; i < leaves; ++i) {
+      tree.AddLeafHash(hash);
+    }
+    SetBytesPerLeaf(state, heap_before, leaves);
+  }
+  state.SetItemsProcessed(state.iterations() * leaves);
+}
+BENCHMARK(BM_AddLeafHash)->RangeMultiplier(32)->Range(1 << 10, 1 << 20);
+
+
+// The whole tree, from the leaf hashes up.
+void BM_CurrentRoot(benchmark::State& state) {
+  const size_t leaves(state.range(0));
+  const string hash(TreeHasher(new Sha256Hasher).HashLeaf(Leaf(0)));
+  for (auto _ : state) {
+    state.PauseTiming();
+    MerkleTree tree(new Sha256Hasher);
+    for (size_t i = 0; i < leaves; ++i) {
+      tree.AddLeafHash(hash);
+    }
+    state.ResumeTiming();
+    benchmark::DoNotOptimize(tree.CurrentRoot());
+  }
+  state.SetItemsProcessed(state.iterations() * leaves);
+}
+BENCHMARK(BM_CurrentRoot)->RangeMultiplier(32)->Range(1 << 10, 1 << 20);
+
+
+void BM_PathToCurrentRoot(benchmark::State& state) {
+  const size_t leaves(state.range(0));
+  MerkleTree* const tree(TreeWithLeaves(leaves));
+  vector<Digest> path;
+  size_t i(0);
+  for (auto _ : state) {
+    tree->PathToCurrentRoot(ProofLeaf(i++, leaves), &path);
+    benchmark::DoNotOptimize(path.data());
+  }
+}
+BENCHMARK(BM_PathToCurrentRoot)->RangeMultiplier(32)->Range(1 << 10, 1 << 20);
+
+
+// In the first half of a tree of twice the size.
+void BM_PathToRootAtSnapshot(benchmark::State& state) {
+  const size_t snapshot(state.range(0));
+  MerkleTree* const tree(TreeWithLeaves(2 * snapshot));
+  vector<Digest> path;
+  size_t i(0);
+  for (auto _ : state) {
+    tree->PathToRootAtSnapshot(ProofLeaf(i++, snapshot), snapshot, &path);
+    benchmark::DoNotOptimize(path.data());
+  }
+}
+BENCHMARK(BM_PathToRootAtSnapshot)
+    ->RangeMultiplier(32)
+    ->Range(1 << 10, 1 << 20);
+
+
+// From snapshots spread over the first half of the tree, to its end.
+void BM_SnapshotConsistency(benchmark::State& state) {
+  const size_t leaves(state.range(0));
+  MerkleTree* const tree(TreeWithLeaves(leaves));
+  vector<Digest> proof;
+  size_t i(0);
+  for (auto _ : state) {
+    tree->SnapshotConsistency(ProofLeaf(i++, leaves / 2), leaves, &proof);
+    benchmark::DoNotOptimize(proof.data());
+  }
+}
+BENCHMARK(BM_SnapshotConsistency)
+    ->RangeMultiplier(32)
+    ->Range(1 << 10, 1 << 20);
+
+
+void BM_CompactMerkleTreeFromMerkleTree(benchmark::State& state) {
+  const size_t leaves(state.range(0));
+  MerkleTree* const tree(TreeWithLeaves(leaves));
+  size_t heap_before(0);
+  for (auto _ : state) {
+    heap_before = HeapInUse();
+    CompactMerkleTree compact(*tree, new Sha256Hasher);
+    SetBytesPerLeaf(state, heap_before, leaves);
+    benchmark::DoNotOptimize(compact.CurrentRoot());
+  }
+}
+BENCHMARK(BM_CompactMerkleTreeFromMerkleTree)
+    ->RangeMultiplier(32)
+    ->Range(1 << 10, 1 << 20);
+
+
+void BM_VerifyPath(benchmark::State& state) {
+  const size_t leaves(state.range(0));
+  MerkleTree* const tree(TreeWithLeaves(leaves));
+  const string root(tree->CurrentRoot());
+  vector<vector<string>> paths;
+  for (size_t i = 0; i < kNumProofs; ++i) {
+    paths.push_back(tree->PathToCurrentRoot(ProofLeaf(i, leaves)));
+  }
+  MerkleVerifier verifier(new Sha256Hasher);
+  size_t i(0);
+  for (auto _ : state) {
+    const size_t leaf(ProofLeaf(i, leaves));
+    CHECK(verifier.VerifyPath(leaf, leaves, paths[i % kNumProofs], root,
+                              Leaf(leaf - 1)));
+    ++i;
+  }
+}
+BENCHMARK(BM_VerifyPath)->RangeMultiplier(32)->Range(1 << 10, 1 << 20);
+
+
+void BM_VerifyConsistency(benchmark::State& state) {
+  const size_t leaves(state.range(0));
+  MerkleTree* const tree(TreeWithLeaves(leaves));
+  const string root(tree->CurrentRoot());
+  vector<vector<string>> proofs;
+  vector<string> roots;
+  for (size_t i = 0; i < kNumProofs; ++i) {
+    const size_t snapshot(ProofLeaf(i, leaves / 2));
+    proofs.push_back(tree->SnapshotConsistency(snapshot, leaves));
+    roots.push_back(tree->RootAtSnapshot(snapshot));
+  }
+  MerkleVerifier verifier(new Sha256Hasher);
+  size_t i(0);
+  for (auto _ : state) {
+    CHECK(verifier.VerifyConsistency(ProofLeaf(i, leaves / 2), leaves,
+                                     roots[i % kNumProofs], root,
+                                     proofs[i % kNumProofs]));
+    ++i;
+  }
+}
+BENCHMARK(BM_VerifyConsistency)->RangeMultiplier(32)->Range(1 << 10, 1 << 20);
+
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
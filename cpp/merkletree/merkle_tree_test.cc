@@ -1,5 +1,6 @@
 #include <glog/logging.h>
 #include <gtest/gtest.h>
+#include <memory>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -13,6 +14,7 @@
 #include "merkletree/serial_hasher.h"
 #include "merkletree/tree_hasher.h"
 #include "util/testing.h"
+#include "util/thread_pool.h"
 #include "util/util.h"
 
 namespace {
@@ -577,6 +579,205 @@ TEST_F(MerkleTreeTest, AddLeafHash) {
   EXPECT_EQ(kHashValue, tree.LeafHash(index));
 }
 
+// Enough leaves for HashLeaves() to split them into several batches.
+std::vector<string> ManyLeaves() {
+  std::vector<string> leaves;
+  for (int i = 0; i < 1000; ++i) {
+    leaves.push_back("leaf " + std::to_string(i));
+  }
+  return leaves;
+}
+
+TEST_F(MerkleTreeTest, AddLeaves) {
+  cert_trans::ThreadPool pool(4);
+  const std::vector<string> leaves(ManyLeaves());
+  MerkleTree tree(new Sha256Hasher());
+  MerkleTree batched_tree(new Sha256Hasher());
+  for (const auto& leaf : leaves) {
+    tree.AddLeaf(leaf);
+  }
+
+  const std::vector<string> first(leaves.begin(), leaves.begin() + 700);
+  const std::vector<string> rest(leaves.begin() + 700, leaves.end());
+  EXPECT_EQ(700U, batched_tree.AddLeaves(first, &pool));
+  EXPECT_EQ(1000U, batched_tree.AddLeaves(rest, nullptr));
+  EXPECT_EQ(1000U, batched_tree.AddLeaves(std::vector<string>(), &pool));
+  EXPECT_EQ(tree.CurrentRoot(), batched_tree.CurrentRoot());
+  EXPECT_EQ(tree.LeafHash(345), batched_tree.LeafHash(345));
+  EXPECT_EQ(tree.PathToCurrentRoot(678), batched_tree.PathToCurrentRoot(678));
+}
+
+TEST_F(CompactMerkleTreeTest, AddLeaves) {
+  cert_trans::ThreadPool pool(4);
+  const std::vector<string> leaves(ManyLeaves());
+  CompactMerkleTree tree(new Sha256Hasher());
+  for (const auto& leaf : leaves) {
+    tree.AddLeaf(leaf);
+  }
+
+  CompactMerkleTree batched_tree(new Sha256Hasher());
+  const std::vector<string> first(leaves.begin(), leaves.begin() + 300);
+  const std::vector<string> rest(leaves.begin() + 300, leaves.end());
+  EXPECT_EQ(300U, batched_tree.AddLeaves(first, nullptr));
+  EXPECT_EQ(1000U, batched_tree.AddLeaves(rest, &pool));
+  EXPECT_EQ(tree.CurrentRoot(), batched_tree.CurrentRoot());
+}
+
+TEST_F(CompactMerkleTreeTest, RecreateFromFrontier) {
+  CompactMerkleTree tree(new Sha256Hasher());
+  CompactMerkleTree empty(0, tree.Frontier(), new Sha256Hasher());
+  EXPECT_EQ(tree.CurrentRoot(), empty.CurrentRoot());
+
+  for (size_t i = 0; i < data_.size(); ++i) {
+    tree.AddLeaf(data_[i]);
+    const std::vector<string> frontier(tree.Frontier());
+    size_t bits(0);
+    for (size_t n = tree.LeafCount(); n != 0; n >>= 1) {
+      bits += n & 1;
+    }
+    EXPECT_EQ(bits, frontier.size());
+
+    CompactMerkleTree recreated(tree.LeafCount(), frontier,
+                                new Sha256Hasher());
+    EXPECT_EQ(tree.LeafCount(), recreated.LeafCount());
+    EXPECT_EQ(tree.LevelCount(), recreated.LevelCount());
+    EXPECT_EQ(tree.CurrentRoot(), recreated.CurrentRoot());
+
+    // And it keeps growing like the original.
+    for (size_t j = i + 1; j < data_.size(); ++j) {
+      recreated.AddLeaf(data_[j]);
+    }
+    EXPECT_EQ(ReferenceMerkleTreeHash(data_.data(), data_.size(),
+                                      &tree_hasher_),
+              recreated.CurrentRoot());
+  }
+}
+
+TEST_F(CompactMerkleTreeTest, ForkFromSnapshot) {
+  CompactMerkleTree tree(new Sha256Hasher());
+  const CompactMerkleTree::Snapshot empty(tree.GetSnapshot());
+  for (size_t i = 0; i < 100; ++i) {
+    tree.AddLeaf(data_[i]);
+  }
+  const CompactMerkleTree::Snapshot snapshot(tree.GetSnapshot());
+  EXPECT_EQ(100U, snapshot.LeafCount());
+
+  // The tree and the forks grow independently.
+  for (size_t i = 100; i < data_.size(); ++i) {
+    tree.AddLeaf(data_[i]);
+  }
+  CompactMerkleTree fork(snapshot, new Sha256Hasher());
+  EXPECT_EQ(100U, fork.LeafCount());
+  EXPECT_EQ(ReferenceMerkleTreeHash(data_.data(), 100, &tree_hasher_),
+            fork.CurrentRoot());
+  fork.AddLeaf("other");
+  CompactMerkleTree other_fork(snapshot, new Sha256Hasher());
+  EXPECT_EQ(ReferenceMerkleTreeHash(data_.data(), 100, &tree_hasher_),
+            other_fork.CurrentRoot());
+  for (size_t i = 100; i < data_.size(); ++i) {
+    other_fork.AddLeaf(data_[i]);
+  }
+  EXPECT_EQ(tree.CurrentRoot(), other_fork.CurrentRoot());
+  EXPECT_EQ(tree.LevelCount(), other_fork.LevelCount());
+  EXPECT_NE(tree.CurrentRoot(), fork.CurrentRoot());
+
+  CompactMerkleTree from_empty(empty, new Sha256Hasher());
+  EXPECT_EQ(0U, from_empty.LeafCount());
+  EXPECT_EQ(tree_hasher_.HashEmpty(), from_empty.CurrentRoot());
+}
+
+TEST_F(MerkleTreeTest, UpdateRootInParallel) {
+  cert_trans::ThreadPool pool(4);
+  MerkleTree tree(new Sha256Hasher());
+  MerkleTree parallel_tree(new Sha256Hasher());
+  EXPECT_EQ(tree.CurrentRoot(), parallel_tree.UpdateRoot(&pool));
+
+  // Big enough for the lower levels to be split across the pool, and
+  // large enough an update to rehash existing right-edge nodes.
+  for (size_t count : {5000, 3001}) {
+    for (size_t i = 0; i < count; ++i) {
+      const string leaf("leaf " + std::to_string(tree.LeafCount()));
+      tree.AddLeaf(leaf);
+      parallel_tree.AddLeaf(leaf);
+    }
+    EXPECT_EQ(tree.CurrentRoot(), parallel_tree.UpdateRoot(&pool));
+    EXPECT_EQ(tree.PathToCurrentRoot(4321),
+              parallel_tree.PathToCurrentRoot(4321));
+  }
+  EXPECT_EQ(tree.RootAtSnapshot(4999), parallel_tree.RootAtSnapshot(4999));
+}
+
+
+TEST_F(MerkleTreeTest, DigestProofs) {
+  MerkleTree tree(new Sha256Hasher());
+  for (size_t i = 0; i < data_.size(); ++i) {
+    tree.AddLeaf(data_[i]);
+  }
+
+  // Reuse the same vector throughout, as a proof server would.
+  std::vector<cert_trans::Digest> digests;
+  for (size_t snapshot = 1; snapshot <= data_.size(); snapshot += 37) {
+    for (size_t leaf = 1; leaf <= snapshot; leaf += 11) {
+      const std::vector<string> path(tree.PathToRootAtSnapshot(leaf, snapshot));
+      tree.PathToRootAtSnapshot(leaf, snapshot, &digests);
+      ASSERT_EQ(path.size(), digests.size());
+      for (size_t i = 0; i < path.size(); ++i) {
+        EXPECT_EQ(path[i], digests[i].ToString());
+      }
+
+      const std::vector<string> proof(
+          tree.SnapshotConsistency(leaf, snapshot));
+      tree.SnapshotConsistency(leaf, snapshot, &digests);
+      ASSERT_EQ(proof.size(), digests.size());
+      for (size_t i = 0; i < proof.size(); ++i) {
+        EXPECT_EQ(proof[i], digests[i].ToString());
+      }
+    }
+  }
+
+  // Out of range requests clear the output.
+  tree.PathToCurrentRoot(data_.size() + 1, &digests);
+  EXPECT_TRUE(digests.empty());
+}
+
+TEST_F(MerkleTreeTest, SnapshotCache) {
+  // Small enough that cycling through the snapshots below evicts.
+  MerkleTree tree(new Sha256Hasher(), 3);
+  for (size_t i = 0; i < data_.size(); ++i) {
+    tree.AddLeaf(data_[i]);
+  }
+
+  // Trees ending at each snapshot answer without recomputing anything.
+  std::vector<std::unique_ptr<MerkleTree>> snapshots;
+  for (size_t snapshot = 1; snapshot < data_.size(); snapshot += 19) {
+    snapshots.emplace_back(new MerkleTree(new Sha256Hasher()));
+    for (size_t i = 0; i < snapshot; ++i) {
+      snapshots.back()->AddLeaf(data_[i]);
+    }
+  }
+
+  for (int round = 0; round < 3; ++round) {
+    for (const auto& snapshot_tree : snapshots) {
+      const size_t snapshot(snapshot_tree->LeafCount());
+      EXPECT_EQ(snapshot_tree->CurrentRoot(), tree.RootAtSnapshot(snapshot));
+      for (size_t leaf = 1; leaf <= snapshot; leaf += 13) {
+        EXPECT_EQ(snapshot_tree->PathToCurrentRoot(leaf),
+                  tree.PathToRootAtSnapshot(leaf, snapshot));
+      }
+    }
+  }
+  EXPECT_LT(0U, tree.SnapshotCacheHits());
+  EXPECT_LT(0U, tree.SnapshotCacheMisses());
+
+  // The cache stays valid as the tree grows.
+  tree.AddLeaf("one more");
+  for (const auto& snapshot_tree : snapshots) {
+    EXPECT_EQ(snapshot_tree->CurrentRoot(),
+              tree.RootAtSnapshot(snapshot_tree->LeafCount()));
+  }
+}
+
+
 TEST_F(CompactMerkleTreeTest, TestCloneEmptyTreeProducesWorkingTree) {
   MerkleTree tree(new Sha256Hasher);
   CompactMerkleTree compact(tree, new Sha256Hasher);
@@ -830,6 +1031,55 @@ TEST_F(MerkleVerifierTest, VerifyConsistencyProof) {
   }
 }
 
+TEST_F(MerkleVerifierTest, VerifyPaths) {
+  EXPECT_EQ(std::vector<bool>(),
+            verifier_.VerifyPaths(0, string(),
+                                  std::vector<MerkleVerifier::LeafPath>(),
+                                  nullptr));
+
+  cert_trans::ThreadPool pool(4);
+  for (size_t tree_size = 1; tree_size <= data_.size() / 2; ++tree_size) {
+    const string root(
+        ReferenceMerkleTreeHash(data_.data(), tree_size, &tree_hasher_));
+    std::vector<MerkleVerifier::LeafPath> paths;
+    std::vector<bool> expected;
+    for (size_t leaf = 1; leaf <= tree_size; ++leaf) {
+      const MerkleVerifier::LeafPath good{
+          leaf, verifier_.LeafHash(data_[leaf - 1]),
+          ReferenceMerklePath(data_.data(), tree_size, leaf, &tree_hasher_)};
+      // Twice, to share everything.
+      paths.push_back(good);
+      paths.push_back(good);
+      expected.insert(expected.end(), 2, true);
+
+      MerkleVerifier::LeafPath bad(good);
+      bad.leaf_hash = verifier_.LeafHash(data_[leaf]);
+      paths.push_back(bad);
+      bad = good;
+      bad.leaf = leaf + 1;
+      paths.push_back(bad);
+      bad = good;
+      bad.path.push_back(root);
+      paths.push_back(bad);
+      expected.insert(expected.end(), 3, false);
+      if (!good.path.empty()) {
+        bad = good;
+        bad.path.pop_back();
+        paths.push_back(bad);
+        bad = good;
+        bad.path.back()[0] ^= 1;
+        paths.push_back(bad);
+        expected.insert(expected.end(), 2, false);
+      }
+    }
+
+    EXPECT_EQ(expected, verifier_.VerifyPaths(tree_size, root, paths, nullptr))
+        << tree_size;
+    EXPECT_EQ(expected, verifier_.VerifyPaths(tree_size, root, paths, &pool))
+        << tree_size;
+  }
+}
+
 #undef S
 #undef H
 
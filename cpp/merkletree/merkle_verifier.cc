@@ -1,9 +1,12 @@
 #include "merkletree/merkle_verifier.h"
 
+#include <algorithm>
 #include <stddef.h>
+#include <string.h>
 #include <vector>
 
 using std::string;
+using std::vector;
 
 MerkleVerifier::MerkleVerifier(SerialHasher* hasher) : treehasher_(hasher) {
 }
@@ -62,6 +65,148 @@ string MerkleVerifier::RootFromPath(size_t leaf, size_t tree_size,
   return node_hash;
 }
 
+namespace {
+
+
+// A path being walked by VerifyPaths().
+struct Walk {
+  // Index into the |paths| given.
+  size_t index;
+  // Its node on the current level.
+  size_t node;
+  // How much of its path has been used.
+  size_t pos;
+  // Where its node's hash is in the current level's hashes.
+  size_t slot;
+};
+
+
+}  // namespace
+
+vector<bool> MerkleVerifier::VerifyPaths(size_t tree_size, const string& root,
+                                         const vector<LeafPath>& paths,
+                                         util::Executor* executor) {
+  const size_t digest_size(treehasher_.DigestSize());
+  vector<bool> valid(paths.size(), false);
+  vector<Walk> walks;
+  // The hashes of the nodes of the current level, one slot per walk.
+  string hashes;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    const LeafPath& leaf_path(paths[i]);
+    if (leaf_path.leaf == 0 || leaf_path.leaf > tree_size ||
+        leaf_path.leaf_hash.size() != digest_size)
+      // No valid path exists.
+      continue;
+    walks.push_back(Walk{i, leaf_path.leaf - 1, 0, walks.size()});
+    hashes.append(leaf_path.leaf_hash);
+  }
+  if (walks.empty())
+    return valid;
+
+  size_t last_node(tree_size - 1);
+  // The sibling |walk| needs on the current level, or NULL if its parent
+  // is a dummy copy.
+  const auto sibling = [&paths, &last_node](const Walk& walk) {
+    const vector<string>& path(paths[walk.index].path);
+    return IsRightChild(walk.node) || walk.node < last_node ? &path[walk.pos]
+                                                            : nullptr;
+  };
+  // Orders walks by their node, its hash and their sibling, so that the
+  // ones that will have the same parent are next to each other.
+  const auto compare = [&hashes, digest_size, &sibling](const Walk& a,
+                                                        const Walk& b) {
+    if (a.node != b.node)
+      return a.node < b.node ? -1 : 1;
+    const int by_hash(memcmp(hashes.data() + a.slot * digest_size,
+                             hashes.data() + b.slot * digest_size,
+                             digest_size));
+    if (by_hash != 0)
+      return by_hash;
+    // Same node, so either both have a sibling or neither does.
+    const string* const sibling_a(sibling(a));
+    return sibling_a ? sibling_a->compare(*sibling(b)) : 0;
+  };
+
+  vector<bool> shared;
+  vector<bool> carried;
+  while (last_node && !walks.empty()) {
+    // Drop the walks that have run out of path.
+    walks.erase(std::remove_if(walks.begin(), walks.end(),
+                               [&paths, &last_node,
+                                digest_size](const Walk& walk) {
+                                 const vector<string>& path(
+                                     paths[walk.index].path);
+                                 if (!IsRightChild(walk.node) &&
+                                     walk.node >= last_node)
+                                   return false;
+                                 return walk.pos >= path.size() ||
+                                        path[walk.pos].size() != digest_size;
+                               }),
+                walks.end());
+    std::sort(walks.begin(), walks.end(),
+              [&compare](const Walk& a, const Walk& b) {
+                return compare(a, b) < 0;
+              });
+
+    // Each distinct (node, hash, sibling) gets one pair of children to
+    // hash, or, if it has no sibling, carries its hash up unchanged.
+    string children;
+    string carried_hashes;
+    size_t num_pairs(0);
+    size_t num_carried(0);
+    shared.assign(walks.size(), false);
+    for (size_t i = 1; i < walks.size(); ++i) {
+      shared[i] = compare(walks[i - 1], walks[i]) == 0;
+    }
+    carried.assign(walks.size(), false);
+    for (size_t i = 0; i < walks.size(); ++i) {
+      Walk* const walk(&walks[i]);
+      const string* const walk_sibling(sibling(*walk));
+      if (shared[i]) {
+        // Shares the parent of the previous walk, whose slot for the
+        // next level is already set.
+        carried[i] = carried[i - 1];
+        walk->slot = walks[i - 1].slot;
+      } else {
+        const char* const hash(hashes.data() + walk->slot * digest_size);
+        if (!walk_sibling) {
+          carried[i] = true;
+          carried_hashes.append(hash, digest_size);
+          walk->slot = num_carried++;
+        } else {
+          if (IsRightChild(walk->node)) {
+            children.append(*walk_sibling);
+            children.append(hash, digest_size);
+          } else {
+            children.append(hash, digest_size);
+            children.append(*walk_sibling);
+          }
+          walk->slot = num_pairs++;
+        }
+      }
+      if (walk_sibling)
+        ++walk->pos;
+    }
+
+    hashes = treehasher_.HashChildrenBatch(children, executor);
+    hashes.append(carried_hashes);
+    for (size_t i = 0; i < walks.size(); ++i) {
+      if (carried[i])
+        walks[i].slot += num_pairs;
+      walks[i].node = Parent(walks[i].node);
+    }
+    last_node = Parent(last_node);
+  }
+
+  for (const Walk& walk : walks) {
+    // Check that the path has been used up, and leads to the root.
+    valid[walk.index] =
+        walk.pos == paths[walk.index].path.size() &&
+        hashes.compare(walk.slot * digest_size, digest_size, root) == 0;
+  }
+  return valid;
+}
+
 bool MerkleVerifier::VerifyConsistency(size_t snapshot1, size_t snapshot2,
                                        const string& root1,
                                        const string& root2,
@@ -2,10 +2,15 @@
 #define MERKLEVERIFIER_H
 
 #include <stddef.h>
+#include <string>
 #include <vector>
 
 #include "merkletree/tree_hasher.h"
 
+namespace util {
+class Executor;
+}  // namespace util
+
 class SerialHasher;
 
 // Class for verifying paths emitted by MerkleTrees.
@@ -13,6 +18,14 @@ class SerialHasher;
 
 class MerkleVerifier {
  public:
+  // An audit path to verify with VerifyPaths().
+  struct LeafPath {
+    // Index of the leaf, starting at 1.
+    size_t leaf;
+    std::string leaf_hash;
+    std::vector<std::string> path;
+  };
+
   // Takes ownership of the SerialHasher.
   MerkleVerifier(SerialHasher* hasher);
   ~MerkleVerifier();
@@ -43,6 +56,21 @@ class MerkleVerifier {
                            const std::vector<std::string>& path,
                            const std::string& data);
 
+  // Verify many Merkle paths into the same tree at once. Returns, for
+  // each path, whether VerifyPath() would accept it for a leaf with
+  // that leaf hash, except that all the hashes must be DigestSize()
+  // bytes long.
+  //
+  // The paths are walked together one level at a time, so the nodes
+  // that several of them lead to the same way (mostly near the root)
+  // are only hashed once, and each level is hashed as one batch, which
+  // is split across |executor| if it is not NULL. As with
+  // TreeHasher::HashChildrenBatch(), this must not be called from one
+  // of |executor|'s threads.
+  std::vector<bool> VerifyPaths(size_t tree_size, const std::string& root,
+                                const std::vector<LeafPath>& paths,
+                                util::Executor* executor);
+
   bool VerifyConsistency(size_t snapshot1, size_t snapshot2,
                          const std::string& root1, const std::string& root2,
                          const std::vector<std::string>& proof);
@@ -0,0 +1,101 @@
+#include "merkletree/node_store.h"
+
+#include <glog/logging.h>
+#include <string.h>
+
+using std::string;
+
+namespace cert_trans {
+
+
+MemoryNodeStore::MemoryNodeStore(size_t node_size)
+    : node_size_(node_size), leaves_processed_(0), dirty_(false) {
+  CHECK_GT(node_size_, 0U);
+}
+
+
+void MemoryNodeStore::AddLevel() {
+  levels_.emplace_back();
+}
+
+
+void MemoryNodeStore::RemoveLevel() {
+  CHECK(!levels_.empty());
+  CHECK(levels_.back().empty());
+  levels_.pop_back();
+}
+
+
+size_t MemoryNodeStore::NodeCount(size_t level) const {
+  CHECK_GT(levels_.size(), level);
+  return levels_[level].size() / node_size_;
+}
+
+
+string MemoryNodeStore::Node(size_t level, size_t index) const {
+  CHECK_GT(NodeCount(level), index);
+  return string(levels_[level].data() + index * node_size_, node_size_);
+}
+
+
+void MemoryNodeStore::CopyNode(size_t level, size_t index, char* out) const {
+  CHECK_GT(NodeCount(level), index);
+  memcpy(out, levels_[level].data() + index * node_size_, node_size_);
+}
+
+
+string MemoryNodeStore::Nodes(size_t level, size_t begin, size_t end) const {
+  CHECK_LE(begin, end);
+  CHECK_GE(NodeCount(level), end);
+  return string(levels_[level].data() + begin * node_size_,
+                (end - begin) * node_size_);
+}
+
+
+void MemoryNodeStore::PushBack(size_t level, const string& node) {
+  CHECK_EQ(node.size(), node_size_);
+  CHECK_GT(levels_.size(), level);
+  levels_[level].insert(levels_[level].end(), node.begin(), node.end());
+}
+
+
+void MemoryNodeStore::PushBackNodes(size_t level, const string& nodes) {
+  CHECK_EQ(0U, nodes.size() % node_size_);
+  CHECK_GT(levels_.size(), level);
+  levels_[level].insert(levels_[level].end(), nodes.begin(), nodes.end());
+}
+
+
+void MemoryNodeStore::PopBack(size_t level) {
+  CHECK_GE(NodeCount(level), 1U);
+  levels_[level].resize(levels_[level].size() - node_size_);
+}
+
+
+void MemoryNodeStore::TruncateLevel(size_t level, size_t count) {
+  CHECK_GE(NodeCount(level), count);
+  levels_[level].resize(count * node_size_);
+}
+
+
+void MemoryNodeStore::BeginUpdate() {
+  dirty_ = true;
+}
+
+
+void MemoryNodeStore::CommitUpdate(size_t leaves_processed) {
+  leaves_processed_ = leaves_processed;
+  dirty_ = false;
+}
+
+
+size_t MemoryNodeStore::MemoryBytes() const {
+  size_t bytes(levels_.capacity() * sizeof(Level));
+  for (const Level& level : levels_) {
+    bytes += level.capacity();
+  }
+  return bytes;
+}
+
+
+}  // namespace cert_trans
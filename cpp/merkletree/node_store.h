@@ -0,0 +1,141 @@
+#ifndef CERT_TRANS_MERKLETREE_NODE_STORE_H_
+#define CERT_TRANS_MERKLETREE_NODE_STORE_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "util/huge_pages.h"
+
+namespace cert_trans {
+
+// Storage for the node levels of a MerkleTree (see
+// merkletree/merkle_tree.h for the layout). Each level is an array of
+// fixed-size nodes which only ever grows to the right, except that
+// the last node of a level may be removed and replaced while the tree
+// is being brought up to date.
+//
+// Besides the nodes, the store also keeps track of how many leaves
+// have been propagated up to the root. Updates to the upper levels
+// are bracketed by BeginUpdate() / CommitUpdate(), so that a
+// persistent store which is reopened after an interrupted update can
+// report itself as Dirty().
+//
+// Implementations abort upon any storage error.
+class NodeStore {
+ public:
+  virtual ~NodeStore() = default;
+
+  // Length of a node, in bytes.
+  virtual size_t NodeSize() const = 0;
+
+  // Number of levels currently held, including any that are empty.
+  virtual size_t LevelCount() const = 0;
+
+  // Start a new, empty level on top of the current ones.
+  virtual void AddLevel() = 0;
+
+  // Remove the topmost level, which must be empty.
+  virtual void RemoveLevel() = 0;
+
+  // Number of nodes at level |level|, which must exist.
+  virtual size_t NodeCount(size_t level) const = 0;
+
+  // Get the |index|-th node at level |level|. Indexing starts at 0.
+  virtual std::string Node(size_t level, size_t index) const = 0;
+
+  // Copy the |index|-th node at level |level| to |out|, which must
+  // have room for NodeSize() bytes.
+  virtual void CopyNode(size_t level, size_t index, char* out) const = 0;
+
+  // Get the nodes in [|begin|, |end|) at level |level|, concatenated.
+  virtual std::string Nodes(size_t level, size_t begin, size_t end) const = 0;
+
+  // Append a node of NodeSize() bytes to the level.
+  virtual void PushBack(size_t level, const std::string& node) = 0;
+
+  // Append a concatenation of whole nodes to the level.
+  virtual void PushBackNodes(size_t level, const std::string& nodes) = 0;
+
+  // Remove the last node of the level.
+  virtual void PopBack(size_t level) = 0;
+
+  // Remove all but the first |count| nodes of the level.
+  virtual void TruncateLevel(size_t level, size_t count) = 0;
+
+  // Number of leaves propagated up to the root, as of the last
+  // committed update.
+  virtual size_t LeavesProcessed() const = 0;
+
+  // True if an update was started with BeginUpdate() but never
+  // committed. The contents of the levels above the leaves should
+  // then not be trusted.
+  virtual bool Dirty() const = 0;
+
+  virtual void BeginUpdate() = 0;
+  virtual void CommitUpdate(size_t leaves_processed) = 0;
+
+  // An estimate of the heap memory used by the store, in bytes.
+  virtual size_t MemoryBytes() const = 0;
+
+ protected:
+  NodeStore() = default;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(NodeStore);
+};
+
+
+// Keeps each level as a single contiguous array in memory, backed by
+// huge pages if --huge_pages says so.
+class MemoryNodeStore : public NodeStore {
+ public:
+  explicit MemoryNodeStore(size_t node_size);
+
+  size_t NodeSize() const override {
+    return node_size_;
+  }
+
+  size_t LevelCount() const override {
+    return levels_.size();
+  }
+
+  void AddLevel() override;
+  void RemoveLevel() override;
+  size_t NodeCount(size_t level) const override;
+  std::string Node(size_t level, size_t index) const override;
+  void CopyNode(size_t level, size_t index, char* out) const override;
+  std::string Nodes(size_t level, size_t begin, size_t end) const override;
+  void PushBack(size_t level, const std::string& node) override;
+  void PushBackNodes(size_t level, const std::string& nodes) override;
+  void PopBack(size_t level) override;
+  void TruncateLevel(size_t level, size_t count) override;
+
+  size_t LeavesProcessed() const override {
+    return leaves_processed_;
+  }
+
+  bool Dirty() const override {
+    return dirty_;
+  }
+
+  void BeginUpdate() override;
+  void CommitUpdate(size_t leaves_processed) override;
+  size_t MemoryBytes() const override;
+
+ private:
+  typedef std::vector<char, HugePageAllocator<char>> Level;
+
+  const size_t node_size_;
+  std::vector<Level> levels_;
+  size_t leaves_processed_;
+  bool dirty_;
+
+  DISALLOW_COPY_AND_ASSIGN(MemoryNodeStore);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_MERKLETREE_NODE_STORE_H_
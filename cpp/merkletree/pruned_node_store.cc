@@ -0,0 +1,175 @@
+#include "merkletree/pruned_node_store.h"
+
+#include <glog/logging.h>
+#include <string.h>
+
+#include "merkletree/serial_hasher.h"
+
+using std::string;
+
+namespace cert_trans {
+
+
+PrunedNodeStore::PrunedNodeStore(size_t memory_level,
+                                 const LeafSource& leaf_source,
+                                 SerialHasher* hasher)
+    : memory_level_(memory_level),
+      leaf_source_(leaf_source),
+      tree_hasher_(CHECK_NOTNULL(hasher)),
+      leaves_processed_(0),
+      dirty_(false),
+      recomputed_subtree_(0) {
+  CHECK_LT(memory_level_, 8 * sizeof(size_t));
+  CHECK(leaf_source_);
+}
+
+
+void PrunedNodeStore::AddLevel() {
+  levels_.emplace_back();
+}
+
+
+void PrunedNodeStore::RemoveLevel() {
+  CHECK(!levels_.empty());
+  CHECK_EQ(0U, NodeCount(levels_.size() - 1));
+  levels_.pop_back();
+}
+
+
+size_t PrunedNodeStore::NodeCount(size_t level) const {
+  CHECK_GT(levels_.size(), level);
+  return levels_[level].pruned + levels_[level].nodes.size() / NodeSize();
+}
+
+
+string PrunedNodeStore::Node(size_t level, size_t index) const {
+  return string(NodeData(level, index), NodeSize());
+}
+
+
+void PrunedNodeStore::CopyNode(size_t level, size_t index, char* out) const {
+  memcpy(out, NodeData(level, index), NodeSize());
+}
+
+
+string PrunedNodeStore::Nodes(size_t level, size_t begin, size_t end) const {
+  CHECK_LE(begin, end);
+  CHECK_GE(NodeCount(level), end);
+  const Level& nodes(levels_[level]);
+  string ret;
+  ret.reserve((end - begin) * NodeSize());
+  for (; begin < end && begin < nodes.pruned; ++begin) {
+    ret.append(NodeData(level, begin), NodeSize());
+  }
+  if (begin < end) {
+    ret.append(nodes.nodes, (begin - nodes.pruned) * NodeSize(),
+               (end - begin) * NodeSize());
+  }
+  return ret;
+}
+
+
+void PrunedNodeStore::PushBack(size_t level, const string& node) {
+  CHECK_EQ(node.size(), NodeSize());
+  CHECK_GT(levels_.size(), level);
+  levels_[level].nodes.append(node);
+}
+
+
+void PrunedNodeStore::PushBackNodes(size_t level, const string& nodes) {
+  CHECK_EQ(0U, nodes.size() % NodeSize());
+  CHECK_GT(levels_.size(), level);
+  levels_[level].nodes.append(nodes);
+}
+
+
+void PrunedNodeStore::PopBack(size_t level) {
+  CHECK_GT(levels_.size(), level);
+  string* const nodes(&levels_[level].nodes);
+  CHECK(!nodes->empty()) << "cannot remove a pruned node";
+  nodes->erase(nodes->size() - NodeSize());
+}
+
+
+void PrunedNodeStore::TruncateLevel(size_t level, size_t count) {
+  CHECK_GE(NodeCount(level), count);
+  Level* const nodes(&levels_[level]);
+  CHECK_GE(count, nodes->pruned) << "cannot remove pruned nodes";
+  nodes->nodes.resize((count - nodes->pruned) * NodeSize());
+}
+
+
+void PrunedNodeStore::BeginUpdate() {
+  dirty_ = true;
+}
+
+
+void PrunedNodeStore::CommitUpdate(size_t leaves_processed) {
+  leaves_processed_ = leaves_processed;
+  dirty_ = false;
+
+  // The subtrees of |memory_level_| that are complete and up to date
+  // will not change anymore, drop what is below them.
+  const size_t subtrees(leaves_processed_ >> memory_level_);
+  for (size_t level = 0; level < memory_level_ && level < levels_.size();
+       ++level) {
+    Level* const nodes(&levels_[level]);
+    const size_t pruned(subtrees << (memory_level_ - level));
+    CHECK_GE(NodeCount(level), pruned);
+    if (pruned > nodes->pruned) {
+      nodes->nodes.erase(0, (pruned - nodes->pruned) * NodeSize());
+      nodes->pruned = pruned;
+    }
+  }
+}
+
+
+size_t PrunedNodeStore::MemoryBytes() const {
+  size_t bytes(levels_.capacity() * sizeof(Level) +
+               recomputed_.capacity() * sizeof(string));
+  for (const Level& level : levels_) {
+    bytes += level.nodes.capacity();
+  }
+  for (const string& level : recomputed_) {
+    bytes += level.capacity();
+  }
+  return bytes;
+}
+
+
+size_t PrunedNodeStore::NodesInMemory() const {
+  size_t count(0);
+  for (const Level& level : levels_) {
+    count += level.nodes.size() / NodeSize();
+  }
+  return count;
+}
+
+
+const char* PrunedNodeStore::NodeData(size_t level, size_t index) const {
+  CHECK_GT(NodeCount(level), index);
+  const Level& nodes(levels_[level]);
+  if (index >= nodes.pruned) {
+    return nodes.nodes.data() + (index - nodes.pruned) * NodeSize();
+  }
+
+  const size_t subtree(index >> (memory_level_ - level));
+  if (recomputed_.empty() || recomputed_subtree_ != subtree) {
+    const size_t subtree_leaves(static_cast<size_t>(1) << memory_level_);
+    recomputed_.resize(memory_level_);
+    recomputed_[0] = leaf_source_(subtree * subtree_leaves,
+                                  (subtree + 1) * subtree_leaves);
+    CHECK_EQ(subtree_leaves * NodeSize(), recomputed_[0].size())
+        << "wrong number of leaf hashes for subtree " << subtree;
+    for (size_t i = 1; i < memory_level_; ++i) {
+      recomputed_[i] =
+          tree_hasher_.HashChildrenBatch(recomputed_[i - 1], nullptr);
+    }
+    recomputed_subtree_ = subtree;
+  }
+  const size_t first(subtree << (memory_level_ - level));
+  return recomputed_[level].data() + (index - first) * NodeSize();
+}
+
+
+}  // namespace cert_trans
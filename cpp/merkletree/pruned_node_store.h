@@ -0,0 +1,110 @@
+#ifndef CERT_TRANS_MERKLETREE_PRUNED_NODE_STORE_H_
+#define CERT_TRANS_MERKLETREE_PRUNED_NODE_STORE_H_
+
+#include <functional>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "merkletree/node_store.h"
+#include "merkletree/tree_hasher.h"
+
+class SerialHasher;
+
+namespace cert_trans {
+
+// A NodeStore that keeps the levels from |memory_level| up in memory,
+// but of the levels below, only the nodes that are not yet under a
+// complete node of |memory_level| (i.e., a subtree of
+// 2^|memory_level| leaves that has been propagated up to the root).
+// The others are recomputed when needed from the leaf hashes of their
+// subtree, which are fetched with |leaf_source|. This divides the
+// memory used by the tree by about 2^|memory_level|, at the cost of
+// one read of 2^|memory_level| leaf hashes for a proof that reaches
+// down into a pruned subtree.
+//
+// The nodes of the last subtree recomputed are kept, so that the
+// successive levels of a single audit path only fetch its leaves once.
+//
+// This class is thread-compatible, but not thread-safe: even the
+// const methods may replace the recomputed subtree.
+class PrunedNodeStore : public NodeStore {
+ public:
+  // Returns the leaf hashes in [begin, end), concatenated. Only ever
+  // asked for leaves of complete subtrees, which must not change.
+  typedef std::function<std::string(size_t begin, size_t end)> LeafSource;
+
+  // Takes ownership of |hasher|, which must be the one the tree is
+  // built with.
+  PrunedNodeStore(size_t memory_level, const LeafSource& leaf_source,
+                  SerialHasher* hasher);
+
+  size_t NodeSize() const override {
+    return tree_hasher_.DigestSize();
+  }
+
+  size_t LevelCount() const override {
+    return levels_.size();
+  }
+
+  void AddLevel() override;
+  void RemoveLevel() override;
+  size_t NodeCount(size_t level) const override;
+  std::string Node(size_t level, size_t index) const override;
+  void CopyNode(size_t level, size_t index, char* out) const override;
+  std::string Nodes(size_t level, size_t begin, size_t end) const override;
+  void PushBack(size_t level, const std::string& node) override;
+  void PushBackNodes(size_t level, const std::string& nodes) override;
+  void PopBack(size_t level) override;
+  void TruncateLevel(size_t level, size_t count) override;
+
+  size_t LeavesProcessed() const override {
+    return leaves_processed_;
+  }
+
+  bool Dirty() const override {
+    return dirty_;
+  }
+
+  void BeginUpdate() override;
+  void CommitUpdate(size_t leaves_processed) override;
+  size_t MemoryBytes() const override;
+
+  // The number of nodes held in memory, for all levels.
+  size_t NodesInMemory() const;
+
+ private:
+  struct Level {
+    Level() : pruned(0) {
+    }
+
+    // Number of nodes dropped from the start of the level.
+    size_t pruned;
+    // The nodes after those.
+    std::string nodes;
+  };
+
+  // A pointer to the |index|-th node at |level|, recomputing its
+  // subtree if it was pruned.
+  const char* NodeData(size_t level, size_t index) const;
+
+  const size_t memory_level_;
+  const LeafSource leaf_source_;
+  const TreeHasher tree_hasher_;
+  std::vector<Level> levels_;
+  size_t leaves_processed_;
+  bool dirty_;
+
+  // The levels below |memory_level_| of the last subtree recomputed,
+  // which is |recomputed_subtree_| at |memory_level_|.
+  mutable size_t recomputed_subtree_;
+  mutable std::vector<std::string> recomputed_;
+
+  DISALLOW_COPY_AND_ASSIGN(PrunedNodeStore);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_MERKLETREE_PRUNED_NODE_STORE_H_
@@ -0,0 +1,122 @@
+#include "merkletree/pruned_node_store.h"
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "merkletree/merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+const size_t kMemoryLevel = 3;
+
+
+class PrunedNodeStoreTest : public ::testing::Test {
+ protected:
+  PrunedNodeStoreTest()
+      : full_(new Sha256Hasher),
+        store_(new PrunedNodeStore(kMemoryLevel,
+                                   [this](size_t begin, size_t end) {
+                                     return ReadLeaves(begin, end);
+                                   },
+                                   new Sha256Hasher)),
+        pruned_(new Sha256Hasher, store_),
+        reads_(0) {
+  }
+
+  string ReadLeaves(size_t begin, size_t end) {
+    ++reads_;
+    EXPECT_LE(end, leaf_hashes_.size());
+    string ret;
+    for (size_t i = begin; i < end; ++i) {
+      ret.append(leaf_hashes_[i]);
+    }
+    return ret;
+  }
+
+  void AddLeaves(size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      const string leaf("leaf " + std::to_string(leaf_hashes_.size()));
+      leaf_hashes_.push_back(full_.LeafHash(leaf));
+      full_.AddLeaf(leaf);
+      pruned_.AddLeaf(leaf);
+    }
+  }
+
+  MerkleTree full_;
+  // Owned by |pruned_|.
+  PrunedNodeStore* const store_;
+  MerkleTree pruned_;
+  vector<string> leaf_hashes_;
+  int reads_;
+};
+
+
+TEST_F(PrunedNodeStoreTest, MatchesFullTree) {
+  for (size_t size : {1, 5, 8, 13, 64, 100}) {
+    AddLeaves(size - full_.LeafCount());
+    EXPECT_EQ(full_.CurrentRoot(), pruned_.CurrentRoot()) << size;
+    for (size_t snapshot = 1; snapshot <= size; ++snapshot) {
+      EXPECT_EQ(full_.RootAtSnapshot(snapshot),
+                pruned_.RootAtSnapshot(snapshot));
+      for (size_t leaf = 1; leaf <= snapshot; ++leaf) {
+        EXPECT_EQ(full_.PathToRootAtSnapshot(leaf, snapshot),
+                  pruned_.PathToRootAtSnapshot(leaf, snapshot))
+            << leaf << " " << snapshot;
+      }
+      EXPECT_EQ(full_.SnapshotConsistency(snapshot, size),
+                pruned_.SnapshotConsistency(snapshot, size));
+    }
+    for (size_t leaf = 1; leaf <= size; ++leaf) {
+      EXPECT_EQ(full_.LeafHash(leaf), pruned_.LeafHash(leaf));
+    }
+  }
+}
+
+
+TEST_F(PrunedNodeStoreTest, KeepsOnlyUpperLevels) {
+  AddLeaves(1000);
+  pruned_.CurrentRoot();
+  // The leaves and levels 1 and 2 of the first 125 subtrees of 8
+  // leaves are gone.
+  const size_t full_nodes(1000 + 500 + 250 + 125 + 63 + 32 + 16 + 8 + 4 + 2 +
+                          1);
+  EXPECT_EQ(full_nodes - 125 * (8 + 4 + 2), store_->NodesInMemory());
+  EXPECT_EQ(0, reads_);
+
+  // Leaves added since the last update are all there.
+  AddLeaves(3);
+  EXPECT_EQ(leaf_hashes_[1001], pruned_.LeafHash(1002));
+  EXPECT_EQ(0, reads_);
+}
+
+
+TEST_F(PrunedNodeStoreTest, ReadsOneSubtreePerPath) {
+  AddLeaves(100);
+  pruned_.CurrentRoot();
+  EXPECT_EQ(full_.PathToCurrentRoot(42), pruned_.PathToCurrentRoot(42));
+  EXPECT_EQ(1, reads_);
+  // Another leaf of the same subtree.
+  EXPECT_EQ(full_.PathToCurrentRoot(45), pruned_.PathToCurrentRoot(45));
+  EXPECT_EQ(1, reads_);
+  EXPECT_EQ(full_.PathToCurrentRoot(3), pruned_.PathToCurrentRoot(3));
+  EXPECT_EQ(2, reads_);
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,186 @@
+#include "merkletree/subtree_prover.h"
+
+#include <glog/logging.h>
+
+using std::string;
+using std::vector;
+
+namespace cert_trans {
+
+namespace {
+
+// The largest power of two smaller than |n|, which must be at least 2.
+size_t SplitPoint(size_t n) {
+  CHECK_GE(n, 2U);
+  size_t k(1);
+  while (k << 1 < n) {
+    k <<= 1;
+  }
+  return k;
+}
+
+
+bool IsPowerOfTwo(size_t n) {
+  return n != 0 && (n & (n - 1)) == 0;
+}
+
+
+int Log2(size_t n) {
+  int level(0);
+  while (n >>= 1) {
+    ++level;
+  }
+  return level;
+}
+
+
+}  // namespace
+
+
+SubtreeProver::SubtreeProver(SerialHasher* hasher, const SubtreeLookup& lookup)
+    : treehasher_(CHECK_NOTNULL(hasher)), lookup_(lookup) {
+  CHECK(lookup_);
+}
+
+
+util::Status SubtreeProver::RootAtSnapshot(size_t snapshot,
+                                           string* root) const {
+  CHECK_NOTNULL(root);
+  if (snapshot == 0) {
+    root->assign(treehasher_.HashEmpty());
+    return util::Status::OK;
+  }
+  return RangeHash(0, snapshot, root);
+}
+
+
+util::Status SubtreeProver::PathToRootAtSnapshot(size_t leaf, size_t snapshot,
+                                                 vector<string>* path) const {
+  CHECK_NOTNULL(path)->clear();
+  if (leaf == 0 || leaf > snapshot) {
+    return util::Status(util::error::INVALID_ARGUMENT,
+                        "leaf is not in the snapshot");
+  }
+  const util::Status status(Path(leaf - 1, 0, snapshot, path));
+  if (!status.ok()) {
+    path->clear();
+  }
+  return status;
+}
+
+
+util::Status SubtreeProver::SnapshotConsistency(size_t snapshot1,
+                                                size_t snapshot2,
+                                                vector<string>* proof) const {
+  CHECK_NOTNULL(proof)->clear();
+  if (snapshot1 == 0 || snapshot1 >= snapshot2) {
+    return util::Status(util::error::INVALID_ARGUMENT,
+                        "snapshots are not in increasing order");
+  }
+  const util::Status status(SubProof(snapshot1, 0, snapshot2, true, proof));
+  if (!status.ok()) {
+    proof->clear();
+  }
+  return status;
+}
+
+
+// Hash of the leaves [begin, end). The ranges we get asked for always
+// start at a multiple of the largest power of two not above their
+// size, so splitting them as RFC 6962 does only ever yields perfect
+// subtrees that are aligned on their own size.
+util::Status SubtreeProver::RangeHash(size_t begin, size_t end,
+                                      string* hash) const {
+  CHECK_LT(begin, end);
+  const size_t size(end - begin);
+  if (IsPowerOfTwo(size)) {
+    const int level(Log2(size));
+    CHECK_EQ(0U, begin & (size - 1));
+    if (!lookup_(level, begin >> level, hash)) {
+      return util::Status(util::error::NOT_FOUND,
+                          "missing subtree hash at level " +
+                              std::to_string(level) + ", index " +
+                              std::to_string(begin >> level));
+    }
+    return util::Status::OK;
+  }
+
+  const size_t k(SplitPoint(size));
+  string left, right;
+  util::Status status(RangeHash(begin, begin + k, &left));
+  if (status.ok()) {
+    status = RangeHash(begin + k, end, &right);
+  }
+  if (status.ok()) {
+    hash->assign(treehasher_.HashChildren(left, right));
+  }
+  return status;
+}
+
+
+// PATH(m, D[begin:end]) from RFC 6962, section 2.1.1, for the 0-based
+// leaf |leaf|, from the leaf up.
+util::Status SubtreeProver::Path(size_t leaf, size_t begin, size_t end,
+                                 vector<string>* path) const {
+  if (end - begin == 1) {
+    return util::Status::OK;
+  }
+  const size_t k(SplitPoint(end - begin));
+  string sibling;
+  util::Status status;
+  if (leaf < begin + k) {
+    status = Path(leaf, begin, begin + k, path);
+    if (status.ok()) {
+      status = RangeHash(begin + k, end, &sibling);
+    }
+  } else {
+    status = Path(leaf, begin + k, end, path);
+    if (status.ok()) {
+      status = RangeHash(begin, begin + k, &sibling);
+    }
+  }
+  if (status.ok()) {
+    path->push_back(sibling);
+  }
+  return status;
+}
+
+
+// SUBPROOF(m, D[begin:end], b) from RFC 6962, section 2.1.2, where
+// |snapshot1| is m counted from the start of the whole tree.
+util::Status SubtreeProver::SubProof(size_t snapshot1, size_t begin,
+                                     size_t end, bool complete_subtree,
+                                     vector<string>* proof) const {
+  string node;
+  if (snapshot1 == end) {
+    if (complete_subtree) {
+      return util::Status::OK;
+    }
+    const util::Status status(RangeHash(begin, end, &node));
+    if (status.ok()) {
+      proof->push_back(node);
+    }
+    return status;
+  }
+
+  const size_t k(SplitPoint(end - begin));
+  util::Status status;
+  if (snapshot1 <= begin + k) {
+    status = SubProof(snapshot1, begin, begin + k, complete_subtree, proof);
+    if (status.ok()) {
+      status = RangeHash(begin + k, end, &node);
+    }
+  } else {
+    status = SubProof(snapshot1, begin + k, end, false, proof);
+    if (status.ok()) {
+      status = RangeHash(begin, begin + k, &node);
+    }
+  }
+  if (status.ok()) {
+    proof->push_back(node);
+  }
+  return status;
+}
+
+
+}  // namespace cert_trans
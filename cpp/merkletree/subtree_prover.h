@@ -0,0 +1,68 @@
+#ifndef CERT_TRANS_MERKLETREE_SUBTREE_PROVER_H_
+#define CERT_TRANS_MERKLETREE_SUBTREE_PROVER_H_
+
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "merkletree/tree_hasher.h"
+#include "util/status.h"
+
+class SerialHasher;
+
+namespace cert_trans {
+
+// Computes the same roots and proofs as MerkleTree, but from the hashes
+// of perfect subtrees stored elsewhere (e.g. in the database), rather
+// than from a tree held in memory. The perfect subtree at (level,
+// index) covers the 2^level leaves starting at leaf index * 2^level;
+// level 0 holds the leaf hashes. Every RFC 6962 proof node is either
+// such a subtree or the right edge of a tree, which is made up of at
+// most one subtree per level, so each proof takes O(log n) lookups.
+//
+// Leaves and snapshots are numbered as in MerkleTree: leaf indices
+// start at 1, and a snapshot is a tree size.
+//
+// This class is thread-safe, if |lookup| is.
+class SubtreeProver {
+ public:
+  // Fills in |hash| with the hash of the perfect subtree at (|level|,
+  // |index|), and returns true, if it is available.
+  typedef std::function<bool(int level, int64_t index, std::string* hash)>
+      SubtreeLookup;
+
+  // Takes ownership of |hasher|.
+  SubtreeProver(SerialHasher* hasher, const SubtreeLookup& lookup);
+
+  // Returns NOT_FOUND if a subtree hash is missing from the store.
+  util::Status RootAtSnapshot(size_t snapshot, std::string* root) const;
+
+  // Returns INVALID_ARGUMENT unless 0 < |leaf| <= |snapshot|.
+  util::Status PathToRootAtSnapshot(size_t leaf, size_t snapshot,
+                                    std::vector<std::string>* path) const;
+
+  // Returns INVALID_ARGUMENT unless 0 < |snapshot1| < |snapshot2|.
+  util::Status SnapshotConsistency(size_t snapshot1, size_t snapshot2,
+                                   std::vector<std::string>* proof) const;
+
+ private:
+  util::Status RangeHash(size_t begin, size_t end, std::string* hash) const;
+  util::Status Path(size_t leaf, size_t begin, size_t end,
+                    std::vector<std::string>* path) const;
+  util::Status SubProof(size_t snapshot1, size_t begin, size_t end,
+                        bool complete_subtree,
+                        std::vector<std::string>* proof) const;
+
+  const TreeHasher treehasher_;
+  const SubtreeLookup lookup_;
+
+  DISALLOW_COPY_AND_ASSIGN(SubtreeProver);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_MERKLETREE_SUBTREE_PROVER_H_
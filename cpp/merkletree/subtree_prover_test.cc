@@ -0,0 +1,135 @@
+#include "merkletree/subtree_prover.h"
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "merkletree/merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "merkletree/tree_hasher.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::vector;
+
+const size_t kLeafCount = 300;
+
+
+class SubtreeProverTest : public ::testing::Test {
+ protected:
+  SubtreeProverTest()
+      : hasher_(new Sha256Hasher),
+        tree_(new Sha256Hasher),
+        prover_(new Sha256Hasher,
+                [this](int level, int64_t index, string* hash) {
+                  return Lookup(level, index, hash);
+                }),
+        lookups_(0) {
+    subtrees_.resize(1);
+    for (size_t i = 0; i < kLeafCount; ++i) {
+      const string leaf("leaf " + std::to_string(i));
+      tree_.AddLeaf(leaf);
+      subtrees_[0].push_back(hasher_.HashLeaf(leaf));
+    }
+    while (subtrees_.back().size() > 1) {
+      const vector<string>& below(subtrees_.back());
+      vector<string> level;
+      for (size_t i = 0; i + 1 < below.size(); i += 2) {
+        level.push_back(hasher_.HashChildren(below[i], below[i + 1]));
+      }
+      subtrees_.push_back(level);
+    }
+  }
+
+  bool Lookup(int level, int64_t index, string* hash) {
+    ++lookups_;
+    if (static_cast<size_t>(level) >= subtrees_.size() ||
+        static_cast<size_t>(index) >= subtrees_[level].size()) {
+      return false;
+    }
+    hash->assign(subtrees_[level][index]);
+    return true;
+  }
+
+  // Proofs should need about two lookups per level of the tree.
+  void ExpectFewLookups(size_t snapshot) {
+    size_t levels(1);
+    while ((1U << (levels - 1)) < snapshot) {
+      ++levels;
+    }
+    EXPECT_LE(lookups_, 2 * levels) << "snapshot " << snapshot;
+    lookups_ = 0;
+  }
+
+  const TreeHasher hasher_;
+  MerkleTree tree_;
+  const SubtreeProver prover_;
+  vector<vector<string>> subtrees_;
+  size_t lookups_;
+};
+
+
+TEST_F(SubtreeProverTest, MatchesMerkleTree) {
+  string root;
+  ASSERT_TRUE(prover_.RootAtSnapshot(0, &root).ok());
+  EXPECT_EQ(tree_.RootAtSnapshot(0), root);
+
+  vector<string> proof;
+  for (size_t snapshot = 1; snapshot <= kLeafCount; ++snapshot) {
+    ASSERT_TRUE(prover_.RootAtSnapshot(snapshot, &root).ok());
+    EXPECT_EQ(tree_.RootAtSnapshot(snapshot), root);
+    lookups_ = 0;
+
+    for (size_t leaf = 1; leaf <= snapshot; leaf += 7) {
+      ASSERT_TRUE(prover_.PathToRootAtSnapshot(leaf, snapshot, &proof).ok());
+      EXPECT_EQ(tree_.PathToRootAtSnapshot(leaf, snapshot), proof);
+      ExpectFewLookups(snapshot);
+    }
+
+    for (size_t snapshot1 = 1; snapshot1 < snapshot; snapshot1 += 5) {
+      ASSERT_TRUE(
+          prover_.SnapshotConsistency(snapshot1, snapshot, &proof).ok());
+      EXPECT_EQ(tree_.SnapshotConsistency(snapshot1, snapshot), proof);
+      ExpectFewLookups(snapshot);
+    }
+  }
+}
+
+
+TEST_F(SubtreeProverTest, RejectsBadArguments) {
+  vector<string> proof;
+  EXPECT_EQ(util::error::INVALID_ARGUMENT,
+            prover_.PathToRootAtSnapshot(0, 10, &proof).CanonicalCode());
+  EXPECT_EQ(util::error::INVALID_ARGUMENT,
+            prover_.PathToRootAtSnapshot(11, 10, &proof).CanonicalCode());
+  EXPECT_EQ(util::error::INVALID_ARGUMENT,
+            prover_.SnapshotConsistency(0, 10, &proof).CanonicalCode());
+  EXPECT_EQ(util::error::INVALID_ARGUMENT,
+            prover_.SnapshotConsistency(10, 10, &proof).CanonicalCode());
+}
+
+
+TEST_F(SubtreeProverTest, ReportsMissingSubtrees) {
+  vector<string> proof;
+  EXPECT_EQ(util::error::NOT_FOUND,
+            prover_.PathToRootAtSnapshot(1, kLeafCount + 1, &proof)
+                .CanonicalCode());
+  EXPECT_TRUE(proof.empty());
+
+  string root;
+  EXPECT_EQ(util::error::NOT_FOUND,
+            prover_.RootAtSnapshot(2 * kLeafCount, &root).CanonicalCode());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
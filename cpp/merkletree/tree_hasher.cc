@@ -1,39 +1,157 @@
 #include "merkletree/tree_hasher.h"
 
+#include <algorithm>
+#include <atomic>
 #include <glog/logging.h>
 
+#include "base/notification.h"
+#include "merkletree/digest.h"
 #include "merkletree/serial_hasher.h"
+#include "util/executor.h"
+#include "util/parallel_for.h"
 
+using cert_trans::Digest;
+using cert_trans::Notification;
+using std::atomic;
 using std::lock_guard;
 using std::mutex;
 using std::string;
+using std::unique_ptr;
+using std::vector;
 
 namespace {
 
 const char kLeafPrefix('\x00');
 const char kNodePrefix('\x01');
 
+// Number of leaves hashed by each closure in HashLeaves().
+const size_t kLeavesPerBatch(256);
+// Number of node pairs hashed by each closure in HashChildrenBatch().
+const size_t kPairsPerBatch(1024);
+
 std::string EmptyHash(SerialHasher* hasher) {
   hasher->Reset();
   return hasher->Final();
 }
 
+std::string LeafHash(SerialHasher* hasher, const string& data) {
+  hasher->Reset();
+  hasher->Update(string(1, kLeafPrefix));
+  hasher->Update(data);
+  return hasher->Final();
+}
+
+void HashBatch(const SerialHasher& prototype, bool sha256,
+               const vector<string>& data, size_t begin, size_t end,
+               vector<string>* hashes) {
+  if (sha256) {
+    for (size_t i = begin; i < end; ++i) {
+      string* const hash(&(*hashes)[i]);
+      hash->resize(Sha256TreeHasher::kDigestSize);
+      Sha256TreeHasher::HashLeaf(data[i].data(), data[i].size(), &(*hash)[0]);
+    }
+    return;
+  }
+  const unique_ptr<SerialHasher> hasher(prototype.Create());
+  for (size_t i = begin; i < end; ++i) {
+    (*hashes)[i] = LeafHash(hasher.get(), data[i]);
+  }
+}
+
+// Hashes the pairs [begin, end) of |children| into the matching slots
+// of |parents|.
+void HashPairs(SerialHasher* hasher, const string& children, size_t begin,
+               size_t end, string* parents) {
+  const size_t digest_size(hasher->DigestSize());
+  const size_t pair_size(2 * digest_size);
+  // Hash the prefix and both children in one go, reusing the buffer.
+  string input(1, kNodePrefix);
+  input.resize(1 + pair_size);
+  for (size_t i = begin; i < end; ++i) {
+    input.replace(1, pair_size, children, i * pair_size, pair_size);
+    hasher->Reset();
+    hasher->Update(input);
+    parents->replace(i * digest_size, digest_size, hasher->Final());
+  }
+}
+
+// As above, with SHA-256, straight from |children| into |parents|.
+void HashSha256Pairs(const string& children, size_t begin, size_t end,
+                     string* parents) {
+  const size_t digest_size(Sha256TreeHasher::kDigestSize);
+  for (size_t i = begin; i < end; ++i) {
+    Sha256TreeHasher::HashChildren(children.data() + 2 * i * digest_size,
+                                   children.data() +
+                                       (2 * i + 1) * digest_size,
+                                   &(*parents)[i * digest_size]);
+  }
+}
+
+// Hashes the pairs [begin, end) with whichever of the above applies.
+// |hasher| is only used without |sha256|.
+void HashPairs(SerialHasher* hasher, bool sha256, const string& children,
+               size_t begin, size_t end, string* parents) {
+  if (sha256) {
+    HashSha256Pairs(children, begin, end, parents);
+  } else {
+    HashPairs(hasher, children, begin, end, parents);
+  }
+}
+
 }  // namespace
 
 TreeHasher::TreeHasher(SerialHasher* hasher)
-    : hasher_(CHECK_NOTNULL(hasher)), empty_hash_(EmptyHash(hasher_.get())) {
+    : hasher_(CHECK_NOTNULL(hasher)),
+      sha256_(dynamic_cast<Sha256Hasher*>(hasher) != nullptr),
+      empty_hash_(EmptyHash(hasher_.get())) {
 }
 
 string TreeHasher::HashLeaf(const string& data) const {
+  if (sha256_) {
+    string hash(Sha256TreeHasher::kDigestSize, '\0');
+    Sha256TreeHasher::HashLeaf(data.data(), data.size(), &hash[0]);
+    return hash;
+  }
   lock_guard<mutex> lock(lock_);
-  hasher_->Reset();
-  hasher_->Update(string(1, kLeafPrefix));
-  hasher_->Update(data);
-  return hasher_->Final();
+  return LeafHash(hasher_.get(), data);
+}
+
+vector<string> TreeHasher::HashLeaves(const vector<string>& data,
+                                      util::Executor* executor) const {
+  vector<string> hashes(data.size());
+  const size_t num_batches((data.size() + kLeavesPerBatch - 1) /
+                           kLeavesPerBatch);
+  if (!executor || num_batches < 2) {
+    HashBatch(*hasher_, sha256_, data, 0, data.size(), &hashes);
+    return hashes;
+  }
+
+  // Each batch writes to its own range of |hashes|, the last one to
+  // finish wakes us up.
+  atomic<size_t> remaining(num_batches);
+  Notification done;
+  for (size_t begin = 0; begin < data.size(); begin += kLeavesPerBatch) {
+    const size_t end(std::min(begin + kLeavesPerBatch, data.size()));
+    executor->Add([this, &data, begin, end, &hashes, &remaining, &done]() {
+      HashBatch(*hasher_, sha256_, data, begin, end, &hashes);
+      if (--remaining == 0) {
+        done.Notify();
+      }
+    });
+  }
+  done.WaitForNotification();
+  return hashes;
 }
 
 string TreeHasher::HashChildren(const string& left_child,
                                 const string& right_child) const {
+  if (sha256_ && left_child.size() == Sha256TreeHasher::kDigestSize &&
+      right_child.size() == Sha256TreeHasher::kDigestSize) {
+    string parent(Sha256TreeHasher::kDigestSize, '\0');
+    Sha256TreeHasher::HashChildren(left_child.data(), right_child.data(),
+                                   &parent[0]);
+    return parent;
+  }
   lock_guard<mutex> lock(lock_);
   hasher_->Reset();
   hasher_->Update(string(1, kNodePrefix));
@@ -41,3 +159,59 @@ string TreeHasher::HashChildren(const string& left_child,
   hasher_->Update(right_child);
   return hasher_->Final();
 }
+
+void TreeHasher::HashChildren(const Digest& left_child,
+                              const Digest& right_child,
+                              Digest* parent) const {
+  if (sha256_) {
+    static_assert(Digest::kSize == Sha256TreeHasher::kDigestSize,
+                  "Digest is not the size of a SHA-256 hash");
+    Sha256TreeHasher::HashChildren(left_child.data(), right_child.data(),
+                                   parent->mutable_data());
+    return;
+  }
+  lock_guard<mutex> lock(lock_);
+  CHECK_EQ(Digest::kSize, hasher_->DigestSize());
+  if (node_input_.empty()) {
+    node_input_.assign(1 + 2 * Digest::kSize, kNodePrefix);
+  }
+  node_input_.replace(1, Digest::kSize, left_child.data(), Digest::kSize);
+  node_input_.replace(1 + Digest::kSize, Digest::kSize, right_child.data(),
+                      Digest::kSize);
+  hasher_->Reset();
+  hasher_->Update(node_input_);
+  const string hash(hasher_->Final());
+  memcpy(parent->mutable_data(), hash.data(), Digest::kSize);
+}
+
+string TreeHasher::HashChildrenBatch(const string& children,
+                                     util::Executor* executor) const {
+  const size_t pair_size(2 * DigestSize());
+  CHECK_EQ(0U, children.size() % pair_size);
+  const size_t num_pairs(children.size() / pair_size);
+  string parents(children.size() / 2, '\0');
+  const size_t num_batches((num_pairs + kPairsPerBatch - 1) / kPairsPerBatch);
+  if (!executor || num_batches < 2) {
+    if (sha256_) {
+      HashSha256Pairs(children, 0, num_pairs, &parents);
+      return parents;
+    }
+    lock_guard<mutex> lock(lock_);
+    HashPairs(hasher_.get(), children, 0, num_pairs, &parents);
+    return parents;
+  }
+
+  // We hash batches too, so this doesn't wait for a thread of
+  // |executor| to be free, and can run on one of them.
+  util::ParallelFor(num_batches, num_batches, executor,
+                    [this, &children, num_pairs, &parents](size_t batch) {
+                      const size_t begin(batch * kPairsPerBatch);
+                      const size_t end(
+                          std::min(begin + kPairsPerBatch, num_pairs));
+                      const unique_ptr<SerialHasher> hasher(
+                          sha256_ ? nullptr : hasher_->Create());
+                      HashPairs(hasher.get(), sha256_, children, begin, end,
+                                &parents);
+                    });
+  return parents;
+}
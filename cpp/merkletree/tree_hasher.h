@@ -3,12 +3,83 @@
 
 #include <memory>
 #include <mutex>
+#include <openssl/sha.h>
 #include <stddef.h>
+#include <string.h>
 #include <string>
+#include <vector>
 
 #include "base/macros.h"
 #include "merkletree/serial_hasher.h"
 
+namespace cert_trans {
+class Digest;
+}  // namespace cert_trans
+
+namespace util {
+class Executor;
+}  // namespace util
+
+// SHA-256, for BasicTreeHasher.
+struct Sha256 {
+  typedef SHA256_CTX Context;
+  static const size_t kDigestSize = SHA256_DIGEST_LENGTH;
+
+  static void Init(Context* ctx) {
+    SHA256_Init(ctx);
+  }
+
+  static void Update(Context* ctx, const void* data, size_t length) {
+    SHA256_Update(ctx, data, length);
+  }
+
+  static void Final(Context* ctx, unsigned char* digest) {
+    SHA256_Final(digest, ctx);
+  }
+};
+
+
+// The leaf and node hashing of RFC 6962, with |Hash| (such as Sha256)
+// known at compile time. The hash context lives on the stack, and a
+// node is hashed from one fixed-size buffer, without the virtual calls
+// and the allocations of a SerialHasher.
+template <class Hash>
+class BasicTreeHasher {
+ public:
+  static const size_t kDigestSize = Hash::kDigestSize;
+
+  // Writes kDigestSize bytes to |digest|.
+  static void HashLeaf(const void* data, size_t length, char* digest) {
+    const unsigned char prefix(0x00);
+    typename Hash::Context ctx;
+    Hash::Init(&ctx);
+    Hash::Update(&ctx, &prefix, 1);
+    Hash::Update(&ctx, data, length);
+    Hash::Final(&ctx, reinterpret_cast<unsigned char*>(digest));
+  }
+
+  // |left| and |right| are kDigestSize bytes each, and |parent| may
+  // alias either.
+  static void HashChildren(const char* left, const char* right,
+                           char* parent) {
+    unsigned char input[1 + 2 * kDigestSize];
+    input[0] = 0x01;
+    memcpy(input + 1, left, kDigestSize);
+    memcpy(input + 1 + kDigestSize, right, kDigestSize);
+    typename Hash::Context ctx;
+    Hash::Init(&ctx);
+    Hash::Update(&ctx, input, sizeof(input));
+    Hash::Final(&ctx, reinterpret_cast<unsigned char*>(parent));
+  }
+};
+
+
+typedef BasicTreeHasher<Sha256> Sha256TreeHasher;
+
+
+// As above, for any SerialHasher. With a Sha256Hasher, which is what
+// all the trees of the log use, the hashing is done by a
+// Sha256TreeHasher instead, without taking the lock.
 class TreeHasher {
  public:
   // Takes ownership of the SerialHasher.
@@ -24,15 +95,44 @@ class TreeHasher {
 
   std::string HashLeaf(const std::string& data) const;
 
+  // Hash each element of |data| as a leaf. The work is split into
+  // batches run on |executor|, each with its own hasher, and this
+  // blocks until all of them are done, so it must not be called from
+  // one of |executor|'s own threads. If |executor| is NULL, or there is
+  // not enough data to be worth it, hash on the calling thread.
+  std::vector<std::string> HashLeaves(const std::vector<std::string>& data,
+                                      util::Executor* executor) const;
+
   // Accepts arbitrary strings as children. When hashing digests, it
   // is the responsibility of the caller to ensure the inputs are of
   // correct size.
   std::string HashChildren(const std::string& left_child,
                            const std::string& right_child) const;
 
+  // As above, for fixed-size digests, writing the parent into |parent|
+  // (which may alias either child). The hasher must produce
+  // Digest::kSize byte digests.
+  void HashChildren(const cert_trans::Digest& left_child,
+                    const cert_trans::Digest& right_child,
+                    cert_trans::Digest* parent) const;
+
+  // Hash each consecutive pair of nodes in |children|, a concatenation
+  // of an even number of DigestSize()-byte nodes, and return the
+  // concatenated parents. Equivalent to calling HashChildren() on each
+  // pair, without the per-pair locking and copying. As with
+  // HashLeaves(), large batches are split across |executor| if it is
+  // not NULL, but the calling thread hashes some of them too, so it
+  // can be one of |executor|'s threads.
+  std::string HashChildrenBatch(const std::string& children,
+                                util::Executor* executor) const;
+
  private:
   mutable std::mutex lock_;
   const std::unique_ptr<SerialHasher> hasher_;
+  // Whether |hasher_| is a Sha256Hasher.
+  const bool sha256_;
+  // Reused by the digest HashChildren(), guarded by |lock_|.
+  mutable std::string node_input_;
   // The pre-computed hash of an empty tree.
   const std::string empty_hash_;
 
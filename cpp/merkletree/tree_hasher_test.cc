@@ -2,9 +2,12 @@
 #include <stddef.h>
 #include <string>
 
+#include "base/notification.h"
+#include "merkletree/digest.h"
 #include "merkletree/serial_hasher.h"
 #include "merkletree/tree_hasher.h"
 #include "util/testing.h"
+#include "util/thread_pool.h"
 #include "util/util.h"
 
 namespace {
@@ -56,6 +59,35 @@ TestVector test_sha256 = {sha256_empty_hash, sha256_leaves, sha256_nodes};
 // The reverse
 #define H(t) util::HexString(t)
 
+// SHA-256 behind a SerialHasher that TreeHasher does not recognize,
+// so that it is hashed through the virtual calls rather than with a
+// Sha256TreeHasher.
+class OpaqueSha256Hasher : public SerialHasher {
+ public:
+  size_t DigestSize() const override {
+    return hasher_.DigestSize();
+  }
+
+  void Reset() override {
+    hasher_.Reset();
+  }
+
+  void Update(const string& data) override {
+    hasher_.Update(data);
+  }
+
+  string Final() override {
+    return hasher_.Final();
+  }
+
+  SerialHasher* Create() const override {
+    return new OpaqueSha256Hasher;
+  }
+
+ private:
+  Sha256Hasher hasher_;
+};
+
 template <class T>
 TestVector* TestVectors();
 
@@ -64,6 +96,11 @@ TestVector* TestVectors<Sha256Hasher>() {
   return &test_sha256;
 }
 
+template <>
+TestVector* TestVectors<OpaqueSha256Hasher>() {
+  return &test_sha256;
+}
+
 template <class T>
 class TreeHasherTest : public ::testing::Test {
  protected:
@@ -73,7 +110,7 @@ class TreeHasherTest : public ::testing::Test {
   }
 };
 
-typedef ::testing::Types<Sha256Hasher> Hashers;
+typedef ::testing::Types<Sha256Hasher, OpaqueSha256Hasher> Hashers;
 
 TYPED_TEST_CASE(TreeHasherTest, Hashers);
 
@@ -147,6 +184,71 @@ TYPED_TEST(TreeHasherTest, TestVectors) {
   }
 }
 
+TYPED_TEST(TreeHasherTest, HashChildrenBatch) {
+  EXPECT_EQ("", this->tree_hasher_.HashChildrenBatch("", nullptr));
+
+  string children, parents;
+  for (int i = 0; i < 10; i += 2) {
+    const string left(this->tree_hasher_.HashLeaf(string(1, i)));
+    const string right(this->tree_hasher_.HashLeaf(string(1, i + 1)));
+    children += left + right;
+    parents += this->tree_hasher_.HashChildren(left, right);
+  }
+  EXPECT_EQ(H(parents),
+            H(this->tree_hasher_.HashChildrenBatch(children, nullptr)));
+}
+
+TYPED_TEST(TreeHasherTest, HashChildrenBatchInParallel) {
+  string children;
+  for (int i = 0; i < 5000; ++i) {
+    children += this->tree_hasher_.HashLeaf(std::to_string(i));
+  }
+  cert_trans::ThreadPool pool(4);
+  EXPECT_EQ(H(this->tree_hasher_.HashChildrenBatch(children, nullptr)),
+            H(this->tree_hasher_.HashChildrenBatch(children, &pool)));
+}
+
+TYPED_TEST(TreeHasherTest, HashChildrenBatchOnTheExecutor) {
+  string children;
+  for (int i = 0; i < 5000; ++i) {
+    children += this->tree_hasher_.HashLeaf(std::to_string(i));
+  }
+  // Its only thread is busy hashing, so the batches it adds can't run.
+  cert_trans::ThreadPool pool(1);
+  cert_trans::Notification done;
+  string parents;
+  pool.Add([this, &children, &pool, &parents, &done]() {
+    parents = this->tree_hasher_.HashChildrenBatch(children, &pool);
+    done.Notify();
+  });
+  done.WaitForNotification();
+  EXPECT_EQ(H(this->tree_hasher_.HashChildrenBatch(children, nullptr)),
+            H(parents));
+}
+
+TYPED_TEST(TreeHasherTest, HashChildrenDigests) {
+  const string left(this->tree_hasher_.HashLeaf("left"));
+  const string right(this->tree_hasher_.HashLeaf("right"));
+  const cert_trans::Digest left_digest(left);
+  cert_trans::Digest parent(right);
+  this->tree_hasher_.HashChildren(left_digest, parent, &parent);
+  EXPECT_EQ(H(this->tree_hasher_.HashChildren(left, right)),
+            H(parent.ToString()));
+}
+
+TEST(Sha256TreeHasherTest, MatchesTreeHasher) {
+  TreeHasher generic(new OpaqueSha256Hasher);
+  const string data("some leaf data");
+  string leaf(Sha256TreeHasher::kDigestSize, '\0');
+  Sha256TreeHasher::HashLeaf(data.data(), data.size(), &leaf[0]);
+  EXPECT_EQ(H(generic.HashLeaf(data)), H(leaf));
+
+  const string other(generic.HashLeaf("other leaf data"));
+  string parent(Sha256TreeHasher::kDigestSize, '\0');
+  Sha256TreeHasher::HashChildren(leaf.data(), other.data(), &parent[0]);
+  EXPECT_EQ(H(generic.HashChildren(leaf, other)), H(parent));
+}
+
 #undef S
 #undef H
 
@@ -23,6 +23,35 @@ Database::WriteResult Database::CreateEntry(
   return CreateEntry_(leaf, leaf_hash, cert, cert_chain);
 }
 
+Database::WriteResult Database::CreateEntries(
+    const std::vector<cert_trans::LoggedCertificate>& logged,
+    util::Executor* executor) {
+  std::vector<std::string> leaves(logged.size());
+  for (size_t i = 0; i < logged.size(); ++i) {
+    if (!logged[i].SerializeForLeaf(&leaves[i]))
+      return this->SERIALIZE_FAILED;
+  }
+
+  TreeHasher hasher(new Sha256Hasher);
+  const std::vector<std::string> leaf_hashes(
+      hasher.HashLeaves(leaves, executor));
+
+  for (size_t i = 0; i < logged.size(); ++i) {
+    std::string cert = Serializer::LeafCertificate(logged[i].entry());
+
+    std::string cert_chain;
+    if (!logged[i].SerializeExtraData(&cert_chain))
+      return this->SERIALIZE_FAILED;
+
+    const WriteResult result(
+        CreateEntry_(leaves[i], leaf_hashes[i], cert, cert_chain));
+    if (result != this->WRITE_OK)
+      return result;
+  }
+
+  return this->WRITE_OK;
+}
+
 Database::WriteResult Database::WriteSTH(const ct::SignedTreeHead& sth) {
   CHECK(sth.has_timestamp());
   CHECK(sth.has_tree_size());
@@ -39,4 +68,17 @@ Database::WriteResult Database::SetVerificationLevel(
   return SetVerificationLevel_(sth, verify_level);
 }
 
+Database::WriteResult Database::WriteFrontier(
+    int64_t tree_size, const std::string& root_hash,
+    const std::vector<std::string>& frontier) {
+  CHECK_GE(tree_size, 0);
+  std::string nodes;
+  for (const auto& node : frontier) {
+    CHECK_EQ(node.size(), root_hash.size());
+    nodes.append(node);
+  }
+
+  return WriteFrontier_(tree_size, root_hash, nodes);
+}
+
 }  // namespace monitor
@@ -3,10 +3,16 @@
 
 #include <glog/logging.h>
 #include <stdint.h>
+#include <string>
+#include <vector>
 
 #include "base/macros.h"
 #include "log/logged_certificate.h"
 
+namespace util {
+class Executor;
+}  // namespace util
+
 namespace monitor {
 
 class Database {
@@ -74,6 +80,13 @@ class Database {
   // RFC compliant get-entries response from the log server.
   WriteResult CreateEntry(const cert_trans::LoggedCertificate& logged);
 
+  // Like CreateEntry() for each of |logged|, in order, with the leaves
+  // hashed on |executor| (which may be NULL). Stops at the first
+  // failure.
+  WriteResult CreateEntries(
+      const std::vector<cert_trans::LoggedCertificate>& logged,
+      util::Executor* executor);
+
   virtual WriteResult WriteSTH(const ct::SignedTreeHead& sth);
 
   // Lookup latest *written* STH (i.e. not necessarily latest timestamp).
@@ -92,6 +105,18 @@ class Database {
   virtual LookupResult LookupVerificationLevel(
       const ct::SignedTreeHead& sth, VerificationLevel* result) const = 0;
 
+  // Records the frontier (see CompactMerkleTree::Frontier()) of the
+  // confirmed tree of |tree_size| leaves and root |root_hash|, so that
+  // later trees can be confirmed from it with the new leaves only.
+  WriteResult WriteFrontier(int64_t tree_size, const std::string& root_hash,
+                            const std::vector<std::string>& frontier);
+
+  // Lookup the frontier of the largest tree recorded with at most
+  // |max_tree_size| leaves.
+  virtual LookupResult LookupLatestFrontier(
+      int64_t max_tree_size, int64_t* tree_size, std::string* root_hash,
+      std::vector<std::string>* frontier) const = 0;
+
  private:
   virtual WriteResult CreateEntry_(const std::string& leaf,
                                    const std::string& leaf_hash,
@@ -104,6 +129,11 @@ class Database {
   virtual WriteResult SetVerificationLevel_(
       const ct::SignedTreeHead& sth, VerificationLevel verify_level) = 0;
 
+  // |frontier| is the concatenation of the frontier nodes.
+  virtual WriteResult WriteFrontier_(int64_t tree_size,
+                                     const std::string& root_hash,
+                                     const std::string& frontier) = 0;
+
   DISALLOW_COPY_AND_ASSIGN(Database);
 };
 
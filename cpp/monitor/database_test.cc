@@ -2,6 +2,7 @@
 
 #include <gtest/gtest.h>
 #include <set>
+#include <vector>
 
 #include "log/test_signer.h"
 #include "monitor/test_db.h"
@@ -30,7 +31,7 @@ class DBTest : public ::testing::Test {
   TestSigner test_signer_;
 };
 
-typedef testing::Types<monitor::SQLiteDB> Databases;
+typedef testing::Types<monitor::SQLiteDB, monitor::LevelDB> Databases;
 
 typedef monitor::Database DB;
 
@@ -140,6 +141,61 @@ TYPED_TEST(DBTest, DenyUndefinedVerificationLevel) {
             this->db()->SetVerificationLevel(sth, DB::UNDEFINED));
 }
 
+TYPED_TEST(DBTest, WriteAndLookupFrontiers) {
+  int64_t tree_size;
+  string root_hash;
+  std::vector<string> frontier;
+  EXPECT_EQ(DB::NOT_FOUND,
+            this->db()->LookupLatestFrontier(10, &tree_size, &root_hash,
+                                             &frontier));
+
+  const string root3(32, 'r');
+  const std::vector<string> frontier3{string(32, 'a'), string(32, 'b')};
+  const string root5(32, 's');
+  const std::vector<string> frontier5{string(32, 'c'), string(32, 'd')};
+  EXPECT_EQ(DB::WRITE_OK, this->db()->WriteFrontier(3, root3, frontier3));
+  EXPECT_EQ(DB::WRITE_OK, this->db()->WriteFrontier(5, root5, frontier5));
+
+  EXPECT_EQ(DB::NOT_FOUND,
+            this->db()->LookupLatestFrontier(2, &tree_size, &root_hash,
+                                             &frontier));
+
+  EXPECT_EQ(DB::LOOKUP_OK,
+            this->db()->LookupLatestFrontier(4, &tree_size, &root_hash,
+                                             &frontier));
+  EXPECT_EQ(3, tree_size);
+  EXPECT_EQ(root3, root_hash);
+  EXPECT_EQ(frontier3, frontier);
+
+  EXPECT_EQ(DB::LOOKUP_OK,
+            this->db()->LookupLatestFrontier(100, &tree_size, &root_hash,
+                                             &frontier));
+  EXPECT_EQ(5, tree_size);
+  EXPECT_EQ(root5, root_hash);
+  EXPECT_EQ(frontier5, frontier);
+}
+
+TYPED_TEST(DBTest, EntriesInTransaction) {
+  LoggedCertificate logged, logged2;
+  this->test_signer_.CreateUnique(&logged);
+  this->test_signer_.CreateUnique(&logged2);
+
+  this->db()->BeginTransaction();
+  EXPECT_EQ(DB::WRITE_OK, this->db()->CreateEntry(logged));
+  EXPECT_EQ(DB::WRITE_OK, this->db()->CreateEntry(logged2));
+  this->db()->EndTransaction();
+
+  string leaf, leaf2, res;
+  logged.SerializeForLeaf(&leaf);
+  logged2.SerializeForLeaf(&leaf2);
+  TreeHasher hasher(new Sha256Hasher);
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupHashByIndex(1, &res));
+  EXPECT_EQ(hasher.HashLeaf(leaf), res);
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupHashByIndex(2, &res));
+  EXPECT_EQ(hasher.HashLeaf(leaf2), res);
+  EXPECT_EQ(DB::NOT_FOUND, this->db()->LookupHashByIndex(3, &res));
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
@@ -0,0 +1,304 @@
+#include "monitor/leveldb_db.h"
+
+#include <glog/logging.h>
+#include <leveldb/db.h>
+#include <leveldb/write_batch.h>
+#include <string.h>
+
+#include "proto/ct.pb.h"
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace monitor {
+
+namespace {
+
+
+const char kEntryPrefix[] = "entry-";
+const char kHashPrefix[] = "hash-";
+const char kTreeHeadPrefix[] = "sth-";
+const char kVerificationLevelPrefix[] = "level-";
+const char kFrontierPrefix[] = "frontier-";
+const char kLatestTreeHeadKey[] = "meta-latest_sth";
+
+// Fields of a value are each preceded by their length.
+const size_t kLengthBytes = 4;
+
+
+// Keeps the keys with the same prefix sorted numerically.
+string IndexToHex(int64_t index) {
+  CHECK_GE(index, 0);
+  const char nibble[] = "0123456789abcdef";
+  string index_str(sizeof(index) * 2, nibble[0]);
+  for (int i = sizeof(index) * 2; i > 0 && index > 0; --i) {
+    index_str[i - 1] = nibble[index & 0xf];
+    index = index >> 4;
+  }
+
+  return index_str;
+}
+
+
+int64_t HexToIndex(const leveldb::Slice& hex) {
+  CHECK_EQ(hex.size(), sizeof(int64_t) * 2);
+  int64_t index(0);
+  for (size_t i = 0; i < hex.size(); ++i) {
+    const char c(hex[i]);
+    CHECK((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'));
+    index = (index << 4) | (c <= '9' ? c - '0' : c - 'a' + 10);
+  }
+  return index;
+}
+
+
+void AppendField(const string& field, string* value) {
+  CHECK_LE(field.size(), 0xffffffffUL);
+  for (int shift = (kLengthBytes - 1) * 8; shift >= 0; shift -= 8) {
+    value->push_back(static_cast<char>(field.size() >> shift));
+  }
+  value->append(field);
+}
+
+
+bool ReadField(leveldb::Slice* value, string* field) {
+  if (value->size() < kLengthBytes) {
+    return false;
+  }
+  size_t length(0);
+  for (size_t i = 0; i < kLengthBytes; ++i) {
+    length = (length << 8) | static_cast<unsigned char>((*value)[i]);
+  }
+  value->remove_prefix(kLengthBytes);
+  if (value->size() < length) {
+    return false;
+  }
+  field->assign(value->data(), length);
+  value->remove_prefix(length);
+  return true;
+}
+
+
+}  // namespace
+
+LevelDB::LevelDB(const string& dbfile) : next_sequence_number_(1) {
+  leveldb::Options options;
+  options.create_if_missing = true;
+  leveldb::DB* db;
+  const leveldb::Status status(leveldb::DB::Open(options, dbfile, &db));
+  CHECK(status.ok()) << "Could not open " << dbfile << ": "
+                     << status.ToString();
+  db_.reset(db);
+
+  // Carry on after the last entry.
+  unique_ptr<leveldb::Iterator> it(db_->NewIterator(leveldb::ReadOptions()));
+  it->Seek(string(kHashPrefix) + "~");
+  if (it->Valid()) {
+    it->Prev();
+  } else {
+    it->SeekToLast();
+  }
+  if (it->Valid() && it->key().starts_with(kHashPrefix)) {
+    leveldb::Slice key(it->key());
+    key.remove_prefix(strlen(kHashPrefix));
+    next_sequence_number_ = HexToIndex(key) + 1;
+  }
+  CHECK(it->status().ok()) << it->status().ToString();
+
+  LOG(INFO) << "LevelDB database opened in " << dbfile << " with "
+            << next_sequence_number_ - 1 << " entries";
+}
+
+LevelDB::~LevelDB() {
+  CHECK(!transaction_) << "Transaction still open";
+}
+
+void LevelDB::BeginTransaction() {
+  CHECK(!transaction_) << "Transactions don't nest";
+  transaction_.reset(new leveldb::WriteBatch);
+}
+
+void LevelDB::EndTransaction() {
+  CHECK(transaction_) << "No transaction to end";
+  const leveldb::Status status(
+      db_->Write(leveldb::WriteOptions(), transaction_.get()));
+  CHECK(status.ok()) << status.ToString();
+  transaction_.reset();
+}
+
+bool LevelDB::Put(const string& key, const string& value) {
+  if (transaction_) {
+    transaction_->Put(key, value);
+    return true;
+  }
+
+  const leveldb::Status status(db_->Put(leveldb::WriteOptions(), key, value));
+  LOG_IF(WARNING, !status.ok()) << "Writing " << key
+                                << " failed: " << status.ToString();
+  return status.ok();
+}
+
+bool LevelDB::Get(const string& key, string* value) const {
+  const leveldb::Status status(
+      db_->Get(leveldb::ReadOptions(), key, value));
+  if (status.IsNotFound()) {
+    return false;
+  }
+  CHECK(status.ok()) << "Reading " << key << " failed: " << status.ToString();
+  return true;
+}
+
+LevelDB::WriteResult LevelDB::CreateEntry_(const string& leaf,
+                                           const string& leaf_hash,
+                                           const string& cert,
+                                           const string& cert_chain) {
+  const string index(IndexToHex(next_sequence_number_));
+  string entry;
+  AppendField(leaf, &entry);
+  AppendField(cert, &entry);
+  AppendField(cert_chain, &entry);
+
+  // The hash keys determine the next sequence number when reopening,
+  // so the hash goes in after the entry.
+  if (!Put(kEntryPrefix + index, entry) ||
+      !Put(kHashPrefix + index, leaf_hash)) {
+    return this->WRITE_FAILED;
+  }
+  ++next_sequence_number_;
+
+  return this->WRITE_OK;
+}
+
+LevelDB::WriteResult LevelDB::WriteSTH_(uint64_t timestamp, int64_t tree_size,
+                                        const string& sth) {
+  CHECK_GE(tree_size, 0);
+  const string key(kTreeHeadPrefix + IndexToHex(timestamp));
+  string existing;
+  if (Get(key, &existing)) {
+    return this->DUPLICATE_TIMESTAMP;
+  }
+
+  if (!Put(key, sth) || !Put(kLatestTreeHeadKey, sth)) {
+    return this->WRITE_FAILED;
+  }
+
+  return this->WRITE_OK;
+}
+
+LevelDB::LookupResult LevelDB::LookupLatestWrittenSTH(
+    ct::SignedTreeHead* result) const {
+  string sth;
+  if (!Get(kLatestTreeHeadKey, &sth)) {
+    return this->NOT_FOUND;
+  }
+
+  CHECK(result->ParseFromString(sth));
+  return this->LOOKUP_OK;
+}
+
+LevelDB::LookupResult LevelDB::LookupHashByIndex(int64_t sequence_number,
+                                                 string* result) const {
+  if (sequence_number < 1 ||
+      !Get(kHashPrefix + IndexToHex(sequence_number), result)) {
+    return this->NOT_FOUND;
+  }
+
+  return this->LOOKUP_OK;
+}
+
+LevelDB::WriteResult LevelDB::SetVerificationLevel_(
+    const ct::SignedTreeHead& sth, LevelDB::VerificationLevel verify_level) {
+  const string timestamp(IndexToHex(sth.timestamp()));
+  string existing;
+  CHECK(Get(kTreeHeadPrefix + timestamp, &existing))
+      << "No STH with timestamp " << sth.timestamp();
+
+  if (!Put(kVerificationLevelPrefix + timestamp,
+           std::to_string(verify_level))) {
+    return this->WRITE_FAILED;
+  }
+
+  return this->WRITE_OK;
+}
+
+LevelDB::LookupResult LevelDB::LookupSTHByTimestamp(
+    uint64_t timestamp, ct::SignedTreeHead* result) const {
+  string sth;
+  if (!Get(kTreeHeadPrefix + IndexToHex(timestamp), &sth)) {
+    return this->NOT_FOUND;
+  }
+
+  result->ParseFromString(sth);
+  return this->LOOKUP_OK;
+}
+
+LevelDB::LookupResult LevelDB::LookupVerificationLevel(
+    const ct::SignedTreeHead& sth, LevelDB::VerificationLevel* result) const {
+  const string timestamp(IndexToHex(sth.timestamp()));
+  string value;
+  if (!Get(kTreeHeadPrefix + timestamp, &value)) {
+    return this->NOT_FOUND;
+  }
+
+  *result = Get(kVerificationLevelPrefix + timestamp, &value)
+                ? LevelDB::VerificationLevel(std::stoi(value))
+                : this->UNDEFINED;
+  return this->LOOKUP_OK;
+}
+
+LevelDB::WriteResult LevelDB::WriteFrontier_(int64_t tree_size,
+                                             const string& root_hash,
+                                             const string& frontier) {
+  string value;
+  AppendField(root_hash, &value);
+  AppendField(frontier, &value);
+
+  if (!Put(kFrontierPrefix + IndexToHex(tree_size), value)) {
+    return this->WRITE_FAILED;
+  }
+
+  return this->WRITE_OK;
+}
+
+LevelDB::LookupResult LevelDB::LookupLatestFrontier(
+    int64_t max_tree_size, int64_t* tree_size, string* root_hash,
+    vector<string>* frontier) const {
+  CHECK_GE(max_tree_size, 0);
+  unique_ptr<leveldb::Iterator> it(db_->NewIterator(leveldb::ReadOptions()));
+
+  // Find the last frontier at or before |max_tree_size|.
+  const string max_key(kFrontierPrefix + IndexToHex(max_tree_size));
+  it->Seek(max_key);
+  if (!it->Valid()) {
+    it->SeekToLast();
+  } else if (it->key() != max_key) {
+    it->Prev();
+  }
+  CHECK(it->status().ok()) << it->status().ToString();
+  if (!it->Valid() || !it->key().starts_with(kFrontierPrefix)) {
+    return this->NOT_FOUND;
+  }
+
+  leveldb::Slice key(it->key());
+  key.remove_prefix(strlen(kFrontierPrefix));
+  *tree_size = HexToIndex(key);
+
+  leveldb::Slice value(it->value());
+  string nodes;
+  CHECK(ReadField(&value, root_hash) && ReadField(&value, &nodes) &&
+        value.empty())
+      << "Corrupt frontier for tree size " << *tree_size;
+
+  // All the nodes are hashes, the same size as the root.
+  frontier->clear();
+  CHECK(!root_hash->empty());
+  CHECK_EQ(nodes.size() % root_hash->size(), 0U);
+  for (size_t pos = 0; pos < nodes.size(); pos += root_hash->size()) {
+    frontier->push_back(nodes.substr(pos, root_hash->size()));
+  }
+
+  return this->LOOKUP_OK;
+}
+
+}  // namespace monitor
@@ -0,0 +1,87 @@
+#ifndef MONITOR_LEVELDB_DB_H
+#define MONITOR_LEVELDB_DB_H
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "monitor/database.h"
+
+namespace leveldb {
+class DB;
+class WriteBatch;
+}  // namespace leveldb
+
+namespace monitor {
+
+// A Database in LevelDB, which scales to large logs much better than
+// SQLiteDB: the leaf hashes needed to confirm trees are kept apart from
+// the certificates, in sequence order, so that confirming a tree is a
+// sequential scan.
+class LevelDB : public Database {
+ public:
+  explicit LevelDB(const std::string& dbfile);
+
+  ~LevelDB();
+
+  typedef Database::WriteResult WriteResult;
+  typedef Database::LookupResult LookupResult;
+  typedef Database::VerificationLevel VerificationLevel;
+
+  // The writes until EndTransaction() are applied atomically, and are
+  // not visible until then.
+  void BeginTransaction();
+
+  void EndTransaction();
+
+  virtual LookupResult LookupLatestWrittenSTH(
+      ct::SignedTreeHead* result) const;
+
+  virtual LookupResult LookupHashByIndex(int64_t sequence_number,
+                                         std::string* result) const;
+
+  virtual LookupResult LookupSTHByTimestamp(uint64_t timestamp,
+                                            ct::SignedTreeHead* result) const;
+
+  virtual LookupResult LookupVerificationLevel(
+      const ct::SignedTreeHead& sth, VerificationLevel* result) const;
+
+  virtual LookupResult LookupLatestFrontier(
+      int64_t max_tree_size, int64_t* tree_size, std::string* root_hash,
+      std::vector<std::string>* frontier) const;
+
+ private:
+  virtual WriteResult CreateEntry_(const std::string& leaf,
+                                   const std::string& leaf_hash,
+                                   const std::string& cert,
+                                   const std::string& cert_chain);
+
+  virtual WriteResult WriteSTH_(uint64_t timestamp, int64_t tree_size,
+                                const std::string& sth);
+
+  virtual WriteResult SetVerificationLevel_(const ct::SignedTreeHead& sth,
+                                            VerificationLevel verify_level);
+
+  virtual WriteResult WriteFrontier_(int64_t tree_size,
+                                     const std::string& root_hash,
+                                     const std::string& frontier);
+
+  // Puts |key| in the current transaction, or straight into the
+  // database if there is none.
+  bool Put(const std::string& key, const std::string& value);
+
+  bool Get(const std::string& key, std::string* value) const;
+
+  std::unique_ptr<leveldb::DB> db_;
+  std::unique_ptr<leveldb::WriteBatch> transaction_;
+  // Like the AUTOINCREMENT of SQLiteDB, the first entry is 1.
+  int64_t next_sequence_number_;
+
+  DISALLOW_COPY_AND_ASSIGN(LevelDB);
+};
+
+}  // namespace monitor
+
+#endif  // MONITOR_LEVELDB_DB_H
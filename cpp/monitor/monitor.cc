@@ -1,22 +1,40 @@
 #include "monitor/monitor.h"
 
+#include <functional>
+#include <gflags/gflags.h>
+#include <memory>
+#include <vector>
+
 #include "client/http_log_client.h"
 #include "log/log_verifier.h"
-#include "merkletree/merkle_tree.h"
+#include "merkletree/compact_merkle_tree.h"
+#include "merkletree/merkle_verifier.h"
+#include "merkletree/serial_hasher.h"
 #include "monitor/database.h"
 
 using cert_trans::AsyncLogClient;
 using cert_trans::HTTPLogClient;
+using std::bind;
+using std::placeholders::_1;
+using std::placeholders::_2;
 using std::string;
 
+DEFINE_int32(monitor_get_entries_batch_size, 1000,
+             "Number of entries the monitor asks for in each get-entries "
+             "request.");
+
 namespace monitor {
 
 Monitor::Monitor(Database* database, LogVerifier* log_verifier,
-                 HTTPLogClient* client, uint64_t sleep_time_sec)
+                 HTTPLogClient* client, uint64_t sleep_time_sec,
+                 util::Executor* hash_executor)
     : db_(CHECK_NOTNULL(database)),
       verifier_(CHECK_NOTNULL(log_verifier)),
       client_(CHECK_NOTNULL(client)),
-      sleep_time_(sleep_time_sec) {
+      sleep_time_(sleep_time_sec),
+      hash_pool_(hash_executor ? nullptr : new cert_trans::ThreadPool),
+      hash_executor_(hash_executor ? hash_executor : hash_pool_.get()),
+      tree_size_(0) {
 }
 
 Monitor::GetResult Monitor::GetSTH() {
@@ -151,35 +169,35 @@ Monitor::GetResult Monitor::GetEntries(int get_first, int get_last) {
   CHECK(get_first >= 0);
   CHECK(get_last >= get_first);
 
-  std::vector<AsyncLogClient::Entry> entries;
-  int dload_count = 0;
-  do {
-    // If the server does not impose a limit, all entries from get_first to
-    // get_last will be downloaded at once (could exceed memory).
-    AsyncLogClient::Status error =
-        client_->GetEntries(get_first + dload_count, get_last, &entries);
-
-    if (error != AsyncLogClient::OK) {
-      LOG(ERROR) << "HTTPLogClient returned with error " << error
-                 << ". No entries have been written to the database.";
-      return NETWORK_PROBLEM;
-    }
+  // Batches are written as they arrive, in order, while the requests for
+  // the following ones are still outstanding.
+  const AsyncLogClient::Status error(client_->GetEntriesPipelined(
+      get_first, get_last, FLAGS_monitor_get_entries_batch_size,
+      bind(&Monitor::WriteEntries, this, _1, _2)));
 
-    LOG(INFO) << "Writing entries from " << get_first + dload_count << " to "
-              << get_first + dload_count + entries.size();
-    dload_count += entries.size();
+  if (error != AsyncLogClient::OK) {
+    LOG(ERROR) << "HTTPLogClient returned with error " << error
+               << ". Entries after the last ones written have not been "
+               << "written to the database.";
+    return NETWORK_PROBLEM;
+  }
+  return OK;
+}
 
-    db_->BeginTransaction();
-    for (size_t i = 0; i < entries.size(); i++) {
-      cert_trans::LoggedCertificate logged;
-      CHECK(logged.CopyFromClientLogEntry(entries.at(i)));
-      CHECK_EQ(db_->CreateEntry(logged), Database::WRITE_OK);
-    }
-    entries.clear();
-    db_->EndTransaction();
+void Monitor::WriteEntries(int first,
+                           std::vector<AsyncLogClient::Entry>* entries) {
+  LOG(INFO) << "Writing entries from " << first << " to "
+            << first + entries->size();
 
-  } while (dload_count + get_first <= get_last);
-  return OK;
+  std::vector<cert_trans::LoggedCertificate> logged(entries->size());
+  for (size_t i = 0; i < entries->size(); i++) {
+    CHECK(logged[i].CopyFromClientLogEntry(entries->at(i)));
+  }
+  entries->clear();
+
+  db_->BeginTransaction();
+  CHECK_EQ(db_->CreateEntries(logged, hash_executor_), Database::WRITE_OK);
+  db_->EndTransaction();
 }
 
 Monitor::ConfirmResult Monitor::ConfirmTree(uint64_t timestamp) {
@@ -199,29 +217,51 @@ Monitor::ConfirmResult Monitor::ConfirmTreeInternal() {
 
 Monitor::ConfirmResult Monitor::ConfirmTreeInternal(
     const ct::SignedTreeHead& sth) {
-  MerkleTree mt(new Sha256Hasher);
-
   Database::VerificationLevel lvl;
   CHECK_EQ(db_->LookupVerificationLevel(sth, &lvl), Database::LOOKUP_OK);
   CHECK_EQ(lvl, Database::SIGNATURE_VERIFIED);
 
+  // Start from the largest tree confirmed so far, if any, so that only the
+  // leaves added since have to be hashed.
+  std::unique_ptr<CompactMerkleTree> tree;
+  int64_t frontier_size;
+  std::string frontier_root;
+  std::vector<std::string> frontier;
+  std::vector<std::string> proof;
+  std::unique_ptr<HTTPLogClient::Request> proof_request;
+  if (db_->LookupLatestFrontier(sth.tree_size(), &frontier_size,
+                                &frontier_root, &frontier) ==
+      Database::LOOKUP_OK) {
+    tree.reset(
+        new CompactMerkleTree(frontier_size, frontier, new Sha256Hasher));
+    CHECK_EQ(tree->CurrentRoot(), frontier_root);
+    // Fetched while the new leaves are hashed.
+    if (frontier_size > 0 && frontier_size < sth.tree_size()) {
+      proof_request = client_->StartGetSTHConsistency(frontier_size,
+                                                      sth.tree_size(), &proof);
+    }
+  } else {
+    tree.reset(new CompactMerkleTree(new Sha256Hasher));
+  }
+
   std::string hash;
 
-  LOG(INFO) << "Building tree...";
+  LOG(INFO) << "Building tree from " << tree->LeafCount() << " leaves...";
 
-  for (int64_t current = 1; current <= sth.tree_size(); current++) {
+  for (int64_t current = tree->LeafCount() + 1; current <= sth.tree_size();
+       current++) {
     CHECK_EQ(db_->LookupHashByIndex(current, &hash), Database::LOOKUP_OK);
-    mt.AddLeafHash(hash);
+    tree->AddLeafHash(hash);
   }
 
   LOG(INFO) << "merkle tree_size and root_hash:";
-  LOG(INFO) << mt.LeafCount();
-  LOG(INFO) << util::ToBase64(mt.CurrentRoot());
+  LOG(INFO) << tree->LeafCount();
+  LOG(INFO) << util::ToBase64(tree->CurrentRoot());
   LOG(INFO) << "STH tree_size and root_hash:";
   LOG(INFO) << sth.tree_size();
   LOG(INFO) << util::ToBase64(sth.sha256_root_hash());
 
-  if (mt.CurrentRoot() != sth.sha256_root_hash()) {
+  if (tree->CurrentRoot() != sth.sha256_root_hash()) {
     LOG(ERROR) << "Tree confirmation failed - hashes mismatch.";
     CHECK_EQ(db_->SetVerificationLevel(sth,
                                        Database::TREE_CONFIRMATION_FAILED),
@@ -230,6 +270,28 @@ Monitor::ConfirmResult Monitor::ConfirmTreeInternal(
     return TREE_CONFIRMATION_FAILED;
   }
 
+  if (proof_request) {
+    if (proof_request->Wait() != AsyncLogClient::OK) {
+      // The new leaves hashed onto the frontier already show that the STH
+      // extends the confirmed tree, so carry on without the proof.
+      LOG(WARNING) << "Could not get a consistency proof from "
+                   << frontier_size << " to " << sth.tree_size() << ".";
+    } else if (!MerkleVerifier(new Sha256Hasher)
+                    .VerifyConsistency(frontier_size, sth.tree_size(),
+                                       frontier_root, sth.sha256_root_hash(),
+                                       proof)) {
+      LOG(ERROR) << "Tree confirmation failed - bad consistency proof from "
+                 << "the confirmed tree of size " << frontier_size << ".";
+      CHECK_EQ(db_->SetVerificationLevel(sth,
+                                         Database::TREE_CONFIRMATION_FAILED),
+               Database::WRITE_OK);
+      return TREE_CONFIRMATION_FAILED;
+    }
+  }
+
+  CHECK_EQ(db_->WriteFrontier(sth.tree_size(), sth.sha256_root_hash(),
+                              tree->Frontier()),
+           Database::WRITE_OK);
   CHECK_EQ(db_->SetVerificationLevel(sth, Database::TREE_CONFIRMED),
            Database::WRITE_OK);
   LOG(INFO) << "Tree confirmed.";
@@ -278,11 +340,39 @@ void Monitor::Init() {
   ConfirmTreeInternal();
 }
 
-void Monitor::Loop() {
-  ct::SignedTreeHead old_sth;
+bool Monitor::Start() {
+  if (db_->LookupLatestWrittenSTH(&last_sth_) != Database::LOOKUP_OK) {
+    return false;
+  }
+  tree_size_ = last_sth_.tree_size();
+  return true;
+}
+
+void Monitor::Poll() {
+  if (VerifySTHInternal() != SIGNATURE_VALID)
+    return;
+
   ct::SignedTreeHead new_sth;
+  CHECK_EQ(db_->LookupLatestWrittenSTH(&new_sth), Database::LOOKUP_OK);
 
-  if (db_->LookupLatestWrittenSTH(&old_sth), Database::LOOKUP_OK)
+  const CheckResult sanity(CheckSTHSanity(last_sth_, new_sth));
+  if (sanity == SANE) {
+    if (GetEntries(last_sth_.tree_size(), new_sth.tree_size() - 1) != OK) {
+      return;
+    }
+  }
+  if (sanity == REFRESHED || sanity == SANE) {
+    // Go on even the confirmation fails to continue to monitor the log.
+    // Nevertheless the failure is logged and written to the database.
+    ConfirmTreeInternal();
+
+    last_sth_ = new_sth;
+    tree_size_ = last_sth_.tree_size();
+  }
+}
+
+void Monitor::Loop() {
+  if (!Start())
     LOG(FATAL) << "Run init_monitor first.";
 
   while (true) {
@@ -290,25 +380,12 @@ void Monitor::Loop() {
     // TODO(weidner): Better only sleep sleep_time - time_used_in_loop.
     sleep(sleep_time_);
 
-    if (VerifySTHInternal() != SIGNATURE_VALID)
-      continue;
-
-    CHECK_EQ(db_->LookupLatestWrittenSTH(&new_sth), Database::LOOKUP_OK);
-
-    const CheckResult sanity(CheckSTHSanity(old_sth, new_sth));
-    if (sanity == SANE) {
-      if (GetEntries(old_sth.tree_size(), new_sth.tree_size() - 1) != OK) {
-        continue;
-      }
-    }
-    if (sanity == REFRESHED || sanity == SANE) {
-      // Go on even the confirmation fails to continue to monitor the log.
-      // Nevertheless the failure is logged and written to the database.
-      ConfirmTreeInternal();
-
-      old_sth = new_sth;
-    }
+    Poll();
   }
 }
 
+int64_t Monitor::TreeSize() const {
+  return tree_size_;
+}
+
 }  // namespace monitor
@@ -1,20 +1,26 @@
 #ifndef MONITOR_H
 #define MONITOR_H
 
+#include <atomic>
+#include <memory>
 #include <stdint.h>
+#include <vector>
 
 #include "base/macros.h"
+#include "client/async_log_client.h"
+#include "proto/ct.pb.h"
+#include "util/thread_pool.h"
 
 class LogVerifier;
 
-namespace ct {
-class SignedTreeHead;
-}
-
 namespace cert_trans {
 class HTTPLogClient;
 }
 
+namespace util {
+class Executor;
+}
+
 namespace monitor {
 
 class Database;
@@ -39,8 +45,11 @@ class Monitor {
     TREE_CONFIRMATION_FAILED = 1,
   };
 
+  // Leaves are hashed on |hash_executor|, if set, rather than on a pool
+  // of the monitor's own.
   Monitor(Database* database, LogVerifier* verifier,
-          cert_trans::HTTPLogClient* client, uint64_t sleep_time_sec);
+          cert_trans::HTTPLogClient* client, uint64_t sleep_time_sec,
+          util::Executor* hash_executor = nullptr);
 
   GetResult GetSTH();
 
@@ -52,8 +61,20 @@ class Monitor {
 
   void Init();
 
+  // Picks up where the last run left off, returns false if the
+  // database hasn't been initialized yet.
+  bool Start();
+
+  // Checks the log once: fetches and verifies its STH, then downloads
+  // the new entries and confirms the tree. Start() must have succeeded.
+  void Poll();
+
+  // Start(), then Poll() every |sleep_time_sec|, forever.
   void Loop();
 
+  // The tree size of the last STH that Poll() got entries for.
+  int64_t TreeSize() const;
+
  private:
   enum CheckResult {
     EQUAL = 0,
@@ -66,6 +87,14 @@ class Monitor {
   LogVerifier* const verifier_;
   cert_trans::HTTPLogClient* const client_;
   const uint64_t sleep_time_;
+  // Hashes the leaves of downloaded entries, unless another executor
+  // was given.
+  const std::unique_ptr<cert_trans::ThreadPool> hash_pool_;
+  util::Executor* const hash_executor_;
+
+  // The last STH that Poll() got the entries for.
+  ct::SignedTreeHead last_sth_;
+  std::atomic<int64_t> tree_size_;
 
   VerifyResult VerifySTHInternal();
   VerifyResult VerifySTHInternal(const ct::SignedTreeHead& sth);
@@ -83,6 +112,10 @@ class Monitor {
 
   VerifyResult VerifySTHWithInvalidTimestamp(const ct::SignedTreeHead& sth);
 
+  // Writes the downloaded |entries|, the first of which is entry |first|.
+  void WriteEntries(int first,
+                    std::vector<cert_trans::AsyncLogClient::Entry>* entries);
+
   DISALLOW_COPY_AND_ASSIGN(Monitor);
 };
 
@@ -0,0 +1,115 @@
+#include "monitor/multi_monitor.h"
+
+#include <functional>
+#include <glog/logging.h>
+#include <utility>
+
+#include "client/http_log_client.h"
+#include "log/log_verifier.h"
+#include "monitor/database.h"
+#include "monitor/monitor.h"
+#include "monitoring/monitoring.h"
+#include "util/executor.h"
+#include "util/task.h"
+
+using cert_trans::Counter;
+using cert_trans::Gauge;
+using cert_trans::HTTPLogClient;
+using std::bind;
+using std::move;
+using std::placeholders::_1;
+using std::string;
+using std::unique_ptr;
+
+namespace monitor {
+
+namespace {
+
+
+Counter<string>* polls(
+    Counter<string>::New("monitor_polls", "log",
+                         "Number of times each monitored log was polled."));
+
+Gauge<string>* tree_size(
+    Gauge<string>::New("monitor_tree_size", "log",
+                       "Size of the latest tree of each monitored log whose "
+                       "entries have been downloaded."));
+
+
+}  // namespace
+
+
+struct MultiMonitor::Log {
+  Log(const string& name, unique_ptr<Database> db,
+      unique_ptr<LogVerifier> verifier, unique_ptr<HTTPLogClient> client,
+      uint64_t sleep_time_secs, util::Executor* hash_executor)
+      : name(name),
+        db(move(db)),
+        verifier(move(verifier)),
+        client(move(client)),
+        monitor(this->db.get(), this->verifier.get(), this->client.get(),
+                sleep_time_secs, hash_executor) {
+  }
+
+  const string name;
+  const unique_ptr<Database> db;
+  const unique_ptr<LogVerifier> verifier;
+  const unique_ptr<HTTPLogClient> client;
+  Monitor monitor;
+};
+
+
+MultiMonitor::MultiMonitor(util::Executor* executor,
+                           util::Executor* hash_executor,
+                           const std::chrono::seconds& sleep_time)
+    : executor_(CHECK_NOTNULL(executor)),
+      hash_executor_(CHECK_NOTNULL(hash_executor)),
+      sleep_time_(sleep_time) {
+  CHECK_NE(executor_, hash_executor_);
+}
+
+
+MultiMonitor::~MultiMonitor() {
+}
+
+
+void MultiMonitor::AddLog(const string& name, unique_ptr<Database> db,
+                          unique_ptr<LogVerifier> verifier,
+                          unique_ptr<HTTPLogClient> client) {
+  logs_.emplace_back(new Log(name, move(db), move(verifier), move(client),
+                             sleep_time_.count(), hash_executor_));
+  CHECK(logs_.back()->monitor.Start()) << "Run init for the " << name
+                                       << " log first.";
+  tree_size->Set(name, logs_.back()->monitor.TreeSize());
+}
+
+
+void MultiMonitor::Run() {
+  for (const auto& log : logs_) {
+    executor_->Add(bind(&MultiMonitor::Poll, this, log.get()));
+  }
+  stopped_.WaitForNotification();
+}
+
+
+void MultiMonitor::Poll(Log* log) {
+  VLOG(1) << "Polling the " << log->name << " log.";
+  log->monitor.Poll();
+  polls->Increment(log->name);
+  tree_size->Set(log->name, log->monitor.TreeSize());
+
+  executor_->Delay(sleep_time_,
+                   new util::Task(bind(&MultiMonitor::PollDelayDone, this,
+                                       log, _1),
+                                  executor_));
+}
+
+
+void MultiMonitor::PollDelayDone(Log* log, util::Task* task) {
+  CHECK_EQ(util::Status::OK, task->status());
+  delete task;
+  Poll(log);
+}
+
+
+}  // namespace monitor
@@ -0,0 +1,67 @@
+#ifndef MONITOR_MULTI_MONITOR_H
+#define MONITOR_MULTI_MONITOR_H
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "base/notification.h"
+
+class LogVerifier;
+
+namespace cert_trans {
+class HTTPLogClient;
+}  // namespace cert_trans
+
+namespace util {
+class Executor;
+class Task;
+}  // namespace util
+
+namespace monitor {
+
+class Database;
+class Monitor;
+
+// Watches several logs at once. Each log has its own Monitor, which is
+// polled on |executor|, shared by all the logs, every |sleep_time|
+// after its last poll finished. A log that is slow to answer only
+// holds up one of the executor's threads.
+class MultiMonitor {
+ public:
+  // Leaves are hashed on |hash_executor|, which must not be |executor|:
+  // polls wait for the hashing.
+  MultiMonitor(util::Executor* executor, util::Executor* hash_executor,
+               const std::chrono::seconds& sleep_time);
+  ~MultiMonitor();
+
+  // Adds a log, called |name| in the logs and metrics. Its database
+  // must have been initialized (see Monitor::Init()).
+  void AddLog(const std::string& name, std::unique_ptr<Database> db,
+              std::unique_ptr<LogVerifier> verifier,
+              std::unique_ptr<cert_trans::HTTPLogClient> client);
+
+  // Starts polling all the logs, and never returns.
+  void Run();
+
+ private:
+  struct Log;
+
+  void Poll(Log* log);
+  void PollDelayDone(Log* log, util::Task* task);
+
+  util::Executor* const executor_;
+  util::Executor* const hash_executor_;
+  const std::chrono::seconds sleep_time_;
+  std::vector<std::unique_ptr<Log>> logs_;
+  // Never notified, Run() waits on it forever.
+  cert_trans::Notification stopped_;
+
+  DISALLOW_COPY_AND_ASSIGN(MultiMonitor);
+};
+
+}  // namespace monitor
+
+#endif  // MONITOR_MULTI_MONITOR_H
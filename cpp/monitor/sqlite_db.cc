@@ -6,14 +6,35 @@
 #include "log/sqlite_statement.h"
 
 using sqlite::Statement;
+using sqlite::StatementCache;
 using std::string;
+using std::vector;
 
 namespace monitor {
 
+namespace {
+
+
+void CreateFrontiersTable(sqlite3* db) {
+  // Added after the other tables, so existing databases may lack it.
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(db,
+                                   "CREATE TABLE IF NOT EXISTS frontiers("
+                                   "tree_size INTEGER PRIMARY KEY, "
+                                   "root_hash BLOB, "
+                                   "frontier BLOB)",
+                                   NULL, NULL, NULL));
+}
+
+
+}  // namespace
+
 SQLiteDB::SQLiteDB(const string& dbfile) : db_(NULL) {
   int ret = sqlite3_open_v2(dbfile.c_str(), &db_, SQLITE_OPEN_READWRITE, NULL);
-  if (ret == SQLITE_OK)
+  if (ret == SQLITE_OK) {
+    CreateFrontiersTable(db_);
+    statements_.reset(new StatementCache(db_));
     return;
+  }
   CHECK_EQ(SQLITE_CANTOPEN, ret);
 
   // We have to close and reopen to avoid memory leaks.
@@ -46,10 +67,14 @@ SQLiteDB::SQLiteDB(const string& dbfile) : db_(NULL) {
                                    "sth BLOB)",
                                    NULL, NULL, NULL));
 
+  CreateFrontiersTable(db_);
+
   LOG(INFO) << "New SQLite database created in " << dbfile;
+  statements_.reset(new StatementCache(db_));
 }
 
 SQLiteDB::~SQLiteDB() {
+  statements_.reset();
   CHECK_EQ(SQLITE_OK, sqlite3_close(db_));
 }
 
@@ -65,7 +90,7 @@ SQLiteDB::WriteResult SQLiteDB::CreateEntry_(const std::string& leaf,
                                              const std::string& leaf_hash,
                                              const std::string& cert,
                                              const std::string& cert_chain) {
-  Statement statement(db_,
+  Statement statement(statements_.get(),
                       "INSERT INTO leaves(leaf, leaf_hash, cert, cert_chain) "
                       "VALUES(?, ?, ?, ?)");
 
@@ -84,7 +109,7 @@ SQLiteDB::WriteResult SQLiteDB::WriteSTH_(uint64_t timestamp,
                                           int64_t tree_size,
                                           const std::string& sth) {
   CHECK_GE(tree_size, 0);
-  Statement statement(db_,
+  Statement statement(statements_.get(),
                       "INSERT INTO trees(timestamp, tree_size, sth) "
                       "VALUES(?, ?, ?)");
 
@@ -94,7 +119,8 @@ SQLiteDB::WriteResult SQLiteDB::WriteSTH_(uint64_t timestamp,
 
   int ret = statement.Step();
   if (ret == SQLITE_CONSTRAINT) {
-    Statement s2(db_, "SELECT timestamp FROM trees WHERE timestamp = ?");
+    Statement s2(statements_.get(),
+                 "SELECT timestamp FROM trees WHERE timestamp = ?");
     s2.BindUInt64(0, timestamp);
     if (s2.Step() != SQLITE_ROW)
       return this->WRITE_FAILED;
@@ -108,7 +134,7 @@ SQLiteDB::WriteResult SQLiteDB::WriteSTH_(uint64_t timestamp,
 
 SQLiteDB::LookupResult SQLiteDB::LookupLatestWrittenSTH(
     ct::SignedTreeHead* result) const {
-  Statement statement(db_,
+  Statement statement(statements_.get(),
                       "SELECT sth FROM trees WHERE id IN "
                       "(SELECT MAX(id) FROM trees)");
 
@@ -126,7 +152,8 @@ SQLiteDB::LookupResult SQLiteDB::LookupLatestWrittenSTH(
 
 SQLiteDB::LookupResult SQLiteDB::LookupHashByIndex(int64_t sequence_number,
                                                    std::string* result) const {
-  Statement statement(db_, "SELECT leaf_hash FROM leaves WHERE sequence = ?");
+  Statement statement(statements_.get(),
+                      "SELECT leaf_hash FROM leaves WHERE sequence = ?");
 
   statement.BindUInt64(0, sequence_number);
   int ret = statement.Step();
@@ -140,7 +167,8 @@ SQLiteDB::LookupResult SQLiteDB::LookupHashByIndex(int64_t sequence_number,
 
 SQLiteDB::WriteResult SQLiteDB::SetVerificationLevel_(
     const ct::SignedTreeHead& sth, SQLiteDB::VerificationLevel verify_level) {
-  Statement statement(db_, "UPDATE trees SET valid = ? WHERE timestamp = ?");
+  Statement statement(statements_.get(),
+                      "UPDATE trees SET valid = ? WHERE timestamp = ?");
   statement.BindUInt64(0, verify_level);
   statement.BindUInt64(1, sth.timestamp());
 
@@ -153,7 +181,8 @@ SQLiteDB::WriteResult SQLiteDB::SetVerificationLevel_(
 
 SQLiteDB::LookupResult SQLiteDB::LookupSTHByTimestamp(
     uint64_t timestamp, ct::SignedTreeHead* result) const {
-  Statement statement(db_, "SELECT sth FROM trees WHERE timestamp = ?");
+  Statement statement(statements_.get(),
+                      "SELECT sth FROM trees WHERE timestamp = ?");
 
   statement.BindUInt64(0, timestamp);
 
@@ -172,8 +201,9 @@ SQLiteDB::LookupResult SQLiteDB::LookupSTHByTimestamp(
 
 SQLiteDB::LookupResult SQLiteDB::LookupVerificationLevel(
     const ct::SignedTreeHead& sth, SQLiteDB::VerificationLevel* result) const {
-  Statement statement(
-      db_, "SELECT IFNULL(valid, ?) FROM trees WHERE timestamp = ?");
+  Statement statement(statements_.get(),
+                      "SELECT IFNULL(valid, ?) FROM trees "
+                      "WHERE timestamp = ?");
   statement.BindUInt64(0, this->UNDEFINED);
   statement.BindUInt64(1, sth.timestamp());
 
@@ -188,4 +218,49 @@ SQLiteDB::LookupResult SQLiteDB::LookupVerificationLevel(
   return this->LOOKUP_OK;
 }
 
+SQLiteDB::WriteResult SQLiteDB::WriteFrontier_(int64_t tree_size,
+                                               const string& root_hash,
+                                               const string& frontier) {
+  Statement statement(statements_.get(),
+                      "INSERT OR REPLACE INTO frontiers(tree_size, root_hash, "
+                      "frontier) VALUES(?, ?, ?)");
+  statement.BindUInt64(0, tree_size);
+  statement.BindBlob(1, root_hash);
+  statement.BindBlob(2, frontier);
+
+  if (statement.Step() != SQLITE_DONE)
+    return this->WRITE_FAILED;
+
+  return this->WRITE_OK;
+}
+
+SQLiteDB::LookupResult SQLiteDB::LookupLatestFrontier(
+    int64_t max_tree_size, int64_t* tree_size, string* root_hash,
+    vector<string>* frontier) const {
+  Statement statement(statements_.get(),
+                      "SELECT tree_size, root_hash, frontier FROM frontiers "
+                      "WHERE tree_size <= ? ORDER BY tree_size DESC LIMIT 1");
+  statement.BindUInt64(0, max_tree_size);
+
+  int ret = statement.Step();
+  if (ret == SQLITE_DONE)
+    return this->NOT_FOUND;
+
+  CHECK_EQ(SQLITE_ROW, ret);
+  *tree_size = statement.GetUInt64(0);
+  statement.GetBlob(1, root_hash);
+  string nodes;
+  statement.GetBlob(2, &nodes);
+
+  // All the nodes are hashes, the same size as the root.
+  frontier->clear();
+  CHECK(!root_hash->empty());
+  CHECK_EQ(nodes.size() % root_hash->size(), 0U);
+  for (size_t pos = 0; pos < nodes.size(); pos += root_hash->size()) {
+    frontier->push_back(nodes.substr(pos, root_hash->size()));
+  }
+
+  return this->LOOKUP_OK;
+}
+
 }  // namespace monitor
@@ -1,14 +1,20 @@
 #ifndef MONITOR_SQLITE_DB_H
 #define MONITOR_SQLITE_DB_H
 
+#include <memory>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "base/macros.h"
 #include "monitor/database.h"
 
 struct sqlite3;
 
+namespace sqlite {
+class StatementCache;
+}
+
 namespace monitor {
 
 class SQLiteDB : public Database {
@@ -37,6 +43,10 @@ class SQLiteDB : public Database {
   virtual LookupResult LookupVerificationLevel(
       const ct::SignedTreeHead& sth, VerificationLevel* result) const;
 
+  virtual LookupResult LookupLatestFrontier(
+      int64_t max_tree_size, int64_t* tree_size, std::string* root_hash,
+      std::vector<std::string>* frontier) const;
+
  private:
   virtual WriteResult CreateEntry_(const std::string& leaf,
                                    const std::string& leaf_hash,
@@ -49,7 +59,13 @@ class SQLiteDB : public Database {
   virtual WriteResult SetVerificationLevel_(const ct::SignedTreeHead& sth,
                                             VerificationLevel verify_level);
 
+  virtual WriteResult WriteFrontier_(int64_t tree_size,
+                                     const std::string& root_hash,
+                                     const std::string& frontier);
+
   sqlite3* db_;
+  // Created once db_ is open.
+  std::unique_ptr<sqlite::StatementCache> statements_;
 
   DISALLOW_COPY_AND_ASSIGN(SQLiteDB);
 };
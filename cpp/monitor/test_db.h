@@ -1,6 +1,7 @@
 #ifndef MONITOR_TEST_DB_H
 #define MONITOR_TEST_DB_H
 
+#include "monitor/leveldb_db.h"
 #include "monitor/sqlite_db.h"
 #include "util/test_db.h"
 
@@ -14,4 +15,16 @@ monitor::SQLiteDB* TestDB<monitor::SQLiteDB>::SecondDB() {
   return new monitor::SQLiteDB(tmp_.TmpStorageDir() + "/sqlite");
 }
 
+template <>
+void TestDB<monitor::LevelDB>::Setup() {
+  db_.reset(new monitor::LevelDB(tmp_.TmpStorageDir() + "/leveldb"));
+}
+
+template <>
+monitor::LevelDB* TestDB<monitor::LevelDB>::SecondDB() {
+  // LevelDB can only be opened once at a time, the first one has to go.
+  db_.reset();
+  return new monitor::LevelDB(tmp_.TmpStorageDir() + "/leveldb");
+}
+
 #endif  // MONITOR_TEST_DB_H
@@ -17,6 +17,26 @@ namespace cert_trans {
 template <class... LabelTypes>
 class Counter : public Metric {
  public:
+  // The value for one set of labels, see GetHandle().
+  class Handle {
+   public:
+    void Increment() {
+      cell_->IncrementBy(1);
+    }
+
+    void IncrementBy(double amount) {
+      cell_->IncrementBy(amount);
+    }
+
+   private:
+    explicit Handle(ValueCell* cell) : cell_(cell) {
+    }
+
+    ValueCell* cell_;
+
+    friend class Counter;
+  };
+
   static Counter<LabelTypes...>* New(
       const std::string& name,
       const typename NameType<LabelTypes>::name&... label_names,
@@ -28,9 +48,16 @@ class Counter : public Metric {
 
   double Get(const LabelTypes&... labels) const;
 
+  // Returns a Handle for |labels|, which can be incremented without looking
+  // them up again or taking a lock. It stays valid for the life of the
+  // counter.
+  Handle GetHandle(const LabelTypes&... labels);
+
   std::map<std::vector<std::string>, Metric::TimestampedValue> CurrentValues()
       const override;
 
+  void VisitValues(const Metric::ValueVisitor& visitor) const override;
+
  private:
   Counter(const std::string& name,
           const typename NameType<LabelTypes>::name&... label_names,
@@ -81,6 +108,13 @@ double Counter<LabelTypes...>::Get(const LabelTypes&... labels) const {
 }
 
 
+template <class... LabelTypes>
+typename Counter<LabelTypes...>::Handle Counter<LabelTypes...>::GetHandle(
+    const LabelTypes&... labels) {
+  return Handle(values_.GetCell(labels...));
+}
+
+
 template <class... LabelTypes>
 std::map<std::vector<std::string>, Metric::TimestampedValue>
 Counter<LabelTypes...>::CurrentValues() const {
@@ -88,6 +122,13 @@ Counter<LabelTypes...>::CurrentValues() const {
 }
 
 
+template <class... LabelTypes>
+void Counter<LabelTypes...>::VisitValues(
+    const Metric::ValueVisitor& visitor) const {
+  values_.VisitValues(visitor);
+}
+
+
 }  // namespace cert_trans
 
 #endif  // CERT_TRANS_MONITORING_COUNTER_H_
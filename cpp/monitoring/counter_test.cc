@@ -4,6 +4,7 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include <memory>
+#include <thread>
 
 #include "util/testing.h"
 
@@ -91,6 +92,38 @@ TEST_F(CounterTest, TestCounterWithLabelsMultiValues) {
 }
 
 
+TEST_F(CounterTest, TestCounterHandle) {
+  std::unique_ptr<Counter<std::string>> counter(
+      Counter<std::string>::New("name", "a string", "help"));
+  Counter<std::string>::Handle handle(counter->GetHandle("alpha"));
+  EXPECT_EQ(0, counter->Get("alpha"));
+  handle.Increment();
+  handle.IncrementBy(2);
+  counter->Increment("alpha");
+  EXPECT_EQ(4, counter->Get("alpha"));
+  EXPECT_EQ(0, counter->Get("beta"));
+}
+
+
+TEST_F(CounterTest, TestCounterConcurrentIncrements) {
+  std::unique_ptr<Counter<>> counter(Counter<>::New("name", "help"));
+  vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&counter]() {
+      Counter<>::Handle handle(counter->GetHandle());
+      for (int j = 0; j < 1000; ++j) {
+        handle.Increment();
+        counter->Increment();
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(8000, counter->Get());
+}
+
+
 }  // namespace cert_trans
 
 
@@ -16,6 +16,22 @@ namespace cert_trans {
 template <class... LabelTypes>
 class Gauge : public Metric {
  public:
+  // The value for one set of labels, see GetHandle().
+  class Handle {
+   public:
+    void Set(double value) {
+      cell_->Set(value);
+    }
+
+   private:
+    explicit Handle(ValueCell* cell) : cell_(cell) {
+    }
+
+    ValueCell* cell_;
+
+    friend class Gauge;
+  };
+
   static Gauge<LabelTypes...>* New(
       const std::string& name,
       const typename NameType<LabelTypes>::name&... label_names,
@@ -25,10 +41,17 @@ class Gauge : public Metric {
 
   void Set(const LabelTypes&... labels, double value);
 
+  // Returns a Handle for |labels|, which can be set without looking
+  // them up again or taking a lock. It stays valid for the life of the
+  // gauge.
+  Handle GetHandle(const LabelTypes&... labels);
+
   // TODO(alcutter): Not over the moon about having this here.
   std::map<std::vector<std::string>, Metric::TimestampedValue> CurrentValues()
       const override;
 
+  void VisitValues(const Metric::ValueVisitor& visitor) const override;
+
  private:
   Gauge(const std::string& name,
         const typename NameType<LabelTypes>::name&... label_names,
@@ -72,6 +95,13 @@ void Gauge<LabelTypes...>::Set(const LabelTypes&... labels, double value) {
 }
 
 
+template <class... LabelTypes>
+typename Gauge<LabelTypes...>::Handle Gauge<LabelTypes...>::GetHandle(
+    const LabelTypes&... labels) {
+  return Handle(values_.GetCell(labels...));
+}
+
+
 template <class... LabelTypes>
 std::map<std::vector<std::string>, Metric::TimestampedValue>
 Gauge<LabelTypes...>::CurrentValues() const {
@@ -79,6 +109,13 @@ Gauge<LabelTypes...>::CurrentValues() const {
 }
 
 
+template <class... LabelTypes>
+void Gauge<LabelTypes...>::VisitValues(
+    const Metric::ValueVisitor& visitor) const {
+  values_.VisitValues(visitor);
+}
+
+
 }  // namespace cert_trans
 
 
@@ -96,6 +96,18 @@ TEST_F(GaugeTest, TestGaugeWithLabelsMultiValues) {
 }
 
 
+TEST_F(GaugeTest, TestGaugeHandle) {
+  std::unique_ptr<Gauge<std::string>> gauge(
+      Gauge<std::string>::New("name", "a string", "help"));
+  Gauge<std::string>::Handle handle(gauge->GetHandle("alpha"));
+  handle.Set(100);
+  EXPECT_EQ(100, gauge->Get("alpha"));
+  gauge->Set("alpha", 200);
+  EXPECT_EQ(200, gauge->Get("alpha"));
+  EXPECT_EQ(1, gauge->CurrentValues().size());
+}
+
+
 }  // namespace cert_trans
 
 
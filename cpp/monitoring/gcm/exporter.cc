@@ -1,7 +1,9 @@
 #include "monitoring/gcm/exporter.h"
 
+#include <algorithm>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <set>
 #include <sstream>
 
 #include "monitoring/monitoring.h"
@@ -24,24 +26,38 @@ DEFINE_int32(google_compute_monitoring_credentials_refresh_interval_minutes,
              "GCM.");
 DEFINE_int32(google_compute_monitoring_retry_delay_seconds, 5,
              "Seconds between retrying failed GCM requests.");
+DEFINE_int32(google_compute_monitoring_max_retry_delay_seconds, 300,
+             "Maximum seconds between retrying a failed GCM push, the delay "
+             "doubles with each consecutive failure up to this.");
+DEFINE_int32(google_compute_monitoring_max_timeseries_per_request, 200,
+             "Maximum number of time series to send to GCM in one request.");
+DEFINE_int32(google_compute_monitoring_max_inflight_requests, 2,
+             "Maximum number of outstanding requests pushing metrics to GCM.");
+DEFINE_int32(google_compute_monitoring_resend_unchanged_seconds, 300,
+             "Series whose value hasn't changed are only pushed to GCM if "
+             "they haven't been for this many seconds.");
 
 
 namespace cert_trans {
 
 using std::bind;
+using std::chrono::duration;
 using std::chrono::minutes;
 using std::chrono::seconds;
 using std::chrono::system_clock;
 using std::make_pair;
 using std::mutex;
+using std::lock_guard;
+using std::min;
 using std::ostringstream;
 using std::placeholders::_1;
+using std::shared_ptr;
 using std::string;
 using std::thread;
 using std::unique_lock;
 using std::unique_ptr;
+using std::vector;
 using util::Executor;
-using util::SyncTask;
 using util::Task;
 
 Counter<>* num_gcm_create_metric_failures =
@@ -80,7 +96,14 @@ GCMExporter::GCMExporter(const string& instance_name, UrlFetcher* fetcher,
       fetcher_(CHECK_NOTNULL(fetcher)),
       executor_(CHECK_NOTNULL(executor)),
       task_(executor_),
-      metrics_created_(false) {
+      metrics_created_(false),
+      next_metric_(0),
+      batch_size_(0),
+      in_flight_(0),
+      retry_delay_(
+          seconds(FLAGS_google_compute_monitoring_retry_delay_seconds)) {
+  CHECK_GT(FLAGS_google_compute_monitoring_max_timeseries_per_request, 0);
+  CHECK_GT(FLAGS_google_compute_monitoring_max_inflight_requests, 0);
   executor_->Add(bind(&GCMExporter::PushMetrics, this));
 }
 
@@ -146,73 +169,90 @@ void AddLabelDescription(const string& key, const string& desc,
 }  // namespace
 
 
-void GCMExporter::CreateMetrics() {
-  const std::set<const Metric*> metrics(Registry::Instance()->GetMetrics());
-  for (auto& m : metrics) {
-    CHECK_NOTNULL(m);
-
-    // See
-    // https://cloud.google.com/monitoring/v2beta2/metricDescriptors#resource
-    // for a description of the structure we're building here.
-
-    JsonArray labels;
-    AddLabelDescription("instance",
-                        "Instance from which the sample originates.", &labels);
-    for (const auto& label : m->LabelNames()) {
-      AddLabelDescription(label, label, &labels);
-    }
+void GCMExporter::CreateMetric(size_t index) {
+  if (task_.task()->CancelRequested()) {
+    task_.task()->Return(util::Status::CANCELLED);
+    return;
+  }
 
-    JsonObject desc;
-    switch (m->Type()) {
-      case Metric::COUNTER:
-        // only gauge type metrics are supported for custom metrics currently:
-        // https://cloud.google.com/monitoring/api/metrics#metric-types
-        desc.Add("metricType", "gauge");
-        break;
-      case Metric::GAUGE:
-        desc.Add("metricType", "gauge");
-        break;
-      default:
-        LOG(FATAL) << "Unknown type: " << m->Type();
-    }
-    desc.Add("valueType", "double");
-
-    JsonObject metric;
-    metric.Add("name", kCloudPrefix + m->Name());
-    metric.Add("description", m->Help());
-    metric.Add("labels", labels);
-    metric.Add("typeDescriptor", desc);
-
-    do {
-      UrlFetcher::Request req((URL(FLAGS_google_compute_monitoring_base_url +
-                                   "/metricDescriptors")));
-      req.verb = UrlFetcher::Verb::POST;
-      req.headers.insert(make_pair("Content-Type", "application/json"));
-      req.headers.insert(
-          make_pair("Authorization", "Bearer " + bearer_token_));
-      req.body = metric.ToString();
-
-      UrlFetcher::Response resp;
-      SyncTask task(executor_);
-      VLOG(1) << "Creating metric m.Name()...";
-      VLOG(2) << req.body;
-      fetcher_->Fetch(req, &resp, task.task());
-      task.Wait();
-      if (!task.status().ok() || resp.status_code != 200) {
-        LOG(WARNING) << "Failed to create/update metric metadata; status: "
-                     << task.status()
-                     << ", response_code: " << resp.status_code;
-        num_gcm_create_metric_failures->Increment();
-        // TODO(alcutter): consider breaking this up into separate child tasks.
-        sleep(FLAGS_google_compute_monitoring_retry_delay_seconds);
-        continue;
-      }
-      VLOG(1) << "Metrics Created.";
-      VLOG(2) << resp.body;
+  if (index >= metrics_.size()) {
+    VLOG(1) << "Metrics Created.";
+    metrics_created_ = true;
+    StartPush();
+    return;
+  }
+
+  const Metric* const m(CHECK_NOTNULL(metrics_[index]));
+
+  // See
+  // https://cloud.google.com/monitoring/v2beta2/metricDescriptors#resource
+  // for a description of the structure we're building here.
+
+  JsonArray labels;
+  AddLabelDescription("instance", "Instance from which the sample originates.",
+                      &labels);
+  for (const auto& label : m->LabelNames()) {
+    AddLabelDescription(label, label, &labels);
+  }
+
+  JsonObject desc;
+  switch (m->Type()) {
+    case Metric::COUNTER:
+      // only gauge type metrics are supported for custom metrics currently:
+      // https://cloud.google.com/monitoring/api/metrics#metric-types
+      desc.Add("metricType", "gauge");
+      desc.Add("valueType", "double");
+      break;
+    case Metric::GAUGE:
+      desc.Add("metricType", "gauge");
+      desc.Add("valueType", "double");
       break;
-    } while (true);
+    case Metric::HISTOGRAM:
+      desc.Add("metricType", "gauge");
+      desc.Add("valueType", "distribution");
+      break;
+    default:
+      LOG(FATAL) << "Unknown type: " << m->Type();
+  }
+
+  JsonObject metric;
+  metric.Add("name", kCloudPrefix + m->Name());
+  metric.Add("description", m->Help());
+  metric.Add("labels", labels);
+  metric.Add("typeDescriptor", desc);
+
+  UrlFetcher::Request req(
+      (URL(FLAGS_google_compute_monitoring_base_url + "/metricDescriptors")));
+  req.verb = UrlFetcher::Verb::POST;
+  req.headers.insert(make_pair("Content-Type", "application/json"));
+  req.headers.insert(make_pair("Authorization", "Bearer " + bearer_token_));
+  req.body = metric.ToString();
+
+  UrlFetcher::Response* const resp(new UrlFetcher::Response);
+  VLOG(1) << "Creating metric " << m->Name() << "...";
+  VLOG(2) << req.body;
+  fetcher_->Fetch(req, resp, task_.task()->AddChild(
+                                 bind(&GCMExporter::CreateMetricDone, this,
+                                      index, resp, _1)));
+}
+
+
+void GCMExporter::CreateMetricDone(size_t index, UrlFetcher::Response* resp,
+                                   Task* task) {
+  unique_ptr<UrlFetcher::Response> resp_deleter(resp);
+  if (!task->status().ok() || resp->status_code != 200) {
+    LOG(WARNING) << "Failed to create/update metric metadata; status: "
+                 << task->status() << ", response_code: " << resp->status_code;
+    num_gcm_create_metric_failures->Increment();
+    executor_->Delay(
+        seconds(FLAGS_google_compute_monitoring_retry_delay_seconds),
+        task_.task()->AddChild(
+            bind(&GCMExporter::CreateMetric, this, index)));
+    return;
   }
-  metrics_created_ = true;
+  VLOG(2) << resp->body;
+
+  CreateMetric(index + 1);
 }
 
 
@@ -224,6 +264,74 @@ void AddLabel(const string& key, const string& value, JsonObject* labels) {
 }
 
 
+void SetPointTime(JsonObject* point) {
+  CHECK_NOTNULL(point);
+  // According to
+  // https://cloud.google.com/monitoring/v2beta2/timeseries/write
+  // GAUGE types should have a zero size timerange here
+  // Which implies we need to use the current time rather than the time the
+  // value was set because there's a [short ~5m] horizon over which GCM
+  // won't accept samples.
+  const auto now(system_clock::now());
+  point->Add("start", RFC3339Time(now));
+  point->Add("end", RFC3339Time(now));
+}
+
+
+// Adds |distribution| to |point| in the bucket layout GCM expects: an
+// underflow bucket up to the first bound, one bucket between each pair of
+// bounds, and an overflow bucket above the last one.
+void AddDistributionValue(const Metric::Distribution& distribution,
+                          JsonObject* point) {
+  const vector<double>& bounds(distribution.bounds);
+  const vector<uint64_t>& counts(distribution.counts);
+  CHECK(!bounds.empty());
+  CHECK_EQ(bounds.size() + 1, counts.size());
+
+  JsonObject underflow;
+  underflow.AddDouble("upperBound", bounds.front());
+  underflow.Add("count", static_cast<int64_t>(counts.front()));
+
+  JsonArray buckets;
+  for (size_t i(1); i < bounds.size(); ++i) {
+    JsonObject bucket;
+    bucket.AddDouble("lowerBound", bounds[i - 1]);
+    bucket.AddDouble("upperBound", bounds[i]);
+    bucket.Add("count", static_cast<int64_t>(counts[i]));
+    buckets.Add(&bucket);
+  }
+
+  JsonObject overflow;
+  overflow.AddDouble("lowerBound", bounds.back());
+  overflow.Add("count", static_cast<int64_t>(counts.back()));
+
+  JsonObject value;
+  value.Add("underflowBucket", underflow);
+  value.Add("buckets", buckets);
+  value.Add("overflowBucket", overflow);
+  CHECK_NOTNULL(point)->Add("distributionValue", value);
+}
+
+
+void AddTimeseries(const Metric& m, const vector<string>& label_values,
+                   const JsonObject& point, JsonArray* timeseries) {
+  JsonObject labels;
+  for (size_t i(0); i < label_values.size(); ++i) {
+    AddLabel(m.LabelName(i), label_values[i], &labels);
+  }
+
+  JsonObject desc;
+  desc.Add("labels", labels);
+  desc.Add("metric", kCloudPrefix + m.Name());
+
+  JsonObject ts;
+  ts.Add("timeseriesDesc", desc);
+  ts.Add("point", point);
+
+  CHECK_NOTNULL(timeseries)->Add(&ts);
+}
+
+
 }  // namespace
 
 
@@ -242,8 +350,49 @@ void GCMExporter::PushMetrics() {
     return;
   }
 
+  const std::set<const Metric*> metrics(Registry::Instance()->GetMetrics());
+  metrics_.assign(metrics.begin(), metrics.end());
+
   if (!metrics_created_) {
-    CreateMetrics();
+    // This calls StartPush() once all the metrics have been created.
+    CreateMetric(0);
+    return;
+  }
+
+  StartPush();
+}
+
+
+void GCMExporter::StartPush() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    CHECK_EQ(0, in_flight_);
+    CHECK(ready_batches_.empty());
+    next_metric_ = 0;
+  }
+  VLOG(1) << "Pushing metrics...";
+  SendBatches();
+}
+
+
+bool GCMExporter::ShouldPush(const string& key, double current,
+                             const system_clock::time_point& now) {
+  const auto it(pushed_.find(key));
+  if (it != pushed_.end() && it->second.value == current &&
+      now - it->second.pushed_at <
+          seconds(FLAGS_google_compute_monitoring_resend_unchanged_seconds)) {
+    return false;
+  }
+  PushedSeries& pushed(pushed_[key]);
+  pushed.value = current;
+  pushed.pushed_at = now;
+  return true;
+}
+
+
+void GCMExporter::QueueBatch() {
+  if (batch_size_ == 0) {
+    return;
   }
 
   // Build up the JSON write request into this object:
@@ -253,72 +402,169 @@ void GCMExporter::PushMetrics() {
   JsonObject common_labels;
   AddLabel("instance", instance_name_, &common_labels);
   metric_write.Add("commonLabels", common_labels);
+  metric_write.Add("timeseries", *batch_);
 
-  const std::set<const Metric*> metrics(Registry::Instance()->GetMetrics());
-  JsonArray timeseries;
-  for (auto& m : metrics) {
-    CHECK_NOTNULL(m);
-    for (auto& p : m->CurrentValues()) {
-      JsonObject labels;
-      for (size_t i(0); i < p.first.size(); ++i) {
-        AddLabel(m->LabelName(i), p.first[i], &labels);
-      }
+  ready_batches_.emplace_back(new string(metric_write.ToString()));
+  batch_.reset();
+  batch_size_ = 0;
+}
 
-      JsonObject desc;
-      desc.Add("labels", labels);
-      desc.Add("metric", kCloudPrefix + m->Name());
 
-      JsonObject ts;
-      ts.Add("timeseriesDesc", desc);
+bool GCMExporter::AddNextMetric() {
+  if (next_metric_ >= metrics_.size()) {
+    QueueBatch();
+    return false;
+  }
 
+  const Metric& m(*CHECK_NOTNULL(metrics_[next_metric_++]));
+  const system_clock::time_point now(system_clock::now());
+  const auto add([this, &m](const vector<string>& label_values,
+                            const JsonObject& point) {
+    if (!batch_) {
+      batch_.reset(new JsonArray);
+    }
+    AddTimeseries(m, label_values, point, batch_.get());
+    if (++batch_size_ >=
+        FLAGS_google_compute_monitoring_max_timeseries_per_request) {
+      QueueBatch();
+    }
+  });
+  const auto key([&m](const vector<string>& label_values) {
+    string ret(m.Name());
+    for (const auto& value : label_values) {
+      ret.push_back('\0');
+      ret.append(value);
+    }
+    return ret;
+  });
+
+  if (m.Type() == Metric::HISTOGRAM) {
+    m.VisitDistributions([&](const vector<string>& label_values,
+                             const Metric::Distribution& distribution) {
+      // Recording a value always bumps the count.
+      if (!ShouldPush(key(label_values), distribution.count, now)) {
+        return;
+      }
       JsonObject point;
-      // According to
-      // https://cloud.google.com/monitoring/v2beta2/timeseries/write
-      // GAUGE types should have a zero size timerange here
-      // Which implies we need to use the current time rather than the time the
-      // value was set because there's a [short ~5m] horizon over which GCM
-      // won't accept samples.
-      const auto now(system_clock::now());
-      point.Add("start", RFC3339Time(now));
-      point.Add("end", RFC3339Time(now));
-      point.Add("doubleValue", p.second.second);
-      ts.Add("point", point);
-
-      timeseries.Add(&ts);
+      SetPointTime(&point);
+      AddDistributionValue(distribution, &point);
+      add(label_values, point);
+    });
+    return true;
+  }
+
+  m.VisitValues([&](const vector<string>& label_values,
+                    const Metric::TimestampedValue& value) {
+    if (!ShouldPush(key(label_values), value.second, now)) {
+      return;
+    }
+    JsonObject point;
+    SetPointTime(&point);
+    point.Add("doubleValue", value.second);
+    add(label_values, point);
+  });
+  return true;
+}
+
+
+void GCMExporter::SendBatches() {
+  vector<shared_ptr<string>> to_send;
+  bool done(false);
+  {
+    lock_guard<mutex> lock(mutex_);
+    if (!task_.task()->CancelRequested()) {
+      while (in_flight_ <
+             FLAGS_google_compute_monitoring_max_inflight_requests) {
+        if (ready_batches_.empty() && !AddNextMetric()) {
+          break;
+        }
+        if (!ready_batches_.empty()) {
+          to_send.emplace_back(ready_batches_.front());
+          ready_batches_.pop_front();
+          ++in_flight_;
+        }
+      }
+    }
+
+    if (in_flight_ == 0) {
+      ready_batches_.clear();
+      batch_.reset();
+      batch_size_ = 0;
+      done = true;
     }
   }
-  metric_write.Add("timeseries", timeseries);
+
+  if (done) {
+    if (task_.task()->CancelRequested()) {
+      task_.task()->Return(util::Status::CANCELLED);
+      return;
+    }
+    VLOG(1) << "Metrics pushed.";
+    executor_->Delay(
+        seconds(FLAGS_google_compute_monitoring_push_interval_seconds),
+        task_.task()->AddChild(bind(&GCMExporter::PushMetrics, this)));
+    return;
+  }
+
+  for (const auto& body : to_send) {
+    SendBatch(body);
+  }
+}
+
+
+void GCMExporter::SendBatch(const shared_ptr<string>& body) {
+  if (task_.task()->CancelRequested()) {
+    {
+      lock_guard<mutex> lock(mutex_);
+      --in_flight_;
+    }
+    SendBatches();
+    return;
+  }
 
   UrlFetcher::Request req(
       (URL(FLAGS_google_compute_monitoring_base_url + "/timeseries:write")));
   req.verb = UrlFetcher::Verb::POST;
   req.headers.insert(make_pair("Content-Type", "application/json"));
   req.headers.insert(make_pair("Authorization", "Bearer " + bearer_token_));
-  req.body = metric_write.ToString();
+  req.body = *body;
 
   UrlFetcher::Response* resp(new UrlFetcher::Response);
-  VLOG(1) << "Pushing metrics...";
   VLOG(2) << req.body;
   fetcher_->Fetch(req, resp,
-                  task_.task()->AddChild(
-                      bind(&GCMExporter::PushMetricsDone, this, resp, _1)));
+                  task_.task()->AddChild(bind(&GCMExporter::SendBatchDone,
+                                              this, body, resp, _1)));
 }
 
 
-void GCMExporter::PushMetricsDone(UrlFetcher::Response* resp, Task* task) {
+void GCMExporter::SendBatchDone(const shared_ptr<string>& body,
+                                UrlFetcher::Response* resp, Task* task) {
   unique_ptr<UrlFetcher::Response> resp_deleter(resp);
   if (!task->status().ok() || resp->status_code != 200) {
     num_gcm_push_failures->Increment();
     LOG(WARNING) << "Failed to push metrics to GCM, status: " << task->status()
                  << ", reponse code: " << resp->status_code;
-  } else {
-    VLOG(1) << "Metrics pushed.";
-    VLOG(2) << resp->body;
+    duration<double> delay;
+    {
+      lock_guard<mutex> lock(mutex_);
+      delay = retry_delay_;
+      retry_delay_ = min<duration<double>>(
+          retry_delay_ * 2,
+          seconds(FLAGS_google_compute_monitoring_max_retry_delay_seconds));
+    }
+    // The batch keeps its in-flight slot until it goes through.
+    executor_->Delay(delay, task_.task()->AddChild(
+                                bind(&GCMExporter::SendBatch, this, body)));
+    return;
   }
+  VLOG(2) << resp->body;
 
-  executor_->Delay(
-      seconds(FLAGS_google_compute_monitoring_push_interval_seconds),
-      task_.task()->AddChild(bind(&GCMExporter::PushMetrics, this)));
+  {
+    lock_guard<mutex> lock(mutex_);
+    retry_delay_ = seconds(FLAGS_google_compute_monitoring_retry_delay_seconds);
+    --in_flight_;
+  }
+  SendBatches();
 }
 
 
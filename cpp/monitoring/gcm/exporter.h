@@ -3,16 +3,32 @@
 
 #include <chrono>
 #include <condition_variable>
+#include <deque>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <thread>
+#include <vector>
 
+#include "monitoring/metric.h"
 #include "net/url_fetcher.h"
 #include "util/executor.h"
 #include "util/sync_task.h"
 
+class JsonArray;
+
 namespace cert_trans {
 
 
+// Periodically pushes the value of every metric to GCM.
+//
+// Series whose value hasn't changed since they were last pushed are
+// skipped (but resent now and then), the rest are sent in batches of up
+// to --google_compute_monitoring_max_timeseries_per_request, with at
+// most --google_compute_monitoring_max_inflight_requests of them
+// outstanding. Batches are only built as there is room to send them, and
+// a failed batch is retried with exponential backoff.
 class GCMExporter {
  public:
   GCMExporter(const std::string& instance_name, UrlFetcher* fetcher,
@@ -23,10 +39,28 @@ class GCMExporter {
   void RefreshCredentials();
   void RefreshCredentialsDone(UrlFetcher::Response* resp, util::Task* task);
 
-  void CreateMetrics();
+  void CreateMetric(size_t index);
+  void CreateMetricDone(size_t index, UrlFetcher::Response* resp,
+                        util::Task* task);
 
   void PushMetrics();
-  void PushMetricsDone(UrlFetcher::Response* resp, util::Task* task);
+  void StartPush();
+  // Sends as many batches as the in-flight limit allows, and schedules
+  // the next push once everything has been sent.
+  void SendBatches();
+  void SendBatch(const std::shared_ptr<std::string>& body);
+  void SendBatchDone(const std::shared_ptr<std::string>& body,
+                     UrlFetcher::Response* resp, util::Task* task);
+  // Finishes the batch being built and queues it. |mutex_| must be held.
+  void QueueBatch();
+  // Adds the series of the next metric to the batch being built, queueing
+  // batches as they fill up. Returns false once all the metrics have been
+  // visited. |mutex_| must be held.
+  bool AddNextMetric();
+  // Whether the series |key| should be pushed given its |current| value,
+  // which is recorded if so. |mutex_| must be held.
+  bool ShouldPush(const std::string& key, double current,
+                  const std::chrono::system_clock::time_point& now);
 
   const std::string instance_name_;
   UrlFetcher* const fetcher_;
@@ -35,6 +69,24 @@ class GCMExporter {
   bool metrics_created_;
   std::chrono::system_clock::time_point token_refreshed_at_;
   std::string bearer_token_;
+  // The metrics being created or pushed.
+  std::vector<const Metric*> metrics_;
+
+  struct PushedSeries {
+    double value;
+    std::chrono::system_clock::time_point pushed_at;
+  };
+
+  std::mutex mutex_;
+  size_t next_metric_;
+  std::unique_ptr<JsonArray> batch_;
+  int batch_size_;
+  std::deque<std::shared_ptr<std::string>> ready_batches_;
+  int in_flight_;
+  std::chrono::duration<double> retry_delay_;
+  // The last value pushed for each series, keyed by metric name and label
+  // values.
+  std::map<std::string, PushedSeries> pushed_;
 
   friend class GCMExporterTest;
 };
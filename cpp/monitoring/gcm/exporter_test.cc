@@ -16,6 +16,8 @@ DECLARE_string(google_compute_monitoring_base_url);
 DECLARE_int32(google_compute_monitoring_push_interval_seconds);
 DECLARE_string(google_compute_monitoring_service_account);
 DECLARE_int32(google_compute_monitoring_retry_delay_seconds);
+DECLARE_int32(google_compute_monitoring_max_timeseries_per_request);
+DECLARE_int32(google_compute_monitoring_resend_unchanged_seconds);
 
 namespace cert_trans {
 
@@ -49,6 +51,7 @@ using testing::InSequence;
 using testing::Invoke;
 using testing::InvokeWithoutArgs;
 using testing::IsEmpty;
+using testing::Not;
 using util::Status;
 using util::SyncTask;
 using util::Task;
@@ -85,6 +88,9 @@ class GCMExporterTest : public ::testing::Test {
     FLAGS_google_compute_monitoring_push_interval_seconds = kPushInterval;
     FLAGS_google_compute_metadata_url = kMetadataUrl;
     FLAGS_google_compute_monitoring_service_account = kServiceAccount;
+    FLAGS_google_compute_monitoring_max_timeseries_per_request = 200;
+    // Push everything every time unless a test says otherwise.
+    FLAGS_google_compute_monitoring_resend_unchanged_seconds = 0;
 
     ON_CALL(fetcher_, Fetch(_, _, _))
         .WillByDefault(Invoke(bind(&HandleFetch, util::Status::OK, 200,
@@ -378,6 +384,139 @@ TEST_F(GCMExporterTest, TestRetriesWhenPushingMetricsFails) {
 }
 
 
+TEST_F(GCMExporterTest, TestSkipsUnchangedSeries) {
+  FLAGS_google_compute_monitoring_resend_unchanged_seconds = 3600;
+  std::unique_ptr<Counter<>> one(Counter<>::New("unchanged_counter", "help1"));
+  one->Increment();
+  std::unique_ptr<Gauge<>> two(Gauge<>::New("changing_gauge", "help2"));
+  two->Set(2);
+
+  SyncTask sync(&pool_);
+
+  EXPECT_CALL(
+      fetcher_,
+      Fetch(IsUrlFetchRequest(
+                UrlFetcher::Verb::GET,
+                URL(string(kMetadataUrl) + "/" + kServiceAccount + "/token"),
+                UrlFetcher::Headers{make_pair("Metadata-Flavor", "Google")},
+                ""),
+            _, _))
+      .WillRepeatedly(
+          Invoke(bind(&HandleFetch, util::Status::OK, 200,
+                      UrlFetcher::Headers{}, kCredentialsJson, _1, _2, _3)));
+  EXPECT_CALL(fetcher_,
+              Fetch(IsUrlFetchRequest(
+                        UrlFetcher::Verb::POST, URL(string(metrics_url_)),
+                        UrlFetcher::Headers{
+                            make_pair("Content-Type", "application/json"),
+                            make_pair("Authorization", "Bearer token")},
+                        _),
+                    _, _))
+      .WillRepeatedly(Invoke(bind(&HandleFetch, util::Status::OK, 200,
+                                  UrlFetcher::Headers{}, "", _1, _2, _3)));
+  {
+    InSequence s;
+    EXPECT_CALL(fetcher_,
+                Fetch(IsUrlFetchRequest(
+                          UrlFetcher::Verb::POST, URL(push_url_),
+                          UrlFetcher::Headers{
+                              make_pair("Content-Type", "application/json"),
+                              make_pair("Authorization", "Bearer token")},
+                          AllOf(HasSubstr("unchanged_counter"),
+                                HasSubstr("changing_gauge"))),
+                      _, _))
+        .WillOnce(DoAll(InvokeWithoutArgs([&two] { two->Set(3); }),
+                        Invoke(bind(&HandleFetch, util::Status::OK, 200,
+                                    UrlFetcher::Headers{}, "", _1, _2, _3))));
+    // Only the gauge changed since.
+    EXPECT_CALL(fetcher_,
+                Fetch(IsUrlFetchRequest(
+                          UrlFetcher::Verb::POST, URL(push_url_),
+                          UrlFetcher::Headers{
+                              make_pair("Content-Type", "application/json"),
+                              make_pair("Authorization", "Bearer token")},
+                          AllOf(Not(HasSubstr("unchanged_counter")),
+                                HasSubstr("changing_gauge"))),
+                      _, _))
+        .WillOnce(DoAll(InvokeWithoutArgs([&sync] { sync.task()->Return(); }),
+                        Invoke(bind(&HandleFetch, util::Status::OK, 200,
+                                    UrlFetcher::Headers{}, "", _1, _2, _3))));
+  }
+  GCMExporter exporter("instance", &fetcher_, &pool_);
+  sync.Wait();
+}
+
+
+TEST_F(GCMExporterTest, TestBatchesTimeseries) {
+  FLAGS_google_compute_monitoring_max_timeseries_per_request = 1;
+  std::unique_ptr<Counter<>> one(Counter<>::New("batched_counter", "help1"));
+  one->Increment();
+  std::unique_ptr<Gauge<>> two(Gauge<>::New("batched_gauge", "help2"));
+  two->Set(2);
+
+  SyncTask sync(&pool_);
+
+  EXPECT_CALL(
+      fetcher_,
+      Fetch(IsUrlFetchRequest(
+                UrlFetcher::Verb::GET,
+                URL(string(kMetadataUrl) + "/" + kServiceAccount + "/token"),
+                UrlFetcher::Headers{make_pair("Metadata-Flavor", "Google")},
+                ""),
+            _, _))
+      .WillRepeatedly(
+          Invoke(bind(&HandleFetch, util::Status::OK, 200,
+                      UrlFetcher::Headers{}, kCredentialsJson, _1, _2, _3)));
+  EXPECT_CALL(fetcher_,
+              Fetch(IsUrlFetchRequest(
+                        UrlFetcher::Verb::POST, URL(string(metrics_url_)),
+                        UrlFetcher::Headers{
+                            make_pair("Content-Type", "application/json"),
+                            make_pair("Authorization", "Bearer token")},
+                        _),
+                    _, _))
+      .WillRepeatedly(Invoke(bind(&HandleFetch, util::Status::OK, 200,
+                                  UrlFetcher::Headers{}, "", _1, _2, _3)));
+  // Every other series goes in a request of its own.
+  EXPECT_CALL(fetcher_,
+              Fetch(IsUrlFetchRequest(
+                        UrlFetcher::Verb::POST, URL(push_url_),
+                        UrlFetcher::Headers{
+                            make_pair("Content-Type", "application/json"),
+                            make_pair("Authorization", "Bearer token")},
+                        _),
+                    _, _))
+      .WillRepeatedly(Invoke(bind(&HandleFetch, util::Status::OK, 200,
+                                  UrlFetcher::Headers{}, "", _1, _2, _3)));
+  EXPECT_CALL(fetcher_,
+              Fetch(IsUrlFetchRequest(
+                        UrlFetcher::Verb::POST, URL(push_url_),
+                        UrlFetcher::Headers{
+                            make_pair("Content-Type", "application/json"),
+                            make_pair("Authorization", "Bearer token")},
+                        AllOf(HasSubstr("batched_counter"),
+                              HasSubstr("batched_gauge"))),
+                    _, _))
+      .Times(0);
+  EXPECT_CALL(fetcher_,
+              Fetch(IsUrlFetchRequest(
+                        UrlFetcher::Verb::POST, URL(push_url_),
+                        UrlFetcher::Headers{
+                            make_pair("Content-Type", "application/json"),
+                            make_pair("Authorization", "Bearer token")},
+                        AllOf(Not(HasSubstr("batched_counter")),
+                              HasSubstr("batched_gauge"))),
+                    _, _))
+      .WillOnce(DoAll(InvokeWithoutArgs([&sync] { sync.task()->Return(); }),
+                      Invoke(bind(&HandleFetch, util::Status::OK, 200,
+                                  UrlFetcher::Headers{}, "", _1, _2, _3))))
+      .WillRepeatedly(Invoke(bind(&HandleFetch, util::Status::OK, 200,
+                                  UrlFetcher::Headers{}, "", _1, _2, _3)));
+  GCMExporter exporter("instance", &fetcher_, &pool_);
+  sync.Wait();
+}
+
+
 }  // namespace cert_trans
 
 
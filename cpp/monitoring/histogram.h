@@ -0,0 +1,274 @@
+#ifndef CERT_TRANS_MONITORING_HISTOGRAM_H_
+#define CERT_TRANS_MONITORING_HISTOGRAM_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <glog/logging.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/macros.h"
+#include "monitoring/labelled_values.h"
+#include "monitoring/metric.h"
+
+namespace cert_trans {
+
+
+// Returns |count| bucket bounds, the first one being |start| and each
+// of the others |factor| times the one before.
+inline std::vector<double> ExponentialBucketBounds(double start,
+                                                   double factor, int count) {
+  CHECK_GT(start, 0);
+  CHECK_GT(factor, 1);
+  std::vector<double> ret;
+  double bound(start);
+  for (int i = 0; i < count; ++i) {
+    ret.push_back(bound);
+    bound *= factor;
+  }
+  return ret;
+}
+
+
+// The buckets for one set of labels of a Histogram. It is updated with
+// atomic operations only.
+class DistributionCell {
+ public:
+  // |bounds| must outlive the cell.
+  explicit DistributionCell(const std::vector<double>* bounds)
+      : bounds_(CHECK_NOTNULL(bounds)),
+        counts_(new std::atomic<uint64_t>[bounds->size() + 1]) {
+    for (size_t i = 0; i <= bounds_->size(); ++i) {
+      counts_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  void Record(double value) {
+    const size_t bucket(
+        std::lower_bound(bounds_->begin(), bounds_->end(), value) -
+        bounds_->begin());
+    counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+    sum_.IncrementBy(value);
+  }
+
+  // The buckets aren't read atomically together, so values recorded
+  // concurrently may or may not be included.
+  Metric::Distribution Get() const {
+    Metric::Distribution ret;
+    ret.bounds = *bounds_;
+    ret.count = 0;
+    for (size_t i = 0; i <= bounds_->size(); ++i) {
+      ret.counts.push_back(counts_[i].load(std::memory_order_relaxed));
+      ret.count += ret.counts.back();
+    }
+    ret.sum = sum_.Get();
+    return ret;
+  }
+
+ private:
+  const std::vector<double>* const bounds_;
+  const std::unique_ptr<std::atomic<uint64_t>[]> counts_;
+  ValueCell sum_;
+
+  DISALLOW_COPY_AND_ASSIGN(DistributionCell);
+};
+
+
+// A metric which counts the values recorded into it in buckets, so that
+// quantiles can be estimated (e.g. request latencies.)
+//
+// Recording a value takes no lock once the cell for its labels exists,
+// and holding on to a Handle avoids looking the labels up at all.
+//
+// CurrentValues() returns the number of values recorded for each set of
+// labels, the buckets themselves are returned by CurrentDistributions().
+template <class... LabelTypes>
+class Histogram : public Metric {
+ public:
+  // The buckets for one set of labels, see GetHandle().
+  class Handle {
+   public:
+    void Record(double value) {
+      cell_->Record(value);
+    }
+
+   private:
+    explicit Handle(DistributionCell* cell) : cell_(cell) {
+    }
+
+    DistributionCell* cell_;
+
+    friend class Histogram;
+  };
+
+  // |bounds| are the inclusive upper bounds of the buckets, in
+  // increasing order. There is an extra bucket for the values above the
+  // last one.
+  static Histogram<LabelTypes...>* New(
+      const std::string& name,
+      const typename NameType<LabelTypes>::name&... label_names,
+      const std::string& help, const std::vector<double>& bounds);
+
+  void Record(const LabelTypes&... labels, double value);
+
+  Metric::Distribution Get(const LabelTypes&... labels) const;
+
+  // Returns a Handle for |labels|, which can be recorded into without
+  // looking them up again or taking a lock. It stays valid for the life
+  // of the histogram.
+  Handle GetHandle(const LabelTypes&... labels);
+
+  std::map<std::vector<std::string>, Metric::TimestampedValue> CurrentValues()
+      const override;
+
+  std::map<std::vector<std::string>, Metric::Distribution>
+  CurrentDistributions() const override;
+
+  void VisitValues(const Metric::ValueVisitor& visitor) const override;
+
+  void VisitDistributions(
+      const Metric::DistributionVisitor& visitor) const override;
+
+ private:
+  Histogram(const std::string& name,
+            const typename NameType<LabelTypes>::name&... label_names,
+            const std::string& help, const std::vector<double>& bounds);
+
+  DistributionCell* GetCell(const LabelTypes&... labels);
+
+  const std::vector<double> bounds_;
+  mutable std::mutex mutex_;
+  // The label values as strings, and their cell. They are never removed.
+  std::map<std::tuple<LabelTypes...>,
+           std::pair<std::vector<std::string>,
+                     std::unique_ptr<DistributionCell>>> cells_;
+
+  DISALLOW_COPY_AND_ASSIGN(Histogram);
+};
+
+
+// static
+template <class... LabelTypes>
+Histogram<LabelTypes...>* Histogram<LabelTypes...>::New(
+    const std::string& name,
+    const typename NameType<LabelTypes>::name&... label_names,
+    const std::string& help, const std::vector<double>& bounds) {
+  return new Histogram(name, label_names..., help, bounds);
+}
+
+
+template <class... LabelTypes>
+Histogram<LabelTypes...>::Histogram(
+    const std::string& name,
+    const typename NameType<LabelTypes>::name&... label_names,
+    const std::string& help, const std::vector<double>& bounds)
+    : Metric(HISTOGRAM, name, {label_names...}, help), bounds_(bounds) {
+  CHECK(std::is_sorted(bounds_.begin(), bounds_.end()));
+}
+
+
+template <class... LabelTypes>
+void Histogram<LabelTypes...>::Record(const LabelTypes&... labels,
+                                      double value) {
+  GetCell(labels...)->Record(value);
+}
+
+
+template <class... LabelTypes>
+Metric::Distribution Histogram<LabelTypes...>::Get(
+    const LabelTypes&... labels) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto it(cells_.find(std::tuple<LabelTypes...>(labels...)));
+  if (it == cells_.end()) {
+    return DistributionCell(&bounds_).Get();
+  }
+  return it->second.second->Get();
+}
+
+
+template <class... LabelTypes>
+typename Histogram<LabelTypes...>::Handle Histogram<LabelTypes...>::GetHandle(
+    const LabelTypes&... labels) {
+  return Handle(GetCell(labels...));
+}
+
+
+template <class... LabelTypes>
+DistributionCell* Histogram<LabelTypes...>::GetCell(
+    const LabelTypes&... labels) {
+  const std::tuple<LabelTypes...> key(labels...);
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it(cells_.find(key));
+  if (it == cells_.end()) {
+    std::unique_ptr<DistributionCell> cell(new DistributionCell(&bounds_));
+    it = cells_.emplace(key, std::make_pair(label_values(key),
+                                            std::move(cell))).first;
+  }
+  return it->second.second.get();
+}
+
+
+template <class... LabelTypes>
+std::map<std::vector<std::string>, Metric::TimestampedValue>
+Histogram<LabelTypes...>::CurrentValues() const {
+  std::map<std::vector<std::string>, Metric::TimestampedValue> ret;
+  VisitValues([&ret](const std::vector<std::string>& label_values,
+                     const Metric::TimestampedValue& value) {
+    ret[label_values] = value;
+  });
+  return ret;
+}
+
+
+template <class... LabelTypes>
+std::map<std::vector<std::string>, Metric::Distribution>
+Histogram<LabelTypes...>::CurrentDistributions() const {
+  std::map<std::vector<std::string>, Metric::Distribution> ret;
+  VisitDistributions([&ret](const std::vector<std::string>& label_values,
+                            const Metric::Distribution& distribution) {
+    ret[label_values] = distribution;
+  });
+  return ret;
+}
+
+
+template <class... LabelTypes>
+void Histogram<LabelTypes...>::VisitValues(
+    const Metric::ValueVisitor& visitor) const {
+  const std::chrono::system_clock::time_point now(
+      std::chrono::system_clock::now());
+  VisitDistributions([&visitor, &now](
+      const std::vector<std::string>& label_values,
+      const Metric::Distribution& distribution) {
+    visitor(label_values,
+            make_pair(now, static_cast<double>(distribution.count)));
+  });
+}
+
+
+template <class... LabelTypes>
+void Histogram<LabelTypes...>::VisitDistributions(
+    const Metric::DistributionVisitor& visitor) const {
+  std::vector<std::pair<const std::vector<std::string>*,
+                        const DistributionCell*>> cells;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cells.reserve(cells_.size());
+    for (const auto& c : cells_) {
+      cells.emplace_back(&c.second.first, c.second.second.get());
+    }
+  }
+  for (const auto& c : cells) {
+    visitor(*c.first, c.second->Get());
+  }
+}
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_MONITORING_HISTOGRAM_H_
@@ -0,0 +1,116 @@
+#include "monitoring/monitoring.h"
+
+#include <glog/logging.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+
+#include "monitoring/latency.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+
+using std::string;
+using std::vector;
+using testing::ElementsAre;
+
+
+TEST(HistogramTest, TestExponentialBucketBounds) {
+  EXPECT_THAT(ExponentialBucketBounds(1, 2, 4), ElementsAre(1, 2, 4, 8));
+}
+
+
+TEST(HistogramTest, TestHistogramType) {
+  std::unique_ptr<Histogram<>> histogram(
+      Histogram<>::New("name", "help", {1, 10}));
+  EXPECT_EQ(Metric::HISTOGRAM, histogram->Type());
+  EXPECT_EQ("name", histogram->Name());
+}
+
+
+TEST(HistogramTest, TestHistogramBuckets) {
+  std::unique_ptr<Histogram<>> histogram(
+      Histogram<>::New("name", "help", {1, 10, 100}));
+  histogram->Record(0.5);
+  histogram->Record(1);  // Bounds are inclusive.
+  histogram->Record(5);
+  histogram->Record(1000);
+
+  const Metric::Distribution d(histogram->Get());
+  EXPECT_THAT(d.bounds, ElementsAre(1, 10, 100));
+  EXPECT_THAT(d.counts, ElementsAre(2, 1, 0, 1));
+  EXPECT_EQ(4, d.count);
+  EXPECT_EQ(1006.5, d.sum);
+}
+
+
+TEST(HistogramTest, TestHistogramWithLabels) {
+  std::unique_ptr<Histogram<string>> histogram(
+      Histogram<string>::New("name", "a string", "help", {1, 10}));
+  EXPECT_EQ(0, histogram->Get("alpha").count);
+  histogram->Record("alpha", 2);
+  Histogram<string>::Handle handle(histogram->GetHandle("beta"));
+  handle.Record(20);
+  handle.Record(20);
+
+  EXPECT_THAT(histogram->Get("alpha").counts, ElementsAre(0, 1, 0));
+  EXPECT_THAT(histogram->Get("beta").counts, ElementsAre(0, 0, 2));
+
+  const std::map<vector<string>, Metric::Distribution> distributions(
+      histogram->CurrentDistributions());
+  ASSERT_EQ(2, distributions.size());
+  EXPECT_EQ(1, distributions.at({"alpha"}).count);
+  EXPECT_EQ(2, distributions.at({"beta"}).count);
+  EXPECT_EQ(2, histogram->CurrentValues().at({"beta"}).second);
+}
+
+
+TEST(HistogramTest, TestHistogramConcurrentRecords) {
+  std::unique_ptr<Histogram<>> histogram(
+      Histogram<>::New("name", "help", {1, 10}));
+  vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&histogram]() {
+      for (int j = 0; j < 1000; ++j) {
+        histogram->Record(j % 20);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  const Metric::Distribution d(histogram->Get());
+  EXPECT_EQ(4000, d.count);
+  EXPECT_THAT(d.counts, ElementsAre(4 * 100, 4 * 450, 4 * 450));
+}
+
+
+TEST(HistogramTest, TestLatencyRecordsDistribution) {
+  Latency<std::chrono::milliseconds, string> latency("latency_ms", "op",
+                                                     "help");
+  latency.RecordLatency("read", std::chrono::microseconds(100));
+  latency.RecordLatency("read", std::chrono::milliseconds(3));
+
+  for (const Metric* m : Registry::Instance()->GetMetrics()) {
+    if (m->Name() == "latency_ms_distribution") {
+      const Metric::Distribution d(m->CurrentDistributions().at({"read"}));
+      EXPECT_EQ(2, d.count);
+      EXPECT_DOUBLE_EQ(3.1, d.sum);
+      // 0.1ms falls in the first bucket, 3ms in (2, 4].
+      EXPECT_EQ(1, d.counts[0]);
+      EXPECT_EQ(1, d.counts[5]);
+      return;
+    }
+  }
+  FAIL() << "No latency_ms_distribution metric";
+}
+
+
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -1,16 +1,59 @@
 #ifndef CERT_TRANS_MONITORING_LABELLED_VALUES_H_
 #define CERT_TRANS_MONITORING_LABELLED_VALUES_H_
 
+#include <atomic>
 #include <chrono>
 #include <glog/logging.h>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
 
+#include "base/macros.h"
 #include "monitoring/metric.h"
 
 namespace cert_trans {
 
 
+// The value for one set of labels of a metric. It is updated with
+// atomic operations only, so holding on to one avoids both the label
+// lookup and the lock of LabelledValues.
+class ValueCell {
+ public:
+  ValueCell() : value_(0) {
+  }
+
+  double Get() const {
+    return value_.load(std::memory_order_relaxed);
+  }
+
+  void Set(double value) {
+    value_.store(value, std::memory_order_relaxed);
+  }
+
+  void IncrementBy(double amount) {
+    double old_value(value_.load(std::memory_order_relaxed));
+    while (!value_.compare_exchange_weak(old_value, old_value + amount,
+                                         std::memory_order_relaxed)) {
+    }
+  }
+
+ private:
+  std::atomic<double> value_;
+
+  DISALLOW_COPY_AND_ASSIGN(ValueCell);
+};
+
+
+// Values are kept in a ValueCell per set of labels. Cells are never
+// removed, so the pointers returned by GetCell() stay valid for the life
+// of the LabelledValues.
+//
+// Updates don't read the clock: the timestamp of a value is the time at
+// which CurrentValues() first saw it change.
 template <class... LabelTypes>
 class LabelledValues {
  public:
@@ -25,15 +68,42 @@ class LabelledValues {
 
   void IncrementBy(const LabelTypes&..., double value);
 
+  // Returns the cell for |labels|, creating it if needed.
+  ValueCell* GetCell(const LabelTypes&... labels);
+
   std::map<std::vector<std::string>, Metric::TimestampedValue> CurrentValues()
       const;
 
+  void VisitValues(const Metric::ValueVisitor& visitor) const;
+
  private:
   const std::string name_;
   const std::vector<std::string> label_names_;
+  struct Entry {
+    explicit Entry(const std::vector<std::string>& labels)
+        : labels(labels),
+          cell(new ValueCell),
+          last_value(0),
+          timestamp(std::chrono::system_clock::now()) {
+    }
+
+    // The label values as strings, converted once.
+    const std::vector<std::string> labels;
+    const std::unique_ptr<ValueCell> cell;
+    // The value seen by the last CurrentValues(), and when it was first
+    // seen.
+    mutable double last_value;
+    mutable std::chrono::system_clock::time_point timestamp;
+  };
+
   mutable std::mutex mutex_;
-  std::map<std::tuple<LabelTypes...>,
-           std::pair<std::chrono::system_clock::time_point, double>> values_;
+  // Updates the timestamp of |entry| if its value changed, and returns
+  // both. |mutex_| must be held.
+  Metric::TimestampedValue StampedValue(
+      const Entry& entry,
+      const std::chrono::system_clock::time_point& now) const;
+
+  std::map<std::tuple<LabelTypes...>, Entry> values_;
 
   DISALLOW_COPY_AND_ASSIGN(LabelledValues);
 };
@@ -87,16 +157,14 @@ double LabelledValues<LabelTypes...>::Get(const LabelTypes&... labels) const {
   if (it == values_.end()) {
     return 0;
   }
-  return it->second.second;
+  return it->second.cell->Get();
 }
 
 
 template <class... LabelTypes>
 void LabelledValues<LabelTypes...>::Set(const LabelTypes&... labels,
                                         double value) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  values_[std::tuple<LabelTypes...>(labels...)] =
-      make_pair(std::chrono::system_clock::now(), value);
+  GetCell(labels...)->Set(value);
 }
 
 
@@ -109,31 +177,74 @@ void LabelledValues<LabelTypes...>::Increment(const LabelTypes&... labels) {
 template <class... LabelTypes>
 void LabelledValues<LabelTypes...>::IncrementBy(const LabelTypes&... labels,
                                                 double amount) {
-  std::lock_guard<std::mutex> lock(mutex_);
+  GetCell(labels...)->IncrementBy(amount);
+}
+
+
+template <class... LabelTypes>
+ValueCell* LabelledValues<LabelTypes...>::GetCell(
+    const LabelTypes&... labels) {
   const std::tuple<LabelTypes...> key(labels...);
-  const auto it(values_.find(key));
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it(values_.find(key));
   if (it == values_.end()) {
-    values_[key] = make_pair(std::chrono::system_clock::now(), amount);
-    return;
+    it = values_.emplace(std::piecewise_construct, std::forward_as_tuple(key),
+                         std::forward_as_tuple(label_values(key))).first;
+  }
+  return it->second.cell.get();
+}
+
+
+template <class... LabelTypes>
+Metric::TimestampedValue LabelledValues<LabelTypes...>::StampedValue(
+    const Entry& entry,
+    const std::chrono::system_clock::time_point& now) const {
+  const double value(entry.cell->Get());
+  if (value != entry.last_value) {
+    entry.last_value = value;
+    entry.timestamp = now;
   }
-  values_[key] = make_pair(std::chrono::system_clock::now(),
-                           values_[key].second + amount);
+  return make_pair(entry.timestamp, value);
 }
 
 
 template <class... LabelTypes>
 std::map<std::vector<std::string>, Metric::TimestampedValue>
 LabelledValues<LabelTypes...>::CurrentValues() const {
+  const std::chrono::system_clock::time_point now(
+      std::chrono::system_clock::now());
   std::lock_guard<std::mutex> lock(mutex_);
   std::map<std::vector<std::string>, Metric::TimestampedValue> ret;
 
   for (const auto& v : values_) {
-    ret[label_values(v.first)] = v.second;
+    ret[v.second.labels] = StampedValue(v.second, now);
   }
   return ret;
 }
 
 
+template <class... LabelTypes>
+void LabelledValues<LabelTypes...>::VisitValues(
+    const Metric::ValueVisitor& visitor) const {
+  const std::chrono::system_clock::time_point now(
+      std::chrono::system_clock::now());
+  // Entries are never removed, so their labels can be referred to once
+  // the lock is released.
+  std::vector<std::pair<const std::vector<std::string>*,
+                        Metric::TimestampedValue>> values;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    values.reserve(values_.size());
+    for (const auto& v : values_) {
+      values.emplace_back(&v.second.labels, StampedValue(v.second, now));
+    }
+  }
+  for (const auto& v : values) {
+    visitor(*v.first, v.second);
+  }
+}
+
+
 }  // namespace cert_trans
 
 #endif  // CERT_TRANS_MONITORING_LABELLED_VALUES_H_
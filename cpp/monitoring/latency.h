@@ -1,11 +1,13 @@
 #ifndef CERT_TRANS_MONITORING_LATENCY_H_
 #define CERT_TRANS_MONITORING_LATENCY_H_
 
+#include <memory>
 #include <string>
 
 #include "base/macros.h"
 #include "monitoring/counter.h"
 #include "monitoring/event_metric.h"
+#include "monitoring/histogram.h"
 #include "monitoring/monitoring.h"
 
 namespace cert_trans {
@@ -17,7 +19,10 @@ class ScopedLatency;
 // This class creates two Counter metrics, one called "|base_name|_overall_sum"
 // which contains the sum of all latencies broken down by labels, and another
 // called "|base_name|_count" which contains the number of latency measurements
-// taken, also broken down by labels.
+// taken, also broken down by labels. It also creates a Histogram metric
+// called "|base_name|_distribution", from which the latency quantiles can
+// be estimated. Its buckets are powers of two of |TimeUnit|, from 1/8th
+// of one to about a million.
 //
 // To actually measure latency, you can either call RecordLatency() directly
 // with a latency sample, or use the ScopedLatency() method to return an object
@@ -67,6 +72,7 @@ class Latency {
 
  private:
   EventMetric<LabelTypes...> metric_;
+  const std::unique_ptr<Histogram<LabelTypes...>> histogram_;
 
   DISALLOW_COPY_AND_ASSIGN(Latency);
 };
@@ -105,7 +111,10 @@ Latency<TimeUnit, LabelTypes...>::Latency(
     const std::string& base_name,
     const typename NameType<LabelTypes>::name&... label_names,
     const std::string& help)
-    : metric_(base_name, label_names..., help) {
+    : metric_(base_name, label_names..., help),
+      histogram_(Histogram<LabelTypes...>::New(
+          base_name + "_distribution", label_names...,
+          help + " (distribution)", ExponentialBucketBounds(0.125, 2, 24))) {
 }
 
 
@@ -114,6 +123,11 @@ void Latency<TimeUnit, LabelTypes...>::RecordLatency(
     const LabelTypes&... labels, std::chrono::duration<double> latency) {
   metric_.RecordEvent(labels...,
                       std::chrono::duration_cast<TimeUnit>(latency).count());
+  // Keep the fractional part, the smallest buckets are below one unit.
+  histogram_->Record(
+      labels...,
+      std::chrono::duration<double, typename TimeUnit::period>(latency)
+          .count());
 }
 
 
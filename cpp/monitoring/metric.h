@@ -1,9 +1,12 @@
 #ifndef CERT_TRANS_MONITORING_METRIC_H_
 #define CERT_TRANS_MONITORING_METRIC_H_
 
+#include <chrono>
+#include <functional>
 #include <map>
 #include <ostream>
 #include <set>
+#include <stdint.h>
 #include <string>
 #include <vector>
 
@@ -27,9 +30,21 @@ class Metric {
   typedef std::pair<std::chrono::system_clock::time_point, double>
       TimestampedValue;
 
+  // The values recorded by a HISTOGRAM metric for one set of labels.
+  struct Distribution {
+    // The inclusive upper bound of each bucket, in increasing order.
+    std::vector<double> bounds;
+    // The number of values in each bucket. It has one more element than
+    // |bounds|, for the values above the last bound.
+    std::vector<uint64_t> counts;
+    uint64_t count;
+    double sum;
+  };
+
   enum Type {
     COUNTER,
     GAUGE,
+    HISTOGRAM,
   };
 
   Type Type() const {
@@ -66,6 +81,36 @@ class Metric {
   virtual std::map<std::vector<std::string>, TimestampedValue> CurrentValues()
       const = 0;
 
+  // Only HISTOGRAM metrics have distributions, the others return an
+  // empty map.
+  virtual std::map<std::vector<std::string>, Distribution>
+  CurrentDistributions() const {
+    return std::map<std::vector<std::string>, Distribution>();
+  }
+
+  typedef std::function<void(const std::vector<std::string>& label_values,
+                             const TimestampedValue& value)> ValueVisitor;
+  typedef std::function<void(const std::vector<std::string>& label_values,
+                             const Distribution& distribution)>
+      DistributionVisitor;
+
+  // Calls |visitor| with what CurrentValues() would return, one set of
+  // labels at a time. Implementations should avoid building the whole
+  // map, and must not hold locks which updates need while |visitor|
+  // runs.
+  virtual void VisitValues(const ValueVisitor& visitor) const {
+    for (const auto& v : CurrentValues()) {
+      visitor(v.first, v.second);
+    }
+  }
+
+  // Like VisitValues(), for CurrentDistributions().
+  virtual void VisitDistributions(const DistributionVisitor& visitor) const {
+    for (const auto& d : CurrentDistributions()) {
+      visitor(d.first, d.second);
+    }
+  }
+
  protected:
   Metric(enum Type type, const std::string& name,
          const std::vector<std::string>& label_names, const std::string& help)
@@ -1,11 +1,13 @@
 #include "monitoring/prometheus/exporter.h"
+
+#include <limits>
+
 #include "monitoring/prometheus/metrics.pb.h"
 #include "monitoring/metric.h"
 #include "monitoring/registry.h"
 
 using std::chrono::duration_cast;
 using std::chrono::milliseconds;
-using std::map;
 using std::set;
 using std::string;
 using std::vector;
@@ -26,6 +28,31 @@ void AddLabelTypes(::io::prometheus::client::Metric* metric,
 }
 
 
+void PopulateHistograms(const Metric& metric,
+                        ::io::prometheus::client::MetricFamily* family) {
+  CHECK_NOTNULL(family);
+  metric.VisitDistributions([&metric, family](
+      const vector<string>& label_values,
+      const Metric::Distribution& distribution) {
+    io::prometheus::client::Metric* m(family->add_metric());
+    AddLabelTypes(m, metric.LabelNames(), label_values);
+    io::prometheus::client::Histogram* histogram(m->mutable_histogram());
+    histogram->set_sample_count(distribution.count);
+    histogram->set_sample_sum(distribution.sum);
+    // Prometheus buckets are cumulative, and the last one is +Inf.
+    uint64_t cumulative_count(0);
+    for (size_t i(0); i < distribution.counts.size(); ++i) {
+      cumulative_count += distribution.counts[i];
+      io::prometheus::client::Bucket* bucket(histogram->add_bucket());
+      bucket->set_cumulative_count(cumulative_count);
+      bucket->set_upper_bound(i < distribution.bounds.size()
+                                  ? distribution.bounds[i]
+                                  : std::numeric_limits<double>::infinity());
+    }
+  });
+}
+
+
 ::io::prometheus::client::MetricFamily PopulateMetricFamily(
     const Metric& metric) {
   ::io::prometheus::client::MetricFamily family;
@@ -38,29 +65,32 @@ void AddLabelTypes(::io::prometheus::client::Metric* metric,
     case Metric::GAUGE:
       family.set_type(io::prometheus::client::MetricType::GAUGE);
       break;
+    case Metric::HISTOGRAM:
+      family.set_type(io::prometheus::client::MetricType::HISTOGRAM);
+      PopulateHistograms(metric, &family);
+      return family;
     default:
       LOG(FATAL) << "Unknown metric type: " << metric.Type();
   }
-  const map<vector<string>, Metric::TimestampedValue> values(
-      metric.CurrentValues());
-  const vector<string> label_names(metric.LabelNames());
-  for (auto it(values.begin()); it != values.end(); ++it) {
+  // The values are added as they are visited, without building a map of
+  // them first.
+  metric.VisitValues([&metric, &family](const vector<string>& label_values,
+                                        const Metric::TimestampedValue& value) {
     io::prometheus::client::Metric* m(family.add_metric());
-    AddLabelTypes(m, label_names, it->first);
+    AddLabelTypes(m, metric.LabelNames(), label_values);
     m->set_timestamp_ms(
-        duration_cast<milliseconds>(it->second.first.time_since_epoch())
-            .count());
+        duration_cast<milliseconds>(value.first.time_since_epoch()).count());
     switch (metric.Type()) {
       case Metric::COUNTER:
-        m->mutable_counter()->set_value(it->second.second);
+        m->mutable_counter()->set_value(value.second);
         break;
       case Metric::GAUGE:
-        m->mutable_gauge()->set_value(it->second.second);
+        m->mutable_gauge()->set_value(value.second);
         break;
       default:
         LOG(FATAL) << "Unknown metric type: " << metric.Type();
     }
-  }
+  });
 
   return family;
 }
@@ -7,6 +7,8 @@
 
 namespace cert_trans {
 
+// Each metric family is written to |os| as soon as it is built, so
+// only one of them is held in memory at a time.
 void ExportMetricsToPrometheus(std::ostream* os);
 
 
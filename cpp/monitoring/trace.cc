@@ -0,0 +1,141 @@
+#include "monitoring/trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <sstream>
+
+using std::chrono::duration;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::milli;
+using std::mutex;
+using std::ostringstream;
+using std::shared_ptr;
+using std::string;
+
+DEFINE_int32(trace_sample_one_in, 0,
+             "Trace one in this many requests on each thread, to see where "
+             "their time goes. Zero disables tracing.");
+DEFINE_int32(trace_log_threshold_ms, 0,
+             "Only log the traced requests which took at least this many "
+             "milliseconds.");
+
+namespace cert_trans {
+namespace {
+
+
+std::atomic<uint64_t> next_trace_id(1);
+
+// The trace made current by a ScopedTrace on this thread.
+thread_local Trace* current_trace(nullptr);
+// How many TraceSpan are open on this thread.
+thread_local int current_depth(0);
+// Calls left before this thread samples a trace.
+thread_local int calls_until_sample(0);
+
+
+double Milliseconds(const Trace::TimePoint& from, const Trace::TimePoint& to) {
+  return duration<double, milli>(to - from).count();
+}
+
+
+}  // namespace
+
+
+// static
+shared_ptr<Trace> Trace::MaybeStart(const string& name) {
+  if (FLAGS_trace_sample_one_in <= 0) {
+    return nullptr;
+  }
+  if (--calls_until_sample > 0) {
+    return nullptr;
+  }
+  calls_until_sample = FLAGS_trace_sample_one_in;
+  return shared_ptr<Trace>(new Trace(next_trace_id++, name));
+}
+
+
+// static
+Trace* Trace::Current() {
+  return current_trace;
+}
+
+
+Trace::Trace(uint64_t id, const string& name)
+    : id_(id), name_(name), start_(steady_clock::now()) {
+}
+
+
+Trace::~Trace() {
+  const double total_ms(Milliseconds(start_, steady_clock::now()));
+  if (total_ms >= FLAGS_trace_log_threshold_ms) {
+    LOG(INFO) << "Trace " << id_ << " " << name_ << " took " << total_ms
+              << "ms:\n" << ToString();
+  }
+}
+
+
+void Trace::AddSpan(const char* name, const TimePoint& start,
+                    const TimePoint& end) {
+  AddSpan(name, current_depth, start, end);
+}
+
+
+void Trace::AddSpan(const char* name, int depth, const TimePoint& start,
+                    const TimePoint& end) {
+  lock_guard<mutex> lock(mutex_);
+  spans_.push_back(Span{name, depth, start, end});
+}
+
+
+string Trace::ToString() const {
+  std::vector<Span> spans;
+  {
+    lock_guard<mutex> lock(mutex_);
+    spans = spans_;
+  }
+  // Spans are added when they end, so the outer ones come last.
+  std::stable_sort(spans.begin(), spans.end(),
+                   [](const Span& a, const Span& b) {
+                     return a.start < b.start;
+                   });
+
+  ostringstream oss;
+  for (const auto& span : spans) {
+    oss << string(2 * (span.depth + 1), ' ') << "+"
+        << Milliseconds(start_, span.start) << "ms " << span.name << ": "
+        << Milliseconds(span.start, span.end) << "ms\n";
+  }
+  return oss.str();
+}
+
+
+ScopedTrace::ScopedTrace(Trace* trace) : previous_(current_trace) {
+  current_trace = trace;
+}
+
+
+ScopedTrace::~ScopedTrace() {
+  current_trace = previous_;
+}
+
+
+TraceSpan::TraceSpan(const char* name) : trace_(current_trace), name_(name) {
+  if (trace_) {
+    start_ = steady_clock::now();
+    ++current_depth;
+  }
+}
+
+
+TraceSpan::~TraceSpan() {
+  if (trace_) {
+    --current_depth;
+    trace_->AddSpan(name_, current_depth, start_, steady_clock::now());
+  }
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,120 @@
+#ifndef CERT_TRANS_MONITORING_TRACE_H_
+#define CERT_TRANS_MONITORING_TRACE_H_
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// A breakdown of where the time of one request went, made of named
+// spans. Only one in --trace_sample_one_in requests is traced, and a
+// trace is logged when it ends if it took at least
+// --trace_log_threshold_ms.
+//
+// A trace is made current on a thread with a ScopedTrace, and TraceSpan
+// objects on that thread then add themselves to it. When no trace is
+// current, a TraceSpan only costs a thread-local load. To follow a
+// request to another thread, pass the shared_ptr along and make it
+// current again there.
+//
+// Example usage:
+//
+//   void HandleRequest() {
+//     const std::shared_ptr<Trace> trace(Trace::MaybeStart("request"));
+//     ScopedTrace scoped_trace(trace.get());
+//     {
+//       TraceSpan span("parse");
+//       ...
+//     }
+//     executor->Add(std::bind(&ContinueRequest, trace));
+//   }
+class Trace {
+ public:
+  typedef std::chrono::steady_clock::time_point TimePoint;
+
+  // Returns a new trace for one in --trace_sample_one_in calls on each
+  // thread, and nullptr for the others.
+  static std::shared_ptr<Trace> MaybeStart(const std::string& name);
+
+  // Returns the trace made current on this thread by a ScopedTrace, or
+  // nullptr.
+  static Trace* Current();
+
+  // Logs the trace, if it took long enough.
+  ~Trace();
+
+  // Adds a span which ran from |start| to |end|, for the times which
+  // don't belong to a single scope (e.g. waiting in a queue).
+  void AddSpan(const char* name, const TimePoint& start,
+               const TimePoint& end);
+
+  // One line per span, in the order they started, indented by nesting.
+  std::string ToString() const;
+
+ private:
+  struct Span {
+    const char* name;
+    int depth;
+    TimePoint start;
+    TimePoint end;
+  };
+
+  Trace(uint64_t id, const std::string& name);
+
+  void AddSpan(const char* name, int depth, const TimePoint& start,
+               const TimePoint& end);
+
+  const uint64_t id_;
+  const std::string name_;
+  const TimePoint start_;
+  // Spans can be added from several threads.
+  mutable std::mutex mutex_;
+  std::vector<Span> spans_;
+
+  friend class TraceSpan;
+
+  DISALLOW_COPY_AND_ASSIGN(Trace);
+};
+
+
+// Makes |trace| the current trace of this thread for the lifetime of
+// this object. |trace| may be nullptr, and must outlive this object.
+class ScopedTrace {
+ public:
+  explicit ScopedTrace(Trace* trace);
+  ~ScopedTrace();
+
+ private:
+  Trace* const previous_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedTrace);
+};
+
+
+// Adds the time between its construction and destruction as a span of
+// the current trace of this thread, if there is one. |name| must be a
+// string literal (or outlive the trace).
+class TraceSpan {
+ public:
+  explicit TraceSpan(const char* name);
+  ~TraceSpan();
+
+ private:
+  Trace* const trace_;
+  const char* const name_;
+  Trace::TimePoint start_;
+
+  DISALLOW_COPY_AND_ASSIGN(TraceSpan);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_MONITORING_TRACE_H_
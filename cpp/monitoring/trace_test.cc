@@ -0,0 +1,96 @@
+#include "monitoring/trace.h"
+
+#include <gflags/gflags.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+
+#include "util/testing.h"
+
+DECLARE_int32(trace_sample_one_in);
+
+namespace cert_trans {
+
+using std::shared_ptr;
+using std::chrono::steady_clock;
+using testing::HasSubstr;
+
+
+class TraceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    FLAGS_trace_sample_one_in = 1;
+  }
+
+  void TearDown() override {
+    FLAGS_trace_sample_one_in = 0;
+  }
+};
+
+
+TEST_F(TraceTest, TestDisabled) {
+  FLAGS_trace_sample_one_in = 0;
+  EXPECT_FALSE(Trace::MaybeStart("request"));
+}
+
+
+TEST_F(TraceTest, TestSamples) {
+  FLAGS_trace_sample_one_in = 3;
+  int sampled(0);
+  for (int i = 0; i < 9; ++i) {
+    if (Trace::MaybeStart("request")) {
+      ++sampled;
+    }
+  }
+  EXPECT_EQ(3, sampled);
+}
+
+
+TEST_F(TraceTest, TestSpansWithoutTrace) {
+  EXPECT_EQ(nullptr, Trace::Current());
+  TraceSpan span("nothing");
+}
+
+
+TEST_F(TraceTest, TestRecordsNestedSpans) {
+  const shared_ptr<Trace> trace(Trace::MaybeStart("request"));
+  ASSERT_TRUE(trace);
+  {
+    ScopedTrace scoped_trace(trace.get());
+    EXPECT_EQ(trace.get(), Trace::Current());
+    TraceSpan outer("outer");
+    TraceSpan inner("inner");
+  }
+  EXPECT_EQ(nullptr, Trace::Current());
+
+  const std::string spans(trace->ToString());
+  EXPECT_THAT(spans, HasSubstr("  +"));
+  EXPECT_LT(spans.find("outer"), spans.find("inner"));
+  EXPECT_THAT(spans, HasSubstr("    +"));
+}
+
+
+TEST_F(TraceTest, TestFollowsToOtherThread) {
+  const shared_ptr<Trace> trace(Trace::MaybeStart("request"));
+  ASSERT_TRUE(trace);
+  const steady_clock::time_point queued_at(steady_clock::now());
+  std::thread thread([trace, queued_at]() {
+    ScopedTrace scoped_trace(trace.get());
+    trace->AddSpan("queue", queued_at, steady_clock::now());
+    TraceSpan span("work");
+  });
+  thread.join();
+
+  EXPECT_THAT(trace->ToString(), HasSubstr("queue"));
+  EXPECT_THAT(trace->ToString(), HasSubstr("work"));
+}
+
+
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
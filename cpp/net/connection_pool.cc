@@ -4,6 +4,7 @@
 #include <event2/event.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <vector>
 
 #include "monitoring/monitoring.h"
 #include "util/openssl_util.h"
@@ -31,6 +32,7 @@ using std::to_string;
 using std::unique_lock;
 using std::unique_ptr;
 using std::shared_ptr;
+using std::vector;
 using util::ClearOpenSSLErrors;
 using util::DumpOpenSSLErrorStack;
 
@@ -50,6 +52,13 @@ DEFINE_string(trusted_root_certs, "/etc/ssl/certs/ca-certificates.crt",
               "connections.");
 DEFINE_int32(url_fetcher_max_conn_per_host_port, 4,
              "maximum number of URL fetcher connections per host:port");
+DEFINE_int32(connection_pool_min_idle_per_host_port, 0,
+             "if non-zero, whenever a connection to a host:port is taken "
+             "from the pool, new ones are opened so that at least this many "
+             "are left idle and ready for the next requests");
+DEFINE_bool(url_fetcher_tls_session_resumption, true,
+            "resume the most recent TLS session with a host:port when "
+            "opening another connection to it, which saves a full handshake");
 
 DEFINE_string(tls_client_minimum_protocol, "tlsv12",
               "Minimum acceptable TLS "
@@ -81,6 +90,11 @@ static Gauge<string>* connections_per_host_port(
     Gauge<string>::New("connections_per_host_port", "host_port",
                        "Number of cached connections port host:port"));
 
+static Counter<string>* tls_handshakes(
+    Counter<string>::New("connection_pool_tls_handshakes", "type",
+                         "Number of TLS handshakes done by returned "
+                         "connections, by type (\"full\" or \"resumed\")."));
+
 
 namespace {
 
@@ -118,7 +132,8 @@ class EvConnection {
   EvConnection(evhtp_connection_t* conn, HostPortPair&& other_end)
       : ev_conn_(CHECK_NOTNULL(conn)),
         other_end_(move(other_end)),
-        errored_(false) {
+        errored_(false),
+        returned_(false) {
     if (ev_conn_->ssl) {
       SSL_set_ex_data(ev_conn_->ssl, GetSSLConnectionIndex(),
                       static_cast<void*>(this));
@@ -144,6 +159,15 @@ class EvConnection {
     return errored_;
   }
 
+  // Returns true only the first time it is called, to do things once
+  // per connection rather than once per request.
+  bool FirstReturn() {
+    lock_guard<mutex> lock(lock_);
+    const bool first(!returned_);
+    returned_ = true;
+    return first;
+  }
+
  private:
   // We never really own this, evhtp does, as it likes to remind us.
   evhtp_connection_t* ev_conn_;
@@ -151,6 +175,7 @@ class EvConnection {
 
   mutable std::mutex lock_;
   bool errored_;
+  bool returned_;
 };
 
 
@@ -295,6 +320,11 @@ ConnectionPool::ConnectionPool(libevent::Base* base)
 
   SSL_CTX_set_verify(ssl_ctx_.get(), SSL_VERIFY_PEER,
                      EvConnection::SSLVerifyCallback);
+
+  CHECK_GE(FLAGS_connection_pool_min_idle_per_host_port, 0);
+  CHECK_LE(FLAGS_connection_pool_min_idle_per_host_port,
+           FLAGS_url_fetcher_max_conn_per_host_port)
+      << "pre-warmed connections would be cleaned up right away";
 }
 
 
@@ -405,59 +435,106 @@ void ConnectionPool::RemoveDeadConnectionsFromDeque(
 }
 
 
-unique_ptr<ConnectionPool::Connection> ConnectionPool::Get(const URL& url) {
-  CHECK(url.Protocol() == "http" || url.Protocol() == "https");
-  const uint16_t default_port(url.Protocol() == "https" ? 443 : 80);
-  HostPortPair key(url.Host(), url.Port() != 0 ? url.Port() : default_port);
-  unique_lock<mutex> lock(lock_);
+ConnectionPool::HostPool* ConnectionPool::GetHostPool(
+    const HostPortPair& key) {
+  lock_guard<mutex> lock(lock_);
+  unique_ptr<HostPool>& host(hosts_[key]);
+  if (!host) {
+    host.reset(new HostPool);
+  }
+  return host.get();
+}
 
-  auto it(conns_.find(key));
 
-  if (it != conns_.end() && !it->second.empty()) {
-    RemoveDeadConnectionsFromDeque(lock, &it->second);
+unique_ptr<ConnectionPool::Connection> ConnectionPool::NewConnection(
+    bool https, const shared_ptr<SSL_SESSION>& session, HostPortPair key) {
+  VLOG(1) << "new evhtp_connection for " << key.first << ":" << key.second;
+  // This EvConnection has a slightly complicated lifetime; it needs to hang
+  // around until libevhtp/libevent have entirely finished with the
+  // evhtp_connection_t it references, and for at least as long as the life
+  // of the Connection we return from this method.
+  //
+  // This is accomplished through the use of a couple of shared_ptrs;
+  // this one, which goes inside the returned Connection object, and another
+  // created further below which gets passed in to the
+  // ConnectionFinishedHook.
+  auto conn(std::make_shared<EvConnection>(
+      https ? base_->HttpsConnectionNew(key.first, key.second, ssl_ctx_.get())
+            : base_->HttpConnectionNew(key.first, key.second),
+      move(key)));
+  if (session) {
+    // Like the SNI hostname, this gets in before the handshake, which
+    // can only start once the TCP connection is established.
+    SSL_set_session(conn->connection()->ssl, session.get());
   }
+  unique_ptr<ConnectionPool::Connection> handle(new Connection(conn));
+  struct timeval read_timeout = {FLAGS_connection_read_timeout_seconds,
+                                 kZeroMillis};
+  struct timeval write_timeout = {FLAGS_connection_write_timeout_seconds,
+                                  kZeroMillis};
+  evhtp_connection_set_timeouts(handle->connection(), &read_timeout,
+                                &write_timeout);
+  evhtp_set_hook(&handle->connection()->hooks, evhtp_hook_on_conn_error,
+                 reinterpret_cast<evhtp_hook>(
+                     EvConnection::ConnectionErrorHook),
+                 reinterpret_cast<void*>(conn.get()));
+  evhtp_set_hook(
+      &handle->connection()->hooks, evhtp_hook_on_connection_fini,
+      reinterpret_cast<evhtp_hook>(EvConnection::ConnectionFinishedHook),
+      // We'll hold on to another shared_ptr to the Connection
+      // until evhtp tells us that it's finished with the cnxn.
+      reinterpret_cast<void*>(new shared_ptr<EvConnection>(conn)));
+  return handle;
+}
 
-  if (it == conns_.end() || it->second.empty()) {
-    VLOG(1) << "new evhtp_connection for " << key.first << ":" << key.second;
-    // This EvConnection has a slightly complicated lifetime; it needs to hang
-    // around until libevhtp/libevent have entirely finished with the
-    // evhtp_connection_t it references, and for at least as long as the life
-    // of the Connection we return from this method.
-    //
-    // This is accomplished through the use of a couple of shared_ptrs;
-    // this one, which goes inside the returned Connection object, and another
-    // created further below which gets passed in to the
-    // ConnectionFinishedHook.
-    auto conn(std::make_shared<EvConnection>(
-        url.Protocol() == "https"
-            ? base_->HttpsConnectionNew(key.first, key.second, ssl_ctx_.get())
-            : base_->HttpConnectionNew(key.first, key.second),
-        move(key)));
-    unique_ptr<ConnectionPool::Connection> handle(new Connection(conn));
-    struct timeval read_timeout = {FLAGS_connection_read_timeout_seconds,
-                                   kZeroMillis};
-    struct timeval write_timeout = {FLAGS_connection_write_timeout_seconds,
-                                    kZeroMillis};
-    evhtp_connection_set_timeouts(handle->connection(), &read_timeout,
-                                  &write_timeout);
-    evhtp_set_hook(&handle->connection()->hooks, evhtp_hook_on_conn_error,
-                   reinterpret_cast<evhtp_hook>(
-                       EvConnection::ConnectionErrorHook),
-                   reinterpret_cast<void*>(conn.get()));
-    evhtp_set_hook(
-        &handle->connection()->hooks, evhtp_hook_on_connection_fini,
-        reinterpret_cast<evhtp_hook>(EvConnection::ConnectionFinishedHook),
-        // We'll hold on to another shared_ptr to the Connection
-        // until evhtp tells us that it's finished with the cnxn.
-        reinterpret_cast<void*>(new shared_ptr<EvConnection>(conn)));
-    return handle;
+
+unique_ptr<ConnectionPool::Connection> ConnectionPool::Get(const URL& url) {
+  CHECK(url.Protocol() == "http" || url.Protocol() == "https");
+  const bool https(url.Protocol() == "https");
+  const uint16_t default_port(https ? 443 : 80);
+  const HostPortPair key(url.Host(),
+                         url.Port() != 0 ? url.Port() : default_port);
+  HostPool* const host(GetHostPool(key));
+
+  unique_ptr<ConnectionPool::Connection> retval;
+  shared_ptr<SSL_SESSION> session;
+  size_t num_idle;
+  {
+    lock_guard<mutex> lock(host->lock);
+    // Dead connections further down are left for Cleanup() to reap.
+    while (!retval && !host->idle.empty()) {
+      retval = move(host->idle.back().second);
+      host->idle.pop_back();
+      if (!retval->connection()) {
+        retval.reset();
+      }
+    }
+    if (https) {
+      session = host->session;
+    }
+    num_idle = host->idle.size();
   }
 
-  VLOG(1) << "cached evhtp_connection for " << key.first << ":" << key.second;
-  unique_ptr<ConnectionPool::Connection> retval(
-      move(it->second.back().second));
-  it->second.pop_back();
-  CHECK_NOTNULL(retval->connection());
+  // New connections are made without holding the lock, as resolving
+  // the hostname can block.
+  if (retval) {
+    VLOG(1) << "cached evhtp_connection for " << key.first << ":"
+            << key.second;
+  } else {
+    retval = NewConnection(https, session, key);
+  }
+
+  // Start connecting ahead of time, so that the next requests in a
+  // burst don't all wait for a handshake.
+  for (; num_idle <
+         static_cast<size_t>(FLAGS_connection_pool_min_idle_per_host_port);
+       ++num_idle) {
+    VLOG(1) << "pre-warming a connection to " << key.first << ":"
+            << key.second;
+    unique_ptr<Connection> warm(NewConnection(https, session, key));
+    lock_guard<mutex> lock(host->lock);
+    host->idle.emplace_back(make_pair(system_clock::now(), move(warm)));
+  }
 
   return retval;
 }
@@ -483,42 +560,70 @@ void ConnectionPool::Put(unique_ptr<ConnectionPool::Connection> handle) {
 
   const HostPortPair& key(handle->other_end());
   VLOG(1) << "returned Connection for " << key.first << ":" << key.second;
-  lock_guard<mutex> lock(lock_);
-  auto& entry(conns_[key]);
+  HostPool* const host(GetHostPool(key));
+  SSL* const ssl(handle->connection()->ssl);
+  const bool remember_session(ssl && SSL_is_init_finished(ssl) &&
+                              handle->connection_->FirstReturn());
+  const string hostport(HostPortString(key));
 
   CHECK_GE(FLAGS_url_fetcher_max_conn_per_host_port, 0);
-  entry.emplace_back(make_pair(system_clock::now(), move(handle)));
-  const string hostport(HostPortString(key));
-  VLOG(1) << "ConnectionPool for " << hostport << " size : " << entry.size();
-  connections_per_host_port->Set(hostport, entry.size());
-  if (!cleanup_scheduled_ &&
-      entry.size() >
-          static_cast<uint>(FLAGS_url_fetcher_max_conn_per_host_port)) {
-    cleanup_scheduled_ = true;
+  lock_guard<mutex> lock(host->lock);
+  if (remember_session) {
+    RememberSession(host, ssl);
+  }
+  host->idle.emplace_back(make_pair(system_clock::now(), move(handle)));
+  VLOG(1) << "ConnectionPool for " << hostport
+          << " size : " << host->idle.size();
+  connections_per_host_port->Set(hostport, host->idle.size());
+  if (host->idle.size() >
+          static_cast<uint>(FLAGS_url_fetcher_max_conn_per_host_port) &&
+      !cleanup_scheduled_.exchange(true)) {
     base_->Add(bind(&ConnectionPool::Cleanup, this));
   }
 }
 
 
+// static
+void ConnectionPool::RememberSession(HostPool* host, SSL* ssl) {
+  tls_handshakes->Increment(SSL_session_reused(ssl) ? "resumed" : "full");
+  if (!FLAGS_url_fetcher_tls_session_resumption) {
+    return;
+  }
+
+  SSL_SESSION* const session(SSL_get1_session(ssl));
+  if (session) {
+    host->session.reset(session, SSL_SESSION_free);
+  }
+}
+
+
 void ConnectionPool::Cleanup() {
-  unique_lock<mutex> lock(lock_);
   cleanup_scheduled_ = false;
   const system_clock::time_point cutoff(
       system_clock::now() -
       seconds(FLAGS_connection_pool_max_unused_age_seconds));
 
-  // conns_ is a std::map<HostPortPair, std::deque<TimestampedConnection>>
-  for (auto& entry : conns_) {
-    RemoveDeadConnectionsFromDeque(lock, &entry.second);
-    while (entry.second.front().first < cutoff &&
-           entry.second.size() >
-               static_cast<uint>(FLAGS_url_fetcher_max_conn_per_host_port)) {
-      entry.second.pop_front();
+  vector<pair<HostPortPair, HostPool*>> hosts;
+  {
+    lock_guard<mutex> lock(lock_);
+    for (const auto& entry : hosts_) {
+      hosts.emplace_back(entry.first, entry.second.get());
+    }
+  }
+
+  for (const auto& entry : hosts) {
+    unique_lock<mutex> lock(entry.second->lock);
+    std::deque<TimestampedConnection>* const idle(&entry.second->idle);
+    RemoveDeadConnectionsFromDeque(lock, idle);
+    while (idle->size() >
+               static_cast<uint>(FLAGS_url_fetcher_max_conn_per_host_port) &&
+           idle->front().first < cutoff) {
+      idle->pop_front();
     }
     const string hostport(HostPortString(entry.first));
     VLOG(1) << "ConnectionPool for " << hostport
-            << " size : " << entry.second.size();
-    connections_per_host_port->Set(hostport, entry.second.size());
+            << " size : " << idle->size();
+    connections_per_host_port->Set(hostport, idle->size());
   }
 }
 
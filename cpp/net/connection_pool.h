@@ -1,6 +1,7 @@
 #ifndef CERT_TRANS_NET_CONNECTION_POOL_H_
 #define CERT_TRANS_NET_CONNECTION_POOL_H_
 
+#include <atomic>
 #include <deque>
 #include <map>
 #include <memory>
@@ -68,19 +69,36 @@ class ConnectionPool {
   typedef std::pair<std::chrono::system_clock::time_point,
                     std::unique_ptr<Connection>> TimestampedConnection;
 
+  // The connections to one host:port, which have their own lock so
+  // that requests to different hosts don't contend.
+  struct HostPool {
+    std::mutex lock;
+    // We get and put connections from the back of the deque, and when
+    // there are too many, we prune them from the front (LIFO).
+    std::deque<TimestampedConnection> idle;
+    // The most recent TLS session, which new connections try to
+    // resume.
+    std::shared_ptr<SSL_SESSION> session;
+  };
+
   static void RemoveDeadConnectionsFromDeque(
       const std::unique_lock<std::mutex>& lock,
       std::deque<TimestampedConnection>* deque);
+  // Must be called with the lock of |host| held.
+  static void RememberSession(HostPool* host, SSL* ssl);
 
+  HostPool* GetHostPool(const HostPortPair& key);
+  std::unique_ptr<Connection> NewConnection(
+      bool https, const std::shared_ptr<SSL_SESSION>& session,
+      HostPortPair key);
   void Cleanup();
 
   libevent::Base* const base_;
 
+  // Only protects the map itself, entries are never removed.
   std::mutex lock_;
-  // We get and put connections from the back of the deque, and when
-  // there are too many, we prune them from the front (LIFO).
-  std::map<HostPortPair, std::deque<TimestampedConnection>> conns_;
-  bool cleanup_scheduled_;
+  std::map<HostPortPair, std::unique_ptr<HostPool>> hosts_;
+  std::atomic<bool> cleanup_scheduled_;
 
   std::unique_ptr<evhtp_ssl_ctx_t, void (*)(evhtp_ssl_ctx_t*)> ssl_ctx_;
 
@@ -1,40 +1,117 @@
 #include "net/url_fetcher.h"
 
+#include <atomic>
 #include <evhtp.h>
 #include <event2/buffer.h>
+#include <event2/bufferevent.h>
 #include <event2/keyvalq_struct.h>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <htparse.h>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <vector>
 
+#include "monitoring/monitoring.h"
 #include "net/connection_pool.h"
 #include "util/thread_pool.h"
 
 using cert_trans::internal::ConnectionPool;
 using std::bind;
 using std::endl;
+using std::function;
+using std::lock_guard;
 using std::make_pair;
+using std::make_shared;
 using std::move;
+using std::mutex;
 using std::ostream;
+using std::pair;
+using std::placeholders::_1;
+using std::shared_ptr;
 using std::string;
 using std::to_string;
 using std::unique_ptr;
+using std::vector;
 using util::Status;
 using util::Task;
 using util::TaskHold;
 
+DEFINE_bool(url_fetcher_coalesce_gets, false,
+            "if true, a GET for the same URL and headers as one that is "
+            "already in progress waits for that one's response instead of "
+            "being sent again");
+DEFINE_int32(url_fetcher_event_loops, 1,
+             "number of event loops the URL fetcher spreads its requests "
+             "over, the first being the one it is given; the others get a "
+             "thread each");
+
 namespace cert_trans {
 
+namespace {
+
+
+static Counter<string, string>* coalesced_gets(
+    Counter<string, string>::New("url_fetcher_coalesced_gets", "path",
+                                 "result",
+                                 "Number of coalescable GETs by URL path, and "
+                                 "whether they were sent or joined one "
+                                 "already in flight."));
+
+
+}  // namespace
+
 
 struct UrlFetcher::Impl {
+  // An event loop and the connections that live on it.
+  struct Loop {
+    explicit Loop(libevent::Base* base) : base_(base), pool_(base_) {
+    }
+
+    libevent::Base* const base_;
+    internal::ConnectionPool pool_;
+  };
+
   Impl(libevent::Base* base, ThreadPool* thread_pool)
-      : base_(CHECK_NOTNULL(base)),
-        thread_pool_(CHECK_NOTNULL(thread_pool)),
-        pool_(base_) {
+      : thread_pool_(CHECK_NOTNULL(thread_pool)), next_loop_(0) {
+    CHECK_LT(0, FLAGS_url_fetcher_event_loops);
+    loops_.emplace_back(new Loop(CHECK_NOTNULL(base)));
+    for (int i = 1; i < FLAGS_url_fetcher_event_loops; ++i) {
+      extra_bases_.emplace_back(make_shared<libevent::Base>());
+      extra_pumps_.emplace_back(
+          new libevent::EventPumpThread(extra_bases_.back()));
+      loops_.emplace_back(new Loop(extra_bases_.back().get()));
+    }
+  }
+
+  // A GET that is in progress on behalf of several callers.
+  struct Flight {
+    UrlFetcher::Response response;
+    vector<pair<UrlFetcher::Response*, Task*>> waiters;
+  };
+
+  void Start(const Request& req, Response* resp, Task* task);
+  void FlightDone(const string& key, const shared_ptr<Flight>& flight,
+                  Task* task);
+
+  // Spreads the requests over the loops in turn.
+  Loop* NextLoop() {
+    return loops_[next_loop_++ % loops_.size()].get();
   }
 
-  libevent::Base* const base_;
   ThreadPool* const thread_pool_;
-  internal::ConnectionPool pool_;
+  // The loops other than the one we were given, in the order they
+  // have to be destroyed in: the pools, then the threads, then the
+  // bases.
+  vector<shared_ptr<libevent::Base>> extra_bases_;
+  vector<unique_ptr<libevent::EventPumpThread>> extra_pumps_;
+  vector<unique_ptr<Loop>> loops_;
+  std::atomic<unsigned> next_loop_;
+
+  mutex flights_lock_;
+  // Keyed by the URL and headers of the request.
+  std::map<string, shared_ptr<Flight>> flights_;
 };
 
 
@@ -74,8 +151,23 @@ struct State {
   // The following methods must only be called on the libevent
   // dispatch thread.
   void RunRequest();
+  void HeadersDone(evhtp_request_t* req);
+  void BodyRead(evbuffer* chunk);
   void RequestDone(evhtp_request_t* req);
 
+  // Whether reading the response of a Request::body_stream is paused,
+  // and whether the request is over, after which resuming must leave
+  // the connection alone. Only used on the event loop, and shared
+  // with the closures that resume it.
+  struct StreamPause {
+    StreamPause() : bev(nullptr), paused(false), done(false) {
+    }
+
+    bufferevent* bev;
+    bool paused;
+    bool done;
+  };
+
   libevent::Base* const base_;
   ConnectionPool* const pool_;
   const UrlFetcher::Request request_;
@@ -83,6 +175,8 @@ struct State {
   Task* const task_;
 
   unique_ptr<ConnectionPool::Connection> conn_;
+  // Only set for a Request::body_stream.
+  shared_ptr<StreamPause> pause_;
 };
 
 
@@ -91,6 +185,28 @@ void RequestCallback(evhtp_request_t* req, void* userdata) {
 }
 
 
+evhtp_res HeadersCallback(evhtp_request_t* req, evhtp_headers_t*,
+                          void* userdata) {
+  static_cast<State*>(CHECK_NOTNULL(userdata))->HeadersDone(req);
+  return EVHTP_RES_OK;
+}
+
+
+evhtp_res BodyCallback(evhtp_request_t*, evbuffer* chunk, void* userdata) {
+  static_cast<State*>(CHECK_NOTNULL(userdata))->BodyRead(chunk);
+  return EVHTP_RES_OK;
+}
+
+
+void CopyHeaders(evhtp_request_t* req, UrlFetcher::Headers* headers) {
+  headers->clear();
+  for (evhtp_kv_s* ptr = req->headers_in->tqh_first; ptr;
+       ptr = ptr->next.tqe_next) {
+    headers->insert(make_pair(ptr->key, ptr->val));
+  }
+}
+
+
 UrlFetcher::Request NormaliseRequest(UrlFetcher::Request req) {
   if (req.url.Path().empty()) {
     req.url.SetPath("/");
@@ -146,6 +262,13 @@ void State::RunRequest() {
                              evhtp_header_new(header.first.c_str(),
                                               header.second.c_str(), 1, 1));
   }
+  if (request_.body_stream) {
+    pause_ = make_shared<StreamPause>();
+    evhtp_set_hook(&http_req->hooks, evhtp_hook_on_headers,
+                   reinterpret_cast<evhtp_hook>(&HeadersCallback), this);
+    evhtp_set_hook(&http_req->hooks, evhtp_hook_on_read,
+                   reinterpret_cast<evhtp_hook>(&BodyCallback), this);
+  }
 
   if (!conn_->connection() || conn_->GetErrored()) {
     conn_.reset();
@@ -184,6 +307,51 @@ void State::RunRequest() {
 }
 
 
+// Copies the chain straight into the string, rather than having
+// evbuffer_pullup() make it contiguous first.
+void BufferToString(evbuffer* buffer, string* out) {
+  out->resize(evbuffer_get_length(buffer));
+  if (!out->empty()) {
+    CHECK_EQ(evbuffer_remove(buffer, &(*out)[0], out->size()),
+             static_cast<int>(out->size()));
+  }
+}
+
+
+void State::HeadersDone(evhtp_request_t* req) {
+  CHECK(libevent::Base::OnEventThread());
+  response_->status_code = htparser_get_status(req->conn->parser);
+  CopyHeaders(req, &response_->headers);
+  request_.body_stream->OnHeaders(*response_);
+}
+
+
+void State::BodyRead(evbuffer* chunk) {
+  CHECK(libevent::Base::OnEventThread());
+  if (evbuffer_get_length(chunk) == 0) {
+    return;
+  }
+
+  libevent::Base* const base(base_);
+  const shared_ptr<StreamPause> pause(pause_);
+  const function<void()> resume([base, pause]() {
+    base->Add([pause]() {
+      if (pause->paused && !pause->done) {
+        pause->paused = false;
+        bufferevent_enable(pause->bev, EV_READ);
+      }
+    });
+  });
+  if (request_.body_stream->OnBody(chunk, resume) || pause_->paused) {
+    return;
+  }
+  // What was read already is still parsed, and passed on.
+  pause_->paused = true;
+  pause_->bev = conn_->connection()->bev;
+  bufferevent_disable(pause_->bev, EV_READ);
+}
+
+
 struct evhtp_request_deleter {
   void operator()(evhtp_request_t* r) const {
     evhtp_request_free(r);
@@ -194,6 +362,15 @@ struct evhtp_request_deleter {
 void State::RequestDone(evhtp_request_t* req) {
   CHECK(libevent::Base::OnEventThread());
   CHECK(conn_);
+  if (pause_) {
+    pause_->done = true;
+    // The end of the body might have paused reading, which the next
+    // request on this connection needs. After an error, the
+    // connection is not reused.
+    if (req && pause_->paused) {
+      bufferevent_enable(pause_->bev, EV_READ);
+    }
+  }
   this->pool_->Put(move(conn_));
   unique_ptr<evhtp_request_t, evhtp_request_deleter> req_deleter(req);
 
@@ -209,8 +386,8 @@ void State::RequestDone(evhtp_request_t* req) {
     return;
   }
 
-  response_->status_code = req->status;
-  if (response_->status_code < 100) {
+  if (req->status < 100) {
+    response_->status_code = req->status;
     util::Status status;
     switch (response_->status_code) {
       case kTimeout:
@@ -234,17 +411,29 @@ void State::RequestDone(evhtp_request_t* req) {
     return;
   }
 
-  response_->headers.clear();
-  for (evhtp_kv_s* ptr = req->headers_in->tqh_first; ptr;
-       ptr = ptr->next.tqe_next) {
-    response_->headers.insert(make_pair(ptr->key, ptr->val));
+  if (request_.body_stream) {
+    // The status code and headers were set by HeadersDone(), and the
+    // body was streamed.
+    response_->body.clear();
+    response_->body_buffer.reset();
+    VLOG(2) << *response_;
+    task_->Return();
+    return;
   }
 
-  const size_t body_length(evbuffer_get_length(req->buffer_in));
-  string body(reinterpret_cast<const char*>(
-                  evbuffer_pullup(req->buffer_in, body_length)),
-              body_length);
-  response_->body.swap(body);
+  response_->status_code = req->status;
+  CopyHeaders(req, &response_->headers);
+
+  if (request_.body_as_buffer) {
+    // Moving the chain over doesn't copy the data.
+    response_->body.clear();
+    response_->body_buffer.reset(CHECK_NOTNULL(evbuffer_new()), evbuffer_free);
+    CHECK_EQ(evbuffer_add_buffer(response_->body_buffer.get(), req->buffer_in),
+             0);
+  } else {
+    response_->body_buffer.reset();
+    BufferToString(req->buffer_in, &response_->body);
+  }
 
   VLOG(2) << *response_;
 
@@ -273,14 +462,72 @@ UrlFetcher::~UrlFetcher() {
 void UrlFetcher::Fetch(const Request& req, Response* resp, Task* task) {
   TaskHold hold(task);
 
-  State* const state(new State(impl_->base_, &impl_->pool_, req, resp, task));
+  // Only one caller can have the body if it is left in a buffer, or
+  // streamed.
+  if (!FLAGS_url_fetcher_coalesce_gets || req.verb != Verb::GET ||
+      !req.body.empty() || req.body_as_buffer || req.body_stream) {
+    return impl_->Start(req, resp, task);
+  }
+
+  std::ostringstream key_stream;
+  key_stream << req.url << endl << req.headers;
+  const string key(key_stream.str());
+  shared_ptr<Impl::Flight> flight;
+  {
+    lock_guard<mutex> lock(impl_->flights_lock_);
+    auto it(impl_->flights_.find(key));
+    if (it != impl_->flights_.end()) {
+      coalesced_gets->Increment(req.url.Path(), "joined");
+      it->second->waiters.emplace_back(resp, task);
+      return;
+    }
+    flight = make_shared<Impl::Flight>();
+    flight->waiters.emplace_back(resp, task);
+    impl_->flights_.emplace(key, flight);
+  }
+
+  coalesced_gets->Increment(req.url.Path(), "sent");
+  impl_->Start(req, &flight->response,
+               new Task(bind(&Impl::FlightDone, impl_.get(), key, flight, _1),
+                        impl_->thread_pool_));
+}
+
+
+void UrlFetcher::Impl::Start(const Request& req, Response* resp, Task* task) {
+  Loop* const loop(NextLoop());
+  State* const state(new State(loop->base_, &loop->pool_, req, resp, task));
   task->DeleteWhenDone(state);
 
   // Run State::MakeRequest() on the task's executor because it may
   // block doing DNS resolution etc.
   // TODO(alcutter): this can go back to being put straight on the event Base
   // once evhtp supports creating SSL connections to a DNS name.
-  impl_->thread_pool_->Add(bind(&State::MakeRequest, state));
+  thread_pool_->Add(bind(&State::MakeRequest, state));
+}
+
+
+void UrlFetcher::Impl::FlightDone(const string& key,
+                                  const shared_ptr<Flight>& flight,
+                                  Task* task) {
+  unique_ptr<Task> task_deleter(task);
+  {
+    // Requests arriving from now on will need a new fetch.
+    lock_guard<mutex> lock(flights_lock_);
+    CHECK_EQ(1U, flights_.erase(key));
+  }
+
+  for (const auto& waiter : flight->waiters) {
+    *waiter.first = flight->response;
+    waiter.second->Return(task->status());
+  }
+}
+
+
+void FlattenBody(UrlFetcher::Response* resp) {
+  if (resp->body_buffer) {
+    BufferToString(resp->body_buffer.get(), &resp->body);
+    resp->body_buffer.reset();
+  }
 }
 
 
@@ -293,6 +540,10 @@ ostream& operator<<(ostream& output, const UrlFetcher::Response& resp) {
   output << "}" << endl
          << "body: <<EOF" << endl
          << resp.body << "EOF" << endl;
+  if (resp.body_buffer) {
+    output << "body_buffer: " << evbuffer_get_length(resp.body_buffer.get())
+           << " bytes" << endl;
+  }
 
   return output;
 }
@@ -2,6 +2,7 @@
 #define CERT_TRANS_NET_URL_FETCHER_H_
 
 #include <chrono>
+#include <functional>
 #include <map>
 #include <memory>
 #include <string>
@@ -12,6 +13,8 @@
 #include "util/compare.h"
 #include "util/task.h"
 
+struct evbuffer;
+
 namespace cert_trans {
 
 namespace libevent {
@@ -33,16 +36,46 @@ class UrlFetcher {
     DELETE,
   };
 
+  struct Response;
+
+  // Receives the body of a response as it arrives, instead of it
+  // being kept in the Response, see Request::body_stream. Its methods
+  // are called on the event loop of the connection, and must not
+  // block.
+  class BodyStream {
+   public:
+    virtual ~BodyStream() = default;
+
+    // Called once the status code and headers of |resp| are known,
+    // before any of the body.
+    virtual void OnHeaders(const Response& resp) = 0;
+
+    // Called with each part of the body as it arrives, which has to be
+    // taken out of |chunk|. Returning false stops reading from the
+    // connection until |resume| is called, from any thread.
+    virtual bool OnBody(evbuffer* chunk,
+                        const std::function<void()>& resume) = 0;
+  };
+
   struct Request {
-    Request() : verb(Verb::GET) {
+    Request() : verb(Verb::GET), body_as_buffer(false) {
     }
-    Request(const URL& input_url) : verb(Verb::GET), url(input_url) {
+    Request(const URL& input_url)
+        : verb(Verb::GET), url(input_url), body_as_buffer(false) {
     }
 
     Verb verb;
     URL url;
     Headers headers;
     std::string body;
+    // If true, the response body is handed over in
+    // Response::body_buffer rather than copied into Response::body.
+    bool body_as_buffer;
+    // If set, the response body is streamed to it, and the Response
+    // only gets the status code and headers. Implementations other
+    // than this one might fill in the Response as usual without
+    // calling it, so callers have to check whether OnHeaders() was.
+    std::shared_ptr<BodyStream> body_stream;
   };
 
   struct Response {
@@ -52,6 +85,10 @@ class UrlFetcher {
     int status_code;
     Headers headers;
     std::string body;
+    // Only set when the request had |body_as_buffer|, and even then
+    // implementations other than this one might use |body| instead,
+    // so callers have to check.
+    std::shared_ptr<evbuffer> body_buffer;
   };
 
   UrlFetcher(libevent::Base* base, ThreadPool* thread_pool);
@@ -74,6 +111,11 @@ class UrlFetcher {
 };
 
 
+// Moves the body out of |resp->body_buffer| into |resp->body|, if it
+// was left there, for callers that need it as a string after all.
+void FlattenBody(UrlFetcher::Response* resp);
+
+
 std::ostream& operator<<(std::ostream& output, const UrlFetcher::Request& req);
 std::ostream& operator<<(std::ostream& output,
                          const UrlFetcher::Response& resp);
@@ -1,7 +1,9 @@
 #include "config.h"
 
 #include <csignal>
+#include <event2/buffer.h>
 #include <fcntl.h>
+#include <functional>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
@@ -24,6 +26,7 @@
 DECLARE_int32(connection_read_timeout_seconds);
 DECLARE_int32(connection_write_timeout_seconds);
 DECLARE_string(trusted_root_certs);
+DECLARE_bool(url_fetcher_coalesce_gets);
 
 namespace cert_trans {
 
@@ -85,6 +88,31 @@ pid_t RunOpenSSLServer(uint16_t port, const std::string& cert_file,
 }
 
 
+// Keeps what it is handed, pausing after each part of the body.
+class CollectingStream : public UrlFetcher::BodyStream {
+ public:
+  CollectingStream() : status_code_(0) {
+  }
+
+  void OnHeaders(const UrlFetcher::Response& resp) override {
+    status_code_ = resp.status_code;
+  }
+
+  bool OnBody(evbuffer* chunk,
+              const std::function<void()>& resume) override {
+    const size_t length(evbuffer_get_length(chunk));
+    body_.append(reinterpret_cast<const char*>(evbuffer_pullup(chunk, -1)),
+                 length);
+    evbuffer_drain(chunk, length);
+    resume();
+    return false;
+  }
+
+  int status_code_;
+  string body_;
+};
+
+
 }  // namespace
 
 
@@ -120,6 +148,69 @@ TEST_F(UrlFetcherTest, TestCertMatchesHost) {
 }
 
 
+TEST_F(UrlFetcherTest, TestBodyAsBuffer) {
+  UrlFetcher::Request req(
+      URL("https://localhost:" + to_string(kLocalHostPort)));
+  req.body_as_buffer = true;
+  UrlFetcher::Response resp;
+
+  SyncTask task(&pool_);
+  fetcher_->Fetch(req, &resp, task.task());
+  task.Wait();
+  EXPECT_EQ(util::Status::OK, task.status());
+  EXPECT_EQ(200, resp.status_code);
+  EXPECT_TRUE(resp.body.empty());
+  ASSERT_TRUE(resp.body_buffer);
+  const size_t length(evbuffer_get_length(resp.body_buffer.get()));
+  EXPECT_GT(length, 0U);
+
+  FlattenBody(&resp);
+  EXPECT_FALSE(resp.body_buffer);
+  EXPECT_EQ(length, resp.body.size());
+}
+
+
+TEST_F(UrlFetcherTest, TestBodyStream) {
+  UrlFetcher::Request req(
+      URL("https://localhost:" + to_string(kLocalHostPort)));
+  const shared_ptr<CollectingStream> stream(make_shared<CollectingStream>());
+  req.body_stream = stream;
+  UrlFetcher::Response resp;
+
+  SyncTask task(&pool_);
+  fetcher_->Fetch(req, &resp, task.task());
+  task.Wait();
+  EXPECT_EQ(util::Status::OK, task.status());
+  EXPECT_EQ(200, resp.status_code);
+  EXPECT_EQ(200, stream->status_code_);
+  EXPECT_TRUE(resp.body.empty());
+  EXPECT_FALSE(resp.body_buffer);
+  EXPECT_FALSE(stream->body_.empty());
+}
+
+
+TEST_F(UrlFetcherTest, TestCoalescedGets) {
+  FLAGS_url_fetcher_coalesce_gets = true;
+  UrlFetcher::Request req(
+      URL("https://localhost:" + to_string(kLocalHostPort)));
+  UrlFetcher::Response resp1;
+  UrlFetcher::Response resp2;
+
+  SyncTask task1(&pool_);
+  SyncTask task2(&pool_);
+  fetcher_->Fetch(req, &resp1, task1.task());
+  fetcher_->Fetch(req, &resp2, task2.task());
+  task1.Wait();
+  task2.Wait();
+  FLAGS_url_fetcher_coalesce_gets = false;
+  EXPECT_EQ(util::Status::OK, task1.status());
+  EXPECT_EQ(util::Status::OK, task2.status());
+  EXPECT_EQ(200, resp1.status_code);
+  EXPECT_EQ(200, resp2.status_code);
+  EXPECT_FALSE(resp1.body.empty());
+}
+
+
 TEST_F(UrlFetcherTest, TestCertDoesNotMatchHost) {
   UrlFetcher::Request req(
       URL("https://localhost:" + to_string(kNonLocalHostPort)));
@@ -6,6 +6,7 @@
 #include <string>
 
 #include "proto/ct.pb.h"
+#include "proto/tls_codec.h"
 
 using ct::DigitallySigned;
 using ct::DigitallySigned_HashAlgorithm_IsValid;
@@ -36,6 +37,47 @@ const size_t Serializer::kMerkleLeafTypeLengthInBytes = 1;
 const size_t Serializer::kKeyHashLengthInBytes = 32;
 const size_t Serializer::kTimestampLengthInBytes = 8;
 
+namespace {
+
+namespace tls = cert_trans::tls;
+
+// The fields of the structures, with the widths and bounds of the
+// constants above.
+typedef tls::Uint<1> Version;
+typedef tls::Uint<1> SignatureType;
+typedef tls::Uint<1> MerkleLeafType;
+typedef tls::Uint<1> HashAlgorithm;
+typedef tls::Uint<1> SignatureAlgorithm;
+typedef tls::Uint<2> LogEntryType;
+typedef tls::Uint<8> Timestamp;
+typedef tls::Fixed<32> KeyID;
+typedef tls::Fixed<32> KeyHash;
+typedef tls::Opaque<(1 << 24) - 1> ASN1Cert;
+typedef tls::Opaque<(1 << 16) - 1> Extensions;
+typedef tls::Opaque<(1 << 16) - 1> Signature;
+
+typedef tls::Struct<HashAlgorithm, SignatureAlgorithm, Signature>
+    DigitallySignedStruct;
+
+// The fields of an SCT before its signature.
+typedef tls::Struct<Version, KeyID, Timestamp, Extensions> SCTHeader;
+
+// The SCT signature input and the Merkle tree leaf have the same
+// layout, with the signature type or the leaf type after the version.
+typedef tls::Struct<Version, tls::Uint<1>, Timestamp, LogEntryType, ASN1Cert,
+                    Extensions> V1CertTimestampedEntry;
+typedef tls::Struct<Version, tls::Uint<1>, Timestamp, LogEntryType, KeyHash,
+                    ASN1Cert, Extensions> V1PrecertTimestampedEntry;
+
+typedef tls::Struct<Version, SignatureType, Timestamp, tls::Uint<8>,
+                    tls::Fixed<32>> V1STHSignatureInput;
+
+typedef tls::Struct<LogEntryType, ASN1Cert> SignedCertEntryWithType;
+typedef tls::Struct<LogEntryType, KeyHash, ASN1Cert>
+    SignedPrecertEntryWithType;
+
+}  // namespace
+
 // static
 // Returns the number of bytes needed to store a value up to max_length.
 size_t Serializer::PrefixLength(size_t max_length) {
@@ -82,14 +124,9 @@ Serializer::SerializeResult Serializer::SerializeV1CertSCTSignatureInput(
   res = CheckExtensionsFormat(extensions);
   if (res != OK)
     return res;
-  Serializer serializer;
-  serializer.WriteUint(ct::V1, kVersionLengthInBytes);
-  serializer.WriteUint(ct::CERTIFICATE_TIMESTAMP, kSignatureTypeLengthInBytes);
-  serializer.WriteUint(timestamp, kTimestampLengthInBytes);
-  serializer.WriteUint(ct::X509_ENTRY, kLogEntryTypeLengthInBytes);
-  serializer.WriteVarBytes(certificate, kMaxCertificateLength);
-  serializer.WriteVarBytes(extensions, kMaxExtensionsLength);
-  result->assign(serializer.SerializedString());
+  V1CertTimestampedEntry::Encode(result, ct::V1, ct::CERTIFICATE_TIMESTAMP,
+                                 timestamp, ct::X509_ENTRY, certificate,
+                                 extensions);
   return OK;
 }
 
@@ -106,15 +143,10 @@ Serializer::SerializeResult Serializer::SerializeV1PrecertSCTSignatureInput(
   res = CheckExtensionsFormat(extensions);
   if (res != OK)
     return res;
-  Serializer serializer;
-  serializer.WriteUint(ct::V1, kVersionLengthInBytes);
-  serializer.WriteUint(ct::CERTIFICATE_TIMESTAMP, kSignatureTypeLengthInBytes);
-  serializer.WriteUint(timestamp, kTimestampLengthInBytes);
-  serializer.WriteUint(ct::PRECERT_ENTRY, kLogEntryTypeLengthInBytes);
-  serializer.WriteFixedBytes(issuer_key_hash);
-  serializer.WriteVarBytes(tbs_certificate, kMaxCertificateLength);
-  serializer.WriteVarBytes(extensions, kMaxExtensionsLength);
-  result->assign(serializer.SerializedString());
+  V1PrecertTimestampedEntry::Encode(result, ct::V1,
+                                    ct::CERTIFICATE_TIMESTAMP, timestamp,
+                                    ct::PRECERT_ENTRY, issuer_key_hash,
+                                    tbs_certificate, extensions);
   return OK;
 }
 
@@ -149,14 +181,9 @@ Serializer::SerializeResult Serializer::SerializeV1CertSCTMerkleTreeLeaf(
   res = CheckExtensionsFormat(extensions);
   if (res != OK)
     return res;
-  Serializer serializer;
-  serializer.WriteUint(ct::V1, kVersionLengthInBytes);
-  serializer.WriteUint(ct::TIMESTAMPED_ENTRY, kMerkleLeafTypeLengthInBytes);
-  serializer.WriteUint(timestamp, kTimestampLengthInBytes);
-  serializer.WriteUint(ct::X509_ENTRY, kLogEntryTypeLengthInBytes);
-  serializer.WriteVarBytes(certificate, kMaxCertificateLength);
-  serializer.WriteVarBytes(extensions, kMaxExtensionsLength);
-  result->assign(serializer.SerializedString());
+  V1CertTimestampedEntry::Encode(result, ct::V1, ct::TIMESTAMPED_ENTRY,
+                                 timestamp, ct::X509_ENTRY, certificate,
+                                 extensions);
   return OK;
 }
 
@@ -173,15 +200,10 @@ Serializer::SerializeResult Serializer::SerializeV1PrecertSCTMerkleTreeLeaf(
   res = CheckExtensionsFormat(extensions);
   if (res != OK)
     return res;
-  Serializer serializer;
-  serializer.WriteUint(ct::V1, kVersionLengthInBytes);
-  serializer.WriteUint(ct::TIMESTAMPED_ENTRY, kMerkleLeafTypeLengthInBytes);
-  serializer.WriteUint(timestamp, kTimestampLengthInBytes);
-  serializer.WriteUint(ct::PRECERT_ENTRY, kLogEntryTypeLengthInBytes);
-  serializer.WriteFixedBytes(issuer_key_hash);
-  serializer.WriteVarBytes(tbs_certificate, kMaxCertificateLength);
-  serializer.WriteVarBytes(extensions, kMaxExtensionsLength);
-  result->assign(serializer.SerializedString());
+  V1PrecertTimestampedEntry::Encode(result, ct::V1, ct::TIMESTAMPED_ENTRY,
+                                    timestamp, ct::PRECERT_ENTRY,
+                                    issuer_key_hash, tbs_certificate,
+                                    extensions);
   return OK;
 }
 
@@ -213,13 +235,8 @@ Serializer::SerializeResult Serializer::SerializeV1STHSignatureInput(
   CHECK_GE(tree_size, 0);
   if (root_hash.size() != 32)
     return INVALID_HASH_LENGTH;
-  Serializer serializer;
-  serializer.WriteUint(ct::V1, kVersionLengthInBytes);
-  serializer.WriteUint(ct::TREE_HEAD, kSignatureTypeLengthInBytes);
-  serializer.WriteUint(timestamp, kTimestampLengthInBytes);
-  serializer.WriteUint(tree_size, 8);
-  serializer.WriteFixedBytes(root_hash);
-  result->assign(serializer.SerializedString());
+  V1STHSignatureInput::Encode(result, ct::V1, ct::TREE_HEAD, timestamp,
+                              tree_size, root_hash);
   return OK;
 }
 
@@ -235,29 +252,25 @@ Serializer::SerializeResult Serializer::SerializeSTHSignatureInput(
 
 Serializer::SerializeResult Serializer::WriteSCT(
     const SignedCertificateTimestamp& sct) {
-  if (sct.version() != ct::V1)
-    return UNSUPPORTED_VERSION;
-  SerializeResult res = CheckExtensionsFormat(sct.extensions());
+  SerializeResult res = CheckSCTFormat(sct);
   if (res != OK)
     return res;
-  if (sct.id().key_id().size() != kKeyIDLengthInBytes)
-    return INVALID_KEYID_LENGTH;
-  WriteUint(ct::V1, kVersionLengthInBytes);
-  WriteFixedBytes(sct.id().key_id());
-  WriteUint(sct.timestamp(), kTimestampLengthInBytes);
-  WriteVarBytes(sct.extensions(), kMaxExtensionsLength);
+  SCTHeader::Append(output_, ct::V1, sct.id().key_id(), sct.timestamp(),
+                    sct.extensions());
   return WriteDigitallySigned(sct.signature());
 }
 
 // static
 Serializer::SerializeResult Serializer::SerializeSCT(
     const SignedCertificateTimestamp& sct, string* result) {
-  Serializer serializer;
-  SerializeResult res = serializer.WriteSCT(sct);
+  SerializeResult res = CheckSCTFormat(sct);
   if (res != OK)
     return res;
-  result->assign(serializer.SerializedString());
-  return OK;
+  Serializer serializer(result,
+                        SCTHeader::Length(ct::V1, sct.id().key_id(),
+                                          sct.timestamp(), sct.extensions()) +
+                            DigitallySignedLength(sct.signature()));
+  return serializer.WriteSCT(sct);
 }
 
 // static
@@ -293,32 +306,34 @@ Serializer::SerializeResult Serializer::SerializePrecertChainEntry(
 Serializer::SerializeResult Serializer::SerializePrecertChainEntry(
     const std::string& pre_certificate,
     const repeated_string& precertificate_chain, std::string* result) {
-  Serializer serializer;
   if (pre_certificate.size() > kMaxCertificateLength)
     return CERTIFICATE_TOO_LONG;
   if (pre_certificate.empty())
     return EMPTY_CERTIFICATE;
-
-  serializer.WriteVarBytes(pre_certificate, kMaxCertificateLength);
-
+  size_t chain_length;
   SerializeResult res =
-      serializer.WriteList(precertificate_chain, kMaxCertificateLength,
-                           kMaxCertificateChainLength);
+      CheckListFormat(precertificate_chain, kMaxCertificateLength,
+                      kMaxCertificateChainLength, &chain_length);
   if (res != OK)
     return res;
-  result->assign(serializer.SerializedString());
-  return OK;
+
+  Serializer serializer(result,
+                        VarBytesLength(pre_certificate,
+                                       kMaxCertificateLength) +
+                            chain_length);
+  serializer.WriteVarBytes(pre_certificate, kMaxCertificateLength);
+  return serializer.WriteList(precertificate_chain, kMaxCertificateLength,
+                              kMaxCertificateChainLength);
 }
 
 // static
 Serializer::SerializeResult Serializer::SerializeDigitallySigned(
     const DigitallySigned& sig, string* result) {
-  Serializer serializer;
-  SerializeResult res = serializer.WriteDigitallySigned(sig);
+  SerializeResult res = CheckSignatureFormat(sig);
   if (res != OK)
     return res;
-  result->assign(serializer.SerializedString());
-  return OK;
+  Serializer serializer(result, DigitallySignedLength(sig));
+  return serializer.WriteDigitallySigned(sig);
 }
 
 // static
@@ -343,10 +358,7 @@ Serializer::SerializeResult Serializer::SerializeV1SignedCertEntryWithType(
   SerializeResult res = CheckCertificateFormat(leaf_certificate);
   if (res != OK)
     return res;
-  Serializer serializer;
-  serializer.WriteUint(ct::X509_ENTRY, kLogEntryTypeLengthInBytes);
-  serializer.WriteVarBytes(leaf_certificate, kMaxCertificateLength);
-  result->assign(serializer.SerializedString());
+  SignedCertEntryWithType::Encode(result, ct::X509_ENTRY, leaf_certificate);
   return OK;
 }
 
@@ -360,16 +372,13 @@ Serializer::SerializeResult Serializer::SerializeV1SignedPrecertEntryWithType(
   res = CheckKeyHashFormat(issuer_key_hash);
   if (res != OK)
     return res;
-  Serializer serializer;
-  serializer.WriteUint(ct::PRECERT_ENTRY, kLogEntryTypeLengthInBytes);
-  serializer.WriteFixedBytes(issuer_key_hash);
-  serializer.WriteVarBytes(tbs_certificate, kMaxCertificateLength);
-  result->assign(serializer.SerializedString());
+  SignedPrecertEntryWithType::Encode(result, ct::PRECERT_ENTRY,
+                                     issuer_key_hash, tbs_certificate);
   return OK;
 }
 
 void Serializer::WriteFixedBytes(const string& in) {
-  output_.append(in);
+  output_->append(in);
 }
 
 void Serializer::WriteVarBytes(const string& in, size_t max_length) {
@@ -380,6 +389,11 @@ void Serializer::WriteVarBytes(const string& in, size_t max_length) {
   WriteFixedBytes(in);
 }
 
+// static
+size_t Serializer::VarBytesLength(const string& in, size_t max_length) {
+  return PrefixLength(max_length) + in.size();
+}
+
 // static
 size_t Serializer::SerializedListLength(const repeated_string& in,
                                         size_t max_elem_length,
@@ -404,29 +418,41 @@ size_t Serializer::SerializedListLength(const repeated_string& in,
 Serializer::SerializeResult Serializer::SerializeList(
     const repeated_string& in, size_t max_elem_length, size_t max_total_length,
     string* result) {
-  Serializer serializer;
+  size_t length;
   SerializeResult res =
-      serializer.WriteList(in, max_elem_length, max_total_length);
+      CheckListFormat(in, max_elem_length, max_total_length, &length);
   if (res != OK)
     return res;
-  result->assign(serializer.SerializedString());
-  return OK;
+  Serializer serializer(result, length);
+  return serializer.WriteList(in, max_elem_length, max_total_length);
 }
 
-Serializer::SerializeResult Serializer::WriteList(const repeated_string& in,
-                                                  size_t max_elem_length,
-                                                  size_t max_total_length) {
+// static
+Serializer::SerializeResult Serializer::CheckListFormat(
+    const repeated_string& in, size_t max_elem_length, size_t max_total_length,
+    size_t* length) {
   for (int i = 0; i < in.size(); ++i) {
     if (in.Get(i).empty())
       return EMPTY_ELEM_IN_LIST;
     if (in.Get(i).size() > max_elem_length)
       return LIST_ELEM_TOO_LONG;
   }
-  size_t length = SerializedListLength(in, max_elem_length, max_total_length);
-  if (length == 0)
+  *length = SerializedListLength(in, max_elem_length, max_total_length);
+  if (*length == 0)
     return LIST_TOO_LONG;
+  CHECK_GE(*length, PrefixLength(max_total_length));
+  return OK;
+}
+
+Serializer::SerializeResult Serializer::WriteList(const repeated_string& in,
+                                                  size_t max_elem_length,
+                                                  size_t max_total_length) {
+  size_t length;
+  SerializeResult res =
+      CheckListFormat(in, max_elem_length, max_total_length, &length);
+  if (res != OK)
+    return res;
   size_t prefix_length = PrefixLength(max_total_length);
-  CHECK_GE(length, prefix_length);
 
   WriteUint(length - prefix_length, prefix_length);
 
@@ -440,12 +466,30 @@ Serializer::SerializeResult Serializer::WriteDigitallySigned(
   SerializeResult res = CheckSignatureFormat(sig);
   if (res != OK)
     return res;
-  WriteUint(sig.hash_algorithm(), kHashAlgorithmLengthInBytes);
-  WriteUint(sig.sig_algorithm(), kSigAlgorithmLengthInBytes);
-  WriteVarBytes(sig.signature(), kMaxSignatureLength);
+  DigitallySignedStruct::Append(output_, sig.hash_algorithm(),
+                                sig.sig_algorithm(), sig.signature());
   return OK;
 }
 
+// static
+size_t Serializer::DigitallySignedLength(const DigitallySigned& sig) {
+  return DigitallySignedStruct::Length(sig.hash_algorithm(),
+                                      sig.sig_algorithm(), sig.signature());
+}
+
+// static
+Serializer::SerializeResult Serializer::CheckSCTFormat(
+    const SignedCertificateTimestamp& sct) {
+  if (sct.version() != ct::V1)
+    return UNSUPPORTED_VERSION;
+  SerializeResult res = CheckExtensionsFormat(sct.extensions());
+  if (res != OK)
+    return res;
+  if (sct.id().key_id().size() != kKeyIDLengthInBytes)
+    return INVALID_KEYID_LENGTH;
+  return CheckSignatureFormat(sct.signature());
+}
+
 Serializer::SerializeResult Serializer::CheckKeyHashFormat(
     const string& key_hash) {
   if (key_hash.size() != kKeyHashLengthInBytes)
@@ -524,6 +568,10 @@ Deserializer::Deserializer(const string& input)
     : current_pos_(input.data()), bytes_remaining_(input.size()) {
 }
 
+Deserializer::Deserializer(const char* input, size_t length)
+    : current_pos_(input), bytes_remaining_(length) {
+}
+
 Deserializer::DeserializeResult Deserializer::ReadSCT(
     SignedCertificateTimestamp* sct) {
   int version;
@@ -532,19 +580,16 @@ Deserializer::DeserializeResult Deserializer::ReadSCT(
   if (!Version_IsValid(version) || version != ct::V1)
     return UNSUPPORTED_VERSION;
   sct->set_version(ct::V1);
-  if (!ReadFixedBytes(Serializer::kKeyIDLengthInBytes,
-                      sct->mutable_id()->mutable_key_id()))
-    return INPUT_TOO_SHORT;
   // V1 encoding.
   uint64_t timestamp = 0;
-  if (!ReadUint(Serializer::kTimestampLengthInBytes, &timestamp))
-    return INPUT_TOO_SHORT;
-  sct->set_timestamp(timestamp);
   string extensions;
-  if (!ReadVarBytes(Serializer::kMaxExtensionsLength, &extensions))
+  if (!tls::Struct<KeyID, Timestamp, Extensions>::Read(
+          &current_pos_, &bytes_remaining_,
+          sct->mutable_id()->mutable_key_id(), &timestamp, &extensions))
     // In theory, could also be an invalid length prefix, but not if
     // length limits follow byte boundaries.
     return INPUT_TOO_SHORT;
+  sct->set_timestamp(timestamp);
   return ReadDigitallySigned(sct->mutable_signature());
 }
 
@@ -616,15 +661,24 @@ Deserializer::DeserializeResult Deserializer::DeserializePrecertChainEntry(
   return OK;
 }
 
-bool Deserializer::ReadFixedBytes(size_t bytes, string* result) {
+bool Deserializer::ReadFixedBytes(size_t bytes, Slice* result) {
   if (bytes_remaining_ < bytes)
     return false;
-  result->assign(current_pos_, bytes);
+  result->data = current_pos_;
+  result->size = bytes;
   current_pos_ += bytes;
   bytes_remaining_ -= bytes;
   return true;
 }
 
+bool Deserializer::ReadFixedBytes(size_t bytes, string* result) {
+  Slice slice;
+  if (!ReadFixedBytes(bytes, &slice))
+    return false;
+  result->assign(slice.data, slice.size);
+  return true;
+}
+
 bool Deserializer::ReadLengthPrefix(size_t max_length, size_t* result) {
   size_t prefix_length = Serializer::PrefixLength(max_length);
   size_t length;
@@ -634,6 +688,13 @@ bool Deserializer::ReadLengthPrefix(size_t max_length, size_t* result) {
   return true;
 }
 
+bool Deserializer::ReadVarBytes(size_t max_length, Slice* result) {
+  size_t length;
+  if (!ReadLengthPrefix(max_length, &length))
+    return false;
+  return ReadFixedBytes(length, result);
+}
+
 bool Deserializer::ReadVarBytes(size_t max_length, string* result) {
   size_t length;
   if (!ReadLengthPrefix(max_length, &length))
@@ -658,7 +719,7 @@ Deserializer::DeserializeResult Deserializer::DeserializeList(
 Deserializer::DeserializeResult Deserializer::ReadList(size_t max_total_length,
                                                        size_t max_elem_length,
                                                        repeated_string* out) {
-  string serialized_list;
+  Slice serialized_list;
   if (!ReadVarBytes(max_total_length, &serialized_list))
     // TODO(ekasper): could also be a length that's too large, if
     // length limits don't follow byte boundaries.
@@ -666,14 +727,14 @@ Deserializer::DeserializeResult Deserializer::ReadList(size_t max_total_length,
   if (!ReachedEnd())
     return INPUT_TOO_LONG;
 
-  Deserializer list_reader(serialized_list);
+  Deserializer list_reader(serialized_list.data, serialized_list.size);
   while (!list_reader.ReachedEnd()) {
-    string elem;
+    Slice elem;
     if (!list_reader.ReadVarBytes(max_elem_length, &elem))
       return INVALID_LIST_ENCODING;
-    if (elem.empty())
+    if (elem.size == 0)
       return EMPTY_ELEM_IN_LIST;
-    *(out->Add()) = elem;
+    out->Add()->assign(elem.data, elem.size);
   }
   return OK;
 }
@@ -690,14 +751,14 @@ Deserializer::DeserializeResult Deserializer::ReadDigitallySigned(
   if (!DigitallySigned_SignatureAlgorithm_IsValid(sig_algo))
     return INVALID_SIGNATURE_ALGORITHM;
 
-  string sig_string;
+  Slice sig_string;
   if (!ReadVarBytes(Serializer::kMaxSignatureLength, &sig_string))
     return INPUT_TOO_SHORT;
   sig->set_hash_algorithm(
       static_cast<DigitallySigned::HashAlgorithm>(hash_algo));
   sig->set_sig_algorithm(
       static_cast<DigitallySigned::SignatureAlgorithm>(sig_algo));
-  sig->set_signature(sig_string);
+  sig->set_signature(sig_string.data, sig_string.size);
   return OK;
 }
 
@@ -719,40 +780,31 @@ Deserializer::DeserializeResult Deserializer::ReadMerkleTreeLeaf(
 
   ct::TimestampedEntry* entry = leaf->mutable_timestamped_entry();
 
-  uint64_t timestamp;
-  if (!ReadUint(Serializer::kTimestampLengthInBytes, &timestamp))
+  uint64_t timestamp, entry_type;
+  if (!tls::Struct<Timestamp, LogEntryType>::Read(
+          &current_pos_, &bytes_remaining_, &timestamp, &entry_type))
     return INPUT_TOO_SHORT;
   entry->set_timestamp(timestamp);
 
-  int entry_type;
-  if (!ReadUint(Serializer::kLogEntryTypeLengthInBytes, &entry_type))
-    return INPUT_TOO_SHORT;
   if (entry_type != ct::X509_ENTRY && entry_type != ct::PRECERT_ENTRY)
     return UNKNOWN_LOGENTRY_TYPE;
   entry->set_entry_type(static_cast<ct::LogEntryType>(entry_type));
 
+  bool read;
   if (entry_type == ct::X509_ENTRY) {
-    string x509;
-    if (!ReadVarBytes(Serializer::kMaxCertificateLength, &x509))
-      return INPUT_TOO_SHORT;
-    entry->mutable_signed_entry()->set_x509(x509);
+    read = tls::Struct<ASN1Cert, Extensions>::Read(
+        &current_pos_, &bytes_remaining_,
+        entry->mutable_signed_entry()->mutable_x509(),
+        entry->mutable_extensions());
   } else {
-    string issuer_key_hash;
-    if (!ReadFixedBytes(32, &issuer_key_hash))
-      return INPUT_TOO_SHORT;
-    entry->mutable_signed_entry()->mutable_precert()->set_issuer_key_hash(
-        issuer_key_hash);
-    string tbs_certificate;
-    if (!ReadVarBytes(Serializer::kMaxCertificateLength, &tbs_certificate))
-      return INPUT_TOO_SHORT;
-    entry->mutable_signed_entry()->mutable_precert()->set_tbs_certificate(
-        tbs_certificate);
+    ct::PreCert* const precert(
+        entry->mutable_signed_entry()->mutable_precert());
+    read = tls::Struct<KeyHash, ASN1Cert, Extensions>::Read(
+        &current_pos_, &bytes_remaining_, precert->mutable_issuer_key_hash(),
+        precert->mutable_tbs_certificate(), entry->mutable_extensions());
   }
-
-  string extensions;
-  if (!ReadVarBytes(Serializer::kMaxExtensionsLength, &extensions))
+  if (!read)
     return INPUT_TOO_SHORT;
-  entry->set_extensions(extensions);
 
   return OK;
 }
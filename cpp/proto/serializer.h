@@ -10,6 +10,11 @@
 #include "proto/ct.pb.h"
 
 // A utility class for writing protocol buffer fields in canonical TLS style.
+//
+// The static methods write straight into |result|, replacing its
+// contents, so that callers who reuse the same string (along with its
+// buffer) don't allocate once it is large enough. |result| is only
+// modified if serialization succeeds.
 class Serializer {
  public:
   typedef google::protobuf::RepeatedPtrField<std::string> repeated_string;
@@ -57,11 +62,6 @@ class Serializer {
 
   static size_t PrefixLength(size_t max_length);
 
-  // returns binary data
-  std::string SerializedString() const {
-    return output_;
-  }
-
   static SerializeResult CheckLogEntryFormat(const ct::LogEntry& entry);
 
   // Helper method to hide some of the ugly select logic.
@@ -127,9 +127,10 @@ class Serializer {
   // TODO(ekasper): tests for these!
   template <class T>
   static std::string SerializeUint(T in, size_t bytes = sizeof(T)) {
-    Serializer serializer;
+    std::string result;
+    Serializer serializer(&result, bytes);
     serializer.WriteUint(in, bytes);
-    return serializer.SerializedString();
+    return result;
   }
 
   static SerializeResult SerializeDigitallySigned(
@@ -150,9 +151,13 @@ class Serializer {
 
  private:
   // This class is mostly a namespace for static methods, but a
-  // temporary instance of it is made internally.
+  // temporary instance of it is made internally, once the input has
+  // been checked. It clears |output| and reserves |length| bytes in
+  // it, the expected size of the serialization.
   // TODO(pphaneuf): Make this into normal functions in a namespace.
-  Serializer() {
+  Serializer(std::string* output, size_t length) : output_(output) {
+    output_->clear();
+    output_->reserve(length);
   }
 
   template <class T>
@@ -160,8 +165,8 @@ class Serializer {
     CHECK_LE(bytes, sizeof(in));
     CHECK(bytes == sizeof(in) || in >> (bytes * 8) == 0);
     for (; bytes > 0; --bytes)
-      output_.push_back(((in & (static_cast<T>(0xff) << ((bytes - 1) * 8))) >>
-                         ((bytes - 1) * 8)));
+      output_->push_back(((in & (static_cast<T>(0xff) << ((bytes - 1) * 8))) >>
+                          ((bytes - 1) * 8)));
   }
 
   // Fixed-length byte array.
@@ -172,6 +177,9 @@ class Serializer {
   // TODO(ekasper): could return a bool instead.
   void WriteVarBytes(const std::string& in, size_t max_length);
 
+  // Length of the serialization of WriteVarBytes(in, max_length).
+  static size_t VarBytesLength(const std::string& in, size_t max_length);
+
   // Length of the serialized list (with length prefix).
   static size_t SerializedListLength(const repeated_string& in,
                                      size_t max_elem_length,
@@ -185,11 +193,22 @@ class Serializer {
                                        size_t max_elem_length,
                                        size_t max_total_length,
                                        std::string* result);
+  // Checks the list for WriteList, and sets |length| to that of its
+  // serialization.
+  static SerializeResult CheckListFormat(const repeated_string& in,
+                                         size_t max_elem_length,
+                                         size_t max_total_length,
+                                         size_t* length);
   SerializeResult WriteList(const repeated_string& in, size_t max_elem_length,
                             size_t max_total_length);
 
   SerializeResult WriteDigitallySigned(const ct::DigitallySigned& sig);
 
+  static size_t DigitallySignedLength(const ct::DigitallySigned& sig);
+
+  static SerializeResult CheckSCTFormat(
+      const ct::SignedCertificateTimestamp& sct);
+
   static SerializeResult CheckKeyHashFormat(const std::string& key_hash);
 
   static SerializeResult CheckSignatureFormat(const ct::DigitallySigned& sig);
@@ -206,7 +225,7 @@ class Serializer {
   static SerializeResult CheckPrecertChainEntryFormat(
       const ct::PrecertChainEntry& entry);
 
-  std::string output_;
+  std::string* const output_;
 };
 
 class Deserializer {
@@ -216,6 +235,7 @@ class Deserializer {
   // We do not make a copy, so input must remain valid.
   // FIXME: and so we should take a string *, not a string &.
   explicit Deserializer(const std::string& input);
+  Deserializer(const char* input, size_t length);
 
   enum DeserializeResult {
     OK,
@@ -285,10 +305,22 @@ class Deserializer {
     return true;
   }
 
+  // A part of the input, which is read in place rather than copied
+  // until it is stored where it belongs.
+  struct Slice {
+    Slice() : data(nullptr), size(0) {
+    }
+
+    const char* data;
+    size_t size;
+  };
+
+  bool ReadFixedBytes(size_t bytes, Slice* result);
   bool ReadFixedBytes(size_t bytes, std::string* result);
 
   bool ReadLengthPrefix(size_t max_length, size_t* result);
 
+  bool ReadVarBytes(size_t max_length, Slice* result);
   bool ReadVarBytes(size_t max_length, std::string* result);
 
   // FIXME(ekasper): for simplicity these reject if the list has empty
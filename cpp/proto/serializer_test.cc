@@ -2,6 +2,7 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
+#include <string.h>
 #include <string>
 
 #include "proto/ct.pb.h"
@@ -860,6 +861,40 @@ TEST_F(SerializerTest, SerializeDeserializePrecertChainEntry_EmptyChainCert) {
             Serializer::SerializePrecertChainEntry(entry, &result));
 }
 
+TEST_F(SerializerTest, SerializeReplacesResult) {
+  string result("previous contents");
+  EXPECT_EQ(Serializer::OK, Serializer::SerializeSCT(DefaultSCT(), &result));
+  EXPECT_EQ(string(kDefaultSCTHexString), H(result));
+
+  // The same string can be reused.
+  EXPECT_EQ(Serializer::OK,
+            Serializer::SerializeDigitallySigned(DefaultSCTSignature(),
+                                                 &result));
+  EXPECT_EQ(string(kDefaultSCTSignatureHexString), H(result));
+
+  // And it is left alone on failure, even if part of the input is valid.
+  PrecertChainEntry entry;
+  entry.set_pre_certificate("hello");
+  entry.add_precertificate_chain("");
+  EXPECT_EQ(Serializer::EMPTY_ELEM_IN_LIST,
+            Serializer::SerializePrecertChainEntry(entry, &result));
+  SignedCertificateTimestamp sct(DefaultSCT());
+  sct.mutable_signature()->set_signature(
+      string(Serializer::kMaxSignatureLength + 1, 'x'));
+  EXPECT_EQ(Serializer::SIGNATURE_TOO_LONG,
+            Serializer::SerializeSCT(sct, &result));
+  EXPECT_EQ(string(kDefaultSCTSignatureHexString), H(result));
+}
+
+TEST_F(SerializerTest, DeserializeFromPointer) {
+  const string input(B(kDefaultSCTHexString) + "trailing");
+  Deserializer deserializer(input.data(), input.size() - strlen("trailing"));
+  SignedCertificateTimestamp sct;
+  EXPECT_EQ(Deserializer::OK, deserializer.ReadSCT(&sct));
+  EXPECT_TRUE(deserializer.ReachedEnd());
+  CompareSCT(DefaultSCT(), sct);
+}
+
 TEST_F(SerializerTest, SerializeSCTSignedEntryWithType_KatTest) {
   string cert_result, precert_result;
   EXPECT_EQ(Serializer::OK, Serializer::SerializeV1SignedCertEntryWithType(
@@ -0,0 +1,220 @@
+#ifndef CERT_TRANS_PROTO_TLS_CODEC_H_
+#define CERT_TRANS_PROTO_TLS_CODEC_H_
+
+#include <glog/logging.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+// Declarative encoding of TLS structures (RFC 5246, section 4): a
+// structure is declared once as a Struct of its fields, and its
+// encoder, decoder and lengths all come from that declaration. For
+// example, the input of an STH signature is
+//
+//   typedef tls::Struct<tls::Uint<1>, tls::Uint<1>, tls::Uint<8>,
+//                       tls::Uint<8>, tls::Fixed<32>> STHSignatureInput;
+//
+// and is encoded with
+//
+//   STHSignatureInput::Encode(&out, version, type, timestamp, tree_size,
+//                             root_hash);
+//
+// The output is sized once from the values, then written in a single
+// pass. Checking the values against the bounds of the fields (the
+// length of a Fixed, the maximum length of an Opaque) is left to the
+// caller, so that it can return its own errors, and is only
+// DCHECKed here.
+namespace cert_trans {
+namespace tls {
+
+
+// Number of bytes needed to encode values up to |max_value|, as the
+// length prefix of an opaque<0..max_value>.
+constexpr size_t BytesFor(uint64_t max_value) {
+  return max_value > 0xff ? 1 + BytesFor(max_value >> 8) : 1;
+}
+
+
+// An unsigned integer encoded in |Bytes| bytes, big-endian.
+template <size_t Bytes>
+struct Uint {
+  static_assert(Bytes > 0 && Bytes <= 8, "unsupported integer width");
+  static constexpr size_t kMinLength = Bytes;
+  static constexpr size_t kMaxLength = Bytes;
+
+  static size_t Length(uint64_t) {
+    return Bytes;
+  }
+
+  static char* Write(uint64_t value, char* out) {
+    DCHECK(Bytes == 8 || value >> (Bytes * 8) == 0);
+    for (size_t i = Bytes; i > 0; --i) {
+      *out++ = static_cast<char>(value >> ((i - 1) * 8));
+    }
+    return out;
+  }
+
+  static bool Read(const char** in, size_t* remaining, uint64_t* value) {
+    if (*remaining < Bytes) {
+      return false;
+    }
+    uint64_t result(0);
+    for (size_t i = 0; i < Bytes; ++i) {
+      result = (result << 8) | static_cast<unsigned char>((*in)[i]);
+    }
+    *in += Bytes;
+    *remaining -= Bytes;
+    *value = result;
+    return true;
+  }
+};
+
+
+// opaque[Length].
+template <size_t Length_>
+struct Fixed {
+  static constexpr size_t kMinLength = Length_;
+  static constexpr size_t kMaxLength = Length_;
+
+  static size_t Length(const std::string& value) {
+    DCHECK_EQ(Length_, value.size());
+    return Length_;
+  }
+
+  static char* Write(const std::string& value, char* out) {
+    memcpy(out, value.data(), Length_);
+    return out + Length_;
+  }
+
+  static bool Read(const char** in, size_t* remaining, std::string* value) {
+    if (*remaining < Length_) {
+      return false;
+    }
+    value->assign(*in, Length_);
+    *in += Length_;
+    *remaining -= Length_;
+    return true;
+  }
+};
+
+
+// opaque<0..MaxLength>: a length prefix of BytesFor(MaxLength) bytes,
+// followed by the bytes themselves.
+template <size_t MaxLength>
+struct Opaque {
+  typedef Uint<BytesFor(MaxLength)> Prefix;
+  static constexpr size_t kMinLength = Prefix::kMaxLength;
+  static constexpr size_t kMaxLength = Prefix::kMaxLength + MaxLength;
+
+  static size_t Length(const std::string& value) {
+    DCHECK_LE(value.size(), MaxLength);
+    return Prefix::kMaxLength + value.size();
+  }
+
+  static char* Write(const std::string& value, char* out) {
+    out = Prefix::Write(value.size(), out);
+    memcpy(out, value.data(), value.size());
+    return out + value.size();
+  }
+
+  static bool Read(const char** in, size_t* remaining, std::string* value) {
+    uint64_t length;
+    if (!Prefix::Read(in, remaining, &length) || length > MaxLength ||
+        *remaining < length) {
+      return false;
+    }
+    value->assign(*in, length);
+    *in += length;
+    *remaining -= length;
+    return true;
+  }
+};
+
+
+// A structure made of |Fields|, in order. Its methods take one value
+// per field: a uint64_t for a Uint, a std::string for the others.
+template <class... Fields>
+struct Struct;
+
+
+template <>
+struct Struct<> {
+  static constexpr size_t kMinLength = 0;
+  static constexpr size_t kMaxLength = 0;
+
+  static size_t Length() {
+    return 0;
+  }
+
+  static char* Write(char* out) {
+    return out;
+  }
+
+  static bool Read(const char**, size_t*) {
+    return true;
+  }
+};
+
+
+template <class First, class... Rest>
+struct Struct<First, Rest...> {
+  static constexpr size_t kMinLength =
+      First::kMinLength + Struct<Rest...>::kMinLength;
+  static constexpr size_t kMaxLength =
+      First::kMaxLength + Struct<Rest...>::kMaxLength;
+
+  // Length of the encoding of |values|.
+  template <class Value, class... Values>
+  static size_t Length(const Value& value, const Values&... values) {
+    return First::Length(value) + Struct<Rest...>::Length(values...);
+  }
+
+  // Writes the encoding of |values| at |out|, which must have room
+  // for Length(values...) bytes, and returns the end of it.
+  template <class Value, class... Values>
+  static char* Write(char* out, const Value& value, const Values&... values) {
+    return Struct<Rest...>::Write(First::Write(value, out), values...);
+  }
+
+  // Replaces the contents of |out| with the encoding of |values|.
+  template <class... Values>
+  static void Encode(std::string* out, const Values&... values) {
+    out->clear();
+    Append(out, values...);
+  }
+
+  // Appends the encoding of |values| to |out|.
+  template <class... Values>
+  static void Append(std::string* out, const Values&... values) {
+    const size_t start(out->size());
+    const size_t length(Length(values...));
+    out->resize(start + length);
+    char* const end(Write(&(*out)[start], values...));
+    DCHECK_EQ(out->data() + out->size(), end);
+  }
+
+  // Reads the fields at |*in| into |values|, moving |*in| past them.
+  // Returns false if the |*remaining| bytes are too short, or if a
+  // length prefix is over its bound.
+  template <class Value, class... Values>
+  static bool Read(const char** in, size_t* remaining, Value* value,
+                   Values*... values) {
+    return First::Read(in, remaining, value) &&
+           Struct<Rest...>::Read(in, remaining, values...);
+  }
+
+  // Like Read(), but the structure has to take up all of |in|.
+  template <class... Values>
+  static bool Decode(const std::string& in, Values*... values) {
+    const char* pos(in.data());
+    size_t remaining(in.size());
+    return Read(&pos, &remaining, values...) && remaining == 0;
+  }
+};
+
+
+}  // namespace tls
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_PROTO_TLS_CODEC_H_
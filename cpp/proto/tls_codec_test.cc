@@ -0,0 +1,98 @@
+#include "proto/tls_codec.h"
+
+#include <gtest/gtest.h>
+#include <string>
+
+#include "proto/serializer.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace tls {
+namespace {
+
+using std::string;
+
+typedef Struct<Uint<1>, Uint<8>, Fixed<4>, Opaque<(1 << 16) - 1>> Example;
+
+
+TEST(TlsCodecTest, LengthsAreKnownAtCompileTime) {
+  static_assert(Example::kMinLength == 1 + 8 + 4 + 2, "kMinLength");
+  static_assert(Example::kMaxLength == 1 + 8 + 4 + 2 + 65535, "kMaxLength");
+  static_assert(Opaque<255>::kMinLength == 1, "prefix of opaque<0..255>");
+  static_assert(Opaque<(1 << 24) - 1>::kMinLength == 3,
+                "prefix of opaque<0..2^24-1>");
+}
+
+
+TEST(TlsCodecTest, PrefixLengthMatchesSerializer) {
+  for (size_t max : {size_t(255), size_t((1 << 16) - 1),
+                     size_t((1 << 24) - 1)}) {
+    EXPECT_EQ(Serializer::PrefixLength(max), BytesFor(max)) << max;
+  }
+}
+
+
+TEST(TlsCodecTest, EncodesFieldsInOrder) {
+  string out("previous contents");
+  Example::Encode(&out, 0x01, 0x0203040506070809ULL, string("abcd"),
+                  string("xy"));
+  EXPECT_EQ(string("\x01\x02\x03\x04\x05\x06\x07\x08\x09"
+                   "abcd\x00\x02xy",
+                   17),
+            out);
+  EXPECT_EQ(Example::Length(0x01, 0, string("abcd"), string("xy")),
+            out.size());
+}
+
+
+TEST(TlsCodecTest, AppendKeepsExistingContents) {
+  string out("prefix");
+  Struct<Uint<2>>::Append(&out, 0x4142);
+  EXPECT_EQ("prefixAB", out);
+}
+
+
+TEST(TlsCodecTest, DecodesWhatItEncodes) {
+  string encoded;
+  Example::Encode(&encoded, 7, 1234567890123ULL, string("wxyz"),
+                  string("hello"));
+
+  uint64_t small, big;
+  string fixed, opaque;
+  ASSERT_TRUE(Example::Decode(encoded, &small, &big, &fixed, &opaque));
+  EXPECT_EQ(7U, small);
+  EXPECT_EQ(1234567890123ULL, big);
+  EXPECT_EQ("wxyz", fixed);
+  EXPECT_EQ("hello", opaque);
+}
+
+
+TEST(TlsCodecTest, RejectsShortOrLongInput) {
+  string encoded;
+  Example::Encode(&encoded, 7, 8, string("wxyz"), string("hello"));
+
+  uint64_t small, big;
+  string fixed, opaque;
+  EXPECT_FALSE(Example::Decode(encoded.substr(0, encoded.size() - 1), &small,
+                               &big, &fixed, &opaque));
+  EXPECT_FALSE(Example::Decode(encoded + "!", &small, &big, &fixed, &opaque));
+}
+
+
+TEST(TlsCodecTest, RejectsLengthPrefixOverBound) {
+  // A prefix of 3, for an opaque<0..2>.
+  const string encoded("\x03" "abc", 4);
+  string value;
+  EXPECT_FALSE(Struct<Opaque<2>>::Decode(encoded, &value));
+}
+
+
+}  // namespace
+}  // namespace tls
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
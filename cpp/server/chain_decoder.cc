@@ -0,0 +1,582 @@
+#include "server/chain_decoder.h"
+
+#include <ctype.h>
+#include <event2/buffer.h>
+#include <functional>
+#include <glog/logging.h>
+#include <string>
+
+#include "base/macros.h"
+#include "log/cert.h"
+#include "monitoring/monitoring.h"
+
+using std::function;
+using std::move;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using util::Status;
+
+namespace cert_trans {
+namespace {
+
+
+const char kInvalidJson[] = "Unable to parse provided JSON.";
+const char kInvalidChain[] = "Unable to parse provided chain.";
+const char kChainTooLong[] = "Chain too long.";
+// Nothing in a request nests anywhere near this deep, it only bounds
+// the recursion when skipping values.
+const int kMaxDepth = 32;
+
+
+static Counter<string>* rejected_submissions(
+    Counter<string>::New("chain_decoder_rejected_submissions", "reason",
+                         "Number of add-chain, add-pre-chain and add-chains "
+                         "bodies or certificates rejected while decoding, "
+                         "by reason."));
+
+
+bool IsJsonSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+
+bool IsDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+
+int SextetValue(char c) {
+  if (c >= 'A' && c <= 'Z') {
+    return c - 'A';
+  }
+  if (c >= 'a' && c <= 'z') {
+    return c - 'a' + 26;
+  }
+  if (c >= '0' && c <= '9') {
+    return c - '0' + 52;
+  }
+  if (c == '+') {
+    return 62;
+  }
+  if (c == '/') {
+    return 63;
+  }
+  return -1;
+}
+
+
+// Decodes base64 one character at a time, appending the bytes to
+// |*out|, with the rules of b64_pton() (and so of util::FromBase64()):
+// whitespace is ignored, padding is required, and the bits of the last
+// sextet that don't make up a byte must be zero.
+class Base64Decoder {
+ public:
+  explicit Base64Decoder(string* out)
+      : out_(CHECK_NOTNULL(out)),
+        sextets_(0),
+        bits_(0),
+        padding_(0),
+        valid_(true) {
+    out_->clear();
+  }
+
+  void Add(char c) {
+    if (!valid_ || isspace(static_cast<unsigned char>(c))) {
+      return;
+    }
+    if (c == '=') {
+      AddPadding();
+      return;
+    }
+
+    const int value(SextetValue(c));
+    if (value < 0 || padding_ > 0) {
+      valid_ = false;
+      return;
+    }
+    bits_ = (bits_ << 6) | value;
+    switch (++sextets_) {
+      case 2:
+        out_->push_back(static_cast<char>(bits_ >> 4));
+        break;
+      case 3:
+        out_->push_back(static_cast<char>(bits_ >> 2));
+        break;
+      case 4:
+        out_->push_back(static_cast<char>(bits_));
+        sextets_ = 0;
+        bits_ = 0;
+        break;
+    }
+  }
+
+  // Whether what was added so far is complete and valid base64.
+  bool IsComplete() const {
+    return valid_ &&
+           (padding_ == 0 ? sextets_ == 0 : padding_ == 4 - sextets_);
+  }
+
+ private:
+  // Two '=' follow two sextets, one follows three.
+  void AddPadding() {
+    if (padding_ == 0 && ((sextets_ == 2 && (bits_ & 0xf) == 0) ||
+                          (sextets_ == 3 && (bits_ & 0x3) == 0))) {
+      padding_ = 1;
+    } else if (padding_ == 1 && sextets_ == 2) {
+      padding_ = 2;
+    } else {
+      valid_ = false;
+    }
+  }
+
+  string* const out_;
+  // The number of sextets of the current group of four.
+  int sextets_;
+  unsigned bits_;
+  int padding_;
+  bool valid_;
+
+  DISALLOW_COPY_AND_ASSIGN(Base64Decoder);
+};
+
+
+// Reads the bytes of an evbuffer where they are, one chunk at a time.
+class BufferReader {
+ public:
+  explicit BufferReader(evbuffer* buffer)
+      : buffer_(CHECK_NOTNULL(buffer)), data_(nullptr), size_(0), pos_(0) {
+    evbuffer_ptr_set(buffer_, &ptr_, 0, EVBUFFER_PTR_SET);
+  }
+
+  // Returns false at the end of the buffer.
+  bool Peek(char* c) {
+    if (pos_ == size_ && !NextChunk()) {
+      return false;
+    }
+    *c = data_[pos_];
+    return true;
+  }
+
+  // Like Peek(), but skipping whitespace first.
+  bool PeekToken(char* c) {
+    while (Peek(c)) {
+      if (!IsJsonSpace(*c)) {
+        return true;
+      }
+      Skip();
+    }
+    return false;
+  }
+
+  // Moves past the character that was just peeked at.
+  void Skip() {
+    CHECK_LT(pos_, size_);
+    ++pos_;
+  }
+
+  bool Next(char* c) {
+    if (!Peek(c)) {
+      return false;
+    }
+    ++pos_;
+    return true;
+  }
+
+ private:
+  bool NextChunk() {
+    if (size_ > 0 &&
+        evbuffer_ptr_set(buffer_, &ptr_, size_, EVBUFFER_PTR_ADD) != 0) {
+      return false;
+    }
+    evbuffer_iovec chunk;
+    if (evbuffer_peek(buffer_, -1, &ptr_, &chunk, 1) < 1 ||
+        chunk.iov_len == 0) {
+      return false;
+    }
+    data_ = static_cast<const char*>(chunk.iov_base);
+    size_ = chunk.iov_len;
+    pos_ = 0;
+    return true;
+  }
+
+  evbuffer* const buffer_;
+  // The start of the current chunk.
+  evbuffer_ptr ptr_;
+  const char* data_;
+  size_t size_;
+  size_t pos_;
+
+  DISALLOW_COPY_AND_ASSIGN(BufferReader);
+};
+
+
+// A recursive descent JSON parser, which hands over the values as it
+// reads them, without keeping them.
+class JsonReader {
+ public:
+  explicit JsonReader(evbuffer* buffer) : reader_(buffer) {
+  }
+
+  // Reads an object, calling |member| with the name of each of its
+  // members, when positioned at the value, which it must read. Returns
+  // false if there isn't an object, or if |member| returns false.
+  bool ReadObject(int depth, const function<bool(const string&)>& member) {
+    char c;
+    if (depth > kMaxDepth || !reader_.PeekToken(&c) || c != '{') {
+      return false;
+    }
+    reader_.Skip();
+    if (reader_.PeekToken(&c) && c == '}') {
+      reader_.Skip();
+      return true;
+    }
+
+    string name;
+    while (true) {
+      name.clear();
+      if (!ReadString([&name](char ch) { name.push_back(ch); }) ||
+          !reader_.PeekToken(&c) || c != ':') {
+        return false;
+      }
+      reader_.Skip();
+      if (!member(name) || !reader_.PeekToken(&c)) {
+        return false;
+      }
+      reader_.Skip();
+      if (c == '}') {
+        return true;
+      }
+      if (c != ',') {
+        return false;
+      }
+    }
+  }
+
+  // Same as ReadObject(), for an array, calling |element| for each of
+  // its elements.
+  bool ReadArray(int depth, const function<bool()>& element) {
+    char c;
+    if (depth > kMaxDepth || !reader_.PeekToken(&c) || c != '[') {
+      return false;
+    }
+    reader_.Skip();
+    if (reader_.PeekToken(&c) && c == ']') {
+      reader_.Skip();
+      return true;
+    }
+
+    while (true) {
+      if (!element() || !reader_.PeekToken(&c)) {
+        return false;
+      }
+      reader_.Skip();
+      if (c == ']') {
+        return true;
+      }
+      if (c != ',') {
+        return false;
+      }
+    }
+  }
+
+  // Reads a string, passing each of its characters to |add|, escapes
+  // decoded. Escaped characters outside of ASCII are all passed as
+  // '\x80', as nothing looked at in requests uses them.
+  template <class Add>
+  bool ReadString(Add add) {
+    char c;
+    if (!reader_.PeekToken(&c) || c != '"') {
+      return false;
+    }
+    reader_.Skip();
+    while (reader_.Next(&c)) {
+      if (c == '"') {
+        return true;
+      }
+      if (static_cast<unsigned char>(c) < 0x20 ||
+          (c == '\\' && !ReadEscape(&c))) {
+        return false;
+      }
+      add(c);
+    }
+    return false;
+  }
+
+  bool SkipValue(int depth) {
+    char c;
+    if (!reader_.PeekToken(&c)) {
+      return false;
+    }
+    switch (c) {
+      case '{':
+        return ReadObject(depth, [this, depth](const string&) {
+          return SkipValue(depth + 1);
+        });
+      case '[':
+        return ReadArray(depth, [this, depth]() {
+          return SkipValue(depth + 1);
+        });
+      case '"':
+        return ReadString([](char) {});
+      case 't':
+        return ReadLiteral("true");
+      case 'f':
+        return ReadLiteral("false");
+      case 'n':
+        return ReadLiteral("null");
+      default:
+        return SkipNumber();
+    }
+  }
+
+ private:
+  bool ReadEscape(char* c) {
+    if (!reader_.Next(c)) {
+      return false;
+    }
+    switch (*c) {
+      case '"':
+      case '\\':
+      case '/':
+        return true;
+      case 'b':
+        *c = '\b';
+        return true;
+      case 'f':
+        *c = '\f';
+        return true;
+      case 'n':
+        *c = '\n';
+        return true;
+      case 'r':
+        *c = '\r';
+        return true;
+      case 't':
+        *c = '\t';
+        return true;
+      case 'u': {
+        unsigned value(0);
+        for (int i = 0; i < 4; ++i) {
+          char digit;
+          if (!reader_.Next(&digit) ||
+              !isxdigit(static_cast<unsigned char>(digit))) {
+            return false;
+          }
+          value = (value << 4) |
+                  (IsDigit(digit)
+                       ? digit - '0'
+                       : tolower(static_cast<unsigned char>(digit)) - 'a' +
+                             10);
+        }
+        *c = value < 0x80 ? static_cast<char>(value) : '\x80';
+        return true;
+      }
+      default:
+        return false;
+    }
+  }
+
+  bool ReadLiteral(const char* literal) {
+    char c;
+    for (const char* p = literal; *p; ++p) {
+      if (!reader_.Next(&c) || c != *p) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Only checks that the characters could be part of a number.
+  bool SkipNumber() {
+    char c;
+    if (!reader_.Peek(&c) || (c != '-' && !IsDigit(c))) {
+      return false;
+    }
+    while (reader_.Peek(&c) &&
+           (IsDigit(c) || c == '-' || c == '+' || c == '.' || c == 'e' ||
+            c == 'E')) {
+      reader_.Skip();
+    }
+    return true;
+  }
+
+  BufferReader reader_;
+
+  DISALLOW_COPY_AND_ASSIGN(JsonReader);
+};
+
+
+// Checks that |der| is a single DER SEQUENCE, with a definite length
+// in its minimal encoding, itself starting with a SEQUENCE, as a
+// certificate does. This is much cheaper than having OpenSSL parse
+// |der|, and turns away most garbage before it gets there.
+bool LooksLikeCertificate(const string& der) {
+  if (der.size() < 4 || der[0] != 0x30) {
+    return false;
+  }
+  const unsigned char first(der[1]);
+  size_t header(2);
+  size_t length(first);
+  if (first & 0x80) {
+    const size_t length_bytes(first & 0x7f);
+    // Nothing is going to need more than 4 length bytes.
+    if (length_bytes < 1 || length_bytes > 4 ||
+        der.size() < header + length_bytes) {
+      return false;
+    }
+    length = 0;
+    for (size_t i = 0; i < length_bytes; ++i) {
+      length = (length << 8) | static_cast<unsigned char>(der[header + i]);
+    }
+    header += length_bytes;
+    // Not the shortest encoding of the length.
+    if (length < 0x80 || (length >> (8 * (length_bytes - 1))) == 0) {
+      return false;
+    }
+  }
+  return length == der.size() - header && length >= 2 &&
+         der[header] == 0x30;
+}
+
+
+// Reads a base64 certificate into |*der|, and adds it to |chain|,
+// unless |*status| is already an error, which gets set if the
+// certificate doesn't decode. Returns false if the JSON doesn't.
+bool ReadCert(JsonReader* reader, string* der, CertChain* chain,
+              Status* status) {
+  Base64Decoder decoder(der);
+  if (!reader->ReadString([&decoder](char c) { decoder.Add(c); })) {
+    return false;
+  }
+  if (!status->ok()) {
+    return true;
+  }
+
+  if (!decoder.IsComplete()) {
+    rejected_submissions->Increment("invalid_base64");
+    *status = Status(util::error::INVALID_ARGUMENT, kInvalidChain);
+    return true;
+  }
+  if (!LooksLikeCertificate(*der)) {
+    rejected_submissions->Increment("invalid_der");
+    *status = Status(util::error::INVALID_ARGUMENT, kInvalidChain);
+    return true;
+  }
+
+  unique_ptr<Cert> cert(new Cert);
+  cert->LoadFromDerString(*der);
+  if (!cert->IsLoaded()) {
+    rejected_submissions->Increment("invalid_certificate");
+    *status = Status(util::error::INVALID_ARGUMENT, kInvalidChain);
+    return true;
+  }
+
+  chain->AddCert(cert.release());
+  return true;
+}
+
+
+}  // namespace
+
+
+Status DecodeChain(evbuffer* buffer, size_t max_length, CertChain* chain) {
+  CHECK_NOTNULL(chain);
+  JsonReader reader(buffer);
+  // Reused for all the certificates.
+  string der;
+  bool found(false);
+  // The certificates are counted rather than taken from |chain|, which
+  // stops growing at the first one that doesn't decode.
+  size_t length(0);
+  bool too_long(false);
+  Status status;
+
+  const bool parsed(reader.ReadObject(0, [&](const string& name) {
+    if (name != "chain") {
+      return reader.SkipValue(1);
+    }
+    if (found) {
+      return false;
+    }
+    found = true;
+    return reader.ReadArray(1, [&]() {
+      if (++length > max_length) {
+        too_long = true;
+        return false;
+      }
+      return ReadCert(&reader, &der, chain, &status);
+    });
+  }));
+  if (too_long) {
+    rejected_submissions->Increment("chain_too_long");
+    return Status(util::error::INVALID_ARGUMENT, kChainTooLong);
+  }
+  if (!parsed || !found) {
+    rejected_submissions->Increment("invalid_json");
+    return Status(util::error::INVALID_ARGUMENT, kInvalidJson);
+  }
+
+  return status;
+}
+
+
+Status DecodeChains(evbuffer* buffer, size_t max_chains, size_t max_length,
+                    vector<unique_ptr<CertChain>>* chains) {
+  CHECK_NOTNULL(chains);
+  JsonReader reader(buffer);
+  string der;
+  bool found(false);
+  bool too_many(false);
+  bool too_long(false);
+
+  const bool parsed(reader.ReadObject(0, [&](const string& name) {
+    if (name != "chains") {
+      return reader.SkipValue(1);
+    }
+    if (found) {
+      return false;
+    }
+    found = true;
+    return reader.ReadArray(1, [&]() {
+      if (chains->size() >= max_chains) {
+        too_many = true;
+        return false;
+      }
+      unique_ptr<CertChain> chain(new CertChain);
+      size_t length(0);
+      Status status;
+      if (!reader.ReadArray(2, [&]() {
+            if (++length > max_length) {
+              too_long = true;
+              return false;
+            }
+            return ReadCert(&reader, &der, chain.get(), &status);
+          })) {
+        return false;
+      }
+      if (!status.ok()) {
+        chain.reset();
+      }
+      chains->emplace_back(move(chain));
+      return true;
+    });
+  }));
+  if (too_many) {
+    rejected_submissions->Increment("too_many_chains");
+    return Status(util::error::INVALID_ARGUMENT, "Too many chains.");
+  }
+  if (too_long) {
+    rejected_submissions->Increment("chain_too_long");
+    return Status(util::error::INVALID_ARGUMENT, kChainTooLong);
+  }
+  if (!parsed || !found) {
+    rejected_submissions->Increment("invalid_json");
+    return Status(util::error::INVALID_ARGUMENT, kInvalidJson);
+  }
+
+  return Status::OK;
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,43 @@
+#ifndef CERT_TRANS_SERVER_CHAIN_DECODER_H_
+#define CERT_TRANS_SERVER_CHAIN_DECODER_H_
+
+#include <memory>
+#include <stddef.h>
+#include <vector>
+
+#include "util/status.h"
+
+struct evbuffer;
+
+namespace cert_trans {
+
+class CertChain;
+
+// These decode the JSON body of add-chain and add-chains requests
+// straight from the evbuffer it was received in, one chunk at a time,
+// without building a json-c tree of it. The base64 certificates are
+// decoded as they are read, into a buffer reused for each of them, and
+// loaded from there, once a quick look at their DER header found it
+// plausible. The other members of the body are skipped, like anything
+// following it. |buffer| is left untouched. Whatever gets rejected is
+// counted in a metric, by reason.
+
+// Decodes {"chain": ["<base64 DER>", ...]} into |chain|, which must
+// have no more than |max_length| certificates, the decoding stopping
+// as soon as there are more. Returns INVALID_ARGUMENT, with a message
+// for the client, if the body is not like that, or if a certificate
+// doesn't decode.
+util::Status DecodeChain(evbuffer* buffer, size_t max_length,
+                         CertChain* chain);
+
+// Decodes {"chains": [[...], ...]} into |chains|, of which there must
+// be no more than |max_chains|, each of no more than |max_length|
+// certificates. The chains with a certificate that doesn't decode are
+// left null. Returns INVALID_ARGUMENT if the body is not like that.
+util::Status DecodeChains(evbuffer* buffer, size_t max_chains,
+                          size_t max_length,
+                          std::vector<std::unique_ptr<CertChain>>* chains);
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_SERVER_CHAIN_DECODER_H_
@@ -0,0 +1,231 @@
+#include "server/chain_decoder.h"
+
+#include <algorithm>
+#include <event2/buffer.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "log/cert.h"
+#include "util/status_test_util.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using util::testing::StatusIs;
+
+const char kLeafCert[] = "test-cert.pem";
+const char kCaCert[] = "ca-cert.pem";
+const size_t kMaxLength = 10;
+
+
+string ReadDer(const char* name) {
+  string pem;
+  CHECK(util::ReadTextFile(FLAGS_test_srcdir + "/test/testdata/" + name,
+                           &pem))
+      << "Could not read test data. Wrong --test_srcdir?";
+  const Cert cert(pem);
+  string der;
+  CHECK_EQ(util::Status::OK, cert.DerEncoding(&der));
+  return der;
+}
+
+
+// Escapes the slashes the way json-c does.
+string JsonBase64(const string& data) {
+  string result;
+  for (const char c : util::ToBase64(data)) {
+    if (c == '/') {
+      result.push_back('\\');
+    }
+    result.push_back(c);
+  }
+  return result;
+}
+
+
+class ChainDecoderTest : public ::testing::Test {
+ protected:
+  ChainDecoderTest()
+      : buffer_(evbuffer_new()),
+        leaf_der_(ReadDer(kLeafCert)),
+        ca_der_(ReadDer(kCaCert)) {
+  }
+
+  ~ChainDecoderTest() {
+    evbuffer_free(buffer_);
+  }
+
+  // Adds |body| to the buffer in pieces of |piece_size| bytes, each in
+  // its own chunk of the buffer.
+  void SetBody(const string& body, size_t piece_size) {
+    body_ = body;
+    evbuffer_drain(buffer_, evbuffer_get_length(buffer_));
+    for (size_t i = 0; i < body_.size(); i += piece_size) {
+      CHECK_EQ(0, evbuffer_add_reference(buffer_, body_.data() + i,
+                                         std::min(piece_size,
+                                                  body_.size() - i),
+                                         nullptr, nullptr));
+    }
+  }
+
+  string ChainJson(const vector<string>& ders) {
+    string json("[");
+    for (const auto& der : ders) {
+      json += (json.size() > 1 ? ", \"" : "\"") + JsonBase64(der) + "\"";
+    }
+    return json + "]";
+  }
+
+  void ExpectChain(const vector<string>& ders, const CertChain& chain) {
+    ASSERT_EQ(ders.size(), chain.Length());
+    for (size_t i = 0; i < ders.size(); ++i) {
+      string der;
+      ASSERT_OK(chain.CertAt(i)->DerEncoding(&der));
+      EXPECT_EQ(ders[i], der) << i;
+    }
+  }
+
+  evbuffer* const buffer_;
+  const string leaf_der_;
+  const string ca_der_;
+  string body_;
+};
+
+
+TEST_F(ChainDecoderTest, DecodesChain) {
+  const string body("{ \"other\": [1, -2.5e3, {\"a\": null}, true, \"x\"],\n"
+                    "  \"chain\" : " +
+                    ChainJson({leaf_der_, ca_der_}) +
+                    " , \"more\": false }trailing");
+  for (const size_t piece_size : {size_t(1), size_t(7), body.size()}) {
+    SetBody(body, piece_size);
+    CertChain chain;
+    EXPECT_OK(DecodeChain(buffer_, kMaxLength, &chain)) << piece_size;
+    ExpectChain({leaf_der_, ca_der_}, chain);
+    // The request is left as it was.
+    EXPECT_EQ(body.size(), evbuffer_get_length(buffer_));
+  }
+
+  SetBody("{\"chain\": []}", 100);
+  CertChain empty;
+  EXPECT_OK(DecodeChain(buffer_, kMaxLength, &empty));
+  EXPECT_EQ(0U, empty.Length());
+}
+
+
+TEST_F(ChainDecoderTest, RejectsInvalidJson) {
+  const string chain(ChainJson({leaf_der_}));
+  for (const string& body :
+       {string(""), string("[]"), string("{}"), string("{\"chain\": 1}"),
+        "{\"chain\": " + chain, "{\"chain\": " + chain + ",}",
+        "{\"chain\" " + chain + "}", string("{\"chain\": [1]}"),
+        "{\"chain\": " + chain + ", \"chain\": " + chain + "}",
+        "{\"other\": tru, \"chain\": " + chain + "}",
+        "{\"other\": \"\\q\", \"chain\": " + chain + "}",
+        "{\"other\": " + string(100, '[') + string(100, ']') +
+            ", \"chain\": " + chain + "}"}) {
+    SetBody(body, 5);
+    CertChain decoded;
+    EXPECT_THAT(DecodeChain(buffer_, kMaxLength, &decoded),
+                StatusIs(util::error::INVALID_ARGUMENT,
+                         "Unable to parse provided JSON."))
+        << body;
+  }
+}
+
+
+TEST_F(ChainDecoderTest, RejectsInvalidCertificates) {
+  const string leaf(util::ToBase64(leaf_der_));
+  for (const string& cert :
+       {string(""), string("not base64!"), leaf.substr(0, leaf.size() - 1),
+        leaf + "=", util::ToBase64("not a certificate"),
+        // A DER header that looks right, followed by garbage.
+        util::ToBase64(string("\x30\x04\x30\x02\x01\x01", 6)),
+        // Long forms of lengths that would fit in fewer bytes.
+        util::ToBase64(string("\x30\x81\x03\x30\x01\x00", 6)),
+        util::ToBase64("\x30\x82" + string(1, '\0') + "\x80\x30" +
+                       string(0x7f, '\0')),
+        // The length of the truncated certificate.
+        util::ToBase64(leaf_der_.substr(0, leaf_der_.size() - 1))}) {
+    SetBody("{\"chain\": [\"" + leaf + "\", \"" + cert + "\"]}", 5);
+    CertChain chain;
+    EXPECT_THAT(DecodeChain(buffer_, kMaxLength, &chain),
+                StatusIs(util::error::INVALID_ARGUMENT,
+                         "Unable to parse provided chain."))
+        << cert;
+  }
+
+  // The JSON is still checked.
+  SetBody("{\"chain\": [\"\", \"" + leaf + "\"", 5);
+  CertChain chain;
+  EXPECT_THAT(DecodeChain(buffer_, kMaxLength, &chain),
+              StatusIs(util::error::INVALID_ARGUMENT,
+                       "Unable to parse provided JSON."));
+}
+
+
+TEST_F(ChainDecoderTest, RejectsLongChains) {
+  const vector<string> chain(kMaxLength, leaf_der_);
+  SetBody("{\"chain\": " + ChainJson(chain) + "}", 7);
+  CertChain decoded;
+  EXPECT_OK(DecodeChain(buffer_, kMaxLength, &decoded));
+  ExpectChain(chain, decoded);
+
+  // The certificates aren't even looked at after the limit, and even
+  // the JSON is left unchecked.
+  SetBody("{\"chain\": [\"bad\", " + ChainJson(chain).substr(1), 7);
+  CertChain too_long;
+  EXPECT_THAT(DecodeChain(buffer_, kMaxLength, &too_long),
+              StatusIs(util::error::INVALID_ARGUMENT, "Chain too long."));
+
+  SetBody("{\"chains\": [" + ChainJson({leaf_der_}) + ", " +
+              ChainJson(chain) + "]}",
+          7);
+  vector<unique_ptr<CertChain>> chains;
+  EXPECT_OK(DecodeChains(buffer_, 2, kMaxLength, &chains));
+  chains.clear();
+  EXPECT_THAT(DecodeChains(buffer_, 2, kMaxLength - 1, &chains),
+              StatusIs(util::error::INVALID_ARGUMENT, "Chain too long."));
+}
+
+
+TEST_F(ChainDecoderTest, DecodesChains) {
+  SetBody("{\"chains\": [" + ChainJson({leaf_der_}) + ", [\"bad\"], " +
+              ChainJson({leaf_der_, ca_der_}) + "]}",
+          3);
+  vector<unique_ptr<CertChain>> chains;
+  EXPECT_OK(DecodeChains(buffer_, 3, kMaxLength, &chains));
+  ASSERT_EQ(3U, chains.size());
+  ASSERT_TRUE(chains[0]);
+  ExpectChain({leaf_der_}, *chains[0]);
+  EXPECT_FALSE(chains[1]);
+  ASSERT_TRUE(chains[2]);
+  ExpectChain({leaf_der_, ca_der_}, *chains[2]);
+
+  chains.clear();
+  EXPECT_THAT(DecodeChains(buffer_, 2, kMaxLength, &chains),
+              StatusIs(util::error::INVALID_ARGUMENT, "Too many chains."));
+
+  SetBody("{\"chains\": [\"" + JsonBase64(leaf_der_) + "\"]}", 3);
+  chains.clear();
+  EXPECT_THAT(DecodeChains(buffer_, 3, kMaxLength, &chains),
+              StatusIs(util::error::INVALID_ARGUMENT,
+                       "Unable to parse provided JSON."));
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,52 @@
+#include "server/consistency_cache.h"
+
+#include <glog/logging.h>
+
+using std::lock_guard;
+using std::mutex;
+using std::shared_ptr;
+
+namespace cert_trans {
+
+
+ConsistencyCache::ConsistencyCache(size_t max_entries)
+    : max_entries_(max_entries) {
+  CHECK_GT(max_entries_, 0U);
+}
+
+
+shared_ptr<const JsonBody> ConsistencyCache::Get(const Key& key) {
+  lock_guard<mutex> lock(lock_);
+  const auto it(index_.find(key));
+  if (it == index_.end()) {
+    return nullptr;
+  }
+  replies_.splice(replies_.begin(), replies_, it->second);
+  return it->second->second;
+}
+
+
+void ConsistencyCache::Put(const Key& key,
+                           const shared_ptr<const JsonBody>& body) {
+  CHECK(body);
+  lock_guard<mutex> lock(lock_);
+  // Another request might have rendered it at the same time.
+  if (index_.find(key) != index_.end()) {
+    return;
+  }
+  replies_.emplace_front(key, body);
+  index_.emplace(key, replies_.begin());
+  while (replies_.size() > max_entries_) {
+    index_.erase(replies_.back().first);
+    replies_.pop_back();
+  }
+}
+
+
+size_t ConsistencyCache::Size() const {
+  lock_guard<mutex> lock(lock_);
+  return replies_.size();
+}
+
+
+}  // namespace cert_trans
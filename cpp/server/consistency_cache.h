@@ -0,0 +1,50 @@
+#ifndef CERT_TRANS_SERVER_CONSISTENCY_CACHE_H_
+#define CERT_TRANS_SERVER_CONSISTENCY_CACHE_H_
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+
+#include "base/macros.h"
+#include "server/json_body.h"
+
+namespace cert_trans {
+
+
+// A thread-safe LRU cache of get-sth-consistency replies, by the
+// (first, second) tree sizes they are for, bounded by their number.
+// The proofs are only cached between trees that were published
+// already, so they never change, and are only ever evicted.
+class ConsistencyCache {
+ public:
+  typedef std::pair<int64_t, int64_t> Key;
+
+  explicit ConsistencyCache(size_t max_entries);
+
+  // Returns nullptr if the reply is not in the cache.
+  std::shared_ptr<const JsonBody> Get(const Key& key);
+
+  void Put(const Key& key, const std::shared_ptr<const JsonBody>& body);
+
+  size_t Size() const;
+
+ private:
+  typedef std::pair<Key, std::shared_ptr<const JsonBody>> Entry;
+
+  const size_t max_entries_;
+  mutable std::mutex lock_;
+  // Most recently used first.
+  std::list<Entry> replies_;
+  std::map<Key, std::list<Entry>::iterator> index_;
+
+  DISALLOW_COPY_AND_ASSIGN(ConsistencyCache);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_SERVER_CONSISTENCY_CACHE_H_
@@ -0,0 +1,51 @@
+#include "server/consistency_cache.h"
+
+#include <gtest/gtest.h>
+#include <memory>
+
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::make_pair;
+using std::make_shared;
+using std::shared_ptr;
+
+
+TEST(ConsistencyCacheTest, EvictsLeastRecentlyUsed) {
+  ConsistencyCache cache(2);
+  EXPECT_FALSE(cache.Get(make_pair(1, 2)));
+
+  const shared_ptr<const JsonBody> body12(make_shared<const JsonBody>("12"));
+  const shared_ptr<const JsonBody> body23(make_shared<const JsonBody>("23"));
+  cache.Put(make_pair(1, 2), body12);
+  cache.Put(make_pair(2, 3), body23);
+  EXPECT_EQ(2U, cache.Size());
+  EXPECT_EQ(body12, cache.Get(make_pair(1, 2)));
+  EXPECT_EQ(body23, cache.Get(make_pair(2, 3)));
+  // The sizes are not interchangeable.
+  EXPECT_FALSE(cache.Get(make_pair(2, 1)));
+
+  // (1, 2) was used less recently.
+  EXPECT_EQ(body12, cache.Get(make_pair(1, 2)));
+  cache.Put(make_pair(3, 4), make_shared<const JsonBody>("34"));
+  EXPECT_EQ(2U, cache.Size());
+  EXPECT_EQ(body12, cache.Get(make_pair(1, 2)));
+  EXPECT_FALSE(cache.Get(make_pair(2, 3)));
+  EXPECT_TRUE(cache.Get(make_pair(3, 4)));
+
+  // The first one stays.
+  cache.Put(make_pair(1, 2), make_shared<const JsonBody>("other"));
+  EXPECT_EQ(body12, cache.Get(make_pair(1, 2)));
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -1,26 +1,70 @@
+#include "config.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
 #include <gflags/gflags.h>
 #include <iostream>
-#include <ldns/ldns.h>
+#include <memory>
+#include <netinet/in.h>
 #include <sstream>
 #include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
+#include "log/leveldb_db.h"
 #include "log/log_lookup.h"
 #include "log/logged_certificate.h"
 #include "log/sqlite_db.h"
 #include "proto/ct.pb.h"
+#include "server/dns_response_cache.h"
 #include "server/event.h"
 #include "util/init.h"
 #include "util/util.h"
 
+using cert_trans::DNSResponseCache;
 using cert_trans::LoggedCertificate;
 using ct::SignedTreeHead;
 using google::RegisterFlagValidator;
+using std::atomic;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::max;
+using std::min;
 using std::string;
 using std::stringstream;
+using std::thread;
+using std::unique_ptr;
+using std::vector;
 
 DEFINE_int32(port, 0, "Server port");
 DEFINE_string(domain, "", "Domain");
-DEFINE_string(db, "", "Database for certificate and tree storage");
+DEFINE_string(db, "",
+              "SQLite database for certificate and tree storage, shared with "
+              "the ct-server populating it");
+DEFINE_string(leveldb_db, "",
+              "LevelDB database to serve instead of --db. As LevelDB only "
+              "lets one process open it, it can't be the database of a "
+              "running ct-server, but it can be a copy of one. Entries are "
+              "never added to it.");
+DEFINE_int32(dns_sth_refresh_ms, 1000,
+             "How often to check --db for a new tree head, in "
+             "milliseconds.");
+DEFINE_int32(dns_cache_size, 100000,
+             "Maximum number of answers to cache, until the tree head "
+             "changes. 0 disables the cache.");
+DEFINE_int32(dns_server_threads, 0,
+             "Number of threads answering queries, each with its own socket "
+             "where SO_REUSEPORT is available. 0 for one per CPU.");
+DEFINE_int32(dns_batch_size, 32,
+             "Maximum number of packets received or sent with a single "
+             "system call.");
 
 // Basic sanity checks on flag values.
 static bool ValidatePort(const char*, int32_t port) {
@@ -37,111 +81,277 @@ static bool NonEmptyString(const char*, const string& str) {
 static const bool domain_dummy =
     RegisterFlagValidator(&FLAGS_domain, &NonEmptyString);
 
-class CTUDPDNSServer : public UDPServer {
- public:
-  CTUDPDNSServer(const string& domain, SQLiteDB<LoggedCertificate>* db,
-                 EventLoop* loop, int fd)
-      : UDPServer(loop, fd), domain_(domain), lookup_(db), db_(db) {
-  }
+namespace {
+
+const size_t kHeaderSize = 12;
+// A name is at most 255 bytes in wire format, which is one more than
+// its text form.
+const size_t kMaxNameSize = 255;
+// Large enough for any query we can answer, bigger ones are dropped.
+const size_t kQueryBufferSize = 2048;
+// We don't do EDNS0, so answers must fit in a plain DNS UDP packet.
+const size_t kMaxAnswerSize = 512;
+// Name pointer, type, class, TTL and data length of the answer record.
+const size_t kAnswerFixedSize = 12;
+const size_t kMaxCharacterString = 255;
+const uint16_t kTypeTXT = 16;
+const uint16_t kClassIN = 1;
+const uint32_t kAnswerTTL = 123;
+
+
+#ifdef HAVE_RECVMMSG
+const int kReceiveFlags = MSG_WAITFORONE;
+#else
+const int kReceiveFlags = 0;
+
+struct mmsghdr {
+  msghdr msg_hdr;
+  unsigned int msg_len;
+};
 
-  virtual void PacketRead(const sockaddr_in& from, const char* buf,
-                          size_t len) {
-    ldns_pkt* packet = NULL;
 
-    ldns_status ret = ldns_wire2pkt(&packet, (const uint8_t*)buf, len);
-    if (ret != LDNS_STATUS_OK) {
-      LOG(INFO) << "Bad DNS packet";
-      return;
+// Stand-in doing one system call per packet, blocking for the first
+// one only, like recvmmsg with MSG_WAITFORONE.
+int recvmmsg(int fd, mmsghdr* msgs, unsigned int vlen, int, timespec*) {
+  for (unsigned int i = 0; i < vlen; ++i) {
+    const ssize_t received(
+        recvmsg(fd, &msgs[i].msg_hdr, i == 0 ? 0 : MSG_DONTWAIT));
+    if (received < 0) {
+      return i > 0 ? i : -1;
     }
+    msgs[i].msg_len = received;
+  }
+  return vlen;
+}
+#endif
 
-    //ldns_pkt_print(stdout, packet);
 
-    if (ldns_pkt_qr(packet) != 0) {
-      LOG(INFO) << "Packet is not a query";
-      return;
+#ifndef HAVE_SENDMMSG
+// Stand-in doing one system call per packet.
+int sendmmsg(int fd, mmsghdr* msgs, unsigned int vlen, int flags) {
+  for (unsigned int i = 0; i < vlen; ++i) {
+    const ssize_t sent(sendmsg(fd, &msgs[i].msg_hdr, flags));
+    if (sent < 0) {
+      return i > 0 ? i : -1;
     }
+    msgs[i].msg_len = sent;
+  }
+  return vlen;
+}
+#endif
 
-    if (ldns_pkt_get_opcode(packet) != LDNS_PACKET_QUERY) {
-      LOG(INFO) << "Packet has bad opcode";
-      return;
-    }
 
-    ldns_pkt* answers = ldns_pkt_new();
-    ldns_pkt_set_id(answers, ldns_pkt_id(packet));
-    ldns_pkt_set_qr(answers, true);
+uint16_t GetUint16(const uint8_t* buf) {
+  return (buf[0] << 8) | buf[1];
+}
 
-    ldns_rr_list* questions = ldns_pkt_question(packet);
 
-    ldns_pkt_safe_push_rr_list(answers, LDNS_SECTION_QUESTION,
-                               ldns_rr_list_clone(questions));
+uint8_t* PutUint16(uint16_t value, uint8_t* buf) {
+  buf[0] = value >> 8;
+  buf[1] = value;
+  return buf + 2;
+}
 
-    for (size_t n = 0; n < ldns_rr_list_rr_count(questions); ++n) {
-      ldns_rr* question = ldns_rr_list_rr(questions, n);
 
-      if (ldns_rr_get_type(question) != LDNS_RR_TYPE_TXT) {
-        LOG(INFO) << "Question is not TXT";
-        // FIXME(benl): set error response?
-        continue;
-      }
+uint8_t* PutUint32(uint32_t value, uint8_t* buf) {
+  return PutUint16(value, PutUint16(value >> 16, buf));
+}
 
-      ldns_rdf* owner = ldns_rr_owner(question);
-      if (ldns_rdf_get_type(owner) != LDNS_RDF_TYPE_DNAME) {
-        LOG(INFO) << "Owner is not a dname";
-        continue;
-      }
 
-      ldns_buffer* dname = ldns_buffer_new(512);
-      if (ldns_rdf2buffer_str_dname(dname, owner) != LDNS_STATUS_OK) {
-        LOG(INFO) << "Can't decode owner";
-        continue;
-      }
+bool IsNameChar(uint8_t c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '-' || c == '_';
+}
 
-      char* owner_name_raw = ldns_buffer2str(dname);
-      std::string owner_name(owner_name_raw);
-      free(owner_name_raw);
-      owner_name_raw = NULL;
-      ldns_buffer_free(dname);
-      dname = NULL;
 
-      LOG(INFO) << "Question is TXT of " << owner_name;
+// Parses a query with a single question, in place. The owner name is
+// written in text form (e.g. "sth.example.com.") to |name|, which
+// must have room for kMaxNameSize bytes, and |question_len| is set to
+// the size of the question section. Returns false if |query| is not
+// a query we could answer, including names with characters that would
+// need escaping, which none of ours have.
+bool ParseQuery(const uint8_t* query, size_t len, char* name,
+                size_t* name_len, size_t* question_len, uint16_t* qtype) {
+  // We only look at the question section, anything after it (such as
+  // an EDNS0 OPT record) is ignored.
+  if (len < kHeaderSize || (query[2] & 0x80) != 0 ||
+      ((query[2] >> 3) & 0x0f) != 0 || GetUint16(query + 4) != 1) {
+    return false;
+  }
 
-      if (owner_name.length() <= domain_.length() ||
-          owner_name.compare(owner_name.length() - domain_.length(),
-                             domain_.length(), domain_) != 0) {
-        LOG(INFO) << "Question is not for our domain";
-        continue;
+  size_t pos(kHeaderSize);
+  *name_len = 0;
+  for (;;) {
+    if (pos >= len) {
+      return false;
+    }
+    const uint8_t label_len(query[pos++]);
+    if (label_len == 0) {
+      break;
+    }
+    // A compression pointer (or reserved label type) is not expected
+    // at the start of the packet.
+    if ((label_len & 0xc0) != 0 || pos + label_len > len ||
+        *name_len + label_len + 1 > kMaxNameSize) {
+      return false;
+    }
+    for (size_t i = 0; i < label_len; ++i) {
+      const uint8_t c(query[pos++]);
+      if (!IsNameChar(c)) {
+        return false;
       }
+      name[(*name_len)++] = c;
+    }
+    name[(*name_len)++] = '.';
+  }
+
+  if (pos + 4 > len) {
+    return false;
+  }
+  *qtype = GetUint16(query + pos);
+  *question_len = pos + 4 - kHeaderSize;
+  return true;
+}
+
+
+// Writes the answer to |query| to |out|, which must have room for
+// kMaxAnswerSize bytes, and returns its size. Its question section
+// (of |question_len| bytes) is copied from |query|, followed by a TXT
+// record holding |txt|, unless it is NULL.
+size_t WriteAnswer(const uint8_t* query, size_t question_len,
+                   const string* txt, uint8_t* out) {
+  // Same ID, QR set, and RD copied from the query.
+  out[0] = query[0];
+  out[1] = query[1];
+  out[2] = 0x80 | (query[2] & 0x01);
+  out[3] = 0;
+  uint8_t* pos(PutUint16(1, out + 4));
+  pos = PutUint16(0, pos);
+  pos = PutUint16(0, pos);
+  pos = PutUint16(0, pos);
+  memcpy(pos, query + kHeaderSize, question_len);
+  pos += question_len;
+  if (!txt) {
+    return pos - out;
+  }
+
+  // The text is split into as many character-strings as needed, and
+  // there has to be at least one.
+  const size_t num_strings(
+      max<size_t>(1, (txt->size() + kMaxCharacterString - 1) /
+                         kMaxCharacterString));
+  const size_t rdata_len(txt->size() + num_strings);
+  if (static_cast<size_t>(pos - out) + kAnswerFixedSize + rdata_len >
+      kMaxAnswerSize) {
+    LOG(WARNING) << "Answer too big, truncated";
+    out[2] |= 0x02;
+    return pos - out;
+  }
+
+  PutUint16(1, out + 6);
+  // The owner is the name of the question, right after the header.
+  pos = PutUint16(0xc000 | kHeaderSize, pos);
+  pos = PutUint16(kTypeTXT, pos);
+  pos = PutUint16(kClassIN, pos);
+  pos = PutUint32(kAnswerTTL, pos);
+  pos = PutUint16(rdata_len, pos);
+  for (size_t i = 0; i < num_strings; ++i) {
+    const size_t offset(i * kMaxCharacterString);
+    const size_t len(min(kMaxCharacterString, txt->size() - offset));
+    *pos++ = len;
+    memcpy(pos, txt->data() + offset, len);
+    pos += len;
+  }
+  return pos - out;
+}
+
+
+}  // namespace
+
+
+class CTDNSServer {
+ public:
+  // If |sqlite_db| is not NULL, it must be the same as |db|, and is
+  // checked for new tree heads written by another process.
+  CTDNSServer(const string& domain, ReadOnlyDatabase<LoggedCertificate>* db,
+              SQLiteDB<LoggedCertificate>* sqlite_db, size_t cache_size)
+      : domain_(domain),
+        lookup_(db),
+        db_(db),
+        sqlite_db_(sqlite_db),
+        cache_(cache_size),
+        next_refresh_ms_(0),
+        sth_timestamp_(lookup_.GetSTH().timestamp()) {
+  }
+
+  // Writes the answer to the |len| bytes long |query| to |answer|,
+  // which must have room for kMaxAnswerSize bytes, and returns its
+  // size, or zero if there should be no answer. Can be called from
+  // multiple threads.
+  size_t HandleQuery(const uint8_t* query, size_t len, uint8_t* answer) {
+    char name[kMaxNameSize];
+    size_t name_len;
+    size_t question_len;
+    uint16_t qtype;
+    if (!ParseQuery(query, len, name, &name_len, &question_len, &qtype)) {
+      VLOG(1) << "Bad DNS query";
+      return 0;
+    }
 
-      std::string response = Response(
-          owner_name.substr(0, owner_name.length() - domain_.length() - 1));
-
-      ldns_rr* answer = ldns_rr_new();
-      ldns_rr_set_owner(answer, ldns_rdf_new_frm_str(LDNS_RDF_TYPE_DNAME,
-                                                     owner_name.c_str()));
-      ldns_rr_set_type(answer, LDNS_RR_TYPE_TXT);
-      ldns_rr_set_ttl(answer, 123);
-      ldns_rr_push_rdf(answer, ldns_rdf_new_frm_str(LDNS_RDF_TYPE_STR,
-                                                    response.c_str()));
-      ldns_pkt_safe_push_rr(answers, LDNS_SECTION_ANSWER, answer);
+    if (qtype != kTypeTXT) {
+      VLOG(1) << "Question is not TXT";
+      // FIXME(benl): set error response?
+      return WriteAnswer(query, question_len, nullptr, answer);
     }
-    ldns_pkt_free(packet);
 
-    char* answer_str = ldns_pkt2str(answers);
-    LOG(INFO) << "Answer is " << answer_str;
-    free(answer_str);
+    VLOG(1) << "Question is TXT of " << string(name, name_len);
 
-    uint8_t* wire_answer;
-    size_t answer_size;
-    if (ldns_pkt2wire(&wire_answer, answers, &answer_size) != LDNS_STATUS_OK) {
-      LOG(ERROR) << "Can't make wire answer";
-      return;
+    if (name_len <= domain_.length() ||
+        domain_.compare(0, domain_.length(),
+                        name + name_len - domain_.length(),
+                        domain_.length()) != 0) {
+      VLOG(1) << "Question is not for our domain";
+      return WriteAnswer(query, question_len, nullptr, answer);
     }
-    QueuePacket(from, wire_answer, answer_size);
-    free(wire_answer);
-    ldns_pkt_free(answers);
+
+    MaybeRefreshSTH();
+    const string question(name, name_len - domain_.length() - 1);
+    string response;
+    uint64_t generation;
+    if (!cache_.Get(question, &response, &generation)) {
+      response = Response(question);
+      cache_.Put(question, response, generation);
+    }
+    VLOG(1) << "Answer is " << response;
+    return WriteAnswer(query, question_len, &response, answer);
   }
 
  private:
+  // Picks up the latest tree head written by the ct-server sharing the
+  // SQLite database, at most once per --dns_sth_refresh_ms, and drops
+  // the cached answers if it changed.
+  void MaybeRefreshSTH() {
+    if (sqlite_db_) {
+      const int64_t now_ms(duration_cast<milliseconds>(
+                               steady_clock::now().time_since_epoch())
+                               .count());
+      int64_t next_ms(next_refresh_ms_.load());
+      // Only one thread does it.
+      if (now_ms >= next_ms &&
+          next_refresh_ms_.compare_exchange_strong(
+              next_ms, now_ms + FLAGS_dns_sth_refresh_ms)) {
+        sqlite_db_->ForceNotifySTH();
+      }
+    }
+
+    // |lookup_| is updated before this is, so the answers cached from
+    // then on are for the new tree head.
+    const uint64_t timestamp(lookup_.GetSTH().timestamp());
+    if (sth_timestamp_.exchange(timestamp) != timestamp) {
+      cache_.Clear();
+    }
+  }
+
   string Response(string question) {
     if (question == "sth")
       return STH();
@@ -152,7 +362,7 @@ class CTUDPDNSServer : public UDPServer {
 
     string head = question.substr(0, dot);
     string tail = question.substr(dot + 1);
-    LOG(INFO) << "head = " << head << ", tail = " << tail;
+    VLOG(1) << "head = " << head << ", tail = " << tail;
     if (tail == "tree")
       return Tree(head);
     else if (tail == "hash")
@@ -172,8 +382,6 @@ class CTUDPDNSServer : public UDPServer {
   }
 
   string Hash(const string& hash) {
-    db_->ForceNotifySTH();
-
     // FIXME: decode hash!
     int64_t index;
     if (lookup_.GetIndex(hash, &index) != lookup_.OK)
@@ -197,8 +405,8 @@ class CTUDPDNSServer : public UDPServer {
     string index = question.substr(dot + 1, dot2 - dot - 1);
     string size = question.substr(dot2 + 1);
 
-    LOG(INFO) << "level = " << level << ", index = " << index
-              << ", size = " << size;
+    VLOG(1) << "level = " << level << ", index = " << index
+            << ", size = " << size;
 
     ct::ShortMerkleAuditProof proof;
     if (lookup_.AuditProof(atoi(index.c_str()), atoi(size.c_str()), &proof) !=
@@ -214,9 +422,8 @@ class CTUDPDNSServer : public UDPServer {
   }
 
   string STH() {
-    db_->ForceNotifySTH();
-
-    const SignedTreeHead& sth = lookup_.GetSTH();
+    // Copied, as another thread might update it.
+    const SignedTreeHead sth(lookup_.GetSTH());
 
     std::string signature;
     CHECK_EQ(Serializer::SerializeDigitallySigned(sth.signature(), &signature),
@@ -230,11 +437,122 @@ class CTUDPDNSServer : public UDPServer {
     return ss.str();
   }
 
-  string domain_;
+  const string domain_;
   LogLookup<LoggedCertificate> lookup_;
-  SQLiteDB<LoggedCertificate>* const db_;
+  ReadOnlyDatabase<LoggedCertificate>* const db_;
+  SQLiteDB<LoggedCertificate>* const sqlite_db_;
+  DNSResponseCache cache_;
+  atomic<int64_t> next_refresh_ms_;
+  atomic<uint64_t> sth_timestamp_;
 };
 
+
+// Opens a UDP socket bound to |port|. Where SO_REUSEPORT is
+// available, several of them can be bound to the same port, and the
+// kernel spreads the incoming packets between them.
+int OpenSocket(int port) {
+  const int fd(socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP));
+  PCHECK(fd >= 0) << "socket";
+
+  const int one(1);
+  PCHECK(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == 0);
+#ifdef SO_REUSEPORT
+  PCHECK(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == 0);
+#endif
+  // Wake up every so often, to notice when we are asked to stop.
+  const timeval timeout{1, 0};
+  PCHECK(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                    sizeof(timeout)) == 0);
+
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  PCHECK(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0)
+      << "bind";
+
+  return fd;
+}
+
+
+// Answers the queries arriving on |fd| until |stop| is set, receiving
+// and sending them in batches of up to --dns_batch_size. All the
+// buffers are allocated up front.
+void ServeUDP(CTDNSServer* server, int fd, const atomic<bool>* stop) {
+  const int batch_size(FLAGS_dns_batch_size);
+  vector<uint8_t> queries(batch_size * kQueryBufferSize);
+  vector<uint8_t> answers(batch_size * kMaxAnswerSize);
+  vector<sockaddr_in> peers(batch_size);
+  vector<iovec> query_iovs(batch_size);
+  vector<iovec> answer_iovs(batch_size);
+  vector<mmsghdr> received(batch_size);
+  vector<mmsghdr> to_send(batch_size);
+  memset(received.data(), 0, received.size() * sizeof(mmsghdr));
+  memset(to_send.data(), 0, to_send.size() * sizeof(mmsghdr));
+  for (int i = 0; i < batch_size; ++i) {
+    query_iovs[i].iov_base = &queries[i * kQueryBufferSize];
+    query_iovs[i].iov_len = kQueryBufferSize;
+    received[i].msg_hdr.msg_name = &peers[i];
+    received[i].msg_hdr.msg_iov = &query_iovs[i];
+    received[i].msg_hdr.msg_iovlen = 1;
+    answer_iovs[i].iov_base = &answers[i * kMaxAnswerSize];
+    to_send[i].msg_hdr.msg_iov = &answer_iovs[i];
+    to_send[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  while (!stop->load()) {
+    for (int i = 0; i < batch_size; ++i) {
+      received[i].msg_hdr.msg_namelen = sizeof(peers[i]);
+    }
+    const int num_received(
+        recvmmsg(fd, received.data(), batch_size, kReceiveFlags, nullptr));
+    if (num_received < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        PLOG(WARNING) << "recvmmsg";
+      }
+      continue;
+    }
+
+    int num_answers(0);
+    for (int i = 0; i < num_received; ++i) {
+      if (received[i].msg_hdr.msg_flags & MSG_TRUNC) {
+        VLOG(1) << "Query too big";
+        continue;
+      }
+      const size_t answer_len(server->HandleQuery(
+          static_cast<const uint8_t*>(query_iovs[i].iov_base),
+          received[i].msg_len,
+          static_cast<uint8_t*>(answer_iovs[num_answers].iov_base)));
+      if (answer_len == 0) {
+        continue;
+      }
+      answer_iovs[num_answers].iov_len = answer_len;
+      to_send[num_answers].msg_hdr.msg_name = &peers[i];
+      to_send[num_answers].msg_hdr.msg_namelen =
+          received[i].msg_hdr.msg_namelen;
+      ++num_answers;
+    }
+
+    int num_sent(0);
+    while (num_sent < num_answers) {
+      const int sent(sendmmsg(fd, &to_send[num_sent], num_answers - num_sent,
+                              0));
+      if (sent < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        // Drop the one that failed, and carry on with the rest.
+        PLOG(WARNING) << "sendmmsg";
+        ++num_sent;
+      } else {
+        num_sent += sent;
+      }
+    }
+  }
+}
+
+
 class Keyboard : public Server {
  public:
   Keyboard(EventLoop* loop) : Server(loop, 0) {
@@ -266,21 +584,56 @@ class Keyboard : public Server {
 
 int main(int argc, char* argv[]) {
   util::InitCT(&argc, &argv);
-
-  // TODO(pphaneuf): This current *has* to be SQLite, because it
-  // depends on sharing the database with a ct-server that will
-  // populate it (which FileDB does not support).
-  SQLiteDB<LoggedCertificate> db(FLAGS_db);
+  CHECK_GT(FLAGS_dns_batch_size, 0);
+  CHECK_GE(FLAGS_dns_cache_size, 0);
+  CHECK_NE(FLAGS_db.empty(), FLAGS_leveldb_db.empty())
+      << "Exactly one of --db and --leveldb_db must be set.";
+
+  // TODO(pphaneuf): FileDB does not support being shared with the
+  // ct-server populating it, and LevelDB does not support it either,
+  // so only SQLite picks up new entries.
+  unique_ptr<Database<LoggedCertificate>> db;
+  SQLiteDB<LoggedCertificate>* sqlite_db(nullptr);
+  if (!FLAGS_db.empty()) {
+    sqlite_db = new SQLiteDB<LoggedCertificate>(FLAGS_db);
+    db.reset(sqlite_db);
+  } else {
+    db.reset(new LevelDB<LoggedCertificate>(FLAGS_leveldb_db));
+  }
 
   EventLoop loop;
 
   // Mostly so we can have a clean exit for valgrind etc.
   Keyboard keyboard(&loop);
 
-  int dns_fd;
-  CHECK(Services::InitServer(&dns_fd, FLAGS_port, NULL, SOCK_DGRAM));
-  CTUDPDNSServer dns(FLAGS_domain, &db, &loop, dns_fd);
+  const int num_threads(FLAGS_dns_server_threads > 0
+                            ? FLAGS_dns_server_threads
+                            : max(1U, thread::hardware_concurrency()));
+  CTDNSServer dns(FLAGS_domain, db.get(), sqlite_db, FLAGS_dns_cache_size);
+  atomic<bool> stop(false);
+  vector<int> fds;
+  vector<thread> workers;
+  for (int i = 0; i < num_threads; ++i) {
+#ifdef SO_REUSEPORT
+    fds.push_back(OpenSocket(FLAGS_port));
+#else
+    // The threads all share the one socket.
+    if (fds.empty()) {
+      fds.push_back(OpenSocket(FLAGS_port));
+    }
+#endif
+    workers.emplace_back(&ServeUDP, &dns, fds.back(), &stop);
+  }
 
-  LOG(INFO) << "Server listening on port " << FLAGS_port;
+  LOG(INFO) << "Server listening on port " << FLAGS_port << " with "
+            << num_threads << " threads";
   loop.Forever();
+
+  stop = true;
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  for (int fd : fds) {
+    close(fd);
+  }
 }
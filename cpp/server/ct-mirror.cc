@@ -5,6 +5,7 @@
 #include <cstring>
 #include <event2/buffer.h>
 #include <event2/thread.h>
+#include <fstream>
 #include <functional>
 #include <gflags/gflags.h>
 #include <iostream>
@@ -12,9 +13,12 @@
 #include <mutex>
 #include <openssl/crypto.h>
 #include <openssl/err.h>
+#include <set>
 #include <signal.h>
+#include <sstream>
 #include <string>
 #include <unistd.h>
+#include <vector>
 
 
 #include "config.h"
@@ -22,6 +26,7 @@
 #include "fetcher/continuous_fetcher.h"
 #include "fetcher/remote_peer.h"
 #include "fetcher/peer_group.h"
+#include "log/caching_database.h"
 #include "log/cluster_state_controller.h"
 #include "log/ct_extensions.h"
 #include "log/database.h"
@@ -29,9 +34,11 @@
 #include "log/file_db.h"
 #include "log/file_storage.h"
 #include "log/leveldb_db.h"
+#ifdef HAVE_ROCKSDB
+#include "log/rocksdb_db.h"
+#endif
 #include "log/sqlite_db.h"
 #include "log/strict_consistent_store.h"
-#include "merkletree/compact_merkle_tree.h"
 #include "merkletree/merkle_verifier.h"
 #include "monitoring/latency.h"
 #include "monitoring/monitoring.h"
@@ -42,10 +49,13 @@
 #include "server/proxy.h"
 #include "server/server.h"
 #include "util/etcd.h"
+#include "util/executor.h"
+#include "util/fair_scheduler.h"
 #include "util/fake_etcd.h"
 #include "util/init.h"
 #include "util/libevent_wrapper.h"
 #include "util/masterelection.h"
+#include "util/memory_budget.h"
 #include "util/periodic_closure.h"
 #include "util/read_key.h"
 #include "util/status.h"
@@ -63,6 +73,12 @@ DEFINE_string(sqlite_db, "",
               "SQLite database for certificate and tree storage");
 DEFINE_string(leveldb_db, "",
               "LevelDB database for certificate and tree storage");
+DEFINE_string(rocksdb_db, "",
+              "RocksDB database for certificate and tree storage, if "
+              "built with RocksDB support");
+DEFINE_int32(database_cache_size_mb, 0,
+             "If non-zero, keep up to this much of the most recently read "
+             "entries in memory.");
 // TODO(ekasper): sanity-check these against the directory structure.
 DEFINE_int32(cert_storage_depth, 0,
              "Subdirectory depth for certificates; if the directory is not "
@@ -82,6 +98,10 @@ DEFINE_string(etcd_servers, "",
 DEFINE_string(etcd_root, "/root", "Root of cluster entries in etcd.");
 DEFINE_int32(num_http_server_threads, 16,
              "Number of threads for servicing the incoming HTTP requests.");
+DEFINE_int32(num_http_event_loops, 1,
+             "Number of event loops accepting and parsing the incoming HTTP "
+             "requests, each with its own listening socket on --port. More "
+             "than one requires SO_REUSEPORT.");
 DEFINE_string(target_log_uri, "http://ct.googleapis.com/pilot",
               "URI of the log to mirror.");
 DEFINE_string(
@@ -89,10 +109,18 @@ DEFINE_string(
     "PEM-encoded server public key file of the log we're mirroring.");
 DEFINE_int32(local_sth_update_frequency_seconds, 30,
              "Number of seconds between local checks for updated tree data.");
+DEFINE_string(mirror_logs_file, "",
+              "If set, mirror all the logs listed in this file in this one "
+              "process, sharing its threads and connections, instead of "
+              "--target_log_uri. Each line is '<name> <port> <log uri> "
+              "<public key file> <leveldb database>'; the cluster state of "
+              "each log is kept under --etcd_root/<name>, and the other "
+              "database flags must not be set.");
 
 namespace libevent = cert_trans::libevent;
 
 using cert_trans::AsyncLogClient;
+using cert_trans::CachingDatabase;
 using cert_trans::ClusterStateController;
 using cert_trans::ConsistentStore;
 using cert_trans::ContinuousFetcher;
@@ -100,6 +128,7 @@ using cert_trans::Counter;
 using cert_trans::Gauge;
 using cert_trans::EtcdClient;
 using cert_trans::EtcdConsistentStore;
+using cert_trans::FairScheduler;
 using cert_trans::FakeEtcdClient;
 using cert_trans::FileStorage;
 using cert_trans::HttpHandler;
@@ -107,6 +136,7 @@ using cert_trans::JsonOutput;
 using cert_trans::Latency;
 using cert_trans::LoggedCertificate;
 using cert_trans::MasterElection;
+using cert_trans::MemoryBudget;
 using cert_trans::PeriodicClosure;
 using cert_trans::Proxy;
 using cert_trans::ReadPublicKey;
@@ -127,17 +157,18 @@ using std::chrono::duration_cast;
 using std::chrono::milliseconds;
 using std::chrono::seconds;
 using std::chrono::steady_clock;
-using std::function;
 using std::lock_guard;
 using std::make_pair;
 using std::make_shared;
 using std::map;
 using std::mutex;
 using std::placeholders::_1;
+using std::set;
 using std::shared_ptr;
 using std::string;
 using std::thread;
 using std::unique_ptr;
+using std::vector;
 using util::HexString;
 using util::StatusOr;
 using util::SyncTask;
@@ -147,6 +178,8 @@ using util::Task;
 namespace {
 
 
+const int kInternalPoolThreads = 8;
+
 Gauge<>* latest_local_tree_size_gauge =
     Gauge<>::New("latest_local_tree_size",
                  "Size of latest locally available STH.");
@@ -156,6 +189,17 @@ Counter<>* inconsistent_sths_received =
                    "Number of STHs received from the mirror target whose root "
                    "hash does not match the locally built tree.");
 
+Gauge<string>* mirror_sth_queue_depth =
+    Gauge<string>::New("mirror_sth_queue_depth", "log",
+                       "Number of STHs received from the mirror target "
+                       "waiting for the local database to catch up with "
+                       "them, by log.");
+
+Latency<milliseconds, string> mirror_sth_validation_latency_ms(
+    "mirror_sth_validation_latency_ms", "log",
+    "Time from receiving an STH from the mirror target to checking it "
+    "against the locally built tree, by log, in ms.");
+
 
 // Basic sanity checks on flag values.
 static bool ValidatePort(const char*, int port) {
@@ -225,10 +269,18 @@ static const bool follow_dummy =
 }  // namespace
 
 
+// An STH of the target log, waiting for the local database to catch
+// up with it.
+struct QueuedSTH {
+  SignedTreeHead sth;
+  steady_clock::time_point received;
+};
+
+
 void STHUpdater(
-    Database<LoggedCertificate>* db,
+    const string& log_name, Database<LoggedCertificate>* db,
     ClusterStateController<LoggedCertificate>* cluster_state_controller,
-    mutex* queue_mutex, map<int64_t, ct::SignedTreeHead>* queue,
+    mutex* queue_mutex, map<int64_t, QueuedSTH>* queue,
     LogLookup<LoggedCertificate>* log_lookup, Task* task) {
   CHECK_NOTNULL(db);
   CHECK_NOTNULL(cluster_state_controller);
@@ -245,64 +297,50 @@ void STHUpdater(
     const int64_t local_size(db->TreeSize());
     latest_local_tree_size_gauge->Set(local_size);
 
-    // log_lookup doesn't yet have the data for the new STHs integrated (that
-    // happens via a callback when the WriteTreeHead() method is called on the
-    // DB), so we'll used a compact tree to pre-validate the STH roots.
-    //
-    // We'll start with one based on the current state of our serving tree and
-    // update it to the STH sizes we're checking.
-    unique_ptr<CompactMerkleTree> new_tree(
-        log_lookup->GetCompactMerkleTree(new Sha256Hasher));
-
+    // Take out the STHs the database has caught up with, so that new
+    // ones can be queued while these are checked.
+    vector<QueuedSTH> ready;
     {
       lock_guard<mutex> lock(*queue_mutex);
-      unique_ptr<Database<LoggedCertificate>::Iterator> entries(
-          db->ScanEntries(new_tree->LeafCount()));
       while (!queue->empty() &&
-             queue->begin()->second.tree_size() <= local_size) {
-        const SignedTreeHead next_sth(queue->begin()->second);
+             queue->begin()->second.sth.tree_size() <= local_size) {
+        ready.emplace_back(queue->begin()->second);
         queue->erase(queue->begin());
+      }
+      mirror_sth_queue_depth->Set(log_name, queue->size());
+    }
 
-        // First, if necessary, catch our local compact tree up to the
-        // candidate STH size:
-        {
-          LoggedCertificate entry;
-          CHECK_LE(next_sth.tree_size(), local_size);
-          while (new_tree->LeafCount() < next_sth.tree_size()) {
-            CHECK(entries->GetNextEntry(&entry));
-            CHECK(entry.has_sequence_number());
-            CHECK_EQ(new_tree->LeafCount(), entry.sequence_number());
-            string serialized_leaf;
-            CHECK(entry.SerializeForLeaf(&serialized_leaf));
-            CHECK_EQ(entry.sequence_number() + 1,
-                     new_tree->AddLeaf(serialized_leaf));
-          }
-        }
-
-        // If the candidate STH is historical, use the RootAtSnapshot() from
-        // our serving tree, otherwise use the root we just calculated with our
-        // compact tree.
-        const string local_root_at_snapshot(
-            next_sth.tree_size() > log_lookup->GetSTH().tree_size()
-                ? new_tree->CurrentRoot()
-                : log_lookup->RootAtSnapshot(next_sth.tree_size()));
-
-        if (next_sth.sha256_root_hash() != local_root_at_snapshot) {
-          LOG(WARNING) << "Received STH:\n" << next_sth.DebugString()
-                       << " whose root:\n"
-                       << HexString(next_sth.sha256_root_hash())
-                       << "\ndoes not match that of local tree at "
-                       << "corresponding snapshot:\n"
-                       << HexString(local_root_at_snapshot);
-          inconsistent_sths_received->Increment();
-          // TODO(alcutter): We should probably write these bad STHs out to a
-          // separate DB table for later analysis.
-          continue;
-        }
-        LOG(INFO) << "Can serve new STH of size " << next_sth.tree_size()
-                  << " locally";
-        cluster_state_controller->NewTreeHead(next_sth);
+    // log_lookup doesn't yet have the data for the new STHs integrated
+    // (that happens via a callback when the WriteTreeHead() method is
+    // called on the DB), but it can compute the roots from the entries we
+    // have, and keeps the leaf hashes for when it does integrate them.
+    // The queue is ordered by tree size, so the roots of all the ready
+    // STHs are computed in one pass.
+    vector<int64_t> sizes;
+    for (const auto& queued : ready) {
+      sizes.push_back(queued.sth.tree_size());
+    }
+    const vector<string> local_roots(log_lookup->RootsAtDatabaseSizes(sizes));
+
+    for (size_t i = 0; i < ready.size(); ++i) {
+      const SignedTreeHead& next_sth(ready[i].sth);
+      mirror_sth_validation_latency_ms.RecordLatency(
+          log_name, steady_clock::now() - ready[i].received);
+      if (next_sth.sha256_root_hash() != local_roots[i]) {
+        LOG(WARNING) << "Received STH:\n" << next_sth.DebugString()
+                     << " whose root:\n"
+                     << HexString(next_sth.sha256_root_hash())
+                     << "\ndoes not match that of local tree at "
+                     << "corresponding snapshot:\n"
+                     << HexString(local_roots[i]);
+        inconsistent_sths_received->Increment();
+        // TODO(alcutter): We should probably write these bad STHs out to a
+        // separate DB table for later analysis.
+        continue;
       }
+      LOG(INFO) << "Can serve new STH of size " << next_sth.tree_size()
+                << " locally";
+      cluster_state_controller->NewTreeHead(next_sth);
     }
 
     std::this_thread::sleep_for(
@@ -311,34 +349,62 @@ void STHUpdater(
 }
 
 
-int main(int argc, char* argv[]) {
-  // Ignore various signals whilst we start up.
-  signal(SIGHUP, SIG_IGN);
-  signal(SIGINT, SIG_IGN);
-  signal(SIGTERM, SIG_IGN);
-
-  util::InitCT(&argc, &argv);
-
-  Server<LoggedCertificate>::StaticInit();
-
-  if (!FLAGS_sqlite_db.empty() + !FLAGS_leveldb_db.empty() +
-          (!FLAGS_cert_dir.empty() | !FLAGS_tree_dir.empty()) !=
-      1) {
-    std::cerr << "Must only specify one database type.";
-    exit(1);
+// A log to mirror.
+struct MirrorTarget {
+  // Empty when mirroring a single log.
+  string name;
+  uint16_t port;
+  string log_uri;
+  string public_key;
+  // Empty to use the database flags.
+  string leveldb_db;
+};
+
+
+vector<MirrorTarget> ReadMirrorTargets(const string& path) {
+  std::ifstream in(path);
+  CHECK(in) << "Could not open " << path;
+
+  vector<MirrorTarget> targets;
+  set<string> names;
+  string line;
+  while (getline(in, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream fields(line);
+    MirrorTarget target;
+    int port;
+    CHECK(fields >> target.name >> port >> target.log_uri >>
+          target.public_key >> target.leveldb_db)
+        << "Invalid line in " << path << ": " << line;
+    CHECK(ValidatePort("port", port)) << "in " << path << ": " << line;
+    target.port = port;
+    CHECK(names.insert(target.name).second) << "Duplicate log name in "
+                                            << path << ": " << target.name;
+    targets.emplace_back(target);
   }
+  CHECK(!targets.empty()) << "No logs to mirror in " << path;
+
+  return targets;
+}
 
-  if (FLAGS_sqlite_db.empty() && FLAGS_leveldb_db.empty()) {
-    CHECK_NE(FLAGS_cert_dir, FLAGS_tree_dir)
-        << "Certificate directory and tree directory must differ";
-  }
 
+Database<LoggedCertificate>* OpenDatabase(const MirrorTarget& target) {
   Database<LoggedCertificate>* db;
 
-  if (!FLAGS_sqlite_db.empty()) {
+  if (!target.leveldb_db.empty()) {
+    db = new LevelDB<LoggedCertificate>(target.leveldb_db);
+  } else if (!FLAGS_sqlite_db.empty()) {
     db = new SQLiteDB<LoggedCertificate>(FLAGS_sqlite_db);
   } else if (!FLAGS_leveldb_db.empty()) {
     db = new LevelDB<LoggedCertificate>(FLAGS_leveldb_db);
+  } else if (!FLAGS_rocksdb_db.empty()) {
+#ifdef HAVE_ROCKSDB
+    db = new RocksDB<LoggedCertificate>(FLAGS_rocksdb_db);
+#else
+    LOG(FATAL) << "--rocksdb_db is not supported by this build";
+#endif
   } else {
     db = new FileDB<LoggedCertificate>(
         new FileStorage(FLAGS_cert_dir, FLAGS_cert_storage_depth),
@@ -346,36 +412,116 @@ int main(int argc, char* argv[]) {
         new FileStorage(FLAGS_meta_dir, 0));
   }
 
-  const bool stand_alone_mode(FLAGS_etcd_servers.empty());
-  const shared_ptr<libevent::Base> event_base(make_shared<libevent::Base>());
-  ThreadPool internal_pool(8);
-  UrlFetcher url_fetcher(event_base.get(), &internal_pool);
+  if (FLAGS_database_cache_size_mb > 0) {
+    db = new CachingDatabase<LoggedCertificate>(
+        db, static_cast<size_t>(FLAGS_database_cache_size_mb) << 20,
+        MemoryBudget::Global());
+  }
+
+  return db;
+}
 
-  const std::unique_ptr<EtcdClient> etcd_client(
-      stand_alone_mode
-          ? new FakeEtcdClient(event_base.get())
-          : new EtcdClient(&internal_pool, &url_fetcher,
-                           SplitHosts(FLAGS_etcd_servers)));
 
-  CHECK(!FLAGS_target_public_key.empty());
-  const StatusOr<EVP_PKEY*> pubkey(ReadPublicKey(FLAGS_target_public_key));
+EVP_PKEY* ReadTargetPublicKey(const MirrorTarget& target) {
+  const StatusOr<EVP_PKEY*> pubkey(ReadPublicKey(target.public_key));
   CHECK(pubkey.ok()) << "Failed to read target log's public key file: "
                      << pubkey.status();
+  return pubkey.ValueOrDie();
+}
 
-  const LogVerifier log_verifier(new LogSigVerifier(pubkey.ValueOrDie()),
-                                 new MerkleVerifier(new Sha256Hasher));
 
+// Mirrors one log into its own database, and serves it on its own
+// port, using the threads and connections of the process.
+class LogMirror {
+ public:
+  // |fetch_executor| may be null, to fetch on |internal_pool|.
+  LogMirror(const MirrorTarget& target,
+            const shared_ptr<libevent::Base>& event_base,
+            ThreadPool* internal_pool, ThreadPool* client_pool,
+            UrlFetcher* url_fetcher, EtcdClient* etcd_client,
+            util::Executor* fetch_executor);
+  ~LogMirror();
+
+  // Starts fetching the entries of the target log.
+  void Start(bool stand_alone_mode);
+
+  // Waits for the local database to catch up with the serving STH of
+  // the cluster, then starts checking the STHs of the target log
+  // against it.
+  void StartSTHUpdater();
+
+  Server<LoggedCertificate>* server() {
+    return &server_;
+  }
+
+ private:
+  static Server<LoggedCertificate>::Options MakeOptions(
+      const MirrorTarget& target, util::Executor* fetch_executor);
+  void NewSTH(const SignedTreeHead& sth);
+
+  const MirrorTarget target_;
+  ThreadPool* const client_pool_;
+  UrlFetcher* const url_fetcher_;
+  const unique_ptr<Database<LoggedCertificate>> db_;
+  const LogVerifier log_verifier_;
+  Server<LoggedCertificate> server_;
+  SyncTask fetcher_task_;
+
+  mutex queue_mutex_;
+  map<int64_t, QueuedSTH> queue_;
+
+  shared_ptr<RemotePeer> peer_;
+  unique_ptr<thread> sth_updater_;
+
+  DISALLOW_COPY_AND_ASSIGN(LogMirror);
+};
+
+
+LogMirror::LogMirror(const MirrorTarget& target,
+                     const shared_ptr<libevent::Base>& event_base,
+                     ThreadPool* internal_pool, ThreadPool* client_pool,
+                     UrlFetcher* url_fetcher, EtcdClient* etcd_client,
+                     util::Executor* fetch_executor)
+    : target_(target),
+      client_pool_(CHECK_NOTNULL(client_pool)),
+      url_fetcher_(CHECK_NOTNULL(url_fetcher)),
+      db_(OpenDatabase(target_)),
+      log_verifier_(new LogSigVerifier(ReadTargetPublicKey(target_)),
+                    new MerkleVerifier(new Sha256Hasher)),
+      server_(MakeOptions(target_, fetch_executor), event_base, internal_pool,
+              db_.get(), etcd_client, url_fetcher_, nullptr /* log_signer */,
+              &log_verifier_, nullptr /* cert_checker */),
+      fetcher_task_(client_pool_) {
+}
+
+
+LogMirror::~LogMirror() {
+  fetcher_task_.task()->Return();
+  fetcher_task_.Wait();
+  if (sth_updater_) {
+    sth_updater_->join();
+  }
+}
+
+
+// static
+Server<LoggedCertificate>::Options LogMirror::MakeOptions(
+    const MirrorTarget& target, util::Executor* fetch_executor) {
   Server<LoggedCertificate>::Options options;
   options.server = FLAGS_server;
-  options.port = FLAGS_port;
-  options.etcd_root = FLAGS_etcd_root;
+  options.port = target.port;
+  options.etcd_root = target.name.empty()
+                          ? FLAGS_etcd_root
+                          : FLAGS_etcd_root + "/" + target.name;
   options.num_http_server_threads = FLAGS_num_http_server_threads;
+  options.num_http_event_loops = FLAGS_num_http_event_loops;
+  options.fetch_executor = fetch_executor;
+  return options;
+}
+
 
-  Server<LoggedCertificate> server(options, event_base, &internal_pool, db,
-                                   etcd_client.get(), &url_fetcher,
-                                   nullptr /* log_signer */, &log_verifier,
-                                   nullptr /* cert_checker */);
-  server.Initialise(true /* is_mirror */);
+void LogMirror::Start(bool stand_alone_mode) {
+  server_.Initialise(true /* is_mirror */);
 
   if (stand_alone_mode) {
     // Set up a simple single-node mirror environment for testing.
@@ -393,61 +539,152 @@ int main(int argc, char* argv[]) {
     config.set_minimum_serving_fraction(1);
     LOG(INFO) << "Setting default single-node ClusterConfig:\n"
               << config.DebugString();
-    server.consistent_store()->SetClusterConfig(config);
+    server_.consistent_store()->SetClusterConfig(config);
 
     // Since we're a single node cluster, we'll settle that we're the
     // master here, so that we can populate the initial STH
     // (StrictConsistentStore won't allow us to do so unless we're master.)
-    server.election()->StartElection();
-    server.election()->WaitToBecomeMaster();
+    server_.election()->StartElection();
+    server_.election()->WaitToBecomeMaster();
   } else {
     CHECK(!FLAGS_server.empty());
   }
 
-  CHECK(!FLAGS_target_log_uri.empty());
+  CHECK(!target_.log_uri.empty());
 
-  ThreadPool pool(16);
-  SyncTask fetcher_task(&pool);
-
-  mutex queue_mutex;
-  map<int64_t, ct::SignedTreeHead> queue;
-
-  const function<void(const ct::SignedTreeHead&)> new_sth(
-      [&queue_mutex, &queue](const ct::SignedTreeHead& sth) {
-        lock_guard<mutex> lock(queue_mutex);
-        const auto it(queue.find(sth.tree_size()));
-        if (it != queue.end() && sth.timestamp() < it->second.timestamp()) {
-          LOG(WARNING) << "Received older STH:\nHad:\n"
-                       << it->second.DebugString() << "\nGot:\n"
-                       << sth.DebugString();
-          return;
-        }
-        queue.insert(make_pair(sth.tree_size(), sth));
-      });
-
-  const shared_ptr<RemotePeer> peer(make_shared<RemotePeer>(
+  peer_ = make_shared<RemotePeer>(
       unique_ptr<AsyncLogClient>(
-          new AsyncLogClient(&pool, &url_fetcher, FLAGS_target_log_uri)),
+          new AsyncLogClient(client_pool_, url_fetcher_, target_.log_uri)),
       unique_ptr<LogVerifier>(
-          new LogVerifier(new LogSigVerifier(pubkey.ValueOrDie()),
+          new LogVerifier(new LogSigVerifier(ReadTargetPublicKey(target_)),
                           new MerkleVerifier(new Sha256Hasher))),
-      new_sth, fetcher_task.task()->AddChild(
-                   [](Task*) { LOG(INFO) << "RemotePeer exited."; })));
+      bind(&LogMirror::NewSTH, this, _1),
+      fetcher_task_.task()->AddChild(
+          [](Task*) { LOG(INFO) << "RemotePeer exited."; }));
+
+  server_.continuous_fetcher()->AddPeer("target", peer_);
+}
+
+
+void LogMirror::StartSTHUpdater() {
+  server_.WaitForWarmUp();
+  server_.WaitForReplication();
+
+  sth_updater_.reset(
+      new thread(&STHUpdater, target_.name, db_.get(),
+                 server_.cluster_state_controller(),
+                 &queue_mutex_, &queue_, server_.log_lookup(),
+                 fetcher_task_.task()->AddChild(
+                     [](Task*) { LOG(INFO) << "STHUpdater exited."; })));
+}
+
+
+void LogMirror::NewSTH(const SignedTreeHead& sth) {
+  // Start fetching the new entries right away.
+  server_.continuous_fetcher()->NewTreeSize(sth.tree_size());
+
+  lock_guard<mutex> lock(queue_mutex_);
+  const auto it(queue_.find(sth.tree_size()));
+  if (it != queue_.end() && sth.timestamp() < it->second.sth.timestamp()) {
+    LOG(WARNING) << "Received older STH:\nHad:\n"
+                 << it->second.sth.DebugString() << "\nGot:\n"
+                 << sth.DebugString();
+    return;
+  }
+  const QueuedSTH queued{sth, steady_clock::now()};
+  queue_.insert(make_pair(sth.tree_size(), queued));
+  mirror_sth_queue_depth->Set(target_.name, queue_.size());
+}
+
+
+int main(int argc, char* argv[]) {
+  // Ignore various signals whilst we start up.
+  signal(SIGHUP, SIG_IGN);
+  signal(SIGINT, SIG_IGN);
+  signal(SIGTERM, SIG_IGN);
+
+  util::InitCT(&argc, &argv);
 
-  server.continuous_fetcher()->AddPeer("target", peer);
+  Server<LoggedCertificate>::StaticInit();
+
+  vector<MirrorTarget> targets;
+  if (!FLAGS_mirror_logs_file.empty()) {
+    if (!FLAGS_sqlite_db.empty() || !FLAGS_leveldb_db.empty() ||
+        !FLAGS_rocksdb_db.empty() || !FLAGS_cert_dir.empty() ||
+        !FLAGS_tree_dir.empty()) {
+      std::cerr << "The databases of the logs are set by "
+                << "--mirror_logs_file.";
+      exit(1);
+    }
+    // These would be shared by all the logs.
+    CHECK(FLAGS_tree_checkpoint.empty())
+        << "--tree_checkpoint is not supported with --mirror_logs_file";
+    CHECK(FLAGS_bootstrap_snapshot_from.empty())
+        << "--bootstrap_snapshot_from is not supported with "
+        << "--mirror_logs_file";
+    targets = ReadMirrorTargets(FLAGS_mirror_logs_file);
+  } else {
+    if (!FLAGS_sqlite_db.empty() + !FLAGS_leveldb_db.empty() +
+            !FLAGS_rocksdb_db.empty() +
+            (!FLAGS_cert_dir.empty() | !FLAGS_tree_dir.empty()) !=
+        1) {
+      std::cerr << "Must only specify one database type.";
+      exit(1);
+    }
+
+    if (FLAGS_sqlite_db.empty() && FLAGS_leveldb_db.empty() &&
+        FLAGS_rocksdb_db.empty()) {
+      CHECK_NE(FLAGS_cert_dir, FLAGS_tree_dir)
+          << "Certificate directory and tree directory must differ";
+    }
+
+    CHECK(!FLAGS_target_public_key.empty());
+    MirrorTarget target;
+    target.port = FLAGS_port;
+    target.log_uri = FLAGS_target_log_uri;
+    target.public_key = FLAGS_target_public_key;
+    targets.emplace_back(target);
+  }
 
-  server.WaitForReplication();
+  const bool stand_alone_mode(FLAGS_etcd_servers.empty());
+  const shared_ptr<libevent::Base> event_base(make_shared<libevent::Base>());
+  ThreadPool internal_pool(kInternalPoolThreads, "internal");
+  UrlFetcher url_fetcher(event_base.get(), &internal_pool);
 
-  thread sth_updater(&STHUpdater, db, server.cluster_state_controller(),
-                     &queue_mutex, &queue, server.log_lookup(),
-                     fetcher_task.task()->AddChild(
-                         [](Task*) { LOG(INFO) << "STHUpdater exited."; }));
+  const std::unique_ptr<EtcdClient> etcd_client(
+      stand_alone_mode
+          ? new FakeEtcdClient(event_base.get())
+          : new EtcdClient(&internal_pool, &url_fetcher,
+                           SplitHosts(FLAGS_etcd_servers)));
+
+  ThreadPool pool(16, "client");
+  // With more than one log, each gets its fair share of the fetching.
+  unique_ptr<FairScheduler> fetch_scheduler;
+  if (targets.size() > 1) {
+    fetch_scheduler.reset(
+        new FairScheduler(&internal_pool, kInternalPoolThreads));
+  }
+
+  // The first log is served from the main event loop, which Run()
+  // dispatches, the others from their own.
+  vector<unique_ptr<LogMirror>> mirrors;
+  for (const auto& target : targets) {
+    mirrors.emplace_back(new LogMirror(
+        target, mirrors.empty() ? event_base : make_shared<libevent::Base>(),
+        &internal_pool, &pool, &url_fetcher, etcd_client.get(),
+        fetch_scheduler ? fetch_scheduler->AddClass(target.name, 1, 0)
+                        : nullptr));
+  }
+  for (const auto& mirror : mirrors) {
+    mirror->Start(stand_alone_mode);
+  }
+  for (const auto& mirror : mirrors) {
+    mirror->StartSTHUpdater();
+  }
 
-  server.Run();
+  mirrors.front()->server()->Run();
 
-  fetcher_task.task()->Return();
-  fetcher_task.Wait();
-  sth_updater.join();
+  mirrors.clear();
 
   return 0;
 }
@@ -1,16 +1,25 @@
 /* -*- indent-tabs-mode: nil -*- */
 
+#include <condition_variable>
+#include <deque>
 #include <event2/thread.h>
+#include <fstream>
 #include <gflags/gflags.h>
 #include <iostream>
 #include <openssl/err.h>
+#include <set>
 #include <signal.h>
+#include <sstream>
 #include <stdlib.h>
 #include <string>
 #include <unistd.h>
 
 
+#include "base/macros.h"
 #include "config.h"
+#include "log/batching_signer.h"
+#include "log/bloom_filter_database.h"
+#include "log/caching_database.h"
 #include "log/cert_checker.h"
 #include "log/cert_submission_handler.h"
 #include "log/cluster_state_controller.h"
@@ -20,6 +29,9 @@
 #include "log/leveldb_db.h"
 #include "log/log_signer.h"
 #include "log/log_verifier.h"
+#ifdef HAVE_ROCKSDB
+#include "log/rocksdb_db.h"
+#endif
 #include "log/sqlite_db.h"
 #include "log/strict_consistent_store.h"
 #include "log/tree_signer.h"
@@ -34,9 +46,11 @@
 #include "util/fake_etcd.h"
 #include "util/init.h"
 #include "util/libevent_wrapper.h"
+#include "util/memory_budget.h"
 #include "util/read_key.h"
 #include "util/status.h"
 #include "util/thread_pool.h"
+#include "util/util.h"
 #include "util/uuid.h"
 
 DEFINE_string(server, "localhost", "Server host");
@@ -52,6 +66,23 @@ DEFINE_string(sqlite_db, "",
               "SQLite database for certificate and tree storage");
 DEFINE_string(leveldb_db, "",
               "LevelDB database for certificate and tree storage");
+DEFINE_string(rocksdb_db, "",
+              "RocksDB database for certificate and tree storage, if "
+              "built with RocksDB support");
+DEFINE_int32(database_cache_size_mb, 0,
+             "If non-zero, keep up to this much of the most recently read "
+             "entries in memory.");
+DEFINE_int32(database_bloom_filter_capacity, 0,
+             "If non-zero, keep a Bloom filter of the hashes of all the "
+             "entries in memory, so that looking up new submissions doesn't "
+             "have to go to the database. It is sized for this many entries "
+             "at first, and grows as needed.");
+DEFINE_double(database_bloom_filter_false_positive_rate, 0.001,
+              "Target false positive rate of the Bloom filter.");
+DEFINE_string(database_bloom_filter_checkpoint, "",
+              "If set, save the Bloom filter to this file every "
+              "--tree_checkpoint_interval entries, and reload it at startup "
+              "rather than scanning all the entries.");
 // TODO(ekasper): sanity-check these against the directory structure.
 DEFINE_int32(cert_storage_depth, 0,
              "Subdirectory depth for certificates; if the directory is not "
@@ -67,15 +98,60 @@ DEFINE_int32(log_stats_frequency_seconds, 3600,
 DEFINE_int32(sequencing_frequency_seconds, 10,
              "How often should new entries be sequenced. The sequencing runs "
              "in parallel with the tree signing and cleanup.");
-DEFINE_int32(cleanup_frequency_seconds, 10,
-             "How often should new entries be cleanedup. The cleanup runs in "
-             "in parallel with the tree signing and sequencing.");
+DEFINE_int32(sequencing_backlog_threshold, 0,
+             "If non-zero, new entries are sequenced as soon as this many "
+             "of them are past the guard window, or the oldest of them has "
+             "been for --sequencing_max_delay_ms, with at most "
+             "--sequencing_frequency_seconds between runs. The tree is then "
+             "also signed as soon as new entries are sequenced, with at "
+             "least --tree_signing_min_interval_seconds between signings.");
+DEFINE_int32(sequencing_max_delay_ms, 1000,
+             "With --sequencing_backlog_threshold, how long an entry can "
+             "wait to be sequenced once past the guard window.");
+DEFINE_int32(tree_signing_min_interval_seconds, 10,
+             "With --sequencing_backlog_threshold or "
+             "--tree_signing_entries_threshold, the minimum time between "
+             "two tree signings.");
+DEFINE_int32(tree_signing_entries_threshold, 0,
+             "If non-zero, the tree is signed as soon as this many entries "
+             "have been sequenced since the latest STH, or the oldest of "
+             "them has waited for --tree_signing_merge_delay_budget_seconds, "
+             "with at least --tree_signing_min_interval_seconds and at most "
+             "--tree_signing_frequency_seconds between signings.");
+DEFINE_int32(tree_signing_merge_delay_budget_seconds, 0,
+             "With --tree_signing_entries_threshold, how long after its SCT "
+             "an entry can wait to be signed into the tree, if non-zero. Set "
+             "this below the MMD, leaving room for the signing itself.");
+DEFINE_int32(sequencing_pipeline_depth, 0,
+             "If non-zero, the sequenced entries are stored in the local "
+             "database by a separate thread, so that the next sequencing "
+             "run can start meanwhile. The sequencer waits when this many "
+             "runs are already waiting to be stored.");
+DEFINE_int32(cleanup_frequency_seconds, 1,
+             "How often to check whether the serving STH has moved on, "
+             "and clean up the entries it newly covers. The cleanup runs "
+             "in parallel with the tree signing and sequencing, and "
+             "checking doesn't touch etcd.");
+DEFINE_int32(cleanup_max_entries_per_second, 0,
+             "If non-zero, pause between the batches of old entries "
+             "cleaned up (see --etcd_cleanup_batch_size) to delete at most "
+             "about this many per second, leaving the rest of etcd's "
+             "capacity to the sequencing.");
 DEFINE_int32(tree_signing_frequency_seconds, 600,
              "How often should we issue a new signed tree head. Approximate: "
              "the signer process will kick off if in the beginning of the "
              "server select loop, at least this period has elapsed since the "
              "last signing. Set this well below the MMD to ensure we sign in "
              "a timely manner. Must be greater than 0.");
+DEFINE_int32(signer_batch_size, 0,
+             "If positive, the SCTs and tree heads are signed through a "
+             "batching signer (see log/batching_signer.h), which coalesces "
+             "the concurrent signatures into batches of up to this many, "
+             "on threads of its own.");
+DEFINE_int32(signer_max_outstanding_batches, 1,
+             "With --signer_batch_size, how many batches can be signed at "
+             "once, the signatures requested meanwhile waiting for the "
+             "next batch.");
 DEFINE_double(guard_window_seconds, 60,
               "Unsequenced entries newer than this "
               "number of seconds will not be sequenced.");
@@ -84,12 +160,39 @@ DEFINE_string(etcd_servers, "",
 DEFINE_string(etcd_root, "/root", "Root of cluster entries in etcd.");
 DEFINE_int32(num_http_server_threads, 16,
              "Number of threads for servicing the incoming HTTP requests.");
+DEFINE_int32(num_http_event_loops, 1,
+             "Number of event loops accepting and parsing the incoming HTTP "
+             "requests, each with its own listening socket on --port. More "
+             "than one requires SO_REUSEPORT.");
 DEFINE_bool(i_know_stand_alone_mode_can_lose_data, false,
             "Set this to allow stand-alone mode, even though it will lost "
             "submissions in the case of a crash.");
+DEFINE_string(log_shards_file, "",
+              "If set, run all the logs listed in this file in this one "
+              "process, sharing its port, threads, connections and trusted "
+              "roots. Each line is '<name> <private key file> <leveldb "
+              "database>'; each log is served under /<name> (as in "
+              "/<name>/ct/v1/get-sth), its cluster state is kept under "
+              "--etcd_root/<name>, and --key and the database flags must not "
+              "be set.");
+DEFINE_bool(read_only_replica, false,
+            "Only serve the get-* requests, straight from the database, "
+            "without etcd, a key, fetching or taking part in the cluster. "
+            "The database is either a copy of a --leveldb_db, or the "
+            "--rocksdb_db of another node, which is followed as that node "
+            "writes to it (see --rocksdb_secondary_dir).");
+DEFINE_string(rocksdb_secondary_dir, "",
+              "With --read_only_replica and --rocksdb_db, where to keep the "
+              "logs of the secondary instance following the database.");
+DEFINE_int32(replica_catch_up_interval_ms, 1000,
+             "With --read_only_replica, how often to pick up the entries "
+             "and tree heads newly written to the --rocksdb_db.");
 
 namespace libevent = cert_trans::libevent;
 
+using cert_trans::BatchingSigner;
+using cert_trans::BloomFilterDatabase;
+using cert_trans::CachingDatabase;
 using cert_trans::CertChecker;
 using cert_trans::ClusterStateController;
 using cert_trans::ConsistentStore;
@@ -101,11 +204,17 @@ using cert_trans::FakeEtcdClient;
 using cert_trans::FileStorage;
 using cert_trans::HttpHandler;
 using cert_trans::Latency;
+using cert_trans::LocalSigningBackend;
 using cert_trans::LoggedCertificate;
+using cert_trans::MasterElection;
+using cert_trans::MemoryBudget;
 using cert_trans::ReadPrivateKey;
 using cert_trans::ScopedLatency;
 using cert_trans::Server;
+using cert_trans::Signer;
+using cert_trans::SigningBackend;
 using cert_trans::SplitHosts;
+using cert_trans::StartupPhase;
 using cert_trans::ThreadPool;
 using cert_trans::TreeSigner;
 using cert_trans::Update;
@@ -119,14 +228,20 @@ using std::chrono::duration_cast;
 using std::chrono::milliseconds;
 using std::chrono::seconds;
 using std::chrono::steady_clock;
+using std::condition_variable;
+using std::deque;
 using std::function;
+using std::lock_guard;
 using std::make_shared;
 using std::mutex;
 using std::placeholders::_1;
+using std::set;
 using std::shared_ptr;
 using std::string;
 using std::thread;
 using std::unique_ptr;
+using std::unique_lock;
+using std::vector;
 
 
 namespace {
@@ -139,10 +254,20 @@ Gauge<>* latest_local_tree_size_gauge =
 Counter<bool>* sequencer_total_runs = Counter<bool>::New(
     "sequencer_total_runs", "successful",
     "Total number of sequencer runs broken out by success.");
+Counter<>* sequencer_takeovers = Counter<>::New(
+    "sequencer_takeovers",
+    "Number of times the sequencer started running upon becoming master.");
 Latency<milliseconds> sequencer_sequence_latency_ms(
     "sequencer_sequence_latency_ms",
     "Total time spent sequencing entries by sequencer");
 
+Gauge<>* sequencer_waiting_batches = Gauge<>::New(
+    "sequencer_waiting_batches",
+    "Number of sequencer runs waiting for their entries to be stored.");
+Latency<milliseconds> sequencer_store_latency_ms(
+    "sequencer_store_latency_ms",
+    "Time spent storing the sequenced entries in the local database");
+
 Counter<bool>* signer_total_runs =
     Counter<bool>::New("signer_total_runs", "successful",
                        "Total number of signer runs broken out by success.");
@@ -170,7 +295,12 @@ static bool ValidateRead(const char* flagname, const string& path) {
   return true;
 }
 
-static const bool key_dummy = RegisterFlagValidator(&FLAGS_key, &ValidateRead);
+// It is empty with --log_shards_file.
+static bool ValidateKey(const char* flagname, const string& path) {
+  return path.empty() || ValidateRead(flagname, path);
+}
+
+static const bool key_dummy = RegisterFlagValidator(&FLAGS_key, &ValidateKey);
 
 static const bool cert_dummy =
     RegisterFlagValidator(&FLAGS_trusted_cert_file, &ValidateRead);
@@ -214,10 +344,54 @@ static const bool stats_dummy =
     RegisterFlagValidator(&FLAGS_log_stats_frequency_seconds,
                           &ValidateIsPositive);
 
+static const bool pipeline_dummy =
+    RegisterFlagValidator(&FLAGS_sequencing_pipeline_depth,
+                          &ValidateIsNonNegative);
+
 static const bool sign_dummy =
     RegisterFlagValidator(&FLAGS_tree_signing_frequency_seconds,
                           &ValidateIsPositive);
 
+static const bool backlog_dummy =
+    RegisterFlagValidator(&FLAGS_sequencing_backlog_threshold,
+                          &ValidateIsNonNegative);
+
+static const bool max_delay_dummy =
+    RegisterFlagValidator(&FLAGS_sequencing_max_delay_ms,
+                          &ValidateIsNonNegative);
+
+static const bool sign_interval_dummy =
+    RegisterFlagValidator(&FLAGS_tree_signing_min_interval_seconds,
+                          &ValidateIsNonNegative);
+
+static const bool sign_threshold_dummy =
+    RegisterFlagValidator(&FLAGS_tree_signing_entries_threshold,
+                          &ValidateIsNonNegative);
+
+static const bool sign_budget_dummy =
+    RegisterFlagValidator(&FLAGS_tree_signing_merge_delay_budget_seconds,
+                          &ValidateIsNonNegative);
+
+static const bool cleanup_rate_dummy =
+    RegisterFlagValidator(&FLAGS_cleanup_max_entries_per_second,
+                          &ValidateIsNonNegative);
+
+static const bool bloom_filter_dummy =
+    RegisterFlagValidator(&FLAGS_database_bloom_filter_capacity,
+                          &ValidateIsNonNegative);
+
+static bool ValidateFalsePositiveRate(const char* flagname, double value) {
+  if (value <= 0 || value >= 1) {
+    std::cout << flagname << " must be between 0 and 1" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static const bool false_positive_dummy =
+    RegisterFlagValidator(&FLAGS_database_bloom_filter_false_positive_rate,
+                          &ValidateFalsePositiveRate);
+
 void CleanUpEntries(ConsistentStore<LoggedCertificate>* store,
                     const function<bool()>& is_master) {
   CHECK_NOTNULL(store);
@@ -228,9 +402,9 @@ void CleanUpEntries(ConsistentStore<LoggedCertificate>* store,
 
   while (true) {
     if (is_master()) {
-      // Keep cleaning up until there's no more work to do.
-      // This should help to keep the etcd contents size down during heavy
-      // load.
+      // Keep cleaning up, a batch at a time, until there's no more
+      // work to do. This should help to keep the etcd contents size
+      // down during heavy load.
       while (true) {
         const util::StatusOr<int64_t> num_cleaned(store->CleanupOldEntries());
         if (!num_cleaned.ok()) {
@@ -241,6 +415,11 @@ void CleanUpEntries(ConsistentStore<LoggedCertificate>* store,
         if (num_cleaned.ValueOrDie() == 0) {
           break;
         }
+        if (FLAGS_cleanup_max_entries_per_second > 0) {
+          std::this_thread::sleep_for(duration<double>(
+              static_cast<double>(num_cleaned.ValueOrDie()) /
+              FLAGS_cleanup_max_entries_per_second));
+        }
       }
     }
 
@@ -253,19 +432,118 @@ void CleanUpEntries(ConsistentStore<LoggedCertificate>* store,
   }
 }
 
+// Hands the entries sequenced by SequenceEntries() over to
+// StoreSequencedEntries(), making the former wait when |max_batches|
+// batches are already waiting.
+class SequencedBatches {
+ public:
+  explicit SequencedBatches(size_t max_batches) : max_batches_(max_batches) {
+    CHECK_GT(max_batches_, 0U);
+  }
+
+  void Push(vector<LoggedCertificate>* batch) {
+    unique_lock<mutex> lock(lock_);
+    cv_.wait(lock, [this]() { return batches_.size() < max_batches_; });
+    batches_.emplace_back();
+    batches_.back().swap(*batch);
+    sequencer_waiting_batches->Set(batches_.size());
+    cv_.notify_all();
+  }
+
+  void Pop(vector<LoggedCertificate>* batch) {
+    unique_lock<mutex> lock(lock_);
+    cv_.wait(lock, [this]() { return !batches_.empty(); });
+    batch->swap(batches_.front());
+    batches_.pop_front();
+    sequencer_waiting_batches->Set(batches_.size());
+    cv_.notify_all();
+  }
+
+ private:
+  const size_t max_batches_;
+  mutex lock_;
+  condition_variable cv_;
+  deque<vector<LoggedCertificate>> batches_;
+
+  DISALLOW_COPY_AND_ASSIGN(SequencedBatches);
+};
+
+// Wakes up SignMerkleTree() when entries have been sequenced, with
+// --sequencing_backlog_threshold or --tree_signing_entries_threshold.
+class SequencingSignal {
+ public:
+  SequencingSignal() : sequenced_(false) {
+  }
+
+  void Notify() {
+    lock_guard<mutex> lock(lock_);
+    sequenced_ = true;
+    cv_.notify_all();
+  }
+
+  // Returns at |deadline|, or once |ready| returns true, but not
+  // before |earliest|. |ready| is checked to begin with, as entries
+  // may have been sequenced while the tree was signed, and then after
+  // each Notify(). It can bring |deadline| forward.
+  void WaitUntil(steady_clock::time_point earliest,
+                 steady_clock::time_point deadline,
+                 const function<bool(steady_clock::time_point*)>& ready) {
+    unique_lock<mutex> lock(lock_);
+    bool check(true);
+    while (check ||
+           cv_.wait_until(lock, deadline, [this]() { return sequenced_; })) {
+      check = false;
+      sequenced_ = false;
+      lock.unlock();
+      std::this_thread::sleep_until(std::min(earliest, deadline));
+      steady_clock::time_point sign_by(deadline);
+      if (ready(&sign_by)) {
+        return;
+      }
+      deadline = std::min(deadline, std::max(earliest, sign_by));
+      lock.lock();
+    }
+  }
+
+ private:
+  mutex lock_;
+  condition_variable cv_;
+  bool sequenced_;
+
+  DISALLOW_COPY_AND_ASSIGN(SequencingSignal);
+};
+
+// If |batches| is not NULL, the sequenced entries are left there for
+// StoreSequencedEntries(). If |signal| is not NULL, it is notified
+// after each run (when the entries are stored, that is). With
+// --sequencing_backlog_threshold, runs happen as soon as there are
+// enough pending entries.
 void SequenceEntries(TreeSigner<LoggedCertificate>* tree_signer,
-                     const function<bool()>& is_master) {
+                     const MasterElection* election,
+                     SequencedBatches* batches, SequencingSignal* signal) {
   CHECK_NOTNULL(tree_signer);
-  CHECK(is_master);
+  CHECK_NOTNULL(election);
   const steady_clock::duration period(
       (seconds(FLAGS_sequencing_frequency_seconds)));
   steady_clock::time_point target_run_time(steady_clock::now());
+  vector<LoggedCertificate> new_entries;
 
   while (true) {
-    if (is_master()) {
+    util::Status status;
+    if (election->IsMaster()) {
       const ScopedLatency sequencer_sequence_latency(
           sequencer_sequence_latency_ms.GetScopedLatency());
-      util::Status status(tree_signer->SequenceNewEntries());
+      if (batches) {
+        status = tree_signer->AssignSequenceNumbers(&new_entries);
+        if (status.ok() && !new_entries.empty()) {
+          batches->Push(&new_entries);
+        }
+      } else {
+        status = tree_signer->SequenceNewEntries();
+        if (status.ok() && signal) {
+          signal->Notify();
+        }
+      }
       if (!status.ok()) {
         LOG(WARNING) << "Problem sequencing new entries: " << status;
       }
@@ -277,18 +555,100 @@ void SequenceEntries(TreeSigner<LoggedCertificate>* tree_signer,
       target_run_time += period;
     }
 
-    std::this_thread::sleep_for(target_run_time - now);
+    // The tree and the pending entries are kept up to date while
+    // standing by, so a node taking over can start sequencing right
+    // away, rather than at its next period.
+    if (!election->IsMaster() &&
+        election->WaitToBecomeMasterUntil(target_run_time)) {
+      sequencer_takeovers->Increment();
+      target_run_time = steady_clock::now();
+      continue;
+    }
+
+    // After a failure, wait for the full period rather than retry
+    // right away.
+    if (FLAGS_sequencing_backlog_threshold > 0 && election->IsMaster() &&
+        status.ok()) {
+      tree_signer->WaitForPendingEntries(
+          FLAGS_sequencing_backlog_threshold,
+          milliseconds(FLAGS_sequencing_max_delay_ms), target_run_time);
+      continue;
+    }
+
+    std::this_thread::sleep_for(target_run_time - steady_clock::now());
+  }
+}
+
+void StoreSequencedEntries(TreeSigner<LoggedCertificate>* tree_signer,
+                           SequencedBatches* batches,
+                           SequencingSignal* signal) {
+  CHECK_NOTNULL(tree_signer);
+  CHECK_NOTNULL(batches);
+  vector<LoggedCertificate> new_entries;
+
+  while (true) {
+    batches->Pop(&new_entries);
+    const ScopedLatency sequencer_store_latency(
+        sequencer_store_latency_ms.GetScopedLatency());
+    tree_signer->StoreSequencedEntries(new_entries);
+    if (signal) {
+      signal->Notify();
+    }
+  }
+}
+
+// Whether the entries of |db| past the latest STH are to be signed
+// now. With --tree_signing_entries_threshold, that is once there are
+// enough of them, or the oldest is out of merge delay budget, before
+// which |sign_by| is brought forward.
+bool ShouldSignTree(const TreeSigner<LoggedCertificate>* tree_signer,
+                    const Database<LoggedCertificate>* db,
+                    steady_clock::time_point* sign_by) {
+  const int64_t signed_size(tree_signer->LatestSTH().tree_size());
+  const int64_t unsigned_entries(db->TreeSize() - signed_size);
+  if (unsigned_entries <= 0) {
+    return false;
+  }
+  if (FLAGS_tree_signing_entries_threshold == 0 ||
+      unsigned_entries >= FLAGS_tree_signing_entries_threshold) {
+    return true;
   }
+  if (FLAGS_tree_signing_merge_delay_budget_seconds == 0) {
+    return false;
+  }
+
+  LoggedCertificate oldest;
+  if (db->LookupByIndex(signed_size, &oldest) !=
+      Database<LoggedCertificate>::LOOKUP_OK) {
+    return false;
+  }
+  const milliseconds waited(
+      static_cast<int64_t>(util::TimeInMilliseconds()) -
+      static_cast<int64_t>(oldest.sct().timestamp()));
+  const milliseconds budget_left(
+      seconds(FLAGS_tree_signing_merge_delay_budget_seconds) - waited);
+  if (budget_left <= milliseconds::zero()) {
+    return true;
+  }
+  *sign_by = std::min(*sign_by, steady_clock::now() + budget_left);
+  return false;
 }
 
+// If |signal| is not NULL, the tree is also signed when it notifies
+// of new entries in |db| (see ShouldSignTree()).
 void SignMerkleTree(TreeSigner<LoggedCertificate>* tree_signer,
                     ConsistentStore<LoggedCertificate>* store,
-                    ClusterStateController<LoggedCertificate>* controller) {
+                    ClusterStateController<LoggedCertificate>* controller,
+                    const Database<LoggedCertificate>* db,
+                    SequencingSignal* signal) {
   CHECK_NOTNULL(tree_signer);
   CHECK_NOTNULL(store);
   CHECK_NOTNULL(controller);
+  CHECK_NOTNULL(db);
   const steady_clock::duration period(
       (seconds(FLAGS_tree_signing_frequency_seconds)));
+  const steady_clock::duration min_interval(
+      (seconds(FLAGS_tree_signing_min_interval_seconds)));
   steady_clock::time_point target_run_time(steady_clock::now());
 
   while (true) {
@@ -319,49 +679,75 @@ void SignMerkleTree(TreeSigner<LoggedCertificate>* tree_signer,
     while (target_run_time <= now) {
       target_run_time += period;
     }
+    if (signal) {
+      signal->WaitUntil(now + min_interval, target_run_time,
+                        [db, tree_signer](steady_clock::time_point* sign_by) {
+                          return ShouldSignTree(tree_signer, db, sign_by);
+                        });
+      // Keep to the period from there.
+      target_run_time = steady_clock::now();
+      continue;
+    }
     std::this_thread::sleep_for(target_run_time - now);
   }
 }
 
-}  // namespace
-
 
-int main(int argc, char* argv[]) {
-  // Ignore various signals whilst we start up.
-  signal(SIGHUP, SIG_IGN);
-  signal(SIGINT, SIG_IGN);
-  signal(SIGTERM, SIG_IGN);
+// A log served by this process.
+struct LogShardConfig {
+  // Empty when serving a single log.
+  string name;
+  string key;
+  // Empty to use the database flags.
+  string leveldb_db;
+};
 
-  util::InitCT(&argc, &argv);
-
-  Server<LoggedCertificate>::StaticInit();
-
-  util::StatusOr<EVP_PKEY*> pkey(ReadPrivateKey(FLAGS_key));
-  CHECK_EQ(pkey.status(), util::Status::OK);
-  LogSigner log_signer(pkey.ValueOrDie());
 
-  CertChecker checker;
-  CHECK(checker.LoadTrustedCertificates(FLAGS_trusted_cert_file))
-      << "Could not load CA certs from " << FLAGS_trusted_cert_file;
+vector<LogShardConfig> ReadLogShards(const string& path) {
+  std::ifstream in(path);
+  CHECK(in) << "Could not open " << path;
 
-  if (!FLAGS_sqlite_db.empty() + !FLAGS_leveldb_db.empty() +
-          (!FLAGS_cert_dir.empty() | !FLAGS_tree_dir.empty()) !=
-      1) {
-    std::cerr << "Must only specify one database type.";
-    exit(1);
+  vector<LogShardConfig> shards;
+  set<string> names;
+  string line;
+  while (getline(in, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream fields(line);
+    LogShardConfig shard;
+    CHECK(fields >> shard.name >> shard.key >> shard.leveldb_db)
+        << "Invalid line in " << path << ": " << line;
+    CHECK(ValidateRead("key", shard.key)) << "in " << path << ": " << line;
+    CHECK(names.insert(shard.name).second) << "Duplicate log name in " << path
+                                           << ": " << shard.name;
+    shards.emplace_back(shard);
   }
+  CHECK(!shards.empty()) << "No logs to serve in " << path;
+
+  return shards;
+}
 
-  if (FLAGS_sqlite_db.empty() && FLAGS_leveldb_db.empty()) {
-    CHECK_NE(FLAGS_cert_dir, FLAGS_tree_dir)
-        << "Certificate directory and tree directory must differ";
-  }
 
+Database<LoggedCertificate>* OpenDatabase(const LogShardConfig& shard) {
   Database<LoggedCertificate>* db;
 
-  if (!FLAGS_sqlite_db.empty()) {
+  unique_ptr<StartupPhase> open_database(new StartupPhase("open_database"));
+  if (!shard.leveldb_db.empty()) {
+    db = new LevelDB<LoggedCertificate>(shard.leveldb_db);
+  } else if (!FLAGS_sqlite_db.empty()) {
     db = new SQLiteDB<LoggedCertificate>(FLAGS_sqlite_db);
   } else if (!FLAGS_leveldb_db.empty()) {
     db = new LevelDB<LoggedCertificate>(FLAGS_leveldb_db);
+  } else if (!FLAGS_rocksdb_db.empty()) {
+#ifdef HAVE_ROCKSDB
+    db = FLAGS_read_only_replica
+             ? new RocksDB<LoggedCertificate>(FLAGS_rocksdb_db,
+                                              FLAGS_rocksdb_secondary_dir)
+             : new RocksDB<LoggedCertificate>(FLAGS_rocksdb_db);
+#else
+    LOG(FATAL) << "--rocksdb_db is not supported by this build";
+#endif
   } else {
     db = new FileDB<LoggedCertificate>(
         new FileStorage(FLAGS_cert_dir, FLAGS_cert_storage_depth),
@@ -369,42 +755,139 @@ int main(int argc, char* argv[]) {
         new FileStorage(FLAGS_meta_dir, 0));
   }
 
-  shared_ptr<libevent::Base> event_base(make_shared<libevent::Base>());
-  ThreadPool internal_pool(8);
-  UrlFetcher url_fetcher(event_base.get(), &internal_pool);
+  if (FLAGS_database_cache_size_mb > 0) {
+    db = new CachingDatabase<LoggedCertificate>(
+        db, static_cast<size_t>(FLAGS_database_cache_size_mb) << 20,
+        MemoryBudget::Global());
+  }
+  open_database.reset();
+
+  if (FLAGS_database_bloom_filter_capacity > 0) {
+    StartupPhase phase("load_bloom_filter");
+    db = new BloomFilterDatabase<LoggedCertificate>(
+        db, FLAGS_database_bloom_filter_capacity,
+        FLAGS_database_bloom_filter_false_positive_rate,
+        FLAGS_database_bloom_filter_checkpoint, FLAGS_tree_checkpoint_interval);
+  }
 
-  const bool stand_alone_mode(FLAGS_etcd_servers.empty());
-  if (stand_alone_mode && !FLAGS_i_know_stand_alone_mode_can_lose_data) {
-    LOG(FATAL) << "attempted to run in stand-alone mode without the "
-                  "--i_know_stand_alone_mode_can_lose_data flag";
+  return db;
+}
+
+
+EVP_PKEY* ReadShardPrivateKey(const LogShardConfig& shard) {
+  util::StatusOr<EVP_PKEY*> pkey(ReadPrivateKey(shard.key));
+  CHECK_EQ(pkey.status(), util::Status::OK);
+  return pkey.ValueOrDie();
+}
+
+
+LogSigner* NewLogSigner(EVP_PKEY* pkey) {
+  if (FLAGS_signer_batch_size <= 0) {
+    return new LogSigner(pkey);
   }
-  LOG(INFO) << "Running in "
-            << (stand_alone_mode ? "STAND-ALONE" : "CLUSTERED") << " mode.";
+  CHECK_GT(FLAGS_signer_max_outstanding_batches, 0);
+  return new LogSigner(unique_ptr<Signer>(new BatchingSigner(
+      unique_ptr<SigningBackend>(
+          new LocalSigningBackend(unique_ptr<Signer>(new Signer(pkey)))),
+      FLAGS_signer_batch_size, FLAGS_signer_max_outstanding_batches)));
+}
 
-  std::unique_ptr<EtcdClient> etcd_client(
-      stand_alone_mode
-          ? new FakeEtcdClient(event_base.get())
-          : new EtcdClient(&internal_pool, &url_fetcher,
-                           SplitHosts(FLAGS_etcd_servers)));
 
-  const LogVerifier log_verifier(new LogSigVerifier(pkey.ValueOrDie()),
-                                 new MerkleVerifier(new Sha256Hasher));
+// Runs one log in its own database and cluster state, using the
+// threads and connections of the process, and serving it on the HTTP
+// servers of the first log.
+class LogShard {
+ public:
+  // |http_host| is null for the first log, whose server gets the HTTP
+  // servers.
+  LogShard(const LogShardConfig& config,
+           const shared_ptr<libevent::Base>& event_base,
+           ThreadPool* internal_pool, UrlFetcher* url_fetcher,
+           EtcdClient* etcd_client, CertChecker* checker,
+           Server<LoggedCertificate>* http_host);
+
+  // Loads the tree, waits for the local database to catch up with the
+  // serving STH of the cluster, and starts sequencing, cleaning up and
+  // signing the tree.
+  void Start(bool stand_alone_mode);
+
+  Server<LoggedCertificate>* server() {
+    return &server_;
+  }
+
+ private:
+  static Server<LoggedCertificate>::Options MakeOptions(
+      const LogShardConfig& config, Server<LoggedCertificate>* http_host);
+
+  const Server<LoggedCertificate>::Options options_;
+  ThreadPool* const internal_pool_;
+  EtcdClient* const etcd_client_;
+  const shared_ptr<libevent::Base> event_base_;
+  EVP_PKEY* const pkey_;
+  const unique_ptr<LogSigner> log_signer_;
+  const unique_ptr<Database<LoggedCertificate>> db_;
+  const LogVerifier log_verifier_;
+  Server<LoggedCertificate> server_;
+  unique_ptr<TreeSigner<LoggedCertificate>> tree_signer_;
+  unique_ptr<SequencingSignal> sequencing_signal_;
+  unique_ptr<SequencedBatches> sequenced_batches_;
+  unique_ptr<thread> sequenced_store_;
+  unique_ptr<thread> sequencer_;
+  unique_ptr<thread> cleanup_;
+  unique_ptr<thread> signer_;
+
+  DISALLOW_COPY_AND_ASSIGN(LogShard);
+};
+
+
+LogShard::LogShard(const LogShardConfig& config,
+                   const shared_ptr<libevent::Base>& event_base,
+                   ThreadPool* internal_pool, UrlFetcher* url_fetcher,
+                   EtcdClient* etcd_client, CertChecker* checker,
+                   Server<LoggedCertificate>* http_host)
+    : options_(MakeOptions(config, http_host)),
+      internal_pool_(CHECK_NOTNULL(internal_pool)),
+      etcd_client_(CHECK_NOTNULL(etcd_client)),
+      event_base_(event_base),
+      pkey_(ReadShardPrivateKey(config)),
+      log_signer_(NewLogSigner(pkey_)),
+      db_(OpenDatabase(config)),
+      log_verifier_(new LogSigVerifier(pkey_),
+                    new MerkleVerifier(new Sha256Hasher)),
+      server_(options_, event_base_, internal_pool_, db_.get(), etcd_client_,
+              url_fetcher, log_signer_.get(), &log_verifier_, checker) {
+}
+
 
+// static
+Server<LoggedCertificate>::Options LogShard::MakeOptions(
+    const LogShardConfig& config, Server<LoggedCertificate>* http_host) {
   Server<LoggedCertificate>::Options options;
   options.server = FLAGS_server;
   options.port = FLAGS_port;
-  options.etcd_root = FLAGS_etcd_root;
   options.num_http_server_threads = FLAGS_num_http_server_threads;
+  options.num_http_event_loops = FLAGS_num_http_event_loops;
+  if (config.name.empty()) {
+    options.etcd_root = FLAGS_etcd_root;
+  } else {
+    options.etcd_root = FLAGS_etcd_root + "/" + config.name;
+    options.path_prefix = "/" + config.name;
+  }
+  options.http_host = http_host;
+  options.trusted_cert_file = FLAGS_trusted_cert_file;
+  return options;
+}
 
-  Server<LoggedCertificate> server(options, event_base, &internal_pool, db,
-                                   etcd_client.get(), &url_fetcher,
-                                   &log_signer, &log_verifier, &checker);
-  server.Initialise(false /* is_mirror */);
 
-  TreeSigner<LoggedCertificate> tree_signer(
-      std::chrono::duration<double>(FLAGS_guard_window_seconds), db,
-      server.log_lookup()->GetCompactMerkleTree(new Sha256Hasher),
-      server.consistent_store(), &log_signer);
+void LogShard::Start(bool stand_alone_mode) {
+  server_.Initialise(false /* is_mirror */);
+  // The tree signer starts from the tree of the LogLookup.
+  server_.WaitForWarmUp();
+
+  tree_signer_.reset(new TreeSigner<LoggedCertificate>(
+      std::chrono::duration<double>(FLAGS_guard_window_seconds), db_.get(),
+      server_.log_lookup()->GetCompactMerkleTree(new Sha256Hasher),
+      server_.consistent_store(), log_signer_.get(), internal_pool_));
 
   if (stand_alone_mode) {
     // Set up a simple single-node environment.
@@ -422,47 +905,208 @@ int main(int argc, char* argv[]) {
     config.set_minimum_serving_fraction(1);
     LOG(INFO) << "Setting default single-node ClusterConfig:\n"
               << config.DebugString();
-    server.consistent_store()->SetClusterConfig(config);
+    server_.consistent_store()->SetClusterConfig(config);
 
     // Since we're a single node cluster, we'll settle that we're the
     // master here, so that we can populate the initial STH
     // (StrictConsistentStore won't allow us to do so unless we're master.)
-    server.election()->StartElection();
-    server.election()->WaitToBecomeMaster();
+    server_.election()->StartElection();
+    server_.election()->WaitToBecomeMaster();
 
     {
       EtcdClient::Response resp;
-      util::SyncTask task(event_base.get());
-      etcd_client->Create("/root/sequence_mapping", "", &resp, task.task());
+      util::SyncTask task(event_base_.get());
+      etcd_client_->Create(options_.etcd_root + "/sequence_mapping", "",
+                           &resp, task.task());
       task.Wait();
       CHECK_EQ(util::Status::OK, task.status());
     }
 
     // Do an initial signing run to get the initial STH, again this is
     // temporary until we re-populate FakeEtcd from the DB.
-    CHECK_EQ(tree_signer.UpdateTree(), TreeSigner<LoggedCertificate>::OK);
+    CHECK_EQ(tree_signer_->UpdateTree(), TreeSigner<LoggedCertificate>::OK);
 
     // Need to boot-strap the Serving STH too because we consider it an error
     // if it's not set, which in turn causes us to not attempt to become
     // master:
-    server.consistent_store()->SetServingSTH(tree_signer.LatestSTH());
+    server_.consistent_store()->SetServingSTH(tree_signer_->LatestSTH());
   } else {
     CHECK(!FLAGS_server.empty());
   }
 
-  server.WaitForReplication();
+  server_.WaitForReplication();
 
   // TODO(pphaneuf): We should be remaining in an "unhealthy state"
   // (either not accepting any requests, or returning some internal
   // server error) until we have an STH to serve.
   const function<bool()> is_master(
-      bind(&Server<LoggedCertificate>::IsMaster, &server));
-  thread sequencer(&SequenceEntries, &tree_signer, is_master);
-  thread cleanup(&CleanUpEntries, server.consistent_store(), is_master);
-  thread signer(&SignMerkleTree, &tree_signer, server.consistent_store(),
-                server.cluster_state_controller());
+      bind(&Server<LoggedCertificate>::IsMaster, &server_));
+  if (FLAGS_sequencing_backlog_threshold > 0 ||
+      FLAGS_tree_signing_entries_threshold > 0) {
+    sequencing_signal_.reset(new SequencingSignal);
+  }
+  if (FLAGS_sequencing_pipeline_depth > 0) {
+    sequenced_batches_.reset(
+        new SequencedBatches(FLAGS_sequencing_pipeline_depth));
+    sequenced_store_.reset(new thread(&StoreSequencedEntries,
+                                      tree_signer_.get(),
+                                      sequenced_batches_.get(),
+                                      sequencing_signal_.get()));
+  }
+  sequencer_.reset(new thread(&SequenceEntries, tree_signer_.get(),
+                              server_.election(), sequenced_batches_.get(),
+                              sequencing_signal_.get()));
+  cleanup_.reset(
+      new thread(&CleanUpEntries, server_.consistent_store(), is_master));
+  signer_.reset(new thread(&SignMerkleTree, tree_signer_.get(),
+                           server_.consistent_store(),
+                           server_.cluster_state_controller(), db_.get(),
+                           sequencing_signal_.get()));
+}
+
+
+// Serves the database as a read-only replica (see
+// --read_only_replica), until the process is killed.
+void RunReadOnlyReplica(const shared_ptr<libevent::Base>& event_base,
+                        ThreadPool* internal_pool, UrlFetcher* url_fetcher,
+                        CertChecker* checker) {
+  CHECK(FLAGS_log_shards_file.empty())
+      << "--log_shards_file is not supported with --read_only_replica";
+  CHECK(FLAGS_leveldb_db.empty() + FLAGS_rocksdb_db.empty() == 1)
+      << "--read_only_replica needs one of --leveldb_db and --rocksdb_db";
+  CHECK(FLAGS_rocksdb_db.empty() || !FLAGS_rocksdb_secondary_dir.empty())
+      << "--read_only_replica with --rocksdb_db needs "
+      << "--rocksdb_secondary_dir";
+  // It would miss the entries picked up after it was loaded.
+  CHECK_EQ(FLAGS_database_bloom_filter_capacity, 0)
+      << "--database_bloom_filter_capacity is not supported with "
+      << "--read_only_replica";
+  CHECK_GT(FLAGS_replica_catch_up_interval_ms, 0);
+  LOG(INFO) << "Running as a READ-ONLY REPLICA.";
+
+  // Nothing is written to it, it only backs the unused cluster state.
+  FakeEtcdClient etcd_client(event_base.get());
+  const unique_ptr<Database<LoggedCertificate>> db(
+      OpenDatabase(LogShardConfig()));
 
+  Server<LoggedCertificate>::Options options;
+  options.server = FLAGS_server;
+  options.port = FLAGS_port;
+  options.num_http_server_threads = FLAGS_num_http_server_threads;
+  options.num_http_event_loops = FLAGS_num_http_event_loops;
+  options.etcd_root = FLAGS_etcd_root;
+  options.read_only_replica = true;
+  options.catch_up_interval =
+      milliseconds(FLAGS_replica_catch_up_interval_ms);
+  options.trusted_cert_file = FLAGS_trusted_cert_file;
+  Server<LoggedCertificate> server(options, event_base, internal_pool,
+                                   db.get(), &etcd_client, url_fetcher,
+                                   nullptr /* log_signer */,
+                                   nullptr /* log_verifier */, checker);
+  server.Initialise(false /* is_mirror */);
   server.Run();
+}
+
+
+}  // namespace
+
+
+int main(int argc, char* argv[]) {
+  // Ignore various signals whilst we start up.
+  signal(SIGHUP, SIG_IGN);
+  signal(SIGINT, SIG_IGN);
+  signal(SIGTERM, SIG_IGN);
+
+  util::InitCT(&argc, &argv);
+
+  Server<LoggedCertificate>::StaticInit();
+  unique_ptr<StartupPhase> startup(new StartupPhase("total"));
+
+  vector<LogShardConfig> shards;
+  if (FLAGS_read_only_replica) {
+    // Served by RunReadOnlyReplica() below.
+  } else if (!FLAGS_log_shards_file.empty()) {
+    if (!FLAGS_key.empty() || !FLAGS_sqlite_db.empty() ||
+        !FLAGS_leveldb_db.empty() || !FLAGS_rocksdb_db.empty() ||
+        !FLAGS_cert_dir.empty() || !FLAGS_tree_dir.empty()) {
+      std::cerr << "The keys and databases of the logs are set by "
+                << "--log_shards_file.";
+      exit(1);
+    }
+    // These would be shared by all the logs.
+    CHECK(FLAGS_tree_checkpoint.empty())
+        << "--tree_checkpoint is not supported with --log_shards_file";
+    CHECK(FLAGS_database_bloom_filter_checkpoint.empty())
+        << "--database_bloom_filter_checkpoint is not supported with "
+        << "--log_shards_file";
+    CHECK(FLAGS_bootstrap_snapshot_from.empty())
+        << "--bootstrap_snapshot_from is not supported with "
+        << "--log_shards_file";
+    shards = ReadLogShards(FLAGS_log_shards_file);
+  } else {
+    if (!FLAGS_sqlite_db.empty() + !FLAGS_leveldb_db.empty() +
+            !FLAGS_rocksdb_db.empty() +
+            (!FLAGS_cert_dir.empty() | !FLAGS_tree_dir.empty()) !=
+        1) {
+      std::cerr << "Must only specify one database type.";
+      exit(1);
+    }
+
+    if (FLAGS_sqlite_db.empty() && FLAGS_leveldb_db.empty() &&
+        FLAGS_rocksdb_db.empty()) {
+      CHECK_NE(FLAGS_cert_dir, FLAGS_tree_dir)
+          << "Certificate directory and tree directory must differ";
+    }
+
+    CHECK(!FLAGS_key.empty()) << "--key is required";
+    LogShardConfig shard;
+    shard.key = FLAGS_key;
+    shards.emplace_back(shard);
+  }
+
+  shared_ptr<libevent::Base> event_base(make_shared<libevent::Base>());
+  ThreadPool internal_pool(8, "internal");
+  UrlFetcher url_fetcher(event_base.get(), &internal_pool);
+
+  // Long chains get their signatures checked on several threads.
+  CertChecker checker(&internal_pool);
+  CHECK(checker.LoadTrustedCertificates(FLAGS_trusted_cert_file))
+      << "Could not load CA certs from " << FLAGS_trusted_cert_file;
+
+  if (FLAGS_read_only_replica) {
+    startup.reset();
+    RunReadOnlyReplica(event_base, &internal_pool, &url_fetcher, &checker);
+    return 0;
+  }
+
+  const bool stand_alone_mode(FLAGS_etcd_servers.empty());
+  if (stand_alone_mode && !FLAGS_i_know_stand_alone_mode_can_lose_data) {
+    LOG(FATAL) << "attempted to run in stand-alone mode without the "
+                  "--i_know_stand_alone_mode_can_lose_data flag";
+  }
+  LOG(INFO) << "Running in "
+            << (stand_alone_mode ? "STAND-ALONE" : "CLUSTERED") << " mode.";
+
+  std::unique_ptr<EtcdClient> etcd_client(
+      stand_alone_mode
+          ? new FakeEtcdClient(event_base.get())
+          : new EtcdClient(&internal_pool, &url_fetcher,
+                           SplitHosts(FLAGS_etcd_servers)));
+
+  // The first log gets the HTTP servers, and the others are served by
+  // them, under their own prefix.
+  vector<unique_ptr<LogShard>> logs;
+  for (const auto& shard : shards) {
+    logs.emplace_back(new LogShard(
+        shard, event_base, &internal_pool, &url_fetcher, etcd_client.get(),
+        &checker, logs.empty() ? nullptr : logs.front()->server()));
+  }
+  for (const auto& log : logs) {
+    log->Start(stand_alone_mode);
+  }
+
+  startup.reset();
+  logs.front()->server()->Run();
 
   return 0;
 }
@@ -0,0 +1,380 @@
+#include "config.h"
+#include "server/debug_handlers.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <event2/buffer.h>
+#include <event2/event.h>
+#include <event2/http.h>
+#include <event2/keyvalq_struct.h>
+#include <fcntl.h>
+#include <functional>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <memory>
+#include <openssl/crypto.h>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBPROFILER
+#include <gperftools/profiler.h>
+#endif
+#if defined(HAVE_LIBTCMALLOC) && defined(HAVE_GPERFTOOLS_MALLOC_EXTENSION_H)
+#include <gperftools/malloc_extension.h>
+#define CT_HAVE_HEAP_SAMPLE 1
+#endif
+
+#include "log/cert_checker.h"
+#include "util/cpu_affinity.h"
+#include "util/executor.h"
+#include "util/libevent_wrapper.h"
+#include "util/thread_pool.h"
+
+using std::atomic;
+using std::bind;
+using std::chrono::duration;
+using std::chrono::nanoseconds;
+using std::map;
+using std::ostringstream;
+using std::placeholders::_1;
+using std::string;
+
+DEFINE_string(debug_handlers_token, "",
+              "If set, serve the /debug/ handlers (CPU and heap profiles, "
+              "thread pool statistics) to requests with an "
+              "\"Authorization: Bearer <token>\" header carrying this "
+              "token.");
+DEFINE_int32(debug_max_cpu_profile_seconds, 300,
+             "Longest CPU profile /debug/pprof/profile will take.");
+
+namespace cert_trans {
+namespace {
+
+const int kHttpForbidden = 403;
+const int kDefaultCpuProfileSeconds = 30;
+
+// Only one CPU profile can be taken at a time.
+atomic<bool> cpu_profile_running(false);
+
+
+void SendError(evhttp_request* req, int code, const string& message) {
+  evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type",
+                    "text/plain");
+  evbuffer_add(evhttp_request_get_output_buffer(req), message.data(),
+               message.size());
+  evhttp_send_reply(req, code, /*reason*/ nullptr, /*databuf*/ nullptr);
+}
+
+
+// Replies with an error and returns false if |req| doesn't carry the
+// token.
+bool Authorize(evhttp_request* req) {
+  static const string kPrefix("Bearer ");
+  const char* const auth(evhttp_find_header(
+      evhttp_request_get_input_headers(req), "Authorization"));
+  const string& token(FLAGS_debug_handlers_token);
+  if (auth && strlen(auth) == kPrefix.size() + token.size() &&
+      kPrefix.compare(0, kPrefix.size(), auth, kPrefix.size()) == 0 &&
+      CRYPTO_memcmp(auth + kPrefix.size(), token.data(), token.size()) == 0) {
+    return true;
+  }
+  SendError(req, kHttpForbidden, "Missing or wrong debug token.\n");
+  return false;
+}
+
+
+bool CheckRequest(evhttp_request* req) {
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
+    evhttp_send_reply(req, HTTP_BADMETHOD, /*reason*/ nullptr,
+                      /*databuf*/ nullptr);
+    return false;
+  }
+  return Authorize(req);
+}
+
+
+// Returns the "seconds" query parameter, the default if it is absent,
+// or -1 if it is invalid.
+int GetSecondsParam(evhttp_request* req) {
+  const char* const query(
+      evhttp_uri_get_query(evhttp_request_get_evhttp_uri(req)));
+  if (!query) {
+    return kDefaultCpuProfileSeconds;
+  }
+  evkeyvalq params;
+  if (evhttp_parse_query_str(query, &params) != 0) {
+    return -1;
+  }
+  int seconds(kDefaultCpuProfileSeconds);
+  const char* const value(evhttp_find_header(&params, "seconds"));
+  if (value) {
+    char* end;
+    const long parsed(strtol(value, &end, 10));
+    seconds = (*value && !*end && parsed > 0 &&
+               parsed <= FLAGS_debug_max_cpu_profile_seconds)
+                  ? parsed
+                  : -1;
+  }
+  evhttp_clear_headers(&params);
+  return seconds;
+}
+
+
+// Replies to |req| with the contents of the file at |path|, and
+// deletes it.
+void SendFile(evhttp_request* req, const string& path) {
+  const int fd(open(path.c_str(), O_RDONLY));
+  unlink(path.c_str());
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    PLOG(WARNING) << "Couldn't read " << path;
+    if (fd >= 0) {
+      close(fd);
+    }
+    SendError(req, HTTP_INTERNAL, "Couldn't read the profile.\n");
+    return;
+  }
+  evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type",
+                    "application/octet-stream");
+  // The evbuffer takes ownership of |fd|.
+  if (evbuffer_add_file(evhttp_request_get_output_buffer(req), fd, 0,
+                        st.st_size) != 0) {
+    SendError(req, HTTP_INTERNAL, "Couldn't send the profile.\n");
+    return;
+  }
+  evhttp_send_reply(req, HTTP_OK, /*reason*/ nullptr, /*databuf*/ nullptr);
+}
+
+
+// A CPU profile being taken. Everything about it happens on the event
+// loop of its request, so that we know whether the client is still
+// there when it is done.
+struct CpuProfile {
+  evhttp_request* req;
+  string path;
+  bool closed;
+};
+
+
+void CpuProfileConnectionClosed(evhttp_connection* conn, void* arg) {
+  static_cast<CpuProfile*>(arg)->closed = true;
+}
+
+
+void CpuProfileDone(evutil_socket_t, short, void* arg) {
+  std::unique_ptr<CpuProfile> profile(static_cast<CpuProfile*>(arg));
+#ifdef HAVE_LIBPROFILER
+  ProfilerStop();
+#endif
+  cpu_profile_running = false;
+  LOG(INFO) << "CPU profile written to " << profile->path;
+
+  if (profile->closed) {
+    // The request is gone along with its connection.
+    unlink(profile->path.c_str());
+    return;
+  }
+  evhttp_connection_set_closecb(evhttp_request_get_connection(profile->req),
+                                nullptr, nullptr);
+  SendFile(profile->req, profile->path);
+}
+
+
+void HandleCpuProfile(evhttp_request* req) {
+  if (!CheckRequest(req)) {
+    return;
+  }
+#ifndef HAVE_LIBPROFILER
+  SendError(req, HTTP_NOTIMPLEMENTED,
+            "Not built with the gperftools CPU profiler.\n");
+#else
+  const int seconds(GetSecondsParam(req));
+  if (seconds < 0) {
+    SendError(req, HTTP_BADREQUEST, "Invalid \"seconds\" parameter.\n");
+    return;
+  }
+  if (cpu_profile_running.exchange(true)) {
+    SendError(req, HTTP_SERVUNAVAIL, "A CPU profile is already running.\n");
+    return;
+  }
+
+  char path[] = "/tmp/ct-cpu-profile-XXXXXX";
+  const int fd(mkstemp(path));
+  if (fd < 0 || !ProfilerStart(path)) {
+    LOG(WARNING) << "Couldn't start the CPU profiler";
+    if (fd >= 0) {
+      close(fd);
+      unlink(path);
+    }
+    cpu_profile_running = false;
+    SendError(req, HTTP_INTERNAL, "Couldn't start the CPU profiler.\n");
+    return;
+  }
+  close(fd);
+  LOG(INFO) << "Taking a " << seconds << " second CPU profile";
+
+  CpuProfile* const profile(new CpuProfile{req, path, false});
+  evhttp_connection* const conn(evhttp_request_get_connection(req));
+  evhttp_connection_set_closecb(conn, &CpuProfileConnectionClosed, profile);
+  const timeval delay{seconds, 0};
+  CHECK_EQ(0, event_base_once(evhttp_connection_get_base(conn), -1,
+                              EV_TIMEOUT, &CpuProfileDone, profile, &delay));
+#endif
+}
+
+
+#ifdef CT_HAVE_HEAP_SAMPLE
+void WriteHeapSample(evhttp_request* req) {
+  string sample;
+  MallocExtension::instance()->GetHeapSample(&sample);
+  evbuffer_add(evhttp_request_get_output_buffer(req), sample.data(),
+               sample.size());
+  libevent::Base::RunOnRequestLoop(req, [req]() {
+    evhttp_send_reply(req, HTTP_OK, /*reason*/ nullptr, /*databuf*/ nullptr);
+  });
+}
+#endif
+
+
+void HandleHeapProfile(util::Executor* executor, evhttp_request* req) {
+  if (!CheckRequest(req)) {
+    return;
+  }
+#ifndef CT_HAVE_HEAP_SAMPLE
+  SendError(req, HTTP_NOTIMPLEMENTED, "Not running with tcmalloc.\n");
+#else
+  if (!getenv("TCMALLOC_SAMPLE_PARAMETER")) {
+    SendError(req, HTTP_SERVUNAVAIL,
+              "Heap sampling is off, restart with TCMALLOC_SAMPLE_PARAMETER "
+              "set (e.g. to 524288).\n");
+    return;
+  }
+  evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type",
+                    "application/octet-stream");
+  // Walking the sampled allocations can take a while, keep it off the
+  // event loop.
+  executor->Add(bind(&WriteHeapSample, req));
+#endif
+}
+
+
+void HandleThreadPools(const map<string, const ThreadPool*>& pools,
+                       evhttp_request* req) {
+  if (!CheckRequest(req)) {
+    return;
+  }
+  ostringstream out;
+  out << "# pool queued delayed thread_busy_seconds...\n";
+  for (const auto& pool : pools) {
+    const ThreadPool::Stats stats(pool.second->GetStats());
+    out << pool.first << " " << stats.queued << " " << stats.delayed;
+    for (const nanoseconds& busy : stats.busy) {
+      out << " " << duration<double>(busy).count();
+    }
+    out << "\n";
+  }
+  const string body(out.str());
+  evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type",
+                    "text/plain");
+  evbuffer_add(evhttp_request_get_output_buffer(req), body.data(),
+               body.size());
+  evhttp_send_reply(req, HTTP_OK, /*reason*/ nullptr, /*databuf*/ nullptr);
+}
+
+
+void HandleCpus(const map<string, const ThreadPool*>& pools,
+                evhttp_request* req) {
+  if (!CheckRequest(req)) {
+    return;
+  }
+  ostringstream out;
+  out << "# pool thread cpus\n";
+  for (const auto& pool : pools) {
+    const ThreadPool::Stats stats(pool.second->GetStats());
+    for (size_t i = 0; i < stats.cpus.size(); ++i) {
+      out << pool.first << " " << i << " " << FormatCpuList(stats.cpus[i])
+          << "\n";
+    }
+  }
+  const string body(out.str());
+  evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type",
+                    "text/plain");
+  evbuffer_add(evhttp_request_get_output_buffer(req), body.data(),
+               body.size());
+  evhttp_send_reply(req, HTTP_OK, /*reason*/ nullptr, /*databuf*/ nullptr);
+}
+
+
+void ReloadRoots(CertChecker* checker, const string& trusted_cert_file,
+                 evhttp_request* req) {
+  const bool reloaded(checker->ReloadTrustedCertificates(trusted_cert_file));
+  LOG_IF(WARNING, !reloaded) << "Could not reload the CA certs from "
+                             << trusted_cert_file
+                             << ", still using the old ones";
+  LOG_IF(INFO, reloaded) << "Reloaded the CA certs from "
+                         << trusted_cert_file;
+  libevent::Base::RunOnRequestLoop(req, [req, reloaded]() {
+    if (!reloaded) {
+      SendError(req, HTTP_INTERNAL, "Couldn't reload, see the logs.\n");
+      return;
+    }
+    evhttp_send_reply(req, HTTP_OK, /*reason*/ nullptr, /*databuf*/ nullptr);
+  });
+}
+
+
+void HandleReloadRoots(util::Executor* executor, CertChecker* checker,
+                       const string& trusted_cert_file, evhttp_request* req) {
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_POST) {
+    evhttp_send_reply(req, HTTP_BADMETHOD, /*reason*/ nullptr,
+                      /*databuf*/ nullptr);
+    return;
+  }
+  if (!Authorize(req)) {
+    return;
+  }
+  // Parsing the certificates can take a while, keep it off the event
+  // loop.
+  executor->Add(bind(&ReloadRoots, checker, trusted_cert_file, req));
+}
+
+
+}  // namespace
+
+
+void AddDebugHandlers(libevent::HttpServer* server, util::Executor* executor,
+                      const map<string, const ThreadPool*>& pools) {
+  CHECK_NOTNULL(server);
+  CHECK_NOTNULL(executor);
+  if (FLAGS_debug_handlers_token.empty()) {
+    return;
+  }
+  CHECK(server->AddHandler("/debug/pprof/profile", &HandleCpuProfile));
+  CHECK(server->AddHandler("/debug/pprof/heap",
+                           bind(&HandleHeapProfile, executor, _1)));
+  CHECK(server->AddHandler("/debug/threadpools",
+                           bind(&HandleThreadPools, pools, _1)));
+  CHECK(server->AddHandler("/debug/cpus", bind(&HandleCpus, pools, _1)));
+}
+
+
+void AddReloadRootsHandler(libevent::HttpServer* server,
+                           util::Executor* executor, CertChecker* checker,
+                           const string& trusted_cert_file) {
+  CHECK_NOTNULL(server);
+  CHECK_NOTNULL(executor);
+  CHECK_NOTNULL(checker);
+  CHECK(!trusted_cert_file.empty());
+  if (FLAGS_debug_handlers_token.empty()) {
+    return;
+  }
+  CHECK(server->AddHandler("/debug/reload-roots",
+                           bind(&HandleReloadRoots, executor, checker,
+                                trusted_cert_file, _1)));
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,56 @@
+#ifndef CERT_TRANS_SERVER_DEBUG_HANDLERS_H_
+#define CERT_TRANS_SERVER_DEBUG_HANDLERS_H_
+
+#include <map>
+#include <string>
+
+namespace util {
+class Executor;
+}  // namespace util
+
+namespace cert_trans {
+namespace libevent {
+class HttpServer;
+}  // namespace libevent
+
+class CertChecker;
+class ThreadPool;
+
+
+// Adds the /debug/ handlers to |server|, if --debug_handlers_token is
+// set (they require an "Authorization: Bearer <token>" header):
+//
+//  /debug/pprof/profile?seconds=N  CPU profile of the next N seconds
+//                                  (default 30), in the gperftools
+//                                  format read by pprof.
+//  /debug/pprof/heap               Sample of the live heap, if running
+//                                  with tcmalloc and
+//                                  TCMALLOC_SAMPLE_PARAMETER set.
+//  /debug/threadpools              Queue depth and busy time of the
+//                                  threads of each of |pools|.
+//  /debug/cpus                     The CPUs each of the threads of
+//                                  |pools| may run on.
+//
+// |executor| takes the heap samples, off the event loop. None of the
+// arguments are owned.
+void AddDebugHandlers(libevent::HttpServer* server, util::Executor* executor,
+                      const std::map<std::string, const ThreadPool*>& pools);
+
+// Adds, with the same condition and authorization as the handlers
+// above:
+//
+//  POST /debug/reload-roots        Replaces the trusted certificates of
+//                                  |checker| with those now in
+//                                  |trusted_cert_file|, replying 500
+//                                  (and keeping the old ones) if it
+//                                  can't be read.
+//
+// The reload runs on |executor|. None of the arguments are owned.
+void AddReloadRootsHandler(libevent::HttpServer* server,
+                           util::Executor* executor, CertChecker* checker,
+                           const std::string& trusted_cert_file);
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_SERVER_DEBUG_HANDLERS_H_
@@ -0,0 +1,68 @@
+#include "server/dns_response_cache.h"
+
+#include <glog/logging.h>
+
+using std::lock_guard;
+using std::mutex;
+using std::string;
+
+namespace cert_trans {
+
+
+DNSResponseCache::DNSResponseCache(size_t max_entries)
+    : max_entries_(max_entries), generation_(0) {
+}
+
+
+bool DNSResponseCache::Get(const string& question, string* answer,
+                           uint64_t* generation) {
+  CHECK_NOTNULL(answer);
+  CHECK_NOTNULL(generation);
+  lock_guard<mutex> lock(lock_);
+  *generation = generation_;
+  const auto it(index_.find(question));
+  if (it == index_.end()) {
+    return false;
+  }
+  answers_.splice(answers_.begin(), answers_, it->second);
+  *answer = it->second->second;
+  return true;
+}
+
+
+void DNSResponseCache::Put(const string& question, const string& answer,
+                           uint64_t generation) {
+  if (max_entries_ == 0) {
+    return;
+  }
+
+  lock_guard<mutex> lock(lock_);
+  // Another thread might have answered the same question at the same
+  // time.
+  if (generation != generation_ || index_.find(question) != index_.end()) {
+    return;
+  }
+  answers_.emplace_front(question, answer);
+  index_.emplace(question, answers_.begin());
+  if (answers_.size() > max_entries_) {
+    index_.erase(answers_.back().first);
+    answers_.pop_back();
+  }
+}
+
+
+void DNSResponseCache::Clear() {
+  lock_guard<mutex> lock(lock_);
+  ++generation_;
+  answers_.clear();
+  index_.clear();
+}
+
+
+size_t DNSResponseCache::Size() const {
+  lock_guard<mutex> lock(lock_);
+  return answers_.size();
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,57 @@
+#ifndef CERT_TRANS_SERVER_DNS_RESPONSE_CACHE_H_
+#define CERT_TRANS_SERVER_DNS_RESPONSE_CACHE_H_
+
+#include <list>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// A thread-safe LRU cache of the answers of ct-dns-server, by question
+// (the query name, without the domain). The answers depend on the
+// latest tree head, so they are all dropped with Clear() when it
+// changes.
+class DNSResponseCache {
+ public:
+  // A |max_entries| of zero disables the cache.
+  explicit DNSResponseCache(size_t max_entries);
+
+  // Returns false if |question| is not in the cache. Either way,
+  // |generation| is set to what should be passed to Put() for the
+  // answer computed from the current state.
+  bool Get(const std::string& question, std::string* answer,
+           uint64_t* generation);
+
+  // Does nothing if the cache was cleared since |generation| was
+  // returned by Get(), as |answer| could be out of date already.
+  void Put(const std::string& question, const std::string& answer,
+           uint64_t generation);
+
+  void Clear();
+
+  size_t Size() const;
+
+ private:
+  typedef std::pair<std::string, std::string> Entry;
+
+  const size_t max_entries_;
+  mutable std::mutex lock_;
+  uint64_t generation_;
+  // Most recently used first.
+  std::list<Entry> answers_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+
+  DISALLOW_COPY_AND_ASSIGN(DNSResponseCache);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_SERVER_DNS_RESPONSE_CACHE_H_
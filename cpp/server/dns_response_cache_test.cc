@@ -0,0 +1,81 @@
+#include "server/dns_response_cache.h"
+
+#include <gtest/gtest.h>
+#include <string>
+
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+
+
+TEST(DNSResponseCacheTest, EvictsLeastRecentlyUsed) {
+  DNSResponseCache cache(2);
+  string answer;
+  uint64_t generation;
+  EXPECT_FALSE(cache.Get("sth", &answer, &generation));
+
+  cache.Put("sth", "1.2.abc.def", generation);
+  cache.Put("0.leafhash", "AAAA", generation);
+  EXPECT_EQ(2U, cache.Size());
+  ASSERT_TRUE(cache.Get("sth", &answer, &generation));
+  EXPECT_EQ("1.2.abc.def", answer);
+
+  // "0.leafhash" was used less recently.
+  cache.Put("1.leafhash", "BBBB", generation);
+  EXPECT_EQ(2U, cache.Size());
+  EXPECT_FALSE(cache.Get("0.leafhash", &answer, &generation));
+  ASSERT_TRUE(cache.Get("1.leafhash", &answer, &generation));
+  EXPECT_EQ("BBBB", answer);
+  EXPECT_TRUE(cache.Get("sth", &answer, &generation));
+
+  // The first answer stays.
+  cache.Put("sth", "other", generation);
+  ASSERT_TRUE(cache.Get("sth", &answer, &generation));
+  EXPECT_EQ("1.2.abc.def", answer);
+}
+
+
+TEST(DNSResponseCacheTest, ClearDropsStaleAnswers) {
+  DNSResponseCache cache(10);
+  string answer;
+  uint64_t old_generation;
+  EXPECT_FALSE(cache.Get("sth", &answer, &old_generation));
+  cache.Put("0.leafhash", "AAAA", old_generation);
+
+  cache.Clear();
+  EXPECT_EQ(0U, cache.Size());
+  uint64_t generation;
+  EXPECT_FALSE(cache.Get("0.leafhash", &answer, &generation));
+  EXPECT_NE(old_generation, generation);
+
+  // Computed before the clear, so it might be stale.
+  cache.Put("sth", "1.2.abc.def", old_generation);
+  EXPECT_FALSE(cache.Get("sth", &answer, &generation));
+  cache.Put("sth", "3.4.ghi.jkl", generation);
+  ASSERT_TRUE(cache.Get("sth", &answer, &generation));
+  EXPECT_EQ("3.4.ghi.jkl", answer);
+}
+
+
+TEST(DNSResponseCacheTest, Disabled) {
+  DNSResponseCache cache(0);
+  string answer;
+  uint64_t generation;
+  EXPECT_FALSE(cache.Get("sth", &answer, &generation));
+  cache.Put("sth", "1.2.abc.def", generation);
+  EXPECT_FALSE(cache.Get("sth", &answer, &generation));
+  EXPECT_EQ(0U, cache.Size());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
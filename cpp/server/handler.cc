@@ -1,18 +1,24 @@
 #include "server/handler.h"
 
 #include <algorithm>
+#include <arpa/inet.h>
 #include <event2/buffer.h>
 #include <event2/http.h>
 #include <event2/keyvalq_struct.h>
+#include <fstream>
 #include <functional>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <map>
 #include <memory>
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include "client/async_log_client.h"
 #include "log/cert.h"
 #include "log/cert_checker.h"
 #include "log/cluster_state_controller.h"
@@ -21,9 +27,21 @@
 #include "log/logged_certificate.h"
 #include "monitoring/monitoring.h"
 #include "monitoring/latency.h"
+#include "monitoring/trace.h"
+#include "proto/serializer.h"
+#include "server/chain_decoder.h"
+#include "server/consistency_cache.h"
+#include "server/json_body.h"
 #include "server/json_output.h"
 #include "server/proxy.h"
+#include "server/request_capture.h"
+#include "server/tile_cache.h"
+#include "util/fair_scheduler.h"
+#include "util/gzip.h"
 #include "util/json_wrapper.h"
+#include "util/json_writer.h"
+#include "util/overload_controller.h"
+#include "util/rate_limiter.h"
 #include "util/thread_pool.h"
 
 namespace libevent = cert_trans::libevent;
@@ -31,37 +49,146 @@ namespace libevent = cert_trans::libevent;
 using cert_trans::Cert;
 using cert_trans::CertChain;
 using cert_trans::CertChecker;
+using cert_trans::ConsistencyCache;
 using cert_trans::Counter;
+using cert_trans::DecodeChain;
+using cert_trans::DecodeChains;
+using cert_trans::EntriesTile;
+using cert_trans::FairScheduler;
+using cert_trans::Gauge;
 using cert_trans::HttpHandler;
+using cert_trans::JsonBody;
 using cert_trans::JsonOutput;
 using cert_trans::Latency;
+using cert_trans::MemoryBudget;
 using cert_trans::LoggedCertificate;
 using cert_trans::Proxy;
+using cert_trans::RequestCapture;
 using cert_trans::ScopedLatency;
+using cert_trans::ScopedTrace;
+using cert_trans::TileCache;
+using cert_trans::Trace;
+using cert_trans::TraceSpan;
+using cert_trans::kBinaryEntriesContentType;
 using ct::ShortMerkleAuditProof;
 using ct::SignedCertificateTimestamp;
 using ct::SignedTreeHead;
 using std::bind;
+using std::chrono::duration;
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
 using std::chrono::milliseconds;
 using std::chrono::seconds;
+using std::chrono::steady_clock;
 using std::function;
 using std::lock_guard;
 using std::make_pair;
 using std::make_shared;
+using std::max;
+using std::milli;
 using std::multimap;
+using std::move;
 using std::mutex;
 using std::placeholders::_1;
 using std::shared_ptr;
 using std::string;
 using std::to_string;
 using std::unique_ptr;
+using std::unordered_map;
 using std::vector;
+using util::JsonWriter;
+using util::OverloadController;
+using util::RateLimiter;
 
 DEFINE_int32(max_leaf_entries_per_response, 1000,
              "maximum number of entries to put in the response of a "
              "get-entries request");
+DEFINE_int32(max_proof_hashes_per_request, 100,
+             "Maximum number of hashes to return the audit proofs of in one "
+             "get-proofs-by-hash request.");
 DEFINE_int32(staleness_check_delay_secs, 5,
              "number of seconds between node staleness checks");
+DEFINE_int32(max_add_chains_batch_size, 1000,
+             "maximum number of chains accepted in a single add-chains "
+             "request");
+DEFINE_int32(max_add_chain_body_bytes, 1 << 20,
+             "add-chain and add-pre-chain requests with a larger body are "
+             "rejected before it is decoded");
+DEFINE_int32(max_add_chains_body_bytes, 64 << 20,
+             "add-chains requests with a larger body are rejected before it "
+             "is decoded");
+DEFINE_int32(max_chain_length, 32,
+             "maximum number of certificates accepted in a submitted chain, "
+             "the decoding of longer ones being abandoned");
+DEFINE_int64(get_entries_tile_cache_bytes, 128 << 20,
+             "if non-zero, get-entries requests are clamped to tiles of "
+             "--max_leaf_entries_per_response entries, and the rendered "
+             "tiles that are complete in the published tree are kept in a "
+             "cache of up to this many bytes");
+DEFINE_int32(get_entries_tile_max_age_seconds, 86400,
+             "max-age of the Cache-Control header of get-entries replies "
+             "served from a complete tile, which never changes");
+DEFINE_int32(get_entries_chunk_bytes, 64 << 10,
+             "get-entries replies that are not served from a tile are sent "
+             "in chunks of about this many bytes of JSON, each read once "
+             "the previous one was sent");
+DEFINE_int32(consistency_cache_entries, 1024,
+             "if non-zero, the get-sth-consistency replies between "
+             "published tree sizes are kept in a cache of up to this many "
+             "(first, second) pairs");
+DEFINE_int32(http_pool_add_chain_weight, 4,
+             "share of the turns on the HTTP thread pool given to add-chain "
+             "and add-pre-chain requests waiting for it, for each turn of "
+             "add-chains and proxied requests");
+DEFINE_int32(http_pool_add_chains_max_running, 4,
+             "maximum number of add-chains requests handled at once on the "
+             "HTTP thread pool, 0 meaning as many as it has threads");
+DEFINE_int32(http_pool_proxy_max_running, 8,
+             "maximum number of requests proxied at once from the HTTP "
+             "thread pool, 0 meaning as many as it has threads");
+DEFINE_int32(max_snapshot_entries_per_response, 10000,
+             "maximum number of entries to put in the response of a "
+             "get-snapshot request");
+DEFINE_int32(http_pool_snapshot_max_running, 1,
+             "maximum number of get-snapshot requests handled at once on the "
+             "HTTP thread pool, 0 meaning as many as it has threads");
+DEFINE_double(client_rate_limit_qps, 0,
+              "if non-zero, the number of requests per second allowed to "
+              "each client network for each endpoint, beyond which they "
+              "get 429 (Too Many Requests) replies");
+DEFINE_double(client_rate_limit_burst, 20,
+              "number of requests a client network can make at once to an "
+              "endpoint, before being held to --client_rate_limit_qps");
+DEFINE_int32(client_rate_limit_ipv4_prefix, 32,
+             "length of the prefix of the IPv4 addresses that are rate "
+             "limited together, as one client network");
+DEFINE_int32(client_rate_limit_ipv6_prefix, 64,
+             "length of the prefix of the IPv6 addresses that are rate "
+             "limited together, as one client network");
+DEFINE_int32(client_rate_limit_max_clients, 100000,
+             "number of client networks and endpoints for which the rate "
+             "limit is tracked, the least recently seen being forgotten");
+DEFINE_int32(overload_max_pool_wait_ms, 0,
+             "if non-zero, the node is overloaded while a request has been "
+             "waiting for the HTTP thread pool for longer than this");
+DEFINE_int32(overload_max_submission_latency_ms, 0,
+             "if non-zero, the node is overloaded while submissions take "
+             "longer than this on average to be queued (mostly stored in "
+             "etcd)");
+DEFINE_int32(overload_max_rss_mb, 0,
+             "if non-zero, the node is overloaded while the resident memory "
+             "of the process is over this many MB");
+DEFINE_int32(overload_check_interval_ms, 1000,
+             "number of milliseconds between overload checks, each of which "
+             "goes one stage further when the node is overloaded: first "
+             "stopping proxying, then rejecting submissions, then capping "
+             "get-entries replies");
+DEFINE_int32(overload_recovery_checks, 10,
+             "number of overload checks in a row under half of the limits "
+             "after which the node goes back one stage");
+DEFINE_int32(overload_max_leaf_entries_per_response, 100,
+             "maximum number of entries to put in the response of a "
+             "get-entries request at the last stage of overload");
 
 namespace {
 
@@ -70,52 +197,380 @@ static Latency<milliseconds, string> http_server_request_latency_ms(
     "total_http_server_request_latency_ms", "path",
     "Total request latency in ms broken down by path");
 
+static Counter<string>* get_entries_tile_lookups(
+    Counter<string>::New("get_entries_tile_lookups", "result",
+                         "Number of get-entries tile lookups, by result "
+                         "(hit, miss or incomplete)."));
+
+static Counter<string, string>* stale_node_requests(
+    Counter<string, string>::New("stale_node_requests", "path", "result",
+                                 "Number of requests received while the "
+                                 "node was stale, by path and whether they "
+                                 "were served locally, proxied or turned "
+                                 "away."));
+
+// libevent doesn't have a constant for this one.
+const int kHttpTooManyRequests = 429;
+
+static Counter<string>* http_rate_limited_requests(
+    Counter<string>::New("http_rate_limited_requests", "path",
+                         "Number of requests rejected because the client "
+                         "was over its rate limit, by path."));
+
+static Counter<string>* oversized_submissions(
+    Counter<string>::New("oversized_submissions", "path",
+                         "Number of submissions rejected because of the "
+                         "size of their body, by path."));
+
+// What HttpHandler stops doing at each stage of overload, each one
+// including the ones before.
+enum OverloadStage {
+  OVERLOAD_NONE = 0,
+  // The requests a stale node would proxy get 503 replies instead.
+  OVERLOAD_NO_PROXY,
+  // Submissions get 503 replies.
+  OVERLOAD_REJECT_SUBMISSIONS,
+  // get-entries replies are capped to
+  // --overload_max_leaf_entries_per_response entries, and not served
+  // from tiles, which are built whole.
+  OVERLOAD_CAP_ENTRIES,
+};
+
+static Gauge<>* overload_stage(
+    Gauge<>::New("overload_stage",
+                 "Stage of overload of the node, from 0 (not overloaded) "
+                 "to 3 (proxying stopped, submissions rejected and "
+                 "get-entries replies capped)."));
+
+static Counter<string>* overload_shed_requests(
+    Counter<string>::New("overload_shed_requests", "action",
+                         "Number of requests turned away or cut short "
+                         "because the node was overloaded, by action "
+                         "(proxy, submission or get_entries)."));
+
+static Counter<string>* http_server_cpu_seconds(
+    Counter<string>::New("http_server_cpu_seconds", "path",
+                         "CPU time used serving requests, in seconds, by "
+                         "path, on the event loops and the HTTP pool."));
+
+
+// Returns the CPU time used by the calling thread so far, in seconds.
+double ThreadCpuSeconds() {
+  timespec ts;
+  CHECK_EQ(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts), 0);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+// Returns the resident memory of the process in bytes, or 0 if it
+// can't be read.
+int64_t ResidentBytes() {
+  std::ifstream statm("/proc/self/statm");
+  int64_t size, resident;
+  if (!(statm >> size >> resident)) {
+    return 0;
+  }
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+
+// Returns the path of |req|. Only the paths of the handlers get to
+// them, unlike the query strings, so it is fine as a metric label.
+string RequestPath(evhttp_request* req) {
+  const char* const path(
+      evhttp_uri_get_path(evhttp_request_get_evhttp_uri(req)));
+  return path ? path : "";
+}
+
+
+// Runs the work a request queued on the HTTP pool, adding the CPU time
+// of the thread while it runs to the one of its path.
+class CpuTimedClosure {
+ public:
+  CpuTimedClosure(const string& path, util::Closure&& closure)
+      : path_(path), closure_(move(closure)) {
+  }
+
+  void operator()() {
+    const double start(ThreadCpuSeconds());
+    closure_();
+    http_server_cpu_seconds->IncrementBy(path_, ThreadCpuSeconds() - start);
+  }
+
+ private:
+  string path_;
+  util::Closure closure_;
+};
+
+
+util::Closure CpuTimed(const string& path, util::Closure&& closure) {
+  return util::Closure(CpuTimedClosure(path, move(closure)));
+}
+
+
+// Returns the network of the peer of |req|, as configured with
+// --client_rate_limit_ipv{4,6}_prefix, in binary form.
+string ClientNetwork(evhttp_request* req) {
+  char* peer_addr;
+  ev_uint16_t peer_port;
+  evhttp_connection_get_peer(evhttp_request_get_connection(req), &peer_addr,
+                             &peer_port);
+
+  unsigned char addr[16];
+  int length;
+  int prefix;
+  if (inet_pton(AF_INET, peer_addr, addr) == 1) {
+    length = 4;
+    prefix = FLAGS_client_rate_limit_ipv4_prefix;
+  } else if (inet_pton(AF_INET6, peer_addr, addr) == 1) {
+    length = 16;
+    prefix = FLAGS_client_rate_limit_ipv6_prefix;
+  } else {
+    return peer_addr;
+  }
+
+  string network(reinterpret_cast<const char*>(addr), length);
+  for (int i = 0; i < length; ++i) {
+    const int bits(std::max(0, std::min(8, prefix - 8 * i)));
+    network[i] &= static_cast<char>(0xff00 >> bits);
+  }
+  return network;
+}
+
+
+void WriteEntry(const ReadOnlyDatabase<LoggedCertificate>::RawLeaf& leaf,
+                bool include_scts, JsonWriter* json) {
+  if (!include_scts && !leaf.json.empty()) {
+    json->AddJson(leaf.json);
+    return;
+  }
+  json->StartObject();
+  json->AddBase64("leaf_input", leaf.leaf_input);
+  json->AddBase64("extra_data", leaf.extra_data);
+
+  if (include_scts) {
+    // This is non-standard, and currently only used by other SuperDuper log
+    // nodes when "following" to fetch data from each other:
+    json->AddBase64("sct", leaf.sct);
+  }
+  json->EndObject();
+}
+
+
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+// A get-entries reply, sent in chunks as the entries are read. Each
+// chunk is only read once the previous one was written out, so that a
+// slow client doesn't make the reply pile up in memory. It deletes
+// itself once done, or if the connection is closed first.
+class EntriesStream {
+ public:
+  // Starts the reply to |req|, of which |first| is the first entry,
+  // for entries up to |end|. Must be called on the event loop of
+  // |req|.
+  static void Start(JsonOutput* output,
+                    const ReadOnlyDatabase<LoggedCertificate>* db,
+                    evhttp_request* req,
+                    const ReadOnlyDatabase<LoggedCertificate>::RawLeaf& first,
+                    int64_t end, bool include_scts) {
+    const bool gzipped(output->StartChunkedJsonReply(req, HTTP_OK));
+    EntriesStream* const stream(
+        new EntriesStream(output, db, req, end, include_scts, gzipped));
+    stream->json_.StartObject();
+    stream->json_.StartArray("entries");
+    WriteEntry(first, include_scts, &stream->json_);
+    stream->next_ = first.sequence_number + 1;
+    stream->SendChunk();
+  }
+
+ private:
+  EntriesStream(JsonOutput* output,
+                const ReadOnlyDatabase<LoggedCertificate>* db,
+                evhttp_request* req, int64_t end, bool include_scts,
+                bool gzipped)
+      : output_(output),
+        db_(db),
+        req_(req),
+        end_(end),
+        include_scts_(include_scts),
+        json_buffer_(evbuffer_new()),
+        json_(json_buffer_),
+        gzipped_buffer_(evbuffer_new()),
+        gzip_(gzipped ? new util::GzipStream : nullptr),
+        next_(0),
+        body_length_(0) {
+    evhttp_connection_set_closecb(evhttp_request_get_connection(req_),
+                                  &EntriesStream::OnClose, this);
+  }
+
+  ~EntriesStream() {
+    evbuffer_free(json_buffer_);
+    evbuffer_free(gzipped_buffer_);
+  }
+
+  // Reads entries until there's a chunk's worth of them, or they are
+  // all there, and sends them.
+  void SendChunk() {
+    const size_t chunk_bytes(FLAGS_get_entries_chunk_bytes);
+    bool done(next_ > end_);
+    if (!done && evbuffer_get_length(json_buffer_) < chunk_bytes) {
+      // A fresh iterator for each chunk, rather than holding one while
+      // the client takes its time.
+      auto it(db_->ScanRawLeaves(next_));
+      ReadOnlyDatabase<LoggedCertificate>::RawLeaf leaf;
+      while (!done && evbuffer_get_length(json_buffer_) < chunk_bytes) {
+        if (!it->GetNextLeaf(&leaf)) {
+          // It was the last one available.
+          done = true;
+          break;
+        }
+        CHECK_EQ(next_, leaf.sequence_number);
+        WriteEntry(leaf, include_scts_, &json_);
+        done = ++next_ > end_;
+      }
+    }
+    if (done) {
+      json_.EndArray();
+      json_.EndObject();
+    }
+
+    evbuffer* chunk(json_buffer_);
+    if (gzip_) {
+      gzip_->Compress(json_buffer_, done, gzipped_buffer_);
+      chunk = gzipped_buffer_;
+    }
+    body_length_ += evbuffer_get_length(chunk);
+
+    if (!done) {
+      return evhttp_send_reply_chunk_with_cb(req_, chunk,
+                                             &EntriesStream::OnChunkSent,
+                                             this);
+    }
+    evhttp_send_reply_chunk(req_, chunk);
+    evhttp_connection_set_closecb(evhttp_request_get_connection(req_),
+                                  nullptr, nullptr);
+    output_->EndChunkedJsonReply(req_, HTTP_OK, body_length_);
+    delete this;
+  }
+
+  static void OnChunkSent(evhttp_connection*, void* stream) {
+    static_cast<EntriesStream*>(stream)->SendChunk();
+  }
+
+  // The request is about to be freed with the connection.
+  static void OnClose(evhttp_connection*, void* stream) {
+    delete static_cast<EntriesStream*>(stream);
+  }
+
+  JsonOutput* const output_;
+  const ReadOnlyDatabase<LoggedCertificate>* const db_;
+  evhttp_request* const req_;
+  const int64_t end_;
+  const bool include_scts_;
+  evbuffer* const json_buffer_;
+  JsonWriter json_;
+  evbuffer* const gzipped_buffer_;
+  // Null if the reply isn't gzipped.
+  const unique_ptr<util::GzipStream> gzip_;
+  // The index of the next entry to read.
+  int64_t next_;
+  size_t body_length_;
+
+  DISALLOW_COPY_AND_ASSIGN(EntriesStream);
+};
+#endif  // LIBEVENT_VERSION_NUMBER >= 0x02010100
+
+
+// Whether the If-None-Match header |value| lists |etag|, which is
+// quoted, so that it can't match part of another tag.
+bool ETagMatches(const string& value, const string& etag) {
+  return value == "*" || value.find(etag) != string::npos;
+}
+
+
+// Whether the client of |req| asked for kBinaryEntriesContentType.
+bool AcceptsBinaryEntries(evhttp_request* req) {
+  const char* const accept(evhttp_find_header(
+      evhttp_request_get_input_headers(req), "Accept"));
+  return accept && string(accept).find(kBinaryEntriesContentType) !=
+                       string::npos;
+}
+
+
+// Checks that the body of |req| is no larger than |max_bytes|, which
+// is about all that can be done before decoding it, replying with an
+// error if it is.
+bool CheckBodySize(JsonOutput* output, evhttp_request* req,
+                   int32_t max_bytes) {
+  if (evbuffer_get_length(evhttp_request_get_input_buffer(req)) <=
+      static_cast<size_t>(max_bytes)) {
+    return true;
+  }
+  oversized_submissions->Increment(RequestPath(req));
+  output->SendError(req, HTTP_ENTITYTOOLARGE, "Request body too large.");
+  return false;
+}
+
 
 bool ExtractChain(JsonOutput* output, evhttp_request* req, CertChain* chain) {
   if (evhttp_request_get_command(req) != EVHTTP_REQ_POST) {
     output->SendError(req, HTTP_BADMETHOD, "Method not allowed.");
     return false;
   }
-
-  // TODO(pphaneuf): Should we check that Content-Type says
-  // "application/json", as recommended by RFC4627?
-  JsonObject json_body(evhttp_request_get_input_buffer(req));
-  if (!json_body.Ok() || !json_body.IsType(json_type_object)) {
-    output->SendError(req, HTTP_BADREQUEST, "Unable to parse provided JSON.");
+  if (!CheckBodySize(output, req, FLAGS_max_add_chain_body_bytes)) {
     return false;
   }
 
-  JsonArray json_chain(json_body, "chain");
-  if (!json_chain.Ok()) {
-    output->SendError(req, HTTP_BADREQUEST, "Unable to parse provided JSON.");
+  // TODO(pphaneuf): Should we check that Content-Type says
+  // "application/json", as recommended by RFC4627?
+  const util::Status status(DecodeChain(evhttp_request_get_input_buffer(req),
+                                        FLAGS_max_chain_length, chain));
+  if (!status.ok()) {
+    output->SendError(req, HTTP_BADREQUEST, status.error_message());
     return false;
   }
 
-  VLOG(2) << "ExtractChain chain:\n" << json_chain.DebugString();
+  return true;
+}
 
-  for (int i = 0; i < json_chain.Length(); ++i) {
-    JsonString json_cert(json_chain, i);
-    if (!json_cert.Ok()) {
-      output->SendError(req, HTTP_BADREQUEST,
-                        "Unable to parse provided JSON.");
-      return false;
-    }
 
-    unique_ptr<Cert> cert(new Cert);
-    cert->LoadFromDerString(json_cert.FromBase64());
-    if (!cert->IsLoaded()) {
-      output->SendError(req, HTTP_BADREQUEST,
-                        "Unable to parse provided chain.");
-      return false;
-    }
+// Expects a JSON object with a "chains" array, of arrays of
+// certificates. A chain that can't be parsed is left null in |chains|,
+// to be reported in the reply for that chain.
+bool ExtractChains(JsonOutput* output, evhttp_request* req,
+                   vector<unique_ptr<CertChain>>* chains) {
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_POST) {
+    output->SendError(req, HTTP_BADMETHOD, "Method not allowed.");
+    return false;
+  }
+  if (!CheckBodySize(output, req, FLAGS_max_add_chains_body_bytes)) {
+    return false;
+  }
 
-    chain->AddCert(cert.release());
+  const util::Status status(DecodeChains(evhttp_request_get_input_buffer(req),
+                                         FLAGS_max_add_chains_batch_size,
+                                         FLAGS_max_chain_length, chains));
+  if (!status.ok()) {
+    output->SendError(req, HTTP_BADREQUEST, status.error_message());
+    return false;
   }
 
   return true;
 }
 
 
+// Writes the members of the reply for |sct|, in the current object.
+void WriteSCT(const SignedCertificateTimestamp& sct, JsonWriter* json) {
+  string signature;
+  CHECK_EQ(Serializer::SerializeDigitallySigned(sct.signature(), &signature),
+           Serializer::OK);
+  json->Add("sct_version", static_cast<int64_t>(0));
+  json->AddBase64("id", sct.id().key_id());
+  json->Add("timestamp", sct.timestamp());
+  json->Add("extensions", "");
+  json->AddBase64("signature", signature);
+}
+
+
 void AddChainReply(JsonOutput* output, evhttp_request* req,
                    const util::Status& add_status,
                    const SignedCertificateTimestamp& sct) {
@@ -129,14 +584,12 @@ void AddChainReply(JsonOutput* output, evhttp_request* req,
     return output->SendError(req, response_code, add_status.error_message());
   }
 
-  JsonObject json_reply;
-  json_reply.Add("sct_version", static_cast<int64_t>(0));
-  json_reply.AddBase64("id", sct.id().key_id());
-  json_reply.Add("timestamp", sct.timestamp());
-  json_reply.Add("extensions", "");
-  json_reply.Add("signature", sct.signature());
+  JsonWriter json(evhttp_request_get_output_buffer(req));
+  json.StartObject();
+  WriteSCT(sct, &json);
+  json.EndObject();
 
-  output->SendJsonReply(req, HTTP_OK, json_reply);
+  output->SendWrittenJsonReply(req, HTTP_OK);
 }
 
 
@@ -205,6 +658,26 @@ int64_t GetIntParam(const multimap<string, string>& query,
 }
 
 
+// For the parameters that don't fit in GetIntParam(), such as
+// timestamps in milliseconds.
+bool GetUint64Param(const multimap<string, string>& query,
+                    const string& param, uint64_t* value) {
+  string str;
+  if (!GetParam(query, param, &str) || str.empty() || str[0] < '0' ||
+      str[0] > '9') {
+    return false;
+  }
+  errno = 0;
+  char* end;
+  const unsigned long long num(strtoull(str.c_str(), &end, 10));
+  if (errno || *end != '\0') {
+    return false;
+  }
+  *value = num;
+  return true;
+}
+
+
 bool GetBoolParam(const multimap<string, string>& query, const string& param) {
   string value;
   if (GetParam(query, param, &value)) {
@@ -227,17 +700,66 @@ HttpHandler::HttpHandler(
     : output_(CHECK_NOTNULL(output)),
       log_lookup_(CHECK_NOTNULL(log_lookup)),
       db_(CHECK_NOTNULL(db)),
-      controller_(CHECK_NOTNULL(controller)),
+      controller_(controller),
       cert_checker_(cert_checker),
       frontend_(frontend),
-      proxy_(CHECK_NOTNULL(proxy)),
+      proxy_(proxy),
       pool_(CHECK_NOTNULL(pool)),
       event_base_(CHECK_NOTNULL(event_base)),
+      tile_cache_(FLAGS_get_entries_tile_cache_bytes > 0
+                      ? new TileCache(FLAGS_get_entries_tile_cache_bytes,
+                                      MemoryBudget::Global())
+                      : nullptr),
+      consistency_cache_(FLAGS_consistency_cache_entries > 0
+                             ? new ConsistencyCache(
+                                   FLAGS_consistency_cache_entries)
+                             : nullptr),
+      rate_limiter_(FLAGS_client_rate_limit_qps > 0
+                        ? new RateLimiter(FLAGS_client_rate_limit_qps,
+                                          FLAGS_client_rate_limit_burst,
+                                          FLAGS_client_rate_limit_max_clients)
+                        : nullptr),
+      overload_(FLAGS_overload_max_pool_wait_ms > 0 ||
+                        FLAGS_overload_max_submission_latency_ms > 0 ||
+                        FLAGS_overload_max_rss_mb > 0
+                    ? new OverloadController(OVERLOAD_CAP_ENTRIES,
+                                             FLAGS_overload_recovery_checks)
+                    : nullptr),
+      num_submissions_(0),
+      submission_us_(0),
+      scheduler_(new FairScheduler(pool_, pool_->NumThreads())),
+      add_chain_executor_(scheduler_->AddClass(
+          "add-chain", FLAGS_http_pool_add_chain_weight, 0)),
+      add_chains_executor_(scheduler_->AddClass(
+          "add-chains", 1, FLAGS_http_pool_add_chains_max_running)),
+      proxy_executor_(
+          scheduler_->AddClass("proxy", 1, FLAGS_http_pool_proxy_max_running)),
+      snapshot_executor_(scheduler_->AddClass(
+          "snapshot", 1, FLAGS_http_pool_snapshot_max_running)),
       task_(pool_),
-      node_is_stale_(controller_->NodeIsStale()) {
-  event_base_->Delay(seconds(FLAGS_staleness_check_delay_secs),
-                     task_.task()->AddChild(
-                         bind(&HttpHandler::UpdateNodeStaleness, this)));
+      node_is_stale_(controller_ && controller_->NodeIsStale()),
+      warming_(false),
+      sth_timestamp_(0) {
+  // The tiles are that many entries long.
+  CHECK(!tile_cache_ || FLAGS_max_leaf_entries_per_response > 0);
+  // Render and compress the get-roots reply now, rather than on the
+  // first request.
+  if (cert_checker_) {
+    const shared_ptr<const JsonBody> roots_body(GetRootsBody());
+    if (roots_body) {
+      roots_body->Gzipped();
+    }
+  }
+  if (controller_) {
+    event_base_->Delay(seconds(FLAGS_staleness_check_delay_secs),
+                       task_.task()->AddChild(
+                           bind(&HttpHandler::UpdateNodeStaleness, this)));
+  }
+  if (overload_) {
+    event_base_->Delay(milliseconds(FLAGS_overload_check_interval_ms),
+                       task_.task()->AddChild(
+                           bind(&HttpHandler::UpdateOverload, this)));
+  }
 }
 
 
@@ -253,67 +775,179 @@ void StatsHandlerInterceptor(const string& path,
   ScopedLatency total_http_server_request_latency(
       http_server_request_latency_ms.GetScopedLatency(path));
 
+  // The handlers that queue work on the HTTP pool account for it
+  // themselves, see CpuTimed().
+  const double cpu_start(ThreadCpuSeconds());
   cb(req);
+  http_server_cpu_seconds->IncrementBy(path, ThreadCpuSeconds() - cpu_start);
+}
+
+
+void HttpHandler::RateLimitInterceptor(
+    const string& path,
+    const libevent::HttpServer::HandlerCallback& next_handler,
+    evhttp_request* request) const {
+  RateLimiter::Clock::duration retry_after;
+  if (rate_limiter_ &&
+      !rate_limiter_->Admit(ClientNetwork(request) + path,
+                            RateLimiter::Clock::now(), &retry_after)) {
+    http_rate_limited_requests->Increment(path);
+    // Rounded up to the next second.
+    const int64_t retry_after_secs(
+        duration_cast<seconds>(retry_after).count() + 1);
+    CHECK_EQ(evhttp_add_header(evhttp_request_get_output_headers(request),
+                               "Retry-After",
+                               to_string(retry_after_secs).c_str()),
+             0);
+    return output_->SendError(request, kHttpTooManyRequests,
+                              "Too many requests.");
+  }
+
+  next_handler(request);
 }
 
 
 void HttpHandler::ProxyInterceptor(
+    const string& path, const LocalCheck& can_serve_locally,
     const libevent::HttpServer::HandlerCallback& local_handler,
     evhttp_request* request) {
   VLOG(2) << "Running proxy interceptor...";
-  // TODO(alcutter): We can be a bit smarter about when to proxy off
-  // the request - being stale wrt to the current serving STH doesn't
-  // automatically mean we're unable to answer this request.
   if (IsNodeStale()) {
+    if (can_serve_locally && can_serve_locally(request)) {
+      stale_node_requests->Increment(path, "local");
+      return local_handler(request);
+    }
+    if (!proxy_) {
+      stale_node_requests->Increment(path, "unavailable");
+      return output_->SendError(request, HTTP_SERVUNAVAIL, "Warming up.");
+    }
+    if (ShedLoad(request, OVERLOAD_NO_PROXY, "proxy")) {
+      stale_node_requests->Increment(path, "overloaded");
+      return;
+    }
+    stale_node_requests->Increment(path, "proxied");
     // Can't do this on the libevent thread since it can block on the lock in
     // ClusterStatusController::GetFreshNodes().
-    pool_->Add(bind(&Proxy::ProxyRequest, proxy_, request));
+    proxy_executor_->Add(CpuTimed(
+        path, util::Closure(bind(&Proxy::ProxyRequest, proxy_, request))));
   } else {
     local_handler(request);
   }
 }
 
 
+bool HttpHandler::ShedLoad(evhttp_request* req, int stage,
+                           const char* action) const {
+  if (!overload_ || overload_->stage() < stage) {
+    return false;
+  }
+  overload_shed_requests->Increment(action);
+  // JsonOutput adds a Retry-After header to 503 replies.
+  output_->SendError(req, HTTP_SERVUNAVAIL, "Overloaded.");
+  return true;
+}
+
+
 void HttpHandler::AddProxyWrappedHandler(
     libevent::HttpServer* server, const string& path,
-    const libevent::HttpServer::HandlerCallback& local_handler) {
+    const libevent::HttpServer::HandlerCallback& local_handler,
+    const LocalCheck& can_serve_locally) {
   const libevent::HttpServer::HandlerCallback stats_handler(
       bind(&StatsHandlerInterceptor, path, local_handler, _1));
-  CHECK(server->AddHandler(path, bind(&HttpHandler::ProxyInterceptor, this,
-                                      stats_handler, _1)));
+  const libevent::HttpServer::HandlerCallback proxy_handler(
+      bind(&HttpHandler::ProxyInterceptor, this, path, can_serve_locally,
+           stats_handler, _1));
+  libevent::HttpServer::HandlerCallback handler(bind(
+      &HttpHandler::RateLimitInterceptor, this, path, proxy_handler, _1));
+  RequestCapture* const capture(RequestCapture::Global());
+  if (capture) {
+    handler = [capture, path, handler](evhttp_request* req) {
+      capture->MaybeCapture(path, req);
+      handler(req);
+    };
+  }
+  CHECK(server->AddHandler(path, handler));
 }
 
 
-void HttpHandler::Add(libevent::HttpServer* server) {
+void HttpHandler::Add(libevent::HttpServer* server,
+                      const string& path_prefix) {
   CHECK_NOTNULL(server);
-  // TODO(pphaneuf): An optional prefix might be nice?
   // TODO(pphaneuf): Find out which methods are CPU intensive enough
   // that they should be spun off to the thread pool.
-  AddProxyWrappedHandler(server, "/ct/v1/get-entries",
-                         bind(&HttpHandler::GetEntries, this, _1));
+  AddProxyWrappedHandler(server, path_prefix + "/ct/v1/get-entries",
+                         bind(&HttpHandler::GetEntries, this, _1),
+                         bind(&HttpHandler::CanServeEntriesLocally, this, _1));
   // TODO(alcutter): Support this for mirrors too
   if (cert_checker_) {
-    // Don't really need to proxy this one, but may as well just to keep
-    // everything tidy:
-    AddProxyWrappedHandler(server, "/ct/v1/get-roots",
-                           bind(&HttpHandler::GetRoots, this, _1));
-  }
-  AddProxyWrappedHandler(server, "/ct/v1/get-proof-by-hash",
-                         bind(&HttpHandler::GetProof, this, _1));
-  AddProxyWrappedHandler(server, "/ct/v1/get-sth",
-                         bind(&HttpHandler::GetSTH, this, _1));
-  AddProxyWrappedHandler(server, "/ct/v1/get-sth-consistency",
-                         bind(&HttpHandler::GetConsistency, this, _1));
+    // This doesn't depend on the tree, so a stale node can serve it
+    // just as well.
+    AddProxyWrappedHandler(server, path_prefix + "/ct/v1/get-roots",
+                           bind(&HttpHandler::GetRoots, this, _1),
+                           [](evhttp_request*) { return true; });
+  }
+  AddProxyWrappedHandler(server, path_prefix + "/ct/v1/get-proof-by-hash",
+                         bind(&HttpHandler::GetProof, this, _1),
+                         bind(&HttpHandler::CanServeProofLocally, this, _1));
+  // The tree head of a stale node is behind the one of the cluster.
+  // Not part of RFC 6962, for auditors with many SCTs to check.
+  AddProxyWrappedHandler(server, path_prefix + "/ct/v1/get-proofs-by-hash",
+                         bind(&HttpHandler::GetProofs, this, _1),
+                         bind(&HttpHandler::CanServeProofLocally, this, _1));
+  AddProxyWrappedHandler(server, path_prefix + "/ct/v1/get-sth",
+                         bind(&HttpHandler::GetSTH, this, _1), LocalCheck());
+  AddProxyWrappedHandler(server, path_prefix + "/ct/v1/get-sth-consistency",
+                         bind(&HttpHandler::GetConsistency, this, _1),
+                         bind(&HttpHandler::CanServeConsistencyLocally, this,
+                              _1));
 
   if (frontend_) {
     // Proxy the add-* calls too, technically we could serve them, but a
     // more up-to-date node will have a better chance of handling dupes
     // correctly, rather than bloating the tree.
-    AddProxyWrappedHandler(server, "/ct/v1/add-chain",
-                           bind(&HttpHandler::AddChain, this, _1));
-    AddProxyWrappedHandler(server, "/ct/v1/add-pre-chain",
-                           bind(&HttpHandler::AddPreChain, this, _1));
+    AddProxyWrappedHandler(server, path_prefix + "/ct/v1/add-chain",
+                           bind(&HttpHandler::AddChain, this, _1),
+                           LocalCheck());
+    AddProxyWrappedHandler(server, path_prefix + "/ct/v1/add-pre-chain",
+                           bind(&HttpHandler::AddPreChain, this, _1),
+                           LocalCheck());
+    // Not part of RFC 6962, for submitters with many chains to add.
+    AddProxyWrappedHandler(server, path_prefix + "/ct/v1/add-chains",
+                           bind(&HttpHandler::AddChains, this, _1),
+                           LocalCheck());
+  }
+
+  // Not part of RFC 6962, for bootstrapping new nodes. It covers the
+  // tree of this node, whether or not it is stale.
+  AddProxyWrappedHandler(server, path_prefix + "/ct/v1/get-snapshot",
+                         bind(&HttpHandler::GetSnapshot, this, _1),
+                         [](evhttp_request*) { return true; });
+}
+
+
+bool HttpHandler::CanServeEntriesLocally(evhttp_request* req) const {
+  const multimap<string, string> query(ParseQuery(req));
+  const int64_t start(GetIntParam(query, "start"));
+  const int64_t end(GetIntParam(query, "end"));
+  if (start < 0 || end < start) {
+    return true;
   }
+  // Whichever way the range gets limited, it's not to more than this.
+  const int64_t last(
+      std::min(end, start + FLAGS_max_leaf_entries_per_response));
+  return last < db_->TreeSize();
+}
+
+
+bool HttpHandler::CanServeProofLocally(evhttp_request* req) const {
+  const int64_t tree_size(GetIntParam(ParseQuery(req), "tree_size"));
+  return tree_size <= log_lookup_->GetSTH().tree_size();
+}
+
+
+bool HttpHandler::CanServeConsistencyLocally(evhttp_request* req) const {
+  const int64_t second(GetIntParam(ParseQuery(req), "second"));
+  return second <= log_lookup_->GetSTH().tree_size();
 }
 
 
@@ -325,6 +959,12 @@ void HttpHandler::GetEntries(evhttp_request* req) const {
 
   const multimap<string, string> query(ParseQuery(req));
 
+  // Not part of RFC 6962: the entries logged in [start_time, end_time),
+  // in milliseconds since the epoch, instead of a range of indices.
+  if (query.find("start_time") != query.end()) {
+    return GetEntriesByTime(req, query);
+  }
+
   const int64_t start(GetIntParam(query, "start"));
   if (start < 0) {
     return output_->SendError(req, HTTP_BADREQUEST,
@@ -337,39 +977,111 @@ void HttpHandler::GetEntries(evhttp_request* req) const {
                               "Missing or invalid \"end\" parameter.");
   }
 
-  // Limit the number of entries returned in a single request.
-  end = std::min(end, start + FLAGS_max_leaf_entries_per_response);
-
   // Sekrit parameter to indicate that SCTs should be included too.
   // This is non-standard, and is only used internally by other log nodes when
   // "following" nodes with more data.
   const bool include_scts(GetBoolParam(query, "include_scts"));
 
+  // The other nodes of the cluster can have the entries as they are
+  // stored, rather than in JSON.
+  if (include_scts && AcceptsBinaryEntries(req)) {
+    end = std::min(end, start + FLAGS_max_leaf_entries_per_response);
+    return BlockingGetBinaryEntries(req, start, end);
+  }
+
+  const bool capped(overload_ &&
+                    overload_->stage() >= OVERLOAD_CAP_ENTRIES);
+  if (capped &&
+      end - start >= FLAGS_overload_max_leaf_entries_per_response) {
+    overload_shed_requests->Increment("get_entries");
+    end = start + FLAGS_overload_max_leaf_entries_per_response - 1;
+  }
+
+  if (tile_cache_ && !include_scts && !capped) {
+    // Stop at the end of the tile of |start|, which is also the limit
+    // on the number of entries returned.
+    const int64_t tile_size(FLAGS_max_leaf_entries_per_response);
+    end = std::min(end, (start / tile_size + 1) * tile_size - 1);
+    return GetEntriesFromTile(req, start, end);
+  }
+
+  // Limit the number of entries returned in a single request.
+  end = std::min(end, start + FLAGS_max_leaf_entries_per_response);
+
   BlockingGetEntries(req, start, end, include_scts);
 }
 
 
+void HttpHandler::GetEntriesByTime(
+    evhttp_request* req, const multimap<string, string>& query) const {
+  uint64_t start_time;
+  if (!GetUint64Param(query, "start_time", &start_time)) {
+    return output_->SendError(req, HTTP_BADREQUEST,
+                              "Invalid \"start_time\" parameter.");
+  }
+  uint64_t end_time;
+  if (!GetUint64Param(query, "end_time", &end_time) ||
+      end_time < start_time) {
+    return output_->SendError(req, HTTP_BADREQUEST,
+                              "Missing or invalid \"end_time\" parameter.");
+  }
+
+  int64_t max_entries(FLAGS_max_leaf_entries_per_response);
+  if (overload_ && overload_->stage() >= OVERLOAD_CAP_ENTRIES) {
+    overload_shed_requests->Increment("get_entries");
+    max_entries = FLAGS_overload_max_leaf_entries_per_response;
+  }
+
+  // Without a time index, this can scan the whole database, so it
+  // doesn't hold up the event loop, and only so many run at once.
+  snapshot_executor_->Add(
+      CpuTimed(RequestPath(req),
+               util::Closure(bind(&HttpHandler::BlockingGetEntriesByTime,
+                                  this, req, start_time, end_time,
+                                  max_entries))));
+}
+
+
 void HttpHandler::GetRoots(evhttp_request* req) const {
   if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
     return output_->SendError(req, HTTP_BADMETHOD, "Method not allowed.");
   }
 
-  JsonArray roots;
-  multimap<string, const Cert*>::const_iterator it;
-  for (it = cert_checker_->GetTrustedCertificates().begin();
-       it != cert_checker_->GetTrustedCertificates().end(); ++it) {
-    string cert;
-    if (it->second->DerEncoding(&cert) != util::Status::OK) {
+  const shared_ptr<const JsonBody> body(GetRootsBody());
+  if (!body) {
+    return output_->SendError(req, HTTP_INTERNAL, "Serialisation failed.");
+  }
+
+  output_->SendJsonReply(req, HTTP_OK, body);
+}
+
+
+shared_ptr<const JsonBody> HttpHandler::GetRootsBody() const {
+  const shared_ptr<const multimap<string, const Cert*>> trusted(
+      cert_checker_->GetTrustedCertificates());
+  lock_guard<mutex> lock(roots_mutex_);
+  if (roots_body_ && trusted.get() == roots_.get()) {
+    return roots_body_;
+  }
+
+  string body;
+  JsonWriter json(&body);
+  json.StartObject();
+  json.StartArray("certificates");
+  string der;
+  for (const auto& root : *trusted) {
+    if (root.second->DerEncoding(&der) != util::Status::OK) {
       LOG(ERROR) << "Cert encoding failed";
-      return output_->SendError(req, HTTP_INTERNAL, "Serialisation failed.");
+      return nullptr;
     }
-    roots.AddBase64(cert);
+    json.AddBase64(der);
   }
+  json.EndArray();
+  json.EndObject();
 
-  JsonObject json_reply;
-  json_reply.Add("certificates", roots);
-
-  output_->SendJsonReply(req, HTTP_OK, json_reply);
+  roots_ = trusted;
+  roots_body_ = make_shared<const JsonBody>(move(body));
+  return roots_body_;
 }
 
 
@@ -405,37 +1117,134 @@ void HttpHandler::GetProof(evhttp_request* req) const {
     return output_->SendError(req, HTTP_BADREQUEST, "Couldn't find hash.");
   }
 
-  JsonArray json_audit;
+  JsonWriter json(evhttp_request_get_output_buffer(req));
+  json.StartObject();
+  json.Add("leaf_index", proof.leaf_index());
+  json.StartArray("audit_path");
   for (int i = 0; i < proof.path_node_size(); ++i) {
-    json_audit.AddBase64(proof.path_node(i));
+    json.AddBase64(proof.path_node(i));
   }
+  json.EndArray();
+  json.EndObject();
 
-  JsonObject json_reply;
-  json_reply.Add("leaf_index", proof.leaf_index());
-  json_reply.Add("audit_path", json_audit);
-
-  output_->SendJsonReply(req, HTTP_OK, json_reply);
+  output_->SendWrittenJsonReply(req, HTTP_OK);
 }
 
 
-void HttpHandler::GetSTH(evhttp_request* req) const {
+// Replies with the proofs of all the "hash" parameters, in the same
+// order, as lists of indices into "nodes", so that the nodes the
+// proofs have in common are sent only once. The proofs of the hashes
+// that aren't in the tree are empty objects.
+void HttpHandler::GetProofs(evhttp_request* req) const {
   if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
     return output_->SendError(req, HTTP_BADMETHOD, "Method not allowed.");
   }
 
-  const SignedTreeHead& sth(log_lookup_->GetSTH());
+  const multimap<string, string> query(ParseQuery(req));
+
+  vector<string> hashes;
+  const auto params(query.equal_range("hash"));
+  for (auto it = params.first; it != params.second; ++it) {
+    hashes.emplace_back(util::FromBase64(it->second.c_str()));
+    if (hashes.back().empty()) {
+      return output_->SendError(req, HTTP_BADREQUEST,
+                                "Invalid \"hash\" parameter.");
+    }
+  }
+  if (hashes.empty() ||
+      hashes.size() > static_cast<size_t>(FLAGS_max_proof_hashes_per_request)) {
+    return output_->SendError(req, HTTP_BADREQUEST,
+                              "Missing or too many \"hash\" parameters.");
+  }
 
-  VLOG(2) << "SignedTreeHead:\n" << sth.DebugString();
+  const int64_t tree_size(GetIntParam(query, "tree_size"));
+  if (tree_size < 0 ||
+      static_cast<int64_t>(tree_size) > log_lookup_->GetSTH().tree_size()) {
+    return output_->SendError(req, HTTP_BADREQUEST,
+                              "Missing or invalid \"tree_size\" parameter.");
+  }
+
+  vector<ShortMerkleAuditProof> proofs;
+  log_lookup_->AuditProofs(hashes, tree_size, &proofs);
+
+  // The index of each distinct node in "nodes".
+  unordered_map<string, int64_t> node_indices;
+  vector<const string*> nodes;
+  for (const auto& proof : proofs) {
+    for (const auto& node : proof.path_node()) {
+      if (node_indices.emplace(node, nodes.size()).second) {
+        nodes.push_back(&node);
+      }
+    }
+  }
+
+  JsonWriter json(evhttp_request_get_output_buffer(req));
+  json.StartObject();
+  json.StartArray("nodes");
+  for (const string* node : nodes) {
+    json.AddBase64(*node);
+  }
+  json.EndArray();
+  json.StartArray("proofs");
+  for (const auto& proof : proofs) {
+    json.StartObject();
+    if (proof.has_leaf_index()) {
+      json.Add("leaf_index", proof.leaf_index());
+      json.StartArray("audit_path");
+      for (const auto& node : proof.path_node()) {
+        json.Add(node_indices.at(node));
+      }
+      json.EndArray();
+    }
+    json.EndObject();
+  }
+  json.EndArray();
+  json.EndObject();
+
+  output_->SendWrittenJsonReply(req, HTTP_OK);
+}
+
+
+void HttpHandler::GetSTH(evhttp_request* req) const {
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
+    return output_->SendError(req, HTTP_BADMETHOD, "Method not allowed.");
+  }
 
-  JsonObject json_reply;
-  json_reply.Add("tree_size", sth.tree_size());
-  json_reply.Add("timestamp", sth.timestamp());
-  json_reply.AddBase64("sha256_root_hash", sth.sha256_root_hash());
-  json_reply.Add("tree_head_signature", sth.signature());
+  shared_ptr<const JsonBody> body;
+  string etag;
+  {
+    const SignedTreeHead& sth(log_lookup_->GetSTH());
+    lock_guard<mutex> lock(sth_mutex_);
+    if (!sth_body_ || sth.timestamp() != sth_timestamp_) {
+      VLOG(2) << "SignedTreeHead:\n" << sth.DebugString();
+
+      JsonObject json_reply;
+      json_reply.Add("tree_size", sth.tree_size());
+      json_reply.Add("timestamp", sth.timestamp());
+      json_reply.AddBase64("sha256_root_hash", sth.sha256_root_hash());
+      json_reply.Add("tree_head_signature", sth.signature());
+
+      VLOG(2) << "GetSTH:\n" << json_reply.DebugString();
+
+      sth_timestamp_ = sth.timestamp();
+      sth_body_ = make_shared<const JsonBody>(json_reply.ToString());
+      sth_etag_ = "\"" + to_string(sth.tree_size()) + "." +
+                  to_string(sth.timestamp()) + "\"";
+    }
+    body = sth_body_;
+    etag = sth_etag_;
+  }
 
-  VLOG(2) << "GetSTH:\n" << json_reply.DebugString();
+  CHECK_EQ(evhttp_add_header(evhttp_request_get_output_headers(req), "ETag",
+                             etag.c_str()),
+           0);
+  const char* const if_none_match(evhttp_find_header(
+      evhttp_request_get_input_headers(req), "If-None-Match"));
+  if (if_none_match && ETagMatches(if_none_match, etag)) {
+    return output_->SendEmptyReply(req, HTTP_NOTMODIFIED);
+  }
 
-  output_->SendJsonReply(req, HTTP_OK, json_reply);
+  output_->SendJsonReply(req, HTTP_OK, body);
 }
 
 
@@ -458,113 +1267,421 @@ void HttpHandler::GetConsistency(evhttp_request* req) const {
                               "Missing or invalid \"second\" parameter.");
   }
 
+  // A proof between published trees never changes. Past the latest
+  // one, the (empty) proof would only be good until the tree grows.
+  const ConsistencyCache::Key key(first, second);
+  const bool cacheable(consistency_cache_ &&
+                       second <= static_cast<int64_t>(
+                                     log_lookup_->GetSTH().tree_size()));
+  if (cacheable) {
+    const shared_ptr<const JsonBody> body(consistency_cache_->Get(key));
+    if (body) {
+      return output_->SendJsonReply(req, HTTP_OK, body);
+    }
+  }
+
   const vector<string> consistency(
       log_lookup_->ConsistencyProof(first, second));
-  JsonArray json_cons;
-  for (vector<string>::const_iterator it = consistency.begin();
-       it != consistency.end(); ++it) {
-    json_cons.AddBase64(*it);
+  string reply;
+  JsonWriter json(&reply);
+  json.StartObject();
+  json.StartArray("consistency");
+  for (const auto& node : consistency) {
+    json.AddBase64(node);
   }
+  json.EndArray();
+  json.EndObject();
 
-  JsonObject json_reply;
-  json_reply.Add("consistency", json_cons);
-
-  output_->SendJsonReply(req, HTTP_OK, json_reply);
+  const shared_ptr<const JsonBody> body(
+      make_shared<const JsonBody>(move(reply)));
+  if (cacheable) {
+    consistency_cache_->Put(key, body);
+  }
+  output_->SendJsonReply(req, HTTP_OK, body);
 }
 
 
 void HttpHandler::AddChain(evhttp_request* req) {
-  const shared_ptr<CertChain> chain(make_shared<CertChain>());
-  if (!ExtractChain(output_, req, chain.get())) {
+  if (ShedLoad(req, OVERLOAD_REJECT_SUBMISSIONS, "submission")) {
     return;
   }
+  const shared_ptr<Trace> trace(Trace::MaybeStart("add-chain"));
+  ScopedTrace scoped_trace(trace.get());
+  const shared_ptr<CertChain> chain(make_shared<CertChain>());
+  {
+    TraceSpan span("extract_chain");
+    if (!ExtractChain(output_, req, chain.get())) {
+      return;
+    }
+  }
 
-  pool_->Add(bind(&HttpHandler::BlockingAddChain, this, req, chain));
+  add_chain_executor_->Add(
+      CpuTimed(RequestPath(req),
+               util::Closure(bind(&HttpHandler::StartAddChain, this, req,
+                                  trace, steady_clock::now(), chain))));
 }
 
 
 void HttpHandler::AddPreChain(evhttp_request* req) {
+  if (ShedLoad(req, OVERLOAD_REJECT_SUBMISSIONS, "submission")) {
+    return;
+  }
+  const shared_ptr<Trace> trace(Trace::MaybeStart("add-pre-chain"));
+  ScopedTrace scoped_trace(trace.get());
   const shared_ptr<PreCertChain> chain(make_shared<PreCertChain>());
-  if (!ExtractChain(output_, req, chain.get())) {
+  {
+    TraceSpan span("extract_chain");
+    if (!ExtractChain(output_, req, chain.get())) {
+      return;
+    }
+  }
+
+  add_chain_executor_->Add(
+      CpuTimed(RequestPath(req),
+               util::Closure(bind(&HttpHandler::StartAddPreChain, this,
+                                  req, trace, steady_clock::now(), chain))));
+}
+
+
+void HttpHandler::AddChains(evhttp_request* req) {
+  if (ShedLoad(req, OVERLOAD_REJECT_SUBMISSIONS, "submission")) {
+    return;
+  }
+  const shared_ptr<vector<unique_ptr<CertChain>>> chains(
+      make_shared<vector<unique_ptr<CertChain>>>());
+  if (!ExtractChains(output_, req, chains.get())) {
     return;
   }
 
-  pool_->Add(bind(&HttpHandler::BlockingAddPreChain, this, req, chain));
+  add_chains_executor_->Add(
+      CpuTimed(RequestPath(req),
+               util::Closure(bind(&HttpHandler::BlockingAddChains, this, req,
+                                  chains))));
+}
+
+
+void HttpHandler::GetSnapshot(evhttp_request* req) const {
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
+    return output_->SendError(req, HTTP_BADMETHOD, "Method not allowed.");
+  }
+
+  const int64_t start(GetIntParam(ParseQuery(req), "start"));
+  if (start < 0) {
+    return output_->SendError(req, HTTP_BADREQUEST,
+                              "Missing or invalid \"start\" parameter.");
+  }
+
+  snapshot_executor_->Add(
+      CpuTimed(RequestPath(req),
+               util::Closure(bind(&HttpHandler::BlockingGetSnapshot, this,
+                                  req, start))));
+}
+
+
+void HttpHandler::BlockingGetSnapshot(evhttp_request* req,
+                                      int64_t start) const {
+  // Only the entries covered by the tree head go in, so that the
+  // importer can check them against it.
+  const SignedTreeHead sth(log_lookup_->GetSTH());
+  const int64_t end(std::min<int64_t>(
+      sth.tree_size(), start + FLAGS_max_snapshot_entries_per_response));
+  string signature;
+  CHECK_EQ(Serializer::SerializeDigitallySigned(sth.signature(), &signature),
+           Serializer::OK);
+
+  JsonWriter json(evhttp_request_get_output_buffer(req));
+  json.StartObject();
+  json.Add("tree_size", sth.tree_size());
+  json.Add("timestamp", sth.timestamp());
+  json.AddBase64("sha256_root_hash", sth.sha256_root_hash());
+  json.AddBase64("tree_head_signature", signature);
+  json.StartArray("entries");
+  // The entries as stored, so that they can be written out again as
+  // they are, without going through the get-entries format.
+  auto it(db_->ScanEntries(start));
+  // Reused for each entry, to save on allocations.
+  LoggedCertificate logged;
+  string serialized;
+  for (int64_t i = start; i < end; ++i) {
+    CHECK(it->GetNextEntry(&logged)) << "Missing entry " << i
+                                     << " of a published tree";
+    CHECK_EQ(i, logged.sequence_number());
+    CHECK(logged.SerializeForDatabase(&serialized));
+    json.AddBase64(serialized);
+  }
+  json.EndArray();
+  json.EndObject();
+
+  output_->SendWrittenJsonReply(req, HTTP_OK);
 }
 
 
 void HttpHandler::BlockingGetEntries(evhttp_request* req, int64_t start,
                                      int64_t end, bool include_scts) const {
-  JsonArray json_entries;
-  auto it(db_->ScanEntries(start));
-  for (int64_t i = start; i <= end; ++i) {
-    LoggedCertificate cert;
+  auto it(db_->ScanRawLeaves(start));
+  ReadOnlyDatabase<LoggedCertificate>::RawLeaf leaf;
+  if (!it->GetNextLeaf(&leaf)) {
+    return output_->SendError(req, HTTP_BADREQUEST, "Entry not found.");
+  }
 
-    if (!it->GetNextEntry(&cert) || cert.sequence_number() != i) {
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+  CHECK(libevent::Base::OnEventThread());
+  EntriesStream::Start(output_, db_, req, leaf, end, include_scts);
+#else
+  // Without evhttp_send_reply_chunk_with_cb(), there is no telling
+  // when a chunk was sent. Written straight into the reply instead.
+  JsonWriter json(evhttp_request_get_output_buffer(req));
+  json.StartObject();
+  json.StartArray("entries");
+  for (int64_t i = start; i <= end; ++i) {
+    if (i > start && !it->GetNextLeaf(&leaf)) {
       break;
     }
+    CHECK_EQ(i, leaf.sequence_number);
+    WriteEntry(leaf, include_scts, &json);
+  }
+  json.EndArray();
+  json.EndObject();
 
-    string leaf_input;
-    string extra_data;
-    string sct_data;
-    if (!cert.SerializeForLeaf(&leaf_input) ||
-        !cert.SerializeExtraData(&extra_data) ||
-        (include_scts &&
-         Serializer::SerializeSCT(cert.sct(), &sct_data) != Serializer::OK)) {
-      LOG(WARNING) << "Failed to serialize entry @ " << i << ":\n"
-                   << cert.DebugString();
-      return output_->SendError(req, HTTP_INTERNAL, "Serialization failed.");
+  output_->SendWrittenJsonReply(req, HTTP_OK);
+#endif
+}
+
+
+void HttpHandler::BlockingGetEntriesByTime(evhttp_request* req,
+                                           uint64_t start_time,
+                                           uint64_t end_time,
+                                           int64_t max_entries) const {
+  // As with the other requests, only the entries in the published tree.
+  const int64_t tree_size(log_lookup_->GetSTH().tree_size());
+  auto it(db_->ScanEntriesByTime(start_time, end_time));
+  // Reused for each entry, to save on allocations.
+  LoggedCertificate logged;
+  ReadOnlyDatabase<LoggedCertificate>::RawLeaf leaf;
+
+  JsonWriter json(evhttp_request_get_output_buffer(req));
+  json.StartObject();
+  json.StartArray("entries");
+  int64_t num_entries(0);
+  while (num_entries < max_entries && it->GetNextEntry(&logged)) {
+    if (logged.sequence_number() >= tree_size) {
+      continue;
     }
+    CHECK(logged.SerializeForLeaf(&leaf.leaf_input));
+    CHECK(logged.SerializeExtraData(&leaf.extra_data));
+    // The entries are not in index order, so each one says where it is.
+    json.StartObject();
+    json.Add("leaf_index", logged.sequence_number());
+    json.AddBase64("leaf_input", leaf.leaf_input);
+    json.AddBase64("extra_data", leaf.extra_data);
+    json.EndObject();
+    ++num_entries;
+  }
+  json.EndArray();
+  json.EndObject();
+
+  output_->SendWrittenJsonReply(req, HTTP_OK);
+}
 
-    JsonObject json_entry;
-    json_entry.AddBase64("leaf_input", leaf_input);
-    json_entry.AddBase64("extra_data", extra_data);
 
-    if (include_scts) {
-      // This is non-standard, and currently only used by other SuperDuper log
-      // nodes when "following" to fetch data from each other:
-      json_entry.AddBase64("sct", sct_data);
+void HttpHandler::BlockingGetBinaryEntries(evhttp_request* req,
+                                           int64_t start, int64_t end) const {
+  evbuffer* const output(evhttp_request_get_output_buffer(req));
+  auto it(db_->ScanEntries(start));
+  // Reused for each entry, to save on allocations.
+  LoggedCertificate logged;
+  string serialized;
+  for (int64_t i = start; i <= end; ++i) {
+    if (!it->GetNextEntry(&logged) || logged.sequence_number() != i) {
+      break;
     }
+    CHECK(logged.SerializeToString(&serialized));
+    const string length(Serializer::SerializeUint(serialized.size(), 4));
+    CHECK_EQ(0, evbuffer_add(output, length.data(), length.size()));
+    CHECK_EQ(0, evbuffer_add(output, serialized.data(), serialized.size()));
+  }
+  if (evbuffer_get_length(output) == 0) {
+    return output_->SendError(req, HTTP_BADREQUEST, "Entry not found.");
+  }
+
+  output_->SendWrittenReply(req, HTTP_OK, kBinaryEntriesContentType);
+}
+
+
+void HttpHandler::GetEntriesFromTile(evhttp_request* req, int64_t start,
+                                     int64_t end) const {
+  const int64_t tile_size(FLAGS_max_leaf_entries_per_response);
+  const int64_t tile_index(start / tile_size);
+  const int64_t tile_start(tile_index * tile_size);
+  CHECK_LE(tile_start, start);
+  CHECK_LT(end, tile_start + tile_size);
 
-    json_entries.Add(&json_entry);
+  const shared_ptr<const EntriesTile> tile(GetTile(tile_index));
+  if (!tile) {
+    // Its entries could still be missing, or change.
+    return BlockingGetEntries(req, start, end, false /* include_scts */);
   }
 
-  if (json_entries.Length() < 1) {
-    return output_->SendError(req, HTTP_BADREQUEST, "Entry not found.");
+  CHECK_EQ(0, evhttp_add_header(
+                  evhttp_request_get_output_headers(req), "Cache-Control",
+                  ("public, max-age=" +
+                   to_string(FLAGS_get_entries_tile_max_age_seconds))
+                      .c_str()));
+  if (start == tile_start && end == tile_start + tile_size - 1) {
+    return output_->SendJsonReply(req, HTTP_OK, tile->body);
   }
+  output_->SendJsonReply(req, HTTP_OK,
+                         make_shared<const JsonBody>(
+                             tile->Slice(start - tile_start, end - tile_start)));
+}
 
-  JsonObject json_reply;
-  json_reply.Add("entries", json_entries);
 
-  output_->SendJsonReply(req, HTTP_OK, json_reply);
+shared_ptr<const EntriesTile> HttpHandler::GetTile(int64_t index) const {
+  shared_ptr<const EntriesTile> tile(tile_cache_->Get(index));
+  if (tile) {
+    get_entries_tile_lookups->Increment("hit");
+    return tile;
+  }
+
+  const int64_t tile_size(FLAGS_max_leaf_entries_per_response);
+  const int64_t tile_start(index * tile_size);
+  if (tile_start + tile_size > log_lookup_->GetSTH().tree_size()) {
+    get_entries_tile_lookups->Increment("incomplete");
+    return nullptr;
+  }
+  get_entries_tile_lookups->Increment("miss");
+
+  const shared_ptr<EntriesTile> new_tile(make_shared<EntriesTile>());
+  string body("{\"entries\":[");
+  auto it(db_->ScanRawLeaves(tile_start));
+  ReadOnlyDatabase<LoggedCertificate>::RawLeaf leaf;
+  for (int64_t i = tile_start; i < tile_start + tile_size; ++i) {
+    if (!it->GetNextLeaf(&leaf)) {
+      LOG(WARNING) << "Missing entry " << i << " of a published tree";
+      return nullptr;
+    }
+    CHECK_EQ(i, leaf.sequence_number);
+
+    new_tile->offsets.push_back(body.size());
+    JsonWriter json(&body);
+    WriteEntry(leaf, false /* include_scts */, &json);
+    body += ",";
+  }
+  new_tile->offsets.push_back(body.size());
+  // Replace the last separator.
+  body.back() = ']';
+  body += "}";
+  new_tile->body = make_shared<const JsonBody>(move(body));
+
+  tile_cache_->Put(index, new_tile);
+  return new_tile;
 }
 
 
-void HttpHandler::BlockingAddChain(evhttp_request* req,
-                                   const shared_ptr<CertChain>& chain) const {
-  SignedCertificateTimestamp sct;
+void HttpHandler::StartAddChain(evhttp_request* req,
+                                const shared_ptr<Trace>& trace,
+                                steady_clock::time_point queued_at,
+                                const shared_ptr<CertChain>& chain) const {
+  ScopedTrace scoped_trace(trace.get());
+  if (trace) {
+    trace->AddSpan("add_chain_queue", queued_at, steady_clock::now());
+  }
+  const shared_ptr<SignedCertificateTimestamp> sct(
+      make_shared<SignedCertificateTimestamp>());
+
+  const steady_clock::time_point start(steady_clock::now());
+  CHECK_NOTNULL(frontend_)->QueueX509EntryAsync(
+      CHECK_NOTNULL(chain.get()), sct.get(),
+      new util::Task(bind(&HttpHandler::AddChainDone, this, req, trace, start,
+                          sct, _1),
+                     pool_));
+}
+
+
+void HttpHandler::StartAddPreChain(
+    evhttp_request* req, const shared_ptr<Trace>& trace,
+    steady_clock::time_point queued_at,
+    const shared_ptr<PreCertChain>& chain) const {
+  ScopedTrace scoped_trace(trace.get());
+  if (trace) {
+    trace->AddSpan("add_chain_queue", queued_at, steady_clock::now());
+  }
+  const shared_ptr<SignedCertificateTimestamp> sct(
+      make_shared<SignedCertificateTimestamp>());
+
+  const steady_clock::time_point start(steady_clock::now());
+  CHECK_NOTNULL(frontend_)->QueuePreCertEntryAsync(
+      CHECK_NOTNULL(chain.get()), sct.get(),
+      new util::Task(bind(&HttpHandler::AddChainDone, this, req, trace, start,
+                          sct, _1),
+                     pool_));
+}
+
 
-  AddChainReply(output_, req,
-                CHECK_NOTNULL(frontend_)
-                    ->QueueX509Entry(CHECK_NOTNULL(chain.get()), &sct),
-                sct);
+void HttpHandler::AddChainDone(
+    evhttp_request* req, const shared_ptr<Trace>& trace,
+    steady_clock::time_point start,
+    const shared_ptr<SignedCertificateTimestamp>& sct,
+    util::Task* task) const {
+  ScopedTrace scoped_trace(trace.get());
+  RecordSubmission(start);
+  AddChainReply(output_, req, task->status(), *sct);
+  // This also deletes the arguments bound to the callback.
+  delete task;
 }
 
 
-void HttpHandler::BlockingAddPreChain(
-    evhttp_request* req, const shared_ptr<PreCertChain>& chain) const {
-  SignedCertificateTimestamp sct;
+void HttpHandler::BlockingAddChains(
+    evhttp_request* req,
+    const shared_ptr<vector<unique_ptr<CertChain>>>& chains) const {
+  vector<CertChain*> parsed_chains;
+  for (const auto& chain : *chains) {
+    if (chain) {
+      parsed_chains.push_back(chain.get());
+    }
+  }
+
+  vector<SignedCertificateTimestamp> scts;
+  vector<util::Status> statuses;
+  CHECK_NOTNULL(frontend_)
+      ->QueueX509Entries(parsed_chains, pool_, &scts, &statuses);
+
+  JsonWriter json(evhttp_request_get_output_buffer(req));
+  json.StartObject();
+  json.StartArray("results");
+  size_t next(0);
+  for (const auto& chain : *chains) {
+    json.StartObject();
+    if (!chain) {
+      json.Add("error", "Unable to parse provided chain.");
+    } else if (statuses[next].ok() ||
+               statuses[next].CanonicalCode() ==
+                   util::error::ALREADY_EXISTS) {
+      WriteSCT(scts[next], &json);
+      ++next;
+    } else {
+      VLOG(1) << "error adding chain: " << statuses[next];
+      json.Add("error", statuses[next].error_message());
+      ++next;
+    }
+    json.EndObject();
+  }
+  json.EndArray();
+  json.EndObject();
 
-  AddChainReply(output_, req,
-                CHECK_NOTNULL(frontend_)
-                    ->QueuePreCertEntry(CHECK_NOTNULL(chain.get()), &sct),
-                sct);
+  output_->SendWrittenJsonReply(req, HTTP_OK);
+}
+
+
+void HttpHandler::SetWarming(bool warming) {
+  lock_guard<mutex> lock(mutex_);
+  warming_ = warming;
 }
 
 
 bool HttpHandler::IsNodeStale() const {
   lock_guard<mutex> lock(mutex_);
-  return node_is_stale_;
+  return node_is_stale_ || warming_;
 }
 
 
@@ -584,3 +1701,49 @@ void HttpHandler::UpdateNodeStaleness() {
                      task_.task()->AddChild(
                          bind(&HttpHandler::UpdateNodeStaleness, this)));
 }
+
+
+void HttpHandler::RecordSubmission(steady_clock::time_point start) const {
+  submission_us_ +=
+      duration_cast<microseconds>(steady_clock::now() - start).count();
+  ++num_submissions_;
+}
+
+
+void HttpHandler::UpdateOverload() {
+  if (!task_.task()->IsActive()) {
+    // We're shutting down, just return.
+    return;
+  }
+
+  // The load is the worst of what is watched, relative to its limit.
+  double load(0);
+  if (FLAGS_overload_max_pool_wait_ms > 0) {
+    load = max(load, duration<double, milli>(pool_->GetStats().oldest_queued)
+                             .count() /
+                         FLAGS_overload_max_pool_wait_ms);
+  }
+  const int64_t num_submissions(num_submissions_.exchange(0));
+  const int64_t submission_us(submission_us_.exchange(0));
+  if (FLAGS_overload_max_submission_latency_ms > 0 && num_submissions > 0) {
+    load = max(load, submission_us / 1000.0 / num_submissions /
+                         FLAGS_overload_max_submission_latency_ms);
+  }
+  if (FLAGS_overload_max_rss_mb > 0) {
+    load = max(load, static_cast<double>(ResidentBytes()) /
+                         (static_cast<int64_t>(FLAGS_overload_max_rss_mb)
+                          << 20));
+  }
+
+  const int previous_stage(overload_->stage());
+  const int stage(overload_->Update(load));
+  if (stage != previous_stage) {
+    LOG(WARNING) << "Overload stage " << previous_stage << " -> " << stage
+                 << " (load " << load << ")";
+  }
+  overload_stage->Set(stage);
+
+  event_base_->Delay(milliseconds(FLAGS_overload_check_interval_ms),
+                     task_.task()->AddChild(
+                         bind(&HttpHandler::UpdateOverload, this)));
+}
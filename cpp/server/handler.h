@@ -1,10 +1,15 @@
 #ifndef CERT_TRANS_SERVER_HANDLER_H_
 #define CERT_TRANS_SERVER_HANDLER_H_
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "util/libevent_wrapper.h"
 #include "util/sync_task.h"
@@ -16,25 +21,43 @@ class LogLookup;
 template <class T>
 class ReadOnlyDatabase;
 
+namespace ct {
+class SignedCertificateTimestamp;
+}  // namespace ct
+
+namespace util {
+class OverloadController;
+class RateLimiter;
+}  // namespace util
+
 namespace cert_trans {
 
+class Cert;
 class CertChain;
 class CertChecker;
+class ConsistencyCache;
 template <class T>
 class ClusterStateController;
+struct EntriesTile;
+class FairScheduler;
+class JsonBody;
 class JsonOutput;
 class LoggedCertificate;
 class PreCertChain;
 class Proxy;
 class ThreadPool;
+class TileCache;
+class Trace;
 
 
 class HttpHandler {
  public:
   // Does not take ownership of its parameters, which must outlive
   // this instance. The "frontend" parameter can be NULL, in which
-  // case this server will not accept "add-chain" and "add-pre-chain"
-  // requests.
+  // case this server will not accept "add-chain", "add-pre-chain" and
+  // "add-chains" requests. The "controller" and "proxy" parameters are
+  // NULL for a read-only replica, which is never stale (but while it
+  // warms up), and has no other node to proxy to.
   HttpHandler(JsonOutput* json_output,
               LogLookup<LoggedCertificate>* log_lookup,
               const ReadOnlyDatabase<LoggedCertificate>* db,
@@ -43,34 +66,115 @@ class HttpHandler {
               Proxy* proxy, ThreadPool* pool, libevent::Base* event_base);
   ~HttpHandler();
 
-  void Add(libevent::HttpServer* server);
+  // Adds the handlers under |path_prefix| (such as "/2025"), which
+  // can be empty, to tell several logs served on one port apart.
+  void Add(libevent::HttpServer* server, const std::string& path_prefix);
+
+  // While the node is warming up (its LogLookup is still loading), it
+  // is treated as stale, so that the requests it can't answer from its
+  // database are proxied.
+  void SetWarming(bool warming);
 
  private:
+  // Replies 429 (Too Many Requests) to the clients over their rate
+  // limit for |path|, before anything else is done for the request.
+  void RateLimitInterceptor(
+      const std::string& path,
+      const libevent::HttpServer::HandlerCallback& next_handler,
+      evhttp_request* request) const;
+
+  // Returns whether a request can be answered from what this node
+  // has, even when it is stale.
+  typedef std::function<bool(evhttp_request*)> LocalCheck;
+
+  // When the node is stale, proxies the requests for which
+  // |can_serve_locally| (which can be empty) doesn't return true.
   void ProxyInterceptor(
+      const std::string& path, const LocalCheck& can_serve_locally,
       const libevent::HttpServer::HandlerCallback& next_handler,
       evhttp_request* request);
 
+  // Replies 503 (Service Unavailable) to |req|, and returns true, if
+  // the node is at |stage| of overload or past it.
+  bool ShedLoad(evhttp_request* req, int stage, const char* action) const;
+
   void AddProxyWrappedHandler(
       libevent::HttpServer* server, const std::string& path,
-      const libevent::HttpServer::HandlerCallback& local_handler);
+      const libevent::HttpServer::HandlerCallback& local_handler,
+      const LocalCheck& can_serve_locally);
+
+  // These only return false for valid requests that reach past the
+  // local tree.
+  bool CanServeEntriesLocally(evhttp_request* req) const;
+  bool CanServeProofLocally(evhttp_request* req) const;
+  bool CanServeConsistencyLocally(evhttp_request* req) const;
 
   void GetEntries(evhttp_request* req) const;
   void GetRoots(evhttp_request* req) const;
+  // Returns the get-roots reply body for the current trusted
+  // certificates, or nullptr if they can't be encoded.
+  std::shared_ptr<const JsonBody> GetRootsBody() const;
   void GetProof(evhttp_request* req) const;
+  void GetProofs(evhttp_request* req) const;
   void GetSTH(evhttp_request* req) const;
   void GetConsistency(evhttp_request* req) const;
   void AddChain(evhttp_request* req);
   void AddPreChain(evhttp_request* req);
+  void AddChains(evhttp_request* req);
+  void GetSnapshot(evhttp_request* req) const;
 
   void BlockingGetEntries(evhttp_request* req, int64_t start, int64_t end,
                           bool include_scts) const;
-  void BlockingAddChain(evhttp_request* req,
-                        const std::shared_ptr<CertChain>& chain) const;
-  void BlockingAddPreChain(evhttp_request* req,
-                           const std::shared_ptr<PreCertChain>& chain) const;
+  // get-entries for a time range rather than a range of indices.
+  void GetEntriesByTime(
+      evhttp_request* req,
+      const std::multimap<std::string, std::string>& query) const;
+  // Replies with up to |max_entries| of the entries of the published
+  // tree whose timestamp is in [|start_time|, |end_time|), with their
+  // indices.
+  void BlockingGetEntriesByTime(evhttp_request* req, uint64_t start_time,
+                                uint64_t end_time,
+                                int64_t max_entries) const;
+  // Replies with entries |start| to |end| in kBinaryEntriesContentType.
+  void BlockingGetBinaryEntries(evhttp_request* req, int64_t start,
+                                int64_t end) const;
+  // Serves entries |start| to |end|, which are in the same tile, from
+  // that tile if it is complete.
+  void GetEntriesFromTile(evhttp_request* req, int64_t start,
+                          int64_t end) const;
+  // Returns nullptr if the tile isn't complete in the published tree.
+  std::shared_ptr<const EntriesTile> GetTile(int64_t index) const;
+  void BlockingGetSnapshot(evhttp_request* req, int64_t start) const;
+  // |trace| may be null, |queued_at| is when the request was added to
+  // the add-chain executor. These only check the chain, the reply is
+  // sent by AddChainDone() once the entry is stored, without holding
+  // a thread of |pool_| in the meantime.
+  void StartAddChain(evhttp_request* req,
+                     const std::shared_ptr<Trace>& trace,
+                     std::chrono::steady_clock::time_point queued_at,
+                     const std::shared_ptr<CertChain>& chain) const;
+  void StartAddPreChain(evhttp_request* req,
+                        const std::shared_ptr<Trace>& trace,
+                        std::chrono::steady_clock::time_point queued_at,
+                        const std::shared_ptr<PreCertChain>& chain) const;
+  // Deletes |task|. |start| is when the submission started.
+  void AddChainDone(
+      evhttp_request* req, const std::shared_ptr<Trace>& trace,
+      std::chrono::steady_clock::time_point start,
+      const std::shared_ptr<ct::SignedCertificateTimestamp>& sct,
+      util::Task* task) const;
+  // Null chains are the ones which couldn't be parsed.
+  void BlockingAddChains(
+      evhttp_request* req,
+      const std::shared_ptr<std::vector<std::unique_ptr<CertChain>>>& chains)
+      const;
 
   bool IsNodeStale() const;
   void UpdateNodeStaleness();
+  // Adds the time taken to queue a submission since |start|, which is
+  // mostly the time etcd takes to store it, to the next overload check.
+  void RecordSubmission(std::chrono::steady_clock::time_point start) const;
+  void UpdateOverload();
 
   JsonOutput* const output_;
   LogLookup<LoggedCertificate>* const log_lookup_;
@@ -81,10 +185,47 @@ class HttpHandler {
   Proxy* const proxy_;
   ThreadPool* const pool_;
   libevent::Base* const event_base_;
+  // Null when get-entries tiles are disabled.
+  const std::unique_ptr<TileCache> tile_cache_;
+  // Null when get-sth-consistency replies are not cached.
+  const std::unique_ptr<ConsistencyCache> consistency_cache_;
+  // Null when clients are not rate limited.
+  const std::unique_ptr<util::RateLimiter> rate_limiter_;
+  // Null when overload control is disabled.
+  const std::unique_ptr<util::OverloadController> overload_;
+  // The submissions since the last overload check, and the time taken
+  // to queue them.
+  mutable std::atomic<int64_t> num_submissions_;
+  mutable std::atomic<int64_t> submission_us_;
+  // Picks which of the requests waiting for |pool_| goes next, so that
+  // a burst of one kind doesn't hold up the others. Declared after
+  // what the requests use, so that it's destroyed first.
+  const std::unique_ptr<FairScheduler> scheduler_;
+  util::Executor* const add_chain_executor_;
+  util::Executor* const add_chains_executor_;
+  util::Executor* const proxy_executor_;
+  util::Executor* const snapshot_executor_;
 
   util::SyncTask task_;
   mutable std::mutex mutex_;
   bool node_is_stale_;
+  bool warming_;
+
+  // The get-sth reply body and its ETag, for the tree head with
+  // |sth_timestamp_|. They are rendered again when the LogLookup has a
+  // newer one.
+  mutable std::mutex sth_mutex_;
+  mutable uint64_t sth_timestamp_;
+  mutable std::shared_ptr<const JsonBody> sth_body_;
+  mutable std::string sth_etag_;
+
+  // The get-roots reply body, for the |roots_| snapshot of the trusted
+  // certificates. The roots only change when they are reloaded, when
+  // it is rendered again.
+  mutable std::mutex roots_mutex_;
+  mutable std::shared_ptr<const std::multimap<std::string, const Cert*>>
+      roots_;
+  mutable std::shared_ptr<const JsonBody> roots_body_;
 
   DISALLOW_COPY_AND_ASSIGN(HttpHandler);
 };
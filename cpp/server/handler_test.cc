@@ -0,0 +1,241 @@
+#include "server/handler.h"
+
+#include <arpa/inet.h>
+#include <glog/logging.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "base/notification.h"
+#include "client/async_log_client.h"
+#include "log/log_lookup.h"
+#include "log/logged_certificate.h"
+#include "log/sqlite_db.h"
+#include "log/test_db.h"
+#include "log/test_signer.h"
+#include "net/mock_url_fetcher.h"
+#include "net/url_fetcher.h"
+#include "server/json_output.h"
+#include "util/libevent_wrapper.h"
+#include "util/sync_task.h"
+#include "util/testing.h"
+#include "util/thread_pool.h"
+
+namespace cert_trans {
+namespace {
+
+using std::make_pair;
+using std::make_shared;
+using std::shared_ptr;
+using std::string;
+using std::to_string;
+using std::unique_ptr;
+using std::vector;
+using testing::_;
+using testing::Invoke;
+using util::SyncTask;
+using util::Task;
+
+
+// Returns a port that was free a moment ago.
+uint16_t FreePort() {
+  const int sock(socket(AF_INET, SOCK_STREAM, 0));
+  CHECK_GE(sock, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  CHECK_EQ(0, bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
+  socklen_t addr_len(sizeof(addr));
+  CHECK_EQ(0, getsockname(sock, reinterpret_cast<sockaddr*>(&addr),
+                          &addr_len));
+  close(sock);
+  return ntohs(addr.sin_port);
+}
+
+
+AsyncLogClient::Status GetEntriesAndSCTs(
+    AsyncLogClient* client, int first, int last,
+    vector<AsyncLogClient::Entry>* entries) {
+  Notification done;
+  AsyncLogClient::Status status;
+  client->GetEntriesAndSCTs(first, last, entries,
+                            [&done, &status](AsyncLogClient::Status s) {
+                              status = s;
+                              done.Notify();
+                            });
+  done.WaitForNotification();
+  return status;
+}
+
+
+AsyncLogClient::Status GetEntries(AsyncLogClient* client, int first,
+                                  int last,
+                                  vector<AsyncLogClient::Entry>* entries) {
+  Notification done;
+  AsyncLogClient::Status status;
+  client->GetEntries(first, last, entries,
+                     [&done, &status](AsyncLogClient::Status s) {
+                       status = s;
+                       done.Notify();
+                     });
+  done.WaitForNotification();
+  return status;
+}
+
+
+// Serves the handlers on a local port, from a database with no tree
+// head, and fetches from it with a real UrlFetcher.
+class HandlerTest : public ::testing::Test {
+ protected:
+  HandlerTest()
+      : port_(FreePort()),
+        url_("http://127.0.0.1:" + to_string(port_)),
+        base_(make_shared<libevent::Base>()),
+        output_(&pool_),
+        lookup_(test_db_.db()),
+        handler_(&output_, &lookup_, test_db_.db(), nullptr /* controller */,
+                 nullptr /* cert_checker */, nullptr /* frontend */,
+                 nullptr /* proxy */, &pool_, base_.get()),
+        server_(*base_),
+        fetcher_(base_.get(), &pool_),
+        client_(&pool_, &fetcher_, url_) {
+    handler_.Add(&server_, "");
+    server_.Bind("127.0.0.1", port_);
+    pump_.reset(new libevent::EventPumpThread(base_));
+  }
+
+  void AddEntries(int num_entries) {
+    for (int i = 0; i < num_entries; ++i) {
+      LoggedCertificate logged;
+      test_signer_.CreateUnique(&logged);
+      logged.set_sequence_number(log_.size());
+      ASSERT_EQ(Database<LoggedCertificate>::OK,
+                test_db_.db()->CreateSequencedEntry(logged));
+      log_.push_back(logged);
+    }
+  }
+
+  // The get-entries reply of the binary format for entries |first| to
+  // |last|, as sent, without compression.
+  UrlFetcher::Response GetBinaryReply(int first, int last) {
+    UrlFetcher::Request req(URL(url_ + "/ct/v1/get-entries"));
+    req.url.SetQuery("start=" + to_string(first) + "&end=" +
+                     to_string(last) + "&include_scts=true");
+    req.headers.insert(make_pair("Accept", kBinaryEntriesContentType));
+    UrlFetcher::Response resp;
+    SyncTask task(&pool_);
+    fetcher_.Fetch(req, &resp, task.task());
+    task.Wait();
+    CHECK(task.status().ok()) << task.status();
+    return resp;
+  }
+
+  ThreadPool pool_;
+  TestDB<SQLiteDB<LoggedCertificate>> test_db_;
+  TestSigner test_signer_;
+  vector<LoggedCertificate> log_;
+  const uint16_t port_;
+  const string url_;
+  const shared_ptr<libevent::Base> base_;
+  JsonOutput output_;
+  LogLookup<LoggedCertificate> lookup_;
+  HttpHandler handler_;
+  libevent::HttpServer server_;
+  UrlFetcher fetcher_;
+  AsyncLogClient client_;
+  // Stopped first, before anything it could call into goes away.
+  unique_ptr<libevent::EventPumpThread> pump_;
+};
+
+
+TEST_F(HandlerTest, BinaryEntriesRoundTrip) {
+  AddEntries(5);
+
+  const UrlFetcher::Response resp(GetBinaryReply(1, 3));
+  ASSERT_EQ(200, resp.status_code) << resp.body;
+  const auto content_type(resp.headers.find("Content-Type"));
+  ASSERT_NE(resp.headers.end(), content_type);
+  EXPECT_EQ(kBinaryEntriesContentType, content_type->second);
+
+  // Through the client, which also asks for gzip.
+  vector<AsyncLogClient::Entry> entries;
+  ASSERT_EQ(AsyncLogClient::OK,
+            GetEntriesAndSCTs(&client_, 1, 3, &entries));
+  // The same entries as through the standard get-entries.
+  vector<AsyncLogClient::Entry> json_entries;
+  ASSERT_EQ(AsyncLogClient::OK, GetEntries(&client_, 1, 3, &json_entries));
+
+  ASSERT_EQ(3U, entries.size());
+  ASSERT_EQ(3U, json_entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const LoggedCertificate& logged(log_[i + 1]);
+    EXPECT_EQ(logged.entry().DebugString(), entries[i].entry.DebugString());
+    ASSERT_TRUE(entries[i].sct);
+    EXPECT_EQ(logged.sct().DebugString(), entries[i].sct->DebugString());
+    EXPECT_EQ(json_entries[i].leaf.DebugString(),
+              entries[i].leaf.DebugString());
+    EXPECT_EQ(json_entries[i].entry.DebugString(),
+              entries[i].entry.DebugString());
+  }
+}
+
+
+TEST_F(HandlerTest, RejectsMalformedBinaryEntries) {
+  AddEntries(2);
+  const UrlFetcher::Response good(GetBinaryReply(0, 1));
+  ASSERT_EQ(200, good.status_code) << good.body;
+  ASSERT_LT(4U, good.body.size());
+
+  string too_long(good.body);
+  too_long[0] = '\x7f';
+  const vector<string> bad_bodies{
+      // Cut in the middle of the last entry, and of a length.
+      good.body.substr(0, good.body.size() - 1),
+      good.body.substr(0, 2),
+      // A length past the end of the body.
+      too_long,
+      // Not a LoggedCertificatePB.
+      string("\0\0\0\x03xyz", 7),
+  };
+
+  testing::NiceMock<MockUrlFetcher> mock_fetcher;
+  AsyncLogClient mock_client(&pool_, &mock_fetcher, url_);
+  for (const auto& body : bad_bodies) {
+    EXPECT_CALL(mock_fetcher, Fetch(_, _, _))
+        .WillOnce(Invoke([&body](const UrlFetcher::Request&,
+                                 UrlFetcher::Response* resp, Task* task) {
+          resp->status_code = 200;
+          resp->headers.insert(
+              make_pair("Content-Type", kBinaryEntriesContentType));
+          resp->body = body;
+          task->Return();
+        }));
+    vector<AsyncLogClient::Entry> entries;
+    EXPECT_EQ(AsyncLogClient::BAD_RESPONSE,
+              GetEntriesAndSCTs(&mock_client, 0, 1, &entries));
+    EXPECT_TRUE(entries.empty());
+  }
+}
+
+
+TEST_F(HandlerTest, BinaryEntriesNotFound) {
+  AddEntries(2);
+  const UrlFetcher::Response resp(GetBinaryReply(5, 6));
+  EXPECT_EQ(400, resp.status_code);
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
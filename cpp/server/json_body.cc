@@ -0,0 +1,28 @@
+#include "server/json_body.h"
+
+#include "util/gzip.h"
+
+using std::lock_guard;
+using std::mutex;
+using std::string;
+
+namespace cert_trans {
+
+
+JsonBody::JsonBody(string json) : json_(std::move(json)), has_gzipped_(false) {
+}
+
+
+const string& JsonBody::Gzipped() const {
+  if (!HasGzipped()) {
+    lock_guard<mutex> lock(gzip_mutex_);
+    if (!has_gzipped_.load(std::memory_order_relaxed)) {
+      gzipped_ = util::Gzip(json_);
+      has_gzipped_.store(true, std::memory_order_release);
+    }
+  }
+  return gzipped_;
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,45 @@
+#ifndef CERT_TRANS_SERVER_JSON_BODY_H_
+#define CERT_TRANS_SERVER_JSON_BODY_H_
+
+#include <atomic>
+#include <mutex>
+#include <string>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// An already rendered JSON reply body, shared by all the replies that
+// send it. Its gzipped version is only computed once, when the first
+// client accepting it asks, and then kept along with it.
+class JsonBody {
+ public:
+  explicit JsonBody(std::string json);
+
+  const std::string& json() const {
+    return json_;
+  }
+
+  // Returns |json()| compressed with gzip, compressing it on the first
+  // call. Other callers wait for that one to be done.
+  const std::string& Gzipped() const;
+
+  // Whether Gzipped() would return without compressing.
+  bool HasGzipped() const {
+    return has_gzipped_.load(std::memory_order_acquire);
+  }
+
+ private:
+  const std::string json_;
+  mutable std::mutex gzip_mutex_;
+  mutable std::atomic<bool> has_gzipped_;
+  mutable std::string gzipped_;
+
+  DISALLOW_COPY_AND_ASSIGN(JsonBody);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_SERVER_JSON_BODY_H_
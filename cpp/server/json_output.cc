@@ -1,14 +1,30 @@
 #include "server/json_output.h"
 
+#include <ctype.h>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <limits>
+#include <stdlib.h>
+#include <string.h>
 #include <string>
+#include <unordered_map>
 
 #include "monitoring/monitoring.h"
 #include "monitoring/latency.h"
+#include "server/json_body.h"
+#include "util/executor.h"
+#include "util/gzip.h"
 #include "util/json_wrapper.h"
 #include "util/libevent_wrapper.h"
 
+DEFINE_int32(json_reply_gzip_min_bytes, 1024,
+             "JSON replies with a body of at least this many bytes are sent "
+             "gzipped to the clients that accept it. 0 disables compression.");
+
+using std::move;
+using std::shared_ptr;
 using std::string;
+using std::unordered_map;
 
 namespace cert_trans {
 namespace {
@@ -27,6 +43,41 @@ static Counter<string, int>* total_http_server_response_codes(
 static const char kJsonContentType[] = "application/json; charset=utf-8";
 
 
+// The counters of the replies to one path, looked up once per thread
+// for each path and status, rather than under the lock of the counters
+// for every reply.
+struct PathCounters {
+  explicit PathCounters(const string& path)
+      : requests(total_http_server_requests->GetHandle(path)) {
+  }
+
+  Counter<string>::Handle requests;
+  unordered_map<int, Counter<string, int>::Handle> response_codes;
+};
+
+
+void CountReply(evhttp_request* req, int http_status) {
+  thread_local unordered_map<string, PathCounters> counters;
+  const string path(evhttp_uri_get_path(evhttp_request_get_evhttp_uri(req)));
+  auto it(counters.find(path));
+  if (it == counters.end()) {
+    it = counters.emplace(path, PathCounters(path)).first;
+  }
+  it->second.requests.Increment();
+
+  auto code_it(it->second.response_codes.find(http_status));
+  if (code_it == it->second.response_codes.end()) {
+    code_it = it->second.response_codes
+                  .emplace(http_status,
+                           total_http_server_response_codes->GetHandle(
+                               path, http_status))
+                  .first;
+  }
+  code_it->second.Increment();
+}
+
+
+// Only called when the replies are logged.
 string LogRequest(evhttp_request* req, int http_status, int resp_body_length) {
   evhttp_connection* conn = evhttp_request_get_connection(req);
   char* peer_addr;
@@ -55,50 +106,232 @@ string LogRequest(evhttp_request* req, int http_status, int resp_body_length) {
       break;
   }
 
-  const string path(evhttp_uri_get_path(evhttp_request_get_evhttp_uri(req)));
-  total_http_server_requests->Increment(path);
-  total_http_server_response_codes->Increment(path, http_status);
-
   const string uri(evhttp_request_get_uri(req));
   return string(peer_addr) + " \"" + http_verb + " " + uri + "\" " +
          std::to_string(http_status) + " " + std::to_string(resp_body_length);
 }
 
 
+void ReleaseSharedBody(const void*, size_t, void* body) {
+  delete static_cast<shared_ptr<const JsonBody>*>(body);
+}
+
+
+string Trim(const string& str) {
+  size_t begin(0);
+  size_t end(str.size());
+  while (begin < end && isspace(str[begin])) {
+    ++begin;
+  }
+  while (end > begin && isspace(str[end - 1])) {
+    --end;
+  }
+  return str.substr(begin, end - begin);
+}
+
+
+// Whether the Accept-Encoding header |value| accepts gzip: it has to
+// list it, or "*", without "q=0". An explicit gzip takes precedence
+// over "*".
+bool AcceptsGzip(const string& value) {
+  bool any_accepted(false);
+  size_t begin(0);
+  while (begin <= value.size()) {
+    size_t end(value.find(',', begin));
+    if (end == string::npos) {
+      end = value.size();
+    }
+    const string element(value.substr(begin, end - begin));
+    begin = end + 1;
+
+    const size_t params(element.find(';'));
+    string coding(Trim(element.substr(0, params)));
+    for (char& c : coding) {
+      c = tolower(c);
+    }
+    double quality(1);
+    if (params != string::npos) {
+      const string param(Trim(element.substr(params + 1)));
+      if (param.size() > 2 && tolower(param[0]) == 'q' && param[1] == '=') {
+        quality = strtod(param.c_str() + 2, nullptr);
+      }
+    }
+
+    if (coding == "gzip" || coding == "x-gzip") {
+      return quality > 0;
+    }
+    if (coding == "*") {
+      any_accepted = quality > 0;
+    }
+  }
+  return any_accepted;
+}
+
+
 }  // namespace
 
 
-JsonOutput::JsonOutput(libevent::Base* base) : base_(CHECK_NOTNULL(base)) {
+JsonOutput::JsonOutput(util::Executor* executor)
+    : executor_(CHECK_NOTNULL(executor)),
+      gzip_min_bytes_(FLAGS_json_reply_gzip_min_bytes) {
 }
 
 
 void JsonOutput::SendJsonReply(evhttp_request* req, int http_status,
                                const JsonObject& json) {
-  CHECK_EQ(evhttp_add_header(evhttp_request_get_output_headers(req),
-                             "Content-Type", kJsonContentType),
+  const char* const body(json.ToString());
+  CHECK_EQ(evbuffer_add(evhttp_request_get_output_buffer(req), body,
+                        strlen(body)),
            0);
-  if (http_status == HTTP_SERVUNAVAIL) {
-    CHECK_EQ(evhttp_add_header(evhttp_request_get_output_headers(req),
-                               "Retry-After", "10"),
-             0);
+  SendWrittenJsonReply(req, http_status);
+}
+
+
+void JsonOutput::SendWrittenJsonReply(evhttp_request* req, int http_status) {
+  SendWrittenReply(req, http_status, kJsonContentType);
+}
+
+
+void JsonOutput::SendWrittenReply(evhttp_request* req, int http_status,
+                                  const char* content_type) {
+  const size_t length(
+      evbuffer_get_length(evhttp_request_get_output_buffer(req)));
+  if (!ShouldGzip(req, length)) {
+    AddHeaders(req, http_status, content_type, length, false);
+    return SendReply(req, http_status, length);
+  }
+
+  if (!libevent::Base::OnEventThread()) {
+    return GzipWrittenReply(req, http_status, content_type);
+  }
+  // Don't hold up the event loop while compressing.
+  executor_->Add([this, req, http_status, content_type]() {
+    GzipWrittenReply(req, http_status, content_type);
+  });
+}
+
+
+void JsonOutput::SendJsonReply(evhttp_request* req, int http_status,
+                               const shared_ptr<const JsonBody>& body) {
+  CHECK(body);
+  if (!ShouldGzip(req, body->json().size())) {
+    return SendSharedReply(req, http_status, body, false);
+  }
+
+  if (body->HasGzipped() || !libevent::Base::OnEventThread()) {
+    return SendSharedReply(req, http_status, body, true);
+  }
+  // Compressing it is only done once, but still not on the event loop.
+  executor_->Add([this, req, http_status, body]() {
+    SendSharedReply(req, http_status, body, true);
+  });
+}
+
+
+bool JsonOutput::StartChunkedJsonReply(evhttp_request* req,
+                                       int http_status) {
+  // Chunked replies are meant to be big ones.
+  const size_t json_length(std::numeric_limits<size_t>::max());
+  const bool gzipped(ShouldGzip(req, json_length));
+  AddHeaders(req, http_status, kJsonContentType, json_length, gzipped);
+  evhttp_send_reply_start(req, http_status, /*reason*/ NULL);
+  return gzipped;
+}
+
+
+void JsonOutput::EndChunkedJsonReply(evhttp_request* req, int http_status,
+                                     size_t body_length) {
+  CountReply(req, http_status);
+  const string logstr(VLOG_IS_ON(1)
+                          ? LogRequest(req, http_status, body_length)
+                          : string());
+  evhttp_send_reply_end(req);
+
+  if (!logstr.empty()) {
+    VLOG(1) << logstr;
+  }
+}
+
+
+void JsonOutput::SendEmptyReply(evhttp_request* req, int http_status) {
+  SendReply(req, http_status, 0);
+}
+
+
+bool JsonOutput::ShouldGzip(evhttp_request* req, size_t length) const {
+  if (gzip_min_bytes_ <= 0 || length < static_cast<size_t>(gzip_min_bytes_)) {
+    return false;
   }
-  const string resp_body(json.ToString());
-  CHECK_GT(evbuffer_add_printf(evhttp_request_get_output_buffer(req), "%s",
-                               resp_body.c_str()),
+  const char* const accept_encoding(evhttp_find_header(
+      evhttp_request_get_input_headers(req), "Accept-Encoding"));
+  return accept_encoding && AcceptsGzip(accept_encoding);
+}
+
+
+void JsonOutput::GzipWrittenReply(evhttp_request* req, int http_status,
+                                  const char* content_type) {
+  evbuffer* const output(evhttp_request_get_output_buffer(req));
+  const size_t body_length(evbuffer_get_length(output));
+  string gzipped(util::Gzip(output));
+  const size_t gzipped_length(gzipped.size());
+  CHECK_EQ(evbuffer_drain(output, body_length), 0);
+  libevent::AddStringToBuffer(output, move(gzipped));
+
+  AddHeaders(req, http_status, content_type, body_length, true);
+  SendReply(req, http_status, gzipped_length);
+}
+
+
+void JsonOutput::SendSharedReply(evhttp_request* req, int http_status,
+                                 const shared_ptr<const JsonBody>& body,
+                                 bool gzipped) {
+  const string& data(gzipped ? body->Gzipped() : body->json());
+  AddHeaders(req, http_status, kJsonContentType, body->json().size(),
+             gzipped);
+  CHECK_EQ(evbuffer_add_reference(evhttp_request_get_output_buffer(req),
+                                  data.data(), data.size(),
+                                  &ReleaseSharedBody,
+                                  new shared_ptr<const JsonBody>(body)),
            0);
+  SendReply(req, http_status, data.size());
+}
+
 
-  const string logstr(LogRequest(req, http_status, resp_body.size()));
-  const auto send_reply([req, http_status, logstr]() {
+void JsonOutput::AddHeaders(evhttp_request* req, int http_status,
+                            const char* content_type, size_t body_length,
+                            bool gzipped) {
+  evkeyvalq* const headers(evhttp_request_get_output_headers(req));
+  CHECK_EQ(evhttp_add_header(headers, "Content-Type", content_type), 0);
+  if (gzip_min_bytes_ > 0 &&
+      body_length >= static_cast<size_t>(gzip_min_bytes_)) {
+    // Whether or not it was gzipped this time, it depends on that.
+    CHECK_EQ(evhttp_add_header(headers, "Vary", "Accept-Encoding"), 0);
+  }
+  if (gzipped) {
+    CHECK_EQ(evhttp_add_header(headers, "Content-Encoding", "gzip"), 0);
+  }
+  if (http_status == HTTP_SERVUNAVAIL) {
+    CHECK_EQ(evhttp_add_header(headers, "Retry-After", "10"), 0);
+  }
+}
+
+
+void JsonOutput::SendReply(evhttp_request* req, int http_status,
+                           size_t body_length) {
+  CountReply(req, http_status);
+  if (!VLOG_IS_ON(1)) {
+    libevent::Base::RunOnRequestLoop(req, [req, http_status]() {
+      evhttp_send_reply(req, http_status, /*reason*/ NULL, /*databuf*/ NULL);
+    });
+    return;
+  }
+
+  const string logstr(LogRequest(req, http_status, body_length));
+  libevent::Base::RunOnRequestLoop(req, [req, http_status, logstr]() {
     evhttp_send_reply(req, http_status, /*reason*/ NULL, /*databuf*/ NULL);
 
     VLOG(1) << logstr;
   });
-
-  if (!libevent::Base::OnEventThread()) {
-    base_->Add(send_reply);
-  } else {
-    send_reply();
-  }
 }
 
 
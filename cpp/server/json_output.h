@@ -1,6 +1,7 @@
 #ifndef CERT_TRANS_SERVER_JSON_OUTPUT_H_
 #define CERT_TRANS_SERVER_JSON_OUTPUT_H_
 
+#include <memory>
 #include <string>
 
 #include "base/macros.h"
@@ -8,25 +9,74 @@
 struct evhttp_request;
 class JsonObject;
 
+namespace util {
+class Executor;
+}  // namespace util
+
 namespace cert_trans {
-namespace libevent {
-class Base;
-}  // namespace libevent
+
+class JsonBody;
 
 
+// The replies are sent on the event loop that received the request.
+//
+// Replies of at least --json_reply_gzip_min_bytes are sent gzipped to
+// the clients that accept it. Compressing is not done on an event loop:
+// replies sent from one are compressed on |executor| first.
 class JsonOutput {
  public:
-  JsonOutput(libevent::Base* base);
+  explicit JsonOutput(util::Executor* executor);
 
   void SendJsonReply(evhttp_request* req, int http_status,
                      const JsonObject& json);
 
+  // Sends the JSON that was written into the output buffer of |req|,
+  // with a util::JsonWriter.
+  void SendWrittenJsonReply(evhttp_request* req, int http_status);
+  // Same, for a body of |content_type| that isn't JSON.
+  void SendWrittenReply(evhttp_request* req, int http_status,
+                        const char* content_type);
+
+  // Sends |body| by reference rather than copying it into the reply,
+  // so that many replies can share it, and its gzipped version.
+  void SendJsonReply(evhttp_request* req, int http_status,
+                     const std::shared_ptr<const JsonBody>& body);
+
+  // For a reply of which the JSON body is sent in chunks as it is
+  // written, with evhttp_send_reply_chunk(): sends the headers, and
+  // returns whether the chunks must make a gzip stream. This and
+  // EndChunkedJsonReply() must be called on the event loop of |req|.
+  bool StartChunkedJsonReply(evhttp_request* req, int http_status);
+  // |body_length| is the total of the chunks sent.
+  void EndChunkedJsonReply(evhttp_request* req, int http_status,
+                           size_t body_length);
+
+  // Sends a reply without a body, such as 304 (Not Modified).
+  void SendEmptyReply(evhttp_request* req, int http_status);
 
   void SendError(evhttp_request* req, int http_status,
                  const std::string& error_msg);
 
  private:
-  libevent::Base* const base_;
+  // Whether a body of |length| bytes should be sent gzipped, in reply
+  // to |req|.
+  bool ShouldGzip(evhttp_request* req, size_t length) const;
+  // Replaces the JSON in the output buffer of |req| with its gzipped
+  // version, and sends it.
+  void GzipWrittenReply(evhttp_request* req, int http_status,
+                        const char* content_type);
+  // Sends |body|, or its gzipped version, by reference.
+  void SendSharedReply(evhttp_request* req, int http_status,
+                       const std::shared_ptr<const JsonBody>& body,
+                       bool gzipped);
+  // |body_length| is that of the uncompressed body.
+  void AddHeaders(evhttp_request* req, int http_status,
+                  const char* content_type, size_t body_length,
+                  bool gzipped);
+  void SendReply(evhttp_request* req, int http_status, size_t body_length);
+
+  util::Executor* const executor_;
+  const int gzip_min_bytes_;
 
   DISALLOW_COPY_AND_ASSIGN(JsonOutput);
 };
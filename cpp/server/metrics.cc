@@ -3,11 +3,14 @@
 #include <cstring>
 #include <event2/buffer.h>
 #include <event2/http.h>
-#include <sstream>
+#include <functional>
+#include <ostream>
+#include <streambuf>
 
 #include "monitoring/prometheus/exporter.h"
+#include "util/executor.h"
+#include "util/libevent_wrapper.h"
 
-using std::ostringstream;
 using std::strncmp;
 
 namespace cert_trans {
@@ -19,33 +22,67 @@ const char kPrometheusProtoContentType[] =
 const size_t kPrometheusProtoContentTypeLen =
     std::strlen(kPrometheusProtoContentType);
 
+
+// Appends whatever is written to it to an evbuffer, so that the reply
+// doesn't have to be built up in memory and then copied.
+class EvbufferStreambuf : public std::streambuf {
+ public:
+  explicit EvbufferStreambuf(evbuffer* buffer) : buffer_(buffer) {
+  }
+
+ protected:
+  std::streamsize xsputn(const char* s, std::streamsize n) override {
+    return evbuffer_add(buffer_, s, n) == 0 ? n : 0;
+  }
+
+  int_type overflow(int_type c) override {
+    if (traits_type::eq_int_type(c, traits_type::eof())) {
+      return traits_type::not_eof(c);
+    }
+    const char ch(traits_type::to_char_type(c));
+    return evbuffer_add(buffer_, &ch, 1) == 0 ? c : traits_type::eof();
+  }
+
+ private:
+  evbuffer* const buffer_;
+};
+
+
+void WriteMetrics(evhttp_request* req, bool as_proto) {
+  EvbufferStreambuf buf(evhttp_request_get_output_buffer(req));
+  std::ostream os(&buf);
+  if (as_proto) {
+    ExportMetricsToPrometheus(&os);
+  } else {
+    ExportMetricsToHtml(&os);
+  }
+
+  libevent::Base::RunOnRequestLoop(req, [req]() {
+    evhttp_send_reply(req, HTTP_OK, /*reason*/ nullptr, /*databuf*/ nullptr);
+  });
+}
+
+
 }  // namespace
 
 
-void ExportPrometheusMetrics(evhttp_request* req) {
+void ExportPrometheusMetrics(util::Executor* executor, evhttp_request* req) {
   if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
     evhttp_send_reply(req, HTTP_BADMETHOD, /*reason*/ nullptr,
                       /*databuf*/ nullptr);
     return;
   }
-  ostringstream oss;
   const char* req_accept(
       evhttp_find_header(evhttp_request_get_input_headers(req), "Accept"));
-  if (req_accept &&
-      std::strncmp(req_accept, kPrometheusProtoContentType,
-                   kPrometheusProtoContentTypeLen) == 0) {
-    evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type",
-                      kPrometheusProtoContentType);
-    ExportMetricsToPrometheus(&oss);
-  } else {
-    evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type",
-                      "text/html");
-    ExportMetricsToHtml(&oss);
-  }
+  const bool as_proto(req_accept &&
+                      std::strncmp(req_accept, kPrometheusProtoContentType,
+                                   kPrometheusProtoContentTypeLen) == 0);
+  evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type",
+                    as_proto ? kPrometheusProtoContentType : "text/html");
 
-  evbuffer_add(evhttp_request_get_output_buffer(req), oss.str().data(),
-               oss.str().size());
-  evhttp_send_reply(req, HTTP_OK, /*reason*/ nullptr, /*databuf*/ nullptr);
+  // Collecting and serializing the metrics can take a while, keep it off
+  // the event loop.
+  executor->Add(std::bind(&WriteMetrics, req, as_proto));
 }
 
 
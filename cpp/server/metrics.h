@@ -3,10 +3,16 @@
 
 struct evhttp_request;
 
+namespace util {
+class Executor;
+}  // namespace util
+
 namespace cert_trans {
 
 
-void ExportPrometheusMetrics(evhttp_request* req);
+// Replies to |req| with the metrics, which are collected and written
+// out on |executor|.
+void ExportPrometheusMetrics(util::Executor* executor, evhttp_request* req);
 
 
 }  // namespace cert_trans
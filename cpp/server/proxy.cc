@@ -2,9 +2,11 @@
 
 #include <algorithm>
 #include <event2/buffer.h>
+#include <event2/event.h>
 #include <event2/http.h>
 #include <event2/http_compat.h>
 #include <event2/keyvalq_struct.h>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <string>
 #include <unordered_set>
@@ -18,19 +20,39 @@
 
 using ct::ClusterNodeState;
 using std::bind;
+using std::chrono::duration;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::function;
 using std::getline;
+using std::lock_guard;
 using std::make_pair;
+using std::make_shared;
+using std::move;
+using std::mutex;
 using std::pair;
 using std::placeholders::_1;
 using std::rand;
+using std::shared_ptr;
 using std::string;
 using std::stringstream;
 using std::unique_ptr;
 using std::unordered_set;
 using std::vector;
+using std::to_string;
 using util::Executor;
+using util::Status;
 using util::Task;
 
+DEFINE_int32(proxy_hedge_delay_ms, 0,
+             "if non-zero, proxied GET requests that haven't been answered "
+             "after this many milliseconds are also sent to another node, "
+             "and the first reply is used");
+DEFINE_int32(proxy_stream_buffer_bytes, 1 << 20,
+             "proxied replies are streamed to the client as they arrive, "
+             "reading from the node being paused while more than this many "
+             "bytes wait to be written out. 0 buffers whole replies");
+
 namespace cert_trans {
 namespace {
 
@@ -44,17 +66,256 @@ static Counter<string, int>* total_proxied_responses(
                               "and status code."));
 
 
-void ProxyRequestDone(libevent::Base* base, JsonOutput* output,
-                      evhttp_request* request, const string& path,
-                      UrlFetcher::Response* response, Task* task) {
-  CHECK_NOTNULL(request);
-  CHECK_NOTNULL(task);
-  unique_ptr<UrlFetcher::Response> response_deleter(CHECK_NOTNULL(response));
+static Counter<string>* total_hedged_proxied_requests(
+    Counter<string>::New("total_hedged_proxied_requests", "path",
+                         "Number of proxied API requests also sent to a "
+                         "second node, by path."));
+
+// The weight of each new sample in the moving average of the latency
+// of a node.
+const double kLatencyDecay = 0.2;
+
+
+string NodeKey(const ClusterNodeState& node) {
+  return node.hostname() + ":" + to_string(node.log_port());
+}
+
+
+// A request being proxied, to one node or (when hedged) two. The
+// first reply to come back is the one sent, unless it's an error and
+// the other one is still pending.
+struct ProxiedRequest {
+  ProxiedRequest(JsonOutput* output, UrlFetcher* fetcher, Executor* executor,
+                 const shared_ptr<ProxyLoadBalancer>& balancer,
+                 evhttp_request* req, vector<ClusterNodeState> nodes,
+                 const UrlFetcher::Request& fetcher_req)
+      : output(output),
+        fetcher(fetcher),
+        executor(executor),
+        balancer(balancer),
+        req(req),
+        nodes(move(nodes)),
+        fetcher_req(fetcher_req),
+        replied(false),
+        pending(0),
+        first_node(0) {
+  }
+
+  JsonOutput* const output;
+  UrlFetcher* const fetcher;
+  Executor* const executor;
+  const shared_ptr<ProxyLoadBalancer> balancer;
+  evhttp_request* const req;
+  const vector<ClusterNodeState> nodes;
+  // Without the host and port, which are set for each attempt.
+  const UrlFetcher::Request fetcher_req;
+
+  mutex lock;
+  bool replied;
+  int pending;
+  size_t first_node;
+};
+
+
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+// Streams the reply to one attempt of a ProxiedRequest to the client
+// as it arrives, if it is the first one to get a reply; the reply to
+// another attempt is dropped. Reading from the node is paused while
+// more than --proxy_stream_buffer_bytes of it wait to be written to
+// the client.
+class ReplyStream : public UrlFetcher::BodyStream,
+                    public std::enable_shared_from_this<ReplyStream> {
+ public:
+  explicit ReplyStream(const shared_ptr<ProxiedRequest>& proxied)
+      : proxied_(proxied),
+        base_(nullptr),
+        started_(false),
+        closed_(false),
+        queued_bytes_(0),
+        unwritten_bytes_(0) {
+  }
+
+  // Whether this took over the reply to the client, in which case
+  // Finish() has to be called once the attempt is done.
+  bool Started() const {
+    lock_guard<mutex> lock(lock_);
+    return started_;
+  }
+
+  void OnHeaders(const UrlFetcher::Response& resp) override {
+    {
+      lock_guard<mutex> lock(proxied_->lock);
+      if (proxied_->replied) {
+        return;
+      }
+      proxied_->replied = true;
+    }
+
+    const string path(proxied_->fetcher_req.url.Path());
+    total_proxied_requests->Increment(path);
+    total_proxied_responses->Increment(path, resp.status_code);
+
+    UrlFetcher::Headers headers(resp.headers);
+    FilterHeaders(&headers);
+    // The body was decoded already, evhttp frames it again.
+    headers.erase("Transfer-Encoding");
+
+    evhttp_request* const req(proxied_->req);
+    base_ = evhttp_connection_get_base(evhttp_request_get_connection(req));
+    {
+      lock_guard<mutex> lock(lock_);
+      started_ = true;
+    }
+    const shared_ptr<ReplyStream> self(shared_from_this());
+    const int status_code(resp.status_code);
+    libevent::Base::RunOnLoop(base_, [self, headers, status_code]() {
+      self->Start(headers, status_code);
+    });
+  }
+
+  bool OnBody(evbuffer* chunk, const function<void()>& resume) override {
+    const size_t length(evbuffer_get_length(chunk));
+    evbuffer* data(nullptr);
+    bool more(true);
+    {
+      lock_guard<mutex> lock(lock_);
+      if (started_ && !closed_) {
+        data = CHECK_NOTNULL(evbuffer_new());
+        queued_bytes_ += length;
+        if (queued_bytes_ > static_cast<size_t>(
+                                FLAGS_proxy_stream_buffer_bytes)) {
+          resume_ = resume;
+          more = false;
+        }
+      }
+    }
+    if (!data) {
+      // Not the reply sent, or there is no one to send it to anymore.
+      CHECK_EQ(0, evbuffer_drain(chunk, length));
+      return true;
+    }
+
+    CHECK_EQ(0, evbuffer_add_buffer(data, chunk));
+    const shared_ptr<ReplyStream> self(shared_from_this());
+    libevent::Base::RunOnLoop(base_, [self, data, length]() {
+      self->SendChunk(data, length);
+    });
+    return more;
+  }
+
+  void Finish(const Status& status) {
+    LOG_IF(WARNING, !status.ok()) << "Proxied reply to "
+                                  << proxied_->fetcher_req.url.PathQuery()
+                                  << " cut short: " << status;
+    const shared_ptr<ReplyStream> self(shared_from_this());
+    libevent::Base::RunOnLoop(base_,
+                              [self, status]() { self->End(status.ok()); });
+  }
+
+ private:
+  // The following methods run on the event loop of the request.
+  void Start(const UrlFetcher::Headers& headers, int status_code) {
+    evhttp_request* const req(proxied_->req);
+    for (const auto& header : headers) {
+      CHECK_EQ(evhttp_add_header(evhttp_request_get_output_headers(req),
+                                 header.first.c_str(), header.second.c_str()),
+               0);
+    }
+    evhttp_connection* const conn(evhttp_request_get_connection(req));
+    if (conn) {
+      evhttp_connection_set_closecb(conn, &ReplyStream::OnClose, this);
+    }
+    evhttp_send_reply_start(req, status_code, /*reason*/ NULL);
+  }
+
+  void SendChunk(evbuffer* data, size_t length) {
+    evhttp_request* const req(proxied_->req);
+    // The request loses its connection if the client goes away.
+    if (evhttp_request_get_connection(req)) {
+      unwritten_bytes_ += length;
+      evhttp_send_reply_chunk_with_cb(req, data, &ReplyStream::OnWritten,
+                                      this);
+    } else {
+      Closed();
+    }
+    evbuffer_free(data);
+  }
+
+  // Everything sent so far was written out.
+  static void OnWritten(evhttp_connection*, void* stream) {
+    ReplyStream* const self(static_cast<ReplyStream*>(stream));
+    function<void()> resume;
+    {
+      lock_guard<mutex> lock(self->lock_);
+      self->queued_bytes_ -= self->unwritten_bytes_;
+      self->unwritten_bytes_ = 0;
+      resume.swap(self->resume_);
+    }
+    if (resume) {
+      resume();
+    }
+  }
+
+  static void OnClose(evhttp_connection*, void* stream) {
+    static_cast<ReplyStream*>(stream)->Closed();
+  }
+
+  // Lets the rest of the reply be read, and dropped.
+  void Closed() {
+    function<void()> resume;
+    {
+      lock_guard<mutex> lock(lock_);
+      closed_ = true;
+      resume.swap(resume_);
+    }
+    if (resume) {
+      resume();
+    }
+  }
+
+  void End(bool complete) {
+    evhttp_request* const req(proxied_->req);
+    evhttp_connection* const conn(evhttp_request_get_connection(req));
+    if (conn) {
+      evhttp_connection_set_closecb(conn, nullptr, nullptr);
+      if (!complete) {
+        // Rather than have the client take a truncated reply for a
+        // complete one.
+        return evhttp_connection_free(conn);
+      }
+    }
+    // Also frees |req| if it has lost its connection.
+    evhttp_send_reply_end(req);
+  }
+
+  const shared_ptr<ProxiedRequest> proxied_;
+  // The event loop of the request, set before |started_|.
+  event_base* base_;
+
+  mutable mutex lock_;
+  bool started_;
+  bool closed_;
+  // Read from the node, and not written to the client yet.
+  size_t queued_bytes_;
+  // Set while reading from the node is paused.
+  function<void()> resume_;
 
+  // Only used on the event loop of the request: passed on to evhttp,
+  // but not written out yet.
+  size_t unwritten_bytes_;
+
+  DISALLOW_COPY_AND_ASSIGN(ReplyStream);
+};
+#endif  // LIBEVENT_VERSION_NUMBER >= 0x02010100
+
+
+void SendProxiedReply(JsonOutput* output, evhttp_request* request,
+                      const string& path, UrlFetcher::Response* response,
+                      const util::Status& status) {
   total_proxied_requests->Increment(path);
   total_proxied_responses->Increment(path, response->status_code);
 
-  if (!task->status().ok()) {
+  if (!status.ok()) {
     return output->SendError(request, HTTP_INTERNAL,
                              "Proxied request failed.");
   }
@@ -68,18 +329,98 @@ void ProxyRequestDone(libevent::Base* base, JsonOutput* output,
                                it->first.c_str(), it->second.c_str()),
              0);
   }
-  CHECK_GT(evbuffer_add_printf(evhttp_request_get_output_buffer(request), "%s",
-                               response->body.c_str()),
-           -1);
+  libevent::AddStringToBuffer(evhttp_request_get_output_buffer(request),
+                              move(response->body));
 
   const int response_code(response->status_code);
-  base->Add([request, response_code]() {
+  libevent::Base::RunOnRequestLoop(request, [request, response_code]() {
     evhttp_send_reply(request, response_code, /*reason*/ NULL,
                       /*databuf*/ NULL);
   });
 }
 
 
+// |stream| is null if the reply is not streamed.
+void AttemptDone(const shared_ptr<ProxiedRequest>& proxied, size_t node,
+                 const steady_clock::time_point& started,
+                 const shared_ptr<UrlFetcher::BodyStream>& stream,
+                 UrlFetcher::Response* response, Task* task) {
+  unique_ptr<Task> task_deleter(CHECK_NOTNULL(task));
+  unique_ptr<UrlFetcher::Response> response_deleter(CHECK_NOTNULL(response));
+  proxied->balancer->Finished(proxied->nodes[node],
+                              steady_clock::now() - started);
+
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+  ReplyStream* const reply_stream(static_cast<ReplyStream*>(stream.get()));
+  if (reply_stream && reply_stream->Started()) {
+    {
+      lock_guard<mutex> lock(proxied->lock);
+      --proxied->pending;
+    }
+    return reply_stream->Finish(task->status());
+  }
+#endif
+
+  {
+    lock_guard<mutex> lock(proxied->lock);
+    --proxied->pending;
+    if (proxied->replied || (!task->status().ok() && proxied->pending > 0)) {
+      return;
+    }
+    proxied->replied = true;
+  }
+
+  SendProxiedReply(proxied->output, proxied->req,
+                   proxied->fetcher_req.url.Path(), response, task->status());
+}
+
+
+void SendAttempt(const shared_ptr<ProxiedRequest>& proxied, size_t node) {
+  const ClusterNodeState& target(proxied->nodes[node]);
+  UrlFetcher::Request fetcher_req(proxied->fetcher_req);
+  fetcher_req.url.SetHost(target.hostname());
+  fetcher_req.url.SetPort(target.log_port());
+  VLOG(1) << "Proxying request to " << fetcher_req.url.Host() << ":"
+          << fetcher_req.url.Port() << fetcher_req.url.PathQuery();
+
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+  if (FLAGS_proxy_stream_buffer_bytes > 0) {
+    fetcher_req.body_stream = make_shared<ReplyStream>(proxied);
+  }
+#endif
+
+  proxied->balancer->Started(target);
+  UrlFetcher::Response* resp(new UrlFetcher::Response);
+  proxied->fetcher->Fetch(fetcher_req, resp,
+                          new Task(bind(&AttemptDone, proxied, node,
+                                        steady_clock::now(),
+                                        fetcher_req.body_stream, resp, _1),
+                                   proxied->executor));
+}
+
+
+void MaybeHedge(const shared_ptr<ProxiedRequest>& proxied, Task* task) {
+  unique_ptr<Task> task_deleter(CHECK_NOTNULL(task));
+  if (!task->status().ok()) {
+    return;
+  }
+
+  size_t first_node;
+  {
+    lock_guard<mutex> lock(proxied->lock);
+    if (proxied->replied) {
+      return;
+    }
+    ++proxied->pending;
+    first_node = proxied->first_node;
+  }
+
+  total_hedged_proxied_requests->Increment(proxied->fetcher_req.url.Path());
+  SendAttempt(proxied,
+              proxied->balancer->Pick(proxied->nodes, first_node));
+}
+
+
 }  // namespace
 
 
@@ -111,14 +452,13 @@ void FilterHeaders(UrlFetcher::Headers* headers) {
 }
 
 
-Proxy::Proxy(libevent::Base* base, JsonOutput* output,
-             const GetFreshNodesFunction& get_fresh_nodes, UrlFetcher* fetcher,
-             Executor* executor)
-    : base_(CHECK_NOTNULL(base)),
-      output_(CHECK_NOTNULL(output)),
+Proxy::Proxy(JsonOutput* output, const GetFreshNodesFunction& get_fresh_nodes,
+             UrlFetcher* fetcher, Executor* executor)
+    : output_(CHECK_NOTNULL(output)),
       get_fresh_nodes_(get_fresh_nodes),
       fetcher_(CHECK_NOTNULL(fetcher)),
-      executor_(CHECK_NOTNULL(executor)) {
+      executor_(CHECK_NOTNULL(executor)),
+      balancer_(make_shared<ProxyLoadBalancer>()) {
   CHECK(get_fresh_nodes_);
 }
 
@@ -126,17 +466,14 @@ Proxy::Proxy(libevent::Base* base, JsonOutput* output,
 void Proxy::ProxyRequest(evhttp_request* req) const {
   CHECK_NOTNULL(req);
 
-  const vector<ClusterNodeState> fresh_nodes(get_fresh_nodes_());
+  vector<ClusterNodeState> fresh_nodes(get_fresh_nodes_());
   if (fresh_nodes.empty()) {
     return output_->SendError(req, HTTP_SERVUNAVAIL,
                               "No node able to serve request.");
   }
-  const ClusterNodeState& target(fresh_nodes[rand() % fresh_nodes.size()]);
 
   URL url(evhttp_request_uri(req));
   url.SetProtocol("http");
-  url.SetHost(target.hostname());
-  url.SetPort(target.log_port());
 
   UrlFetcher::Request fetcher_req(url);
 
@@ -174,13 +511,87 @@ void Proxy::ProxyRequest(evhttp_request* req) const {
                                body_length));
     fetcher_req.body.swap(body);
   }
-  VLOG(1) << "Proxying request to " << url.Host() << ":" << url.Port()
-          << url.PathQuery();
-  UrlFetcher::Response* resp(new UrlFetcher::Response);
-  fetcher_->Fetch(fetcher_req, resp,
-                  new Task(bind(&ProxyRequestDone, base_, output_, req,
-                                url.Path(), resp, _1),
-                           executor_));
+
+  const bool hedge(FLAGS_proxy_hedge_delay_ms > 0 &&
+                   fetcher_req.verb == UrlFetcher::Verb::GET &&
+                   fresh_nodes.size() > 1);
+  const size_t node(balancer_->Pick(fresh_nodes, fresh_nodes.size()));
+  const shared_ptr<ProxiedRequest> proxied(
+      make_shared<ProxiedRequest>(output_, fetcher_, executor_, balancer_, req,
+                                  move(fresh_nodes), fetcher_req));
+  proxied->pending = 1;
+  proxied->first_node = node;
+  SendAttempt(proxied, node);
+
+  if (hedge) {
+    executor_->Delay(milliseconds(FLAGS_proxy_hedge_delay_ms),
+                     new Task(bind(&MaybeHedge, proxied, _1), executor_));
+  }
+}
+
+
+size_t ProxyLoadBalancer::Pick(const vector<ClusterNodeState>& nodes,
+                               size_t exclude) {
+  CHECK(!nodes.empty());
+  if (nodes.size() == 1) {
+    return 0;
+  }
+
+  // Pick two distinct nodes among the others, at random.
+  const size_t num_candidates(exclude < nodes.size() ? nodes.size() - 1
+                                                     : nodes.size());
+  size_t first(rand() % num_candidates);
+  size_t second(num_candidates > 1 ? rand() % (num_candidates - 1) : first);
+  if (num_candidates > 1 && second >= first) {
+    ++second;
+  }
+  if (first >= exclude) {
+    ++first;
+  }
+  if (second >= exclude) {
+    ++second;
+  }
+
+  lock_guard<mutex> lock(lock_);
+  return BetterLocked(nodes[second], nodes[first]) ? second : first;
+}
+
+
+void ProxyLoadBalancer::Started(const ClusterNodeState& node) {
+  lock_guard<mutex> lock(lock_);
+  ++loads_[NodeKey(node)].outstanding;
+}
+
+
+void ProxyLoadBalancer::Finished(const ClusterNodeState& node,
+                                 const steady_clock::duration& latency) {
+  const double latency_ms(duration<double, std::milli>(latency).count());
+  lock_guard<mutex> lock(lock_);
+  Load* const load(&loads_[NodeKey(node)]);
+  --load->outstanding;
+  load->latency_ms = load->latency_ms > 0
+                         ? (1 - kLatencyDecay) * load->latency_ms +
+                               kLatencyDecay * latency_ms
+                         : latency_ms;
+}
+
+
+bool ProxyLoadBalancer::BetterLocked(const ClusterNodeState& a,
+                                     const ClusterNodeState& b) {
+  const Load& load_a(loads_[NodeKey(a)]);
+  const Load& load_b(loads_[NodeKey(b)]);
+  // A node that hasn't been tried yet counts as fast, so that it gets
+  // a chance.
+  const double score_a((load_a.outstanding + 1) * load_a.latency_ms);
+  const double score_b((load_b.outstanding + 1) * load_b.latency_ms);
+  if (score_a != score_b) {
+    return score_a < score_b;
+  }
+  if (load_a.outstanding != load_b.outstanding) {
+    return load_a.outstanding < load_b.outstanding;
+  }
+  return a.current_serving_sth().tree_size() >
+         b.current_serving_sth().tree_size();
 }
 
 
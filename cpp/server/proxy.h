@@ -1,7 +1,13 @@
 #ifndef CERT_TRANS_SERVER_PROXY_H_
 #define CERT_TRANS_SERVER_PROXY_H_
 
+#include <chrono>
 #include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <string>
 #include <vector>
 
 #include "base/macros.h"
@@ -22,9 +28,6 @@ class Task;
 
 
 namespace cert_trans {
-namespace libevent {
-class Base;
-}  // namespace libevent
 
 class JsonOutput;
 
@@ -33,24 +36,68 @@ class JsonOutput;
 void FilterHeaders(UrlFetcher::Headers* headers);
 
 
+// Keeps track of the requests outstanding to each node, and of how
+// long they took recently, to pick the least loaded node to proxy a
+// request to. This class is thread-safe.
+//
+// Visible for testing.
+class ProxyLoadBalancer {
+ public:
+  ProxyLoadBalancer() = default;
+
+  // Returns the index in |nodes| (which must not be empty) of the node
+  // to send the next request to. Two random nodes other than the one
+  // at |exclude| (unless there is no other) are compared, and the one
+  // with the least outstanding requests, weighted by its latency,
+  // wins, or else the one with the largest serving tree.
+  size_t Pick(const std::vector<ct::ClusterNodeState>& nodes,
+              size_t exclude);
+
+  void Started(const ct::ClusterNodeState& node);
+  void Finished(const ct::ClusterNodeState& node,
+                const std::chrono::steady_clock::duration& latency);
+
+ private:
+  struct Load {
+    Load() : outstanding(0), latency_ms(0) {
+    }
+
+    int outstanding;
+    // Moving average of the latency of the requests, zero until the
+    // first one is done.
+    double latency_ms;
+  };
+
+  // Whether |a| is a better target than |b|.
+  bool BetterLocked(const ct::ClusterNodeState& a,
+                    const ct::ClusterNodeState& b);
+
+  std::mutex lock_;
+  // By host and port.
+  std::map<std::string, Load> loads_;
+
+  DISALLOW_COPY_AND_ASSIGN(ProxyLoadBalancer);
+};
+
+
 class Proxy {
  public:
   typedef std::function<std::vector<ct::ClusterNodeState>()>
       GetFreshNodesFunction;
-  Proxy(libevent::Base* base, JsonOutput* output,
-        const GetFreshNodesFunction& get_fresh_nodes, UrlFetcher* fetcher,
-        util::Executor* executor);
+  Proxy(JsonOutput* output, const GetFreshNodesFunction& get_fresh_nodes,
+        UrlFetcher* fetcher, util::Executor* executor);
 
   virtual ~Proxy() = default;
 
   virtual void ProxyRequest(evhttp_request* req) const;
 
  private:
-  libevent::Base* const base_;
   JsonOutput* const output_;
   const GetFreshNodesFunction get_fresh_nodes_;
   UrlFetcher* const fetcher_;
   util::Executor* const executor_;
+  // Shared with the requests in flight, which can outlive this.
+  const std::shared_ptr<ProxyLoadBalancer> balancer_;
 
   DISALLOW_COPY_AND_ASSIGN(Proxy);
 };
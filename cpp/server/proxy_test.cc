@@ -3,13 +3,18 @@
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 
+#include "proto/ct.pb.h"
 #include "util/testing.h"
 
 using cert_trans::FilterHeaders;
+using cert_trans::ProxyLoadBalancer;
 using cert_trans::UrlFetcher;
+using ct::ClusterNodeState;
+using std::chrono::milliseconds;
 using std::make_pair;
 using std::shared_ptr;
 using std::string;
+using std::vector;
 
 class ProxyTest : public ::testing::Test {};
 
@@ -98,6 +103,60 @@ TEST_F(ProxyTest, TestFilterHeadersHandlesMultipleConnectionHeaders) {
 }
 
 
+vector<ClusterNodeState> MakeNodes(int num) {
+  vector<ClusterNodeState> nodes(num);
+  for (int i = 0; i < num; ++i) {
+    nodes[i].set_hostname("node" + std::to_string(i));
+    nodes[i].set_log_port(80);
+  }
+  return nodes;
+}
+
+
+TEST_F(ProxyTest, TestLoadBalancerPrefersLeastLoadedNode) {
+  const vector<ClusterNodeState> nodes(MakeNodes(2));
+  ProxyLoadBalancer balancer;
+
+  balancer.Started(nodes[0]);
+  EXPECT_EQ(1U, balancer.Pick(nodes, nodes.size()));
+
+  // Untried nodes count as fast.
+  balancer.Finished(nodes[0], milliseconds(10));
+  balancer.Started(nodes[1]);
+  EXPECT_EQ(1U, balancer.Pick(nodes, nodes.size()));
+
+  // Then the outstanding requests are weighted by latency.
+  balancer.Finished(nodes[1], milliseconds(50));
+  EXPECT_EQ(0U, balancer.Pick(nodes, nodes.size()));
+  for (int i = 0; i < 5; ++i) {
+    balancer.Started(nodes[0]);
+  }
+  EXPECT_EQ(1U, balancer.Pick(nodes, nodes.size()));
+}
+
+
+TEST_F(ProxyTest, TestLoadBalancerPrefersLargestTree) {
+  vector<ClusterNodeState> nodes(MakeNodes(2));
+  nodes[0].mutable_current_serving_sth()->set_tree_size(10);
+  nodes[1].mutable_current_serving_sth()->set_tree_size(20);
+  ProxyLoadBalancer balancer;
+
+  EXPECT_EQ(1U, balancer.Pick(nodes, nodes.size()));
+}
+
+
+TEST_F(ProxyTest, TestLoadBalancerExcludesNode) {
+  const vector<ClusterNodeState> nodes(MakeNodes(3));
+  ProxyLoadBalancer balancer;
+
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_NE(1U, balancer.Pick(nodes, 1));
+  }
+  // Unless there is no other.
+  EXPECT_EQ(0U, balancer.Pick(MakeNodes(1), 0));
+}
+
+
 int main(int argc, char** argv) {
   cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
   return RUN_ALL_TESTS();
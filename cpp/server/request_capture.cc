@@ -0,0 +1,200 @@
+#include "server/request_capture.h"
+
+#include <event2/buffer.h>
+#include <event2/http.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <utility>
+
+#include "merkletree/serial_hasher.h"
+#include "monitoring/monitoring.h"
+#include "util/protobuf_util.h"
+
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::minutes;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::unique_lock;
+using std::vector;
+
+DEFINE_string(http_capture_file, "",
+              "If set, a sample of the requests received is appended to "
+              "this file, for ct-replay to send them again.");
+DEFINE_int32(http_capture_one_in, 100,
+             "With --http_capture_file, one in every this many requests "
+             "is recorded.");
+DEFINE_bool(http_capture_bodies, false,
+            "With --http_capture_file, record the bodies of the requests "
+            "too, rather than just their hashes. Needed to replay the "
+            "submissions.");
+
+namespace cert_trans {
+namespace {
+
+
+static Counter<string>* http_captured_requests(
+    Counter<string>::New("http_captured_requests", "result",
+                         "Number of requests sampled by the capture, by "
+                         "result (\"written\", \"dropped\" when too many "
+                         "were pending, or \"expired\" when their "
+                         "connection closed before the reply)."));
+
+// Requests whose reply doesn't come in that time are given up on.
+const minutes kMaxPendingAge(10);
+const size_t kMaxPending(10000);
+
+
+}  // namespace
+
+
+RequestCapture::RequestCapture(const string& filename, int one_in,
+                               bool bodies)
+    : one_in_(one_in),
+      bodies_(bodies),
+      start_(steady_clock::now()),
+      out_(filename, std::ios::out | std::ios::app | std::ios::binary),
+      num_requests_(0),
+      exiting_(false),
+      writer_(&RequestCapture::WriteRecords, this) {
+  CHECK_GT(one_in_, 0);
+  CHECK(out_.good()) << "Could not open " << filename;
+}
+
+
+RequestCapture::~RequestCapture() {
+  {
+    lock_guard<mutex> lock(lock_);
+    exiting_ = true;
+  }
+  to_write_cv_.notify_all();
+  writer_.join();
+}
+
+
+// static
+RequestCapture* RequestCapture::Global() {
+  // Never deleted, as requests can still complete on the event loops
+  // while the process exits.
+  static RequestCapture* const capture(
+      FLAGS_http_capture_file.empty()
+          ? nullptr
+          : new RequestCapture(FLAGS_http_capture_file,
+                               FLAGS_http_capture_one_in,
+                               FLAGS_http_capture_bodies));
+  return capture;
+}
+
+
+void RequestCapture::MaybeCapture(const string& path, evhttp_request* req) {
+  if (num_requests_++ % one_in_ != 0) {
+    return;
+  }
+
+  Pending pending;
+  pending.arrival = steady_clock::now();
+  ct::CapturedRequest* const record(&pending.record);
+  record->set_arrival_us(
+      duration_cast<microseconds>(pending.arrival - start_).count());
+  record->set_path(path);
+  const char* const query(
+      evhttp_uri_get_query(evhttp_request_get_evhttp_uri(req)));
+  if (query) {
+    record->set_query(query);
+  }
+  record->set_post(evhttp_request_get_command(req) == EVHTTP_REQ_POST);
+  evbuffer* const input(evhttp_request_get_input_buffer(req));
+  const size_t body_size(evbuffer_get_length(input));
+  if (body_size > 0) {
+    const string body(
+        reinterpret_cast<const char*>(evbuffer_pullup(input, -1)),
+        body_size);
+    record->set_body_size(body_size);
+    record->set_body_sha256(Sha256Hasher::Sha256Digest(body));
+    if (bodies_) {
+      record->set_body(body);
+    }
+  }
+
+  {
+    lock_guard<mutex> lock(lock_);
+    if (pending_.size() >= kMaxPending) {
+      ExpirePending(pending.arrival);
+    }
+    if (pending_.size() >= kMaxPending) {
+      http_captured_requests->Increment("dropped");
+      return;
+    }
+    // A request still there with the same address never completed.
+    pending_[req] = std::move(pending);
+  }
+  evhttp_request_set_on_complete_cb(req, &RequestCapture::OnComplete, this);
+}
+
+
+// static
+void RequestCapture::OnComplete(evhttp_request* req, void* userdata) {
+  static_cast<RequestCapture*>(userdata)->Complete(req);
+}
+
+
+void RequestCapture::Complete(evhttp_request* req) {
+  const steady_clock::time_point now(steady_clock::now());
+  const int response_code(evhttp_request_get_response_code(req));
+  {
+    lock_guard<mutex> lock(lock_);
+    const auto it(pending_.find(req));
+    if (it == pending_.end()) {
+      return;
+    }
+    ct::CapturedRequest* const record(&it->second.record);
+    record->set_response_code(response_code);
+    record->set_latency_us(
+        duration_cast<microseconds>(now - it->second.arrival).count());
+    to_write_.emplace_back();
+    to_write_.back().Swap(record);
+    pending_.erase(it);
+  }
+  to_write_cv_.notify_one();
+}
+
+
+void RequestCapture::ExpirePending(const steady_clock::time_point& now) {
+  for (auto it = pending_.begin(); it != pending_.end();) {
+    if (now - it->second.arrival > kMaxPendingAge) {
+      http_captured_requests->Increment("expired");
+      it = pending_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+
+void RequestCapture::WriteRecords() {
+  vector<ct::CapturedRequest> records;
+  while (true) {
+    {
+      unique_lock<mutex> lock(lock_);
+      to_write_cv_.wait(lock,
+                        [this]() { return exiting_ || !to_write_.empty(); });
+      if (to_write_.empty()) {
+        return;
+      }
+      records.swap(to_write_);
+    }
+
+    for (const auto& record : records) {
+      LOG_IF(WARNING, !WriteDelimitedToOstream(record, &out_))
+          << "Could not write a captured request";
+    }
+    out_.flush();
+    http_captured_requests->IncrementBy("written", records.size());
+    records.clear();
+  }
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,78 @@
+#ifndef CERT_TRANS_SERVER_REQUEST_CAPTURE_H_
+#define CERT_TRANS_SERVER_REQUEST_CAPTURE_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "base/macros.h"
+#include "proto/ct.pb.h"
+
+struct evhttp_request;
+
+namespace cert_trans {
+
+
+// Records one in every |one_in| requests received, with their timing
+// and the code of their reply, as ct::CapturedRequest messages
+// appended to a file (each preceded by its length, see
+// WriteDelimitedTo()). ct-replay sends them again, to reproduce the
+// traffic of a log against a test server.
+//
+// The request bodies are only kept as their SHA-256 hash and size,
+// unless |bodies| is true.
+class RequestCapture {
+ public:
+  RequestCapture(const std::string& filename, int one_in, bool bodies);
+  ~RequestCapture();
+
+  // The capture set with --http_capture_file, null if there is none.
+  static RequestCapture* Global();
+
+  // Records |req|, received by the handler for |path|, once its reply
+  // is sent, if it is part of the sample. Must be called as soon as
+  // |req| is received, on the thread of its event loop, and the
+  // capture must outlive the reply.
+  void MaybeCapture(const std::string& path, evhttp_request* req);
+
+ private:
+  struct Pending {
+    std::chrono::steady_clock::time_point arrival;
+    ct::CapturedRequest record;
+  };
+
+  static void OnComplete(evhttp_request* req, void* userdata);
+  void Complete(evhttp_request* req);
+  // Drops the requests whose connection was closed before their
+  // reply, which never complete. Must be called with |lock_| held.
+  void ExpirePending(const std::chrono::steady_clock::time_point& now);
+  void WriteRecords();
+
+  const int one_in_;
+  const bool bodies_;
+  const std::chrono::steady_clock::time_point start_;
+  std::ofstream out_;
+  std::atomic<uint64_t> num_requests_;
+
+  std::mutex lock_;
+  std::unordered_map<evhttp_request*, Pending> pending_;
+  std::vector<ct::CapturedRequest> to_write_;
+  bool exiting_;
+  std::condition_variable to_write_cv_;
+
+  std::thread writer_;
+
+  DISALLOW_COPY_AND_ASSIGN(RequestCapture);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_SERVER_REQUEST_CAPTURE_H_
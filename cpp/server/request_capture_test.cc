@@ -0,0 +1,282 @@
+#include "server/request_capture.h"
+
+#include <arpa/inet.h>
+#include <event2/http.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <netinet/in.h>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "merkletree/serial_hasher.h"
+#include "util/libevent_wrapper.h"
+#include "util/protobuf_util.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace cert_trans {
+namespace {
+
+using ct::CapturedRequest;
+using google::protobuf::io::ArrayInputStream;
+using google::protobuf::io::FileInputStream;
+using std::make_shared;
+using std::ostringstream;
+using std::shared_ptr;
+using std::string;
+using std::to_string;
+using std::unique_ptr;
+using std::vector;
+
+const char kPath[] = "/ct/v1/get-entries";
+
+
+// Returns a port that was free a moment ago.
+uint16_t FreePort() {
+  const int sock(socket(AF_INET, SOCK_STREAM, 0));
+  CHECK_GE(sock, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  CHECK_EQ(0, bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
+  socklen_t addr_len(sizeof(addr));
+  CHECK_EQ(0, getsockname(sock, reinterpret_cast<sockaddr*>(&addr),
+                          &addr_len));
+  close(sock);
+  return ntohs(addr.sin_port);
+}
+
+
+// Serves |kPath| on a local port, capturing its requests with the
+// RequestCapture made by Start(). GETs are answered with 200, POSTs
+// with 400.
+class RequestCaptureTest : public ::testing::Test {
+ protected:
+  RequestCaptureTest()
+      : port_(FreePort()), base_(make_shared<libevent::Base>()) {
+  }
+
+  void SetUp() override {
+    dir_ = util::CreateTemporaryDirectory("/tmp/requestcaptureXXXXXX");
+    path_ = dir_ + "/capture";
+  }
+
+  void TearDown() override {
+    unlink(path_.c_str());
+    rmdir(dir_.c_str());
+  }
+
+  void Start(int one_in, bool bodies) {
+    capture_.reset(new RequestCapture(path_, one_in, bodies));
+    server_.reset(new libevent::HttpServer(*base_));
+    server_->Bind("127.0.0.1", port_);
+    CHECK(server_->AddHandler(kPath, [this](evhttp_request* req) {
+      capture_->MaybeCapture(kPath, req);
+      evhttp_send_reply(req, evhttp_request_get_command(req) ==
+                                     EVHTTP_REQ_POST
+                                 ? HTTP_BADREQUEST
+                                 : HTTP_OK,
+                        nullptr, nullptr);
+    }));
+    pump_.reset(new libevent::EventPumpThread(base_));
+  }
+
+  // Stops serving, and waits for the capture to be written.
+  void Stop() {
+    pump_.reset();
+    server_.reset();
+    capture_.reset();
+  }
+
+  // Sends an HTTP/1.0 request, and waits for the server to close the
+  // connection, which it does only once the capture has seen the end
+  // of the reply.
+  void Send(const string& request) {
+    const int sock(socket(AF_INET, SOCK_STREAM, 0));
+    CHECK_GE(sock, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port_);
+    CHECK_EQ(0, connect(sock, reinterpret_cast<sockaddr*>(&addr),
+                        sizeof(addr)));
+    CHECK_EQ(static_cast<ssize_t>(request.size()),
+             write(sock, request.data(), request.size()));
+    char buf[1024];
+    while (read(sock, buf, sizeof(buf)) > 0) {
+    }
+    close(sock);
+  }
+
+  void Get(const string& query) {
+    Send(string("GET ") + kPath + "?" + query + " HTTP/1.0\r\n\r\n");
+  }
+
+  void Post(const string& body) {
+    Send(string("POST ") + kPath + " HTTP/1.0\r\nContent-Length: " +
+         to_string(body.size()) + "\r\n\r\n" + body);
+  }
+
+  // The records in the capture file, which must end cleanly.
+  vector<CapturedRequest> ReadCapture() {
+    const int fd(open(path_.c_str(), O_RDONLY));
+    CHECK_GE(fd, 0);
+    vector<CapturedRequest> records;
+    {
+      FileInputStream input(fd);
+      CapturedRequest record;
+      bool clean_eof(false);
+      while (ReadDelimitedFrom(&input, &record, &clean_eof)) {
+        records.push_back(record);
+      }
+      EXPECT_TRUE(clean_eof);
+    }
+    close(fd);
+    return records;
+  }
+
+  const uint16_t port_;
+  const shared_ptr<libevent::Base> base_;
+  string dir_;
+  string path_;
+  unique_ptr<RequestCapture> capture_;
+  unique_ptr<libevent::HttpServer> server_;
+  unique_ptr<libevent::EventPumpThread> pump_;
+};
+
+
+TEST_F(RequestCaptureTest, CapturesOneInN) {
+  // As with --http_capture_one_in=3.
+  Start(3, false /* bodies */);
+  for (int i = 0; i < 7; ++i) {
+    Get("start=" + to_string(i));
+  }
+  Stop();
+
+  const vector<CapturedRequest> records(ReadCapture());
+  ASSERT_EQ(3U, records.size());
+  for (size_t i = 0; i < records.size(); ++i) {
+    EXPECT_EQ(kPath, records[i].path());
+    EXPECT_EQ("start=" + to_string(3 * i), records[i].query());
+    EXPECT_FALSE(records[i].post());
+    EXPECT_FALSE(records[i].has_body_size());
+    EXPECT_FALSE(records[i].has_body_sha256());
+    EXPECT_FALSE(records[i].has_body());
+    EXPECT_EQ(200, records[i].response_code());
+    EXPECT_LE(0, records[i].latency_us());
+    if (i > 0) {
+      EXPECT_LE(records[i - 1].arrival_us(), records[i].arrival_us());
+    }
+  }
+}
+
+
+TEST_F(RequestCaptureTest, CapturesTheBodies) {
+  Start(1, true /* bodies */);
+  Post("some chain");
+  Get("start=0");
+  Stop();
+
+  const vector<CapturedRequest> records(ReadCapture());
+  ASSERT_EQ(2U, records.size());
+  EXPECT_TRUE(records[0].post());
+  EXPECT_FALSE(records[0].has_query());
+  EXPECT_EQ(10, records[0].body_size());
+  EXPECT_EQ(Sha256Hasher::Sha256Digest("some chain"),
+            records[0].body_sha256());
+  EXPECT_EQ("some chain", records[0].body());
+  EXPECT_EQ(400, records[0].response_code());
+
+  // Requests without a body have none of it recorded.
+  EXPECT_FALSE(records[1].post());
+  EXPECT_FALSE(records[1].has_body_size());
+  EXPECT_FALSE(records[1].has_body_sha256());
+  EXPECT_FALSE(records[1].has_body());
+  EXPECT_EQ(200, records[1].response_code());
+}
+
+
+TEST_F(RequestCaptureTest, OnlyHashesTheBodiesByDefault) {
+  Start(1, false /* bodies */);
+  Post("some chain");
+  Stop();
+
+  const vector<CapturedRequest> records(ReadCapture());
+  ASSERT_EQ(1U, records.size());
+  EXPECT_TRUE(records[0].post());
+  EXPECT_EQ(10, records[0].body_size());
+  EXPECT_EQ(Sha256Hasher::Sha256Digest("some chain"),
+            records[0].body_sha256());
+  EXPECT_FALSE(records[0].has_body());
+}
+
+
+TEST_F(RequestCaptureTest, AppendsToTheFile) {
+  Start(1, false /* bodies */);
+  Get("start=0");
+  Stop();
+  Start(1, false /* bodies */);
+  Get("start=1");
+  Stop();
+
+  const vector<CapturedRequest> records(ReadCapture());
+  ASSERT_EQ(2U, records.size());
+  EXPECT_EQ("start=0", records[0].query());
+  EXPECT_EQ("start=1", records[1].query());
+}
+
+
+TEST(ReadDelimitedFromTest, TellsTruncationFromTheEnd) {
+  CapturedRequest written;
+  written.set_path(kPath);
+  written.set_body(string(300, 'x'));
+  ostringstream out;
+  ASSERT_TRUE(WriteDelimitedToOstream(written, &out));
+  ASSERT_TRUE(WriteDelimitedToOstream(written, &out));
+  const string data(out.str());
+
+  {
+    ArrayInputStream input(data.data(), data.size());
+    CapturedRequest read;
+    bool clean_eof(true);
+    ASSERT_TRUE(ReadDelimitedFrom(&input, &read, &clean_eof));
+    EXPECT_FALSE(clean_eof);
+    EXPECT_EQ(written.DebugString(), read.DebugString());
+    ASSERT_TRUE(ReadDelimitedFrom(&input, &read, &clean_eof));
+    EXPECT_EQ(written.DebugString(), read.DebugString());
+    EXPECT_FALSE(ReadDelimitedFrom(&input, &read, &clean_eof));
+    EXPECT_TRUE(clean_eof);
+  }
+
+  // Cut in the middle of the second message, and of its length.
+  for (const size_t cut : {data.size() - 1, data.size() / 2 + 1}) {
+    ArrayInputStream input(data.data(), cut);
+    CapturedRequest read;
+    bool clean_eof(true);
+    ASSERT_TRUE(ReadDelimitedFrom(&input, &read, &clean_eof));
+    EXPECT_FALSE(ReadDelimitedFrom(&input, &read, &clean_eof));
+    EXPECT_FALSE(clean_eof);
+  }
+
+  // The clean end flag is optional.
+  ArrayInputStream input(data.data(), 0);
+  CapturedRequest read;
+  EXPECT_FALSE(ReadDelimitedFrom(&input, &read, nullptr));
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
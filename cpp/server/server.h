@@ -1,17 +1,25 @@
 #ifndef CERT_TRANS_SERVER_SERVER_H_
 #define CERT_TRANS_SERVER_SERVER_H_
 
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <csignal>
 #include <cstring>
+#include <event2/buffer.h>
+#include <event2/http.h>
 #include <functional>
 #include <gflags/gflags.h>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <openssl/crypto.h>
+#include <vector>
 
+#include "client/async_log_client.h"
 #include "config.h"
+#include "fetcher/snapshot.h"
 #include "log/cert_submission_handler.h"
 #include "log/ct_extensions.h"
 #include "log/file_db.h"
@@ -27,9 +35,12 @@
 #include "monitoring/latency.h"
 #include "monitoring/monitoring.h"
 #include "monitoring/registry.h"
+#include "server/debug_handlers.h"
 #include "server/json_output.h"
 #include "server/proxy.h"
+#include "util/cpu_affinity.h"
 #include "util/etcd.h"
+#include "util/executor.h"
 #include "util/periodic_closure.h"
 #include "util/read_key.h"
 #include "util/status.h"
@@ -45,6 +56,48 @@ DEFINE_int32(watchdog_seconds, 120,
              "before firing the watchdog timer.");
 DEFINE_bool(watchdog_timeout_is_fatal, true,
             "Exit if the watchdog timer fires.");
+DEFINE_string(tree_checkpoint, "",
+              "If set, periodically save the leaf hashes of the in-memory "
+              "Merkle tree to this file, and reload them at startup.");
+DEFINE_int32(tree_checkpoint_interval, 100000,
+             "Rewrite the tree checkpoint whenever the tree has grown by "
+             "this many entries.");
+DEFINE_int32(tree_memory_level, 0,
+             "If positive, only keep the levels of the in-memory Merkle "
+             "tree from this one up (0 being the leaves), which divides its "
+             "memory use by about 2^level. The nodes below are recomputed "
+             "when serving proofs, reading 2^level leaf hashes from the tree "
+             "checkpoint or the database.");
+DEFINE_int64(precomputed_proof_leaves, 0,
+             "If positive, compute the audit paths of up to this many of "
+             "the entries added by each tree update (the latest ones) as "
+             "the tree is updated, so that the proofs of newly merged "
+             "entries don't have to be computed for each request.");
+DEFINE_bool(proofs_from_subtree_hashes, false,
+            "Compute the audit and consistency proofs from the perfect "
+            "subtree hashes the database stores (see "
+            "--leveldb_subtree_hashes) where it has them, rather than from "
+            "the in-memory Merkle tree.");
+DEFINE_bool(serve_while_warming, false,
+            "Load the in-memory Merkle tree in the background once the "
+            "HTTP handlers are up, proxying the requests that need it to "
+            "the other nodes in the meantime. /ready replies 503 until "
+            "it is loaded.");
+DEFINE_string(bootstrap_snapshot_from, "",
+              "If set, the URL of a log node to import a snapshot of the "
+              "entries from at startup (see get-snapshot), before fetching "
+              "the entries after them as usual.");
+DEFINE_string(event_loop_cpus, "",
+              "If set, the CPUs to run the HTTP event loops on, as a list "
+              "such as \"0-3,8\".");
+DEFINE_string(http_pool_cpus, "",
+              "If set, the CPUs to run the threads of the HTTP thread pool "
+              "on, as a list such as \"0-3,8\".");
+DEFINE_string(internal_pool_cpus, "",
+              "If set, the CPUs to run the threads of the internal thread "
+              "pool on, as a list such as \"0-3,8\". The in-memory Merkle "
+              "tree is built by these threads, so its memory is on their "
+              "NUMA node.");
 
 namespace cert_trans {
 
@@ -52,12 +105,62 @@ Gauge<>* latest_local_tree_size_gauge =
     Gauge<>::New("latest_local_tree_size",
                  "Size of latest locally generated STH.");
 
+static Gauge<std::string>* startup_phase_seconds(
+    Gauge<std::string>::New("startup_phase_seconds", "phase",
+                            "How long each phase of the server startup "
+                            "took, in seconds."));
+
+
+// Parses the value of one of the --*_cpus flags, which is empty if it
+// is unset.
+static std::vector<int> CpusFromFlag(const std::string& flag,
+                                     const std::string& value) {
+  std::vector<int> cpus;
+  if (!value.empty()) {
+    CHECK(ParseCpuList(value, &cpus)) << "Invalid --" << flag << ": "
+                                      << value;
+  }
+  return cpus;
+}
+
+
+// Logs and exports (in startup_phase_seconds) how long it is until
+// the instance is destroyed.
+class StartupPhase {
+ public:
+  explicit StartupPhase(const std::string& name)
+      : name_(name), start_(std::chrono::steady_clock::now()) {
+    LOG(INFO) << "Startup phase " << name_ << " starting";
+  }
+
+  ~StartupPhase() {
+    const double seconds(std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start_)
+                             .count());
+    startup_phase_seconds->Set(name_, seconds);
+    LOG(INFO) << "Startup phase " << name_ << " took " << seconds << "s";
+  }
+
+ private:
+  const std::string name_;
+  const std::chrono::steady_clock::time_point start_;
+
+  DISALLOW_COPY_AND_ASSIGN(StartupPhase);
+};
+
 
 template <class Logged>
 class Server {
  public:
   struct Options {
-    Options() : port(0), num_http_server_threads(16) {
+    Options()
+        : port(0),
+          num_http_server_threads(16),
+          num_http_event_loops(1),
+          fetch_executor(nullptr),
+          http_host(nullptr),
+          read_only_replica(false),
+          catch_up_interval(std::chrono::seconds(1)) {
     }
 
     std::string server;
@@ -66,6 +169,37 @@ class Server {
     std::string etcd_root;
 
     int num_http_server_threads;
+    // The HTTP requests are received on the main event loop, plus this
+    // many minus one others, each with its own HttpServer on |port|.
+    int num_http_event_loops;
+
+    // If not null, runs the fetching of the entries from the peers,
+    // instead of the internal pool. Not owned.
+    util::Executor* fetch_executor;
+
+    // Prefix of the paths of the log's handlers (such as "/2025"), to
+    // tell it apart from the other logs served on the same port.
+    std::string path_prefix;
+
+    // If not null, the log is served by the HTTP servers of this other
+    // instance, on the same |port| and event loop, with its HTTP
+    // threads, instead of by its own. It must outlive this instance,
+    // and be the one to Run(). Not owned.
+    Server* http_host;
+
+    // Serves the get-* requests straight from the database, which
+    // another process writes to, without fetching from the peers, the
+    // election, or publishing the node state. The database is only
+    // read, and caught up with its writer (see Database::CatchUp())
+    // every |catch_up_interval|. The etcd client only needs to be a
+    // FakeEtcdClient, and the log verifier can be null.
+    bool read_only_replica;
+    std::chrono::duration<double> catch_up_interval;
+
+    // If set, the CertChecker's trusted certificates can be reloaded
+    // from this file with the /debug/reload-roots handler (see
+    // AddReloadRootsHandler()).
+    std::string trusted_cert_file;
   };
 
   static void StaticInit();
@@ -87,14 +221,33 @@ class Server {
   ContinuousFetcher* continuous_fetcher();
 
   void Initialise(bool is_mirror);
+  // With --serve_while_warming, waits for the LogLookup to be loaded.
+  void WaitForWarmUp();
   void WaitForReplication() const;
   void Run();
 
  private:
+  // The HTTP servers this log is served by, its own or those of
+  // Options::http_host.
+  std::vector<libevent::HttpServer*> HttpServers();
+  void InitialiseReadOnlyReplica();
+  void AddHandlers();
+  void CatchUp();
+  // Loads the LogLookup, on a thread running on --internal_pool_cpus
+  // if it is set, so that the tree is on the NUMA node of the threads
+  // that update it.
+  void LoadTree();
+  void WarmUp();
+  void SetReady();
+  // Replies 200 once the node has warmed up, 503 before, for the load
+  // balancer health checks.
+  void HandleReady(evhttp_request* req);
+
   const Options options_;
   const std::shared_ptr<libevent::Base> event_base_;
   std::unique_ptr<libevent::EventPumpThread> event_pump_;
-  libevent::HttpServer http_server_;
+  // Null with Options::http_host.
+  const std::unique_ptr<libevent::HttpServer> http_server_;
   Database<Logged>* const db_;
   const LogVerifier* const log_verifier_;
   CertChecker* const cert_checker_;
@@ -110,12 +263,26 @@ class Server {
   std::unique_ptr<ClusterStateController<LoggedCertificate>>
       cluster_controller_;
   std::unique_ptr<ContinuousFetcher> fetcher_;
-  ThreadPool http_pool_;
+  // Null with Options::http_host.
+  const std::unique_ptr<ThreadPool> own_http_pool_;
+  ThreadPool* const http_pool_;
   JsonOutput json_output_;
   std::unique_ptr<Proxy> proxy_;
   std::unique_ptr<HttpHandler> handler_;
+  // Only set with Options::read_only_replica.
+  std::unique_ptr<PeriodicClosure> catch_up_;
+  std::atomic_flag catching_up_;
   std::unique_ptr<std::thread> node_refresh_thread_;
+  std::unique_ptr<std::thread> warm_up_thread_;
+  std::mutex ready_mutex_;
+  std::condition_variable ready_cv_;
+  bool ready_;
   std::unique_ptr<GCMExporter> gcm_exporter_;
+  // The additional event loops for HTTP, and their servers. The pumps
+  // are last, so that they are stopped first.
+  std::vector<std::shared_ptr<libevent::Base>> extra_http_bases_;
+  std::vector<std::unique_ptr<libevent::HttpServer>> extra_http_servers_;
+  std::vector<std::unique_ptr<libevent::EventPumpThread>> extra_http_pumps_;
 
   DISALLOW_COPY_AND_ASSIGN(Server);
 };
@@ -195,12 +362,19 @@ Server<Logged>::Server(const Options& opts,
                        CertChecker* cert_checker)
     : options_(opts),
       event_base_(event_base),
-      event_pump_(new libevent::EventPumpThread(event_base_)),
-      http_server_(*event_base_),
+      // The event loop is pumped by the host until it is Run().
+      event_pump_(opts.http_host ? nullptr
+                                 : new libevent::EventPumpThread(event_base_)),
+      http_server_(opts.http_host ? nullptr
+                                  : new libevent::HttpServer(*event_base_)),
       db_(CHECK_NOTNULL(db)),
-      log_verifier_(CHECK_NOTNULL(log_verifier)),
+      log_verifier_(opts.read_only_replica ? log_verifier
+                                           : CHECK_NOTNULL(log_verifier)),
       cert_checker_(cert_checker),
-      node_id_(GetNodeId(db_)),
+      // A replica mustn't write its own node id to the database, nor
+      // take that of its writer.
+      node_id_(opts.read_only_replica ? cert_trans::UUID4()
+                                      : GetNodeId(db_)),
       url_fetcher_(CHECK_NOTNULL(url_fetcher)),
       etcd_client_(CHECK_NOTNULL(etcd_client)),
       election_(event_base_, etcd_client_, options_.etcd_root + "/election",
@@ -216,33 +390,126 @@ Server<Logged>::Server(const Options& opts,
                                    new FrontendSigner(db_, &consistent_store_,
                                                       log_signer))
                     : nullptr),
-      http_pool_(options_.num_http_server_threads),
-      json_output_(event_base_.get()) {
+      own_http_pool_(
+          opts.http_host
+              ? nullptr
+              : new ThreadPool(opts.num_http_server_threads, "http")),
+      http_pool_(opts.http_host ? opts.http_host->http_pool_
+                                : own_http_pool_.get()),
+      json_output_(http_pool_),
+      catching_up_(ATOMIC_FLAG_INIT),
+      ready_(false) {
   CHECK_LT(0, options_.port);
   CHECK_LT(0, options_.num_http_server_threads);
-
-  if (FLAGS_monitoring == kPrometheus) {
-    http_server_.AddHandler("/metrics",
-                            bind(&cert_trans::ExportPrometheusMetrics,
-                                 std::placeholders::_1));
-  } else if (FLAGS_monitoring == kGcm) {
-    gcm_exporter_.reset(
-        new GCMExporter(options_.server, url_fetcher_, internal_pool_));
+  CHECK_LT(0, options_.num_http_event_loops);
+
+  if (options_.http_host) {
+    CHECK_EQ(event_base_, options_.http_host->event_base_);
+    CHECK_EQ(options_.port, options_.http_host->options_.port);
+    // The host exports the metrics, and has the debug handlers, for
+    // the whole process.
+    CHECK(!options_.path_prefix.empty());
   } else {
-    LOG(FATAL) << "Please set --monitoring to one of the supported values.";
+    for (int i = 1; i < options_.num_http_event_loops; ++i) {
+      extra_http_bases_.emplace_back(std::make_shared<libevent::Base>());
+      extra_http_servers_.emplace_back(
+          new libevent::HttpServer(*extra_http_bases_.back()));
+    }
+
+    // The main event loop only gets its CPUs once Run() dispatches it.
+    const std::vector<int> loop_cpus(
+        CpusFromFlag("event_loop_cpus", FLAGS_event_loop_cpus));
+    if (!loop_cpus.empty()) {
+      event_base_->SetCpus(loop_cpus);
+      for (const auto& base : extra_http_bases_) {
+        base->SetCpus(loop_cpus);
+      }
+    }
+    const std::vector<int> http_cpus(
+        CpusFromFlag("http_pool_cpus", FLAGS_http_pool_cpus));
+    if (!http_cpus.empty()) {
+      const util::Status status(http_pool_->SetCpus(http_cpus));
+      LOG_IF(WARNING, !status.ok()) << status;
+    }
+    const std::vector<int> internal_cpus(
+        CpusFromFlag("internal_pool_cpus", FLAGS_internal_pool_cpus));
+    if (!internal_cpus.empty()) {
+      const util::Status status(internal_pool_->SetCpus(internal_cpus));
+      LOG_IF(WARNING, !status.ok()) << status;
+    }
+
+    if (FLAGS_monitoring == kPrometheus) {
+      for (libevent::HttpServer* server : HttpServers()) {
+        server->AddHandler("/metrics",
+                           bind(&cert_trans::ExportPrometheusMetrics,
+                                http_pool_, std::placeholders::_1));
+      }
+    } else if (FLAGS_monitoring == kGcm) {
+      gcm_exporter_.reset(
+          new GCMExporter(options_.server, url_fetcher_, internal_pool_));
+    } else {
+      LOG(FATAL) << "Please set --monitoring to one of the supported values.";
+    }
+
+    const std::map<std::string, const ThreadPool*> pools{
+        {"internal", internal_pool_}, {"http", http_pool_}};
+    for (libevent::HttpServer* server : HttpServers()) {
+      AddDebugHandlers(server, http_pool_, pools);
+      if (cert_checker_ && !options_.trusted_cert_file.empty()) {
+        AddReloadRootsHandler(server, http_pool_, cert_checker_,
+                              options_.trusted_cert_file);
+      }
+    }
+  }
+
+  for (libevent::HttpServer* server : HttpServers()) {
+    CHECK(server->AddHandler(options_.path_prefix + "/ready",
+                             bind(&Server<Logged>::HandleReady, this,
+                                  std::placeholders::_1)));
   }
 
-  http_server_.Bind(nullptr, options_.port);
-  election_.StartElection();
+  if (!options_.http_host) {
+    if (extra_http_servers_.empty()) {
+      http_server_->Bind(nullptr, options_.port);
+    } else {
+      // The kernel spreads the incoming connections between the sockets.
+      for (libevent::HttpServer* server : HttpServers()) {
+        server->BindReusingPort(nullptr, options_.port);
+      }
+    }
+  }
+  if (!options_.read_only_replica) {
+    election_.StartElection();
+  }
 }
 
 template <class Logged>
 Server<Logged>::~Server() {
+  if (warm_up_thread_) {
+    warm_up_thread_->join();
+  }
+  catch_up_.reset();
   server_task_.Cancel();
-  node_refresh_thread_->join();
+  if (node_refresh_thread_) {
+    node_refresh_thread_->join();
+  } else {
+    // A read-only replica has nothing else to return it.
+    server_task_.task()->Return(util::Status::CANCELLED);
+  }
   server_task_.Wait();
 }
 
+template <class Logged>
+std::vector<libevent::HttpServer*> Server<Logged>::HttpServers() {
+  Server<Logged>* const host(options_.http_host ? options_.http_host : this);
+  std::vector<libevent::HttpServer*> servers{host->http_server_.get()};
+  for (const auto& server : host->extra_http_servers_) {
+    servers.push_back(server.get());
+  }
+  return servers;
+}
+
+
 template <class Logged>
 bool Server<Logged>::IsMaster() const {
   return election_.IsMaster();
@@ -278,11 +545,69 @@ ContinuousFetcher* Server<Logged>::continuous_fetcher() {
 }
 
 
+template <class Logged>
+void Server<Logged>::WaitForWarmUp() {
+  std::unique_lock<std::mutex> lock(ready_mutex_);
+  ready_cv_.wait(lock, [this]() { return ready_; });
+}
+
+
+template <class Logged>
+void Server<Logged>::LoadTree() {
+  StartupPhase phase("log_lookup");
+  const std::vector<int> cpus(
+      CpusFromFlag("internal_pool_cpus", FLAGS_internal_pool_cpus));
+  if (cpus.empty()) {
+    log_lookup_->Load();
+    return;
+  }
+  std::thread loader([this, &cpus]() {
+    const util::Status status(SetThreadCpus(pthread_self(), cpus));
+    LOG_IF(WARNING, !status.ok()) << status;
+    log_lookup_->Load();
+  });
+  loader.join();
+}
+
+
+template <class Logged>
+void Server<Logged>::WarmUp() {
+  LoadTree();
+  handler_->SetWarming(false);
+  SetReady();
+}
+
+
+template <class Logged>
+void Server<Logged>::SetReady() {
+  {
+    std::lock_guard<std::mutex> lock(ready_mutex_);
+    ready_ = true;
+  }
+  ready_cv_.notify_all();
+}
+
+
+template <class Logged>
+void Server<Logged>::HandleReady(evhttp_request* req) {
+  bool ready;
+  {
+    std::lock_guard<std::mutex> lock(ready_mutex_);
+    ready = ready_;
+  }
+  const char* const body(ready ? "ready\n" : "warming up\n");
+  evbuffer_add(evhttp_request_get_output_buffer(req), body, strlen(body));
+  evhttp_send_reply(req, ready ? HTTP_OK : HTTP_SERVUNAVAIL,
+                    /*reason*/ nullptr, /*databuf*/ nullptr);
+}
+
+
 template <class Logged>
 void Server<Logged>::WaitForReplication() const {
   // If we're joining an existing cluster, this node needs to get its database
   // up-to-date with the serving_sth before we can do anything, so we'll wait
   // here for that:
+  StartupPhase phase("wait_for_replication");
   util::StatusOr<ct::SignedTreeHead> serving_sth(
       consistent_store_.GetServingSTH());
   if (serving_sth.ok()) {
@@ -298,11 +623,44 @@ void Server<Logged>::WaitForReplication() const {
 
 template <class Logged>
 void Server<Logged>::Initialise(bool is_mirror) {
-  fetcher_.reset(ContinuousFetcher::New(event_base_.get(), internal_pool_, db_,
-                                        log_verifier_, !is_mirror)
+  if (options_.read_only_replica) {
+    return InitialiseReadOnlyReplica();
+  }
+
+  if (!FLAGS_bootstrap_snapshot_from.empty()) {
+    StartupPhase phase("import_snapshot");
+    AsyncLogClient client(internal_pool_, url_fetcher_,
+                          FLAGS_bootstrap_snapshot_from);
+    const util::Status status(
+        ImportSnapshot(&client, log_verifier_, internal_pool_, db_));
+    // The entries the database had are not those of the log. Anything
+    // else, fetching the entries will get them anyway.
+    CHECK_NE(util::error::DATA_LOSS, status.CanonicalCode()) << status;
+    LOG_IF(WARNING, !status.ok()) << "Could not import a snapshot from "
+                                  << FLAGS_bootstrap_snapshot_from << ": "
+                                  << status;
+  }
+
+  fetcher_.reset(ContinuousFetcher::New(event_base_.get(),
+                                        options_.fetch_executor
+                                            ? options_.fetch_executor
+                                            : internal_pool_,
+                                        db_, log_verifier_, !is_mirror)
                      .release());
 
-  log_lookup_.reset(new LogLookup<LoggedCertificate>(db_));
+  CHECK_GE(FLAGS_tree_memory_level, 0);
+  CHECK_GE(FLAGS_precomputed_proof_leaves, 0);
+  log_lookup_.reset(new LogLookup<Logged>(
+      db_, FLAGS_tree_checkpoint, FLAGS_tree_checkpoint_interval,
+      true /* deferred */, FLAGS_tree_memory_level));
+  log_lookup_->PrecomputeProofs(FLAGS_precomputed_proof_leaves);
+  log_lookup_->UpdateRootsOn(internal_pool_);
+  if (FLAGS_proofs_from_subtree_hashes) {
+    log_lookup_->ServeProofsFromSubtreeHashes();
+  }
+  if (!FLAGS_serve_while_warming) {
+    LoadTree();
+  }
 
   cluster_controller_.reset(new ClusterStateController<LoggedCertificate>(
       internal_pool_, event_base_, url_fetcher_, db_, &consistent_store_,
@@ -329,24 +687,107 @@ void Server<Logged>::Initialise(bool is_mirror) {
                                              server_task_.task()));
 
   proxy_.reset(
-      new Proxy(event_base_.get(), &json_output_,
+      new Proxy(&json_output_,
                 bind(&ClusterStateController<LoggedCertificate>::GetFreshNodes,
                      cluster_controller_.get()),
-                url_fetcher_, &http_pool_));
+                url_fetcher_, http_pool_));
   handler_.reset(new HttpHandler(&json_output_, log_lookup_.get(), db_,
                                  cluster_controller_.get(), cert_checker_,
-                                 frontend_.get(), proxy_.get(), &http_pool_,
+                                 frontend_.get(), proxy_.get(), http_pool_,
                                  event_base_.get()));
 
-  handler_->Add(&http_server_);
+  AddHandlers();
+}
+
+
+template <class Logged>
+void Server<Logged>::InitialiseReadOnlyReplica() {
+  CHECK(!frontend_) << "A read-only replica can't take submissions";
+  CHECK(FLAGS_bootstrap_snapshot_from.empty())
+      << "A read-only replica can't import a snapshot";
+
+  // The tree is updated from the tree heads the database is notified
+  // of by CatchUp(), with the entries it picked up before them.
+  CHECK_GE(FLAGS_tree_memory_level, 0);
+  CHECK_GE(FLAGS_precomputed_proof_leaves, 0);
+  log_lookup_.reset(new LogLookup<Logged>(
+      db_, FLAGS_tree_checkpoint, FLAGS_tree_checkpoint_interval,
+      true /* deferred */, FLAGS_tree_memory_level));
+  log_lookup_->PrecomputeProofs(FLAGS_precomputed_proof_leaves);
+  log_lookup_->UpdateRootsOn(internal_pool_);
+  if (FLAGS_proofs_from_subtree_hashes) {
+    log_lookup_->ServeProofsFromSubtreeHashes();
+  }
+  if (!FLAGS_serve_while_warming) {
+    LoadTree();
+  }
+
+  handler_.reset(new HttpHandler(&json_output_, log_lookup_.get(), db_,
+                                 nullptr /* controller */, cert_checker_,
+                                 nullptr /* frontend */, nullptr /* proxy */,
+                                 http_pool_, event_base_.get()));
+  AddHandlers();
+
+  // The hold keeps the destructor waiting for the pending catch ups.
+  catch_up_.reset(new PeriodicClosure(event_base_, options_.catch_up_interval,
+                                      [this]() {
+                                        server_task_.task()->AddHold();
+                                        internal_pool_->Add([this]() {
+                                          CatchUp();
+                                          server_task_.task()->RemoveHold();
+                                        });
+                                      }));
+}
+
+
+template <class Logged>
+void Server<Logged>::AddHandlers() {
+  if (FLAGS_serve_while_warming) {
+    handler_->SetWarming(true);
+    warm_up_thread_.reset(new std::thread(&Server<Logged>::WarmUp, this));
+  } else {
+    SetReady();
+  }
+
+  for (libevent::HttpServer* server : HttpServers()) {
+    handler_->Add(server, options_.path_prefix);
+  }
+  // Only one event_base can get the signals, the last one to start
+  // dispatching, and that should be the main loop, in Run().
+  for (const auto& base : extra_http_bases_) {
+    extra_http_pumps_.emplace_back(new libevent::EventPumpThread(base));
+  }
+}
+
+
+template <class Logged>
+void Server<Logged>::CatchUp() {
+  // A slow catch up shouldn't have the next ones pile up behind it.
+  if (server_task_.task()->CancelRequested() ||
+      catching_up_.test_and_set()) {
+    return;
+  }
+  const util::Status status(db_->CatchUp());
+  LOG_IF(WARNING, !status.ok()) << "Could not catch up with the database: "
+                                << status;
+  catching_up_.clear();
 }
 
 
 template <class Logged>
 void Server<Logged>::Run() {
+  CHECK(!options_.http_host) << "Run() the host of the HTTP servers instead";
   // Ding the temporary event pump because we're about to enter the event loop
   event_pump_.reset();
   event_base_->Dispatch();
+
+  std::vector<libevent::Base*> bases{event_base_.get()};
+  std::vector<libevent::HttpServer*> servers{http_server_.get()};
+  for (size_t i = 0; i < extra_http_servers_.size(); ++i) {
+    bases.push_back(extra_http_bases_[i].get());
+    servers.push_back(extra_http_servers_[i].get());
+  }
+  libevent::DrainHttpServers(bases, servers);
 }
 
 
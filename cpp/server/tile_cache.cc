@@ -0,0 +1,96 @@
+#include "server/tile_cache.h"
+
+#include <glog/logging.h>
+
+#include "monitoring/monitoring.h"
+
+using std::lock_guard;
+using std::mutex;
+using std::shared_ptr;
+using std::string;
+
+namespace cert_trans {
+namespace {
+
+
+static Gauge<>* tile_cache_bytes(
+    Gauge<>::New("get_entries_tile_cache_bytes",
+                 "Size of the get-entries tiles held in the cache."));
+
+
+}  // namespace
+
+
+string EntriesTile::Slice(size_t first, size_t last) const {
+  CHECK_LE(first, last);
+  CHECK_LT(last, NumEntries());
+  const string& json(body->json());
+  const size_t prefix_length(offsets.front());
+  const size_t suffix_offset(offsets.back() - 1);
+  const size_t slice_length(offsets[last + 1] - 1 - offsets[first]);
+
+  string result;
+  result.reserve(prefix_length + slice_length + json.size() - suffix_offset);
+  result.append(json, 0, prefix_length);
+  result.append(json, offsets[first], slice_length);
+  result.append(json, suffix_offset, string::npos);
+  return result;
+}
+
+
+TileCache::TileCache(size_t max_bytes, MemoryBudget* budget)
+    : max_bytes_(max_bytes),
+      account_(budget ? budget->OpenAccount() : nullptr),
+      bytes_(0) {
+}
+
+
+shared_ptr<const EntriesTile> TileCache::Get(int64_t index) {
+  lock_guard<mutex> lock(lock_);
+  const auto it(index_.find(index));
+  if (it == index_.end()) {
+    return nullptr;
+  }
+  tiles_.splice(tiles_.begin(), tiles_, it->second);
+  return it->second->second;
+}
+
+
+void TileCache::Put(int64_t index, const shared_ptr<const EntriesTile>& tile) {
+  CHECK(tile);
+  const size_t size(tile->body->json().size());
+  if (size > max_bytes_) {
+    return;
+  }
+
+  lock_guard<mutex> lock(lock_);
+  // Another request might have rendered it at the same time.
+  if (index_.find(index) != index_.end()) {
+    return;
+  }
+  tiles_.emplace_front(index, tile);
+  index_.emplace(index, tiles_.begin());
+  bytes_ += size;
+  if (account_) {
+    account_->Set(bytes_);
+  }
+  while (bytes_ > max_bytes_ ||
+         (account_ && account_->ShouldShrink() && !tiles_.empty())) {
+    bytes_ -= tiles_.back().second->body->json().size();
+    index_.erase(tiles_.back().first);
+    tiles_.pop_back();
+    if (account_) {
+      account_->Set(bytes_);
+    }
+  }
+  tile_cache_bytes->Set(bytes_);
+}
+
+
+size_t TileCache::Bytes() const {
+  lock_guard<mutex> lock(lock_);
+  return bytes_;
+}
+
+
+}  // namespace cert_trans
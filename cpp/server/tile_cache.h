@@ -0,0 +1,74 @@
+#ifndef CERT_TRANS_SERVER_TILE_CACHE_H_
+#define CERT_TRANS_SERVER_TILE_CACHE_H_
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "base/macros.h"
+#include "server/json_body.h"
+#include "util/memory_budget.h"
+
+namespace cert_trans {
+
+
+// A get-entries reply for all the entries of an aligned range (a
+// "tile"), rendered once. Tiles are only made of entries that are in
+// a published tree already, so they never change. The whole tile is
+// sent as a shared |body|, so that it's only gzipped once.
+struct EntriesTile {
+  // The whole JSON reply, {"entries":[...]}.
+  std::shared_ptr<const JsonBody> body;
+  // The offset in |body| of each entry, followed by that of the end of
+  // the last one plus one, as if there was a separator after it, so
+  // that entries i to j - 1 are at offsets[i] to offsets[j] - 1.
+  std::vector<size_t> offsets;
+
+  size_t NumEntries() const {
+    return offsets.empty() ? 0 : offsets.size() - 1;
+  }
+
+  // Returns the reply for entries |first| to |last| (inclusive).
+  std::string Slice(size_t first, size_t last) const;
+};
+
+
+// A thread-safe LRU cache of EntriesTile, by tile index, bounded by
+// the total size of their bodies, and by |budget| if it is not null
+// (see util/memory_budget.h).
+class TileCache {
+ public:
+  TileCache(size_t max_bytes, MemoryBudget* budget);
+
+  // Returns nullptr if the tile is not in the cache.
+  std::shared_ptr<const EntriesTile> Get(int64_t index);
+
+  // Tiles bigger than the whole cache are not kept.
+  void Put(int64_t index, const std::shared_ptr<const EntriesTile>& tile);
+
+  size_t Bytes() const;
+
+ private:
+  typedef std::pair<int64_t, std::shared_ptr<const EntriesTile>> Entry;
+
+  const size_t max_bytes_;
+  const std::unique_ptr<MemoryBudget::Account> account_;
+  mutable std::mutex lock_;
+  size_t bytes_;
+  // Most recently used first.
+  std::list<Entry> tiles_;
+  std::unordered_map<int64_t, std::list<Entry>::iterator> index_;
+
+  DISALLOW_COPY_AND_ASSIGN(TileCache);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_SERVER_TILE_CACHE_H_
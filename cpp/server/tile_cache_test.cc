@@ -0,0 +1,98 @@
+#include "server/tile_cache.h"
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::make_shared;
+using std::shared_ptr;
+using std::string;
+
+
+shared_ptr<EntriesTile> MakeTile(const string& body) {
+  shared_ptr<EntriesTile> tile(make_shared<EntriesTile>());
+  tile->body = make_shared<const JsonBody>(body);
+  return tile;
+}
+
+
+TEST(EntriesTileTest, Slice) {
+  EntriesTile tile;
+  tile.body = make_shared<const JsonBody>(
+      "{\"entries\":[{\"a\":1},{\"b\":22},{\"c\":333}]}");
+  tile.offsets = {12, 20, 29, 39};
+  ASSERT_EQ(3U, tile.NumEntries());
+
+  EXPECT_EQ(tile.body->json(), tile.Slice(0, 2));
+  EXPECT_EQ("{\"entries\":[{\"a\":1}]}", tile.Slice(0, 0));
+  EXPECT_EQ("{\"entries\":[{\"b\":22}]}", tile.Slice(1, 1));
+  EXPECT_EQ("{\"entries\":[{\"b\":22},{\"c\":333}]}", tile.Slice(1, 2));
+  EXPECT_EQ("{\"entries\":[{\"c\":333}]}", tile.Slice(2, 2));
+}
+
+
+TEST(TileCacheTest, EvictsLeastRecentlyUsed) {
+  TileCache cache(10, nullptr);
+  EXPECT_FALSE(cache.Get(0));
+
+  const shared_ptr<const EntriesTile> tile0(MakeTile("0000"));
+  const shared_ptr<const EntriesTile> tile1(MakeTile("1111"));
+  cache.Put(0, tile0);
+  cache.Put(1, tile1);
+  EXPECT_EQ(8U, cache.Bytes());
+  EXPECT_EQ(tile0, cache.Get(0));
+  EXPECT_EQ(tile1, cache.Get(1));
+
+  // Tile 0 was used less recently.
+  EXPECT_EQ(tile0, cache.Get(0));
+  cache.Put(2, MakeTile("2222"));
+  EXPECT_EQ(8U, cache.Bytes());
+  EXPECT_EQ(tile0, cache.Get(0));
+  EXPECT_FALSE(cache.Get(1));
+  EXPECT_TRUE(cache.Get(2));
+
+  // The first one stays.
+  cache.Put(0, MakeTile("other"));
+  EXPECT_EQ(tile0, cache.Get(0));
+}
+
+
+TEST(TileCacheTest, SkipsTilesBiggerThanCache) {
+  TileCache cache(3, nullptr);
+  cache.Put(0, MakeTile("0000"));
+  EXPECT_FALSE(cache.Get(0));
+  EXPECT_EQ(0U, cache.Bytes());
+}
+
+
+
+TEST(TileCacheTest, ShrinksToItsShareOfTheBudget) {
+  MemoryBudget budget(10);
+  const std::unique_ptr<MemoryBudget::Account> other(budget.OpenAccount());
+  other->Set(4);
+  TileCache cache(100, &budget);
+
+  cache.Put(0, MakeTile("0000"));
+  EXPECT_EQ(4U, cache.Bytes());
+  // Over the budget, and over half of it.
+  cache.Put(1, MakeTile("1111"));
+  EXPECT_EQ(4U, cache.Bytes());
+  EXPECT_FALSE(cache.Get(0));
+  EXPECT_TRUE(cache.Get(1));
+  EXPECT_EQ(8U, budget.Bytes());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
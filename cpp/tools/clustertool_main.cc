@@ -53,6 +53,14 @@ DEFINE_string(cluster_config, "",
 DEFINE_string(etcd_servers, "",
               "Comma separated list of 'hostname:port' of the etcd server(s)");
 DEFINE_string(key, "", "PEM-encoded server private key file");
+DEFINE_int64(bulk_cleanup_chunk_size, 10000,
+             "bulk_cleanup: number of old entries to delete between progress "
+             "reports");
+DEFINE_bool(bulk_cleanup_delete_shards, false,
+            "bulk_cleanup: delete the entry shards (see "
+            "--etcd_entries_shard_digits) that only hold old entries with "
+            "one recursive delete each. Only use this while the log "
+            "servers are stopped.");
 
 
 namespace {
@@ -69,7 +77,9 @@ void Usage() {
             << "\n"
             << "Commands:\n"
             << "  initlog     Initialise a new log.\n"
-            << "  set_config  Set/Change a cluster's config.\n";
+            << "  set_config  Set/Change a cluster's config.\n"
+            << "  bulk_cleanup  Delete the entries covered by the serving "
+            << "STH.\n";
 }
 
 
@@ -90,7 +100,8 @@ unique_ptr<TreeSigner<LoggedCertificate>> BuildTreeSigner(
                                         unique_ptr<CompactMerkleTree>(
                                             new CompactMerkleTree(
                                                 new Sha256Hasher)),
-                                        consistent_store, log_signer));
+                                        consistent_store, log_signer,
+                                        nullptr));
 }
 
 
@@ -155,10 +166,13 @@ int main(int argc, char* argv[]) {
   unique_ptr<MasterElection> election(
       BuildAndJoinMasterElection(node_id, event_base, &etcd_client));
   ThreadPool internal_pool(4);
-  StrictConsistentStore<LoggedCertificate> consistent_store(
-      election.get(), new EtcdConsistentStore<LoggedCertificate>(
-                          event_base.get(), &internal_pool, &etcd_client,
-                          election.get(), "/root", node_id));
+  EtcdConsistentStore<LoggedCertificate>* const etcd_store(
+      new EtcdConsistentStore<LoggedCertificate>(event_base.get(),
+                                                 &internal_pool, &etcd_client,
+                                                 election.get(), "/root",
+                                                 node_id));
+  StrictConsistentStore<LoggedCertificate> consistent_store(election.get(),
+                                                            etcd_store);
   SQLiteDB<LoggedCertificate> db("/tmp/clustertooldb");
 
 
@@ -172,6 +186,15 @@ int main(int argc, char* argv[]) {
   } else if (command == "set_config") {
     CHECK(!FLAGS_cluster_config.empty());
     status = SetClusterConfig(LoadConfig(), &consistent_store);
+  } else if (command == "bulk_cleanup") {
+    CHECK_GT(FLAGS_bulk_cleanup_chunk_size, 0);
+    const util::StatusOr<int64_t> num_cleaned(
+        etcd_store->BulkCleanupOldEntries(FLAGS_bulk_cleanup_chunk_size,
+                                          FLAGS_bulk_cleanup_delete_shards));
+    status = num_cleaned.status();
+    if (status.ok()) {
+      LOG(INFO) << "Cleaned up " << num_cleaned.ValueOrDie() << " entries.";
+    }
   } else {
     Usage();
   }
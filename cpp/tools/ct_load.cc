@@ -0,0 +1,581 @@
+/* -*- indent-tabs-mode: nil -*- */
+// Sends a mix of requests to a running log, to see how much load it
+// can take, e.g.:
+//
+//   ct_load --ct_server=http://127.0.0.1:6962 --rate=500 \
+//       --duration_secs=300 --get_entries_weight=5
+//
+// Requests are sent at random (Poisson) intervals averaging --rate per
+// second, whether or not the earlier ones have completed, and their
+// latency is measured from when they were due to be sent. That way, a
+// log that slows down gets more requests in flight and worse
+// latencies, as it would with real clients, instead of fewer requests.
+//
+// The certificates submitted are issued by the test CA (which the log
+// must trust), ahead of time. The read requests are for entries, tree
+// sizes and leaf hashes that the log returned earlier.
+//
+// At the end, the results and a histogram of the latencies of the
+// successful requests are printed for each type of request.
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <openssl/bn.h>
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/obj_mac.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "client/async_log_client.h"
+#include "log/cert.h"
+#include "log/ct_extensions.h"
+#include "merkletree/serial_hasher.h"
+#include "merkletree/tree_hasher.h"
+#include "monitoring/histogram.h"
+#include "net/url_fetcher.h"
+#include "proto/ct.pb.h"
+#include "util/init.h"
+#include "util/libevent_wrapper.h"
+#include "util/parallel_for.h"
+#include "util/thread_pool.h"
+
+namespace libevent = cert_trans::libevent;
+
+using cert_trans::AsyncLogClient;
+using cert_trans::Cert;
+using cert_trans::CertChain;
+using cert_trans::DistributionCell;
+using cert_trans::ExponentialBucketBounds;
+using cert_trans::Metric;
+using cert_trans::PreCertChain;
+using cert_trans::ThreadPool;
+using cert_trans::UrlFetcher;
+using std::atomic;
+using std::chrono::duration;
+using std::chrono::duration_cast;
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+using std::condition_variable;
+using std::deque;
+using std::lock_guard;
+using std::make_shared;
+using std::mt19937;
+using std::mutex;
+using std::shared_ptr;
+using std::string;
+using std::to_string;
+using std::unique_lock;
+using std::unique_ptr;
+using std::vector;
+
+DEFINE_string(ct_server, "", "URL of the log to send the requests to.");
+DEFINE_double(rate, 100, "Average number of requests sent per second.");
+DEFINE_int32(duration_secs, 60, "How long to send requests for.");
+DEFINE_int32(max_outstanding, 10000,
+             "Requests that would be sent while this many are still in "
+             "flight are dropped instead, and counted as such.");
+DEFINE_double(add_chain_weight, 1,
+              "Relative frequency of the add-chain requests.");
+DEFINE_double(add_pre_chain_weight, 1,
+              "Relative frequency of the add-pre-chain requests.");
+DEFINE_double(get_sth_weight, 1,
+              "Relative frequency of the get-sth requests.");
+DEFINE_double(get_entries_weight, 1,
+              "Relative frequency of the get-entries requests.");
+DEFINE_double(get_proof_by_hash_weight, 1,
+              "Relative frequency of the get-proof-by-hash requests.");
+DEFINE_double(get_sth_consistency_weight, 1,
+              "Relative frequency of the get-sth-consistency requests.");
+DEFINE_int32(get_entries_batch_size, 32,
+             "Number of entries asked for by each get-entries request.");
+DEFINE_string(ca_cert, "test/testdata/ca-cert.pem",
+              "Certificate of the CA issuing the submitted certificates.");
+DEFINE_string(ca_key, "test/testdata/ca-key.pem",
+              "Private key of the CA issuing the submitted certificates.");
+DEFINE_string(ca_key_password, "password1",
+              "Password of the CA private key.");
+DEFINE_int32(num_certs, 10000,
+             "Number of distinct certificates and precertificates to "
+             "generate. Once they have all been submitted, they are "
+             "submitted again.");
+DEFINE_int32(num_threads, 16, "Number of threads running the callbacks.");
+
+namespace {
+
+
+enum Endpoint {
+  ADD_CHAIN,
+  ADD_PRE_CHAIN,
+  GET_STH,
+  GET_ENTRIES,
+  GET_PROOF_BY_HASH,
+  GET_STH_CONSISTENCY,
+  NUM_ENDPOINTS,
+};
+
+
+const char* const kEndpointNames[NUM_ENDPOINTS] = {
+    "add-chain",         "add-pre-chain",    "get-sth",
+    "get-entries",       "get-proof-by-hash", "get-sth-consistency",
+};
+
+// The leaf hashes kept for get-proof-by-hash requests.
+const size_t kMaxLeafHashes(10000);
+
+const char kAsn1Null[] = {0x05, 0x00};
+
+
+// Issues a new certificate for |key|, signed by |ca_key|. It is a
+// precertificate if |precert| is true.
+X509* IssueCert(int index, bool precert, X509* ca, EVP_PKEY* ca_key,
+                EVP_PKEY* key) {
+  X509* const x509(CHECK_NOTNULL(X509_new()));
+  CHECK_EQ(1, X509_set_version(x509, 2));
+
+  BIGNUM* const serial(CHECK_NOTNULL(BN_new()));
+  CHECK_EQ(1, BN_rand(serial, 128, 0, 0));
+  CHECK_NOTNULL(BN_to_ASN1_INTEGER(serial, X509_get_serialNumber(x509)));
+  BN_free(serial);
+
+  CHECK_NOTNULL(X509_gmtime_adj(X509_get_notBefore(x509), -3600));
+  CHECK_NOTNULL(X509_gmtime_adj(X509_get_notAfter(x509), 365 * 24 * 3600));
+  CHECK_EQ(1, X509_set_issuer_name(x509, X509_get_subject_name(ca)));
+
+  const string name((precert ? "precert-" : "cert-") + to_string(index) +
+                    ".load.example.com");
+  X509_NAME* const subject(CHECK_NOTNULL(X509_NAME_new()));
+  CHECK_EQ(1, X509_NAME_add_entry_by_NID(
+                  subject, NID_commonName, MBSTRING_ASC,
+                  reinterpret_cast<const unsigned char*>(name.c_str()), -1,
+                  -1, 0));
+  CHECK_EQ(1, X509_set_subject_name(x509, subject));
+  X509_NAME_free(subject);
+  CHECK_EQ(1, X509_set_pubkey(x509, key));
+
+  if (precert) {
+    ASN1_OCTET_STRING* const poison(CHECK_NOTNULL(ASN1_OCTET_STRING_new()));
+    CHECK_EQ(1, ASN1_OCTET_STRING_set(
+                    poison, reinterpret_cast<const unsigned char*>(kAsn1Null),
+                    sizeof(kAsn1Null)));
+    X509_EXTENSION* const extension(CHECK_NOTNULL(X509_EXTENSION_create_by_NID(
+        nullptr, cert_trans::NID_ctPoison, 1 /* critical */, poison)));
+    CHECK_EQ(1, X509_add_ext(x509, extension, -1));
+    X509_EXTENSION_free(extension);
+    ASN1_OCTET_STRING_free(poison);
+  }
+
+  CHECK_LT(0, X509_sign(x509, ca_key, EVP_sha256()));
+  return x509;
+}
+
+
+// The results of one type of request.
+struct EndpointStats {
+  explicit EndpointStats(const vector<double>* bounds)
+      : latency_ms(bounds), ok(0), failed(0), dropped(0), skipped(0) {
+  }
+
+  // Of the successful requests only.
+  DistributionCell latency_ms;
+  atomic<uint64_t> ok;
+  atomic<uint64_t> failed;
+  // Not sent because too many requests were outstanding.
+  atomic<uint64_t> dropped;
+  // Not sent because nothing was known yet to ask about (e.g. the
+  // get-proof-by-hash requests, before any get-entries succeeded).
+  atomic<uint64_t> skipped;
+};
+
+
+class LoadGenerator {
+ public:
+  LoadGenerator(AsyncLogClient* client, vector<unique_ptr<CertChain>> chains,
+                vector<unique_ptr<PreCertChain>> pre_chains);
+
+  // Sends requests for |run_time|, and waits for the last ones to
+  // complete.
+  void Run(const steady_clock::duration& run_time);
+
+  void PrintReport(std::ostream* out) const;
+
+ private:
+  void Send(Endpoint endpoint, const steady_clock::time_point& due);
+  void Done(Endpoint endpoint, const steady_clock::time_point& due,
+            AsyncLogClient::Status status);
+  void UpdateSTH(const ct::SignedTreeHead& sth);
+  void AddLeafHashes(const AsyncLogClient::RawEntries& entries);
+
+  AsyncLogClient* const client_;
+  const vector<unique_ptr<CertChain>> chains_;
+  const vector<unique_ptr<PreCertChain>> pre_chains_;
+  const vector<double> bounds_;
+  const TreeHasher tree_hasher_;
+  vector<unique_ptr<EndpointStats>> stats_;
+  atomic<uint64_t> next_chain_;
+  atomic<uint64_t> next_pre_chain_;
+  steady_clock::duration elapsed_;
+
+  mutable mutex lock_;
+  mt19937 rng_;
+  ct::SignedTreeHead sth_;
+  deque<string> leaf_hashes_;
+  int outstanding_;
+  condition_variable outstanding_done_;
+
+  DISALLOW_COPY_AND_ASSIGN(LoadGenerator);
+};
+
+
+LoadGenerator::LoadGenerator(AsyncLogClient* client,
+                             vector<unique_ptr<CertChain>> chains,
+                             vector<unique_ptr<PreCertChain>> pre_chains)
+    : client_(CHECK_NOTNULL(client)),
+      chains_(std::move(chains)),
+      pre_chains_(std::move(pre_chains)),
+      // 1/16th of a ms to about an hour.
+      bounds_(ExponentialBucketBounds(1.0 / 16, 2, 27)),
+      tree_hasher_(new Sha256Hasher),
+      next_chain_(0),
+      next_pre_chain_(0),
+      elapsed_(0),
+      rng_(std::random_device()()),
+      outstanding_(0) {
+  CHECK(!chains_.empty());
+  CHECK(!pre_chains_.empty());
+  for (int i = 0; i < NUM_ENDPOINTS; ++i) {
+    stats_.emplace_back(new EndpointStats(&bounds_));
+  }
+}
+
+
+void LoadGenerator::Run(const steady_clock::duration& run_time) {
+  std::discrete_distribution<int> endpoints(
+      {FLAGS_add_chain_weight, FLAGS_add_pre_chain_weight,
+       FLAGS_get_sth_weight, FLAGS_get_entries_weight,
+       FLAGS_get_proof_by_hash_weight, FLAGS_get_sth_consistency_weight});
+  std::exponential_distribution<double> interval_secs(FLAGS_rate);
+  std::random_device seed;
+  mt19937 rng(seed());
+
+  const steady_clock::time_point start(steady_clock::now());
+  const steady_clock::time_point end(start + run_time);
+  steady_clock::time_point due(start);
+  while (true) {
+    due += duration_cast<steady_clock::duration>(
+        duration<double>(interval_secs(rng)));
+    if (due >= end) {
+      break;
+    }
+    std::this_thread::sleep_until(due);
+    Send(static_cast<Endpoint>(endpoints(rng)), due);
+  }
+
+  unique_lock<mutex> lock(lock_);
+  outstanding_done_.wait(lock, [this]() { return outstanding_ == 0; });
+  elapsed_ = steady_clock::now() - start;
+}
+
+
+void LoadGenerator::Send(Endpoint endpoint,
+                         const steady_clock::time_point& due) {
+  EndpointStats* const stats(stats_[endpoint].get());
+  ct::SignedTreeHead sth;
+  string leaf_hash;
+  int64_t first(0);
+  {
+    lock_guard<mutex> lock(lock_);
+    if (outstanding_ >= FLAGS_max_outstanding) {
+      ++stats->dropped;
+      return;
+    }
+
+    // Pick what to ask about, among what the log returned already.
+    const int64_t tree_size(sth_.tree_size());
+    switch (endpoint) {
+      case GET_ENTRIES:
+        if (tree_size < 1) {
+          ++stats->skipped;
+          return;
+        }
+        first = std::uniform_int_distribution<int64_t>(0, tree_size - 1)(rng_);
+        break;
+      case GET_PROOF_BY_HASH:
+        if (leaf_hashes_.empty()) {
+          ++stats->skipped;
+          return;
+        }
+        sth.CopyFrom(sth_);
+        leaf_hash = leaf_hashes_[std::uniform_int_distribution<size_t>(
+            0, leaf_hashes_.size() - 1)(rng_)];
+        break;
+      case GET_STH_CONSISTENCY:
+        if (tree_size < 2) {
+          ++stats->skipped;
+          return;
+        }
+        sth.CopyFrom(sth_);
+        first = std::uniform_int_distribution<int64_t>(1, tree_size - 1)(rng_);
+        break;
+      default:
+        break;
+    }
+    ++outstanding_;
+  }
+
+  const AsyncLogClient::Callback done(
+      [this, endpoint, due](AsyncLogClient::Status status) {
+        Done(endpoint, due, status);
+      });
+  switch (endpoint) {
+    case ADD_CHAIN: {
+      const shared_ptr<ct::SignedCertificateTimestamp> sct(
+          make_shared<ct::SignedCertificateTimestamp>());
+      client_->AddCertChain(*chains_[next_chain_++ % chains_.size()],
+                            sct.get(),
+                            [sct, done](AsyncLogClient::Status status) {
+                              done(status);
+                            });
+      break;
+    }
+    case ADD_PRE_CHAIN: {
+      const shared_ptr<ct::SignedCertificateTimestamp> sct(
+          make_shared<ct::SignedCertificateTimestamp>());
+      client_->AddPreCertChain(
+          *pre_chains_[next_pre_chain_++ % pre_chains_.size()], sct.get(),
+          [sct, done](AsyncLogClient::Status status) { done(status); });
+      break;
+    }
+    case GET_STH: {
+      const shared_ptr<ct::SignedTreeHead> new_sth(
+          make_shared<ct::SignedTreeHead>());
+      client_->GetSTH(new_sth.get(),
+                      [this, new_sth, done](AsyncLogClient::Status status) {
+                        if (status == AsyncLogClient::OK) {
+                          UpdateSTH(*new_sth);
+                        }
+                        done(status);
+                      });
+      break;
+    }
+    case GET_ENTRIES: {
+      const shared_ptr<AsyncLogClient::RawEntries> entries(
+          make_shared<AsyncLogClient::RawEntries>());
+      client_->GetRawEntries(
+          first, first + FLAGS_get_entries_batch_size - 1, entries.get(),
+          [this, entries, done](AsyncLogClient::Status status) {
+            if (status == AsyncLogClient::OK) {
+              AddLeafHashes(*entries);
+            }
+            done(status);
+          });
+      break;
+    }
+    case GET_PROOF_BY_HASH: {
+      const shared_ptr<ct::MerkleAuditProof> proof(
+          make_shared<ct::MerkleAuditProof>());
+      client_->QueryInclusionProof(
+          sth, leaf_hash, proof.get(),
+          [proof, done](AsyncLogClient::Status status) { done(status); });
+      break;
+    }
+    case GET_STH_CONSISTENCY: {
+      const shared_ptr<vector<string>> proof(make_shared<vector<string>>());
+      client_->GetSTHConsistency(first, sth.tree_size(), proof.get(),
+                                 [proof, done](AsyncLogClient::Status status) {
+                                   done(status);
+                                 });
+      break;
+    }
+    case NUM_ENDPOINTS:
+      LOG(FATAL) << "Invalid endpoint";
+  }
+}
+
+
+void LoadGenerator::Done(Endpoint endpoint,
+                         const steady_clock::time_point& due,
+                         AsyncLogClient::Status status) {
+  EndpointStats* const stats(stats_[endpoint].get());
+  if (status == AsyncLogClient::OK) {
+    ++stats->ok;
+    stats->latency_ms.Record(
+        duration<double, std::milli>(steady_clock::now() - due).count());
+  } else {
+    VLOG(1) << kEndpointNames[endpoint] << " failed: " << status;
+    ++stats->failed;
+  }
+
+  lock_guard<mutex> lock(lock_);
+  CHECK_GT(outstanding_, 0);
+  if (--outstanding_ == 0) {
+    outstanding_done_.notify_all();
+  }
+}
+
+
+void LoadGenerator::UpdateSTH(const ct::SignedTreeHead& sth) {
+  lock_guard<mutex> lock(lock_);
+  if (sth.tree_size() > sth_.tree_size()) {
+    sth_.CopyFrom(sth);
+  }
+}
+
+
+void LoadGenerator::AddLeafHashes(const AsyncLogClient::RawEntries& entries) {
+  vector<string> hashes;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    hashes.push_back(tree_hasher_.HashLeaf(entries.LeafInput(i)));
+  }
+
+  lock_guard<mutex> lock(lock_);
+  for (string& hash : hashes) {
+    leaf_hashes_.emplace_back(std::move(hash));
+  }
+  while (leaf_hashes_.size() > kMaxLeafHashes) {
+    leaf_hashes_.pop_front();
+  }
+}
+
+
+// Estimates the |quantile| of |dist| as the upper bound of the bucket
+// it falls in.
+string Quantile(const Metric::Distribution& dist, double quantile) {
+  const uint64_t rank(dist.count * quantile);
+  uint64_t seen(0);
+  for (size_t i = 0; i < dist.bounds.size(); ++i) {
+    seen += dist.counts[i];
+    if (seen > rank) {
+      return to_string(dist.bounds[i]);
+    }
+  }
+  return ">" + to_string(dist.bounds.back());
+}
+
+
+void LoadGenerator::PrintReport(std::ostream* out) const {
+  const double elapsed_secs(duration<double>(elapsed_).count());
+  *out << "Ran for " << elapsed_secs << " s\n\n"
+       << std::left << std::setw(20) << "endpoint" << std::right
+       << std::setw(10) << "ok" << std::setw(10) << "failed" << std::setw(10)
+       << "dropped" << std::setw(10) << "skipped" << std::setw(10) << "ok/s"
+       << std::setw(12) << "mean ms" << std::setw(12) << "p50 ms"
+       << std::setw(12) << "p90 ms" << std::setw(12) << "p99 ms"
+       << std::setw(12) << "p99.9 ms"
+       << "\n";
+  for (int i = 0; i < NUM_ENDPOINTS; ++i) {
+    const EndpointStats& stats(*stats_[i]);
+    const Metric::Distribution dist(stats.latency_ms.Get());
+    *out << std::left << std::setw(20) << kEndpointNames[i] << std::right
+         << std::setw(10) << stats.ok << std::setw(10) << stats.failed
+         << std::setw(10) << stats.dropped << std::setw(10) << stats.skipped
+         << std::setw(10) << static_cast<uint64_t>(stats.ok / elapsed_secs)
+         << std::setw(12) << (dist.count ? dist.sum / dist.count : 0)
+         << std::setw(12) << Quantile(dist, 0.5) << std::setw(12)
+         << Quantile(dist, 0.9) << std::setw(12) << Quantile(dist, 0.99)
+         << std::setw(12) << Quantile(dist, 0.999) << "\n";
+  }
+
+  for (int i = 0; i < NUM_ENDPOINTS; ++i) {
+    const Metric::Distribution dist(stats_[i]->latency_ms.Get());
+    if (dist.count == 0) {
+      continue;
+    }
+    *out << "\n" << kEndpointNames[i] << " latencies:\n";
+    for (size_t j = 0; j < dist.counts.size(); ++j) {
+      if (dist.counts[j] == 0) {
+        continue;
+      }
+      *out << std::setw(16)
+           << (j < dist.bounds.size() ? "<= " + to_string(dist.bounds[j])
+                                      : "> " + to_string(dist.bounds.back()))
+           << " ms: " << dist.counts[j] << "\n";
+    }
+  }
+}
+
+
+void FileCloser(FILE* fp) {
+  if (fp) {
+    fclose(fp);
+  }
+}
+
+
+}  // namespace
+
+
+int main(int argc, char* argv[]) {
+  util::InitCT(&argc, &argv);
+  CHECK(!FLAGS_ct_server.empty()) << "Please specify --ct_server";
+  CHECK_GT(FLAGS_rate, 0);
+  CHECK_GT(FLAGS_duration_secs, 0);
+  CHECK_GT(FLAGS_max_outstanding, 0);
+  CHECK_GT(FLAGS_get_entries_batch_size, 0);
+  CHECK_GT(FLAGS_num_certs, 0);
+  CHECK_GT(FLAGS_num_threads, 0);
+
+  unique_ptr<FILE, void (*)(FILE*)> ca_file(fopen(FLAGS_ca_cert.c_str(), "r"),
+                                            FileCloser);
+  PCHECK(ca_file) << "Could not open " << FLAGS_ca_cert;
+  X509* const ca(CHECK_NOTNULL(
+      PEM_read_X509(ca_file.get(), nullptr, nullptr, nullptr)));
+  unique_ptr<FILE, void (*)(FILE*)> key_file(fopen(FLAGS_ca_key.c_str(), "r"),
+                                             FileCloser);
+  PCHECK(key_file) << "Could not open " << FLAGS_ca_key;
+  EVP_PKEY* const ca_key(CHECK_NOTNULL(PEM_read_PrivateKey(
+      key_file.get(), nullptr, nullptr,
+      const_cast<char*>(FLAGS_ca_key_password.c_str()))));
+
+  // All the certificates are for the same key, as it doesn't matter to
+  // the log.
+  EC_KEY* const ec_key(
+      CHECK_NOTNULL(EC_KEY_new_by_curve_name(NID_X9_62_prime256v1)));
+  CHECK_EQ(1, EC_KEY_generate_key(ec_key));
+  EVP_PKEY* const key(CHECK_NOTNULL(EVP_PKEY_new()));
+  CHECK_EQ(1, EVP_PKEY_assign_EC_KEY(key, ec_key));
+
+  ThreadPool pool(FLAGS_num_threads);
+  LOG(INFO) << "Issuing " << FLAGS_num_certs
+            << " certificates and precertificates";
+  vector<unique_ptr<CertChain>> chains(FLAGS_num_certs);
+  vector<unique_ptr<PreCertChain>> pre_chains(FLAGS_num_certs);
+  util::ParallelFor(FLAGS_num_certs, FLAGS_num_threads, &pool,
+                    [&](size_t i) {
+                      chains[i].reset(new CertChain);
+                      CHECK(chains[i]->AddCert(
+                          new Cert(IssueCert(i, false, ca, ca_key, key))));
+                      CHECK(chains[i]->AddCert(new Cert(X509_dup(ca))));
+                      pre_chains[i].reset(new PreCertChain);
+                      CHECK(pre_chains[i]->AddCert(
+                          new Cert(IssueCert(i, true, ca, ca_key, key))));
+                      CHECK(pre_chains[i]->AddCert(new Cert(X509_dup(ca))));
+                    });
+  EVP_PKEY_free(key);
+  EVP_PKEY_free(ca_key);
+  X509_free(ca);
+
+  const shared_ptr<libevent::Base> event_base(make_shared<libevent::Base>());
+  libevent::EventPumpThread pump(event_base);
+  UrlFetcher fetcher(event_base.get(), &pool);
+  AsyncLogClient client(&pool, &fetcher, FLAGS_ct_server);
+
+  LoadGenerator generator(&client, std::move(chains), std::move(pre_chains));
+  LOG(INFO) << "Sending requests for " << FLAGS_duration_secs << " s";
+  generator.Run(seconds(FLAGS_duration_secs));
+  generator.PrintReport(&std::cout);
+
+  return 0;
+}
@@ -0,0 +1,374 @@
+/* -*- indent-tabs-mode: nil -*- */
+// Sends the requests recorded by a log server with --http_capture_file
+// to a test server, with the same timing (or faster), to reproduce the
+// shape of real traffic, e.g.:
+//
+//   ct_replay --capture_file=prod.capture \
+//       --ct_server=http://127.0.0.1:6962 --speedup=4 \
+//       --results_file=new.results --baseline=old.results
+//
+// The requests are sent when they are due, whether or not the earlier
+// ones have completed, and their latency is measured from then (as in
+// ct_load). The submissions can only be replayed if the bodies were
+// captured (--http_capture_bodies), they are skipped otherwise.
+//
+// At the end, the latencies are printed for each endpoint. The results
+// can be saved with --results_file, in the same format as the capture,
+// and compared with those of another build with --baseline.
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "base/macros.h"
+#include "net/url.h"
+#include "net/url_fetcher.h"
+#include "proto/ct.pb.h"
+#include "util/init.h"
+#include "util/libevent_wrapper.h"
+#include "util/protobuf_util.h"
+#include "util/status.h"
+#include "util/task.h"
+#include "util/thread_pool.h"
+
+namespace libevent = cert_trans::libevent;
+
+using cert_trans::ReadDelimitedFrom;
+using cert_trans::ThreadPool;
+using cert_trans::URL;
+using cert_trans::UrlFetcher;
+using cert_trans::WriteDelimitedToOstream;
+using ct::CapturedRequest;
+using std::bind;
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::steady_clock;
+using std::condition_variable;
+using std::lock_guard;
+using std::map;
+using std::mutex;
+using std::placeholders::_1;
+using std::string;
+using std::unique_lock;
+using std::unique_ptr;
+using std::vector;
+
+DEFINE_string(capture_file, "",
+              "Requests to send, as recorded with --http_capture_file.");
+DEFINE_string(ct_server, "", "URL of the log to send the requests to.");
+DEFINE_double(speedup, 1,
+              "The requests are sent this many times faster than they "
+              "were received.");
+DEFINE_int32(max_outstanding, 10000,
+             "Requests that would be sent while this many are still in "
+             "flight are dropped instead, and counted as such.");
+DEFINE_int32(num_threads, 16, "Number of threads running the callbacks.");
+DEFINE_string(results_file, "",
+              "If set, the latency and reply code of each request sent are "
+              "written to this file, to be given as --baseline later.");
+DEFINE_string(baseline, "",
+              "If set, the results of an earlier run (see --results_file) "
+              "to compare the latencies with.");
+
+namespace {
+
+
+vector<CapturedRequest> ReadRequests(const string& filename) {
+  const int fd(open(filename.c_str(), O_RDONLY));
+  PCHECK(fd >= 0) << "Could not open " << filename;
+  vector<CapturedRequest> requests;
+  {
+    google::protobuf::io::FileInputStream input(fd);
+    CapturedRequest request;
+    bool clean_eof(false);
+    while (ReadDelimitedFrom(&input, &request, &clean_eof)) {
+      requests.push_back(request);
+    }
+    CHECK(clean_eof) << "Truncated or corrupted " << filename << " after "
+                     << requests.size() << " requests";
+  }
+  PCHECK(close(fd) == 0);
+  return requests;
+}
+
+
+// The latencies of the requests to one endpoint.
+struct Summary {
+  Summary() : errors(0) {
+  }
+
+  // Of the requests which got the same reply code as when they were
+  // captured, in ms, sorted once Finish()ed.
+  vector<double> latencies_ms;
+  // The other requests, which failed or got another reply code (and
+  // whose results have a response_code of 0).
+  int errors;
+
+  void Finish() {
+    std::sort(latencies_ms.begin(), latencies_ms.end());
+  }
+
+  double Quantile(double quantile) const {
+    if (latencies_ms.empty()) {
+      return 0;
+    }
+    return latencies_ms[std::min(latencies_ms.size() - 1,
+                                 static_cast<size_t>(latencies_ms.size() *
+                                                     quantile))];
+  }
+};
+
+
+// The results by endpoint.
+map<string, Summary> Summarize(const vector<CapturedRequest>& results) {
+  map<string, Summary> summaries;
+  for (const auto& result : results) {
+    Summary* const summary(&summaries[result.path()]);
+    if (result.response_code() != 0) {
+      summary->latencies_ms.push_back(result.latency_us() / 1000.0);
+    } else {
+      ++summary->errors;
+    }
+  }
+  for (auto& summary : summaries) {
+    summary.second.Finish();
+  }
+  return summaries;
+}
+
+
+void PrintReport(const map<string, Summary>& summaries,
+                 const map<string, Summary>& baseline, std::ostream* out) {
+  const vector<double> quantiles{0.5, 0.9, 0.99};
+  *out << std::left << std::setw(32) << "endpoint" << std::right
+       << std::setw(10) << "ok" << std::setw(10) << "errors"
+       << std::setw(12) << "p50 ms" << std::setw(12) << "p90 ms"
+       << std::setw(12) << "p99 ms";
+  if (!baseline.empty()) {
+    *out << std::setw(12) << "p50 delta" << std::setw(12) << "p90 delta"
+         << std::setw(12) << "p99 delta";
+  }
+  *out << "\n" << std::fixed << std::setprecision(2);
+  for (const auto& it : summaries) {
+    const Summary& summary(it.second);
+    *out << std::left << std::setw(32) << it.first << std::right
+         << std::setw(10) << summary.latencies_ms.size() << std::setw(10)
+         << summary.errors;
+    for (double quantile : quantiles) {
+      *out << std::setw(12) << summary.Quantile(quantile);
+    }
+    const auto base(baseline.find(it.first));
+    if (base != baseline.end() && !base->second.latencies_ms.empty()) {
+      for (double quantile : quantiles) {
+        const double before(base->second.Quantile(quantile));
+        *out << std::setw(11)
+             << 100 * (summary.Quantile(quantile) - before) / before << "%";
+      }
+    }
+    *out << "\n";
+  }
+}
+
+
+class Replayer {
+ public:
+  Replayer(UrlFetcher* fetcher, ThreadPool* pool, const URL& server)
+      : fetcher_(CHECK_NOTNULL(fetcher)),
+        pool_(CHECK_NOTNULL(pool)),
+        server_(server),
+        skipped_(0),
+        dropped_(0),
+        outstanding_(0) {
+  }
+
+  // Sends |requests|, sorted by arrival, and waits for the last ones
+  // to complete.
+  void Run(const vector<CapturedRequest>& requests);
+
+  const vector<CapturedRequest>& results() const {
+    return results_;
+  }
+
+  int skipped() const {
+    return skipped_;
+  }
+
+  int dropped() const {
+    return dropped_;
+  }
+
+ private:
+  void Send(const CapturedRequest& request,
+            const steady_clock::time_point& due);
+  void Done(const CapturedRequest& request,
+            const steady_clock::time_point& due,
+            UrlFetcher::Response* resp, util::Task* task);
+
+  UrlFetcher* const fetcher_;
+  ThreadPool* const pool_;
+  const URL server_;
+  // Submissions without their body.
+  int skipped_;
+
+  mutex lock_;
+  vector<CapturedRequest> results_;
+  int dropped_;
+  int outstanding_;
+  condition_variable outstanding_done_;
+
+  DISALLOW_COPY_AND_ASSIGN(Replayer);
+};
+
+
+void Replayer::Run(const vector<CapturedRequest>& requests) {
+  if (requests.empty()) {
+    return;
+  }
+  const int64_t first_us(requests.front().arrival_us());
+  const steady_clock::time_point start(steady_clock::now());
+  for (const auto& request : requests) {
+    const steady_clock::time_point due(
+        start + duration_cast<steady_clock::duration>(microseconds(
+                    static_cast<int64_t>((request.arrival_us() - first_us) /
+                                         FLAGS_speedup))));
+    if (request.post() && !request.has_body() && request.body_size() > 0) {
+      ++skipped_;
+      continue;
+    }
+    std::this_thread::sleep_until(due);
+    Send(request, due);
+  }
+
+  unique_lock<mutex> lock(lock_);
+  outstanding_done_.wait(lock, [this]() { return outstanding_ == 0; });
+}
+
+
+void Replayer::Send(const CapturedRequest& request,
+                    const steady_clock::time_point& due) {
+  {
+    lock_guard<mutex> lock(lock_);
+    if (outstanding_ >= FLAGS_max_outstanding) {
+      ++dropped_;
+      return;
+    }
+    ++outstanding_;
+  }
+
+  UrlFetcher::Request req(server_);
+  req.url.SetPath(server_.Path() + request.path());
+  req.url.SetQuery(request.query());
+  if (request.post()) {
+    req.verb = UrlFetcher::Verb::POST;
+    req.body = request.body();
+  }
+  UrlFetcher::Response* const resp(new UrlFetcher::Response);
+  fetcher_->Fetch(req, resp,
+                  new util::Task(bind(&Replayer::Done, this, request, due,
+                                      resp, _1),
+                                 pool_));
+}
+
+
+void Replayer::Done(const CapturedRequest& request,
+                    const steady_clock::time_point& due,
+                    UrlFetcher::Response* resp, util::Task* task) {
+  unique_ptr<UrlFetcher::Response> resp_deleter(CHECK_NOTNULL(resp));
+  unique_ptr<util::Task> task_deleter(CHECK_NOTNULL(task));
+
+  CapturedRequest result;
+  result.set_arrival_us(request.arrival_us());
+  result.set_path(request.path());
+  result.set_query(request.query());
+  result.set_post(request.post());
+  if (task->status().ok()) {
+    result.set_response_code(resp->status_code);
+  } else {
+    VLOG(1) << request.path() << " failed: " << task->status();
+  }
+  result.set_latency_us(
+      duration_cast<microseconds>(steady_clock::now() - due).count());
+  if (result.response_code() != request.response_code()) {
+    VLOG(1) << request.path() << "?" << request.query() << " got "
+            << result.response_code() << " instead of "
+            << request.response_code();
+    // Counted as an error, whatever the code.
+    result.set_response_code(0);
+  }
+
+  lock_guard<mutex> lock(lock_);
+  results_.emplace_back(std::move(result));
+  CHECK_GT(outstanding_, 0);
+  if (--outstanding_ == 0) {
+    outstanding_done_.notify_all();
+  }
+}
+
+
+}  // namespace
+
+
+int main(int argc, char* argv[]) {
+  util::InitCT(&argc, &argv);
+  CHECK(!FLAGS_capture_file.empty()) << "Please specify --capture_file";
+  CHECK(!FLAGS_ct_server.empty()) << "Please specify --ct_server";
+  CHECK_GT(FLAGS_speedup, 0);
+  CHECK_GT(FLAGS_max_outstanding, 0);
+  CHECK_GT(FLAGS_num_threads, 0);
+
+  // They are written as they complete, not as they arrive.
+  vector<CapturedRequest> requests(ReadRequests(FLAGS_capture_file));
+  std::stable_sort(requests.begin(), requests.end(),
+                   [](const CapturedRequest& a, const CapturedRequest& b) {
+                     return a.arrival_us() < b.arrival_us();
+                   });
+  map<string, Summary> baseline;
+  if (!FLAGS_baseline.empty()) {
+    baseline = Summarize(ReadRequests(FLAGS_baseline));
+  }
+
+  ThreadPool pool(FLAGS_num_threads);
+  const std::shared_ptr<libevent::Base> event_base(
+      std::make_shared<libevent::Base>());
+  libevent::EventPumpThread pump(event_base);
+  UrlFetcher fetcher(event_base.get(), &pool);
+
+  Replayer replayer(&fetcher, &pool, URL(FLAGS_ct_server));
+  LOG(INFO) << "Sending " << requests.size() << " requests";
+  const steady_clock::time_point start(steady_clock::now());
+  replayer.Run(requests);
+  const double elapsed_secs(
+      std::chrono::duration<double>(steady_clock::now() - start).count());
+
+  if (!FLAGS_results_file.empty()) {
+    std::ofstream out(FLAGS_results_file,
+                      std::ios::out | std::ios::trunc | std::ios::binary);
+    CHECK(out.good()) << "Could not open " << FLAGS_results_file;
+    for (const auto& result : replayer.results()) {
+      CHECK(WriteDelimitedToOstream(result, &out));
+    }
+  }
+
+  std::cout << "Ran for " << elapsed_secs << " s, skipped "
+            << replayer.skipped() << " submissions without their body, "
+            << "dropped " << replayer.dropped() << " requests\n\n";
+  PrintReport(Summarize(replayer.results()), baseline, &std::cout);
+
+  return 0;
+}
@@ -1,18 +1,39 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
 #include <functional>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <iostream>
 #include <limits.h>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
+#include "config.h"
 #include "log/database.h"
 #include "log/file_db.h"
 #include "log/file_storage.h"
 #include "log/leveldb_db.h"
 #include "log/logged_certificate.h"
+#ifdef HAVE_ROCKSDB
+#include "log/rocksdb_db.h"
+#endif
 #include "log/sqlite_db.h"
+#include "merkletree/merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "merkletree/tree_hasher.h"
 #include "proto/serializer.h"
+#include "util/dictionary_compressor.h"
 #include "util/init.h"
+#include "util/parallel_for.h"
+#include "util/thread_pool.h"
 #include "util/util.h"
 
 DEFINE_string(cert_dir, "", "Storage directory for certificates");
@@ -28,18 +49,53 @@ DEFINE_string(sqlite_db, "",
               "SQLite database for certificate and tree storage");
 DEFINE_string(leveldb_db, "",
               "LevelDB database for certificate and tree storage");
+DEFINE_string(rocksdb_db, "",
+              "RocksDB database for certificate and tree storage, if "
+              "built with RocksDB support");
 
 DEFINE_int64(start, 0, "Starting sequence number (inclusive).");
 DEFINE_int64(end, std::numeric_limits<int64_t>::max(),
              "Ending sequence number (inclusive).");
+DEFINE_int32(num_threads, 4, "Number of threads used by verify.");
+DEFINE_int64(verify_chunk_size, 1 << 16,
+             "Number of entries checked at a time by each thread of verify. "
+             "Must be a power of two.");
+
+DEFINE_string(dest_sqlite_db, "",
+              "SQLite database that migrate copies the database to.");
+DEFINE_string(dest_leveldb_db, "",
+              "LevelDB database that migrate copies the database to.");
+DEFINE_string(dest_rocksdb_db, "",
+              "RocksDB database that migrate copies the database to.");
+DEFINE_int32(migrate_batch_size, 10000,
+             "Number of entries migrate writes at a time.");
+DEFINE_int32(migrate_read_ahead, 4,
+             "Number of batches migrate reads ahead of the writes.");
+
+DEFINE_string(dictionary_file, "",
+              "File that build_dictionary writes the dictionary to.");
+
+DECLARE_bool(leveldb_subtree_hashes);
 
 using cert_trans::FileStorage;
 using cert_trans::LoggedCertificate;
+using cert_trans::ThreadPool;
+using std::atomic;
 using std::cerr;
+using std::chrono::duration;
+using std::chrono::steady_clock;
+using std::condition_variable;
 using std::cout;
+using std::deque;
 using std::function;
+using std::lock_guard;
+using std::map;
+using std::mutex;
 using std::string;
+using std::unique_lock;
 using std::unique_ptr;
+using std::vector;
+using util::DictionaryCompressor;
 using util::InitCT;
 using util::ToBase64;
 
@@ -47,7 +103,24 @@ using util::ToBase64;
 void Usage() {
   cerr << "Usage: db_tool [flags] <command>\n"
        << "Where <command> is one of:\n"
-       << "  dump_leaf_inputs\n";
+       << "  dump_leaf_inputs\n"
+       << "  verify         check the entries, the hash index and the "
+       << "root\n"
+       << "                 of the latest tree head\n"
+       << "  rebuild_index  rebuild the hash index and, with\n"
+       << "                 --leveldb_subtree_hashes, the subtree hashes "
+       << "of\n"
+       << "                 --leveldb_db (resumes if interrupted)\n"
+       << "  migrate        copy the database to --dest_leveldb_db,\n"
+       << "                 --dest_rocksdb_db or --dest_sqlite_db "
+       << "(resumes if\n"
+       << "                 interrupted)\n"
+       << "  build_dictionary\n"
+       << "                 write a dictionary for "
+       << "--leveldb_entry_dictionary\n"
+       << "                 to --dictionary_file, from the entries "
+       << "between\n"
+       << "                 --start and --end\n";
 }
 
 
@@ -82,6 +155,358 @@ int DumpLeafInputs(const ReadOnlyDatabase<LoggedCertificate>* db) {
 }
 
 
+// Checks the entries from |begin| to |end|, and returns the root of
+// the subtree they form. Problems are logged, and counted in |errors|.
+string VerifyRange(const ReadOnlyDatabase<LoggedCertificate>* db,
+                   int64_t begin, int64_t end, atomic<int64_t>* errors) {
+  const TreeHasher hasher(new Sha256Hasher);
+  MerkleTree tree(new Sha256Hasher);
+  const unique_ptr<ReadOnlyDatabase<LoggedCertificate>::Iterator> it(
+      db->ScanEntries(begin));
+  // What the tree is built from, which may be stored apart.
+  const unique_ptr<ReadOnlyDatabase<LoggedCertificate>::LeafHashIterator>
+      leaf_hashes(db->ScanLeafHashes(begin));
+  ReadOnlyDatabase<LoggedCertificate>::LeafHash stored;
+  LoggedCertificate cert;
+  LoggedCertificate indexed;
+  for (int64_t seq = begin; seq < end; ++seq) {
+    if (!it->GetNextEntry(&cert) || cert.sequence_number() != seq) {
+      LOG(ERROR) << "Missing entry with seq# " << seq;
+      ++*errors;
+      return string();
+    }
+
+    string leaf;
+    CHECK(cert.SerializeForLeaf(&leaf)) << "Failed to serialize entry with "
+                                        << "seq# " << seq;
+    const string leaf_hash(hasher.HashLeaf(leaf));
+    if (!cert.merkle_leaf_hash().empty() &&
+        cert.merkle_leaf_hash() != leaf_hash) {
+      LOG(ERROR) << "Wrong stored leaf hash for entry with seq# " << seq;
+      ++*errors;
+    }
+    if (!leaf_hashes->GetNextLeafHash(&stored) ||
+        stored.sequence_number != seq || stored.hash != leaf_hash ||
+        stored.timestamp != cert.timestamp()) {
+      LOG(ERROR) << "Wrong leaf hash scanned for entry with seq# " << seq;
+      ++*errors;
+    }
+
+    // The hash index has the first entry with each hash.
+    if (db->LookupByHash(cert.Hash(), &indexed) !=
+        ReadOnlyDatabase<LoggedCertificate>::LOOKUP_OK) {
+      LOG(ERROR) << "Entry with seq# " << seq << " is not in the hash index";
+      ++*errors;
+    } else if (indexed.sequence_number() > seq ||
+               indexed.Hash() != cert.Hash()) {
+      LOG(ERROR) << "Hash of entry with seq# " << seq << " is indexed to "
+                 << "seq# " << indexed.sequence_number();
+      ++*errors;
+    }
+
+    tree.AddLeafHash(leaf_hash);
+  }
+  return tree.CurrentRoot();
+}
+
+
+int Verify(const ReadOnlyDatabase<LoggedCertificate>* db) {
+  CHECK_NOTNULL(db);
+  CHECK_GT(FLAGS_num_threads, 0);
+  CHECK_GT(FLAGS_verify_chunk_size, 0);
+  CHECK_EQ(0, FLAGS_verify_chunk_size & (FLAGS_verify_chunk_size - 1))
+      << "--verify_chunk_size must be a power of two";
+
+  ct::SignedTreeHead sth;
+  if (db->LatestTreeHead(&sth) !=
+      ReadOnlyDatabase<LoggedCertificate>::LOOKUP_OK) {
+    LOG(ERROR) << "No tree head to verify";
+    return 1;
+  }
+  const int64_t tree_size(sth.tree_size());
+  if (db->TreeSize() < tree_size) {
+    LOG(ERROR) << "The database has " << db->TreeSize() << " contiguous "
+               << "entries, but its latest tree head has " << tree_size;
+    return 1;
+  }
+
+  // Chunks of a power of two entries are perfect subtrees, so the root
+  // of the tree can be computed from theirs.
+  const int64_t chunk_size(FLAGS_verify_chunk_size);
+  vector<string> chunk_roots((tree_size + chunk_size - 1) / chunk_size);
+  atomic<int64_t> errors(0);
+  atomic<size_t> chunks_done(0);
+  ThreadPool pool(FLAGS_num_threads);
+  util::ParallelFor(chunk_roots.size(), FLAGS_num_threads, &pool,
+                    [&](size_t i) {
+                      const int64_t begin(i * chunk_size);
+                      chunk_roots[i] = VerifyRange(
+                          db, begin, std::min(tree_size, begin + chunk_size),
+                          &errors);
+                      LOG(INFO) << "Verified " << ++chunks_done << " of "
+                                << chunk_roots.size() << " chunks";
+                    });
+
+  MerkleTree tree(new Sha256Hasher);
+  for (const auto& root : chunk_roots) {
+    tree.AddLeafHash(root);
+  }
+  if (tree.CurrentRoot() != sth.sha256_root_hash()) {
+    LOG(ERROR) << "Root of the first " << tree_size << " entries does not "
+               << "match the tree head @ " << sth.timestamp();
+    ++errors;
+  }
+
+  if (errors > 0) {
+    cout << "Verifying " << tree_size << " entries found " << errors
+         << " problems\n";
+    return 1;
+  }
+  cout << "Verified " << tree_size << " entries against the tree head @ "
+       << sth.timestamp() << "\n";
+  return 0;
+}
+
+
+// The batches of entries read by migrate, waiting to be written.
+class EntryBatches {
+ public:
+  explicit EntryBatches(size_t max_batches)
+      : max_batches_(max_batches), closed_(false) {
+    CHECK_GT(max_batches_, 0U);
+  }
+
+  void Push(vector<LoggedCertificate>* batch) {
+    unique_lock<mutex> lock(lock_);
+    cv_.wait(lock, [this]() { return batches_.size() < max_batches_; });
+    batches_.emplace_back();
+    batches_.back().swap(*batch);
+    cv_.notify_all();
+  }
+
+  // No more batches will be pushed.
+  void Close() {
+    lock_guard<mutex> lock(lock_);
+    closed_ = true;
+    cv_.notify_all();
+  }
+
+  // Returns false once all the batches have been popped, and Close()
+  // has been called.
+  bool Pop(vector<LoggedCertificate>* batch) {
+    unique_lock<mutex> lock(lock_);
+    cv_.wait(lock, [this]() { return !batches_.empty() || closed_; });
+    if (batches_.empty()) {
+      return false;
+    }
+    batch->swap(batches_.front());
+    batches_.pop_front();
+    cv_.notify_all();
+    return true;
+  }
+
+ private:
+  const size_t max_batches_;
+  mutex lock_;
+  condition_variable cv_;
+  deque<vector<LoggedCertificate>> batches_;
+  bool closed_;
+};
+
+
+// Copies the entries of |src| from |start| onwards to |dest|, in
+// batches of --migrate_batch_size. They are read on another thread, so
+// that reading and writing overlap. Returns the number of entries
+// copied, or -1 on error.
+int64_t CopyEntries(const ReadOnlyDatabase<LoggedCertificate>* src,
+                    int64_t start, Database<LoggedCertificate>* dest) {
+  EntryBatches batches(FLAGS_migrate_read_ahead);
+  std::thread reader([src, start, &batches]() {
+    const unique_ptr<ReadOnlyDatabase<LoggedCertificate>::Iterator> it(
+        src->ScanEntries(start));
+    vector<LoggedCertificate> batch(FLAGS_migrate_batch_size);
+    size_t size(0);
+    while (it->GetNextEntry(&batch[size])) {
+      if (++size == batch.size()) {
+        batches.Push(&batch);
+        batch.resize(FLAGS_migrate_batch_size);
+        size = 0;
+      }
+    }
+    if (size > 0) {
+      batch.resize(size);
+      batches.Push(&batch);
+    }
+    batches.Close();
+  });
+
+  const steady_clock::time_point begin(steady_clock::now());
+  int64_t copied(0);
+  vector<LoggedCertificate> batch;
+  vector<const LoggedCertificate*> pointers;
+  while (batches.Pop(&batch)) {
+    pointers.clear();
+    for (const auto& entry : batch) {
+      pointers.push_back(&entry);
+    }
+    const Database<LoggedCertificate>::WriteResult result(
+        dest->CreateSequencedEntries(pointers));
+    if (result != Database<LoggedCertificate>::OK) {
+      // Let the reader finish, so that it can be joined.
+      LOG(ERROR) << "Failed to write the entries from seq# "
+                 << batch.front().sequence_number() << ": " << result;
+      while (batches.Pop(&batch)) {
+      }
+      copied = -1;
+      break;
+    }
+    copied += batch.size();
+    LOG_EVERY_N(INFO, 10)
+        << "Copied " << copied << " entries, up to seq# "
+        << batch.back().sequence_number() << " ("
+        << copied / duration<double>(steady_clock::now() - begin).count()
+        << " entries/s)";
+  }
+  reader.join();
+  return copied;
+}
+
+
+int Migrate(ReadOnlyDatabase<LoggedCertificate>* src) {
+  CHECK_NOTNULL(src);
+  CHECK_GT(FLAGS_migrate_batch_size, 0);
+  CHECK_GT(FLAGS_migrate_read_ahead, 0);
+  if (!FLAGS_dest_sqlite_db.empty() + !FLAGS_dest_leveldb_db.empty() +
+          !FLAGS_dest_rocksdb_db.empty() !=
+      1) {
+    LOG(ERROR) << "migrate needs one of --dest_sqlite_db, --dest_leveldb_db "
+               << "or --dest_rocksdb_db";
+    return 1;
+  }
+  if ((!FLAGS_sqlite_db.empty() && FLAGS_dest_sqlite_db == FLAGS_sqlite_db) ||
+      (!FLAGS_leveldb_db.empty() &&
+       FLAGS_dest_leveldb_db == FLAGS_leveldb_db) ||
+      (!FLAGS_rocksdb_db.empty() &&
+       FLAGS_dest_rocksdb_db == FLAGS_rocksdb_db)) {
+    LOG(ERROR) << "migrate cannot copy a database onto itself";
+    return 1;
+  }
+
+  unique_ptr<Database<LoggedCertificate>> dest;
+  if (!FLAGS_dest_sqlite_db.empty()) {
+    dest.reset(new SQLiteDB<LoggedCertificate>(FLAGS_dest_sqlite_db));
+  } else if (!FLAGS_dest_leveldb_db.empty()) {
+    dest.reset(new LevelDB<LoggedCertificate>(FLAGS_dest_leveldb_db));
+  } else {
+#ifdef HAVE_ROCKSDB
+    dest.reset(new RocksDB<LoggedCertificate>(FLAGS_dest_rocksdb_db));
+#else
+    LOG(ERROR) << "--dest_rocksdb_db is not supported by this build";
+    return 1;
+#endif
+  }
+
+  // An interrupted migration carries on after the entries it copied.
+  const int64_t start(dest->TreeSize());
+  if (start > 0) {
+    LOG(INFO) << "Resuming after the " << start << " entries already copied";
+  }
+  const int64_t copied(CopyEntries(src, start, dest.get()));
+  if (copied < 0) {
+    return 1;
+  }
+  LOG(INFO) << "Copied " << copied << " entries";
+
+  string node_id;
+  if (src->NodeId(&node_id) == ReadOnlyDatabase<LoggedCertificate>::LOOKUP_OK) {
+    string dest_node_id;
+    if (dest->NodeId(&dest_node_id) ==
+        ReadOnlyDatabase<LoggedCertificate>::NOT_FOUND) {
+      dest->InitializeNode(node_id);
+    } else if (dest_node_id != node_id) {
+      LOG(ERROR) << "Destination already belongs to node " << dest_node_id;
+      return 1;
+    }
+  }
+
+  // Only the latest tree head is needed to serve, and it is the only
+  // one the Database interface gives access to.
+  ct::SignedTreeHead sth;
+  if (src->LatestTreeHead(&sth) ==
+      ReadOnlyDatabase<LoggedCertificate>::LOOKUP_OK) {
+    ct::SignedTreeHead dest_sth;
+    if (dest->LatestTreeHead(&dest_sth) !=
+            ReadOnlyDatabase<LoggedCertificate>::LOOKUP_OK ||
+        dest_sth.timestamp() < sth.timestamp()) {
+      CHECK_EQ(Database<LoggedCertificate>::OK, dest->WriteTreeHead(sth));
+    }
+    return Verify(dest.get());
+  }
+  return 0;
+}
+
+
+// The chain certificates are what the entries have most in common,
+// and they share a lot with the leaf certificates too (names, URLs,
+// policies), so the dictionary is made of the most frequent of them,
+// as many as fit, the most frequent at the end, where deflate finds
+// matches the cheapest.
+int BuildDictionary(const ReadOnlyDatabase<LoggedCertificate>* db) {
+  CHECK_NOTNULL(db);
+  if (FLAGS_dictionary_file.empty()) {
+    LOG(ERROR) << "build_dictionary needs --dictionary_file";
+    return 1;
+  }
+
+  map<string, int64_t> counts;
+  ForEachLeaf(db, [&counts](const LoggedCertificate& cert) {
+    const ct::LogEntry& entry(cert.entry());
+    for (const string& chain_cert :
+         entry.type() == ct::X509_ENTRY
+             ? entry.x509_entry().certificate_chain()
+             : entry.precert_entry().precertificate_chain()) {
+      ++counts[chain_cert];
+    }
+  });
+
+  vector<std::pair<int64_t, const string*>> by_count;
+  for (const auto& count : counts) {
+    by_count.emplace_back(count.second, &count.first);
+  }
+  std::sort(by_count.begin(), by_count.end(),
+            [](const std::pair<int64_t, const string*>& a,
+               const std::pair<int64_t, const string*>& b) {
+              return a.first > b.first;
+            });
+  vector<const string*> chosen;
+  size_t size(0);
+  for (const auto& count : by_count) {
+    if (size + count.second->size() <=
+        DictionaryCompressor::kMaxDictionaryBytes) {
+      chosen.push_back(count.second);
+      size += count.second->size();
+    }
+  }
+  string dictionary;
+  for (auto it = chosen.rbegin(); it != chosen.rend(); ++it) {
+    dictionary.append(**it);
+  }
+
+  std::ofstream out(FLAGS_dictionary_file,
+                    std::ios::out | std::ios::binary | std::ios::trunc);
+  out.write(dictionary.data(), dictionary.size());
+  out.close();
+  if (!out) {
+    LOG(ERROR) << "Failed to write " << FLAGS_dictionary_file;
+    return 1;
+  }
+  cout << "Wrote a dictionary of " << chosen.size() << " of the "
+       << counts.size() << " chain certificates (" << dictionary.size()
+       << " bytes, id " << DictionaryCompressor(dictionary).id() << ")\n";
+  return 0;
+}
+
+
 int main(int argc, char* argv[]) {
   InitCT(&argc, &argv);
 
@@ -94,22 +519,41 @@ int main(int argc, char* argv[]) {
   // TODO(alcutter): Refactor this out into a common CreateDatabase() call
   // somewhere.
   if (!FLAGS_sqlite_db.empty() + !FLAGS_leveldb_db.empty() +
+          !FLAGS_rocksdb_db.empty() +
           (!FLAGS_cert_dir.empty() | !FLAGS_tree_dir.empty()) !=
       1) {
     LOG(FATAL) << "Must only specify one database type.";
   }
 
-  if (FLAGS_sqlite_db.empty() && FLAGS_leveldb_db.empty()) {
+  if (FLAGS_sqlite_db.empty() && FLAGS_leveldb_db.empty() &&
+      FLAGS_rocksdb_db.empty()) {
     CHECK_NE(FLAGS_cert_dir, FLAGS_tree_dir)
         << "Certificate directory and tree directory must differ";
   }
 
+  const string command(argv[1]);
+  if (command == "rebuild_index") {
+    // FileDB indexes its entries in memory, and SQLite maintains its
+    // own indexes.
+    if (FLAGS_leveldb_db.empty()) {
+      LOG(ERROR) << "rebuild_index is only supported with --leveldb_db";
+      return 1;
+    }
+    LevelDB<LoggedCertificate>::DropIndexes(FLAGS_leveldb_db);
+  }
+
   unique_ptr<ReadOnlyDatabase<LoggedCertificate>> db;
 
   if (!FLAGS_sqlite_db.empty()) {
     db.reset(new SQLiteDB<LoggedCertificate>(FLAGS_sqlite_db));
   } else if (!FLAGS_leveldb_db.empty()) {
     db.reset(new LevelDB<LoggedCertificate>(FLAGS_leveldb_db));
+  } else if (!FLAGS_rocksdb_db.empty()) {
+#ifdef HAVE_ROCKSDB
+    db.reset(new RocksDB<LoggedCertificate>(FLAGS_rocksdb_db));
+#else
+    LOG(FATAL) << "--rocksdb_db is not supported by this build";
+#endif
   } else {
     db.reset(new FileDB<LoggedCertificate>(
         new FileStorage(FLAGS_cert_dir, FLAGS_cert_storage_depth),
@@ -118,8 +562,21 @@ int main(int argc, char* argv[]) {
   }
   // ------8<----------8<---------8<-----------
 
-  if (strcmp(argv[1], "dump_leaf_inputs") == 0) {
+  if (command == "dump_leaf_inputs") {
     return DumpLeafInputs(db.get());
+  } else if (command == "verify") {
+    return Verify(db.get());
+  } else if (command == "migrate") {
+    return Migrate(db.get());
+  } else if (command == "build_dictionary") {
+    return BuildDictionary(db.get());
+  } else if (command == "rebuild_index") {
+    // Opening the database did the work.
+    cout << "Rebuilt the indexes of " << db->TreeSize()
+         << " contiguous entries"
+         << (FLAGS_leveldb_subtree_hashes ? ", with subtree hashes" : "")
+         << "\n";
+    return 0;
   } else {
     Usage();
     return 1;
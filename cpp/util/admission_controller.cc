@@ -0,0 +1,104 @@
+#include "util/admission_controller.h"
+
+#include <algorithm>
+#include <glog/logging.h>
+
+using std::chrono::duration;
+using std::lock_guard;
+using std::max;
+using std::min;
+using std::mutex;
+
+namespace util {
+
+namespace {
+
+// The limit never goes below this, so that the backend keeps being
+// probed.
+const double kMinRate = 1;
+
+// The limit is lifted when the admitted rate is below this fraction
+// of it, and nothing was rejected.
+const double kUnlimitedFraction = 0.5;
+
+
+}  // namespace
+
+
+AdmissionController::AdmissionController(double increase,
+                                         double decrease_factor,
+                                         const Clock::time_point& now)
+    : increase_(increase),
+      decrease_factor_(decrease_factor),
+      rate_(-1),
+      tokens_(0),
+      last_refill_(now),
+      last_update_(now),
+      admitted_(0),
+      rejected_(0) {
+  CHECK_GE(increase_, 0);
+  CHECK_GT(decrease_factor_, 0);
+  CHECK_LT(decrease_factor_, 1);
+}
+
+
+bool AdmissionController::Admit(const Clock::time_point& now) {
+  lock_guard<mutex> lock(lock_);
+  if (rate_ < 0) {
+    ++admitted_;
+    return true;
+  }
+
+  if (now > last_refill_) {
+    // Allow bursts of up to one second worth of requests.
+    tokens_ = min(max(rate_, 1.0),
+                  tokens_ + rate_ * duration<double>(now - last_refill_).count());
+    last_refill_ = now;
+  }
+  if (tokens_ < 1) {
+    ++rejected_;
+    return false;
+  }
+  tokens_ -= 1;
+  ++admitted_;
+  return true;
+}
+
+
+void AdmissionController::Update(bool congested,
+                                 const Clock::time_point& now) {
+  lock_guard<mutex> lock(lock_);
+  const double period(duration<double>(now - last_update_).count());
+  if (period <= 0) {
+    return;
+  }
+  const double admitted_rate(admitted_ / period);
+
+  if (congested) {
+    // Back off from what actually got through, which can be below the
+    // limit.
+    const double base(rate_ < 0 ? admitted_rate : min(rate_, admitted_rate));
+    rate_ = max(kMinRate, base * decrease_factor_);
+    tokens_ = min(tokens_, rate_);
+    last_refill_ = now;
+  } else if (rate_ >= 0) {
+    if (rejected_ == 0 && admitted_rate < rate_ * kUnlimitedFraction) {
+      rate_ = -1;
+    } else {
+      rate_ += increase_;
+    }
+  }
+
+  last_update_ = now;
+  admitted_ = 0;
+  rejected_ = 0;
+}
+
+
+double AdmissionController::rate() const {
+  lock_guard<mutex> lock(lock_);
+  return rate_;
+}
+
+
+}  // namespace util
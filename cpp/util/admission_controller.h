@@ -0,0 +1,61 @@
+#ifndef CERT_TRANS_UTIL_ADMISSION_CONTROLLER_H_
+#define CERT_TRANS_UTIL_ADMISSION_CONTROLLER_H_
+
+#include <chrono>
+#include <mutex>
+#include <stdint.h>
+
+#include "base/macros.h"
+
+namespace util {
+
+
+// Token bucket admission control, with a rate adjusted by additive
+// increase and multiplicative decrease (AIMD), from periodic reports
+// on whether the backend is congested. This sheds load progressively,
+// instead of letting everything through until a hard limit is hit.
+//
+// Requests are not limited until the first congested update. The
+// limit is lifted again once it is well above the admitted rate.
+//
+// This class is thread-safe.
+class AdmissionController {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  // |increase| is the rate, in requests per second, added to the
+  // limit on each uncongested update. The limit is multiplied by
+  // |decrease_factor| on each congested update.
+  AdmissionController(double increase, double decrease_factor,
+                      const Clock::time_point& now);
+
+  // Returns true if a request arriving at |now| should be let through.
+  bool Admit(const Clock::time_point& now);
+
+  // Adjusts the limit according to the requests seen since the
+  // previous update.
+  void Update(bool congested, const Clock::time_point& now);
+
+  // The current limit in requests per second, or a negative value if
+  // requests are not limited.
+  double rate() const;
+
+ private:
+  const double increase_;
+  const double decrease_factor_;
+
+  mutable std::mutex lock_;
+  double rate_;
+  double tokens_;
+  Clock::time_point last_refill_;
+  Clock::time_point last_update_;
+  int64_t admitted_;
+  int64_t rejected_;
+
+  DISALLOW_COPY_AND_ASSIGN(AdmissionController);
+};
+
+
+}  // namespace util
+
+#endif  // CERT_TRANS_UTIL_ADMISSION_CONTROLLER_H_
@@ -0,0 +1,100 @@
+#include <chrono>
+#include <gtest/gtest.h>
+
+#include "util/admission_controller.h"
+#include "util/testing.h"
+
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+using util::AdmissionController;
+
+namespace {
+
+
+class AdmissionControllerTest : public ::testing::Test {
+ protected:
+  AdmissionControllerTest()
+      : now_(AdmissionController::Clock::now()), controller_(10, 0.5, now_) {
+  }
+
+  // Sends |num| requests evenly over one second, and returns how many
+  // were admitted.
+  int Send(int num) {
+    int admitted(0);
+    const AdmissionController::Clock::time_point start(now_);
+    for (int i = 1; i <= num; ++i) {
+      if (controller_.Admit(start + milliseconds(1000 * i / num))) {
+        ++admitted;
+      }
+    }
+    now_ = start + seconds(1);
+    return admitted;
+  }
+
+  AdmissionController::Clock::time_point now_;
+  AdmissionController controller_;
+};
+
+
+TEST_F(AdmissionControllerTest, UnlimitedUntilCongested) {
+  EXPECT_EQ(1000, Send(1000));
+  controller_.Update(false, now_);
+  EXPECT_GT(0, controller_.rate());
+  EXPECT_EQ(1000, Send(1000));
+}
+
+
+TEST_F(AdmissionControllerTest, DecreasesWhenCongested) {
+  EXPECT_EQ(100, Send(100));
+  controller_.Update(true, now_);
+  EXPECT_DOUBLE_EQ(50, controller_.rate());
+  EXPECT_EQ(50, Send(100));
+
+  controller_.Update(true, now_);
+  EXPECT_DOUBLE_EQ(25, controller_.rate());
+  EXPECT_EQ(25, Send(100));
+}
+
+
+TEST_F(AdmissionControllerTest, IncreasesWhenNotCongested) {
+  EXPECT_EQ(100, Send(100));
+  controller_.Update(true, now_);
+  EXPECT_DOUBLE_EQ(50, controller_.rate());
+
+  EXPECT_EQ(50, Send(100));
+  controller_.Update(false, now_);
+  EXPECT_DOUBLE_EQ(60, controller_.rate());
+  EXPECT_NEAR(60, Send(100), 1);
+}
+
+
+TEST_F(AdmissionControllerTest, NeverBlocksEverything) {
+  Send(1);
+  for (int i = 0; i < 10; ++i) {
+    controller_.Update(true, now_);
+    Send(100);
+  }
+  EXPECT_DOUBLE_EQ(1, controller_.rate());
+  EXPECT_EQ(1, Send(100));
+}
+
+
+TEST_F(AdmissionControllerTest, LiftsLimitWhenLoadDrops) {
+  EXPECT_EQ(100, Send(100));
+  controller_.Update(true, now_);
+  EXPECT_DOUBLE_EQ(50, controller_.rate());
+
+  EXPECT_EQ(10, Send(10));
+  controller_.Update(false, now_);
+  EXPECT_GT(0, controller_.rate());
+  EXPECT_EQ(100, Send(100));
+}
+
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -1,29 +1,53 @@
+#include <algorithm>
+#include <chrono>
 #include <event2/thread.h>
 #include <functional>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
 
+#include "log/etcd_consistent_store.h"
+#include "log/logged_certificate.h"
+#include "proto/ct.pb.h"
 #include "util/etcd.h"
+#include "util/fake_etcd.h"
 #include "util/libevent_wrapper.h"
+#include "util/masterelection.h"
 #include "util/sync_task.h"
 #include "util/thread_pool.h"
+#include "util/util.h"
 
 namespace libevent = cert_trans::libevent;
 
+using cert_trans::EntryHandle;
 using cert_trans::EtcdClient;
+using cert_trans::EtcdConsistentStore;
+using cert_trans::FakeEtcdClient;
+using cert_trans::LoggedCertificate;
+using cert_trans::MasterElection;
 using cert_trans::ThreadPool;
 using cert_trans::UrlFetcher;
 using std::bind;
+using std::chrono::duration;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::lock_guard;
 using std::make_shared;
+using std::map;
+using std::move;
+using std::mutex;
 using std::placeholders::_1;
 using std::shared_ptr;
 using std::string;
 using std::thread;
 using std::to_string;
+using std::unique_ptr;
 using std::vector;
 using util::Status;
 using util::SyncTask;
@@ -35,6 +59,28 @@ DEFINE_int32(requests_per_thread, 10, "number of requests per thread");
 DEFINE_int32(bytes_per_request, 10, "number of bytes per requests");
 DEFINE_int32(num_threads, 1, "number of threads");
 DEFINE_string(test_key, "/bench_etcd", "base etcd key for testing");
+DEFINE_string(workload, "create",
+              "what to benchmark: create (etcd Create requests from "
+              "--num_threads threads), or one of the EtcdConsistentStore "
+              "workloads: add_pending, get_pending, update_mapping or "
+              "cleanup");
+DEFINE_bool(fake_etcd, false,
+            "use an in-memory FakeEtcdClient instead of the etcd server");
+DEFINE_int32(fake_etcd_latency_ms, 0,
+             "with --fake_etcd, delay the reply to each request by this "
+             "many milliseconds");
+DEFINE_int32(num_entries, 10000,
+             "number of entries added, fetched, mapped or cleaned up by the "
+             "EtcdConsistentStore workloads (of --bytes_per_request bytes)");
+DEFINE_double(entries_per_second, 0,
+              "rate at which add_pending adds entries, or 0 to add them all "
+              "at once");
+DEFINE_int32(iterations, 10,
+             "number of times get_pending and update_mapping repeat their "
+             "operation");
+DEFINE_int32(mapping_batch_size, 1000,
+             "number of entries update_mapping adds to the sequence mapping "
+             "in each iteration");
 
 namespace {
 
@@ -83,14 +129,27 @@ void State::RequestDone(Task* child_task) {
 }
 
 
+unique_ptr<EtcdClient> NewEtcdClient(libevent::Base* base, ThreadPool* pool,
+                                     UrlFetcher* fetcher) {
+  if (FLAGS_fake_etcd) {
+    unique_ptr<FakeEtcdClient> client(new FakeEtcdClient(base));
+    client->SetLatency(milliseconds(FLAGS_fake_etcd_latency_ms));
+    return move(client);
+  }
+  return unique_ptr<EtcdClient>(
+      new EtcdClient(pool, fetcher, FLAGS_etcd, FLAGS_etcd_port));
+}
+
+
 void test_etcd(int thread_num) {
   const shared_ptr<libevent::Base> event_base(make_shared<libevent::Base>());
   libevent::EventPumpThread pump(event_base);
   ThreadPool pool;
   UrlFetcher fetcher(event_base.get(), &pool);
-  EtcdClient etcd(&pool, &fetcher, FLAGS_etcd, FLAGS_etcd_port);
+  const unique_ptr<EtcdClient> etcd(
+      NewEtcdClient(event_base.get(), &pool, &fetcher));
   SyncTask task(event_base.get());
-  State state(&etcd, thread_num, task.task());
+  State state(etcd.get(), thread_num, task.task());
 
   // Get the ball rolling...
   state.MakeRequest();
@@ -101,6 +160,241 @@ void test_etcd(int thread_num) {
 }
 
 
+// This process is the only writer, so it can act as the master.
+class BenchElection : public MasterElection {
+ public:
+  BenchElection() = default;
+
+  bool IsMaster() const override {
+    return true;
+  }
+};
+
+
+// Prints the count, rate and latency quantiles of |latencies_ms|, which
+// took |elapsed| in total.
+void PrintLatencies(const string& op, const steady_clock::duration& elapsed,
+                    vector<double>* latencies_ms) {
+  CHECK(!latencies_ms->empty());
+  std::sort(latencies_ms->begin(), latencies_ms->end());
+  const double secs(duration<double>(elapsed).count());
+  const auto quantile([latencies_ms](double q) {
+    return (*latencies_ms)[static_cast<size_t>(q *
+                                               (latencies_ms->size() - 1))];
+  });
+  std::cout << op << ": " << latencies_ms->size() << " in " << secs << " s ("
+            << latencies_ms->size() / secs << "/s), latency ms p50 "
+            << quantile(0.5) << " p90 " << quantile(0.9) << " p99 "
+            << quantile(0.99) << " max " << latencies_ms->back() << "\n";
+}
+
+
+// Runs the EtcdConsistentStore workloads. Each run uses a fresh
+// directory under --test_key, which is left behind in etcd.
+class StoreBench {
+ public:
+  StoreBench();
+  ~StoreBench();
+
+  void AddPending();
+  void GetPending();
+  void UpdateMapping();
+  void Cleanup();
+
+ private:
+  LoggedCertificate MakeEntry(int64_t index) const;
+  // Adds |FLAGS_num_entries| pending entries, as quickly as possible,
+  // for the workloads that need a backlog.
+  void AddBacklog(vector<LoggedCertificate>* entries);
+  void AddToMapping(const vector<LoggedCertificate>& entries, size_t begin,
+                    size_t end);
+
+  const shared_ptr<libevent::Base> base_;
+  libevent::EventPumpThread pump_;
+  ThreadPool pool_;
+  UrlFetcher fetcher_;
+  const unique_ptr<EtcdClient> client_;
+  const string root_;
+  BenchElection election_;
+  unique_ptr<EtcdConsistentStore<LoggedCertificate>> store_;
+};
+
+
+StoreBench::StoreBench()
+    : base_(make_shared<libevent::Base>()),
+      pump_(base_),
+      fetcher_(base_.get(), &pool_),
+      client_(NewEtcdClient(base_.get(), &pool_, &fetcher_)),
+      root_(FLAGS_test_key + "/" + to_string(util::TimeInMilliseconds())) {
+  // As "ct-clustertool initlog" does.
+  SyncTask task(&pool_);
+  EtcdClient::Response resp;
+  string mapping;
+  CHECK(ct::SequenceMapping().SerializeToString(&mapping));
+  client_->ForceSet(root_ + "/sequence_mapping", util::ToBase64(mapping),
+                    &resp, task.task());
+  task.Wait();
+  CHECK_EQ(Status::OK, task.status());
+
+  store_.reset(new EtcdConsistentStore<LoggedCertificate>(
+      base_.get(), &pool_, client_.get(), &election_, root_, "bench_etcd"));
+  LOG(INFO) << "using " << root_;
+}
+
+
+StoreBench::~StoreBench() {
+  store_.reset();
+}
+
+
+LoggedCertificate StoreBench::MakeEntry(int64_t index) const {
+  string body(to_string(index) + ":");
+  body.resize(std::max<size_t>(body.size(), FLAGS_bytes_per_request), 'x');
+  LoggedCertificate entry;
+  entry.mutable_sct()->set_timestamp(util::TimeInMilliseconds());
+  entry.mutable_entry()->set_type(ct::X509_ENTRY);
+  entry.mutable_entry()->mutable_x509_entry()->set_leaf_certificate(body);
+  return entry;
+}
+
+
+void StoreBench::AddPending() {
+  vector<LoggedCertificate> entries;
+  for (int i = 0; i < FLAGS_num_entries; ++i) {
+    entries.emplace_back(MakeEntry(i));
+  }
+
+  mutex lock;
+  vector<double> latencies_ms;
+  map<string, int> errors;
+  SyncTask task(&pool_);
+  const steady_clock::time_point start(steady_clock::now());
+  for (int i = 0; i < FLAGS_num_entries; ++i) {
+    // Open loop: the entries are added on schedule, however long the
+    // previous ones are taking.
+    const steady_clock::time_point due(
+        FLAGS_entries_per_second > 0
+            ? start + std::chrono::duration_cast<steady_clock::duration>(
+                          duration<double>(i / FLAGS_entries_per_second))
+            : start);
+    std::this_thread::sleep_until(due);
+    store_->AddPendingEntryAsync(
+        &entries[i], task.task()->AddChild([&, due](Task* child) {
+          lock_guard<mutex> guard(lock);
+          if (child->status().ok()) {
+            latencies_ms.push_back(
+                duration<double, std::milli>(steady_clock::now() - due)
+                    .count());
+          } else {
+            ++errors[child->status().ToString()];
+          }
+        }));
+  }
+  task.task()->Return();
+  task.Wait();
+
+  for (const auto& error : errors) {
+    std::cout << "add_pending: " << error.second << " x " << error.first
+              << "\n";
+  }
+  PrintLatencies("add_pending", steady_clock::now() - start, &latencies_ms);
+}
+
+
+void StoreBench::AddBacklog(vector<LoggedCertificate>* entries) {
+  vector<LoggedCertificate*> pointers;
+  for (int i = 0; i < FLAGS_num_entries; ++i) {
+    entries->emplace_back(MakeEntry(i));
+  }
+  for (auto& entry : *entries) {
+    pointers.push_back(&entry);
+  }
+  vector<Status> statuses;
+  store_->AddPendingEntries(pointers, &statuses);
+  for (const auto& status : statuses) {
+    CHECK_EQ(Status::OK, status);
+  }
+}
+
+
+void StoreBench::GetPending() {
+  vector<LoggedCertificate> entries;
+  AddBacklog(&entries);
+
+  vector<double> latencies_ms;
+  const steady_clock::time_point start(steady_clock::now());
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    const steady_clock::time_point begin(steady_clock::now());
+    vector<EntryHandle<LoggedCertificate>> pending;
+    CHECK_EQ(Status::OK, store_->GetPendingEntries(&pending));
+    CHECK_EQ(entries.size(), pending.size());
+    latencies_ms.push_back(
+        duration<double, std::milli>(steady_clock::now() - begin).count());
+  }
+  PrintLatencies("get_pending", steady_clock::now() - start, &latencies_ms);
+}
+
+
+void StoreBench::AddToMapping(const vector<LoggedCertificate>& entries,
+                              size_t begin, size_t end) {
+  EntryHandle<ct::SequenceMapping> mapping;
+  CHECK_EQ(Status::OK, store_->GetSequenceMapping(&mapping));
+  for (size_t i = begin; i < end; ++i) {
+    ct::SequenceMapping::Mapping* const m(
+        mapping.MutableEntry()->add_mapping());
+    m->set_entry_hash(entries[i].Hash());
+    m->set_sequence_number(i);
+  }
+  CHECK_EQ(Status::OK, store_->UpdateSequenceMapping(&mapping));
+}
+
+
+void StoreBench::UpdateMapping() {
+  // The entries need not be in etcd, only their hashes are mapped.
+  vector<LoggedCertificate> entries;
+  const int num_entries(FLAGS_num_entries +
+                        FLAGS_iterations * FLAGS_mapping_batch_size);
+  for (int i = 0; i < num_entries; ++i) {
+    entries.emplace_back(MakeEntry(i));
+  }
+  AddToMapping(entries, 0, FLAGS_num_entries);
+
+  vector<double> latencies_ms;
+  const steady_clock::time_point start(steady_clock::now());
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    const size_t begin(FLAGS_num_entries + i * FLAGS_mapping_batch_size);
+    const steady_clock::time_point started(steady_clock::now());
+    AddToMapping(entries, begin, begin + FLAGS_mapping_batch_size);
+    latencies_ms.push_back(
+        duration<double, std::milli>(steady_clock::now() - started).count());
+  }
+  PrintLatencies("update_mapping", steady_clock::now() - start,
+                 &latencies_ms);
+}
+
+
+void StoreBench::Cleanup() {
+  vector<LoggedCertificate> entries;
+  AddBacklog(&entries);
+  AddToMapping(entries, 0, entries.size());
+  ct::SignedTreeHead sth;
+  sth.set_timestamp(util::TimeInMilliseconds());
+  sth.set_tree_size(entries.size());
+  CHECK_EQ(Status::OK, store_->SetServingSTH(sth));
+
+  const steady_clock::time_point start(steady_clock::now());
+  const util::StatusOr<int64_t> cleaned(store_->CleanupOldEntries());
+  const steady_clock::duration elapsed(steady_clock::now() - start);
+  CHECK_EQ(Status::OK, cleaned.status());
+  vector<double> latencies_ms{
+      duration<double, std::milli>(elapsed).count()};
+  std::cout << "cleanup: removed " << cleaned.ValueOrDie() << " entries ("
+            << cleaned.ValueOrDie() / duration<double>(elapsed).count()
+            << "/s)\n";
+  PrintLatencies("cleanup", elapsed, &latencies_ms);
+}
+
+
 }  // namespace
 
 
@@ -109,6 +403,25 @@ int main(int argc, char* argv[]) {
   google::InitGoogleLogging(argv[0]);
   evthread_use_pthreads();
 
+  if (FLAGS_workload != "create") {
+    CHECK_GT(FLAGS_num_entries, 0);
+    CHECK_GT(FLAGS_iterations, 0);
+    CHECK_GT(FLAGS_mapping_batch_size, 0);
+    StoreBench bench;
+    if (FLAGS_workload == "add_pending") {
+      bench.AddPending();
+    } else if (FLAGS_workload == "get_pending") {
+      bench.GetPending();
+    } else if (FLAGS_workload == "update_mapping") {
+      bench.UpdateMapping();
+    } else if (FLAGS_workload == "cleanup") {
+      bench.Cleanup();
+    } else {
+      LOG(FATAL) << "Unknown workload: " << FLAGS_workload;
+    }
+    return 0;
+  }
+
   CHECK_GT(FLAGS_requests_per_thread, 0);
   CHECK_GE(FLAGS_bytes_per_request, 0);
   CHECK_GT(FLAGS_num_threads, 0);
@@ -0,0 +1,155 @@
+#ifndef CERT_TRANS_UTIL_CLOSURE_H_
+#define CERT_TRANS_UTIL_CLOSURE_H_
+
+#include <cstddef>
+#include <glog/logging.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "base/macros.h"
+
+namespace util {
+
+
+// A callable that takes no arguments and returns nothing, like
+// std::function<void()>, except that it can only be moved, so the
+// callable it holds does not have to be copyable and is never copied.
+// Callables small enough (most lambdas and binds capturing a few
+// pointers or smart pointers) are stored inline, without allocating.
+class Closure {
+ public:
+  Closure() : ops_(nullptr) {
+  }
+
+  template <class F, class = typename std::enable_if<!std::is_same<
+                         typename std::decay<F>::type, Closure>::value>::type>
+  explicit Closure(F&& f)
+      : ops_(&OpsFor<typename std::decay<F>::type>::kOps) {
+    OpsFor<typename std::decay<F>::type>::Construct(&storage_,
+                                                    std::forward<F>(f));
+  }
+
+  Closure(Closure&& other) : ops_(other.ops_) {
+    if (ops_) {
+      ops_->move(&other.storage_, &storage_);
+      other.ops_ = nullptr;
+    }
+  }
+
+  Closure& operator=(Closure&& other) {
+    if (this != &other) {
+      Reset();
+      if (other.ops_) {
+        other.ops_->move(&other.storage_, &storage_);
+        ops_ = other.ops_;
+        other.ops_ = nullptr;
+      }
+    }
+    return *this;
+  }
+
+  ~Closure() {
+    Reset();
+  }
+
+  explicit operator bool() const {
+    return ops_ != nullptr;
+  }
+
+  void operator()() {
+    CHECK(ops_) << "calling an empty closure";
+    ops_->call(&storage_);
+  }
+
+ private:
+  static const size_t kInlineSize = 8 * sizeof(void*);
+  typedef std::aligned_storage<kInlineSize, alignof(std::max_align_t)>::type
+      Storage;
+
+  struct Ops {
+    void (*call)(Storage* storage);
+    // Moves the callable from |from| to |to|, leaving |from| empty.
+    void (*move)(Storage* from, Storage* to);
+    void (*destroy)(Storage* storage);
+  };
+
+  template <class F>
+  struct InlineOps {
+    template <class G>
+    static void Construct(Storage* storage, G&& g) {
+      new (storage) F(std::forward<G>(g));
+    }
+    static F* Get(Storage* storage) {
+      return reinterpret_cast<F*>(storage);
+    }
+    static void Call(Storage* storage) {
+      (*Get(storage))();
+    }
+    static void Move(Storage* from, Storage* to) {
+      new (to) F(std::move(*Get(from)));
+      Destroy(from);
+    }
+    static void Destroy(Storage* storage) {
+      Get(storage)->~F();
+    }
+
+    static const Ops kOps;
+  };
+
+  template <class F>
+  struct HeapOps {
+    template <class G>
+    static void Construct(Storage* storage, G&& g) {
+      *Get(storage) = new F(std::forward<G>(g));
+    }
+    static F** Get(Storage* storage) {
+      return reinterpret_cast<F**>(storage);
+    }
+    static void Call(Storage* storage) {
+      (**Get(storage))();
+    }
+    static void Move(Storage* from, Storage* to) {
+      *Get(to) = *Get(from);
+    }
+    static void Destroy(Storage* storage) {
+      delete *Get(storage);
+    }
+
+    static const Ops kOps;
+  };
+
+  // Callables that could throw while being moved are kept on the
+  // heap, so that moving a Closure never throws.
+  template <class F>
+  using OpsFor = typename std::conditional<
+      sizeof(F) <= sizeof(Storage) &&
+          alignof(Storage) % alignof(F) == 0 &&
+          std::is_nothrow_move_constructible<F>::value,
+      InlineOps<F>, HeapOps<F>>::type;
+
+  void Reset() {
+    if (ops_) {
+      ops_->destroy(&storage_);
+      ops_ = nullptr;
+    }
+  }
+
+  Storage storage_;
+  const Ops* ops_;
+
+  DISALLOW_COPY_AND_ASSIGN(Closure);
+};
+
+
+template <class F>
+const Closure::Ops Closure::InlineOps<F>::kOps = {&Call, &Move, &Destroy};
+
+
+template <class F>
+const Closure::Ops Closure::HeapOps<F>::kOps = {&Call, &Move, &Destroy};
+
+
+}  // namespace util
+
+#endif  // CERT_TRANS_UTIL_CLOSURE_H_
@@ -0,0 +1,78 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "util/closure.h"
+#include "util/testing.h"
+
+using std::move;
+using std::string;
+using std::unique_ptr;
+using util::Closure;
+
+namespace {
+
+
+TEST(ClosureTest, DefaultIsEmpty) {
+  Closure closure;
+  EXPECT_FALSE(closure);
+}
+
+
+TEST(ClosureTest, CallsInlineCallable) {
+  int calls(0);
+  Closure closure([&calls]() { ++calls; });
+  EXPECT_TRUE(closure);
+  closure();
+  closure();
+  EXPECT_EQ(2, calls);
+}
+
+
+TEST(ClosureTest, HoldsMoveOnlyCallable) {
+  unique_ptr<int> value(new int(42));
+  int seen(0);
+  // Lambdas can't capture by move in C++11, but bind can.
+  Closure closure(std::bind(
+      [&seen](const unique_ptr<int>& v) { seen = *v; }, move(value)));
+  Closure moved(move(closure));
+  EXPECT_FALSE(closure);
+  moved();
+  EXPECT_EQ(42, seen);
+  EXPECT_EQ(nullptr, value.get());
+}
+
+
+TEST(ClosureTest, HoldsLargeCallable) {
+  const string a(100, 'a');
+  const string b(100, 'b');
+  const string c(100, 'c');
+  string result;
+  Closure closure([a, b, c, &result]() { result = a + b + c; });
+  Closure other;
+  other = move(closure);
+  EXPECT_FALSE(closure);
+  other();
+  EXPECT_EQ(a + b + c, result);
+}
+
+
+TEST(ClosureTest, DestroysCallable) {
+  const std::shared_ptr<int> value(std::make_shared<int>(0));
+  {
+    Closure closure([value]() {});
+    Closure moved(move(closure));
+    EXPECT_EQ(2, value.use_count());
+  }
+  EXPECT_EQ(1, value.use_count());
+}
+
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
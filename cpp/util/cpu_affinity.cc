@@ -0,0 +1,128 @@
+#include "config.h"
+#include "util/cpu_affinity.h"
+
+#include <glog/logging.h>
+#include <sched.h>
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+
+using std::ostringstream;
+using std::string;
+using std::vector;
+
+namespace cert_trans {
+namespace {
+
+
+// Parses a CPU number at |*pos|, and moves past it.
+bool ParseCpu(const string& list, size_t* pos, int* cpu) {
+  if (*pos >= list.size() || list[*pos] < '0' || list[*pos] > '9') {
+    return false;
+  }
+  char* end;
+  const long value(strtol(list.c_str() + *pos, &end, 10));
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+  if (value >= CPU_SETSIZE) {
+    return false;
+  }
+#endif
+  *cpu = static_cast<int>(value);
+  *pos = end - list.c_str();
+  return true;
+}
+
+
+}  // namespace
+
+
+bool ParseCpuList(const string& list, vector<int>* cpus) {
+  CHECK_NOTNULL(cpus)->clear();
+  size_t pos(0);
+  while (pos < list.size()) {
+    int first, last;
+    if (!ParseCpu(list, &pos, &first)) {
+      return false;
+    }
+    last = first;
+    if (pos < list.size() && list[pos] == '-') {
+      ++pos;
+      if (!ParseCpu(list, &pos, &last) || last < first) {
+        return false;
+      }
+    }
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus->push_back(cpu);
+    }
+    if (pos < list.size() && list[pos++] != ',') {
+      return false;
+    }
+  }
+  return !cpus->empty();
+}
+
+
+string FormatCpuList(const vector<int>& cpus) {
+  ostringstream out;
+  for (size_t i = 0; i < cpus.size();) {
+    size_t j(i);
+    while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+      ++j;
+    }
+    out << (i > 0 ? "," : "") << cpus[i];
+    if (j > i) {
+      out << "-" << cpus[j];
+    }
+    i = j + 1;
+  }
+  return out.str();
+}
+
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+util::Status SetThreadCpus(pthread_t thread, const vector<int>& cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    CHECK_GE(cpu, 0);
+    CHECK_LT(cpu, CPU_SETSIZE);
+    CPU_SET(cpu, &set);
+  }
+  const int err(pthread_setaffinity_np(thread, sizeof(set), &set));
+  if (err != 0) {
+    return util::Status(util::error::INVALID_ARGUMENT,
+                        "Could not restrict thread to CPUs " +
+                            FormatCpuList(cpus) + ": " + strerror(err));
+  }
+  return util::Status::OK;
+}
+
+
+vector<int> GetThreadCpus(pthread_t thread) {
+  cpu_set_t set;
+  vector<int> cpus;
+  if (pthread_getaffinity_np(thread, sizeof(set), &set) != 0) {
+    return cpus;
+  }
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &set)) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+#else
+util::Status SetThreadCpus(pthread_t, const vector<int>&) {
+  return util::Status(util::error::UNIMPLEMENTED,
+                      "Thread CPU affinity is not supported on this "
+                      "platform");
+}
+
+
+vector<int> GetThreadCpus(pthread_t) {
+  return vector<int>();
+}
+#endif
+
+
+}  // namespace cert_trans
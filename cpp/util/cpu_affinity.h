@@ -0,0 +1,35 @@
+#ifndef CERT_TRANS_UTIL_CPU_AFFINITY_H_
+#define CERT_TRANS_UTIL_CPU_AFFINITY_H_
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#include "util/status.h"
+
+namespace cert_trans {
+
+
+// Parses a list of CPUs in the format of "taskset -c" (and of
+// /sys/devices/system/node/node*/cpulist), such as "0-3,8,10-11".
+// Returns false if it is malformed.
+bool ParseCpuList(const std::string& list, std::vector<int>* cpus);
+
+// The reverse of ParseCpuList(), with consecutive CPUs as ranges.
+std::string FormatCpuList(const std::vector<int>& cpus);
+
+// Restricts |thread| to run on |cpus|. Threads inherit the CPUs of the
+// thread that starts them, and the kernel allocates memory on the NUMA
+// node of the CPU that first touches it, so pinning the threads that
+// build a structure also places it. Returns UNIMPLEMENTED where
+// pthread_setaffinity_np() is not available (e.g. on Mac OS X).
+util::Status SetThreadCpus(pthread_t thread, const std::vector<int>& cpus);
+
+// Returns the CPUs |thread| may run on, or an empty vector where that
+// can't be known.
+std::vector<int> GetThreadCpus(pthread_t thread);
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_UTIL_CPU_AFFINITY_H_
@@ -0,0 +1,66 @@
+#include "config.h"
+
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#include "util/cpu_affinity.h"
+#include "util/testing.h"
+
+using cert_trans::FormatCpuList;
+using cert_trans::GetThreadCpus;
+using cert_trans::ParseCpuList;
+using cert_trans::SetThreadCpus;
+using std::vector;
+
+namespace {
+
+
+TEST(CpuAffinityTest, ParsesLists) {
+  vector<int> cpus;
+  EXPECT_TRUE(ParseCpuList("3", &cpus));
+  EXPECT_EQ(vector<int>({3}), cpus);
+  EXPECT_TRUE(ParseCpuList("0-3,8,10-11", &cpus));
+  EXPECT_EQ(vector<int>({0, 1, 2, 3, 8, 10, 11}), cpus);
+}
+
+
+TEST(CpuAffinityTest, RejectsMalformedLists) {
+  vector<int> cpus;
+  EXPECT_FALSE(ParseCpuList("", &cpus));
+  EXPECT_FALSE(ParseCpuList("a", &cpus));
+  EXPECT_FALSE(ParseCpuList("1,", &cpus));
+  EXPECT_FALSE(ParseCpuList("3-1", &cpus));
+  EXPECT_FALSE(ParseCpuList("-1", &cpus));
+  EXPECT_FALSE(ParseCpuList("1-", &cpus));
+}
+
+
+TEST(CpuAffinityTest, FormatsRanges) {
+  EXPECT_EQ("", FormatCpuList({}));
+  EXPECT_EQ("0-3,8,10-11", FormatCpuList({0, 1, 2, 3, 8, 10, 11}));
+}
+
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+TEST(CpuAffinityTest, SetsTheCpusOfAThread) {
+  const vector<int> all(GetThreadCpus(pthread_self()));
+  ASSERT_FALSE(all.empty());
+
+  EXPECT_TRUE(SetThreadCpus(pthread_self(), {all.front()}).ok());
+  EXPECT_EQ(vector<int>({all.front()}), GetThreadCpus(pthread_self()));
+
+  EXPECT_TRUE(SetThreadCpus(pthread_self(), all).ok());
+  EXPECT_EQ(all, GetThreadCpus(pthread_self()));
+}
+#endif
+
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,150 @@
+#include "util/dictionary_compressor.h"
+
+#include <glog/logging.h>
+#include <openssl/sha.h>
+#include <zlib.h>
+
+using std::string;
+
+namespace util {
+namespace {
+
+// Negative window bits make zlib read and write raw deflate streams,
+// without the zlib header and trailer, which would only repeat the
+// dictionary id that callers keep anyway.
+const int kRawWindowBits = -15;
+const int kMemLevel = 8;
+// How much output space is reserved at a time.
+const size_t kOutputChunkBytes = 4 << 10;
+
+
+void InitStream(z_stream* stream) {
+  stream->zalloc = Z_NULL;
+  stream->zfree = Z_NULL;
+  stream->opaque = Z_NULL;
+  stream->next_in = Z_NULL;
+  stream->avail_in = 0;
+}
+
+
+// The zlib streams of the calling thread, set up once and reset for
+// each value, which saves allocating their state (some 256KB for
+// deflate) every time.
+class ThreadStreams {
+ public:
+  ThreadStreams() {
+    InitStream(&deflate_);
+    CHECK_EQ(Z_OK,
+             deflateInit2(&deflate_, Z_BEST_COMPRESSION, Z_DEFLATED,
+                          kRawWindowBits, kMemLevel, Z_DEFAULT_STRATEGY));
+    InitStream(&inflate_);
+    CHECK_EQ(Z_OK, inflateInit2(&inflate_, kRawWindowBits));
+  }
+
+  ~ThreadStreams() {
+    deflateEnd(&deflate_);
+    inflateEnd(&inflate_);
+  }
+
+  z_stream* Deflate(const string& dictionary) {
+    CHECK_EQ(Z_OK, deflateReset(&deflate_));
+    if (!dictionary.empty()) {
+      CHECK_EQ(Z_OK, deflateSetDictionary(&deflate_, Bytes(dictionary),
+                                          dictionary.size()));
+    }
+    return &deflate_;
+  }
+
+  z_stream* Inflate(const string& dictionary) {
+    CHECK_EQ(Z_OK, inflateReset(&inflate_));
+    // Raw streams take their dictionary up front.
+    if (!dictionary.empty()) {
+      CHECK_EQ(Z_OK, inflateSetDictionary(&inflate_, Bytes(dictionary),
+                                          dictionary.size()));
+    }
+    return &inflate_;
+  }
+
+ private:
+  static const Bytef* Bytes(const string& data) {
+    return reinterpret_cast<const Bytef*>(data.data());
+  }
+
+  z_stream deflate_;
+  z_stream inflate_;
+
+  DISALLOW_COPY_AND_ASSIGN(ThreadStreams);
+};
+
+
+ThreadStreams* CurrentThreadStreams() {
+  thread_local ThreadStreams streams;
+  return &streams;
+}
+
+
+uint32_t DictionaryId(const string& dictionary) {
+  unsigned char digest[SHA256_DIGEST_LENGTH];
+  SHA256(reinterpret_cast<const unsigned char*>(dictionary.data()),
+         dictionary.size(), digest);
+  return (static_cast<uint32_t>(digest[0]) << 24) |
+         (static_cast<uint32_t>(digest[1]) << 16) |
+         (static_cast<uint32_t>(digest[2]) << 8) | digest[3];
+}
+
+
+}  // namespace
+
+
+const size_t DictionaryCompressor::kMaxDictionaryBytes = 32 << 10;
+
+
+DictionaryCompressor::DictionaryCompressor(const string& dictionary)
+    : dictionary_(dictionary.size() > kMaxDictionaryBytes
+                      ? dictionary.substr(dictionary.size() -
+                                          kMaxDictionaryBytes)
+                      : dictionary),
+      id_(DictionaryId(dictionary_)) {
+}
+
+
+void DictionaryCompressor::Compress(const char* data, size_t length,
+                                    string* out) const {
+  z_stream* const stream(CurrentThreadStreams()->Deflate(dictionary_));
+  // zlib doesn't modify the input, it just isn't const-correct.
+  stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+  stream->avail_in = length;
+
+  const size_t start(out->size());
+  // Enough for it never to run out of space.
+  out->resize(start + deflateBound(stream, length));
+  stream->next_out = reinterpret_cast<Bytef*>(&(*out)[start]);
+  stream->avail_out = out->size() - start;
+  CHECK_EQ(Z_STREAM_END, deflate(stream, Z_FINISH));
+  out->resize(out->size() - stream->avail_out);
+}
+
+
+bool DictionaryCompressor::Decompress(const char* data, size_t length,
+                                      string* out) const {
+  z_stream* const stream(CurrentThreadStreams()->Inflate(dictionary_));
+  stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+  stream->avail_in = length;
+
+  // Keeps the capacity of |out|, which callers reuse.
+  out->clear();
+  int ret(Z_OK);
+  while (ret == Z_OK) {
+    const size_t used(out->size());
+    out->resize(used + kOutputChunkBytes);
+    stream->next_out = reinterpret_cast<Bytef*>(&(*out)[used]);
+    stream->avail_out = kOutputChunkBytes;
+    ret = inflate(stream, Z_NO_FLUSH);
+    out->resize(out->size() - stream->avail_out);
+  }
+
+  return ret == Z_STREAM_END && stream->avail_in == 0;
+}
+
+
+}  // namespace util
@@ -0,0 +1,56 @@
+#ifndef CERT_TRANS_UTIL_DICTIONARY_COMPRESSOR_H_
+#define CERT_TRANS_UTIL_DICTIONARY_COMPRESSOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "base/macros.h"
+
+namespace util {
+
+
+// Compresses small values, such as database entries, which share a lot
+// with each other but little within themselves, as raw deflate streams
+// (RFC 1951) primed with a preset dictionary of what they typically
+// contain. Only the last kMaxDictionaryBytes of the dictionary are
+// used, which is the size of the deflate window: the most common
+// content is best put at its end.
+//
+// The zlib streams are kept per thread and reset for each value, and
+// the output strings are reused, so that compressing many values
+// doesn't allocate much.
+class DictionaryCompressor {
+ public:
+  static const size_t kMaxDictionaryBytes;
+
+  explicit DictionaryCompressor(const std::string& dictionary);
+
+  const std::string& dictionary() const {
+    return dictionary_;
+  }
+
+  // An identifier for the dictionary, derived from its content, for
+  // compressed values to say which one they need.
+  uint32_t id() const {
+    return id_;
+  }
+
+  // Appends |data| compressed to |out|.
+  void Compress(const char* data, size_t length, std::string* out) const;
+
+  // Sets |out| to |data| decompressed. Returns false if |data| is not a
+  // complete stream compressed with this dictionary.
+  bool Decompress(const char* data, size_t length, std::string* out) const;
+
+ private:
+  const std::string dictionary_;
+  const uint32_t id_;
+
+  DISALLOW_COPY_AND_ASSIGN(DictionaryCompressor);
+};
+
+
+}  // namespace util
+
+#endif  // CERT_TRANS_UTIL_DICTIONARY_COMPRESSOR_H_
@@ -0,0 +1,125 @@
+#include "util/dictionary_compressor.h"
+
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "util/testing.h"
+
+namespace util {
+namespace {
+
+using std::string;
+
+const char kDictionary[] =
+    "Let's Encrypt Authority X3 http://cert.int-x3.letsencrypt.org/";
+const char kValue[] =
+    "issued by Let's Encrypt Authority X3, see "
+    "http://cert.int-x3.letsencrypt.org/ for details";
+
+
+TEST(DictionaryCompressorTest, RoundTrip) {
+  const DictionaryCompressor compressor(kDictionary);
+  const string value(kValue);
+  string compressed("prefix");
+  compressor.Compress(value.data(), value.size(), &compressed);
+  ASSERT_EQ(0U, compressed.find("prefix"));
+  compressed.erase(0, 6);
+
+  string decompressed("left over");
+  ASSERT_TRUE(compressor.Decompress(compressed.data(), compressed.size(),
+                                    &decompressed));
+  EXPECT_EQ(value, decompressed);
+
+  // The dictionary helps.
+  const DictionaryCompressor plain("");
+  string plain_compressed;
+  plain.Compress(value.data(), value.size(), &plain_compressed);
+  EXPECT_LT(compressed.size(), plain_compressed.size());
+
+  // Empty values work too.
+  compressed.clear();
+  compressor.Compress("", 0, &compressed);
+  ASSERT_TRUE(compressor.Decompress(compressed.data(), compressed.size(),
+                                    &decompressed));
+  EXPECT_EQ("", decompressed);
+}
+
+
+TEST(DictionaryCompressorTest, LargeValues) {
+  const DictionaryCompressor compressor(kDictionary);
+  string value;
+  for (int i = 0; value.size() < 100000; ++i) {
+    value += kValue + std::to_string(i * i);
+  }
+  string compressed;
+  compressor.Compress(value.data(), value.size(), &compressed);
+  string decompressed;
+  ASSERT_TRUE(compressor.Decompress(compressed.data(), compressed.size(),
+                                    &decompressed));
+  EXPECT_EQ(value, decompressed);
+}
+
+
+TEST(DictionaryCompressorTest, RejectsOtherData) {
+  const DictionaryCompressor compressor(kDictionary);
+  const DictionaryCompressor other("some other dictionary");
+  EXPECT_NE(compressor.id(), other.id());
+  EXPECT_EQ(compressor.id(), DictionaryCompressor(kDictionary).id());
+
+  const string value(kValue);
+  string compressed;
+  compressor.Compress(value.data(), value.size(), &compressed);
+  string decompressed;
+  EXPECT_FALSE(compressor.Decompress(compressed.data(),
+                                     compressed.size() - 1, &decompressed));
+  EXPECT_FALSE(other.Decompress(compressed.data(), compressed.size(),
+                                &decompressed) &&
+               decompressed == value);
+  EXPECT_FALSE(compressor.Decompress(value.data(), value.size(),
+                                     &decompressed) &&
+               decompressed == value);
+}
+
+
+TEST(DictionaryCompressorTest, KeepsTheEndOfLongDictionaries) {
+  const string dictionary(string(40 << 10, 'x') + kDictionary);
+  const DictionaryCompressor compressor(dictionary);
+  EXPECT_EQ(32U << 10, compressor.dictionary().size());
+  EXPECT_EQ(dictionary.substr(dictionary.size() - (32 << 10)),
+            compressor.dictionary());
+}
+
+
+TEST(DictionaryCompressorTest, ManyThreads) {
+  const DictionaryCompressor compressor(kDictionary);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&compressor, i]() {
+      const string value(kValue + std::to_string(i));
+      string compressed;
+      string decompressed;
+      for (int j = 0; j < 100; ++j) {
+        compressed.clear();
+        compressor.Compress(value.data(), value.size(), &compressed);
+        EXPECT_TRUE(compressor.Decompress(compressed.data(),
+                                          compressed.size(), &decompressed));
+        EXPECT_EQ(value, decompressed);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+
+}  // namespace
+}  // namespace util
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
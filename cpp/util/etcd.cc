@@ -3,8 +3,12 @@
 #include <ctime>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <limits>
+#include <mutex>
 #include <utility>
 
+#include "monitoring/monitoring.h"
+#include "util/etcd_node_parser.h"
 #include "util/json_wrapper.h"
 #include "util/libevent_wrapper.h"
 #include "util/statusor.h"
@@ -13,7 +17,10 @@ namespace libevent = cert_trans::libevent;
 
 using std::atoll;
 using std::bind;
+using std::chrono::duration;
+using std::chrono::milliseconds;
 using std::chrono::seconds;
+using std::chrono::steady_clock;
 using std::chrono::system_clock;
 using std::ctime;
 using std::list;
@@ -31,6 +38,7 @@ using std::stoi;
 using std::string;
 using std::time_t;
 using std::to_string;
+using std::unique_lock;
 using std::unique_ptr;
 using std::vector;
 using util::Executor;
@@ -45,13 +53,36 @@ DEFINE_bool(etcd_consistent, true, "Add consistent=true param to all requests. "
             "Do not turn this off unless you *know* what you're doing.");
 DEFINE_bool(etcd_quorum, true, "Add quorum=true param to all requests. "
             "Do not turn this off unless you *know* what you're doing.");
+DEFINE_bool(etcd_route_reads_to_fastest, true,
+            "send reads (when --etcd_consistent is off, as otherwise they "
+            "get redirected to the leader anyway) to the etcd member with "
+            "the lowest recent latency and error rate, rather than to the "
+            "one writes go to");
 DEFINE_int32(etcd_connection_timeout_seconds, 10,
              "Number of seconds after which to timeout etcd connections.");
+DEFINE_int32(etcd_watch_coalesce_ms, 0,
+             "if positive, watch updates arriving within this many "
+             "milliseconds of the first one not yet delivered are passed "
+             "to the watch callback together, in a single call");
 
 namespace cert_trans {
 
 namespace {
 
+
+static Gauge<string>* etcd_member_latency_ms(
+    Gauge<string>::New("etcd_member_latency_ms", "member",
+                       "Moving average of the latency of requests to each "
+                       "etcd member, in milliseconds (long polls excluded)."));
+
+static Gauge<string>* etcd_member_error_rate(
+    Gauge<string>::New("etcd_member_error_rate", "member",
+                       "Moving average of the fraction of requests to each "
+                       "etcd member that could not reach it."));
+
+// The weight of each new sample in the moving averages of MemberStats.
+const double kMemberStatsDecay = 0.2;
+
 const char* kStoreStats[] = {"setsFail", "getsSuccess", "watchers",
                              "expireCount", "createFail", "setsSuccess",
                              "compareAndDeleteFail", "createSuccess",
@@ -66,6 +97,19 @@ const char kStatsSpace[] = "/v2/stats";
 const char kStoreStatsKey[] = "/store";
 
 
+// Moves the keys under |node| (or |node| itself, if it is not a
+// directory) to |leaves|.
+void MoveLeaves(EtcdClient::Node* node, vector<EtcdClient::Node>* leaves) {
+  if (!node->is_dir_) {
+    leaves->emplace_back(move(*node));
+    return;
+  }
+  for (auto& child : node->nodes_) {
+    MoveLeaves(&child, leaves);
+  }
+}
+
+
 util::error::Code ErrorCodeForHttpResponseCode(int response_code) {
   switch (response_code) {
     case 200:
@@ -257,6 +301,24 @@ void CopyStat(const string& key, const JsonObject& from,
 }
 
 
+void GetDirRequestDone(const string& keyname, EtcdClient::GetResponse* resp,
+                       Task* parent_task, EtcdClient::GenericResponse* gen_resp,
+                       Task* task) {
+  *resp = EtcdClient::GetResponse();
+  resp->etcd_index = gen_resp->etcd_index;
+  if (!task->status().ok()) {
+    parent_task->Return(
+        Status(task->status().CanonicalCode(),
+               task->status().error_message() + " (" + keyname + ")"));
+    return;
+  }
+
+  // The nodes under it have already been passed to the callback.
+  resp->node = move(gen_resp->node);
+  parent_task->Return();
+}
+
+
 void GetStoreStatsRequestDone(EtcdClient::StatsResponse* resp,
                               Task* parent_task,
                               EtcdClient::GenericResponse* gen_resp,
@@ -388,6 +450,127 @@ string UrlEscapeAndJoinParams(const map<string, string>& params) {
 static const EtcdClient::Node kInvalidNode(-1, -1, "", false, "", {}, true);
 
 
+class BatchState {
+ public:
+  BatchState(EtcdClient* client, vector<EtcdClient::WriteOp>&& ops,
+             int max_concurrency, EtcdClient::BatchResponse* resp, Task* task)
+      : client_(CHECK_NOTNULL(client)),
+        max_concurrency_(max_concurrency),
+        resp_(CHECK_NOTNULL(resp)),
+        task_(CHECK_NOTNULL(task)),
+        outstanding_(0),
+        ops_(move(ops)),
+        next_(0) {
+    CHECK_GT(max_concurrency_, 0);
+    resp_->statuses.assign(ops_.size(),
+                           Status(util::error::ABORTED, "not attempted"));
+    resp_->responses.assign(ops_.size(), EtcdClient::Response());
+
+    if (ops_.empty()) {
+      // Nothing to do!
+      task_->Return();
+    } else {
+      StartNextRequests(unique_lock<mutex>(mutex_));
+    }
+  }
+
+  ~BatchState() {
+    CHECK_EQ(outstanding_, 0);
+  }
+
+ private:
+  void RequestDone(size_t index, Task* child_task);
+  void StartNextRequests(unique_lock<mutex>&& lock);
+  void StartRequest(size_t index, Task* child_task);
+
+  EtcdClient* const client_;
+  const int max_concurrency_;
+  EtcdClient::BatchResponse* const resp_;
+  Task* const task_;
+  mutex mutex_;
+  int outstanding_;
+  const vector<EtcdClient::WriteOp> ops_;
+  size_t next_;
+};
+
+
+void BatchState::RequestDone(size_t index, Task* child_task) {
+  unique_lock<mutex> lock(mutex_);
+  --outstanding_;
+  resp_->statuses[index] = child_task->status();
+  resp_->etcd_index = max(resp_->etcd_index, resp_->responses[index].etcd_index);
+
+  if (!child_task->status().ok() &&
+      !(ops_[index].type == EtcdClient::WriteOp::FORCE_DELETE &&
+        child_task->status().CanonicalCode() == util::error::NOT_FOUND)) {
+    lock.unlock();
+    task_->Return(child_task->status());
+    return;
+  }
+
+  if (next_ < ops_.size()) {
+    StartNextRequests(move(lock));
+  } else if (outstanding_ < 1) {
+    // No more operations to start, and this was the last one to
+    // complete.
+    lock.unlock();
+    task_->Return();
+  }
+}
+
+
+void BatchState::StartNextRequests(unique_lock<mutex>&& lock) {
+  CHECK(lock.owns_lock());
+
+  if (task_->CancelRequested()) {
+    // In case the task uses an inline executor.
+    lock.unlock();
+    task_->Return(Status::CANCELLED);
+    return;
+  }
+
+  while (outstanding_ < max_concurrency_ && next_ < ops_.size() &&
+         task_->IsActive()) {
+    CHECK(lock.owns_lock());
+    const size_t index(next_);
+    ++next_;
+    ++outstanding_;
+
+    // In case the task uses an inline executor.
+    lock.unlock();
+
+    StartRequest(index, task_->AddChild(
+                            bind(&BatchState::RequestDone, this, index, _1)));
+
+    // We must be holding the lock to evaluate the loop condition.
+    lock.lock();
+  }
+}
+
+
+void BatchState::StartRequest(size_t index, Task* child_task) {
+  const EtcdClient::WriteOp& op(ops_[index]);
+  EtcdClient::Response* const resp(&resp_->responses[index]);
+  switch (op.type) {
+    case EtcdClient::WriteOp::CREATE:
+      client_->Create(op.key, op.value, resp, child_task);
+      break;
+    case EtcdClient::WriteOp::UPDATE:
+      client_->Update(op.key, op.value, op.previous_index, resp, child_task);
+      break;
+    case EtcdClient::WriteOp::FORCE_SET:
+      client_->ForceSet(op.key, op.value, resp, child_task);
+      break;
+    case EtcdClient::WriteOp::DELETE:
+      client_->Delete(op.key, op.previous_index, child_task);
+      break;
+    case EtcdClient::WriteOp::FORCE_DELETE:
+      client_->ForceDelete(op.key, child_task);
+      break;
+  }
+}
+
+
 }  // namespace
 
 
@@ -402,7 +585,9 @@ struct EtcdClient::RequestState {
     CHECK_EQ(key[0], '/');
 
     req_.verb = verb;
+    req_.body_as_buffer = true;
     SetHostPort(host_port);
+    long_poll_ = params.find("wait") != params.end();
 
     if (FLAGS_etcd_consistent) {
       params.insert(make_pair("consistent", "true"));
@@ -430,16 +615,23 @@ struct EtcdClient::RequestState {
     VLOG(2) << "path query: " << req_.url.PathQuery();
   }
 
+  // Must be called right before sending the request.
   void SetHostPort(const HostPortPair& host_port) {
     CHECK(!host_port.first.empty());
     CHECK_GT(host_port.second, 0);
     req_.url.SetProtocol("http");
     req_.url.SetHost(host_port.first);
     req_.url.SetPort(host_port.second);
+    host_port_ = host_port;
+    started_ = steady_clock::now();
   }
 
   GenericResponse* const gen_resp_;
   Task* const parent_task_;
+  HostPortPair host_port_;
+  steady_clock::time_point started_;
+  // How long long polls take says nothing about the member.
+  bool long_poll_;
 
   UrlFetcher::Request req_;
   UrlFetcher::Response resp_;
@@ -451,7 +643,8 @@ struct EtcdClient::WatchState {
       : key_(key),
         cb_(cb),
         task_(CHECK_NOTNULL(task)),
-        highest_index_seen_(-1) {
+        highest_index_seen_(-1),
+        delivering_(false) {
   }
 
   ~WatchState() {
@@ -464,6 +657,13 @@ struct EtcdClient::WatchState {
 
   int64_t highest_index_seen_;
   map<string, int64_t> known_keys_;
+
+  // With --etcd_watch_coalesce_ms, the updates waiting for the end of
+  // the window, if any (possibly an empty set, for the initial
+  // callback), and whether a delivery is scheduled or in progress.
+  mutex lock_;
+  unique_ptr<vector<Node>> pending_;
+  bool delivering_;
 };
 
 
@@ -492,12 +692,10 @@ void EtcdClient::WatchInitialGetDone(WatchState* state, GetResponse* resp,
   state->highest_index_seen_ =
       max(state->highest_index_seen_, resp->etcd_index);
 
+  // The keys in the subdirectories are watched too, but not the
+  // directories themselves.
   vector<Node> nodes;
-  if (resp->node.is_dir_) {
-    nodes = move(resp->node.nodes_);
-  } else {
-    nodes.push_back(resp->node);
-  }
+  MoveLeaves(&resp->node, &nodes);
 
   vector<Node> updates;
   map<string, int64_t> new_known_keys;
@@ -567,8 +765,10 @@ void EtcdClient::WatchRequestDone(WatchState* state, GetResponse* get_resp,
           max(state->highest_index_seen_, get_resp->etcd_index);
     }
 
+    Request req(state->key_);
+    req.recursive = true;
     GetResponse* const resp(new GetResponse);
-    Get(state->key_, resp,
+    Get(req, resp,
         state->task_->AddChild(
             bind(&EtcdClient::WatchInitialGetDone, this, state, resp, _1)));
 
@@ -581,11 +781,20 @@ void EtcdClient::WatchRequestDone(WatchState* state, GetResponse* get_resp,
     return;
   }
 
-  vector<Node> updates;
   state->highest_index_seen_ =
       max(state->highest_index_seen_, get_resp->node.modified_index_);
-  updates.emplace_back(get_resp->node);
 
+  if (get_resp->node.is_dir_) {
+    // Deleting a directory deletes the keys under it without an event
+    // for each of them, so they have to be listed again to know which
+    // are gone.
+    VLOG(1) << "directory event: " << get_resp->node.key_;
+    WatchRequestDone(state, nullptr, nullptr);
+    return;
+  }
+
+  vector<Node> updates;
+  updates.emplace_back(get_resp->node);
   if (!get_resp->node.deleted_) {
     state->known_keys_[get_resp->node.key_] = get_resp->node.modified_index_;
   } else {
@@ -601,6 +810,16 @@ void EtcdClient::WatchRequestDone(WatchState* state, GetResponse* get_resp,
 // state->task_.
 void EtcdClient::SendWatchUpdates(WatchState* state,
                                   const vector<Node>& updates) {
+  if (FLAGS_etcd_watch_coalesce_ms > 0) {
+    if (!updates.empty() || state->highest_index_seen_ == -1) {
+      QueueWatchUpdates(state, updates);
+    }
+    // The deliveries keep themselves in order, so there is no need to
+    // wait for them.
+    StartWatchRequest(state);
+    return;
+  }
+
   if (!updates.empty() || state->highest_index_seen_ == -1) {
     state->cb_(updates);
   }
@@ -611,6 +830,62 @@ void EtcdClient::SendWatchUpdates(WatchState* state,
 }
 
 
+void EtcdClient::QueueWatchUpdates(WatchState* state,
+                                   const vector<Node>& updates) {
+  {
+    lock_guard<mutex> lock(state->lock_);
+    if (!state->pending_) {
+      state->pending_.reset(new vector<Node>);
+    }
+    state->pending_->insert(state->pending_->end(), updates.begin(),
+                            updates.end());
+    if (state->delivering_) {
+      // They will go with the delivery already on its way, or the one
+      // after it.
+      return;
+    }
+    state->delivering_ = true;
+  }
+  ScheduleWatchDelivery(state);
+}
+
+
+void EtcdClient::ScheduleWatchDelivery(WatchState* state) {
+  state->task_->executor()->Delay(
+      milliseconds(FLAGS_etcd_watch_coalesce_ms),
+      state->task_->AddChild(
+          bind(&EtcdClient::DeliverWatchUpdates, this, state, _1)));
+}
+
+
+// Only one of these is scheduled at a time, so that the callback is
+// never called concurrently, and the updates stay in order.
+void EtcdClient::DeliverWatchUpdates(WatchState* state, Task* child_task) {
+  unique_ptr<vector<Node>> updates;
+  {
+    lock_guard<mutex> lock(state->lock_);
+    updates.swap(state->pending_);
+  }
+
+  if (state->task_->CancelRequested()) {
+    return;
+  }
+
+  VLOG(1) << "Watch " << state->key_ << " : delivering " << updates->size()
+          << " coalesced update(s)";
+  state->cb_(*updates);
+
+  {
+    lock_guard<mutex> lock(state->lock_);
+    state->delivering_ = state->pending_ != nullptr;
+    if (!state->delivering_) {
+      return;
+    }
+  }
+  ScheduleWatchDelivery(state);
+}
+
+
 void EtcdClient::StartWatchRequest(WatchState* state) {
   if (state->task_->CancelRequested()) {
     state->task_->Return(Status::CANCELLED);
@@ -719,6 +994,9 @@ EtcdClient::~EtcdClient() {
 
 void EtcdClient::FetchDone(RequestState* etcd_req, Task* task) {
   VLOG(2) << "EtcdClient::FetchDone: " << task->status();
+  RecordResult(etcd_req->host_port_,
+               task->status().error_code() != util::error::UNAVAILABLE,
+               etcd_req->long_poll_, steady_clock::now() - etcd_req->started_);
 
   if (!task->status().ok()) {
     if (task->status().error_code() == util::error::UNAVAILABLE) {
@@ -768,13 +1046,6 @@ void EtcdClient::FetchDone(RequestState* etcd_req, Task* task) {
     return;
   }
 
-  etcd_req->gen_resp_->json_body =
-      make_shared<JsonObject>(etcd_req->resp_.body);
-  CHECK_NOTNULL(etcd_req->gen_resp_->json_body.get());
-  if (!etcd_req->gen_resp_->json_body->Ok()) {
-    LOG(WARNING) << "Got invalid JSON: " << etcd_req->resp_.body;
-  }
-
   etcd_req->gen_resp_->etcd_index = -1;
 
   UrlFetcher::Headers::const_iterator it(
@@ -783,6 +1054,41 @@ void EtcdClient::FetchDone(RequestState* etcd_req, Task* task) {
     etcd_req->gen_resp_->etcd_index = atoll(it->second.c_str());
   }
 
+  // Stream the nodes of successful responses out to the callback, if
+  // there is one, without ever building the whole document. Errors
+  // are small, and go through the usual path.
+  const NodeCallback& node_callback(etcd_req->gen_resp_->node_callback);
+  if (node_callback && ErrorCodeForHttpResponseCode(
+                           etcd_req->resp_.status_code) == util::error::OK) {
+    const StatusOr<Node> node(
+        etcd_req->resp_.body_buffer
+            ? StreamNodesFromJson(etcd_req->resp_.body_buffer.get(),
+                                  node_callback)
+            : StreamNodesFromJson(etcd_req->resp_.body.data(),
+                                  etcd_req->resp_.body.size(),
+                                  node_callback));
+    if (node.ok()) {
+      etcd_req->gen_resp_->node = node.ValueOrDie();
+    } else {
+      LOG(WARNING) << "Got invalid JSON: " << node.status();
+    }
+    etcd_req->parent_task_->Return(node.status());
+    return;
+  }
+
+  // Directory listings can be large, parse them without copying the
+  // body out of the buffer first.
+  etcd_req->gen_resp_->json_body =
+      etcd_req->resp_.body_buffer
+          ? make_shared<JsonObject>(etcd_req->resp_.body_buffer.get())
+          : make_shared<JsonObject>(etcd_req->resp_.body);
+  CHECK_NOTNULL(etcd_req->gen_resp_->json_body.get());
+  if (!etcd_req->gen_resp_->json_body->Ok()) {
+    // On failure, the parser leaves the buffer untouched.
+    FlattenBody(&etcd_req->resp_);
+    LOG(WARNING) << "Got invalid JSON: " << etcd_req->resp_.body;
+  }
+
   etcd_req->parent_task_->Return(
       StatusFromResponse(etcd_req->resp_.status_code,
                          *etcd_req->gen_resp_->json_body));
@@ -795,6 +1101,55 @@ EtcdClient::HostPortPair EtcdClient::GetEndpoint() const {
 }
 
 
+EtcdClient::HostPortPair EtcdClient::GetReadEndpoint() const {
+  lock_guard<mutex> lock(lock_);
+  if (!FLAGS_etcd_route_reads_to_fastest || FLAGS_etcd_consistent) {
+    return etcds_.front();
+  }
+
+  // Members we have no numbers for yet count as fast, so that they get
+  // tried, but not those that have only ever failed.
+  const HostPortPair* best(nullptr);
+  double best_cost(0);
+  for (const auto& member : etcds_) {
+    const auto it(member_stats_.find(member));
+    double cost(0);
+    if (it != member_stats_.end() && it->second.latency_seconds > 0) {
+      cost = it->second.latency_seconds / max(1 - it->second.error_rate, 0.05);
+    } else if (it != member_stats_.end() && it->second.error_rate > 0) {
+      cost = std::numeric_limits<double>::max();
+    }
+    if (!best || cost < best_cost) {
+      best = &member;
+      best_cost = cost;
+    }
+  }
+
+  return *best;
+}
+
+
+void EtcdClient::RecordResult(const HostPortPair& member, bool reached,
+                              bool long_poll,
+                              const steady_clock::duration& elapsed) {
+  const string name(member.first + ":" + to_string(member.second));
+  lock_guard<mutex> lock(lock_);
+  MemberStats* const stats(&member_stats_[member]);
+  stats->error_rate = (1 - kMemberStatsDecay) * stats->error_rate +
+                      (reached ? 0 : kMemberStatsDecay);
+  etcd_member_error_rate->Set(name, stats->error_rate);
+  if (reached && !long_poll) {
+    const double latency(duration<double>(elapsed).count());
+    stats->latency_seconds =
+        stats->latency_seconds > 0
+            ? (1 - kMemberStatsDecay) * stats->latency_seconds +
+                  kMemberStatsDecay * latency
+            : latency;
+    etcd_member_latency_ms->Set(name, stats->latency_seconds * 1000);
+  }
+}
+
+
 EtcdClient::HostPortPair EtcdClient::UpdateEndpoint(
     HostPortPair&& new_endpoint) {
   lock_guard<mutex> lock(lock_);
@@ -837,6 +1192,23 @@ void EtcdClient::Get(const Request& req, GetResponse* resp, Task* task) {
 }
 
 
+void EtcdClient::GetDir(const Request& req, const NodeCallback& cb,
+                        GetResponse* resp, Task* task) {
+  CHECK_EQ(0, req.wait_index) << "GetDir() does not wait";
+  CHECK(cb);
+  map<string, string> params;
+  if (req.recursive) {
+    params["recursive"] = "true";
+  }
+  GenericResponse* const gen_resp(new GenericResponse);
+  task->DeleteWhenDone(gen_resp);
+  gen_resp->node_callback = cb;
+  Generic(req.key, kKeysSpace, params, UrlFetcher::Verb::GET, gen_resp,
+          task->AddChild(
+              bind(&GetDirRequestDone, req.key, resp, task, gen_resp, _1)));
+}
+
+
 void EtcdClient::Create(const string& key, const string& value, Response* resp,
                         Task* task) {
   map<string, string> params;
@@ -937,6 +1309,17 @@ void EtcdClient::ForceDelete(const string& key, Task* task) {
 }
 
 
+void EtcdClient::ForceDeleteDir(const string& key, Task* task) {
+  map<string, string> params;
+  params["dir"] = "true";
+  params["recursive"] = "true";
+  GenericResponse* const gen_resp(new GenericResponse);
+  task->DeleteWhenDone(gen_resp);
+
+  Generic(key, kKeysSpace, params, UrlFetcher::Verb::DELETE, gen_resp, task);
+}
+
+
 void EtcdClient::GetStoreStats(StatsResponse* resp, Task* task) {
   map<string, string> params;
   GenericResponse* const gen_resp(new GenericResponse);
@@ -948,6 +1331,15 @@ void EtcdClient::GetStoreStats(StatsResponse* resp, Task* task) {
 }
 
 
+void EtcdClient::Batch(vector<WriteOp>&& ops, int max_concurrency,
+                       BatchResponse* resp, Task* task) {
+  util::TaskHold hold(CHECK_NOTNULL(task));
+  BatchState* const state(
+      new BatchState(this, move(ops), max_concurrency, resp, task));
+  task->DeleteWhenDone(state);
+}
+
+
 void EtcdClient::Watch(const string& key, const WatchCallback& cb,
                        Task* task) {
   VLOG(1) << "EtcdClient::Watch: " << key;
@@ -965,8 +1357,12 @@ void EtcdClient::Generic(const string& key, const string& key_space,
                          UrlFetcher::Verb verb, GenericResponse* resp,
                          Task* task) {
   MaybeLogEtcdVersion();
-  RequestState* const etcd_req(new RequestState(verb, key, key_space, params,
-                                                GetEndpoint(), resp, task));
+  // Writes go to the member a redirect last told us about, as it is
+  // the leader.
+  RequestState* const etcd_req(new RequestState(
+      verb, key, key_space, params,
+      verb == UrlFetcher::Verb::GET ? GetReadEndpoint() : GetEndpoint(), resp,
+      task));
   task->DeleteWhenDone(etcd_req);
 
   fetcher_->Fetch(etcd_req->req_, &etcd_req->resp_,
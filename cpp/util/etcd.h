@@ -2,6 +2,7 @@
 #define CERT_TRANS_UTIL_ETCD_H_
 
 #include <chrono>
+#include <functional>
 #include <list>
 #include <map>
 #include <memory>
@@ -72,14 +73,53 @@ class EtcdClient {
     Node node;
   };
 
+  typedef std::function<void(const Node& node)> NodeCallback;
+
   struct GenericResponse : public Response {
     std::shared_ptr<JsonObject> json_body;
+    // If set, a successful response is parsed as it is read, passing
+    // the nodes under its "node" to this callback, and the rest of
+    // that node is left in |node| instead of |json_body|.
+    NodeCallback node_callback;
+    Node node;
   };
 
   struct StatsResponse : public Response {
     std::map<std::string, int64_t> stats;
   };
 
+  // A single write, for Batch().
+  struct WriteOp {
+    enum Type {
+      CREATE,
+      UPDATE,
+      FORCE_SET,
+      DELETE,
+      FORCE_DELETE,
+    };
+
+    WriteOp(Type thetype, const std::string& thekey,
+            const std::string& thevalue, int64_t theprevious_index)
+        : type(thetype),
+          key(thekey),
+          value(thevalue),
+          previous_index(theprevious_index) {
+    }
+
+    Type type;
+    std::string key;
+    // Unused for DELETE and FORCE_DELETE.
+    std::string value;
+    // Only used for UPDATE and DELETE.
+    int64_t previous_index;
+  };
+
+  struct BatchResponse : public Response {
+    // For each of the operations, in the same order.
+    std::vector<util::Status> statuses;
+    std::vector<Response> responses;
+  };
+
   typedef std::function<void(const std::vector<Node>& updates)> WatchCallback;
 
   EtcdClient(util::Executor* executor, UrlFetcher* fetcher, const std::string& host, uint16_t port);
@@ -90,6 +130,15 @@ class EtcdClient {
 
   virtual void Get(const Request& req, GetResponse* resp, util::Task* task);
 
+  // Like Get(), but the nodes listed under |req.key| are passed to
+  // |cb| one at a time as they are parsed out of the response, rather
+  // than all kept in |resp->node.nodes_|, which is left empty. This
+  // keeps large directory listings from being held in memory all at
+  // once. |cb| is called before |task| completes, and on error may
+  // already have been called for some of the nodes.
+  virtual void GetDir(const Request& req, const NodeCallback& cb,
+                      GetResponse* resp, util::Task* task);
+
   virtual void Create(const std::string& key, const std::string& value,
                       Response* resp, util::Task* task);
 
@@ -119,12 +168,37 @@ class EtcdClient {
 
   virtual void ForceDelete(const std::string& key, util::Task* task);
 
+  // Deletes the directory |key| and everything under it.
+  virtual void ForceDeleteDir(const std::string& key, util::Task* task);
+
   virtual void GetStoreStats(StatsResponse* resp, util::Task* task);
 
+  // Performs the operations in |ops|, with up to |max_concurrency| of
+  // their requests in flight at a time (the v2 API has no multi-key
+  // transactions). Each operation succeeds or fails on its own, but no
+  // more are started after one fails, and |task| then returns that
+  // error. A FORCE_DELETE of a key that doesn't exist is not an error.
+  virtual void Batch(std::vector<WriteOp>&& ops, int max_concurrency,
+                     BatchResponse* resp, util::Task* task);
+
+  // Watches "key" and, if it is a directory, all the keys under it,
+  // including those of its subdirectories (but not the directories
+  // themselves). The first call to "cb" has all of those that exist,
+  // and the following ones the keys updated or deleted since.
+  //
   // The "cb" will be called on the "task" executor. Also, only one
   // will be sent to the executor at a time (for a given call to this
   // method, not for all of them), to make sure they are received in
   // order.
+  //
+  // Each call holds its own long poll (the v2 API has no multiplexed
+  // watch stream), which resumes from the last index seen after each
+  // event or error, and only falls back to a full get of "key" when
+  // etcd no longer has that index.
+  //
+  // With --etcd_watch_coalesce_ms, the updates that arrive within that
+  // window are passed to "cb" in a single call, so that bursts of them
+  // (such as on startup) do not each cause work of their own.
   virtual void Watch(const std::string& key, const WatchCallback& cb,
                      util::Task* task);
 
@@ -136,8 +210,20 @@ class EtcdClient {
   struct RequestState;
   struct WatchState;
 
+  // Moving averages for one etcd member.
+  struct MemberStats {
+    MemberStats() : latency_seconds(0), error_rate(0) {
+    }
+
+    double latency_seconds;
+    double error_rate;
+  };
+
   HostPortPair ChooseNextServer();
   HostPortPair GetEndpoint() const;
+  HostPortPair GetReadEndpoint() const;
+  void RecordResult(const HostPortPair& member, bool reached, bool long_poll,
+                    const std::chrono::steady_clock::duration& elapsed);
   HostPortPair UpdateEndpoint(HostPortPair&& new_endpoint);
   void FetchDone(RequestState* etcd_req, util::Task* task);
   void Generic(const std::string& key, const std::string& key_space,
@@ -147,6 +233,9 @@ class EtcdClient {
   void WatchInitialGetDone(WatchState* state, GetResponse* resp,
                            util::Task* task);
   void SendWatchUpdates(WatchState* state, const std::vector<Node>& updates);
+  void QueueWatchUpdates(WatchState* state, const std::vector<Node>& updates);
+  void ScheduleWatchDelivery(WatchState* state);
+  void DeliverWatchUpdates(WatchState* state, util::Task* child_task);
   void StartWatchRequest(WatchState* state);
   void WatchRequestDone(WatchState* state, GetResponse* gen_resp,
                         util::Task* child_task);
@@ -159,6 +248,7 @@ class EtcdClient {
 
   mutable std::mutex lock_;
   std::list<HostPortPair> etcds_;
+  std::map<HostPortPair, MemberStats> member_stats_;
   bool logged_version_;
 
   DISALLOW_COPY_AND_ASSIGN(EtcdClient);
@@ -1,11 +1,21 @@
 #include "util/etcd_delete.h"
 
-#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <mutex>
 
+#include "monitoring/monitoring.h"
+
+using std::atomic;
 using std::bind;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::max;
+using std::min;
 using std::move;
 using std::mutex;
 using std::placeholders::_1;
@@ -18,53 +28,88 @@ using util::TaskHold;
 
 DEFINE_int32(etcd_delete_concurrency, 4,
              "number of etcd keys to delete at a time");
+DEFINE_int32(etcd_delete_target_latency_ms, 0,
+             "if non-zero, the number of etcd keys deleted at a time starts "
+             "at --etcd_delete_concurrency, and is then adjusted (up to "
+             "--etcd_delete_max_concurrency) to keep the latency of the "
+             "deletes under this many milliseconds");
+DEFINE_int32(etcd_delete_max_concurrency, 64,
+             "maximum number of etcd keys to delete at a time, when "
+             "--etcd_delete_target_latency_ms is set");
 
 namespace cert_trans {
 namespace {
 
 
-class DeleteState {
+static Gauge<>* etcd_delete_concurrency(
+    Gauge<>::New("etcd_delete_concurrency",
+                 "Number of etcd keys deleted at a time, as adjusted by "
+                 "--etcd_delete_target_latency_ms."));
+
+// The adjusted concurrency is carried over from one call to the next,
+// so that a cleanup done in chunks doesn't have to find it again for
+// each of them. Zero until the first adjusted deletion.
+atomic<int> adjusted_concurrency(0);
+
+
+// Deletes the keys, increasing the number of requests in flight by
+// one for each round of them completing within the target latency,
+// and halving it when one doesn't.
+class AdaptiveDeleteState {
  public:
-  DeleteState(EtcdClient* client, vector<string>&& keys, Task* task)
+  AdaptiveDeleteState(EtcdClient* client, vector<string>&& keys, Task* task)
       : client_(CHECK_NOTNULL(client)),
         task_(CHECK_NOTNULL(task)),
-        outstanding_(0),
         keys_(move(keys)),
-        it_(keys_.begin()) {
-    CHECK_GT(FLAGS_etcd_delete_concurrency, 0);
+        target_latency_(FLAGS_etcd_delete_target_latency_ms),
+        max_concurrency_(max(1, FLAGS_etcd_delete_max_concurrency)),
+        concurrency_(adjusted_concurrency.load()),
+        outstanding_(0),
+        next_(0),
+        successes_(0),
+        last_decrease_(steady_clock::now()) {
+    if (concurrency_ < 1) {
+      concurrency_ = FLAGS_etcd_delete_concurrency;
+    }
+    concurrency_ = min(concurrency_, max_concurrency_);
+    etcd_delete_concurrency->Set(concurrency_);
 
-    if (it_ == keys_.end()) {
+    if (keys_.empty()) {
       // Nothing to do!
       task_->Return();
     } else {
-      StartNextRequest(unique_lock<mutex>(mutex_));
+      StartNextRequests(unique_lock<mutex>(mutex_));
     }
   }
 
-  ~DeleteState() {
+  ~AdaptiveDeleteState() {
     CHECK_EQ(outstanding_, 0);
   }
 
  private:
-  void RequestDone(Task* child_task);
-  void StartNextRequest(unique_lock<mutex>&& lock);
+  void RequestDone(steady_clock::time_point started, Task* child_task);
+  void StartNextRequests(unique_lock<mutex>&& lock);
 
   EtcdClient* const client_;
   Task* const task_;
+  const vector<string> keys_;
+  const milliseconds target_latency_;
+  const int max_concurrency_;
   mutex mutex_;
+  int concurrency_;
   int outstanding_;
-  const vector<string> keys_;
-  vector<string>::const_iterator it_;
+  size_t next_;
+  int successes_;
+  steady_clock::time_point last_decrease_;
 };
 
 
-void DeleteState::RequestDone(Task* child_task) {
+void AdaptiveDeleteState::RequestDone(steady_clock::time_point started,
+                                      Task* child_task) {
+  const steady_clock::time_point now(steady_clock::now());
   unique_lock<mutex> lock(mutex_);
   --outstanding_;
 
-  // If a child task has an error (except for not found, this is close
-  // enough to success), return that error, and do not start any more
-  // requests.
   if (!child_task->status().ok() &&
       child_task->status().CanonicalCode() != util::error::NOT_FOUND) {
     lock.unlock();
@@ -72,19 +117,32 @@ void DeleteState::RequestDone(Task* child_task) {
     return;
   }
 
-  if (it_ != keys_.end()) {
-    StartNextRequest(move(lock));
-  } else {
-    if (outstanding_ < 1) {
-      // No more keys to get, and this was the last one to complete.
-      lock.unlock();
-      task_->Return();
+  if (duration_cast<milliseconds>(now - started) > target_latency_) {
+    // The requests started before the last decrease were sent at the
+    // old concurrency, so they don't count against the new one.
+    if (started >= last_decrease_) {
+      concurrency_ = max(1, concurrency_ / 2);
+      successes_ = 0;
+      last_decrease_ = now;
     }
+  } else if (++successes_ >= concurrency_) {
+    concurrency_ = min(max_concurrency_, concurrency_ + 1);
+    successes_ = 0;
+  }
+  adjusted_concurrency.store(concurrency_);
+  etcd_delete_concurrency->Set(concurrency_);
+
+  if (next_ < keys_.size()) {
+    StartNextRequests(move(lock));
+  } else if (outstanding_ < 1) {
+    // No more keys to delete, and this was the last one to complete.
+    lock.unlock();
+    task_->Return();
   }
 }
 
 
-void DeleteState::StartNextRequest(unique_lock<mutex>&& lock) {
+void AdaptiveDeleteState::StartNextRequests(unique_lock<mutex>&& lock) {
   CHECK(lock.owns_lock());
 
   if (task_->CancelRequested()) {
@@ -94,18 +152,18 @@ void DeleteState::StartNextRequest(unique_lock<mutex>&& lock) {
     return;
   }
 
-  while (outstanding_ < FLAGS_etcd_delete_concurrency && it_ != keys_.end() &&
+  while (outstanding_ < concurrency_ && next_ < keys_.size() &&
          task_->IsActive()) {
-    CHECK(lock.owns_lock());
-    const string& key(*it_);
-    ++it_;
+    const string& key(keys_[next_]);
+    ++next_;
     ++outstanding_;
 
     // In case the task uses an inline executor.
     lock.unlock();
 
     client_->ForceDelete(key, task_->AddChild(
-                                  bind(&DeleteState::RequestDone, this, _1)));
+                                  bind(&AdaptiveDeleteState::RequestDone,
+                                       this, steady_clock::now(), _1)));
 
     // We must be holding the lock to evaluate the loop condition.
     lock.lock();
@@ -119,8 +177,21 @@ void DeleteState::StartNextRequest(unique_lock<mutex>&& lock) {
 void EtcdForceDeleteKeys(EtcdClient* client, vector<string>&& keys,
                          Task* task) {
   TaskHold hold(CHECK_NOTNULL(task));
-  DeleteState* const state(new DeleteState(client, move(keys), task));
-  task->DeleteWhenDone(state);
+  CHECK_NOTNULL(client);
+  CHECK_GT(FLAGS_etcd_delete_concurrency, 0);
+  if (FLAGS_etcd_delete_target_latency_ms > 0) {
+    task->DeleteWhenDone(new AdaptiveDeleteState(client, move(keys), task));
+    return;
+  }
+
+  vector<EtcdClient::WriteOp> ops;
+  ops.reserve(keys.size());
+  for (const auto& key : keys) {
+    ops.emplace_back(EtcdClient::WriteOp::FORCE_DELETE, key, "", 0);
+  }
+  EtcdClient::BatchResponse* const resp(new EtcdClient::BatchResponse);
+  task->DeleteWhenDone(resp);
+  client->Batch(move(ops), FLAGS_etcd_delete_concurrency, resp, task);
 }
 
 
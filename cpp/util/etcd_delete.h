@@ -10,8 +10,10 @@
 namespace cert_trans {
 
 
-// Force delete keys in batches (implemented using concurrent
-// requests). The "keys" argument are pairs of key and modified index.
+// Force delete keys in batches (implemented using EtcdClient::Batch(),
+// with --etcd_delete_concurrency requests at a time). If
+// --etcd_delete_target_latency_ms is set, the number of requests at a
+// time is instead adjusted to how quickly etcd responds.
 void EtcdForceDeleteKeys(EtcdClient* client, std::vector<std::string>&& keys,
                          util::Task* task);
 
@@ -32,6 +32,8 @@ using util::Task;
 using util::testing::StatusIs;
 
 DECLARE_int32(etcd_delete_concurrency);
+DECLARE_int32(etcd_delete_max_concurrency);
+DECLARE_int32(etcd_delete_target_latency_ms);
 
 namespace cert_trans {
 namespace {
@@ -41,6 +43,7 @@ class EtcdDeleteTest : public ::testing::Test {
  protected:
   EtcdDeleteTest() : pool_(1) {
     FLAGS_etcd_delete_concurrency = 2;
+    FLAGS_etcd_delete_target_latency_ms = 0;
   }
 
   ThreadPool pool_;
@@ -217,6 +220,70 @@ TEST_F(EtcdDeleteTest, ErrorHandling) {
 }
 
 
+TEST_F(EtcdDeleteTest, AdaptiveDeletesAll) {
+  FLAGS_etcd_delete_target_latency_ms = 60000;
+  FLAGS_etcd_delete_max_concurrency = 4;
+  vector<string> keys;
+  for (int i = 0; i < 20; ++i) {
+    keys.emplace_back("/" + std::to_string(i));
+  }
+  SyncTask sync(&pool_);
+
+  for (const auto& key : keys) {
+    EXPECT_CALL(client_, ForceDelete(key, _))
+        .WillOnce(Invoke([](const string&, Task* task) { task->Return(); }));
+  }
+  EtcdForceDeleteKeys(&client_, move(keys), sync.task());
+
+  sync.Wait();
+  EXPECT_OK(sync.status());
+}
+
+
+TEST_F(EtcdDeleteTest, AdaptiveWithinMaxConcurrency) {
+  FLAGS_etcd_delete_target_latency_ms = 60000;
+  FLAGS_etcd_delete_max_concurrency = 2;
+  vector<string> keys{"/one", "/two", "/three"};
+  SyncTask sync(&pool_);
+
+  Task* first_task(nullptr);
+  Notification first;
+  Task* second_task(nullptr);
+  Notification second;
+  EXPECT_CALL(client_, ForceDelete("/one", _))
+      .WillOnce(DoAll(SaveArg<1>(&first_task),
+                      InvokeWithoutArgs(&first, &Notification::Notify)));
+  EXPECT_CALL(client_, ForceDelete("/two", _))
+      .WillOnce(DoAll(SaveArg<1>(&second_task),
+                      InvokeWithoutArgs(&second, &Notification::Notify)));
+  EtcdForceDeleteKeys(&client_, move(keys), sync.task());
+
+  ASSERT_TRUE(first.WaitForNotificationWithTimeout(seconds(1)));
+  ASSERT_TRUE(first_task);
+  ASSERT_TRUE(second.WaitForNotificationWithTimeout(seconds(1)));
+  ASSERT_TRUE(second_task);
+
+  // Make sure all the expected calls were called, and no more.
+  Mock::VerifyAndClearExpectations(&client_);
+
+  Task* third_task(nullptr);
+  Notification third;
+  EXPECT_CALL(client_, ForceDelete("/three", _))
+      .WillOnce(DoAll(SaveArg<1>(&third_task),
+                      InvokeWithoutArgs(&third, &Notification::Notify)));
+  first_task->Return(Status(util::error::NOT_FOUND, "already gone"));
+
+  ASSERT_TRUE(third.WaitForNotificationWithTimeout(seconds(1)));
+  ASSERT_TRUE(third_task);
+
+  second_task->Return();
+  third_task->Return();
+
+  sync.Wait();
+  EXPECT_OK(sync.status());
+}
+
+
 }  // namespace
 }  // namespace cert_trans
 
@@ -0,0 +1,474 @@
+#include "util/etcd_node_parser.h"
+
+#include <event2/buffer.h>
+#include <functional>
+#include <glog/logging.h>
+#include <limits>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::function;
+using std::move;
+using std::numeric_limits;
+using std::string;
+using std::to_string;
+using std::vector;
+using util::Status;
+using util::StatusOr;
+
+namespace cert_trans {
+namespace {
+
+
+// etcd does not nest anywhere near this deep, this only protects the
+// stack from malformed input.
+const int kMaxDepth = 64;
+
+
+// A recursive descent parser, reading the input in the chunks it is
+// given (which need not end on token boundaries) rather than requiring
+// it to be contiguous.
+class Parser {
+ public:
+  Parser(vector<evbuffer_iovec>&& chunks, const EtcdClient::NodeCallback& cb)
+      : chunks_(move(chunks)), cb_(cb), chunk_(0), pos_(0), offset_(0) {
+  }
+
+  StatusOr<EtcdClient::Node> Parse();
+
+ private:
+  // Returns the next character without consuming it, or -1 at the
+  // end of the input.
+  int Peek() {
+    while (chunk_ < chunks_.size()) {
+      if (pos_ < chunks_[chunk_].iov_len) {
+        return static_cast<unsigned char>(
+            static_cast<const char*>(chunks_[chunk_].iov_base)[pos_]);
+      }
+      ++chunk_;
+      pos_ = 0;
+    }
+    return -1;
+  }
+
+  int Next() {
+    const int c(Peek());
+    if (c >= 0) {
+      ++pos_;
+      ++offset_;
+    }
+    return c;
+  }
+
+  void SkipWhitespace() {
+    for (int c(Peek()); c == ' ' || c == '\t' || c == '\n' || c == '\r';
+         c = Peek()) {
+      Next();
+    }
+  }
+
+  // Consumes |c| if it is the next character after any whitespace.
+  bool Consume(char c) {
+    SkipWhitespace();
+    if (Peek() != c) {
+      return false;
+    }
+    Next();
+    return true;
+  }
+
+  bool Expect(char c) {
+    return Consume(c) || Fail(string("expected '") + c + "'");
+  }
+
+  // Records the first error, and returns false for convenience.
+  bool Fail(const string& what) {
+    if (error_.empty()) {
+      error_ = what + " at offset " + to_string(offset_);
+    }
+    return false;
+  }
+
+  // Calls |member| with the name of each member of an object, with
+  // the input positioned at its value, which it must consume.
+  bool ParseObject(int depth, const function<bool(const string&)>& member);
+  // Calls |element| for each element of an array, which it must
+  // consume.
+  bool ParseArray(int depth, const function<bool()>& element);
+  // |out| may be NULL, to skip the string.
+  bool ParseString(string* out);
+  bool ParseHex4(uint32_t* out);
+  bool ParseInt(int64_t* out);
+  bool ParseBool(bool* out);
+  bool ParseLiteral(const char* literal);
+  bool SkipValue(int depth);
+  // If |stream|, the nodes under this one are passed to |cb_| rather
+  // than added to it.
+  bool ParseNode(int depth, bool stream, EtcdClient::Node* node);
+
+  const vector<evbuffer_iovec> chunks_;
+  const EtcdClient::NodeCallback& cb_;
+  size_t chunk_;
+  size_t pos_;
+  size_t offset_;
+  string error_;
+};
+
+
+void AppendUtf8(uint32_t code, string* out) {
+  if (code < 0x80) {
+    out->push_back(code);
+  } else if (code < 0x800) {
+    out->push_back(0xc0 | (code >> 6));
+    out->push_back(0x80 | (code & 0x3f));
+  } else if (code < 0x10000) {
+    out->push_back(0xe0 | (code >> 12));
+    out->push_back(0x80 | ((code >> 6) & 0x3f));
+    out->push_back(0x80 | (code & 0x3f));
+  } else {
+    out->push_back(0xf0 | (code >> 18));
+    out->push_back(0x80 | ((code >> 12) & 0x3f));
+    out->push_back(0x80 | ((code >> 6) & 0x3f));
+    out->push_back(0x80 | (code & 0x3f));
+  }
+}
+
+
+bool Parser::ParseObject(int depth,
+                         const function<bool(const string&)>& member) {
+  if (depth > kMaxDepth) {
+    return Fail("nested too deep");
+  }
+  if (!Expect('{')) {
+    return false;
+  }
+  string name;
+  // Like json-c, tolerate a trailing comma.
+  while (!Consume('}')) {
+    if (!ParseString(&name) || !Expect(':') || !member(name)) {
+      return false;
+    }
+    if (!Consume(',')) {
+      return Expect('}');
+    }
+  }
+  return true;
+}
+
+
+bool Parser::ParseArray(int depth, const function<bool()>& element) {
+  if (depth > kMaxDepth) {
+    return Fail("nested too deep");
+  }
+  if (!Expect('[')) {
+    return false;
+  }
+  while (!Consume(']')) {
+    if (!element()) {
+      return false;
+    }
+    if (!Consume(',')) {
+      return Expect(']');
+    }
+  }
+  return true;
+}
+
+
+bool Parser::ParseString(string* out) {
+  SkipWhitespace();
+  if (Next() != '"') {
+    return Fail("expected a string");
+  }
+  if (out) {
+    out->clear();
+  }
+
+  while (true) {
+    // Copy the plain characters up to the end of the chunk in one go.
+    if (chunk_ < chunks_.size()) {
+      const char* const begin(
+          static_cast<const char*>(chunks_[chunk_].iov_base) + pos_);
+      const char* const end(
+          static_cast<const char*>(chunks_[chunk_].iov_base) +
+          chunks_[chunk_].iov_len);
+      const char* p(begin);
+      while (p < end && *p != '"' && *p != '\\' &&
+             static_cast<unsigned char>(*p) >= 0x20) {
+        ++p;
+      }
+      if (out) {
+        out->append(begin, p - begin);
+      }
+      pos_ += p - begin;
+      offset_ += p - begin;
+    }
+
+    int c(Next());
+    if (c < 0) {
+      return Fail("unterminated string");
+    }
+    if (c == '"') {
+      return true;
+    }
+    if (c < 0x20) {
+      return Fail("control character in string");
+    }
+    if (c == '\\') {
+      c = Next();
+      switch (c) {
+        case '"':
+        case '\\':
+        case '/':
+          break;
+        case 'b':
+          c = '\b';
+          break;
+        case 'f':
+          c = '\f';
+          break;
+        case 'n':
+          c = '\n';
+          break;
+        case 'r':
+          c = '\r';
+          break;
+        case 't':
+          c = '\t';
+          break;
+        case 'u': {
+          uint32_t code;
+          if (!ParseHex4(&code)) {
+            return false;
+          }
+          if (code >= 0xd800 && code < 0xdc00) {
+            uint32_t low;
+            if (Next() != '\\' || Next() != 'u' || !ParseHex4(&low) ||
+                low < 0xdc00 || low >= 0xe000) {
+              return Fail("invalid surrogate pair");
+            }
+            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+          }
+          if (out) {
+            AppendUtf8(code, out);
+          }
+          continue;
+        }
+        default:
+          return Fail("invalid escape");
+      }
+    }
+    if (out) {
+      out->push_back(c);
+    }
+  }
+}
+
+
+bool Parser::ParseHex4(uint32_t* out) {
+  *out = 0;
+  for (int i = 0; i < 4; ++i) {
+    const int c(Next());
+    *out <<= 4;
+    if (c >= '0' && c <= '9') {
+      *out |= c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      *out |= c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      *out |= c - 'A' + 10;
+    } else {
+      return Fail("invalid \\u escape");
+    }
+  }
+  return true;
+}
+
+
+bool Parser::ParseInt(int64_t* out) {
+  SkipWhitespace();
+  const bool negative(Peek() == '-');
+  if (negative) {
+    Next();
+  }
+  if (Peek() < '0' || Peek() > '9') {
+    return Fail("expected an integer");
+  }
+  int64_t value(0);
+  while (Peek() >= '0' && Peek() <= '9') {
+    const int digit(Next() - '0');
+    if (value > (numeric_limits<int64_t>::max() - digit) / 10) {
+      return Fail("integer out of range");
+    }
+    value = value * 10 + digit;
+  }
+  *out = negative ? -value : value;
+  return true;
+}
+
+
+bool Parser::ParseBool(bool* out) {
+  SkipWhitespace();
+  *out = Peek() == 't';
+  return ParseLiteral(*out ? "true" : "false");
+}
+
+
+bool Parser::ParseLiteral(const char* literal) {
+  SkipWhitespace();
+  for (const char* p = literal; *p; ++p) {
+    if (Next() != *p) {
+      return Fail(string("expected ") + literal);
+    }
+  }
+  return true;
+}
+
+
+bool Parser::SkipValue(int depth) {
+  SkipWhitespace();
+  switch (Peek()) {
+    case '{':
+      return ParseObject(depth, [this, depth](const string&) {
+        return SkipValue(depth + 1);
+      });
+    case '[':
+      return ParseArray(depth, [this, depth]() {
+        return SkipValue(depth + 1);
+      });
+    case '"':
+      return ParseString(nullptr);
+    case 't':
+      return ParseLiteral("true");
+    case 'f':
+      return ParseLiteral("false");
+    case 'n':
+      return ParseLiteral("null");
+  }
+
+  // Anything else has to be a number, which is not interpreted.
+  int length(0);
+  for (int c(Peek()); (c >= '0' && c <= '9') || c == '-' || c == '+' ||
+                      c == '.' || c == 'e' || c == 'E';
+       c = Peek()) {
+    Next();
+    ++length;
+  }
+  return length > 0 || Fail("unexpected character");
+}
+
+
+bool Parser::ParseNode(int depth, bool stream, EtcdClient::Node* node) {
+  int64_t created_index(-1);
+  int64_t modified_index(-1);
+  bool has_key(false);
+  string key;
+  bool has_value(false);
+  string value;
+  bool is_dir(false);
+  vector<EtcdClient::Node> nodes;
+
+  const bool ok(ParseObject(depth, [&](const string& name) {
+    if (name == "createdIndex") {
+      return ParseInt(&created_index);
+    } else if (name == "modifiedIndex") {
+      return ParseInt(&modified_index);
+    } else if (name == "key") {
+      has_key = true;
+      return ParseString(&key);
+    } else if (name == "value") {
+      has_value = true;
+      return ParseString(&value);
+    } else if (name == "dir") {
+      return ParseBool(&is_dir);
+    } else if (name == "nodes") {
+      return ParseArray(depth + 1, [&]() {
+        EtcdClient::Node child;
+        if (!ParseNode(depth + 2, false, &child)) {
+          return false;
+        }
+        if (child.deleted_) {
+          return Fail("deleted sub-node " + child.key_);
+        }
+        if (stream) {
+          cb_(child);
+        } else {
+          nodes.emplace_back(move(child));
+        }
+        return true;
+      });
+    }
+    return SkipValue(depth + 1);
+  }));
+  if (!ok) {
+    return false;
+  }
+
+  if (created_index < 0) {
+    return Fail("couldn't find 'createdIndex'");
+  }
+  if (modified_index < 0) {
+    return Fail("couldn't find 'modifiedIndex'");
+  }
+  if (!has_key) {
+    return Fail("couldn't find 'key'");
+  }
+
+  const bool deleted(!has_value && !is_dir);
+  if (!is_dir || deleted) {
+    nodes.clear();
+  }
+  *node = EtcdClient::Node(created_index, modified_index, key, is_dir, "",
+                           move(nodes), deleted);
+  if (!is_dir && !deleted) {
+    node->value_.swap(value);
+  }
+  return true;
+}
+
+
+StatusOr<EtcdClient::Node> Parser::Parse() {
+  EtcdClient::Node node;
+  bool found(false);
+  const bool ok(ParseObject(0, [this, &node, &found](const string& name) {
+    if (name == "node" && !found) {
+      found = true;
+      return ParseNode(1, true, &node);
+    }
+    return SkipValue(1);
+  }));
+  if (ok && !found) {
+    Fail("couldn't find 'node'");
+  }
+  if (!error_.empty()) {
+    return Status(util::error::FAILED_PRECONDITION, "Invalid JSON: " + error_);
+  }
+  return node;
+}
+
+
+}  // namespace
+
+
+StatusOr<EtcdClient::Node> StreamNodesFromJson(
+    const char* data, size_t length, const EtcdClient::NodeCallback& cb) {
+  evbuffer_iovec chunk;
+  chunk.iov_base = const_cast<char*>(data);
+  chunk.iov_len = length;
+  return Parser(vector<evbuffer_iovec>{chunk}, cb).Parse();
+}
+
+
+StatusOr<EtcdClient::Node> StreamNodesFromJson(
+    evbuffer* buffer, const EtcdClient::NodeCallback& cb) {
+  const int count(evbuffer_peek(buffer, -1, nullptr, nullptr, 0));
+  vector<evbuffer_iovec> chunks(count > 0 ? count : 0);
+  if (!chunks.empty()) {
+    CHECK_EQ(count, evbuffer_peek(buffer, -1, nullptr, chunks.data(), count));
+  }
+  return Parser(move(chunks), cb).Parse();
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,33 @@
+#ifndef CERT_TRANS_UTIL_ETCD_NODE_PARSER_H_
+#define CERT_TRANS_UTIL_ETCD_NODE_PARSER_H_
+
+#include <stddef.h>
+
+#include "util/etcd.h"
+#include "util/statusor.h"
+
+struct evbuffer;
+
+namespace cert_trans {
+
+
+// Parses the JSON body of a successful etcd v2 response without
+// building a document for it first. Each of the nodes listed in the
+// "nodes" of its "node" is passed to |cb| as soon as it has been read,
+// so that only one of them is held at a time, and the "node" itself is
+// returned with its |nodes_| left empty. Nodes further down (in a
+// recursive listing) stay in the |nodes_| of their parent.
+//
+// On error, |cb| may already have been called for some of the nodes.
+util::StatusOr<EtcdClient::Node> StreamNodesFromJson(
+    const char* data, size_t length, const EtcdClient::NodeCallback& cb);
+
+// Same, for a body in |buffer|, which is read in place and left
+// untouched.
+util::StatusOr<EtcdClient::Node> StreamNodesFromJson(
+    evbuffer* buffer, const EtcdClient::NodeCallback& cb);
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_UTIL_ETCD_NODE_PARSER_H_
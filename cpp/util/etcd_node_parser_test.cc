@@ -0,0 +1,135 @@
+#include "util/etcd_node_parser.h"
+
+#include <event2/buffer.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using util::StatusOr;
+
+const char kDirJson[] =
+    "{\"action\":\"get\","
+    " \"node\":{\"key\":\"/dir\",\"dir\":true,\"nodes\":["
+    "  {\"key\":\"/dir/a\",\"value\":\"one\",\"modifiedIndex\":4,"
+    "   \"createdIndex\":3},"
+    "  {\"key\":\"/dir/b\",\"value\":\"t\\\\w\\\"o\\u00e9\\ud83d\\ude00\","
+    "   \"expiration\":\"2015-01-01T00:00:00Z\",\"ttl\":12,"
+    "   \"modifiedIndex\":6,\"createdIndex\":5},"
+    "  {\"key\":\"/dir/sub\",\"dir\":true,\"nodes\":["
+    "   {\"key\":\"/dir/sub/c\",\"value\":\"three\",\"modifiedIndex\":8,"
+    "    \"createdIndex\":8}],"
+    "   \"modifiedIndex\":7,\"createdIndex\":7},"
+    " ],\"modifiedIndex\":2,\"createdIndex\":1},"
+    " \"prevNode\":{\"key\":\"/dir\",\"dir\":true,\"extra\":[1.5e3,null]}}";
+
+
+class EtcdNodeParserTest : public ::testing::Test {
+ protected:
+  StatusOr<EtcdClient::Node> Parse(const string& json) {
+    nodes_.clear();
+    return StreamNodesFromJson(json.data(), json.size(),
+                               [this](const EtcdClient::Node& node) {
+                                 nodes_.emplace_back(node);
+                               });
+  }
+
+  vector<EtcdClient::Node> nodes_;
+};
+
+
+TEST_F(EtcdNodeParserTest, StreamsDirectory) {
+  const StatusOr<EtcdClient::Node> dir(Parse(kDirJson));
+  ASSERT_TRUE(dir.ok()) << dir.status();
+  EXPECT_EQ("/dir", dir.ValueOrDie().key_);
+  EXPECT_TRUE(dir.ValueOrDie().is_dir_);
+  EXPECT_EQ(1, dir.ValueOrDie().created_index_);
+  EXPECT_EQ(2, dir.ValueOrDie().modified_index_);
+  EXPECT_TRUE(dir.ValueOrDie().nodes_.empty());
+
+  ASSERT_EQ(3U, nodes_.size());
+  EXPECT_EQ("/dir/a", nodes_[0].key_);
+  EXPECT_EQ("one", nodes_[0].value_);
+  EXPECT_EQ(3, nodes_[0].created_index_);
+  EXPECT_EQ(4, nodes_[0].modified_index_);
+  EXPECT_FALSE(nodes_[0].deleted_);
+  EXPECT_EQ("t\\w\"o\xc3\xa9\xf0\x9f\x98\x80", nodes_[1].value_);
+  EXPECT_EQ(6, nodes_[1].modified_index_);
+  // Nodes further down stay with their parent.
+  EXPECT_TRUE(nodes_[2].is_dir_);
+  ASSERT_EQ(1U, nodes_[2].nodes_.size());
+  EXPECT_EQ("three", nodes_[2].nodes_[0].value_);
+}
+
+
+TEST_F(EtcdNodeParserTest, SingleNode) {
+  const StatusOr<EtcdClient::Node> node(
+      Parse("{\"node\":{\"key\":\"/k\",\"value\":\"v\",\"modifiedIndex\":9,"
+            "\"createdIndex\":6}}"));
+  ASSERT_TRUE(node.ok()) << node.status();
+  EXPECT_EQ("v", node.ValueOrDie().value_);
+  EXPECT_FALSE(node.ValueOrDie().is_dir_);
+  EXPECT_TRUE(nodes_.empty());
+}
+
+
+TEST_F(EtcdNodeParserTest, AcrossBufferChunks) {
+  // One byte per chunk, so that every token straddles a boundary.
+  const unique_ptr<evbuffer, void (*)(evbuffer*)> buffer(evbuffer_new(),
+                                                         evbuffer_free);
+  const string json(kDirJson);
+  for (size_t i = 0; i < json.size(); ++i) {
+    evbuffer_add_reference(buffer.get(), json.data() + i, 1, nullptr,
+                           nullptr);
+  }
+  ASSERT_EQ(json.size(), evbuffer_get_length(buffer.get()));
+  const StatusOr<EtcdClient::Node> dir(StreamNodesFromJson(
+      buffer.get(), [this](const EtcdClient::Node& node) {
+        nodes_.emplace_back(node);
+      }));
+  ASSERT_TRUE(dir.ok()) << dir.status();
+  ASSERT_EQ(3U, nodes_.size());
+  EXPECT_EQ("t\\w\"o\xc3\xa9\xf0\x9f\x98\x80", nodes_[1].value_);
+  // The buffer is left as it was.
+  EXPECT_EQ(json.size(), evbuffer_get_length(buffer.get()));
+}
+
+
+TEST_F(EtcdNodeParserTest, Errors) {
+  EXPECT_FALSE(Parse("").ok());
+  EXPECT_FALSE(Parse("{\"action\":\"get\"}").ok());
+  EXPECT_FALSE(Parse("{\"node\":{\"key\":\"/k\",\"value\":\"v\"}}").ok());
+  EXPECT_FALSE(Parse("{\"node\":{\"key\":\"/k\",\"value\":\"v").ok());
+  EXPECT_FALSE(Parse("{\"node\":{\"key\":\"/k\\x\"}}").ok());
+
+  // The nodes before the error have been passed on already.
+  EXPECT_FALSE(Parse("{\"node\":{\"key\":\"/d\",\"dir\":true,\"nodes\":["
+                     "{\"key\":\"/d/a\",\"value\":\"\",\"modifiedIndex\":1,"
+                     "\"createdIndex\":1},{\"key\":")
+                   .ok());
+  EXPECT_EQ(1U, nodes_.size());
+
+  string deep;
+  for (int i = 0; i < 100; ++i) {
+    deep += "[";
+  }
+  EXPECT_FALSE(Parse("{\"x\":" + deep).ok());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -12,6 +12,7 @@
 #include "util/sync_task.h"
 #include "util/testing.h"
 
+DECLARE_int32(etcd_watch_coalesce_ms);
 DECLARE_int32(etcd_watch_error_retry_delay_seconds);
 
 namespace cert_trans {
@@ -205,6 +206,15 @@ void HandleFetch(Status status, int status_code,
 }
 
 
+// An update of kEntryKey to "v<index>", at |index|.
+string SetEventJson(int index) {
+  return "{\"action\":\"set\",\"node\":{\"createdIndex\":" +
+         to_string(index) + ",\"key\":\"" + kEntryKey +
+         "\",\"modifiedIndex\":" + to_string(index) + ",\"value\":\"v" +
+         to_string(index) + "\"}}";
+}
+
+
 class EtcdTest : public ::testing::Test {
  public:
   EtcdTest()
@@ -340,6 +350,64 @@ TEST_F(EtcdTest, GetAll) {
 }
 
 
+TEST_F(EtcdTest, GetDir) {
+  EXPECT_CALL(url_fetcher_,
+              Fetch(IsUrlFetchRequest(UrlFetcher::Verb::GET,
+                                      URL(GetEtcdUrl(kDirKey) +
+                                          "?consistent=true&quorum=true"),
+                                      IsEmpty(), ""),
+                    _, _))
+      .WillOnce(
+          Invoke(bind(HandleFetch, Status::OK, 200,
+                      UrlFetcher::Headers{make_pair("x-etcd-index", "1")},
+                      kGetAllJson, _1, _2, _3)));
+  SyncTask task(base_.get());
+  vector<EtcdClient::Node> nodes;
+  EtcdClient::GetResponse resp;
+  client_.GetDir(string(kDirKey),
+                 [&nodes](const EtcdClient::Node& node) {
+                   nodes.emplace_back(node);
+                 },
+                 &resp, task.task());
+  task.Wait();
+  ASSERT_OK(task);
+  EXPECT_EQ(1, resp.etcd_index);
+  EXPECT_TRUE(resp.node.is_dir_);
+  EXPECT_EQ(2, resp.node.modified_index_);
+  EXPECT_TRUE(resp.node.nodes_.empty());
+  ASSERT_EQ(2, nodes.size());
+  EXPECT_EQ(9, nodes[0].modified_index_);
+  EXPECT_EQ("123", nodes[0].value_);
+  EXPECT_EQ(7, nodes[1].modified_index_);
+  EXPECT_EQ("456", nodes[1].value_);
+}
+
+
+TEST_F(EtcdTest, GetDirForInvalidKey) {
+  EXPECT_CALL(url_fetcher_,
+              Fetch(IsUrlFetchRequest(UrlFetcher::Verb::GET,
+                                      URL(GetEtcdUrl(kDirKey) +
+                                          "?consistent=true&quorum=true"),
+                                      IsEmpty(), ""),
+                    _, _))
+      .WillOnce(
+          Invoke(bind(HandleFetch, Status::OK, 404,
+                      UrlFetcher::Headers{make_pair("x-etcd-index", "17")},
+                      kKeyNotFoundJson, _1, _2, _3)));
+  SyncTask task(base_.get());
+  EtcdClient::GetResponse resp;
+  client_.GetDir(string(kDirKey),
+                 [](const EtcdClient::Node& node) {
+                   ADD_FAILURE() << "unexpected node " << node.ToString();
+                 },
+                 &resp, task.task());
+  task.Wait();
+  EXPECT_THAT(task.status(), StatusIs(util::error::NOT_FOUND,
+                                      AllOf(HasSubstr("Key not found"),
+                                            HasSubstr(string(kDirKey)))));
+}
+
+
 TEST_F(EtcdTest, GetWaitTooOld) {
   const int kOldIndex(42);
   const int kNewIndex(2015);
@@ -695,7 +763,7 @@ TEST_F(EtcdTest, WatchInitialGetFailureCausesRetry) {
     EXPECT_CALL(url_fetcher_,
                 Fetch(IsUrlFetchRequest(UrlFetcher::Verb::GET,
                                         URL(GetEtcdUrl(kEntryKey) +
-                                            "?consistent=true&quorum=true"),
+                                            "?consistent=true&quorum=true&recursive=true"),
                                         IsEmpty(), ""),
                       _, _))
         .WillOnce(
@@ -704,7 +772,7 @@ TEST_F(EtcdTest, WatchInitialGetFailureCausesRetry) {
     EXPECT_CALL(url_fetcher_,
                 Fetch(IsUrlFetchRequest(UrlFetcher::Verb::GET,
                                         URL(GetEtcdUrl(kEntryKey) +
-                                            "?consistent=true&quorum=true"),
+                                            "?consistent=true&quorum=true&recursive=true"),
                                         IsEmpty(), ""),
                       _, _))
         .WillOnce(
@@ -734,7 +802,7 @@ TEST_F(EtcdTest, WatchInitialGetFailureRetriesOnNextEtcd) {
     EXPECT_CALL(url_fetcher_,
                 Fetch(IsUrlFetchRequest(UrlFetcher::Verb::GET,
                                         URL(GetEtcdUrl(kEntryKey) +
-                                            "?consistent=true&quorum=true"),
+                                            "?consistent=true&quorum=true&recursive=true"),
                                         IsEmpty(), ""),
                       _, _))
         .WillOnce(
@@ -745,7 +813,7 @@ TEST_F(EtcdTest, WatchInitialGetFailureRetriesOnNextEtcd) {
         Fetch(IsUrlFetchRequest(UrlFetcher::Verb::GET,
                                 URL(GetEtcdUrl(kEntryKey, kDefaultSpace,
                                                kEtcdHost2, kEtcdPort2) +
-                                    "?consistent=true&quorum=true"),
+                                    "?consistent=true&quorum=true&recursive=true"),
                                 IsEmpty(), ""),
               _, _))
         .WillOnce(
@@ -775,7 +843,7 @@ TEST_F(EtcdTest, WatchHangingGetTimeoutCausesRetry) {
     EXPECT_CALL(url_fetcher_,
                 Fetch(IsUrlFetchRequest(UrlFetcher::Verb::GET,
                                         URL(GetEtcdUrl(kEntryKey) +
-                                            "?consistent=true&quorum=true"),
+                                            "?consistent=true&quorum=true&recursive=true"),
                                         IsEmpty(), ""),
                       _, _))
         .WillOnce(
@@ -825,6 +893,143 @@ TEST_F(EtcdTest, WatchHangingGetTimeoutCausesRetry) {
 }
 
 
+TEST_F(EtcdTest, WatchCoalescesUpdates) {
+  FLAGS_etcd_watch_coalesce_ms = 200;
+  const string kWatchUrl(GetEtcdUrl(kEntryKey) +
+                         "?consistent=true&quorum=false&recursive=true"
+                         "&wait=true&waitIndex=");
+  {
+    InSequence s;
+    EXPECT_CALL(url_fetcher_,
+                Fetch(IsUrlFetchRequest(UrlFetcher::Verb::GET,
+                                        URL(GetEtcdUrl(kEntryKey) +
+                                            "?consistent=true&quorum=true&recursive=true"),
+                                        IsEmpty(), ""),
+                      _, _))
+        .WillOnce(
+            Invoke(bind(HandleFetch, Status::OK, 200,
+                        UrlFetcher::Headers{make_pair("x-etcd-index", "9")},
+                        kGetJson, _1, _2, _3)));
+    for (const int index : {10, 11}) {
+      EXPECT_CALL(url_fetcher_,
+                  Fetch(IsUrlFetchRequest(UrlFetcher::Verb::GET,
+                                          URL(kWatchUrl + to_string(index)),
+                                          IsEmpty(), ""),
+                        _, _))
+          .WillOnce(Invoke(bind(
+              HandleFetch, Status::OK, 200,
+              UrlFetcher::Headers{make_pair("x-etcd-index", to_string(index))},
+              SetEventJson(index), _1, _2, _3)));
+    }
+    // The next one hangs until the watch is cancelled.
+    EXPECT_CALL(url_fetcher_,
+                Fetch(IsUrlFetchRequest(UrlFetcher::Verb::GET,
+                                        URL(kWatchUrl + "12"), IsEmpty(), ""),
+                      _, _))
+        .WillOnce(Invoke([](const UrlFetcher::Request&, UrlFetcher::Response*,
+                            Task* task) {
+          task->WhenCancelled([task]() { task->Return(Status::CANCELLED); });
+        }));
+  }
+
+  SyncTask task(base_.get());
+  int num_calls(0);
+  client_.Watch(kEntryKey,
+                [&task, &num_calls](const vector<EtcdClient::Node>& updates) {
+                  ++num_calls;
+                  ASSERT_EQ(3, updates.size());
+                  EXPECT_EQ("123", updates[0].value_);
+                  EXPECT_EQ("v10", updates[1].value_);
+                  EXPECT_EQ("v11", updates[2].value_);
+                  task.Cancel();
+                },
+                task.task());
+  task.Wait();
+  EXPECT_EQ(1, num_calls);
+  FLAGS_etcd_watch_coalesce_ms = 0;
+}
+
+
+TEST_F(EtcdTest, WatchesSubdirectories) {
+  const string kGetUrl(GetEtcdUrl(kDirKey) +
+                       "?consistent=true&quorum=true&recursive=true");
+  const string kWatchUrl(GetEtcdUrl(kDirKey) +
+                         "?consistent=true&quorum=false&recursive=true"
+                         "&wait=true&waitIndex=");
+  {
+    InSequence s;
+    EXPECT_CALL(url_fetcher_,
+                Fetch(IsUrlFetchRequest(UrlFetcher::Verb::GET, URL(kGetUrl),
+                                        IsEmpty(), ""),
+                      _, _))
+        .WillOnce(Invoke(bind(
+            HandleFetch, Status::OK, 200,
+            UrlFetcher::Headers{make_pair("x-etcd-index", "10")},
+            "{\"action\":\"get\",\"node\":{\"createdIndex\":1,\"dir\":true,"
+            "\"key\":\"/some\",\"modifiedIndex\":1,\"nodes\":["
+            "{\"createdIndex\":2,\"dir\":true,\"key\":\"/some/sub\","
+            "\"modifiedIndex\":2,\"nodes\":[{\"createdIndex\":3,"
+            "\"key\":\"/some/sub/key1\",\"modifiedIndex\":3,"
+            "\"value\":\"1\"}]},"
+            "{\"createdIndex\":4,\"key\":\"/some/key2\","
+            "\"modifiedIndex\":4,\"value\":\"2\"}]}}",
+            _1, _2, _3)));
+    // Deleting the subdirectory has a single event, so everything is
+    // listed again.
+    EXPECT_CALL(url_fetcher_,
+                Fetch(IsUrlFetchRequest(UrlFetcher::Verb::GET,
+                                        URL(kWatchUrl + "11"), IsEmpty(), ""),
+                      _, _))
+        .WillOnce(Invoke(bind(
+            HandleFetch, Status::OK, 200,
+            UrlFetcher::Headers{make_pair("x-etcd-index", "12")},
+            "{\"action\":\"delete\",\"node\":{\"createdIndex\":2,"
+            "\"dir\":true,\"key\":\"/some/sub\",\"modifiedIndex\":12}}",
+            _1, _2, _3)));
+    EXPECT_CALL(url_fetcher_,
+                Fetch(IsUrlFetchRequest(UrlFetcher::Verb::GET, URL(kGetUrl),
+                                        IsEmpty(), ""),
+                      _, _))
+        .WillOnce(Invoke(bind(
+            HandleFetch, Status::OK, 200,
+            UrlFetcher::Headers{make_pair("x-etcd-index", "12")},
+            "{\"action\":\"get\",\"node\":{\"createdIndex\":1,\"dir\":true,"
+            "\"key\":\"/some\",\"modifiedIndex\":1,\"nodes\":["
+            "{\"createdIndex\":4,\"key\":\"/some/key2\","
+            "\"modifiedIndex\":4,\"value\":\"2\"}]}}",
+            _1, _2, _3)));
+    // The next one hangs until the watch is cancelled.
+    EXPECT_CALL(url_fetcher_,
+                Fetch(IsUrlFetchRequest(UrlFetcher::Verb::GET,
+                                        URL(kWatchUrl + "13"), IsEmpty(), ""),
+                      _, _))
+        .WillOnce(Invoke([](const UrlFetcher::Request&, UrlFetcher::Response*,
+                            Task* task) {
+          task->WhenCancelled([task]() { task->Return(Status::CANCELLED); });
+        }));
+  }
+
+  SyncTask task(base_.get());
+  int num_calls(0);
+  client_.Watch(kDirKey,
+                [&task, &num_calls](const vector<EtcdClient::Node>& updates) {
+                  if (num_calls++ == 0) {
+                    ASSERT_EQ(2, updates.size());
+                    EXPECT_EQ("/some/sub/key1", updates[0].key_);
+                    EXPECT_EQ("/some/key2", updates[1].key_);
+                    return;
+                  }
+                  ASSERT_EQ(1, updates.size());
+                  EXPECT_EQ("/some/sub/key1", updates[0].key_);
+                  EXPECT_TRUE(updates[0].deleted_);
+                  task.Cancel();
+                },
+                task.task());
+  task.Wait();
+  EXPECT_EQ(2, num_calls);
+}
+
+
 TEST_F(EtcdTest, UnavailableEtcdRetriesOnNewServer) {
   EtcdClient multi_client(base_.get(), &url_fetcher_,
                           {EtcdClient::HostPortPair(kEtcdHost, kEtcdPort),
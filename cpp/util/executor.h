@@ -3,8 +3,11 @@
 
 #include <chrono>
 #include <functional>
+#include <memory>
+#include <utility>
 
 #include "base/macros.h"
+#include "util/closure.h"
 
 namespace util {
 class Task;
@@ -15,6 +18,18 @@ class Executor {
   virtual ~Executor() = default;
 
   virtual void Add(const std::function<void()>& closure) = 0;
+  // Like the above, but takes ownership of |closure| instead of
+  // copying it (and everything it captured). Executors that queue
+  // closures should override this, the default shares |closure| in a
+  // copyable wrapper.
+  virtual void Add(Closure&& closure) {
+    if (!closure) {
+      return;
+    }
+    const std::shared_ptr<Closure> shared(
+        std::make_shared<Closure>(std::move(closure)));
+    Add(std::function<void()>([shared]() { (*shared)(); }));
+  }
   virtual void Delay(const std::chrono::duration<double>& delay,
                      Task* task) = 0;
 
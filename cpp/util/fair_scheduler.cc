@@ -0,0 +1,188 @@
+#include "util/fair_scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <glog/logging.h>
+#include <utility>
+
+#include "monitoring/latency.h"
+#include "monitoring/monitoring.h"
+
+using std::bind;
+using std::chrono::duration;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::deque;
+using std::function;
+using std::lock_guard;
+using std::mutex;
+using std::pair;
+using std::string;
+using std::unique_lock;
+using std::unique_ptr;
+using std::vector;
+
+namespace cert_trans {
+namespace {
+
+
+static Latency<milliseconds, string> fair_scheduler_queue_latency_ms(
+    "fair_scheduler_queue_latency_ms", "class",
+    "Time spent by closures waiting for their turn, by scheduler class");
+
+
+}  // namespace
+
+
+class FairScheduler::Class : public util::Executor {
+ public:
+  Class(FairScheduler* scheduler, const string& name, int weight,
+        int max_running)
+      : scheduler_(scheduler),
+        name_(name),
+        stride_(1.0 / weight),
+        max_running_(max_running),
+        running_(0),
+        pass_(0) {
+  }
+
+  void Add(const function<void()>& closure) override;
+
+  void Delay(const duration<double>& delay, util::Task* task) override {
+    scheduler_->executor_->Delay(delay, task);
+  }
+
+  FairScheduler* const scheduler_;
+  const string name_;
+  // How far the class moves in virtual time with each turn.
+  const double stride_;
+  const int max_running_;
+
+  // These are guarded by the |lock_| of the scheduler.
+  int running_;
+  // The virtual time of the next turn of this class, the lowest going
+  // first.
+  double pass_;
+  deque<pair<steady_clock::time_point, function<void()>>> waiting_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(Class);
+};
+
+
+void FairScheduler::Class::Add(const function<void()>& closure) {
+  if (!closure) {
+    return;
+  }
+
+  vector<function<void()>> to_run;
+  {
+    lock_guard<mutex> lock(scheduler_->lock_);
+    CHECK(!scheduler_->stopping_);
+    if (waiting_.empty()) {
+      pass_ = std::max(pass_, scheduler_->pass_);
+    }
+    waiting_.emplace_back(steady_clock::now(), closure);
+    to_run = scheduler_->PickLocked();
+  }
+
+  for (const auto& next : to_run) {
+    scheduler_->executor_->Add(next);
+  }
+}
+
+
+FairScheduler::FairScheduler(util::Executor* executor, int max_running)
+    : executor_(CHECK_NOTNULL(executor)),
+      max_running_(max_running),
+      running_(0),
+      stopping_(false),
+      pass_(0) {
+  CHECK_GT(max_running_, 0);
+}
+
+
+FairScheduler::~FairScheduler() {
+  unique_lock<mutex> lock(lock_);
+  stopping_ = true;
+  idle_.wait(lock, [this]() {
+    if (running_ > 0) {
+      return false;
+    }
+    for (const auto& queue : classes_) {
+      if (!queue->waiting_.empty()) {
+        return false;
+      }
+    }
+    return true;
+  });
+}
+
+
+util::Executor* FairScheduler::AddClass(const string& name, int weight,
+                                        int max_running) {
+  CHECK_GT(weight, 0);
+  CHECK_GE(max_running, 0);
+  lock_guard<mutex> lock(lock_);
+  classes_.emplace_back(
+      new Class(this, name, weight,
+                max_running > 0 ? std::min(max_running, max_running_)
+                                : max_running_));
+  return classes_.back().get();
+}
+
+
+vector<function<void()>> FairScheduler::PickLocked() {
+  vector<function<void()>> to_run;
+  while (running_ < max_running_) {
+    Class* next(nullptr);
+    for (const auto& queue : classes_) {
+      if (!queue->waiting_.empty() &&
+          queue->running_ < queue->max_running_ &&
+          (!next || queue->pass_ < next->pass_)) {
+        next = queue.get();
+      }
+    }
+    if (!next) {
+      break;
+    }
+
+    pass_ = next->pass_;
+    next->pass_ += next->stride_;
+    ++next->running_;
+    ++running_;
+
+    fair_scheduler_queue_latency_ms.RecordLatency(
+        next->name_, steady_clock::now() - next->waiting_.front().first);
+    to_run.emplace_back(
+        bind(&FairScheduler::Run, this, next, next->waiting_.front().second));
+    next->waiting_.pop_front();
+  }
+
+  return to_run;
+}
+
+
+void FairScheduler::Run(Class* queue, const function<void()>& closure) {
+  closure();
+
+  vector<function<void()>> to_run;
+  {
+    lock_guard<mutex> lock(lock_);
+    --queue->running_;
+    --running_;
+    to_run = PickLocked();
+    // Nothing else can be waiting when there's nothing to run.
+    if (stopping_ && running_ == 0) {
+      idle_.notify_all();
+    }
+  }
+
+  for (const auto& next : to_run) {
+    executor_->Add(next);
+  }
+}
+
+
+}  // namespace cert_trans
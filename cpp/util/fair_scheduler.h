@@ -0,0 +1,72 @@
+#ifndef CERT_TRANS_UTIL_FAIR_SCHEDULER_H_
+#define CERT_TRANS_UTIL_FAIR_SCHEDULER_H_
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "util/executor.h"
+
+namespace cert_trans {
+
+
+// Shares an executor, like a ThreadPool, between classes of closures,
+// each with its own queue. Only as many closures as the executor has
+// threads are handed to it at a time, so that it's the scheduler that
+// picks which one runs next: the classes get turns in proportion to
+// their weight, among those that have closures waiting, and each can
+// have a limit on how many of its closures run at once.
+//
+// The time the closures wait for their turn is reported by class, in
+// the "fair_scheduler_queue_latency_ms" metric.
+class FairScheduler {
+ public:
+  // Does not take ownership of |executor|, which must outlive this
+  // instance, and should be able to run |max_running| closures at
+  // once.
+  FairScheduler(util::Executor* executor, int max_running);
+
+  // Waits for all the closures to have run. Nothing can be added to
+  // the classes once this has started.
+  ~FairScheduler();
+
+  // Returns the executor for a new class named |name|, which belongs
+  // to the scheduler. A class of weight 2 gets two turns for each of a
+  // class of weight 1, when both have closures waiting. At most
+  // |max_running| of its closures run at once, or up to the limit of
+  // the scheduler if that is zero. Delay() is passed on to |executor|
+  // as is.
+  util::Executor* AddClass(const std::string& name, int weight,
+                           int max_running);
+
+ private:
+  class Class;
+
+  // Picks the closures to run next, if there is room for them, and
+  // returns them, to be handed to |executor_| without holding |lock_|.
+  std::vector<std::function<void()>> PickLocked();
+  void Run(Class* queue, const std::function<void()>& closure);
+
+  util::Executor* const executor_;
+  const int max_running_;
+
+  std::mutex lock_;
+  std::condition_variable idle_;
+  std::vector<std::unique_ptr<Class>> classes_;
+  int running_;
+  bool stopping_;
+  // The virtual time of the last turn, from which the classes that
+  // were idle resume, so they can't save up turns while they are.
+  double pass_;
+
+  DISALLOW_COPY_AND_ASSIGN(FairScheduler);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_UTIL_FAIR_SCHEDULER_H_
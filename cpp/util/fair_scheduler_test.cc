@@ -0,0 +1,116 @@
+#include "util/fair_scheduler.h"
+
+#include <atomic>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "base/notification.h"
+#include "util/testing.h"
+#include "util/thread_pool.h"
+
+namespace cert_trans {
+namespace {
+
+using std::atomic;
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::unique_ptr;
+
+
+TEST(FairSchedulerTest, SharesTurnsByWeight) {
+  ThreadPool pool(1);
+  mutex lock;
+  string order;
+  {
+    FairScheduler scheduler(&pool, 1);
+    util::Executor* const heavy(scheduler.AddClass("heavy", 2, 0));
+    util::Executor* const light(scheduler.AddClass("light", 1, 0));
+    util::Executor* const blocker(scheduler.AddClass("blocker", 1, 0));
+
+    // Hold the only thread, so that everything else queues up.
+    Notification started, release;
+    blocker->Add([&started, &release]() {
+      started.Notify();
+      release.WaitForNotification();
+    });
+    started.WaitForNotification();
+
+    for (int i = 0; i < 3; ++i) {
+      for (const auto& added :
+           {std::make_pair(heavy, 'h'), std::make_pair(light, 'l')}) {
+        const char name(added.second);
+        added.first->Add([&lock, &order, name]() {
+          lock_guard<mutex> order_lock(lock);
+          order.push_back(name);
+        });
+      }
+    }
+    release.Notify();
+  }
+
+  // The heavy class gets two turns for each of the light one, until
+  // it runs out of closures.
+  EXPECT_EQ("hlhhll", order);
+}
+
+
+TEST(FairSchedulerTest, LimitsRunningClosuresOfAClass) {
+  ThreadPool pool(4);
+  unique_ptr<FairScheduler> scheduler(new FairScheduler(&pool, 4));
+  util::Executor* const limited(scheduler->AddClass("limited", 1, 2));
+  util::Executor* const other(scheduler->AddClass("other", 1, 0));
+
+  atomic<int> running(0);
+  atomic<int> max_running(0);
+  Notification release;
+  for (int i = 0; i < 4; ++i) {
+    limited->Add([&running, &max_running, &release]() {
+      const int now(++running);
+      int max(max_running.load());
+      while (now > max && !max_running.compare_exchange_weak(max, now)) {
+      }
+      release.WaitForNotification();
+      --running;
+    });
+  }
+
+  // The other class still gets the threads the limited one can't use.
+  Notification other_done;
+  other->Add([&other_done]() { other_done.Notify(); });
+  other_done.WaitForNotification();
+  while (running.load() < 2) {
+  }
+
+  release.Notify();
+  scheduler.reset();
+  EXPECT_EQ(0, running.load());
+  EXPECT_EQ(2, max_running.load());
+}
+
+
+TEST(FairSchedulerTest, DestructorWaitsForQueuedClosures) {
+  ThreadPool pool(1);
+  atomic<int> done(0);
+  unique_ptr<FairScheduler> scheduler(new FairScheduler(&pool, 1));
+  util::Executor* const executor(scheduler->AddClass("class", 1, 0));
+  for (int i = 0; i < 10; ++i) {
+    executor->Add([&done]() { ++done; });
+  }
+
+  scheduler.reset();
+  EXPECT_EQ(10, done.load());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
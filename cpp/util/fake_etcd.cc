@@ -1,10 +1,12 @@
 #include "util/fake_etcd.h"
 
 #include <glog/logging.h>
+#include <iterator>
 
 #include "util/json_wrapper.h"
 
 using std::bind;
+using std::chrono::duration;
 using std::chrono::seconds;
 using std::chrono::system_clock;
 using std::function;
@@ -96,7 +98,10 @@ const char* kStoreStats[] = {"setsFail", "getsSuccess", "watchers",
 
 
 FakeEtcdClient::FakeEtcdClient(libevent::Base* base)
-    : base_(CHECK_NOTNULL(base)), parent_task_(base_), index_(1) {
+    : base_(CHECK_NOTNULL(base)),
+      parent_task_(base_),
+      latency_(0),
+      index_(1) {
   for (const auto& s : kStoreStats) {
     stats_[s] = 0;
   }
@@ -110,8 +115,30 @@ FakeEtcdClient::~FakeEtcdClient() {
 }
 
 
+void FakeEtcdClient::SetLatency(const duration<double>& latency) {
+  latency_ = latency;
+}
+
+
+Task* FakeEtcdClient::WithLatency(Task* task) {
+  if (latency_ <= duration<double>::zero()) {
+    return task;
+  }
+  return task->AddChild([this, task](Task* child) {
+    const Status status(child->status());
+    base_->Delay(latency_,
+                 task->AddChild([task, status](Task*) {
+                   task->Return(status);
+                 }));
+  });
+}
+
+
 void FakeEtcdClient::DumpEntries(const unique_lock<mutex>& lock) const {
   CHECK(lock.owns_lock());
+  if (!VLOG_IS_ON(1)) {
+    return;
+  }
   for (const auto& pair : entries_) {
     VLOG(1) << pair.second.ToString();
   }
@@ -131,14 +158,17 @@ void FakeEtcdClient::Watch(const string& rawkey, const WatchCallback& cb,
                  it->first.compare(0, key_prefix.size(), key_prefix) == 0;
            ++it) {
         CHECK(!it->second.deleted_);
-        initial_updates.emplace_back(it->second);
+        // As with etcd, only the keys of the subdirectories are watched.
+        if (!it->second.is_dir_) {
+          initial_updates.emplace_back(it->second);
+        }
       }
     } else {
       CHECK(!it->second.deleted_);
       initial_updates.emplace_back(it->second);
     }
   }
-  ScheduleWatchCallback(lock, task, bind(cb, move(initial_updates)));
+  ScheduleWatchCallback(lock, task, cb, move(initial_updates), false);
   watches_[key].push_back(make_pair(cb, task));
   task->WhenCancelled(bind(&FakeEtcdClient::CancelWatch, this, task));
   ++stats_["watchers"];
@@ -148,16 +178,18 @@ void FakeEtcdClient::Watch(const string& rawkey, const WatchCallback& cb,
 void FakeEtcdClient::PurgeExpiredEntriesWithLock(
     const unique_lock<mutex>& lock) {
   CHECK(lock.owns_lock());
-  for (auto it = entries_.begin(); it != entries_.end();) {
-    if (it->second.expires_ < system_clock::now()) {
+  const system_clock::time_point now(system_clock::now());
+  while (!expiries_.empty() && expiries_.begin()->first < now) {
+    const auto expiry(expiries_.begin());
+    const map<string, Node>::iterator it(entries_.find(expiry->second));
+    if (it != entries_.end() && it->second.expires_ == expiry->first) {
       VLOG(1) << "Deleting expired entry " << it->first;
       it->second.deleted_ = true;
       NotifyForPath(lock, it->first);
-      it = entries_.erase(it);
+      entries_.erase(it);
       ++stats_["expireCount"];
-    } else {
-      ++it;
     }
+    expiries_.erase(expiry);
   }
 }
 
@@ -192,8 +224,8 @@ void FakeEtcdClient::NotifyForPath(const unique_lock<mutex>& lock,
   for (const auto& pair : watches_) {
     if (path.find(pair.first) == 0) {
       for (const auto& cb_cookie : pair.second) {
-        ScheduleWatchCallback(lock, cb_cookie.second,
-                              bind(cb_cookie.first, vector<Node>{node}));
+        ScheduleWatchCallback(lock, cb_cookie.second, cb_cookie.first,
+                              vector<Node>{node}, true);
       }
     }
   }
@@ -206,6 +238,7 @@ void FakeEtcdClient::Get(const Request& req, GetResponse* resp, Task* task) {
 
   CHECK_NE(key, "/") << "not implemented";
 
+  task = WithLatency(task);
   task->CleanupWhenDone(
       bind(&FakeEtcdClient::UpdateOperationStats, this, "gets", task));
 
@@ -264,6 +297,31 @@ void FakeEtcdClient::Get(const Request& req, GetResponse* resp, Task* task) {
 }
 
 
+void FakeEtcdClient::GetDir(const Request& req, const NodeCallback& cb,
+                            GetResponse* resp, Task* task) {
+  CHECK_EQ(0, req.wait_index) << "GetDir() does not wait";
+  // Everything is in memory already, so there is nothing to gain from
+  // streaming: list the directory, then hand its nodes over.
+  GetResponse* const dir_resp(new GetResponse);
+  task->DeleteWhenDone(dir_resp);
+  Get(req, dir_resp,
+      task->AddChild([cb, resp, dir_resp, task](Task* child_task) {
+        *resp = GetResponse();
+        resp->etcd_index = dir_resp->etcd_index;
+        if (!child_task->status().ok()) {
+          task->Return(child_task->status());
+          return;
+        }
+        for (const auto& node : dir_resp->node.nodes_) {
+          cb(node);
+        }
+        resp->node = move(dir_resp->node);
+        resp->node.nodes_.clear();
+        task->Return();
+      }));
+}
+
+
 void FakeEtcdClient::InternalPut(const string& rawkey, const string& value,
                                  const system_clock::time_point& expires,
                                  bool create, int64_t prev_index,
@@ -284,6 +342,7 @@ void FakeEtcdClient::InternalPut(const string& rawkey, const string& value,
   }
 
   *resp = EtcdClient::Response();
+  task = WithLatency(task);
   unique_lock<mutex> lock(mutex_);
   PurgeExpiredEntriesWithLock(lock);
   const int64_t new_index(index_ + 1);
@@ -334,6 +393,9 @@ void FakeEtcdClient::InternalPut(const string& rawkey, const string& value,
   }
 
   entries_[key] = node;
+  if (expires < system_clock::time_point::max()) {
+    expiries_.emplace(expires, key);
+  }
   resp->etcd_index = new_index;
   index_ = new_index;
   task->Return();
@@ -356,6 +418,7 @@ void FakeEtcdClient::InternalDelete(const string& key,
 
   const string op_name(current_index > 0 ? "compareAndDelete" : "delete");
 
+  task = WithLatency(task);
   unique_lock<mutex> lock(mutex_);
   PurgeExpiredEntriesWithLock(lock);
   const map<string, Node>::iterator entry(entries_.find(key));
@@ -462,6 +525,38 @@ void FakeEtcdClient::ForceDelete(const string& key, Task* task) {
 }
 
 
+void FakeEtcdClient::ForceDeleteDir(const string& key, Task* task) {
+  VLOG(1) << "DELETE (recursive) " << key;
+  CHECK(!key.empty());
+  CHECK_EQ(key.front(), '/');
+  CHECK_NE(key.back(), '/');
+  const string prefix(key + "/");
+
+  task = WithLatency(task);
+  unique_lock<mutex> lock(mutex_);
+  PurgeExpiredEntriesWithLock(lock);
+  map<string, Node>::iterator entry(entries_.lower_bound(prefix));
+  if (entry == entries_.end() || entry->first.compare(0, prefix.size(),
+                                                      prefix) != 0) {
+    ++stats_["deleteFail"];
+    task->Return(Status(util::error::NOT_FOUND, "Node doesn't exist: " + key));
+    return;
+  }
+  // Directories are implicit here, so this deletes (and notifies the
+  // watchers of) each of the entries under it in turn.
+  while (entry != entries_.end() &&
+         entry->first.compare(0, prefix.size(), prefix) == 0) {
+    entry->second.modified_index_ = ++index_;
+    entry->second.value_.clear();
+    entry->second.deleted_ = true;
+    NotifyForPath(lock, entry->first);
+    entry = entries_.erase(entry);
+  }
+  ++stats_["deleteSuccess"];
+  task->Return();
+}
+
+
 void FakeEtcdClient::GetStoreStats(StatsResponse* resp, Task* task) {
   CHECK_NOTNULL(resp);
   CHECK_NOTNULL(task);
@@ -508,44 +603,57 @@ void FakeEtcdClient::CancelWaitingGet(const string& key, Task* task) {
 }
 
 
-void FakeEtcdClient::ScheduleWatchCallback(
-    const unique_lock<mutex>& lock, Task* task,
-    const std::function<void()>& callback) {
+void FakeEtcdClient::ScheduleWatchCallback(const unique_lock<mutex>& lock,
+                                           Task* task,
+                                           const WatchCallback& callback,
+                                           vector<Node> updates,
+                                           bool notification) {
   CHECK(lock.owns_lock());
   const bool already_running(!watches_callbacks_.empty());
 
+  // The callback at the front is taken out before it runs, so this one
+  // hasn't started yet.
+  if (notification && already_running &&
+      watches_callbacks_.back().task == task &&
+      watches_callbacks_.back().notification) {
+    vector<Node>* const pending(&watches_callbacks_.back().updates);
+    pending->insert(pending->end(),
+                    std::make_move_iterator(updates.begin()),
+                    std::make_move_iterator(updates.end()));
+    return;
+  }
+
   task->AddHold();
-  watches_callbacks_.emplace_back(make_pair(task, move(callback)));
+  watches_callbacks_.emplace_back(
+      PendingWatchCallback{task, callback, move(updates), notification});
 
   // TODO(pphaneuf): This might fare poorly if the executor is
   // synchronous.
   if (!already_running) {
-    watches_callbacks_.front().first->executor()->Add(
+    watches_callbacks_.front().task->executor()->Add(
         bind(&FakeEtcdClient::RunWatchCallback, this));
   }
 }
 
 
 void FakeEtcdClient::RunWatchCallback() {
-  Task* current(nullptr);
   Task* next(nullptr);
-  function<void()> callback;
+  PendingWatchCallback current;
 
   {
     lock_guard<mutex> lock(mutex_);
 
     CHECK(!watches_callbacks_.empty());
-    current = move(watches_callbacks_.front().first);
-    callback = move(watches_callbacks_.front().second);
+    current = move(watches_callbacks_.front());
     watches_callbacks_.pop_front();
 
     if (!watches_callbacks_.empty()) {
-      next = CHECK_NOTNULL(watches_callbacks_.front().first);
+      next = CHECK_NOTNULL(watches_callbacks_.front().task);
     }
   }
 
-  callback();
-  current->RemoveHold();
+  current.callback(current.updates);
+  current.task->RemoveHold();
 
   // If we have a next executor, schedule ourselves on it.
   if (next) {
@@ -1,6 +1,7 @@
 #ifndef CERT_TRANS_UTIL_FAKE_ETCD_H_
 #define CERT_TRANS_UTIL_FAKE_ETCD_H_
 
+#include <chrono>
 #include <deque>
 #include <map>
 #include <queue>
@@ -16,14 +17,27 @@
 namespace cert_trans {
 
 
+// An in-memory etcd, for tests and for simulations with many keys:
+// entries with a TTL are kept in order of expiry, so that purging them
+// doesn't go through all the entries, and the notifications for a
+// watch that pile up while its callback is busy are passed on
+// together.
 class FakeEtcdClient : public EtcdClient {
  public:
   explicit FakeEtcdClient(libevent::Base* base);
 
   virtual ~FakeEtcdClient();
 
+  // Delays the reply to each request (but not the watch notifications)
+  // by |latency|, as a round trip to a real etcd would. Must be called
+  // before any request is made.
+  void SetLatency(const std::chrono::duration<double>& latency);
+
   void Get(const Request& req, GetResponse* resp, util::Task* task) override;
 
+  void GetDir(const Request& req, const NodeCallback& cb, GetResponse* resp,
+              util::Task* task) override;
+
   void Create(const std::string& key, const std::string& value, Response* resp,
               util::Task* task) override;
 
@@ -52,6 +66,8 @@ class FakeEtcdClient : public EtcdClient {
 
   void ForceDelete(const std::string& key, util::Task* task) override;
 
+  void ForceDeleteDir(const std::string& key, util::Task* task) override;
+
   void GetStoreStats(StatsResponse* resp, util::Task* task) override;
 
   // The callbacks for *all* watches will be called one at a time, in
@@ -79,26 +95,44 @@ class FakeEtcdClient : public EtcdClient {
 
   void UpdateOperationStats(const std::string& op, const util::Task* task);
 
+  // Returns a task to pass on to the implementation of a request made
+  // with |task|, which returns it after |latency_|.
+  util::Task* WithLatency(util::Task* task);
+
   void CancelWatch(util::Task* task);
   void CancelWaitingGet(const std::string& key, util::Task* task);
 
   // Arranges for the watch callbacks to be called in order. Should be
-  // called with mutex_ held.
+  // called with mutex_ held. If the last callback waiting to run is
+  // for the same watch, and is a notification too (rather than the
+  // initial state), |updates| are added to it instead.
   void ScheduleWatchCallback(const std::unique_lock<std::mutex>& lock,
-                             util::Task* task,
-                             const std::function<void()>& callback);
+                             util::Task* task, const WatchCallback& callback,
+                             std::vector<Node> updates, bool notification);
   void RunWatchCallback();
 
+  struct PendingWatchCallback {
+    util::Task* task;
+    WatchCallback callback;
+    std::vector<Node> updates;
+    bool notification;
+  };
+
   libevent::Base* const base_;
   util::SyncTask parent_task_;
+  std::chrono::duration<double> latency_;
   std::mutex mutex_;
   int64_t index_;
   std::map<std::string, Node> entries_;
+  // The keys of the entries with a TTL, by expiry. Entries deleted or
+  // set again since are left behind, and skipped when they expire.
+  std::multimap<std::chrono::system_clock::time_point, std::string>
+      expiries_;
   std::multimap<std::string, std::tuple<bool, GetResponse*, util::Task*>>
       waiting_gets_;
   std::map<std::string, std::vector<std::pair<WatchCallback, util::Task*>>>
       watches_;
-  std::deque<std::pair<util::Task*, std::function<void()>>> watches_callbacks_;
+  std::deque<PendingWatchCallback> watches_callbacks_;
   std::map<std::string, int64_t> stats_;
 
   friend class ElectionTest;
@@ -32,6 +32,7 @@ using std::deque;
 using std::function;
 using std::lock_guard;
 using std::map;
+using std::move;
 using std::mutex;
 using std::placeholders::_1;
 using std::placeholders::_2;
@@ -486,6 +487,69 @@ TEST_F(FakeEtcdTest, Delete) {
 }
 
 
+TEST_F(FakeEtcdTest, Batch) {
+  int64_t update_index;
+  EXPECT_OK(BlockingCreate(key_prefix_ + "/update", kValue, &update_index));
+  int64_t delete_index;
+  EXPECT_OK(BlockingCreate(key_prefix_ + "/delete", kValue, &delete_index));
+
+  vector<EtcdClient::WriteOp> ops;
+  ops.emplace_back(EtcdClient::WriteOp::CREATE, key_prefix_ + "/create",
+                   kValue, 0);
+  ops.emplace_back(EtcdClient::WriteOp::UPDATE, key_prefix_ + "/update",
+                   kValue2, update_index);
+  ops.emplace_back(EtcdClient::WriteOp::FORCE_SET, key_prefix_ + "/set",
+                   kValue, 0);
+  ops.emplace_back(EtcdClient::WriteOp::DELETE, key_prefix_ + "/delete", "",
+                   delete_index);
+  ops.emplace_back(EtcdClient::WriteOp::FORCE_DELETE,
+                   key_prefix_ + "/missing", "", 0);
+  SyncTask task(base_.get());
+  EtcdClient::BatchResponse resp;
+  client_->Batch(move(ops), 2, &resp, task.task());
+  task.Wait();
+  EXPECT_OK(task.status());
+  ASSERT_EQ(5U, resp.statuses.size());
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_OK(resp.statuses[i]) << i;
+  }
+  EXPECT_THAT(resp.statuses[4], StatusIs(util::error::NOT_FOUND));
+
+  EtcdClient::Node node;
+  EXPECT_OK(BlockingGet(key_prefix_ + "/create", &node));
+  EXPECT_EQ(kValue, node.value_);
+  EXPECT_EQ(resp.responses[0].etcd_index, node.modified_index_);
+  EXPECT_OK(BlockingGet(key_prefix_ + "/update", &node));
+  EXPECT_EQ(kValue2, node.value_);
+  EXPECT_OK(BlockingGet(key_prefix_ + "/set", &node));
+  EXPECT_THAT(BlockingGet(key_prefix_ + "/delete", &node),
+              StatusIs(util::error::NOT_FOUND));
+}
+
+
+TEST_F(FakeEtcdTest, BatchStopsAtFirstError) {
+  int64_t created_index;
+  EXPECT_OK(BlockingCreate(key_prefix_ + "/exists", kValue, &created_index));
+
+  vector<EtcdClient::WriteOp> ops;
+  ops.emplace_back(EtcdClient::WriteOp::CREATE, key_prefix_ + "/exists",
+                   kValue, 0);
+  ops.emplace_back(EtcdClient::WriteOp::CREATE, key_prefix_ + "/new", kValue,
+                   0);
+  SyncTask task(base_.get());
+  EtcdClient::BatchResponse resp;
+  client_->Batch(move(ops), 1, &resp, task.task());
+  task.Wait();
+  EXPECT_THAT(task.status(), StatusIs(util::error::FAILED_PRECONDITION));
+  EXPECT_THAT(resp.statuses[0], StatusIs(util::error::FAILED_PRECONDITION));
+  EXPECT_THAT(resp.statuses[1], StatusIs(util::error::ABORTED));
+
+  EtcdClient::Node node;
+  EXPECT_THAT(BlockingGet(key_prefix_ + "/new", &node),
+              StatusIs(util::error::NOT_FOUND));
+}
+
+
 class CheckingExecutor : public util::Executor {
  public:
   CheckingExecutor() : inner_(1), in_executor_(false) {
@@ -682,6 +746,72 @@ TEST_F(FakeEtcdTest, WatcherWithTTLExpires) {
 }
 
 
+// Specific to FakeEtcdClient, whatever --etcd is.
+TEST_F(FakeEtcdTest, WatcherGetsPiledUpUpdatesTogether) {
+  FakeEtcdClient fake(base_.get());
+  const string kDir(key_prefix_);
+  const auto create([this, &fake](const string& key) {
+    SyncTask task(base_.get());
+    EtcdClient::Response resp;
+    fake.Create(key, kValue, &resp, task.task());
+    task.Wait();
+    return task.status();
+  });
+
+  mutex lock;
+  vector<vector<EtcdClient::Node>> calls;
+  Notification initial;
+  Notification blocked;
+  Notification release;
+  Notification done;
+  util::SyncTask watch_task(&pool_);
+  fake.Watch(kDir,
+             [&](const vector<EtcdClient::Node>& updates) {
+               size_t num_calls;
+               {
+                 lock_guard<mutex> guard(lock);
+                 calls.push_back(updates);
+                 num_calls = calls.size();
+               }
+               if (num_calls == 1) {
+                 initial.Notify();
+               } else if (num_calls == 2) {
+                 blocked.Notify();
+                 release.WaitForNotification();
+               } else {
+                 done.Notify();
+               }
+             },
+             watch_task.task());
+  ASSERT_TRUE(initial.WaitForNotificationWithTimeout(seconds(1)));
+
+  EXPECT_OK(create(kDir + "/1"));
+  ASSERT_TRUE(blocked.WaitForNotificationWithTimeout(seconds(1)));
+  // These wait for the callback to be done with the first one.
+  EXPECT_OK(create(kDir + "/2"));
+  EXPECT_OK(create(kDir + "/3"));
+  EXPECT_OK(create(kDir + "/4"));
+  release.Notify();
+  ASSERT_TRUE(done.WaitForNotificationWithTimeout(seconds(1)));
+
+  {
+    lock_guard<mutex> guard(lock);
+    ASSERT_EQ(3U, calls.size());
+    EXPECT_TRUE(calls[0].empty());
+    EXPECT_THAT(calls[1], ElementsAre(EtcdClientNodeIs(kDir + "/1", kValue,
+                                                       false)));
+    EXPECT_THAT(calls[2],
+                ElementsAre(EtcdClientNodeIs(kDir + "/2", kValue, false),
+                            EtcdClientNodeIs(kDir + "/3", kValue, false),
+                            EtcdClientNodeIs(kDir + "/4", kValue, false)));
+  }
+
+  watch_task.Cancel();
+  watch_task.Wait();
+  EXPECT_THAT(watch_task.status(), StatusIs(util::error::CANCELLED));
+}
+
+
 TEST_F(FakeEtcdTest, PutUnderNonDir) {
   const string kPath1(key_prefix_);
   const string kPath2(kPath1 + "/subkey");
@@ -0,0 +1,166 @@
+#include "util/gzip.h"
+
+#include <event2/buffer.h>
+#include <glog/logging.h>
+#include <vector>
+#include <zlib.h>
+
+using std::string;
+using std::vector;
+
+namespace util {
+namespace {
+
+// Adding 16 to the window bits makes zlib write a gzip header and
+// trailer, rather than a zlib one.
+const int kGzipWindowBits = 15 + 16;
+const int kMemLevel = 8;
+// How much output space is reserved at a time, when streaming.
+const size_t kStreamOutputBytes = 16 << 10;
+
+
+void InitGzip(z_stream* stream) {
+  stream->zalloc = Z_NULL;
+  stream->zfree = Z_NULL;
+  stream->opaque = Z_NULL;
+  stream->next_in = Z_NULL;
+  stream->avail_in = 0;
+  CHECK_EQ(Z_OK, deflateInit2(stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                              kGzipWindowBits, kMemLevel, Z_DEFAULT_STRATEGY));
+}
+
+
+// Compresses the |num_pieces| pieces of |pieces|, one after the other.
+string GzipPieces(const evbuffer_iovec* pieces, size_t num_pieces) {
+  z_stream stream;
+  InitGzip(&stream);
+
+  size_t total_length(0);
+  for (size_t i = 0; i < num_pieces; ++i) {
+    total_length += pieces[i].iov_len;
+  }
+  string result;
+  // Enough for it never to run out of space.
+  result.resize(deflateBound(&stream, total_length));
+  stream.next_out = reinterpret_cast<Bytef*>(&result[0]);
+  stream.avail_out = result.size();
+  for (size_t i = 0; i < num_pieces; ++i) {
+    if (pieces[i].iov_len == 0) {
+      // zlib would complain that it can't make progress.
+      continue;
+    }
+    stream.next_in = static_cast<Bytef*>(pieces[i].iov_base);
+    stream.avail_in = pieces[i].iov_len;
+    CHECK_EQ(Z_OK, deflate(&stream, Z_NO_FLUSH));
+    CHECK_EQ(0U, stream.avail_in);
+  }
+  CHECK_EQ(Z_STREAM_END, deflate(&stream, Z_FINISH));
+  result.resize(stream.total_out);
+  CHECK_EQ(Z_OK, deflateEnd(&stream));
+
+  return result;
+}
+
+
+}  // namespace
+
+
+string Gzip(const string& data) {
+  evbuffer_iovec piece;
+  // zlib doesn't modify the input, it just isn't const-correct.
+  piece.iov_base = const_cast<char*>(data.data());
+  piece.iov_len = data.size();
+  return GzipPieces(&piece, 1);
+}
+
+
+string Gzip(evbuffer* data) {
+  const int num_pieces(evbuffer_peek(data, -1, nullptr, nullptr, 0));
+  CHECK_GE(num_pieces, 0);
+  vector<evbuffer_iovec> pieces(num_pieces);
+  CHECK_EQ(num_pieces,
+           evbuffer_peek(data, -1, nullptr, pieces.data(), num_pieces));
+  return GzipPieces(pieces.data(), pieces.size());
+}
+
+
+bool Gunzip(const string& data, string* out) {
+  z_stream stream;
+  stream.zalloc = Z_NULL;
+  stream.zfree = Z_NULL;
+  stream.opaque = Z_NULL;
+  stream.next_in = Z_NULL;
+  stream.avail_in = 0;
+  // Only accept gzip, not zlib.
+  CHECK_EQ(Z_OK, inflateInit2(&stream, kGzipWindowBits));
+  // zlib doesn't modify the input, it just isn't const-correct.
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = data.size();
+
+  out->clear();
+  int ret(Z_OK);
+  while (ret == Z_OK) {
+    char buffer[kStreamOutputBytes];
+    stream.next_out = reinterpret_cast<Bytef*>(buffer);
+    stream.avail_out = sizeof(buffer);
+    ret = inflate(&stream, Z_NO_FLUSH);
+    out->append(buffer, sizeof(buffer) - stream.avail_out);
+  }
+  CHECK_EQ(Z_OK, inflateEnd(&stream));
+
+  return ret == Z_STREAM_END && stream.avail_in == 0;
+}
+
+
+GzipStream::GzipStream() : stream_(new z_stream) {
+  InitGzip(stream_.get());
+}
+
+
+GzipStream::~GzipStream() {
+  // This returns Z_DATA_ERROR if the stream wasn't finished, which is
+  // fine.
+  deflateEnd(stream_.get());
+}
+
+
+void GzipStream::Compress(evbuffer* in, bool finish, evbuffer* out) {
+  const int num_pieces(evbuffer_peek(in, -1, nullptr, nullptr, 0));
+  CHECK_GE(num_pieces, 0);
+  vector<evbuffer_iovec> pieces(num_pieces);
+  CHECK_EQ(num_pieces,
+           evbuffer_peek(in, -1, nullptr, pieces.data(), num_pieces));
+  for (const auto& piece : pieces) {
+    if (piece.iov_len == 0) {
+      continue;
+    }
+    stream_->next_in = static_cast<Bytef*>(piece.iov_base);
+    stream_->avail_in = piece.iov_len;
+    Deflate(Z_NO_FLUSH, out);
+    CHECK_EQ(0U, stream_->avail_in);
+  }
+  CHECK_EQ(0, evbuffer_drain(in, evbuffer_get_length(in)));
+
+  Deflate(finish ? Z_FINISH : Z_SYNC_FLUSH, out);
+}
+
+
+void GzipStream::Deflate(int flush, evbuffer* out) {
+  // When zlib leaves some of the output space unused, it has written
+  // all it could.
+  do {
+    evbuffer_iovec extent;
+    CHECK_EQ(1,
+             evbuffer_reserve_space(out, kStreamOutputBytes, &extent, 1));
+    stream_->next_out = static_cast<Bytef*>(extent.iov_base);
+    stream_->avail_out = extent.iov_len;
+    const int ret(deflate(stream_.get(), flush));
+    // Z_BUF_ERROR just means that there was nothing to do.
+    CHECK(ret == Z_OK || ret == Z_STREAM_END || ret == Z_BUF_ERROR) << ret;
+    extent.iov_len -= stream_->avail_out;
+    CHECK_EQ(0, evbuffer_commit_space(out, &extent, 1));
+  } while (stream_->avail_out == 0);
+}
+
+
+}  // namespace util
@@ -0,0 +1,48 @@
+#ifndef CERT_TRANS_UTIL_GZIP_H_
+#define CERT_TRANS_UTIL_GZIP_H_
+
+#include <memory>
+#include <string>
+
+#include "base/macros.h"
+
+struct evbuffer;
+struct z_stream_s;
+
+namespace util {
+
+// Returns |data| compressed in the gzip format (RFC 1952), as used
+// for "Content-Encoding: gzip".
+std::string Gzip(const std::string& data);
+
+// Same, for the contents of |data|, which is left untouched.
+std::string Gzip(evbuffer* data);
+
+// Sets |out| to |data| decompressed. Returns false if |data| is not a
+// complete gzip stream.
+bool Gunzip(const std::string& data, std::string* out);
+
+
+// Compresses a gzip stream one piece at a time, such as the chunks of
+// a reply that is sent as it is written.
+class GzipStream {
+ public:
+  GzipStream();
+  ~GzipStream();
+
+  // Moves the contents of |in|, compressed, to the end of |out|. All
+  // that was compressed so far can then be decompressed, and once
+  // |finish| is set, the stream is complete.
+  void Compress(evbuffer* in, bool finish, evbuffer* out);
+
+ private:
+  void Deflate(int flush, evbuffer* out);
+
+  const std::unique_ptr<z_stream_s> stream_;
+
+  DISALLOW_COPY_AND_ASSIGN(GzipStream);
+};
+
+}  // namespace util
+
+#endif  // CERT_TRANS_UTIL_GZIP_H_
@@ -0,0 +1,154 @@
+#include "util/gzip.h"
+
+#include <event2/buffer.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <zlib.h>
+
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace util {
+namespace {
+
+using std::string;
+
+
+// If |complete| is false, |data| can be the start of a stream.
+string Gunzip(const string& data, bool complete) {
+  z_stream stream;
+  stream.zalloc = Z_NULL;
+  stream.zfree = Z_NULL;
+  stream.opaque = Z_NULL;
+  stream.next_in = Z_NULL;
+  stream.avail_in = 0;
+  // Only accept gzip, not zlib.
+  CHECK_EQ(Z_OK, inflateInit2(&stream, 15 + 16));
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = data.size();
+
+  string result;
+  int ret(Z_OK);
+  while (ret == Z_OK) {
+    char buffer[4096];
+    stream.next_out = reinterpret_cast<Bytef*>(buffer);
+    stream.avail_out = sizeof(buffer);
+    ret = inflate(&stream, Z_NO_FLUSH);
+    result.append(buffer, sizeof(buffer) - stream.avail_out);
+  }
+  if (complete) {
+    CHECK_EQ(Z_STREAM_END, ret);
+  } else {
+    // It ran out of input.
+    CHECK_EQ(Z_BUF_ERROR, ret);
+  }
+  CHECK_EQ(0U, stream.avail_in);
+  inflateEnd(&stream);
+  return result;
+}
+
+
+string Gunzip(const string& data) {
+  return Gunzip(data, true);
+}
+
+
+string ToString(evbuffer* buffer) {
+  return string(reinterpret_cast<const char*>(evbuffer_pullup(buffer, -1)),
+                evbuffer_get_length(buffer));
+}
+
+
+TEST(GzipTest, RoundTrips) {
+  for (const string& data :
+       {string(), string("{}"), string(100000, 'a'),
+        RandomString(100000, 100000)}) {
+    const string gzipped(Gzip(data));
+    // The gzip magic number.
+    ASSERT_LE(2U, gzipped.size());
+    EXPECT_EQ("\x1f\x8b", gzipped.substr(0, 2));
+    EXPECT_EQ(data, Gunzip(gzipped));
+  }
+}
+
+
+TEST(GzipTest, Decompresses) {
+  const string data(RandomString(100000, 100000));
+  string gunzipped;
+  ASSERT_TRUE(util::Gunzip(Gzip(data), &gunzipped));
+  EXPECT_EQ(data, gunzipped);
+
+  // Truncated, or not gzipped.
+  const string gzipped(Gzip(data));
+  EXPECT_FALSE(util::Gunzip(gzipped.substr(0, gzipped.size() / 2),
+                            &gunzipped));
+  EXPECT_FALSE(util::Gunzip(data, &gunzipped));
+}
+
+
+TEST(GzipTest, CompressesEvbuffer) {
+  evbuffer* const buffer(evbuffer_new());
+  EXPECT_EQ("", Gunzip(Gzip(buffer)));
+
+  string data;
+  for (int i = 0; i < 100; ++i) {
+    const string piece(RandomString(1, 1000));
+    // Each in its own chunk of the buffer.
+    evbuffer* const chunk(evbuffer_new());
+    CHECK_EQ(0, evbuffer_add(chunk, piece.data(), piece.size()));
+    CHECK_EQ(0, evbuffer_add_buffer(buffer, chunk));
+    evbuffer_free(chunk);
+    data += piece;
+  }
+  EXPECT_EQ(data, Gunzip(Gzip(buffer)));
+  // It's left as it was.
+  EXPECT_EQ(data.size(), evbuffer_get_length(buffer));
+  evbuffer_free(buffer);
+}
+
+
+TEST(GzipTest, CompressesStream) {
+  evbuffer* const in(evbuffer_new());
+  evbuffer* const out(evbuffer_new());
+  string data;
+  {
+    GzipStream stream;
+    for (int i = 0; i < 50; ++i) {
+      const string piece(i % 10 == 0 ? RandomString(20000, 20000)
+                                     : string(i * 100, 'a' + i % 26));
+      CHECK_EQ(0, evbuffer_add(in, piece.data(), piece.size()));
+      data += piece;
+      stream.Compress(in, false, out);
+      EXPECT_EQ(0U, evbuffer_get_length(in));
+
+      // What was compressed so far can be decompressed already.
+      EXPECT_EQ(data, Gunzip(ToString(out), false)) << i;
+    }
+    stream.Compress(in, true, out);
+  }
+  EXPECT_EQ(data, Gunzip(ToString(out)));
+  evbuffer_free(in);
+  evbuffer_free(out);
+}
+
+
+TEST(GzipTest, Compresses) {
+  string json("{\"entries\":[");
+  for (int i = 0; i < 1000; ++i) {
+    json += "{\"leaf_input\":\"AAAAAAFPA9rFYgAAAAXKMIIFxjCCBK6gAwIBAgIQ\"},";
+  }
+  json.back() = ']';
+  json += "}";
+  EXPECT_GT(json.size() / 10, Gzip(json).size());
+}
+
+
+}  // namespace
+}  // namespace util
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
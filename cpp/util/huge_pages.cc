@@ -0,0 +1,127 @@
+#include "util/huge_pages.h"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <stdint.h>
+#include <string>
+#include <sys/mman.h>
+
+#include "monitoring/monitoring.h"
+
+using std::string;
+
+namespace {
+
+
+bool ValidateHugePages(const char* flagname, const string& value) {
+  if (value != "none" && value != "transparent" && value != "hugetlb") {
+    LOG(ERROR) << "--" << flagname << " must be one of none, transparent "
+               << "or hugetlb, not \"" << value << "\"";
+    return false;
+  }
+  return true;
+}
+
+
+}  // namespace
+
+DEFINE_string(huge_pages, "none",
+              "How to back the in-memory Merkle tree levels and leaf "
+              "index: \"none\" for ordinary pages, \"transparent\" to ask "
+              "for transparent huge pages, or \"hugetlb\" to use the "
+              "huge pages reserved with vm.nr_hugepages, falling back to "
+              "transparent ones once they run out.");
+static const bool huge_pages_dummy =
+    google::RegisterFlagValidator(&FLAGS_huge_pages, &ValidateHugePages);
+
+namespace cert_trans {
+namespace {
+
+
+Counter<string>* huge_page_allocated_bytes(
+    Counter<string>::New("huge_page_allocated_bytes", "backing",
+                         "Bytes allocated for the big in-memory structures "
+                         "with huge pages, by backing (hugetlb or "
+                         "transparent)."));
+
+
+size_t RoundUp(size_t bytes) {
+  return (bytes + kHugePageSize - 1) & ~(kHugePageSize - 1);
+}
+
+
+// Maps |bytes| (a multiple of kHugePageSize) at an address aligned on
+// kHugePageSize, so that all of it can be in huge pages.
+void* MapAligned(size_t bytes) {
+  char* const mapped(static_cast<char*>(
+      mmap(nullptr, bytes + kHugePageSize, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)));
+  if (mapped == MAP_FAILED) {
+    return nullptr;
+  }
+  char* const aligned(reinterpret_cast<char*>(
+      RoundUp(reinterpret_cast<uintptr_t>(mapped))));
+  if (aligned > mapped) {
+    munmap(mapped, aligned - mapped);
+  }
+  if (mapped + kHugePageSize > aligned) {
+    munmap(aligned + bytes, mapped + kHugePageSize - aligned);
+  }
+#ifdef MADV_HUGEPAGE
+  PLOG_IF(WARNING, madvise(aligned, bytes, MADV_HUGEPAGE) != 0)
+      << "madvise(MADV_HUGEPAGE)";
+#endif
+  return aligned;
+}
+
+
+}  // namespace
+
+
+HugePages HugePagesFromFlag() {
+  if (FLAGS_huge_pages == "transparent") {
+    return HugePages::TRANSPARENT;
+  }
+  if (FLAGS_huge_pages == "hugetlb") {
+    return HugePages::HUGETLB;
+  }
+  return HugePages::NONE;
+}
+
+
+void* AllocateHugePages(HugePages mode, size_t bytes) {
+  if (mode == HugePages::NONE || bytes < kHugePageSize) {
+    return ::operator new(bytes);
+  }
+  const size_t mapped_bytes(RoundUp(bytes));
+#ifdef MAP_HUGETLB
+  if (mode == HugePages::HUGETLB) {
+    void* const ptr(mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0));
+    if (ptr != MAP_FAILED) {
+      huge_page_allocated_bytes->IncrementBy("hugetlb", mapped_bytes);
+      return ptr;
+    }
+    PLOG_FIRST_N(WARNING, 1) << "Could not allocate from the reserved huge "
+                             << "pages, falling back to transparent ones";
+  }
+#endif
+  void* const ptr(MapAligned(mapped_bytes));
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  huge_page_allocated_bytes->IncrementBy("transparent", mapped_bytes);
+  return ptr;
+}
+
+
+void FreeHugePages(HugePages mode, void* ptr, size_t bytes) {
+  if (mode == HugePages::NONE || bytes < kHugePageSize) {
+    ::operator delete(ptr);
+    return;
+  }
+  PCHECK(munmap(ptr, RoundUp(bytes)) == 0);
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,91 @@
+#ifndef CERT_TRANS_UTIL_HUGE_PAGES_H_
+#define CERT_TRANS_UTIL_HUGE_PAGES_H_
+
+#include <new>
+#include <stddef.h>
+#include <type_traits>
+
+namespace cert_trans {
+
+
+// How large blocks of memory are backed, as set with --huge_pages.
+enum class HugePages {
+  // Plain operator new.
+  NONE,
+  // Anonymous mappings aligned on huge pages, which the kernel is
+  // asked to back with transparent huge pages (madvise(MADV_HUGEPAGE)).
+  TRANSPARENT,
+  // Mappings from the pool reserved in /proc/sys/vm/nr_hugepages
+  // (MAP_HUGETLB), falling back to TRANSPARENT once it runs out.
+  HUGETLB,
+};
+
+// The mode given with --huge_pages.
+HugePages HugePagesFromFlag();
+
+// Blocks smaller than this always come from operator new, whatever
+// the mode.
+const size_t kHugePageSize = 2 << 20;
+
+// Allocates |bytes| as |mode| says, throwing std::bad_alloc on
+// failure. Must be freed with FreeHugePages(), with the same |mode|
+// and |bytes|.
+void* AllocateHugePages(HugePages mode, size_t bytes);
+void FreeHugePages(HugePages mode, void* ptr, size_t bytes);
+
+
+// An allocator for the containers behind the big in-memory lookup
+// structures (the Merkle tree levels, the leaf index), which are read
+// at random and so take a TLB miss for nearly every access with 4 KiB
+// pages. The mode is that of --huge_pages when the allocator is
+// created, and stays with it (and the copies the container makes).
+template <class T>
+class HugePageAllocator {
+ public:
+  typedef T value_type;
+  // So that containers can always swap their storage, even between
+  // allocators of different modes.
+  typedef std::true_type propagate_on_container_copy_assignment;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  HugePageAllocator() : mode_(HugePagesFromFlag()) {
+  }
+
+  template <class U>
+  HugePageAllocator(const HugePageAllocator<U>& other)
+      : mode_(other.mode()) {
+  }
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(AllocateHugePages(mode_, n * sizeof(T)));
+  }
+
+  void deallocate(T* ptr, size_t n) {
+    FreeHugePages(mode_, ptr, n * sizeof(T));
+  }
+
+  HugePages mode() const {
+    return mode_;
+  }
+
+ private:
+  HugePages mode_;
+};
+
+
+template <class T, class U>
+bool operator==(const HugePageAllocator<T>& a, const HugePageAllocator<U>& b) {
+  return a.mode() == b.mode();
+}
+
+
+template <class T, class U>
+bool operator!=(const HugePageAllocator<T>& a, const HugePageAllocator<U>& b) {
+  return !(a == b);
+}
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_UTIL_HUGE_PAGES_H_
@@ -0,0 +1,71 @@
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "util/huge_pages.h"
+#include "util/testing.h"
+
+using cert_trans::AllocateHugePages;
+using cert_trans::FreeHugePages;
+using cert_trans::HugePageAllocator;
+using cert_trans::HugePages;
+using cert_trans::kHugePageSize;
+using std::vector;
+
+DECLARE_string(huge_pages);
+
+namespace {
+
+
+class HugePagesTest : public ::testing::TestWithParam<HugePages> {};
+
+
+TEST_P(HugePagesTest, AllocatesSmallAndLargeBlocks) {
+  for (size_t bytes : {size_t(100), kHugePageSize, 3 * kHugePageSize + 1}) {
+    char* const ptr(static_cast<char*>(AllocateHugePages(GetParam(), bytes)));
+    memset(ptr, 'x', bytes);
+    EXPECT_EQ('x', ptr[bytes - 1]);
+    FreeHugePages(GetParam(), ptr, bytes);
+  }
+}
+
+
+TEST_P(HugePagesTest, LargeBlocksAreAligned) {
+  if (GetParam() != HugePages::TRANSPARENT) {
+    return;
+  }
+  void* const ptr(AllocateHugePages(GetParam(), kHugePageSize));
+  EXPECT_EQ(0U, reinterpret_cast<uintptr_t>(ptr) % kHugePageSize);
+  FreeHugePages(GetParam(), ptr, kHugePageSize);
+}
+
+
+TEST(HugePageAllocatorTest, GrowsAVector) {
+  FLAGS_huge_pages = "transparent";
+  vector<int64_t, HugePageAllocator<int64_t>> values;
+  EXPECT_EQ(HugePages::TRANSPARENT, values.get_allocator().mode());
+  for (int64_t i = 0; i < 1000000; ++i) {
+    values.push_back(i);
+  }
+  for (int64_t i = 0; i < 1000000; ++i) {
+    ASSERT_EQ(i, values[i]);
+  }
+  FLAGS_huge_pages = "none";
+}
+
+
+INSTANTIATE_TEST_CASE_P(Modes, HugePagesTest,
+                        ::testing::Values(HugePages::NONE,
+                                          HugePages::TRANSPARENT,
+                                          HugePages::HUGETLB));
+
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -101,6 +101,10 @@ class JsonObject {
     Add(name, json_object_new_boolean(b));
   }
 
+  void AddDouble(const char* name, double value) {
+    Add(name, json_object_new_double(value));
+  }
+
   const char* ToString() const {
     return json_object_to_json_string(obj_);
   }
@@ -190,6 +194,10 @@ class JsonArray : public JsonObject {
       : JsonObject(from, field, json_type_array) {
   }
 
+  JsonArray(const JsonArray& from, int offset)
+      : JsonObject(from, offset, json_type_array) {
+  }
+
   JsonArray() : JsonObject(json_object_new_array()) {
   }
 
@@ -0,0 +1,272 @@
+#include "util/json_writer.h"
+
+#include <event2/buffer.h>
+#include <glog/logging.h>
+#include <stdio.h>
+#include <string.h>
+
+using std::string;
+
+namespace util {
+namespace {
+
+const char kBase64Chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+
+// Encodes |data| into |out|, which must have room for
+// Base64Length() bytes.
+void EncodeBase64(const string& data, char* out) {
+  const unsigned char* in(
+      reinterpret_cast<const unsigned char*>(data.data()));
+  size_t remaining(data.size());
+  while (remaining >= 3) {
+    *out++ = kBase64Chars[in[0] >> 2];
+    *out++ = kBase64Chars[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+    *out++ = kBase64Chars[((in[1] & 0x0f) << 2) | (in[2] >> 6)];
+    *out++ = kBase64Chars[in[2] & 0x3f];
+    in += 3;
+    remaining -= 3;
+  }
+  if (remaining > 0) {
+    *out++ = kBase64Chars[in[0] >> 2];
+    if (remaining == 1) {
+      *out++ = kBase64Chars[(in[0] & 0x03) << 4];
+      *out++ = '=';
+    } else {
+      *out++ = kBase64Chars[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+      *out++ = kBase64Chars[(in[1] & 0x0f) << 2];
+    }
+    *out++ = '=';
+  }
+}
+
+
+size_t Base64Length(size_t length) {
+  return ((length + 2) / 3) * 4;
+}
+
+
+}  // namespace
+
+
+JsonWriter::JsonWriter(evbuffer* output)
+    : buffer_(CHECK_NOTNULL(output)), string_(nullptr) {
+}
+
+
+JsonWriter::JsonWriter(string* output)
+    : buffer_(nullptr), string_(CHECK_NOTNULL(output)) {
+}
+
+
+void JsonWriter::StartObject(const char* name) {
+  StartMember(name);
+  Start(true);
+}
+
+
+void JsonWriter::StartArray(const char* name) {
+  StartMember(name);
+  Start(false);
+}
+
+
+void JsonWriter::Add(const char* name, int64_t value) {
+  StartMember(name);
+  WriteInt(value);
+}
+
+
+void JsonWriter::Add(const char* name, const string& value) {
+  StartMember(name);
+  WriteString(value);
+}
+
+
+void JsonWriter::AddBase64(const char* name, const string& data) {
+  StartMember(name);
+  WriteBase64(data);
+}
+
+
+void JsonWriter::AddBoolean(const char* name, bool value) {
+  StartMember(name);
+  if (value) {
+    Write("true", 4);
+  } else {
+    Write("false", 5);
+  }
+}
+
+
+void JsonWriter::StartObject() {
+  StartElement();
+  Start(true);
+}
+
+
+void JsonWriter::StartArray() {
+  StartElement();
+  Start(false);
+}
+
+
+void JsonWriter::Add(int64_t value) {
+  StartElement();
+  WriteInt(value);
+}
+
+
+void JsonWriter::Add(const string& value) {
+  StartElement();
+  WriteString(value);
+}
+
+
+void JsonWriter::AddBase64(const string& data) {
+  StartElement();
+  WriteBase64(data);
+}
+
+
+void JsonWriter::AddJson(const string& json) {
+  StartElement();
+  Write(json.data(), json.size());
+}
+
+
+void JsonWriter::EndObject() {
+  End(true);
+}
+
+
+void JsonWriter::EndArray() {
+  End(false);
+}
+
+
+void JsonWriter::StartMember(const char* name) {
+  CHECK(!levels_.empty() && levels_.back().is_object)
+      << "members must be in an object";
+  if (!levels_.back().is_empty) {
+    Write(",", 1);
+  }
+  levels_.back().is_empty = false;
+  WriteString(name);
+  Write(":", 1);
+}
+
+
+void JsonWriter::StartElement() {
+  if (levels_.empty()) {
+    return;
+  }
+  CHECK(!levels_.back().is_object) << "elements must be in an array";
+  if (!levels_.back().is_empty) {
+    Write(",", 1);
+  }
+  levels_.back().is_empty = false;
+}
+
+
+void JsonWriter::Start(bool is_object) {
+  Write(is_object ? "{" : "[", 1);
+  levels_.push_back(Level{is_object, true});
+}
+
+
+void JsonWriter::End(bool is_object) {
+  CHECK(!levels_.empty() && levels_.back().is_object == is_object)
+      << "mismatched end of " << (is_object ? "object" : "array");
+  levels_.pop_back();
+  Write(is_object ? "}" : "]", 1);
+}
+
+
+void JsonWriter::Write(const char* data, size_t length) {
+  if (buffer_) {
+    CHECK_EQ(evbuffer_add(buffer_, data, length), 0);
+  } else {
+    string_->append(data, length);
+  }
+}
+
+
+void JsonWriter::WriteInt(int64_t value) {
+  char buf[32];
+  const int length(snprintf(buf, sizeof(buf), "%lld",
+                            static_cast<long long>(value)));
+  CHECK_GT(length, 0);
+  Write(buf, length);
+}
+
+
+void JsonWriter::WriteString(const string& value) {
+  Write("\"", 1);
+  // Write the runs of characters that don't need escaping as they are.
+  size_t run_start(0);
+  for (size_t i = 0; i < value.size(); ++i) {
+    const unsigned char c(value[i]);
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+    Write(value.data() + run_start, i - run_start);
+    run_start = i + 1;
+    char escaped[7];
+    switch (c) {
+      case '"':
+        Write("\\\"", 2);
+        break;
+      case '\\':
+        Write("\\\\", 2);
+        break;
+      case '\b':
+        Write("\\b", 2);
+        break;
+      case '\f':
+        Write("\\f", 2);
+        break;
+      case '\n':
+        Write("\\n", 2);
+        break;
+      case '\r':
+        Write("\\r", 2);
+        break;
+      case '\t':
+        Write("\\t", 2);
+        break;
+      default:
+        snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        Write(escaped, 6);
+        break;
+    }
+  }
+  Write(value.data() + run_start, value.size() - run_start);
+  Write("\"", 1);
+}
+
+
+void JsonWriter::WriteBase64(const string& data) {
+  const size_t length(Base64Length(data.size()));
+  Write("\"", 1);
+  if (length == 0) {
+    // Nothing to reserve.
+  } else if (buffer_) {
+    // A single extent is contiguous.
+    evbuffer_iovec extent;
+    CHECK_EQ(evbuffer_reserve_space(buffer_, length, &extent, 1), 1);
+    CHECK_GE(extent.iov_len, length);
+    EncodeBase64(data, static_cast<char*>(extent.iov_base));
+    extent.iov_len = length;
+    CHECK_EQ(evbuffer_commit_space(buffer_, &extent, 1), 0);
+  } else {
+    const size_t offset(string_->size());
+    string_->resize(offset + length);
+    EncodeBase64(data, &(*string_)[offset]);
+  }
+  Write("\"", 1);
+}
+
+
+}  // namespace util
@@ -0,0 +1,82 @@
+#ifndef CERT_TRANS_UTIL_JSON_WRITER_H_
+#define CERT_TRANS_UTIL_JSON_WRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+
+struct evbuffer;
+
+namespace util {
+
+
+// Writes JSON straight into an evbuffer or a string as it goes, rather
+// than building a json-c tree of it and rendering that. The members
+// and elements are written in order, the writer only adds the
+// punctuation and escapes the strings. Base64 values are encoded
+// straight into the output.
+//
+//   JsonWriter json(evhttp_request_get_output_buffer(req));
+//   json.StartObject();
+//   json.Add("leaf_index", index);
+//   json.StartArray("audit_path");
+//   json.AddBase64(node);
+//   json.EndArray();
+//   json.EndObject();
+class JsonWriter {
+ public:
+  // The JSON is appended to |output|.
+  explicit JsonWriter(evbuffer* output);
+  explicit JsonWriter(std::string* output);
+
+  // Members of the current object.
+  void StartObject(const char* name);
+  void StartArray(const char* name);
+  void Add(const char* name, int64_t value);
+  void Add(const char* name, const std::string& value);
+  void AddBase64(const char* name, const std::string& data);
+  void AddBoolean(const char* name, bool value);
+
+  // Elements of the current array, or the top-level value.
+  void StartObject();
+  void StartArray();
+  void Add(int64_t value);
+  void Add(const std::string& value);
+  void AddBase64(const std::string& data);
+  // An element already encoded as JSON, written as it is.
+  void AddJson(const std::string& json);
+
+  void EndObject();
+  void EndArray();
+
+ private:
+  struct Level {
+    bool is_object;
+    bool is_empty;
+  };
+
+  // Writes what goes before a member, or an element.
+  void StartMember(const char* name);
+  void StartElement();
+  void Start(bool is_object);
+  void End(bool is_object);
+
+  void Write(const char* data, size_t length);
+  void WriteInt(int64_t value);
+  void WriteString(const std::string& value);
+  void WriteBase64(const std::string& data);
+
+  evbuffer* const buffer_;
+  std::string* const string_;
+  std::vector<Level> levels_;
+
+  DISALLOW_COPY_AND_ASSIGN(JsonWriter);
+};
+
+
+}  // namespace util
+
+#endif  // CERT_TRANS_UTIL_JSON_WRITER_H_
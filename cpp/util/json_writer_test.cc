@@ -0,0 +1,147 @@
+#include "util/json_writer.h"
+
+#include <event2/buffer.h>
+#include <gtest/gtest.h>
+#include <string>
+
+#include "util/json_wrapper.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace util {
+namespace {
+
+using std::string;
+
+
+string ToString(evbuffer* buffer) {
+  const size_t length(evbuffer_get_length(buffer));
+  return string(reinterpret_cast<const char*>(evbuffer_pullup(buffer, -1)),
+                length);
+}
+
+
+TEST(JsonWriterTest, WritesObjects) {
+  string out;
+  JsonWriter json(&out);
+  json.StartObject();
+  json.Add("int", 42);
+  json.Add("negative", -9000000000LL);
+  json.Add("string", "hello");
+  json.AddBoolean("yes", true);
+  json.AddBoolean("no", false);
+  json.StartArray("array");
+  json.Add("a");
+  json.Add(7);
+  json.StartObject();
+  json.EndObject();
+  json.StartArray();
+  json.EndArray();
+  json.EndArray();
+  json.StartObject("object");
+  json.AddBase64("b64", "\x01\x02\x03");
+  json.EndObject();
+  json.EndObject();
+
+  EXPECT_EQ(
+      "{\"int\":42,\"negative\":-9000000000,\"string\":\"hello\","
+      "\"yes\":true,\"no\":false,\"array\":[\"a\",7,{},[]],"
+      "\"object\":{\"b64\":\"AQID\"}}",
+      out);
+
+  // json-c agrees.
+  JsonObject parsed(out);
+  ASSERT_TRUE(parsed.Ok());
+  JsonInt i(parsed, "negative");
+  ASSERT_TRUE(i.Ok());
+  EXPECT_EQ(-9000000000LL, i.Value());
+}
+
+
+TEST(JsonWriterTest, AppendsToString) {
+  string out("prefix");
+  JsonWriter json(&out);
+  json.Add("x");
+  EXPECT_EQ("prefix\"x\"", out);
+}
+
+
+TEST(JsonWriterTest, EscapesStrings) {
+  string out;
+  JsonWriter json(&out);
+  json.StartArray();
+  json.Add(string("\"\\/\b\f\n\r\t\x01\x1f\0", 11));
+  json.Add("caf\xc3\xa9");
+  json.EndArray();
+  EXPECT_EQ("[\"\\\"\\\\/\\b\\f\\n\\r\\t\\u0001\\u001f\\u0000\","
+            "\"caf\xc3\xa9\"]",
+            out);
+
+  JsonObject parsed("{\"a\":" + out + "}");
+  ASSERT_TRUE(parsed.Ok());
+  JsonArray array(parsed, "a");
+  ASSERT_TRUE(array.Ok());
+  JsonString first(array, 0);
+  ASSERT_TRUE(first.Ok());
+  // json-c stops at the NUL.
+  EXPECT_EQ("\"\\/\b\f\n\r\t\x01\x1f", string(first.Value()));
+}
+
+
+TEST(JsonWriterTest, EncodesBase64) {
+  for (size_t length = 0; length < 10; ++length) {
+    const string data(RandomString(length, length));
+    string out;
+    JsonWriter json(&out);
+    json.AddBase64(data);
+    EXPECT_EQ("\"" + ToBase64(data) + "\"", out) << length;
+  }
+}
+
+
+TEST(JsonWriterTest, CopiesJson) {
+  string out;
+  JsonWriter json(&out);
+  json.StartArray();
+  json.AddJson("{\"a\":1}");
+  json.AddJson("[]");
+  json.Add(2);
+  json.EndArray();
+
+  EXPECT_EQ("[{\"a\":1},[],2]", out);
+}
+
+
+TEST(JsonWriterTest, WritesToEvbuffer) {
+  evbuffer* const buffer(evbuffer_new());
+  string expected;
+  {
+    JsonWriter to_buffer(buffer);
+    JsonWriter to_string(&expected);
+    for (JsonWriter* json : {&to_buffer, &to_string}) {
+      json->StartObject();
+      json->StartArray("entries");
+      for (int i = 0; i < 100; ++i) {
+        json->StartObject();
+        json->AddBase64("leaf_input", string(1000 + i, 'x'));
+        json->AddBase64("extra_data", "");
+        json->EndObject();
+      }
+      json->EndArray();
+      json->EndObject();
+    }
+  }
+  EXPECT_EQ(expected, ToString(buffer));
+  EXPECT_TRUE(JsonObject(expected).Ok());
+  evbuffer_free(buffer);
+}
+
+
+}  // namespace
+}  // namespace util
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -2,33 +2,78 @@
 #include "util/libevent_wrapper.h"
 
 #include <arpa/inet.h>
+#include <atomic>
 #include <climits>
+#include <condition_variable>
+#include <deque>
+#include <errno.h>
 #include <evhtp.h>
+#include <event2/buffer.h>
 #include <event2/thread.h>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <map>
 #include <math.h>
 #include <netdb.h>
+#include <string.h>
 #include <sys/socket.h>
 #include <signal.h>
 
+#include "monitoring/monitoring.h"
+#include "util/cpu_affinity.h"
+
 using std::bind;
+using std::chrono::steady_clock;
 using std::chrono::duration;
 using std::chrono::duration_cast;
 using std::chrono::microseconds;
 using std::chrono::milliseconds;
 using std::chrono::seconds;
 using std::chrono::system_clock;
+using std::condition_variable;
+using std::deque;
 using std::function;
 using std::lock_guard;
+using std::map;
+using std::move;
 using std::mutex;
+using std::pair;
 using std::placeholders::_1;
 using std::recursive_mutex;
 using std::shared_ptr;
 using std::string;
+using std::thread;
+using std::unique_lock;
 using std::unique_ptr;
 using std::vector;
 using util::TaskHold;
 
+DEFINE_int32(dns_cache_ttl_seconds, 60,
+             "how long resolved hostnames are used before being looked up "
+             "again (in the background), zero to not cache them");
+DEFINE_int32(http_server_max_connections, 0,
+             "If non-zero, the maximum number of connections each HTTP "
+             "server (one per event loop) keeps open, past which new ones "
+             "are refused. Only supported with libevent 2.2 and later.");
+DEFINE_int32(http_server_idle_timeout_seconds, 0,
+             "If non-zero, how long the HTTP servers keep a connection open "
+             "waiting for its next request (or for the rest of a request), "
+             "instead of the libevent default of 50 seconds.");
+DEFINE_int32(http_server_max_headers_bytes, 0,
+             "If non-zero, the HTTP servers reject requests with headers "
+             "larger than this.");
+DEFINE_int32(http_server_max_body_bytes, 0,
+             "If non-zero, the HTTP servers reject requests with a body "
+             "larger than this.");
+DEFINE_int32(http_server_listen_backlog, 128,
+             "Length of the queue of connections waiting to be accepted by "
+             "each HTTP server.");
+DEFINE_int32(http_drain_seconds, 0,
+             "If non-zero, on SIGINT or SIGTERM the HTTP servers stop "
+             "accepting connections and keep answering on the open ones "
+             "(closing each after its next response) for this long, "
+             "before the server exits.");
+
 namespace {
 
 void FreeEvDns(evdns_base* dns) {
@@ -62,10 +107,23 @@ void DelayDispatch(evutil_socket_t, short, void* userdata) {
 }
 
 
+void RunClosure(evutil_socket_t, short, void* userdata) {
+  const unique_ptr<function<void()>> cb(
+      static_cast<function<void()>*>(CHECK_NOTNULL(userdata)));
+  (*cb)();
+}
+
+
+void DeleteString(const void*, size_t, void* data) {
+  delete static_cast<string*>(data);
+}
+
+
+// The event_base being dispatched on this thread, if any.
 #ifdef HAVE_THREAD_LOCAL
-thread_local bool on_event_thread = false;
+thread_local event_base* current_event_base = nullptr;
 #elif HAVE___THREAD
-__thread bool on_event_thread = false;
+__thread event_base* current_event_base = nullptr;
 #else
 #error No suitable thread local storage available
 #endif
@@ -75,13 +133,54 @@ __thread bool on_event_thread = false;
 
 namespace cert_trans {
 namespace libevent {
+namespace {
+
+
+static Histogram<>* libevent_closures_per_wakeup(Histogram<>::New(
+    "libevent_closures_per_wakeup",
+    "Number of closures added to event loops that were run together.",
+    ExponentialBucketBounds(1, 2, 12)));
+
+static Histogram<>* libevent_closure_wait_seconds(Histogram<>::New(
+    "libevent_closure_wait_seconds",
+    "Time closures added to event loops waited to run, in seconds.",
+    ExponentialBucketBounds(1e-6, 4, 14)));
+
+static Histogram<>* libevent_closure_run_seconds(Histogram<>::New(
+    "libevent_closure_run_seconds",
+    "Time closures added to event loops took to run, in seconds.",
+    ExponentialBucketBounds(1e-6, 4, 14)));
+
+static Gauge<>* http_server_connections(
+    Gauge<>::New("http_server_connections",
+                 "Number of connections open to the HTTP servers, as of "
+                 "their latest requests (with libevent 2.2 and later)."));
+
+static Gauge<>* http_server_draining(
+    Gauge<>::New("http_server_draining",
+                 "Number of HTTP servers draining their connections."));
+
+static Counter<>* http_server_drained_requests(
+    Counter<>::New("http_server_drained_requests",
+                   "Number of requests answered while draining, after which "
+                   "their connection is closed."));
+
+// The sum of HttpServer::num_connections_, and the number of servers
+// with draining_ set.
+std::atomic<int> total_http_connections(0);
+std::atomic<int> draining_http_servers(0);
+
+
+}  // namespace
 
 
 struct HttpServer::Handler {
-  Handler(const string& _path, const HandlerCallback& _cb)
-      : path(_path), cb(_cb) {
+  Handler(HttpServer* _server, const string& _path,
+          const HandlerCallback& _cb)
+      : server(_server), path(_path), cb(_cb) {
   }
 
+  HttpServer* const server;
   const string path;
   const HandlerCallback cb;
 };
@@ -100,9 +199,9 @@ class ResolverImpl : public Base::Resolver {
     hints.ai_socktype = SOCK_STREAM;
     const int resolved(getaddrinfo(host.c_str(), AF_UNSPEC, &hints, &info));
     if (resolved != 0) {
-      LOG(WARNING) << "Failed to resolve HTTPS hostname " << host << ": "
+      LOG(WARNING) << "Failed to resolve hostname " << host << ": "
                    << gai_strerror(resolved);
-      return nullptr;
+      return string();
     }
 
     struct addrinfo* res(info);
@@ -126,7 +225,8 @@ class ResolverImpl : public Base::Resolver {
 
     if (!addr) {
       LOG(WARNING) << "Got no usable address for " << host;
-      return nullptr;
+      freeaddrinfo(info);
+      return string();
     }
 
     char addr_str[INET6_ADDRSTRLEN];
@@ -137,7 +237,110 @@ class ResolverImpl : public Base::Resolver {
 };
 
 
-Base::Base() : Base(unique_ptr<Resolver>(new ResolverImpl)) {
+// Remembers what another resolver returned. Once an address is older
+// than --dns_cache_ttl_seconds, it is still handed out while a
+// background thread looks it up again, so that only the first lookup
+// of a host waits. If looking it up again fails, the old address keeps
+// being used.
+class CachingResolver : public Base::Resolver {
+ public:
+  explicit CachingResolver(unique_ptr<Base::Resolver> resolver)
+      : resolver_(std::move(resolver)), exiting_(false) {
+  }
+
+  ~CachingResolver() {
+    {
+      lock_guard<mutex> lock(lock_);
+      exiting_ = true;
+    }
+    refresh_cond_var_.notify_one();
+    if (refresher_.joinable()) {
+      refresher_.join();
+    }
+  }
+
+  string Resolve(const string& host) override {
+    if (FLAGS_dns_cache_ttl_seconds <= 0) {
+      return resolver_->Resolve(host);
+    }
+
+    {
+      lock_guard<mutex> lock(lock_);
+      const auto it(cache_.find(host));
+      if (it != cache_.end()) {
+        if (steady_clock::now() - it->second.resolved >=
+                seconds(FLAGS_dns_cache_ttl_seconds) &&
+            !it->second.refreshing) {
+          it->second.refreshing = true;
+          to_refresh_.push_back(host);
+          if (!refresher_.joinable()) {
+            refresher_ = thread(&CachingResolver::Refresher, this);
+          }
+          refresh_cond_var_.notify_one();
+        }
+        return it->second.addr;
+      }
+    }
+
+    const string addr(resolver_->Resolve(host));
+    if (!addr.empty()) {
+      lock_guard<mutex> lock(lock_);
+      cache_[host] = Entry{addr, steady_clock::now(), false};
+    }
+    return addr;
+  }
+
+ private:
+  struct Entry {
+    string addr;
+    steady_clock::time_point resolved;
+    bool refreshing;
+  };
+
+  void Refresher() {
+    unique_lock<mutex> lock(lock_);
+    while (true) {
+      refresh_cond_var_.wait(lock, [this]() {
+        return exiting_ || !to_refresh_.empty();
+      });
+      if (exiting_) {
+        return;
+      }
+
+      const string host(to_refresh_.front());
+      to_refresh_.pop_front();
+      lock.unlock();
+      const string addr(resolver_->Resolve(host));
+      lock.lock();
+
+      Entry* const entry(&cache_.at(host));
+      entry->refreshing = false;
+      if (!addr.empty()) {
+        VLOG_IF(1, addr != entry->addr) << host << " moved from "
+                                        << entry->addr << " to " << addr;
+        entry->addr = addr;
+        entry->resolved = steady_clock::now();
+      }
+    }
+  }
+
+  const unique_ptr<Base::Resolver> resolver_;
+
+  mutex lock_;
+  condition_variable refresh_cond_var_;
+  map<string, Entry> cache_;
+  deque<string> to_refresh_;
+  bool exiting_;
+  // Only started the first time something needs refreshing.
+  thread refresher_;
+
+  DISALLOW_COPY_AND_ASSIGN(CachingResolver);
+};
+
+
+Base::Base()
+    : Base(unique_ptr<Resolver>(
+          new CachingResolver(unique_ptr<Resolver>(new ResolverImpl)))) {
 }
 
 
@@ -161,7 +364,7 @@ Base::~Base() {
 
 // static
 bool Base::OnEventThread() {
-  return on_event_thread;
+  return current_event_base != nullptr;
 }
 
 
@@ -171,9 +374,36 @@ void Base::CheckNotOnEventThread() {
 }
 
 
+// static
+void Base::RunOnRequestLoop(evhttp_request* req, const function<void()>& cb) {
+  RunOnLoop(evhttp_connection_get_base(evhttp_request_get_connection(req)),
+            cb);
+}
+
+
+// static
+void Base::RunOnLoop(event_base* base, const function<void()>& cb) {
+  if (base == current_event_base) {
+    cb();
+    return;
+  }
+
+  // The base is notifiable, so this wakes it up if needed.
+  CHECK_EQ(0, event_base_once(base, -1, EV_TIMEOUT, &RunClosure,
+                              new function<void()>(cb), nullptr));
+}
+
+
 void Base::Add(const function<void()>& cb) {
   lock_guard<mutex> lock(closures_lock_);
-  closures_.push_back(cb);
+  closures_.emplace_back(steady_clock::now(), util::Closure(cb));
+  event_active(wake_closures_.get(), 0, 0);
+}
+
+
+void Base::Add(util::Closure&& cb) {
+  lock_guard<mutex> lock(closures_lock_);
+  closures_.emplace_back(steady_clock::now(), move(cb));
   event_active(wake_closures_.get(), 0, 0);
 }
 
@@ -211,7 +441,18 @@ void Base::Delay(const duration<double>& delay, util::Task* task) {
 }
 
 
+void Base::SetCpus(const vector<int>& cpus) {
+  cpus_ = cpus;
+}
+
+
 void Base::Dispatch() {
+  if (!cpus_.empty()) {
+    const util::Status status(SetThreadCpus(pthread_self(), cpus_));
+    LOG_IF(WARNING, !status.ok()) << status;
+    LOG_IF(INFO, status.ok()) << "Event loop running on CPUs "
+                              << FormatCpuList(cpus_);
+  }
   SetExitLoopHandler(base_.get(), SIGHUP);
   SetExitLoopHandler(base_.get(), SIGINT);
   SetExitLoopHandler(base_.get(), SIGTERM);
@@ -219,12 +460,12 @@ void Base::Dispatch() {
   // There should /never/ be more than 1 thread trying to call Dispatch(), so
   // we should expect to always own the lock here.
   CHECK(dispatch_lock_.try_lock());
-  LOG_IF(WARNING, on_event_thread)
+  LOG_IF(WARNING, OnEventThread())
       << "Huh?, Are you calling Dispatch() from a libevent thread?";
-  const bool old_on_event_thread(on_event_thread);
-  on_event_thread = true;
+  event_base* const old_event_base(current_event_base);
+  current_event_base = base_.get();
   CHECK_EQ(event_base_dispatch(base_.get()), 0);
-  on_event_thread = old_on_event_thread;
+  current_event_base = old_event_base;
   dispatch_lock_.unlock();
 }
 
@@ -232,12 +473,12 @@ void Base::Dispatch() {
 void Base::DispatchOnce() {
   // Only one thread can be running a dispatch loop at a time
   lock_guard<mutex> lock(dispatch_lock_);
-  LOG_IF(WARNING, on_event_thread)
+  LOG_IF(WARNING, OnEventThread())
       << "Huh?, Are you calling Dispatch() from a libevent thread?";
-  const bool old_on_event_thread(on_event_thread);
-  on_event_thread = true;
+  event_base* const old_event_base(current_event_base);
+  current_event_base = base_.get();
   CHECK_EQ(event_base_loop(base_.get(), EVLOOP_ONCE), 0);
-  on_event_thread = old_on_event_thread;
+  current_event_base = old_event_base;
 }
 
 
@@ -271,8 +512,12 @@ evdns_base* Base::GetDns() {
 
 evhtp_connection_t* Base::HttpConnectionNew(const string& host,
                                             unsigned short port) {
+  // Going through the resolver rather than evdns lets the name be
+  // cached.
+  const string addr_str(resolver_->Resolve(host));
+  VLOG(1) << "Got addr: " << addr_str << ":" << port;
   return CHECK_NOTNULL(
-      evhtp_connection_new_dns(base_.get(), GetDns(), host.c_str(), port));
+      evhtp_connection_new(base_.get(), addr_str.c_str(), port));
 }
 
 
@@ -294,14 +539,20 @@ evhtp_connection_t* Base::HttpsConnectionNew(const string& host,
 void Base::RunClosures(evutil_socket_t, short, void* userdata) {
   Base* self(static_cast<Base*>(CHECK_NOTNULL(userdata)));
 
-  vector<function<void()>> closures;
+  vector<pair<steady_clock::time_point, util::Closure>> closures;
   {
     lock_guard<mutex> lock(self->closures_lock_);
     closures.swap(self->closures_);
   }
 
-  for (const auto& closure : closures) {
-    closure();
+  libevent_closures_per_wakeup->Record(closures.size());
+  for (auto& closure : closures) {
+    const steady_clock::time_point start(steady_clock::now());
+    libevent_closure_wait_seconds->Record(
+        duration<double>(start - closure.first).count());
+    closure.second();
+    libevent_closure_run_seconds->Record(
+        duration<double>(steady_clock::now() - start).count());
   }
 }
 
@@ -337,11 +588,35 @@ void Event::Dispatch(evutil_socket_t sock, short events, void* userdata) {
 }
 
 
-HttpServer::HttpServer(const Base& base) : http_(base.HttpNew()) {
+HttpServer::HttpServer(const Base& base)
+    : http_(base.HttpNew()), draining_(false), num_connections_(0) {
+  CHECK_GE(FLAGS_http_server_max_connections, 0);
+  CHECK_LT(0, FLAGS_http_server_listen_backlog);
+  if (FLAGS_http_server_max_connections > 0) {
+#ifdef HAVE_EVHTTP_SET_MAX_CONNECTIONS
+    evhttp_set_max_connections(http_, FLAGS_http_server_max_connections);
+#else
+    LOG_FIRST_N(WARNING, 1) << "--http_server_max_connections needs "
+                            << "libevent 2.2 or later, ignoring it";
+#endif
+  }
+  if (FLAGS_http_server_idle_timeout_seconds > 0) {
+    evhttp_set_timeout(http_, FLAGS_http_server_idle_timeout_seconds);
+  }
+  if (FLAGS_http_server_max_headers_bytes > 0) {
+    evhttp_set_max_headers_size(http_, FLAGS_http_server_max_headers_bytes);
+  }
+  if (FLAGS_http_server_max_body_bytes > 0) {
+    evhttp_set_max_body_size(http_, FLAGS_http_server_max_body_bytes);
+  }
 }
 
 
 HttpServer::~HttpServer() {
+  if (draining_) {
+    http_server_draining->Set(--draining_http_servers);
+  }
+  http_server_connections->Set(total_http_connections -= num_connections_);
   evhttp_free(http_);
   for (vector<Handler*>::iterator it = handlers_.begin();
        it != handlers_.end(); ++it) {
@@ -351,20 +626,96 @@ HttpServer::~HttpServer() {
 
 
 void HttpServer::Bind(const char* address, ev_uint16_t port) {
-  CHECK_EQ(evhttp_bind_socket(http_, address, port), 0);
+  BindSocket(address, port, false /* reuse_port */);
+}
+
+
+void HttpServer::BindReusingPort(const char* address, ev_uint16_t port) {
+  BindSocket(address, port, true /* reuse_port */);
+}
+
+
+void HttpServer::BindSocket(const char* address, ev_uint16_t port,
+                            bool reuse_port) {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  struct addrinfo* info;
+  const int resolved(
+      getaddrinfo(address, std::to_string(port).c_str(), &hints, &info));
+  CHECK_EQ(0, resolved) << gai_strerror(resolved);
+
+  const evutil_socket_t sock(
+      socket(info->ai_family, info->ai_socktype, info->ai_protocol));
+  CHECK_GE(sock, 0) << "socket: " << strerror(errno);
+  const int on(1);
+  CHECK_EQ(0, setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)))
+      << "SO_REUSEADDR: " << strerror(errno);
+  if (reuse_port) {
+    CHECK_EQ(0,
+             setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)))
+        << "SO_REUSEPORT: " << strerror(errno);
+  }
+  CHECK_EQ(0, evutil_make_socket_nonblocking(sock));
+  CHECK_EQ(0, evutil_make_socket_closeonexec(sock));
+  CHECK_EQ(0, bind(sock, info->ai_addr, info->ai_addrlen))
+      << "bind: " << strerror(errno);
+  freeaddrinfo(info);
+  CHECK_EQ(0, listen(sock, FLAGS_http_server_listen_backlog))
+      << "listen: " << strerror(errno);
+
+  // This takes ownership of the socket.
+  evhttp_bound_socket* const bound(
+      evhttp_accept_socket_with_handle(http_, sock));
+  CHECK_NOTNULL(bound);
+  bound_sockets_.push_back(bound);
 }
 
 
 bool HttpServer::AddHandler(const string& path, const HandlerCallback& cb) {
-  Handler* handler(new Handler(path, cb));
+  Handler* handler(new Handler(this, path, cb));
   handlers_.push_back(handler);
 
   return evhttp_set_cb(http_, path.c_str(), &HandleRequest, handler) == 0;
 }
 
 
+void HttpServer::Drain() {
+  if (draining_) {
+    return;
+  }
+  draining_ = true;
+  http_server_draining->Set(++draining_http_servers);
+  for (evhttp_bound_socket* bound : bound_sockets_) {
+    evhttp_del_accept_socket(http_, bound);
+  }
+  bound_sockets_.clear();
+}
+
+
 void HttpServer::HandleRequest(evhttp_request* req, void* userdata) {
-  static_cast<Handler*>(userdata)->cb(req);
+  Handler* const handler(static_cast<Handler*>(userdata));
+  HttpServer* const server(handler->server);
+  server->UpdateConnectionCount();
+  if (server->draining_) {
+    // evhttp closes the connection once this response is sent.
+    evhttp_add_header(evhttp_request_get_output_headers(req), "Connection",
+                      "close");
+    http_server_drained_requests->Increment();
+  }
+  handler->cb(req);
+}
+
+
+void HttpServer::UpdateConnectionCount() {
+#ifdef HAVE_EVHTTP_SET_MAX_CONNECTIONS
+  const int num_connections(evhttp_get_connection_count(http_));
+  total_http_connections += num_connections - num_connections_;
+  num_connections_ = num_connections;
+  http_server_connections->Set(total_http_connections);
+#endif
 }
 
 
@@ -385,5 +736,38 @@ void EventPumpThread::Pump() {
 }
 
 
+void DrainHttpServers(const vector<Base*>& bases,
+                      const vector<HttpServer*>& servers) {
+  CHECK(!bases.empty());
+  CHECK_EQ(bases.size(), servers.size());
+  if (FLAGS_http_drain_seconds <= 0) {
+    return;
+  }
+  LOG(INFO) << "Draining the HTTP connections for "
+            << FLAGS_http_drain_seconds << " seconds";
+  servers[0]->Drain();
+  for (size_t i = 1; i < servers.size(); ++i) {
+    HttpServer* const server(servers[i]);
+    bases[i]->Add([server]() { server->Drain(); });
+  }
+  Base* const base(bases[0]);
+  const Event exit_timer(*base, -1, 0,
+                         [base](evutil_socket_t, short) { base->LoopExit(); });
+  exit_timer.Add(seconds(FLAGS_http_drain_seconds));
+  base->Dispatch();
+}
+
+
+void AddStringToBuffer(evbuffer* buffer, string&& data) {
+  if (data.empty()) {
+    return;
+  }
+  string* const owned(new string(move(data)));
+  CHECK_EQ(evbuffer_add_reference(buffer, owned->data(), owned->size(),
+                                  &DeleteString, owned),
+           0);
+}
+
+
 }  // namespace libevent
 }  // namespace cert_trans
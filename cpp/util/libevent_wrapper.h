@@ -11,7 +11,9 @@
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
+#include <utility>
 #include <vector>
 
 #include "base/macros.h"
@@ -35,16 +37,30 @@ class Base : public util::Executor {
   static bool OnEventThread();
   static void CheckNotOnEventThread();
 
+  // Arranges to run the closure on the event loop that received |req|,
+  // which is the one that must send its reply, or runs it right away
+  // if that is the current thread.
+  static void RunOnRequestLoop(evhttp_request* req,
+                               const std::function<void()>& cb);
+  // Same, for the event loop of |base|, for when the request might
+  // have lost its connection already.
+  static void RunOnLoop(event_base* base, const std::function<void()>& cb);
+
   Base();
   Base(std::unique_ptr<Resolver> resolver);
   ~Base();
 
   // Arranges to run the closure on the main loop.
   void Add(const std::function<void()>& cb) override;
+  void Add(util::Closure&& cb) override;
 
   void Delay(const std::chrono::duration<double>& delay,
              util::Task* task) override;
 
+  // Restricts the thread that runs Dispatch() to |cpus| (see
+  // SetThreadCpus()). Must be called before Dispatch().
+  void SetCpus(const std::vector<int>& cpus);
+
   void Dispatch();
   void DispatchOnce();
   void LoopExit();
@@ -72,8 +88,11 @@ class Base : public util::Executor {
   // "wake_closures_" should be after base_, so that it gets destroyed
   // first.
   const std::unique_ptr<event, void (*)(event*)> wake_closures_;
-  std::vector<std::function<void()>> closures_;
+  // With the time they were added.
+  std::vector<std::pair<std::chrono::steady_clock::time_point, util::Closure>>
+      closures_;
   std::unique_ptr<Resolver> resolver_;
+  std::vector<int> cpus_;
 
   DISALLOW_COPY_AND_ASSIGN(Base);
 };
@@ -99,6 +118,9 @@ class Event {
 };
 
 
+// The limits on the connections (--http_server_max_connections), on
+// how long they can stay idle, on the size of the requests and on the
+// accept queue are taken from the flags.
 class HttpServer {
  public:
   typedef std::function<void(evhttp_request*)> HandlerCallback;
@@ -108,18 +130,36 @@ class HttpServer {
 
   void Bind(const char* address, ev_uint16_t port);
 
+  // Like Bind(), but with SO_REUSEPORT set on the listening socket, so
+  // that several servers, each on its own event loop, can accept
+  // connections on the same port.
+  void BindReusingPort(const char* address, ev_uint16_t port);
+
   // Returns false if there was an error adding the handler.
   bool AddHandler(const std::string& path, const HandlerCallback& cb);
 
+  // Stops accepting connections, and closes the open ones once they
+  // have answered their next request (or after the idle timeout), so
+  // that clients move to other servers without losing any request.
+  // Must be called on the thread of the event loop of this server, or
+  // while that loop isn't running.
+  void Drain();
+
  private:
   struct Handler;
 
   static void HandleRequest(evhttp_request* req, void* userdata);
+  void BindSocket(const char* address, ev_uint16_t port, bool reuse_port);
+  void UpdateConnectionCount();
 
   evhttp* const http_;
   // Could have been a vector<Handler>, but it is important that
   // pointers to entries remain valid.
   std::vector<Handler*> handlers_;
+  std::vector<evhttp_bound_socket*> bound_sockets_;
+  // Only used on the thread of the event loop.
+  bool draining_;
+  int num_connections_;
 
   DISALLOW_COPY_AND_ASSIGN(HttpServer);
 };
@@ -140,6 +180,20 @@ class EventPumpThread {
 };
 
 
+// If --http_drain_seconds is set, drains each of |servers| (see
+// HttpServer::Drain()) on the event loop of the matching entry of
+// |bases|, and then dispatches the first of those, whose loop must not
+// be running, for that long, to answer the requests still coming on
+// the open connections. The other loops must be running elsewhere.
+void DrainHttpServers(const std::vector<Base*>& bases,
+                      const std::vector<HttpServer*>& servers);
+
+
+// Appends |data| to |buffer| without copying it: the buffer takes it
+// over, and frees it once it has been sent.
+void AddStringToBuffer(evbuffer* buffer, std::string&& data);
+
+
 }  // namespace libevent
 }  // namespace cert_trans
 
@@ -1,12 +1,38 @@
 #include "util/libevent_wrapper.h"
 
+#include <arpa/inet.h>
+#include <chrono>
+#include <errno.h>
+#include <event2/buffer.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
 #include <gtest/gtest.h>
+#include <map>
+#include <mutex>
+#include <netinet/in.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
 #include "util/testing.h"
 
+DECLARE_int32(http_drain_seconds);
+
 namespace cert_trans {
 namespace libevent {
 
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::map;
+using std::mutex;
+using std::string;
+using std::thread;
+using std::vector;
+
 void DoNothing() {
 }
 
@@ -55,6 +81,208 @@ TEST_F(LibEventWrapperDeathTest, TestCheckNotOnEventThread) {
 }
 
 
+TEST_F(LibEventWrapperTest, TestAddStringToBuffer) {
+  const std::unique_ptr<evbuffer, void (*)(evbuffer*)> buffer(evbuffer_new(),
+                                                              evbuffer_free);
+  // Long enough not to be stored in the string object itself.
+  string data(100, 'x');
+  const char* const contents(data.data());
+  AddStringToBuffer(buffer.get(), std::move(data));
+  AddStringToBuffer(buffer.get(), string());
+  ASSERT_EQ(100U, evbuffer_get_length(buffer.get()));
+  // It wasn't copied.
+  EXPECT_EQ(contents, reinterpret_cast<const char*>(
+                          evbuffer_pullup(buffer.get(), -1)));
+}
+
+
+// Returns a port that was free a moment ago.
+uint16_t FreePort() {
+  const int sock(socket(AF_INET, SOCK_STREAM, 0));
+  CHECK_GE(sock, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  CHECK_EQ(0, bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
+  socklen_t addr_len(sizeof(addr));
+  CHECK_EQ(0, getsockname(sock, reinterpret_cast<sockaddr*>(&addr),
+                          &addr_len));
+  close(sock);
+  return ntohs(addr.sin_port);
+}
+
+
+// Returns a socket connected to |port|, or -1 with errno set.
+int Connect(uint16_t port) {
+  const int sock(socket(AF_INET, SOCK_STREAM, 0));
+  CHECK_GE(sock, 0);
+  // Don't wait forever for a server which doesn't close the connection.
+  const timeval timeout{5, 0};
+  CHECK_EQ(0, setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                         sizeof(timeout)));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    const int error(errno);
+    close(sock);
+    errno = error;
+    return -1;
+  }
+  return sock;
+}
+
+
+// Sends a keep-alive request for /test on |sock|, and returns what is
+// read back until |sock| is closed, or once the reply ends with
+// |body_end|, if not empty.
+string KeepAliveGet(int sock, const string& body_end) {
+  const string request(
+      "GET /test HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+      "Connection: keep-alive\r\n\r\n");
+  CHECK_EQ(static_cast<ssize_t>(request.size()),
+           write(sock, request.data(), request.size()));
+  string response;
+  char buf[1024];
+  ssize_t len;
+  while ((body_end.empty() || response.size() < body_end.size() ||
+          response.compare(response.size() - body_end.size(),
+                           body_end.size(), body_end) != 0) &&
+         (len = read(sock, buf, sizeof(buf))) > 0) {
+    response.append(buf, len);
+  }
+  return response;
+}
+
+
+string Get(uint16_t port) {
+  const int sock(Connect(port));
+  CHECK_GE(sock, 0) << strerror(errno);
+  const string request("GET /test HTTP/1.0\r\n\r\n");
+  CHECK_EQ(static_cast<ssize_t>(request.size()),
+           write(sock, request.data(), request.size()));
+  string response;
+  char buf[1024];
+  ssize_t len;
+  while ((len = read(sock, buf, sizeof(buf))) > 0) {
+    response.append(buf, len);
+  }
+  close(sock);
+  return response;
+}
+
+
+TEST_F(LibEventWrapperTest, TestRepliesOnRequestLoop) {
+  const uint16_t port(FreePort());
+  vector<std::shared_ptr<Base>> bases;
+  vector<std::unique_ptr<HttpServer>> servers;
+  mutex lock;
+  map<evhttp_request*, thread::id> received_on;
+  vector<thread> repliers;
+  for (int i = 0; i < 2; ++i) {
+    bases.emplace_back(std::make_shared<Base>());
+    servers.emplace_back(new HttpServer(*bases.back()));
+    // Both can listen on the same port.
+    servers.back()->BindReusingPort("127.0.0.1", port);
+    servers.back()->AddHandler("/test", [&](evhttp_request* req) {
+      lock_guard<mutex> guard(lock);
+      received_on[req] = std::this_thread::get_id();
+      // Reply from another thread.
+      repliers.emplace_back([&, req]() {
+        Base::RunOnRequestLoop(req, [&, req]() {
+          {
+            lock_guard<mutex> guard(lock);
+            EXPECT_EQ(received_on[req], std::this_thread::get_id());
+            received_on.erase(req);
+          }
+          evbuffer_add_printf(evhttp_request_get_output_buffer(req), "hi");
+          evhttp_send_reply(req, HTTP_OK, nullptr, nullptr);
+        });
+      });
+    });
+  }
+
+  {
+    vector<std::unique_ptr<EventPumpThread>> pumps;
+    for (const auto& base : bases) {
+      pumps.emplace_back(new EventPumpThread(base));
+    }
+    for (int i = 0; i < 10; ++i) {
+      const string response(Get(port));
+      EXPECT_EQ(0U, response.find("HTTP/1.")) << response;
+      EXPECT_EQ(response.size() - 2, response.rfind("hi")) << response;
+    }
+  }
+
+  for (auto& replier : repliers) {
+    replier.join();
+  }
+  EXPECT_TRUE(received_on.empty());
+}
+
+
+TEST_F(LibEventWrapperTest, TestDrain) {
+  const uint16_t port(FreePort());
+  const std::shared_ptr<Base> base(std::make_shared<Base>());
+  HttpServer server(*base);
+  server.Bind("127.0.0.1", port);
+  server.AddHandler("/test", [](evhttp_request* req) {
+    evbuffer_add_printf(evhttp_request_get_output_buffer(req), "hi");
+    evhttp_send_reply(req, HTTP_OK, nullptr, nullptr);
+  });
+
+  // A connection opened, and kept open, before draining.
+  const int sock(Connect(port));
+  ASSERT_LE(0, sock) << strerror(errno);
+  {
+    EventPumpThread pump(base);
+    const string response(KeepAliveGet(sock, "hi"));
+    EXPECT_EQ(0U, response.find("HTTP/1.1 200")) << response;
+    EXPECT_EQ(string::npos, response.find("Connection: close")) << response;
+  }
+
+  FLAGS_http_drain_seconds = 1;
+  // The first server is drained before its loop is dispatched, so that
+  // this is already the case for what follows.
+  server.Drain();
+  steady_clock::duration drained_for;
+  thread drain([&base, &server, &drained_for]() {
+    const steady_clock::time_point start(steady_clock::now());
+    DrainHttpServers({base.get()}, {&server});
+    drained_for = steady_clock::now() - start;
+  });
+
+  // No longer accepting connections.
+  const int refused(Connect(port));
+  const int error(errno);
+  EXPECT_EQ(-1, refused);
+  EXPECT_EQ(ECONNREFUSED, error) << strerror(error);
+
+  // But still answering on the open one, which it then closes.
+  const string response(KeepAliveGet(sock, ""));
+  EXPECT_EQ(0U, response.find("HTTP/1.1 200")) << response;
+  EXPECT_NE(string::npos, response.find("Connection: close")) << response;
+  EXPECT_EQ(response.size() - 2, response.rfind("hi")) << response;
+  close(sock);
+
+  // And the loop exits once the time is up.
+  drain.join();
+  EXPECT_LE(milliseconds(1000), drained_for);
+  EXPECT_GT(milliseconds(5000), drained_for);
+  FLAGS_http_drain_seconds = 0;
+}
+
+
+TEST_F(LibEventWrapperTest, TestDrainNeedsTheFlag) {
+  const std::shared_ptr<Base> base(std::make_shared<Base>());
+  HttpServer server(*base);
+  server.Bind("127.0.0.1", FreePort());
+  // Returns at once, without dispatching.
+  DrainHttpServers({base.get()}, {&server});
+}
+
+
 }  // namespace libevent
 }  // namespace cert_trans
 
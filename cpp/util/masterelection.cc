@@ -12,7 +12,9 @@ namespace cert_trans {
 
 using cert_trans::Gauge;
 using std::bind;
+using std::chrono::milliseconds;
 using std::chrono::seconds;
+using std::chrono::steady_clock;
 using std::mutex;
 using std::placeholders::_1;
 using std::placeholders::_2;
@@ -28,6 +30,15 @@ DEFINE_int32(master_keepalive_interval_seconds, 60,
 DEFINE_int32(masterelection_retry_delay_seconds, 5,
              "Seconds to delay before retrying a failed attempt to create a "
              "proposal file.");
+DEFINE_int32(master_proposal_ttl_seconds, 0,
+             "TTL of the mastership proposals. A master which stops "
+             "refreshing its proposal is replaced once it expires, so this "
+             "bounds how long a dead master stalls the log. If zero, twice "
+             "--master_keepalive_interval_seconds is used.");
+DEFINE_int32(master_lease_margin_ms, 1000,
+             "The master lease runs out this long before the proposal of "
+             "the master could expire in etcd, to allow for the clocks of "
+             "etcd and of the master drifting apart.");
 
 namespace {
 
@@ -50,6 +61,13 @@ static Counter<>* proposal_creation_failures(
 const char kNoBacking[] = "";
 
 
+seconds ProposalTTL() {
+  return seconds(FLAGS_master_proposal_ttl_seconds > 0
+                     ? FLAGS_master_proposal_ttl_seconds
+                     : FLAGS_master_keepalive_interval_seconds * 2);
+}
+
+
 // Returns |s| with a '/' appended if the last char is not already a '/'
 string EnsureEndsWithSlash(const string& s) {
   if (s.empty() || s.back() != '/') {
@@ -106,8 +124,13 @@ MasterElection::MasterElection(const shared_ptr<libevent::Base>& base,
       proposal_state_(ProposalState::NONE),
       running_(false),
       backed_proposal_(kNoBacking),
-      is_master_(false) {
+      is_master_(false),
+      has_lease_(false) {
   CHECK_NE(kNoBacking, node_id);
+  // The proposal has to outlive the interval at which it is refreshed.
+  CHECK_GT(ProposalTTL().count(), FLAGS_master_keepalive_interval_seconds);
+  CHECK_GE(FLAGS_master_lease_margin_ms, 0);
+  CHECK_LT(milliseconds(FLAGS_master_lease_margin_ms), ProposalTTL());
   is_master_gauge->Set(0);
   participating_in_election_gauge->Set(0);
 }
@@ -115,7 +138,9 @@ MasterElection::MasterElection(const shared_ptr<libevent::Base>& base,
 
 // Testing only c'tor
 MasterElection::MasterElection()
-    : client_(nullptr), proposal_state_(ProposalState::NONE) {
+    : client_(nullptr),
+      proposal_state_(ProposalState::NONE),
+      has_lease_(false) {
 }
 
 
@@ -163,7 +188,7 @@ void MasterElection::StopElection() {
   proposal_watch_.reset();
 
   lock.lock();
-  is_master_ = false;
+  SetIsMaster(lock, false);
   is_master_cv_.notify_all();
 
   // But wait for any in-flight updates to finish
@@ -202,6 +227,16 @@ bool MasterElection::WaitToBecomeMaster() const {
 }
 
 
+bool MasterElection::WaitToBecomeMasterUntil(
+    const std::chrono::steady_clock::time_point& deadline) const {
+  unique_lock<mutex> lock(mutex_);
+  is_master_cv_.wait_until(lock, deadline, [this, &lock]() {
+    return IsMaster(lock) || !running_;
+  });
+  return IsMaster(lock);
+}
+
+
 bool MasterElection::IsMaster() const {
   unique_lock<mutex> lock(mutex_);
   return IsMaster(lock);
@@ -214,6 +249,30 @@ bool MasterElection::IsMaster(const unique_lock<mutex>& lock) const {
 }
 
 
+bool MasterElection::GetMasterLease(Lease* lease) const {
+  CHECK_NOTNULL(lease);
+  const steady_clock::time_point now(steady_clock::now());
+  std::lock_guard<mutex> lock(lease_lock_);
+  if (!has_lease_ || now >= lease_.deadline) {
+    return false;
+  }
+  *lease = lease_;
+  return true;
+}
+
+
+void MasterElection::SetIsMaster(const unique_lock<mutex>& lock,
+                                 bool is_master) {
+  CHECK(lock.owns_lock());
+  is_master_ = is_master;
+  is_master_gauge->Set(is_master ? 1 : 0);
+  std::lock_guard<mutex> lease_lock(lease_lock_);
+  has_lease_ = is_master;
+  lease_.deadline = proposal_expiry_;
+  lease_.token = my_proposal_create_index_;
+}
+
+
 void MasterElection::Transition(const unique_lock<mutex>& lock,
                                 const ProposalState to) {
   CHECK(lock.owns_lock());
@@ -265,9 +324,10 @@ void MasterElection::CreateProposal() {
   // Technically this could already exist if we had mastership before, crashed,
   // and then restarted before the TTL expired.
   EtcdClient::Response* const resp(new EtcdClient::Response);
+  proposal_sent_ = steady_clock::now();
   client_->CreateWithTTL(
       my_proposal_path_, kNoBacking,
-      seconds(FLAGS_master_keepalive_interval_seconds * 2), resp,
+      ProposalTTL(), resp,
       new Task(bind(&MasterElection::ProposalCreateDone, this, resp, _1),
                base_.get()));
 }
@@ -296,6 +356,8 @@ void MasterElection::ProposalCreateDone(EtcdClient::Response* resp,
           << resp->etcd_index;
 
   my_proposal_modified_index_ = my_proposal_create_index_ = resp->etcd_index;
+  proposal_expiry_ = proposal_sent_ + ProposalTTL() -
+                     milliseconds(FLAGS_master_lease_margin_ms);
   // Start a periodic callback to keep our proposal from being garbage
   // collected
   CHECK(!proposal_refresh_callback_);
@@ -345,8 +407,8 @@ void MasterElection::UpdateProposal(const string& backed) {
 
   // TODO(alcutter): Set the HTTP timeout inside here to something sensible.
   EtcdClient::Response* const resp(new EtcdClient::Response);
-  client_->UpdateWithTTL(my_proposal_path_, backed,
-                         seconds(FLAGS_master_keepalive_interval_seconds * 2),
+  proposal_sent_ = steady_clock::now();
+  client_->UpdateWithTTL(my_proposal_path_, backed, ProposalTTL(),
                          my_proposal_modified_index_, resp,
                          new Task(bind(&MasterElection::ProposalUpdateDone,
                                        this, resp, _1),
@@ -367,6 +429,10 @@ void MasterElection::ProposalUpdateDone(EtcdClient::Response* resp,
   my_proposal_modified_index_ = resp->etcd_index;
   VLOG(1) << my_proposal_path_ << ": Proposal refreshed @ "
           << resp->etcd_index;
+  // Extends the lease, if we hold it.
+  proposal_expiry_ = proposal_sent_ + ProposalTTL() -
+                     milliseconds(FLAGS_master_lease_margin_ms);
+  SetIsMaster(lock, is_master_);
 }
 
 
@@ -469,8 +535,7 @@ void MasterElection::OnProposalUpdate(
     VLOG(1) << my_proposal_path_
             << ": No proposals to consider; no master currently";
     // Since nobody is a master, that includes us:
-    is_master_ = false;
-    is_master_gauge->Set(0);
+    SetIsMaster(lock, false);
     return;
   }
 
@@ -494,8 +559,7 @@ void MasterElection::OnProposalUpdate(
     // Strictly this might not be true - if everyone else already voted for us
     // we could short circuit and set this true here, but there's no really
     // anything to be gained from that other than more complex code.
-    is_master_ = false;
-    is_master_gauge->Set(0);
+    SetIsMaster(lock, false);
     return;
   }
 
@@ -526,8 +590,7 @@ void MasterElection::OnProposalUpdate(
               << apparent_master.key_ << " but " << pair.first
               << " is backing: " << pair.second.value_;
       // No master, so we can't be master
-      is_master_ = false;
-      is_master_gauge->Set(0);
+      SetIsMaster(lock, false);
       return;
     }
   }
@@ -539,12 +602,11 @@ void MasterElection::OnProposalUpdate(
 
   // Finally, determine if we're the master, and wake up anyone blocked in
   // WaitToBecomeMaster() if so:
-  is_master_ = running_ &&
-               (apparent_master.key_ == my_proposal_path_ &&
-                apparent_master.created_index_ == my_proposal_create_index_);
+  SetIsMaster(lock, running_ && (apparent_master.key_ == my_proposal_path_ &&
+                                 apparent_master.created_index_ ==
+                                     my_proposal_create_index_));
   if (is_master_) {
     LOG(INFO) << my_proposal_path_ << ": Became master";
-    is_master_gauge->Set(1);
     is_master_cv_.notify_all();
   }
 }
@@ -1,6 +1,7 @@
 #ifndef CERT_TRANS_UTIL_MASTERELECTION_H_
 #define CERT_TRANS_UTIL_MASTERELECTION_H_
 
+#include <chrono>
 #include <condition_variable>
 #include <memory>
 #include <mutex>
@@ -61,10 +62,30 @@ class MasterElection {
   // Returns true iff we're master at the time the call returns.
   virtual bool WaitToBecomeMaster() const;
 
+  // As above, but also returns once |deadline| is reached.
+  virtual bool WaitToBecomeMasterUntil(
+      const std::chrono::steady_clock::time_point& deadline) const;
+
   // Returns true iff this instance is currently master at the time of the
   // call.
   virtual bool IsMaster() const;
 
+  // A period during which this instance is master, and no other
+  // instance can become master: that is until our proposal, which
+  // has the lowest creation index, could expire in etcd (less
+  // --master_lease_margin_ms).
+  struct Lease {
+    std::chrono::steady_clock::time_point deadline;
+    // Fencing token for the mastership term: the creation index of
+    // our proposal, which is higher for each new master.
+    int64_t token;
+  };
+
+  // Returns true and sets |lease| iff this instance is master and its
+  // lease hasn't run out. This only compares the lease deadline with
+  // the clock, and doesn't wait for any election update in progress.
+  virtual bool GetMasterLease(Lease* lease) const;
+
  protected:
   MasterElection();
 
@@ -132,6 +153,10 @@ class MasterElection {
   // Internal non-locking accessor for is_master_
   bool IsMaster(const std::unique_lock<std::mutex>& lock) const;
 
+  // Sets |is_master_|, and the lease given out by GetMasterLease()
+  // to match it and |proposal_expiry_|.
+  void SetIsMaster(const std::unique_lock<std::mutex>& lock, bool is_master);
+
   const std::shared_ptr<libevent::Base> base_;
   EtcdClient* const client_;  // Not owned by us.
   const std::string proposal_dir_;
@@ -159,6 +184,17 @@ class MasterElection {
   bool is_master_;
   EtcdClient::Node current_master_;
 
+  // When the last create or refresh of our proposal was sent, and so
+  // the earliest it can expire (less --master_lease_margin_ms).
+  std::chrono::steady_clock::time_point proposal_sent_;
+  std::chrono::steady_clock::time_point proposal_expiry_;
+
+  // The lease is kept under its own lock, so that GetMasterLease()
+  // isn't held up by the processing of election updates.
+  mutable std::mutex lease_lock_;
+  bool has_lease_;
+  Lease lease_;
+
   friend class ElectionTest;
   friend std::ostream& operator<<(std::ostream& output, ProposalState state);
 };
@@ -26,7 +26,9 @@ namespace cert_trans {
 using cert_trans::Notification;
 using std::atomic;
 using std::bind;
+using std::chrono::milliseconds;
 using std::chrono::seconds;
+using std::chrono::steady_clock;
 using std::function;
 using std::make_shared;
 using std::map;
@@ -96,6 +98,11 @@ struct Participant {
     return election_->WaitToBecomeMaster();
   }
 
+  bool WaitToBecomeMasterUntil(
+      const std::chrono::steady_clock::time_point& deadline) {
+    return election_->WaitToBecomeMasterUntil(deadline);
+  }
+
   bool IsMaster() {
     return election_->IsMaster();
   }
@@ -193,6 +200,21 @@ TEST_F(ElectionTest, SingleInstanceBecomesMaster) {
 }
 
 
+TEST_F(ElectionTest, MasterHoldsLease) {
+  Participant one(kProposalDir, "1", base_, client_.get());
+  MasterElection::Lease lease;
+  EXPECT_FALSE(one.election_->GetMasterLease(&lease));
+
+  one.ElectLikeABoss();
+  ASSERT_TRUE(one.election_->GetMasterLease(&lease));
+  EXPECT_GT(lease.deadline, steady_clock::now());
+  EXPECT_LT(0, lease.token);
+
+  one.StopElection();
+  EXPECT_FALSE(one.election_->GetMasterLease(&lease));
+}
+
+
 TEST_F(ElectionTest, MultiInstanceElection) {
   Participant one(kProposalDir, "1", base_, client_.get());
   one.ElectLikeABoss();
@@ -236,6 +258,34 @@ TEST_F(ElectionTest, MultiInstanceElection) {
 }
 
 
+TEST_F(ElectionTest, StandbyTakesOverWithoutWaitingForDeadline) {
+  Participant one(kProposalDir, "1", base_, client_.get());
+  one.ElectLikeABoss();
+
+  Participant two(kProposalDir, "2", base_, client_.get());
+  two.StartElection();
+  const steady_clock::time_point start(steady_clock::now());
+  EXPECT_FALSE(two.WaitToBecomeMasterUntil(start + milliseconds(500)));
+  EXPECT_LE(start + milliseconds(500), steady_clock::now());
+
+  thread stopper([&one]() {
+    sleep(1);
+    one.StopElection();
+  });
+  // Returns as soon as the handoff is done, well before the deadline.
+  EXPECT_TRUE(two.WaitToBecomeMasterUntil(steady_clock::now() + seconds(30)));
+  EXPECT_GT(start + seconds(10), steady_clock::now());
+  EXPECT_TRUE(two.IsMaster());
+  stopper.join();
+  EXPECT_FALSE(one.IsMaster());
+
+  two.StopElection();
+  // Doesn't block once the election is stopped.
+  EXPECT_FALSE(two.WaitToBecomeMasterUntil(steady_clock::now() + seconds(30)));
+  EXPECT_GT(start + seconds(10), steady_clock::now());
+}
+
+
 TEST_F(ElectionTest, RejoinElection) {
   Participant one(kProposalDir, "1", base_, client_.get());
   EXPECT_FALSE(one.IsMaster());
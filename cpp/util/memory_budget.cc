@@ -0,0 +1,74 @@
+#include "util/memory_budget.h"
+
+#include <algorithm>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+using std::max;
+using std::unique_ptr;
+
+DEFINE_int32(cache_memory_budget_mb, 0,
+             "if set, the in-memory caches (get-entries tiles, database "
+             "entries) shrink so that together they use no more than this "
+             "many megabytes, on top of their own limits");
+
+namespace cert_trans {
+
+
+MemoryBudget::Account::Account(MemoryBudget* budget)
+    : budget_(CHECK_NOTNULL(budget)), bytes_(0) {
+  ++budget_->num_accounts_;
+}
+
+
+MemoryBudget::Account::~Account() {
+  Set(0);
+  --budget_->num_accounts_;
+}
+
+
+void MemoryBudget::Account::Set(size_t bytes) {
+  const size_t old_bytes(bytes_.exchange(bytes));
+  if (bytes >= old_bytes) {
+    budget_->bytes_ += bytes - old_bytes;
+  } else {
+    budget_->bytes_ -= old_bytes - bytes;
+  }
+}
+
+
+bool MemoryBudget::Account::ShouldShrink() const {
+  const size_t share(budget_->max_bytes_ /
+                     max<size_t>(1, budget_->num_accounts_.load()));
+  return budget_->bytes_.load() > budget_->max_bytes_ && bytes_.load() > share;
+}
+
+
+MemoryBudget::MemoryBudget(size_t max_bytes)
+    : max_bytes_(max_bytes), bytes_(0), num_accounts_(0) {
+  CHECK_GT(max_bytes_, 0U);
+}
+
+
+MemoryBudget::~MemoryBudget() {
+  CHECK_EQ(0U, num_accounts_.load());
+}
+
+
+// static
+MemoryBudget* MemoryBudget::Global() {
+  static MemoryBudget* const budget(
+      FLAGS_cache_memory_budget_mb > 0
+          ? new MemoryBudget(static_cast<size_t>(FLAGS_cache_memory_budget_mb)
+                             << 20)
+          : nullptr);
+  return budget;
+}
+
+
+unique_ptr<MemoryBudget::Account> MemoryBudget::OpenAccount() {
+  return unique_ptr<Account>(new Account(this));
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,71 @@
+#ifndef CERT_TRANS_UTIL_MEMORY_BUDGET_H_
+#define CERT_TRANS_UTIL_MEMORY_BUDGET_H_
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// A number of bytes shared by the caches of a process, so that they
+// can be sized together rather than each on its own. Each cache opens
+// an Account, in which it keeps the number of bytes it holds, and
+// evicts entries for as long as ShouldShrink() says so, on top of its
+// own limit.
+//
+// A cache is only asked to shrink while the total is over the budget
+// and it holds more than its share, an equal part of the budget for
+// each account, so that a busy cache doesn't empty a quiet one.
+//
+// This class is thread-safe.
+class MemoryBudget {
+ public:
+  class Account {
+   public:
+    ~Account();
+
+    // Records that the cache now holds |bytes|.
+    void Set(size_t bytes);
+
+    bool ShouldShrink() const;
+
+   private:
+    explicit Account(MemoryBudget* budget);
+
+    MemoryBudget* const budget_;
+    std::atomic<size_t> bytes_;
+
+    friend class MemoryBudget;
+
+    DISALLOW_COPY_AND_ASSIGN(Account);
+  };
+
+  explicit MemoryBudget(size_t max_bytes);
+  // All the accounts must have been closed.
+  ~MemoryBudget();
+
+  // The budget set with --cache_memory_budget_mb, or nullptr if there
+  // is none.
+  static MemoryBudget* Global();
+
+  std::unique_ptr<Account> OpenAccount();
+
+  size_t Bytes() const {
+    return bytes_.load();
+  }
+
+ private:
+  const size_t max_bytes_;
+  std::atomic<size_t> bytes_;
+  std::atomic<size_t> num_accounts_;
+
+  DISALLOW_COPY_AND_ASSIGN(MemoryBudget);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_UTIL_MEMORY_BUDGET_H_
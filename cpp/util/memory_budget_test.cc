@@ -0,0 +1,51 @@
+#include <gtest/gtest.h>
+#include <memory>
+
+#include "util/memory_budget.h"
+#include "util/testing.h"
+
+using cert_trans::MemoryBudget;
+using std::unique_ptr;
+
+namespace {
+
+
+TEST(MemoryBudgetTest, OnlyCachesOverTheirShareShrink) {
+  MemoryBudget budget(100);
+  const unique_ptr<MemoryBudget::Account> busy(budget.OpenAccount());
+  const unique_ptr<MemoryBudget::Account> quiet(budget.OpenAccount());
+
+  busy->Set(90);
+  EXPECT_EQ(90U, budget.Bytes());
+  EXPECT_FALSE(busy->ShouldShrink());
+
+  quiet->Set(20);
+  EXPECT_EQ(110U, budget.Bytes());
+  // Each one's share is half of the budget.
+  EXPECT_TRUE(busy->ShouldShrink());
+  EXPECT_FALSE(quiet->ShouldShrink());
+
+  busy->Set(80);
+  EXPECT_EQ(100U, budget.Bytes());
+  EXPECT_FALSE(busy->ShouldShrink());
+}
+
+
+TEST(MemoryBudgetTest, ClosingAnAccountReleasesItsBytes) {
+  MemoryBudget budget(100);
+  unique_ptr<MemoryBudget::Account> account(budget.OpenAccount());
+  account->Set(150);
+  EXPECT_TRUE(account->ShouldShrink());
+
+  account.reset();
+  EXPECT_EQ(0U, budget.Bytes());
+}
+
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
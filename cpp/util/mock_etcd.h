@@ -12,6 +12,8 @@ class MockEtcdClient : public EtcdClient {
  public:
   MOCK_METHOD3(Get,
                void(const Request& req, GetResponse* resp, util::Task* task));
+  MOCK_METHOD4(GetDir, void(const Request& req, const NodeCallback& cb,
+                            GetResponse* resp, util::Task* task));
   MOCK_METHOD4(Create, void(const std::string& key, const std::string& value,
                             Response* resp, util::Task* task));
   MOCK_METHOD5(CreateWithTTL,
@@ -35,6 +37,8 @@ class MockEtcdClient : public EtcdClient {
   MOCK_METHOD3(Delete, void(const std::string& key,
                             const int64_t current_index, util::Task* task));
   MOCK_METHOD2(ForceDelete, void(const std::string& key, util::Task* task));
+  MOCK_METHOD2(ForceDeleteDir,
+               void(const std::string& key, util::Task* task));
   MOCK_METHOD2(GetStoreStats,
                void(EtcdClient::StatsResponse* resp, util::Task* task));
   MOCK_METHOD3(Watch, void(const std::string& key, const WatchCallback& cb,
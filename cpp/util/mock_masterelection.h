@@ -14,7 +14,20 @@ class MockMasterElection : public MasterElection {
   MOCK_METHOD0(StartElection, void());
   MOCK_METHOD0(StopElection, void());
   MOCK_CONST_METHOD0(WaitToBecomeMaster, bool());
+  MOCK_CONST_METHOD1(WaitToBecomeMasterUntil,
+                     bool(const std::chrono::steady_clock::time_point&));
   MOCK_CONST_METHOD0(IsMaster, bool());
+
+  // Holds a lease that never runs out whenever IsMaster() says so, so
+  // that tests only have to set up the latter.
+  bool GetMasterLease(Lease* lease) const override {
+    if (!IsMaster()) {
+      return false;
+    }
+    lease->deadline = std::chrono::steady_clock::time_point::max();
+    lease->token = 1;
+    return true;
+  }
 };
 
 }  // namespace cert_trans
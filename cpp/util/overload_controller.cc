@@ -0,0 +1,46 @@
+#include "util/overload_controller.h"
+
+#include <glog/logging.h>
+
+namespace util {
+
+namespace {
+
+// The load under which an update counts towards recovery.
+const double kCalmLoad = 0.5;
+
+
+}  // namespace
+
+
+OverloadController::OverloadController(int max_stage, int calm_updates)
+    : max_stage_(max_stage),
+      calm_updates_(calm_updates),
+      stage_(0),
+      num_calm_(0) {
+  CHECK_GT(max_stage_, 0);
+  CHECK_GT(calm_updates_, 0);
+}
+
+
+int OverloadController::Update(double load) {
+  int stage(stage_.load());
+  if (load >= 1) {
+    num_calm_ = 0;
+    if (stage < max_stage_) {
+      ++stage;
+    }
+  } else if (load < kCalmLoad && stage > 0) {
+    if (++num_calm_ >= calm_updates_) {
+      num_calm_ = 0;
+      --stage;
+    }
+  } else {
+    num_calm_ = 0;
+  }
+  stage_ = stage;
+  return stage;
+}
+
+
+}  // namespace util
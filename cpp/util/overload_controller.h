@@ -0,0 +1,46 @@
+#ifndef CERT_TRANS_UTIL_OVERLOAD_CONTROLLER_H_
+#define CERT_TRANS_UTIL_OVERLOAD_CONTROLLER_H_
+
+#include <atomic>
+
+#include "base/macros.h"
+
+namespace util {
+
+
+// Tracks how far a server should degrade what it does, in stages from
+// 0 (not degraded) to |max_stage|, from periodic reports of its load.
+// The load is the ratio of the worst of what is watched to its limit,
+// so that 1 or more means overloaded.
+//
+// Each overloaded update goes up one stage, so that the cheapest
+// measures are taken first. Once the load has stayed below half of
+// the limit for |calm_updates| updates in a row, it goes back down one
+// stage, and so on until it recovers completely. The gap between the
+// two keeps the stage from flapping.
+//
+// stage() can be called from any thread, Update() from one at a time.
+class OverloadController {
+ public:
+  OverloadController(int max_stage, int calm_updates);
+
+  // Returns the new stage.
+  int Update(double load);
+
+  int stage() const {
+    return stage_.load();
+  }
+
+ private:
+  const int max_stage_;
+  const int calm_updates_;
+  std::atomic<int> stage_;
+  int num_calm_;
+
+  DISALLOW_COPY_AND_ASSIGN(OverloadController);
+};
+
+
+}  // namespace util
+
+#endif  // CERT_TRANS_UTIL_OVERLOAD_CONTROLLER_H_
@@ -0,0 +1,61 @@
+#include <gtest/gtest.h>
+
+#include "util/overload_controller.h"
+#include "util/testing.h"
+
+using util::OverloadController;
+
+namespace {
+
+
+TEST(OverloadControllerTest, GoesUpOneStagePerOverloadedUpdate) {
+  OverloadController controller(3, 2);
+  EXPECT_EQ(0, controller.Update(0.9));
+  EXPECT_EQ(1, controller.Update(1));
+  EXPECT_EQ(2, controller.Update(5));
+  EXPECT_EQ(3, controller.Update(1.5));
+  EXPECT_EQ(3, controller.Update(2));
+  EXPECT_EQ(3, controller.stage());
+}
+
+
+TEST(OverloadControllerTest, RecoversAfterCalmUpdates) {
+  OverloadController controller(3, 2);
+  controller.Update(1);
+  controller.Update(1);
+  ASSERT_EQ(2, controller.stage());
+
+  // Under the limit, but not calm.
+  EXPECT_EQ(2, controller.Update(0.8));
+  EXPECT_EQ(2, controller.Update(0.8));
+
+  EXPECT_EQ(2, controller.Update(0.1));
+  EXPECT_EQ(1, controller.Update(0.1));
+  // A load that isn't calm starts the count again.
+  EXPECT_EQ(1, controller.Update(0.1));
+  EXPECT_EQ(1, controller.Update(0.7));
+  EXPECT_EQ(1, controller.Update(0.1));
+  EXPECT_EQ(0, controller.Update(0.1));
+  EXPECT_EQ(0, controller.Update(0));
+}
+
+
+TEST(OverloadControllerTest, OverloadInterruptsRecovery) {
+  OverloadController controller(2, 3);
+  controller.Update(1);
+  controller.Update(0);
+  controller.Update(0);
+  EXPECT_EQ(2, controller.Update(1));
+  EXPECT_EQ(2, controller.Update(0));
+  EXPECT_EQ(2, controller.Update(0));
+  EXPECT_EQ(1, controller.Update(0));
+}
+
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
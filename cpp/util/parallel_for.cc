@@ -0,0 +1,84 @@
+#include "util/parallel_for.h"
+
+#include <algorithm>
+#include <atomic>
+#include <glog/logging.h>
+#include <memory>
+
+#include "base/macros.h"
+#include "base/notification.h"
+#include "util/executor.h"
+
+using cert_trans::Notification;
+using std::atomic;
+using std::function;
+using std::make_shared;
+using std::min;
+using std::shared_ptr;
+
+namespace util {
+
+namespace {
+
+
+class ParallelLoop {
+ public:
+  ParallelLoop(size_t count, const function<void(size_t)>& process)
+      : count_(count), process_(process), next_(0), done_(0) {
+  }
+
+  void Run() {
+    for (size_t i = next_++; i < count_; i = next_++) {
+      process_(i);
+      if (++done_ == count_) {
+        all_done_.Notify();
+      }
+    }
+  }
+
+  void Wait() {
+    all_done_.WaitForNotification();
+  }
+
+ private:
+  const size_t count_;
+  const function<void(size_t)> process_;
+  atomic<size_t> next_;
+  atomic<size_t> done_;
+  Notification all_done_;
+
+  DISALLOW_COPY_AND_ASSIGN(ParallelLoop);
+};
+
+
+}  // namespace
+
+
+void ParallelFor(size_t count, size_t max_parallelism, Executor* executor,
+                 const function<void(size_t)>& process) {
+  CHECK_GT(max_parallelism, static_cast<size_t>(0));
+  if (count == 0) {
+    return;
+  }
+  if (!executor || count == 1 || max_parallelism == 1) {
+    for (size_t i = 0; i < count; ++i) {
+      process(i);
+    }
+    return;
+  }
+
+  // The closures might only run after we're done, so they share the
+  // loop with us. They never call |process| then, as there are no
+  // indices left.
+  const shared_ptr<ParallelLoop> loop(
+      make_shared<ParallelLoop>(count, process));
+  const size_t num_helpers(min(count, max_parallelism) - 1);
+  for (size_t i = 0; i < num_helpers; ++i) {
+    executor->Add([loop]() { loop->Run(); });
+  }
+  loop->Run();
+  loop->Wait();
+}
+
+
+}  // namespace util
@@ -0,0 +1,27 @@
+#ifndef CERT_TRANS_UTIL_PARALLEL_FOR_H_
+#define CERT_TRANS_UTIL_PARALLEL_FOR_H_
+
+#include <functional>
+#include <stddef.h>
+
+namespace util {
+
+class Executor;
+
+
+// Calls |process| with each index in [0, |count|), and returns once
+// they have all been processed. The calling thread and up to
+// |max_parallelism| - 1 closures added to |executor| each take the
+// next index until there are none left.
+//
+// As the calling thread works through the indices too, it doesn't
+// depend on the closures running soon (or at all), so |executor| can
+// be the one the caller runs on, even when it has no idle thread. If
+// |executor| is null, everything runs on the calling thread.
+void ParallelFor(size_t count, size_t max_parallelism, Executor* executor,
+                 const std::function<void(size_t)>& process);
+
+
+}  // namespace util
+
+#endif  // CERT_TRANS_UTIL_PARALLEL_FOR_H_
@@ -0,0 +1,104 @@
+#include <atomic>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "base/notification.h"
+#include "util/parallel_for.h"
+#include "util/testing.h"
+#include "util/thread_pool.h"
+
+using cert_trans::Notification;
+using cert_trans::ThreadPool;
+using std::atomic;
+using std::lock_guard;
+using std::mutex;
+using std::set;
+using std::thread;
+using std::vector;
+using util::ParallelFor;
+
+namespace {
+
+
+// The pool drops whatever is still queued when it goes away, which
+// might include helpers that had nothing left to do.
+void Drain(ThreadPool* pool) {
+  Notification drained;
+  pool->Add([&drained]() { drained.Notify(); });
+  drained.WaitForNotification();
+}
+
+
+TEST(ParallelForTest, ProcessesEachIndexOnce) {
+  ThreadPool pool(4);
+  vector<atomic<int>> calls(1000);
+  for (auto& count : calls) {
+    count = 0;
+  }
+
+  ParallelFor(calls.size(), 8, &pool, [&calls](size_t i) { ++calls[i]; });
+  Drain(&pool);
+
+  for (size_t i = 0; i < calls.size(); ++i) {
+    EXPECT_EQ(1, calls[i]) << i;
+  }
+}
+
+
+TEST(ParallelForTest, UsesSeveralThreads) {
+  ThreadPool pool(3);
+  mutex lock;
+  set<thread::id> threads;
+  // Keep the first indices busy until a second thread shows up.
+  Notification second_thread;
+
+  ParallelFor(100, 4, &pool, [&](size_t i) {
+    {
+      lock_guard<mutex> guard(lock);
+      threads.insert(std::this_thread::get_id());
+      if (threads.size() > 1 && !second_thread.HasBeenNotified()) {
+        second_thread.Notify();
+      }
+    }
+    if (i == 0) {
+      second_thread.WaitForNotification();
+    }
+  });
+
+  Drain(&pool);
+  EXPECT_GT(threads.size(), 1U);
+}
+
+
+TEST(ParallelForTest, DoesNotNeedAnIdleExecutor) {
+  ThreadPool pool(1);
+  Notification release;
+  // Occupy the only thread of the pool.
+  pool.Add([&release]() { release.WaitForNotification(); });
+
+  int calls(0);
+  ParallelFor(10, 4, &pool, [&calls](size_t) { ++calls; });
+  EXPECT_EQ(10, calls);
+
+  release.Notify();
+  Drain(&pool);
+}
+
+
+TEST(ParallelForTest, NoExecutor) {
+  vector<size_t> order;
+  ParallelFor(5, 4, nullptr, [&order](size_t i) { order.push_back(i); });
+  EXPECT_EQ((vector<size_t>{0, 1, 2, 3, 4}), order);
+}
+
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -7,8 +7,10 @@
 namespace cert_trans {
 
 using google::protobuf::MessageLite;
+using google::protobuf::io::CodedInputStream;
 using google::protobuf::io::CodedOutputStream;
 using google::protobuf::io::OstreamOutputStream;
+using google::protobuf::io::ZeroCopyInputStream;
 using google::protobuf::io::ZeroCopyOutputStream;
 
 
@@ -48,4 +50,40 @@ bool WriteDelimitedToOstream(const MessageLite& message, std::ostream* os) {
 }
 
 
+bool ReadDelimitedFrom(ZeroCopyInputStream* rawInput, MessageLite* message,
+                       bool* clean_eof) {
+  // We create a new coded stream for each message.  Don't worry, this is fast,
+  // and it makes sure the 64MB total size limit is imposed per-message rather
+  // than on the whole stream.
+  CodedInputStream input(rawInput);
+
+  // Read the size.
+  if (clean_eof) {
+    *clean_eof = false;
+  }
+  const int start(input.CurrentPosition());
+  uint32_t size;
+  if (!input.ReadVarint32(&size)) {
+    if (clean_eof) {
+      *clean_eof = input.CurrentPosition() == start;
+    }
+    return false;
+  }
+
+  // Tell the stream not to read beyond that size.
+  const CodedInputStream::Limit limit(input.PushLimit(size));
+
+  // Parse the message.
+  if (!message->ParseFromCodedStream(&input) ||
+      !input.ConsumedEntireMessage()) {
+    return false;
+  }
+
+  // Release the limit.
+  input.PopLimit(limit);
+
+  return true;
+}
+
+
 }  // namespace cert_trans
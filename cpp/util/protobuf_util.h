@@ -6,6 +6,7 @@
 namespace google {
 namespace protobuf {
 namespace io {
+class ZeroCopyInputStream;
 class ZeroCopyOutputStream;
 }  // namespace io
 
@@ -29,6 +30,14 @@ bool WriteDelimitedToOstream(const google::protobuf::MessageLite& message,
                              std::ostream* os);
 
 
+// The reverse of WriteDelimitedTo(), from the same source. Returns
+// false at the end of |rawInput| (setting |clean_eof|, if not null,
+// when it was between two messages), or on a parse error.
+bool ReadDelimitedFrom(google::protobuf::io::ZeroCopyInputStream* rawInput,
+                       google::protobuf::MessageLite* message,
+                       bool* clean_eof);
+
+
 }  // namespace cert_trans
 
 
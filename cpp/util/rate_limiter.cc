@@ -0,0 +1,67 @@
+#include "util/rate_limiter.h"
+
+#include <algorithm>
+#include <glog/logging.h>
+#include <utility>
+
+using std::chrono::duration;
+using std::chrono::duration_cast;
+using std::lock_guard;
+using std::min;
+using std::mutex;
+using std::string;
+
+namespace util {
+
+
+RateLimiter::RateLimiter(double rate, double burst, size_t max_keys)
+    : rate_(rate), burst_(burst), max_keys_(max_keys) {
+  CHECK_GT(rate_, 0);
+  CHECK_GE(burst_, 1);
+  CHECK_GT(max_keys_, 0U);
+}
+
+
+bool RateLimiter::Admit(const string& key, const Clock::time_point& now,
+                        Clock::duration* retry_after) {
+  lock_guard<mutex> lock(lock_);
+  const auto it(index_.find(key));
+  if (it == index_.end()) {
+    buckets_.emplace_front(key, Bucket{burst_, now});
+    index_.emplace(key, buckets_.begin());
+    if (buckets_.size() > max_keys_) {
+      index_.erase(buckets_.back().first);
+      buckets_.pop_back();
+    }
+  } else {
+    buckets_.splice(buckets_.begin(), buckets_, it->second);
+  }
+
+  Bucket* const bucket(&buckets_.front().second);
+  if (now > bucket->last_refill) {
+    bucket->tokens =
+        min(burst_, bucket->tokens +
+                        rate_ * duration<double>(now - bucket->last_refill)
+                                    .count());
+    bucket->last_refill = now;
+  }
+  if (bucket->tokens < 1) {
+    if (retry_after) {
+      *retry_after = duration_cast<Clock::duration>(
+          duration<double>((1 - bucket->tokens) / rate_));
+    }
+    return false;
+  }
+
+  bucket->tokens -= 1;
+  return true;
+}
+
+
+size_t RateLimiter::NumKeys() const {
+  lock_guard<mutex> lock(lock_);
+  return buckets_.size();
+}
+
+
+}  // namespace util
@@ -0,0 +1,60 @@
+#ifndef CERT_TRANS_UTIL_RATE_LIMITER_H_
+#define CERT_TRANS_UTIL_RATE_LIMITER_H_
+
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <stddef.h>
+#include <string>
+#include <unordered_map>
+
+#include "base/macros.h"
+
+namespace util {
+
+
+// A token bucket for each key (a client, for example), all with the
+// same fixed rate. Only the most recently seen keys are remembered, so
+// that the memory used is bounded; a key that was forgotten starts
+// again with a full bucket.
+//
+// This class is thread-safe.
+class RateLimiter {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  // Each key is allowed |rate| requests per second, in bursts of up to
+  // |burst| requests, for the |max_keys| most recent keys.
+  RateLimiter(double rate, double burst, size_t max_keys);
+
+  // Returns true if a request for |key| arriving at |now| should be
+  // let through. Otherwise, sets |retry_after| (if not null) to how
+  // long until the next one would be.
+  bool Admit(const std::string& key, const Clock::time_point& now,
+             Clock::duration* retry_after);
+
+  size_t NumKeys() const;
+
+ private:
+  struct Bucket {
+    double tokens;
+    Clock::time_point last_refill;
+  };
+  typedef std::list<std::pair<std::string, Bucket>> BucketList;
+
+  const double rate_;
+  const double burst_;
+  const size_t max_keys_;
+
+  mutable std::mutex lock_;
+  // Most recently used first.
+  BucketList buckets_;
+  std::unordered_map<std::string, BucketList::iterator> index_;
+
+  DISALLOW_COPY_AND_ASSIGN(RateLimiter);
+};
+
+
+}  // namespace util
+
+#endif  // CERT_TRANS_UTIL_RATE_LIMITER_H_
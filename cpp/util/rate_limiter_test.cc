@@ -0,0 +1,81 @@
+#include <chrono>
+#include <gtest/gtest.h>
+
+#include "util/rate_limiter.h"
+#include "util/testing.h"
+
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+using util::RateLimiter;
+
+namespace {
+
+
+class RateLimiterTest : public ::testing::Test {
+ protected:
+  RateLimiterTest() : now_(RateLimiter::Clock::now()), limiter_(10, 5, 3) {
+  }
+
+  // Returns how many of |num| requests for |key| at |now_| were let
+  // through.
+  int Send(const char* key, int num) {
+    int admitted(0);
+    for (int i = 0; i < num; ++i) {
+      if (limiter_.Admit(key, now_, nullptr)) {
+        ++admitted;
+      }
+    }
+    return admitted;
+  }
+
+  RateLimiter::Clock::time_point now_;
+  RateLimiter limiter_;
+};
+
+
+TEST_F(RateLimiterTest, AllowsBurstsThenTheRate) {
+  EXPECT_EQ(5, Send("a", 10));
+
+  RateLimiter::Clock::duration retry_after;
+  EXPECT_FALSE(limiter_.Admit("a", now_, &retry_after));
+  EXPECT_NEAR(100, duration_cast<milliseconds>(retry_after).count(), 1);
+
+  now_ += milliseconds(500);
+  EXPECT_EQ(5, Send("a", 10));
+
+  // It doesn't save up more than a burst.
+  now_ += seconds(60);
+  EXPECT_EQ(5, Send("a", 10));
+}
+
+
+TEST_F(RateLimiterTest, KeysHaveTheirOwnBucket) {
+  EXPECT_EQ(5, Send("a", 10));
+  EXPECT_EQ(5, Send("b", 10));
+  EXPECT_EQ(0, Send("a", 1));
+}
+
+
+TEST_F(RateLimiterTest, ForgetsLeastRecentlySeenKeys) {
+  EXPECT_EQ(5, Send("a", 5));
+  EXPECT_EQ(5, Send("b", 5));
+  EXPECT_EQ(5, Send("c", 5));
+  EXPECT_EQ(0, Send("a", 1));
+  EXPECT_EQ(3U, limiter_.NumKeys());
+
+  // "b" is forgotten, as "a" was just seen.
+  EXPECT_EQ(5, Send("d", 5));
+  EXPECT_EQ(3U, limiter_.NumKeys());
+  EXPECT_EQ(0, Send("a", 1));
+  EXPECT_EQ(5, Send("b", 5));
+}
+
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
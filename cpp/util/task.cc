@@ -5,13 +5,13 @@
 using std::bind;
 using std::function;
 using std::lock_guard;
-using std::make_shared;
+using std::move;
 using std::mutex;
 using std::ostream;
 using std::placeholders::_1;
-using std::shared_ptr;
 using std::unique_lock;
 using std::vector;
+using util::Closure;
 
 namespace util {
 
@@ -19,22 +19,26 @@ namespace util {
 Task::Task(const function<void(Task*)>& done_callback, Executor* executor)
     : done_callback_(done_callback),
       executor_(CHECK_NOTNULL(executor)),
-      state_(ACTIVE),
+      state_and_holds_(ACTIVE),
       cancelled_(false),
-      holds_(0) {
+      refs_(1),
+      first_child_(nullptr),
+      prev_sibling_(nullptr),
+      next_sibling_(nullptr) {
 }
 
 
 Task::~Task() {
-  CHECK_EQ(state_, DONE);
+  CHECK_EQ(state(), DONE);
   CHECK(cancel_callbacks_.empty());
+  CHECK(!first_child_);
 }
 
 
 void Task::Cancel() {
   unique_lock<mutex> lock(lock_);
 
-  if (state_ == DONE || cancelled_) {
+  if (state() == DONE || cancelled_) {
     return;
   }
 
@@ -45,14 +49,16 @@ void Task::Cancel() {
 
   // Add a hold for each cancellation callback, so that we do not go
   // into the DONE state until they all have completed.
-  holds_ += cancel_callbacks.size();
+  if (!cancel_callbacks.empty()) {
+    AddHolds(cancel_callbacks.size());
+  }
 
-  // Take a copy of the child tasks before giving back the lock. Since
-  // these are shared_ptrs, having a copy will protect us in case some
-  // of them complete and get removed (which will free them). Any
-  // child tasks created after giving back the lock will be already
-  // cancelled, so no need to cancel them here.
-  const vector<shared_ptr<Task>> child_tasks(child_tasks_);
+  // Take a reference on the child tasks before giving back the
+  // lock. This will protect us in case some of them complete and get
+  // removed (which would free them). Any child tasks created after
+  // giving back the lock will be already cancelled, so no need to
+  // cancel them here.
+  const vector<Task*> child_tasks(RefChildrenLocked());
 
   // Give up the lock, in case the executor is synchronous.
   lock.unlock();
@@ -60,16 +66,16 @@ void Task::Cancel() {
   for (const auto& child_task : child_tasks) {
     child_task->Cancel();
   }
+  UnrefChildren(child_tasks);
 
-  for (const auto& cb : cancel_callbacks) {
-    executor_->Add(bind(&Task::RunCancelCallback, this, cb));
+  for (auto& cb : cancel_callbacks) {
+    executor_->Add(Closure(bind(&Task::RunCancelCallback, this, move(cb))));
   }
 }
 
 
 Status Task::status() const {
-  lock_guard<mutex> lock(lock_);
-  CHECK_NE(state_, ACTIVE);
+  CHECK_NE(state(), ACTIVE);
   return status_;
 }
 
@@ -77,71 +83,80 @@ Status Task::status() const {
 bool Task::Return(const Status& status) {
   unique_lock<mutex> lock(lock_);
 
-  if (state_ != ACTIVE) {
+  // Only Return() leaves the ACTIVE state, and always with |lock_|
+  // held.
+  if (state() != ACTIVE) {
     return false;
   }
 
   status_ = status;
-  state_ = PREPARED;
   cancel_callbacks_.clear();
 
-  // Take a copy of the child tasks, so we can still access it after
-  // calling TryDoneTransition(). See Task::Cancel() for more
-  // explanation.
-  const vector<shared_ptr<Task>> child_tasks(child_tasks_);
+  // Take a reference on the child tasks, so we can still access them
+  // after the state changes. See Task::Cancel() for more explanation.
+  const vector<Task*> child_tasks(RefChildrenLocked());
 
-  // Do not touch any members after this, as the task object might be
-  // deleted by the time this method returns.
-  TryDoneTransition(&lock);
+  int64_t old_value(state_and_holds_.load());
+  int64_t new_value;
+  do {
+    new_value = (old_value & ~kStateMask) == 0
+                    ? DONE
+                    : (old_value & ~kStateMask) | PREPARED;
+  } while (!state_and_holds_.compare_exchange_weak(old_value, new_value));
 
-  // If we still have the lock (we are not in the DONE state yet),
-  // give it up.
-  if (lock.owns_lock()) {
-    lock.unlock();
+  lock.unlock();
+
+  if (new_value == DONE) {
+    // Each child task has a hold, so there are none to cancel. Do not
+    // touch any members after this, as the task object might be
+    // deleted by the time this method returns.
+    Done();
+    return true;
   }
 
   for (const auto& child_task : child_tasks) {
     child_task->Cancel();
   }
+  UnrefChildren(child_tasks);
 
   return true;
 }
 
 
 void Task::AddHold() {
-  lock_guard<mutex> lock(lock_);
-  CHECK_NE(state_, DONE);
-  ++holds_;
+  AddHolds(1);
 }
 
 
 void Task::RemoveHold() {
-  unique_lock<mutex> lock(lock_);
-
-  CHECK_GT(holds_, 0);
-  CHECK_NE(state_, DONE);
-  --holds_;
-
-  // Do not touch any members after this, as the task object might be
-  // deleted by the time this method returns.
-  TryDoneTransition(&lock);
+  int64_t old_value(state_and_holds_.load());
+  int64_t new_value;
+  do {
+    CHECK_GT(old_value >> kStateBits, 0);
+    CHECK_NE(old_value & kStateMask, DONE);
+    new_value = old_value == (kOneHold | PREPARED) ? DONE
+                                                   : old_value - kOneHold;
+  } while (!state_and_holds_.compare_exchange_weak(old_value, new_value));
+
+  if (new_value == DONE) {
+    // Do not touch any members after this, as the task object might
+    // be deleted by the time this method returns.
+    Done();
+  }
 }
 
 
 bool Task::IsActive() const {
-  lock_guard<mutex> lock(lock_);
-  return state_ == ACTIVE;
+  return state() == ACTIVE;
 }
 
 
 bool Task::IsDone() const {
-  lock_guard<mutex> lock(lock_);
-  return state_ == DONE;
+  return state() == DONE;
 }
 
 
 bool Task::CancelRequested() const {
-  lock_guard<mutex> lock(lock_);
   return cancelled_;
 }
 
@@ -149,78 +164,95 @@ bool Task::CancelRequested() const {
 void Task::WhenCancelled(const std::function<void()>& cancel_cb) {
   unique_lock<mutex> lock(lock_);
 
-  if (state_ != ACTIVE) {
+  if (state() != ACTIVE) {
     return;
   }
 
   if (!cancelled_) {
     cancel_callbacks_.emplace_back(cancel_cb);
   } else {
-    ++holds_;
+    AddHolds(1);
 
     // Give up the lock, in case the executor is synchronous.
     lock.unlock();
-    executor_->Add(bind(&Task::RunCancelCallback, this, cancel_cb));
+    executor_->Add(Closure(bind(&Task::RunCancelCallback, this, cancel_cb)));
   }
 }
 
 
 Task* Task::AddChildWithExecutor(const function<void(Task*)>& done_callback,
                                  Executor* executor) {
-  const shared_ptr<Task> child_task(make_shared<Task>(
-      bind(&Task::RunChildDoneCallback, this, done_callback, _1),
-      CHECK_NOTNULL(executor)));
+  Task* const child_task(
+      new Task(bind(&Task::RunChildDoneCallback, this, done_callback, _1),
+               CHECK_NOTNULL(executor)));
   bool cancel;
 
   {
     lock_guard<mutex> lock(lock_);
-    CHECK_NE(state_, DONE);
+    AddHolds(1);
 
-    child_tasks_.emplace_back(child_task);
-    ++holds_;
+    child_task->next_sibling_ = first_child_;
+    if (first_child_) {
+      first_child_->prev_sibling_ = child_task;
+    }
+    first_child_ = child_task;
 
-    cancel = state_ != ACTIVE || cancelled_;
+    cancel = state() != ACTIVE || cancelled_;
   }
 
   if (cancel) {
     child_task->Cancel();
   }
 
-  return child_task.get();
+  return child_task;
 }
 
 
 void Task::CleanupWhenDone(const function<void()>& cleanup_cb) {
   lock_guard<mutex> lock(lock_);
-  CHECK_NE(state_, DONE);
+  CHECK_NE(state(), DONE);
 
   cleanup_callbacks_.emplace_back(cleanup_cb);
 }
 
 
+void Task::AddHolds(int64_t num_holds) {
+  const int64_t old_value(state_and_holds_.fetch_add(num_holds * kOneHold));
+  CHECK_NE(old_value & kStateMask, DONE);
+}
+
+
 // After calling this method, the task object might have become
-// invalid, if the transition to DONE worked, as the done callback is
-// allowed to delete it. So make sure not to use any more member
-// variables after calling this.
-//
-// It will also release "*lock", if that transition succeeds.
-void Task::TryDoneTransition(unique_lock<mutex>* lock) {
-  CHECK(lock->owns_lock());
-  CHECK_NE(state_, DONE);
-
-  if (state_ != PREPARED || holds_ > 0) {
-    return;
+// invalid, as the done callback is allowed to delete it. So make sure
+// not to use any more member variables after calling this.
+void Task::Done() {
+  // Once this is called, the task might get deleted.
+  executor_->Add(Closure(bind(&Task::RunCleanupAndDoneCallbacks, this)));
+}
+
+
+vector<Task*> Task::RefChildrenLocked() const {
+  vector<Task*> children;
+  for (Task* child = first_child_; child; child = child->next_sibling_) {
+    ++child->refs_;
+    children.push_back(child);
   }
+  return children;
+}
 
-  state_ = DONE;
 
-  // Give up the lock, as the callback is allowed to delete us. We
-  // also do not want to cause a deadlock, in the possibility that the
-  // executor is synchronous.
-  lock->unlock();
+// static
+void Task::UnrefChildren(const vector<Task*>& children) {
+  for (const auto& child : children) {
+    child->Unref();
+  }
+}
 
-  // Once this is called, the task might get deleted.
-  executor_->Add(bind(&Task::RunCleanupAndDoneCallbacks, this));
+
+void Task::Unref() {
+  if (--refs_ == 0) {
+    delete this;
+  }
 }
 
 
@@ -256,24 +288,28 @@ void Task::RunChildDoneCallback(const function<void(Task*)>& done_callback,
                                 Task* child_task) {
   done_callback(child_task);
 
-  unique_lock<mutex> lock(lock_);
-  vector<shared_ptr<Task>>::iterator it;
-  for (it = child_tasks_.begin(); it != child_tasks_.end(); ++it) {
-    if (it->get() == child_task) {
-      break;
+  {
+    lock_guard<mutex> lock(lock_);
+    if (child_task->prev_sibling_) {
+      child_task->prev_sibling_->next_sibling_ = child_task->next_sibling_;
+    } else {
+      CHECK_EQ(first_child_, child_task);
+      first_child_ = child_task->next_sibling_;
+    }
+    if (child_task->next_sibling_) {
+      child_task->next_sibling_->prev_sibling_ = child_task->prev_sibling_;
     }
+    child_task->prev_sibling_ = nullptr;
+    child_task->next_sibling_ = nullptr;
   }
 
-  CHECK(it != child_tasks_.end());
-  CHECK_GT(holds_, 0);
-  CHECK_NE(state_, DONE);
-
-  child_tasks_.erase(it);
-  --holds_;
+  // This may delete the child task, whose done callback this is, but
+  // it does not touch any of its members after calling us.
+  child_task->Unref();
 
   // Do not touch any members after this, as the task object might be
   // deleted by the time this method returns.
-  TryDoneTransition(&lock);
+  RemoveHold();
 }
 
 
@@ -22,9 +22,11 @@
 #ifndef CERT_TRANS_UTIL_TASK_H_
 #define CERT_TRANS_UTIL_TASK_H_
 
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <stdint.h>
 #include <vector>
 
 #include "base/macros.h"
@@ -162,7 +164,24 @@ class Task {
     DONE = 2,
   };
 
-  void TryDoneTransition(std::unique_lock<std::mutex>* lock);
+  // The state is kept in the low bits of |state_and_holds_|, and the
+  // number of holds above them, so that holds can be added and removed
+  // (and the DONE transition made) without taking |lock_|.
+  static const int kStateBits = 2;
+  static const int64_t kStateMask = (1 << kStateBits) - 1;
+  static const int64_t kOneHold = 1 << kStateBits;
+
+  State state() const {
+    return static_cast<State>(state_and_holds_.load() & kStateMask);
+  }
+  void AddHolds(int64_t num_holds);
+  // Runs the cleanup and done callbacks on the executor.
+  void Done();
+  // Takes a reference on each child, to be released with
+  // UnrefChildren(). Must be called with |lock_| held.
+  std::vector<Task*> RefChildrenLocked() const;
+  static void UnrefChildren(const std::vector<Task*>& children);
+  void Unref();
   void RunCancelCallback(const std::function<void()>& cb);
   void RunCleanupAndDoneCallbacks();
   void RunChildDoneCallback(const std::function<void(Task*)>& done_callback,
@@ -172,13 +191,19 @@ class Task {
   Executor* const executor_;
 
   mutable std::mutex lock_;
-  State state_;
-  Status status_;  // not protected by lock_
-  bool cancelled_;
-  int holds_;
-  // References to child tasks are kept as shared pointers to avoid
-  // some races.
-  std::vector<std::shared_ptr<Task>> child_tasks_;
+  std::atomic<int64_t> state_and_holds_;
+  Status status_;  // not protected by lock_, set before PREPARED
+  std::atomic<bool> cancelled_;
+  // Child tasks are freed once their done callback has run and no
+  // Cancel() or Return() of the parent still refers to them, which
+  // avoids some races. The parent holds one reference.
+  mutable std::atomic<int> refs_;
+  // The child tasks form a doubly linked list, through their
+  // |prev_sibling_| and |next_sibling_|, which are protected by the
+  // parent's |lock_|.
+  Task* first_child_;
+  Task* prev_sibling_;
+  Task* next_sibling_;
   std::vector<std::function<void()>> cancel_callbacks_;
   std::vector<std::function<void()>> cleanup_callbacks_;
 
@@ -145,7 +145,7 @@ TEST_F(TaskDeathTest, DestroyIncompleteTask) {
   InlineExecutor executor;
 
   EXPECT_DEATH(util::Task(DoNothing, &executor),
-               "Check failed: state_ == DONE");
+               "Check failed: state\\(\\) == DONE");
 }
 
 
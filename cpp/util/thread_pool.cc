@@ -1,135 +1,394 @@
+#include "config.h"
 #include "util/thread_pool.h"
 #include "util/task.h"
 
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
 #include <glog/logging.h>
+#include <deque>
 #include <mutex>
 #include <queue>
+#include <stdint.h>
+#include <string>
 #include <thread>
 #include <vector>
 
+#include "monitoring/monitoring.h"
+#include "util/cpu_affinity.h"
+
+using std::atomic;
 using std::chrono::duration;
 using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
 using std::chrono::seconds;
 using std::chrono::steady_clock;
 using std::condition_variable;
+using std::deque;
 using std::function;
-using std::get;
 using std::lock_guard;
+using std::max;
+using std::move;
 using std::mutex;
 using std::priority_queue;
+using std::string;
 using std::thread;
-using std::tuple;
 using std::unique_lock;
+using std::unique_ptr;
 using std::vector;
+using util::Closure;
 
 namespace cert_trans {
 namespace {
 
-typedef tuple<steady_clock::time_point, function<void()>, util::Task*>
-    QueueEntry;
+typedef std::pair<steady_clock::time_point, util::Task*> DelayedEntry;
 
 
-struct QueueOrdering {
-  bool operator()(const QueueEntry& lhs, const QueueEntry& rhs) const {
-    return get<0>(lhs) > get<0>(rhs);
+struct DelayedOrdering {
+  bool operator()(const DelayedEntry& lhs, const DelayedEntry& rhs) const {
+    return lhs.first > rhs.first;
   }
 };
 
 
+// How many times an idle thread looks for work to steal before
+// parking itself.
+const int kIdleSpins = 16;
+
+
+static Gauge<string>* thread_pool_queued(
+    Gauge<string>::New("thread_pool_queued", "pool",
+                       "Number of closures waiting for a thread, by pool."));
+
+static Gauge<string>* thread_pool_busy_threads(
+    Gauge<string>::New("thread_pool_busy_threads", "pool",
+                       "Number of threads running a closure, by pool."));
+
+static Histogram<string>* thread_pool_wait_seconds(Histogram<string>::New(
+    "thread_pool_wait_seconds", "pool",
+    "Time closures waited for a thread, in seconds, by pool.",
+    ExponentialBucketBounds(1e-6, 4, 14)));
+
+static Histogram<string>* thread_pool_run_seconds(Histogram<string>::New(
+    "thread_pool_run_seconds", "pool",
+    "Time closures took to run, in seconds, by pool.",
+    ExponentialBucketBounds(1e-6, 4, 14)));
+
+
 }  // namespace
 
 
 class ThreadPool::Impl {
  public:
+  struct QueuedClosure {
+    steady_clock::time_point queued_at;
+    Closure closure;
+  };
+
+  // The closures queued for one thread. It runs them from the front,
+  // and the other threads steal from the back when they run out.
+  struct WorkerQueue {
+    WorkerQueue() : busy_ns_(0) {
+    }
+
+    mutex lock_;
+    deque<QueuedClosure> queue_;
+    // The time the thread has spent running closures.
+    atomic<int64_t> busy_ns_;
+  };
+
+  // The metric cells of a named pool.
+  struct Metrics {
+    explicit Metrics(const string& name)
+        : queued(thread_pool_queued->GetHandle(name)),
+          busy_threads(thread_pool_busy_threads->GetHandle(name)),
+          wait_seconds(thread_pool_wait_seconds->GetHandle(name)),
+          run_seconds(thread_pool_run_seconds->GetHandle(name)) {
+    }
+
+    Gauge<string>::Handle queued;
+    Gauge<string>::Handle busy_threads;
+    Histogram<string>::Handle wait_seconds;
+    Histogram<string>::Handle run_seconds;
+  };
+
+  explicit Impl(const string& name)
+      : name_(name),
+        metrics_(name.empty() ? nullptr : new Metrics(name)),
+        next_queue_(0),
+        num_queued_(0),
+        num_busy_(0),
+        num_parked_(0),
+        timer_waiter_(false),
+        exiting_(false),
+        next_due_(steady_clock::time_point::max().time_since_epoch().count()) {
+  }
   ~Impl();
 
-  void Worker();
+  void Worker(size_t index);
+
+  // Queues |closure| on the current thread's queue if it is one of
+  // ours, or on the next one in turn otherwise, and wakes up a thread
+  // if needed.
+  void Push(Closure&& closure);
+
+  // Takes a closure from the queue of thread |index|, or steals one
+  // from another thread. Returns false if there were none.
+  bool Take(size_t index, QueuedClosure* closure);
+
+  // Updates the gauges with the new values of |num_queued_| or
+  // |num_busy_|. The threads don't update them in the same order as
+  // the counts, so they can be a bit off until the next update.
+  void SetQueued(int queued) {
+    if (metrics_) {
+      metrics_->queued.Set(queued);
+    }
+  }
+  void SetBusy(int busy) {
+    if (metrics_) {
+      metrics_->busy_threads.Set(busy);
+    }
+  }
+
+  // Moves the delayed tasks that are due to the queues. Must be called
+  // with |park_lock_| held.
+  void MoveDueTasks();
 
+  // Sets |next_due_| from |delayed_|. Must be called with |park_lock_|
+  // held, whenever |delayed_| changes.
+  void UpdateNextDue() {
+    next_due_ = delayed_.empty()
+                    ? steady_clock::time_point::max().time_since_epoch().count()
+                    : delayed_.top().first.time_since_epoch().count();
+  }
+
+  const string name_;
+  // Null if the pool has no name.
+  const unique_ptr<Metrics> metrics_;
   // TODO(pphaneuf): I'd like this to be const, but it required
   // jumping through a few more hoops, keeping it simple for now.
   vector<thread> threads_;
-
-  mutex queue_lock_;
-  condition_variable queue_cond_var_;
-  priority_queue<QueueEntry, vector<QueueEntry>, QueueOrdering> queue_;
+  vector<unique_ptr<WorkerQueue>> queues_;
+  atomic<size_t> next_queue_;
+  // The number of closures in all of |queues_|.
+  atomic<int> num_queued_;
+  // The number of threads running a closure.
+  atomic<int> num_busy_;
+
+  mutex park_lock_;
+  // Idle threads wait on this, except for at most one of them, which
+  // waits on |timer_cond_var_| for the next delayed task to be due.
+  // That way, they don't all wake up at once for each delayed task.
+  condition_variable park_cond_var_;
+  condition_variable timer_cond_var_;
+  atomic<int> num_parked_;
+  atomic<bool> timer_waiter_;
+  bool exiting_;
+  priority_queue<DelayedEntry, vector<DelayedEntry>, DelayedOrdering>
+      delayed_;
+  // When the first of |delayed_| is due, so that the threads which
+  // keep finding work can check it without taking |park_lock_|.
+  atomic<steady_clock::rep> next_due_;
 };
 
 
+namespace {
+
+
+// The pool (its Impl) and queue of the worker running on this
+// thread, if any.
+#ifdef HAVE_THREAD_LOCAL
+thread_local const void* current_pool = nullptr;
+thread_local size_t current_queue = 0;
+#elif HAVE___THREAD
+__thread const void* current_pool = nullptr;
+__thread size_t current_queue = 0;
+#else
+#error No suitable thread local storage available
+#endif
+
+
+}  // namespace
+
+
 ThreadPool::Impl::~Impl() {
-  // Start by sending an empty closure to every thread (and notify
-  // them), to have them exit cleanly.
   {
-    lock_guard<mutex> lock(queue_lock_);
-    for (int i = threads_.size(); i > 0; --i)
-      queue_.emplace(
-          make_tuple(steady_clock::time_point(), function<void()>(), nullptr));
+    lock_guard<mutex> lock(park_lock_);
+    exiting_ = true;
   }
-  // Notify all the threads *after* adding all the empty closures, to
-  // avoid any races.
-  queue_cond_var_.notify_all();
+  park_cond_var_.notify_all();
+  timer_cond_var_.notify_all();
 
   // Wait for the threads to exit.
   for (auto& thread : threads_) {
     thread.join();
   }
 
-  // Workers should've drained everything from the queue.
-  CHECK(queue_.empty());
+  // Workers should've drained everything from the queues.
+  for (const auto& queue : queues_) {
+    CHECK(queue->queue_.empty());
+  }
 }
 
 
-void ThreadPool::Impl::Worker() {
-  while (true) {
-    QueueEntry entry;
+void ThreadPool::Impl::Push(Closure&& closure) {
+  const size_t index(current_pool == this
+                         ? current_queue
+                         : next_queue_++ % queues_.size());
+  {
+    lock_guard<mutex> lock(queues_[index]->lock_);
+    queues_[index]->queue_.push_back(
+        QueuedClosure{steady_clock::now(), move(closure)});
+  }
+  SetQueued(++num_queued_);
+
+  // Parking threads check |num_queued_| after announcing themselves,
+  // so either they see the closure, or we see them.
+  if (num_parked_.load() > 0) {
+    lock_guard<mutex> lock(park_lock_);
+    park_cond_var_.notify_one();
+  } else if (timer_waiter_.load()) {
+    lock_guard<mutex> lock(park_lock_);
+    timer_cond_var_.notify_one();
+  }
+}
+
+
+bool ThreadPool::Impl::Take(size_t index, QueuedClosure* closure) {
+  if (num_queued_.load() == 0) {
+    return false;
+  }
+
+  for (size_t i = 0; i < queues_.size(); ++i) {
+    WorkerQueue* const queue(queues_[(index + i) % queues_.size()].get());
+    lock_guard<mutex> lock(queue->lock_);
+    if (queue->queue_.empty()) {
+      continue;
+    }
+    if (i == 0) {
+      *closure = move(queue->queue_.front());
+      queue->queue_.pop_front();
+    } else {
+      *closure = move(queue->queue_.back());
+      queue->queue_.pop_back();
+    }
+    SetQueued(--num_queued_);
+    return true;
+  }
+
+  return false;
+}
+
 
+void ThreadPool::Impl::MoveDueTasks() {
+  const steady_clock::time_point now(steady_clock::now());
+  while (!delayed_.empty() && delayed_.top().first <= now) {
+    util::Task* const task(delayed_.top().second);
+    delayed_.pop();
+    const size_t index(next_queue_++ % queues_.size());
     {
-      unique_lock<mutex> lock(queue_lock_);
-      while (queue_.empty() || get<0>(queue_.top()) > steady_clock::now()) {
-        if (queue_.empty()) {
-          // If there's nothing to do, wait until there is.
-          queue_cond_var_.wait(lock);
-        } else {
-          // Otherwise, wait until the next thing we currently know about is
-          // ready.
-          const steady_clock::duration duration(get<0>(queue_.top()) -
-                                                steady_clock::now());
-          queue_cond_var_.wait_for(lock, duration);
+      lock_guard<mutex> lock(queues_[index]->lock_);
+      queues_[index]->queue_.push_back(
+          QueuedClosure{now, Closure([task]() { task->Return(); })});
+    }
+    SetQueued(++num_queued_);
+  }
+  UpdateNextDue();
+}
+
+
+void ThreadPool::Impl::Worker(size_t index) {
+  current_pool = this;
+  current_queue = index;
+
+  while (true) {
+    // The delayed tasks are queued behind what is already there, but a
+    // busy pool must still get to them.
+    if (steady_clock::now().time_since_epoch().count() >= next_due_.load()) {
+      lock_guard<mutex> lock(park_lock_);
+      MoveDueTasks();
+    }
+
+    QueuedClosure closure;
+    bool found(Take(index, &closure));
+    for (int spin = 0; !found && spin < kIdleSpins; ++spin) {
+      std::this_thread::yield();
+      found = Take(index, &closure);
+    }
+
+    if (!found) {
+      unique_lock<mutex> lock(park_lock_);
+      MoveDueTasks();
+      if (num_queued_.load() > 0) {
+        if (num_parked_.load() > 0) {
+          // There might be more than we can run, get some help.
+          park_cond_var_.notify_one();
         }
+        continue;
       }
 
-      entry = queue_.top();
-      queue_.pop();
-
-      // If we received an empty entry, exit cleanly.
-      if (!get<1>(entry)) {
-        // Anything left in the queue must be either other exit sentinels, or
-        // future (delayed) tasks, so we'll cancel anything we find, up until
-        // either the next exit sentinel, or the end of the queue.
+      if (exiting_) {
+        // Anything left is a future (delayed) task, so we cancel
+        // them all.
         VLOG(1) << "Cancelling delayed tasks...";
         vector<util::Task*> to_be_cancelled;
-        while (!queue_.empty() && get<2>(queue_.top())) {
-          to_be_cancelled.push_back(CHECK_NOTNULL(get<2>(queue_.top())));
-          queue_.pop();
+        while (!delayed_.empty()) {
+          to_be_cancelled.push_back(CHECK_NOTNULL(delayed_.top().second));
+          delayed_.pop();
         }
+        UpdateNextDue();
 
-        // Cancel the callbacks below outside of the lock to avoid deadlocking
-        // anyone who tries to Add() more stuff when they're cancelled.
-        // Anyone who does that is going to cause a CHECK fail in the d'tor of
-        // the pool anyway, but at least they'll know about it that way.
+        // Cancel the callbacks below outside of the lock to avoid
+        // deadlocking anyone who tries to Add() more stuff when
+        // they're cancelled. Anyone who does that is going to cause a
+        // CHECK fail in the d'tor of the pool anyway, but at least
+        // they'll know about it that way.
         lock.unlock();
 
         for (const auto& t : to_be_cancelled) {
           t->Return(util::Status::CANCELLED);
         }
 
-        VLOG(1) << "Cancelled " << to_be_cancelled.size() << " delayed tasks.";
+        VLOG(1) << "Cancelled " << to_be_cancelled.size()
+                << " delayed tasks.";
         return;
       }
+
+      if (!delayed_.empty() && !timer_waiter_.load()) {
+        // Wait until the next thing we currently know about is ready.
+        timer_waiter_ = true;
+        if (num_queued_.load() == 0) {
+          timer_cond_var_.wait_until(lock, delayed_.top().first);
+        }
+        timer_waiter_ = false;
+        if (!delayed_.empty() && num_parked_.load() > 0) {
+          // Someone else has to wait for the rest.
+          park_cond_var_.notify_one();
+        }
+      } else {
+        // If there's nothing to do, wait until there is.
+        ++num_parked_;
+        if (num_queued_.load() == 0) {
+          park_cond_var_.wait(lock);
+        }
+        --num_parked_;
+      }
+      continue;
     }
 
-    // Make sure not to hold the lock while calling the closure.
-    get<1>(entry)();
+    // Make sure not to hold any lock while calling the closure.
+    const steady_clock::time_point start(steady_clock::now());
+    SetBusy(++num_busy_);
+    closure.closure();
+    const steady_clock::time_point end(steady_clock::now());
+    SetBusy(--num_busy_);
+    queues_[index]->busy_ns_ +=
+        duration_cast<nanoseconds>(end - start).count();
+    if (metrics_) {
+      metrics_->wait_seconds.Record(
+          duration<double>(start - closure.queued_at).count());
+      metrics_->run_seconds.Record(duration<double>(end - start).count());
+    }
   }
 }
 
@@ -141,11 +400,21 @@ ThreadPool::ThreadPool()
 }
 
 
-ThreadPool::ThreadPool(size_t num_threads) : impl_(new Impl) {
+ThreadPool::ThreadPool(size_t num_threads) : ThreadPool(num_threads, "") {
+}
+
+
+ThreadPool::ThreadPool(size_t num_threads, const string& name)
+    : impl_(new Impl(name)) {
   CHECK_GT(num_threads, 0);
-  LOG(INFO) << "ThreadPool starting with " << num_threads << " threads";
-  for (int i = 0; i < static_cast<int64_t>(num_threads); ++i)
-    impl_->threads_.emplace_back(thread(&Impl::Worker, impl_.get()));
+  LOG(INFO) << "ThreadPool " << (name.empty() ? "" : name + " ")
+            << "starting with " << num_threads << " threads";
+  for (size_t i = 0; i < num_threads; ++i) {
+    impl_->queues_.emplace_back(new Impl::WorkerQueue);
+  }
+  for (size_t i = 0; i < num_threads; ++i) {
+    impl_->threads_.emplace_back(thread(&Impl::Worker, impl_.get(), i));
+  }
 }
 
 
@@ -156,29 +425,88 @@ ThreadPool::~ThreadPool() {
 
 
 void ThreadPool::Add(const function<void()>& closure) {
-  // Empty closures signal a thread to exit, don't allow that (also,
-  // it doesn't make sense).
+  // Empty closures don't make sense.
   if (!closure) {
     return;
   }
 
+  impl_->Push(Closure(closure));
+}
+
+
+void ThreadPool::Add(Closure&& closure) {
+  // Empty closures don't make sense.
+  if (!closure) {
+    return;
+  }
+
+  impl_->Push(move(closure));
+}
+
+
+size_t ThreadPool::NumThreads() const {
+  return impl_->threads_.size();
+}
+
+
+util::Status ThreadPool::SetCpus(const vector<int>& cpus) {
+  for (auto& thread : impl_->threads_) {
+    const util::Status status(SetThreadCpus(thread.native_handle(), cpus));
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  LOG(INFO) << "ThreadPool "
+            << (impl_->name_.empty() ? "" : impl_->name_ + " ")
+            << "running on CPUs " << FormatCpuList(cpus);
+  return util::Status::OK;
+}
+
+
+ThreadPool::Stats ThreadPool::GetStats() const {
+  Stats stats;
+  stats.queued = impl_->num_queued_.load();
   {
-    lock_guard<mutex> lock(impl_->queue_lock_);
-    impl_->queue_.emplace(make_tuple(steady_clock::now(), closure, nullptr));
+    lock_guard<mutex> lock(impl_->park_lock_);
+    stats.delayed = impl_->delayed_.size();
   }
-  impl_->queue_cond_var_.notify_one();
+  const steady_clock::time_point now(steady_clock::now());
+  stats.oldest_queued = nanoseconds::zero();
+  for (const auto& queue : impl_->queues_) {
+    stats.busy.emplace_back(queue->busy_ns_.load());
+    // Each queue is in the order its closures were pushed.
+    lock_guard<mutex> lock(queue->lock_);
+    if (!queue->queue_.empty()) {
+      stats.oldest_queued =
+          max(stats.oldest_queued, duration_cast<nanoseconds>(
+                                       now - queue->queue_.front().queued_at));
+    }
+  }
+  for (auto& thread : impl_->threads_) {
+    stats.cpus.emplace_back(GetThreadCpus(thread.native_handle()));
+  }
+  return stats;
 }
 
 
 void ThreadPool::Delay(const duration<double>& delay, util::Task* task) {
   CHECK_NOTNULL(task);
-  {
-    lock_guard<mutex> lock(impl_->queue_lock_);
-    impl_->queue_.emplace(make_tuple(
-        steady_clock::now() + duration_cast<std::chrono::microseconds>(delay),
-        [task]() { task->Return(); }, task));
+  const steady_clock::time_point when(
+      steady_clock::now() + duration_cast<std::chrono::microseconds>(delay));
+  lock_guard<mutex> lock(impl_->park_lock_);
+  const bool earliest(impl_->delayed_.empty() ||
+                      when < impl_->delayed_.top().first);
+  impl_->delayed_.emplace(when, task);
+  impl_->UpdateNextDue();
+  if (!earliest) {
+    // Whoever is waiting for the earlier one will get to it.
+    return;
+  }
+  if (impl_->timer_waiter_.load()) {
+    impl_->timer_cond_var_.notify_one();
+  } else if (impl_->num_parked_.load() > 0) {
+    impl_->park_cond_var_.notify_one();
   }
-  impl_->queue_cond_var_.notify_one();
 }
 
 
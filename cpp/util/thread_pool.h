@@ -5,33 +5,69 @@
 #include <functional>
 #include <map>
 #include <memory>
+#include <stddef.h>
+#include <string>
+#include <vector>
 
 #include "base/macros.h"
 #include "util/executor.h"
+#include "util/status.h"
 
 namespace cert_trans {
 
 
 // Provides a fixed size thread pool to run closures on. The pool is
 // sized according to the number of cores in the system.
+//
+// Pools given a name export their queue length, the number of threads
+// running closures, and how long closures wait and run, as metrics
+// labelled with it.
 class ThreadPool : public util::Executor {
  public:
+  struct Stats {
+    // Closures waiting for a thread to run them.
+    int queued;
+    // How long the closure that has waited the longest so far has been
+    // waiting, zero if none are.
+    std::chrono::nanoseconds oldest_queued;
+    // Tasks waiting for their Delay() to be over.
+    int delayed;
+    // The time each of the threads has spent running closures.
+    std::vector<std::chrono::nanoseconds> busy;
+    // The CPUs each of the threads may run on, empty where that can't
+    // be known.
+    std::vector<std::vector<int>> cpus;
+  };
+
   // Creates the threads.
   ThreadPool();
 
   // Creates the threads.
   ThreadPool(size_t num_threads);
 
+  // Creates the threads, and exports the metrics of the pool under
+  // |name|, unless it is empty.
+  ThreadPool(size_t num_threads, const std::string& name);
+
   // The destructor will wait for any outstanding closures to finish.
   ~ThreadPool();
 
   // Arranges for "closure" to be called in the thread pool. The
   // function must not be empty.
   void Add(const std::function<void()>& closure) override;
+  void Add(util::Closure&& closure) override;
 
   void Delay(const std::chrono::duration<double>& delay,
              util::Task* task) override;
 
+  size_t NumThreads() const;
+
+  // Restricts all the threads of the pool to run on |cpus| (see
+  // SetThreadCpus()).
+  util::Status SetCpus(const std::vector<int>& cpus);
+
+  Stats GetStats() const;
+
  private:
   class Impl;
   const std::unique_ptr<Impl> impl_;
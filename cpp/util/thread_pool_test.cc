@@ -1,21 +1,54 @@
 #include "util/thread_pool.h"
 
 #include <atomic>
+#include <chrono>
+#include <functional>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 #include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "base/notification.h"
+#include "monitoring/metric.h"
+#include "monitoring/registry.h"
 #include "util/sync_task.h"
 #include "util/testing.h"
 
 namespace cert_trans {
 
 using std::chrono::milliseconds;
+using std::chrono::steady_clock;
 using std::chrono::system_clock;
+using std::string;
 using std::unique_ptr;
+using std::vector;
 using util::SyncTask;
 
+namespace {
+
+
+// Returns the value of the metric |name| for the pool |pool|, or -1
+// if it has none.
+double GetPoolMetric(const string& name, const string& pool) {
+  for (const Metric* metric : Registry::Instance()->GetMetrics()) {
+    if (metric->Name() != name) {
+      continue;
+    }
+    for (const auto& value : metric->CurrentValues()) {
+      if (value.first == vector<string>{pool}) {
+        return value.second.second;
+      }
+    }
+  }
+  return -1;
+}
+
+
+}  // namespace
+
+
 class ThreadPoolTest : public ::testing::Test {
  public:
   ThreadPoolTest() : pool_of_one_(1) {
@@ -76,6 +109,77 @@ TEST_F(ThreadPoolTest, NaturalOrderingPreserved) {
 }
 
 
+TEST_F(ThreadPoolTest, ManyDelaysOnManyThreads) {
+  ThreadPool pool(4);
+  std::vector<unique_ptr<SyncTask>> tasks;
+  for (int i = 0; i < 100; ++i) {
+    tasks.emplace_back(new SyncTask(&pool));
+    pool.Delay(milliseconds((i * 7) % 50), tasks.back()->task());
+  }
+
+  for (const auto& task : tasks) {
+    task->Wait();
+    EXPECT_EQ(util::Status::OK, task->status());
+  }
+}
+
+
+TEST_F(ThreadPoolTest, DelayedTasksRunWhileFlooded) {
+  const int kNumThreads(4);
+  ThreadPool pool(kNumThreads);
+  std::atomic<bool> stop(false);
+  std::atomic<int> running(0);
+
+  // Each closure queues another one before returning, so that every
+  // thread always finds work.
+  std::function<void()> flood;
+  flood = [&pool, &stop, &running, &flood]() {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+    if (stop.load()) {
+      --running;
+      return;
+    }
+    pool.Add(flood);
+  };
+  for (int i = 0; i < 4 * kNumThreads; ++i) {
+    ++running;
+    pool.Add(flood);
+  }
+
+  SyncTask task(&pool);
+  const steady_clock::time_point start(steady_clock::now());
+  pool.Delay(milliseconds(50), task.task());
+  while (!task.IsDone() && steady_clock::now() - start < milliseconds(5000)) {
+    std::this_thread::sleep_for(milliseconds(10));
+  }
+  EXPECT_TRUE(task.IsDone());
+  EXPECT_GT(milliseconds(1000), steady_clock::now() - start);
+
+  stop = true;
+  task.Wait();
+  while (running.load() > 0) {
+    std::this_thread::sleep_for(milliseconds(10));
+  }
+}
+
+
+TEST_F(ThreadPoolTest, ClosuresAddedFromAWorkerAreStolen) {
+  ThreadPool pool(2);
+  Notification release;
+  Notification stolen;
+
+  // The closures added from a worker go on its own queue, so the
+  // other thread has to steal them while this one is blocked.
+  pool.Add([&pool, &release, &stolen]() {
+    pool.Add([&stolen]() { stolen.Notify(); });
+    EXPECT_TRUE(stolen.WaitForNotificationWithTimeout(milliseconds(5000)));
+    release.Notify();
+  });
+
+  release.WaitForNotification();
+}
+
+
 TEST_F(ThreadPoolTest, CancelsDelayTasks) {
   unique_ptr<ThreadPool> pool(new ThreadPool(1));
 
@@ -89,6 +193,67 @@ TEST_F(ThreadPoolTest, CancelsDelayTasks) {
 }
 
 
+TEST_F(ThreadPoolTest, Stats) {
+  SyncTask delay_task(&pool_of_one_);
+  pool_of_one_.Delay(milliseconds(500), delay_task.task());
+
+  Notification release;
+  Notification running;
+  pool_of_one_.Add([&release, &running]() {
+    running.Notify();
+    release.WaitForNotification();
+  });
+  running.WaitForNotification();
+  pool_of_one_.Add([]() {});
+
+  ThreadPool::Stats stats(pool_of_one_.GetStats());
+  EXPECT_EQ(1, stats.queued);
+  EXPECT_EQ(1, stats.delayed);
+  ASSERT_EQ(1, stats.busy.size());
+  EXPECT_EQ(1, stats.cpus.size());
+
+  std::this_thread::sleep_for(milliseconds(50));
+  EXPECT_LE(milliseconds(50), pool_of_one_.GetStats().oldest_queued);
+  release.Notify();
+  delay_task.Wait();
+
+  stats = pool_of_one_.GetStats();
+  EXPECT_EQ(0, stats.queued);
+  EXPECT_EQ(0, stats.oldest_queued.count());
+  EXPECT_EQ(0, stats.delayed);
+  EXPECT_LE(milliseconds(50), stats.busy[0]);
+}
+
+
+TEST_F(ThreadPoolTest, Metrics) {
+  ThreadPool pool(1, "metrics_test");
+
+  Notification release;
+  Notification running;
+  pool.Add([&release, &running]() {
+    running.Notify();
+    release.WaitForNotification();
+  });
+  running.WaitForNotification();
+  Notification done;
+  pool.Add([&done]() { done.Notify(); });
+
+  EXPECT_EQ(1, GetPoolMetric("thread_pool_queued", "metrics_test"));
+  EXPECT_EQ(1, GetPoolMetric("thread_pool_busy_threads", "metrics_test"));
+
+  release.Notify();
+  done.WaitForNotification();
+  EXPECT_EQ(0, GetPoolMetric("thread_pool_queued", "metrics_test"));
+  // The histograms count the closures that were run.
+  EXPECT_LE(1, GetPoolMetric("thread_pool_wait_seconds", "metrics_test"));
+  EXPECT_LE(1, GetPoolMetric("thread_pool_run_seconds", "metrics_test"));
+
+  // Pools without a name have no metrics.
+  pool_of_one_.Add([]() {});
+  EXPECT_EQ(-1, GetPoolMetric("thread_pool_queued", ""));
+}
+
+
 }  // namespace cert_trans
 
 
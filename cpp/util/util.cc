@@ -1,11 +1,10 @@
 #include "util/util.h"
 
+#include <cctype>
 #include <cstring>
 #include <fstream>
 #include <glog/logging.h>
 #include <iostream>
-#include <netinet/in.h>  // for resolv.h
-#include <resolv.h>      // for b64_ntop
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -29,6 +28,49 @@ namespace util {
 namespace {
 const char nibble[] = "0123456789abcdef";
 
+const char kBase64Alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Set in kBase64Decode for bytes outside of the alphabet, so that
+// several lookups can be or'ed together and tested at once.
+const uint8_t kBase64Invalid = 0x80;
+
+// The value of each byte in kBase64Alphabet, or kBase64Invalid.
+const uint8_t kBase64Decode[256] = {
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x3e, 0x80, 0x80, 0x80, 0x3f,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b,
+    0x3c, 0x3d, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+    0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+    0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16,
+    0x17, 0x18, 0x19, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20,
+    0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30,
+    0x31, 0x32, 0x33, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+};
+
 char ByteValue(char high, char low) {
   CHECK(('0' <= high && high <= '9') || ('a' <= high && high <= 'f'));
   char ret;
@@ -175,28 +217,126 @@ string RandomString(size_t min_length, size_t max_length) {
   return ret;
 }
 
+bool FromBase64(const char* b64, size_t length, string* to) {
+  CHECK_NOTNULL(to);
+  // Decoded data is at most 3/4 of the input length.
+  const size_t start(to->size());
+  to->resize(start + length / 4 * 3 + 3);
+  char* const out(&(*to)[start]);
+  size_t out_length(0);
+  uint32_t bits(0);
+  int num_chars(0);
+  size_t i(0);
+
+  // Fast path: whole quads of alphabet characters.
+  for (; i + 4 <= length; i += 4) {
+    const uint32_t a(kBase64Decode[static_cast<uint8_t>(b64[i])]);
+    const uint32_t b(kBase64Decode[static_cast<uint8_t>(b64[i + 1])]);
+    const uint32_t c(kBase64Decode[static_cast<uint8_t>(b64[i + 2])]);
+    const uint32_t d(kBase64Decode[static_cast<uint8_t>(b64[i + 3])]);
+    if ((a | b | c | d) & kBase64Invalid) {
+      break;
+    }
+    const uint32_t quad((a << 18) | (b << 12) | (c << 6) | d);
+    out[out_length++] = static_cast<char>(quad >> 16);
+    out[out_length++] = static_cast<char>(quad >> 8);
+    out[out_length++] = static_cast<char>(quad);
+  }
+
+  // Slow path: whitespace, padding and the tail.
+  for (; i < length; ++i) {
+    const char ch(b64[i]);
+    if (isspace(static_cast<unsigned char>(ch))) {
+      continue;
+    }
+    if (ch == '=') {
+      break;
+    }
+    const uint32_t value(kBase64Decode[static_cast<uint8_t>(ch)]);
+    if (value & kBase64Invalid) {
+      to->resize(start);
+      return false;
+    }
+    bits = (bits << 6) | value;
+    if (++num_chars == 4) {
+      out[out_length++] = static_cast<char>(bits >> 16);
+      out[out_length++] = static_cast<char>(bits >> 8);
+      out[out_length++] = static_cast<char>(bits);
+      bits = 0;
+      num_chars = 0;
+    }
+  }
+
+  bool ok(true);
+  if (i == length) {
+    // No padding, the input must end on a quad boundary.
+    ok = num_chars == 0;
+  } else {
+    // Padding: one "=" after three characters, two after two, and the
+    // unused low bits must be zero.
+    int num_pads(0);
+    for (; i < length; ++i) {
+      const char ch(b64[i]);
+      if (ch == '=') {
+        ++num_pads;
+      } else if (!isspace(static_cast<unsigned char>(ch))) {
+        ok = false;
+        break;
+      }
+    }
+    if (ok && num_chars == 2 && num_pads == 2 && (bits & 0xf) == 0) {
+      out[out_length++] = static_cast<char>(bits >> 4);
+    } else if (ok && num_chars == 3 && num_pads == 1 && (bits & 0x3) == 0) {
+      out[out_length++] = static_cast<char>(bits >> 10);
+      out[out_length++] = static_cast<char>(bits >> 2);
+    } else {
+      ok = false;
+    }
+  }
+
+  to->resize(ok ? start + out_length : start);
+  return ok;
+}
+
 string FromBase64(const char* b64) {
-  size_t length = strlen(b64);
-  // Lazy: base 64 encoding is always >= in length to decoded value
-  // (equality occurs for zero length).
-  u_char* buf = new u_char[length];
-  int rlength = b64_pton(b64, buf, length);
+  string ret;
   // Treat decode errors as empty strings.
-  if (rlength < 0)
-    rlength = 0;
-  string ret(reinterpret_cast<char*>(buf), rlength);
-  delete[] buf;
+  FromBase64(b64, strlen(b64), &ret);
   return ret;
 }
 
-string ToBase64(const string& from) {
+void ToBase64(const char* from, size_t length, string* to) {
+  CHECK_NOTNULL(to);
+  const size_t start(to->size());
   // base 64 is 4 output bytes for every 3 input bytes (rounded up).
-  size_t length = ((from.size() + 2) / 3) * 4;
-  char* buf = new char[length + 1];
-  length =
-      b64_ntop((const u_char*)from.data(), from.length(), buf, length + 1);
-  string ret(buf, length);
-  delete[] buf;
+  to->resize(start + (length + 2) / 3 * 4);
+  char* out(&(*to)[start]);
+  const uint8_t* const in(reinterpret_cast<const uint8_t*>(from));
+
+  size_t i(0);
+  for (; i + 3 <= length; i += 3) {
+    const uint32_t triple((in[i] << 16) | (in[i + 1] << 8) | in[i + 2]);
+    *out++ = kBase64Alphabet[triple >> 18];
+    *out++ = kBase64Alphabet[(triple >> 12) & 0x3f];
+    *out++ = kBase64Alphabet[(triple >> 6) & 0x3f];
+    *out++ = kBase64Alphabet[triple & 0x3f];
+  }
+  if (i + 1 == length) {
+    *out++ = kBase64Alphabet[in[i] >> 2];
+    *out++ = kBase64Alphabet[(in[i] & 0x3) << 4];
+    *out++ = '=';
+    *out++ = '=';
+  } else if (i + 2 == length) {
+    *out++ = kBase64Alphabet[in[i] >> 2];
+    *out++ = kBase64Alphabet[((in[i] & 0x3) << 4) | (in[i + 1] >> 4)];
+    *out++ = kBase64Alphabet[(in[i + 1] & 0xf) << 2];
+    *out++ = '=';
+  }
+}
+
+string ToBase64(const string& from) {
+  string ret;
+  ToBase64(from.data(), from.size(), &ret);
   return ret;
 }
 
@@ -34,10 +34,18 @@ uint64_t TimeInMilliseconds();
 // srand() is called if needed.
 std::string RandomString(size_t min_length, size_t max_length);
 
+// Decode errors are returned as an empty string.
 std::string FromBase64(const char* b64);
 
+// Appends the decoding of the |length| bytes at |b64| to |to|. Returns
+// false, leaving |to| as it was, if they aren't valid base 64.
+bool FromBase64(const char* b64, size_t length, std::string* to);
+
 std::string ToBase64(const std::string& from);
 
+// Appends the encoding of the |length| bytes at |from| to |to|.
+void ToBase64(const char* from, size_t length, std::string* to);
+
 std::vector<std::string> split(const std::string& in, char delim = ',');
 
 }  // namespace util
@@ -0,0 +1,65 @@
+#include <cstring>
+#include <gtest/gtest.h>
+#include <string>
+
+#include "util/testing.h"
+#include "util/util.h"
+
+using std::string;
+
+namespace {
+
+
+TEST(UtilTest, ToBase64) {
+  EXPECT_EQ("", util::ToBase64(""));
+  EXPECT_EQ("Zg==", util::ToBase64("f"));
+  EXPECT_EQ("Zm8=", util::ToBase64("fo"));
+  EXPECT_EQ("Zm9v", util::ToBase64("foo"));
+  EXPECT_EQ("Zm9vYmFy", util::ToBase64("foobar"));
+  EXPECT_EQ("AP/+", util::ToBase64(string("\x00\xff\xfe", 3)));
+}
+
+
+TEST(UtilTest, ToBase64Appends) {
+  string out("x");
+  util::ToBase64("fo", 2, &out);
+  EXPECT_EQ("xZm8=", out);
+}
+
+
+TEST(UtilTest, FromBase64) {
+  EXPECT_EQ("", util::FromBase64(""));
+  EXPECT_EQ("f", util::FromBase64("Zg=="));
+  EXPECT_EQ("fo", util::FromBase64("Zm8="));
+  EXPECT_EQ("foo", util::FromBase64("Zm9v"));
+  EXPECT_EQ("foobar", util::FromBase64("Zm9v\nYmFy\n"));
+  EXPECT_EQ(string("\x00\xff\xfe", 3), util::FromBase64("AP/+"));
+}
+
+
+TEST(UtilTest, FromBase64RejectsInvalid) {
+  // Bad characters, missing or extra padding, and non-zero unused bits.
+  for (const char* b64 : {"Zm9!", "Zg", "Zg=", "Zm9v=", "Zh==", "Zg==Zg=="}) {
+    string out("x");
+    EXPECT_FALSE(util::FromBase64(b64, strlen(b64), &out)) << b64;
+    EXPECT_EQ("x", out) << b64;
+    EXPECT_EQ("", util::FromBase64(b64)) << b64;
+  }
+}
+
+
+TEST(UtilTest, Base64RoundTrip) {
+  for (size_t length = 0; length < 100; ++length) {
+    const string data(util::RandomString(length, length));
+    EXPECT_EQ(data, util::FromBase64(util::ToBase64(data).c_str()));
+  }
+}
+
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}